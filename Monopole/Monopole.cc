@@ -49,7 +49,7 @@ void MParticleState::setMcharge(double new_mcharge) {
 }
 
 double MParticleState::getLorentzFactor() const {
-	return 1 + getEnergy() / (getMass() * c_squared);
+	return lorentzFactor(getEnergy(), getMass());
 }
 
 void MParticleState::setLorentzFactor(double lf) {
@@ -58,11 +58,32 @@ void MParticleState::setLorentzFactor(double lf) {
 }
 
 Vector3d MParticleState::getVelocity() const {
-	return getDirection() * c_light * sqrt(1 - 1 / (1 + getEnergy() / getMass() / c_squared) / (1 + getEnergy() / getMass() / c_squared));
+	return velocity(getDirection(), getEnergy(), getMass());
 }
 
 Vector3d MParticleState::getMomentum() const {
-	return getDirection() * sqrt( (getEnergy() + getMass() * c_squared) * (getEnergy() + getMass() * c_squared) - (getMass() * c_squared) * (getMass() * c_squared) ) / c_light;
+	return momentum(getDirection(), getEnergy(), getMass());
+}
+
+double MParticleState::lorentzFactor(double E, double m) {
+	return 1 + E / (m * c_squared);
+}
+
+Vector3d MParticleState::velocity(const Vector3d &dir, double E, double m) {
+	// beta = sqrt(x (2 + x)) / (1 + x) with x = E / mc^2
+	double x = E / (m * c_squared);
+	return dir * (c_light * sqrt(x * (2 + x)) / (1 + x));
+}
+
+Vector3d MParticleState::momentum(const Vector3d &dir, double E, double m) {
+	// pc = sqrt(E (E + 2 mc^2))
+	return dir * (sqrt(E * (E + 2 * m * c_squared)) / c_light);
+}
+
+double MParticleState::kineticEnergy(double p, double m) {
+	double mc2 = m * c_squared;
+	double pc = p * c_light;
+	return pc * pc / (sqrt(mc2 * mc2 + pc * pc) + mc2);
 }
 
 std::string MParticleState::getDescription() const {
@@ -82,7 +103,8 @@ std::string MParticleState::getDescription() const {
 MCandidate
 */
 
-MCandidate::MCandidate(int id, double E, Vector3d pos, Vector3d dir, double pmass, double mcharge, double z, double weight, std::string tagOrigin) {
+MCandidate::MCandidate(int id, double E, Vector3d pos, Vector3d dir, double pmass, double mcharge, double z, double weight, std::string tagOrigin) :
+		stepRadiation(0) {
 	Candidate::setRedshift(z);
 	Candidate::setTrajectoryLength(0);
 	Candidate::setWeight(weight);
@@ -96,25 +118,14 @@ MCandidate::MCandidate(int id, double E, Vector3d pos, Vector3d dir, double pmas
 	created = Mstate;
 	previous = Mstate;
 	current = Mstate;
-	Msource = Mstate;
-	Mcreated = Mstate;
-	Mprevious = Mstate;
-	Mcurrent = Mstate;
-
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber()++);}
-#elif defined(__GNUC__)
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber() + 1);}
-#else
-		#pragma omp critical
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber()++);}
-#endif
+	mass = Mstate.getMass();
+	this->mcharge = Mstate.getMcharge();
+	// the serial number is assigned by the Candidate constructor
 }
 
 
 MCandidate::MCandidate(const MParticleState &Mstate) :
-		Msource(Mstate), Mcreated(Mstate), Mcurrent(Mstate), Mprevious(Mstate){
+		mass(Mstate.getMass()), mcharge(Mstate.getMcharge()), stepRadiation(0) {
 	
 	source = Mstate;
 	created = Mstate;
@@ -128,16 +139,45 @@ MCandidate::MCandidate(const MParticleState &Mstate) :
 	Candidate:setActive(true);
 	parent = 0;
 	Candidate::setTagOrigin("PRIM");
+	// the serial number is assigned by the Candidate constructor
+}
+
+double MCandidate::getMass() const {
+	return mass;
+}
+
+void MCandidate::setMass(double pmass) {
+	mass = pmass * kilogram;
+}
 
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber()++);}
-#elif defined(__GNUC__)
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber() + 1);}
-#else
-		#pragma omp critical
-		{Candidate::setSerialNumber(Candidate::getNextSerialNumber()++);}
-#endif
+double MCandidate::getMcharge() const {
+	return mcharge;
+}
+
+void MCandidate::setMcharge(double g) {
+	mcharge = fabs(g * ampere * meter);
+	if (current.getId() < 0)
+		mcharge *= -1; //anti-monopole
+}
+
+double MCandidate::getLorentzFactor() const {
+	return MParticleState::lorentzFactor(current.getEnergy(), mass);
+}
+
+Vector3d MCandidate::getVelocity() const {
+	return MParticleState::velocity(current.getDirection(), current.getEnergy(), mass);
+}
+
+Vector3d MCandidate::getMomentum() const {
+	return MParticleState::momentum(current.getDirection(), current.getEnergy(), mass);
+}
+
+MParticleState MCandidate::getMcurrent() const {
+	MParticleState state;
+	static_cast<ParticleState &>(state) = current;
+	state.setMass(mass);
+	state.setMcharge(mcharge);
+	return state;
 }
 
 void MCandidate::setStepRadiation(double radiation)  {
@@ -177,23 +217,18 @@ SourceParticleMonopole::SourceParticleMonopole(int id, double pmass, double mcha
 
 void SourceParticleMonopole::prepareCandidate(Candidate& candidate) const {
 	MCandidate& Mcandidate = *MCandidate::convertToMCandidate(&candidate);
-	ParticleState &source = Mcandidate.source;
-	MParticleState &Msource = Mcandidate.Msource;
-	
-	Msource.setPosition(source.getPosition());
-	Msource.setDirection(source.getDirection());
-	Msource.setEnergy(source.getEnergy());
+	// equals the current state at the source, which is kept if the source
+	// state is not; assignments to states that are not kept are ignored
+	ParticleState source = Mcandidate.source.isRetained() ?
+			Mcandidate.source.get() : Mcandidate.current;
+	source.setId(id);
 	
-	Msource.setId(id);
-	Msource.setMass(pmass);
-	Msource.setMcharge(mcharge);
-	
-	Mcandidate.created = Msource;
-	Mcandidate.current = Msource;
-	Mcandidate.previous = Msource;
-	Mcandidate.Mcreated = Msource;
-	Mcandidate.Mcurrent = Msource;
-	Mcandidate.Mprevious = Msource;
+	Mcandidate.source = source;
+	Mcandidate.created = source;
+	Mcandidate.current = source;
+	Mcandidate.previous = source;
+	Mcandidate.setMass(pmass);
+	Mcandidate.setMcharge(mcharge);
 }
 
 void SourceParticleMonopole::setDescription() {
@@ -221,21 +256,13 @@ void MonopoleSimulationModule::process(Candidate* c) const {
 	
 	//Downconvert
 	MCandidate *candidate = MCandidate::convertToMCandidate(c);
-	MParticleState &current = candidate->Mcurrent;
-	
-	//Copy current to Mcurrent
-	current.setEnergy(candidate -> current.getEnergy());
-	current.setDirection(candidate ->current.getDirection());
+	ParticleState &current = candidate->current;
 	
 	// save the new previous particle state
 	candidate->previous = current;
-	candidate->Mprevious = current;
 	
 	//Call the virtual function for normal processing
 	Mprocess(candidate, current);
-	
-	//Copy Mcurrent to current
-	candidate -> current = current;
 }
 
 } // namespace crpropa
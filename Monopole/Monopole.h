@@ -96,23 +96,35 @@ public:
 	 @returns The momentum [kg m/s]
 	*/
 	Vector3d getMomentum() const;
+
+	// ======== Kinematics for a given kinetic energy and mass ========
+	// shared by MParticleState and MCandidate
+
+	static double lorentzFactor(double energy, double mass);
+	/** Velocity and momentum are written in the kinetic energy, so that one
+	 square root serves all Lorentz factors without the cancellation of
+	 1 - 1/gamma^2 or E_total^2 - (mc^2)^2 for slow monopoles. */
+	static Vector3d velocity(const Vector3d &direction, double energy, double mass);
+	static Vector3d momentum(const Vector3d &direction, double energy, double mass);
+	/** Kinetic energy for the absolute momentum p, written as
+	 (pc)^2 / (sqrt((mc^2)^2 + (pc)^2) + mc^2) to avoid the cancellation
+	 of E_total - mc^2 for heavy, slow monopoles. */
+	static double kineticEnergy(double p, double mass);
 }; // MParticleState
 
 /**
- @class Candidate Candidate.h include/crpropa/Candidate.h
- @brief All information about the cosmic ray.
+ @class MCandidate
+ @brief All information about the cosmic ray; modified for monopoles
 
- The Candidate is a passive object, that holds the information about the state
- of the cosmic ray and the simulation itself.
+ The MCandidate uses the particle states of Candidate (source, created,
+ current, previous). Mass and magnetic charge do not change during the
+ propagation, so they are stored once per candidate instead of in every
+ particle state.
  */
 class MCandidate: public Candidate {
-public:
-	MParticleState Msource; /**< Particle state at the source */
-	MParticleState Mcreated; /**< Particle state of parent particle at the time of creation */
-	MParticleState Mcurrent; /**< Current particle state */
-	MParticleState Mprevious; /**< Particle state at the end of the previous step */
-	
 private:
+	double mass; /**< particle mass [in kg] */
+	double mcharge; /**< particle magnetic charge [in A*m] */
 	double stepRadiation; /**<Electromagnetic radiation lost at current step */
 	
 public:
@@ -134,6 +146,24 @@ public:
 	 */
 	MCandidate(const MParticleState &Mstate);
 	
+	/** Mass of the particle [in kg] */
+	double getMass() const;
+	/** Set mass of the particle [in kg] */
+	void setMass(double pmass);
+	/** Magnetic charge of the particle [in A*m] */
+	double getMcharge() const;
+	/** Set magnetic charge of the particle [in A*m], negative for ids < 0 (anti-monopoles) */
+	void setMcharge(double mcharge);
+
+	/** Lorentz factor of the current particle state */
+	double getLorentzFactor() const;
+	/** Velocity of the current particle state [m/s] */
+	Vector3d getVelocity() const;
+	/** Momentum of the current particle state [kg m/s] */
+	Vector3d getMomentum() const;
+	/** Current particle state together with mass and magnetic charge */
+	MParticleState getMcurrent() const;
+
 	//Helper functions to store and retrieve the radiative losses at each step for debugging and verification
 	void setStepRadiation(double radiation);
 	double getStepRadiation() const;
@@ -187,7 +217,7 @@ public:
 class MonopoleSimulationModule: public Module {
 public:
  	void process (Candidate* c) const override;
- 	virtual void Mprocess (MCandidate *candidate, MParticleState& current) const = 0; 
+ 	virtual void Mprocess (MCandidate *candidate, ParticleState& current) const = 0; 
 };//MonopoleSimulationModule
 
 } // namespace crpropa
@@ -13,6 +13,8 @@
 #include "MonopolePropagationBP.h"
 #include "MonopolePropagationCK.h"
 #include "MonopoleRadiation.h"
+#include "MonopoleSweep.h"
+#include "MonopoleLens.h"
 %}
 
 /* import crpropa in wrapper */
@@ -23,6 +25,8 @@
 %include "MonopolePropagationBP.h"
 %include "MonopolePropagationCK.h"
 %include "MonopoleRadiation.h"
+%include "MonopoleSweep.h"
+%include "MonopoleLens.h"
 
 
 
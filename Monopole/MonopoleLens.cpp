@@ -0,0 +1,221 @@
+#include "MonopoleLens.h"
+#include "crpropa/Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+static const char lensMagic[8] = {'M', 'P', 'L', 'E', 'N', 'S', '0', '1'};
+
+MonopoleLens::MonopoleLens(size_t nPhi, size_t nTheta,
+		double ratioMin, double ratioMax, size_t nRatio,
+		double energyMin, double energyMax, size_t nEnergy,
+		double gainMin, double gainMax, size_t nGain) :
+		inMap(nPhi, nTheta), outMap(nPhi, nTheta),
+		ratioMin(ratioMin), ratioMax(ratioMax), energyMin(energyMin), energyMax(energyMax),
+		gainMin(gainMin), gainMax(gainMax),
+		nRatio(nRatio), nEnergy(nEnergy), nGain(nGain), frozen(false) {
+	if (not (ratioMin > 0) or not (ratioMax > ratioMin) or not (energyMin > 0)
+			or not (energyMax > energyMin) or not (gainMin > 0) or not (gainMax > gainMin))
+		throw std::runtime_error("MonopoleLens: invalid axis");
+	if ((nRatio < 1) or (nEnergy < 1) or (nGain < 1))
+		throw std::runtime_error("MonopoleLens: at least one bin per axis required");
+	init();
+}
+
+MonopoleLens::MonopoleLens(const std::string &filename) : frozen(true) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char magic[8];
+	in.read(magic, 8);
+	if (not in or not std::equal(magic, magic + 8, lensMagic))
+		throw std::runtime_error("MonopoleLens: " + filename + " is not a monopole lens");
+	uint64_t header[5];
+	double axes[6];
+	in.read((char *) header, sizeof(header));
+	in.read((char *) axes, sizeof(axes));
+	inMap = outMap = CylindricalProjectionMap(header[0], header[1]);
+	nRatio = header[2];
+	nEnergy = header[3];
+	nGain = header[4];
+	ratioMin = axes[0];
+	ratioMax = axes[1];
+	energyMin = axes[2];
+	energyMax = axes[3];
+	gainMin = axes[4];
+	gainMax = axes[5];
+	init();
+	in.read((char *) &launched[0], launched.size() * sizeof(double));
+	for (size_t i = 0; i < keys.size(); i++) {
+		uint64_t n;
+		in.read((char *) &n, sizeof(n));
+		keys[i].resize(n);
+		cdf[i].resize(n);
+		if (n > 0) {
+			in.read((char *) &keys[i][0], n * sizeof(uint64_t));
+			in.read((char *) &cdf[i][0], n * sizeof(double));
+		}
+	}
+	if (not in)
+		throw std::runtime_error("MonopoleLens: cannot read " + filename);
+}
+
+void MonopoleLens::init() {
+	size_t cells = inMap.getNPhi() * inMap.getNTheta() * nRatio * nEnergy;
+	launched.assign(cells, 0);
+	keys.resize(cells);
+	cdf.resize(cells);
+	if (not frozen)
+		counts.resize(cells);
+}
+
+size_t MonopoleLens::logBin(double x, double xmin, double xmax, size_t n) {
+	if (not (x > xmin))
+		return 0;
+	size_t i = n * log(x / xmin) / log(xmax / xmin);
+	return std::min(i, n - 1);
+}
+
+size_t MonopoleLens::inputCell(const Vector3d &direction, double ratio, double energy) const {
+	size_t nDir = inMap.getNPhi() * inMap.getNTheta();
+	size_t d = std::min(inMap.binFromDirection(direction), nDir - 1);
+	return (d * nRatio + logBin(ratio, ratioMin, ratioMax, nRatio)) * nEnergy
+			+ logBin(energy, energyMin, energyMax, nEnergy);
+}
+
+void MonopoleLens::countLaunch(const Vector3d &direction, double ratio, double energy) {
+	if (frozen)
+		throw std::runtime_error("MonopoleLens: the lens is frozen");
+	size_t cell = inputCell(direction, ratio, energy);
+#pragma omp atomic
+	launched[cell] += 1;
+}
+
+void MonopoleLens::fill(const Vector3d &inDirection, double ratio, double inEnergy,
+		const Vector3d &outDirection, double outEnergy, double weight) {
+	if (frozen)
+		throw std::runtime_error("MonopoleLens: the lens is frozen");
+	size_t cell = inputCell(inDirection, ratio, inEnergy);
+	size_t nDir = outMap.getNPhi() * outMap.getNTheta();
+	uint64_t key = std::min(outMap.binFromDirection(outDirection), nDir - 1) * nGain
+			+ logBin(outEnergy / inEnergy, gainMin, gainMax, nGain);
+#pragma omp critical(MonopoleLens)
+	counts[cell][key] += weight;
+}
+
+void MonopoleLens::freeze() {
+	if (frozen)
+		return;
+	for (size_t i = 0; i < counts.size(); i++) {
+		keys[i].reserve(counts[i].size());
+		cdf[i].reserve(counts[i].size());
+		double sum = 0;
+		for (std::map<uint64_t, double>::const_iterator it = counts[i].begin();
+				it != counts[i].end(); ++it) {
+			sum += it->second;
+			keys[i].push_back(it->first);
+			cdf[i].push_back(sum);
+		}
+	}
+	counts.clear();
+	frozen = true;
+}
+
+bool MonopoleLens::isFrozen() const {
+	return frozen;
+}
+
+double MonopoleLens::getArrivalProbability(const Vector3d &direction, double ratio,
+		double energy) const {
+	if (not frozen)
+		throw std::runtime_error("MonopoleLens: freeze the lens first");
+	size_t cell = inputCell(direction, ratio, energy);
+	if (cdf[cell].empty() or not (launched[cell] > 0))
+		return 0;
+	return cdf[cell].back() / launched[cell];
+}
+
+bool MonopoleLens::sampleArrival(const Vector3d &inDirection, double ratio,
+		double inEnergy, Vector3d &outDirection, double &outEnergy) const {
+	if (not frozen)
+		throw std::runtime_error("MonopoleLens: freeze the lens first");
+	const std::vector<double> &c = cdf[inputCell(inDirection, ratio, inEnergy)];
+	if (c.empty())
+		return false;
+	Random &random = Random::instance();
+	size_t i = std::upper_bound(c.begin(), c.end(), random.rand() * c.back()) - c.begin();
+	uint64_t key = keys[inputCell(inDirection, ratio, inEnergy)][std::min(i, c.size() - 1)];
+	outDirection = outMap.directionFromBin(key / nGain);
+	// log-uniform within the gain bin
+	double step = log(gainMax / gainMin) / nGain;
+	outEnergy = inEnergy * gainMin * exp(((key % nGain) + random.rand()) * step);
+	return true;
+}
+
+void MonopoleLens::save(const std::string &filename) const {
+	if (not frozen)
+		throw std::runtime_error("MonopoleLens: freeze the lens first");
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	uint64_t header[5] = {inMap.getNPhi(), inMap.getNTheta(), nRatio, nEnergy, nGain};
+	double axes[6] = {ratioMin, ratioMax, energyMin, energyMax, gainMin, gainMax};
+	out.write(lensMagic, 8);
+	out.write((const char *) header, sizeof(header));
+	out.write((const char *) axes, sizeof(axes));
+	out.write((const char *) &launched[0], launched.size() * sizeof(double));
+	for (size_t i = 0; i < keys.size(); i++) {
+		uint64_t n = keys[i].size();
+		out.write((const char *) &n, sizeof(n));
+		if (n > 0) {
+			out.write((const char *) &keys[i][0], n * sizeof(uint64_t));
+			out.write((const char *) &cdf[i][0], n * sizeof(double));
+		}
+	}
+	if (not out)
+		throw std::runtime_error("MonopoleLens: cannot write " + filename);
+}
+
+std::string MonopoleLens::getDescription() const {
+	std::stringstream s;
+	s << "MonopoleLens: " << inMap.getNPhi() << " x " << inMap.getNTheta() << " directions, ";
+	s << nRatio << " mass/charge bins " << ratioMin << " - " << ratioMax << " kg/(A m), ";
+	s << nEnergy << " energy bins " << energyMin / EeV << " - " << energyMax / EeV << " EeV, ";
+	s << nGain << " gain bins " << gainMin << " - " << gainMax;
+	return s.str();
+}
+
+// ----------------------------------------------------------------------------
+SourceMonopoleLensCounter::SourceMonopoleLensCounter(ref_ptr<MonopoleLens> lens) :
+		lens(lens) {
+	description = "SourceMonopoleLensCounter: counts the launches of a MonopoleLens\n";
+}
+
+void SourceMonopoleLensCounter::prepareCandidate(Candidate &candidate) const {
+	MCandidate *c = MCandidate::convertToMCandidate(&candidate);
+	const ParticleState &source = c->source;
+	lens->countLaunch(source.getDirection(), c->getMass() / std::fabs(c->getMcharge()),
+			source.getEnergy());
+}
+
+// ----------------------------------------------------------------------------
+MonopoleLensRecorder::MonopoleLensRecorder(ref_ptr<MonopoleLens> lens) :
+		lens(lens) {
+}
+
+void MonopoleLensRecorder::process(Candidate *candidate) const {
+	MCandidate *c = MCandidate::convertToMCandidate(candidate);
+	if (not c->source.isRetained())
+		throw std::runtime_error("MonopoleLensRecorder: the source state is not retained");
+	const ParticleState &source = c->source;
+	lens->fill(source.getDirection(), c->getMass() / std::fabs(c->getMcharge()),
+			source.getEnergy(), c->current.getDirection(), c->current.getEnergy(),
+			c->getWeight());
+}
+
+std::string MonopoleLensRecorder::getDescription() const {
+	return "MonopoleLensRecorder: fills a MonopoleLens";
+}
+
+} // namespace crpropa
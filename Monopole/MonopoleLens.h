@@ -0,0 +1,118 @@
+#ifndef MONOPOLELENS_H
+#define MONOPOLELENS_H
+
+#include "crpropa/EmissionMap.h"
+#include "crpropa/Module.h"
+#include "crpropa/Source.h"
+#include "Monopole.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+/**
+ @class MonopoleLens
+ @brief Tabulated arrival directions and energy gains of monopoles, e.g. for the Galaxy
+
+ Analogous to a MagneticLens, the lens stores the result of propagating
+ monopoles through a fixed field configuration, e.g. JF12Field, from the
+ boundary to Earth. The input cells are the incoming direction, the
+ mass / |magnetic charge| ratio and the energy. For each cell the
+ lens holds the distribution of the outgoing direction and of the energy
+ gain, which is the ratio of the final and initial energy. It also
+ holds the fraction of the launched monopoles that arrived.
+
+ Build a lens with a simulation that launches monopoles from the boundary:
+ the MSource gets the SourceMonopoleLensCounter as its last feature, and
+ the observer at Earth gets a MonopoleLensRecorder. After freeze(), or after
+ load(), sampleArrival draws arrival states for parameter studies without a
+ propagation.
+
+ The directions are binned as in CylindricalProjectionMap. The ratio,
+ energy and gain axes are log-spaced, and values outside them count in the
+ first or last bin.
+ */
+class MonopoleLens: public Referenced {
+	CylindricalProjectionMap inMap, outMap; // direction binning
+	double ratioMin, ratioMax, energyMin, energyMax, gainMin, gainMax;
+	size_t nRatio, nEnergy, nGain;
+	bool frozen;
+
+	std::vector<double> launched;
+	std::vector<std::map<uint64_t, double> > counts; // (outBin * nGain + gainBin) -> weight
+	std::vector<std::vector<uint64_t> > keys;
+	std::vector<std::vector<double> > cdf;
+
+	static size_t logBin(double x, double xmin, double xmax, size_t n);
+	size_t inputCell(const Vector3d &direction, double ratio, double energy) const;
+	void init();
+public:
+	/** Constructor
+	 @param nPhi, nTheta		direction bins for both directions
+	 @param ratioMin, ratioMax, nRatio	mass / |magnetic charge| axis [kg / (A m)]
+	 @param energyMin, energyMax, nEnergy	axis of the incoming energy [J]
+	 @param gainMin, gainMax, nGain		axis of the energy gain E_out / E_in
+	 */
+	MonopoleLens(size_t nPhi, size_t nTheta,
+			double ratioMin, double ratioMax, size_t nRatio,
+			double energyMin, double energyMax, size_t nEnergy,
+			double gainMin = 0.1, double gainMax = 1e4, size_t nGain = 100);
+	/** Lens from a file written by save */
+	MonopoleLens(const std::string &filename);
+
+	/** Count a launched monopole */
+	void countLaunch(const Vector3d &direction, double ratio, double energy);
+	/** Add an arrived monopole */
+	void fill(const Vector3d &inDirection, double ratio, double inEnergy,
+			const Vector3d &outDirection, double outEnergy, double weight = 1);
+
+	/** Build the distributions; afterwards the lens can not be filled any more */
+	void freeze();
+	bool isFrozen() const;
+
+	/** Fraction of the launched monopoles of the cell that arrived */
+	double getArrivalProbability(const Vector3d &direction, double ratio, double energy) const;
+	/** Draw the outgoing direction and energy of an arrival
+	 @return	false if no monopole of the cell arrived */
+	bool sampleArrival(const Vector3d &inDirection, double ratio, double inEnergy,
+			Vector3d &outDirection, double &outEnergy) const;
+
+	void save(const std::string &filename) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class SourceMonopoleLensCounter
+ @brief Counts the launched monopoles of a MonopoleLens; add it as the last feature of the MSource
+ */
+class SourceMonopoleLensCounter: public SourceFeature {
+	ref_ptr<MonopoleLens> lens;
+public:
+	SourceMonopoleLensCounter(ref_ptr<MonopoleLens> lens);
+	void prepareCandidate(Candidate &candidate) const override;
+};
+
+/**
+ @class MonopoleLensRecorder
+ @brief Fills the arrived monopoles into a MonopoleLens, e.g. in the onDetection of an Observer
+
+ The incoming state is the source state, which has to be retained.
+ */
+class MonopoleLensRecorder: public Module {
+	ref_ptr<MonopoleLens> lens;
+public:
+	MonopoleLensRecorder(ref_ptr<MonopoleLens> lens);
+	void process(Candidate *candidate) const override;
+	std::string getDescription() const override;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // MONOPOLELENS_H
@@ -1,65 +1,177 @@
 #include "MonopolePropagationBP.h"
 
+#include <cmath>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
 
 namespace crpropa {
 	void MonopolePropagationBP::tryStep(const Y &y, Y &out, Y &error, double h,
-			MParticleState &p, double z) const {
-		out = dY(y.x, h, p, z);  // 1 step with h
+			const MCandidate &c, double z) const {
+		out = dY(y.x, h, c, z);  // 1 step with h
 		
 		// 2 steps with h/2
-		Y outHelp = dY(y.x, h/2, p, z);
-		Y outCompare = dY(outHelp.x, h/2, p, z);
+		Y outHelp = dY(y.x, h/2, c, z);
+		Y outCompare = dY(outHelp.x, h/2, c, z);
 
 		error = errorEstimation(out.x , outCompare.x , h);
 	}
 
 
 	MonopolePropagationBP::Y MonopolePropagationBP::dY(Vector3d pos, double step,
-			MParticleState &p, double z) const {
+			const MCandidate &c, double z) const {
+		// u = gamma * v, from the momentum of the candidate
+		double m = c.getMass();
+		Vector3d ui = c.getMomentum() / m;
+		double dt = step / c_light;
+
 		// half leap frog step in the position
-		Vector3d vi = p.getVelocity();
-		pos += vi * step / 2. / c_light;
+		pos += ui * (dt / 2. / sqrt(1. + ui.dot(ui) / c_squared));
 
 		// get B field at particle position
 		Vector3d B = getFieldAtPosition(pos, z);
-		
-		// define useful particle quantities
-		double g = p.getMcharge();
-		double q = p.getCharge();
-		double m = p.getMass();
-		double lf = p.getLorentzFactor();
-
-		// first half magnetic field acceleration
-		Vector3d u_minus = vi * lf + g * step * B / 2. / m / c_light;
-		Vector3d u_plus;
-		
-		// help vectors
+		Vector3d ui_1 = push(ui, B, c.getMcharge() / m, c.current.getCharge() / m, dt);
+
+		// the other half leap frog step in the position with the new velocity
+		double u = ui_1.getR();
+		pos += ui_1 * (dt / 2. / sqrt(1. + u * u / c_squared));
+		double E = MParticleState::kineticEnergy(u * m, m);
+		return Y(pos, ui_1 / u, E);
+	}
+
+
+	Vector3d MonopolePropagationBP::push(const Vector3d &u, const Vector3d &B,
+			double gm, double qm, double dt) {
+		// first half magnetic charge acceleration
+		Vector3d a = B * (gm * dt / 2.);
+		Vector3d u_minus = u + a;
+
+		// rotation by the electric charge, keeps |u|
 		double gamma_half = sqrt(1. + u_minus.dot(u_minus) / c_squared);
-		Vector3d t = q * step * B / 2. / m / c_light / gamma_half;
-		Vector3d s = 2. * t / (1. + t.dot(t));
-		
-		// second half magnetic field acceleration
-		u_plus = u_minus + (u_minus + u_minus.cross(t)).cross(s);
+		Vector3d t = B * (qm * dt / 2. / gamma_half);
+		Vector3d s = t * (2. / (1. + t.dot(t)));
+		Vector3d u_plus = u_minus + (u_minus + u_minus.cross(t)).cross(s);
 
-		
-		// Boris push
-		Vector3d ui_1 = u_plus + g * step * B / 2. / m / c_light;
+		// second half magnetic charge acceleration
+		return u_plus + a;
+	}
+
+
+	void MonopolePropagationBP::pushBatch(double *const *x, double *const *u,
+			const double *gm, const double *qm, double dt, const double *z,
+			size_t n) const {
+		double *x0 = x[0], *x1 = x[1], *x2 = x[2];
+		double *u0 = u[0], *u1 = u[1], *u2 = u[2];
+		const double hdt = dt / 2.;
+
+		// half leap frog step in the position
+		#pragma omp simd
+		for (size_t l = 0; l < n; l++) {
+			double f = hdt / sqrt(1. + (u0[l] * u0[l] + u1[l] * u1[l] + u2[l] * u2[l]) / c_squared);
+			x0[l] += u0[l] * f;
+			x1[l] += u1[l] * f;
+			x2[l] += u2[l] * f;
+		}
+
+		std::vector<Vector3d> pos(n), B(n);
+		for (size_t l = 0; l < n; l++)
+			pos[l] = Vector3d(x0[l], x1[l], x2[l]);
+		getFieldsAtPositions(pos.data(), B.data(), z, n);
+		std::vector<double> BStore(3 * n);
+		double *B0 = &BStore[0], *B1 = &BStore[n], *B2 = &BStore[2 * n];
+		for (size_t l = 0; l < n; l++) {
+			B0[l] = B[l].x;
+			B1[l] = B[l].y;
+			B2[l] = B[l].z;
+		}
+
+		// same as push, then the other half leap frog step
+		#pragma omp simd
+		for (size_t l = 0; l < n; l++) {
+			double ga = gm[l] * hdt;
+			double a0 = B0[l] * ga, a1 = B1[l] * ga, a2 = B2[l] * ga;
+			double m0 = u0[l] + a0, m1 = u1[l] + a1, m2 = u2[l] + a2;
+			double tf = qm[l] * hdt / sqrt(1. + (m0 * m0 + m1 * m1 + m2 * m2) / c_squared);
+			double t0 = B0[l] * tf, t1 = B1[l] * tf, t2 = B2[l] * tf;
+			double sf = 2. / (1. + t0 * t0 + t1 * t1 + t2 * t2);
+			double s0 = t0 * sf, s1 = t1 * sf, s2 = t2 * sf;
+			double w0 = m0 + m1 * t2 - m2 * t1;
+			double w1 = m1 + m2 * t0 - m0 * t2;
+			double w2 = m2 + m0 * t1 - m1 * t0;
+			double p0 = m0 + w1 * s2 - w2 * s1 + a0;
+			double p1 = m1 + w2 * s0 - w0 * s2 + a1;
+			double p2 = m2 + w0 * s1 - w1 * s0 + a2;
+			u0[l] = p0;
+			u1[l] = p1;
+			u2[l] = p2;
+			double f = hdt / sqrt(1. + (p0 * p0 + p1 * p1 + p2 * p2) / c_squared);
+			x0[l] += p0 * f;
+			x1[l] += p1 * f;
+			x2[l] += p2 * f;
+		}
+	}
+
+
+	void MonopolePropagationBP::processBatch(
+			const std::vector<ref_ptr<Candidate> > &candidates) const {
+		// the batch kernel covers fixed steps of charged candidates, all
+		// other candidates are propagated one by one
+		std::vector<MCandidate *> charged;
+		charged.reserve(candidates.size());
+		for (size_t i = 0; i < candidates.size(); i++) {
+			MCandidate *candidate = MCandidate::convertToMCandidate(candidates[i]);
+			if ((minStep != maxStep) or (candidate->getMcharge() == 0))
+				process(candidate);
+			else
+				charged.push_back(candidate);
+		}
+
+		size_t n = charged.size();
+		if (n == 0)
+			return;
+
+		std::vector<double> store(6 * n), gm(n), qm(n), z(n), mass(n);
+		double *x[3], *u[3];
+		for (size_t c = 0; c < 3; c++) {
+			x[c] = &store[c * n];
+			u[c] = &store[(c + 3) * n];
+		}
+		for (size_t l = 0; l < n; l++) {
+			MCandidate *candidate = charged[l];
+			candidate->previous = candidate->current;
+			mass[l] = candidate->getMass();
+			Vector3d pos = candidate->current.getPosition();
+			Vector3d ul = candidate->getMomentum() / mass[l];
+			x[0][l] = pos.x;
+			x[1][l] = pos.y;
+			x[2][l] = pos.z;
+			u[0][l] = ul.x;
+			u[1][l] = ul.y;
+			u[2][l] = ul.z;
+			gm[l] = candidate->getMcharge() / mass[l];
+			qm[l] = candidate->current.getCharge() / mass[l];
+			z[l] = candidate->getRedshift();
+		}
 
-		// the other half leap frog step in the position
-		Vector3d dir = ui_1.getUnitVector(); 
-		Vector3d vi_1 = c_light / pow(1 + c_squared / ui_1.dot(ui_1), 0.5) * dir;
-		pos += vi * step / 2. / c_light;
-		double E = sqrt(pow(m*c_squared, 2) + pow(ui_1.getR()*m*c_light, 2)) - m*c_squared; 
-		return Y(pos, dir, E);
+		pushBatch(x, u, gm.data(), qm.data(), maxStep / c_light, z.data(), n);
+
+		for (size_t l = 0; l < n; l++) {
+			MCandidate *candidate = charged[l];
+			ParticleState &current = candidate->current;
+			Vector3d ul(u[0][l], u[1][l], u[2][l]);
+			double ur = ul.getR();
+			current.setPosition(Vector3d(x[0][l], x[1][l], x[2][l]));
+			current.setDirection(ul / ur);
+			current.setEnergy(MParticleState::kineticEnergy(ur * mass[l], mass[l]));
+			candidate->setCurrentStep(maxStep);
+			candidate->setNextStep(maxStep);
+		}
 	}
 
 
 	// with a fixed step size
 	MonopolePropagationBP::MonopolePropagationBP(ref_ptr<MagneticField> field, double fixedStep) :
-			minStep(0) {
+			minStep(0), stepHints(false) {
 		setField(field);
 		setTolerance(0.42);
 		setMaximumStep(fixedStep);
@@ -69,7 +181,7 @@ namespace crpropa {
 
 	// with adaptive step size
 	MonopolePropagationBP::MonopolePropagationBP(ref_ptr<MagneticField> field, double tolerance, double minStep, double maxStep) :
-			minStep(0) {
+			minStep(0), stepHints(false) {
 		setField(field);
 		setTolerance(tolerance);
 		setMaximumStep(maxStep);
@@ -77,17 +189,17 @@ namespace crpropa {
 	}
 
 
-	void MonopolePropagationBP::Mprocess(MCandidate *candidate, MParticleState &current) const {
+	void MonopolePropagationBP::Mprocess(MCandidate *candidate, ParticleState &current) const {
 		Y yIn(current.getPosition(), current.getDirection());
 
 		// calculate magnetic charge of particle
-		double g = current.getMcharge();
+		double g = candidate->getMcharge();
 		double step = maxStep;
 
 		// rectilinear propagation for neutral particles
 		if (g == 0) {
 			step = clip(candidate->getNextStep(), minStep, maxStep);
-			current.setPosition(yIn.x + current.getVelocity() * step / c_light);
+			current.setPosition(yIn.x + candidate->getVelocity() * step / c_light);
 			candidate->setCurrentStep(step);
 			candidate->setNextStep(maxStep);
 			return;
@@ -96,19 +208,36 @@ namespace crpropa {
 		Y yOut, yErr;
 		double newStep = step;
 		double z = candidate->getRedshift();
+		double nextStep = candidate->getNextStep();
+
+		if (stepHints and field.valid()) {
+			MagneticFieldStepHint hint = field->getStepHint(yIn.x, z);
+			// no field around: straight step, at most to the border of the region
+			if (hint.isFieldFree() and (hint.radius >= minStep)) {
+				step = std::min(clip((nextStep == 0) ? maxStep : nextStep, minStep, maxStep), hint.radius);
+				current.setPosition(yIn.x + candidate->getVelocity() * step / c_light);
+				candidate->setCurrentStep(step);
+				// at the border the next step starts afresh, like the first one
+				candidate->setNextStep((step < hint.radius) ? maxStep : 0);
+				return;
+			}
+			// first step of the candidate, bound by the variation length
+			if (nextStep == 0)
+				nextStep = hint.variationLength;
+		}
 
 		// if minStep is the same as maxStep the adaptive algorithm with its error
 		// estimation is not needed and the computation time can be saved:
 		if (minStep == maxStep){
-			tryStep(yIn, yOut, yErr, step, current, z);
+			yOut = dY(yIn.x, step, *candidate, z);
 		} else {
-			step = clip(candidate->getNextStep(), minStep, maxStep);
+			step = clip(nextStep, minStep, maxStep);
 			newStep = step;
 			double r = 42;  // arbitrary value
 
 			// try performing step until the target error (tolerance) or the minimum/maximum step size has been reached
 			while (true) {
-				tryStep(yIn, yOut, yErr, step, current, z);
+				tryStep(yIn, yOut, yErr, step, *candidate, z);
 				r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
 				if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
 					if (step == minStep)  // already minimum step size
@@ -148,6 +277,10 @@ namespace crpropa {
 		return field;
 	}
 
+	size_t MonopolePropagationBP::getSizeOf() const {
+		return field.valid() ? field->getSizeOf() : 0;
+	}
+
 
 	Vector3d MonopolePropagationBP::getFieldAtPosition(Vector3d pos, double z) const {
 		Vector3d B(0, 0, 0);
@@ -164,6 +297,25 @@ namespace crpropa {
 	}
 
 
+	void MonopolePropagationBP::getFieldsAtPositions(const Vector3d *pos,
+			Vector3d *B, const double *z, size_t n) const {
+		bool sameRedshift = true;
+		for (size_t i = 1; i < n; i++)
+			sameRedshift = sameRedshift and (z[i] == z[0]);
+
+		if (field.valid() and sameRedshift) {
+			try {
+				field->getFields(pos, B, n, z[0]);
+				return;
+			} catch (std::exception &e) {
+				// evaluate point by point to report the failing positions
+			}
+		}
+		for (size_t i = 0; i < n; i++)
+			B[i] = getFieldAtPosition(pos[i], z[i]);
+	}
+
+
 	double MonopolePropagationBP::errorEstimation(const Vector3d x1, const Vector3d x2, double step) const {
 		// compare the position after one step with the position after two steps with step/2.
 		Vector3d diff = (x1 - x2);
@@ -208,6 +360,14 @@ namespace crpropa {
 	}
 
 
+	void MonopolePropagationBP::setStepHints(bool use) {
+		stepHints = use;
+	}
+
+	bool MonopolePropagationBP::getStepHints() const {
+		return stepHints;
+	}
+
 	double MonopolePropagationBP::getMaximumStep() const {
 		return maxStep;
 	}
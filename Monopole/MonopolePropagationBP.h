@@ -1,3 +1,6 @@
+#ifndef MONOPOLEPROPAGATIONBP_H
+#define MONOPOLEPROPAGATIONBP_H
+
 #include "crpropa/Source.h"
 #include "crpropa/Units.h"
 #include "crpropa/magneticField/MagneticField.h"
@@ -17,9 +20,12 @@ namespace crpropa {
  This module solves the equations of motion of a relativistic magnetically charged particle when propagating through a magnetic field.\n
  It uses the Boris push integration method.\n
  It can be used with a fixed step size or an adaptive version which supports the step size control.
+ With a fixed step size, processBatch pushes a batch of candidates in one pass.
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
  For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ With setStepHints the first step of a candidate starts from the variation
+ length of the field, and regions without field are crossed in straight steps.
  */
 class MonopolePropagationBP: public MonopoleSimulationModule {
 
@@ -60,6 +66,7 @@ private:
 	double tolerance; /** target relative error of the numerical integration */
 	double minStep; /** minimum step size of the propagation */
 	double maxStep; /** maximum step size of the propagation */
+	bool stepHints; /** use the step hints of the field */
 
 public:
 	/** Default constructor for the Boris push. It is constructed with a fixed step size.
@@ -78,17 +85,47 @@ public:
 
 	/** Propagates the particle. Is called once per iteration.
 	 * @param candidate	 The Candidate is a passive object, that holds the information about the state of the cosmic ray and the simulation itself. 
-	   @param current	Current is a reference to the Mcurrent member of candidate*/
-	void Mprocess(MCandidate *candidate, MParticleState& current) const override;
+	   @param current	Current is a reference to the current member of candidate*/
+	void Mprocess(MCandidate *candidate, ParticleState& current) const override;
+
+	/** Propagates a batch of monopole candidates by one step each.
+	 With a fixed step size (minStep == maxStep) the charged candidates are
+	 pushed together: u = gamma * v is held in structure-of-arrays form, the
+	 field is evaluated once for all candidates via MagneticField::getFields
+	 and the push runs lane-parallel. With adaptive steps the candidates are
+	 propagated one by one.
+	 * @param candidates	MCandidates to propagate */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+
+	/** Boris push of u = gamma * v: half acceleration by the magnetic
+	 charge, rotation by the electric charge, which keeps |u|, and the other
+	 half acceleration.
+	 * @param u	gamma * v at the start of the step
+	 * @param B	magnetic field at the half step
+	 * @param gm	magnetic charge / mass
+	 * @param qm	electric charge / mass
+	 * @param dt	integration time step
+	 * @return	gamma * v after the step */
+	static Vector3d push(const Vector3d &u, const Vector3d &B, double gm, double qm, double dt);
+
+	/** Leap frog step with push for n lanes, arrays in structure-of-arrays form
+	 * @param x	positions (x, y, z), 3 arrays of length n, updated
+	 * @param u	gamma * v (ux, uy, uz), 3 arrays of length n, updated
+	 * @param gm	magnetic charge / mass of the lanes
+	 * @param qm	electric charge / mass of the lanes
+	 * @param dt	integration time step
+	 * @param z	redshifts of the lanes */
+	void pushBatch(double *const *x, double *const *u, const double *gm,
+			const double *qm, double dt, const double *z, size_t n) const;
 
 	/** Calculates the new position and direction of the particle based on the solution of the Lorentz force
 	 * @param pos	current position of the candidate
 	 * @param step	current step size of the candidate
-	 * @param p	current particle state
+	 * @param c	candidate, provides the current particle state, mass and magnetic charge
 	 * @param z	current redshift
 	 * @return	  return the new calculated position, direction, and energy of the candidate 
 	 */
-	Y dY(Vector3d  pos, double step, crpropa::MParticleState &p, double z) const;
+	Y dY(Vector3d  pos, double step, const MCandidate &c, double z) const;
 
 	/** comparison of the position after one step with the position after two steps with step/2.
 	 * @param x1	position after one step of size step
@@ -105,15 +142,23 @@ public:
 	 */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
 
+	/** Get magnetic field vectors at many positions, batched if the redshifts agree
+	 * @param pos	positions of the candidates
+	 * @param B	 output: magnetic field vectors at the positions
+	 * @param z	 redshifts of the candidates
+	 * @param n	 number of positions */
+	void getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+			const double *z, size_t n) const;
+
 	/** Adapt step size if required and calculates the new position and direction of the particle with the usage of the function dY
 	 * @param y		 current position and direction of candidate
 	 * @param out	   position, direction, and energy of candidate after the step
 	 * @param error	 error for the current step
 	 * @param h		 current step size
-	 * @param p		 current particle state
+	 * @param c		 candidate, provides the current particle state, mass and magnetic charge
 	 * @param z	current redshift
 	 */
-	void tryStep(const Y &y, Y &out, Y &error, double h, MParticleState &p, double z) const;
+	void tryStep(const Y &y, Y &out, Y &error, double h, const MCandidate &c, double z) const;
 
 	/** Set functions for the parameters of the class PropagationBP */
 
@@ -133,6 +178,9 @@ public:
 	 * @param maxStep	   maxStep/c_light is the maximum integration time step 
 	 */
 	void setMaximumStep(double maxStep);
+	/** Use the step hints of the field for the first step and field-free
+	 regions; off by default. Only used by process, not processBatch. */
+	void setStepHints(bool use);
 
 	/** Get functions for the parameters of the class PropagationBP, similar to the set functions */
 
@@ -140,10 +188,13 @@ public:
 	double getTolerance() const;
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	bool getStepHints() const;
 	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
 } // namespace crpropa
 
-
+#endif // MONOPOLEPROPAGATIONBP_H
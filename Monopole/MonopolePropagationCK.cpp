@@ -1,5 +1,7 @@
 #include "MonopolePropagationCK.h"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <sstream>
 #include <stdexcept>
@@ -26,13 +28,17 @@ const double cash_karp_bs[] = {
 };
 
 void MonopolePropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
-		MParticleState &particle, double z) const {
-	std::vector<Y> k;
-	k.reserve(6);
+		const MCandidate &candidate, double z) const {
+	Y k[6];
 
 	out = y;
 	error = Y(0);
 
+	// the speed is constant during the step, evaluate it only once
+	Vector3d velocity = candidate.getVelocity();
+	double g = candidate.getMcharge();
+	double q = candidate.current.getCharge();
+
 	// calculate the sum of b_i * k_i
 	for (size_t i = 0; i < 6; i++) {
 
@@ -41,28 +47,98 @@ void MonopolePropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
 			y_n += k[j] * a[i * 6 + j] * h;
 
 		// update k_i
-		k[i] = dYdt(y_n, particle, z);
+		k[i] = dYdt(y_n, velocity, g, q, z);
 
 		out += k[i] * b[i] * h;
 		error += k[i] * (b[i] - bs[i]) * h;
 	}
 }
 
-MonopolePropagationCK::Y MonopolePropagationCK::dYdt(const Y &y, MParticleState &p, double z) const {
+void MonopolePropagationCK::tryStepBatch(const double *const *y,
+		double *const *out, double *const *errU, const double *const *v,
+		const double *g, const double *q, const double *h, const double *z,
+		size_t n) const {
+	// k[i][c][l]: component c (x, y, z, px, py, pz) of stage i for lane l
+	std::vector<double> kStore(6 * 6 * n), ynStore(6 * n);
+	double *k[6][6], *yn[6];
+	for (size_t c = 0; c < 6; c++) {
+		yn[c] = &ynStore[c * n];
+		for (size_t i = 0; i < 6; i++)
+			k[i][c] = &kStore[(i * 6 + c) * n];
+	}
+	std::vector<Vector3d> pos(n), B(n);
+
+	for (size_t c = 0; c < 6; c++)
+		for (size_t l = 0; l < n; l++)
+			out[c][l] = y[c][l];
+	for (size_t c = 0; c < 3; c++)
+		for (size_t l = 0; l < n; l++)
+			errU[c][l] = 0;
+
+	for (size_t i = 0; i < 6; i++) {
+		for (size_t c = 0; c < 6; c++) {
+			double *ync = yn[c];
+			const double *yc = y[c];
+			for (size_t l = 0; l < n; l++)
+				ync[l] = yc[l];
+			for (size_t j = 0; j < i; j++) {
+				const double aij = a[i * 6 + j];
+				const double *kjc = k[j][c];
+				for (size_t l = 0; l < n; l++)
+					ync[l] += kjc[l] * aij * h[l];
+			}
+		}
+
+		// one field evaluation for all lanes
+		for (size_t l = 0; l < n; l++)
+			pos[l] = Vector3d(yn[0][l], yn[1][l], yn[2][l]);
+		getFieldsAtPositions(pos.data(), B.data(), z, n);
+
+		// same as dYdt: dx/dt = v, dp/dt = g*B + q*vxB
+		const double *vx = v[0], *vy = v[1], *vz = v[2];
+		for (size_t l = 0; l < n; l++) {
+			k[i][0][l] = vx[l];
+			k[i][1][l] = vy[l];
+			k[i][2][l] = vz[l];
+			k[i][3][l] = B[l].x * g[l] + (vy[l] * B[l].z - B[l].y * vz[l]) * q[l];
+			k[i][4][l] = B[l].y * g[l] + (vz[l] * B[l].x - B[l].z * vx[l]) * q[l];
+			k[i][5][l] = B[l].z * g[l] + (vx[l] * B[l].y - B[l].x * vy[l]) * q[l];
+		}
+
+		const double bi = b[i], ei = b[i] - bs[i];
+		for (size_t c = 0; c < 6; c++) {
+			const double *kic = k[i][c];
+			double *outc = out[c];
+			for (size_t l = 0; l < n; l++)
+				outc[l] += kic[l] * bi * h[l];
+		}
+		for (size_t c = 0; c < 3; c++) {
+			const double *kic = k[i][c + 3];
+			double *errc = errU[c];
+			for (size_t l = 0; l < n; l++)
+				errc[l] += kic[l] * ei * h[l];
+		}
+	}
+}
+
+MonopolePropagationCK::Y MonopolePropagationCK::dYdt(const Y &y, const MCandidate &c, double z) const {
+	return dYdt(y, c.getVelocity(), c.getMcharge(), c.current.getCharge(), z);
+}
+
+MonopolePropagationCK::Y MonopolePropagationCK::dYdt(const Y &y, const Vector3d &velocity,
+		double g, double q, double z) const {
 	// Derivative of position is velocity
-	Vector3d velocity = p.getVelocity();
-	
 	// get B field at particle position
 	Vector3d B = getFieldAtPosition(y.x, z);
 
 	// Lorentz force: du/dt = dp/dt = F = g*B + q*vxB
-	Vector3d dudt = p.getMcharge() * B + p.getCharge() * velocity.cross(B);
+	Vector3d dudt = g * B + q * velocity.cross(B);
 	return Y(velocity, dudt);
 }
 
 MonopolePropagationCK::MonopolePropagationCK(ref_ptr<MagneticField> field, double tolerance,
 		double minStep, double maxStep) :
-		minStep(0) {
+		minStep(0), sharingDistance(0), maxDeflection(0), stepHints(false) {
 	setField(field);
 	setTolerance(tolerance);
 	setMaximumStep(maxStep);
@@ -74,36 +150,56 @@ MonopolePropagationCK::MonopolePropagationCK(ref_ptr<MagneticField> field, doubl
 	bs.assign(cash_karp_bs, cash_karp_bs + 6);
 }
 
-void MonopolePropagationCK::Mprocess(MCandidate *candidate, MParticleState &current) const {
-	Y yIn(current.getPosition(), current.getMomentum());
+void MonopolePropagationCK::Mprocess(MCandidate *candidate, ParticleState &current) const {
+	Y yIn(current.getPosition(), candidate->getMomentum());
 	double step = maxStep;
 
 	// rectilinear propagation for neutral particles
-	if (current.getCharge() == 0 && current.getMcharge() == 0) {
+	if (current.getCharge() == 0 && candidate->getMcharge() == 0) {
 		step = clip(candidate->getNextStep(), minStep, maxStep);
-		current.setPosition(yIn.x + current.getVelocity() * step / c_light);
+		current.setPosition(yIn.x + candidate->getVelocity() * step / c_light);
 		candidate->setCurrentStep(step);
 		candidate->setNextStep(maxStep);
 		return;
 	}
 
+	if (tryStraightLineStep(candidate))
+		return;
+
 	Y yOut, yErr;
 	double newStep = step;
 	double z = candidate->getRedshift();
-
+	double nextStep = candidate->getNextStep();
+
+	if (stepHints and field.valid()) {
+		MagneticFieldStepHint hint = field->getStepHint(yIn.x, z);
+		// no field around: straight step, at most to the border of the region
+		if (hint.isFieldFree() and (hint.radius >= minStep)) {
+			step = std::min(clip((nextStep == 0) ? maxStep : nextStep, minStep, maxStep), hint.radius);
+			current.setPosition(yIn.x + candidate->getVelocity() * step / c_light);
+			candidate->setCurrentStep(step);
+			// at the border the next step starts afresh, like the first one
+			candidate->setNextStep((step < hint.radius) ? maxStep : 0);
+			return;
+		}
+		// first step of the candidate; monopoles are accelerated along the
+		// field, so only its variation length bounds the step
+		if (nextStep == 0)
+			nextStep = hint.variationLength;
+	}
 
 	// if minStep is the same as maxStep the adaptive algorithm with its error
 	// estimation is not needed and the computation time can be saved:
 	if (minStep == maxStep){
-		tryStep(yIn, yOut, yErr, step / c_light, current, z);
+		tryStep(yIn, yOut, yErr, step / c_light, *candidate, z);
 	} else {
-		step = clip(candidate->getNextStep(), minStep, maxStep);
+		step = clip(nextStep, minStep, maxStep);
 		newStep = step;
 		double r = 42;  // arbitrary value
 
 		// try performing step until the target error (tolerance) or the minimum/maximum step size has been reached
 		while (true) {
-			tryStep(yIn, yOut, yErr, step / c_light, current, z);
+			tryStep(yIn, yOut, yErr, step / c_light, *candidate, z);
 			r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
 			if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
 				if (step == minStep)  // already minimum step size
@@ -126,15 +222,184 @@ void MonopolePropagationCK::Mprocess(MCandidate *candidate, MParticleState &curr
 	}
 
 	current.setPosition(yOut.x);
-	double m = current.getMass();
-	double E = sqrt(pow(m*c_squared, 2) + pow(yOut.u.getR()*c_light, 2)) - m*c_squared; 
-	current.setEnergy(E);
+	current.setEnergy(MParticleState::kineticEnergy(yOut.u.getR(), candidate->getMass()));
 	current.setDirection(yOut.u.getUnitVector());
 	
 	candidate->setCurrentStep(step);
 	candidate->setNextStep(newStep);
 }
 
+void MonopolePropagationCK::processBatch(
+		const std::vector<ref_ptr<Candidate> > &candidates) const {
+	// neutral candidates move rectilinearly and are handled one by one
+	std::vector<MCandidate *> charged;
+	charged.reserve(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		MCandidate *candidate = MCandidate::convertToMCandidate(candidates[i]);
+		if (candidate->current.getCharge() == 0 && candidate->getMcharge() == 0) {
+			process(candidate);
+		} else {
+			candidate->previous = candidate->current;
+			if (not tryStraightLineStep(candidate))
+				charged.push_back(candidate);
+		}
+	}
+
+	size_t n = charged.size();
+	if (n == 0)
+		return;
+
+	// per candidate quantities that stay constant during the step
+	std::vector<double> step(n), newStep(n), g(n), q(n), z(n);
+	std::vector<Vector3d> velocity(n);
+	for (size_t i = 0; i < n; i++) {
+		MCandidate *candidate = charged[i];
+		if (minStep == maxStep)
+			step[i] = maxStep;
+		else
+			step[i] = clip(candidate->getNextStep(), minStep, maxStep);
+		newStep[i] = step[i];
+		g[i] = candidate->getMcharge();
+		q[i] = candidate->current.getCharge();
+		z[i] = candidate->getRedshift();
+		velocity[i] = candidate->getVelocity();
+	}
+
+	// candidates whose step has not been accepted yet
+	std::vector<size_t> active(n);
+	for (size_t i = 0; i < n; i++)
+		active[i] = i;
+
+	std::vector<double> yStore(6 * n), outStore(6 * n), errStore(3 * n), vStore(3 * n);
+	std::vector<double> h(n), laneG(n), laneQ(n), laneZ(n);
+	while (not active.empty()) {
+		size_t m = active.size();
+		double *y[6], *out[6], *errU[3], *v[3];
+		for (size_t c = 0; c < 6; c++) {
+			y[c] = &yStore[c * m];
+			out[c] = &outStore[c * m];
+		}
+		for (size_t c = 0; c < 3; c++) {
+			errU[c] = &errStore[c * m];
+			v[c] = &vStore[c * m];
+		}
+
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			Vector3d x = charged[i]->current.getPosition();
+			Vector3d p = charged[i]->getMomentum();
+			y[0][l] = x.x;
+			y[1][l] = x.y;
+			y[2][l] = x.z;
+			y[3][l] = p.x;
+			y[4][l] = p.y;
+			y[5][l] = p.z;
+			v[0][l] = velocity[i].x;
+			v[1][l] = velocity[i].y;
+			v[2][l] = velocity[i].z;
+			h[l] = step[i] / c_light;
+			laneG[l] = g[i];
+			laneQ[l] = q[i];
+			laneZ[l] = z[i];
+		}
+
+		tryStepBatch(y, out, errU, v, laneG.data(), laneQ.data(), h.data(),
+				laneZ.data(), m);
+
+		// step size control as in Mprocess, lanes with a rejected step
+		// are tried again with the reduced step
+		size_t remaining = 0;
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			bool accepted = true;
+			if (minStep != maxStep) {
+				double r = Vector3d(errU[0][l], errU[1][l], errU[2][l]).getR() / tolerance;
+				if (r > 1) {
+					if (step[i] != minStep) {
+						newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+						newStep[i] = std::max(newStep[i], 0.1 * step[i]);
+						newStep[i] = std::max(newStep[i], minStep);
+						step[i] = newStep[i];
+						accepted = false;
+					}
+				} else if (step[i] != maxStep) {
+					newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+					newStep[i] = std::min(newStep[i], 5 * step[i]);
+					newStep[i] = std::min(newStep[i], maxStep);
+				}
+			}
+
+			if (not accepted) {
+				active[remaining++] = i;
+				continue;
+			}
+			MCandidate *candidate = charged[i];
+			ParticleState &current = candidate->current;
+			Vector3d p(out[3][l], out[4][l], out[5][l]);
+			current.setPosition(Vector3d(out[0][l], out[1][l], out[2][l]));
+			current.setEnergy(MParticleState::kineticEnergy(p.getR(), candidate->getMass()));
+			current.setDirection(p.getUnitVector());
+			candidate->setCurrentStep(step[i]);
+			candidate->setNextStep(newStep[i]);
+		}
+		active.resize(remaining);
+	}
+}
+
+bool MonopolePropagationCK::tryStraightLineStep(MCandidate *candidate) const {
+	if (maxDeflection <= 0)
+		return false;
+	ParticleState &current = candidate->current;
+	double step = (minStep == maxStep) ? maxStep : clip(candidate->getNextStep(), minStep, maxStep);
+	double z = candidate->getRedshift();
+	double g = candidate->getMcharge();
+	double q = current.getCharge();
+	Vector3d x0 = current.getPosition();
+	Vector3d u = current.getDirection();
+	Vector3d v = candidate->getVelocity();
+	double speed = v.getR();
+	double p = candidate->getMomentum().getR();
+
+	// deflection estimate from the field at the start of the step; as in
+	// tryStep the step is c times the integration time
+	Vector3d B0 = getFieldAtPosition(x0, z);
+	double dt = step / c_light;
+	double L = speed * dt;
+	if ((std::fabs(g) + std::fabs(q) * speed) * B0.getR() * dt > maxDeflection * p)
+		return false;
+
+	// field integrals along the straight line x0 + u s, s in [0, L]:
+	// I = int B ds, J = int (L - s) B ds = int_0^L I(s) ds
+	Vector3d Bm = getFieldAtPosition(x0 + u * (L / 2), z);
+	Vector3d B1 = getFieldAtPosition(x0 + u * L, z);
+	Vector3d I = (B0 + Bm * 4 + B1) * (L / 6);
+	Vector3d J = (B0 + Bm * 2) * (L * L / 6);
+	Vector3d trapezoid = (B0 + B1) * (L / 2);
+	if ((I - trapezoid).getR() > tolerance * std::max(I.getR(), trapezoid.getR()))
+		return false;
+
+	// dp = int (g B + q v x B) dt with dt = ds / v
+	Vector3d dp = (I * g + v.cross(I) * q) / speed;
+	Vector3d pOut = u * p + dp;
+	double deflection = (dp - u * dp.dot(u)).getR() / p;
+	if (deflection > maxDeflection)
+		return false;
+
+	// transverse displacement: int_0^L dp_perp(s) / p ds
+	Vector3d dx = (J * g + v.cross(J) * q) / (speed * p);
+	dx -= u * dx.dot(u);
+
+	current.setPosition(x0 + u * L + dx);
+	current.setEnergy(MParticleState::kineticEnergy(pOut.getR(), candidate->getMass()));
+	current.setDirection(pOut.getUnitVector());
+	candidate->setCurrentStep(step);
+	double newStep = step * 5;
+	if (deflection > 0)
+		newStep = std::min(newStep, 0.9 * step * maxDeflection / deflection);
+	candidate->setNextStep(clip(newStep, minStep, maxStep));
+	return true;
+}
+
 void MonopolePropagationCK::setField(ref_ptr<MagneticField> f) {
 	field = f;
 }
@@ -143,6 +408,10 @@ ref_ptr<MagneticField> MonopolePropagationCK::getField() const {
 	return field;
 }
 
+size_t MonopolePropagationCK::getSizeOf() const {
+	return field.valid() ? field->getSizeOf() : 0;
+}
+
 Vector3d MonopolePropagationCK::getFieldAtPosition(Vector3d pos, double z) const {
 	Vector3d B(0, 0, 0);
 	try {
@@ -157,6 +426,58 @@ Vector3d MonopolePropagationCK::getFieldAtPosition(Vector3d pos, double z) const
 	return B;
 }
 
+void MonopolePropagationCK::getFieldsAtPositions(const Vector3d *pos,
+		Vector3d *B, const double *z, size_t n) const {
+	if (n == 0)
+		return;
+	if (not field.valid()) {
+		for (size_t i = 0; i < n; i++)
+			B[i] = Vector3d(0, 0, 0);
+		return;
+	}
+
+	if (sharingDistance > 0) {
+		// evaluate only the lanes that moved away from the last evaluated one
+		std::vector<Vector3d> p;
+		std::vector<double> zp;
+		std::vector<size_t> lane(n);
+		for (size_t i = 0; i < n; i++) {
+			if (p.empty() or (z[i] != zp.back())
+					or (pos[i].getDistanceTo(p.back()) >= sharingDistance)) {
+				p.push_back(pos[i]);
+				zp.push_back(z[i]);
+			}
+			lane[i] = p.size() - 1;
+		}
+		if (p.size() < n) {
+			std::vector<Vector3d> Bp(p.size());
+			evaluateFields(p.data(), Bp.data(), zp.data(), p.size());
+			for (size_t i = 0; i < n; i++)
+				B[i] = Bp[lane[i]];
+			return;
+		}
+	}
+	evaluateFields(pos, B, z, n);
+}
+
+void MonopolePropagationCK::evaluateFields(const Vector3d *pos,
+		Vector3d *B, const double *z, size_t n) const {
+	bool sameRedshift = true;
+	for (size_t i = 1; i < n; i++)
+		sameRedshift = sameRedshift and (z[i] == z[0]);
+
+	if (sameRedshift) {
+		try {
+			field->getFields(pos, B, n, z[0]);
+			return;
+		} catch (std::exception &e) {
+			// evaluate point by point to report the failing positions
+		}
+	}
+	for (size_t i = 0; i < n; i++)
+		B[i] = getFieldAtPosition(pos[i], z[i]);
+}
+
 void MonopolePropagationCK::setTolerance(double tol) {
 	if ((tol > 1) or (tol < 0))
 		throw std::runtime_error(
@@ -178,6 +499,26 @@ void MonopolePropagationCK::setMaximumStep(double max) {
 	maxStep = max;
 }
 
+void MonopolePropagationCK::setFieldSharingDistance(double distance) {
+	if (distance < 0)
+		throw std::runtime_error("PropagationCK: field sharing distance < 0");
+	sharingDistance = distance;
+}
+
+double MonopolePropagationCK::getFieldSharingDistance() const {
+	return sharingDistance;
+}
+
+void MonopolePropagationCK::setStraightLineDeflection(double deflection) {
+	if (deflection < 0)
+		throw std::runtime_error("PropagationCK: straight-line deflection < 0");
+	maxDeflection = deflection;
+}
+
+double MonopolePropagationCK::getStraightLineDeflection() const {
+	return maxDeflection;
+}
+
 double MonopolePropagationCK::getTolerance() const {
 	return tolerance;
 }
@@ -186,6 +527,14 @@ double MonopolePropagationCK::getMinimumStep() const {
 	return minStep;
 }
 
+void MonopolePropagationCK::setStepHints(bool use) {
+	stepHints = use;
+}
+
+bool MonopolePropagationCK::getStepHints() const {
+	return stepHints;
+}
+
 double MonopolePropagationCK::getMaximumStep() const {
 	return maxStep;
 }
@@ -196,6 +545,10 @@ std::string MonopolePropagationCK::getDescription() const {
 	s << " Target error: " << tolerance;
 	s << ", Minimum Step: " << minStep / kpc << " kpc";
 	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	if (sharingDistance > 0)
+		s << ", Field sharing distance: " << sharingDistance / kpc << " kpc";
+	if (maxDeflection > 0)
+		s << ", Straight-line steps below a deflection of " << maxDeflection << " rad";
 	return s.str();
 }
 
@@ -1,3 +1,6 @@
+#ifndef MONOPOLEPROPAGATIONCK_H
+#define MONOPOLEPROPAGATIONCK_H
+
 #include "crpropa/Units.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include "kiss/logger.h"
@@ -18,6 +21,8 @@ namespace crpropa {
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
  For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ With setStepHints the first step of a candidate starts from the variation
+ length of the field, and regions without field are crossed in straight steps.
  */
 class MonopolePropagationCK: public MonopoleSimulationModule {
 public:
@@ -53,6 +58,12 @@ private:
 	double tolerance; /*< target relative error of the numerical integration */
 	double minStep; /*< minimum step size of the propagation */
 	double maxStep; /*< maximum step size of the propagation */
+	double sharingDistance; /*< lanes closer than this share one field evaluation */
+	double maxDeflection; /*< largest deflection angle of a straight-line step, 0: off */
+	bool stepHints; /*< use the step hints of the field */
+
+	// field vectors at all positions, batched if the redshifts agree
+	void evaluateFields(const Vector3d *pos, Vector3d *B, const double *z, size_t n) const;
 
 public:
 	/** Constructor for the adaptive Kash Carp.
@@ -66,23 +77,74 @@ public:
 
 	/** Propagates the particle. Is called once per iteration.
 	 * @param candidate	 The Candidate is a passive object, that holds the information about the state of the cosmic ray and the simulation itself. 
-	   @param current	Current is a reference to the Mcurrent member of candidate*/
-	void Mprocess(MCandidate *candidate, MParticleState& current) const override;
+	   @param current	Current is a reference to the current member of candidate*/
+	void Mprocess(MCandidate *candidate, ParticleState& current) const override;
+
+	/** Propagates a batch of monopole candidates by one step each.
+	 The phase points of the charged candidates are held in structure-of-arrays
+	 form, the Cash-Karp stages run lane-parallel over the batch and the field
+	 is evaluated once per stage for all candidates via
+	 MagneticField::getFields. Step size control is done per candidate as in
+	 Mprocess, candidates with a rejected step are retried together.
+	 * @param candidates	MCandidates to propagate */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
 
 	// derivative of phase point, dY/dt = d/dt(x, u) = (v, du/dt)
 	// du/dt = dp/dt = F = g*B + q*vxB
-	Y dYdt(const Y &y, MParticleState &p, double z) const;
+	Y dYdt(const Y &y, const MCandidate &c, double z) const;
+	// dYdt for the velocity v, magnetic charge g and electric charge q
+	Y dYdt(const Y &y, const Vector3d &v, double g, double q, double z) const;
 
 	void tryStep(const Y &y, Y &out, Y &error, double t,
-			MParticleState &p, double z) const;
+			const MCandidate &c, double z) const;
+
+	/** tryStep for n lanes, arrays in structure-of-arrays form
+	 * @param y	phase points (x, y, z, px, py, pz), 6 arrays of length n
+	 * @param out	phase points after the step, same layout as y
+	 * @param errU	momentum error of the step, 3 arrays of length n
+	 * @param v	velocities of the lanes (vx, vy, vz), 3 arrays of length n
+	 * @param g	magnetic charges of the lanes
+	 * @param q	electric charges of the lanes
+	 * @param h	integration time steps
+	 * @param z	redshifts of the lanes */
+	void tryStepBatch(const double *const *y, double *const *out, double *const *errU,
+			const double *const *v, const double *g, const double *q,
+			const double *h, const double *z, size_t n) const;
 
 	void setField(ref_ptr<MagneticField> field);
 	void setTolerance(double tolerance);
 	void setMinimumStep(double minStep);
 	void setMaximumStep(double maxStep);
+	/** Use the step hints of the field for the first step and field-free
+	 regions; off by default. Only used by process, not processBatch. */
+	void setStepHints(bool use);
+	/** Consecutive lanes of a batch whose positions are closer than the
+	 distance to the last evaluated one reuse its field vector, e.g. the
+	 hypotheses of a MonopoleSweep that stay together. The error is about
+	 distance * |grad B|, default 0 (no sharing). */
+	void setFieldSharingDistance(double distance);
+	double getFieldSharingDistance() const;
+	/** Fast path for weakly deflected candidates, e.g. ultra-heavy monopoles.
+	 A step whose deflection (|g| + |q| v) |B| dt / p at the start is below
+	 maxDeflection is taken along the straight line: the momentum gain
+	 g * int B dl + q * v x int B dl and the small transverse displacement are
+	 computed from the field integrals along the line (Simpson's rule with
+	 three field evaluations). The full integration is used instead when the
+	 resulting deflection exceeds maxDeflection or Simpson's rule and the
+	 trapezoidal rule of the field integral differ by more than the
+	 tolerance. Default 0 (off).
+	 * @param maxDeflection	largest deflection angle of a straight-line step [rad] */
+	void setStraightLineDeflection(double maxDeflection);
+	double getStraightLineDeflection() const;
+
+	/** Try a straight-line step, see setStraightLineDeflection.
+	 * @return	true if the step was taken */
+	bool tryStraightLineStep(MCandidate *candidate) const;
 
 	 /** get functions for the parameters of the class MonopolePropagationCK, similar to the set functions */
 	ref_ptr<MagneticField> getField() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
 	
 	/** get magnetic field vector at current candidate position
 	 * @param pos   current position of the candidate
@@ -90,12 +152,23 @@ public:
 	 * @return	  magnetic field vector at the position pos */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
 
+	/** get magnetic field vectors at the positions of a batch of candidates,
+	 sharing the evaluations within the field sharing distance
+	 * @param pos	positions of the candidates
+	 * @param B	 output: magnetic field vectors at the positions
+	 * @param z	 redshifts of the candidates
+	 * @param n	 number of positions */
+	void getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+			const double *z, size_t n) const;
+
 	double getTolerance() const;
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	bool getStepHints() const;
 	std::string getDescription() const;
 };
 /** @}*/
 
 } // namespace crpropa
 
+#endif // MONOPOLEPROPAGATIONCK_H
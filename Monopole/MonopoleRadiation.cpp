@@ -1,30 +1,77 @@
 #include "MonopoleRadiation.h"
+#include "crpropa/Common.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
 #include <fstream>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 
 namespace crpropa {
 
+ref_ptr<MonopoleRadiationSpectrum> MonopoleRadiationSpectrum::load(const std::string &filename) {
+	static std::map<std::string, ref_ptr<MonopoleRadiationSpectrum> > spectra;
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> guard(mutex);
+	ref_ptr<MonopoleRadiationSpectrum> &spectrum = spectra[filename];
+	if (spectrum.valid())
+		return spectrum;
+
+	std::ifstream infile(filename.c_str());
+	if (!infile.good())
+		throw std::runtime_error("MonopoleRadiation: could not open file " + filename);
+
+	ref_ptr<MonopoleRadiationSpectrum> s = new MonopoleRadiationSpectrum();
+	while (infile.good()) {
+		if (infile.peek() != '#') {
+			double a, b;
+			infile >> a >> b;
+			if (infile) {
+				s->x.push_back(pow(10, a));
+				s->cdf.push_back(b);
+			}
+		}
+		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	}
+	infile.close();
+	if (s->x.size() < 2)
+		throw std::runtime_error("MonopoleRadiation: no spectrum in file " + filename);
+
+	// the table is read by all threads, build it before the first draw
+	s->sampler.setCDF(s->cdf);
+	s->sampler.prepare();
+	double sum = 0;
+	for (size_t i = 1; i < s->x.size(); i++)
+		sum += (s->cdf[i] - s->cdf[i - 1]) * (s->x[i - 1] + s->x[i]) / 2;
+	s->meanX = sum / (s->cdf.back() - s->cdf.front());
+
+	spectrum = s;
+	return spectrum;
+}
+
 MonopoleRadiation::MonopoleRadiation(ref_ptr<MagneticField> field, bool havePhotons, double thinning, int nSamples, double limit) {
 	setField(field);
 	setBrms(0);
-	//initSpectrum(); //Only necessary for photon secondaries
+	setThinning(thinning);
 	setHavePhotons(havePhotons);
 	setLimit(limit);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setAnalyticEnergyLoss(false);
+	setTurbulentBrms(0);
 }
 
 MonopoleRadiation::MonopoleRadiation(double Brms, bool havePhotons, double thinning, int nSamples, double limit) {
 	setBrms(Brms);
-	//initSpectrum(); //Only necessary for photon secondaries
+	setThinning(thinning);
 	setHavePhotons(havePhotons);
 	setLimit(limit);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setAnalyticEnergyLoss(false);
+	setTurbulentBrms(0);
 }
 
 void MonopoleRadiation::setField(ref_ptr<MagneticField> f) {
@@ -43,8 +90,20 @@ double MonopoleRadiation::getBrms() {
 	return Brms;
 }
 
+void MonopoleRadiation::setTurbulentBrms(double Brms) {
+	if (Brms < 0)
+		throw std::runtime_error("MonopoleRadiation: the turbulent Brms must be >= 0");
+	turbulentBrms = Brms;
+}
+
+double MonopoleRadiation::getTurbulentBrms() const {
+	return turbulentBrms;
+}
+
 void MonopoleRadiation::setHavePhotons(bool havePhotons) {
 	this->havePhotons = havePhotons;
+	if (havePhotons and not spectrum.valid())
+		initSpectrum();
 }
 
 bool MonopoleRadiation::getHavePhotons() {
@@ -75,6 +134,33 @@ int MonopoleRadiation::getMaximumSamples() {
 	return maximumSamples;
 }
 
+void MonopoleRadiation::setAnalyticEnergyLoss(bool analytic) {
+	analyticEnergyLoss = analytic;
+}
+
+bool MonopoleRadiation::getAnalyticEnergyLoss() const {
+	return analyticEnergyLoss;
+}
+
+double MonopoleRadiation::lorentzFactorLoss(double lf, double a, double b, double t) {
+	double dlf;
+	if (b == 0) {
+		dlf = a * t;
+	} else if (a == 0) {
+		dlf = b * lf * lf * t / (1 + b * lf * t);
+	} else {
+		// lf(t) = s * tan(theta0 - w*t) with tan(theta0) = lf / s
+		double s = sqrt(a / b);
+		double w = sqrt(a * b);
+		double theta0 = atan(lf / s);
+		double theta1 = theta0 - w * t;
+		if (theta1 <= 0)
+			return lf - 1; // particle stops within the step
+		dlf = s * sin(w * t) / (cos(theta0) * cos(theta1));
+	}
+	return std::min(dlf, lf - 1);
+}
+
 void MonopoleRadiation::setSecondaryThreshold(double threshold) {
 	secondaryThreshold = threshold;
 }
@@ -84,46 +170,47 @@ double MonopoleRadiation::getSecondaryThreshold() const {
 }
 
 void MonopoleRadiation::initSpectrum() {
-	std::string filename = getDataPath("MonopoleRadiation/spectrum.txt");
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error("MonopoleRadiation: could not open file " + filename);
-
-	// clear previously loaded interaction rates
-	tabx.clear();
-	tabCDF.clear();
-
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabx.push_back(pow(10, a));
-				tabCDF.push_back(b);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-	}
-	infile.close();
+	spectrum = MonopoleRadiationSpectrum::load(getDataPath("Synchrotron/spectrum.txt"));
 }
 
-void MonopoleRadiation::Mprocess(MCandidate *candidate, MParticleState &current) const {
-	double mcharge = fabs(current.getMcharge());
+void MonopoleRadiation::Mprocess(MCandidate *candidate, ParticleState &current) const {
+	double mcharge = fabs(candidate->getMcharge());
 	if (mcharge == 0)
 		return; // only charged particles
 
-	// get magnetic field
+	// get magnetic field, shared with the other modules of the step
 	Vector3d pos = current.getPosition();
 	double z = candidate->getRedshift();
-	Vector3d B = getFieldAtPosition(pos, z);
+	Vector3d B;
+	if (not field.valid() or not candidate->getStepField(field, pos, z, B)) {
+		B = getFieldAtPosition(pos, z);
+		if (field.valid())
+			candidate->setStepField(field, pos, z, B);
+	}
 
 	//Get helper values
-	double lf = current.getLorentzFactor();
+	double lf = candidate->getLorentzFactor();
 	double step = candidate->getCurrentStep(); // step size in local frame
-	Vector3d v = current.getVelocity();
+	Vector3d v = candidate->getVelocity();
 	Vector3d F = mcharge*B + current.getCharge()*v.cross(B); //Force on particle
-	double m = current.getMass();
+	double m = candidate->getMass();
+
+	// squared force, and its components along and perpendicular to the motion
+	Vector3d dir = current.getDirection();
+	double Fpar = F.dot(dir);
+	double F2 = F.getR2();
+	double Fpar2 = Fpar * Fpar;
+	double Fperp2 = dir.cross(F).getR2();
+	if (turbulentBrms > 0) {
+		// mean over the orientations of an isotropic turbulent field dB, which
+		// adds <|g dB + q v x dB|^2> = dB^2 (g^2 + 2/3 q^2 v^2), one third of
+		// g^2 dB^2 along the motion; the mixed terms with B average to zero
+		double g2 = mcharge * mcharge * turbulentBrms * turbulentBrms;
+		double q2v2 = pow(current.getCharge(), 2) * v.getR2() * turbulentBrms * turbulentBrms;
+		F2 += g2 + 2. / 3 * q2v2;
+		Fpar2 += g2 / 3;
+		Fperp2 += 2. / 3 * (g2 + q2v2);
+	}
 	
 	//Vector3d a = F_mag / m * (dir / cos * (1/ pow(lf, 3)  -1 / lf) + Fdir / lf);
 	//Vector3d a = 1 / m / lf * (F - F.dot(v)*v / c_squared);	
@@ -133,80 +220,72 @@ void MonopoleRadiation::Mprocess(MCandidate *candidate, MParticleState &current)
 	// calculate energy loss
 	//double P = mu0 / 6 / M_PI * pow(mcharge/ m, 2) * pow(1/c_light, 3) * (F.dot(F) * pow(lf, 2) - pow(p.dot(F) / m, 2)/c_squared); // Jackson p. 666 (14.26)
 	//double P = mu0 * pow(mcharge, 2) * pow (lf, 6) / 6 / M_PI / c_light * (a.dot(a) / c_squared - v.cross(a).dot(v.cross(a)) / c_squared / c_squared); 
-	double A = mu0 / 6 / M_PI * pow(mcharge / m, 2) * pow(1/c_light, 3);
-	double P = A * (F.getR2() + pow(lf, 2) * v.cross(F).getR2() / c_squared);
-	double dE = P * step / c_light;
-	candidate->setStepRadiation(dE);
+	double gm = mcharge / m;
+	double A = mu0 / 6 / M_PI * gm * gm / (c_squared * c_light);
 
-	// apply energy loss and limit next step
 	double E = current.getEnergy();
-	current.setEnergy(E - dE);
-	candidate->limitNextStep(limit * E * c_light / P);
+	double dE;
+	if (analyticEnergyLoss) {
+		// P = A * (F_par^2 + lf^2 * F_perp^2) and dE = -m c^2 d(lf)
+		double mc2 = m * c_squared;
+		double dlf = lorentzFactorLoss(lf, A * Fpar2 / mc2, A * Fperp2 / mc2, step / c_light);
+		dE = std::min(dlf * mc2, E);
+		candidate->setStepRadiation(dE);
+		current.setEnergy(E - dE);
+	} else {
+		// gamma^2 |v x F|^2 / c^2 = (gamma^2 - 1) |dir x F|^2, gamma^2 - 1 = eps (2 + eps) with eps = E / mc^2
+		double eps = E / (m * c_squared);
+		double P = A * (F2 + eps * (2 + eps) * Fperp2);
+		dE = P * step / c_light;
+		candidate->setStepRadiation(dE);
+
+		// apply energy loss and limit next step
+		current.setEnergy(E - dE);
+		candidate->limitNextStep(limit * E * c_light / P);
+	}
 
 	// optionally add secondary photons
-	if (not(havePhotons))
+	if (not(havePhotons) or dE <= 0)
 		return;
 
-	// Everything below this has not been altered for magnetically charged particles
-	
-	/*double Ecrit = 3. / 4 * h_planck / M_PI * c_light * pow(lf, 3) / Rg;
+	// synchrotron spectrum of the curvature radius of the perpendicular force,
+	// rho = lf m v^2 / F_perp; a force along the motion does not bend the track
+	double FperpR = sqrt(Fperp2);
+	if (FperpR == 0)
+		return;
+	double beta2 = 1 - 1 / (lf * lf);
+	double rho = lf * m * c_squared * beta2 / FperpR;
+	double Ecrit = 3. / 4 * h_planck / M_PI * c_light * pow(lf, 3) / rho;
 	if (14 * Ecrit < secondaryThreshold)
 		return;
 
-	// draw photons up to the total energy loss
-	// if maximumSamples is reached before that, compensate the total energy afterwards
-	Random &random = Random::instance();
-	double dE0 = dE;
-	std::vector<double> energies;
-	int counter = 0;
-	while (dE > 0) {
-		// draw random value between 0 and maximum of corresponding cdf
-		// choose bin of s where cdf(x) = cdf_rand -> x_rand
-		size_t i = random.randBin(tabCDF); // draw random bin (upper bin boundary returned)
-		double binWidth = (tabx[i] - tabx[i-1]);
-		double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
-		double Ephoton = x * Ecrit;
-
-		// if the remaining energy is not sufficient check for random accepting
-		if (Ephoton > dE) {
-			if (random.rand() > (dE / Ephoton))
-				break; // not accepted
-		}
-
-		// only activate the "per-step" sampling if maximumSamples is explicitly set.
-		if (maximumSamples > 0) {
-			if (counter >= maximumSamples) 
-				break;			
-		}
-
-		// store energies in array
-		energies.push_back(Ephoton);
-
-		// energy loss
-		dE -= Ephoton;
-
-		// counter for sampling break condition;
-		counter++;
-	}
+	// expected number of photons, at most maximumSamples of weight nExpected / n
+	const MonopoleRadiationSpectrum &s = *spectrum;
+	double nExpected = dE / (s.meanX * Ecrit);
+	double n = nExpected;
+	if (maximumSamples > 0)
+		n = std::min(n, double(maximumSamples));
+	double w1 = nExpected / n;
 
-	// while loop before gave total energy which is just a fraction of the required
-	double w1 = 1;
-	if (maximumSamples > 0 && dE > 0)
-		w1 = 1. / (1. - dE / dE0); 
+	Random &random = Random::instance();
+	size_t nPhotons = size_t(n);
+	if (random.rand() < n - nPhotons)
+		nPhotons++;
 
-	// loop over sampled photons and attribute weights accordingly
-	for (int i = 0; i < energies.size(); i++) {
-		double Ephoton = energies[i];
-		double f = Ephoton / (E - dE0);
-		double w = w1 / pow(f, thinning);
+	for (size_t k = 0; k < nPhotons; k++) {
+		size_t i = std::max(random.randBin(s.sampler), size_t(1)); // upper bin boundary
+		double x = s.x[i-1] + random.rand() * (s.x[i] - s.x[i-1]); // x uniformly distributed in the bin
+		double Ephoton = x * Ecrit;
+		if (Ephoton <= secondaryThreshold)
+			continue;
 
 		// thinning procedure: accepts only a few random secondaries
-		if (random.rand() < pow(f, thinning)) {
-			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
-			if (Ephoton > secondaryThreshold) // create only photons with energies above threshold
-				candidate->addSecondary(22, Ephoton, pos, w, interactionTag);
-		}
-	} */
+		double p = (thinning > 0) ? pow(std::min(1., Ephoton / E), thinning) : 1;
+		if (p < 1 and random.rand() >= p)
+			continue;
+		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), current.getPosition());
+		candidate->addSecondary(22, Ephoton, pos, w1 / p, interactionTagCode);
+	}
 }
 
 Vector3d MonopoleRadiation::getFieldAtPosition(Vector3d pos, double z) const {
@@ -231,6 +310,10 @@ std::string MonopoleRadiation::getDescription() const {
 		s << " for specified magnetic field";
 	else
 		s << " for Brms = " << Brms / nG << " nG";
+	if (turbulentBrms > 0)
+		s << ", averaged turbulent Brms = " << turbulentBrms / nG << " nG";
+	if (analyticEnergyLoss)
+		s << ", analytic energy loss";
 	if (havePhotons)
 		s << ", photons E > " << secondaryThreshold / eV << " eV";
 	else
@@ -244,10 +327,17 @@ std::string MonopoleRadiation::getDescription() const {
 
 void MonopoleRadiation::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string MonopoleRadiation::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t MonopoleRadiation::getSizeOf() const {
+	if (not spectrum.valid())
+		return 0;
+	return vectorSizeOf(spectrum->x) + vectorSizeOf(spectrum->cdf) + spectrum->sampler.getSizeOf();
+}
+
 } // namespace crpropa
@@ -1,4 +1,5 @@
 #include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Random.h"
 #include "kiss/logger.h"
 #include "Monopole.h"
 
@@ -8,17 +9,50 @@ namespace crpropa {
  * @{
  */
 
+/**
+ @class MonopoleRadiationSpectrum
+ @brief Tabulated photon spectrum of MonopoleRadiation, loaded once per file
+ */
+struct MonopoleRadiationSpectrum: public Referenced {
+	std::vector<double> x; ///< tabulated fraction E_photon/E_critical, log-spaced bin edges
+	std::vector<double> cdf; ///< tabulated CDF of the radiation spectrum at x
+	AliasSampler sampler; ///< alias table of the bins of the CDF
+	double meanX; ///< mean fraction E_photon/E_critical, x uniform in the bins
+
+	/** Spectrum of the file, shared by all modules that use it */
+	static ref_ptr<MonopoleRadiationSpectrum> load(const std::string &filename);
+};
+
 /**
  @class MonopoleRadiation
  @brief Radiation of magnetically charged particles in magnetic fields.
 
  This module simulates the continuous energy loss of magnetically charged particles in magnetic fields, c.f. Jackson.
  The magnetic field is specified either by a MagneticField or by a RMS field strength value.
+ The value of a MagneticField is shared with the other modules of the step (Candidate::getStepField).
  The module limits the next step size to ensure a fractional energy loss dE/E < limit (default = 0.1).
- Optionally, photons above a threshold (default E > 10^7 eV) are created as secondary particles.
- Note that the large number of secondary photons per propagation can cause memory problems.
- To mitigate this, use thinning. However, this still does not solve the problem completely.
- For this reason, a break-condition stops tracking secondary photons and reweights the current ones. 
+ Optionally, photons above a threshold (default E > 10^6 eV) are created as secondary particles.
+ The radiation of the force component perpendicular to the motion is taken to have the
+ synchrotron spectrum of the curvature radius gamma m c^2 beta^2 / F_perp, the energy radiated
+ by a force along the motion is lost without photons. Per step, the expected number of photons
+ N = dE / <E_photon> is rounded stochastically; with setMaximumSamples(n) at most n photons of
+ weight N / n are drawn. The photon energies are drawn from an alias table of the spectrum, which
+ all modules share, and the thinning f^thinning with f = E_photon / E is applied before a
+ secondary is created, so the rejected photons cost only their random numbers.
+
+ With setAnalyticEnergyLoss(true) the energy loss is integrated analytically over the step,
+ with the force frozen at its value after the propagation step (operator splitting).
+ For a force F with components F_par and F_perp relative to the direction of motion
+ the radiated power is A (F_par^2 + gamma^2 F_perp^2), so d(gamma)/dt = -(a + b gamma^2) has a closed solution.
+ The next step is then not limited by the energy loss, which allows much larger steps for
+ radiation-dominated tracks; getStepRadiation is the exact energy difference over the step.
+ Secondary photons are emitted from this energy loss as in the explicit mode.
+
+ With setTurbulentBrms the field is split into the coherent field of setField, evaluated
+ at the position, and an isotropic turbulent field of the given RMS, whose contribution
+ to the radiated power and to the curvature of the photon spectrum is its average over
+ the orientations. The turbulent field, e.g. a PlaneWaveTurbulence or a grid, then need
+ not be evaluated by this module; the propagation uses the full field.
  */
 class MonopoleRadiation: public MonopoleSimulationModule {
 private:
@@ -29,16 +63,18 @@ private:
 	bool havePhotons; ///< flag for production of secondary photons
 	int maximumSamples; ///< maximum number of samples of photons (break condition; defaults to 100; 0 or <0 means no sampling)
 	double secondaryThreshold; ///< threshold energy for secondary photons
-	std::vector<double> tabx; ///< tabulated fraction E_photon/E_critical from 10^-6 to 10^2 in 801 log-spaced steps
-	std::vector<double> tabCDF; ///< tabulated CDF of radiation spectrum
+	ref_ptr<MonopoleRadiationSpectrum> spectrum; ///< photon spectrum, loaded with the photons
 	std::string interactionTag = "SYN";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
+	bool analyticEnergyLoss; ///< integrate the energy loss analytically over the step
+	double turbulentBrms; ///< RMS of the turbulent field that is averaged over, see setTurbulentBrms
 
 public:
 	/** Constructor
 	 @param field			magnetic field object
 	 @param havePhotons		if true, add secondary photons as candidates
 	 @param thinning		weighted sampling of secondaries (0: all particles are tracked; 1: maximum thinning)
-	 @param nSamples		number of photons to be sampled and added as candidates
+	 @param nSamples		maximum number of photons per step (0: no limit)
 	 @param limit			step size limit as fraction of mean free path
 	 */
 	MonopoleRadiation(ref_ptr<MagneticField> field, bool havePhotons = false, double thinning = 0, int nSamples = 0, double limit = 0.1);
@@ -46,19 +82,20 @@ public:
 	 @param field			RMS of the magnetic field (if magnetic-field object not provided)
 	 @param havePhotons		if true, add secondary photons as candidates
 	 @param thinning		weighted sampling of secondaries (0: all particles are tracked; 1: maximum thinning)
-	 @param nSamples		number of photons to be sampled and added as candidates
+	 @param nSamples		maximum number of photons per step (0: no limit)
 	 @param limit			step size limit as fraction of mean free path
 	 */
 	MonopoleRadiation(double Brms = 0, bool havePhotons = false, double thinning = 0, int nSamples = 0, double limit = 0.1);
 	
 	void setField(ref_ptr<MagneticField> field);
 	void setBrms(double Brms);	
+	/** Create secondary photons, loads the spectrum, see initSpectrum */
 	void setHavePhotons(bool havePhotons);
 	void setThinning(double thinning);
 	void setLimit(double limit);
-	/** Set the maximum number of photons that will be allowed to be added as candidates. 
+	/** Set the maximum number of photons that will be allowed to be added as candidates per step.
 	 This choice depends on the problem at hand. It must be such that all relevant physics is captured with the sample. Weights are added accordingly and the column 'weight' must be added to output.
-	 @param nmax	maximum number of photons to be sampled
+	 @param nmax	maximum number of photons to be sampled, 0 or less for no limit
 	 */
 	void setMaximumSamples(int nmax);
 	/** Photons above the secondary energy threshold are added as candidates.
@@ -67,6 +104,28 @@ public:
 	 */
 	void setSecondaryThreshold(double threshold);	
 	void setInteractionTag(std::string tag);
+	/** Integrate the energy loss analytically over the step instead of applying P * step / c.
+	 @param analytic	if true, the next step is not limited by the energy loss;
+	 					the secondary photons are emitted in both modes
+	 */
+	void setAnalyticEnergyLoss(bool analytic);
+	bool getAnalyticEnergyLoss() const;
+	/** RMS of an isotropic turbulent field that is added on average to the
+	 coherent field of setField, see the class description; 0 (default) for none.
+	 Only the RMS enters the mean power, the spectrum of the turbulence does not.
+	 @param Brms	RMS of the turbulent field [T]
+	 */
+	void setTurbulentBrms(double Brms);
+	double getTurbulentBrms() const;
+
+	/** Decrease of the Lorentz factor over the time t for d(gamma)/dt = -(a + b gamma^2).
+	 Written as a difference to keep full precision for gamma close to 1; at most lf - 1.
+	 @param lf	Lorentz factor at the beginning of the step
+	 @param a	coefficient of the force component parallel to the motion [1/s]
+	 @param b	coefficient of the force component perpendicular to the motion [1/s]
+	 @param t	time of the step [s]
+	 */
+	static double lorentzFactorLoss(double lf, double a, double b, double t);
 	ref_ptr<MagneticField> getField();
 
 	double getBrms();
@@ -77,11 +136,16 @@ public:
 	double getSecondaryThreshold() const;
 	std::string getInteractionTag() const;
 
+	/** Load the spectrum of the photons, the synchrotron spectrum in
+	 Synchrotron/spectrum.txt of the data path, once for all modules */
 	void initSpectrum();
+	/** Memory of the photon spectrum in bytes, the field is counted by the
+	 propagation module */
+	size_t getSizeOf() const;
 	/** Propagates the particle. Is called once per iteration.
 	 * @param candidate	 The Candidate is a passive object, that holds the information about the state of the cosmic ray and the simulation itself. 
-	   @param current	Current is a reference to the Mcurrent member of candidate*/
-	void Mprocess(MCandidate *candidate, MParticleState& current) const override;
+	   @param current	Current is a reference to the current member of candidate*/
+	void Mprocess(MCandidate *candidate, ParticleState& current) const override;
 	std::string getDescription() const;
 	
 	/** Get magnetic field vector at current candidate position
@@ -0,0 +1,96 @@
+#include "MonopoleSweep.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+MonopoleSweep::MonopoleSweep(ref_ptr<MonopolePropagationCK> propagation,
+		ref_ptr<ModuleList> modules) :
+		propagation(propagation), modules(modules) {
+	if (not propagation.valid())
+		throw std::runtime_error("MonopoleSweep: no propagation");
+}
+
+void MonopoleSweep::addHypothesis(double pmass, double mcharge) {
+	if (not (pmass > 0))
+		throw std::runtime_error("MonopoleSweep: the mass has to be positive");
+	masses.push_back(pmass);
+	mcharges.push_back(mcharge);
+}
+
+void MonopoleSweep::addGrid(const std::vector<double> &m,
+		const std::vector<double> &g) {
+	for (size_t i = 0; i < m.size(); i++)
+		for (size_t j = 0; j < g.size(); j++)
+			addHypothesis(m[i], g[j]);
+}
+
+size_t MonopoleSweep::getNumberOfHypotheses() const {
+	return masses.size();
+}
+
+double MonopoleSweep::getMass(size_t i) const {
+	return masses.at(i);
+}
+
+double MonopoleSweep::getMcharge(size_t i) const {
+	return mcharges.at(i);
+}
+
+std::vector<ref_ptr<Candidate> > MonopoleSweep::createBundle(
+		const MCandidate &prototype) const {
+	std::vector<ref_ptr<Candidate> > bundle;
+	bundle.reserve(masses.size());
+	for (size_t i = 0; i < masses.size(); i++) {
+		MCandidate *c = new MCandidate(prototype.getMcurrent());
+		c->setRedshift(prototype.getRedshift());
+		c->setWeight(prototype.getWeight());
+		c->setNextStep(prototype.getNextStep());
+		c->setTagOriginCode(prototype.getTagOriginCode());
+		c->setMass(masses[i]);
+		c->setMcharge(mcharges[i]);
+		c->setProperty("hypothesis", Variant::fromUInt64(i));
+		bundle.push_back(c);
+	}
+	return bundle;
+}
+
+void MonopoleSweep::run(const std::vector<ref_ptr<Candidate> > &bundle) const {
+	std::vector<ref_ptr<Candidate> > active;
+	active.reserve(bundle.size());
+	for (size_t i = 0; i < bundle.size(); i++)
+		if (bundle[i]->isActive())
+			active.push_back(bundle[i]);
+
+	while (not active.empty()) {
+		propagation->processBatch(active);
+		size_t remaining = 0;
+		for (size_t i = 0; i < active.size(); i++) {
+			if (modules.valid())
+				modules->process(active[i]);
+			if (active[i]->isActive())
+				active[remaining++] = active[i];
+		}
+		active.resize(remaining);
+	}
+}
+
+void MonopoleSweep::run(SourceInterface *source, size_t count) const {
+#pragma omp parallel for schedule(dynamic, 1)
+	for (long i = 0; i < long(count); i++) {
+		ref_ptr<Candidate> candidate = source->getCandidate();
+		run(createBundle(*MCandidate::convertToMCandidate(candidate)));
+	}
+}
+
+std::string MonopoleSweep::getDescription() const {
+	std::stringstream s;
+	s << "MonopoleSweep: " << masses.size() << " hypotheses of mass and magnetic charge\n";
+	s << "  " << propagation->getDescription() << "\n";
+	if (modules.valid())
+		s << modules->getDescription();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,70 @@
+#ifndef MONOPOLESWEEP_H
+#define MONOPOLESWEEP_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+#include "Monopole.h"
+#include "MonopolePropagationCK.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class MonopoleSweep
+ @brief Propagation of a bundle of (mass, magnetic charge) hypotheses from identical initial conditions
+
+ Instead of one run per point of a scan in monopole mass and magnetic charge,
+ each primary is copied once per hypothesis and the copies are propagated
+ together: MonopolePropagationCK::processBatch integrates all of them in one
+ structure-of-arrays state, with one batched field evaluation per Cash-Karp
+ stage. With a field sharing distance (MonopolePropagationCK::setFieldSharingDistance)
+ hypotheses whose trajectories are still close, e.g. ultra-heavy and weakly
+ deflected ones, share the field evaluation; neighbouring hypotheses should
+ then be similar, as for addGrid.
+
+ After each step the candidates are passed to the modules (e.g. radiation,
+ break conditions, observers and outputs), which must not contain the
+ propagation. The property "hypothesis" holds the index of the hypothesis
+ for per-hypothesis outputs (Output::enableProperty).
+ */
+class MonopoleSweep: public Referenced {
+	ref_ptr<MonopolePropagationCK> propagation;
+	ref_ptr<ModuleList> modules;
+	std::vector<double> masses, mcharges;
+public:
+	/** Constructor
+	 @param propagation	propagation of the bundles
+	 @param modules		modules applied after each step, without the propagation
+	 */
+	MonopoleSweep(ref_ptr<MonopolePropagationCK> propagation, ref_ptr<ModuleList> modules);
+
+	/** Add a hypothesis
+	 @param pmass		mass [in kg]
+	 @param mcharge		magnetic charge [in A*m], anti-monopoles (ids < 0) get the negative charge */
+	void addHypothesis(double pmass, double mcharge);
+	/** Add all combinations, the charges varying fastest */
+	void addGrid(const std::vector<double> &masses, const std::vector<double> &mcharges);
+	size_t getNumberOfHypotheses() const;
+	double getMass(size_t i) const;
+	double getMcharge(size_t i) const;
+
+	/** Copies of the current state of the candidate, one per hypothesis */
+	std::vector<ref_ptr<Candidate> > createBundle(const MCandidate &prototype) const;
+	/** Propagate the bundle until all its candidates are inactive */
+	void run(const std::vector<ref_ptr<Candidate> > &bundle) const;
+	/** Propagate the bundles of count candidates of the source (e.g. MSource
+	 with SourceParticleMonopole), the bundles in parallel */
+	void run(SourceInterface *source, size_t count) const;
+
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // MONOPOLESWEEP_H
@@ -0,0 +1,83 @@
+# Compares MonopolePropagationCK.processBatch and MonopolePropagationBP.processBatch
+# with the propagation of single candidates for the setup of "Jupyter Validation/Validation Dyon.ipynb":
+# dyons with q = 199, g = 1 gD, m = 100 GeV/c^2 and E = 0.01 EeV in a uniform
+# 10 nG field along z, for several pitch angles.
+from crpropa import *
+from Monopole import Monopole
+import time
+
+B = 10 * nG
+field = UniformMagneticField(Vector3d(0, 0, B))
+
+m = 100 * gigaelectronvolt / c_squared
+g = 1 * Monopole.gD
+q = 199
+energy = 0.01 * EeV
+
+max_trajectory = 1 * kpc
+number_of_steps = 5000
+steplength = max_trajectory / number_of_steps
+n_candidates = 64
+
+def make_candidates():
+    candidates = CandidateVector()
+    for i in range(n_candidates):
+        p_z = -0.99 + 1.98 * i / (n_candidates - 1)
+        p_x = (1 - p_z**2)**0.5 / 2**0.5
+        direction = Vector3d(p_x, p_x, p_z)
+        c = Monopole.MCandidate(4110000 + q * 10, energy, Vector3d(0, 0, 0), direction, m, g)
+        c.setNextStep(steplength)
+        candidates.push_back(c)
+    return candidates
+
+def run(adaptive, batch):
+    if adaptive:
+        propagation = Monopole.MonopolePropagationCK(field, 1e-4, steplength / 10, steplength * 10)
+    else:
+        propagation = Monopole.MonopolePropagationCK(field, 1e-4, steplength, steplength)
+    candidates = make_candidates()
+    t0 = time.time()
+    for step in range(number_of_steps):
+        if batch:
+            propagation.processBatch(candidates)
+        else:
+            for c in candidates:
+                propagation.process(c)
+    t1 = time.time()
+    return candidates, t1 - t0
+
+for adaptive in (False, True):
+    single, t_single = run(adaptive, False)
+    batch, t_batch = run(adaptive, True)
+    deviation = max((single[i].current.getPosition() - batch[i].current.getPosition()).getR()
+                    for i in range(n_candidates))
+    print('adaptive' if adaptive else 'fixed step')
+    print('  single candidates: %.2f s, batch: %.2f s, speedup %.1f' % (t_single, t_batch, t_single / t_batch))
+    print('  maximum position deviation: %.3e pc' % (deviation / pc))
+
+# fixed steps with the Boris push: the batch kernel against the Cash-Karp
+# batch, and against a Boris reference with ten times smaller steps
+def run_boris(batch, substeps=1):
+    propagation = Monopole.MonopolePropagationBP(field, steplength / substeps)
+    candidates = make_candidates()
+    t0 = time.time()
+    for step in range(number_of_steps * substeps):
+        if batch:
+            propagation.processBatch(candidates)
+        else:
+            for c in candidates:
+                propagation.process(c)
+    t1 = time.time()
+    return candidates, t1 - t0
+
+reference, _ = run_boris(True, 10)
+cash_karp, t_ck = run(False, True)
+boris, t_bp = run_boris(True)
+boris_single, t_bp_single = run_boris(False)
+print('fixed step Boris push')
+print('  single candidates: %.2f s, batch: %.2f s, Cash-Karp batch: %.2f s'
+      % (t_bp_single, t_bp, t_ck))
+for name, result in (('Boris batch', boris), ('Cash-Karp batch', cash_karp)):
+    deviation = max((reference[i].current.getPosition() - result[i].current.getPosition()).getR()
+                    for i in range(n_candidates))
+    print('  %s: maximum deviation from the reference %.3e pc' % (name, deviation / pc))
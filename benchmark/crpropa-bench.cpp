@@ -0,0 +1,278 @@
+/** End-to-end benchmarks of production-like simulation scenarios.
+
+ Each scenario is run with a fixed seed and reports one JSON object per line:
+ the number of candidates and steps, their rates, the setup and run time and
+ the peak resident memory of the process. For a meaningful peak memory per
+ scenario, run one scenario per call.
+
+ Usage: crpropa-bench [--list] [-n <candidates>] [-s <seed>] [scenario ...]
+ */
+
+#include "CRPropa.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+using namespace crpropa;
+
+// counts the steps of all candidates, one counter per thread
+class StepCounter: public Module {
+private:
+	struct Counter {
+		uint64_t steps;
+		char padding[64 - sizeof(uint64_t)];
+	};
+	mutable std::vector<Counter> counters;
+
+public:
+	StepCounter() {
+		int threads = 1;
+#if _OPENMP
+		threads = omp_get_max_threads();
+#endif
+		counters.resize(threads);
+		for (size_t i = 0; i < counters.size(); i++)
+			counters[i].steps = 0;
+	}
+
+	void process(Candidate *candidate) const {
+		int thread = 0;
+#if _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		counters[thread].steps++;
+	}
+
+	uint64_t getSteps() const {
+		uint64_t steps = 0;
+		for (size_t i = 0; i < counters.size(); i++)
+			steps += counters[i].steps;
+		return steps;
+	}
+};
+
+struct Scenario {
+	ref_ptr<ModuleList> modules;
+	ref_ptr<Source> source;
+	size_t candidates; ///< default number of candidates
+};
+
+typedef Scenario (*ScenarioSetup)();
+
+// 1D UHECR nuclei with photo-disintegration and photo-pion production on CMB and IRB
+static Scenario uhecr1D() {
+	ref_ptr<PhotonField> cmb = new CMB();
+	ref_ptr<PhotonField> irb = new IRB_Gilmore12();
+
+	Scenario s;
+	s.modules = new ModuleList();
+	s.modules->add(new SimplePropagation(1 * kpc, 10 * Mpc));
+	s.modules->add(new Redshift());
+	s.modules->add(new PhotoPionProduction(cmb));
+	s.modules->add(new PhotoPionProduction(irb));
+	s.modules->add(new PhotoDisintegration(cmb));
+	s.modules->add(new PhotoDisintegration(irb));
+	s.modules->add(new NuclearDecay());
+	s.modules->add(new ElectronPairProduction(cmb));
+	s.modules->add(new ElectronPairProduction(irb));
+	s.modules->add(new MinimumEnergy(1 * EeV));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverPoint());
+	s.modules->add(observer);
+
+	s.source = new Source();
+	s.source->add(new SourceUniform1D(1 * Mpc, 1000 * Mpc));
+	s.source->add(new SourceRedshift1D());
+	s.source->add(new SourceParticleType(nucleusId(56, 26)));
+	s.source->add(new SourcePowerLawSpectrum(10 * EeV, 1000 * EeV, -1));
+	s.candidates = 1000;
+	return s;
+}
+
+// 3D protons in a 256^3 turbulent grid
+static Scenario turbulence3D() {
+#ifdef CRPROPA_HAVE_FFTW3F
+	double spacing = 10 * kpc;
+	GridProperties grid(Vector3d(0.), 256, spacing);
+	SimpleTurbulenceSpectrum spectrum(1 * nG, 2 * spacing, 128 * spacing);
+	ref_ptr<MagneticField> field = new GridTurbulence(spectrum, grid, 42);
+
+	Scenario s;
+	s.modules = new ModuleList();
+	s.modules->add(new PropagationCK(field, 1e-4, 1 * kpc, 1 * Mpc));
+	s.modules->add(new MaximumTrajectoryLength(100 * Mpc));
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(Vector3d(128 * spacing)));
+	s.source->add(new SourceIsotropicEmission());
+	s.source->add(new SourceParticleType(nucleusId(1, 1)));
+	s.source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	s.candidates = 1000;
+	return s;
+#else
+	throw std::runtime_error("crpropa-bench: turbulence3D requires FFTW3F");
+#endif
+}
+
+// electromagnetic cascade with all EM interactions
+static Scenario emCascade() {
+	ref_ptr<PhotonField> cmb = new CMB();
+	ref_ptr<PhotonField> irb = new IRB_Gilmore12();
+
+	Scenario s;
+	s.modules = new ModuleList();
+	s.modules->add(new SimplePropagation(1 * kpc, 10 * Mpc));
+	s.modules->add(new Redshift());
+	ref_ptr<PhotonField> fields[] = {cmb, irb};
+	for (int i = 0; i < 2; i++) {
+		s.modules->add(new EMPairProduction(fields[i], true, 0.9));
+		s.modules->add(new EMDoublePairProduction(fields[i], true, 0.9));
+		s.modules->add(new EMTripletPairProduction(fields[i], true, 0.9));
+		s.modules->add(new EMInverseComptonScattering(fields[i], true, 0.9));
+	}
+	s.modules->add(new MinimumEnergy(10 * GeV));
+	ref_ptr<Observer> observer = new Observer();
+	observer->add(new ObserverPoint());
+	s.modules->add(observer);
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(Vector3d(50 * Mpc, 0, 0)));
+	s.source->add(new SourceRedshift1D());
+	s.source->add(new SourceParticleType(22));
+	s.source->add(new SourcePowerLawSpectrum(1 * PeV, 1 * EeV, -1));
+	s.candidates = 100;
+	return s;
+}
+
+// diffusive galactic propagation of cosmic rays in the JF12 field
+static Scenario galacticDiffusion() {
+	ref_ptr<MagneticField> field = new JF12Field();
+
+	Scenario s;
+	s.modules = new ModuleList();
+	s.modules->add(new DiffusionSDE(field, 1e-4, 1 * pc, 100 * pc));
+	s.modules->add(new SphericalBoundary(Vector3d(0.), 20 * kpc));
+	s.modules->add(new MaximumTrajectoryLength(1 * Mpc));
+
+	s.source = new Source();
+	s.source->add(new SourceUniformSphere(Vector3d(0.), 5 * kpc));
+	s.source->add(new SourceIsotropicEmission());
+	s.source->add(new SourceParticleType(nucleusId(1, 1)));
+	s.source->add(new SourcePowerLawSpectrum(1 * TeV, 1 * PeV, -1));
+	s.candidates = 100;
+	return s;
+}
+
+// ballistic propagation of heavy nuclei through the JF12 field
+static Scenario galacticJF12() {
+	ref_ptr<MagneticField> field = new JF12Field();
+
+	Scenario s;
+	s.modules = new ModuleList();
+	s.modules->add(new PropagationCK(field, 1e-4, 1 * pc, 100 * pc));
+	s.modules->add(new SphericalBoundary(Vector3d(0.), 20 * kpc));
+
+	s.source = new Source();
+	s.source->add(new SourcePosition(Vector3d(-8.5 * kpc, 0, 0)));
+	s.source->add(new SourceIsotropicEmission());
+	s.source->add(new SourceParticleType(nucleusId(56, 26)));
+	s.source->add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+	s.candidates = 1000;
+	return s;
+}
+
+static long peakRSS() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss; // kB on Linux
+}
+
+static double wallTime() {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, ScenarioSetup> scenarios;
+	scenarios["uhecr1D"] = uhecr1D;
+	scenarios["turbulence3D"] = turbulence3D;
+	scenarios["emCascade"] = emCascade;
+	scenarios["galacticDiffusion"] = galacticDiffusion;
+	scenarios["galacticJF12"] = galacticJF12;
+
+	std::vector<std::string> selected;
+	size_t count = 0;
+	uint64_t seed = 42;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--list") == 0) {
+			std::map<std::string, ScenarioSetup>::const_iterator s;
+			for (s = scenarios.begin(); s != scenarios.end(); s++)
+				std::cout << s->first << std::endl;
+			return 0;
+		} else if (std::strcmp(argv[i], "-n") == 0 and i + 1 < argc) {
+			count = std::atol(argv[++i]);
+		} else if (std::strcmp(argv[i], "-s") == 0 and i + 1 < argc) {
+			seed = std::strtoull(argv[++i], 0, 10);
+		} else if (scenarios.count(argv[i])) {
+			selected.push_back(argv[i]);
+		} else {
+			std::cerr << "Usage: " << argv[0]
+					<< " [--list] [-n <candidates>] [-s <seed>] [scenario ...]" << std::endl;
+			return 1;
+		}
+	}
+	if (selected.empty()) {
+		std::map<std::string, ScenarioSetup>::const_iterator s;
+		for (s = scenarios.begin(); s != scenarios.end(); s++)
+			selected.push_back(s->first);
+	}
+
+	int threads = 1;
+#if _OPENMP
+	threads = omp_get_max_threads();
+#endif
+
+	int failed = 0;
+	for (size_t i = 0; i < selected.size(); i++) {
+		double start = wallTime();
+		Scenario s;
+		try {
+			s = scenarios[selected[i]]();
+		} catch (std::exception &e) {
+			std::cerr << selected[i] << ": " << e.what() << std::endl;
+			failed++;
+			continue;
+		}
+		ref_ptr<StepCounter> counter = new StepCounter();
+		s.modules->add(counter);
+		size_t n = (count > 0) ? count : s.candidates;
+
+		double setup = wallTime() - start;
+		Random::seedStreams(seed);
+		start = wallTime();
+		s.modules->run(s.source, n);
+		double time = wallTime() - start;
+
+		std::cout << "{\"scenario\": \"" << selected[i] << "\""
+				<< ", \"threads\": " << threads
+				<< ", \"candidates\": " << n
+				<< ", \"steps\": " << counter->getSteps()
+				<< ", \"setup_time\": " << setup
+				<< ", \"run_time\": " << time
+				<< ", \"candidates_per_s\": " << n / time
+				<< ", \"steps_per_s\": " << counter->getSteps() / time
+				<< ", \"peak_rss_kb\": " << peakRSS() << "}" << std::endl;
+	}
+	return failed;
+}
@@ -0,0 +1,320 @@
+/** Microbenchmarks of single CRPropa primitives.
+
+ Each benchmark sets up its data once and then times a single operation,
+ repeated until it takes at least the minimum time. It reports one JSON
+ object per line with the iterations and the time per operation. Benchmarks
+ that fail (e.g. for missing data files) are reported on stderr and
+ skipped. A name given on the command line selects all benchmarks that
+ start with it. The portable and SIMD variants of PlaneWaveTurbulence only
+ differ in builds with FAST_WAVES.
+
+ Usage: crpropa-microbench [--list] [-t <seconds>] [benchmark prefix ...]
+ */
+
+#include "CRPropa.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace crpropa;
+
+// keeps the results of the operations alive
+static volatile double sink;
+
+// runs the operation n times
+typedef std::function<void(size_t n)> Operation;
+typedef std::function<Operation()> BenchmarkSetup;
+
+static double wallTime() {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// positions inside a box, cycled by the operations
+static std::vector<Vector3d> randomPositions(const Vector3d &origin, double size) {
+	Random random(42);
+	std::vector<Vector3d> positions(1024);
+	for (size_t i = 0; i < positions.size(); i++)
+		positions[i] = origin + Vector3d(random.rand(), random.rand(), random.rand()) * size;
+	return positions;
+}
+
+template <typename T>
+static BenchmarkSetup gridInterpolation(size_t n, interpolationType type, bool ghostLayers = false) {
+	return [n, type, ghostLayers]() {
+		ref_ptr<Grid<T> > grid = new Grid<T>(Vector3d(0.), n, 1.);
+		Random random(42);
+		for (size_t i = 0; i < n * n * n; i++)
+			grid->getGrid()[i] = T(random.rand());
+		grid->setInterpolationType(type);
+		grid->setGhostLayers(ghostLayers);
+		std::vector<Vector3d> positions = randomPositions(Vector3d(0.), n - 1);
+		return Operation([grid, positions](size_t iterations) {
+			double s = 0;
+			for (size_t i = 0; i < iterations; i++)
+				s += grid->interpolate(positions[i & 1023]).x;
+			sink = s;
+		});
+	};
+}
+
+static BenchmarkSetup fieldEvaluation(std::function<MagneticField *()> create,
+		const Vector3d &origin, double size) {
+	return [create, origin, size]() {
+		ref_ptr<MagneticField> field = create();
+		std::vector<Vector3d> positions = randomPositions(origin, size);
+		return Operation([field, positions](size_t iterations) {
+			double s = 0;
+			for (size_t i = 0; i < iterations; i++)
+				s += field->getField(positions[i & 1023]).x;
+			sink = s;
+		});
+	};
+}
+
+static MagneticField *planeWaves() {
+	return new PlaneWaveTurbulence(TurbulenceSpectrum(1 * nG, 10 * kpc, 1 * Mpc), 256, 42);
+}
+
+static BenchmarkSetup planeWaveTurbulence(bool simd) {
+	return [simd]() {
+		// the highest supported level is restored after each benchmark
+		setSimdLevel(simd ? SIMD_AVX512 : SIMD_NONE);
+		return fieldEvaluation(planeWaves, Vector3d(0.), 10 * Mpc)();
+	};
+}
+
+static BenchmarkSetup modulatedField(bool fused) {
+	return [fused]() {
+		const size_t n = 128;
+		ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), n, 1.);
+		ref_ptr<Grid1f> modGrid = new Grid1f(Vector3d(0.), n, 1.);
+		Random random(42);
+		for (size_t i = 0; i < n * n * n; i++) {
+			grid->getGrid()[i] = Vector3f(random.rand(), random.rand(), random.rand());
+			modGrid->getGrid()[i] = random.rand();
+		}
+		ref_ptr<ModulatedMagneticFieldGrid> field = new ModulatedMagneticFieldGrid(grid, modGrid);
+		field->setReflective(false, false);
+		if (fused)
+			field->fuse();
+		return fieldEvaluation([field]() -> MagneticField * {
+			return field;
+		}, Vector3d(0.), n)();
+	};
+}
+
+static BenchmarkSetup propagationStep(std::function<Module *(ref_ptr<MagneticField>)> create) {
+	return [create]() {
+		ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+		ref_ptr<Module> propagation = create(field);
+		ref_ptr<Candidate> candidate = new Candidate(nucleusId(1, 1), 1 * EeV);
+		return Operation([propagation, candidate](size_t iterations) {
+			for (size_t i = 0; i < iterations; i++) {
+				candidate->setNextStep(1 * kpc);
+				propagation->process(candidate);
+			}
+			sink = candidate->current.getPosition().x;
+		});
+	};
+}
+
+// process of an interaction module for a candidate reset to the same state
+static BenchmarkSetup interaction(std::function<Module *()> create, int id, double energy) {
+	return [create, id, energy]() {
+		ref_ptr<Module> module = create();
+		ref_ptr<Candidate> candidate = new Candidate(id, energy);
+		return Operation([module, candidate, id, energy](size_t iterations) {
+			for (size_t i = 0; i < iterations; i++) {
+				candidate->current.setId(id);
+				candidate->current.setEnergy(energy);
+				candidate->setCurrentStep(10 * kpc);
+				candidate->setNextStep(10 * kpc);
+				candidate->secondaries.clear();
+				module->process(candidate);
+			}
+			sink = candidate->getNextStep();
+		});
+	};
+}
+
+static std::map<std::string, BenchmarkSetup> benchmarks() {
+	std::map<std::string, BenchmarkSetup> b;
+
+	const size_t sizes[] = {16, 128};
+	const interpolationType types[] = {TRILINEAR, TRICUBIC, NEAREST_NEIGHBOUR};
+	const char *typeNames[] = {"trilinear", "tricubic", "nearest"};
+	for (size_t i = 0; i < 2; i++) {
+		for (size_t j = 0; j < 3; j++) {
+			std::string suffix = std::string(typeNames[j]) + "/" + std::to_string(sizes[i]);
+			b["Grid3f/interpolate/" + suffix] = gridInterpolation<Vector3f>(sizes[i], types[j]);
+			b["Grid3d/interpolate/" + suffix] = gridInterpolation<Vector3d>(sizes[i], types[j]);
+			if (types[j] != NEAREST_NEIGHBOUR)
+				b["Grid3f/interpolate/" + suffix + "/ghost"] = gridInterpolation<Vector3f>(sizes[i], types[j], true);
+		}
+	}
+
+	b["PlaneWaveTurbulence/getField/portable"] = planeWaveTurbulence(false);
+	b["PlaneWaveTurbulence/getField/simd"] = planeWaveTurbulence(true);
+	b["JF12Field/getField"] = fieldEvaluation([]() -> MagneticField * {
+		return new JF12Field();
+	}, Vector3d(-20 * kpc, -20 * kpc, -5 * kpc), 40 * kpc);
+
+	b["ModulatedMagneticFieldGrid/getField/separate"] = modulatedField(false);
+	b["ModulatedMagneticFieldGrid/getField/fused"] = modulatedField(true);
+
+	b["PropagationCK/step"] = propagationStep([](ref_ptr<MagneticField> field) -> Module * {
+		return new PropagationCK(field, 1e-4, 1 * kpc, 1 * kpc);
+	});
+	b["PropagationBP/step"] = propagationStep([](ref_ptr<MagneticField> field) -> Module * {
+		return new PropagationBP(field, 1 * kpc);
+	});
+
+	b["Common/interpolate"] = []() {
+		std::vector<double> X(100), Y(100);
+		for (size_t i = 0; i < X.size(); i++) {
+			X[i] = i * i;
+			Y[i] = sqrt(double(i));
+		}
+		return Operation([X, Y](size_t iterations) {
+			double s = 0;
+			for (size_t i = 0; i < iterations; i++)
+				s += interpolate((i % 9801) + 0.5, X, Y);
+			sink = s;
+		});
+	};
+	b["Common/interpolateEquidistant"] = []() {
+		std::vector<double> Y(100);
+		for (size_t i = 0; i < Y.size(); i++)
+			Y[i] = sqrt(double(i));
+		return Operation([Y](size_t iterations) {
+			double s = 0;
+			for (size_t i = 0; i < iterations; i++)
+				s += interpolateEquidistant((i % 1000) * 0.099, 0, 99, Y);
+			sink = s;
+		});
+	};
+	b["Random/randBin"] = []() {
+		std::vector<double> cdf(100);
+		for (size_t i = 0; i < cdf.size(); i++)
+			cdf[i] = (i + 1) * (i + 1);
+		return Operation([cdf](size_t iterations) {
+			Random &random = Random::instance();
+			size_t s = 0;
+			for (size_t i = 0; i < iterations; i++)
+				s += random.randBin(cdf);
+			sink = s;
+		});
+	};
+
+	b["Candidate/construct"] = []() {
+		return Operation([](size_t iterations) {
+			for (size_t i = 0; i < iterations; i++) {
+				ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 1 * EeV);
+				sink = c->current.getEnergy();
+			}
+		});
+	};
+	b["Candidate/clone"] = []() {
+		ref_ptr<Candidate> candidate = new Candidate(nucleusId(1, 1), 1 * EeV);
+		candidate->setProperty("tag", Variant::fromString("source"));
+		return Operation([candidate](size_t iterations) {
+			for (size_t i = 0; i < iterations; i++) {
+				ref_ptr<Candidate> c = candidate->clone();
+				sink = c->current.getEnergy();
+			}
+		});
+	};
+
+	b["PhotoPionProduction/process"] = interaction([]() -> Module * {
+		return new PhotoPionProduction(new CMB());
+	}, nucleusId(1, 1), 100 * EeV);
+	b["PhotoDisintegration/process"] = interaction([]() -> Module * {
+		return new PhotoDisintegration(new CMB());
+	}, nucleusId(56, 26), 100 * EeV);
+	b["ElectronPairProduction/process"] = interaction([]() -> Module * {
+		return new ElectronPairProduction(new CMB());
+	}, nucleusId(1, 1), 10 * EeV);
+	b["NuclearDecay/process"] = interaction([]() -> Module * {
+		return new NuclearDecay();
+	}, nucleusId(3, 1), 1 * EeV);
+	b["EMPairProduction/process"] = interaction([]() -> Module * {
+		return new EMPairProduction(new CMB());
+	}, 22, 1 * EeV);
+	b["EMDoublePairProduction/process"] = interaction([]() -> Module * {
+		return new EMDoublePairProduction(new CMB());
+	}, 22, 1 * EeV);
+	b["EMTripletPairProduction/process"] = interaction([]() -> Module * {
+		return new EMTripletPairProduction(new CMB());
+	}, 11, 1 * EeV);
+	b["EMInverseComptonScattering/process"] = interaction([]() -> Module * {
+		return new EMInverseComptonScattering(new CMB());
+	}, 11, 1 * TeV);
+	return b;
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, BenchmarkSetup> all = benchmarks();
+
+	std::vector<std::string> prefixes;
+	double minTime = 0.5;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--list") == 0) {
+			std::map<std::string, BenchmarkSetup>::const_iterator b;
+			for (b = all.begin(); b != all.end(); b++)
+				std::cout << b->first << std::endl;
+			return 0;
+		} else if (std::strcmp(argv[i], "-t") == 0 and i + 1 < argc) {
+			minTime = std::atof(argv[++i]);
+		} else if (argv[i][0] != '-') {
+			prefixes.push_back(argv[i]);
+		} else {
+			std::cerr << "Usage: " << argv[0]
+					<< " [--list] [-t <seconds>] [benchmark prefix ...]" << std::endl;
+			return 1;
+		}
+	}
+
+	int failed = 0;
+	std::map<std::string, BenchmarkSetup>::const_iterator b;
+	for (b = all.begin(); b != all.end(); b++) {
+		bool selected = prefixes.empty();
+		for (size_t i = 0; i < prefixes.size(); i++)
+			selected = selected or (b->first.compare(0, prefixes[i].size(), prefixes[i]) == 0);
+		if (not selected)
+			continue;
+
+		// increase the iterations until the operations take the minimum time
+		size_t iterations = 1;
+		double time = 0;
+		try {
+			Operation operation = b->second();
+			while (true) {
+				double start = wallTime();
+				operation(iterations);
+				time = wallTime() - start;
+				if (time >= minTime)
+					break;
+				double factor = (time > 0) ? 1.5 * minTime / time : 100;
+				iterations = std::max<size_t>(iterations * std::min(factor, 100.), iterations + 1);
+			}
+		} catch (std::exception &e) {
+			std::cerr << b->first << ": " << e.what() << std::endl;
+			failed++;
+			setSimdLevel(SIMD_AVX512);
+			continue;
+		}
+
+		std::cout << "{\"benchmark\": \"" << b->first << "\""
+				<< ", \"iterations\": " << iterations
+				<< ", \"ns_per_op\": " << time / iterations * 1e9 << "}" << std::endl;
+		setSimdLevel(SIMD_AVX512);
+	}
+	return failed;
+}
@@ -0,0 +1,312 @@
+/** Accuracy versus cost of the integrators of the Monopole plugin.
+
+ The scenarios of the notebooks in Monopole/Jupyter Validation, in uniform
+ fields with analytic solutions, are propagated with MonopolePropagationBP
+ and MonopolePropagationCK at several fixed step sizes and tolerances, and
+ with MonopoleRadiation in the radiation scenario. Each run reports one JSON
+ object per line: the relative error against the analytic reference at the
+ end of the trajectory, the steps, the run time per trajectory, steps/s and
+ ns/step. Runs that no other run of the scenario beats in both the error and
+ the run time are marked as pareto, the curve to choose the settings from.
+
+ Usage: monopole-bench [--list] [-t <seconds>] [scenario ...]
+ */
+
+#include "CRPropa.h"
+#include "Monopole.h"
+#include "MonopolePropagationBP.h"
+#include "MonopolePropagationCK.h"
+#include "MonopoleRadiation.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace crpropa;
+
+static const double mass = 100 * GeV / c_squared;
+
+// counts the steps and sums the radiated energy of a candidate
+class StepRecorder: public Module {
+public:
+	mutable size_t steps;
+	mutable double radiated;
+	StepRecorder() : steps(0), radiated(0) {
+	}
+	void process(Candidate *candidate) const {
+		steps++;
+		radiated += MCandidate::convertToMCandidate(candidate)->getStepRadiation();
+	}
+};
+
+/** Uniform motion under the force F along b (MacColl 1938): the proper
+ velocity u = p / m grows along b with F / m, its perpendicular part stays.
+ Position after the time t of a particle starting at the origin. */
+static Vector3d uniformForcePosition(const Vector3d &b, double F, double energy,
+		const Vector3d &direction, double t) {
+	double p = sqrt(pow(energy + mass * c_squared, 2) - pow(mass * c_squared, 2)) / c_light;
+	Vector3d u = direction.getUnitVector() * p / mass;
+	double uPar0 = u.dot(b);
+	Vector3d uPerp = u - b * uPar0;
+	double uPar = uPar0 + F / mass * t;
+	double a = sqrt(c_squared + uPerp.getR2());
+	Vector3d x = b * c_light * mass / F * (sqrt(a * a + uPar * uPar) - sqrt(a * a + uPar0 * uPar0));
+	if (uPerp.getR() > 0)
+		x += uPerp * c_light * mass / F * (asinh(uPar / a) - asinh(uPar0 / a));
+	return x;
+}
+
+struct Scenario {
+	ref_ptr<MagneticField> field;
+	int id;
+	double energy; ///< kinetic energy
+	Vector3d position;
+	Vector3d direction;
+	double time; ///< propagation time
+	bool radiation;
+
+	Scenario() : id(4110000), energy(0), position(0.), time(0), radiation(false) {
+	}
+	virtual ~Scenario() {
+	}
+	/** Relative error of the candidate at the end of the trajectory, after
+	 the time t, which exceeds the propagation time if the last fixed step
+	 is not shortened to the maximum trajectory length */
+	virtual double error(const MCandidate &candidate, double t, double radiated) const = 0;
+};
+
+// notebook "Validation 2D": monopole entering a 10 nG field along y against it
+struct Motion2D: public Scenario {
+	Motion2D() {
+		field = new UniformMagneticField(Vector3d(0, 10 * nG, 0));
+		energy = 10 * EeV;
+		direction = Vector3d(0.1, -1, 0).getUnitVector();
+		time = 30 * kpc / c_light;
+	}
+	double error(const MCandidate &candidate, double t, double radiated) const {
+		Vector3d x = uniformForcePosition(Vector3d(0, 1, 0), gD * 10 * nG, energy, direction, t);
+		return (candidate.current.getPosition() - position - x).getR() / x.getR();
+	}
+};
+
+// notebook "Validation Dyon": electric charge 199 gyrating around a 10 nG field along z
+struct Dyon: public Scenario {
+	Dyon() {
+		field = new UniformMagneticField(Vector3d(0, 0, 10 * nG));
+		id = 4110000 + 199 * 10;
+		energy = 0.01 * EeV;
+		double pz = 0.5;
+		double pxy = sqrt((1 - pz * pz) / 2);
+		direction = Vector3d(pxy, pxy, pz);
+		time = 100 * kpc / c_light;
+	}
+	// the motion along the field is that of the uniform force, the
+	// perpendicular momentum and thus the gyration radius are constant
+	double error(const MCandidate &candidate, double t, double radiated) const {
+		Vector3d b(0, 0, 1);
+		double B = 10 * nG, q = 199 * eplus;
+		Vector3d x = uniformForcePosition(b, gD * B, energy, direction, t);
+		double p = sqrt(pow(energy + mass * c_squared, 2) - pow(mass * c_squared, 2)) / c_light;
+		Vector3d dirPerp = direction - b * direction.dot(b);
+		double rg = p * dirPerp.getR() / (q * B);
+		// centre of the gyration, towards the force q v x B
+		Vector3d centre = position + direction.cross(b).getUnitVector() * rg;
+
+		Vector3d r = candidate.current.getPosition();
+		double dz = (r - position).dot(b) - x.dot(b);
+		Vector3d d = r - centre;
+		double dr = (d - b * d.dot(b)).getR() - rg;
+		return sqrt(dz * dz + dr * dr) / std::max(std::abs(x.dot(b)), rg);
+	}
+};
+
+// notebook "Validation for Low Energies": monopole at rest accelerated along a 10 nG field
+struct LowEnergy: public Scenario {
+	LowEnergy() {
+		field = new UniformMagneticField(Vector3d(0, 0, 10 * nG));
+		position = Vector3d(5, 5, 5);
+		direction = Vector3d(0, 0, 1);
+		time = 1 * pc / c_light;
+	}
+	double error(const MCandidate &candidate, double t, double radiated) const {
+		Vector3d x = uniformForcePosition(Vector3d(0, 0, 1), gD * 10 * nG, energy, direction, t);
+		return (candidate.current.getPosition() - position - x).getR() / x.getR();
+	}
+};
+
+// notebook "Validation Linear Radiation": radiation of a monopole accelerated
+// from rest along a 1000 nG field, P = mu0 g^2 F^2 / (6 pi m^2 c^3)
+struct LinearRadiation: public Scenario {
+	LinearRadiation() {
+		field = new UniformMagneticField(Vector3d(0, 0, 1000 * nG));
+		direction = Vector3d(0, 0, 1);
+		time = 10 * kpc / c_light;
+		radiation = true;
+	}
+	double error(const MCandidate &candidate, double t, double radiated) const {
+		double F = gD * 1000 * nG;
+		double P = mu0 * gD * gD * F * F / (6 * M_PI * mass * mass * pow(c_light, 3));
+		return std::abs(radiated - P * t) / (P * t);
+	}
+};
+
+struct Setting {
+	std::string integrator;
+	std::string parameters;
+	ref_ptr<Module> propagation;
+	double initialStep;
+	bool analyticEnergyLoss;
+};
+
+// fixed step sizes and tolerances of both integrators
+static std::vector<Setting> settings(const Scenario &s) {
+	std::vector<Setting> list;
+	double length = s.time * c_light;
+	size_t steps[] = {100, 1000, 10000, 100000};
+	double tolerances[] = {1e-3, 1e-4, 1e-5, 1e-6, 1e-7};
+	for (int k = 0; k < 2; k++) {
+		bool analytic = (k == 1);
+		if (analytic and not s.radiation)
+			continue;
+		std::string suffix = analytic ? ", analytic energy loss" : "";
+		for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+			double step = length / steps[i];
+			std::string p = "fixed step, " + std::to_string(steps[i]) + " steps" + suffix;
+			Setting bp = {"BP", p, new MonopolePropagationBP(s.field, step), step, analytic};
+			Setting ck = {"CK", p, new MonopolePropagationCK(s.field, 1e-4, step, step), step, analytic};
+			list.push_back(bp);
+			list.push_back(ck);
+		}
+		for (size_t i = 0; i < sizeof(tolerances) / sizeof(tolerances[0]); i++) {
+			double minStep = length * 1e-7, maxStep = length / 10;
+			std::stringstream p;
+			p << "tolerance " << tolerances[i] << suffix;
+			Setting bp = {"BP", p.str(), new MonopolePropagationBP(s.field, tolerances[i], minStep, maxStep), maxStep, analytic};
+			Setting ck = {"CK", p.str(), new MonopolePropagationCK(s.field, tolerances[i], minStep, maxStep), maxStep, analytic};
+			list.push_back(bp);
+			list.push_back(ck);
+		}
+	}
+	return list;
+}
+
+struct Result {
+	std::string integrator, parameters;
+	size_t steps;
+	double error;
+	double time; ///< run time per trajectory
+};
+
+static double wallTime() {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// propagates the candidate of the scenario, repeated for at least minTime
+static Result run(const Scenario &s, const Setting &setting, double minTime) {
+	ModuleList modules;
+	modules.add(setting.propagation);
+	modules.add(new MaximumTrajectoryLength(s.time * c_light));
+	if (s.radiation) {
+		// the step is not limited by the energy loss, as in the notebook
+		ref_ptr<MonopoleRadiation> radiation = new MonopoleRadiation(s.field, false, 0, 0, 1);
+		radiation->setAnalyticEnergyLoss(setting.analyticEnergyLoss);
+		modules.add(radiation);
+	}
+	ref_ptr<StepRecorder> recorder = new StepRecorder();
+	modules.add(recorder);
+
+	Result result;
+	result.integrator = setting.integrator;
+	result.parameters = setting.parameters;
+	size_t runs = 0;
+	double start = wallTime(), time = 0;
+	do {
+		recorder->steps = 0;
+		recorder->radiated = 0;
+		ref_ptr<MCandidate> candidate = new MCandidate(s.id, s.energy, s.position,
+				s.direction, mass, gD);
+		candidate->setNextStep(setting.initialStep);
+		modules.run(candidate.get(), false);
+		result.steps = recorder->steps;
+		result.error = s.error(*candidate, candidate->getTrajectoryLength() / c_light, recorder->radiated);
+		runs++;
+		time = wallTime() - start;
+	} while (time < minTime);
+	result.time = time / runs;
+	return result;
+}
+
+typedef Scenario *(*ScenarioSetup)();
+template <typename T>
+static Scenario *create() {
+	return new T();
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, ScenarioSetup> scenarios;
+	scenarios["motion2D"] = create<Motion2D>;
+	scenarios["dyon"] = create<Dyon>;
+	scenarios["lowEnergy"] = create<LowEnergy>;
+	scenarios["linearRadiation"] = create<LinearRadiation>;
+
+	std::vector<std::string> selected;
+	double minTime = 0.1;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--list") == 0) {
+			std::map<std::string, ScenarioSetup>::const_iterator s;
+			for (s = scenarios.begin(); s != scenarios.end(); s++)
+				std::cout << s->first << std::endl;
+			return 0;
+		} else if (std::strcmp(argv[i], "-t") == 0 and i + 1 < argc) {
+			minTime = std::atof(argv[++i]);
+		} else if (scenarios.count(argv[i])) {
+			selected.push_back(argv[i]);
+		} else {
+			std::cerr << "Usage: " << argv[0]
+					<< " [--list] [-t <seconds>] [scenario ...]" << std::endl;
+			return 1;
+		}
+	}
+	if (selected.empty()) {
+		std::map<std::string, ScenarioSetup>::const_iterator s;
+		for (s = scenarios.begin(); s != scenarios.end(); s++)
+			selected.push_back(s->first);
+	}
+
+	for (size_t i = 0; i < selected.size(); i++) {
+		Scenario *s = scenarios[selected[i]]();
+		std::vector<Setting> list = settings(*s);
+		std::vector<Result> results;
+		for (size_t j = 0; j < list.size(); j++)
+			results.push_back(run(*s, list[j], minTime));
+		delete s;
+
+		for (size_t j = 0; j < results.size(); j++) {
+			const Result &r = results[j];
+			bool pareto = true;
+			for (size_t k = 0; k < results.size(); k++) {
+				const Result &o = results[k];
+				if (o.error <= r.error and o.time <= r.time
+						and (o.error < r.error or o.time < r.time))
+					pareto = false;
+			}
+			std::cout << "{\"scenario\": \"" << selected[i] << "\""
+					<< ", \"integrator\": \"" << r.integrator << "\""
+					<< ", \"setting\": \"" << r.parameters << "\""
+					<< ", \"steps\": " << r.steps
+					<< ", \"error\": " << r.error
+					<< ", \"run_time\": " << r.time
+					<< ", \"steps_per_s\": " << r.steps / r.time
+					<< ", \"ns_per_step\": " << r.time / r.steps * 1e9
+					<< ", \"pareto\": " << (pareto ? "true" : "false") << "}" << std::endl;
+		}
+	}
+	return 0;
+}
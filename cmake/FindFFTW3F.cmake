@@ -2,9 +2,11 @@
 # FFTW3F_FOUND = true if fftw3f is found
 # FFTW3F_INCLUDE_DIR = fftw3.h
 # FFTW3F_LIBRARY = libfftw3f.a .so
+# FFTW3F_THREADS_LIBRARY = libfftw3f_omp or libfftw3f_threads, if found
 
 find_path(FFTW3F_INCLUDE_DIR fftw3.h)
 find_library(FFTW3F_LIBRARY fftw3f)
+find_library(FFTW3F_THREADS_LIBRARY NAMES fftw3f_omp fftw3f_threads)
 
 set(FFTW3F_FOUND FALSE)
 if(FFTW3F_INCLUDE_DIR AND FFTW3F_LIBRARY)
@@ -16,5 +18,6 @@ endif()
 
 MESSAGE(STATUS "  Include:     ${FFTW3F_INCLUDE_DIR}")
 MESSAGE(STATUS "  Library:     ${FFTW3F_LIBRARY}")
+MESSAGE(STATUS "  Threads:     ${FFTW3F_THREADS_LIBRARY}")
 
-mark_as_advanced(FFTW3F_INCLUDE_DIR FFTW3F_LIBRARY FFTW3F_FOUND)
+mark_as_advanced(FFTW3F_INCLUDE_DIR FFTW3F_LIBRARY FFTW3F_THREADS_LIBRARY FFTW3F_FOUND)
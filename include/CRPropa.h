@@ -2,35 +2,65 @@
 #ifndef CRPROPA_H
 #define CRPROPA_H
 
+#include "crpropa/AdaptiveThinning.h"
 #include "crpropa/Candidate.h"
+#include "crpropa/CandidateStream.h"
+#include "crpropa/Checkpoint.h"
 #include "crpropa/Common.h"
+#include "crpropa/Configuration.h"
+#include "crpropa/ConvergenceMonitor.h"
 #include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/DistributedModuleList.h"
+#include "crpropa/DomainDecomposition.h"
 #include "crpropa/EmissionMap.h"
 #include "crpropa/Geometry.h"
 #include "crpropa/Grid.h"
+#include "crpropa/CompressedGrid.h"
+#include "crpropa/TiledGrid.h"
 #include "crpropa/GridTools.h"
 #include "crpropa/Logging.h"
+#include "crpropa/LookupTable.h"
 #include "crpropa/Module.h"
 #include "crpropa/ModuleList.h"
+#include "crpropa/MultilevelMonteCarlo.h"
+#include "crpropa/Numa.h"
+#include "crpropa/OutputReader.h"
+#include "crpropa/PageMemory.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/ParticleState.h"
 #include "crpropa/PhotonBackground.h"
 #include "crpropa/PhotonPropagation.h"
+#include "crpropa/PrimaryCostModel.h"
 #include "crpropa/Random.h"
+#include "crpropa/RateBuilder.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/SimdDispatch.h"
+#include "crpropa/ScratchVector.h"
+#include "crpropa/SimdMath.h"
 #include "crpropa/Source.h"
+#include "crpropa/StaticModuleList.h"
+#include "crpropa/TableRegistry.h"
+#include "crpropa/ThreadSlots.h"
+#include "crpropa/TransferMatrix.h"
 #include "crpropa/Units.h"
 #include "crpropa/Variant.h"
 #include "crpropa/Vector3.h"
+#include "crpropa/Vector3Packet.h"
 #include "crpropa/Version.h"
 
 #include "crpropa/module/AdiabaticCooling.h"
 #include "crpropa/module/Acceleration.h"
+#include "crpropa/module/BatchModule.h"
 #include "crpropa/module/Boundary.h"
 #include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/CandidateStreamOutput.h"
+#include "crpropa/module/ContinuousLosses.h"
+#include "crpropa/module/DiffusionEstimator.h"
 #include "crpropa/module/DiffusionSDE.h"
 #include "crpropa/module/EMCascade.h"
+#include "crpropa/module/EMCascadeResponse.h"
 #include "crpropa/module/EMDoublePairProduction.h"
 #include "crpropa/module/EMInverseComptonScattering.h"
 #include "crpropa/module/EMPairProduction.h"
@@ -38,6 +68,9 @@
 #include "crpropa/module/ElasticScattering.h"
 #include "crpropa/module/ElectronPairProduction.h"
 #include "crpropa/module/HDF5Output.h"
+#include "crpropa/module/HistogramOutput.h"
+#include "crpropa/module/ParquetOutput.h"
+#include "crpropa/module/InteractionScheduler.h"
 #include "crpropa/module/NuclearDecay.h"
 #include "crpropa/module/Observer.h"
 #include "crpropa/module/OutputShell.h"
@@ -48,12 +81,19 @@
 #include "crpropa/module/PhotonOutput1D.h"
 #include "crpropa/module/PropagationBP.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationDP.h"
+#include "crpropa/module/PropagationGuidingCenter.h"
+#include "crpropa/module/PropagationHandoff.h"
+#include "crpropa/module/PropagationJump.h"
 #include "crpropa/module/Redshift.h"
 #include "crpropa/module/RestrictToRegion.h"
 #include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/SpectralReweighting.h"
 #include "crpropa/module/SynchrotronRadiation.h"
 #include "crpropa/module/TextOutput.h"
 #include "crpropa/module/Tools.h"
+#include "crpropa/module/TrajectoryRecorder.h"
+#include "crpropa/module/WeightWindow.h"
 
 #include "crpropa/magneticField/AMRMagneticField.h"
 #include "crpropa/magneticField/ArchimedeanSpiralField.h"
@@ -61,15 +101,18 @@
 #include "crpropa/magneticField/JF12FieldSolenoidal.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/OctreeMagneticField.h"
 #include "crpropa/magneticField/PolarizedSingleModeMagneticField.h"
 #include "crpropa/magneticField/PT11Field.h"
 #include "crpropa/magneticField/QuimbyMagneticField.h"
+#include "crpropa/magneticField/TabulatedMagneticField.h"
 #include "crpropa/magneticField/TF17Field.h"
 #include "crpropa/magneticField/CMZField.h"
 #include "crpropa/magneticField/turbulentField/GridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/HelicalGridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 #include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
+#include "crpropa/magneticField/turbulentField/TiledTurbulence.h"
 #include "crpropa/magneticField/turbulentField/TurbulentField.h"
 
 #include "crpropa/advectionField/AdvectionField.h"
@@ -0,0 +1,78 @@
+#ifndef CRPROPA_ADAPTIVETHINNING_H
+#define CRPROPA_ADAPTIVETHINNING_H
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/Vector3.h"
+
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class AdaptiveThinning
+ @brief Thinning of secondaries towards a budget of particles per primary
+
+ Replaces the fixed thinning parameter of the electromagnetic modules, see
+ e.g. EMPairProduction::setAdaptiveThinning. Each candidate carries a budget,
+ the expected number of particles its cascade may still create, stored as
+ candidate property. A primary starts with the full budget. In an interaction
+ the budget is shared in proportion to the energy: a secondary with the
+ fraction f of the energy of its parent gets f times the budget of the parent
+ and a continuing parent keeps the fraction of its remaining energy.
+ Secondaries with a budget b >= 1 are kept with weight 1, the others with the
+ probability b and the weight 1 / b, after which they continue with budget 1.
+
+ Cascades with fewer particles than the budget are not thinned at all,
+ while for larger primary energies the thinning adjusts itself such that
+ about the budget of particles is tracked. The acceptance probability is
+ fixed before the random decision, so that the weights stay unbiased.
+ */
+class AdaptiveThinning: public Referenced {
+private:
+	double budget;
+	PropertyKey budgetKey;
+
+public:
+	/** Constructor
+	 @param budget		number of particles per primary
+	 @param property	name of the candidate property that holds the budget
+	 */
+	AdaptiveThinning(double budget = 1000, const std::string &property = "ThinningBudget");
+
+	void setBudget(double budget);
+	double getBudget() const;
+	/** Budget of the candidate; the full budget if not set yet */
+	double getBudget(const Candidate *candidate) const;
+	void setBudget(Candidate *candidate, double budget) const;
+	/** Set the budget of the secondary that the last addSecondary of the
+	 parent created, also if it is deferred (see Candidate::setSecondaryProperty) */
+	void setSecondaryBudget(Candidate *parent, double budget) const;
+
+	/** Decide on a secondary with the fraction f of the energy of its parent.
+	 @param parent	parent candidate, before its budget is reduced with keep
+	 @param f		energy fraction of the secondary
+	 @param budget	budget of the secondary, if accepted
+	 @return		weight of the secondary, or 0 if it is dropped
+	 */
+	double sample(const Candidate *parent, double f, double &budget) const;
+	/** Add the secondary as Candidate::addSecondary if accepted by sample
+	 @return	true if the secondary is added
+	 */
+	bool addSecondary(Candidate *parent, double f, int id, double energy,
+			const Vector3d &position, const std::string &tag) const;
+	/** addSecondary with the code of the tag (Candidate::getTagCode) */
+	bool addSecondary(Candidate *parent, double f, int id, double energy,
+			const Vector3d &position, uint32_t tag) const;
+	/** Reduce the budget of a parent that continues with the fraction f of its energy */
+	void keep(Candidate *parent, double f) const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_ADAPTIVETHINNING_H
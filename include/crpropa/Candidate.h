@@ -17,40 +17,310 @@ namespace crpropa {
  * @{
  */
 
+class MagneticField;
+class PhotonField;
+
+/**
+ @class CandidatePool
+ @brief Thread-local pool for the memory of Candidate objects.
+
+ Candidates are created and destroyed in large numbers, e.g. for every
+ secondary. The memory of a destroyed Candidate is kept in a free list of the
+ destroying thread and reused for the next Candidate created by that thread,
+ instead of going through the global heap each time. Each thread keeps at
+ most getMaximumSize() blocks, the rest is returned to the system.
+ Only objects of exactly the size of Candidate are pooled; derived classes
+ use the normal heap.
+ */
+class CandidatePool {
+public:
+	struct Statistics {
+		uint64_t allocated; ///< blocks taken from the system heap
+		uint64_t reused; ///< blocks reused from a free list
+		uint64_t recycled; ///< blocks put back into a free list
+		uint64_t released; ///< blocks returned to the system heap
+		uint64_t cached; ///< blocks currently held in the free lists
+	};
+
+	static void *allocate(size_t size);
+	static void deallocate(void *p, size_t size);
+
+	/** Statistics summed over all threads, including finished ones */
+	static Statistics getStatistics();
+	/** Maximum number of free blocks kept per thread, 0 disables the pool (default: 1024) */
+	static void setMaximumSize(size_t n);
+	static size_t getMaximumSize();
+	/** Return the free blocks of the calling thread to the system */
+	static void clear();
+};
+
+/** Handle of a candidate property name, see Candidate::getPropertyKey */
+typedef uint32_t PropertyKey;
+
+/**
+ @class RetainedParticleState
+ @brief Particle state of a candidate that is shared or not kept at all
+
+ Used for Candidate::source and Candidate::created, which are only read by
+ few modules, most prominently the outputs. The state is kept in a
+ reference-counted block that is shared on assignment and copied on the
+ first modification, so that e.g. all candidates of a cascade share the
+ state at the source. If the state is not retained, see
+ Candidate::setStateRetention, assignments and modifications are ignored and
+ reading it throws a runtime_error.
+ */
+class RetainedParticleState {
+	struct Block: public Referenced {
+		ParticleState state;
+		Block(const ParticleState &state) : state(state) {}
+	};
+	ref_ptr<Block> block;
+	unsigned int retention; ///< flag of Candidate::StateRetention that keeps this state
+
+	ParticleState &modify();
+
+public:
+	explicit RetainedParticleState(unsigned int retention);
+	RetainedParticleState(unsigned int retention, const ParticleState &state);
+	RetainedParticleState(const RetainedParticleState &state);
+	/** Assignments keep the retention of this state */
+	RetainedParticleState &operator=(const RetainedParticleState &state);
+	RetainedParticleState &operator=(const ParticleState &state);
+
+	/** True if the state is kept */
+	bool isRetained() const;
+	const ParticleState &get() const;
+	operator const ParticleState &() const;
+
+	void setPosition(const Vector3d &pos);
+	const Vector3d &getPosition() const;
+	void setDirection(const Vector3d &dir);
+	const Vector3d &getDirection() const;
+	void setEnergy(double newEnergy);
+	double getEnergy() const;
+	double getRigidity() const;
+	void setId(int newId);
+	int getId() const;
+	std::string getDescription() const;
+	double getCharge() const;
+	double getMass() const;
+	void setLorentzFactor(double gamma);
+	double getLorentzFactor() const;
+	Vector3d getVelocity() const;
+	Vector3d getMomentum() const;
+};
+
+/**
+ @struct SecondaryRecord
+ @brief Compact secondary of a candidate, see Candidate::setDeferSecondaries
+
+ Holds what addSecondary sets, so that the secondary is only created as a
+ Candidate (Candidate::createSecondary) when it is propagated, or not at
+ all when it is handed to a module as record (Module::processSecondaryRecord).
+ */
+struct SecondaryRecord {
+	ParticleState current; ///< state of the secondary
+	ParticleState previous; ///< previous state of the parent at creation
+	double weight;
+	double redshift;
+	double trajectoryLength;
+	uint32_t tag; ///< tag of origin, see Candidate::getTagCode
+	bool atPosition; ///< created at current.position instead of previous.position
+	bool hasProperty; ///< property set by Candidate::setSecondaryProperty
+	PropertyKey propertyKey;
+	double propertyValue;
+};
+
+/**
+ @class StepQuantities
+ @brief Quantities derived from the current state and redshift of a candidate
+
+ Shared by the interaction modules through Candidate::getStepQuantities
+ instead of being recomputed by each module in every step. The quantities
+ are computed on the first access and kept until the particle id, the
+ energy or the redshift of the candidate change.
+ */
+class StepQuantities {
+public:
+	double redshift2; ///< (1 + z)^2, scaling of the interaction rates per comoving distance
+	double redshift3; ///< (1 + z)^3, scaling of the energy loss rates per comoving distance
+	double energy; ///< E (1 + z), energy in the frame of the photon fields at z = 0
+	double lorentzFactor; ///< Lorentz factor of the current state
+	double lgLorentzFactor; ///< log10(Gamma (1 + z)), Lorentz factor in the frame of the photon fields at z = 0
+	double rigidity; ///< rigidity of the current state, as ParticleState::getRigidity
+
+	StepQuantities();
+	/** Redshift scaling of the photon field at the redshift of the candidate, cached per field */
+	double getRedshiftScaling(const PhotonField *field) const;
+
+private:
+	friend class Candidate;
+	static const int nFields = 4;
+	int id;
+	double E, z; ///< key of the cached values
+	mutable int nFieldsCached;
+	mutable const PhotonField *fields[nFields];
+	mutable double scalings[nFields];
+
+	bool matches(const ParticleState &state, double redshift) const {
+		return (state.getEnergy() == E) and (redshift == z) and (state.getId() == id);
+	}
+	void update(const ParticleState &state, double redshift);
+};
+
+/**
+ @class InteractionRateCache
+ @brief Interaction rates of a candidate, kept per module within tolerances
+
+ Used by StochasticInteraction::getCachedInteractionRate. The rate of a
+ module is reused while the particle id is the same and the energy and the
+ redshift stay within the tolerances around those of its computation.
+ */
+class InteractionRateCache {
+public:
+	InteractionRateCache();
+	/** Cached rate of the owner, false if none or out of the tolerances */
+	bool find(const void *owner, const ParticleState &state, double redshift,
+			double &rate) const;
+	/** Keep the rate of the owner, valid within lgTolerance in log10(E) and zTolerance in z */
+	void store(const void *owner, const ParticleState &state, double redshift,
+			double rate, double lgTolerance, double zTolerance);
+	/** Drop all rates */
+	void clear();
+
+private:
+	static const int nRates = 8;
+	struct Entry {
+		const void *owner;
+		int id;
+		double Emin, Emax, zmin, zmax;
+		double rate;
+	};
+	int nCached;
+	int next; ///< entry replaced next when all are in use
+	Entry entries[nRates];
+};
+
+/**
+ @struct CandidateCost
+ @brief Cost of the propagation of a candidate, see Candidate::setCostAccounting
+ */
+struct CandidateCost {
+	uint64_t steps; ///< steps, i.e. calls of ModuleList::process
+	uint64_t fieldEvaluations; ///< evaluations of the magnetic field by the propagation
+	uint64_t rejectedSteps; ///< steps tried again by an adaptive step size control
+	uint64_t secondaries; ///< secondaries created
+	double time; ///< wall time of the steps in seconds
+
+	CandidateCost();
+	CandidateCost &operator+=(const CandidateCost &cost);
+};
+
 /**
  @class Candidate Candidate.h include/crpropa/Candidate.h
  @brief All information about the cosmic ray.
  The Candidate is a passive object, that holds the information about the state
  of the cosmic ray and the simulation itself.
+
+ The members read and written in every step (the current and previous
+ state, the step sizes, weight, redshift and the step quantities) come
+ first, so that a step touches a contiguous block behind the reference
+ count; the states at the source and creation, the secondaries, properties
+ and serial numbers follow. The interaction rate cache is allocated on its
+ first use, see getRateCache.
  */
 class Candidate: public Referenced {
 public:
-	ParticleState source; /**< Particle state at the source */
-	ParticleState created; /**< Particle state of parent particle at the time of creation */
 	ParticleState current; /**< Current particle state */
 	ParticleState previous; /**< Particle state at the end of the previous step */
 
+private:
+	bool active; /**< Active status */
+	bool detached; /**< Parent released, its serial numbers are kept, see detachParent */
+	uint32_t tagOrigin; /**< Code of the interaction/source process which created this candidate, see getTagCode */
+	double weight; /**< Weight of the candidate */
+	double redshift; /**< Current simulation time-point in terms of redshift z */
+	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
+	double currentStep; /**< Size of the currently performed step in [m] comoving units */
+	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
+	mutable StepQuantities stepQuantities; /**< Cache of getStepQuantities */
+
+public:
+	RetainedParticleState source; /**< Particle state at the source */
+	RetainedParticleState created; /**< Particle state of parent particle at the time of creation */
+
 	std::vector<ref_ptr<Candidate> > secondaries; /**< Secondary particles from interactions */
+	std::vector<SecondaryRecord> deferredSecondaries; /**< Secondaries not yet created as candidates, see setDeferSecondaries */
 
 	typedef Loki::AssocVector<std::string, Variant> PropertyMap;
-	PropertyMap properties; /**< Map of property names and their values. */
+	PropertyMap properties; /**< Map of property names and their values, for names without a PropertyKey. */
 
 	/** Parent candidate. 0 if no parent (initial particle). Must not be a ref_ptr to prevent circular referencing. */
 	Candidate *parent;
 
 private:
-	bool active; /**< Active status */
-	double weight; /**< Weight of the candidate */
-	double redshift; /**< Current simulation time-point in terms of redshift z */
-	double trajectoryLength; /**< Comoving distance [m] the candidate has traveled so far */
-	double currentStep; /**< Size of the currently performed step in [m] comoving units */
-	double nextStep; /**< Proposed size of the next propagation step in [m] comoving units */
-	std::string tagOrigin; /**< Name of interaction/source process which created this candidate*/
+	struct PropertySlots: public Referenced {
+		std::vector<Variant> values;
+	};
+	/** Values of the properties with a PropertyKey, indexed by key. Shared
+	 by clones and copied on the first modification, 0 if none was set. */
+	ref_ptr<PropertySlots> propertySlots;
+
+	/** InteractionRateCache allocated on the first access; a copy of the
+	 candidate starts with an empty cache */
+	class LazyRateCache {
+		mutable InteractionRateCache *cache;
+	public:
+		LazyRateCache() : cache(0) {
+		}
+		LazyRateCache(const LazyRateCache &) : cache(0) {
+		}
+		LazyRateCache &operator=(const LazyRateCache &) {
+			if (cache)
+				cache->clear();
+			return *this;
+		}
+		~LazyRateCache() {
+			delete cache;
+		}
+		InteractionRateCache &get() const {
+			if (not cache)
+				cache = new InteractionRateCache();
+			return *cache;
+		}
+	};
+	LazyRateCache rateCache; /**< Cache of getRateCache */
 
 	static uint64_t nextSerialNumber;
+	static uint64_t serialNumberBlockSize;
 	uint64_t serialNumber;
+	uint64_t sourceSerialNumber, createdSerialNumber; /**< Serial numbers of a detached parent */
+	static unsigned int stateRetention;
+	static bool deferSecondaries;
+	static double secondaryThreshold;
+	static std::map<int, double> secondaryThresholds;
+	static bool droppedEnergyEnabled;
+	static PropertyKey droppedEnergyKey;
+	static double secondaryMerging;
+	static bool costAccounting;
+	static void addThreadCost(uint64_t fieldEvaluations, uint64_t rejectedSteps);
+
+	std::vector<Variant> &modifyPropertySlots();
+	bool dropSecondary(int id, double energy, double w);
+	void deferSecondary(int id, double energy, const Vector3d &position,
+			bool atPosition, double length, double w, uint32_t tagOrigin);
+	bool mergeSecondary(int id, double energy, const Vector3d &position,
+			bool atPosition, double length, double w, uint32_t tagOrigin);
 
 public:
+	/** States kept in addition to Candidate::current and Candidate::previous */
+	enum StateRetention {
+		RetainNone = 0,
+		RetainSource = 1, ///< Candidate::source
+		RetainCreated = 2, ///< Candidate::created
+		RetainAll = RetainSource | RetainCreated
+	};
+
 	Candidate(
 		int id = 0,
 		double energy = 0,
@@ -67,6 +337,12 @@ public:
 	 */
 	Candidate(const ParticleState &state);
 
+	/**
+	 Creates a candidate from the state with a given serial number, e.g. one
+	 of a range obtained with reserveSerialNumbers.
+	 */
+	Candidate(const ParticleState &state, uint64_t serialNumber);
+
 	bool isActive() const;
 	void setActive(bool b);
 
@@ -76,6 +352,21 @@ public:
 	void setRedshift(double z);
 	double getRedshift() const;
 
+	/**
+	 Quantities derived from the current state and the redshift, computed
+	 once per change of the id, energy or redshift.
+	 */
+	const StepQuantities &getStepQuantities() const {
+		if (not stepQuantities.matches(current, redshift))
+			stepQuantities.update(current, redshift);
+		return stepQuantities;
+	}
+
+	/** Interaction rates of the modules, see StochasticInteraction::setRateTolerance */
+	InteractionRateCache &getRateCache() const {
+		return rateCache.get();
+	}
+
 	/**
 	 Sets weight of each candidate.
 	 Weights are calculated for each tracked secondary.
@@ -91,6 +382,21 @@ public:
 	void setCurrentStep(double step);
 	double getCurrentStep() const;
 
+	/**
+	 Position at a fraction of the current step, from the cubic Hermite
+	 interpolation of the previous and current positions and directions.
+	 It is exact for straight lines and of third order for curved steps,
+	 without field evaluations, see Surface::getStepCrossing.
+	 */
+	Vector3d interpolatePosition(double fraction) const;
+	/**
+	 Move the current state back to a fraction of the current step: the
+	 position and direction of the interpolation, the energy linear between
+	 the previous and current state. The current step and the trajectory
+	 length are shortened accordingly; the redshift is kept.
+	 */
+	void interpolateStep(double fraction);
+
 	/**
 	 Sets the proposed next step.
 	 Only the propagation module should use this.
@@ -101,19 +407,69 @@ public:
 	/**
 	 Sets the tagOrigin of the candidate. Can be used to trace back the interactions
 	 */
-	void setTagOrigin(std::string tagOrigin);
-	std::string getTagOrigin() const;
+	void setTagOrigin(const std::string &tagOrigin);
+	const std::string &getTagOrigin() const;
+	/** Tag of origin as code of getTagCode, without string handling */
+	void setTagOriginCode(uint32_t code);
+	uint32_t getTagOriginCode() const;
 
 	/**
 	 Make a bid for the next step size: the lowest wins.
 	 */
 	void limitNextStep(double step);
 
+	/**
+	 Attribution of the next step to the module that bid it, see
+	 StepLimiterProfiler. While a thread has StepBids set, setNextStep and
+	 limitNextStep, when their bid becomes the next step, copy the bidder
+	 to the winner.
+	 */
+	struct StepBids {
+		int bidder; ///< set by the caller before each module
+		int winner; ///< bidder of the next step so far, -1 for none
+	};
+	/** Set the step bids of the calling thread, 0 to stop the attribution
+	 @returns	the previous step bids of the thread
+	 */
+	static StepBids *setStepBids(StepBids *bids);
+
+	/**
+	 Magnetic field shared by the modules of a step. A module that evaluates
+	 a field at the current position, e.g. PropagationDP with the last stage
+	 of its step or SynchrotronRadiation, stores the value with setStepField;
+	 the other modules of the step and the propagator at the start of the
+	 next step take it with getStepField instead of evaluating the field
+	 again. Each thread keeps one value, for one candidate, field object,
+	 position and redshift. ModuleList::run drops it for each new primary,
+	 call clearStepField after changing a field in between.
+	 @returns	true if the value for the given arguments was found
+	 */
+	bool getStepField(const MagneticField *field, const Vector3d &position,
+			double z, Vector3d &B) const;
+	void setStepField(const MagneticField *field, const Vector3d &position,
+			double z, const Vector3d &B) const;
+	static void clearStepField();
+
 	void setProperty(const std::string &name, const Variant &value);
 	const Variant &getProperty(const std::string &name) const;
 	bool removeProperty(const std::string &name);
 	bool hasProperty(const std::string &name) const;
 
+	/**
+	 Handle of a property name for fast access.
+	 The name is registered once (thread-safe); afterwards the property is
+	 kept in a slot of the candidate instead of the string-keyed map, also
+	 when it is accessed by name.
+	 */
+	static PropertyKey getPropertyKey(const std::string &name);
+	static const std::string &getPropertyName(PropertyKey key);
+	void setProperty(PropertyKey key, const Variant &value);
+	const Variant &getProperty(PropertyKey key) const;
+	bool removeProperty(PropertyKey key);
+	bool hasProperty(PropertyKey key) const;
+	/** All properties by name, including those with a PropertyKey */
+	PropertyMap getProperties() const;
+
 	/**
 	 Add a new candidate to the list of secondaries.
 	 @param c Candidate
@@ -125,24 +481,62 @@ public:
 	void addSecondary(Candidate *c);
 	inline void addSecondary(ref_ptr<Candidate> c) { addSecondary(c.get()); };
 	/**
-	 Add a new candidate to the list of secondaries.
+	 Add a new candidate to the list of secondaries, unless it is below the
+	 secondary threshold (see setSecondaryThreshold).
 	 @param id			particle ID of the secondary
 	 @param energy		energy of the secondary
 	 @param w			weight of the secondary
 	 @param tagOrigin 	tag of the secondary
+	 @returns			true if the secondary is added
 	 */
-	void addSecondary(int id, double energy, double w = 1., std::string tagOrigin = "SEC");
+	bool addSecondary(int id, double energy, double w = 1., const std::string &tagOrigin = "SEC");
 	/**
-	 Add a new candidate to the list of secondaries.
+	 Add a new candidate to the list of secondaries, unless it is below the
+	 secondary threshold (see setSecondaryThreshold).
 	 @param id			particle ID of the secondary
 	 @param energy		energy of the secondary
 	 @param position	start position of the secondary
 	 @param w			weight of the secondary
 	 @param tagOrigin 	tag of the secondary
+	 @returns			true if the secondary is added
 	 */
-	void addSecondary(int id, double energy, Vector3d position, double w = 1., std::string tagOrigin = "SEC");
+	bool addSecondary(int id, double energy, Vector3d position, double w = 1., const std::string &tagOrigin = "SEC");
+	/** addSecondary with the code of the tag (getTagCode), e.g. registered
+	 once by the interaction module */
+	bool addSecondary(int id, double energy, double w, uint32_t tagOrigin);
+	bool addSecondary(int id, double energy, const Vector3d &position, double w, uint32_t tagOrigin);
+	/** Set a property of the secondary that the last successful
+	 addSecondary(id, energy, ...) created or merged into, also if it is
+	 deferred, e.g. the budget of AdaptiveThinning. A deferred secondary
+	 holds one such property, the last one set. */
+	void setSecondaryProperty(PropertyKey key, double value);
+	/** Remove the secondaries and the deferred secondaries */
 	void clearSecondaries();
 
+	/** Let addSecondary(id, energy, ...) store a SecondaryRecord in
+	 Candidate::deferredSecondaries instead of creating a candidate
+	 (default: false). ModuleList::run creates the candidates when it
+	 propagates the secondaries, or hands the records of selected particle
+	 ids to a module (ModuleList::setSecondaryRecordModule), e.g. to write
+	 neutrinos without creating candidates. Modules that read the
+	 secondaries right after an interaction have to call
+	 materializeSecondaries first. Set it before the simulation.
+	 */
+	static void setDeferSecondaries(bool defer);
+	static bool getDeferSecondaries();
+	/** Candidate of a deferred secondary of this candidate, with the same
+	 states as if it had been created by addSecondary */
+	ref_ptr<Candidate> createSecondary(const SecondaryRecord &record);
+	/** Create the deferred secondaries as candidates in Candidate::secondaries */
+	void materializeSecondaries();
+	/** Code of a tag of origin, registered on first use. The codes are
+	 small integers, counted from 0 in the order of registration, and only
+	 valid within the process; outputs write the names of getTagNames. */
+	static uint32_t getTagCode(const std::string &tag);
+	static const std::string &getTagName(uint32_t code);
+	/** Names of the registered tags, indexed by their code */
+	static std::vector<std::string> getTagNames();
+
 	std::string getDescription() const;
 
 	/** Unique (inside process) serial number (id) of candidate */
@@ -155,23 +549,162 @@ public:
 	/** Serial number of candidate at creation */
 	uint64_t getCreatedSerialNumber() const;
 
+	/** Keep the source and created serial numbers and set the parent to 0,
+	 so that the candidate no longer depends on its parent being alive.
+	 */
+	void detachParent();
+
 	/** Set the next serial number to use */
 	static void setNextSerialNumber(uint64_t snr);
 
-	/** Get the next serial number that will be assigned */
+	/** Get the last serial number reserved from the global counter.
+	 With serial number blocks, the threads still assign the numbers of their
+	 current blocks below it. */
 	static uint64_t getNextSerialNumber();
 
+	/** Reserve n consecutive serial numbers with a single atomic operation
+	 @returns	the first of the reserved serial numbers
+	 */
+	static uint64_t reserveSerialNumbers(uint64_t n);
+
+	/** Serial number for a new candidate, as used by the constructors.
+	 Each thread takes its numbers from a block of serial number block size
+	 consecutive numbers, which it reserves from the global counter when the
+	 block is used up, so that creating candidates does not contend for the
+	 counter. The numbers are unique, but their order depends on the threads.
+	 */
+	static uint64_t newSerialNumber();
+
+	/** Number of serial numbers each thread reserves at once (default: 2^16).
+	 1 reserves each number separately, so that they follow the order of
+	 creation over all threads, as without blocks.
+	 Set it before the simulation, not during, as for setNextSerialNumber.
+	 */
+	static void setSerialNumberBlockSize(uint64_t size);
+	static uint64_t getSerialNumberBlockSize();
+
+	/** Set the states that new candidates keep (default: RetainAll).
+	 Not retaining Candidate::created, which is a separate copy for each
+	 secondary, reduces the memory of large cascades. The outputs check that
+	 the states of their columns are retained.
+	 @param states	combination of StateRetention flags
+	 */
+	static void setStateRetention(unsigned int states);
+	static unsigned int getStateRetention();
+
+	/** Minimum energy of the secondaries that addSecondary(id, energy, ...)
+	 creates, for all particles (default: 0). Secondaries below the threshold
+	 are not created at all, instead of being created and rejected by a
+	 break condition in their first step, see MinimumEnergy::applyToSecondaries.
+	 The thresholds are read without locking and have to be set before the run.
+	 */
+	static void setSecondaryThreshold(double energy);
+	/** Threshold for one particle id, replaces the one for all particles */
+	static void setSecondaryThreshold(int id, double energy);
+	static double getSecondaryThreshold(int id);
+	static void clearSecondaryThresholds();
+	/** True if addSecondary would drop the secondary; for modules that can
+	 skip the preparation of such secondaries */
+	static bool isBelowSecondaryThreshold(int id, double energy);
+	/** Sum the energy times the relative weight of the dropped secondaries
+	 in a property of the parent (default: disabled)
+	 @param name	name of the property, disabled if empty
+	 */
+	static void setDroppedEnergyProperty(const std::string &name);
+
+	/** Merge the secondaries that addSecondary(id, energy, ...) creates in
+	 the same step with the same particle id and tag of origin into one
+	 macro-particle if their energies are in the same logarithmic bin
+	 (default: 0, no merging). The macro-particle has the sum of the weights,
+	 the weighted mean of the energies, so that the energy times the weight
+	 is conserved, and the weighted mean of the positions and trajectory
+	 lengths on the step. The merged secondary is moved to the end of the
+	 secondaries. As the thresholds, it has to be set before the run.
+	 @param binsPerDecade	energy bins per decade, 0 for no merging
+	 */
+	static void setSecondaryMerging(double binsPerDecade);
+	static double getSecondaryMerging();
+
+	/** Count the cost of each candidate (default: false): ModuleList::run
+	 adds the steps, their wall time, the secondaries created and the field
+	 evaluations and rejected steps counted by the propagation modules to
+	 the candidate after each step, and the cost of each finished secondary
+	 to the tree cost of its parent. The cost is kept in the properties
+	 CostSteps, CostFieldEvaluations, CostRejectedSteps, CostSecondaries and
+	 CostTime, which the outputs write with Output::enableCost; a row has
+	 the cost of the steps before the one in which it is written.
+	 Set it before the simulation.
+	 */
+	static void setCostAccounting(bool enable);
+	static bool getCostAccounting();
+	/** Count field evaluations or rejected steps for the candidate that
+	 the calling thread propagates; called by the propagation modules */
+	static void countFieldEvaluations(uint64_t n) {
+		if (costAccounting)
+			addThreadCost(n, 0);
+	}
+	static void countRejectedSteps(uint64_t n) {
+		if (costAccounting)
+			addThreadCost(0, n);
+	}
+	/** Field evaluations and rejected steps counted by the calling thread
+	 since the last call, which resets them */
+	static CandidateCost takeThreadCost();
+	/** Cost of this candidate without its secondaries */
+	CandidateCost getCost() const;
+	void addCost(const CandidateCost &cost);
+	/** Cost of this candidate and its secondaries that have finished,
+	 including theirs, i.e. of the whole tree after ModuleList::run */
+	CandidateCost getTreeCost() const;
+	/** Add the tree cost of a finished secondary */
+	void addSecondaryCost(const CandidateCost &cost);
+
 	/**
-	 Create an exact clone of candidate
+	 Create an exact clone of candidate. The clone shares the source and
+	 created states and the values of the properties with a PropertyKey with
+	 the candidate until either of them modifies them, so that e.g. the
+	 clones of detected candidates cost no deep copy of the properties.
 	 @param recursive	recursively clone and add the secondaries
 	 */
 	ref_ptr<Candidate> clone(bool recursive = false) const;
 
+	/**
+	 Append the candidate to a buffer, e.g. to send it to another process:
+	 its states, serial numbers, weight, redshift, trajectory length, steps,
+	 tag, active status and properties, but neither the parent nor the
+	 secondaries. The bytes are in the byte order of the machine.
+	 */
+	void pack(std::vector<char> &buffer) const;
+	/**
+	 Candidate from the bytes of pack at p, which is advanced behind them.
+	 The candidate keeps the serial numbers of its parent as by detachParent.
+	 @param end	end of the buffer, a runtime_error is thrown if it is reached
+	 */
+	static ref_ptr<Candidate> unpack(const char *&p, const char *end);
+
+	/**
+	 Count the references of this candidate and its secondaries atomically
+	 again, so that they can be handed to other threads, see
+	 Referenced::setThreadConfined. Only if ModuleList::setThreadConfined(true)
+	 is set, ModuleList::run confines the candidates from a source to the
+	 thread propagating them; their secondaries and clones inherit it. Modules that keep or share candidates, like the
+	 ParticleCollector, call this first.
+	 */
+	void makeShared();
+
 	/**
 	 Copy the source particle state to the current state
 	 and activate it if inactive, e.g. restart it
 	*/
 	void restart();
+
+	/** Memory of the candidate in bytes, including its property values and
+	 the lists of its secondaries, but not the secondaries themselves */
+	size_t getSizeOf() const;
+
+	/** Memory of candidates is managed by the CandidatePool */
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
 };
 
 /** @}*/
@@ -0,0 +1,133 @@
+#ifndef CRPROPA_CANDIDATESTREAM_H
+#define CRPROPA_CANDIDATESTREAM_H
+
+#include "crpropa/Source.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @struct CandidateStreamState
+ @brief Particle state in a candidate stream file
+ */
+struct CandidateStreamState {
+	int32_t id;
+	uint32_t padding;
+	double energy;
+	double position[3];
+	double direction[3];
+};
+
+/**
+ @struct CandidateStreamValue
+ @brief Property of a candidate in a candidate stream file
+ */
+struct CandidateStreamValue {
+	uint32_t type; ///< Variant::Type, TYPE_NONE if the candidate has no such property
+	uint32_t padding;
+	char data[8]; ///< the value as by Variant::copyToBuffer
+};
+
+/**
+ @struct CandidateStreamRecord
+ @brief Candidate in a candidate stream file
+
+ A candidate stream file (see CandidateStreamOutput and SourceFromFile)
+ starts with the magic "CRPCAN01", the number of properties (uint32, and
+ uint32 0) and their names (uint32 length and characters each, padded with
+ zeros to a multiple of 8 bytes). Then follow the records of fixed size: a
+ CandidateStreamRecord and one CandidateStreamValue per property. The
+ footer, written on close, holds the names of the tags (uint32 number, then
+ uint32 length and characters each), the number of records (uint64), the
+ offset of the footer (uint64) and the magic "CRPCANEN". All numbers are in
+ the byte order of the machine.
+ */
+struct CandidateStreamRecord {
+	enum Flags {
+		SourceRetained = 1, CreatedRetained = 2
+	};
+	uint64_t serialNumber;
+	uint64_t sourceSerialNumber;
+	uint64_t createdSerialNumber;
+	double weight;
+	double redshift;
+	double trajectoryLength;
+	uint32_t tag; ///< index into the tag names of the file
+	uint32_t flags; ///< combination of Flags
+	CandidateStreamState source;
+	CandidateStreamState created;
+	CandidateStreamState previous;
+	CandidateStreamState current;
+};
+
+/** Magic numbers at the begin and the end of a candidate stream file */
+extern const char candidateStreamMagic[8];
+extern const char candidateStreamEndMagic[8];
+
+/** @}*/
+
+/** @addtogroup SourceFeatures
+ *  @{
+ */
+
+/**
+ @class SourceFromFile
+ @brief Source of the candidates of candidate stream files
+
+ Reads the files of a CandidateStreamOutput, e.g. the candidates of a first
+ simulation stage at its boundary, to start the next stage with them. Each
+ candidate is created with the recorded source, created, previous and
+ current state, weight, redshift, trajectory length, tag and properties;
+ only the serial numbers are new (a state that was not retained is the
+ current state). The files are mapped into memory instead of being read, so
+ that the candidates are streamed from the disk as they are used.
+
+ The candidates are handed out in the order of the files and records, one
+ at a time to the threads (the assignment of the records to the primary
+ indices of ModuleList::run hence depends on the threads). Run count =
+ getCount() candidates; asking for more throws a runtime_error.
+ */
+class SourceFromFile: public SourceInterface {
+	struct File;
+	std::vector<File *> files;
+	std::vector<size_t> firsts; ///< index of the first candidate of each file, and the total
+	mutable size_t next;
+
+	ref_ptr<Candidate> read(size_t i) const;
+
+	SourceFromFile(const SourceFromFile &);
+	SourceFromFile &operator=(const SourceFromFile &);
+public:
+	SourceFromFile();
+	/** Constructor
+	 @param filename	file written by a CandidateStreamOutput
+	 */
+	SourceFromFile(const std::string &filename);
+	~SourceFromFile();
+	/** Append the candidates of a file */
+	void add(const std::string &filename);
+	ref_ptr<Candidate> getCandidate() const;
+	/** Append the next n candidates, fewer (and null pointers) at the end */
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const;
+	/** Number of candidates in all files */
+	size_t getCount() const;
+	/** Number of candidates handed out so far */
+	size_t getPosition() const;
+	/** Start again with the first candidate */
+	void rewind();
+	std::string getDescription() const;
+};
+
+/**  @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_CANDIDATESTREAM_H
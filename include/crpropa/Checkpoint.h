@@ -0,0 +1,90 @@
+#ifndef CRPROPA_CHECKPOINT_H
+#define CRPROPA_CHECKPOINT_H
+
+#include "crpropa/Referenced.h"
+#include "crpropa/module/Output.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class Checkpoint
+ @brief Periodic checkpoints of ModuleList::run(source, count) for restarts.
+
+ With a checkpoint, ModuleList::run processes the primaries in batches of
+ getInterval() and after each batch writes the index of the next primary,
+ the seed of the random streams and the offsets of the registered outputs
+ to the checkpoint file. No candidates are in flight at this point, and as
+ every primary uses its own random stream (Random::seedStreams), a primary
+ interrupted later is repeated bit by bit after a restart.
+
+ To restart a run, the same script is executed again: if the checkpoint
+ file exists, the Checkpoint has to be created before the outputs, which
+ then continue their files after the last checkpoint (data written after
+ it is discarded), and the run continues with the next primary.
+ The last checkpoint of a run that processed all primaries is marked as
+ completed; executing the script again then starts a new run, which
+ overwrites the outputs instead of resuming after the last primary.
+ Supported outputs are TextOutput to uncompressed files and HDF5Output.
+ */
+class Checkpoint: public Referenced {
+private:
+	struct OutputState {
+		std::string filename;
+		size_t offset; ///< size of the output at the checkpoint (bytes or rows)
+		size_t count; ///< number of candidates written to the output
+	};
+
+	std::string filename;
+	size_t interval;
+	bool restart;
+	uint64_t seed;
+	size_t nextPrimary;
+	std::vector<ref_ptr<Output> > outputs;
+
+	bool load();
+
+public:
+	/** Constructor
+	 @param filename	checkpoint file, loaded if it exists
+	 @param interval	number of primaries between checkpoints
+	 */
+	Checkpoint(const std::string &filename, size_t interval = 100000);
+
+	/** Register an output whose position is saved with the checkpoint */
+	void add(Output *output);
+	void setInterval(size_t interval);
+	size_t getInterval() const;
+	/** True if the checkpoint was loaded from an interrupted run */
+	bool isRestart() const;
+	/** Index of the first primary to process */
+	size_t getNextPrimary() const;
+	/** Seed of the random streams of the run */
+	uint64_t getSeed() const;
+
+	/** Enable the random streams of the run, called by ModuleList::run */
+	void begin();
+	/** Flush the outputs and write the checkpoint
+	 @param nextPrimary	index of the first primary not processed yet
+	 @param completed	true after the last primary of the run, so that the
+	 					checkpoint is not resumed
+	 */
+	void save(size_t nextPrimary, bool completed = false);
+
+	/** Position of an output file in the checkpoint loaded last.
+	 Used by the outputs to continue a file, false if the file is unknown.
+	 */
+	static bool getRestart(const std::string &filename, size_t &offset, size_t &count);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CHECKPOINT_H
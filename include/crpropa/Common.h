@@ -17,9 +17,31 @@ namespace crpropa {
 // Returns the full path to a CRPropa data file
 std::string getDataPath(std::string filename);
 
+// Adds a directory that getDataPath searches before the data directory,
+// e.g. for the tables of RateBuilder
+void addDataPath(const std::string &path);
+
 // Returns the install prefix
 std::string getInstallPrefix();
 
+// Returns the peak resident memory of the process in bytes, 0 if unknown
+size_t getPeakResidentMemory();
+
+// Returns the memory in bytes allocated for the elements of a vector
+template <typename T>
+size_t vectorSizeOf(const std::vector<T> &v) {
+	return sizeof(T) * v.capacity();
+}
+
+// Returns the memory in bytes allocated for a vector of vectors and their elements
+template <typename T>
+size_t vectorSizeOf(const std::vector<std::vector<T> > &v) {
+	size_t size = sizeof(v[0]) * v.capacity();
+	for (size_t i = 0; i < v.size(); i++)
+		size += vectorSizeOf(v[i]);
+	return size;
+}
+
 // Returns a certain digit from a given integer
 inline int digit(const int& value, const int& d) {
 	return (value % (d * 10)) / d;
@@ -0,0 +1,113 @@
+#ifndef CRPROPA_COMPRESSEDGRID_H
+#define CRPROPA_COMPRESSEDGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace crpropa {
+
+/** Encoding of the values of a CompressedGrid3f.
+If set to FLOAT16, the values are stored as IEEE half precision floats (11 bit mantissa)
+If set to QUANTIZED_INT16, the values are stored as 16 bit integers (15 bit resolution of the largest value of a brick) */
+enum gridEncoding {
+  FLOAT16 = 0,
+  QUANTIZED_INT16
+};
+
+/** IEEE half precision of a float, rounded to nearest even */
+uint16_t floatToHalf(float f);
+
+/** Float of an IEEE half precision value */
+float halfToFloat(uint16_t h);
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class CompressedGrid3f
+ @brief Vector grid with 16 bit values, for grids that do not fit into memory as Grid3f
+
+ The values are stored in bricks of 8 x 8 x 8 grid points, as the BRICKED layout
+ of Grid, with 2 bytes per component instead of 4. The values of each brick are
+ divided by the largest absolute component in it, so that the encoding covers
+ any unit. The values are decoded on the fly in the interpolation, with F16C if
+ available. See GridTools::compressGrid and GridTools::rmsCompressionError.
+ */
+class CompressedGrid3f: public Referenced {
+	size_t Nx, Ny, Nz; /**< Number of grid points */
+	size_t nBricksY, nBricksZ; /**< Number of bricks along y and z */
+	Vector3d origin; /**< Origin of the volume that is represented by the grid. */
+	Vector3d gridOrigin; /**< Grid origin */
+	Vector3d spacing; /**< Distance between grid points, determines the extension of the grid */
+	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
+	interpolationType ipolType; /**< Type of interpolation between the grid points */
+	gridEncoding encoding;
+	std::vector<uint16_t> values; /**< Three components per grid point, brick by brick */
+	std::vector<float> scales; /**< Factor to decode the values, per brick */
+
+public:
+	/** Constructor
+	 @param grid		vector grid to compress, in any layout
+	 @param encoding	encoding of the values (FLOAT16, QUANTIZED_INT16)
+	 */
+	CompressedGrid3f(const Grid3f &grid, gridEncoding encoding = FLOAT16);
+
+	/** Decoded value of a grid point */
+	Vector3f get(size_t ix, size_t iy, size_t iz) const {
+		size_t b, i;
+		locate(ix, iy, iz, b, i);
+		return decode(i, scales[b]);
+	}
+
+	/** Interpolate with the interpolation type, see Grid::interpolate */
+	Vector3f interpolate(const Vector3d &position) const;
+
+	void setReflective(bool b);
+	void setInterpolationType(interpolationType ipolType);
+
+	Vector3d getOrigin() const;
+	Vector3d getSpacing() const;
+	size_t getNx() const;
+	size_t getNy() const;
+	size_t getNz() const;
+	bool isReflective() const;
+	gridEncoding getEncoding() const;
+
+	/** Calculates the total size of the grid in bytes */
+	size_t getSizeOf() const;
+
+private:
+	/** Brick and index of the first component of a grid point */
+	void locate(size_t ix, size_t iy, size_t iz, size_t &brick, size_t &index) const {
+		brick = ((ix >> 3) * nBricksY + (iy >> 3)) * nBricksZ + (iz >> 3);
+		index = 3 * (brick * 512 + (ix & 7) * 64 + (iy & 7) * 8 + (iz & 7));
+	}
+
+	Vector3f decode(size_t i, float scale) const {
+		if (encoding == QUANTIZED_INT16)
+			return Vector3f(int16_t(values[i]), int16_t(values[i + 1]), int16_t(values[i + 2])) * scale;
+		#if defined(HAVE_SIMD) && defined(__F16C__)
+		// the fourth half is the next component or the padding at the end
+		__m128 v = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*) &values[i]));
+		float f[4];
+		_mm_storeu_ps(f, _mm_mul_ps(v, _mm_set1_ps(scale)));
+		return Vector3f(f[0], f[1], f[2]);
+		#else
+		return Vector3f(halfToFloat(values[i]), halfToFloat(values[i + 1]), halfToFloat(values[i + 2])) * scale;
+		#endif // HAVE_SIMD && __F16C__
+	}
+
+	Vector3f closestValue(const Vector3d &position) const;
+	Vector3f trilinearInterpolate(const Vector3d &position) const;
+	Vector3f tricubicInterpolate(const Vector3d &position) const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_COMPRESSEDGRID_H
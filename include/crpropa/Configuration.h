@@ -0,0 +1,218 @@
+#ifndef CRPROPA_CONFIGURATION_H
+#define CRPROPA_CONFIGURATION_H
+
+#include "crpropa/Checkpoint.h"
+#include "crpropa/DistributedModuleList.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/PhotonBackground.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/Source.h"
+#include "crpropa/Vector3.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/Observer.h"
+#include "crpropa/module/Output.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ConfigValue
+ @brief Value of a JSON configuration file: null, bool, number, string, array or object.
+
+ Comments from '#' to the end of the line are allowed outside of strings.
+ Numbers can be given as strings with a unit of crpropa/Units.h, e.g.
+ "10 EeV", "1.5 kpc" or "1 nG", which asDouble converts to SI units.
+ Errors name the path of the value in the file, e.g. modules[2].maxStep.
+ */
+class ConfigValue {
+public:
+	enum Type {
+		Null, Bool, Number, String, Array, Object
+	};
+
+private:
+	Type type;
+	bool boolean;
+	double number;
+	std::string string;
+	std::vector<ConfigValue> elements; ///< elements of an array, values of an object
+	std::vector<std::string> keys; ///< keys of an object, in the order of the file
+	std::string path;
+
+	friend class ConfigParser;
+
+public:
+	ConfigValue();
+	/** Parse a JSON text, throws std::runtime_error on syntax errors */
+	static ConfigValue parse(const std::string &text);
+	/** Parse a JSON file */
+	static ConfigValue load(const std::string &filename);
+
+	Type getType() const;
+	bool isNull() const;
+	bool isArray() const;
+	bool isObject() const;
+	/** Path of the value in the file, e.g. modules[2].maxStep */
+	const std::string &getPath() const;
+
+	/** Number of elements of an array or object, 0 otherwise */
+	size_t size() const;
+	/** True if the object has the key */
+	bool has(const std::string &key) const;
+	/** Value of the key of an object, throws if it is missing */
+	const ConfigValue &operator[](const std::string &key) const;
+	/** Element of an array */
+	const ConfigValue &operator[](size_t i) const;
+	/** Keys of an object, in the order of the file */
+	const std::vector<std::string> &getKeys() const;
+
+	bool asBool() const;
+	/** Number, or string of a number and a unit, in SI units */
+	double asDouble() const;
+	int asInt() const;
+	size_t asSize() const;
+	std::string asString() const;
+	/** Array of three numbers, each possibly with a unit */
+	Vector3d asVector3d() const;
+
+	/** Value of the key, or the default if the key is missing */
+	bool getBool(const std::string &key, bool defaultValue) const;
+	double getDouble(const std::string &key, double defaultValue) const;
+	int getInt(const std::string &key, int defaultValue) const;
+	size_t getSize(const std::string &key, size_t defaultValue) const;
+	std::string getString(const std::string &key, const std::string &defaultValue) const;
+	Vector3d getVector3d(const std::string &key, const Vector3d &defaultValue) const;
+
+	/** Compact JSON text of the value, which parse reads back; keys keep
+	 their order, numbers are written with 17 digits */
+	std::string toJSON() const;
+
+	/** Throw a std::runtime_error with the path of the value */
+	void error(const std::string &message) const;
+
+	/** Value in SI units of a unit of crpropa/Units.h, e.g. "EeV" */
+	static double unit(const std::string &name);
+};
+
+/**
+ @class SimulationConfig
+ @brief Simulation built from a JSON configuration file, see crpropa-run.
+
+ The file has the sections
+ - "simulation": count, seed, recursive, secondariesFirst, showProgress,
+   threads, dataPath, secondaryTasks, streamSecondaries, sourceBatchSize;
+   "checkpoint": {"file", "interval"} for Checkpoint restarts and
+   "distributed": {"chunkSize"} for a DistributedModuleList over MPI ranks;
+ - "fields": named magnetic fields, e.g. {"gmf": {"type": "JF12Field"}};
+ - "outputs": named outputs, e.g. {"events": {"type": "TextOutput",
+   "file": "events.txt", "columns": "Event3D"}};
+ - "source": list of source features, e.g. [{"type": "SourceEnergy",
+   "energy": "10 EeV"}];
+ - "modules": list of modules, e.g. [{"type": "PropagationCK",
+   "field": "gmf"}, {"type": "Observer", "features": [...],
+   "output": "events"}].
+ Each entry names its class in "type" and its constructor arguments by
+ the names of the parameters, which default as in the constructor.
+ Photon fields are given by class name, e.g. "photonField": "CMB".
+ Conditions take "onReject" and "onAccept" with the name of an output.
+ PropagationHandoff takes the wrapped "propagation" module and a "region",
+ a sphere {"center", "radius"} or a box {"corner", "size"}.
+
+ A MagneticFieldGrid with "N" and "spacing" reads its "file" with loadGrid;
+ with only a "file" written by dumpMappedGrid it maps the file instead.
+
+ The configuration (getConfig().toJSON()) describes the whole simulation,
+ so that worker processes, e.g. of Python multiprocessing, rebuild it from
+ the text instead of receiving the objects; in Python SimulationConfig is
+ pickled this way. The workers share the pages of the mapped grids and of
+ the binary caches of the data tables (DataTable), and so rebuild the
+ simulation without reading the data again. Each worker opens the files of
+ its outputs, which should therefore differ between the workers.
+
+ Further classes, e.g. of plugins, are added with the register functions.
+ With a checkpoint, the checkpoint is created before the outputs, which
+ continue their files on a restart. In distributed runs each rank writes
+ the shards DistributedModuleList::shardFilename of the output files,
+ which run merges at the end.
+ */
+class SimulationConfig: public Referenced {
+public:
+	typedef Module *(*ModuleFactory)(const ConfigValue &config, SimulationConfig &simulation);
+	typedef MagneticField *(*FieldFactory)(const ConfigValue &config, SimulationConfig &simulation);
+	typedef SourceFeature *(*SourceFeatureFactory)(const ConfigValue &config, SimulationConfig &simulation);
+	typedef ObserverFeature *(*ObserverFeatureFactory)(const ConfigValue &config, SimulationConfig &simulation);
+	typedef PhotonField *(*PhotonFieldFactory)();
+
+private:
+	struct OutputEntry {
+		ref_ptr<Output> output;
+		std::string type;
+		std::string filename;
+	};
+
+	ConfigValue config;
+	ref_ptr<ModuleList> modules;
+	ref_ptr<DistributedModuleList> distributed;
+	ref_ptr<Source> source;
+	ref_ptr<Checkpoint> checkpoint;
+	std::map<std::string, ref_ptr<MagneticField> > fields;
+	std::map<std::string, OutputEntry> outputs;
+	size_t count;
+	bool recursive, secondariesFirst;
+
+	void build();
+	void buildSimulation(const ConfigValue &simulation);
+	void buildFields(const ConfigValue &section);
+	void buildOutputs(const ConfigValue &section);
+	void buildSource(const ConfigValue &section);
+	void buildModules(const ConfigValue &section);
+
+public:
+	/** Build the simulation from a parsed configuration */
+	SimulationConfig(const ConfigValue &config);
+	/** Build the simulation from a JSON file */
+	SimulationConfig(const std::string &filename);
+
+	ModuleList *getModuleList() const;
+	Source *getSource() const;
+	Checkpoint *getCheckpoint() const;
+	/** Number of primaries of run */
+	size_t getCount() const;
+	bool isDistributed() const;
+	const ConfigValue &getConfig() const;
+
+	/** Magnetic field of the "fields" section, or built in place if the
+	 value is an object; throws if the name is unknown */
+	ref_ptr<MagneticField> getField(const ConfigValue &value);
+	/** Output of the "outputs" section; throws if the name is unknown */
+	ref_ptr<Output> getOutput(const std::string &name) const;
+	/** Photon field given by its class name */
+	ref_ptr<PhotonField> getPhotonField(const ConfigValue &value) const;
+	/** Module built from its configuration, e.g. for containers of modules */
+	ref_ptr<Module> createModule(const ConfigValue &value);
+
+	/** Run the primaries of the source, then close the outputs and merge
+	 the shards of distributed runs */
+	void run();
+
+	static void registerModule(const std::string &type, ModuleFactory factory);
+	static void registerField(const std::string &type, FieldFactory factory);
+	static void registerSourceFeature(const std::string &type, SourceFeatureFactory factory);
+	static void registerObserverFeature(const std::string &type, ObserverFeatureFactory factory);
+	static void registerPhotonField(const std::string &type, PhotonFieldFactory factory);
+	/** Registered types of the given kind: "modules", "fields", "source",
+	 "observer" or "photonFields" */
+	static std::vector<std::string> getTypes(const std::string &kind);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CONFIGURATION_H
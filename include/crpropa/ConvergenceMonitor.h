@@ -0,0 +1,136 @@
+#ifndef CRPROPA_CONVERGENCEMONITOR_H
+#define CRPROPA_CONVERGENCEMONITOR_H
+
+#include "crpropa/Module.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ConvergenceMonitor
+ @brief Statistics of observables during a run, stops it at a target precision
+
+ The monitor is called for the candidates that are observed, e.g. as the
+ detection module of an Observer, and estimates the observables from their
+ weights:
+ - the detection fraction and spectrum bins: weighted number of observed
+   candidates (in the energy range) per primary,
+ - composition moments: weighted mean of (ln A)^order of the observed nuclei.
+
+ With ModuleList::setConvergenceMonitor, run(source, count) processes the
+ primaries in batches of getBatchSize() and calls endBatch after each batch.
+ The uncertainties are estimated from the batch means (ratio estimator), and
+ the run stops once the relative uncertainty of every observable is below
+ the target, after at least getMinBatches() batches. Otherwise
+ getRemainingPrimaries projects the primaries still needed, assuming that the
+ uncertainties decrease with 1 / sqrt(primaries).
+ ~~~
+ ref_ptr<ConvergenceMonitor> monitor = new ConvergenceMonitor(0.01);
+ monitor->addDetectionFraction();
+ monitor->addSpectrum(1 * EeV, 100 * EeV, 4);
+ observer->onDetection(monitor);
+ sim->setConvergenceMonitor(monitor);
+ sim->run(source, 100000000);
+ ~~~
+ */
+class ConvergenceMonitor: public Module {
+public:
+	enum ObservableType {
+		DetectionFraction, SpectrumBin, CompositionMoment
+	};
+
+private:
+	struct Observable {
+		ObservableType type;
+		double energyMin, energyMax;
+		int order;
+		std::vector<double> numerator; ///< sum of each batch
+		std::vector<double> denominator; ///< primaries or weight of each batch
+	};
+	struct ThreadSums {
+		std::vector<double> sums; ///< numerators of the current batch
+		double nucleusWeight; ///< weight of the nuclei of the current batch
+		ThreadSums() : nucleusWeight(0) {
+		}
+	};
+
+	std::vector<Observable> observables;
+	mutable std::vector<ThreadSums> threadSums;
+	mutable ThreadSums sharedSums; ///< sums of the threads beyond threadSums
+	double targetUncertainty;
+	size_t batchSize;
+	size_t minBatches;
+	size_t primaries;
+
+	size_t addObservable(ObservableType type, double energyMin, double energyMax, int order);
+	void record(Candidate *candidate, ThreadSums &sums) const;
+
+public:
+	/** Constructor
+	 @param targetUncertainty	target relative uncertainty of all observables
+	 @param batchSize			primaries per batch in ModuleList::run
+	 */
+	ConvergenceMonitor(double targetUncertainty = 0.01, size_t batchSize = 10000);
+
+	/** Add the weighted number of observed candidates per primary
+	 @returns index of the observable */
+	size_t addDetectionFraction();
+	/** Add the weighted number of observed candidates per primary with
+	 energyMin <= E < energyMax
+	 @returns index of the observable */
+	size_t addSpectrumBin(double energyMin, double energyMax);
+	/** Add nBins logarithmic spectrum bins between energyMin and energyMax
+	 @returns index of the first bin */
+	size_t addSpectrum(double energyMin, double energyMax, size_t nBins);
+	/** Add the weighted mean of (ln A)^order of the observed nuclei
+	 @returns index of the observable */
+	size_t addCompositionMoment(int order);
+
+	/** Target relative uncertainty of all observables */
+	void setTargetUncertainty(double targetUncertainty);
+	double getTargetUncertainty() const;
+	void setBatchSize(size_t batchSize);
+	size_t getBatchSize() const;
+	/** Minimum number of batches before the run can stop (default 10) */
+	void setMinBatches(size_t minBatches);
+	size_t getMinBatches() const;
+
+	void process(Candidate *candidate) const;
+	/** Close the batch of candidates observed since the last call.
+	 Called by ModuleList::run when no candidates are in flight.
+	 @param primaries	number of primaries of the batch
+	 */
+	void endBatch(size_t primaries);
+	/** Discard all statistics, the observables are kept */
+	void reset();
+
+	/** Number of observables */
+	size_t size() const;
+	ObservableType getType(size_t i) const;
+	/** Estimate of observable i */
+	double getValue(size_t i) const;
+	/** Absolute uncertainty of observable i, infinite for less than 2 batches */
+	double getUncertainty(size_t i) const;
+	/** Relative uncertainty of observable i, infinite for a value of 0 */
+	double getRelativeUncertainty(size_t i) const;
+	/** Number of primaries of all batches */
+	size_t getPrimaries() const;
+	size_t getBatches() const;
+	/** True if all observables reached the target after the minimum batches */
+	bool isConverged() const;
+	/** Projected number of further primaries to reach the target, 0 if
+	 converged, the maximum of size_t if an observable is still 0 */
+	size_t getRemainingPrimaries() const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CONVERGENCEMONITOR_H
@@ -19,9 +19,22 @@ namespace crpropa {
  */
 void setCosmologyParameters(double hubbleParameter, double omegaMatter);
 
+/**
+ Set the cosmological parameters for a possibly curved universe with the
+ dark energy equation of state w(a) = w0 + wa * (1 - a), omegaK = 1 - omegaM - omegaL
+ @param hubbleParameter	dimensionless Hubble parameter
+ @param omegaMatter		matter parameter
+ @param omegaLambda		dark energy parameter
+ @param w0				equation of state of the dark energy today, -1 for a cosmological constant
+ @param wa				evolution of the equation of state
+ */
+void setCosmologyParameters(double hubbleParameter, double omegaMatter,
+		double omegaLambda, double w0 = -1, double wa = 0);
+
 /**
  Hubble rate at given redshift
- H(z) = H0 * sqrt(omegaM * (1 + z)^3 + omegaL)
+ H(z) = H0 * sqrt(omegaM * (1 + z)^3 + omegaK * (1 + z)^2
+ 	+ omegaL * (1 + z)^(3 (1 + w0 + wa)) * exp(-3 wa z / (1 + z)))
  */
 double hubbleRate(double redshift = 0);
 
@@ -34,6 +47,18 @@ double omegaM();
 // Returns the hubble parameter
 double H0();
 
+// Returns the curvature parameter 1 - omegaM - omegaL
+double omegaK();
+
+// Returns the dark energy equation of state today
+double darkEnergyW0();
+
+// Returns the evolution of the dark energy equation of state
+double darkEnergyWa();
+
+// Returns the maximum redshift of the distance conversions
+double redshiftRange();
+
 /**
  Redshift of a comoving object at a given comoving distance to an observer at z = 0.
  d_comoving(z) = c/H0 * int_0^z dz' / E(z')
@@ -48,7 +73,8 @@ double redshift2ComovingDistance(double redshift);
 
 /**
  Redshift of a comoving object at a given luminosity distance to an observer at z = 0.
- d_luminosity(z) = (1 + z) * d_comoving(z)
+ d_luminosity(z) = (1 + z) * d_transverse(z), where the transverse comoving
+ distance equals d_comoving(z) in a flat universe
  */
 double luminosityDistance2Redshift(double distance);
 
@@ -0,0 +1,102 @@
+#ifndef CRPROPA_DATATABLE_H
+#define CRPROPA_DATATABLE_H
+
+#include "crpropa/PageMemory.h"
+#include "crpropa/Referenced.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class DataTable
+ @brief Numeric table read from a text data file with a binary cache.
+
+ The text file is interpreted as rows of whitespace separated numbers, one
+ row per line. Empty lines and lines starting with '#' are skipped.
+ On first use, a binary copy of the table is written next to the text file
+ (filename + ".bin"). Later loads map this copy read-only into memory, which
+ avoids parsing the text and lets all processes on a node share the same
+ pages. The text file remains the reference: the cache is rebuilt if the size
+ or modification time of the text file changed. If the cache cannot be
+ written (e.g. read-only data directory) the parsed values are used directly.
+ With setHugePages, tables of at least one huge page are copied to memory in
+ huge pages instead (the shared file mapping cannot use them), which reduces
+ the TLB misses of the interpolation lookups.
+ */
+class DataTable: public Referenced {
+private:
+	void *mapping; ///< memory-mapped cache file, 0 if not mapped
+	size_t mappingSize;
+	std::vector<uint64_t> ownOffsets; ///< row offsets if the table is not mapped
+	std::vector<double> ownValues; ///< values if the table is not mapped
+	ref_ptr<PageMemory> pages; ///< offsets and values if copied to huge pages
+
+	const uint64_t *offsets; ///< offsets[i] ... offsets[i+1] are the values of row i
+	const double *values;
+	size_t nRows;
+
+	static bool cacheEnabled;
+	static bool hugePages;
+
+	void unmap();
+	bool mapCache(const std::string &cachename, uint64_t textSize, int64_t textTime);
+	void writeCache(const std::string &cachename, uint64_t textSize, int64_t textTime) const;
+	bool parse(const std::string &filename);
+	void copyToHugePages();
+
+public:
+	DataTable();
+	~DataTable();
+
+	/** Load a table, via the binary cache if possible.
+	 @param filename	path of the text data file
+	 @returns false if the text file could not be read
+	 */
+	bool load(const std::string &filename);
+
+	/** The table of the file shared by all users in the process, see
+	 TableRegistry. Use this instead of load for tables that are read only.
+	 @returns invalid if the text file could not be read
+	 */
+	static ref_ptr<const DataTable> acquire(const std::string &filename);
+
+	/** Number of rows */
+	size_t size() const;
+	/** Number of values in row i */
+	size_t columns(size_t i) const;
+	/** Pointer to the values of row i */
+	const double *row(size_t i) const;
+	/** Pointer to the values of row i; throws a runtime_error if the row has
+	 fewer than minColumns values */
+	const double *row(size_t i, size_t minColumns) const;
+	/** Value j of row i */
+	double get(size_t i, size_t j) const;
+	/** True if the values are read from a memory-mapped cache file */
+	bool isMapped() const;
+	/** Size of the pages holding the values in bytes, see PageMemory::getPageSize */
+	size_t getPageSize() const;
+	/** Memory of the offsets and values in bytes, including the mapped cache
+	 file, whose pages the processes of a node share */
+	size_t getSizeOf() const;
+
+	/** Enable or disable reading and writing of the binary cache (default: enabled) */
+	static void setCacheEnabled(bool enabled);
+	static bool isCacheEnabled();
+	/** Copy large tables to huge pages when they are loaded (default: disabled) */
+	static void setHugePages(bool enabled);
+	static bool getHugePages();
+	/** Name of the cache file that belongs to the text file */
+	static std::string cacheFilename(const std::string &filename);
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_DATATABLE_H
@@ -0,0 +1,111 @@
+#ifndef CRPROPA_DISTRIBUTEDMODULELIST_H
+#define CRPROPA_DISTRIBUTEDMODULELIST_H
+
+#include "crpropa/DomainDecomposition.h"
+#include "crpropa/ModuleList.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace crpropa {
+
+/**
+ @class DistributedModuleList
+ @brief ModuleList that distributes the primaries of a run over MPI ranks.
+
+ The primaries 0 ... count-1 are handed out in chunks on demand: whenever a
+ thread of any rank has finished its chunk, it fetches the next one from a
+ counter held by rank 0 (MPI one-sided fetch-and-add). A rank that is busy
+ with long cascades thus takes fewer chunks and no rank waits for a fixed
+ share of the others. Each primary uses its own random stream
+ (Random::seedStreams), so the results do not depend on the distribution.
+
+ With a DomainDecomposition (setDomainDecomposition) the ranks instead
+ divide the volume: each candidate is propagated by the rank whose box
+ contains it, which only needs the field of its box and halo (see
+ DomainMagneticField). Rank r draws the primaries r, r + size, ... and sends
+ those outside of its box to their rank. A module added to the end of the
+ list for the run limits the steps to DomainDecomposition::getReach() and
+ deactivates the candidates that have left the box; after each batch of
+ chunk size candidates they are sent to the rank of their new box in one
+ message per rank, without waiting for the delivery, and continue there
+ with their secondaries propagated where they were created. The run ends
+ when all ranks are idle and all sent candidates were received, which the
+ ranks check in rounds of non-blocking reductions of the numbers of sent and
+ received candidates (two rounds with the same sums). The migrated
+ candidates use random streams that depend on the order of the messages,
+ so the results of a domain run are not reproducible in detail.
+
+ Output modules should write one file per rank (shardFilename), which can
+ be joined after the run with mergeTextShards or mergeHDF5Shards.
+ Without MPI support (CRPROPA_HAVE_MPI) the run is done by the single process.
+ */
+class DistributedModuleList: public ModuleList {
+private:
+	size_t chunkSize;
+	uint64_t seed;
+	bool seedSet;
+	size_t processed;
+	size_t migrated;
+	ref_ptr<DomainDecomposition> domain;
+
+	void runChunks(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst);
+	void runDomains(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst);
+
+public:
+	/** Constructor
+	 @param chunkSize	number of primaries fetched at once by a thread
+	 */
+	DistributedModuleList(size_t chunkSize = 100);
+
+	void setChunkSize(size_t chunkSize);
+	size_t getChunkSize() const;
+	/** Run seed of the random streams. If not set, rank 0 draws one and
+	 broadcasts it to all ranks. */
+	void setSeed(uint64_t seed);
+
+	using ModuleList::run;
+	/** Run the simulation for count candidates from the given source,
+	 distributed over all ranks. Has to be called by all ranks. */
+	void run(SourceInterface *source, size_t count, bool recursive = true, bool secondariesFirst = false);
+	/** Number of primaries processed by this rank in the last run, in
+	 domain mode of primaries and received candidates */
+	size_t getProcessed() const;
+
+	/** Propagate each candidate on the rank whose box of the decomposition
+	 contains it, NULL to distribute the primaries in chunks again */
+	void setDomainDecomposition(ref_ptr<DomainDecomposition> domain);
+	ref_ptr<DomainDecomposition> getDomainDecomposition() const;
+	/** Number of candidates sent to other ranks by this rank in the last run */
+	size_t getMigrated() const;
+
+	std::string getDescription() const;
+
+	/** Rank of this process and number of processes; MPI is initialized if necessary */
+	static int getRank();
+	static int getSize();
+	/** Name of the output file of this rank: filename.rank */
+	static std::string shardFilename(const std::string &filename);
+	/** Join the text output shards of all ranks into filename. The header of
+	 the first shard is kept. Has to be called by all ranks after the
+	 outputs were closed.
+	 @param filename		name of the merged file, as passed to shardFilename
+	 @param removeShards	delete the shards after merging
+	 */
+	static void mergeTextShards(const std::string &filename, bool removeShards = true);
+	/** Join the HDF5Output shards of all ranks into filename. With parallel
+	 HDF5 all ranks write their rows into the merged dataset with collective
+	 MPI-IO, otherwise rank 0 appends the shards one after another. Layout,
+	 filters and attributes are those of the first shard; the tag codes of
+	 each shard are translated to the TagNames of the merged file, which
+	 holds the tags of all shards. Has to be called by
+	 all ranks after the outputs were closed. Requires CRPROPA_HAVE_HDF5.
+	 @param filename		name of the merged file, as passed to shardFilename
+	 @param removeShards	delete the shards after merging
+	 */
+	static void mergeHDF5Shards(const std::string &filename, bool removeShards = true);
+};
+
+} // namespace crpropa
+
+#endif // CRPROPA_DISTRIBUTEDMODULELIST_H
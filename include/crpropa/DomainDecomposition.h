@@ -0,0 +1,123 @@
+#ifndef CRPROPA_DOMAINDECOMPOSITION_H
+#define CRPROPA_DOMAINDECOMPOSITION_H
+
+#include "crpropa/Grid.h"
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <string>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class DomainDecomposition
+ @brief Division of a periodic grid into one box per MPI rank
+
+ The grid points are divided into px * py * pz boxes of nearly the same
+ size, with the number of ranks = px * py * pz chosen such that the boxes
+ have the smallest surface. Each rank holds the values of its box and of
+ a halo of grid points around it (getLocalGridProperties), so that a field
+ too large for the memory of one process is spread over the ranks.
+ With DistributedModuleList::setDomainDecomposition each candidate is
+ propagated by the rank whose box contains it and migrates to the next
+ rank when it leaves the box.
+
+ The halo has to cover the interpolation of the field for all positions
+ that a step starting in the box reaches: the steps are limited to
+ getReach(), which is the halo minus the grid points the interpolation
+ needs beyond the cell of a position (one for trilinear, two for tricubic
+ interpolation).
+ */
+class DomainDecomposition: public Referenced {
+	GridProperties properties;
+	size_t halo;
+	int ranks, rank;
+	size_t N[3];
+	size_t division[3];
+	size_t localBegin[3], localEnd[3];
+
+	/** First grid point of part i along an axis */
+	size_t begin(int axis, size_t i) const;
+public:
+	/** Constructor
+	 @param properties	of the whole grid, which has to be periodic
+	 @param halo		grid points around the box of each rank
+	 @param ranks		number of ranks, -1 for DistributedModuleList::getSize()
+	 @param rank		rank of this process, -1 for DistributedModuleList::getRank()
+	 */
+	DomainDecomposition(const GridProperties &properties, size_t halo = 2,
+			int ranks = -1, int rank = -1);
+
+	int getRanks() const;
+	int getRank() const;
+	size_t getHalo() const;
+	/** Number of boxes along an axis (0, 1, 2) */
+	size_t getDivision(int axis) const;
+	/** Maximum step length that keeps the field of a step from the box
+	 inside the halo */
+	double getReach() const;
+
+	/** Rank of the box that contains the position, periodically repeated */
+	int getRank(const Vector3d &position) const;
+	/** True if the box of this rank contains the position */
+	bool isLocal(const Vector3d &position) const;
+	/** Lower and upper corner of the box of this rank */
+	Vector3d getLocalMin() const;
+	Vector3d getLocalMax() const;
+	/** Position of the periodic image closest to the box of this rank */
+	Vector3d getLocalImage(const Vector3d &position) const;
+
+	/** Properties of the grid of this rank: its box and the halo */
+	GridProperties getLocalGridProperties() const;
+	/** Copy the values of the grid of this rank from the whole grid */
+	ref_ptr<Grid3f> extractLocalGrid(ref_ptr<Grid3f> grid) const;
+	/** Grid of this rank from a file written by dumpMappedGrid. The file is
+	 mapped into memory, so only the pages of the box and the halo are read.
+	 The values are in the unit of the file, see MagneticFieldGrid. */
+	ref_ptr<Grid3f> loadLocalGrid(const std::string &filename) const;
+
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class DomainMagneticField
+ @brief Magnetic field of the grid of one rank of a DomainDecomposition
+
+ Interpolates the grid of this rank (DomainDecomposition::extractLocalGrid
+ or loadLocalGrid) at the periodic image of a position closest to the box
+ of the rank. Positions whose interpolation needs grid points outside of
+ the halo throw a runtime_error.
+ */
+class DomainMagneticField: public MagneticField {
+	ref_ptr<DomainDecomposition> domain;
+	ref_ptr<Grid3f> grid;
+	double scale;
+	Vector3d lower, upper; ///< covered positions
+public:
+	/** Constructor
+	 @param domain	decomposition of the whole grid
+	 @param grid	grid of this rank, with the local grid properties
+	 @param scale	factor of the interpolated values, e.g. the unit of the file
+	 */
+	DomainMagneticField(ref_ptr<DomainDecomposition> domain,
+			ref_ptr<Grid3f> grid, double scale = 1);
+	ref_ptr<Grid3f> getGrid();
+	Vector3d getField(const Vector3d &position) const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_DOMAINDECOMPOSITION_H
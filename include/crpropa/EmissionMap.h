@@ -3,20 +3,27 @@
 
 #include "Referenced.h"
 #include "Candidate.h"
+#include "Random.h"
 
 namespace crpropa {
 
 /**
  @class CylindricalProjectionMap
  @brief 2D histogram of spherical coordinates in equal-area projection
+
+ After freeze the map can not be filled any more and directions are drawn
+ from an alias table (AliasSampler) in constant time, without modifying the
+ map, so that any number of threads can draw concurrently.
  */
 class CylindricalProjectionMap : public Referenced {
 private:
 	size_t nPhi, nTheta;
 	double sPhi, sTheta;
 	mutable bool dirty;
+	bool frozen;
 	std::vector<double> pdf;
 	mutable std::vector<double> cdf;
+	AliasSampler sampler;
 
 	/** Calculate the cdf from the pdf */
 	void updateCdf() const;
@@ -41,19 +48,30 @@ public:
 	/** Check if the direction has a non zero propabiliy. */
 	bool checkDirection(const Vector3d &direction) const;
 
+	/** Probability per solid angle of the direction, normalized over the
+	 sphere; zero for an empty map */
+	double getDensity(const Vector3d &direction) const;
+
+	/** Build the alias table and make the map immutable */
+	void freeze();
+	bool isFrozen() const;
+
 	const std::vector<double>& getPdf() const;
 	std::vector<double>& getPdf();
 
 	const std::vector<double>& getCdf() const;
 
-	size_t getNPhi();
-	size_t getNTheta();
+	size_t getNPhi() const;
+	size_t getNTheta() const;
 
 	/** Calculate the bin from a direction */
 	size_t binFromDirection(const Vector3d& direction) const;
 
 	/** Calculate a random vector inside the bin boundaries */
 	Vector3d directionFromBin(size_t bin) const;
+
+	/** Memory of the pdf, cdf and alias table in bytes */
+	size_t getSizeOf() const;
 };
 
 /**
@@ -61,6 +79,11 @@ public:
  @brief Particle Type and energy binned emission maps.
 
  Use SourceEmissionMap to suppress directions at the source. Use EmissionMapFiller to create EmissionMap from Observer.
+
+ Within parallel regions each thread fills its own maps, which are added to
+ the maps on the next access outside of the parallel region. Fills and draws
+ should thus not be mixed in one parallel region. Call freeze after filling to
+ draw lock-free from alias tables, e.g. with SourceEmissionMap in a second run.
  */
 class EmissionMap : public Referenced {
 public:
@@ -109,26 +132,50 @@ public:
 	bool checkDirection(const ParticleState& state) const;
 
 	/** Check if a valid map exists */
-	bool hasMap(int pid, double energy);
+	bool hasMap(int pid, double energy) const;
+
+	/** Probability per solid angle of the direction in the map for the
+	 particle type and energy, zero if there is no map */
+	double getDensity(int pid, double energy, const Vector3d& direction) const;
 
 	/** Get the map for the specified pid and energy */
 	ref_ptr<CylindricalProjectionMap> getMap(int pid, double energy);
 
 	/** Save the content of the maps into a text file */
 	void save(const std::string &filename);
-	/** Load the content of the maps from a text file */
+	/** Save the content of the maps into a binary file, which is exact and
+	 more compact than the text file */
+	void saveBinary(const std::string &filename);
+	/** Load the content of the maps from a text or binary file */
 	void load(const std::string &filename);
 
+	/** Add the maps filled by the threads and make all maps immutable,
+	 see CylindricalProjectionMap::freeze */
+	void freeze();
+	bool isFrozen() const;
+
 	/** Merge other maps, add pdfs */
 	void merge(const EmissionMap *other);
 
 	/** Merge maps from file */
 	void merge(const std::string &filename);
 
+	/** Memory of the maps in bytes, including those of the threads that
+	 are not yet merged. Has to be called outside of parallel regions. */
+	size_t getSizeOf() const;
+
 protected:
 	double minEnergy, maxEnergy, logStep;
 	size_t nPhi, nTheta, nEnergy;
 	map_t maps;
+	bool frozen;
+	mutable std::vector<map_t> threadMaps; ///< maps filled by the threads in parallel regions
+	mutable bool threadMapsFilled;
+
+	void initThreadMaps();
+	/** Add the maps of the threads; outside of parallel regions only */
+	void reduce() const;
+	static void addMap(map_t &maps, const key_t &key, const CylindricalProjectionMap &map);
 };
 
 } // namespace crpropa
@@ -32,6 +32,31 @@ public:
 	 @param point	vector corresponding to the point to which compute the normal vector
 	 */
 	virtual Vector3d normal(const Vector3d& point) const = 0;
+	/** Axis-aligned box that contains the surface, e.g. for spatial indices.
+	 Returns false for unbounded surfaces.
+	 @param lower	output: lower corner of the box
+	 @param upper	output: upper corner of the box
+	 */
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const {return false;};
+	/** Distance along a straight line to its first crossing of the surface,
+	 e.g. for rectilinear jumps. Returns infinity if the line does not cross
+	 it. The default marches along the line with steps of the distance to
+	 the surface, which has to be a lower bound of the distance to the
+	 closest point, and may return a shorter distance without crossing if
+	 it does not converge within maxDistance.
+	 @param point		start of the line
+	 @param direction	unit vector of the line
+	 @param maxDistance	length of the line
+	 */
+	virtual double rayDistance(const Vector3d &point, const Vector3d &direction,
+			double maxDistance) const;
+	/** Fraction of the current step of the candidate at which its trajectory,
+	 interpolated with Candidate::interpolatePosition, first leaves the side
+	 of the surface of the previous position, found by bisection to 1e-12 of
+	 the step. The point at the fraction is just behind the surface.
+	 Returns 1 if the current position is on the same side.
+	 */
+	double getStepCrossing(const Candidate *candidate) const;
 	virtual std::string getDescription() const {return "Surface without description.";};
 };
 
@@ -48,6 +73,8 @@ public:
 	Plane(const Vector3d& x0, const Vector3d& n);
 	virtual double distance(const Vector3d &x) const;
 	virtual Vector3d normal(const Vector3d& point) const;
+	virtual double rayDistance(const Vector3d &point, const Vector3d &direction,
+			double maxDistance) const;
 	virtual std::string getDescription() const;
 };
 
@@ -64,6 +91,9 @@ public:
 	Sphere(const Vector3d& center, double radius);
 	virtual double distance(const Vector3d &point) const;
 	virtual Vector3d normal(const Vector3d& point) const;
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
+	virtual double rayDistance(const Vector3d &point, const Vector3d &direction,
+			double maxDistance) const;
 	virtual std::string getDescription() const;
 };
 
@@ -79,6 +109,9 @@ public:
 	ParaxialBox(const Vector3d& corner, const Vector3d& size);
 	virtual double distance(const Vector3d &point) const;
 	virtual Vector3d normal(const Vector3d& point) const;
+	virtual bool getBounds(Vector3d &lower, Vector3d &upper) const;
+	virtual double rayDistance(const Vector3d &point, const Vector3d &direction,
+			double maxDistance) const;
 	virtual std::string getDescription() const;
 };
 
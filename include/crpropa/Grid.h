@@ -1,14 +1,20 @@
 #ifndef CRPROPA_GRID_H
 #define CRPROPA_GRID_H
 
+#include "crpropa/PageMemory.h"
 #include "crpropa/Referenced.h"
+#include "crpropa/SimdDispatch.h"
 #include "crpropa/Vector3.h"
 
 #include "kiss/string.h"
 #include "kiss/logger.h"
 
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
 #include <vector>
 #include <type_traits>
+#include <stdint.h>
 #if HAVE_SIMD
 #include <immintrin.h>
 #include <smmintrin.h>
@@ -18,11 +24,23 @@ namespace crpropa {
 
 /** If set to TRILINEAR, use trilinear interpolation (standard)
 If set to TRICUBIC, use tricubic interpolation instead of trilinear interpolation
-If set to NEAREST_NEIGHBOUR , use nearest neighbour interpolation instead of trilinear interpolation */
+If set to NEAREST_NEIGHBOUR , use nearest neighbour interpolation instead of trilinear interpolation
+If set to ADAPTIVE, use tricubic interpolation in the bricks of 8 x 8 x 8 grid points with strong
+curvature and trilinear interpolation elsewhere, see Grid::updateAdaptiveMap */
 enum interpolationType {
   TRILINEAR = 0,
   TRICUBIC,
-  NEAREST_NEIGHBOUR
+  NEAREST_NEIGHBOUR,
+  ADAPTIVE
+};
+
+/** Memory layout of the grid values.
+If set to DENSE, the values are stored in row-major order, ix * Ny * Nz + iy * Nz + iz (standard)
+If set to BRICKED, the values are stored in bricks of 8 x 8 x 8 grid points, each in row-major order,
+so that the neighbours of an interpolation mostly lie in the same few memory pages of large grids */
+enum gridLayout {
+  DENSE = 0,
+  BRICKED
 };
 
 /** Lower and upper neighbour in a periodically continued unit grid */
@@ -43,10 +61,16 @@ inline int periodicBoundary(int index, int n) {
 	return ((index % (n)) + (n)) % (n);
 }
 
-/** Lower and upper neighbour in a reflectively repeated unit grid */
-inline void reflectiveClamp(double x, int n, int &lo, int &hi, double &res) {
+/** Position in a reflectively repeated unit grid, reflected into -0.5 <= x <= n - 0.5 */
+inline double reflectivePosition(double x, int n) {
 	while ((x < -0.5) or (x > (n-0.5)))
 		x = 2 * n * (x > (n-0.5)) -x-1;
+	return x;
+}
+
+/** Lower and upper neighbour in a reflectively repeated unit grid */
+inline void reflectiveClamp(double x, int n, int &lo, int &hi, double &res) {
+	x = reflectivePosition(x, n);
 	res = x;
 	lo = floor(x);
 	hi = lo + (lo < n-1);
@@ -56,11 +80,124 @@ inline void reflectiveClamp(double x, int n, int &lo, int &hi, double &res) {
 	}
 }
 
+/** Spread the lower 21 bits of x to every third bit */
+inline uint64_t mortonSpread(uint64_t x) {
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffULL;
+	x = (x | x << 16) & 0x1f0000ff0000ffULL;
+	x = (x | x << 8) & 0x100f00f00f00f00fULL;
+	x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+	x = (x | x << 2) & 0x1249249249249249ULL;
+	return x;
+}
+
+/** Morton (Z-order) key of a grid cell, interleaving the lower 21 bits of the
+ indices, so that cells with close keys are close in space */
+inline uint64_t mortonKey(uint64_t ix, uint64_t iy, uint64_t iz) {
+	return mortonSpread(ix) << 2 | mortonSpread(iy) << 1 | mortonSpread(iz);
+}
+
+/** Unique number for the geometry of a new or changed grid, see GridCell */
+inline uint64_t nextGridRevision() {
+	static std::atomic<uint64_t> revision(0);
+	return ++revision;
+}
+
+/** Four components per grid point that are interpolated together, e.g. a field
+ vector and its modulation (Bx, By, Bz, m) in Grid4f. The 16 bytes of a value are
+ aligned, so that the compiler operates on all components with one SIMD instruction. */
+struct alignas(16) Vector4f {
+	float x, y, z, w;
+	Vector4f() : x(0), y(0), z(0), w(0) {}
+	explicit Vector4f(double a) : x(a), y(a), z(a), w(a) {}
+	Vector4f(const Vector3f &v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+	Vector4f(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+	Vector3f getVector() const {
+		return Vector3f(x, y, z);
+	}
+
+	Vector4f &operator+=(const Vector4f &v) {
+		x += v.x;
+		y += v.y;
+		z += v.z;
+		w += v.w;
+		return *this;
+	}
+
+	Vector4f operator+(const Vector4f &v) const {
+		return Vector4f(x + v.x, y + v.y, z + v.z, w + v.w);
+	}
+
+	Vector4f operator-(const Vector4f &v) const {
+		return Vector4f(x - v.x, y - v.y, z - v.z, w - v.w);
+	}
+
+	Vector4f operator*(double a) const {
+		float f = a;
+		return Vector4f(x * f, y * f, z * f, w * f);
+	}
+
+	Vector4f operator/(double a) const {
+		float f = 1 / a;
+		return Vector4f(x * f, y * f, z * f, w * f);
+	}
+};
+
+/** Neighbours of the last trilinear interpolation of a periodic grid, which
+ Grid::interpolate(position, cell) reuses while the positions stay in the same cell.
+ One cell per thread, as it is modified by each interpolation. */
+struct GridCell {
+	uint64_t revision; /**< geometry of the grid, 0 for none */
+	int iX, iY, iZ; /**< lower neighbours on the unit grid, not wrapped */
+	size_t offset[8]; /**< offsets of the eight neighbours into the grid values */
+	GridCell() : revision(0), iX(0), iY(0), iZ(0) {}
+};
+
 /** Symmetrical round */
 inline double round(double r) {
 	return (r > 0.0) ? floor(r + 0.5) : ceil(r - 0.5);
 }
 
+/** Catmull-Rom weights of the four neighbours of a position, for its fraction f beyond the second */
+inline void cubicWeights(double f, double w[4]) {
+	double f2 = f * f;
+	double f3 = f2 * f;
+	w[0] = -0.5 * f3 + f2 - 0.5 * f;
+	w[1] = 1.5 * f3 - 2.5 * f2 + 1;
+	w[2] = -1.5 * f3 + 2 * f2 + 0.5 * f;
+	w[3] = 0.5 * f3 - 0.5 * f2;
+}
+
+/** Indices of the four neighbours of x in a unit grid of n points, continued
+ reflectively or periodically, and their Catmull-Rom weights for the tricubic
+ interpolation, equivalent to Grid::CubicInterpolateScalar */
+inline void cubicStencil(double x, int n, bool reflective, size_t index[4], double w[4]) {
+	int i0 = floor(x);
+	for (int k = 0; k < 4; k++)
+		index[k] = reflective ? reflectiveBoundary(i0 + k - 1, n) : periodicBoundary(i0 + k - 1, n);
+	cubicWeights(x - i0, w);
+}
+
+#if defined(HAVE_SIMD) && defined(__AVX__)
+/** a * b + c, fused if the target supports FMA */
+inline __m256d simdMulAdd(__m256d a, __m256d b, __m256d c) {
+#ifdef __FMA__
+	return _mm256_fmadd_pd(a, b, c);
+#else
+	return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+inline __m256 simdMulAdd(__m256 a, __m256 b, __m256 c) {
+#ifdef __FMA__
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+#endif // HAVE_SIMD && __AVX__
+
 /**
  * \addtogroup Core
  * @{
@@ -77,6 +214,7 @@ public:
 	Vector3d spacing; 	// Spacing vector between gridpoints
 	bool reflective;	// using reflective repetition of the grid instead of periodic
 	interpolationType ipol;	// Interpolation type used between grid points
+	gridLayout layout;	// Memory layout of the grid values
 
 	/** Constructor for cubic grid
 	 @param	origin	Position of the lower left front corner of the volume
@@ -84,7 +222,7 @@ public:
 	 @param spacing	Spacing between grid points
 	 */
 	GridProperties(Vector3d origin, size_t N, double spacing) :
-		origin(origin), Nx(N), Ny(N), Nz(N), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR) {
+		origin(origin), Nx(N), Ny(N), Nz(N), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), layout(DENSE) {
 	}
 
 	/** Constructor for non-cubic grid
@@ -95,7 +233,7 @@ public:
 	 @param spacing	Spacing between grid points
 	 */
 	GridProperties(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) :
-		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR) {
+		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(Vector3d(spacing)), reflective(false), ipol(TRILINEAR), layout(DENSE) {
 	}
 
 	/** Constructor for non-cubic grid with spacing vector
@@ -106,7 +244,7 @@ public:
 	 @param spacing	Spacing vector between grid points
 	*/
 	GridProperties(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) :
-		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(spacing), reflective(false), ipol(TRILINEAR) {
+		origin(origin), Nx(Nx), Ny(Ny), Nz(Nz), spacing(spacing), reflective(false), ipol(TRILINEAR), layout(DENSE) {
 	}
 	
 	virtual ~GridProperties() {
@@ -118,10 +256,136 @@ public:
 	}
 
 	/** set the type of interpolation between grid points.
-	 * @param i: interpolationType (TRILINEAR, TRICUBIC, NEAREST_NEIGHBOUR) */
+	 * @param i: interpolationType (TRILINEAR, TRICUBIC, NEAREST_NEIGHBOUR, ADAPTIVE) */
 	void setInterpolationType(interpolationType i) {
 		ipol = i;
 	}
+
+	/** set the memory layout of the grid values.
+	 * @param l: gridLayout (DENSE, BRICKED) */
+	void setLayout(gridLayout l) {
+		layout = l;
+	}
+};
+
+/**
+ @class GridValues
+ @brief Values of a Grid, either owned or mapped from a file
+
+ Mapped values, see GridTools::mapGrid, are shared with all processes that
+ map the same file until they are modified: modified pages are copied for
+ this process only and never written back to the file. Values placed in
+ PageMemory (see place) are kept the same way.
+ */
+template<typename T>
+class GridValues {
+	std::vector<T> owned;
+	T *values;
+	size_t count;
+	ref_ptr<Referenced> mapping; /**< Keeps the mapped memory or the pages alive */
+	const PageMemory *pages; /**< The pages of placed values, 0 otherwise */
+
+public:
+	GridValues() : values(0), count(0), pages(0) {
+	}
+
+	/** Copies own their values, also of mapped values */
+	GridValues(const GridValues<T> &v) : owned(v.values, v.values + v.count), count(v.count),
+			pages(0) {
+		values = owned.data();
+	}
+
+	GridValues<T> &operator=(const GridValues<T> &v) {
+		if (this != &v) {
+			owned.assign(v.values, v.values + v.count);
+			count = v.count;
+			mapping = NULL;
+			pages = 0;
+			values = owned.data();
+		}
+		return *this;
+	}
+
+	/** Resize, mapped values are copied first */
+	void resize(size_t n) {
+		if (mapping) {
+			owned.assign(values, values + std::min(n, count));
+			mapping = NULL;
+			pages = 0;
+		}
+		owned.resize(n);
+		values = owned.data();
+		count = n;
+	}
+
+	void assign(size_t n, const T &value) {
+		mapping = NULL;
+		pages = 0;
+		owned.assign(n, value);
+		values = owned.data();
+		count = n;
+	}
+
+	/** Use n values at the given address, that stay valid as long as the mapping exists */
+	void map(ref_ptr<Referenced> mapping, T *values, size_t n) {
+		std::vector<T>().swap(owned);
+		this->mapping = mapping;
+		this->values = values;
+		count = n;
+		pages = 0;
+	}
+
+	/** Move the values to PageMemory with the flags, copied in parallel */
+	void place(unsigned int flags) {
+		if (count == 0)
+			return;
+		ref_ptr<PageMemory> memory = new PageMemory(count * sizeof(T), flags);
+		T *target = (T *) memory->data();
+		const T *source = values;
+#pragma omp parallel for schedule(static)
+		for (long long i = 0; i < (long long) count; i++)
+			target[i] = source[i];
+		std::vector<T>().swap(owned);
+		mapping = memory;
+		pages = memory;
+		values = target;
+	}
+
+	bool isMapped() const {
+		return mapping.valid() and pages == 0;
+	}
+
+	/** The pages of the values if they are placed, 0 otherwise */
+	const PageMemory *getPages() const {
+		return pages;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	T *data() {
+		return values;
+	}
+
+	const T *data() const {
+		return values;
+	}
+
+	T &operator[](size_t i) {
+		return values[i];
+	}
+
+	const T &operator[](size_t i) const {
+		return values[i];
+	}
+
+	/** Owned values; throws for mapped values */
+	std::vector<T> &vector() {
+		if (mapping)
+			throw std::runtime_error("Grid: the values are mapped from a file or placed in PageMemory, use getValues");
+		return owned;
+	}
 };
 
 /**
@@ -132,17 +396,37 @@ public:
  Values are calculated by trilinear interpolation of the surrounding 8 grid points.
  The grid is periodically (default) or reflectively extended.
  The grid sample positions are at 1/2 * size/N, 3/2 * size/N ... (2N-1)/2 * size/N.
+ The values are stored densely (default) or in bricks, see gridLayout and setLayout.
+ With setGhostLayers the trilinear and tricubic interpolation read a padded copy of the
+ values, so that the neighbours need no periodic or reflective continuation.
  */
 template<typename T>
 class Grid: public Referenced {
-	std::vector<T> grid;
+	GridValues<T> grid;
 	size_t Nx, Ny, Nz; /**< Number of grid points */
+	gridLayout layout; /**< Memory layout of the grid values */
+	/** Offset of the value of grid point (ix, iy, iz) is the sum of the offsets per axis,
+	  (i >> shift) * stride + (i & mask) * brickStride, with shift = mask = 0 for the dense layout */
+	unsigned int shift;
+	size_t mask;
+	size_t strideX, strideY, strideZ;
+	size_t brickStrideX, brickStrideY;
 	Vector3d origin; /**< Origin of the volume that is represented by the grid. */
 	Vector3d gridOrigin; /**< Grid origin */
 	Vector3d spacing; /**< Distance between grid points, determines the extension of the grid */
 	bool clipVolume; /**< If set to true, all values outside of the grid will be 0*/
 	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
 	interpolationType ipolType; /**< Type of interpolation between the grid points */
+	uint64_t revision; /**< Identifies the offsets of the grid points, see GridCell */
+	/** Dense copy of the values with ghostWidth extra grid points at each side, see setGhostLayers */
+	std::vector<T> ghost;
+	bool ghostLayers;
+	size_t ghostStrideX, ghostStrideY;
+	static const int ghostWidth = 2;
+	/** Per brick of 8 x 8 x 8 grid points, 1 if the ADAPTIVE interpolation is tricubic there, see updateAdaptiveMap */
+	std::vector<uint8_t> tricubicBricks;
+	size_t adaptiveBricksY, adaptiveBricksZ;
+	double adaptiveTolerance;
 
 public:
 	/** Constructor for cubic grid
@@ -150,7 +434,7 @@ public:
 	 @param	N		Number of grid points in one direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t N, double spacing) {
+	Grid(Vector3d origin, size_t N, double spacing) : layout(DENSE), ipolType(TRILINEAR), ghostLayers(false), adaptiveTolerance(0.01) {
 		setOrigin(origin);
 		setGridSize(N, N, N);
 		setSpacing(Vector3d(spacing));
@@ -165,7 +449,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing between grid points
 	 */
-	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) {
+	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, double spacing) : layout(DENSE), ipolType(TRILINEAR), ghostLayers(false), adaptiveTolerance(0.01) {
 		setOrigin(origin);
 		setGridSize(Nx, Ny, Nz);
 		setSpacing(Vector3d(spacing));
@@ -180,7 +464,7 @@ public:
 	 @param	Nz		Number of grid points in z-direction
 	 @param spacing	Spacing vector between grid points
 	*/
-	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) {
+	Grid(Vector3d origin, size_t Nx, size_t Ny, size_t Nz, Vector3d spacing) : layout(DENSE), ipolType(TRILINEAR), ghostLayers(false), adaptiveTolerance(0.01) {
 		setOrigin(origin);
 		setGridSize(Nx, Ny, Nz);
 		setSpacing(spacing);
@@ -192,10 +476,27 @@ public:
 	 @param p	GridProperties instance
      */
 	Grid(const GridProperties &p) :
-		origin(p.origin), spacing(p.spacing), reflective(p.reflective), ipolType(p.ipol) {
+		layout(p.layout), origin(p.origin), spacing(p.spacing), clipVolume(false), reflective(p.reflective), ipolType(p.ipol),
+		ghostLayers(false), adaptiveTolerance(0.01) {
 		setGridSize(p.Nx, p.Ny, p.Nz);
 	}
 
+	/** Constructor for values mapped from a file, see GridTools::mapGrid
+	 @param p		GridProperties instance
+	 @param mapping	object that keeps the mapped memory alive
+	 @param values	the values in the layout of the grid properties
+	 @param n		number of values, has to match the grid properties
+	 */
+	Grid(const GridProperties &p, ref_ptr<Referenced> mapping, T *values, size_t n) :
+		Nx(p.Nx), Ny(p.Ny), Nz(p.Nz), layout(p.layout), origin(p.origin), spacing(p.spacing),
+		clipVolume(false), reflective(p.reflective), ipolType(p.ipol), ghostLayers(false),
+		adaptiveTolerance(0.01) {
+		if (n != setStrides())
+			throw std::runtime_error("Grid: number of mapped values does not match the grid size");
+		grid.map(mapping, values, n);
+		setOrigin(origin);
+	}
+
 	void setOrigin(Vector3d origin) {
 		this->origin = origin;
 		this->gridOrigin = origin + spacing/2;
@@ -206,8 +507,31 @@ public:
 		this->Nx = Nx;
 		this->Ny = Ny;
 		this->Nz = Nz;
-		grid.resize(Nx * Ny * Nz);
+		grid.resize(setStrides());
 		setOrigin(origin);
+		updateGhostLayers();
+		std::vector<uint8_t>().swap(tricubicBricks);
+	}
+
+	/** Change the memory layout, the values are reordered accordingly.
+	 The get, set and interpolate functions do not depend on the layout, only the order
+	 of the values in getGrid. Files written with GridTools are always dense.
+	 @param layout	gridLayout (DENSE, BRICKED) */
+	void setLayout(gridLayout layout) {
+		if (layout == this->layout)
+			return;
+		Grid<T> old(*this);
+		this->layout = layout;
+		grid.assign(setStrides(), T(0.));
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++)
+					get(ix, iy, iz) = old.get(ix, iy, iz);
+		updateGhostLayers();
+	}
+
+	gridLayout getLayout() const {
+		return layout;
 	}
 
 	void setSpacing(Vector3d spacing) {
@@ -217,6 +541,46 @@ public:
 
 	void setReflective(bool b) {
 		reflective = b;
+		updateGhostLayers();
+		updateAdaptiveMap();
+	}
+
+	/** Keep a padded copy of the values with two extra grid points at each side, filled
+	 periodically or reflectively as the grid is continued. The trilinear and tricubic
+	 interpolation then take the neighbours from the copy: the position is continued into
+	 the grid once per axis instead of every neighbour index. Needs the memory of the
+	 values a second time.
+	 setValue, setReflective, setGridSize and setLayout update the copy; after changing the
+	 values through get, getGrid or getValues, updateGhostLayers has to be called. */
+	void setGhostLayers(bool b) {
+		ghostLayers = b;
+		updateGhostLayers();
+	}
+
+	bool hasGhostLayers() const {
+		return ghostLayers;
+	}
+
+	/** Fill the ghost layers from the current values, see setGhostLayers */
+	void updateGhostLayers() {
+		if (not ghostLayers) {
+			std::vector<T>().swap(ghost);
+			return;
+		}
+		int nX = Nx + 2 * ghostWidth, nY = Ny + 2 * ghostWidth, nZ = Nz + 2 * ghostWidth;
+		ghostStrideY = nZ;
+		ghostStrideX = nY * ghostStrideY;
+		ghost.resize(nX * ghostStrideX);
+#pragma omp parallel for schedule(static)
+		for (int px = 0; px < nX; px++) {
+			size_t ix = continuedIndex(px - ghostWidth, Nx);
+			for (int py = 0; py < nY; py++) {
+				size_t iy = continuedIndex(py - ghostWidth, Ny);
+				T *row = &ghost[px * ghostStrideX + py * ghostStrideY];
+				for (int pz = 0; pz < nZ; pz++)
+					row[pz] = get(ix, iy, continuedIndex(pz - ghostWidth, Nz));
+			}
+		}
 	}
 
 	// If set to true, all values outside of the grid will be 0.
@@ -227,16 +591,92 @@ public:
 	/** Change the interpolation type to the routine specified by the user. Check if this routine is
 		contained in the enum interpolationType and thus supported by CRPropa.*/
 	void setInterpolationType(interpolationType ipolType) {
-		if (ipolType == TRILINEAR || ipolType == TRICUBIC || ipolType == NEAREST_NEIGHBOUR) {
+		if (ipolType == TRILINEAR || ipolType == TRICUBIC || ipolType == NEAREST_NEIGHBOUR || ipolType == ADAPTIVE) {
 			this->ipolType = ipolType;
-			if ((ipolType == TRICUBIC) && (std::is_same<T, Vector3d>::value)) {
-				KISS_LOG_WARNING << "Tricubic interpolation on Grid3d works only with float-precision, doubles will be downcasted";
-		}
+			updateAdaptiveMap();
 		} else {
 			throw std::runtime_error("InterpolationType: unknown interpolation type");
 		}
 	}
 
+	/** Tolerance of the ADAPTIVE interpolation: a brick is interpolated tricubic
+	 if a second difference of the values at or next to its grid points exceeds
+	 the tolerance times the root mean square of the values, see updateAdaptiveMap.
+	 The trilinear interpolation deviates by up to about 1/8 of the second
+	 differences. Default 0.01. */
+	void setAdaptiveTolerance(double tolerance) {
+		if (tolerance < 0)
+			throw std::runtime_error("Grid: the adaptive tolerance must be >= 0");
+		adaptiveTolerance = tolerance;
+		updateAdaptiveMap();
+	}
+
+	double getAdaptiveTolerance() const {
+		return adaptiveTolerance;
+	}
+
+	/** Flag the bricks of 8 x 8 x 8 grid points that the ADAPTIVE interpolation
+	 interpolates tricubic, from the magnitude of the second differences of the
+	 values along the axes. Called by setInterpolationType, setAdaptiveTolerance
+	 and setReflective; after changing the values through setValue, get, getGrid
+	 or getValues, e.g. loading them with GridTools, and after setGridSize, it
+	 has to be called again. Without a map, e.g. after setGridSize, the
+	 interpolation is tricubic in all bricks. Does nothing for the other
+	 interpolation types. */
+	void updateAdaptiveMap() {
+		if (ipolType != ADAPTIVE) {
+			std::vector<uint8_t>().swap(tricubicBricks);
+			return;
+		}
+		size_t nBricksX = (Nx + 7) / 8;
+		adaptiveBricksY = (Ny + 7) / 8;
+		adaptiveBricksZ = (Nz + 7) / 8;
+		tricubicBricks.assign(nBricksX * adaptiveBricksY * adaptiveBricksZ, 0);
+
+		double sum = 0;
+		for (size_t ix = 0; ix < Nx; ix++)
+			for (size_t iy = 0; iy < Ny; iy++)
+				for (size_t iz = 0; iz < Nz; iz++) {
+					double v = valueNorm(get(ix, iy, iz));
+					sum += v * v;
+				}
+		double threshold = adaptiveTolerance * sqrt(sum / (Nx * Ny * Nz));
+
+		for (int ix = 0; ix < (int) Nx; ix++)
+			for (int iy = 0; iy < (int) Ny; iy++)
+				for (int iz = 0; iz < (int) Nz; iz++) {
+					T v2 = get(ix, iy, iz) * 2.;
+					double d = valueNorm(get(continuedIndex(ix - 1, Nx), iy, iz)
+							+ get(continuedIndex(ix + 1, Nx), iy, iz) - v2);
+					d = std::max(d, valueNorm(get(ix, continuedIndex(iy - 1, Ny), iz)
+							+ get(ix, continuedIndex(iy + 1, Ny), iz) - v2));
+					d = std::max(d, valueNorm(get(ix, iy, continuedIndex(iz - 1, Nz))
+							+ get(ix, iy, continuedIndex(iz + 1, Nz)) - v2));
+					if (not (d > threshold))
+						continue;
+					// the cells below and above the grid point along each axis
+					size_t jX[2] = {continuedIndex(ix - 1, Nx), (size_t) ix};
+					size_t jY[2] = {continuedIndex(iy - 1, Ny), (size_t) iy};
+					size_t jZ[2] = {continuedIndex(iz - 1, Nz), (size_t) iz};
+					for (int a = 0; a < 2; a++)
+						for (int b = 0; b < 2; b++)
+							for (int c = 0; c < 2; c++)
+								tricubicBricks[adaptiveBrick(jX[a], jY[b], jZ[c])] = 1;
+				}
+	}
+
+	/** Fraction of the bricks that the ADAPTIVE interpolation interpolates tricubic */
+	double getTricubicFraction() const {
+		if (ipolType != ADAPTIVE)
+			return (ipolType == TRICUBIC) ? 1 : 0;
+		if (tricubicBricks.empty())
+			return 1;
+		size_t n = 0;
+		for (size_t i = 0; i < tricubicBricks.size(); i++)
+			n += tricubicBricks[i];
+		return double(n) / tricubicBricks.size();
+	}
+
 	/** returns the positon of the lower left front corner of the volume */
 	Vector3d getOrigin() const {
 		return origin;
@@ -256,7 +696,7 @@ public:
 
 	/** Calculates the total size of the grid in bytes */
 	size_t getSizeOf() const {
-		return sizeof(grid) + (sizeof(grid[0]) * grid.size());
+		return sizeof(grid) + (sizeof(grid[0]) * grid.size()) + sizeof(T) * ghost.size();
 	}
 
 	Vector3d getSpacing() const {
@@ -267,6 +707,14 @@ public:
 		return reflective;
 	}
 
+	bool isClipVolume() const {
+		return clipVolume;
+	}
+
+	interpolationType getInterpolationType() const {
+		return ipolType;
+	}
+
 	/** Choose the interpolation algorithm based on the set interpolation type.
 	  By default this it the trilinear interpolation. The user can change the
 	  routine with the setInterpolationType function.*/
@@ -285,49 +733,207 @@ public:
 			return tricubicInterpolate(T(), position);
 		else if (ipolType == NEAREST_NEIGHBOUR)
 			return closestValue(position);
+		else if ((ipolType == ADAPTIVE) and isTricubic(position))
+			return tricubicInterpolate(T(), position);
 		else
 			return trilinearInterpolate(position);
 	}
 
+	/** True if the ADAPTIVE interpolation is tricubic at the position, see updateAdaptiveMap */
+	bool isTricubic(const Vector3d &position) const {
+		if (tricubicBricks.empty())
+			return true;
+		Vector3d r = ((position - gridOrigin) / spacing).floor();
+		size_t ix = continuedIndex(r.x, Nx), iy = continuedIndex(r.y, Ny), iz = continuedIndex(r.z, Nz);
+		return tricubicBricks[adaptiveBrick(ix, iy, iz)];
+	}
+
+	/** Interpolate as interpolate(position), reusing the neighbours of the previous
+	  interpolation in the same cell. Only the periodic trilinear interpolation of
+	  an unclipped grid uses the cell, the other types ignore it.
+	  The cell holds no grid values, so that later changes of the values are seen. */
+	T interpolate(const Vector3d &position, GridCell &cell) {
+		if (clipVolume or reflective or (ipolType != TRILINEAR))
+			return interpolate(position);
+
+		/** position on a unit grid */
+		Vector3d r = (position - gridOrigin) / spacing;
+		Vector3d r0 = r.floor();
+		int iX = r0.x, iY = r0.y, iZ = r0.z;
+		if ((cell.revision != revision) or (cell.iX != iX) or (cell.iY != iY) or (cell.iZ != iZ)) {
+			int iX0, iX1, iY0, iY1, iZ0, iZ1;
+			periodicClamp(r.x, Nx, iX0, iX1);
+			periodicClamp(r.y, Ny, iY0, iY1);
+			periodicClamp(r.z, Nz, iZ0, iZ1);
+			size_t oX0 = offsetX(iX0), oX1 = offsetX(iX1);
+			size_t oY0 = offsetY(iY0), oY1 = offsetY(iY1);
+			size_t oZ0 = offsetZ(iZ0), oZ1 = offsetZ(iZ1);
+			cell.offset[0] = oX0 + oY0 + oZ0;
+			cell.offset[1] = oX1 + oY0 + oZ0;
+			cell.offset[2] = oX0 + oY1 + oZ0;
+			cell.offset[3] = oX0 + oY0 + oZ1;
+			cell.offset[4] = oX1 + oY0 + oZ1;
+			cell.offset[5] = oX0 + oY1 + oZ1;
+			cell.offset[6] = oX1 + oY1 + oZ0;
+			cell.offset[7] = oX1 + oY1 + oZ1;
+			cell.revision = revision;
+			cell.iX = iX;
+			cell.iY = iY;
+			cell.iZ = iZ;
+		}
+
+		double fX0 = r.x - r0.x, fY0 = r.y - r0.y, fZ0 = r.z - r0.z;
+		double fX1 = 1 - fX0, fY1 = 1 - fY0, fZ1 = 1 - fZ0;
+		const size_t *o = cell.offset;
+		T b(0.);
+		b += grid[o[0]] * fX1 * fY1 * fZ1;
+		b += grid[o[1]] * fX0 * fY1 * fZ1;
+		b += grid[o[2]] * fX1 * fY0 * fZ1;
+		b += grid[o[3]] * fX1 * fY1 * fZ0;
+		b += grid[o[4]] * fX0 * fY1 * fZ0;
+		b += grid[o[5]] * fX1 * fY0 * fZ0;
+		b += grid[o[6]] * fX0 * fY0 * fZ1;
+		b += grid[o[7]] * fX0 * fY0 * fZ0;
+		return b;
+	}
+
+	/** Trilinear interpolation of a periodic grid with the partial derivatives
+	  of the interpolation along the axes, which are continuous within a cell.
+	  Throws for reflective grids, which have no derivatives at the boundaries of the reflections. */
+	T interpolateWithDerivatives(const Vector3d &position, T &dX, T &dY, T &dZ) const {
+		if (reflective)
+			throw std::runtime_error("Grid: no derivatives of reflective grids");
+
+		/** position on a unit grid */
+		Vector3d r = (position - gridOrigin) / spacing;
+		int iX0, iX1, iY0, iY1, iZ0, iZ1;
+		periodicClamp(r.x, Nx, iX0, iX1);
+		periodicClamp(r.y, Ny, iY0, iY1);
+		periodicClamp(r.z, Nz, iZ0, iZ1);
+		double fX0 = r.x - floor(r.x), fY0 = r.y - floor(r.y), fZ0 = r.z - floor(r.z);
+		double fX1 = 1 - fX0, fY1 = 1 - fY0, fZ1 = 1 - fZ0;
+
+		size_t oX0 = offsetX(iX0), oX1 = offsetX(iX1);
+		size_t oY0 = offsetY(iY0), oY1 = offsetY(iY1);
+		size_t oZ0 = offsetZ(iZ0), oZ1 = offsetZ(iZ1);
+		const T &v000 = grid[oX0 + oY0 + oZ0], &v100 = grid[oX1 + oY0 + oZ0];
+		const T &v010 = grid[oX0 + oY1 + oZ0], &v001 = grid[oX0 + oY0 + oZ1];
+		const T &v101 = grid[oX1 + oY0 + oZ1], &v011 = grid[oX0 + oY1 + oZ1];
+		const T &v110 = grid[oX1 + oY1 + oZ0], &v111 = grid[oX1 + oY1 + oZ1];
+
+		dX = ((v100 - v000) * fY1 * fZ1 + (v110 - v010) * fY0 * fZ1
+				+ (v101 - v001) * fY1 * fZ0 + (v111 - v011) * fY0 * fZ0) / spacing.x;
+		dY = ((v010 - v000) * fX1 * fZ1 + (v110 - v100) * fX0 * fZ1
+				+ (v011 - v001) * fX1 * fZ0 + (v111 - v101) * fX0 * fZ0) / spacing.y;
+		dZ = ((v001 - v000) * fX1 * fY1 + (v101 - v100) * fX0 * fY1
+				+ (v011 - v010) * fX1 * fY0 + (v111 - v110) * fX0 * fY0) / spacing.z;
+		return trilinearInterpolate(position);
+	}
+
 	/** Inspector & Mutator */
 	T &get(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[offsetX(ix) + offsetY(iy) + offsetZ(iz)];
 	}
 
 	/** Inspector */
 	const T &get(size_t ix, size_t iy, size_t iz) const {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return grid[offsetX(ix) + offsetY(iy) + offsetZ(iz)];
 	}
 
 	const T &periodicGet(size_t ix, size_t iy, size_t iz) const {
 		ix = periodicBoundary(ix, Nx);
 		iy = periodicBoundary(iy, Ny);
 		iz = periodicBoundary(iz, Nz);
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return get(ix, iy, iz);
 	}
 
 	const T &reflectiveGet(size_t ix, size_t iy, size_t iz) const {
 		ix = reflectiveBoundary(ix, Nx);
 		iy = reflectiveBoundary(iy, Ny);
 		iz = reflectiveBoundary(iz, Nz);
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return get(ix, iy, iz);
 	}
 
 	T getValue(size_t ix, size_t iy, size_t iz) {
-		return grid[ix * Ny * Nz + iy * Nz + iz];
+		return get(ix, iy, iz);
 	}
 
 	void setValue(size_t ix, size_t iy, size_t iz, T value) {
-		grid[ix * Ny * Nz + iy * Nz + iz] = value;
+		get(ix, iy, iz) = value;
+		if (not ghostLayers)
+			return;
+		// the point and its copies in the ghost layers
+		int pX[1 + 2 * ghostWidth], pY[1 + 2 * ghostWidth], pZ[1 + 2 * ghostWidth];
+		int nX = ghostCopies(ix, Nx, pX), nY = ghostCopies(iy, Ny, pY), nZ = ghostCopies(iz, Nz, pZ);
+		for (int i = 0; i < nX; i++)
+			for (int j = 0; j < nY; j++)
+				for (int k = 0; k < nZ; k++)
+					ghost[pX[i] * ghostStrideX + pY[j] * ghostStrideY + pZ[k]] = value;
 	}
 
-	/** Return a reference to the grid values */
+	/** Return a reference to the grid values, in the order of the layout.
+	 For the BRICKED layout the values include the padding of the bricks at the upper edges, which is 0.
+	 Throws for values mapped from a file or placed in PageMemory, see getValues. */
 	std::vector<T> &getGrid() {
-		return grid;
+		return grid.vector();
+	}
+
+	/** Pointer to the getNumberOfValues() grid values, in the order of the layout, for owned and mapped values */
+	T *getValues() {
+		return grid.data();
+	}
+
+	const T *getValues() const {
+		return grid.data();
+	}
+
+	size_t getNumberOfValues() const {
+		return grid.size();
+	}
+
+	/** True if the values are mapped from a file, see GridTools::mapGrid */
+	bool isMapped() const {
+		return grid.isMapped();
+	}
+
+	/** Move the values to memory with the given placement of its pages, see
+	 PageMemory, e.g. after loading a large field. Mapped values are copied.
+	 Afterwards, as for mapped values, getGrid throws and getValues has to be
+	 used; resizing or changing the layout moves the values back to ordinary
+	 memory.
+	 @param flags	combination of PageMemory::Flags */
+	void placeValues(unsigned int flags) {
+		grid.place(flags);
+	}
+
+	/** Interleave the pages of the values over the NUMA nodes, see placeValues */
+	void interleave() {
+		placeValues(PageMemory::Interleave);
+	}
+
+	/** True if the values are placed for interleaving, see interleave; the
+	 pages are only interleaved on machines with several nodes */
+	bool isInterleaved() const {
+		return grid.getPages() and (grid.getPages()->getFlags() & PageMemory::Interleave);
+	}
+
+	/** Size of the pages of the values in bytes, see PageMemory::getPageSize */
+	size_t getPageSize() const {
+		return grid.getPages() ? grid.getPages()->getPageSize() : PageMemory::getSystemPageSize();
 	}
 
-	/** Position of the grid point of a given index */
+	/** Position of the grid point of a given index into the grid values */
 	Vector3d positionFromIndex(int index) const {
+		if (layout == BRICKED) {
+			size_t brick = index / strideZ;
+			size_t local = index % strideZ;
+			size_t nBricksY = strideX / strideY;
+			size_t nBricksZ = strideY / strideZ;
+			size_t ix = (brick / (nBricksY * nBricksZ)) * 8 + local / 64;
+			size_t iy = ((brick / nBricksZ) % nBricksY) * 8 + (local / 8) % 8;
+			size_t iz = (brick % nBricksZ) * 8 + local % 8;
+			return Vector3d(ix, iy, iz) * spacing + gridOrigin;
+		}
 		int ix = index / (Ny * Nz);
 		int iy = (index / Nz) % Ny;
 		int iz = index % Nz;
@@ -360,19 +966,111 @@ public:
 	}
 
 private:
+	/** Set the offsets per axis for the layout
+	 @returns	number of values to store */
+	size_t setStrides() {
+		revision = nextGridRevision();
+		if (layout == BRICKED) {
+			size_t nBricksX = (Nx + 7) / 8;
+			size_t nBricksY = (Ny + 7) / 8;
+			size_t nBricksZ = (Nz + 7) / 8;
+			shift = 3;
+			mask = 7;
+			strideZ = 8 * 8 * 8;
+			strideY = nBricksZ * strideZ;
+			strideX = nBricksY * strideY;
+			brickStrideX = 8 * 8;
+			brickStrideY = 8;
+			return nBricksX * strideX;
+		}
+		shift = 0;
+		mask = 0;
+		strideX = Ny * Nz;
+		strideY = Nz;
+		strideZ = 1;
+		brickStrideX = 0;
+		brickStrideY = 0;
+		return Nx * Ny * Nz;
+	}
+
+	/** Index into tricubicBricks of the brick of a grid point */
+	size_t adaptiveBrick(size_t ix, size_t iy, size_t iz) const {
+		return ((ix >> 3) * adaptiveBricksY + (iy >> 3)) * adaptiveBricksZ + (iz >> 3);
+	}
+
+	/** Magnitude of a value or of a difference of values, see updateAdaptiveMap */
+	static double valueNorm(double v) {
+		return std::fabs(v);
+	}
+
+	static double valueNorm(const Vector3f &v) {
+		return v.getR();
+	}
+
+	static double valueNorm(const Vector3d &v) {
+		return v.getR();
+	}
+
+	static double valueNorm(const Vector4f &v) {
+		return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z + v.w * v.w);
+	}
+
+	size_t offsetX(size_t ix) const {
+		return (ix >> shift) * strideX + (ix & mask) * brickStrideX;
+	}
+
+	size_t offsetY(size_t iy) const {
+		return (iy >> shift) * strideY + (iy & mask) * brickStrideY;
+	}
+
+	size_t offsetZ(size_t iz) const {
+		return (iz >> shift) * strideZ + (iz & mask);
+	}
+
+	/** Index of the grid point within the grid as it is continued */
+	size_t continuedIndex(int index, int n) const {
+		return reflective ? reflectiveBoundary(index, n) : periodicBoundary(index, n);
+	}
+
+	/** Indices of grid point i and its copies along an axis of the padded values
+	 @returns	number of indices */
+	int ghostCopies(int i, int n, int copies[1 + 2 * ghostWidth]) const {
+		int c = 0;
+		copies[c++] = i + ghostWidth;
+		for (int k = 1; k <= ghostWidth; k++) {
+			if ((int) continuedIndex(-k, n) == i)
+				copies[c++] = ghostWidth - k;
+			if ((int) continuedIndex(n - 1 + k, n) == i)
+				copies[c++] = n - 1 + k + ghostWidth;
+		}
+		return c;
+	}
+
+	/** Lower neighbour of x on the unit grid and the fraction beyond it, with the
+	 position continued into the grid once, so that the neighbours from one below
+	 to two above lie within the ghost layers */
+	void ghostNeighbour(double x, int n, int &i, double &f) const {
+		if (reflective)
+			x = reflectivePosition(x, n);
+		i = floor(x);
+		f = x - floor(x);
+		if (not reflective)
+			i = periodicBoundary(i, n);
+	}
+
 	#ifdef HAVE_SIMD
 	__m128 simdperiodicGet(size_t ix, size_t iy, size_t iz) const {
 		ix = periodicBoundary(ix, Nx);
 		iy = periodicBoundary(iy, Ny);
 		iz = periodicBoundary(iz, Nz);
-		return convertVector3fToSimd(grid[ix * Ny * Nz + iy * Nz + iz]);
+		return convertVector3fToSimd(get(ix, iy, iz));
 	}
 
 	__m128 simdreflectiveGet(size_t ix, size_t iy, size_t iz) const {
 		ix = reflectiveBoundary(ix, Nx);
 		iy = reflectiveBoundary(iy, Ny);
 		iz = reflectiveBoundary(iz, Nz);
-		return convertVector3fToSimd(grid[ix * Ny * Nz + iy * Nz + iz]);
+		return convertVector3fToSimd(get(ix, iy, iz));
 	}
 
 	__m128 convertVector3fToSimd(const Vector3f v) const {
@@ -410,9 +1108,109 @@ private:
 		return res;
 	}
 	#endif // HAVE_SIMD
+	/** Offsets per axis and Catmull-Rom weights of the 4 x 4 x 4 neighbours of a position for the tricubic interpolation
+	 @returns	the values the offsets refer to, the ghost layers if enabled */
+	const T *tricubicStencil(const Vector3d &position, size_t iX[4], size_t iY[4], size_t iZ[4],
+			double wX[4], double wY[4], double wZ[4]) const {
+		// position on a unit grid
+		Vector3d r = (position - gridOrigin) / spacing;
+		if (ghostLayers) {
+			int i, j, k;
+			double fX, fY, fZ;
+			ghostNeighbour(r.x, Nx, i, fX);
+			ghostNeighbour(r.y, Ny, j, fY);
+			ghostNeighbour(r.z, Nz, k, fZ);
+			cubicWeights(fX, wX);
+			cubicWeights(fY, wY);
+			cubicWeights(fZ, wZ);
+			for (int l = 0; l < 4; l++) {
+				iX[l] = (i + l - 1 + ghostWidth) * ghostStrideX;
+				iY[l] = (j + l - 1 + ghostWidth) * ghostStrideY;
+				iZ[l] = k + l - 1 + ghostWidth;
+			}
+			return ghost.data();
+		}
+		cubicStencil(r.x, Nx, reflective, iX, wX);
+		cubicStencil(r.y, Ny, reflective, iY, wY);
+		cubicStencil(r.z, Nz, reflective, iZ, wZ);
+		for (int k = 0; k < 4; k++) {
+			iX[k] = offsetX(iX[k]);
+			iY[k] = offsetY(iY[k]);
+			iZ[k] = offsetZ(iZ[k]);
+		}
+		return grid.data();
+	}
+
+	/** Weighted sum of the tricubic stencil with the SIMD kernel chosen at
+	 runtime, for the value types that have one; false if there is none */
+	static bool tricubicKernel(const Vector3f *values, const size_t iX[4], const size_t iY[4],
+			const size_t iZ[4], const double wX[4], const double wY[4], const double wZ[4], Vector3f &result) {
+		const SimdKernels &kernels = getSimdKernels();
+		if (kernels.tricubic3f) // the vectors as triples of floats
+			kernels.tricubic3f(values->data, iX, iY, iZ, wX, wY, wZ, result.data);
+		return kernels.tricubic3f != 0;
+	}
+
+	static bool tricubicKernel(const Vector3d *values, const size_t iX[4], const size_t iY[4],
+			const size_t iZ[4], const double wX[4], const double wY[4], const double wZ[4], Vector3d &result) {
+		const SimdKernels &kernels = getSimdKernels();
+		if (kernels.tricubic3d)
+			kernels.tricubic3d(values->data, iX, iY, iZ, wX, wY, wZ, result.data);
+		return kernels.tricubic3d != 0;
+	}
+
+	static bool tricubicKernel(const double *values, const size_t iX[4], const size_t iY[4],
+			const size_t iZ[4], const double wX[4], const double wY[4], const double wZ[4], double &result) {
+		const SimdKernels &kernels = getSimdKernels();
+		if (kernels.tricubic1d)
+			result = kernels.tricubic1d(values, iX, iY, iZ, wX, wY, wZ);
+		return kernels.tricubic1d != 0;
+	}
+
+	template<typename U, typename R>
+	static bool tricubicKernel(const U *, const size_t *, const size_t *, const size_t *,
+			const double *, const double *, const double *, R &) {
+		return false;
+	}
+
 	/** Interpolate the grid tricubic at a given position (see https://www.paulinternet.nl/?page=bicubic, http://graphics.cs.cmu.edu/nsp/course/15-462/Fall04/assts/catmullRom.pdf) */
 	Vector3f tricubicInterpolate(Vector3f, const Vector3d &position) const {
-		#ifdef HAVE_SIMD
+		#if defined(HAVE_SIMD) && defined(__AVX__)
+		size_t iX[4], iY[4], iZ[4];
+		double wX[4], wY[4], wZ[4];
+		const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+
+		// the components of two neighbours along z per register
+		__m256 acc = _mm256_setzero_ps();
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double wXY = wX[i] * wY[j];
+				for (int k = 0; k < 4; k += 2) {
+					const Vector3f &a = row[iZ[k]];
+					const Vector3f &b = row[iZ[k + 1]];
+					float wa = wXY * wZ[k];
+					float wb = wXY * wZ[k + 1];
+					__m256 p = _mm256_set_ps(0, b.z, b.y, b.x, 0, a.z, a.y, a.x);
+					__m256 w = _mm256_set_ps(wb, wb, wb, wb, wa, wa, wa, wa);
+					acc = simdMulAdd(w, p, acc);
+				}
+			}
+		__m128 result = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		return convertSimdToVector3f(result);
+		#else // HAVE_SIMD && __AVX__
+		// the AVX kernel chosen at runtime, if the CPU supports it
+		if (getSimdKernels().tricubic3f) {
+			size_t iX[4], iY[4], iZ[4];
+			double wX[4], wY[4], wZ[4];
+			const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+			Vector3f result;
+			tricubicKernel(values, iX, iY, iZ, wX, wY, wZ, result);
+			return result;
+		}
+		#endif // HAVE_SIMD && __AVX__
+
+		#if defined(HAVE_SIMD) && !defined(__AVX__)
 		// position on a unit grid
 		Vector3d r = (position - gridOrigin) / spacing;
 
@@ -445,9 +1243,75 @@ private:
 		}
 		__m128 result = CubicInterpolate(interpolateVaryX[0], interpolateVaryX[1], interpolateVaryX[2], interpolateVaryX[3], fX);
 		return convertSimdToVector3f(result);
-		#else // HAVE_SIMD
-		throw std::runtime_error( "Tried to use tricubic Interpolation without SIMD_EXTENSION. SIMD Optimization is neccesary for tricubic interpolation of vector grids.\n");
-		#endif // HAVE_SIMD	
+		#elif !defined(HAVE_SIMD)
+		// portable version, as the tricubic interpolation of Vector3d
+		size_t iX[4], iY[4], iZ[4];
+		double wX[4], wY[4], wZ[4];
+		const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+		Vector3d result(0.);
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double wXY = wX[i] * wY[j];
+				for (int k = 0; k < 4; k++) {
+					const Vector3f &v = row[iZ[k]];
+					result += Vector3d(v.x, v.y, v.z) * (wXY * wZ[k]);
+				}
+			}
+		return Vector3f(result.x, result.y, result.z);
+		#endif
+	}
+
+	/** Interpolate the grid tricubic at a given position in double precision, as the tricubic interpolation of Vector3f */
+	Vector3d tricubicInterpolate(Vector3d, const Vector3d &position) const {
+		size_t iX[4], iY[4], iZ[4];
+		double wX[4], wY[4], wZ[4];
+		const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+
+		#if defined(HAVE_SIMD) && defined(__AVX__)
+		// the three components of a neighbour per register
+		__m256d acc = _mm256_setzero_pd();
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double wXY = wX[i] * wY[j];
+				for (int k = 0; k < 4; k++) {
+					const Vector3d &v = row[iZ[k]];
+					acc = simdMulAdd(_mm256_set1_pd(wXY * wZ[k]), _mm256_set_pd(0, v.z, v.y, v.x), acc);
+				}
+			}
+		double result[4];
+		_mm256_storeu_pd(result, acc);
+		return Vector3d(result[0], result[1], result[2]);
+		#else // HAVE_SIMD && __AVX__
+		Vector3d result(0.);
+		if (tricubicKernel(values, iX, iY, iZ, wX, wY, wZ, result))
+			return result;
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double wXY = wX[i] * wY[j];
+				for (int k = 0; k < 4; k++)
+					result += row[iZ[k]] * (wXY * wZ[k]);
+			}
+		return result;
+		#endif // HAVE_SIMD && __AVX__
+	}
+
+	/** Interpolate the grid tricubic at a given position, all four components at once */
+	Vector4f tricubicInterpolate(Vector4f, const Vector3d &position) const {
+		size_t iX[4], iY[4], iZ[4];
+		double wX[4], wY[4], wZ[4];
+		const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+		Vector4f result;
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double wXY = wX[i] * wY[j];
+				for (int k = 0; k < 4; k++)
+					result += row[iZ[k]] * (wXY * wZ[k]);
+			}
+		return result;
 	}
 
 	/** Vectorized cubic Interpolator in 1D that returns a scalar (see https://www.paulinternet.nl/?page=bicubic, http://graphics.cs.cmu.edu/nsp/course/15-462/Fall04/assts/catmullRom.pdf) */
@@ -457,42 +1321,72 @@ private:
 
   /** Interpolate the grid tricubic at a given position (see https://www.paulinternet.nl/?page=bicubic, http://graphics.cs.cmu.edu/nsp/course/15-462/Fall04/assts/catmullRom.pdf) */
 	double tricubicInterpolate(double, const Vector3d &position) const {
-		/** position on a unit grid */
-		Vector3d r = (position - gridOrigin) / spacing;
-
-		int iX0, iY0, iZ0;
-		iX0 = floor(r.x);
-		iY0 = floor(r.y);
-		iZ0 = floor(r.z);
-
-		double fX, fY, fZ;
-		fX = r.x - iX0;
-		fY = r.y - iY0;
-		fZ = r.z - iZ0;
-
-		int nrCubicInterpolations = 4;
-		double interpolateVaryX[nrCubicInterpolations];
-		double interpolateVaryY[nrCubicInterpolations];
-		double interpolateVaryZ[nrCubicInterpolations];
-		/** Perform 1D interpolations while iterating in each for loop over the index of another direction */
-		for (int iLoopX = -1; iLoopX < nrCubicInterpolations-1; iLoopX++) {
-			for (int iLoopY = -1; iLoopY < nrCubicInterpolations-1; iLoopY++) {
-				for (int iLoopZ = -1; iLoopZ < nrCubicInterpolations-1; iLoopZ++) {
-					if (reflective)
-						interpolateVaryZ[iLoopZ+1] = reflectiveGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ);
-					else
-						interpolateVaryZ[iLoopZ+1] = periodicGet(iX0+iLoopX, iY0+iLoopY, iZ0+iLoopZ);
-				}
-				interpolateVaryY[iLoopY+1] = CubicInterpolateScalar(interpolateVaryZ[0], interpolateVaryZ[1], interpolateVaryZ[2], interpolateVaryZ[3], fZ);
+		size_t iX[4], iY[4], iZ[4];
+		double wX[4], wY[4], wZ[4];
+		const T *values = tricubicStencil(position, iX, iY, iZ, wX, wY, wZ);
+
+		#if defined(HAVE_SIMD) && defined(__AVX__)
+		// the four neighbours along z per register, weighted along z at the end
+		__m256d acc = _mm256_setzero_pd();
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				__m256d p = _mm256_set_pd(row[iZ[3]], row[iZ[2]], row[iZ[1]], row[iZ[0]]);
+				acc = simdMulAdd(_mm256_set1_pd(wX[i] * wY[j]), p, acc);
+			}
+		acc = _mm256_mul_pd(acc, _mm256_set_pd(wZ[3], wZ[2], wZ[1], wZ[0]));
+		__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+		#else // HAVE_SIMD && __AVX__
+		double result = 0;
+		if (tricubicKernel(values, iX, iY, iZ, wX, wY, wZ, result))
+			return result;
+		for (int i = 0; i < 4; i++) {
+			double sumY = 0;
+			for (int j = 0; j < 4; j++) {
+				const T *row = values + iX[i] + iY[j];
+				double sumZ = 0;
+				for (int k = 0; k < 4; k++)
+					sumZ += wZ[k] * row[iZ[k]];
+				sumY += wY[j] * sumZ;
 			}
-			interpolateVaryX[iLoopX+1] = CubicInterpolateScalar(interpolateVaryY[0], interpolateVaryY[1], interpolateVaryY[2], interpolateVaryY[3], fY);
+			result += wX[i] * sumY;
 		}
-		double result = CubicInterpolateScalar(interpolateVaryX[0], interpolateVaryX[1], interpolateVaryX[2], interpolateVaryX[3], fX);
 		return result;
+		#endif // HAVE_SIMD && __AVX__
+	}
+
+	/** Interpolate the grid trilinear at a given position, from the ghost layers */
+	T trilinearInterpolateGhost(const Vector3d &position) const {
+		/** position on a unit grid */
+		Vector3d r = (position - gridOrigin) / spacing;
+		int iX, iY, iZ;
+		double fX0, fY0, fZ0;
+		ghostNeighbour(r.x, Nx, iX, fX0);
+		ghostNeighbour(r.y, Ny, iY, fY0);
+		ghostNeighbour(r.z, Nz, iZ, fZ0);
+		double fX1 = 1 - fX0, fY1 = 1 - fY0, fZ1 = 1 - fZ0;
+
+		/** the upper neighbours follow the lower ones, at most in the ghost layers */
+		const T *v = &ghost[(iX + ghostWidth) * ghostStrideX + (iY + ghostWidth) * ghostStrideY + iZ + ghostWidth];
+		const size_t dX = ghostStrideX, dY = ghostStrideY;
+		T b(0.);
+		b += v[0] * fX1 * fY1 * fZ1;
+		b += v[dX] * fX0 * fY1 * fZ1;
+		b += v[dY] * fX1 * fY0 * fZ1;
+		b += v[1] * fX1 * fY1 * fZ0;
+		b += v[dX + 1] * fX0 * fY1 * fZ0;
+		b += v[dY + 1] * fX1 * fY0 * fZ0;
+		b += v[dX + dY] * fX0 * fY0 * fZ1;
+		b += v[dX + dY + 1] * fX0 * fY0 * fZ0;
+		return b;
 	}
 
 	/** Interpolate the grid trilinear at a given position */
 	T trilinearInterpolate(const Vector3d &position) const {
+		if (ghostLayers)
+			return trilinearInterpolateGhost(position);
+
 		/** position on a unit grid */
 		Vector3d r = (position - gridOrigin) / spacing;
 
@@ -522,16 +1416,21 @@ private:
 		double fY1 = 1 - fY0;
 		double fZ1 = 1 - fZ0;
 
+		/** offsets of the neighbours per axis */
+		size_t oX0 = offsetX(iX0), oX1 = offsetX(iX1);
+		size_t oY0 = offsetY(iY0), oY1 = offsetY(iY1);
+		size_t oZ0 = offsetZ(iZ0), oZ1 = offsetZ(iZ1);
+
 		/** trilinear interpolation (see http://paulbourke.net/miscellaneous/interpolation) */
 		T b(0.);
-		b += get(iX0, iY0, iZ0) * fX1 * fY1 * fZ1;
-		b += get(iX1, iY0, iZ0) * fX0 * fY1 * fZ1;
-		b += get(iX0, iY1, iZ0) * fX1 * fY0 * fZ1;
-		b += get(iX0, iY0, iZ1) * fX1 * fY1 * fZ0;
-		b += get(iX1, iY0, iZ1) * fX0 * fY1 * fZ0;
-		b += get(iX0, iY1, iZ1) * fX1 * fY0 * fZ0;
-		b += get(iX1, iY1, iZ0) * fX0 * fY0 * fZ1;
-		b += get(iX1, iY1, iZ1) * fX0 * fY0 * fZ0;
+		b += grid[oX0 + oY0 + oZ0] * fX1 * fY1 * fZ1;
+		b += grid[oX1 + oY0 + oZ0] * fX0 * fY1 * fZ1;
+		b += grid[oX0 + oY1 + oZ0] * fX1 * fY0 * fZ1;
+		b += grid[oX0 + oY0 + oZ1] * fX1 * fY1 * fZ0;
+		b += grid[oX1 + oY0 + oZ1] * fX0 * fY1 * fZ0;
+		b += grid[oX0 + oY1 + oZ1] * fX1 * fY0 * fZ0;
+		b += grid[oX1 + oY1 + oZ0] * fX0 * fY0 * fZ1;
+		b += grid[oX1 + oY1 + oZ1] * fX0 * fY0 * fZ0;
 
 		return b;
 	}
@@ -542,6 +1441,8 @@ typedef Grid<Vector3f> Grid3f;
 typedef Grid<Vector3d> Grid3d;
 typedef Grid<float> Grid1f;
 typedef Grid<double> Grid1d;
+/** Grid of four components per point, see Vector4f and ModulatedMagneticFieldGrid */
+typedef Grid<Vector4f> Grid4f;
 
 // DEPRECATED: Will be removed in CRPropa v3.2
 class VectorGrid: public Grid3f {
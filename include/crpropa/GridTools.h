@@ -2,6 +2,7 @@
 #define CRPROPA_GRIDTOOLS_H
 
 #include "crpropa/Grid.h"
+#include "crpropa/CompressedGrid.h"
 #include "crpropa/magneticField/MagneticField.h"
 #include <string>
 #include <array>
@@ -21,6 +22,9 @@
  Vector components are stored per grid point in xyz-order.
  In case of plain-text files the vector components are separated by a blank or tab and grid points are stored one per line.
  All functions offer a conversion factor that is multiplied to all values.
+
+ Files written with dumpMappedGrid start with a header that describes the grid
+ and are mapped into memory with mapGrid3f and mapGrid1f instead of being read.
  */
 
 namespace crpropa {
@@ -62,6 +66,27 @@ double rmsFieldStrength(ref_ptr<Grid3f> grid);
  */
 std::array<float, 3> rmsFieldStrengthPerAxis(ref_ptr<Grid3f> grid);
 
+/** Evaluate the RMS of the divergence from central differences, in parallel.
+ The grid is continued periodically or reflectively, as for the interpolation.
+ For a divergence-free field, e.g. a turbulent grid, rmsDivergence * spacing /
+ rmsFieldStrength is small compared to 1.
+ @param grid		a vector grid (Grid3f)
+ @returns The RMS of div B in units of the values per length.
+ */
+double rmsDivergence(ref_ptr<Grid3f> grid);
+
+/** Evaluate the structure function S_p(l) = <|B(x + l) - B(x)|^p>, averaged
+ over the grid points and the lags l along the three axes, in parallel.
+ The grid is continued periodically or reflectively, as for the interpolation.
+ For a turbulent field, S_2(l) = 2 (B_rms^2 - C(l)) with the correlation C(l).
+ @param grid		a vector grid (Grid3f)
+ @param maxLag	largest lag in grid cells
+ @param order		order p of the structure function
+ @returns A vector with S_p for the lags 0, 1, ..., maxLag cells.
+ */
+std::vector<double> structureFunction(ref_ptr<Grid3f> grid, size_t maxLag,
+		double order = 2);
+
 /** Multiply all grid values by a given factor.
  @param grid		a scalar grid (Grid1f)
  @param a			scaling factor that will be used to multiply all points in grid
@@ -85,6 +110,98 @@ void fromMagneticField(ref_ptr<Grid3f> grid, ref_ptr<MagneticField> field);
  */
 void fromMagneticFieldStrength(ref_ptr<Grid1f> grid, ref_ptr<MagneticField> field);
 
+/** Copy of a vector grid with the values in the given memory layout.
+ @param grid		a vector grid (Grid3f)
+ @param layout	memory layout of the copy (DENSE, BRICKED)
+ */
+ref_ptr<Grid3f> convertLayout(ref_ptr<Grid3f> grid, gridLayout layout);
+
+/** Copy of a scalar grid with the values in the given memory layout.
+ @param grid		a scalar grid (Grid1f)
+ @param layout	memory layout of the copy (DENSE, BRICKED)
+ */
+ref_ptr<Grid1f> convertLayout(ref_ptr<Grid1f> grid, gridLayout layout);
+
+/** Grid of the vectors of a vector grid and the values of a scalar grid per
+ grid point, which interpolate(position) returns in one interpolation, see
+ ModulatedMagneticFieldGrid. Throws if the grids differ in size, origin,
+ spacing, boundary condition or interpolation type.
+ @param grid		a vector grid (Grid3f), for the first three components
+ @param modGrid	a scalar grid (Grid1f), for the fourth component
+ */
+ref_ptr<Grid4f> fuseGrids(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> modGrid);
+
+/** Compressed copy of a vector grid with 16 bit values, see CompressedGrid3f.
+ @param grid		a vector grid (Grid3f)
+ @param encoding	encoding of the values (FLOAT16, QUANTIZED_INT16)
+ */
+ref_ptr<CompressedGrid3f> compressGrid(ref_ptr<Grid3f> grid, gridEncoding encoding = FLOAT16);
+
+/** Decoded copy of a compressed vector grid.
+ @param grid		a compressed vector grid (CompressedGrid3f)
+ @param layout	memory layout of the copy (DENSE, BRICKED)
+ */
+ref_ptr<Grid3f> decompressGrid(ref_ptr<CompressedGrid3f> grid, gridLayout layout = DENSE);
+
+/** RMS of the difference between the grid points of a vector grid and its compressed copy.
+ Divide by rmsFieldStrength for the relative error.
+ @param grid		the original vector grid (Grid3f)
+ @param compressed	the compressed copy (CompressedGrid3f)
+ */
+double rmsCompressionError(ref_ptr<Grid3f> grid, ref_ptr<CompressedGrid3f> compressed);
+
+/**
+ @class GridFileInfo
+ @brief Description of a grid in a file written by dumpMappedGrid
+ */
+struct GridFileInfo {
+	size_t components; ///< 1 for scalar (Grid1f) and 3 for vector grids (Grid3f)
+	size_t Nx, Ny, Nz;
+	Vector3d origin;
+	Vector3d spacing;
+	bool reflective;
+	gridLayout layout;
+	double unit; ///< value of one unit of the stored values, e.g. nG
+	std::string unitName;
+};
+
+/** Dump a Grid3f with single precision and a header, for mapGrid3f.
+ The values are stored in the layout of the grid.
+ @param grid		a vector grid (Grid3f)
+ @param filename	name of output file
+ @param unit		unit of the stored values: every point in the grid is divided by it
+ @param unitName	name of the unit, for information
+ */
+void dumpMappedGrid(ref_ptr<Grid3f> grid, std::string filename,
+		double unit = 1, std::string unitName = "");
+
+/** Dump a Grid1f with single precision and a header, for mapGrid1f.
+ @param grid		a scalar grid (Grid1f)
+ @param filename	name of output file
+ @param unit		unit of the stored values: every point in the grid is divided by it
+ @param unitName	name of the unit, for information
+ */
+void dumpMappedGrid(ref_ptr<Grid1f> grid, std::string filename,
+		double unit = 1, std::string unitName = "");
+
+/** Read the header of a file written by dumpMappedGrid */
+GridFileInfo readGridFileInfo(std::string filename);
+
+/** Map a Grid3f from a file written by dumpMappedGrid.
+ The values are not read but mapped into memory, which is loaded page by page on
+ first access and shared by all processes that map the same file. Modified values
+ are copied for this process and not written to the file.
+ The values are in units of GridFileInfo::unit, which has to be applied when using
+ the grid, e.g. as scale of MagneticFieldGrid.
+ @param filename	name of input file
+ */
+ref_ptr<Grid3f> mapGrid3f(std::string filename);
+
+/** Map a Grid1f from a file written by dumpMappedGrid, as mapGrid3f.
+ @param filename	name of input file
+ */
+ref_ptr<Grid1f> mapGrid1f(std::string filename);
+
 /** Load a Grid3f from a binary file with single precision.
  @param grid		a vector grid (Grid3f)
  @param filename	name of input file
@@ -150,12 +267,41 @@ void dumpGridToTxt(ref_ptr<Grid1f> grid, std::string filename,
 		double conversion = 1);
 
 #ifdef CRPROPA_HAVE_FFTW3F
+/**
+ Plan the following FFTW transforms with all OpenMP threads. Does nothing if
+ FFTW is not built with threads (libfftw3f_omp or libfftw3f_threads).
+ Used by gridPowerSpectrum and the turbulent grid fields.
+*/
+void initFFTWThreads();
+
 /**
  Calculate the omnidirectional power spectrum E(k) for a given turbulent field
  @param grid	a three-dimensional grid
  @returns Returns a vector of pairs (k_i, E(k_i)).
 */
 std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid);
+
+/**
+ Calculate the correlation length Lc = 1/2 * sum_k (2 pi / k) E(k) / sum_k E(k)
+ from the omnidirectional energy spectrum E(k) of a cubic grid, with threaded
+ FFTW transforms (see initFFTWThreads); comparable to
+ TurbulenceSpectrum::getCorrelationLength of the field of e.g. GridTurbulence.
+ @param grid	a cubic vector grid (Grid3f) with periodic turbulence
+ @returns The correlation length in units of the grid spacing times the number
+	of cells, i.e. in the length units of the spacing.
+*/
+double gridCorrelationLength(ref_ptr<Grid3f> grid);
+
+/**
+ Calculate the relative magnetic helicity
+ sum_k k <A_k* . B_k> / sum_k |B_k|^2,
+ with the vector potential A_k = i k x B_k / k^2 (Coulomb gauge), of a cubic
+ grid with threaded FFTW transforms. It is between -1 and 1 and +-1 for a
+ maximally helical field, e.g. of HelicalGridTurbulence with H = +-1.
+ Two complex transforms are held in memory at a time.
+ @param grid	a cubic vector grid (Grid3f) with periodic turbulence
+*/
+double gridRelativeHelicity(ref_ptr<Grid3f> grid);
 #endif // CRPROPA_HAVE_FFTW3F
 
 /** @}*/
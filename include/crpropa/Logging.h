@@ -7,21 +7,26 @@
 
 #include <fstream>
 
-// make the kiss log functions available in python
+// make the kiss log functions available in python; the messages from python
+// share these statements, so they are not limited by setLogSiteLimit
 void inline logError(const std::string &log) {
-	KISS_LOG_ERROR << log;
+	if (kiss::Logger::getLogLevel() >= kiss::LOG_LEVEL_ERROR)
+		kiss::Logger(kiss::LOG_LEVEL_ERROR) << log;
 }
 
 void inline logInfo(const std::string &log) {
-	KISS_LOG_INFO << log;
+	if (kiss::Logger::getLogLevel() >= kiss::LOG_LEVEL_INFO)
+		kiss::Logger(kiss::LOG_LEVEL_INFO) << log;
 }
 
 void inline logWarning(const std::string &log) {
-	KISS_LOG_WARNING << log;
+	if (kiss::Logger::getLogLevel() >= kiss::LOG_LEVEL_WARNING)
+		kiss::Logger(kiss::LOG_LEVEL_WARNING) << log;
 }
 
 void inline logDebug(const std::string &log) {
-	KISS_LOG_DEBUG << log;
+	if (kiss::Logger::getLogLevel() >= kiss::LOG_LEVEL_DEBUG)
+		kiss::Logger(kiss::LOG_LEVEL_DEBUG) << log;
 }
 
 void setLogStream(std::ostream &stream) {
@@ -32,4 +37,19 @@ void setLogLevel(int level) {
 	kiss::Logger::setLogLevel(static_cast<kiss::eLogLevel>(level));
 }
 
+// messages are written from a background thread
+void inline setLogAsync(bool async) {
+	kiss::Logger::setAsync(async);
+}
+
+// at most limit messages per logging statement in the C++ code, 0 for no limit
+void inline setLogSiteLimit(size_t limit) {
+	kiss::Logger::setSiteLimit(limit);
+}
+
+// number of the messages per logging statement
+void inline printLogSummary() {
+	kiss::Logger::printSummary();
+}
+
 #endif // CRPROPA_LOGGING_H
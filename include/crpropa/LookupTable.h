@@ -0,0 +1,211 @@
+#ifndef CRPROPA_LOOKUPTABLE_H
+#define CRPROPA_LOOKUPTABLE_H
+
+#include "crpropa/Common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stddef.h>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class TableAxis
+ @brief Nodes of a lookup table with O(1) search of the interval
+
+ On assignment the nodes are checked for logarithmic or linear equidistant
+ spacing. For these the interval of a value is computed from log(x) or x
+ directly, otherwise a binary search is used.
+ */
+class TableAxis {
+public:
+	enum Spacing {
+		Irregular, Linear, Logarithmic
+	};
+
+private:
+	std::vector<double> X;
+	Spacing spacing;
+	double lo, invStep; ///< first node and inverse node spacing, both in log(X) for logarithmic spacing
+
+public:
+	TableAxis();
+	TableAxis(const std::vector<double> &X);
+	void assign(const std::vector<double> &X);
+
+	/** Index i of the interval X[i] <= x < X[i+1], in [0, size() - 2]; x has to be in the range of the nodes */
+	size_t index(double x) const;
+	/** Index of the node closest to x as closestIndex(x, X), clamped to the nodes */
+	size_t closest(double x) const;
+
+	size_t size() const {
+		return X.size();
+	}
+	bool empty() const {
+		return X.empty();
+	}
+	double operator[](size_t i) const {
+		return X[i];
+	}
+	double front() const {
+		return X.front();
+	}
+	double back() const {
+		return X.back();
+	}
+	const std::vector<double> &getNodes() const {
+		return X;
+	}
+	Spacing getSpacing() const {
+		return spacing;
+	}
+	/** Memory of the nodes in bytes */
+	size_t getSizeOf() const {
+		return vectorSizeOf(X);
+	}
+};
+
+/**
+ @class LogGridTable
+ @brief Linear interpolation in a 1D table, see interpolate
+
+ Gives the same results as interpolate(x, X, Y), i.e. Y is interpolated
+ linearly in x and continued with the first and last value outside of the
+ nodes, but the interval is found in constant time for the (mostly
+ log-equidistant) nodes of the interaction and photon field tables.
+ */
+class LogGridTable {
+private:
+	TableAxis X;
+	std::vector<double> Y;
+
+public:
+	LogGridTable();
+	LogGridTable(const std::vector<double> &X, const std::vector<double> &Y);
+	void assign(const std::vector<double> &X, const std::vector<double> &Y);
+
+	double operator()(double x) const {
+		if (not (x > X.front()))
+			return Y.front();
+		if (not (x < X.back()))
+			return Y.back();
+		size_t i = X.index(x);
+		return Y[i] + (x - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+	}
+
+	/** Interpolate n values at once: y[i] = (*this)(x[i]) */
+	void evaluate(const double *x, double *y, size_t n) const;
+
+	size_t size() const {
+		return Y.size();
+	}
+	bool empty() const {
+		return Y.empty();
+	}
+	const TableAxis &getAxis() const {
+		return X;
+	}
+	const std::vector<double> &getValues() const {
+		return Y;
+	}
+	/** Memory of the nodes and values in bytes */
+	size_t getSizeOf() const {
+		return X.getSizeOf() + vectorSizeOf(Y);
+	}
+};
+
+/**
+ @class UniformTable2D
+ @brief Bilinear interpolation in a 2D table, see interpolate2d
+
+ Gives the same results as interpolate2d(x, y, X, Y, Z): Z[i * Y.size() + j]
+ belongs to X[i], Y[j], and the result is 0 outside of the nodes. The
+ intervals are found in constant time for equidistant or log-equidistant
+ nodes.
+ */
+class UniformTable2D {
+private:
+	TableAxis X, Y;
+	std::vector<double> Z;
+
+public:
+	UniformTable2D();
+	UniformTable2D(const std::vector<double> &X, const std::vector<double> &Y,
+			const std::vector<double> &Z);
+	void assign(const std::vector<double> &X, const std::vector<double> &Y,
+			const std::vector<double> &Z);
+
+	double operator()(double x, double y) const {
+		if ((x < X.front()) or (x > X.back()) or (y < Y.front()) or (y > Y.back()))
+			return 0;
+		size_t i = X.index(x);
+		size_t j = Y.index(y);
+		size_t n = Y.size();
+		double fx = (x - X[i]) / (X[i + 1] - X[i]);
+		double fy = (y - Y[j]) / (Y[j + 1] - Y[j]);
+		double R1 = (1 - fx) * Z[i * n + j] + fx * Z[(i + 1) * n + j];
+		double R2 = (1 - fx) * Z[i * n + j + 1] + fx * Z[(i + 1) * n + j + 1];
+		return (1 - fy) * R1 + fy * R2;
+	}
+
+	/** Interpolate n values at once: z[i] = (*this)(x[i], y[i]) */
+	void evaluate(const double *x, const double *y, double *z, size_t n) const;
+
+	bool empty() const {
+		return Z.empty();
+	}
+	const TableAxis &getAxisX() const {
+		return X;
+	}
+	const TableAxis &getAxisY() const {
+		return Y;
+	}
+	const std::vector<double> &getValues() const {
+		return Z;
+	}
+	/** Memory of the nodes and values in bytes */
+	size_t getSizeOf() const {
+		return X.getSizeOf() + Y.getSizeOf() + vectorSizeOf(Z);
+	}
+};
+
+inline size_t TableAxis::index(double x) const {
+	size_t n = X.size();
+	if (n < 2)
+		return 0;
+	if (spacing == Irregular) {
+		size_t i = std::upper_bound(X.begin(), X.end(), x) - X.begin();
+		return std::min(n - 2, (i > 0) ? i - 1 : 0);
+	}
+
+	double p = ((spacing == Logarithmic) ? std::log(x) : x) - lo;
+	p *= invStep;
+	size_t i = (p > 0) ? size_t(std::min(p, double(n - 2))) : 0;
+	// correct for the rounding of the nodes
+	while ((i > 0) and (x < X[i]))
+		i--;
+	while ((i < n - 2) and (x >= X[i + 1]))
+		i++;
+	return i;
+}
+
+inline size_t TableAxis::closest(double x) const {
+	if (X.empty() or not (x > X.front()))
+		return 0;
+	if (not (x < X.back()))
+		return X.size() - 1;
+	size_t i = index(x);
+	if (x == X[i])
+		return i;
+	return (x - X[i] < X[i + 1] - x) ? i : i + 1;
+}
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_LOOKUPTABLE_H
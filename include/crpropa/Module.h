@@ -6,6 +6,7 @@
 #include "crpropa/Common.h"
 
 #include <string>
+#include <vector>
 
 namespace crpropa {
 
@@ -27,6 +28,76 @@ public:
 	inline void process(ref_ptr<Candidate> candidate) const {
 		process(candidate.get());
 	}
+	/** Process a deferred secondary of the parent, see
+	 ModuleList::setSecondaryRecordModule. The default creates the candidate
+	 and passes it to process; modules that can use the record as it is,
+	 e.g. the compact ParticleCollector, override it. */
+	virtual void processSecondaryRecord(const SecondaryRecord &record,
+			Candidate *parent) const;
+	/** Process the candidates of a batch in one call, e.g. of
+	 ModuleList::runLanes. The default calls process for each candidate;
+	 modules that vectorize over the candidates, e.g. PropagationCK, override
+	 it. Not available for overriding in Python. */
+	virtual void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+	/** Memory in bytes held by the module, e.g. its tables, fields and
+	 buffers; 0 by default. Tables shared with other modules are counted by
+	 each of them. Not thread-safe with process. */
+	virtual size_t getSizeOf() const;
+	/** Called by ModuleList::run after the primaries of a source, candidate
+	 vector or initial states are finished, e.g. to merge the per-thread
+	 state of the module (see ThreadSlots). The default does nothing;
+	 modules that hold further modules forward it. */
+	virtual void endRun();
+};
+
+/**
+ @class StochasticInteraction
+ @brief Interface of interaction modules that can be scheduled jointly.
+
+ Implemented by the interaction modules in addition to Module, see
+ InteractionScheduler.
+
+ With setRateTolerance, the modules and the InteractionScheduler reuse the
+ rate of a candidate (see Candidate::getRateCache) until its energy or
+ redshift drift past the tolerances or the particle id changes, instead of
+ interpolating the tables in every step. The rate is then that of the
+ start of the interval, e.g. up to 2% off for a tolerance of 0.01 in
+ log10(E) and a rate proportional to the energy.
+ */
+class StochasticInteraction {
+	double lgEnergyTolerance, redshiftTolerance;
+public:
+	StochasticInteraction();
+	virtual ~StochasticInteraction() {
+	}
+	/** Reuse the rate of a candidate within the tolerances; 0 for both
+	 (default) computes the rate in every step
+	 @param lgEnergy	tolerance in log10(E / J)
+	 @param redshift	tolerance in z
+	 */
+	void setRateTolerance(double lgEnergy, double redshift);
+	double getRateEnergyTolerance() const;
+	double getRateRedshiftTolerance() const;
+	/** Interaction rate of the current state, from the rate cache of the
+	 candidate if within the tolerances */
+	double getCachedInteractionRate(Candidate *candidate) const;
+	/** Interaction rate per comoving distance in [1/m] of the current state, 0 if the candidate does not interact */
+	virtual double getInteractionRate(Candidate *candidate) const = 0;
+	/** Perform a single interaction of the candidate, choosing among the channels of the module */
+	virtual void interact(Candidate *candidate) const = 0;
+protected:
+	/** Interaction loop of process for a batch of candidates, e.g. in
+	 Module::processBatch of the interaction modules: the rates, the
+	 interaction distances and the limits of the next steps are computed
+	 for all candidates in one pass, the distances with
+	 Random::fillExponential. The few candidates that interact within their
+	 step are then handled one by one, as in process. The random numbers are
+	 drawn in a different order than by process.
+	 @param candidates	candidates of the batch
+	 @param limit		fraction of the mean free path to limit the next step to
+	 */
+	void processInteractionBatch(const std::vector<ref_ptr<Candidate> > &candidates,
+			double limit) const;
 };
 
 
@@ -59,6 +130,10 @@ public:
 	void setMakeAcceptedInactive(bool makeInactive);
 	void setRejectFlag(std::string key, std::string value);
 	void setAcceptFlag(std::string key, std::string value);
+	/** Memory of the reject and accept actions */
+	size_t getSizeOf() const;
+	/** Forwarded to the reject and accept actions */
+	void endRun();
 };
 } // namespace crpropa
 
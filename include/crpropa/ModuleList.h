@@ -2,14 +2,81 @@
 #define CRPROPA_MODULE_LIST_H
 
 #include "crpropa/Candidate.h"
+#include "crpropa/Checkpoint.h"
+#include "crpropa/ConvergenceMonitor.h"
+#include "crpropa/Grid.h"
 #include "crpropa/Module.h"
+#include "crpropa/PrimaryCostModel.h"
+#include "crpropa/ProgressBar.h"
 #include "crpropa/Source.h"
+#include "crpropa/module/Output.h"
 
+#include <atomic>
+#include <functional>
 #include <list>
+#include <map>
 #include <sstream>
 
 namespace crpropa {
 
+/**
+ @class LaneStatistics
+ @brief Occupancy of the lanes of one thread in ModuleList::runLanes
+ */
+struct LaneStatistics {
+	size_t width; ///< number of lanes
+	size_t steps; ///< steps of the lanes, i.e. calls of processBatch
+	size_t laneSteps; ///< occupied lanes summed over the steps
+	size_t refills; ///< lanes filled with a new candidate
+	size_t primaries; ///< primaries taken from the source
+	size_t secondaries; ///< secondaries propagated in the lanes
+	LaneStatistics();
+	/** Fraction of the lanes that were occupied in the steps */
+	double getOccupancy() const;
+};
+
+/**
+ @class PipelineStatistics
+ @brief Queue of the source candidates in ModuleList::runPipelined
+
+ The wait times tell which stage is short of threads: producers that
+ often wait for a full queue could be fewer, workers that often wait for
+ an empty queue need more producers (or a larger queue for bursts).
+ */
+struct PipelineStatistics {
+	size_t producers; ///< threads taking candidates from the source
+	size_t workers; ///< threads that only propagate
+	size_t queueLimit; ///< capacity of the queue
+	size_t primaries; ///< primaries taken from the source
+	size_t peakDepth; ///< largest number of candidates in the queue
+	double depthSum; ///< queue depth summed over the candidates taken from it
+	double producerWaitTime; ///< seconds the producers waited for a full queue
+	double workerWaitTime; ///< seconds the threads waited for an empty queue
+	PipelineStatistics();
+	/** Mean number of candidates in the queue when one was taken */
+	double getMeanDepth() const;
+};
+
+/**
+ @class InitialStates
+ @brief Initial states of the primaries of ModuleList::run as arrays
+
+ The arrays are given by the caller, e.g. from NumPy, and have count
+ entries each; the positions and directions count x 3 entries. The ids and
+ energies are required, the other arrays are optional and default to the
+ values of the Candidate constructor if NULL.
+ */
+struct InitialStates {
+	size_t count; ///< number of primaries
+	const int *id;
+	const double *energy;
+	const double *position; ///< x, y, z of each primary
+	const double *direction; ///< x, y, z of each primary
+	const double *weight;
+	const double *redshift;
+	InitialStates();
+};
+
 /**
  @class ModuleList
  @brief The simulation itself: A list of simulation modules
@@ -18,10 +85,207 @@ class ModuleList: public Module {
 public:
 	typedef std::list<ref_ptr<Module> > module_list_t;
 	typedef std::vector<ref_ptr<Candidate> > candidate_vector_t;
+	/** Called with the number of a batch of submit() once it is finished */
+	typedef std::function<void(size_t batch)> BatchCallback;
+
+	/** Distribution of the primaries of run() over the OpenMP threads */
+	enum Schedule {
+		StaticSchedule, ///< fixed chunks assigned round-robin
+		DynamicSchedule, ///< chunks assigned on demand
+		GuidedSchedule, ///< chunks on demand, shrinking towards the end
+		AdaptiveSchedule ///< chunks on demand, sized from the measured cost per primary
+	};
+
+	/** Pinning of the OpenMP threads of run() to the cpus, see getThreadCpus */
+	enum ThreadAffinity {
+		NoAffinity, ///< threads move as the operating system or OMP_PROC_BIND decide
+		CompactAffinity, ///< thread i on the i-th cpu, filling one NUMA node after the other
+		SpreadAffinity ///< consecutive threads on alternating NUMA nodes
+	};
 
 	ModuleList();
 	virtual ~ModuleList();
 	void setShowProgress(bool show = true); ///< activate a progress bar
+	/** Report the progress to a function instead of the terminal or log,
+	 called periodically from a separate thread if setShowProgress is set */
+	void setProgressCallback(ProgressBar::Callback callback);
+	/** Propagate secondaries as independent OpenMP tasks.
+	 Idle threads then pick up the secondaries of a busy thread, so that
+	 cascades with many secondaries from a single primary are processed in
+	 parallel. Has no effect without OpenMP or if recursive is false.
+	 @param tasks	if true, each secondary is scheduled as a separate task
+	 */
+	void setSecondaryTasks(bool tasks = true);
+	bool getSecondaryTasks() const;
+	/** Release the secondaries from their parent when they are run.
+	 Each secondary is freed as soon as it and its own secondaries are
+	 finished, so that the memory of a cascade is bounded by the candidates
+	 still waiting to be run instead of the whole tree. The secondaries keep
+	 the serial numbers of their parent (Candidate::detachParent), but
+	 Candidate::secondaries is empty after the run.
+	 @param stream	if true, secondaries are released by their parent
+	 */
+	void setStreamSecondaries(bool stream = true);
+	bool getStreamSecondaries() const;
+	/** Count the references to the candidates of run(source, count) and
+	 their secondaries without atomic operations while one thread propagates
+	 them (default: false), see Candidate::makeShared.
+	 Only switch it on if no module or collector keeps references to
+	 candidates that other threads use without calling Candidate::makeShared,
+	 e.g. Python modules.
+	 @param confined	if true, candidates are confined to their thread
+	 */
+	void setThreadConfined(bool confined = true);
+	bool getThreadConfined() const;
+	/** Hand the deferred secondaries with the particle id to the module
+	 instead of propagating them, see Candidate::setDeferSecondaries and
+	 Module::processSecondaryRecord.
+	 @param id		particle id of the secondaries
+	 @param module	module for the records, NULL to propagate them again
+	 */
+	void setSecondaryRecordModule(int id, Module *module);
+	/** Write checkpoints in run(source, count), see Checkpoint.
+	 @param checkpoint	checkpoint to use, NULL to disable
+	 */
+	void setCheckpoint(Checkpoint *checkpoint);
+	Checkpoint *getCheckpoint() const;
+	/** Stop run(source, count) once the observables of the monitor reach
+	 its target uncertainty, see ConvergenceMonitor. The primaries are then
+	 processed in batches of the monitor, the statistics of several runs
+	 are accumulated until ConvergenceMonitor::reset.
+	 @param monitor	monitor to use, NULL to disable
+	 */
+	void setConvergenceMonitor(ConvergenceMonitor *monitor);
+	ConvergenceMonitor *getConvergenceMonitor() const;
+	/** Dispatch the primaries of run() longest-expected-first.
+	 The wall time of each primary and its secondaries is recorded in the
+	 model, which estimates the cost of the next primaries from their source
+	 energy and particle id, see PrimaryCostModel. run(source, count) takes
+	 PrimaryCostModel::getBatchSize() primaries from the source at once, each
+	 from its own stream with Random::seedStreams, and then propagates them
+	 in the order of their cost. The primaries are taken on demand, a static
+	 schedule is replaced by the dynamic one.
+	 @param model	cost model to use and train, NULL to disable
+	 */
+	void setCostModel(PrimaryCostModel *model);
+	PrimaryCostModel *getCostModel() const;
+	/** Dispatch the primaries of run() in the Morton (Z-order) of the cells
+	 of the grid that contain their positions, so that the primaries run at
+	 the same time, and those of one chunk, read the field values of nearby
+	 cells, e.g. of a large MagneticFieldGrid. The grid is continued
+	 periodically or reflectively, as given by its properties.
+	 run(source, count) takes batchSize primaries from the source at once,
+	 as with setCostModel, whose order is replaced by the locality order.
+	 Without effect with ordered outputs, see addOrderedOutput.
+	 @param grid		properties of the grid, NULL to disable
+	 @param batchSize	primaries taken from the source before ordering them
+	 */
+	void setLocalityOrder(GridProperties *grid, size_t batchSize = 100000);
+	GridProperties *getLocalityGrid() const;
+	size_t getLocalityBatchSize() const;
+	/** Write the rows of the output in the order of the primaries of
+	 run() for candidate vectors and sources, see Output::beginOrder.
+	 With Random::seedStreams the file is then the same for any number of
+	 threads, except for the serial numbers. A primary starts only once the
+	 primaries before it are no further back than the order window, which
+	 bounds the rows held in memory. The primaries are dispatched in their
+	 order, without a cost model, and on demand, a static schedule is
+	 replaced by the dynamic one. Not supported with setSecondaryTasks.
+	 @param output	output in the observers or modules of the list
+	 */
+	void addOrderedOutput(Output *output);
+	/** Maximum distance between the primaries in flight and the next
+	 primary of the ordered outputs (default: 10000) */
+	void setOrderWindow(size_t primaries);
+	size_t getOrderWindow() const;
+	/** Set the OpenMP schedule of run() for candidate vectors and sources.
+	 The default is given by the cmake option OMP_SCHEDULE.
+	 The adaptive schedule chooses chunks that take about 10 ms, but at
+	 most an eighth of the remaining primaries per thread.
+	 @param schedule	type of the schedule
+	 @param chunkSize	number of primaries per chunk, 0 for the OpenMP default
+						or, for the adaptive schedule, to start with one primary
+	 */
+	void setSchedule(Schedule schedule, size_t chunkSize = 0);
+	Schedule getSchedule() const;
+	size_t getScheduleChunkSize() const;
+	/** Number of candidates each thread takes from the source at once in
+	 run(source, count), see SourceInterface::getCandidates.
+	 The batches are aligned to multiples of the size in the primary index,
+	 so a schedule with larger chunks (e.g. static) should be used.
+	 With Random::seedStreams the batches are generated from their own
+	 streams, the results thus depend on the batch size but not on the threads.
+	 With Random::seedQuasiSources the candidates are taken one by one.
+	 @param size	number of candidates per batch, 1 to call getCandidate for each
+	 */
+	void setSourceBatchSize(size_t size);
+	size_t getSourceBatchSize() const;
+	/** Pin the threads to cpus during run() for candidate vectors and
+	 sources (default: NoAffinity); the previous affinity is restored after
+	 the run. Pinned threads keep the memory they first touch, e.g. their
+	 candidates, on their own NUMA node; for the fields read by all threads
+	 see Grid::interleave.
+	 @param affinity	placement of the threads
+	 */
+	void setThreadAffinity(ThreadAffinity affinity);
+	ThreadAffinity getThreadAffinity() const;
+	/** Time in seconds each thread spent on primaries in the last run */
+	const std::vector<double> &getThreadBusyTime() const;
+	/** Time in seconds each thread spent waiting in the last run */
+	const std::vector<double> &getThreadIdleTime() const;
+	/** Largest number of candidates in flight during the last run for
+	 candidate vectors and sources: primaries taken from the source (or
+	 being propagated) and not finished, and secondaries waiting for their
+	 propagation or being propagated */
+	size_t getPeakCandidates() const;
+	/** Largest number of secondaries in flight during the last run */
+	size_t getPeakSecondaries() const;
+	/** Memory in bytes held by the modules, see Module::getSizeOf */
+	size_t getSizeOf() const;
+	/** Call Module::endRun of the modules, done at the end of run */
+	void endRun();
+	/** Summary of the memory of the modules, the candidates in flight in
+	 the last run and the peak resident memory of the process, shown at the
+	 end of run with setShowProgress */
+	std::string getMemoryReport() const;
+	void showMemoryReport() const;
+
+	/** Start a pool of OpenMP threads that stays alive between the batches
+	 of submit(), so that many small batches are processed without starting
+	 a thread team, installing signal handlers or a progress bar each time.
+	 The team has one more thread than workers, which only waits, so that
+	 the random generator of the calling thread (Random::instance) stays
+	 free for it; the team size is limited by omp_get_max_threads(), for
+	 which the modules size their buffers per thread. Without OpenMP or
+	 with a single thread there is no worker, and submit() processes the
+	 batch before it returns. Do not call run() while the pool is active.
+	 @param workers		number of worker threads, 0 for omp_get_max_threads() - 1
+	 @param queueLimit	number of candidates waiting for a worker above
+						which submit() blocks, 0 for 64 per worker
+	 */
+	void startWorkers(size_t workers = 0, size_t queueLimit = 0);
+	/** Process the submitted candidates and stop the pool */
+	void stopWorkers();
+	bool hasWorkers() const;
+	/** Number of worker threads of the pool */
+	size_t getWorkers() const;
+	/** Queue a batch for the pool, which is started if necessary, and return
+	 the number of the batch. Blocks while the queue is full (backpressure),
+	 a batch larger than the limit is accepted once the queue is empty.
+	 With Random::seedStreams the i-th candidate submitted since
+	 startWorkers uses stream i.
+	 */
+	size_t submit(const candidate_vector_t &candidates, bool recursive = true, bool secondariesFirst = false);
+	/** As above, the callback is called by the worker that finishes the batch */
+	size_t submit(const candidate_vector_t &candidates, BatchCallback callback,
+			bool recursive = true, bool secondariesFirst = false);
+	bool isFinished(size_t batch) const;
+	/** Wait until the batch is finished */
+	void wait(size_t batch) const;
+	/** Wait until all submitted batches are finished */
+	void drain() const;
+	/** Number of submitted candidates that are not finished */
+	size_t getPendingCandidates() const;
 
 	void add(Module* module);
 	void remove(std::size_t i);
@@ -30,11 +294,70 @@ public:
 
 	void process(Candidate* candidate) const; ///< call process in all modules
 	void process(ref_ptr<Candidate> candidate) const; ///< call process in all modules
+	/** call processBatch in all modules */
+	void processBatch(const candidate_vector_t &candidates) const;
 
 	void run(Candidate* candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(ref_ptr<Candidate> candidate, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a single candidate
 	void run(const candidate_vector_t *candidates, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a candidate vector
 	void run(SourceInterface* source, size_t count, bool recursive = true, bool secondariesFirst = false); ///< run simulation for a number of candidates from the given source
+	/** Run the simulation for primaries given by their initial states.
+	 Each candidate is created by the thread that propagates it, right
+	 before its propagation, so that no candidate vector has to be built
+	 first. The serial numbers follow the order of the states.
+	 */
+	void run(const InitialStates &states, bool recursive = true, bool secondariesFirst = false);
+	/** Run the simulation for a number of candidates from the source in
+	 fixed-width lanes, for modules that propagate many candidates at once
+	 in processBatch, e.g. PropagationCK or PropagationBPDevice.
+	 Each thread holds up to width candidates, which take their steps
+	 together in one call of processBatch of each module. After each step
+	 the finished candidates are removed and their lanes are refilled, first
+	 from the secondaries waiting in the thread, most recent first, then
+	 from the source, so that the lanes stay full until the source and the
+	 secondaries run out, instead of draining as the candidates of a fixed
+	 batch finish one after the other. Threads without work take waiting
+	 secondaries from the busy ones.
+	 All modules process all lanes of a step, as ModuleList::process, a
+	 candidate deactivated by one module is thus still processed by the
+	 following ones in that step. Secondaries are always released by their
+	 parent, as with setStreamSecondaries. The random numbers are those of
+	 the thread, not of the primary (see Random::seedStreams), and the
+	 checkpoint, convergence monitor, cost model, locality and ordered
+	 outputs are not used. See getLaneStatistics for the occupancy.
+	 @param source		source of the primaries
+	 @param count		number of primaries
+	 @param width		number of lanes per thread
+	 @param recursive	if true, the secondaries are propagated
+	 */
+	void runLanes(SourceInterface* source, size_t count, size_t width = 64, bool recursive = true);
+	/** Run the simulation for a number of candidates from the source in
+	 two stages: producer threads take the candidates from the source, in
+	 batches of setSourceBatchSize, and put them into a bounded queue, from
+	 which the other threads take and propagate them. Expensive sources,
+	 e.g. SourceDensityGrid or emission maps, thus run next to the
+	 propagation instead of on its critical path; the producers propagate
+	 as well once the source is exhausted. With Random::seedStreams the
+	 results are those of run(source, count). For the third stage, the
+	 writing of the detected candidates, enable Output::setAsynchronous.
+	 The checkpoint, convergence monitor, cost model, locality and ordered
+	 outputs are not used. See getPipelineStatistics for the queue.
+	 Without a second thread the candidates are run by run(source, count).
+	 @param source		source of the primaries
+	 @param count		number of primaries
+	 @param producers	number of producer threads, at most the number of threads - 1
+	 @param queueLimit	number of candidates in the queue above which the
+						producers wait, 0 for 64 per thread
+	 @param recursive	if true, the secondaries are propagated
+	 */
+	void runPipelined(SourceInterface* source, size_t count, size_t producers = 1,
+			size_t queueLimit = 0, bool recursive = true);
+	/** Queue statistics of the last runPipelined */
+	const PipelineStatistics &getPipelineStatistics() const;
+	/** Occupancy of the lanes of each thread in the last runLanes */
+	const std::vector<LaneStatistics> &getLaneStatistics() const;
+	/** Fraction of the lanes of all threads occupied in the last runLanes */
+	double getLaneOccupancy() const;
 
 	std::string getDescription() const;
 	void showModules() const;
@@ -50,6 +373,60 @@ public:
 private:
 	module_list_t modules;
 	bool showProgress;
+	ProgressBar::Callback progressCallback;
+	ProgressBar *progress; ///< progress bar of the current run, counts the secondaries
+	bool secondaryTasks;
+	bool streamSecondaries;
+	bool threadConfined;
+	std::map<int, ref_ptr<Module> > secondaryRecordModules;
+	ref_ptr<Checkpoint> checkpoint;
+	ref_ptr<ConvergenceMonitor> convergenceMonitor;
+	ref_ptr<PrimaryCostModel> costModel;
+	ref_ptr<GridProperties> localityGrid;
+	size_t localityBatchSize;
+	std::vector<ref_ptr<Output> > orderedOutputs;
+	size_t orderWindow;
+	Schedule schedule;
+	size_t scheduleChunkSize;
+	size_t sourceBatchSize;
+	ThreadAffinity threadAffinity;
+	std::vector<double> threadBusyTime, threadIdleTime;
+	std::vector<LaneStatistics> laneStatistics;
+	PipelineStatistics pipelineStatistics;
+	std::atomic<long> candidatesInFlight, secondariesInFlight;
+	std::atomic<long> peakCandidates, peakSecondaries;
+	struct WorkerPool;
+	WorkerPool *workerPool;
+
+	/** Call body(i) for i in [begin, end) in parallel with the selected schedule */
+	template <typename Body>
+	void parallelLoop(size_t begin, size_t end, Body body);
+	/** Run the primaries [0, count) in the order, if given, each created
+	 with primary(i) */
+	template <typename Primary>
+	void runPrimaries(size_t count, const std::vector<size_t> &order,
+			bool recursive, Primary primary);
+	void showThreadTimes() const;
+	/** Add to the candidates in flight, of which secondaries are secondaries */
+	void countInFlight(long candidates, long secondaries);
+	void resetInFlight();
+	/** Indices of the candidates, longest expected cost first */
+	std::vector<size_t> costOrder(const candidate_vector_t &candidates) const;
+	/** Indices of the candidates in the Morton order of their grid cells */
+	std::vector<size_t> localityOrder(const candidate_vector_t &candidates) const;
+	/** Morton key of the grid cell of a position */
+	uint64_t localityKey(const Vector3d &position) const;
+	void beginOrder(size_t firstPrimary);
+	void endOrder();
+	/** Wait for the order window and mark the primary in the ordered outputs */
+	void beginPrimary(size_t i) const;
+	void endPrimary(size_t i) const;
+
+	/** Process one step and add its cost to the candidate, see Candidate::setCostAccounting */
+	void processCounted(Candidate* candidate) const;
+	void runSecondaries(Candidate* candidate, bool secondariesFirst);
+	/** Create the deferred secondaries or hand them to their record module */
+	void routeSecondaries(Candidate* candidate) const;
 };
 
 /**
@@ -64,6 +441,8 @@ public:
 	ModuleListRunner(ModuleList *mlist);
 	void process(Candidate *candidate) const; ///< call run of wrapped ModuleList
 	std::string getDescription() const;
+	size_t getSizeOf() const;
+	void endRun();
 };
 
 } // namespace crpropa
@@ -0,0 +1,126 @@
+#ifndef CRPROPA_MULTILEVELMONTECARLO_H
+#define CRPROPA_MULTILEVELMONTECARLO_H
+
+#include "crpropa/Module.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/Source.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class MultilevelMonteCarlo
+ @brief Multi-level Monte Carlo estimate of an observable over simulations of increasing accuracy
+
+ The levels are module lists of the same simulation with increasing
+ accuracy and cost, e.g. with decreasing tolerance of PropagationCK or step
+ size of DiffusionSDE. The observable of a primary is the sum of
+ weight * E^power over its candidates observed with energyMin <= E < energyMax;
+ the driver is the detection module that counts them, e.g.
+ observer->onDetection(mlmc), in each level.
+
+ The expectation at the finest level L is the telescoping sum
+ E[P_L] = E[P_0] + sum_l E[P_l - P_(l-1)].
+ A sample of level l > 0 propagates the same primary in level l and l - 1
+ with the same random numbers (the counter-based stream of the sample), so
+ that the difference has a small variance and few of the expensive fine
+ samples are needed. run estimates the variance V_l and the cost C_l (wall
+ time per sample) of each level from initial samples and adds samples until
+ N_l = (sum_k sqrt(V_k C_k)) sqrt(V_l / C_l) / targetUncertainty^2,
+ which minimizes the cost for the target uncertainty of the estimate.
+ The random generators of the threads are restored after the run.
+ ~~~
+ ref_ptr<MultilevelMonteCarlo> mlmc = new MultilevelMonteCarlo(1e-3);
+ for (size_t l = 0; l < 3; l++) {
+	 ref_ptr<ModuleList> sim = ...; // tolerance 1e-2, 1e-3, 1e-4
+	 observer->onDetection(mlmc);
+	 mlmc->addLevel(sim);
+ }
+ mlmc->run(source);
+ ~~~
+ */
+class MultilevelMonteCarlo: public Module {
+	struct Level {
+		ref_ptr<ModuleList> simulation;
+		size_t samples;
+		double sum, sum2; ///< of the differences to the coarser level
+		double fineSum; ///< of the observable at this level
+		double time; ///< wall time of all samples
+		Level(ModuleList *simulation);
+	};
+	std::vector<Level> levels;
+	double targetUncertainty;
+	size_t initialSamples;
+	uint64_t seed;
+	double energyMin, energyMax, energyPower;
+	mutable std::vector<double> threadSums; ///< observable of the primary of each thread
+
+	void runSamples(SourceInterface *source, size_t level, size_t samples);
+	/** Observable of the primary in the simulation, with the random stream */
+	double sample(ModuleList *simulation, Candidate *primary, uint64_t stream) const;
+
+public:
+	/** Constructor
+	 @param targetUncertainty	target absolute uncertainty (standard deviation) of the estimate
+	 @param initialSamples		samples of each level before the variances are estimated
+	 @param seed				key of the counter-based random streams of the samples
+	 */
+	MultilevelMonteCarlo(double targetUncertainty = 0.01,
+			size_t initialSamples = 100, uint64_t seed = 42);
+
+	/** Add the next finer level */
+	void addLevel(ModuleList *simulation);
+	/** Number of levels */
+	size_t size() const;
+
+	void setTargetUncertainty(double targetUncertainty);
+	double getTargetUncertainty() const;
+	void setInitialSamples(size_t samples);
+	size_t getInitialSamples() const;
+	/** Count the observed candidates with energyMin <= E < energyMax */
+	void setEnergyRange(double energyMin, double energyMax);
+	/** Count weight * E^power per observed candidate (default: 0, the weight) */
+	void setEnergyPower(double power);
+
+	/** Count an observed candidate */
+	void process(Candidate *candidate) const;
+
+	/** Run the samples for the target uncertainty, in parallel with OpenMP.
+	 The statistics of earlier runs are kept, see reset.
+	 @param source		source of the primaries
+	 @param maxSamples	maximum number of samples of all levels in this run
+	 */
+	void run(SourceInterface *source,
+			size_t maxSamples = std::numeric_limits<size_t>::max());
+	/** Discard the samples, the levels are kept */
+	void reset();
+
+	/** Estimate of the observable at the finest level */
+	double getValue() const;
+	/** Standard deviation of the estimate, infinite for a level with less than 2 samples */
+	double getUncertainty() const;
+	size_t getSamples(size_t level) const;
+	/** Mean difference of the observable to the coarser level, of the observable for level 0 */
+	double getLevelMean(size_t level) const;
+	/** Variance of the difference to the coarser level */
+	double getLevelVariance(size_t level) const;
+	/** Mean of the observable of the level alone */
+	double getLevelObservable(size_t level) const;
+	/** Wall time per sample in seconds */
+	double getLevelCost(size_t level) const;
+	/** Samples of the level for the target uncertainty from the current variances and costs */
+	size_t getOptimalSamples(size_t level) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_MULTILEVELMONTECARLO_H
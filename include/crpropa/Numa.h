@@ -0,0 +1,54 @@
+#ifndef CRPROPA_NUMA_H
+#define CRPROPA_NUMA_H
+
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @struct NumaNode
+ @brief Memory node of the machine and the cpus attached to it
+ */
+struct NumaNode {
+	int id;
+	std::vector<int> cpus;
+};
+
+/** The NUMA nodes of the machine (Linux, from /sys/devices/system/node),
+ a single node with all cpus if they are unknown */
+std::vector<NumaNode> getNumaNodes();
+
+/** The cpus the process may run on, in the order in which threads should be
+ pinned to them: node by node (compact), or alternating between the nodes
+ (spread), so that few threads already use the memory bandwidth of all nodes */
+std::vector<int> getThreadCpus(bool spread);
+
+/**
+ @class ThreadAffinityGuard
+ @brief Pins the calling thread to a cpu during its lifetime
+
+ Restores the previous affinity of the thread when destroyed. Does nothing
+ for cpu < 0 or where the affinity cannot be set (other than Linux).
+ */
+class ThreadAffinityGuard {
+	std::vector<unsigned long> previous;
+	bool pinned;
+
+	ThreadAffinityGuard(const ThreadAffinityGuard &);
+	ThreadAffinityGuard &operator=(const ThreadAffinityGuard &);
+public:
+	ThreadAffinityGuard(int cpu);
+	~ThreadAffinityGuard();
+	bool isPinned() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_NUMA_H
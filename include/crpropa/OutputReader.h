@@ -0,0 +1,123 @@
+#ifndef CRPROPA_OUTPUTREADER_H
+#define CRPROPA_OUTPUTREADER_H
+
+#include "crpropa/Source.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class OutputTable
+ @brief Columns of TextOutput and HDF5Output files in memory
+
+ The table holds one array per column of the file, e.g. for histograms or
+ as NumPy arrays, and is read by readText or readHDF5 much faster than
+ TextOutput::load fills a ParticleCollector: text files are split into byte
+ ranges that the threads parse at once, HDF5 files are read in hyperslabs
+ of many rows. SourceFromOutput creates candidates of the rows.
+
+ The columns are named as in the files (D, z, SN, ID, E, X, ..., W, tag and
+ the properties). All values are doubles in SI units, i.e. the columns of
+ trajectory lengths, positions and energies are multiplied by the length
+ and energy scale of the file; the tag column holds the codes of
+ Candidate::getTagCode. Columns that are not numbers, e.g. properties of
+ strings, are left out of HDF5 files and NaN in text files.
+ */
+class OutputTable: public Referenced {
+	std::vector<std::string> names;
+	std::vector<std::vector<double> > columns;
+
+	size_t index(const std::string &name) const;
+public:
+	OutputTable();
+	/** Table of the given (empty) columns */
+	OutputTable(const std::vector<std::string> &names);
+
+	/** Read a file of TextOutput, also compressed (.gz) if built with zlib
+	 @param filename	file written by a TextOutput
+	 @param threads		threads that parse the file, all OpenMP threads by default
+	 */
+	static ref_ptr<OutputTable> readText(const std::string &filename, int threads = 0);
+#ifdef CRPROPA_HAVE_HDF5
+	/** Read a file of HDF5Output, also the virtual dataset of a sharded output
+	 @param filename	file written by a HDF5Output
+	 @param chunkRows	rows read at once
+	 */
+	static ref_ptr<OutputTable> readHDF5(const std::string &filename, size_t chunkRows = 65536);
+#endif
+
+	/** Append the rows of a table with the same columns, e.g. of a shard */
+	void append(const OutputTable &other);
+
+	size_t getNumberOfRows() const;
+	size_t getNumberOfColumns() const;
+	const std::vector<std::string> &getColumnNames() const;
+	bool hasColumn(const std::string &name) const;
+	/** Values of a column; throws a runtime_error for unknown columns */
+	const std::vector<double> &getColumn(const std::string &name) const;
+	double get(const std::string &name, size_t row) const;
+};
+
+/** @}*/
+
+/** @addtogroup SourceFeatures
+ *  @{
+ */
+
+/**
+ @class SourceFromOutput
+ @brief Source of the candidates of the rows of an OutputTable
+
+ Re-injects the particles of past TextOutput or HDF5Output files, e.g. to
+ continue the propagation of their secondaries. Each candidate is created
+ with the current, source and created state of its row (a state without
+ columns is the current state; a state without heading columns, as in 1D
+ outputs, heads towards -x), weight, redshift, trajectory length and tag;
+ the other columns become properties of type double, unless NaN. The serial
+ numbers are new.
+
+ The rows are handed out in order, one at a time to the threads as by
+ SourceFromFile. Run count = getCount() candidates; asking for more throws a
+ runtime_error.
+ */
+class SourceFromOutput: public SourceInterface {
+	struct StateColumns {
+		const std::vector<double> *id, *energy, *position[3], *direction[3];
+	};
+	ref_ptr<OutputTable> table;
+	StateColumns current, source, created;
+	const std::vector<double> *trajectoryLength, *redshift, *weight, *tag;
+	std::vector<std::pair<PropertyKey, const std::vector<double> *> > properties;
+	mutable size_t next;
+
+	StateColumns stateColumns(const std::string &suffix) const;
+	const std::vector<double> *column(const std::string &name) const;
+	ParticleState state(const StateColumns &s, size_t i) const;
+	ref_ptr<Candidate> read(size_t i) const;
+public:
+	SourceFromOutput(ref_ptr<OutputTable> table);
+	ref_ptr<Candidate> getCandidate() const;
+	/** Append the next n candidates, fewer (and null pointers) at the end */
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const;
+	/** Number of rows of the table */
+	size_t getCount() const;
+	/** Number of candidates handed out so far */
+	size_t getPosition() const;
+	/** Start again with the first row */
+	void rewind();
+	std::string getDescription() const;
+};
+
+/**  @} */
+
+} // namespace crpropa
+
+#endif // CRPROPA_OUTPUTREADER_H
@@ -0,0 +1,70 @@
+#ifndef CRPROPA_PAGEMEMORY_H
+#define CRPROPA_PAGEMEMORY_H
+
+#include "crpropa/Referenced.h"
+
+#include <cstddef>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class PageMemory
+ @brief Memory with a chosen placement of its pages, for large tables
+
+ For large data that all threads read at random, e.g. the values of a Grid:
+ - Interleave distributes the pages round-robin over the NUMA nodes. On
+   machines with several sockets, memory on a single node (where the
+   loading thread first touched it) limits the threads to the bandwidth of
+   that node and lets the threads of the other sockets go through the
+   interconnect for every access.
+ - HugePages backs the memory with huge pages (2 MB on x86-64) to reduce
+   the TLB misses of random accesses: pages reserved in hugetlbfs if there
+   are enough, otherwise transparent huge pages (madvise).
+ What the system does not support is ignored, the memory is then ordinary
+ memory; getPageSize tells which pages were achieved. The memory is zero.
+ */
+class PageMemory: public Referenced {
+	void *region; ///< the mapping, aligned memory inside it
+	size_t regionSize;
+	void *memory;
+	size_t bytes;
+	unsigned int flags;
+	bool interleaved;
+	bool hugetlb;
+public:
+	enum Flags {
+		Interleave = 1, HugePages = 2
+	};
+
+	/** Constructor
+	 @param bytes	size of the memory
+	 @param flags	combination of Flags
+	 */
+	PageMemory(size_t bytes, unsigned int flags);
+	~PageMemory();
+	void *data() const;
+	size_t size() const;
+	unsigned int getFlags() const;
+	/** True if the pages are interleaved over more than one node */
+	bool isInterleaved() const;
+	/** Size of the pages backing the memory in bytes: the huge page size if
+	 (for transparent huge pages: some of) the touched memory is in huge
+	 pages, otherwise the normal page size */
+	size_t getPageSize() const;
+
+	/** Size of the normal pages */
+	static size_t getSystemPageSize();
+	/** Size of the (transparent) huge pages, 0 if there are none */
+	static size_t getHugePageSize();
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PAGEMEMORY_H
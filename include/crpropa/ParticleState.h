@@ -16,16 +16,27 @@ namespace crpropa {
  is assumed to be traveling at the exact speed of light.
  The cosmic ray state is defined by particle ID, energy and position and
  direction vector.
- For faster lookup mass and charge of the particle are stored as members.
+ For faster lookup mass and charge of the particle are stored as members,
+ as well as the properties of the ID that the modules query in each step
+ (mass and charge number, type of the particle, isotope index), which setId
+ decodes once.
  */
 class ParticleState {
 private:
+	enum TypeFlags {
+		NucleusFlag = 1, LeptonFlag = 2, PhotonFlag = 4, NeutrinoFlag = 8
+	};
+
 	int id; ///< particle ID (Particle Data Group numbering scheme)
 	double energy; ///< total energy
 	Vector3d position; ///< position vector in comoving coordinates
 	Vector3d direction; ///< unit vector of velocity or momentum
 	double pmass; ///< particle rest mass
 	double charge; ///< particle charge
+	int A; ///< mass number, as massNumber(id)
+	int Z; ///< charge number, as chargeNumber(id)
+	int isotope; ///< Z * 31 + N for nuclei up to Z = 26, N = 30, otherwise -1
+	unsigned int flags; ///< TypeFlags
 
 public:
 	/** Constructor for a particle state.
@@ -94,6 +105,35 @@ public:
 	 */
 	double getMass() const;
 
+	/** Mass number A of nuclei, as massNumber(getId()); 0 for other particles */
+	int getMassNumber() const {
+		return A;
+	}
+	/** Charge number Z of nuclei, as chargeNumber(getId()); 0 for other particles */
+	int getChargeNumber() const {
+		return Z;
+	}
+	/** Index Z * 31 + N of the isotope in the tables of the nuclear
+	 interactions and the nuclear mass, -1 beyond Z = 26, N = 30 and for
+	 other particles */
+	int getIsotopeIndex() const {
+		return isotope;
+	}
+	/** True for nuclei including the neutron, as isNucleus(getId()) */
+	bool isNucleus() const {
+		return flags & NucleusFlag;
+	}
+	/** True for charged leptons and neutrinos */
+	bool isLepton() const {
+		return flags & LeptonFlag;
+	}
+	bool isPhoton() const {
+		return flags & PhotonFlag;
+	}
+	bool isNeutrino() const {
+		return flags & NeutrinoFlag;
+	}
+
 	/** Set Lorentz factor and modify the particle's energy accordingly.
 	 @param gamma		Lorentz factor
 	 */
@@ -2,6 +2,7 @@
 #define CRPROPA_PHOTONBACKGROUND_H
 
 #include "crpropa/Common.h"
+#include "crpropa/LookupTable.h"
 #include "crpropa/Referenced.h"
 
 #include <vector>
@@ -31,6 +32,10 @@ public:
 	 @param z			redshift (if redshift dependent, default = 0.)
 	 */
 	virtual double getPhotonDensity(double ePhoton, double z = 0.) const = 0;
+	/** getPhotonDensity for n photon energies, evaluated in parallel, e.g.
+	 for spectra from Python (getPhotonDensities_numpyArray) */
+	void getPhotonDensities(const double *ePhoton, double *densities, size_t n,
+			double z = 0.) const;
 	virtual double getMinimumPhotonEnergy(double z) const = 0;
 	virtual double getMaximumPhotonEnergy(double z) const = 0;
 	virtual std::string getFieldName() const {
@@ -88,6 +93,10 @@ protected:
 	std::vector<double> photonDensity;
 	std::vector<double> redshifts;
 	std::vector<double> redshiftScalings;
+
+	LogGridTable densityTable;
+	UniformTable2D densityTable2d;
+	LogGridTable scalingTable;
 };
 
 /**
@@ -238,14 +247,23 @@ public:
 /**
  @class BlackbodyPhotonField
  @brief Photon field decorator for black body photon fields.
+
+ The interaction modules use the tables of the field name if the data path
+ has them, otherwise the tables of the CMB rescaled to the temperature, see
+ interactionTableField.
  */
 class BlackbodyPhotonField: public PhotonField {
 public:
+	/** Temperature of the CMB, to which the tables of the CMB refer [K] */
+	static const double cmbTemperature;
+
 	BlackbodyPhotonField(const std::string fieldName, const double blackbodyTemperature);
 	double getPhotonDensity(double ePhoton, double z = 0.) const;
 	double getMinimumPhotonEnergy(double z) const;
 	double getMaximumPhotonEnergy(double z) const;
 	void setQuantile(double q);
+	/** Temperature of the field [K] */
+	double getBlackbodyTemperature() const;
 
 protected:
 	double blackbodyTemperature;
@@ -261,9 +279,29 @@ protected:
  */
 class CMB: public BlackbodyPhotonField {
 public:
-	CMB() : BlackbodyPhotonField("CMB", 2.73) {}
+	CMB() : BlackbodyPhotonField("CMB", cmbTemperature) {}
 };
 
+/**
+ Field name of the tables of an interaction module for a photon field, and
+ the factor by which the module rescales them.
+
+ In a blackbody field of temperature T, the rates at a Lorentz factor or
+ energy x are R_T(x) = s^3 R_CMB(s x) with s = T / T_CMB, and the
+ distributions of the invariants of the interactions at x are those of the
+ CMB at s x. A BlackbodyPhotonField without tables of its own, i.e. without
+ the file getDataPath(prefix + name + ".txt"), therefore uses the tables of
+ the CMB with the scale s, so that fields of any temperature need no tables;
+ all other fields use their own tables with s = 1.
+ @param field		photon field of the module
+ @param prefix		path of the tables in the data path up to the field name, e.g. "EMPairProduction/rate_"
+ @param scale		set to s
+ @param nameLength	number of characters of the field name in the file names, all by default
+ @returns			field name of the tables, shortened to nameLength
+ */
+std::string interactionTableField(const PhotonField &field, const std::string &prefix,
+		double &scale, size_t nameLength = std::string::npos);
+
 
 } // namespace crpropa
 
@@ -11,6 +11,19 @@
 
 namespace crpropa {
 
+/**
+ Photon, electron or positron at the start of the cascade calculation,
+ as written by PhotonOutput1D or kept in memory with PhotonOutput1D::collect
+ */
+struct CascadeParticle {
+	int id;          //!< particle id
+	double energy;   //!< energy [J]
+	double distance; //!< comoving distance to the observer [m]
+	CascadeParticle(int id = 0, double energy = 0, double distance = 0) :
+			id(id), energy(energy), distance(distance) {
+	}
+};
+
 /**
  Propagate photons, electrons and positrons using the EleCa code.
  The propagation is stopped when the particles reach the observer or their energy drops below the threshold energy.
@@ -36,6 +49,25 @@ void DintPropagation(
 	double aCutcascade_Magfield = 0       //!< a-parameter, see CRPropa 2 paper
 	);
 
+/**
+ Calculate the electromagnetic cascade of particles kept in memory with DINT.
+ The particles are split into a fixed number of groups of neighbouring
+ distances that are propagated in parallel, each with a copy of the cascade
+ calculation that shares the interaction tables, and then combined from the
+ largest distance down. The groups do not depend on the number of threads,
+ so neither does the spectrum. It differs slightly from a serial
+ calculation, as the spectrum of the farther groups crosses each group in
+ one step instead of one step per distance bin.
+ */
+void DintPropagation(
+	const std::vector<CascadeParticle> &particles, //!< particles, e.g. from PhotonOutput1D::collect
+	const std::string &outputfile,        //!< output spectrum (photons, electrons, positrons)
+	int IRFlag = 4,                       //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
+	int RadioFlag = 4,                    //!< radio background 0: high, 1: medium, 2: obs, 3: none, 4: Protheroe'96
+	double magneticFieldStrength = 1E-13, //!< magnetic field strength [T], default = 1 nG
+	double aCutcascade_Magfield = 0       //!< a-parameter, see CRPropa 2 paper
+	);
+
 /**
  Propagate photons using EleCa for energies above the crossover energy and DINT below
  */
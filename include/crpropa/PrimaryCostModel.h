@@ -0,0 +1,91 @@
+#ifndef CRPROPA_PRIMARYCOSTMODEL_H
+#define CRPROPA_PRIMARYCOSTMODEL_H
+
+#include "crpropa/Candidate.h"
+#include "crpropa/Referenced.h"
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class PrimaryCostModel
+ @brief Expected wall time of a primary from its particle id and energy
+
+ With ModuleList::setCostModel, run() measures the wall time of each primary
+ and its secondaries and records it in the model, binned in the particle id
+ and the logarithm of the source energy. The expected cost of a primary is
+ the mean of its bin; without samples in the bin it is extrapolated from the
+ closest energy bin of the particle, or from the mean cost per energy of all
+ primaries, assuming that the cost grows linearly with the energy.
+ Without any samples the energy itself orders the primaries.
+ The model is kept across runs, record and getCost are thread-safe.
+ ~~~
+ ref_ptr<PrimaryCostModel> costModel = new PrimaryCostModel();
+ sim->setCostModel(costModel);
+ sim->setSchedule(ModuleList::DynamicSchedule, 1);
+ sim->run(source, 1000000);
+ ~~~
+ */
+class PrimaryCostModel: public Referenced {
+	struct Bin {
+		double time; ///< sum of the wall times
+		size_t samples;
+		Bin() : time(0), samples(0) {
+		}
+	};
+	typedef std::map<std::pair<int, int>, Bin> BinMap;
+
+	BinMap bins;
+	double totalTime;
+	double totalEnergy;
+	size_t totalSamples;
+	double binsPerDecade;
+	size_t batchSize;
+	mutable std::mutex mutex;
+
+	int energyBin(double energy) const;
+
+public:
+	/** Constructor
+	 @param binsPerDecade	number of energy bins per decade
+	 @param batchSize		primaries that run(source, count) takes from the
+	 						source before ordering them
+	 */
+	PrimaryCostModel(double binsPerDecade = 4, size_t batchSize = 100000);
+
+	/** Record the wall time of a primary with the particle id and energy */
+	void record(int id, double energy, double seconds);
+	/** Record the wall time of a primary, from its source state */
+	void record(const Candidate *candidate, double seconds);
+	/** Expected wall time in seconds of a primary with the particle id and
+	 energy, or the energy in Joule if nothing was recorded */
+	double getCost(int id, double energy) const;
+	/** Expected wall time of a primary, from its source state */
+	double getCost(const Candidate *candidate) const;
+
+	/** Number of recorded primaries */
+	size_t getSamples() const;
+	/** Mean recorded wall time per primary, 0 if nothing was recorded */
+	double getMeanCost() const;
+	/** Discard all samples */
+	void reset();
+
+	double getBinsPerDecade() const;
+	/** Primaries that run(source, count) takes from the source at once, then
+	 orders and propagates. Larger batches order more primaries, but hold
+	 all of them in memory. */
+	void setBatchSize(size_t batchSize);
+	size_t getBatchSize() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_PRIMARYCOSTMODEL_H
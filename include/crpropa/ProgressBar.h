@@ -1,8 +1,13 @@
 #ifndef CRPROPA_PROGRESSBAR_H
 #define CRPROPA_PROGRESSBAR_H
 
-#include <string>
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
 
 namespace crpropa {
 
@@ -11,33 +16,80 @@ namespace crpropa {
  * @{
  */
 
-/** 
+/**
+ @struct ProgressStatus
+ @brief Progress of a run as reported by ProgressBar
+ */
+struct ProgressStatus {
+	unsigned long primaries; ///< number of finished primaries
+	unsigned long secondaries; ///< number of secondaries created so far
+	unsigned long total; ///< number of primaries of the run
+	double elapsed; ///< time since the start in seconds
+	double primaryRate; ///< primaries per second since the last report
+	double secondaryRate; ///< secondaries per second since the last report
+	double eta; ///< estimated time to go in seconds
+};
+
+/**
  @class ProgressBar
  @brief Track the evolution of the simulations with a progress bar
+
+ The counters are atomic and update() does not lock, so that it can be
+ called from all threads. A reporter thread started with start() samples
+ the counters periodically and draws the bar, or writes log lines if the
+ output is not a terminal (e.g. in batch systems). The time to go is
+ estimated from the recent cost per primary.
  */
 class ProgressBar {
+public:
+	typedef std::function<void(const ProgressStatus &)> Callback;
+
 private:
 	unsigned long _steps;
-	unsigned long _currentCount;
+	std::atomic<unsigned long> _currentCount;
+	std::atomic<unsigned long> _secondaries;
 	unsigned long _maxbarLength;
-	unsigned long _nextStep;
-	unsigned long _updateSteps;
 	time_t _startTime;
 	std::string stringTmpl;
 	std::string arrow;
 
+	double interval;
+	bool logLines;
+	Callback callback;
+
+	// reporter thread
+	std::thread reporter;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool running;
+
+	// state of the rates and the time estimate
+	double startTime, lastTime;
+	unsigned long lastCount, lastSecondaries;
+	double cost; ///< smoothed wall time per primary in seconds
+	ProgressStatus status;
+
+	void report();
+	void print(const ProgressStatus &s);
+
 public:
 	/** Constructor to initialize a progress bar
 	 @param steps		number of steps
-	 @param updateSteps	progress bar will be updated at the steps given by this parameter
+	 @param updateSteps	unused, the bar is updated periodically, see setInterval
 	 */
 	ProgressBar(unsigned long steps = 0, unsigned long updateSteps = 100);
+	~ProgressBar();
+	/** Print the title and start the reporter thread */
 	void start(const std::string &title);
+	/** Stop the reporter thread and print the final state */
+	void stop();
 
 	/** Update the progressbar
 	 This should be called steps times in a loop.
 	*/
-	void update(); 
+	void update();
+	/** Count secondaries created in the run */
+	void addSecondaries(unsigned long n);
 
 	/** Sets the position of the progress bar to a given value
 	 @param position	current position of the progress bar
@@ -47,6 +99,15 @@ public:
 	/** Mark the progress bar with an error
 	 */
 	void setError();
+
+	/** Time between two reports in seconds (default 1) */
+	void setInterval(double seconds);
+	/** Write log lines instead of the bar; the default for non-terminals */
+	void setLogLines(bool lines);
+	/** Function called by the reporter thread with each report */
+	void setCallback(Callback callback);
+	/** Status of the last report */
+	ProgressStatus getStatus();
 };
 /** @}*/
 
@@ -72,6 +72,7 @@
 #include <stdexcept>
 #include <algorithm>
 
+#include <atomic>
 #include <stdint.h>
 #include <string>
 
@@ -82,6 +83,8 @@
 
 namespace crpropa {
 
+class AliasSampler;
+
 /**
  * \addtogroup Core
  * @{
@@ -93,11 +96,25 @@ namespace crpropa {
  Mersenne Twister random number generator -- a C++ class Random
  Based on code by Makoto Matsumoto, Takuji Nishimura, and Shawn Cokus
  Richard J. Wagner  v1.0  15 May 2003  rjwagner@writeme.com
+
+ Alternatively the generator can run in a counter-based mode (seedStream),
+ where the numbers are the Philox4x32-10 encryption of a counter
+ (J. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+ A stream is then fully defined by a key, a stream number and a position,
+ which allows to give every primary its own stream independent of the
+ thread that processes it (see seedStreams).
+
+ For quasi-Monte Carlo sampling (seedSobol), the numbers are the coordinates
+ of one point of an Owen-scrambled Sobol sequence (direction numbers of
+ S. Joe and F. Y. Kuo, SIAM J. Sci. Comput. 30, 2635 (2008), hash-based
+ scrambling of B. Burley, JCGT 9, 1 (2020)), one dimension per number.
  */
 class Random {
 public:
 	enum {N = 624}; // length of state vector
 	enum {SAVE = N + 1}; // length of array for save()
+	enum {SOBOL_DIM = 16}; // dimensions of the Sobol sequence
+	enum {STREAM_BUFFER = 32}; // values of the counter-based mode generated at once
 
 protected:
 	enum {M = 397}; // period parameter
@@ -106,6 +123,19 @@ protected:
 	uint32_t *pNext;// next value to get from state
 	int left;// number of values left before reload needed
 
+	// counter-based mode
+	bool counterBased;
+	uint64_t streamKey;
+	uint64_t streamId;
+	uint64_t streamPosition; // number of 32-bit values drawn from the stream
+	uint32_t streamBuffer[STREAM_BUFFER]; // output of the counters around streamPosition
+
+	// quasi-random mode
+	bool quasiRandom;
+	uint32_t sobolIndex;
+	uint64_t sobolScramble;
+	unsigned int sobolDimension; // next coordinate of the point
+
 //Methods
 public:
 	/// initialize with a simple uint32_t
@@ -140,16 +170,34 @@ public:
 	double randExponential();
 	/// Normal distributed random number
 	double randNorm( const double& mean = 0.0, const double& variance = 1.0 );
+	/// n standard normal distributed random numbers, from both branches of the Box-Muller method
+	void randNormArray(double *values, size_t n);
+
+	// Bulk access: the same numbers as the corresponding calls one by one,
+	// generated in vectorizable loops
+	void fillInt(uint32_t *values, size_t n); ///< n times randInt()
+	void fillUniform(double *values, size_t n); ///< n times rand()
+	void fillUniform(double *values, size_t n, double min, double max); ///< n times randUniform(min, max)
+	/// n normal distributed numbers with the given mean and standard deviation,
+	/// as randNormArray with the vectorized log and sincos of SimdMath.h
+	void fillNormal(double *values, size_t n, double mean = 0, double sigma = 1);
+	/// n exponential distributed numbers in (0,inf), -log(randDblExc());
+	/// unlike randExponential without rejection, hence other numbers
+	void fillExponential(double *values, size_t n);
 	/// Uniform distribution in [min, max]
 	double randUniform(double min, double max);
 	/// Rayleigh distributed random number
 	double randRayleigh(double sigma);
 	/// Fisher distributed random number
 	double randFisher(double k);
+	/// Poisson distributed number of events with the given mean
+	uint64_t randPoisson(double mean);
 
 	/// Draw a random bin from a (unnormalized) cumulative distribution function, without leading zero.
 	size_t randBin(const std::vector<float> &cdf);
 	size_t randBin(const std::vector<double> &cdf);
+	/// Draw a random bin in constant time, see AliasSampler
+	size_t randBin(const AliasSampler &sampler);
 
 	/// Random point on a unit-sphere
 	Vector3d randVector();
@@ -197,9 +245,48 @@ public:
 	friend std::ostream& operator<<( std::ostream& os, const Random& mtrand );
 	friend std::istream& operator>>( std::istream& is, Random& mtrand );
 
+	/// Switch to the counter-based mode: draw from stream number 'stream' of
+	/// the run with the given key, starting at 'position'
+	void seedStream(uint64_t key, uint64_t stream, uint64_t position = 0);
+	bool isCounterBased() const;
+	uint64_t getStreamKey() const;
+	uint64_t getStream() const;
+	uint64_t getStreamPosition() const;
+	/// Number of a new stream derived from the current stream and position,
+	/// e.g. for the i-th secondary that is processed in a separate task
+	uint64_t deriveStream(uint64_t i) const;
+
 	static Random &instance();
+	/// Seed the Mersenne Twister of all threads, disables seedStreams
 	static void seedThreads(const uint32_t oneSeed);
 	static std::vector< std::vector<uint32_t> > getSeedThreads();
+	/// Reproducible mode for ModuleList::run: primary i and its secondaries
+	/// use stream i of the key 'runSeed', whichever thread processes them.
+	/// Thus the results are the same for any OpenMP schedule and number of threads.
+	static void seedStreams(uint64_t runSeed);
+	static bool useStreams();
+	static uint64_t getStreamsSeed();
+	/// If seedStreams is active, switch the generator of the calling thread to the given stream
+	static void selectStream(uint64_t stream);
+
+	/// Switch to the quasi-random mode: the next SOBOL_DIM 32-bit numbers are
+	/// the coordinates of point 'index' of the Sobol sequence scrambled with
+	/// 'scramble', the generator continues as before after them or endSobol
+	void seedSobol(uint64_t index, uint64_t scramble);
+	void endSobol();
+	bool isQuasiRandom() const;
+	/// Number of coordinates drawn from the current Sobol point
+	unsigned int getSobolDimension() const;
+	/// Quasi-Monte Carlo mode for ModuleList::run(source, count): the source
+	/// features of primary i draw from point i of the Sobol sequence scrambled
+	/// with 'scrambleSeed', the propagation from the pseudo-random generator.
+	static void seedQuasiSources(uint64_t scrambleSeed);
+	static void disableQuasiSources();
+	static bool useQuasiSources();
+	/// If seedQuasiSources is active, switch the generator of the calling
+	/// thread to point 'index' until endQuasiPoint
+	static void selectQuasiPoint(uint64_t index);
+	static void endQuasiPoint();
 
 protected:
 	/// Initialize generator state with seed
@@ -233,6 +320,102 @@ protected:
 	/// Based on code by Lawrence Kirby (fred@genesis.demon.co.uk)
 	static uint32_t hash( time_t t, clock_t c );
 
+	/// Philox4x32-10 blocks first, first + 1, ... of the stream, 4 values each
+	void philox(uint64_t first, uint32_t *values, size_t blocks) const;
+	/// Next scrambled coordinate of the Sobol point
+	uint32_t sobol();
+
+};
+
+/** Bin of an alias table, see AliasSampler */
+struct AliasBin {
+	float probability; ///< acceptance probability of the bin
+	uint32_t alias; ///< bin drawn if the bin is not accepted
+};
+
+/**
+ @class AliasSampler
+ @brief Discrete distribution with constant time draws (Walker's alias method)
+
+ Bin i is drawn with probability weight[i] / sum(weight), like randBin for the
+ corresponding cumulative distribution. The table of acceptance
+ probabilities and aliases is built once, in O(n), on the first draw after
+ the weights changed; afterwards a draw costs two random numbers and no
+ search, independent of the number of bins. Bins can be added during the
+ setup of a simulation, but not while other threads are drawing.
+ */
+class AliasSampler {
+private:
+	mutable std::vector<double> weights; ///< all weights while the table is not built
+	mutable std::vector<AliasBin> table;
+	mutable std::atomic<bool> stale; ///< weights changed since the table was built
+	double total;
+	size_t n;
+
+	void build() const;
+	void restoreWeights();
+
+public:
+	AliasSampler();
+	/** Sampler for the given (unnormalized, non-negative) weights */
+	AliasSampler(const std::vector<double> &weights);
+	AliasSampler(const AliasSampler &sampler);
+	AliasSampler &operator=(const AliasSampler &sampler);
+
+	/** Append a bin with the given weight */
+	void add(double weight);
+	void setWeights(const std::vector<double> &weights);
+	void setWeights(const std::vector<float> &weights);
+	/** Weights from an (unnormalized) cumulative distribution without leading zero, as for randBin */
+	void setCDF(const std::vector<double> &cdf);
+	void setCDF(const std::vector<float> &cdf);
+	void clear();
+
+	/** Number of bins */
+	size_t size() const;
+	bool empty() const;
+	/** Sum of the weights */
+	double getTotalWeight() const;
+	/** Draw a bin; bin 0 if all weights are zero, as randBin */
+	size_t draw(Random &random) const;
+	/** Build the table now instead of on the first draw */
+	void prepare() const;
+	/** Memory of the weights and the table in bytes */
+	size_t getSizeOf() const;
+};
+
+/**
+ @class AliasTable
+ @brief Alias tables of several distributions in one contiguous array
+
+ For the tabulated secondary energy distributions of the interactions, where
+ the distribution is selected by a row index (e.g. the primary energy) and
+ all rows have the same number of bins. A draw from row i reads one bin of
+ the table, see AliasSampler.
+ */
+class AliasTable {
+private:
+	size_t nBins;
+	std::vector<AliasBin> table;
+
+public:
+	AliasTable();
+	/** Append a row given as (unnormalized) cumulative distribution without leading zero, as for randBin */
+	void addCDF(const std::vector<double> &cdf);
+	void clear();
+
+	/** Number of rows */
+	size_t size() const;
+	/** Number of bins per row */
+	size_t bins() const;
+	/** Memory of the table in bytes */
+	size_t getSizeOf() const;
+	/** Draw a bin of the given row; bin 0 if all weights of the row are zero, as randBin */
+	size_t draw(size_t row, Random &random) const {
+		const AliasBin &bin = table[row * nBins + random.randInt(uint32_t(nBins - 1))];
+		size_t i = &bin - &table[row * nBins];
+		return (random.randExc() < bin.probability) ? i : bin.alias;
+	}
 };
 /** @}*/
 
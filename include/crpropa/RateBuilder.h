@@ -0,0 +1,97 @@
+#ifndef CRPROPA_RATEBUILDER_H
+#define CRPROPA_RATEBUILDER_H
+
+#include "crpropa/PhotonBackground.h"
+#include "crpropa/Referenced.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup PhotonFields
+ * @{
+ */
+
+/**
+ @class RateBuilder
+ @brief Compute the interaction tables of a photon field in-process
+
+ The interaction modules read their rates and cumulative rates from files
+ in the data directory, named after the photon field. For a custom photon
+ field these tables are computed here from PhotonField::getPhotonDensity at
+ z = 0, in parallel over the energies, and written in the format of the data
+ files to <cache directory>/<hash>/<module>/. The hash is computed from the
+ sampled photon density, so that a changed field gets new tables and an
+ unchanged field reuses the cached ones. DataTable keeps a binary copy of
+ the tables next to the text files, see DataTable.
+
+ After registerTables() (called by buildAll) the modules find the tables via
+ getDataPath:
+ ~~~
+ RateBuilder builder(field);
+ builder.buildAll();
+ ref_ptr<EMPairProduction> pp = new EMPairProduction(field);
+ ~~~
+ The cross sections and integrals follow the scripts that produced the data
+ files: rate(E) = 1 / (8 E^2) int sigma(s) s_kin I(s_kin / 4E) ds_kin for the
+ electromagnetic interactions and rate(Gamma) = 1 / (2 Gamma^2) int sigma(eps')
+ eps' I(eps' / 2 Gamma) deps' for photo-pion production on nucleons, with
+ I(x) = int_x dn/deps / eps^2 deps. Photo-disintegration needs the nuclear
+ cross sections and branching ratios, which are not part of CRPropa, and
+ the pair spectrum of ElectronPairProduction is still taken from the data
+ directory.
+ */
+class RateBuilder: public Referenced {
+private:
+	ref_ptr<PhotonField> photonField;
+	std::string fieldName;
+	std::string cacheDirectory;
+	std::string hash;
+
+	// photon density sampled at z = 0 on a logarithmic grid
+	double lnEpsMin, dlnEps;
+	std::vector<double> density; ///< eps dn/deps [1/m^3]
+	std::vector<double> integral; ///< I(eps) = int_eps dn/deps' / eps'^2 deps' [1/m^3/J^2]
+
+	void samplePhotonField();
+	double photonIntegral(double eps) const;
+	double photonDensity(double eps) const;
+
+	std::string tableFile(const std::string &module, const std::string &prefix) const;
+	bool haveTable(const std::string &filename) const;
+
+	typedef double (*CrossSection)(double s);
+	void buildEM(const std::string &module, CrossSection sigma, double mass,
+			double sKinMin, bool centered, bool cumulative);
+
+public:
+	/** Constructor
+	 @param field			photon field, sampled once on construction
+	 @param cacheDirectory	directory of the table cache; default $CRPROPA_CACHE_PATH or crpropa_cache
+	 */
+	RateBuilder(ref_ptr<PhotonField> field, const std::string &cacheDirectory = "");
+
+	/** Hash of the sampled photon density and the table format */
+	std::string getHash() const;
+	/** Directory of the tables of this field: <cache directory>/<hash> */
+	std::string getDirectory() const;
+
+	void buildEMPairProduction();
+	void buildEMDoublePairProduction();
+	void buildEMTripletPairProduction();
+	void buildEMInverseComptonScattering();
+	void buildElectronPairProduction();
+	void buildPhotoPionProduction();
+	/** Build all tables that are not cached yet and register them */
+	void buildAll();
+
+	/** Let getDataPath find the tables of this field, see addDataPath */
+	void registerTables() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_RATEBUILDER_H
@@ -23,16 +23,21 @@ namespace crpropa {
  Every reference increases the reference counter, every dereference decreases it.
  When the counter is decreased to 0, the object is deleted.
  Candidate, Module, MagneticField and Source inherit from this class
+
+ The counter is changed atomically, unless the object is thread confined
+ (setThreadConfined): then all its references are made and released by one
+ thread at a time, e.g. a candidate during its propagation by one worker,
+ and the counter is changed without the costly atomic operations.
  */
 class Referenced {
 public:
 
 	inline Referenced() :
-			_referenceCount(0) {
+			_referenceCount(0), _threadConfined(false) {
 	}
 
 	inline Referenced(const Referenced&) :
-			_referenceCount(0) {
+			_referenceCount(0), _threadConfined(false) {
 	}
 
 	inline Referenced& operator =(const Referenced&) {
@@ -40,6 +45,8 @@ public:
 	}
 
 	inline size_t addReference() const {
+		if (_threadConfined)
+			return ++_referenceCount;
 		int newRef;
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
@@ -61,6 +68,9 @@ public:
 					<< typeid(*this).name() << std::endl;
 #endif
 		int newRef;
+		if (_threadConfined) {
+			newRef = --_referenceCount;
+		} else {
 #if defined(OPENMP_3_1)
 		#pragma omp atomic capture
 		{newRef = _referenceCount--;}
@@ -70,6 +80,7 @@ public:
 		#pragma omp critical
 		{newRef = _referenceCount--;}
 #endif
+		}
 
 		if (newRef == 0) {
 			delete this;
@@ -85,6 +96,19 @@ public:
 		return _referenceCount;
 	}
 
+	/** Count the references without atomic operations.
+	 Only valid while all references are made and released by the same
+	 thread, or by threads that synchronize, e.g. tasks and taskwait.
+	 Must be switched off (by the confining thread) before the object is
+	 handed to threads that run concurrently. */
+	inline void setThreadConfined(bool confined) const {
+		_threadConfined = confined;
+	}
+
+	inline bool isThreadConfined() const {
+		return _threadConfined;
+	}
+
 protected:
 
 	virtual inline ~Referenced() {
@@ -96,6 +120,7 @@ protected:
 	}
 
 	mutable size_t _referenceCount;
+	mutable bool _threadConfined;
 };
 
 inline void intrusive_ptr_add_ref(Referenced* p) {
@@ -0,0 +1,106 @@
+#ifndef CRPROPA_SCRATCHVECTOR_H
+#define CRPROPA_SCRATCHVECTOR_H
+
+#include <cstddef>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ScratchVector
+ @brief Per-thread reusable vector for the temporaries of a step
+
+ A ScratchVector borrows an empty std::vector<T> from a pool of the calling
+ thread and gives it back, cleared but with its capacity, when it goes out
+ of scope, e.g. at the end of process. Nested scratch vectors of a thread
+ borrow different vectors. Once the vectors of a thread have grown to the
+ largest use, the temporaries of the further steps do not allocate:
+ ~~~
+ ScratchVector<double> energies; // instead of std::vector<double>
+ energies->push_back(E);
+ ~~~
+ A ScratchVector has to be destroyed by the thread that created it, and
+ must not outlive the thread, e.g. as a member of a module.
+ */
+template<class T>
+class ScratchVector {
+	struct Pool {
+		std::vector<std::vector<T> *> vectors;
+		~Pool() {
+			for (size_t i = 0; i < vectors.size(); i++)
+				delete vectors[i];
+		}
+	};
+
+	static Pool &pool() {
+		static thread_local Pool p;
+		return p;
+	}
+
+	std::vector<T> *v;
+
+	void borrow() {
+		Pool &p = pool();
+		if (p.vectors.empty()) {
+			v = new std::vector<T>();
+		} else {
+			v = p.vectors.back();
+			p.vectors.pop_back();
+		}
+	}
+
+	ScratchVector(const ScratchVector &);
+	ScratchVector &operator=(const ScratchVector &);
+public:
+	ScratchVector() {
+		borrow();
+	}
+
+	/** Scratch vector of n copies of the value */
+	explicit ScratchVector(size_t n, const T &value = T()) {
+		borrow();
+		v->assign(n, value);
+	}
+
+	~ScratchVector() {
+		v->clear();
+		pool().vectors.push_back(v);
+	}
+
+	std::vector<T> &operator*() {
+		return *v;
+	}
+
+	const std::vector<T> &operator*() const {
+		return *v;
+	}
+
+	std::vector<T> *operator->() {
+		return v;
+	}
+
+	const std::vector<T> *operator->() const {
+		return v;
+	}
+
+	T &operator[](size_t i) {
+		return (*v)[i];
+	}
+
+	const T &operator[](size_t i) const {
+		return (*v)[i];
+	}
+
+	size_t size() const {
+		return v->size();
+	}
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_SCRATCHVECTOR_H
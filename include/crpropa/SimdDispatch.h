@@ -0,0 +1,83 @@
+#ifndef CRPROPA_SIMDDISPATCH_H
+#define CRPROPA_SIMDDISPATCH_H
+
+#include <stddef.h>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** SIMD instruction sets of the runtime kernels, see getSimdKernels */
+enum SimdLevel {
+	SIMD_NONE = 0, ///< no kernels, the portable code is used
+	SIMD_AVX,      ///< SSE4.2 and AVX
+	SIMD_AVX2,     ///< AVX2 and FMA
+	SIMD_AVX512    ///< AVX-512F, AVX2 and FMA
+};
+
+/**
+ @struct SimdKernels
+ @brief SIMD kernels compiled for one SimdLevel and chosen at runtime
+
+ Independent of SIMD_EXTENSIONS, the kernels are compiled for each SimdLevel
+ (on x86 with GCC or Clang) and the best one the CPU supports is used. So one
+ binary uses e.g. AVX-512 on the nodes that have it and AVX2 on the others.
+ Code that is compiled with AVX anyway, e.g. with SIMD_EXTENSIONS "native",
+ uses its inline SIMD code instead. A null kernel is not available.
+
+ Vectors are passed as x, y, z triples, e.g. the values of an array of
+ Vector3d, so that the files of the kernels, which are compiled for their
+ instruction set, have no inline functions in common with the rest of the
+ library.
+ */
+struct SimdKernels {
+	/** Weighted sum of the 4 x 4 x 4 neighbours values[iX[i] + iY[j] + iZ[k]]
+	 with the weights wX[i] * wY[j] * wZ[k], see Grid::tricubicStencil; the
+	 values of the vector grids are triples, the indices count triples */
+	void (*tricubic3f)(const float *values, const size_t iX[4],
+			const size_t iY[4], const size_t iZ[4], const double wX[4],
+			const double wY[4], const double wZ[4], float result[3]);
+	void (*tricubic3d)(const double *values, const size_t iX[4],
+			const size_t iY[4], const size_t iZ[4], const double wX[4],
+			const double wY[4], const double wZ[4], double result[3]);
+	double (*tricubic1d)(const double *values, const size_t iX[4],
+			const size_t iY[4], const size_t iZ[4], const double wX[4],
+			const double wY[4], const double wZ[4]);
+
+	/** Sum of the wavemodes of PlaneWaveTurbulence (FAST_WAVES) at nPos
+	 positions. The data holds the rows A * xi (x, y, z), k * kappa / pi
+	 (x, y, z) and beta / pi, each of n values, n a multiple of 16 and the
+	 rows aligned to 64 bytes. The positions and fields are triples. */
+	void (*planeWaves)(const double *data, int n, const double *positions,
+			double *fields, size_t nPos);
+	/** planeWaves in single precision */
+	void (*planeWavesFloat)(const float *data, int n, const double *positions,
+			double *fields, size_t nPos);
+
+	/** Elementwise functions of n numbers, see SimdMath.h */
+	void (*logArray)(const double *x, double *y, size_t n);
+	void (*log10Array)(const double *x, double *y, size_t n);
+	void (*expArray)(const double *x, double *y, size_t n);
+	void (*pow10Array)(const double *x, double *y, size_t n);
+	void (*sinCosArray)(const double *x, double *s, double *c, size_t n);
+};
+
+/** Highest SimdLevel that the CPU supports and this build has kernels for,
+ limited by setSimdLevel or by the environment variable CRPROPA_SIMD
+ ("none", "avx", "avx2" or "avx512") */
+SimdLevel getSimdLevel();
+/** Limit the kernels to the given level, e.g. to compare them; the level is
+ at most the one supported. Set it before the simulation, not during. */
+void setSimdLevel(SimdLevel level);
+/** Name of the level as for CRPROPA_SIMD */
+std::string getSimdLevelName(SimdLevel level);
+/** Kernels of getSimdLevel() */
+const SimdKernels &getSimdKernels();
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_SIMDDISPATCH_H
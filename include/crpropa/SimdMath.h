@@ -0,0 +1,40 @@
+#ifndef CRPROPA_SIMDMATH_H
+#define CRPROPA_SIMDMATH_H
+
+#include <stddef.h>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ Elementwise functions of arrays for the batched sampling, e.g. of the source
+ features (Source::getCandidates). They are vectorized for the instruction set
+ of getSimdKernels(), or for the baseline of the build without SIMD kernels,
+ and agree with libm within the bounds given below. The arrays may be the
+ same (in place), but must not overlap otherwise.
+ */
+
+/** y = log(x); relative error below 2e-16 for positive x, also subnormal;
+ -inf for 0, nan for negative x */
+void simdLog(const double *x, double *y, size_t n);
+/** y = log10(x); error as simdLog, relative error below 3e-16 */
+void simdLog10(const double *x, double *y, size_t n);
+/** y = exp(x); relative error below 3e-16; inf for x > 709.78 and 0 for
+ x < -708.39, where the result would be subnormal */
+void simdExp(const double *x, double *y, size_t n);
+/** y = 10^x; relative error below 3e-16; inf for x > 308.25 and 0 for
+ x < -307.65 */
+void simdPow10(const double *x, double *y, size_t n);
+/** y = x^a = exp(a log(x)) for x > 0; relative error below
+ (1 + |a log(x)|) 3e-16 */
+void simdPow(const double *x, double a, double *y, size_t n);
+/** s = sin(x), c = cos(x); absolute error below 2e-16 for |x| < 1e5 */
+void simdSinCos(const double *x, double *s, double *c, size_t n);
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_SIMDMATH_H
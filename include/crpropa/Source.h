@@ -4,6 +4,8 @@
 #include "crpropa/Candidate.h"
 #include "crpropa/Grid.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/LookupTable.h"
+#include "crpropa/Random.h"
 #include "crpropa/massDistribution/Density.h"
 
 
@@ -18,6 +20,12 @@ namespace crpropa {
 /**
  @class SourceFeature
  @brief Abstract base class for specific source features
+
+ Features that only modify the particle state, and not the other properties
+ of the candidate, override isParticleFeature to return true. For a batch of
+ candidates (Source::getCandidates) they are then applied to an array of
+ particle states with prepareParticles, which cheap features implement as a
+ loop over the array.
  */
 class SourceFeature: public Referenced {
 protected:
@@ -25,6 +33,12 @@ protected:
 public:
 	virtual void prepareParticle(ParticleState& particle) const {};
 	virtual void prepareCandidate(Candidate& candidate) const;
+	/** Prepare n particle states, by default calls prepareParticle for each */
+	virtual void prepareParticles(ParticleState *particles, size_t n) const;
+	/** Prepare n candidates, by default calls prepareCandidate for each */
+	virtual void prepareCandidates(ref_ptr<Candidate> *candidates, size_t n) const;
+	/** True if the feature only acts on the particle state (see prepareParticles) */
+	virtual bool isParticleFeature() const;
 	std::string getDescription() const;
 };
 
@@ -36,6 +50,8 @@ public:
 class SourceInterface : public Referenced {
 public:
 	virtual ref_ptr<Candidate> getCandidate() const = 0;
+	/** Append n new candidates to out, by default calls getCandidate n times */
+	virtual void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const;
 	virtual std::string getDescription() const = 0;
 };
 
@@ -47,12 +63,18 @@ public:
  This class is a container for source features.
  The source prepares a new candidate by passing it to all its source features
  to be modified accordingly.
+ For a batch of candidates, the leading features that only act on the
+ particle state prepare an array of states first, from which the candidates
+ are created with consecutive serial numbers. The remaining features are then
+ applied feature by feature. The candidates hence differ from those of
+ repeated calls of getCandidate only in the order of the random numbers.
  */
 class Source: public SourceInterface {
 	std::vector<ref_ptr<SourceFeature> > features;
 public:
 	void add(SourceFeature* feature);
 	ref_ptr<Candidate> getCandidate() const;
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const;
 	std::string getDescription() const;
 };
 
@@ -66,7 +88,7 @@ public:
  */
 class SourceList: public SourceInterface {
 	std::vector<ref_ptr<Source> > sources;
-	std::vector<double> cdf;
+	AliasSampler sampler;
 public:
 	/** Add an individual source to the list.
 	 @param source		source to be added
@@ -78,6 +100,78 @@ public:
 };
 
 
+/**
+ @class SourceCatalog
+ @brief Catalogue of many point sources with one set of source features
+
+ For catalogues of e.g. galaxies with 10^6 entries, where a SourceList of a
+ Source per entry would need millions of objects. The positions, weights,
+ redshifts and the optional spectral parameters of the sources are held in
+ one array each, the source of a candidate is drawn with an alias table in
+ constant time (see AliasSampler).
+
+ A candidate starts at the position of the drawn source, with its redshift,
+ and is then prepared by the features of the catalogue, which are the same
+ for all sources (e.g. SourceParticleType, SourceIsotropicEmission). Sources
+ with spectral parameters finally get an energy from a power law dN/dE ~
+ E^index between the minimum energy of the catalogue and the maximum energy
+ of the source; the energy of the other sources is set by the features.
+ */
+class SourceCatalog: public SourceInterface {
+	std::vector<double> x, y, z; ///< positions
+	std::vector<double> weights, redshifts;
+	std::vector<double> indices, maxEnergies; ///< spectra, empty if no source has one
+	AliasSampler sampler;
+	std::vector<ref_ptr<SourceFeature> > features;
+	double minEnergy;
+
+	void prepareSource(size_t i, Candidate &candidate) const;
+	void prepareSpectrum(size_t i, Candidate &candidate) const;
+public:
+	/** Constructor
+	 @param minEnergy	minimum energy of the spectra of the sources
+	 */
+	SourceCatalog(double minEnergy = 0);
+	/** Add a source
+	 @param position	position of the source
+	 @param weight		weight (luminosity) of the source
+	 @param redshift	redshift of the emission
+	 */
+	void add(const Vector3d &position, double weight = 1, double redshift = 0);
+	/** Add a source with a power-law spectrum
+	 @param position	position of the source
+	 @param weight		weight (luminosity) of the source
+	 @param redshift	redshift of the emission
+	 @param index		differential spectral index
+	 @param maxEnergy	maximum energy
+	 */
+	void add(const Vector3d &position, double weight, double redshift,
+			double index, double maxEnergy);
+	/** Add a feature that prepares the candidates of all sources */
+	void add(SourceFeature *feature);
+	/** Reserve memory for n sources */
+	void reserve(size_t n);
+	void setMinimumEnergy(double minEnergy);
+	double getMinimumEnergy() const;
+
+	/** Number of sources */
+	size_t size() const;
+	Vector3d getPosition(size_t i) const;
+	double getWeight(size_t i) const;
+	double getRedshift(size_t i) const;
+	/** True if the source has a spectrum */
+	bool hasSpectrum(size_t i) const;
+	double getSpectralIndex(size_t i) const;
+	double getMaximumEnergy(size_t i) const;
+	/** Memory of the arrays and the alias table in bytes */
+	size_t getSizeOf() const;
+
+	ref_ptr<Candidate> getCandidate() const;
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const;
+	std::string getDescription() const;
+};
+
+
 /**
  @class SourceParticleType
  @brief Particle type at the source
@@ -95,6 +189,7 @@ public:
 	*/
 	SourceParticleType(int id);
 	void prepareParticle(ParticleState &particle) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -135,7 +230,7 @@ public:
  */
 class SourceMultipleParticleTypes: public SourceFeature {
 	std::vector<int> particleTypes;
-	std::vector<double> cdf;
+	AliasSampler sampler;
 public:
 	/** Constructor
 	 */
@@ -164,6 +259,7 @@ public:
 	 */
 	SourceEnergy(double energy);
 	void prepareParticle(ParticleState &particle) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -186,6 +282,8 @@ public:
 	 */
 	SourcePowerLawSpectrum(double Emin, double Emax, double index);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *particles, size_t n) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -201,7 +299,7 @@ class SourceComposition: public SourceFeature {
 	double Rmax;
 	double index;
 	std::vector<int> nuclei;
-	std::vector<double> cdf;
+	AliasSampler sampler;
 public:
 	/** Constructor
 	 @param Emin		minimum energy (in Joules)
@@ -221,6 +319,8 @@ public:
 	 */
 	void add(int A, int Z, double abundance);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *particles, size_t n) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -242,6 +342,7 @@ public:
 	 */
 	SourcePosition(double d);
 	void prepareParticle(ParticleState &state) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -252,7 +353,7 @@ public:
  */
 class SourceMultiplePositions: public SourceFeature {
 	std::vector<Vector3d> positions;
-	std::vector<double> cdf;
+	AliasSampler sampler;
 public:
 	/** Constructor.
 	 The sources must be added individually to the object.
@@ -282,6 +383,8 @@ public:
 	 */
 	SourceUniformSphere(Vector3d center, double radius);
 	void prepareParticle(ParticleState &particle) const;
+	void prepareParticles(ParticleState *particles, size_t n) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -370,6 +473,9 @@ public:
  The origin of the distribution is the Galactic center. The default maximum radius is set 
  to rMax=20 kpc and the default maximum height is zMax = 5 kpc.
  See G. Case and D. Bhattacharya (1996) for the details of the distribution.
+ The radius is drawn from a table of the inverse cumulative distribution,
+ built when the parameters are set, and the height from the inverse of the
+ exponential distribution.
  */
 class SourceSNRDistribution: public SourceFeature {
 	double rEarth; // parameter given by observation
@@ -381,6 +487,8 @@ class SourceSNRDistribution: public SourceFeature {
 	double rMax; // maximum radial distance - default 20 kpc 
 		      // (due to the extension of the JF12 field)
 	double zMax; // maximum distance from galactic plane - default 5 kpc
+	LogGridTable rTable; // inverse cumulative distribution of the radius
+	void updateRTable();
 public:
 	/** Default constructor. 
 	 Default parameters are:
@@ -428,6 +536,7 @@ public:
  The pulsar distribution is explained in detail in C.-A. Faucher-Giguere
  and V. M. Kaspi, ApJ 643 (May, 2006) 332. The radial distribution is 
  parametrized as in Blasi and Amato, JCAP 1 (Jan., 2012) 10.
+ Radius and height are sampled as in SourceSNRDistribution.
  */
 class SourcePulsarDistribution: public SourceFeature {
 	double rEarth; // parameter given by observation
@@ -439,6 +548,8 @@ class SourcePulsarDistribution: public SourceFeature {
 	double zMax; // maximum distance from galactic plane - default 5 kpc
 	double rBlur; // relative smearing factor for the radius
 	double thetaBlur; // smearing factor for the angle. Unit = [1/length]
+	LogGridTable rTable; // inverse cumulative distribution of the radius
+	void updateRTable();
 public:
 	/** Default constructor. 
 	 Default parameters are:
@@ -506,6 +617,7 @@ public:
 	 */
 	SourceUniform1D(double minD, double maxD, bool withCosmology = true);
 	void prepareParticle(ParticleState& particle) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -513,12 +625,24 @@ public:
 /**
  @class SourceDensityGrid
  @brief Random source positions from a density grid
+
+ The cells are drawn hierarchically: a brick of 8^3 cells with an alias
+ table over the non-empty bricks, a row of 8 cells within the brick from the
+ cumulative weights of its 64 rows, and the cell from the density values of
+ the row. Besides the grid this needs about half a byte per cell of the
+ non-empty bricks, and a draw takes constant time. Negative densities are
+ treated as 0.
  */
 class SourceDensityGrid: public SourceFeature {
 	ref_ptr<Grid1f> grid;
+	size_t nBricksY, nBricksZ;
+	std::vector<uint32_t> bricks; // indices of the non-empty bricks
+	std::vector<float> rowCdfs; // cumulative weights of the rows, 64 per brick
+	AliasSampler brickSampler;
 public:
 	/** Constructor
-	 @param densityGrid 	3D grid containing the density of sources in each cell
+	 @param densityGrid 	3D grid containing the density of sources in each cell;
+	 						the grid is not modified
 	 */
 	SourceDensityGrid(ref_ptr<Grid1f> densityGrid);
 	void prepareParticle(ParticleState &particle) const;
@@ -532,9 +656,11 @@ public:
  */
 class SourceDensityGrid1D: public SourceFeature {
 	ref_ptr<Grid1f> grid;
+	AliasSampler sampler;
 public:
 	/** Constructor
-	 @param densityGrid 	1D grid containing the density of sources in each cell
+	 @param densityGrid 	1D grid containing the density of sources in each cell;
+	 						the grid is not modified
 	 */
 	SourceDensityGrid1D(ref_ptr<Grid1f> densityGrid);
 	void prepareParticle(ParticleState &particle) const;
@@ -552,6 +678,7 @@ public:
 	 */
 	SourceIsotropicEmission();
 	void prepareParticle(ParticleState &particle) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -589,6 +716,108 @@ public:
 	void setDescription();
 };
 
+/**
+ @class SourceBiasedEmission
+ @brief Abstract base class for emission biased towards a target, with weights for an isotropic emission
+
+ With the probability isotropicFraction the direction is isotropic, otherwise
+ it is drawn from the density q of the target. The weight of the candidate is
+ multiplied by the ratio of the isotropic to the emitted density,
+ 1 / (f + (1 - f) 4 pi q), so that weighted results equal those of an
+ isotropic emission, as long as all directions that can reach the observer
+ have a non-zero probability. The isotropic part guarantees this with weights
+ of at most 1 / f; it may be switched off if the target covers all such
+ directions. States without a target, e.g. a particle without an emission
+ map, are emitted isotropically with unchanged weight.
+ */
+class SourceBiasedEmission: public SourceFeature {
+protected:
+	double isotropicFraction;
+	/** True if the state has a target, depends only on the state */
+	virtual bool hasTarget(const ParticleState &state) const = 0;
+	/** Random direction from the target density */
+	virtual Vector3d drawTarget(const ParticleState &state) const = 0;
+	/** Target density per solid angle of the direction */
+	virtual double getTargetDensity(const ParticleState &state, const Vector3d &direction) const = 0;
+public:
+	SourceBiasedEmission(double isotropicFraction);
+	void prepareCandidate(Candidate &candidate) const;
+	void setIsotropicFraction(double isotropicFraction);
+	double getIsotropicFraction() const;
+};
+
+/**
+ @class SourceBiasedEmissionCone
+ @brief Emission biased towards a cone of fixed direction, see SourceBiasedEmission
+ */
+class SourceBiasedEmissionCone: public SourceBiasedEmission {
+	Vector3d direction;
+	double aperture;
+	double oneMinusCos;
+protected:
+	bool hasTarget(const ParticleState &state) const;
+	Vector3d drawTarget(const ParticleState &state) const;
+	double getTargetDensity(const ParticleState &state, const Vector3d &direction) const;
+public:
+	/** Constructor
+	 @param direction			axis of the cone
+	 @param aperture			half-opening angle of the cone
+	 @param isotropicFraction	fraction of isotropically emitted candidates
+	 */
+	SourceBiasedEmissionCone(Vector3d direction, double aperture, double isotropicFraction = 0.1);
+	void setDescription();
+};
+
+/**
+ @class SourceBiasedEmissionSphere
+ @brief Emission biased towards a sphere, e.g. an ObserverSmallSphere, see SourceBiasedEmission
+
+ The directions are uniform in the cone that the sphere subtends at the
+ source position. Sources inside the sphere emit isotropically.
+ */
+class SourceBiasedEmissionSphere: public SourceBiasedEmission {
+	Vector3d center;
+	double radius;
+	double oneMinusCos(const Vector3d &position) const;
+protected:
+	bool hasTarget(const ParticleState &state) const;
+	Vector3d drawTarget(const ParticleState &state) const;
+	double getTargetDensity(const ParticleState &state, const Vector3d &direction) const;
+public:
+	/** Constructor
+	 @param center				center of the target sphere
+	 @param radius				radius of the target sphere, may be larger than the observer to include deflections
+	 @param isotropicFraction	fraction of isotropically emitted candidates
+	 */
+	SourceBiasedEmissionSphere(Vector3d center, double radius, double isotropicFraction = 0.1);
+	void setDescription();
+};
+
+/**
+ @class SourceBiasedEmissionMap
+ @brief Emission biased by an EmissionMap, see SourceBiasedEmission
+
+ The map of the particle type and energy of the candidate is the target
+ density, e.g. an acceptance filled with EmissionMapFiller in a first run or
+ from the source directions of backtracked particles. Freeze the map for
+ lock-free draws.
+ */
+class SourceBiasedEmissionMap: public SourceBiasedEmission {
+	ref_ptr<EmissionMap> emissionMap;
+protected:
+	bool hasTarget(const ParticleState &state) const;
+	Vector3d drawTarget(const ParticleState &state) const;
+	double getTargetDensity(const ParticleState &state, const Vector3d &direction) const;
+public:
+	/** Constructor
+	 @param emissionMap			target density of the directions
+	 @param isotropicFraction	fraction of isotropically emitted candidates
+	 */
+	SourceBiasedEmissionMap(EmissionMap *emissionMap, double isotropicFraction = 0.1);
+	void setEmissionMap(EmissionMap *emissionMap);
+	void setDescription();
+};
+
 /**
  @class SourceLambertDistributionOnSphere
  @brief Uniform random position on a sphere with isotropic Lamberts distributed directions.
@@ -626,6 +855,7 @@ public:
 	 */
 	SourceDirection(Vector3d direction = Vector3d(-1, 0, 0));
 	void prepareParticle(ParticleState &particle) const;
+	bool isParticleFeature() const;
 	void setDescription();
 };
 
@@ -818,7 +1048,7 @@ protected:
 	std::vector<double> energy;
 
 	std::vector<Nucleus> nuclei;
-	std::vector<double> cdf;
+	AliasSampler sampler;
 
 };
 #endif
@@ -0,0 +1,87 @@
+#ifndef CRPROPA_STATICMODULELIST_H
+#define CRPROPA_STATICMODULELIST_H
+
+#include "crpropa/ModuleList.h"
+
+#include <stdexcept>
+#include <tuple>
+#include <typeinfo>
+
+namespace crpropa {
+
+/**
+ @class StaticModuleList
+ @brief ModuleList with a sequence of module types fixed at compile time.
+
+ The step of a candidate calls the modules in order through non-virtual,
+ qualified calls, which removes the dispatch and the list traversal of
+ ModuleList::process for each module and step. All run methods of
+ ModuleList (sources, candidate vectors, OpenMP, checkpoints) are
+ available unchanged.
+
+ The modules have to be exactly of the given types, subclasses are
+ rejected, as their overrides of process would be bypassed. Modules can not
+ be added or removed later.
+
+ Example:
+ \code
+ StaticModuleList<SimplePropagation, Redshift, MinimumEnergy, Observer> sim(
+		new SimplePropagation(), new Redshift(), new MinimumEnergy(1 * EeV), obs);
+ sim.run(&source, 10000);
+ \endcode
+ */
+template <typename... Modules>
+class StaticModuleList: public ModuleList {
+private:
+	std::tuple<ref_ptr<Modules>...> modules;
+
+	template <size_t I>
+	void processModule(Candidate *candidate, std::integral_constant<size_t, I>) const {
+		typedef typename std::tuple_element<I, std::tuple<Modules...> >::type ModuleType;
+		std::get<I>(modules)->ModuleType::process(candidate);
+		processModule(candidate, std::integral_constant<size_t, I + 1>());
+	}
+
+	void processModule(Candidate *candidate, std::integral_constant<size_t, sizeof...(Modules)>) const {
+	}
+
+	template <size_t I>
+	void addModule(std::integral_constant<size_t, I>) {
+		typedef typename std::tuple_element<I, std::tuple<Modules...> >::type ModuleType;
+		ModuleType *module = std::get<I>(modules);
+		if (module == 0)
+			throw std::runtime_error("StaticModuleList: module must not be NULL");
+		if (typeid(*module) != typeid(ModuleType))
+			throw std::runtime_error(std::string("StaticModuleList: expected a module of type ")
+					+ typeid(ModuleType).name() + ", got a subclass");
+		ModuleList::add(module);
+		addModule(std::integral_constant<size_t, I + 1>());
+	}
+
+	void addModule(std::integral_constant<size_t, sizeof...(Modules)>) {
+	}
+
+	// the sequence of modules is fixed
+	using ModuleList::add;
+	using ModuleList::remove;
+
+public:
+	StaticModuleList(Modules*... m) : modules(m...) {
+		addModule(std::integral_constant<size_t, 0>());
+	}
+
+	using ModuleList::process;
+	void process(Candidate *candidate) const {
+		processModule(candidate, std::integral_constant<size_t, 0>());
+	}
+
+	/** Module at position I of the sequence */
+	template <size_t I>
+	typename std::tuple_element<I, std::tuple<Modules...> >::type *get() const {
+		return std::get<I>(modules);
+	}
+};
+
+} // namespace crpropa
+
+#endif // CRPROPA_STATICMODULELIST_H
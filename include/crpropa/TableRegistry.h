@@ -0,0 +1,80 @@
+#ifndef CRPROPA_TABLEREGISTRY_H
+#define CRPROPA_TABLEREGISTRY_H
+
+#include "crpropa/Referenced.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class TableRegistry
+ @brief Process-wide registry of immutable tables loaded from files
+
+ Modules constructed several times in one process, e.g. for different photon
+ fields or by parameter scans that rebuild their module lists, acquire the
+ tables they read from the registry instead of loading their own copies.
+ A table is identified by its type, the path of its file and the size and
+ modification time of the file, so that a changed file is loaded again.
+ The registry holds a reference to each table; tables that nobody else
+ references any more are released when the next table is added, or with
+ prune. All methods are thread-safe.
+ ~~~
+ ref_ptr<const DataTable> table = DataTable::acquire(filename);
+ ~~~
+ */
+class TableRegistry {
+	static ref_ptr<const Referenced> find(const std::string &type, const std::string &filename,
+			uint64_t fileSize, int64_t fileTime);
+	static void insert(const std::string &type, const std::string &filename,
+			uint64_t fileSize, int64_t fileTime, const Referenced *table);
+	static bool stamp(const std::string &filename, uint64_t &fileSize, int64_t &fileTime);
+	static std::recursive_mutex &mutex();
+
+public:
+	/** The shared table of the file, loaded with load if it is not registered.
+	 @param type		name of the table type, tables of different types are
+	 					separate even for the same file
+	 @param filename	path of the file
+	 @param load		function that loads the table, returns 0 if the file
+	 					cannot be read
+	 @returns			the table, invalid if the file cannot be read
+	 */
+	template<class T>
+	static ref_ptr<const T> acquire(const std::string &type, const std::string &filename,
+			T *(*load)(const std::string &)) {
+		uint64_t fileSize;
+		int64_t fileTime;
+		if (not stamp(filename, fileSize, fileTime))
+			return NULL;
+		// loading under the lock loads each table once, loaders may acquire
+		// further tables
+		std::lock_guard<std::recursive_mutex> guard(mutex());
+		ref_ptr<const T> table = static_cast<const T *>(
+				find(type, filename, fileSize, fileTime).get());
+		if (not table.valid()) {
+			table = load(filename);
+			if (table.valid())
+				insert(type, filename, fileSize, fileTime, table.get());
+		}
+		return table;
+	}
+
+	/** Release the tables that are only referenced by the registry */
+	static void prune();
+	/** Release all tables, the modules keep the ones they reference */
+	static void clear();
+	/** Number of registered tables */
+	static size_t size();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_TABLEREGISTRY_H
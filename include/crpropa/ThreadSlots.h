@@ -0,0 +1,127 @@
+#ifndef CRPROPA_THREADSLOTS_H
+#define CRPROPA_THREADSLOTS_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** Unique id of a ThreadSlots instance or of one of its clears */
+inline uint64_t newThreadSlotsInstance() {
+	static std::atomic<uint64_t> instances(0);
+	return ++instances;
+}
+
+/**
+ @class ThreadSlots
+ @brief Per-thread state of a module, e.g. accumulators of const process methods
+
+ Each thread that calls local() gets its own slot, a copy of the initial
+ value, on first use; afterwards it finds it in a thread-local cache without
+ locking. The slots are padded to separate cache lines, so the threads
+ write them without races or false sharing. After the run the slots are
+ read with forEach or folded into one value with merge, e.g. in
+ Module::endRun; both must not run concurrently with local().
+ ~~~
+ mutable ThreadSlots<std::vector<double> > histograms; // in the module
+ histograms.local()[i] += w;                           // in process
+ histograms.merge(total, addHistograms);               // in endRun
+ ~~~
+ */
+template<class T>
+class ThreadSlots {
+	struct Slot {
+		T value;
+		char padding[64]; ///< keeps the slots of different threads on separate cache lines
+		Slot(const T &value) : value(value) {
+		}
+	};
+
+	T initial;
+	mutable std::vector<Slot *> slots;
+	mutable std::mutex mutex;
+	uint64_t instance; ///< identifies the slots in the caches of the threads
+
+	void deleteSlots() {
+		for (size_t i = 0; i < slots.size(); i++)
+			delete slots[i];
+		slots.clear();
+	}
+
+	ThreadSlots(const ThreadSlots &);
+	ThreadSlots &operator=(const ThreadSlots &);
+public:
+	explicit ThreadSlots(const T &initial = T()) : initial(initial),
+			instance(newThreadSlotsInstance()) {
+	}
+
+	~ThreadSlots() {
+		deleteSlots();
+	}
+
+	/** Slot of the calling thread */
+	T &local() const {
+		static thread_local std::vector<std::pair<uint64_t, Slot *> > cache;
+		for (size_t i = 0; i < cache.size(); i++)
+			if (cache[i].first == instance)
+				return cache[i].second->value;
+
+		Slot *slot = new Slot(initial);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slots.push_back(slot);
+		}
+		cache.push_back(std::make_pair(instance, slot));
+		return slot->value;
+	}
+
+	/** Number of threads that used a slot */
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return slots.size();
+	}
+
+	/** Call f(T &) for each slot */
+	template<class F>
+	void forEach(F f) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); i++)
+			f(slots[i]->value);
+	}
+
+	/** Add each slot to the sum with add(T &sum, const T &slot) and reset
+	 the slots to the initial value */
+	template<class Add>
+	void merge(T &sum, Add add) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); i++) {
+			add(sum, slots[i]->value);
+			slots[i]->value = initial;
+		}
+	}
+
+	/** Drop the slots and set a new initial value; the threads get new slots
+	 on their next call of local() */
+	void clear(const T &initial) {
+		std::lock_guard<std::mutex> lock(mutex);
+		deleteSlots();
+		this->initial = initial;
+		instance = newThreadSlotsInstance();
+	}
+
+	void clear() {
+		clear(initial);
+	}
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_THREADSLOTS_H
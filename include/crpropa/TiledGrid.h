@@ -0,0 +1,123 @@
+#ifndef CRPROPA_TILEDGRID_H
+#define CRPROPA_TILEDGRID_H
+
+#include "crpropa/Grid.h"
+
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/** Dump a vector grid in tiles of tileSize^3 grid points, for TiledGrid3f.
+ The grid is read point by point, so that mapped grids (see GridTools::mapGrid3f)
+ larger than the memory can be converted.
+ @param grid		a vector grid (Grid3f)
+ @param filename	name of output file
+ @param tileSize	number of grid points along each edge of a tile
+ */
+void dumpTiledGrid(ref_ptr<Grid3f> grid, std::string filename, size_t tileSize = 32);
+
+/**
+ @class TiledGrid3f
+ @brief Vector grid on disk, for fields larger than the memory
+
+ The grid is stored in a file of dumpTiledGrid in cubic tiles, which are read
+ on first access into a cache with a bounded size. The least recently used
+ tiles are dropped from the cache when it is full. The cache is shared by all
+ threads; tiles in use by a thread stay valid when they are dropped.
+ With prefetch the tiles ahead of a candidate are requested from the operating
+ system in the background, e.g. by the module TiledGridPrefetch. Interpolation
+ as Grid, see TiledMagneticFieldGrid for the use as magnetic field.
+ */
+class TiledGrid3f: public Referenced {
+public:
+	/** Values of a tile, in row-major order */
+	struct Tile: public Referenced {
+		std::vector<Vector3f> values;
+	};
+
+private:
+	class Cursor;
+
+	std::string filename;
+	int fd; /**< File descriptor for the reads, -1 without POSIX */
+	size_t Nx, Ny, Nz; /**< Number of grid points */
+	size_t tileSize, tileShift; /**< Edge of a tile, power of two */
+	size_t nTilesX, nTilesY, nTilesZ;
+	Vector3d origin; /**< Origin of the volume that is represented by the grid. */
+	Vector3d gridOrigin; /**< Grid origin */
+	Vector3d spacing; /**< Distance between grid points, determines the extension of the grid */
+	bool reflective; /**< If set to true, the grid is repeated reflectively instead of periodically */
+	interpolationType ipolType; /**< Type of interpolation between the grid points */
+
+	size_t cacheSize; /**< Maximum number of cached tiles */
+	mutable std::mutex mutex;
+	typedef std::list<size_t> TileList;
+	mutable TileList recentTiles; /**< Cached tiles, most recently used first */
+	mutable std::unordered_map<size_t, std::pair<ref_ptr<Tile>, TileList::iterator> > cache;
+	mutable uint64_t loads;
+
+	ref_ptr<Tile> loadTile(size_t tile) const;
+	Vector3f closestValue(const Vector3d &position) const;
+	Vector3f trilinearInterpolate(const Vector3d &position) const;
+	Vector3f tricubicInterpolate(const Vector3d &position) const;
+
+public:
+	/** Constructor
+	 @param filename	file written by dumpTiledGrid
+	 @param cacheSize	maximum memory of the cached tiles in bytes
+	 */
+	TiledGrid3f(const std::string &filename, size_t cacheSize = 1 << 30);
+	~TiledGrid3f();
+
+	/** Tile of a given index, from the cache or the file */
+	ref_ptr<Tile> getTile(size_t tile) const;
+
+	/** Value of a grid point */
+	Vector3f get(size_t ix, size_t iy, size_t iz) const;
+
+	/** Interpolate with the interpolation type, see Grid::interpolate */
+	Vector3f interpolate(const Vector3d &position) const;
+
+	/** Request the tiles along a straight line from the operating system in the background.
+	 @param position	start of the line
+	 @param direction	direction of the line
+	 @param distance	length of the line
+	 */
+	void prefetch(const Vector3d &position, const Vector3d &direction, double distance) const;
+
+	/** Maximum memory of the cached tiles in bytes, at least one tile */
+	void setCacheSize(size_t bytes);
+	size_t getCacheSize() const;
+	/** Number of tiles in the cache */
+	size_t getNumberOfCachedTiles() const;
+	/** Number of tiles read from the file so far */
+	uint64_t getNumberOfLoads() const;
+	/** Memory of the cached tiles in bytes */
+	size_t getSizeOf() const;
+
+	void setReflective(bool b);
+	void setInterpolationType(interpolationType ipolType);
+
+	Vector3d getOrigin() const;
+	Vector3d getSpacing() const;
+	size_t getNx() const;
+	size_t getNy() const;
+	size_t getNz() const;
+	size_t getTileSize() const;
+	bool isReflective() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_TILEDGRID_H
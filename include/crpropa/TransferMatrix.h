@@ -0,0 +1,99 @@
+#ifndef CRPROPA_TRANSFERMATRIX_H
+#define CRPROPA_TRANSFERMATRIX_H
+
+#include "crpropa/ModuleList.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/Units.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class TransferMatrix
+ @brief Tabulated arrival of nuclei in 1D for fits of source spectra and composition
+
+ The matrix holds, for each injected species, energy bin and distance bin
+ (a cell), the nuclei arriving at the observer at the origin per injected
+ nucleus, by mass number and energy bin. It is built once with build() from
+ the 1D simulation of the existing modules (PhotoDisintegration,
+ PhotoPionProduction, ElectronPairProduction, NuclearDecay, Redshift and a
+ propagation), and can be saved and loaded. The arrival for any source
+ spectrum and composition is then the matrix-vector product of apply(),
+ e.g. for each evaluation of a fit.
+
+ The energy bins are in log10(E/eV) and used for the injection and the
+ arrival, the distance bins are linear in comoving distance. Particles that
+ are not nuclei (photons, electrons, neutrinos) are not tabulated.
+ */
+class TransferMatrix: public Referenced {
+	std::vector<int> species;
+	int nE, nD, nA;
+	double logEmin, logEmax, dlogE, Dmax, dD;
+	std::vector<double> matrix; ///< [cell][mass number - 1][arrival energy bin]
+
+	size_t cellIndex(size_t s, int iE, int iD) const;
+public:
+	/** Constructor
+	 @param species	ids of the injected nuclei
+	 @param Dmax	maximum distance [m]
+	 @param nD		number of distance bins
+	 @param logEmin	log10 of the minimum energy [eV]
+	 @param logEmax	log10 of the maximum energy [eV]
+	 @param dlogE	width of the energy bins in log10
+	 */
+	TransferMatrix(const std::vector<int> &species, double Dmax = 1000 * Mpc,
+			int nD = 50, double logEmin = 17, double logEmax = 21, double dlogE = 0.1);
+
+	/** Tabulate the arrival: propagate samples nuclei of each cell, uniform
+	 in log10(E) and distance within the bins, towards the origin with the
+	 simulation modules, which have to include a propagation. The run is
+	 done by ModuleList::run for the candidates of the cells, which start at
+	 the redshift of their distance; a module added to the end of the list
+	 for the run detects them at the origin and deactivates those below the
+	 minimum energy.
+	 @param simulation	interaction and propagation modules
+	 @param samples		candidates per cell
+	 */
+	void build(ref_ptr<ModuleList> simulation, size_t samples = 100);
+	/** Save the nonzero elements of the matrix */
+	void save(const std::string &filename) const;
+	/** Load a matrix saved with the same species and binning */
+	void load(const std::string &filename);
+
+	/** Arrival for an injection
+	 @param injection	injected nuclei per cell, index cell(s, iE, iD)
+	 @returns			arriving nuclei, index arrival(A, iE)
+	 */
+	std::vector<double> apply(const std::vector<double> &injection) const;
+	/** Arrival per injected nucleus of a cell */
+	double get(size_t s, int iE, int iD, int A, int jE) const;
+
+	/** Index of a cell in the injection of apply */
+	size_t cell(size_t s, int iE, int iD) const;
+	/** Index of mass number and energy bin in the arrival of apply */
+	size_t arrival(int A, int iE) const;
+	size_t getNumberOfCells() const;
+	int getNumberOfEnergyBins() const;
+	int getNumberOfDistanceBins() const;
+	/** Largest mass number of the arrival, that of the injected species */
+	int getMaximumMassNumber() const;
+	/** Energy of the centre of a bin [J] */
+	double getEnergy(int iE) const;
+	/** Distance of the centre of a bin [m] */
+	double getDistance(int iD) const;
+
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_TRANSFERMATRIX_H
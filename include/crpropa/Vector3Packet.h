@@ -0,0 +1,310 @@
+#ifndef CRPROPA_VECTOR3PACKET_H
+#define CRPROPA_VECTOR3PACKET_H
+
+#include "crpropa/Vector3.h"
+
+#include <cmath>
+#include <stddef.h>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Core
+ * @{
+ */
+
+/**
+ @class ScalarPacket
+ @brief N numbers for lane-parallel arithmetic, see Vector3Packet
+ */
+template<typename T, int N = 4>
+class ScalarPacket {
+public:
+	T v[N];
+
+	ScalarPacket() {
+		for (int l = 0; l < N; l++)
+			v[l] = 0;
+	}
+
+	explicit ScalarPacket(T t) {
+		for (int l = 0; l < N; l++)
+			v[l] = t;
+	}
+
+	/** N numbers from p */
+	static ScalarPacket load(const T *p) {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = p[l];
+		return r;
+	}
+
+	void store(T *p) const {
+		for (int l = 0; l < N; l++)
+			p[l] = v[l];
+	}
+
+	T &operator[](int l) {
+		return v[l];
+	}
+
+	const T &operator[](int l) const {
+		return v[l];
+	}
+
+	ScalarPacket operator +(const ScalarPacket &p) const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = v[l] + p.v[l];
+		return r;
+	}
+
+	ScalarPacket operator -(const ScalarPacket &p) const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = v[l] - p.v[l];
+		return r;
+	}
+
+	ScalarPacket operator *(const ScalarPacket &p) const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = v[l] * p.v[l];
+		return r;
+	}
+
+	ScalarPacket operator /(const ScalarPacket &p) const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = v[l] / p.v[l];
+		return r;
+	}
+
+	ScalarPacket operator *(T t) const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = v[l] * t;
+		return r;
+	}
+
+	ScalarPacket sqrt() const {
+		ScalarPacket r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = std::sqrt(v[l]);
+		return r;
+	}
+};
+
+/**
+ @class Vector3Packet
+ @brief N 3-vectors in structure-of-arrays form for lane-parallel arithmetic
+
+ The x, y and z components of the N lanes are stored in separate arrays, so
+ that each operation is a fixed-length loop over the lanes, which the
+ compiler turns into SIMD instructions: with the default of four lanes one
+ __m256d per component with AVX, or two __m128d with SSE2. Unlike Vector3d,
+ a cross or dot product then costs the same instructions as for a single
+ vector. Meant as the building block of the batched propagation kernels,
+ which convert from and to Vector3 with load / store (arrays of vectors) or
+ loadSoA / storeSoA (one array per component).
+ */
+template<typename T, int N = 4>
+class Vector3Packet {
+public:
+	typedef ScalarPacket<T, N> Scalars;
+	static const int lanes = N;
+
+	T x[N];
+	T y[N];
+	T z[N];
+
+	Vector3Packet() {
+		for (int l = 0; l < N; l++)
+			x[l] = y[l] = z[l] = 0;
+	}
+
+	/** The vector v in all lanes */
+	explicit Vector3Packet(const Vector3<T> &v) {
+		for (int l = 0; l < N; l++) {
+			x[l] = v.x;
+			y[l] = v.y;
+			z[l] = v.z;
+		}
+	}
+
+	/** The first n <= N vectors of v, the other lanes are 0 */
+	template<typename U>
+	static Vector3Packet load(const Vector3<U> *v, int n = N) {
+		Vector3Packet p;
+		for (int l = 0; l < n; l++) {
+			p.x[l] = v[l].x;
+			p.y[l] = v[l].y;
+			p.z[l] = v[l].z;
+		}
+		return p;
+	}
+
+	/** Store the first n <= N lanes */
+	template<typename U>
+	void store(Vector3<U> *v, int n = N) const {
+		for (int l = 0; l < n; l++)
+			v[l] = Vector3<U>(x[l], y[l], z[l]);
+	}
+
+	/** Lanes i ... i + n - 1 of three component arrays, the other lanes are 0 */
+	static Vector3Packet loadSoA(const T *const *c, size_t i, int n = N) {
+		Vector3Packet p;
+		for (int l = 0; l < n; l++) {
+			p.x[l] = c[0][i + l];
+			p.y[l] = c[1][i + l];
+			p.z[l] = c[2][i + l];
+		}
+		return p;
+	}
+
+	/** Store the first n <= N lanes to three component arrays, starting at i */
+	void storeSoA(T *const *c, size_t i, int n = N) const {
+		for (int l = 0; l < n; l++) {
+			c[0][i + l] = x[l];
+			c[1][i + l] = y[l];
+			c[2][i + l] = z[l];
+		}
+	}
+
+	Vector3<T> get(int l) const {
+		return Vector3<T>(x[l], y[l], z[l]);
+	}
+
+	void set(int l, const Vector3<T> &v) {
+		x[l] = v.x;
+		y[l] = v.y;
+		z[l] = v.z;
+	}
+
+	Vector3Packet operator +(const Vector3Packet &p) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] + p.x[l];
+			r.y[l] = y[l] + p.y[l];
+			r.z[l] = z[l] + p.z[l];
+		}
+		return r;
+	}
+
+	Vector3Packet operator -(const Vector3Packet &p) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] - p.x[l];
+			r.y[l] = y[l] - p.y[l];
+			r.z[l] = z[l] - p.z[l];
+		}
+		return r;
+	}
+
+	Vector3Packet &operator +=(const Vector3Packet &p) {
+		for (int l = 0; l < N; l++) {
+			x[l] += p.x[l];
+			y[l] += p.y[l];
+			z[l] += p.z[l];
+		}
+		return *this;
+	}
+
+	Vector3Packet operator *(T f) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] * f;
+			r.y[l] = y[l] * f;
+			r.z[l] = z[l] * f;
+		}
+		return r;
+	}
+
+	/** Lane l scaled by f[l] */
+	Vector3Packet operator *(const Scalars &f) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] * f.v[l];
+			r.y[l] = y[l] * f.v[l];
+			r.z[l] = z[l] * f.v[l];
+		}
+		return r;
+	}
+
+	Vector3Packet operator /(T f) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] / f;
+			r.y[l] = y[l] / f;
+			r.z[l] = z[l] / f;
+		}
+		return r;
+	}
+
+	/** Lane l divided by f[l] */
+	Vector3Packet operator /(const Scalars &f) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] / f.v[l];
+			r.y[l] = y[l] / f.v[l];
+			r.z[l] = z[l] / f.v[l];
+		}
+		return r;
+	}
+
+	/** this * f + p, per lane */
+	Vector3Packet mulAdd(const Scalars &f, const Vector3Packet &p) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = x[l] * f.v[l] + p.x[l];
+			r.y[l] = y[l] * f.v[l] + p.y[l];
+			r.z[l] = z[l] * f.v[l] + p.z[l];
+		}
+		return r;
+	}
+
+	Scalars dot(const Vector3Packet &p) const {
+		Scalars r;
+		for (int l = 0; l < N; l++)
+			r.v[l] = x[l] * p.x[l] + y[l] * p.y[l] + z[l] * p.z[l];
+		return r;
+	}
+
+	Vector3Packet cross(const Vector3Packet &p) const {
+		Vector3Packet r;
+		for (int l = 0; l < N; l++) {
+			r.x[l] = y[l] * p.z[l] - p.y[l] * z[l];
+			r.y[l] = z[l] * p.x[l] - p.z[l] * x[l];
+			r.z[l] = x[l] * p.y[l] - p.x[l] * y[l];
+		}
+		return r;
+	}
+
+	Scalars getR2() const {
+		return dot(*this);
+	}
+
+	Scalars getR() const {
+		return getR2().sqrt();
+	}
+
+	Vector3Packet getUnitVector() const {
+		Scalars r = getR();
+		Vector3Packet u;
+		for (int l = 0; l < N; l++) {
+			u.x[l] = x[l] / r.v[l];
+			u.y[l] = y[l] / r.v[l];
+			u.z[l] = z[l] / r.v[l];
+		}
+		return u;
+	}
+};
+
+typedef Vector3Packet<double> Vector3Packetd;
+typedef Vector3Packet<float, 8> Vector3Packetf;
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_VECTOR3PACKET_H
@@ -11,6 +11,7 @@
 #include "crpropa/Vector3.h"
 #include "crpropa/Referenced.h"
 #include "crpropa/Units.h"
+#include "crpropa/Grid.h"
 
 namespace crpropa {
 
@@ -178,6 +179,48 @@ public:
 	std::string getDescription() const;
 };
 
+/**
+ @class AdvectionFieldGrid
+ @brief Advection field on a grid, e.g. the flow of a simulation
+
+ The velocity is interpolated on a Grid3f as set by its interpolation type
+ (trilinear or the vectorized tricubic interpolation) and multiplied with a
+ scale, e.g. the velocity unit of the grid. The divergence is interpolated
+ on a Grid1f of the same geometry, which is either given or computed from
+ central differences between the grid points of the velocity, continued
+ periodically or reflectively as the velocity grid.
+ */
+class AdvectionFieldGrid: public AdvectionField {
+	ref_ptr<Grid3f> grid;
+	ref_ptr<Grid1f> divergence; // in units of the grid values per length
+	double scale;
+public:
+	/** Constructor, computes the divergence from the velocity grid
+	 @param grid	velocity grid
+	 @param scale	factor for the grid values
+	 */
+	AdvectionFieldGrid(ref_ptr<Grid3f> grid, double scale = 1);
+	/** Constructor
+	 @param grid		velocity grid
+	 @param divergence	divergence of the unscaled velocity grid
+	 @param scale		factor for the grid values and the divergence
+	 */
+	AdvectionFieldGrid(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> divergence,
+			double scale = 1);
+
+	Vector3d getField(const Vector3d &position) const;
+	double getDivergence(const Vector3d &position) const;
+
+	ref_ptr<Grid3f> getGrid() const;
+	ref_ptr<Grid1f> getDivergenceGrid() const;
+	double getScale() const;
+
+	/** Divergence from central differences between the grid points */
+	static ref_ptr<Grid1f> computeDivergence(ref_ptr<Grid3f> grid);
+
+	std::string getDescription() const;
+};
+
 } // namespace crpropa
 
 #endif // CRPROPA_ADVECTIONFIELD_H
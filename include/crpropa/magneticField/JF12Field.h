@@ -98,6 +98,7 @@ public:
 
 	ref_ptr<Grid1f> getStriatedGrid();
 	ref_ptr<Grid3f> getTurbulentGrid();
+	size_t getSizeOf() const;
 
 	void setUseRegularField(bool use);
 	virtual void setUseStriatedField(bool use);
@@ -117,21 +118,42 @@ public:
 
 	// Regular field components
 	Vector3d getRegularField(const Vector3d& pos) const;
+	// Regular field with given in-plane radius r and azimuth phi of pos
+	Vector3d getRegularField(const Vector3d& pos, const double& r, const double& phi) const;
 	virtual Vector3d getDiskField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const;
 	Vector3d getToroidalHaloField(const double& r, const double& z, const double& sinPhi, const double& cosPhi) const;
 	virtual Vector3d getXField(const double& r, const double& z, const double& sinPhi, const double& cosPhi) const;
 
+	// Regular field components with their partial derivatives along the axes
+	Vector3d getRegularFieldAndJacobian(const Vector3d& pos, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+
 	// Regular and striated field component
 	Vector3d getStriatedField(const Vector3d& pos) const;
 
 	// Brms of the turbulent field
 	double getTurbulentStrength(const Vector3d& pos) const;
+	// Brms of the turbulent field with given in-plane radius r and azimuth phi of pos
+	double getTurbulentStrength(const Vector3d& pos, const double& r, const double& phi) const;
 
 	// Turbulent field component
 	Vector3d getTurbulentField(const Vector3d& pos) const;
 
 	// All set field components
 	Vector3d getField(const Vector3d& pos) const;
+
+	// All set field components at n positions, the in-plane radius and
+	// azimuth of each position are computed only once for all components
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z = 0) const;
+
+	// Analytic derivatives of the regular field, finite differences with the
+	// striated or turbulent field, which are not differentiable
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+
+	// Zero field beyond 20 kpc; inside, the widths of the disk and halo
+	// transitions near them and 1 kpc elsewhere, or the spacing of the
+	// striated or turbulent grid if smaller
+	MagneticFieldStepHint getStepHint(const Vector3d &position, double z = 0) const;
 };
 
 
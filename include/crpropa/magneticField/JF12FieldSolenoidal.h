@@ -73,6 +73,9 @@ public:
 
 	Vector3d getXField(const double& r, const double& z, const double& sinPhi, const double& cosPhi) const; // override old X and spiral field
 	Vector3d getDiskField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const;
+	// finite differences, the analytic derivatives of JF12Field are those of the original disk and X field
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
 
 /** @brief Disable the transition of the spiral field strength to 0 at the outer boundary such that only the magnetic flux at the 5 kpc ring is redirected.
 	Thus, the spiral field lines are continued to r = 20 kpc as in the initial JF12 field. You can reactivate the outer transition afterwards via setDiskTransitionWidth which sets both transition widths at the inner and outer boundary.
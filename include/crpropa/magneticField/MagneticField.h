@@ -5,6 +5,8 @@
 #include "crpropa/Vector3.h"
 #include "crpropa/Referenced.h"
 
+#include <limits>
+
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
 #endif
@@ -15,6 +17,36 @@ namespace crpropa {
  * @{
  */
 
+/**
+ @struct MagneticFieldStepHint
+ @brief Structure of a magnetic field around a position, see MagneticField::getStepHint
+
+ The default hint carries no information: an infinite variation length and
+ no bound on the field.
+ */
+struct MagneticFieldStepHint {
+	double variationLength; ///< length over which the field changes appreciably [m], infinite if unknown
+	double radius; ///< radius of the ball around the position in which maxField holds [m]
+	double maxField; ///< bound on |B| within radius [T], infinite if unknown, 0 if field-free
+
+	MagneticFieldStepHint(
+			double variationLength = std::numeric_limits<double>::infinity(),
+			double radius = 0,
+			double maxField = std::numeric_limits<double>::infinity()) :
+			variationLength(variationLength), radius(radius), maxField(maxField) {
+	}
+
+	/** True if there is no field within a ball of nonzero radius */
+	bool isFieldFree() const {
+		return (maxField == 0) and (radius > 0);
+	}
+
+	/** Step for a particle of the rigidity (E / |q|, in V) that starts without a
+	 step history: the smaller of the variation length and a tenth of the
+	 smallest gyroradius allowed by maxField; infinite if neither is known */
+	double getInitialStep(double rigidity) const;
+};
+
 /**
  @class MagneticField
  @brief Abstract base class for magnetic fields.
@@ -29,6 +61,44 @@ public:
 	virtual Vector3d getField(const Vector3d &position, double z) const {
 		return getField(position);
 	};
+	/** Field vectors at n positions: fields[i] = getField(positions[i], z).
+	 Fields that can share work between the points may override this.
+	 */
+	virtual void getFields(const Vector3d *positions, Vector3d *fields,
+			size_t n, double z = 0) const;
+	/** getFields for many positions, evaluated in parallel in blocks of
+	 getFields; e.g. for field maps from Python (getFields_numpyArray).
+	 The field has to be thread safe, as for a simulation.
+	 */
+	void getFieldsParallel(const Vector3d *positions, Vector3d *fields,
+			size_t n, double z = 0) const;
+	/** Field vector and its partial derivatives along the axes, e.g. for
+	 integrators that adapt their steps to the curvature of the field lines.
+	 The default takes central differences of getField with a step of
+	 1e-5 max(|position|, 1 kpc); fields with analytic or interpolated
+	 derivatives override this.
+	 @param position	position
+	 @param z			redshift
+	 @param dBdx		returns dB/dx, the derivative of the field vector along x
+	 @param dBdy		returns dB/dy
+	 @param dBdz		returns dB/dz
+	 @returns			getField(position, z)
+	 */
+	virtual Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+	/** Memory in bytes held by the field, e.g. its grids; 0 by default */
+	virtual size_t getSizeOf() const {
+		return 0;
+	}
+	/** Structure of the field around a position, used by the propagators
+	 with setStepHints to choose the first step and to cross field-free
+	 regions in straight steps. Fields that know their smoothness or
+	 extent override this; the default hint carries no information.
+	 */
+	virtual MagneticFieldStepHint getStepHint(const Vector3d &position,
+			double z = 0) const {
+		return MagneticFieldStepHint();
+	}
 };
 
 /**
@@ -51,6 +121,9 @@ public:
 	bool isReflective();
 	void setReflective(bool reflective);
 	Vector3d getField(const Vector3d &position) const;
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+	size_t getSizeOf() const;
 };
 
 /**
@@ -62,6 +135,11 @@ class MagneticFieldList: public MagneticField {
 public:
 	void addField(ref_ptr<MagneticField> field);
 	Vector3d getField(const Vector3d &position) const;
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+	size_t getSizeOf() const;
+	/** Smallest variation length and radius, sum of the field bounds */
+	MagneticFieldStepHint getStepHint(const Vector3d &position, double z = 0) const;
 };
 
 /**
@@ -74,6 +152,10 @@ class MagneticFieldEvolution: public MagneticField {
 public:
 	MagneticFieldEvolution(ref_ptr<MagneticField> field, double m);
 	Vector3d getField(const Vector3d &position, double z = 0) const;
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+	size_t getSizeOf() const;
+	MagneticFieldStepHint getStepHint(const Vector3d &position, double z = 0) const;
 };
 
 /**
@@ -89,6 +171,15 @@ public:
 	Vector3d getField(const Vector3d &position) const {
 		return value;
 	}
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+		dBdx = dBdy = dBdz = Vector3d(0.);
+		return value;
+	}
+	MagneticFieldStepHint getStepHint(const Vector3d &position, double z = 0) const {
+		return MagneticFieldStepHint(std::numeric_limits<double>::infinity(),
+				std::numeric_limits<double>::infinity(), value.getR());
+	}
 };
 
 /**
@@ -104,6 +195,8 @@ public:
 			origin(origin), moment(moment), radius(radius) {
 	}
 	Vector3d getField(const Vector3d &position) const;
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
 };
 
 #ifdef CRPROPA_HAVE_MUPARSER
@@ -3,6 +3,10 @@
 
 #include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/CompressedGrid.h"
+#include "crpropa/TiledGrid.h"
+
+#include <string>
 
 namespace crpropa {
 /**
@@ -15,14 +19,74 @@ namespace crpropa {
  @brief Magnetic field on a periodic (or reflective), cartesian grid with trilinear interpolation.
 
  This class wraps a Grid3f to serve as a MagneticField.
+ The interpolated values are multiplied with a scale, e.g. the unit of a grid
+ mapped with mapGrid3f. Each thread reuses the neighbours of its last
+ interpolation while the positions stay in the same cell, see GridCell.
  */
 class MagneticFieldGrid: public MagneticField {
 	ref_ptr<Grid3f> grid;
+	double scale;
 public:
-	MagneticFieldGrid(ref_ptr<Grid3f> grid);
+	MagneticFieldGrid(ref_ptr<Grid3f> grid, double scale = 1);
+	/** Map the grid from a file written by dumpMappedGrid, scaled with its unit */
+	MagneticFieldGrid(const std::string &filename);
 	void setGrid(ref_ptr<Grid3f> grid);
 	ref_ptr<Grid3f> getGrid();
+	void setScale(double scale);
+	double getScale() const;
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+			double z = 0) const;
+	/** Derivatives of the trilinear interpolation for periodic, unclipped
+	 grids, finite differences otherwise */
+	Vector3d getFieldAndJacobian(const Vector3d &position, double z,
+			Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const;
+	size_t getSizeOf() const;
+	/** Variation length of the grid spacing; outside of a clipped grid
+	 (setClipVolume) the field is zero up to the grid volume */
+	MagneticFieldStepHint getStepHint(const Vector3d &position, double z = 0) const;
+};
+
+/**
+ @class CompressedMagneticFieldGrid
+ @brief Magnetic field on a compressed grid with 16 bit values, see CompressedGrid3f.
+
+ This class wraps a CompressedGrid3f to serve as a MagneticField, as MagneticFieldGrid.
+ */
+class CompressedMagneticFieldGrid: public MagneticField {
+	ref_ptr<CompressedGrid3f> grid;
+	double scale;
+public:
+	CompressedMagneticFieldGrid(ref_ptr<CompressedGrid3f> grid, double scale = 1);
+	void setGrid(ref_ptr<CompressedGrid3f> grid);
+	ref_ptr<CompressedGrid3f> getGrid();
+	void setScale(double scale);
+	double getScale() const;
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+			double z = 0) const;
+	size_t getSizeOf() const;
+};
+
+/**
+ @class TiledMagneticFieldGrid
+ @brief Magnetic field on a grid on disk, see TiledGrid3f.
+
+ This class wraps a TiledGrid3f to serve as a MagneticField, as MagneticFieldGrid.
+ */
+class TiledMagneticFieldGrid: public MagneticField {
+	ref_ptr<TiledGrid3f> grid;
+	double scale;
+public:
+	TiledMagneticFieldGrid(ref_ptr<TiledGrid3f> grid, double scale = 1);
+	void setGrid(ref_ptr<TiledGrid3f> grid);
+	ref_ptr<TiledGrid3f> getGrid();
+	void setScale(double scale);
+	double getScale() const;
 	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+			double z = 0) const;
+	size_t getSizeOf() const;
 };
 
 /**
@@ -32,20 +96,37 @@ public:
  This class wraps a Grid3f to serve as a MagneticField.
  The field is modulated on-the-fly with a Grid1f.
  The Grid3f and Grid1f do not need to share the same origin, spacing or size.
+ If they do (including the boundary conditions), fuse() stores the field
+ vector and the modulation of each grid point together in a Grid4f, so that
+ getField needs one interpolation and one set of memory accesses instead of
+ two. A Grid4f of (Bx, By, Bz, modulation) can also be set directly.
  */
 class ModulatedMagneticFieldGrid: public MagneticField {
 	ref_ptr<Grid3f> grid;
 	ref_ptr<Grid1f> modGrid;
+	ref_ptr<Grid4f> fusedGrid;
 public:
 	ModulatedMagneticFieldGrid() {
 	}
 	ModulatedMagneticFieldGrid(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> modGrid);
+	/** Constructor for a fused grid of (Bx, By, Bz, modulation) */
+	ModulatedMagneticFieldGrid(ref_ptr<Grid4f> fusedGrid);
+	/** Set the field grid, drops the fused grid */
 	void setGrid(ref_ptr<Grid3f> grid);
+	/** Set the modulation grid, drops the fused grid */
 	void setModulationGrid(ref_ptr<Grid1f> modGrid);
 	ref_ptr<Grid3f> getGrid();
 	ref_ptr<Grid1f> getModulationGrid();
+	/** Combine the field and modulation grid to a fused grid, see fuseGrids.
+	 Later changes of the values of the two grids are not seen. */
+	void fuse();
+	void setFusedGrid(ref_ptr<Grid4f> fusedGrid);
+	ref_ptr<Grid4f> getFusedGrid();
+	bool isFused() const;
+	/** Boundary conditions of the grids, the same for both with a fused grid */
 	void setReflective(bool gridReflective, bool modGridReflective);
 	Vector3d getField(const Vector3d &position) const;
+	size_t getSizeOf() const;
 };
 /** @} */
 } // namespace crpropa
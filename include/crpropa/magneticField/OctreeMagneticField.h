@@ -0,0 +1,84 @@
+#ifndef CRPROPA_OCTREEMAGNETICFIELD_H
+#define CRPROPA_OCTREEMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class OctreeMagneticField
+ @brief Magnetic field on a block-structured octree, for AMR simulations
+
+ The cubic volume is divided by an octree; each leaf holds a block of
+ blockSize^3 cells with the field at the cell centers, as the AMR grids of
+ Enzo or RAMSES. A position is located in O(depth) from the root; the last
+ leaf of each thread is remembered, so that the many queries of a step in the
+ same leaf skip the descent. The field is interpolated trilinearly between the
+ cell centers without any allocation. Near the faces of a block the values of
+ the neighbouring cells are taken from the leaves that contain them, with
+ their own resolution. Outside of the volume the field is zero.
+
+ The octree is read from the binary format of save, which a converter of the
+ simulation output can write, or built with refine and sample.
+ */
+class OctreeMagneticField: public MagneticField {
+	struct Node {
+		int32_t child; // first of the eight children, -1 for a leaf
+		int32_t block; // block of a leaf
+	};
+	Vector3d origin;
+	double size;
+	size_t blockSize;
+	std::vector<Node> nodes;
+	std::vector<Vector3f> values; // blocks of blockSize^3 values, x slowest
+	uint64_t instance; // identifies the octree in the leaf caches of the threads
+
+	int32_t locate(const Vector3d &position, Vector3d &lo, double &s) const;
+	int32_t locateCached(const Vector3d &position, Vector3d &lo, double &s) const;
+	Vector3f cellValue(const Vector3d &position) const;
+	void split(int32_t node);
+
+public:
+	/** Read an octree of save, the values are multiplied by unit */
+	OctreeMagneticField(const std::string &filename, double unit = 1);
+	/** An octree with a single leaf of zeros
+	 @param origin		lower corner of the volume
+	 @param size		edge of the volume
+	 @param blockSize	number of cells along an edge of a leaf block
+	 */
+	OctreeMagneticField(const Vector3d &origin, double size, size_t blockSize = 8);
+
+	/** Split the leaves that contain a position until they have the given depth.
+	 The values of the new leaves are those of the cells they are in.
+	 */
+	void refine(const Vector3d &position, int depth);
+	/** Set the values of all cells to the given field at the cell centers, in parallel */
+	void sample(ref_ptr<MagneticField> field);
+	/** Write the octree in binary format, the values are divided by unit */
+	void save(const std::string &filename, double unit = 1) const;
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+			double z = 0) const;
+
+	/** Depth of the leaf at a position, 0 for the root; -1 outside of the volume */
+	int getDepth(const Vector3d &position) const;
+	size_t getNumberOfLeaves() const;
+	size_t getNumberOfNodes() const;
+	size_t getBlockSize() const;
+	Vector3d getOrigin() const;
+	double getSize() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_OCTREEMAGNETICFIELD_H
@@ -0,0 +1,93 @@
+#ifndef CRPROPA_TABULATEDMAGNETICFIELD_H
+#define CRPROPA_TABULATEDMAGNETICFIELD_H
+
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Grid.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class TabulatedMagneticField
+ @brief Magnetic field sampled onto grids, for fast evaluation of analytic fields
+
+ The wrapped field is sampled onto one grid per level, each of which covers a
+ box with a spacing of its own, e.g. a coarse level for the halo and a fine
+ level for the disk of a galactic field. The field at a position is
+ interpolated trilinearly on the finest level that contains it; outside of all
+ levels the wrapped field is evaluated.
+
+ The levels are sampled in parallel with tabulate. With a tolerance, the
+ spacing of a level is halved until the largest deviation from the wrapped
+ field at random positions in its box is below the tolerance, or until
+ the level would have more than maxPoints grid points. The deviation is thus
+ an estimate of the error bound, see getErrorBound. With a cache file, the
+ levels are written after the sampling and mapped from the file (see
+ GridTools::mapGrid3f) by a later tabulate with the same levels and tolerance.
+ The cache does not identify the wrapped field, use a file per field.
+ */
+class TabulatedMagneticField: public MagneticField {
+	struct Level {
+		Vector3d origin, size; // box of the level
+		double requestedSpacing, spacing;
+		double error; // largest deviation at the random test positions
+		ref_ptr<Grid3f> grid;
+	};
+	ref_ptr<MagneticField> field;
+	std::vector<Level> levels; // finest first
+
+	void sample(Level &level) const;
+	double testLevel(const Level &level, size_t nPositions) const;
+	bool readCache(const std::string &filename, double tolerance);
+	void writeCache(const std::string &filename, double tolerance) const;
+
+public:
+	/** Constructor
+	 @param field	field to tabulate
+	 */
+	TabulatedMagneticField(ref_ptr<MagneticField> field);
+
+	/** Add a level, to be sampled with tabulate
+	 @param origin	lower corner of the box of the level
+	 @param size	extension of the box
+	 @param spacing	distance of the grid points, before the refinement by tabulate
+	 */
+	void addLevel(const Vector3d &origin, const Vector3d &size, double spacing);
+
+	/** Sample the field onto the levels
+	 @param tolerance	largest deviation from the wrapped field, 0 for no refinement
+	 @param maxPoints	largest number of grid points of a refined level
+	 @param cacheFile	file to map the levels from, or to write them to; no cache if empty
+	 */
+	void tabulate(double tolerance = 0, size_t maxPoints = 1 << 27,
+			const std::string &cacheFile = "");
+
+	Vector3d getField(const Vector3d &position) const;
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+			double z = 0) const;
+
+	size_t getNumberOfLevels() const;
+	/** Spacing of a level after tabulate */
+	double getSpacing(size_t level) const;
+	/** Largest deviation from the wrapped field at the test positions in a level */
+	double getError(size_t level) const;
+	/** Largest deviation of all levels */
+	double getErrorBound() const;
+	/** Grid of a level, NULL before tabulate */
+	ref_ptr<Grid3f> getGrid(size_t level) const;
+	/** Field that is tabulated */
+	ref_ptr<MagneticField> getWrappedField() const;
+	/** Memory of the levels and the wrapped field in bytes */
+	size_t getSizeOf() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_TABULATEDMAGNETICFIELD_H
@@ -8,7 +8,12 @@
 
 #include "fftw3.h"
 
+#include <functional>
+
 namespace crpropa {
+
+class Random;
+
 /**
  * \addtogroup MagneticFields
  * @{
@@ -26,6 +31,22 @@ class GridTurbulence : public TurbulentField {
 	void initGrid(const GridProperties &grid);
 	void initTurbulence();
 
+	/** Random numbers of a mode, drawn in the order of the modes */
+	typedef std::function<void(Random &random, float *draws)> DrawFunction;
+	/** Real and imaginary part of the field of a mode */
+	typedef std::function<void(const Vector3f &ek, double k, const float *draws,
+	                           Vector3f &re, Vector3f &im)> ModeFunction;
+
+	/** Fill the grid with the inverse FFT of the modes with kMin <= k <= kMax.
+	 The nDraws random numbers of all modes are drawn first, in the order of
+	 the modes, so that the field depends on the seed only. The half spectrum
+	 of each component is then computed in parallel and transformed in turn,
+	 which needs one spectrum of a component instead of three.
+	 */
+	static void fillGrid(ref_ptr<Grid3f> grid, double kMin, double kMax,
+	                     Random &random, int nDraws, const DrawFunction &draw,
+	                     const ModeFunction &mode);
+
   public:
 	/**
 	 Create a random initialization of a turbulent field.
@@ -41,6 +62,7 @@ class GridTurbulence : public TurbulentField {
 
 	/** Return a const reference to the grid */
 	const ref_ptr<Grid3f> &getGrid() const;
+	size_t getSizeOf() const;
 
 	/* Helper functions for synthetic turbulent field models */
 	// Check the grid properties before the FFT procedure
@@ -51,6 +73,10 @@ class GridTurbulence : public TurbulentField {
 	static void executeInverseFFTInplace(ref_ptr<Grid3f> grid,
 	                                     fftwf_complex *Bkx, fftwf_complex *Bky,
 	                                     fftwf_complex *Bkz);
+	// Execute inverse discrete FFT of the half spectrum (n x n x (n/2+1)) of
+	// one component into the component of a 3D grid; the spectrum is destroyed
+	static void executeInverseFFT(ref_ptr<Grid3f> grid, fftwf_complex *Bk,
+	                              int component);
 
 	// Usefull checks for a grid field
 	/** Evaluate the mean vector of all grid points */
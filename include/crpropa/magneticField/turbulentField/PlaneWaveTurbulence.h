@@ -38,15 +38,19 @@ method of field generation, an optimized version is provided. According to our
 tests (see the paper above), this version runs 20-30x faster than the baseline
 implementation and matches the speed of trilinear interpolation on a grid at
 a bit less than 100 wavemodes. To do this, it uses special CPU instructions
-called AVX, which are unfortunately not supported by every CPU. On Linux, you
-can check whether your CPU supports AVX by using the `lscpu` command, and
-searching the flags section for the string "avx". Alternatively, if you are
-building on the same CPU that CRPropa will run on, you can have the compiler
-detect this for you automatically (see below).
-
- An additional speedup of about 1.33 can be achieved if the CPU supports the
-FMA extension in addition to AVX. Again, you can either check for this
-manually, or have the compiler figure it out for you.
+called AVX, which are unfortunately not supported by every CPU. The kernel is
+chosen at runtime (see SimdKernels): AVX, AVX2 with FMA (a further speedup of
+about 1.33) or AVX-512, whichever the CPU supports, so the same build runs on
+all nodes of a cluster. CPUs without AVX fall back to the non-optimized
+implementation, with a warning.
+
+ With AVX-512 the wavemodes are summed eight at a time instead of
+four. With setSinglePrecision the sums are done in single precision, with
+twice as many wavemodes per instruction. The phases are then accurate to
+about 1e-7 times the number of wavelengths of the smallest mode between the
+position and the origin, so this should only be used in a region of up to
+about 1e4 lMin around the origin. getFields evaluates blocks of positions
+at once, loading each wavemode once for the block.
 
  **Note** that the optimized and non-optimized implementations to not return
 the exact same results. In fact, since the effective wave numbers used
@@ -56,39 +60,16 @@ of a double, but nevertheless relevant at some point), the wavemodes go
 out of phase for large distances from the origin, and the fields are no longer
 comparable at all.
 
- ### If you are building on the same machine that the code will run on:
-
-1. In cmake: enable the FAST_WAVES flag.
-2. Also in cmake: set SIMD_EXTENSIONS to "native". The compiler will automatically
-detect support for your CPU and run the build with the appropriate settings.
-3. Generate files and exit cmake, then build.
-3. If your CPU does not support the necessary extensions, the build will fail
-with an error telling you so. In this case, you won't be able to use the optimization;
-go back into cmake, disable FAST_WAVES, and build again.
-4. If the build runs through without errors, the code is built with the optimization.
-
- ### If you are building on a different machine from the one where the code will run:
-
-1. Figure out which extensions your target machine supports, using `lscpu | grep avx`
-for AVX, and `lscpu | grep fma` for FMA. Run these commands on your target machine,
-not on your build machine. If your target machine does not run Linux, you may have to
-use different commands.
-2. If the CPU does not support AVX, you can stop here, and build normally. The CPU
-does not support the necessary extensions, and will not run code that is compiled
-using them.
-3. If the CPU does support AVX, continue. In cmake, enable the FAST_WAVES flag.
-4. Also in cmake, set SIMD_EXTENSIONS to the appropriate value. If your target CPU
-supports only AVX, but not FMA, set it to "avx". If it supports both, set it to
-"avx+fma".
-5. Generate and exit cmake, then build.
-6. If you made a mistake and used the wrong flags, you should see an illegal
-instruction error when trying to import CRPropa, or (at the latest) when trying
-to call `getField`.
+ To use the optimization, enable the FAST_WAVES flag in cmake; SIMD_EXTENSIONS
+does not need to be set. The environment variable CRPROPA_SIMD limits the
+instruction set, e.g. CRPROPA_SIMD=avx to compare the kernels.
 
 [GJ99]: https://doi.org/10.1086/307452
 [TD13]: https://doi.org/10.1063/1.4789861
  */
 class PlaneWaveTurbulence : public TurbulentField {
+	friend class PlaneWaveEvaluator;
+
   private:
 	int Nm;
 
@@ -99,12 +80,16 @@ class PlaneWaveTurbulence : public TurbulentField {
 	std::vector<double> beta;
 	std::vector<double> Ak;
 	std::vector<double> k;
+	double sumAk; // bound on |B|, sum of the amplitudes of the wavemodes
 
 	// data for FAST_WAVES
-	int avx_Nm;
+	int avx_Nm; // Nm padded to a multiple of 16, the float lanes of AVX-512
 	int align_offset;
 	std::vector<double> avx_data;
-	// the following are index bases into the avx_data array.
+	int align_offset_f;
+	std::vector<float> avx_data_f; // avx_data in single precision
+	bool singlePrecision;
+	// the following are index bases into the avx_data arrays.
 	// since each subarray has avx_Nm elements, the start offset
 	// of each subarray can be computed by multiplying the two,
 	// and then adding on the alignment offset.
@@ -140,6 +125,82 @@ class PlaneWaveTurbulence : public TurbulentField {
 	   Theoretical runtime is O(Nm), where Nm is the number of wavemodes.
 	*/
 	Vector3d getField(const Vector3d &pos) const;
+
+	/**
+	   Evaluates the field at n positions.
+
+	   Without FAST_WAVES the loop over the wavemodes is the outer loop, so
+	   that each mode is loaded once for all positions and the inner loop over
+	   the positions can be vectorized. With FAST_WAVES the SIMD kernel of
+	   getField is applied to blocks of four positions, loading each wavemode
+	   once per block. The fields are the same as those of getField.
+	*/
+	void getFields(const Vector3d *positions, Vector3d *fields, size_t n,
+	               double z = 0) const;
+
+	/**
+	   Variation length lMin / 2 pi and the sum of the wavemode amplitudes as
+	   bound on |B| everywhere.
+	*/
+	MagneticFieldStepHint getStepHint(const Vector3d &position,
+	                                  double z = 0) const;
+
+	/**
+	   Sum the wavemodes in single precision, only with FAST_WAVES on a CPU
+	   with AVX.
+	   See the class description for the accuracy.
+	*/
+	void setSinglePrecision(bool b);
+	bool isSinglePrecision() const;
+};
+
+/**
+ @class PlaneWaveEvaluator
+ @brief Evaluates a PlaneWaveTurbulence at equidistant points along a line
+
+ The cosine and sine of the phase of each wavemode are kept and advanced by
+ the fixed step with the angle addition theorems, which costs a few
+ multiplications per wavemode instead of a cosine. Every resyncSteps steps the
+ phases are computed anew at the current position, so that the rounding errors
+ of the recurrence do not accumulate. The wavemodes are copied, so that the
+ evaluator does not depend on the lifetime of the field. The fields are those
+ of PlaneWaveTurbulence without FAST_WAVES. An evaluator is not thread-safe,
+ use one per thread.
+ */
+class PlaneWaveEvaluator : public Referenced {
+	size_t Nm, nPadded; // wavemodes, padded to a multiple of 8
+	std::vector<double> kx, ky, kz; // k * kappa
+	std::vector<double> Ax, Ay, Az; // Ak * xi
+	std::vector<double> beta;
+	std::vector<double> c, s;   // cos and sin of the phases at the position
+	std::vector<double> cd, sd; // cos and sin of the phase differences of the step
+	Vector3d position, step;
+	int resyncSteps, stepsSinceResync;
+
+	void resync();
+	static Vector3d sum(const double *B0, const double *B1, const double *B2);
+
+  public:
+	/**
+	 @param field		turbulent field to evaluate
+	 @param resyncSteps	number of steps after which the phases are computed anew
+	 */
+	PlaneWaveEvaluator(const PlaneWaveTurbulence &field, int resyncSteps = 256);
+
+	/** Move to a position and compute the phases there */
+	void setPosition(const Vector3d &position);
+	/** Set the step of advance */
+	void setStep(const Vector3d &step);
+
+	/** Advance the position by the step and return the field there */
+	Vector3d advance();
+	/** Field at the current position */
+	Vector3d getField() const;
+
+	Vector3d getPosition() const;
+	Vector3d getStep() const;
+	void setResyncSteps(int n);
+	int getResyncSteps() const;
 };
 
 /** @} */
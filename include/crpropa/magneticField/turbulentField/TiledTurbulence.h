@@ -0,0 +1,91 @@
+#ifndef CRPROPA_TILEDTURBULENCE_H
+#define CRPROPA_TILEDTURBULENCE_H
+
+#ifdef CRPROPA_HAVE_FFTW3F
+
+#include "crpropa/Grid.h"
+#include "crpropa/magneticField/turbulentField/TurbulentField.h"
+
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticFields
+ * @{
+ */
+
+/**
+ @class TiledTurbulence
+ @brief Turbulent field of unbounded extent, generated tile by tile on demand
+
+ The space is divided into cubic tiles of the size of the given grid. The field
+ of each tile is a periodic GridTurbulence of its own seed, which is derived
+ from the seed and the index of the tile, so that the field at a position does
+ not depend on the order of the evaluations. The fields of the eight tiles
+ around a position are blended with the weights cos(pi f / 2) and
+ sin(pi f / 2) along each axis, where f is the offset from the tile centers
+ in units of the tile size. The sum of the squared weights is one, so that
+ the blended field keeps the Brms of the tiles, and the field is smooth at the
+ tile boundaries. The blending adds a divergence of the order Brms / tile size,
+ hence the tiles should be larger than lMax.
+
+ The tiles are generated on first use into a cache of a bounded size, which is
+ shared by all threads; the least recently used tiles are dropped when it is
+ full.
+ */
+class TiledTurbulence: public TurbulentField {
+	unsigned int seed;
+	GridProperties tileProperties;
+	Vector3d tileSize; /**< Extension of a tile */
+
+	size_t cacheSize; /**< Maximum number of cached tiles */
+	mutable std::mutex mutex;
+	typedef std::list<uint64_t> TileList;
+	mutable TileList recentTiles; /**< Cached tiles, most recently used first */
+	mutable std::unordered_map<uint64_t, std::pair<ref_ptr<Grid3f>, TileList::iterator> > cache;
+	mutable uint64_t generated;
+
+	ref_ptr<Grid3f> generateTile(int ix, int iy, int iz) const;
+
+public:
+	/**
+	 @param spectrum	TurbulenceSpectrum of the tiles
+	 @param tileProperties	GridProperties of the tile at the index (0, 0, 0);
+	 the other tiles are shifted by multiples of the tile size
+	 @param seed		random seed, a seed of 0 is used like any other seed
+	 @param cacheSize	maximum memory of the cached tiles in bytes
+	 */
+	TiledTurbulence(const TurbulenceSpectrum &spectrum,
+	                const GridProperties &tileProperties, unsigned int seed = 0,
+	                size_t cacheSize = 1 << 30);
+
+	Vector3d getField(const Vector3d &pos) const;
+
+	/** Grid of the tile with the given index, from the cache or generated */
+	ref_ptr<Grid3f> getTile(int ix, int iy, int iz) const;
+
+	/** Seed of the tile with the given index */
+	unsigned int getTileSeed(int ix, int iy, int iz) const;
+
+	/** Maximum memory of the cached tiles in bytes, at least eight tiles */
+	void setCacheSize(size_t bytes);
+	size_t getCacheSize() const;
+	/** Number of tiles in the cache */
+	size_t getNumberOfCachedTiles() const;
+	/** Number of tiles generated so far */
+	uint64_t getNumberOfGeneratedTiles() const;
+	/** Memory of the cached tiles in bytes */
+	size_t getSizeOf() const;
+
+	Vector3d getTileSize() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_FFTW3F
+
+#endif // CRPROPA_TILEDTURBULENCE_H
@@ -0,0 +1,57 @@
+#ifndef CRPROPA_GALACTICLENS_H
+#define CRPROPA_GALACTICLENS_H
+
+#include "crpropa/Module.h"
+#include "crpropa/magneticLens/MagneticLens.h"
+
+namespace crpropa {
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+/**
+ @class GalacticLens
+ @brief Deflection of the detected cosmic rays by a galactic MagneticLens within the simulation
+
+ Used as detection action of the Observer at the boundary of the galaxy,
+ e.g. an ObserverSurface of a sphere around it, so that the extragalactic
+ and the galactic propagation are done in one run, without storing the
+ events at the boundary and lensing them in a second pass with the
+ ParticleMapsContainer. The module draws the arrival direction of each
+ candidate from the lens with the cumulative column sums of the lens parts
+ (see MagneticLens::transformCosmicRay), sets it as the direction of the
+ current state and passes the candidate to the output module.
+
+ The directions of the simulation have to be in galactic coordinates, as
+ those of the lens. The rigidity is E / |Z|, as the lenses are computed for
+ protons. Neutral particles are passed unchanged; cosmic rays that are lost
+ by the lens or with a rigidity not covered by it are not passed. The lens
+ has to outlive the module.
+ */
+class GalacticLens: public Module {
+	MagneticLens *lens;
+	ref_ptr<Module> output;
+public:
+	/** Constructor
+	 @param lens	galactic lens, not copied
+	 @param output	module processing the lensed candidates, e.g. an output
+	 */
+	GalacticLens(MagneticLens *lens, Module *output = 0);
+
+	void setLens(MagneticLens *lens);
+	void setOutput(Module *output);
+
+	/** Draw the arrival direction; true if the candidate was lensed or is
+	 neutral, false if it was lost or not covered by the lens */
+	bool lensCandidate(Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+	size_t getSizeOf() const;
+	void endRun();
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_GALACTICLENS_H
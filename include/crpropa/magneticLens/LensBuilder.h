@@ -0,0 +1,99 @@
+#ifndef CRPROPA_LENSBUILDER_H
+#define CRPROPA_LENSBUILDER_H
+
+#include "crpropa/magneticLens/ModelMatrix.h"
+#include "crpropa/magneticLens/Pixelization.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/Module.h"
+#include "crpropa/Referenced.h"
+#include "crpropa/Vector3.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup MagneticLenses
+ * @{
+ */
+
+/**
+ @class LensBuilder
+ @brief Builds the matrices of a MagneticLens by backtracking in a galactic field.
+
+ For each HEALPix pixel of the arrival directions at the observer, particles
+ are started from random directions within the pixel and propagated as the
+ antiparticle (backtracking) until they leave the galaxy at a spherical
+ boundary. The direction at the boundary gives the pixel outside of the
+ galaxy. Each particle adds 1 / (particles per pixel) to the element
+ (arrival pixel, outside pixel) of the matrix, so that the lens maps the
+ directions outside of the galaxy (columns) to the arrival directions (rows),
+ as required by MagneticLens. The particles run in parallel, each thread
+ accumulates its own sparse matrix; particles that do not reach the boundary
+ are lost.
+
+ Rigidities are given in Joule, i.e. the energy divided by the charge
+ number. The particle energies are drawn uniformly in log10 within each
+ rigidity bin.
+ */
+class LensBuilder: public Referenced {
+private:
+	ref_ptr<MagneticField> field;
+	ref_ptr<Module> propagation;
+	Pixelization pixelization;
+	Vector3d observer;
+	Vector3d center;
+	double radius;
+	double maximumTrajectoryLength;
+	size_t particlesPerPixel;
+	int particleId;
+	size_t lost;
+
+public:
+	/** Constructor
+	 @param field	galactic magnetic field
+	 @param order	HEALPix order of the lens, 12 * 4^order pixels
+	 */
+	LensBuilder(ref_ptr<MagneticField> field, int order = 6);
+
+	/** Position of the observer, default (-8.5 kpc, 0, 0) */
+	void setObserverPosition(Vector3d position);
+	/** Center and radius of the galaxy, default (0, 0, 0) and 20 kpc */
+	void setBoundary(Vector3d center, double radius);
+	/** Particles that are still inside of the galaxy after this length are
+	 lost, default 200 kpc */
+	void setMaximumTrajectoryLength(double length);
+	/** Number of particles started in each pixel, default 100 */
+	void setParticlesPerPixel(size_t n);
+	/** Id of the backtracked particle, default antiprotons for a lens of
+	 (positively charged) cosmic rays */
+	void setParticleId(int id);
+	/** Propagation module, default PropagationCK in the field with a
+	 tolerance of 1e-4 and steps from 1 pc to 100 pc */
+	void setPropagation(ref_ptr<Module> propagation);
+
+	/** Number of particles lost in the last call of buildMatrix */
+	size_t getNumberOfLost() const;
+
+	/** Backtracks the particles of one rigidity bin and returns the matrix.
+	 @param rigidityMin		lower edge of the rigidity bin [J]
+	 @param rigidityMax		upper edge of the rigidity bin [J]
+	 */
+	ModelMatrixType buildMatrix(double rigidityMin, double rigidityMax);
+
+	/** Builds a lens for the rigidity bins and writes it as file to be read
+	 with MagneticLens::loadLens, with the matrices in the binary format of
+	 serialize next to it (filename_0.mldat, filename_1.mldat ...).
+	 @param filename	name of the lens file
+	 @param log10RigidityEdges	edges of the bins in log10(rigidity / eV)
+	 */
+	void buildLens(const std::string &filename,
+			const std::vector<double> &log10RigidityEdges);
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_LENSBUILDER_H
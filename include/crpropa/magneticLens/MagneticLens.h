@@ -35,12 +35,16 @@
 #include <sstream>
 #include <iostream>
 #include <stdint.h>
+#include <atomic>
 
 
 namespace crpropa
 {
 
-/// Holds one matrix for the lens and information about the rigidity range
+/// Holds one matrix for the lens and information about the rigidity range.
+/// The matrix is loaded on first use, either from the format of serialize
+/// or from the compact format of saveCompact. Compact files are mapped
+/// read-only into memory, so that processes on one node share the pages.
 class LensPart
 {
 	string _filename;
@@ -49,29 +53,83 @@ class LensPart
 	ModelMatrixType M;
 	double _maximumSumOfColumns;
 	bool _maximumSumOfColumns_calculated;
+	std::atomic<bool> _loaded;
+
+	// cumulative sums of the columns of M, column c spans the entries
+	// _cdfOffsets[c] to _cdfOffsets[c + 1] of _cdfValues and _cdfPixels
+	std::vector<uint64_t> _cdfOffsets;
+	std::vector<double> _cdfValues;
+	std::vector<uint32_t> _cdfPixels;
+
+	// the cumulative sums used to draw, either the vectors above or the
+	// memory-mapped compact file
+	void *_mapping;
+	size_t _mappingSize;
+	uint32_t _nColumns;
+	const uint64_t *_offsets;
+	const uint32_t *_pixels;
+	const double *_cdf;
+	// normalization of a mapped matrix, applied when drawing
+	double _scale;
+	bool _columnsNormalized;
+
+	LensPart(const LensPart &);
+	LensPart& operator=(const LensPart &);
+
+	void unmap();
+	bool mapCompact();
+	// recovers M of a mapped matrix, which is then no longer mapped
+	void materialize();
+	double columnFactor(uint32_t column) const;
 
 public:
-	LensPart()
-	{
-	}
+	LensPart();
 	/// File containing the matrix to be used in the range rigidityMin,
 	/// rigidityMax in Joule
-	LensPart(const std::string &filename, double rigidityMin, double rigidityMax) :
-			_filename(filename), _rigidityMin(rigidityMin), _rigidityMax(rigidityMax), _maximumSumOfColumns_calculated(
-					false), _maximumSumOfColumns(0)
+	LensPart(const std::string &filename, double rigidityMin, double rigidityMax);
+
+	~LensPart();
+
+	/// Loads the matrix from file, mapping it if it is in the compact format
+	void loadMatrixFromFile();
+
+	/// Loads the matrix on first use, safe to call from several threads
+	void load()
 	{
+		if (_loaded)
+			return;
+#pragma omp critical(LensPartLoad)
+		{
+			if (!_loaded)
+				loadMatrixFromFile();
+		}
 	}
 
-	~LensPart()
+	/// True if the matrix was loaded or set
+	bool isLoaded() const
 	{
+		return _loaded;
 	}
 
-	/// Loads the matrix from file
-	void loadMatrixFromFile()
+	/// True if the matrix is read from a memory-mapped compact file
+	bool isMapped() const
 	{
-		deserialize(_filename, M);
+		return _mapping != NULL;
 	}
 
+	/// Reads the number of rows and columns from the header of the file
+	/// without loading the matrix
+	void readSize(uint32_t &rows, uint32_t &columns) const;
+
+	/// Writes the matrix in the compact format, the matrix in compressed
+	/// sparse column order with the cumulative sums of each column instead
+	/// of the values, so that cosmic rays are drawn directly from the mapped
+	/// file. Includes all normalizations applied so far.
+	void saveCompact(const std::string &filename);
+
+	/// True if the file starts with the header of the compact format
+	static bool isCompactFile(const std::string &filename);
+
 	/// Returns the filename of the matrix
 	const std::string& getFilename()
 	{
@@ -79,15 +137,7 @@ public:
 	}
 
 	/// Calculates the maximum of the sums of columns for the matrix
-	double getMaximumOfSumsOfColumns()
-	{
-		if (!_maximumSumOfColumns_calculated)
-		{ // lazy calculation of maximum
-			_maximumSumOfColumns = maximumOfSumsOfColumns(M);
-			_maximumSumOfColumns_calculated = true;
-		}
-		return _maximumSumOfColumns;
-	}
+	double getMaximumOfSumsOfColumns();
 
 	/// Returns the minimum of the rigidity range for the lenspart in eV
 	double getMinimumRigidity()
@@ -101,19 +151,38 @@ public:
 		return _rigidityMax / eV;
 	}
 
-	/// Returns the modelmatrix
-	ModelMatrixType& getMatrix()
-	{
-		return M;
-	}
+	/// Returns the modelmatrix. A mapped matrix is copied into memory.
+	ModelMatrixType& getMatrix();
 
 	/// Sets the modelmatrix
-	void setMatrix(const ModelMatrixType& m)
+	void setMatrix(const ModelMatrixType& m);
+
+	/// Divides the matrix by norm, without copying a mapped matrix
+	void normalize(double norm);
+
+	/// Normalizes all columns to unity, without copying a mapped matrix
+	void normalizeColumns();
+
+	/// Precomputes the cumulative sums of the matrix columns used to draw
+	/// the deflected pixels. Has to be called again if the matrix was
+	/// changed via getMatrix; the normalizations of MagneticLens do that.
+	void updateColumnCdfs();
+
+	/// True if the cumulative sums of the columns are computed or mapped
+	bool hasColumnCdfs() const
 	{
-		M = m;
+		return _offsets != NULL;
 	}
 
+	/// Draws the deflected pixel of a cosmic ray from pixel column with the
+	/// uniform random number rn in [0, 1). Returns false if the cosmic ray is
+	/// lost, i.e. rn is not below the sum of the column.
+	/// Requires a loaded matrix.
+	bool drawPixel(uint32_t column, double rn, uint32_t &pixel) const;
 
+	/// Memory of the matrix and the cumulative sums in bytes, including a
+	/// mapped compact file; 0 if the part is not loaded
+	size_t getSizeOf() const;
 };
 
 /// Function to calculate the mean deflection [rad] of the matrix M, given a pixelization
@@ -159,6 +228,9 @@ class MagneticLens
 	// Checks Matrix, raises Errors if not ok - also generate
 	// _pixelization if called first time
 	void _checkMatrix(const ModelMatrixType &M);
+	void _checkSize(uint32_t rows, uint32_t columns);
+	// lens part of the rigidity, without loading it
+	LensPart* findLensPart(double rigidity) const;
 	// minimum / maximum rigidity that is covered by the lens [Joule]
 	double _minimumRigidity;
 	double _maximumRigidity;
@@ -174,14 +246,14 @@ public:
 
 	/// Constructs lens with predefined healpix order
 	MagneticLens(uint8_t healpixorder) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1)
 	{
 		_pixelization = new Pixelization(healpixorder);
 	}
 
 	/// Construct lens and load lens from file
 	MagneticLens(const string &filename) :
-			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN)
+			_pixelization(NULL), _minimumRigidity(DBL_MAX), _maximumRigidity(DBL_MIN), _norm(1)
 	{
 		loadLens(filename);
 	}
@@ -214,6 +286,13 @@ public:
 	/// Tries transform a cosmic ray with momentum vector p
 	bool transformCosmicRay(double rigidity, Vector3d &p);
 
+	/// Transforms many cosmic rays in parallel, as transformCosmicRay for
+	/// each index. Cosmic rays that are lost or not covered by the lens
+	/// keep their direction. Rigidities are given in Joule, phis and thetas
+	/// in rad. Returns 1 for each transformed cosmic ray, otherwise 0.
+	std::vector<int> transformCosmicRays(const std::vector<double> &rigidities,
+			std::vector<double> &phis, std::vector<double> &thetas);
+
 	/// transforms the model array assuming that model points to an array of the
 	/// correct size. Rigidity is given in Joule
 	void transformModelVector(double* model, double rigidity) const;
@@ -225,8 +304,14 @@ public:
 	/// Loads a lens from a given file, containing lines like
 	/// lensefile.MLDAT rigidityMin rigidityMax
 	/// rigidities are given in logarithmic units [log10(E / eV)]
+	/// The matrices are loaded on the first use of their rigidity range,
+	/// lens files in the compact format (see saveCompact) are memory-mapped.
 	void loadLens(const string &filename);
 
+	/// Saves the lens as file to be read with loadLens, with all parts in
+	/// the compact format next to it (filename_0.mlcmp, filename_1.mlcmp ...)
+	void saveCompact(const string &filename);
+
 	/// Normalizes the lens parts to the maximum of sums of columns of
 	/// every lenspart. By doing this, the lens won't distort the spectrum
 	void normalizeLens();
@@ -260,7 +345,8 @@ public:
 		return _norm;
 	}
 
-	/// Returns iterator to the lens part with rigidity Joule
+	/// Returns iterator to the lens part with rigidity Joule, loads the
+	/// part if it is not loaded yet
 	LensPart* getLensPart(double rigidity) const;
 
 	/// Returns all lens parts
@@ -268,6 +354,9 @@ public:
 	{
 		return _lensParts;
 	}
+
+	/// Memory of the loaded lens parts in bytes
+	size_t getSizeOf() const;
 };
 
 /** @}*/
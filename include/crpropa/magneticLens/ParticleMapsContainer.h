@@ -2,10 +2,12 @@
 #define CRPROPA_PARTICLEMAPSCONTAINER_HH
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/MagneticLens.h"
 
+#include "crpropa/Random.h"
 #include "crpropa/Vector3.h"
 
 namespace crpropa {
@@ -20,22 +22,40 @@ namespace crpropa {
 
  The maps are stored with discrete energies on a logarithmic scale. The
  default energy width is 0.02 with an energy bin from 10**17.99 - 10**18.01 eV.
+
+ All maps are stored in one array, map after map, with one weight per pixel.
+ A hash of (particle id, energy bin) gives the position of the map. Random
+ particles are drawn with alias tables for the maps and for the pixels of
+ each map, built once after the maps changed. Several containers, e.g. one
+ per thread, can be filled independently and merged.
  */
 class ParticleMapsContainer {
 private:
-	std::map<int, std::map <int, double*> > _data;
 	Pixelization _pixelization;
 	double _deltaLogE;
 	double _bin0lowerEdge;
 
+	// weights of all maps, map i at _data[i * number of pixels]
+	std::vector<double> _data;
+	// particle id and energy bin of each map
+	std::vector<int> _mapIds;
+	std::vector<int> _mapEnergyIdx;
+	std::unordered_map<int64_t, size_t> _mapIndex;
+
 	// get the bin number of the energy
 	int energy2Idx(double energy) const;
 	double idx2Energy(int idx) const;
+	static int64_t mapKey(int pid, int energyIdx);
+	// index of the map, -1 if there is none
+	long findMap(int pid, int energyIdx) const;
+	// index of the map, a new map is added if there is none
+	size_t addMap(int pid, int energyIdx);
 
 	// weights of the particles
 	double _sumOfWeights;
-	std::map<int, double > _weightsPID;
-	std::map<int, map<int, double> > _weights_pidEnergy;
+	std::vector<double> _mapWeights;
+	AliasSampler _mapSampler;
+	AliasTable _pixelSampler;
 
 	// lazy update of weights
 	bool _weightsUpToDate;
@@ -46,7 +66,7 @@ public:
 	 @param deltaLogE		width of logarithmic energy bin [in eV]
 	 @param bin0lowerEdge	logarithm of energy of the lower edge of first bin [in log(eV)]
 	 */
-	ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _pixelization(6), _weightsUpToDate(false), _sumOfWeights(0) {
+	ParticleMapsContainer(double deltaLogE = 0.02, double bin0lowerEdge = 17.99) : _pixelization(6), _deltaLogE(deltaLogE), _bin0lowerEdge(bin0lowerEdge), _sumOfWeights(0), _weightsUpToDate(false) {
 	}
 	/** Destructor.
 	 */
@@ -56,10 +76,16 @@ public:
 		return _pixelization.getNumberOfPixels();
 	}
 
+	/** Number of (particle id, energy) maps */
+	size_t getNumberOfMaps() const {
+		return _mapIds.size();
+	}
+
 	/** Get the map for the particleId with the given energy.
 	 @param particleId		id of the particle following the PDG numbering scheme
 	 @param energy			the energy of the particle [in Joules]
-	 @returns The map for a given particleId with a given energy
+	 @returns The map for a given particleId with a given energy. The pointer
+	 is valid until a map for a new particle id or energy is added.
 	 */
 	double *getMap(const int particleId, double energy);
 
@@ -78,6 +104,19 @@ public:
 	 @param weight				relative weight for the specific particle
 	*/
 	void addParticle(const int particleId, double energy, const Vector3d &v, double weight = 1);
+	/** Adds many particles, the pixels of the directions are computed in
+	 parallel. Arguments as for addParticle, all of the same size.
+	 */
+	void addParticles(const std::vector<int> &particleIds,
+		const std::vector<double> &energies,
+		const std::vector<double> &galacticLongitudes,
+		const std::vector<double> &galacticLatitudes,
+		const std::vector<double> &weights);
+
+	/** Adds the maps of another container with the same energy binning,
+	 e.g. filled by another thread.
+	 */
+	void merge(const ParticleMapsContainer &other);
 
 	/** Get all particle ids in the map.
 	 @returns Vector of all ids.
@@ -92,7 +131,7 @@ public:
 
 	void applyLens(MagneticLens &lens);;
 
-	/** Get random particles from map.
+	/** Get random particles from map, drawn in parallel.
 	 The arguments are the vectors where the information will be stored.
 	 @param N					number of particles to be selected
 	 @param particleId			id of the particle following the PDG numbering scheme
@@ -135,7 +174,8 @@ public:
 	double getWeight(int pid, double energy) {
 		if (!_weightsUpToDate)
 			_updateWeights();
-		return _weights_pidEnergy[pid][energy2Idx(energy)];
+		long i = findMap(pid, energy2Idx(energy));
+		return (i < 0) ? 0 : _mapWeights[i];
 	}
 };
 /** @}*/
@@ -27,6 +27,7 @@
 #include "healpix_base/healpix_base.h"
 #include <cmath>
 #include <stdint.h>
+#include <vector>
 
 namespace crpropa
 {
@@ -54,14 +55,20 @@ const uint32_t _nPix[] =
 		805306368
 };
 
+/// Highest order with a table of the pixel centers (786432 pixels, 12 MB)
+const uint8_t _nOrder_centerTable = 8;
+
 /// Every communication with healpix is done through this class to avoid
-/// bugs with missmatching coordinates (and make python hooks easier)
+/// bugs with missmatching coordinates (and make python hooks easier).
+/// The pixel centers of the orders up to _nOrder_centerTable are tabulated
+/// once per order and shared by all instances.
 class Pixelization
 {
 public:
 	Pixelization()
 	{
 		_healpix = new healpix::T_Healpix_Base<int>(6, healpix::RING);
+		initCenters();
 	}
 
 	/// Constructor creating Pixelization with healpix order 6 (about
@@ -69,6 +76,7 @@ public:
 	Pixelization(uint8_t order)
 	{
 		_healpix = new healpix::T_Healpix_Base<int>(order, healpix::RING);
+		initCenters();
 	}
 
 	~Pixelization()
@@ -80,6 +88,11 @@ public:
 	/// phi in [-pi, pi], theta in [-pi/2, pi/2]
 	uint32_t direction2Pix(double longitude, double latitude) const;
 
+	/// Pixels of many directions, computed in parallel
+	void direction2Pix(const std::vector<double> &longitudes,
+			const std::vector<double> &latitudes,
+			std::vector<uint32_t> &pixels) const;
+
 	/// Returns the number of pixels of the pixelization
 	uint32_t nPix() const
 	{
@@ -102,6 +115,11 @@ public:
 	/// Gives the center of pixel i in longitude [rad] and latitude [rad]
 	void pix2Direction(uint32_t i, double &longitude, double &latitude) const;
 
+	/// Centers of many pixels, computed in parallel
+	void pix2Direction(const std::vector<uint32_t> &pixels,
+			std::vector<double> &longitudes,
+			std::vector<double> &latitudes) const;
+
 	/// Calculate the angle [rad] between the vectors pointing to pixels i and j
 	double angularDistance(uint32_t i, uint32_t j) const;
 
@@ -131,7 +149,11 @@ public:
 private:
 	void spherCo2Vec(double phi, double theta, healpix::vec3 &V) const;
 	void vec2SphereCo(double &phi , double &theta, const healpix::vec3 &V) const;
+	void initCenters();
 	healpix::T_Healpix_Base<int> *_healpix;
+	// longitude and latitude of the pixel centers, NULL for high orders
+	const double *_centers;
+	static std::vector<double> _centerTables[_nOrder_centerTable + 1];
 	static healpix::T_Healpix_Base<healpix::int64> _healpix_nest;
 };
 
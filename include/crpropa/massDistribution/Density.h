@@ -5,8 +5,15 @@
 #include "crpropa/Vector3.h"
 #include "crpropa/Referenced.h"
 
+#include <string>
+
 namespace crpropa {
 
+/** Kind of density for Density::getDensities */
+enum DensityType {
+	TotalDensity, HIDensity, HIIDensity, H2Density, NucleonDensity
+};
+
 /**
  @class Density
  @brief Abstract base class for target densities
@@ -36,6 +43,11 @@ public:
 		return 0;
 	}
 
+	/** Densities of one kind at n positions, evaluated in parallel, e.g. for
+	 density maps from Python (getDensities_numpyArray) */
+	void getDensities(const Vector3d *positions, double *densities, size_t n,
+			DensityType type = TotalDensity) const;
+
 	virtual bool getIsForHI() {
 		return false;
 	}
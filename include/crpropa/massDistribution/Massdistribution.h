@@ -7,6 +7,7 @@
 
 #include "kiss/logger.h"
 
+#include <string>
 #include <vector>
 
 namespace crpropa {
@@ -54,6 +55,13 @@ public:
 	 */
 	double getNucleonDensity(const Vector3d &position) const;
 
+	/** @return true if any of the added densities is for HI */
+	bool getIsForHI();
+	/** @return true if any of the added densities is for HII */
+	bool getIsForHII();
+	/** @return true if any of the added densities is for H2 */
+	bool getIsForH2();
+
 	std::string getDescription();
 };
 
@@ -63,15 +71,35 @@ public:
 
  The DensityGrid uses a given grid for the chosen density type. More than one type can be chosen to follow the same distribution.
  If no type is chosen a warning will be raised and all densities are 0.
+
+ Alternatively the DensityGrid samples the activated types of any density
+ model, e.g. Ferriere, Cordes, Nakanishi or a DensityList, onto one grid
+ per type, so that each lookup costs one interpolation instead of the
+ evaluation of the model. The sampled grids can be kept in a binary cache
+ file for later runs.
 */
 class DensityGrid: public Density {
 private: 
-	ref_ptr<Grid1f> grid; //< Grid with data
+	ref_ptr<Grid1f> gridHI, gridHII, gridH2; //< Grids with data, per type
 	bool isForHI, isForHII, isForH2; 
 	void checkAndWarn(); //< raise a warning if all density types are deactivated.
+	void sample(ref_ptr<Density> density);
+	bool loadCache(const std::string &filename, const std::string &description);
+	void dumpCache(const std::string &filename, const std::string &description) const;
 
 public:
 	DensityGrid(ref_ptr<Grid1f> grid, bool isForHI = false, bool isForHII = false, bool isForH2 = false);
+
+	/** Sample a density model onto grids
+	 The grid points of the activated types of the density are evaluated in parallel.
+	 @param density		density model to sample
+	 @param properties	origin, size, spacing, repetition and interpolation of the grids
+	 @param cacheFile	binary file with the sampled grids; read if it was written for the same
+	 					grid properties and density description, otherwise written after the
+	 					sampling. No cache if empty.
+	 */
+	DensityGrid(ref_ptr<Density> density, const GridProperties &properties,
+			const std::string &cacheFile = "");
 	
 	/** Get HI density at a given position.
 	 @param position position in Galactic coordinates with Earth at (-8.5 kpc, 0, 0)
@@ -124,10 +152,17 @@ public:
 	void setIsForH2(bool b);
 	
 	/* Change the grid for the density
-	 @param grid (Grid1f) new grid for the density. 
+	 @param grid (Grid1f) new grid for the density, used for all types. 
 	*/
 	void setGrid(ref_ptr<Grid1f> grid);
 
+	/** @return grid of the HI density, 0 if the HI density is not sampled */
+	ref_ptr<Grid1f> getGridHI() const;
+	/** @return grid of the HII density, 0 if the HII density is not sampled */
+	ref_ptr<Grid1f> getGridHII() const;
+	/** @return grid of the H2 density, 0 if the H2 density is not sampled */
+	ref_ptr<Grid1f> getGridH2() const;
+
 	std::string getDescription();
 };
 
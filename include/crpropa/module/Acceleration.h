@@ -29,9 +29,16 @@ class StepLengthModifier : public Referenced {
 /// @details The velocity field is implicity implemented in the derived classes
 ///  for performance reasons. Models for the dependence of the step length of
 ///  the scatter process are set via modifiers.
+///  By default every scattering of a propagation step is simulated, which
+///  costs a scattering per step length for short step lengths. With
+///  setCompoundScattering(true), the number of scatterings in the step is
+///  drawn from a Poisson distribution instead, and compoundScatter applies
+///  their net effect at once. The step lengths are evaluated once per
+///  propagation step in both modes.
 class AbstractAccelerationModule : public Module {
 	double stepLength;
 	std::vector<ref_ptr<StepLengthModifier>> modifiers;
+	bool compound;
 
   public:
 	/// The parent's constructor need to be called on initialization!
@@ -50,16 +57,36 @@ class AbstractAccelerationModule : public Module {
 	/// candidate is ultra-relativistic (m = 0).
 	void scatter(Candidate *candidate,
 	             const Vector3d &scatter_center_velocity) const;
+
+	/// Draw the number of scatterings per propagation step from a Poisson
+	/// distribution instead of simulating the distance to each scattering.
+	void setCompoundScattering(bool compound);
+	bool getCompoundScattering() const;
+
+	/// Net effect of n scatterings in compound mode. The default scatters n
+	/// times, derived classes replace it with the compound distribution of
+	/// their scatter centers.
+	virtual void compoundScatter(Candidate *candidate, uint64_t n) const;
 };
 
 
 /// @class SecondOrderFermi
 /// @brief  Implements scattering with centers moving in isotropic directions.
 ///   All scatter centers have the same velocity.
+/// @details The energy gains of the scatterings are independent of each
+///   other. In compound mode, all but the last scattering only change the
+///   energy: for up to compoundThreshold scatterings each gain is drawn,
+///   for more the logarithm of the total gain is drawn from a normal
+///   distribution with the mean and variance of the sum. The last scattering
+///   is simulated from an isotropic direction, neglecting the correlation
+///   of order v / c with the direction before the step.
 class SecondOrderFermi : public AbstractAccelerationModule {
 	double scatterVelocity;
 	std::vector<double> angle;
 	std::vector<double> angleCDF;
+	double logGainMean; ///< mean logarithmic energy gain per scattering
+	double logGainVariance;
+	double logGain() const;
 
   public:
 	SecondOrderFermi(double scatterVelocity = .1 * crpropa::c_light,
@@ -67,6 +94,10 @@ class SecondOrderFermi : public AbstractAccelerationModule {
 	                 unsigned int sizeOfPitchangleTable = 10000);
 	virtual crpropa::Vector3d
 	scatterCenterVelocity(crpropa::Candidate *candidate) const;
+	void compoundScatter(Candidate *candidate, uint64_t n) const;
+
+	/// Number of scatterings up to which the gains are drawn one by one
+	static const uint64_t compoundThreshold = 32;
 };
 
 
@@ -76,6 +107,9 @@ class SecondOrderFermi : public AbstractAccelerationModule {
 ///    velocities can be used to create first order Fermi scenario.
 ///    Thanks to Aritra Ghosh, Groningn University, for first work in 2017 on
 ///    the shock acceleration in CRPropa leading to this module.
+///    As the scatterings are elastic in the rest frame of the flow, any
+///    number of them is equivalent to the last one. In compound mode, one
+///    scattering is simulated for n > 0.
 class DirectedFlowScattering : public AbstractAccelerationModule {
   private:
 	crpropa::Vector3d __scatterVelocity;
@@ -85,6 +119,7 @@ class DirectedFlowScattering : public AbstractAccelerationModule {
 	                       double stepLength = 1. * parsec);
 	virtual crpropa::Vector3d
 	scatterCenterVelocity(crpropa::Candidate *candidate) const;
+	void compoundScatter(Candidate *candidate, uint64_t n) const;
 };
 
 
@@ -149,6 +184,7 @@ class ParticleSplitting : public Module {
 	double minWeight;
 	ref_ptr<Surface> surface;
 	std::string counterid;
+	PropertyKey counterKey;
 
 	public:
 	/// @params surface               The surface to monitor
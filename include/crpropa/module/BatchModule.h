@@ -0,0 +1,92 @@
+#ifndef CRPROPA_BATCHMODULE_H
+#define CRPROPA_BATCHMODULE_H
+
+#include "crpropa/Module.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class CandidateBatch
+ @brief Current states of the candidates collected by a BatchModule
+
+ The records contain only 8 byte fields, so that they map one to one on the
+ NumPy structured array of toNumpy() in Python.
+ */
+class CandidateBatch {
+public:
+	struct Record {
+		double x, y, z; ///< position
+		double energy;
+		double weight;
+		double redshift;
+		int64_t id;
+		uint64_t serialNumber;
+	};
+
+	std::vector<Record> records;
+
+	size_t size() const {
+		return records.size();
+	}
+	const Record &getRecord(size_t i) const {
+		return records.at(i);
+	}
+};
+
+/**
+ @class BatchModule
+ @brief Module that hands the candidates to processBatch in batches
+
+ Meant for analyses and outputs written in Python: a Python Module is called
+ per candidate and step and takes the GIL every time, which serializes a
+ parallel run. The BatchModule instead records the current state of each
+ candidate in a buffer of its thread and calls processBatch once the buffer
+ holds batchSize records. In Python, override processBatch and use
+ batch.toNumpy() for vectorized processing; the GIL is then taken once per
+ batch, while the other threads keep propagating into their own buffers.
+
+ The calls of processBatch are serialized. The candidates have moved on when
+ their batch is processed, so the batch is read-only. Call flush() after the
+ run to process the remaining records.
+ */
+class BatchModule: public Module {
+	size_t batchSize;
+	mutable std::vector<std::vector<CandidateBatch::Record> > threadRecords;
+	mutable size_t batches;
+
+	void dispatch(std::vector<CandidateBatch::Record> &records) const;
+public:
+	/** Constructor
+	 @param batchSize	number of candidates per call of processBatch
+	 */
+	BatchModule(size_t batchSize = 10000);
+	virtual ~BatchModule();
+
+	void setBatchSize(size_t batchSize);
+	size_t getBatchSize() const;
+	/** Number of calls of processBatch so far */
+	size_t getNumberOfBatches() const;
+
+	/** Called with each full batch and by flush */
+	virtual void processBatch(const CandidateBatch &batch) const = 0;
+	/** Process the records of all threads; call outside of parallel regions */
+	void flush() const;
+
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_BATCHMODULE_H
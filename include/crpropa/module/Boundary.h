@@ -1,6 +1,7 @@
 #ifndef CRPROPA_BOUNDARY_H
 #define CRPROPA_BOUNDARY_H
 
+#include "crpropa/Geometry.h"
 #include "crpropa/Module.h"
 
 namespace crpropa {
@@ -72,6 +73,7 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setInterpolateCrossing the steps are not limited and the particle is rejected at the crossing instead.
  */
 class CubicBoundary: public AbstractCondition {
 private:
@@ -79,6 +81,7 @@ private:
 	double size;
 	double margin;
 	bool limitStep;
+	bool interpolate;
 
 public:
 	/** Default constructor
@@ -94,6 +97,10 @@ public:
 	void setSize(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Reject at the crossing of the boundary, interpolated along the step
+	 (Surface::getStepCrossing, Candidate::interpolateStep), instead of
+	 limiting the steps */
+	void setInterpolateCrossing(bool interpolate);
 	std::string getDescription() const;
 };
 
@@ -104,6 +111,7 @@ public:
  The particle is made inactive and flagged as "Rejected".
  By default the module prevents overshooting the boundary by more than a margin of 0.1 kpc.
  This corresponds to the default minimum step size of the propagation modules (PropagationCK and SimplePropagation).
+ With setInterpolateCrossing the steps are not limited and the particle is rejected at the crossing instead.
  */
 class SphericalBoundary: public AbstractCondition {
 private:
@@ -111,6 +119,7 @@ private:
 	double radius;
 	double margin;
 	bool limitStep;
+	bool interpolate;
 
 public:
 	/** Default constructor
@@ -126,6 +135,10 @@ public:
 	void setRadius(double size);
 	void setMargin(double margin);
 	void setLimitStep(bool limitStep);
+	/** Reject at the crossing of the boundary, interpolated along the step
+	 (Surface::getStepCrossing, Candidate::interpolateStep), instead of
+	 limiting the steps */
+	void setInterpolateCrossing(bool interpolate);
 	std::string getDescription() const;
 };
 
@@ -2,8 +2,13 @@
 #define CRPROPA_BREAKCONDITION_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Units.h"
+
+#include <map>
 
 namespace crpropa {
+
+class ElectronPairProduction;
 /**
  * \addtogroup Condition 
  * @{
@@ -36,6 +41,8 @@ public:
 
  This modules deactivates the candidate below a given minimum energy.
  In that case the property ("Deactivated", module::description) is set.
+ With applyToSecondaries, secondaries below the minimum energy are not even
+ created, see Candidate::setSecondaryThreshold.
  */
 class MinimumEnergy: public AbstractCondition {
 	double minEnergy;
@@ -43,6 +50,9 @@ public:
 	MinimumEnergy(double minEnergy = 0);
 	void setMinimumEnergy(double energy);
 	double getMinimumEnergy() const;
+	/** Set the minimum energy as threshold of the secondaries. Only for
+	 conditions that deactivate the rejected candidates without an action. */
+	void applyToSecondaries() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
 };
@@ -108,6 +118,8 @@ public:
  This modules deactivates the candidate below a given minimum energy for specific particle types.
  In that case the property ("Deactivated", module::description) is set.
  All particles whose minimum energies are not specified follow the more general minEnergyOthers condition.
+ With applyToSecondaries, secondaries below the minimum energies are not even
+ created, see Candidate::setSecondaryThreshold.
  */
 class MinimumEnergyPerParticleId: public AbstractCondition {
 	std::vector<double> minEnergies;
@@ -118,11 +130,69 @@ public:
 	void setMinimumEnergyOthers(double energy);
 	double getMinimumEnergyOthers() const;
 	void add(int id, double energy);
+	/** Set the minimum energies as thresholds of the secondaries. Only for
+	 conditions that deactivate the rejected candidates without an action. */
+	void applyToSecondaries() const;
 	std::string getDescription() const;
 	void process(Candidate *candidate) const;
 };
 
 
+/**
+ @class ReachabilityPruning
+ @brief Deactivates candidates that cannot reach an observer above a minimum energy
+
+ The continuous energy losses of a species are a lower bound of its losses,
+ and the straight distance to the nearest observer a lower bound of the
+ remaining path. The module tabulates for each species the range, i.e. the
+ distance after which the continuous losses alone have brought any energy
+ below the minimum energy, and rejects candidates whose range is shorter
+ than the distance to the nearest observer. The ranges are rounded up, so
+ that no candidate which could arrive above the minimum energy is rejected.
+ Species without losses are never rejected.
+
+ The losses are taken at redshift 0, where they are smallest for the photon
+ fields with a density that does not decrease with redshift. As for
+ MinimumEnergy, the secondaries a rejected candidate could still create are
+ lost.
+ */
+class ReachabilityPruning: public AbstractCondition {
+	double minEnergy, maxEnergy;
+	std::vector<Vector3d> observerPositions;
+	std::vector<double> observerRadii;
+	bool oneDimensional;
+	std::map<int, std::vector<double> > ranges; ///< range on log-equidistant energies from minEnergy
+
+	void setRanges(int id, const std::vector<double> &lossLengths);
+public:
+	/** Nodes per decade of energy of the ranges */
+	static const int nodesPerDecade = 100;
+
+	/** Constructor
+	 @param minEnergy	minimum energy at the observer
+	 @param maxEnergy	maximum energy of the tabulated ranges, candidates above are not rejected
+	 */
+	ReachabilityPruning(double minEnergy, double maxEnergy = 1e24 * eV);
+	/** Observer sphere, e.g. of an ObserverSurface or ObserverSmallSphere */
+	void addObserverPosition(const Vector3d &position, double radius = 0);
+	/** 1D simulation with the observer at x = 0 (Observer1D) */
+	void set1D(bool oneDimensional);
+	/** Species with a table of its energy loss lengths -E dx/dE, e.g. of
+	 continuous losses not covered by addSpecies. The loss length is
+	 interpolated in log-log and continued with the last values. */
+	void setLossLength(int id, const std::vector<double> &energies,
+			const std::vector<double> &lossLengths);
+	/** Species with the continuous losses of the electron pair production */
+	void addSpecies(int id, const ElectronPairProduction *pairProduction);
+	/** Distance that the species can travel above the minimum energy,
+	 infinite for species without a range */
+	double getRange(int id, double energy) const;
+	/** Straight distance to the nearest observer */
+	double getDistance(const Vector3d &position) const;
+	std::string getDescription() const;
+	void process(Candidate *candidate) const;
+};
+
 /**
  @class DetectionLength
  @brief Detects the candidate at a given trajectoryLength
@@ -0,0 +1,65 @@
+#ifndef CRPROPA_CANDIDATESTREAMOUTPUT_H
+#define CRPROPA_CANDIDATESTREAMOUTPUT_H
+
+#include "crpropa/Module.h"
+#include "crpropa/CandidateStream.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class CandidateStreamOutput
+ @brief Writes the candidates to a binary candidate stream file
+
+ Each candidate is written as a record of fixed size, see
+ CandidateStreamRecord, with all four states, the serial numbers, weight,
+ redshift, trajectory length, tag and the enabled properties. Unlike the
+ text outputs nothing is converted or rounded, so that SourceFromFile
+ restores the candidates as they were, e.g. at the boundary of a first
+ simulation stage, for a second stage.
+
+ The records are collected by each thread and written in blocks,
+ the footer with the tag names on close.
+ */
+class CandidateStreamOutput: public Module {
+	std::string filename;
+	mutable std::ofstream fout;
+	std::vector<std::string> properties;
+	std::vector<PropertyKey> keys;
+	mutable std::vector<std::vector<char> > threadBuffers;
+	mutable bool started;
+	mutable size_t count;
+	mutable uint32_t maxTag;
+
+	void start() const;
+	void flush(std::vector<char> &buffer) const;
+public:
+	/** Constructor
+	 @param filename	name of the binary file
+	 */
+	CandidateStreamOutput(const std::string &filename);
+	~CandidateStreamOutput();
+	/** Write the property (numbers and bools) with each candidate that has it.
+	 Only before the first candidate. */
+	void enableProperty(const std::string &property);
+	void process(Candidate *candidate) const;
+	/** Write the remaining records and the footer, and close the file */
+	void close();
+	/** Number of candidates written so far */
+	size_t getCount() const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_CANDIDATESTREAMOUTPUT_H
@@ -0,0 +1,77 @@
+#ifndef CRPROPA_CONTINUOUSLOSSES_H
+#define CRPROPA_CONTINUOUSLOSSES_H
+
+#include "crpropa/Module.h"
+#include "crpropa/LookupTable.h"
+#include "crpropa/PhotonBackground.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class ContinuousLosses
+ @brief Combined continuous energy losses without secondaries.
+
+ Replaces ElectronPairProduction without electrons, Redshift and
+ SynchrotronRadiation in a homogeneous RMS field by one module. The relative
+ energy loss rate of all processes is combined per step and integrated over
+ the step together with the redshift with a fourth order Runge-Kutta scheme,
+ so that the next step can be limited to a larger fraction of the energy
+ loss length than with the first order updates of the single modules.
+
+ The pair production losses of all photon fields are summed into one table
+ over the redshift and the Lorentz factor of a proton, which is scaled with
+ Z^2 / A for the other nuclei (cf. ElectronPairProduction).
+ Do not combine this module with the modules it replaces.
+ */
+class ContinuousLosses: public Module {
+private:
+	double limit;
+	bool redshift; ///< update the redshift and apply adiabatic losses
+	double Brms;
+	double maxRedshift;
+
+	std::vector<ref_ptr<PhotonField> > photonFields;
+	std::vector<LogGridTable> pairTables; ///< relative loss rate of protons at z = 0 [1/m] over Gamma, per photon field
+	UniformTable2D pairTable; ///< summed relative loss rate of protons [1/m] over z and log10(Gamma)
+	double lgGammaMin, lgGammaMax;
+
+	void initPairTable();
+	double pairLossRate(double lf, double z) const;
+	/** d u / dx and dz / dx at the comoving position, u = ln(E / (1 + z)) */
+	void derivatives(double u, double z, double mc2, double pairScale, double charge,
+			double &du, double &dz) const;
+
+public:
+	/** Constructor
+	 @param limit		step size limit as fraction of the energy loss length (default 0.3)
+	 @param redshift	update the redshift and apply adiabatic losses as Redshift
+	 */
+	ContinuousLosses(double limit = 0.3, bool redshift = true);
+
+	/** Add the pair production losses on a photon field, from the tables of ElectronPairProduction */
+	void addPhotonField(ref_ptr<PhotonField> photonField);
+	/** Synchrotron losses in a homogeneous field of this RMS strength, 0 to disable */
+	void setBrms(double Brms);
+	void setRedshift(bool redshift);
+	void setLimit(double limit);
+	/** Largest tabulated redshift of the pair production losses (default 10) */
+	void setMaximumRedshift(double z);
+
+	double getLimit() const;
+
+	/** Combined relative energy loss rate 1/E dE/dx [1/m] of a particle at the redshift of the candidate, per comoving distance */
+	double getLossRate(Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_CONTINUOUSLOSSES_H
@@ -0,0 +1,91 @@
+#ifndef CRPROPA_DIFFUSIONESTIMATOR_H
+#define CRPROPA_DIFFUSIONESTIMATOR_H
+
+#include "crpropa/Module.h"
+#include "crpropa/ThreadSlots.h"
+#include "crpropa/Vector3.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Observer
+ * @{
+ */
+
+/**
+ @class DiffusionEstimator
+ @brief Running moments of the displacement of the candidates for diffusion coefficients
+
+ Used as detection action of an Observer with ObserverTimeEvolution and the
+ same detection times, instead of an output of all candidates at all times.
+ At each detection it adds the weighted displacement from the source
+ position, its square per axis and the squares parallel and perpendicular
+ to the mean field direction to the moments of the detection time. The
+ detection time is taken from the DetectionIndex property of the observer,
+ or else from the trajectory length. The threads accumulate in their own
+ moments, which are added up by endRun at the end of ModuleList::run.
+
+ The diffusion coefficients at time t = L / c are
+ D_i = <dx_i^2> / 2t per axis, D_par = <dx_par^2> / 2t and
+ D_perp = <dx_perp^2> / 4t, with weighted means over the detected
+ candidates. The source positions have to be retained, see
+ Candidate::setStateRetention.
+ */
+class DiffusionEstimator: public Module {
+	std::vector<double> times;
+	Vector3d fieldDirection;
+	PropertyKey indexKey;
+	std::vector<double> moments; ///< [time][moment], see the enum in DiffusionEstimator.cpp
+	mutable ThreadSlots<std::vector<double> > threadMoments;
+
+	double getMoment(size_t i, int moment) const;
+public:
+	/** Constructor
+	 @param times			detection times as trajectory lengths [m], as of ObserverTimeEvolution::getTimes
+	 @param fieldDirection	direction of the mean magnetic field
+	 */
+	DiffusionEstimator(const std::vector<double> &times,
+			Vector3d fieldDirection = Vector3d(0, 0, 1));
+
+	void setFieldDirection(Vector3d direction);
+	Vector3d getFieldDirection() const;
+	const std::vector<double> &getTimes() const;
+
+	void process(Candidate *candidate) const;
+	/** Add the moments of the threads */
+	void endRun();
+	/** Reset the moments */
+	void clear();
+
+	/** Sum of the weights detected at time i */
+	double getWeight(size_t i) const;
+	/** Number of detections at time i */
+	size_t getCount(size_t i) const;
+	/** Mean displacement at time i [m] */
+	Vector3d getMeanDisplacement(size_t i) const;
+	/** Mean squared displacement per axis at time i [m^2] */
+	Vector3d getMeanSquaredDisplacement(size_t i) const;
+	/** Mean squared displacement parallel to the field at time i [m^2] */
+	double getParallelMeanSquaredDisplacement(size_t i) const;
+	/** Mean squared displacement perpendicular to the field at time i [m^2] */
+	double getPerpendicularMeanSquaredDisplacement(size_t i) const;
+	/** Diffusion coefficients per axis at time i [m^2/s] */
+	Vector3d getDiffusionCoefficient(size_t i) const;
+	/** Diffusion coefficient parallel to the field at time i [m^2/s] */
+	double getParallelDiffusionCoefficient(size_t i) const;
+	/** Diffusion coefficient perpendicular to the field at time i [m^2/s] */
+	double getPerpendicularDiffusionCoefficient(size_t i) const;
+
+	/** Save a table of the moments and coefficients per detection time */
+	void save(const std::string &filename);
+
+	std::string getDescription() const;
+	size_t getSizeOf() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_DIFFUSIONESTIMATOR_H
@@ -43,6 +43,16 @@ private:
 	    double epsilon; // ratio of parallel and perpendicular diffusion coefficient D_par = epsilon*D_perp
 	    double alpha; // power law index of the energy dependent diffusion coefficient: D\propto E^alpha
 	    double scale; // scaling factor for the diffusion coefficient D = scale*D_0
+	    bool stepHints; // start candidates with the variation length of the field
+
+	    // move the candidate from PosIn to the end PosOut of the field line
+	    // integration, with the perpendicular and advection steps
+	    void finishStep(Candidate *candidate, const Vector3d &PosIn, const Vector3d &PosOut,
+			    double h, double TStep, double NStep, double BStep, size_t stepNumber) const;
+	    // tryStep with the first Cash-Karp stage k0, the field line direction
+	    // at PosIn times c_light, which the trials of a step share
+	    void tryStep(const Vector3d &PosIn, const Vector3d &k0, Vector3d &POut,
+			    Vector3d &PosErr, double z, double propStep) const;
 
 public:
 	/** Constructor
@@ -65,7 +75,21 @@ public:
 
 	void process(crpropa::Candidate *candidate) const;
 
+	/** Propagate an ensemble of pseudo-particles by one step each.
+	 The normal variates of all candidates are drawn at once and the field
+	 line integrations run lane-parallel over the charged candidates, with
+	 positions in structure-of-arrays form and one MagneticField::getFields
+	 call per Cash-Karp stage for all candidates. The steps are those of
+	 process(), with the random numbers drawn in a different order.
+	 @param candidates	candidates to propagate
+	 */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+
 	void tryStep(const Vector3d &Pos, Vector3d &POut, Vector3d &PosErr, double z, double propStep ) const;
+	/** tryStep for n field line integrations, with the components of the
+	 positions in x[0..2], out[0..2] and err[0..2], each an array of n values */
+	void tryStepBatch(const double *const *x, double **out, double **err,
+			const double *propStep, const double *z, size_t n) const;
 	void driftStep(const Vector3d &Pos, Vector3d &LinProp, double h) const;
 	void calculateBTensor(double rig, double BTen[], Vector3d pos, Vector3d dir, double z) const;
 
@@ -77,6 +101,10 @@ public:
 	void setScale(double Scale);
 	void setMagneticField(ref_ptr<crpropa::MagneticField> magneticField);
 	void setAdvectionField(ref_ptr<crpropa::AdvectionField> advectionField);
+	/** Start the first step of a candidate from the variation length of the
+	 field (MagneticField::getStepHint) instead of the minimum step; off by
+	 default. Only used by process, not processBatch. */
+	void setStepHints(bool use);
 
 	double getMinimumStep() const;
 	double getMaximumStep() const;
@@ -84,7 +112,10 @@ public:
 	double getEpsilon() const;
 	double getAlpha() const;
 	double getScale() const;
+	bool getStepHints() const;
 	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
   
   ref_ptr<MagneticField> getMagneticField() const;
 	/** get magnetic field vector at current candidate position
@@ -92,6 +123,8 @@ public:
 	 @param z	 current redshift is needed to calculate the magnetic field
 	 @return	  magnetic field vector at the position pos */
 	Vector3d getMagneticFieldAtPosition(Vector3d pos, double z) const;
+	/** magnetic field vectors at n positions, with one getFields call if all redshifts are equal */
+	void getMagneticFieldsAtPositions(const Vector3d *pos, Vector3d *B, const double *z, size_t n) const;
 	ref_ptr<AdvectionField> getAdvectionField() const;
 	/** get advection field vector at current candidate position
 	 @param pos   current position of the candidate
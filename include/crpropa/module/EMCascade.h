@@ -2,6 +2,7 @@
 #define CRPROPA_EMCASCADE_H
 
 #include "crpropa/Module.h"
+#include "crpropa/ThreadSlots.h"
 
 namespace crpropa {
 
@@ -16,9 +17,11 @@ private:
 	double logEmin, logEmax, dlogE, Dmax, dD;
 
 	// histograms (distance,energy) of photons, electrons and positrons
-	mutable std::vector<uint64_t> photonHist;
-	mutable std::vector<uint64_t> electronHist;
-	mutable std::vector<uint64_t> positronHist;
+	std::vector<uint64_t> photonHist;
+	std::vector<uint64_t> electronHist;
+	std::vector<uint64_t> positronHist;
+	// histograms of the threads, of photons, electrons and positrons one after the other
+	mutable ThreadSlots<std::vector<uint64_t> > threadHist;
 	void init();
 
 public:
@@ -32,6 +35,8 @@ public:
 
 	/** Collect and deactivate photons, electrons and positrons */
 	void process(Candidate *candidate) const;
+	/** Add the histograms of the threads */
+	void endRun();
 
 	/** Save the unpropagated histogram of EM particles */
 	void save(const std::string &filename);
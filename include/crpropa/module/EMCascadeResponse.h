@@ -0,0 +1,95 @@
+#ifndef CRPROPA_EMCASCADERESPONSE_H
+#define CRPROPA_EMCASCADERESPONSE_H
+
+#include "crpropa/Module.h"
+#include "crpropa/ModuleList.h"
+#include "crpropa/ThreadSlots.h"
+#include "crpropa/Units.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class EMCascadeResponse
+ @brief Folds photons, electrons and positrons with tabulated cascade responses into an observer spectrum
+
+ The response table holds the photons arriving at the observer at the
+ origin per photon or electron (positron) injected at an energy and a
+ distance, in logarithmic energy bins. It is built once with build() from a
+ 1D simulation of the cascade with the EM modules (EMPairProduction,
+ EMInverseComptonScattering, ..., for a photon background), and can be
+ saved and loaded. As a module, EMCascadeResponse then deactivates each
+ photon, electron and positron, as EMCascade, and adds its response times
+ its weight to the observer spectrum, so that the cascade of a secondary
+ costs one table lookup. The distance is that to the origin, the energy and
+ distance bins of the particle are used without interpolation; particles
+ outside of the table are dropped, so it should cover the energies of the
+ secondaries.
+ */
+class EMCascadeResponse: public Module {
+private:
+	// energy and distance binning
+	int nE, nD;
+	double logEmin, logEmax, dlogE, Dmax, dD;
+
+	/** arriving photons per particle, [type][distance][energy][arrival energy],
+	 type 0 for photons and 1 for electrons and positrons */
+	std::vector<double> response;
+	mutable ThreadSlots<std::vector<double> > threadSpectra;
+
+	size_t index(int type, int iD, int iE) const;
+public:
+	/** Constructor
+	 @param Dmax	maximum distance [m]
+	 @param nD		number of distance bins
+	 @param logEmin	log10 of the minimum energy [eV]
+	 @param logEmax	log10 of the maximum energy [eV]
+	 @param dlogE	width of the energy bins in log10
+	 */
+	EMCascadeResponse(double Dmax = 1000 * Mpc, int nD = 100, double logEmin = 9,
+			double logEmax = 21, double dlogE = 0.1);
+
+	/** Tabulate the response: propagate samples photons and electrons from
+	 the centre of each energy and distance bin towards the origin with the
+	 cascade modules, which have to include a propagation (e.g.
+	 SimplePropagation) and should include the Redshift module. The
+	 candidates start at the redshift of their distance; a module added to
+	 the end of the list for the run detects them at the origin and
+	 deactivates those below the minimum energy.
+	 @param cascade	EM interaction and propagation modules
+	 @param samples	candidates per bin and particle type
+	 */
+	void build(ref_ptr<ModuleList> cascade, size_t samples = 100);
+	/** Save the response table */
+	void save(const std::string &filename) const;
+	/** Load a response table saved with the same binning */
+	void load(const std::string &filename);
+
+	/** Arriving photons per arrival energy bin for a photon (22) or electron
+	 (+-11) injected with the energy at the distance */
+	std::vector<double> getResponse(int id, double energy, double distance) const;
+	/** Energy of the centre of a bin [J] */
+	double getEnergy(int i) const;
+	int getNumberOfEnergyBins() const;
+
+	/** Fold and deactivate photons, electrons and positrons */
+	void process(Candidate *candidate) const;
+	/** Weighted number of photons at the observer per energy bin */
+	std::vector<double> getSpectrum() const;
+	void clearSpectrum();
+	/** Save the observer spectrum */
+	void dumpSpectrum(const std::string &filename) const;
+
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_EMCASCADERESPONSE_H
@@ -4,6 +4,8 @@
 #include <fstream>
 #include <cmath>
 
+#include "crpropa/AdaptiveThinning.h"
+#include "crpropa/LookupTable.h"
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
 
@@ -24,17 +26,20 @@ namespace crpropa {
  For the maximum thinning of 1, only a few representative particles are added to the list of secondaries.
  Note that for thinning>0 the output must contain the column "weights", which should be included in the post-processing.
  */
-class EMDoublePairProduction: public Module {
+class EMDoublePairProduction: public Module, public StochasticInteraction {
 private:
 	ref_ptr<PhotonField> photonField;
 	bool haveElectrons;
 	double limit;
 	double thinning;
+	ref_ptr<AdaptiveThinning> adaptiveThinning; ///< replaces the thinning parameter if set
 	std::string interactionTag = "EMDP";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 	// tabulated interaction rate 1/lambda(E)
 	std::vector<double> tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
+	LogGridTable rateTable;  //!< interaction rate over the electron energy
 
 public:
 	/** Constructor
@@ -49,12 +54,19 @@ public:
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
 	void setThinning(double thinning);
+	/** Thinning towards a budget of particles per primary instead of the fixed thinning parameter, 0 to disable */
+	void setAdaptiveThinning(ref_ptr<AdaptiveThinning> thinning);
+	ref_ptr<AdaptiveThinning> getAdaptiveThinning() const;
 	
 	void setInteractionTag(std::string tag);
 	std::string getInteractionTag() const;
 
 	void initRate(std::string filename);
 	void process(Candidate *candidate) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
+	/** Memory of the tables in bytes */
+	size_t getSizeOf() const;
 	void performInteraction(Candidate *candidate) const;
 };
 /** @}*/
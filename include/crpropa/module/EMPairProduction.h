@@ -4,7 +4,10 @@
 #include <fstream>
 #include <cmath>
 
+#include "crpropa/AdaptiveThinning.h"
+#include "crpropa/LookupTable.h"
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
 
 
@@ -26,22 +29,28 @@ namespace crpropa {
  For the maximum thinning of 1, only a few representative particles are added to the list of secondaries.
  Note that for thinning>0 the output must contain the column "weights", which should be included in the post-processing.
  */
-class EMPairProduction: public Module {
+class EMPairProduction: public Module, public StochasticInteraction {
 private:
 	ref_ptr<PhotonField> photonField;
+	double tableScale; // T / T_CMB for rescaled CMB tables, otherwise 1, see interactionTableField
 	bool haveElectrons;
 	double limit;
 	double thinning;
+	ref_ptr<AdaptiveThinning> adaptiveThinning; ///< replaces the thinning parameter if set
 	std::string interactionTag = "EMPP";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 	// tabulated interaction rate 1/lambda(E)
 	std::vector<double> tabEnergy;  //!< electron energy in [J]
 	std::vector<double> tabRate;  //!< interaction rate in [1/m]
+	LogGridTable rateTable;  //!< interaction rate over the electron energy
 	
 	// tabulated CDF(s_kin, E) = cumulative differential interaction rate
 	std::vector<double> tabE;  //!< electron energy in [J]
 	std::vector<double> tabs;  //!< s_kin = s - m^2 in [J**2]
 	std::vector< std::vector<double> > tabCDF;  //!< cumulative interaction rate
+	AliasTable tabSampler;  //!< alias tables of tabCDF, one row per tabE
+	TableAxis tabEAxis;  //!< nodes of tabE for the lookup of the closest row
 
 public:
 	/** Constructor
@@ -56,6 +65,9 @@ public:
 	void setHaveElectrons(bool haveElectrons);
 	void setLimit(double limit);
 	void setThinning(double thinning);
+	/** Thinning towards a budget of particles per primary instead of the fixed thinning parameter, 0 to disable */
+	void setAdaptiveThinning(ref_ptr<AdaptiveThinning> thinning);
+	ref_ptr<AdaptiveThinning> getAdaptiveThinning() const;
 	
 	void setInteractionTag(std::string tag);
 	std::string getInteractionTag() const;
@@ -65,6 +77,10 @@ public:
 
 	void performInteraction(Candidate *candidate) const;
 	void process(Candidate *candidate) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
+	/** Memory of the tables in bytes */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
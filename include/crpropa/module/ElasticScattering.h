@@ -2,6 +2,7 @@
 #define CRPROPA_ELASTICSCATTERING_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
 
 #include <vector>
@@ -12,13 +13,17 @@ namespace crpropa {
  @class ElasticScattering
  @brief Elastic scattering of background photons on cosmic-ray nuclei.
  */
-class ElasticScattering: public Module {
+class ElasticScattering: public Module, public StochasticInteraction {
 private:
 	ref_ptr<PhotonField> photonField;
+	double tableScale; // T / T_CMB for rescaled CMB tables, otherwise 1, see interactionTableField
+	double lgTableScale; // log10(tableScale)
 
 	std::vector<double> tabRate; // elastic scattering rate
 	std::vector<std::vector<double> > tabCDF; // CDF as function of background photon energy
+	AliasTable tabSampler; // alias tables of tabCDF, one row per gamma
 	std::string interactionTag = "ES";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 	static const double lgmin; // minimum log10(Lorentz-factor)
 	static const double lgmax; // maximum log10(Lorentz-factor)
@@ -36,6 +41,8 @@ public:
 	void initCDF(std::string filename);
 	void setPhotonField(ref_ptr<PhotonField> photonField);
 	void process(Candidate *candidate) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	
 	std::string getInteractionTag() const;
 	void setInteractionTag(std::string tag);
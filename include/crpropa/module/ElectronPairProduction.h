@@ -1,7 +1,9 @@
 #ifndef CRPROPA_ELECTRONPAIRPRODUCTION_H
 #define CRPROPA_ELECTRONPAIRPRODUCTION_H
 
+#include "crpropa/LookupTable.h"
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/PhotonBackground.h"
 
 namespace crpropa {
@@ -25,10 +27,18 @@ private:
 	ref_ptr<PhotonField> photonField;
 	std::vector<double> tabLossRate; /*< tabulated energy loss rate in [J/m] for protons at z = 0 */
 	std::vector<double> tabLorentzFactor; /*< tabulated Lorentz factor */
+	LogGridTable lossRateTable; /*< energy loss rate over the Lorentz factor */
+	AliasTable spectrumSampler; /*< alias tables of tabSpectrum, one row per gamma */
 	std::vector<std::vector<double> > tabSpectrum; /*< electron/positron cdf(Ee|log10(gamma)) for log10(Ee/eV)=7-24 in 170 steps and log10(gamma)=6-13 in 70 steps and*/
 	double limit; ///< fraction of energy loss length to limit the next step
 	bool haveElectrons;
 	std::string interactionTag = "EPP";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
+
+	/** lossLength for a particle of charge number Z and mass A * mass_proton */
+	double lossLength(double Z, double A, double lf, double z) const;
+	/** Energy loss of the current step and secondary pairs for a loss length */
+	void applyLoss(Candidate *candidate, double lf, double losslen) const;
 
 public:
 	ElectronPairProduction(ref_ptr<PhotonField> photonField, bool haveElectrons =
@@ -43,6 +53,10 @@ public:
 	void initRate(std::string filename);
 	void initSpectrum(std::string filename);
 	void process(Candidate *candidate) const;
+	/** Loss lengths of the nuclei of the batch with one interpolation of the
+	 loss rate table for all of them; the losses and pairs are those of
+	 process */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
 
 	/**
 	 Calculates the energy loss length 1/beta = -E dx/dE in [m]
@@ -57,7 +71,9 @@ public:
 	 beta(E,z) = (1+z)^3 beta((1+z)E).
 	 */
 	double lossLength(int id, double lf, double z=0) const;
-	
+
+	/** Memory of the tables in bytes */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
@@ -6,7 +6,12 @@
 
 #include "crpropa/module/Output.h"
 #include <stdint.h>
+#include <atomic>
 #include <ctime>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <H5Ipublic.h>
 
@@ -49,8 +54,40 @@ DATASET "OUTPUTTYPE" {
 } } }
 ```
 
+ The dataset is chunked and compressed, by default with deflate (level 5) in
+ chunks of 16384 rows. Other filters are zstd and blosc, which require the
+ HDF5 filter plugins (HDF5_PLUGIN_PATH).
+
+ For runs with DistributedModuleList each rank writes its own file
+ (DistributedModuleList::shardFilename), which can be joined into one file
+ with a collective MPI-IO write by DistributedModuleList::mergeHDF5Shards
+ in builds with parallel HDF5.
+
+ In the sharded mode (setSharded) every thread writes its own file. Since
+ the HDF5 library is not thread-safe, the threads still take turns for the
+ writes of full buffers, but not for the individual rows. On close the file
+ of this output is created as a virtual dataset (VDS) that maps the
+ datasets of the shards, so that it can be read like a single output as long
+ as the shards are next to it. mergeShards copies the rows into one file.
+
+ The tag column holds codes of the tags; their names are written once as
+ the attribute "TagNames", one name per line in the order of the codes, on
+ close and on checkpoints. The codes of a new file are those of
+ Candidate::getTagCode. Since these are only valid within one process, a
+ file resumed after a checkpoint keeps its own codes, and concatenate and
+ DistributedModuleList::mergeHDF5Shards translate the codes of each file
+ through its TagNames.
  */
 class HDF5Output: public Output {
+public:
+	enum CompressionFilter {
+		NoCompression,
+		DeflateCompression,
+		ZstdCompression,
+		BloscCompression
+	};
+
+private:
 
 	typedef struct OutputRow {
 		double D;
@@ -83,7 +120,7 @@ class HDF5Output: public Output {
 		double P1y;
 		double P1z;
 		double weight;
-		std::string tag;
+		uint32_t tag;
 		unsigned char propertyBuffer[propertyBufferSize];
 	} OutputRow;
 
@@ -91,11 +128,44 @@ class HDF5Output: public Output {
 
 	hid_t file, sid;
 	hid_t dset, dataspace;
+	/// set after open has created the file and its dataset, read by the
+	/// threads of process without a lock
+	std::atomic<bool> opened;
 	mutable std::vector<OutputRow> buffer;
+	/// rows of each thread, handed over to buffer in batches to avoid
+	/// locking for every candidate
+	mutable std::vector<std::vector<OutputRow> > threadBuffers;
+	/// rows of finished primaries in the ordered mode
+	mutable std::map<uint64_t, std::vector<OutputRow> > heldRows;
 
 	time_t lastFlush;
 	unsigned int flushLimit;
 	unsigned int candidatesSinceFlush;
+
+	size_t chunkSize;
+	CompressionFilter compression;
+	int compressionLevel;
+	double syncInterval;
+	mutable time_t lastSync;
+
+	/// names of the tag codes of the file, see writeTagNames
+	mutable std::vector<std::string> tagNames;
+	/// code in tagNames of each code of Candidate::getTagCode
+	mutable std::vector<uint32_t> tagCodes;
+
+	/// translate the tag codes of the rows to those of the file
+	void mapTagCodes(std::vector<OutputRow> &rows) const;
+	/// move rows to the shared buffer and flush if required; caller must hold the lock
+	void appendRows(std::vector<OutputRow> &rows) const;
+	/// append rows to the data set; in asynchronous mode called by the output thread only
+	void writeRows(const std::vector<OutputRow> &rows) const;
+	void holdPrimary(uint64_t index, size_t thread) const;
+	void writePrimary(uint64_t index) const;
+	Output *createShard(size_t index) const;
+	/// create the file as a virtual dataset of the shards
+	void writeShardIndex(const std::vector<std::pair<size_t, size_t> > &rows);
+	/// write or replace the attribute with the names of the tag codes
+	void writeTagNames();
 public:
 	HDF5Output();
 	HDF5Output(const std::string &filename);
@@ -106,16 +176,47 @@ public:
 	herr_t insertStringAttribute(const std::string &key, const std::string &value);
 	herr_t insertDoubleAttribute(const std::string &key, const double &value);
 	std::string getDescription() const;
+	/// Memory of the buffered rows in bytes, see Output::getSizeOf
+	size_t getSizeOf() const;
 
 	/// Force flush after N events. In long running applications with scarse
 	/// output this can be set to 1 or 0 to avoid data corruption. In applications
 	/// with frequent output this should be set to a high number (default)
 	void setFlushLimit(unsigned int N);
+	/// Number of rows per chunk of the dataset, set before the file is opened
+	void setChunkSize(size_t rows);
+	/// Compression filter and its level, set before the file is opened
+	void setCompression(CompressionFilter filter, int level = 5);
+	/// Minimum time in seconds between two syncs of the file in flush,
+	/// 0 (default) syncs after every flush. The file is always synced on
+	/// checkpoint and close.
+	void setSyncInterval(double seconds);
 
 	void open(const std::string &filename);
 	void close();
+	/// Write the buffered rows to file. Outside of a parallel region this
+	/// includes the rows still buffered by the individual threads.
 	void flush() const;
-
+	size_t checkpoint(std::string &filename);
+
+	/// Copy the rows of the shards of a virtual dataset (see setSharded)
+	/// into one file; removeShards deletes the shards and the index afterwards.
+	/// Returns the number of rows.
+	static size_t mergeShards(const std::string &index, const std::string &filename, bool removeShards = false);
+	/// Concatenate the datasets of HDF5 outputs with the same columns into
+	/// one file. Layout, filters and attributes are taken from the first
+	/// file. Returns the number of rows.
+	static size_t concatenate(const std::vector<std::string> &files, const std::string &filename);
+
+	/// Names of the tag codes of a dataset (attribute TagNames)
+	static std::vector<std::string> getTagNames(hid_t dset);
+	/// Write or replace the attribute TagNames of a dataset
+	static void setTagNames(hid_t dset, const std::vector<std::string> &names);
+	/// Code of the name in names, which is appended if not yet contained
+	static uint32_t getTagCode(std::vector<std::string> &names, const std::string &name);
+	/// Replace the code c of the tag column of n rows of the compound type
+	/// by codes[c]; codes beyond the map are kept
+	static void mapTagCodes(hid_t type, void *rows, size_t n, const std::vector<uint32_t> &codes);
 };
 /** @}*/
 
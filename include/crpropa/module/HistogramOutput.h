@@ -0,0 +1,134 @@
+#ifndef CRPROPA_HISTOGRAMOUTPUT_H
+#define CRPROPA_HISTOGRAMOUTPUT_H
+
+#include "crpropa/module/Output.h"
+#include "crpropa/module/SpectralReweighting.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+class Pixelization;
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class HistogramOutput
+ @brief Weighted histograms of the candidates instead of one line per candidate.
+
+ Each axis bins one quantity of the candidate, the histogram has a bin for
+ each combination of the bins of all axes, e.g. energy x mass group x arrival
+ pixel for skymaps per composition. The bins hold the sum of the weights and
+ of the squared weights. Each thread fills its own copy of the histogram; the
+ copies are merged when the histogram is read or saved. Candidates outside
+ of the range of an axis are only summed up in getOutOfRange.
+
+ The histogram is saved in a sparse text format with one line per filled bin,
+ compressed with gzip if the filename ends with .gz. Energies are stored in
+ units of the energy scale and lengths in units of the length scale
+ (setEnergyScale, setLengthScale), by default EeV and Mpc.
+
+ With a hypothesis axis (addHypothesisAxis) the candidate fills a bin in the
+ histogram of each source model of a SpectralReweighting, with the weight for
+ the model.
+ */
+class HistogramOutput: public Output {
+public:
+	enum Quantity {
+		Energy,
+		SourceEnergy,
+		Redshift,
+		TrajectoryLength,
+		SourceDistance, ///< distance between the current and the source position
+		Id,
+		MassNumber,
+		ArrivalPixel,
+		Hypothesis
+	};
+
+private:
+	struct Axis {
+		Quantity quantity;
+		size_t bins;
+		double min, max; ///< range, log10 of the range for logarithmic axes
+		bool logarithmic;
+		std::vector<int> values; ///< ids, or edges of the mass groups
+	};
+	std::string filename;
+	std::vector<Axis> axes;
+	Pixelization *pixelization;
+	ref_ptr<SpectralReweighting> reweighting;
+	size_t nBins;
+	/// weights and squared weights of each thread, the last is shared with a lock
+	mutable std::vector<std::vector<double> > threadBins;
+	mutable double outOfRange;
+
+	void appendAxis(const Axis &axis);
+	std::vector<double> merge(size_t offset) const;
+
+public:
+	HistogramOutput();
+	/** Constructor
+	 @param filename	file to which the histogram is saved on close
+	 */
+	HistogramOutput(const std::string &filename);
+	~HistogramOutput();
+
+	/** Axis with bins of equal width in the quantity or in its logarithm.
+	 @param quantity	Energy, SourceEnergy, Redshift, TrajectoryLength or SourceDistance
+	 @param bins		number of bins
+	 @param min			lower edge of the first bin
+	 @param max			upper edge of the last bin
+	 @param logarithmic	bins of equal width in log10
+	 */
+	void addAxis(Quantity quantity, size_t bins, double min, double max, bool logarithmic = false);
+	/** One bin for each of the particle ids */
+	void addIdAxis(const std::vector<int> &ids);
+	/** Groups of the mass number A, 0 for photons and leptons.
+	 @param edges	group i contains edges[i] <= A < edges[i + 1]
+	 */
+	void addMassGroupAxis(const std::vector<int> &edges);
+	/** HEALPix pixels (RING scheme) of the arrival direction, with the
+	 longitude and latitude of ParticleMapsContainer. Requires the galactic
+	 lens support (ENABLE_GALACTICMAGETICLENS).
+	 @param order	HEALPix order, 12 * 4^order pixels
+	 */
+	void addPixelAxis(int order = 6);
+	/** One histogram for each source model of the reweighting, has to be
+	 the first axis. The bins of the other axes are the same for all models. */
+	void addHypothesisAxis(SpectralReweighting *reweighting);
+
+	size_t getNumberOfAxes() const;
+	size_t getNumberOfBins() const;
+	/** Index of the bin of a candidate, the first axis varies slowest.
+	 Returns false if the candidate is out of range. The index is the one in
+	 the first hypothesis for a hypothesis axis. */
+	bool getBin(const Candidate *candidate, size_t &index) const;
+	/** Sum of the weights in each bin, merged over all threads. Has to be
+	 called outside of parallel regions, as getSquaredWeights. */
+	std::vector<double> getWeights() const;
+	std::vector<double> getSquaredWeights() const;
+	/** Sum of the weights of the candidates out of range */
+	double getOutOfRange() const;
+	void clear();
+
+	/** Save the merged histogram. The header describes the axes, followed
+	 by lines of the bin indices of all axes, the sum of the weights and the
+	 sum of the squared weights of the non-empty bins. */
+	void save(const std::string &filename) const;
+	/** Save to the file of the constructor, if given */
+	void close();
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+	/** Memory of the bins of all threads in bytes */
+	size_t getSizeOf() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_HISTOGRAMOUTPUT_H
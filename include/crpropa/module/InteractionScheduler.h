@@ -0,0 +1,59 @@
+#ifndef CRPROPA_INTERACTIONSCHEDULER_H
+#define CRPROPA_INTERACTIONSCHEDULER_H
+
+#include "crpropa/Module.h"
+
+#include <string>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup EnergyLosses
+ * @{
+ */
+
+/**
+ @class InteractionScheduler
+ @brief Samples the stochastic interactions of several modules jointly.
+
+ Instead of adding the interaction modules (PhotoDisintegration,
+ PhotoPionProduction, EMPairProduction, ...) to the ModuleList, where each
+ draws its own interaction distance and limits the step to a fraction of
+ its mean free path, they are added to the scheduler.
+ The scheduler draws a single optical depth per interaction, which is
+ consumed by the sum of the interaction rates along the path and kept with
+ the candidate in between steps. When it is used up, the interacting module
+ is chosen proportionally to its rate. The next step is limited to the
+ distance of the next interaction at the current rates only, so that the
+ step size is no longer bound to the shortest mean free path.
+ The rates are taken with StochasticInteraction::getCachedInteractionRate,
+ i.e. reused between steps for the modules with a rate tolerance.
+ */
+class InteractionScheduler: public Module {
+private:
+	std::vector<ref_ptr<Module> > modules;
+	std::vector<const StochasticInteraction *> interactions;
+	std::string depthProperty;
+	PropertyKey depthKey;
+
+public:
+	/** Constructor
+	 @param depthProperty	name of the candidate property for the remaining optical depth
+	 */
+	InteractionScheduler(const std::string &depthProperty = "InteractionSchedulerDepth");
+
+	/** Add an interaction module, which has to implement StochasticInteraction */
+	void add(Module *module);
+	std::size_t size() const;
+	ref_ptr<Module> operator[](const std::size_t i);
+
+	/** Sum of the interaction rates of all modules of the current state in [1/m], within their rate tolerances */
+	double getTotalRate(Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+} // namespace crpropa
+
+#endif // CRPROPA_INTERACTIONSCHEDULER_H
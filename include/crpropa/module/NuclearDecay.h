@@ -20,10 +20,16 @@ namespace crpropa {
  The resulting non-hadronic secondary particles (e+, e-, neutrinos, gamma) can optionally be created.
 
  For details on the preprocessing of the NuDat2 data refer to "CRPropa3-data/calc_decay.py".
+
+ Chains of short-lived nuclei, e.g. after photo-disintegration, are resolved
+ in a single call: if the mean decay length of the whole remaining chain in
+ the lab frame is below a fraction of the current step (see setChainFraction),
+ the decays are performed without sampling the decay distances.
  */
-class NuclearDecay: public Module {
+class NuclearDecay: public Module, public StochasticInteraction {
 private:
 	double limit;
+	double chainFraction;
 	bool haveElectrons;
 	bool havePhotons;
 	bool haveNeutrinos;
@@ -32,9 +38,17 @@ private:
 		double rate; // decay rate in [1/m]
 		std::vector<double> energy; // photon energies of ensuing gamma decays
 		std::vector<double> intensity; // probabilities of ensuing gamma decays
+		int product; // index Z * 31 + N of the daughter nucleus
 	};
 	std::vector<std::vector<DecayMode> > decayTable; // decayTable[Z * 31 + N] = vector<DecayMode>
+	std::vector<double> totalRate; // total decay rate in [1/m] per nucleus
+	std::vector<double> chainLength; // mean decay length in [m] of the chain down to a stable nucleus, in the rest frame
+
+	void initChains();
+	double chainDecayLength(int idx, std::vector<int> &state);
+	int randomChannel(const std::vector<DecayMode> &decays) const;
 	std::string interactionTag = "ND";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 public:
 	/** Constructor.
@@ -45,6 +59,8 @@ public:
 	 */
 	NuclearDecay(bool electrons = false, bool photons = false, bool neutrinos = false, double limit = 0.1);
 	void setLimit(double limit);
+	/** Resolve decay chains at once whose mean decay length is below this fraction of the current step (default 0.01, 0 disables) */
+	void setChainFraction(double fraction);
 	void setHaveElectrons(bool b);
 	void setHavePhotons(bool b);
 	void setHaveNeutrinos(bool b);
@@ -53,6 +69,8 @@ public:
 	std::string getInteractionTag() const;
 
 	void process(Candidate *candidate) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 	void gammaEmission(Candidate *candidate, int channel) const;
 	void betaDecay(Candidate *candidate, bool isBetaPlus) const;
@@ -66,6 +84,9 @@ public:
 	 @returns The mean free path [in meters]
 	 */
 	double meanFreePath(int id, double gamma);
+
+	/** Memory of the tables in bytes */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
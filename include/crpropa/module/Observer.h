@@ -4,6 +4,7 @@
 #include <fstream>
 #include <limits>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "../Candidate.h"
@@ -64,6 +65,10 @@ public:
 	void onDetection(Module *action, bool clone = false);
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
+	/** Memory of the detection action, e.g. an output */
+	size_t getSizeOf() const;
+	/** Forwarded to the detection action */
+	void endRun();
 	void setFlag(std::string key, std::string value);
 	/** Determine whether candidate should be deactivated on detection.
 	 @param deactivate	if true, deactivate detected particles; if false, continue tracking them
@@ -86,20 +91,92 @@ public:
 /**
  @class ObserverSurface
  @brief Detects particles crossing a given surface
+
+ By default the next step is limited to the distance to the surface, so that
+ the steps shrink geometrically while a particle approaches it. With
+ setInterpolateCrossing the steps are not limited; a step that crosses the
+ surface is instead cut back to the crossing, found on the interpolation of
+ the step (Surface::getStepCrossing, Candidate::interpolateStep), and the
+ particle is detected there. PropagationDP and PropagationJump, given the
+ surface with addCrossingSurface, already end their steps on it.
  */
 class ObserverSurface: public ObserverFeature {
 private:
 	ref_ptr<Surface> surface;
+	bool interpolate;
 public:
 	/** Constructor
 	 @param surface		object with some specific geometric (see Geometry.h)
 	*/
 	ObserverSurface(Surface* surface);
 	DetectionState checkDetection(Candidate *candidate) const;
+	/** Detect at the interpolated crossing instead of limiting the steps */
+	void setInterpolateCrossing(bool interpolate);
+	bool getInterpolateCrossing() const;
 	std::string getDescription() const;
 };
 
 
+/**
+ @class ObserverMultiSurface
+ @brief Detects particles crossing any of many surfaces, e.g. of a detector array or a catalogue of targets
+
+ As a list of ObserverSurface, but the bounded surfaces (see Surface::getBounds)
+ are indexed in a uniform grid of cubic cells. A step only tests the surfaces
+ in the cells swept by the segment from its previous to its current position,
+ and the next step is limited by the distance to the nearest surface found in
+ the cells around the current position. Where no surface is within
+ maxRings cells, the next step is limited to the distance to these cells
+ instead, which is a lower bound of the distance to all surfaces.
+ Unbounded surfaces, and surfaces larger than 64 cells, are tested every step.
+ The cell size should be about the distance between neighbouring surfaces.
+ */
+class ObserverMultiSurface: public ObserverFeature {
+private:
+	struct CellKey {
+		int64_t x, y, z;
+		bool operator==(const CellKey &k) const {
+			return (x == k.x) and (y == k.y) and (z == k.z);
+		}
+	};
+	struct CellHash {
+		size_t operator()(const CellKey &k) const {
+			return size_t(k.x * 73856093) ^ size_t(k.y * 19349663) ^ size_t(k.z * 83492791);
+		}
+	};
+	std::vector<ref_ptr<Surface> > surfaces;
+	std::vector<size_t> unbounded; // surfaces tested in every step
+	std::unordered_map<CellKey, std::vector<size_t>, CellHash> cells;
+	double cellSize;
+	int maxRings;
+	std::string indexKey;
+
+	CellKey cellOf(const Vector3d &position) const;
+	void collectSegment(const Vector3d &a, const Vector3d &b,
+			std::vector<size_t> &found) const;
+
+public:
+	/** Constructor
+	 @param cellSize	edge of the cubic cells of the index
+	 @param maxRings	number of rings of cells around the current cell searched for the nearest surface
+	 */
+	ObserverMultiSurface(double cellSize, int maxRings = 2);
+	/** Add a surface, e.g. a Sphere or ParaxialBox of Geometry.h */
+	void add(Surface *surface);
+	/** Add a target sphere */
+	void addSphere(const Vector3d &center, double radius);
+	/** Store the index of the crossed surface, in the order of adding, as
+	 candidate property with the given key; empty (default) for none */
+	void setIndexProperty(const std::string &key);
+	/** Lower bound of the distance of a position to all surfaces, which is
+	 the distance to the nearest surface if it is within maxRings cells */
+	double getNearestDistance(const Vector3d &position) const;
+	size_t getNumberOfSurfaces() const;
+	size_t getNumberOfCells() const;
+	DetectionState checkDetection(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
 /**
  @class ObserverSmallSphere
  @brief Detects particles that enter a sphere from the outside to the inside
@@ -2,9 +2,12 @@
 #define CRPROPA_OUTPUT_H
 
 #include "crpropa/Module.h"
+#include "crpropa/Referenced.h"
 #include "crpropa/Variant.h"
 
 #include <bitset>
+#include <functional>
+#include <set>
 #include <vector>
 #include <string>
 
@@ -59,6 +62,7 @@ protected:
 	struct Property
 	{
 		std::string name;
+		PropertyKey key;
 		std::string comment;
 		Variant defaultValue;
 	};
@@ -68,6 +72,57 @@ protected:
 	mutable size_t count;
 
 	void modify();
+	/** Throw if a column needs a state of the candidate that is not retained, see Candidate::setStateRetention */
+	void checkRetention(const Candidate *candidate) const;
+
+	/** Hand a write job to the output thread.
+	 Jobs are executed one after another in the order of submission. In
+	 synchronous mode (default) the job is executed immediately by the
+	 calling thread. If the queue is full, the call blocks until the output
+	 thread has caught up.
+	 */
+	void submit(const std::function<void()> &job) const;
+	/** Wait until all submitted jobs have been executed */
+	void drain() const;
+
+	// ordered mode, see beginOrder
+	bool ordered;
+	mutable uint64_t nextPrimary; ///< next primary to be written
+	mutable std::vector<char> threadHeld; ///< threads inside a primary
+	mutable std::set<uint64_t> finishedPrimaries; ///< finished, but not written
+	/** True if the rows of the thread belong to a primary that is not
+	 finished, so that they have to be held until endPrimary */
+	bool isHeld(size_t thread) const;
+	/** Keep the rows the thread collected for the finished primary until
+	 it is written; caller must hold the lock */
+	virtual void holdPrimary(uint64_t index, size_t thread) const;
+	/** Write the rows of a finished primary; caller must hold the lock */
+	virtual void writePrimary(uint64_t index) const;
+
+	// sharded mode, see setSharded
+	bool sharded;
+	bool exclusive; ///< this is a shard, written by a single thread only
+	mutable std::vector<ref_ptr<Output> > shards; ///< shard of each thread
+	/** New output for the shard with the given index, called by the thread
+	 that writes it. Only supported by outputs to files, the default throws. */
+	virtual Output *createShard(size_t index) const;
+	/** Copy the columns, properties and units to a new shard */
+	void configureShard(Output *shard) const;
+	/** Shard of the calling thread, created on first use; 0 if the output
+	 is not sharded or the thread has no shard */
+	Output *getShard() const;
+	/** Release the shards, which closes their files, and add their rows to
+	 the count of this output
+	 @returns index and number of rows of each shard that was created */
+	std::vector<std::pair<size_t, size_t> > releaseShards();
+
+private:
+	struct AsyncQueue;
+	AsyncQueue *asyncQueue;
+
+	// the queue and its writer thread are owned, not copied
+	Output(const Output &);
+	Output &operator=(const Output &);
 
 public:
 	enum OutputColumn {
@@ -112,6 +167,7 @@ public:
 	 @param outputType	type of output: Trajectory1D, Trajectory3D, Event1D, Event3D, Everything
 	 */
 	Output(OutputType outputType);
+	~Output();
 
 	/** Set energy scale.
 	 @param scale	energy scale (scale = 1 corresponds to 1 Joule)
@@ -137,6 +193,11 @@ public:
 	 @param	comment		string with a comment
 	 */
 	void enableProperty(const std::string &property, const Variant& defaultValue, const std::string &comment = "");
+	/** Add the cost of the candidates as properties, see
+	 Candidate::setCostAccounting: CostSteps, CostFieldEvaluations,
+	 CostRejectedSteps, CostSecondaries and CostTime (seconds).
+	 */
+	void enableCost();
 	/** Enable specific column in the output.
 	 @param field	name of the field to be enabled
 	 */
@@ -158,9 +219,66 @@ public:
 	 @param value	boolean flag
 	 */
 	void set1D(bool value);
-	/** Returns the size of the output
+	/** Write in a separate output thread.
+	 The simulation threads only prepare the data and pass it in batches to
+	 a bounded queue which is processed by a single output thread, so that
+	 the propagation does not wait for slow file systems.
+	 @param async	enable (true) or disable (false) asynchronous writing
+	 @param queueLimit	maximum number of pending batches
+	 */
+	void setAsynchronous(bool async, size_t queueLimit = 16);
+	bool isAsynchronous() const;
+	/** Write all pending data for a checkpoint (see Checkpoint).
+	 Only supported by outputs to files, the default throws.
+	 @param filename	set to the name of the output file
+	 @returns size of the output file up to now (bytes or rows)
+	 */
+	virtual size_t checkpoint(std::string &filename);
+
+	/** Write the rows in the order of the primaries, called by
+	 ModuleList::run for its ordered outputs (ModuleList::addOrderedOutput).
+	 The rows of each primary are held by the thread that propagates it
+	 and written once all earlier primaries are finished, so that the file
+	 is the same for any number of threads. The rows written outside of
+	 beginPrimary and endPrimary keep the order in which they arrive.
+	 Supported by TextOutput and HDF5Output, other outputs only count the
+	 finished primaries.
+	 @param firstPrimary	index of the first primary of the run
+	 */
+	void beginOrder(uint64_t firstPrimary);
+	/** Write the rows of the primaries that are still held, in their order,
+	 and return to the unordered mode */
+	void endOrder();
+	bool isOrdered() const;
+	/** Index of the next primary to be written in the ordered mode */
+	uint64_t getNextPrimary() const;
+	/** The calling thread starts propagating the primary */
+	void beginPrimary(uint64_t index) const;
+	/** The calling thread finished the primary and all its secondaries */
+	void endPrimary(uint64_t index) const;
+	/** Write a separate file (shard) for each thread, without any locking
+	 between the threads.
+	 The shards are named by shardFilename and created when their thread
+	 writes its first row; columns, properties and units are taken from this
+	 output at that time. On close the file of this output becomes an index
+	 of the shards (a manifest, or a virtual dataset for HDF5), which can be
+	 joined into a single file with the mergeShards of the format.
+	 Supported by TextOutput and HDF5Output, not combined with the ordered
+	 mode and checkpoints. Threads beyond the maximum number of threads at
+	 the time of the call write to the file of this output.
+	 @param value	enable (true) or disable (false) the shards
+	 */
+	void setSharded(bool value);
+	bool isSharded() const;
+	/** Name of a shard: the index is inserted before the first extension,
+	 e.g. out.txt.gz becomes out.t3.txt.gz */
+	static std::string shardFilename(const std::string &filename, size_t index);
+	/** Returns the size of the output, including its shards
 	 */
 	size_t size() const;
+	/** Memory of the buffered rows in bytes, including the shards. Has to
+	 be called outside of parallel regions. */
+	size_t getSizeOf() const;
 
 	void process(Candidate *) const;
 };
@@ -0,0 +1,73 @@
+#ifdef CRPROPA_HAVE_PARQUET
+
+#ifndef CRPROPA_PARQUETOUTPUT_H
+#define CRPROPA_PARQUETOUTPUT_H
+
+#include "crpropa/module/Output.h"
+
+#include <ctime>
+#include <string>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class ParquetOutput
+ @brief Columnar output to Apache Parquet files.
+
+ The columns are those of HDF5Output, selected with the output type and
+ enable/disable, plus the enabled properties. The rows of each thread are
+ collected without locking and written in batches, each batch as a row group
+ of column chunks. The columns are compressed with zstd, the particle ids and
+ the tag are dictionary encoded. The output type, version and scales are
+ stored as metadata in the file, so that e.g. pandas.read_parquet or Spark
+ can read single columns of large runs.
+
+ Parquet files can not be appended, so runs can not be resumed from a
+ checkpoint into the same file. Requires Apache Arrow with Parquet support.
+ */
+class ParquetOutput: public Output {
+	struct Writer; // Arrow schema and Parquet file writer, hides the Arrow headers
+	struct Row;
+
+	std::string filename;
+	Writer *writer;
+
+	time_t lastFlush;
+	unsigned int flushLimit;
+	unsigned int candidatesSinceFlush;
+
+	/// move rows to the shared buffer and flush if required; caller must hold the lock
+	void appendRows(std::vector<Row> &rows) const;
+	/// write rows as a row group; in asynchronous mode called by the output thread only
+	void writeRows(const std::vector<Row> &rows) const;
+public:
+	ParquetOutput();
+	ParquetOutput(const std::string &filename);
+	ParquetOutput(const std::string &filename, OutputType outputtype);
+	~ParquetOutput();
+
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+
+	/// Force flush after N events, see HDF5Output::setFlushLimit
+	void setFlushLimit(unsigned int N);
+
+	void open(const std::string &filename);
+	void close();
+	/// Write the buffered rows to file. Outside of a parallel region this
+	/// includes the rows still buffered by the individual threads.
+	void flush() const;
+	size_t checkpoint(std::string &filename);
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PARQUETOUTPUT_H
+
+#endif // CRPROPA_HAVE_PARQUET
@@ -2,6 +2,7 @@
 #define CRPROPA_PARTICLECOLLECTOR_H
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 #include "crpropa/Module.h"
 #include "crpropa/ModuleList.h"
@@ -16,8 +17,45 @@ namespace crpropa {
 /**
  @class ParticleCollector
  @brief A helper ouput mechanism to keep candidates in-memory and directly transfer them to Python
+
+ Each thread collects into its own container, the containers are merged on the
+ first access after the run (size, operator[], iterators, reprocess, ...),
+ which have to be called outside of parallel regions.
+
+ In compact mode (setCompact) only the current state, redshift and weight of
+ each candidate are stored as a record of 80 bytes instead of the candidate.
+ With a memory limit (setMemoryLimit) the records exceeding it are spilled to
+ a binary file. The records are only accessible through reprocess (and dump),
+ which streams them back as new candidates.
  */
 class ParticleCollector: public Module {
+public:
+	/// Compact record of a candidate, see setCompact
+	struct Record {
+		double energy;
+		double position[3];
+		double direction[3];
+		double redshift;
+		double weight;
+		int32_t id;
+	};
+
+	/// Current states of all candidates as one array per quantity (structure of arrays)
+	struct Columns {
+		std::vector<int32_t> id;
+		std::vector<double> energy;
+		std::vector<double> x, y, z; ///< position
+		std::vector<double> px, py, pz; ///< direction
+		std::vector<double> redshift;
+		std::vector<double> weight;
+
+		void reserve(size_t n);
+		void append(const Candidate *candidate);
+		size_t size() const {
+			return id.size();
+		}
+	};
+
 protected:
         typedef std::vector<ref_ptr<Candidate> > tContainer;
         mutable tContainer container;
@@ -25,6 +63,23 @@ protected:
 	bool clone;
 	bool recursive;
 
+	bool compact;
+	size_t memoryLimit;
+	std::string spillFilename;
+	mutable std::vector<tContainer> threadContainers;
+	mutable std::vector<std::vector<Record> > threadRecords;
+	mutable std::vector<Record> records;
+	mutable size_t spilled;
+
+	void init();
+	/// move the records of a thread to the shared records, caller must hold the lock
+	void appendRecords(std::vector<Record> &rs) const;
+	/// add a compact record in the buffer of thread tid
+	void collect(const Record &r, size_t tid) const;
+	void spill() const;
+	/// merge the containers of the threads; called outside of parallel regions
+	void merge() const;
+
 public:
         ParticleCollector();
         ParticleCollector(const std::size_t nBuffer);
@@ -34,6 +89,8 @@ public:
 
         void process(Candidate *candidate) const;
 	void process(ref_ptr<Candidate> c) const;
+	/** In compact mode the record is stored without creating a candidate */
+	void processSecondaryRecord(const SecondaryRecord &record, Candidate *parent) const;
 	void reprocess(Module *action) const;
 	void dump(const std::string &filename) const;
 	void load(const std::string &filename);
@@ -46,6 +103,23 @@ public:
 	std::vector<ref_ptr<Candidate> >& getContainer() const;
 	void setClone(bool b);
 	bool getClone() const;
+	/** Store compact records instead of the candidates. Has to be set
+	 while the collector is empty. */
+	void setCompact(bool compact);
+	bool isCompact() const;
+	/** Keep at most maxRecords records in memory, earlier ones are
+	 appended to the binary file filename. Implies compact mode. */
+	void setMemoryLimit(std::size_t maxRecords, const std::string &filename);
+	/** Number of records in the spill file */
+	std::size_t getSpilled() const;
+	/** Memory of the collected candidates and records in bytes. Has to be
+	 called outside of parallel regions. */
+	std::size_t getSizeOf() const;
+
+	/** Snapshot of the current states of all candidates, including the
+	 spilled records, as one array per quantity. Has to be called outside of
+	 parallel regions. In Python, toNumpy() returns the arrays as a dict. */
+	void getColumns(Columns &columns) const;
 
 	/** iterator goodies */
         typedef tContainer::iterator iterator;
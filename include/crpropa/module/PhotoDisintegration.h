@@ -1,11 +1,11 @@
 #ifndef CRPROPA_PHOTODISINTEGRATION_H
 #define CRPROPA_PHOTODISINTEGRATION_H
 
+#include "crpropa/DataTable.h"
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
 
 #include <vector>
-#include <map>
 
 namespace crpropa {
 /**
@@ -16,27 +16,47 @@ namespace crpropa {
 /**
  @class PhotoDisintegration
  @brief Photodisintegration of nuclei by background photons.
+
+ The rates and branching ratios of a nucleus are read from the shared tables
+ (see DataTable::acquire) when the nucleus is first encountered, so that runs
+ with few species do not unpack the tables of all nuclei up to iron.
  */
-class PhotoDisintegration: public Module {
+class PhotoDisintegration: public Module, public StochasticInteraction {
 private:
 	ref_ptr<PhotonField> photonField;
+	double tableScale; // T / T_CMB for rescaled CMB tables, otherwise 1, see interactionTableField
+	double lgTableScale; // log10(tableScale)
 	double limit; // fraction of mean free path for limiting the next step
 	bool havePhotons;
 	std::string interactionTag = "PD";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 	struct Branch {
 		int channel; // number of emitted (n, p, H2, H3, He3, He4)
 		std::vector<double> branchingRatio; // branching ratio as function of nucleus Lorentz factor
+		size_t photonBegin, photonEnd; // range of the emitted photons in pdPhotonEnergy
 	};
 
-	struct PhotonEmission {
-		double energy; // energy of emitted photon [J]
-		std::vector<double> emissionProbability; // emission probability as function of nucleus Lorentz factor
-	};
+	ref_ptr<const DataTable> rateData; // row: Z, N, rates
+	ref_ptr<const DataTable> branchData; // row: Z, N, channel, branching ratios
+	std::vector<long> rateRow; // rateRow[Z * 31 + N] = row in rateData, -1 if none
+	std::vector<std::vector<size_t> > branchRows; // branchRows[Z * 31 + N] = rows in branchData
+
+	// unpacked on first use of the nucleus, see loadNucleus
+	mutable std::vector<std::vector<double> > pdRate; // pdRate[Z * 31 + N] = total interaction rate
+	mutable std::vector<std::vector<Branch> > pdBranch; // pdTable[Z * 31 + N] = branching ratios
+	mutable std::vector<unsigned char> pdLoaded; // pdLoaded[Z * 31 + N] = 1 if unpacked
 
-	std::vector<std::vector<double> > pdRate; // pdRate[Z * 31 + N] = total interaction rate
-	std::vector<std::vector<Branch> > pdBranch; // pdTable[Z * 31 + N] = branching ratios
-	mutable std::map<int, std::vector<PhotonEmission> > pdPhoton; // map of emitted photon energies and photon emission probabilities
+	// emitted photons of all channels, sorted by the key of parent and daughter nucleus
+	std::vector<int> pdPhotonKey; // Z * 1000000 + N * 10000 + Z daughter * 100 + N daughter
+	std::vector<double> pdPhotonEnergy; // energy of emitted photon [J]
+	std::vector<double> pdPhotonProbability; // pdPhotonProbability[i * nlg + l] = emission probability of photon i at Lorentz factor l
+
+	void resetNuclei();
+	void loadNucleus(size_t idx) const;
+	const std::vector<double> &getRate(size_t idx) const;
+	const std::vector<Branch> &getBranches(size_t idx) const;
+	const Branch *findBranch(int Z, int N, int channel) const;
 
 	static const double lgmin; // minimum log10(Lorentz-factor)
 	static const double lgmax; // maximum log10(Lorentz-factor)
@@ -62,6 +82,11 @@ public:
 	void initPhotonEmission(std::string filename);
 
 	void process(Candidate *candidate) const;
+	/** Interaction distances and step limits of all candidates in one pass,
+	 see StochasticInteraction::processInteractionBatch */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, int channel) const;
 
 	/**
@@ -73,6 +98,10 @@ public:
 	 @returns E dx/dE [in meters]
 	 */
 	double lossLength(int id, double gamma, double z = 0);
+
+	/** Memory of the tables in bytes, including the shared data tables and
+	 the tables of the nuclei unpacked so far */
+	size_t getSizeOf() const;
 };
 
 /** @}*/
@@ -1,9 +1,12 @@
 #ifndef CRPROPA_PHOTOPIONPRODUCTION_H
 #define CRPROPA_PHOTOPIONPRODUCTION_H
 
+#include "crpropa/LookupTable.h"
 #include "crpropa/Module.h"
 #include "crpropa/PhotonBackground.h"
 
+#include <stdint.h>
+#include <string>
 #include <vector>
 
 namespace crpropa {
@@ -18,18 +21,93 @@ struct SophiaEventOutput {
 	std::vector<int> id;
 };
 
+/**
+ @class SophiaEventLibrary
+ @brief Precomputed SOPHIA events for the fast mode of PhotoPionProduction
+
+ The events of protons and neutrons are binned logarithmically in the
+ nucleon energy and the photon energy. Each event is stored as the SOPHIA
+ codes of the outgoing particles and their energies relative to the
+ incoming nucleon. An interaction draws one event of its bin and scales it
+ to the nucleon energy, without calling SOPHIA and its critical section.
+
+ The file is a flat binary in native byte order: a fixed header, the first
+ event of each bin, the first particle of each event and the particles.
+ It contains offsets only, so the arrays can be used as they are in memory.
+ Libraries are made with generate, which calls SOPHIA for each event.
+ */
+class SophiaEventLibrary: public Referenced {
+public:
+	struct Particle {
+		int32_t id; ///< SOPHIA particle code, see sophia.h
+		float fraction; ///< energy relative to the incoming nucleon
+	};
+
+private:
+	uint32_t nEnergy, nEps;
+	double lgEnergyMin, lgEnergyMax; ///< log10 of the nucleon energy range in [GeV]
+	double lgEpsMin, lgEpsMax; ///< log10 of the photon energy range in [GeV]
+	std::vector<uint32_t> binFirst; ///< first event of each bin (nucleon, energy, photon energy)
+	std::vector<uint32_t> eventFirst; ///< first particle of each event
+	std::vector<Particle> particles;
+
+	long bin(bool onProton, double Ein, double eps) const;
+
+public:
+	/** Load a library
+	 @param filename	path of the file, see generate
+	 */
+	SophiaEventLibrary(const std::string &filename);
+
+	/** Generate a library with SOPHIA
+	 @param filename		output file
+	 @param events			number of events per bin
+	 @param nEnergy			number of logarithmic bins in the nucleon energy
+	 @param energyMin		minimum nucleon energy [J]
+	 @param energyMax		maximum nucleon energy [J]
+	 @param nEps			number of logarithmic bins in the photon energy
+	 @param epsMin			minimum photon energy [J]
+	 @param epsMax			maximum photon energy [J]
+	 */
+	static void generate(const std::string &filename, size_t events,
+			size_t nEnergy, double energyMin, double energyMax,
+			size_t nEps, double epsMin, double epsMax);
+
+	/** True if the library has events for the nucleon and photon energy [J] */
+	bool contains(bool onProton, double Ein, double eps) const;
+	/** Draw an event for the nucleon and photon energy [J], see contains.
+	 @param energies	energies of the outgoing particles [J]
+	 @param ids			SOPHIA codes of the outgoing particles
+	 @returns			number of outgoing particles
+	 */
+	size_t sample(bool onProton, double Ein, double eps,
+			std::vector<double> &energies, std::vector<int> &ids) const;
+
+	size_t getNumberOfEvents() const;
+	size_t getNumberOfEvents(bool onProton, double Ein, double eps) const;
+	/** Memory of the events in bytes */
+	size_t getSizeOf() const;
+};
+
 /**
  @class PhotoPionProduction
  @brief Photo-pion interactions of nuclei with background photons.
+
+ With an event library (loadEventLibrary) the secondaries are drawn from
+ precomputed SOPHIA events wherever the library has events, and SOPHIA is
+ called for the other interactions.
  */
-class PhotoPionProduction: public Module {
+class PhotoPionProduction: public Module, public StochasticInteraction {
 
 protected:
 	ref_ptr<PhotonField> photonField;
+	double tableScale; ///< T / T_CMB for rescaled CMB tables, otherwise 1, see interactionTableField
 	std::vector<double> tabLorentz; ///< Lorentz factor of nucleus
 	std::vector<double> tabRedshifts;  ///< redshifts (optional for haveRedshiftDependence)
 	std::vector<double> tabProtonRate; ///< interaction rate in [1/m] for protons
 	std::vector<double> tabNeutronRate; ///< interaction rate in [1/m] for neutrons
+	LogGridTable rateTable[2]; ///< interaction rate over the Lorentz factor for protons and neutrons
+	UniformTable2D rateTable2d[2]; ///< interaction rate over redshift and Lorentz factor (haveRedshiftDependence)
 	double limit; ///< fraction of mean free path to limit the next step
 	bool havePhotons;
 	bool haveNeutrinos;
@@ -37,6 +115,8 @@ protected:
 	bool haveAntiNucleons;
 	bool haveRedshiftDependence;
 	std::string interactionTag = "PPP";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
+	ref_ptr<SophiaEventLibrary> eventLibrary;
 
 	// called by: sampleEps
 	// - input: s [GeV^2]
@@ -62,36 +142,43 @@ protected:
 	 */
 	double momentum(bool onProton, double Ein) const;
 	
-	// called by: functs
-	// - input: photon energy [eV]
-	// - output: crossection of nucleon-photon-interaction [mubarn]
-	double crossection(double eps, bool onProton) const;
-
 	// called by: crossection
 	// - input: photon energy [eV], threshold [eV], max [eV], unknown [no unit]
 	// - output: unknown [no unit]
-	double Pl(double eps, double xth, double xMax, double alpha) const;
+	static double Pl(double eps, double xth, double xMax, double alpha);
 
 	// called by: crossection
 	// - input: photon energy [eV], threshold [eV], unknown [eV]
 	// - output: unknown [no unit]
-	double Ef(double eps, double epsTh, double w) const;
+	static double Ef(double eps, double epsTh, double w);
 
 	// called by: crossection
 	// - input: cross section [µbarn], width [GeV], mass [GeV/c^2], rest frame photon energy [GeV]
 	// - output: Breit-Wigner crossection of a resonance of width Gamma
-	double breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) const;
+	static double breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton);
 
 	// called by: probEps, crossection, breitwigner, functs
 	// - input: is proton [bool]
 	// - output: mass [Gev/c^2]
-	double mass(bool onProton) const;
+	static double mass(bool onProton);
 
 	// - output: [GeV^2] head-on collision 
-	double sMin() const;
+	static double sMin();
 
 	bool sampleLog = true;
 	double correctionFactor = 1.6; // increeses the maximum of the propability function
+
+	// inverse cumulative distributions of the photon energy, see initSampleTables
+	bool sampleTables = true;
+	double tabSampleLgEnergyMin; ///< log10 of the smallest tabulated nucleon energy [GeV]
+	double tabSampleDLgEnergy; ///< spacing in log10 of the nucleon energy
+	double tabSampleDRedshift; ///< spacing of the redshifts, starting at 0
+	size_t tabSampleNEnergy, tabSampleNRedshift;
+	std::vector<float> tabEpsQuantiles; ///< log10(eps/eV) at the probabilities (1 - cos(pi t)) / 2 for equidistant t, [nucleon][energy][redshift][quantile], NaN where no interaction is possible
+
+	// called by: sampleEps
+	// - output: photon energy [J] from the tables, 0 if the tables do not cover E and z
+	double sampleEpsTable(bool onProton, double E, double z) const;
 	
 
 public:
@@ -111,10 +198,27 @@ public:
 	void setHaveRedshiftDependence(bool b);
 	void setLimit(double limit);
 	void setInteractionTag(std::string tag);
+	/** Draw the interactions from precomputed events, NULL to always call SOPHIA */
+	void setEventLibrary(ref_ptr<SophiaEventLibrary> library);
+	/** Load the event library from the data path */
+	void loadEventLibrary(const std::string &filename = "PhotoPionProduction/sophia_events.bin");
+	ref_ptr<SophiaEventLibrary> getEventLibrary() const;
 	void initRate(std::string filename);
+	/** Tabulate the inverse cumulative distributions of the target photon
+	 energy for sampleEps over the nucleon energies of the rate tables and
+	 the redshifts of the photon field. Called by setPhotonField.
+	 */
+	void initSampleTables();
 	double nucleonMFP(double gamma, double z, bool onProton) const;
 	double nucleiModification(int A, int X) const;
 	void process(Candidate *candidate) const;
+	/** Interaction distances and step limits of all candidates in one pass,
+	 see StochasticInteraction::processInteractionBatch. The interactions on
+	 protons and neutrons are drawn from their total rate, and the nucleon
+	 by interact. */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+	double getInteractionRate(Candidate *candidate) const;
+	void interact(Candidate *candidate) const;
 	void performInteraction(Candidate *candidate, bool onProton) const;
 
 	/**
@@ -139,11 +243,20 @@ public:
 
 	/**
 	 SOPHIA's photon sampling method. Returns energy [J] of a photon of the photon field.
+	 The energy is drawn from the tables of initSampleTables if they cover
+	 the nucleon energy and redshift, otherwise by rejection sampling.
 	 @param onProton	particle type: proton or neutron
 	 @param E		energy of incoming nucleon [J]
 	 @param z		redshift of incoming nucleon
 	 */
 	double sampleEps(bool onProton, double E, double z) const;
+
+	/**
+	 Total photo-pion cross section of SOPHIA in [mubarn], used for the rate tables
+	 @param eps			photon energy in the nucleon rest frame [GeV]
+	 @param onProton	proton or neutron
+	 */
+	static double crossection(double eps, bool onProton);
 	
 	/** called by: sampleEps
 	@param onProton	particle type: proton or neutron
@@ -164,6 +277,10 @@ public:
 	// A correction factor can be set to increase pEpsMax by that factor
 	void setCorrectionFactor(double factor);
 
+	// sample the photon energy from the tables (default) or with the
+	// exact rejection sampling, e.g. for validation
+	void setSampleTables(bool tables);
+
 	/** get functions for the parameters of the class PhotoPionProduction, similar to the set functions */
 	ref_ptr<PhotonField> getPhotonField() const;
 	bool getHavePhotons() const;
@@ -174,7 +291,10 @@ public:
 	double getLimit() const;
 	bool getSampleLog() const;
 	double getCorrectionFactor() const;
+	bool getSampleTables() const;
 	std::string getInteractionTag() const;
+	/** Memory of the tables and the event library in bytes */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
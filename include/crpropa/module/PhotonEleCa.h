@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <fstream>
+#include <vector>
 
 // forward declaration
 namespace eleca {
@@ -15,16 +16,29 @@ class Propagation;
 
 namespace crpropa {
 
+/**
+ @class PhotonEleCa
+ @brief Propagation of photons to the observer with EleCa
+
+ The EleCa tables are read once and shared by all threads. The random
+ numbers of EleCa are drawn from Random::instance(), so that process can be
+ called from several threads and follows the seeds of CRPropa. The previous
+ random number callback of EleCa is restored on destruction, so that
+ eleca::setSeed applies again once the module is gone.
+ */
 class PhotonEleCa: public Module {
 private:
 	std::auto_ptr<eleca::Propagation> propagation;
 	mutable std::ofstream output;
 	Vector3d observer;
 	bool saveOnlyPhotonEnergies;
+	double (*previousUniform)(double min, double max);
 public:
 	PhotonEleCa(const std::string background, const std::string &outputFilename);
 	~PhotonEleCa();
 	void process(Candidate *candidate) const;
+	/** Propagate the photons of several candidates at once, in parallel with OpenMP */
+	void propagate(const std::vector<ref_ptr<Candidate> > &candidates) const;
 	std::string getDescription() const;
 	void setObserver(const Vector3d &position);
 	void setSaveOnlyPhotonEnergies(bool photonsOnly);
@@ -2,8 +2,10 @@
 #define CRPROPA_PHOTON_OUTPUT_H
 
 #include "crpropa/Module.h"
+#include "crpropa/PhotonPropagation.h"
 
 #include <fstream>
+#include <vector>
 
 namespace crpropa {
 /**
@@ -11,11 +13,20 @@ namespace crpropa {
  * @{
  */
 
+/**
+ @class PhotonOutput1D
+ @brief Output of photons, electrons and positrons for DintPropagation and ElecaPropagation
+
+ The particles are written to a stream or a file, or with collect() kept in
+ memory for DintPropagation(const std::vector<CascadeParticle> &, ...).
+ */
 class PhotonOutput1D: public Module {
 private:
 	std::ostream *out;
 	std::string filename;
 	mutable std::ofstream outfile;
+	bool collecting;
+	mutable std::vector<CascadeParticle> particles;
 
 public:
 	PhotonOutput1D();
@@ -26,6 +37,11 @@ public:
 	std::string getDescription() const;
 	void close();
 	void gzip();
+
+	/** Keep the particles in memory instead of writing them */
+	void collect();
+	const std::vector<CascadeParticle> &getParticles() const;
+	void clearParticles();
 };
 /** @}*/
 
@@ -22,6 +22,8 @@ namespace crpropa {
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
  For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ With setStepHints the first step and the field-free regions are handled from
+ the step hints of the field, as in PropagationCK.
  */
 class PropagationBP: public Module {
 
@@ -57,6 +59,7 @@ private:
 	double tolerance; /** target relative error of the numerical integration */
 	double minStep; /** minimum step size of the propagation */
 	double maxStep; /** maximum step size of the propagation */
+	bool stepHints; /** use the step hints of the field */
 
 public:
 	/** Default constructor for the Boris push. It is constructed with a fixed step size.
@@ -77,6 +80,16 @@ public:
 	 * @param candidate	 The Candidate is a passive object, that holds the information about the state of the cosmic ray and the simulation itself. */
 	void process(Candidate *candidate) const;
 
+	/** Propagates a batch of candidates by one step each.
+	 The positions and directions of the charged candidates are held in
+	 structure-of-arrays form, so that the Boris push runs lane-parallel over
+	 the batch and the field is evaluated once per half step for all candidates
+	 via MagneticField::getFields. The result is the same as calling process()
+	 for every candidate.
+	 * @param candidates	candidates to propagate
+	 */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+
 	/** Calculates the new position and direction of the particle based on the solution of the Lorentz force
 	 * @param pos	current position of the candidate
 	 * @param dir	current direction of the candidate
@@ -88,6 +101,17 @@ public:
 	 */
 	Y dY(Vector3d  pos, Vector3d  dir, double step, double z, double q, double m) const;
 
+	/** Same as dY for n lanes of a batch, updates the phase points in place
+	 * @param y		positions and directions (x, y, z, ux, uy, uz), 6 arrays of length n
+	 * @param step	step sizes of the lanes
+	 * @param z		redshifts of the lanes
+	 * @param q		charges of the lanes
+	 * @param m		masses of the lanes
+	 * @param n		number of lanes
+	 */
+	void dYBatch(double *const *y, const double *step, const double *z,
+			const double *q, const double *m, size_t n) const;
+
 	/** comparison of the position after one step with the position after two steps with step/2.
 	 * @param x1	position after one step of size step
 	 * @param x2	position after two steps of size step/2
@@ -103,6 +127,15 @@ public:
 	 */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
 
+	/** Get magnetic field vectors at the positions of a batch of candidates
+	 * @param pos   positions of the candidates
+	 * @param B	 output: magnetic field vectors at the positions
+	 * @param z	 redshifts of the candidates
+	 * @param n	 number of positions
+	 */
+	void getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+			const double *z, size_t n) const;
+
 	/** Adapt step size if required and calculates the new position and direction of the particle with the usage of the function dY
 	 * @param y		 current position and direction of candidate
 	 * @param out	   position and direction of candidate after the step
@@ -115,6 +148,20 @@ public:
 	 */
 	void tryStep(const Y &y, Y &out, Y &error, double h, ParticleState &p, double z, double m, double q) const;
 
+	/** Same as tryStep for n lanes of a batch
+	 * @param y		 positions and directions (x, y, z, ux, uy, uz), 6 arrays of length n
+	 * @param out	   positions and directions after the step, same layout as y
+	 * @param error	 error estimation for the step of each lane
+	 * @param h		 step sizes of the lanes
+	 * @param z		 redshifts of the lanes
+	 * @param m		 masses of the lanes
+	 * @param q		 charges of the lanes
+	 * @param n		 number of lanes
+	 */
+	void tryStepBatch(const double *const *y, double *const *out, double *error,
+			const double *h, const double *z, const double *m, const double *q,
+			size_t n) const;
+
 	/** Set functions for the parameters of the class PropagationBP */
 
 	/** Set a specific magnetic field
@@ -133,6 +180,11 @@ public:
 	 * @param maxStep	   maxStep/c_light is the maximum integration time step 
 	 */
 	void setMaximumStep(double maxStep);
+	/** Use the step hints of the field for the first step and field-free
+	 * regions, see MagneticField::getStepHint; off by default. Only used by
+	 * process, not processBatch.
+	 */
+	void setStepHints(bool use);
 
 	/** Get functions for the parameters of the class PropagationBP, similar to the set functions */
 
@@ -140,7 +192,10 @@ public:
 	double getTolerance() const;
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	bool getStepHints() const;
 	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
@@ -0,0 +1,80 @@
+#ifndef CRPROPA_PROPAGATIONBPDEVICE_H
+#define CRPROPA_PROPAGATIONBPDEVICE_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationBPDevice
+ @brief Boris push with a fixed step through a magnetic field grid, offloaded to an accelerator.
+
+ The values of the MagneticFieldGrid are copied once into a dense array,
+ which is uploaded to the device when CRPropa is built with
+ ENABLE_OPENMP_OFFLOAD (OpenMP target offload, e.g. to NVIDIA or AMD GPUs).
+ processBatch then moves the positions and directions of a batch of charged
+ candidates to the device, pushes all of them there and returns them, so
+ that the interactions and the output of the ModuleList stay on the CPU.
+ Without offload the same kernel runs on the host.
+
+ To amortize the transfers, a candidate is pushed by up to maxSubsteps
+ steps per call, as many as fit into its next step. As the interaction
+ modules limit the next step, they still see every step they ask for.
+ A step of maxSubsteps = 1 gives the same result as PropagationBP with a
+ fixed step and the field grid. Only periodic or clipped grids with
+ trilinear interpolation are supported; call update after changing the
+ grid values. Neutral candidates move rectilinearly on the host.
+ */
+class PropagationBPDevice: public Module {
+	ref_ptr<MagneticFieldGrid> field;
+	std::vector<float> values; // dense copy of the grid, 3 floats per point, x slowest
+	size_t Nx, Ny, Nz;
+	Vector3d origin, gridOrigin, spacing;
+	bool clipVolume;
+	float scale;
+	double step;
+	size_t maxSubsteps;
+	bool mapped; // values are present on the device
+
+	void release();
+
+public:
+	/** Constructor
+	 @param field		magnetic field grid, periodic or clipped with trilinear interpolation
+	 @param step		fixed step of the Boris push
+	 @param maxSubsteps	maximum number of steps per call
+	 */
+	PropagationBPDevice(ref_ptr<MagneticFieldGrid> field, double step = 1. * kpc,
+			size_t maxSubsteps = 1);
+	~PropagationBPDevice();
+
+	/** Copy the grid values again and upload them to the device */
+	void update();
+
+	void process(Candidate *candidate) const;
+	/** Push a batch of candidates on the device with one transfer of their states */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+
+	void setStep(double step);
+	void setMaximumSubsteps(size_t maxSubsteps);
+
+	ref_ptr<MagneticFieldGrid> getField() const;
+	double getStep() const;
+	size_t getMaximumSubsteps() const;
+	/** True if the kernel runs on an accelerator, false for the host */
+	bool isOffloaded() const;
+	std::string getDescription() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONBPDEVICE_H
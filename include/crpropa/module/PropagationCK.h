@@ -21,6 +21,10 @@ namespace crpropa {
  The step size control tries to keep the relative error close to, but smaller than the designated tolerance.
  Additionally a minimum and maximum size for the steps can be set.
  For neutral particles a rectilinear propagation is applied and a next step of the maximum step size proposed.
+ With setStepHints the field is asked for its structure (MagneticField::getStepHint):
+ the first step of a candidate starts from the variation length of the field
+ and the gyroradius in its bound instead of the minimum step, and regions
+ without field are crossed in straight steps up to their border.
  */
 class PropagationCK: public Module {
 public:
@@ -56,6 +60,7 @@ private:
 	double tolerance; /*< target relative error of the numerical integration */
 	double minStep; /*< minimum step size of the propagation */
 	double maxStep; /*< maximum step size of the propagation */
+	bool stepHints; /*< use the step hints of the field */
 
 public:
 	/** Constructor for the adaptive Kash Carp.
@@ -69,17 +74,46 @@ public:
 
 	void process(Candidate *candidate) const;
 
+	/** Propagate a batch of candidates by one step each.
+	 The phase points of the charged candidates are held in structure-of-arrays
+	 form, so that the Runge-Kutta stages run lane-parallel over the batch and
+	 the field is evaluated once per stage for all candidates via
+	 MagneticField::getFields. The result is the same as calling process()
+	 for every candidate.
+	 @param candidates	candidates to propagate
+	 */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
+
 	// derivative of phase point, dY/dt = d/dt(x, u) = (v, du/dt)
 	// du/dt = q*c^2/E * (u x B)
 	Y dYdt(const Y &y, ParticleState &p, double z) const;
+	/** Derivative of the phase point for the field B at its position */
+	Y dYdt(const Y &y, ParticleState &p, const Vector3d &B) const;
 
+	/** Cash-Karp step of the time t
+	 @param B0	field at y, evaluated if NULL
+	 */
 	void tryStep(const Y &y, Y &out, Y &error, double t,
-			ParticleState &p, double z) const;
+			ParticleState &p, double z, const Vector3d *B0 = NULL) const;
+
+	/** Try a step for n lanes of a batch, arrays in structure-of-arrays form.
+	 @param y	phase points (x, y, z, ux, uy, uz), 6 arrays of length n
+	 @param out	phase points after the step, same layout as y
+	 @param errU	direction error of the step, 3 arrays of length n
+	 @param h	integration time steps
+	 @param qcE	charge * c_light / energy of the candidates
+	 @param z	redshifts
+	 */
+	void tryStepBatch(const double *const *y, double **out, double **errU,
+			const double *h, const double *qcE, const double *z, size_t n) const;
 
 	void setField(ref_ptr<MagneticField> field);
 	void setTolerance(double tolerance);
 	void setMinimumStep(double minStep);
 	void setMaximumStep(double maxStep);
+	/** Use the step hints of the field for the first step and field-free
+	 regions; off by default. Only used by process, not processBatch. */
+	void setStepHints(bool use);
 
 	 /** get functions for the parameters of the class PropagationCK, similar to the set functions */
 	ref_ptr<MagneticField> getField() const;
@@ -90,10 +124,21 @@ public:
 	 * @return	  magnetic field vector at the position pos */
 	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
 
+	/** get magnetic field vectors at the positions of a batch of candidates
+	 * @param pos	positions of the candidates
+	 * @param B	 output: magnetic field vectors at the positions
+	 * @param z	 redshifts of the candidates
+	 * @param n	 number of positions */
+	void getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+			const double *z, size_t n) const;
+
 	double getTolerance() const;
 	double getMinimumStep() const;
 	double getMaximumStep() const;
+	bool getStepHints() const;
 	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
@@ -0,0 +1,115 @@
+#ifndef CRPROPA_PROPAGATIONDP_H
+#define CRPROPA_PROPAGATIONDP_H
+
+#include "crpropa/Geometry.h"
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/PropagationCK.h"
+
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationDP
+ @brief Propagation through magnetic fields using the Dormand-Prince method with a PI step size control.
+
+ This module solves the same equations of motion as PropagationCK with the
+ embedded Runge-Kutta 5(4) method of Dormand and Prince. Its last stage is
+ the derivative at the end of the step (first same as last): it enters the
+ error estimate and the dense output, and a rejected step is tried again
+ with 6 new field evaluations, as the first stage is kept.
+
+ The step size is controlled on the direction error, as in PropagationCK,
+ with the proportional-integral controller of Gustafsson (see Hairer and
+ Wanner, Solving ODEs II, IV.2):
+ newStep = step * 0.9 * r^(-0.17) * rOld^0.04,
+ where rOld is the error ratio of the previous accepted step, which is kept
+ in the candidate property PropagationDP_errorRatio. This damps the
+ oscillation between rejected and too small steps of the purely
+ proportional controller in turbulent fields.
+
+ Surfaces added with addCrossingSurface, e.g. those of an ObserverSurface,
+ end the step exactly on the surface: if the step crosses one, the crossing
+ is found on the 4th order dense output of the step without further field
+ evaluations, and the step ends just behind it.
+ The field of the last stage, at the end of the step, is kept as the step
+ field of the candidate (Candidate::getStepField) for the other modules of
+ the step and the first stage of the next step.
+ For neutral particles a rectilinear propagation is applied and a next step
+ of the maximum step size proposed.
+ */
+class PropagationDP: public Module {
+public:
+	typedef PropagationCK::Y Y;
+
+private:
+	ref_ptr<MagneticField> field;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+	std::vector<ref_ptr<Surface> > surfaces; /*< surfaces at which steps end */
+
+	// fraction of the step at which the trajectory first crosses a surface, 1 if none
+	double crossing(const Y &y, const Y &out, const Y *k, double h) const;
+
+public:
+	/** Constructor
+	 @param field		magnetic field
+	 @param tolerance	target direction error of a step; the step size is only
+						adapted if minStep < maxStep
+	 @param minStep		minimum step size
+	 @param maxStep		maximum step size
+	 */
+	PropagationDP(ref_ptr<MagneticField> field = NULL, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+
+	void process(Candidate *candidate) const;
+
+	// derivative of phase point, dY/dt = d/dt(x, u) = (v, du/dt)
+	// du/dt = q*c^2/E * (u x B)
+	Y dYdt(const Y &y, ParticleState &p, double z) const;
+	/** Derivative of the phase point for the field B at its position */
+	Y dYdt(const Y &y, ParticleState &p, const Vector3d &B) const;
+
+	/** Dormand-Prince step of the time h
+	 @param y		phase point at the start
+	 @param out		phase point after the step (5th order)
+	 @param error	difference of the 5th and 4th order solutions
+	 @param k		7 stages; k[0] = dYdt(y) has to be given, k[6] is dYdt(out)
+	 @param Bout	if given, set to the field at out
+	 */
+	void tryStep(const Y &y, Y &out, Y &error, Y *k, double h,
+			ParticleState &p, double z, Vector3d *Bout = NULL) const;
+	/** Phase point at the fraction theta of a step from the 4th order dense
+	 output; y, out and k as given to and returned by tryStep */
+	Y denseOutput(const Y &y, const Y &out, const Y *k, double h, double theta) const;
+
+	/** End the steps that cross the surface on it */
+	void addCrossingSurface(Surface *surface);
+	void clearCrossingSurfaces();
+
+	void setField(ref_ptr<MagneticField> field);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	ref_ptr<MagneticField> getField() const;
+	Vector3d getFieldAtPosition(Vector3d pos, double z) const;
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONDP_H
@@ -0,0 +1,133 @@
+#ifndef CRPROPA_PROPAGATIONGUIDINGCENTER_H
+#define CRPROPA_PROPAGATIONGUIDINGCENTER_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/PropagationCK.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationGuidingCenter
+ @brief Propagation of low-rigidity particles in smooth magnetic fields using the guiding-centre equations.
+
+ Instead of resolving every gyration, this module integrates the motion of
+ the guiding centre R and the pitch cosine u = v.b along the field direction b:\n
+ dR/dt = c u b + E / (q B) b x (sin^2(a) / 2 grad(B) / B + u^2 k)\n
+ du/dt = -c sin^2(a) / 2 (b.grad(B)) / B\n
+ with the grad-B and curvature drifts, the curvature k = (b.grad)b of the
+ field lines and the mirror force. The magnetic moment is conserved, i.e.
+ sin^2(a) / B is constant along the step. The gradients are taken from
+ MagneticField::getFieldAndJacobian. The equations are integrated with the
+ embedded Runge-Kutta 3(2) method of Bogacki and Shampine with a step size
+ control on the relative errors of position and pitch, as for PropagationCK.
+
+ The candidate holds the particle and not the guiding centre: each step
+ starts from the guiding centre of the particle and ends with the particle
+ on its gyration around the new guiding centre, with the gyrophase advanced
+ by the gyrofrequency integrated over the step.
+
+ Where the adiabaticity parameter, the maximum gyroradius E / (|q| c B)
+ over the scale length of the field, exceeds maxAdiabaticity, and for
+ neutral particles, the step is made with the full orbit integration of
+ PropagationCK in the same field.
+ As CRPropa has no electric fields, there is no E x B drift.
+ */
+class PropagationGuidingCenter: public Module {
+public:
+	class Y {
+	public:
+		Vector3d x; /*< guiding centre */
+		double u; /*< pitch cosine */
+
+		Y() : u(0) {
+		}
+
+		Y(const Vector3d &x, double u) :
+				x(x), u(u) {
+		}
+
+		Y operator *(double f) const {
+			return Y(x * f, u * f);
+		}
+
+		Y operator +(const Y &y) const {
+			return Y(x + y.x, u + y.u);
+		}
+	};
+
+	/** Local geometry of the magnetic field */
+	class FieldGeometry {
+	public:
+		Vector3d b; /*< field direction */
+		double B; /*< field strength */
+		Vector3d gradB; /*< gradient of the field strength */
+		Vector3d curvature; /*< curvature (b.grad)b of the field lines */
+
+		FieldGeometry() : B(0) {
+		}
+	};
+
+private:
+	ref_ptr<MagneticField> field;
+	ref_ptr<PropagationCK> fullOrbit; /*< used where the guiding centre approximation fails */
+	double maxAdiabaticity;
+	double tolerance; /*< target relative error of the numerical integration */
+	double minStep; /*< minimum step size of the propagation */
+	double maxStep; /*< maximum step size of the propagation */
+
+	// derivative of the guiding centre state for the invariant sin^2(a) / B
+	Y dYdt(const Y &y, double invariant, double qcE, double z) const;
+	// Bogacki-Shampine step of the time h with the error of the embedded 2nd order solution
+	void tryStep(const Y &y, Y &out, Y &error, double h, double invariant,
+			double qcE, double z) const;
+
+public:
+	/** Constructor
+	 @param field			magnetic field
+	 @param maxAdiabaticity	largest ratio of gyroradius and field scale length for
+							guiding centre steps
+	 @param tolerance		target relative error of position and pitch of a step
+	 @param minStep			minimum step size
+	 @param maxStep			maximum step size
+	 */
+	PropagationGuidingCenter(ref_ptr<MagneticField> field = NULL,
+			double maxAdiabaticity = 0.01, double tolerance = 1e-4,
+			double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+
+	void process(Candidate *candidate) const;
+
+	/** Field direction, strength, gradient and curvature at the position;
+	 a zero field has B = 0 */
+	FieldGeometry getFieldGeometry(const Vector3d &position, double z) const;
+	/** Adiabaticity parameter of the candidate at its position: maximum
+	 gyroradius over the scale length of the field, infinite without field */
+	double getAdiabaticity(const Candidate *candidate) const;
+	/** Guiding centre of the particle */
+	Vector3d getGuidingCenter(const ParticleState &particle, double z) const;
+
+	void setField(ref_ptr<MagneticField> field);
+	void setMaximumAdiabaticity(double maxAdiabaticity);
+	void setTolerance(double tolerance);
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+
+	ref_ptr<MagneticField> getField() const;
+	double getMaximumAdiabaticity() const;
+	double getTolerance() const;
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	/** Memory of the magnetic field */
+	size_t getSizeOf() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONGUIDINGCENTER_H
@@ -0,0 +1,72 @@
+#ifndef CRPROPA_PROPAGATIONHANDOFF_H
+#define CRPROPA_PROPAGATIONHANDOFF_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Geometry.h"
+#include "crpropa/Units.h"
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationHandoff
+ @brief Rectilinear propagation of candidates that escaped a magnetized region towards an observer sphere.
+
+ Wraps the propagation in magnetic fields, e.g. PropagationCK, which moves
+ the candidates inside the region, e.g. the volume of a MagneticFieldGrid
+ with setClipVolume or of a SphericalBoundary. Outside of the region the
+ field has to vanish. A candidate outside of the region that moves away from
+ it does not come back, as the region has to be convex (e.g. a Sphere or a
+ ParaxialBox), and is moved on a straight line as with SimplePropagation:
+ the steps are limited by the interactions and the redshift only, not by the
+ step control of the field integration.
+
+ A step that reaches the observer sphere, e.g. of an ObserverLargeSphere
+ with the same center and radius, ends just behind its surface. The arrival
+ position, direction and trajectory length, and with it the time delay, are
+ thus those of the straight line to the observer.
+ */
+class PropagationHandoff: public Module {
+private:
+	ref_ptr<Module> propagation;
+	ref_ptr<Surface> region;
+	Vector3d observerCenter;
+	double observerRadius;
+	double minStep, maxStep;
+
+public:
+	/** Constructor
+	 @param propagation		propagation module inside the region
+	 @param region			convex surface around the magnetized region
+	 @param observerCenter	center of the observer sphere
+	 @param observerRadius	radius of the observer sphere
+	 @param minStep			minimum step of the rectilinear propagation
+	 @param maxStep			maximum step of the rectilinear propagation
+	 */
+	PropagationHandoff(Module *propagation, Surface *region, Vector3d observerCenter,
+			double observerRadius, double minStep = (0.1 * kpc), double maxStep = (1 * Gpc));
+	void process(Candidate *candidate) const;
+
+	/** True if the candidate is outside of the region and moves away from
+	 it, so that it is propagated on a straight line */
+	bool isHandedOff(const Candidate *candidate) const;
+	/** Distance along the direction of the candidate to the observer
+	 sphere, negative if the straight line misses it */
+	double distanceToObserver(const Candidate *candidate) const;
+
+	void setMinimumStep(double minStep);
+	void setMaximumStep(double maxStep);
+	double getMinimumStep() const;
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	/** Memory of the wrapped propagation */
+	size_t getSizeOf() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONHANDOFF_H
@@ -0,0 +1,72 @@
+#ifndef CRPROPA_PROPAGATIONJUMP_H
+#define CRPROPA_PROPAGATIONJUMP_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Geometry.h"
+#include "crpropa/Units.h"
+
+#include <set>
+#include <vector>
+
+namespace crpropa {
+/**
+ * \addtogroup Propagation
+ * @{
+ */
+
+/**
+ @class PropagationJump
+ @brief Rectilinear propagation of non-interacting neutral particles in a single step to the next surface.
+
+ Wraps the propagation of the other candidates, e.g. SimplePropagation or
+ PropagationCK. Neutrinos, and photons if they are added when no EM
+ interactions are in the simulation, are not changed by any module but the
+ Redshift. Their steps, which the observers and boundaries limit to
+ conservative distances to their surfaces, are thus replaced by one jump on
+ the straight line to its first crossing of the added surfaces, e.g. those of
+ the ObserverSurface and the boundaries. The jump ends just behind the
+ crossing, so that the observer detects it or the boundary deactivates the
+ candidate, and the Redshift module in the same step applies the redshift and
+ the adiabatic losses of the whole jump.
+
+ The steps proposed by the other modules are ignored for these particles.
+ Without a crossing the jump has the maximum step size, which should be the
+ maximum trajectory length of the simulation.
+ */
+class PropagationJump: public Module {
+private:
+	ref_ptr<Module> propagation;
+	std::vector<ref_ptr<Surface> > surfaces;
+	std::set<int> ids;
+	double maxStep;
+
+public:
+	/** Constructor
+	 @param propagation	propagation of the other candidates
+	 @param maxStep		largest jump, without crossing of a surface
+	 */
+	PropagationJump(Module *propagation, double maxStep = (1 * Gpc));
+	void process(Candidate *candidate) const;
+
+	/** Surface at which the jumps end, e.g. of an observer or a boundary */
+	void addSurface(Surface *surface);
+	/** Neutral particle that no module changes, e.g. 22 for photons without
+	 EM interactions; the neutrinos are added by default */
+	void addParticleId(int id);
+	void clearParticleIds();
+	bool isJumping(const Candidate *candidate) const;
+	/** Distance along the direction of the candidate to the first crossing
+	 of a surface, or maxStep without crossing */
+	double distanceToSurfaces(const Candidate *candidate) const;
+
+	void setMaximumStep(double maxStep);
+	double getMaximumStep() const;
+	std::string getDescription() const;
+	/** Memory of the wrapped propagation */
+	size_t getSizeOf() const;
+};
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_PROPAGATIONJUMP_H
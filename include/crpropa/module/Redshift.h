@@ -16,6 +16,8 @@ namespace crpropa {
 class Redshift: public Module {
 public:
 	void process(Candidate *candidate) const;
+	/** Redshift steps and adiabatic losses of all candidates in one pass, as process */
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const;
 	std::string getDescription() const;
 };
 
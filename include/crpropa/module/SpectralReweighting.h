@@ -0,0 +1,100 @@
+#ifndef CRPROPA_SPECTRALREWEIGHTING_H
+#define CRPROPA_SPECTRALREWEIGHTING_H
+
+#include "crpropa/Module.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace crpropa {
+
+class Output;
+
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class SpectralModel
+ @brief Composition and power-law spectrum of a source model for SpectralReweighting
+
+ The species are given as for SourceComposition: the spectrum of species i
+ is abundance_i * A_i^-(1 + index) * E^index for Emin <= E <= Z_i * Rmax, so
+ that the model with the parameters of a SourceComposition describes its
+ injection. Above Z_i * Rcut the spectrum is suppressed by
+ exp(1 - E / (Z_i * Rcut)). Neutral particles count as Z = 1 and particles
+ that are not nuclei as A = 1, so that the model of
+ SourcePowerLawSpectrum(Emin, Emax, index) for protons, neutrons, electrons
+ or photons has Rmax = Emax.
+ */
+class SpectralModel: public Referenced {
+	double Emin, Rmax, index, Rcut;
+	std::vector<int> ids;
+	std::vector<double> abundances;
+	std::vector<double> factors; ///< abundance with the mass factor and the normalization
+
+	double integral(int Z) const;
+	void normalize();
+public:
+	/** Constructor
+	 @param Emin	minimum energy (in Joules)
+	 @param Rmax	maximum rigidity (in Volts)
+	 @param index	spectral index of the power law
+	 @param Rcut	rigidity above which the spectrum is suppressed exponentially
+	 */
+	SpectralModel(double Emin, double Rmax, double index,
+			double Rcut = std::numeric_limits<double>::infinity());
+	/** Add a particle species with a relative abundance */
+	void add(int id, double abundance = 1);
+	void add(int A, int Z, double abundance);
+	/** Probability density of the species and the energy, normalized to
+	 one over all species and energies */
+	double getDensity(int id, double energy) const;
+	std::string getDescription() const;
+};
+
+/**
+ @class SpectralReweighting
+ @brief Weights of the candidates for other source models than the injected one
+
+ Simulate once with a wide injection, e.g. a flat spectrum in log(E) and
+ several species, and obtain the results for many source models from one
+ run: the weight for a model is the weight of the candidate times the ratio
+ of the densities of the model and of the injection at the source species and
+ energy (ID0, E0). The source state has to be retained.
+
+ Added before an output, e.g. in the onDetection of an Observer, the module
+ stores the weights in the candidate properties "weight_<name>", which the
+ outputs write after enableOutput. HistogramOutput fills one histogram per
+ model with addHypothesisAxis.
+ */
+class SpectralReweighting: public Module {
+	ref_ptr<SpectralModel> injection;
+	std::vector<ref_ptr<SpectralModel> > models;
+	std::vector<std::string> names;
+	std::vector<PropertyKey> keys;
+public:
+	/** Constructor
+	 @param injection	model of the simulated injection
+	 */
+	SpectralReweighting(SpectralModel *injection);
+	/** Add a source model, which is named in the outputs */
+	void addHypothesis(const std::string &name, SpectralModel *model);
+	size_t getNumberOfHypotheses() const;
+	const std::string &getName(size_t i) const;
+	/** Weights of the candidate for all models */
+	void getWeights(const Candidate *candidate, std::vector<double> &weights) const;
+	std::vector<double> getWeights(const Candidate *candidate) const;
+	/** Enable the weight properties of all models in the output */
+	void enableOutput(Output *output) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_SPECTRALREWEIGHTING_H
@@ -1,7 +1,9 @@
 #ifndef CRPROPA_SYNCHROTRONRADIATION_H
 #define CRPROPA_SYNCHROTRONRADIATION_H
 
+#include "crpropa/AdaptiveThinning.h"
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
 #include "crpropa/magneticField/MagneticField.h"
 
 namespace crpropa {
@@ -21,6 +23,8 @@ namespace crpropa {
  Note that the large number of secondary photons per propagation can cause memory problems.
  To mitigate this, use thinning. However, this still does not solve the problem completely.
  For this reason, a break-condition stops tracking secondary photons and reweights the current ones. 
+ Alternatively, in the aggregated mode (see setAggregatedSamples) a fixed number of weighted photons
+ per step represents the spectrum, with the total energy of the emitted photons.
  */
 class SynchrotronRadiation: public Module {
 private:
@@ -28,12 +32,17 @@ private:
 	double Brms; ///< Brms value in case no MagneticField is specified
 	double limit; ///< fraction of energy loss length to limit the next step
 	double thinning; ///< thinning parameter for weighted-sampling (maximum 1, minimum 0)
+	ref_ptr<AdaptiveThinning> adaptiveThinning; ///< replaces the thinning parameter if set
 	bool havePhotons; ///< flag for production of secondary photons
 	int maximumSamples; ///< maximum number of samples of synchrotron photons (break condition; defaults to 100; 0 or <0 means no sampling)
 	double secondaryThreshold; ///< threshold energy for secondary photons
 	std::vector<double> tabx; ///< tabulated fraction E_photon/E_critical from 10^-6 to 10^2 in 801 log-spaced steps
 	std::vector<double> tabCDF; ///< tabulated CDF of synchrotron spectrum
+	AliasSampler cdfSampler; ///< alias table of tabCDF
+	double tabMeanX; ///< mean fraction E_photon/E_critical of the tabulated spectrum
+	int aggregatedSamples; ///< number of weighted photons per step in the aggregated mode (0: off)
 	std::string interactionTag = "SYN";
+	uint32_t interactionTagCode = Candidate::getTagCode(interactionTag);
 
 public:
 	/** Constructor
@@ -57,12 +66,22 @@ public:
 	void setBrms(double Brms);	
 	void setHavePhotons(bool havePhotons);
 	void setThinning(double thinning);
+	/** Thinning towards a budget of particles per primary instead of the fixed thinning parameter, 0 to disable */
+	void setAdaptiveThinning(ref_ptr<AdaptiveThinning> thinning);
+	ref_ptr<AdaptiveThinning> getAdaptiveThinning() const;
 	void setLimit(double limit);
 	/** Set the maximum number of synchrotron photons that will be allowed to be added as candidates. 
 	 This choice depends on the problem at hand. It must be such that all relevant physics is captured with the sample. Weights are added accordingly and the column 'weight' must be added to output.
 	 @param nmax	maximum number of synchrotron photons to be sampled
 	 */
 	void setMaximumSamples(int nmax);
+	/** Aggregated sampling of the synchrotron photons.
+	 If more than n photons are expected in a step, n photons are drawn from the spectrum stratified in
+	 the cumulative distribution, each with the weight dE / sum(E_photon), so that the weighted photons
+	 carry the total energy loss dE of the step. Takes precedence over setMaximumSamples.
+	 @param n	number of photons per step (0: off)
+	 */
+	void setAggregatedSamples(int n);
 	/** Synchrotron photons above the secondary energy threshold are added as candidates.
 	 This may lead to a quick increase in memory.
 	 @param threshold	energy threshold above which photons will be added [in Joules]
@@ -76,12 +95,16 @@ public:
 	double getThinning();
 	double getLimit();
 	int getMaximumSamples();
+	int getAggregatedSamples() const;
 	double getSecondaryThreshold() const;
 	std::string getInteractionTag() const;
 
 	void initSpectrum();
 	void process(Candidate *candidate) const;
 	std::string getDescription() const;
+	/** Memory of the spectrum tables in bytes, the field is counted by the
+	 propagation module */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
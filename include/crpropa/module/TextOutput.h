@@ -5,6 +5,9 @@
 #include "crpropa/module/ParticleCollector.h"
 
 #include <fstream>
+#include <map>
+#include <string>
+#include <vector>
 
 namespace crpropa {
 /**
@@ -18,6 +21,17 @@ namespace crpropa {
  This type of output can also be used to generate a .tar.gz file if
  the library zlib is available. For details see:
  	http://zlib.net/
+
+ The numbers are formatted independently of the locale in the format of
+ printf %.5E. Within a parallel region each thread collects its lines and
+ writes them in blocks of 64 kB, so that lines of different threads are not
+ interleaved line by line. Outside of parallel regions every line is written
+ immediately. In the ordered mode (ModuleList::addOrderedOutput) the lines
+ are written in the order of the primaries.
+
+ In the sharded mode (setSharded) every thread writes its own file, and on
+ close the file of this output lists the shards as lines
+ "# shard NAME ROWS", with the names relative to its directory.
  */
 class TextOutput: public Output {
 protected:
@@ -25,8 +39,20 @@ protected:
 	std::ofstream outfile;
 	std::string filename;
 	bool storeRandomSeeds;
-	
+	mutable std::string batch; ///< lines collected for the output thread in asynchronous mode
+	mutable std::vector<std::string> lineBuffers; ///< lines of each thread, written in blocks
+	mutable std::map<uint64_t, std::string> heldLines; ///< lines of finished primaries in the ordered mode
+	mutable bool headerWritten;
+	size_t resumeCount; ///< candidates in the file continued after a checkpoint
+
 	void printHeader() const;
+	void submitBatch() const;
+	/// write a block of lines and clear it; caller must hold the lock
+	void writeLines(std::string &lines) const;
+	void openFile();
+	void holdPrimary(uint64_t index, size_t thread) const;
+	void writePrimary(uint64_t index) const;
+	Output *createShard(size_t index) const;
 
 public:
 	/** Default constructor
@@ -63,14 +89,35 @@ public:
 	void enableRandomSeeds() {storeRandomSeeds = true;};
 	void close();
 	void gzip();
+	/** Write the lines buffered by the threads. Has to be called outside of
+	 parallel regions; close and checkpoint include it. */
+	void flush() const;
+	/** Write the lines of the threads at the end of ModuleList::run, so
+	 that the file or stream holds all rows before close */
+	void endRun();
 	void process(Candidate *candidate) const;
+	size_t checkpoint(std::string &filename);
 	/** Loads a file to a particle collector.
 	 This is useful for analysis involving, e.g., magnetic lenses.
 	 @param filename	string containing the name of the file to be loaded
 	 @param collector	object of type ParticleCollector that will store the information
 	 */
 	static void load(const std::string &filename, ParticleCollector *collector);
+	/** Join the shards listed in an index file (see setSharded) into one file
+	 @param index		name of the index file
+	 @param filename	name of the joined file
+	 @param removeShards	delete the shards and the index afterwards
+	 @returns number of rows
+	 */
+	static size_t mergeShards(const std::string &index, const std::string &filename, bool removeShards = false);
+	/** Concatenate uncompressed text outputs into one file. The header of
+	 the first file is kept, the header lines of the others are skipped.
+	 @returns number of rows
+	 */
+	static size_t concatenate(const std::vector<std::string> &files, const std::string &filename);
 	std::string getDescription() const;
+	/** Memory of the buffered lines in bytes, see Output::getSizeOf */
+	size_t getSizeOf() const;
 };
 /** @}*/
 
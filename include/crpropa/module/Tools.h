@@ -3,9 +3,12 @@
 
 #include "crpropa/Module.h"
 #include "crpropa/EmissionMap.h"
+#include "crpropa/TiledGrid.h"
 
-#include <vector>
+#include <mutex>
 #include <set>
+#include <stdint.h>
+#include <vector>
 
 namespace crpropa {
 /**
@@ -18,22 +21,117 @@ namespace crpropa {
  @brief Module to monitor the simulation performance
 
  Add modules under investigation to this module instead of the ModuleList.
+ The calls of each module are timed with a nanosecond clock and counted in
+ counters per thread, without synchronization between the threads. The
+ counters are merged when read, e.g. after the run, and can be exported as
+ JSON (toJSON, getStatistics() in Python). A summary is printed when the
+ module is deleted.
+
+ With setHardwareCounters, each thread also counts the CPU cycles,
+ instructions, last level cache misses and branch misses of the calls with
+ the hardware counters of the processor (Linux perf_event_open), e.g. to see
+ whether a module is bound by memory or by arithmetic. This costs a system
+ call per module call.
  */
 class PerformanceModule: public Module {
-private:
-	struct _module_info {
-		double time;
-		ref_ptr<Module> module;
+public:
+	/** Bins of the time histogram: bin i counts calls of 2^i to 2^(i+1) ns */
+	static const size_t histogramBins = 32;
+	/** Events of the hardware counters */
+	enum HardwareEvent {
+		Cycles = 0, Instructions, CacheMisses, BranchMisses
 	};
+	static const size_t hardwareEvents = 4;
+
+private:
+	struct ThreadCounters;
+
+	std::vector<ref_ptr<Module> > modules;
+	mutable std::vector<ThreadCounters *> threadCounters;
+	mutable std::mutex mutex;
+	uint64_t instance; ///< unique id, identifies the counters of the threads
+	bool hardwareCounters;
 
-	mutable std::vector<_module_info> modules;
-	mutable size_t calls;
+	ThreadCounters *getThreadCounters() const;
+	void clearCounters();
 
 public:
+	PerformanceModule();
 	~PerformanceModule();
+	/** Add a module to monitor; resets the counters */
+	void add(Module* module);
+	void process(Candidate* candidate) const;
+	std::string getDescription() const;
+
+	size_t size() const;
+	/** Number of calls of process, i.e. steps of the candidates */
+	uint64_t getSteps() const;
+	/** Number of calls of module i */
+	uint64_t getCalls(size_t i) const;
+	/** Total time spent in module i in seconds */
+	double getTime(size_t i) const;
+	/** Histogram of the call durations of module i, see histogramBins */
+	std::vector<uint64_t> getTimeHistogram(size_t i) const;
+	/** Count the hardware events of the calls; resets the counters.
+	 Threads that cannot open the counters (not Linux, perf_event_paranoid
+	 above 2, virtual machines without them) count none of the events. */
+	void setHardwareCounters(bool enable);
+	bool getHardwareCounters() const;
+	/** True if the calling thread can open the hardware counters */
+	static bool hasHardwareCounters();
+	/** Number of hardware events of the calls of module i */
+	uint64_t getHardwareCount(size_t i, HardwareEvent event) const;
+	/** Reset all counters */
+	void reset();
+	/** Merged counters of all threads as JSON object */
+	std::string toJSON() const;
+};
+
+/**
+ @class StepLimiterProfiler
+ @brief Module to find the modules that limit the steps
+
+ Add the modules under investigation, all that bid for the next step (the
+ propagation, interactions, observers, break conditions), to this module
+ instead of the ModuleList. For each call the module whose bid became the
+ next step of the candidate, with Candidate::setNextStep or the lowest
+ Candidate::limitNextStep, is counted as winner, separately for the particle
+ ids and the energy decades (floor(log10(E / eV))) of the candidates after
+ the call. Steps without any bid, and those of inactive candidates, are not
+ counted. The counters are kept per thread and merged when read, which
+ should hence be done after the run.
+ */
+class StepLimiterProfiler: public Module {
+	struct ThreadCounters;
+
+	std::vector<ref_ptr<Module> > modules;
+	mutable std::vector<ThreadCounters *> threadCounters;
+	mutable std::mutex mutex;
+	uint64_t instance; ///< unique id, identifies the counters of the threads
+
+	ThreadCounters *getThreadCounters() const;
+	void clearCounters();
+
+public:
+	StepLimiterProfiler();
+	~StepLimiterProfiler();
+	/** Add a module to monitor; resets the counters */
 	void add(Module* module);
 	void process(Candidate* candidate) const;
 	std::string getDescription() const;
+
+	size_t size() const;
+	/** Number of counted steps */
+	uint64_t getSteps() const;
+	/** Number of steps limited by module i */
+	uint64_t getWins(size_t i) const;
+	/** Number of steps limited by module i for particle id and energy decade */
+	uint64_t getWins(size_t i, int id, int decade) const;
+	/** Reset all counters */
+	void reset();
+	/** Merged counters of all threads as JSON object: for each module the
+	 wins for each particle id and energy decade */
+	std::string toJSON() const;
 };
 
 /**
@@ -68,6 +166,28 @@ public:
 	std::string getDescription() const;
 };
 
+/**
+  @class TiledGridPrefetch
+  @brief Request the tiles of a TiledGrid3f ahead of the candidate
+
+  Add before the propagation module, so that the tiles along the direction of
+  the candidate are read by the operating system in the background.
+*/
+class TiledGridPrefetch: public Module {
+	ref_ptr<TiledGrid3f> grid;
+	double distance;
+public:
+	/** Constructor
+	 @param grid		the tiled grid of the magnetic field
+	 @param distance	distance ahead of the candidate; 0 for the next step of the candidate
+	 */
+	TiledGridPrefetch(ref_ptr<TiledGrid3f> grid, double distance = 0);
+	void setDistance(double distance);
+	double getDistance() const;
+	void process(Candidate* candidate) const;
+	std::string getDescription() const;
+};
+
 /** @}*/
 } // namespace crpropa
 
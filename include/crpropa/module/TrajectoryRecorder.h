@@ -0,0 +1,132 @@
+#ifndef CRPROPA_TRAJECTORYRECORDER_H
+#define CRPROPA_TRAJECTORYRECORDER_H
+
+#include "crpropa/Module.h"
+
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Output
+ * @{
+ */
+
+/**
+ @class TrajectoryRecorder
+ @brief Records the trajectories of all candidates for TrajectoryReplay
+
+ Each call adds the current state (id, position, direction, energy,
+ trajectory length, redshift and weight) of the candidate as a point of its
+ trajectory, the first call also the previous state. When the candidate is
+ inactive, its trajectory is written to the binary file: the values of each
+ quantity delta encoded (bit-wise xor of consecutive values) and, with zlib,
+ compressed. Add the recorder at the end of the module list, since the
+ trajectories of candidates deactivated after it are only written by close().
+
+ The trajectories of one thread are kept in memory until their candidates
+ finish, writing is serialized.
+
+ As detection action of an Observer with ObserverTracking it is a track
+ writer: the tracked steps are stored as one delta encoded array per
+ candidate instead of an output row per step. To reduce them further,
+ - setSamplingInterval keeps at most one point per interval of trajectory
+   length (the last point of the trajectory is always kept),
+ - setTolerance removes points whose position is closer than the tolerance
+   to the line through the kept points around them (Douglas-Peucker),
+ - setChunkSize writes a trajectory in chunks of so many points, so that
+   long tracks do not stay in memory. A chunk starts with the last point of
+   the chunk before and is replayed separately, with the same serial number.
+ Points where the particle id changes are always kept.
+ */
+class TrajectoryRecorder: public Module {
+public:
+	/// number of double quantities of a point
+	static const int nValues = 10;
+	struct Point {
+		double values[nValues]; ///< x, y, z, px, py, pz, E, D, z, W
+		int32_t id;
+	};
+	struct Track {
+		uint64_t sourceSerialNumber;
+		std::vector<Point> points;
+		bool provisional; ///< last point is only kept if it is the last of the trajectory
+		double sampled; ///< trajectory length of the last sampled point
+	};
+
+private:
+	std::string filename;
+	mutable std::ofstream fout;
+	mutable std::vector<std::unordered_map<uint64_t, Track> > threadTracks;
+	mutable std::unordered_map<uint64_t, Track> sharedTracks;
+	mutable size_t count;
+	double samplingInterval;
+	double tolerance;
+	size_t chunkSize;
+
+	void write(uint64_t serialNumber, const Track &track) const;
+	void decimate(const std::vector<Point> &points, std::vector<Point> &kept) const;
+	void record(Candidate *candidate, std::unordered_map<uint64_t, Track> &tracks) const;
+
+public:
+	/** Constructor
+	 @param filename	name of the binary file
+	 */
+	TrajectoryRecorder(const std::string &filename);
+	~TrajectoryRecorder();
+	void process(Candidate *candidate) const;
+	/** Keep at most one point per interval of trajectory length,
+	 0 to keep all (default) */
+	void setSamplingInterval(double interval);
+	double getSamplingInterval() const;
+	/** Maximum distance of the removed points to the decimated trajectory,
+	 0 to keep all (default) */
+	void setTolerance(double tolerance);
+	double getTolerance() const;
+	/** Write the trajectories in chunks of this number of points,
+	 0 to write them when their candidates finish (default) */
+	void setChunkSize(size_t points);
+	size_t getChunkSize() const;
+	/** Write the unfinished trajectories and close the file */
+	void close();
+	/** Number of trajectories (or chunks of them) written so far */
+	size_t getCount() const;
+	std::string getDescription() const;
+};
+
+/**
+ @class TrajectoryReplay
+ @brief Runs modules over the trajectories of a TrajectoryRecorder file
+
+ Each trajectory is replayed as a candidate that moves from point to point:
+ previous and current state, trajectory length, current step, redshift and
+ weight are set as recorded, then the module is called. So observers (e.g.
+ with ObserverSurface or ObserverTimeEvolution) and outputs can be tuned
+ without propagating again. The replay of a trajectory ends when the
+ candidate becomes inactive, e.g. on detection. The trajectories are
+ replayed in parallel; a state the recorder did not see, like the exact
+ source state of secondaries, is the first point of the trajectory.
+ */
+class TrajectoryReplay: public Referenced {
+	std::string filename;
+public:
+	/** Constructor
+	 @param filename	file written by a TrajectoryRecorder
+	 */
+	TrajectoryReplay(const std::string &filename);
+	/** Replay all trajectories
+	 @param module	module to call after each step, e.g. a ModuleList with observers
+	 @returns		number of replayed trajectories
+	 */
+	size_t run(Module *module) const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_TRAJECTORYRECORDER_H
@@ -0,0 +1,69 @@
+#ifndef CRPROPA_WEIGHTWINDOW_H
+#define CRPROPA_WEIGHTWINDOW_H
+
+#include "crpropa/Module.h"
+#include "crpropa/Vector3.h"
+
+#include <map>
+#include <string>
+
+namespace crpropa {
+
+/**
+ * \addtogroup Tools
+ * @{
+ */
+
+/**
+ @class WeightWindow
+ @brief Russian roulette and splitting of candidates by weight and importance
+
+ A variance reduction for any simulation, e.g. electromagnetic cascades.
+ The importance I of a candidate is the product of the importances by energy
+ (E / E0)^index, by species (1 for species without a set importance) and by
+ distance to an observer, L / (L + d). The window keeps the product w * I of
+ weight and importance in [lower, upper]:
+ . below, the candidate survives with the probability w * I / s and the
+   weight s / I, where s = sqrt(lower * upper), otherwise it is deactivated
+ . above, it is split into n = ceil(w * I / upper) candidates, at most
+   maxSplits, of weight w / n; the copies are added as secondaries
+ Both keep the expected weight, so that the results stay unbiased, while the
+ computing time goes to the important candidates. Candidates without
+ importance are deactivated. Split copies carry the properties of the
+ candidate, but not its earlier secondaries.
+ */
+class WeightWindow: public Module {
+	double lower, upper;
+	size_t maxSplits;
+	double referenceEnergy, energyIndex;
+	std::map<int, double> speciesImportance;
+	bool useObserver;
+	Vector3d observer;
+	double observerScale;
+public:
+	/** Constructor
+	 @param lower		lower edge of the window in weight times importance
+	 @param upper		upper edge of the window in weight times importance
+	 @param maxSplits	maximum number of candidates a candidate is split into in one step
+	 */
+	WeightWindow(double lower = 0.5, double upper = 2, size_t maxSplits = 10);
+	void setWindow(double lower, double upper);
+	void setMaximumSplits(size_t maxSplits);
+	/** Importance (E / referenceEnergy)^index, by default index 0 */
+	void setEnergyImportance(double referenceEnergy, double index);
+	/** Importance of a species, 1 for species that are not set */
+	void setSpeciesImportance(int id, double importance);
+	/** Importance scale / (scale + d) by the distance d to an observer */
+	void setObserverImportance(const Vector3d &position, double scale);
+
+	/** Importance of the candidate, the product of all importances */
+	virtual double getImportance(const Candidate *candidate) const;
+	void process(Candidate *candidate) const;
+	std::string getDescription() const;
+};
+
+/** @}*/
+
+} // namespace crpropa
+
+#endif // CRPROPA_WEIGHTWINDOW_H
@@ -7,10 +7,14 @@ double z2Mpc(double z);
 double Mpc2z(double D);
 double Uniform(double min, double max);
 
-// set the seed for the random generator. If 0, current ime is used
+// set the seed for the random generator of all threads. If 0, current time is used
 void setSeed(long int seedval=0);
 
-void setUniformCallback(double (*Uniform)(double min, double max));
+// draw the random numbers of Uniform from this function instead, which has to
+// be thread-safe for the use from several threads; 0 restores the default.
+// Returns the previous callback, so that it can be restored.
+typedef double (*UniformCallback)(double min, double max);
+UniformCallback setUniformCallback(UniformCallback callback);
 
 
 // integer pow implementation as template that is evaluated at compile time
@@ -10,6 +10,11 @@
 namespace eleca {
 
 class Process;
+
+// The tables are read with ReadTables and InitBkgArray and not modified
+// afterwards, so that one instance can be shared by several threads: the
+// const methods only keep state in their arguments and draw their random
+// numbers from Uniform, see setUniformCallback.
 class Propagation {
 
 private:
@@ -51,6 +56,10 @@ public:
 			std::vector<Particle> &ParticleAtMatrix,
 			std::vector<Particle> &ParticleAtGround,
 			bool dropParticlesBelowEnergyThreshold = true) const;
+	// Propagate the particle and all its secondaries to the observer
+	void PropagateCascade(const Particle &particle,
+			std::vector<Particle> &ParticleAtGround,
+			bool dropParticlesBelowEnergyThreshold = true) const;
 	double ExtractPhotonEnergyMC(double z, Process &proc) const;
 	double ShootPhotonEnergyMC(double z) const;
 	double ShootPhotonEnergyMC(double Emin, double z) const;
@@ -7,6 +7,11 @@
 #include <ctime>
 
 #include <iostream>
+#include <atomic>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace eleca {
 
@@ -33,18 +38,62 @@ double Mpc2z(double D) {
 }
 
 
+// The default generator keeps a drand48 state per thread. The state of a
+// thread is derived from the seed and the OpenMP thread number, so that the
+// streams do not depend on the order in which the threads start. Each call of
+// setSeed starts a new generation, on which all threads restart their stream.
+static std::atomic<long int> gSeed(0);
+static std::atomic<unsigned long> gGeneration(1);
+static std::atomic<UniformCallback> gUniformCallback(0);
+
+static unsigned int threadNumber() {
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+struct _ThreadState {
+	unsigned short xsubi[3];
+	unsigned long generation;
+	unsigned int thread;
+	_ThreadState() : generation(0), thread(0) {}
+	void init(unsigned long g, unsigned int t) {
+		long int s = gSeed;
+		generation = g;
+		thread = t;
+		xsubi[0] = 0x330E; // as srand48
+		xsubi[1] = (unsigned short) (s ^ (thread * 0x9E37));
+		xsubi[2] = (unsigned short) ((s >> 16) + thread);
+	}
+};
+static thread_local _ThreadState gState;
+
 void setSeed(long int seedval)
 {
 	if (seedval == 0)
 	{ // use system time
 		time(&seedval);
 	}
-	::srand48(seedval);
+	gSeed = seedval;
+	gState.init(++gGeneration, threadNumber());
 }
 
+UniformCallback setUniformCallback(UniformCallback callback)
+{
+	return gUniformCallback.exchange(callback);
+}
 
 double Uniform(double min, double max) {
-		return min + (max - min) * ::drand48();
+	UniformCallback callback = gUniformCallback;
+	if (callback)
+		return callback(min, max);
+	unsigned long generation = gGeneration;
+	unsigned int thread = threadNumber();
+	if (gState.generation != generation or gState.thread != thread)
+		gState.init(generation, thread);
+	return min + (max - min) * ::erand48(gState.xsubi);
 }
 
 } // namespace eleca
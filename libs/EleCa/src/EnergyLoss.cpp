@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <cfloat>
+#include <mutex>
 
 namespace eleca {
 
@@ -64,12 +65,9 @@ static double gRKa[RK_ORDER + 1];
 static double gRKc[RK_ORDER + 1];
 static double gRKcs[RK_ORDER + 1];
 static double gRKb[RK_ORDER + 1][RK_ORDER];
-static bool gRKInitialized = false;
-
-void InitRK() {
-	if (gRKInitialized)
-		return;
+static std::once_flag gRKInitialized;
 
+static void _InitRK() {
 	// Current Runge-Kutta method for solving ODE
 	gRKa[0] = 0;
 	gRKa[1] = 0;
@@ -118,7 +116,10 @@ void InitRK() {
 	gRKcs[5] = 277. / 14336.;
 	gRKcs[6] = 1. / 4.;
 
-	gRKInitialized = true;
+}
+
+void InitRK() {
+	std::call_once(gRKInitialized, _InitRK);
 }
 
 //===================================
@@ -127,10 +128,7 @@ double EnergyLoss1D(double Energy, double z0, double zfin, double B) {
 
 	double zStep = 2.5e-5;
 
-#pragma omp critical
-	{
-		InitRK();
-	}
+	InitRK();
 	double k1, k2, k3, k4, k5, k6;
 
 	bool FLAG_PROPAG = 1;
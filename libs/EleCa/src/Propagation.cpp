@@ -446,6 +446,22 @@ void Propagation::WriteOutput(std::ostream &out, Particle &p1,
 //	}
 //}
 
+void Propagation::PropagateCascade(const Particle &particle,
+		std::vector<Particle> &ParticleAtGround,
+		bool dropParticlesBelowEnergyThreshold) const {
+	std::vector<Particle> ParticleAtMatrix;
+	ParticleAtMatrix.push_back(particle);
+
+	while (ParticleAtMatrix.size() > 0) {
+		Particle p1 = ParticleAtMatrix.back();
+		ParticleAtMatrix.pop_back();
+
+		if (p1.IsGood())
+			Propagate(p1, ParticleAtMatrix, ParticleAtGround,
+					dropParticlesBelowEnergyThreshold);
+	}
+}
+
 void Propagation::Propagate(Particle &curr_particle,
 		std::vector<Particle> &ParticleAtMatrix,
 		std::vector<Particle> &ParticleAtGround,
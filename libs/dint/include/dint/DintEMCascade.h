@@ -15,6 +15,28 @@
 #include "dint/final.h"
 #include "dint/utilities.h"
 
+#include <memory>
+
+// Interaction tables of the electromagnetic processes, read-only after loading.
+// Shared by the copies of a DintEMCascade.
+struct DintEMTables {
+	RawTotalRate ICSTotalRate;
+	RawTotalRate PPTotalRate;
+	RawTotalRate TPPTotalRate;
+	RawTotalRate DPPRate;
+
+	RawDiffRate ICSPhotonRate;
+	RawDiffRate ICSScatRate;
+	RawDiffRate PPDiffRate;
+	RawDiffRate TPPDiffRate;
+
+	DintEMTables(const string &aDirTables);
+	~DintEMTables();
+
+private:
+	DintEMTables(const DintEMTables &);
+	DintEMTables &operator=(const DintEMTables &);
+};
 
 // DintEMCascade.
 // Class based on the original DINT prop_second function, intended as starting
@@ -24,21 +46,13 @@ class DintEMCascade {
 	private:
 		//-------- Declaration of main variables --------
 		//---- Interaction table coefficients ----
-		RawTotalRate ICSTotalRate;
-		RawTotalRate PPTotalRate;
-		RawTotalRate TPPTotalRate;
-		RawTotalRate DPPRate;
+		std::shared_ptr<const DintEMTables> tables;
 
 		RawTotalRate PPPProtonLossRate;
 		RawTotalRate PPPNeutronLossRate;
 		RawTotalRate NPPTotalRate;
 		// total (interaction) rates before being folded into the background
 
-		RawDiffRate ICSPhotonRate;
-		RawDiffRate ICSScatRate;
-		RawDiffRate PPDiffRate;
-		RawDiffRate TPPDiffRate;
-
 		RawDiffRate PPPProtonScatRate;
 		RawDiffRate PPPProtonNeutronRate;
 		RawDiffRate PPPNeutronProtonRate;
@@ -171,6 +185,9 @@ class DintEMCascade {
 		dCVector pB_field;
 		string aDirTables;
 
+		void allocate(double B);
+		DintEMCascade &operator=(const DintEMCascade &);
+
 public:
 	DintEMCascade(
 		int _aIRFlag,       //!< EBL background 0: high, 1: low, 2: Primack, 4: Stecker'06
@@ -182,6 +199,10 @@ public:
 		double _aOmegaLambda = OMEGA_LAMBDA  //!< omegaL parameter
 		);
 
+	// Copy with its own work buffers that shares the interaction tables, so
+	// that each thread can propagate with a copy.
+	DintEMCascade(const DintEMCascade &other);
+
 	~DintEMCascade();
 
 	void propagate(
@@ -13,7 +13,66 @@ DintEMCascade::DintEMCascade(int _aIRFlag, int _aRadioFlag, string _aDirTables,
 	DPPSwitch(1), PPPSwitch(0), NPPSwitch(0), neutronDecaySwitch(0),
 	nucleonToSecondarySwitch(0), neutrinoNeutrinoSwitch(0), aIRFlag(_aIRFlag),
 	aRadioFlag(_aRadioFlag), aH0(_aH0), aOmegaM(_aOmegaM),
-	aOmegaLambda(_aOmegaLambda), aZmax_IR(5.), aDirTables(_aDirTables)
+	aOmegaLambda(_aOmegaLambda), aZmax_IR(5.), aDirTables(_aDirTables),
+	tables(new DintEMTables(_aDirTables))
+{
+	allocate(B);
+}
+
+DintEMCascade::DintEMCascade(const DintEMCascade &other) :
+	synchrotronSwitch(other.synchrotronSwitch),
+	sourceTypeSwitch(other.sourceTypeSwitch),
+	tauNeutrinoMassSwitch(other.tauNeutrinoMassSwitch),
+	ICSSwitch(other.ICSSwitch), PPSwitch(other.PPSwitch),
+	TPPSwitch(other.TPPSwitch), DPPSwitch(other.DPPSwitch),
+	PPPSwitch(other.PPPSwitch), NPPSwitch(other.NPPSwitch),
+	neutronDecaySwitch(other.neutronDecaySwitch),
+	nucleonToSecondarySwitch(other.nucleonToSecondarySwitch),
+	neutrinoNeutrinoSwitch(other.neutrinoNeutrinoSwitch),
+	aIRFlag(other.aIRFlag), aRadioFlag(other.aRadioFlag), aH0(other.aH0),
+	aOmegaM(other.aOmegaM), aOmegaLambda(other.aOmegaLambda),
+	aZmax_IR(other.aZmax_IR), aDirTables(other.aDirTables),
+	tables(other.tables)
+{
+	allocate(other.pB_field.vector[0]);
+}
+
+DintEMTables::DintEMTables(const string &aDirTables)
+{
+	NewRawTotalRate(&ICSTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
+	NewRawDiffRate(&ICSPhotonRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
+		 NUM_IP_ELEMENTS);
+	NewRawDiffRate(&ICSScatRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
+		 NUM_IS_ELEMENTS);
+	NewRawTotalRate(&PPTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
+	NewRawDiffRate(&PPDiffRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
+		 NUM_PP_ELEMENTS);
+	NewRawTotalRate(&TPPTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
+	NewRawDiffRate(&TPPDiffRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
+		 NUM_TPP_ELEMENTS);
+	NewRawTotalRate(&DPPRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
+
+	//---- read in coefficient tables; clipping is done here if necessary ----
+	LoadICSTables(&ICSTotalRate, &ICSPhotonRate, &ICSScatRate,
+		NUM_MAIN_BINS, aDirTables);
+	LoadPPTables(&PPTotalRate, &PPDiffRate, NUM_MAIN_BINS, aDirTables);
+	LoadTPPTables(&TPPTotalRate, &TPPDiffRate, NUM_MAIN_BINS, aDirTables);
+	LoadDPPTables(&DPPRate, NUM_MAIN_BINS, aDirTables);
+}
+
+DintEMTables::~DintEMTables()
+{
+	DeleteRawDiffRate(&ICSPhotonRate);
+	DeleteRawDiffRate(&ICSScatRate);
+	DeleteRawTotalRate(&ICSTotalRate);
+	DeleteRawDiffRate(&PPDiffRate);
+	DeleteRawTotalRate(&PPTotalRate);
+	DeleteRawDiffRate(&TPPDiffRate);
+	DeleteRawTotalRate(&TPPTotalRate);
+	DeleteRawTotalRate(&DPPRate);
+}
+
+void DintEMCascade::allocate(double B)
 {
 	BuildRedshiftTable(aH0, aOmegaM, aOmegaLambda, &RedshiftArray, &DistanceArray) ;
 
@@ -45,40 +104,6 @@ DintEMCascade::DintEMCascade(int _aIRFlag, int _aRadioFlag, string _aDirTables,
 	New_dCVector(&otherLoss, NUM_MAIN_BINS);
 	New_dCVector(&continuousLoss, NUM_MAIN_BINS);
 
-	if (ICSSwitch == 1) {
-		NewRawTotalRate(&ICSTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
-		NewRawDiffRate(&ICSPhotonRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
-			 NUM_IP_ELEMENTS);
-		NewRawDiffRate(&ICSScatRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
-			 NUM_IS_ELEMENTS);
-	}
-
-	if (PPSwitch == 1) {
-		NewRawTotalRate(&PPTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
-		NewRawDiffRate(&PPDiffRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
-			 NUM_PP_ELEMENTS);
-	}
-
-	if (TPPSwitch == 1) {
-		NewRawTotalRate(&TPPTotalRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
-		NewRawDiffRate(&TPPDiffRate, EM_NUM_MAIN_BINS, NUM_BG_BINS,
-			 NUM_TPP_ELEMENTS);
-	}
-
-	if (DPPSwitch == 1)
-		NewRawTotalRate(&DPPRate, EM_NUM_MAIN_BINS, NUM_BG_BINS);
-
-	//---- read in coefficient tables; clipping is done here if necessary ----
-	if (ICSSwitch == 1)
-		LoadICSTables(&ICSTotalRate, &ICSPhotonRate, &ICSScatRate,
-			NUM_MAIN_BINS, aDirTables);
-	if (PPSwitch == 1)
-		LoadPPTables(&PPTotalRate, &PPDiffRate, NUM_MAIN_BINS, aDirTables);
-	if (TPPSwitch == 1)
-		LoadTPPTables(&TPPTotalRate, &TPPDiffRate, NUM_MAIN_BINS, aDirTables);
-	if (DPPSwitch == 1)
-		LoadDPPTables(&DPPRate, NUM_MAIN_BINS, aDirTables);
-
 	NewTotalRate(&leptonTotalRate, NUM_MAIN_BINS);
 	NewTotalRate(&photonTotalRate, NUM_MAIN_BINS);
 
@@ -155,22 +180,6 @@ DintEMCascade::~DintEMCascade()
 	DeleteTotalRate(&muonNeutTotalRate);
 	DeleteTotalRate(&tauNeutTotalRate);
 
-	if (ICSSwitch == 1) {
-		DeleteRawDiffRate(&ICSPhotonRate);
-		DeleteRawDiffRate(&ICSScatRate);
-		DeleteRawTotalRate(&ICSTotalRate);
-	}
-	if (PPSwitch == 1) {
-		DeleteRawDiffRate(&PPDiffRate);
-		DeleteRawTotalRate(&PPTotalRate);
-	}
-	if (TPPSwitch == 1) {
-		DeleteRawDiffRate(&TPPDiffRate);
-		DeleteRawTotalRate(&TPPTotalRate);
-	}
-	if (DPPSwitch == 1)
-		DeleteRawTotalRate(&DPPRate);
-
 	DeleteSpectrum(&Q_0);
 	DeleteSpectrum(&spectrumNew);
 	DeleteSpectrum(&derivative);
@@ -258,18 +267,18 @@ void DintEMCascade::propagate(const double start_distance,
 
 		//---- fold interaction rates w/ photon background ----
 		if (ICSSwitch == 1)
-			FoldICS(&bgPhotonDensity, &ICSTotalRate, &ICSPhotonRate,
-				&ICSScatRate, &leptonTotalRate, &leptonPhotonRate,
+			FoldICS(&bgPhotonDensity, &tables->ICSTotalRate, &tables->ICSPhotonRate,
+				&tables->ICSScatRate, &leptonTotalRate, &leptonPhotonRate,
 				&leptonScatRate);
 		if (TPPSwitch == 1)
-			FoldTPP(&bgPhotonDensity, &pEnergy, &TPPTotalRate, &TPPDiffRate,
+			FoldTPP(&bgPhotonDensity, &pEnergy, &tables->TPPTotalRate, &tables->TPPDiffRate,
 				&leptonTotalRate, &leptonScatRate, &leptonExchRate,
 				&otherLoss);
 		if (PPSwitch == 1)
-			FoldPP(&bgPhotonDensity, &PPTotalRate, &PPDiffRate,
+			FoldPP(&bgPhotonDensity, &tables->PPTotalRate, &tables->PPDiffRate,
 			 &photonTotalRate, &photonLeptonRate);
 		if (DPPSwitch == 1)
-			FoldDPP(&bgPhotonDensity, &DPPRate, &photonTotalRate,
+			FoldDPP(&bgPhotonDensity, &tables->DPPRate, &photonTotalRate,
 				&photonLeptonRate);
 
 		//---- main iteration (convergence) block ----
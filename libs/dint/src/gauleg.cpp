@@ -10,6 +10,7 @@
 
 #include <math.h>
 #include <map>
+#include <mutex>
 
 
 void legendre_compute_glr ( int n, double x[], double w[] );
@@ -511,22 +512,31 @@ void Gauleg(const double x1, const double x2, double x[], double w[],
 	static std::map<int, double*> __legendreAbcissa;
 	static std::map<int, double*> __legendreWeights;
 
-	if (__legendreAbcissa.find(n) == __legendreAbcissa.end())
+	static std::mutex __legendreMutex;
+
+	// the cache is filled on first use, possibly from several threads
+	double *abcissa, *weights;
 	{
-		__legendreAbcissa[n] =  new double[n];
-		__legendreWeights[n] =  new double[n];
-		legendre_compute_glr ( n, __legendreAbcissa[n], __legendreWeights[n]);
+		std::lock_guard<std::mutex> lock(__legendreMutex);
+		if (__legendreAbcissa.find(n) == __legendreAbcissa.end())
+		{
+			__legendreAbcissa[n] =  new double[n];
+			__legendreWeights[n] =  new double[n];
+			legendre_compute_glr ( n, __legendreAbcissa[n], __legendreWeights[n]);
+		}
+		abcissa = __legendreAbcissa[n];
+		weights = __legendreWeights[n];
 	}
 
 
 
   for ( int i = 0; i < n; i++ )
   {
-    x[i] = ( ( x1 + x2 ) + ( x2 - x1 ) * __legendreAbcissa[n][i] ) / 2.0;
+    x[i] = ( ( x1 + x2 ) + ( x2 - x1 ) * abcissa[i] ) / 2.0;
   }
   for ( int i = 0; i < n; i++ )
   {
-    w[i] = ( x2 - x1 ) * __legendreWeights[n][i] / 2.0;
+    w[i] = ( x2 - x1 ) * weights[i] / 2.0;
   }
   return;
 
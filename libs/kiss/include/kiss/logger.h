@@ -1,7 +1,9 @@
 #ifndef KISS_LOG_H
 #define KISS_LOG_H
 
+#include <atomic>
 #include <iostream>
+#include <sstream>
 
 namespace kiss {
 
@@ -9,11 +11,40 @@ enum eLogLevel {
 	LOG_LEVEL_ERROR, LOG_LEVEL_WARNING, LOG_LEVEL_INFO, LOG_LEVEL_DEBUG
 };
 
+/**
+ Counter of the messages of one KISS_LOG_* statement. The macros create one
+ static site per statement, which registers itself for Logger::printSummary.
+ */
+class LogSite {
+public:
+	const char *file;
+	int line;
+	std::atomic<size_t> count;
+	LogSite(const char *file, int line);
+};
+
+/**
+ Logger of the KISS_LOG_* macros.
+
+ With setSiteLimit, at most the given number of messages of each statement is
+ written, further ones are only counted, so that e.g. an exception of a
+ field in one region of the simulation costs a counter increment instead of
+ a write per particle. printSummary lists the counts; it is called at the end
+ of the program if messages were suppressed.
+
+ With setAsync, the messages are formatted by the calling thread and written
+ to the log stream by a background thread, so that the threads of the
+ simulation do not wait for each other and for the stream.
+ */
 class Logger {
 	static std::ostream *stream;
 	static eLogLevel level;
+	std::ostringstream *buffer; // the message in the asynchronous mode
+	bool muted;
+	void writePrefix(std::ostream &s, eLogLevel level);
 public:
 	Logger(eLogLevel level);
+	Logger(eLogLevel level, LogSite &site);
 	~Logger();
 	static std::ostream &getLogStream();
 	static void setLogStream(std::ostream *s);
@@ -24,11 +55,33 @@ public:
 
 	static void loadEnvLogLevel();
 
+	/** Write the messages from a background thread */
+	static void setAsync(bool async);
+	static bool isAsync();
+	/** Wait until the background thread has written all messages */
+	static void flush();
+
+	/** Maximum number of written messages per statement, 0 for no limit; also
+	 from the environment variable KISS_LOG_SITE_LIMIT */
+	static void setSiteLimit(size_t limit);
+	static size_t getSiteLimit();
+	/** Number of messages that were counted but not written */
+	static size_t getSuppressed();
+	/** Write the number of messages of each statement that logged */
+	static void printSummary();
+	static void printSummary(std::ostream &s);
+
 	operator std::ostream &() {
 		return getLogStream();
 	}
 
-	template<typename T> inline Logger& operator<<(T& data) {
+	template<typename T> inline Logger& operator<<(const T& data) {
+		if (muted)
+			return *this;
+		if (buffer) {
+			*buffer << data;
+			return *this;
+		}
 		#pragma omp critical (KISS_LOGGER)
 		{
 		getLogStream() << data;
@@ -37,6 +90,12 @@ public:
 	}
 
 	inline Logger& operator<<(std::ostream& (*func)(std::ostream&)) {
+		if (muted)
+			return *this;
+		if (buffer) {
+			*buffer << func;
+			return *this;
+		}
 		#pragma omp critical (KISS_LOGGER)
 		{
 		getLogStream() << func;
@@ -47,9 +106,12 @@ public:
 
 } // namespace kiss
 
-#define KISS_LOG_ERROR if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_ERROR) {} else kiss::Logger(kiss::LOG_LEVEL_ERROR)
-#define KISS_LOG_WARNING if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_WARNING) {} else kiss::Logger(kiss::LOG_LEVEL_WARNING)
-#define KISS_LOG_INFO if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_INFO) {} else kiss::Logger(kiss::LOG_LEVEL_INFO)
-#define KISS_LOG_DEBUG if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_DEBUG) {} else kiss::Logger(kiss::LOG_LEVEL_DEBUG)
+// one LogSite per statement
+#define KISS_LOG_SITE ([]() -> kiss::LogSite & { static kiss::LogSite site(__FILE__, __LINE__); return site; }())
+
+#define KISS_LOG_ERROR if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_ERROR) {} else kiss::Logger(kiss::LOG_LEVEL_ERROR, KISS_LOG_SITE)
+#define KISS_LOG_WARNING if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_WARNING) {} else kiss::Logger(kiss::LOG_LEVEL_WARNING, KISS_LOG_SITE)
+#define KISS_LOG_INFO if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_INFO) {} else kiss::Logger(kiss::LOG_LEVEL_INFO, KISS_LOG_SITE)
+#define KISS_LOG_DEBUG if (kiss::Logger::getLogLevel() < kiss::LOG_LEVEL_DEBUG) {} else kiss::Logger(kiss::LOG_LEVEL_DEBUG, KISS_LOG_SITE)
 
 #endif /* KISSLOG_H */
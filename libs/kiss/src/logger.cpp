@@ -1,7 +1,14 @@
 #include "kiss/logger.h"
 
 #include <stdlib.h>
+#include <time.h>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace kiss {
 
@@ -9,28 +16,163 @@ std::ostream *Logger::stream = &std::cerr;
 eLogLevel Logger::level = LOG_LEVEL_WARNING;
 const char* sLoggerLevel[] = { " ERROR ", "WARNING", " INFO  ", " DEBUG " };
 
+// the statements that logged, for the summary
+static std::mutex sitesMutex;
+static std::vector<LogSite *> &getSites() {
+	// not destructed, as the summary is written at exit
+	static std::vector<LogSite *> *sites = new std::vector<LogSite *>();
+	return *sites;
+}
+static size_t siteLimit = 0;
+static std::atomic<size_t> suppressed(0);
+
+// writes the messages of the asynchronous mode from a background thread
+class AsyncWriter {
+	std::mutex mutex;
+	std::condition_variable wake, written;
+	std::deque<std::string> queue;
+	std::thread thread;
+	size_t writing; // messages taken from the queue but not yet written
+	bool stop;
+
+	void loop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [this] { return stop or not queue.empty(); });
+			if (queue.empty())
+				break;
+			std::deque<std::string> messages;
+			messages.swap(queue);
+			writing = messages.size();
+			lock.unlock();
+			std::ostream &s = Logger::getLogStream();
+			for (size_t i = 0; i < messages.size(); i++)
+				s << messages[i];
+			s.flush();
+			lock.lock();
+			writing = 0;
+			written.notify_all();
+		}
+	}
+
+public:
+	std::atomic<bool> running;
+
+	AsyncWriter() : writing(0), stop(false), running(false) {
+	}
+
+	~AsyncWriter() {
+		setRunning(false);
+	}
+
+	void setRunning(bool run) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (run == running)
+			return;
+		if (run) {
+			stop = false;
+			thread = std::thread(&AsyncWriter::loop, this);
+			running = true;
+		} else {
+			// the thread writes the remaining messages before it stops
+			running = false;
+			stop = true;
+			wake.notify_one();
+			lock.unlock();
+			thread.join();
+		}
+	}
+
+	void push(const std::string &message) {
+		std::unique_lock<std::mutex> lock(mutex);
+		queue.push_back(message);
+		wake.notify_one();
+	}
+
+	void flush() {
+		std::unique_lock<std::mutex> lock(mutex);
+		written.wait(lock, [this] { return queue.empty() and writing == 0; });
+	}
+};
+static AsyncWriter writer;
+
 class EnvLogger {
 public:
 	EnvLogger() {
 		Logger::loadEnvLogLevel();
+		if (::getenv("KISS_LOG_SITE_LIMIT"))
+			Logger::setSiteLimit(atol(::getenv("KISS_LOG_SITE_LIMIT")));
+	}
+	~EnvLogger() {
+		Logger::setAsync(false);
+		if (Logger::getSuppressed() > 0)
+			Logger::printSummary();
 	}
 };
 static EnvLogger _env_log_;
 
-Logger::Logger(eLogLevel level) {
+LogSite::LogSite(const char *file, int line) : file(file), line(line), count(0) {
+	std::lock_guard<std::mutex> lock(sitesMutex);
+	getSites().push_back(this);
+}
+
+void Logger::writePrefix(std::ostream &s, eLogLevel level) {
 	time_t rawtime;
-	struct tm * timeinfo;
+	struct tm timeinfo;
 	char buffer[80];
 
 	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+#ifdef WIN32
+	localtime_s(&timeinfo, &rawtime);
+#else
+	localtime_r(&rawtime, &timeinfo);
+#endif
+
+	strftime(buffer, 80, "%Y-%m-%d %H:%M:%S ", &timeinfo);
+	s << buffer;
+	s << "[" << sLoggerLevel[level] << "] ";
+}
 
-	strftime(buffer, 80, "%Y-%m-%d %H:%M:%S ", timeinfo);
-	*stream << buffer;
-	*stream << "[" << sLoggerLevel[level] << "] ";
+Logger::Logger(eLogLevel level) : buffer(NULL), muted(false) {
+	if (writer.running) {
+		buffer = new std::ostringstream();
+		writePrefix(*buffer, level);
+	} else {
+		writePrefix(*stream, level);
+	}
+}
+
+Logger::Logger(eLogLevel level, LogSite &site) : buffer(NULL), muted(false) {
+	size_t n = ++site.count;
+	size_t limit = siteLimit;
+	if ((limit > 0) and (n > limit)) {
+		muted = true;
+		suppressed++;
+		if (n == limit + 1)
+			Logger(level) << "further messages from " << site.file << ":"
+					<< site.line << " are only counted";
+		return;
+	}
+	if (writer.running) {
+		buffer = new std::ostringstream();
+		writePrefix(*buffer, level);
+	} else {
+		writePrefix(*stream, level);
+	}
 }
 
 Logger::~Logger() {
+	if (muted)
+		return;
+	if (buffer) {
+		*buffer << '\n';
+		if (writer.running)
+			writer.push(buffer->str());
+		else
+			*stream << buffer->str() << std::flush;
+		delete buffer;
+		return;
+	}
 	*stream << std::endl;
 }
 
@@ -39,10 +181,12 @@ std::ostream &Logger::getLogStream() {
 }
 
 void Logger::setLogStream(std::ostream *s) {
+	flush();
 	stream = s;
 }
 
 void Logger::setLogStream(std::ostream &s) {
+	flush();
 	stream = &s;
 }
 
@@ -53,12 +197,61 @@ eLogLevel Logger::getLogLevel() {
 	return (level);
 }
 
+void Logger::setAsync(bool async) {
+	writer.setRunning(async);
+}
+
+bool Logger::isAsync() {
+	return writer.running;
+}
+
+void Logger::flush() {
+	if (writer.running)
+		writer.flush();
+}
+
+void Logger::setSiteLimit(size_t limit) {
+	siteLimit = limit;
+}
+
+size_t Logger::getSiteLimit() {
+	return siteLimit;
+}
+
+size_t Logger::getSuppressed() {
+	return suppressed;
+}
+
+void Logger::printSummary() {
+	flush();
+	printSummary(*stream);
+}
+
+void Logger::printSummary(std::ostream &s) {
+	std::lock_guard<std::mutex> lock(sitesMutex);
+	const std::vector<LogSite *> &sites = getSites();
+	s << "kiss::Logger: messages per statement";
+	if (siteLimit > 0)
+		s << ", at most " << siteLimit << " written";
+	s << "\n";
+	for (size_t i = 0; i < sites.size(); i++) {
+		size_t n = sites[i]->count;
+		if (n == 0)
+			continue;
+		s << "  " << sites[i]->file << ":" << sites[i]->line << ": " << n;
+		if ((siteLimit > 0) and (n > siteLimit))
+			s << " (" << n - siteLimit << " not written)";
+		s << "\n";
+	}
+	s.flush();
+}
+
 
 
 
 void Logger::loadEnvLogLevel() {
 	if (::getenv("KISS_LOG_LEVEL")) {
-		
+
 		int level = atoi(::getenv("KISS_LOG_LEVEL"));
 		switch (level) {
 		case LOG_LEVEL_ERROR:
@@ -82,4 +275,3 @@ void Logger::loadEnvLogLevel() {
 }
 
 } // namespace kiss
-
@@ -0,0 +1,66 @@
+#include "kiss/logger.h"
+
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+using namespace kiss;
+
+static void logMany(size_t n) {
+	for (size_t i = 0; i < n; i++)
+		KISS_LOG_WARNING << "message " << i;
+}
+
+static size_t countLines(const std::string &s) {
+	size_t n = 0;
+	for (size_t i = 0; i < s.size(); i++)
+		if (s[i] == '\n')
+			n++;
+	return n;
+}
+
+TEST(testLogger, siteLimit) {
+	std::ostringstream s;
+	Logger::setLogStream(s);
+	Logger::setSiteLimit(3);
+	size_t suppressed = Logger::getSuppressed();
+
+	logMany(10);
+	// 3 messages and the note that the others are only counted
+	EXPECT_EQ(4, countLines(s.str()));
+	EXPECT_NE(std::string::npos, s.str().find("message 2"));
+	EXPECT_EQ(std::string::npos, s.str().find("message 3"));
+	EXPECT_EQ(suppressed + 7, Logger::getSuppressed());
+
+	std::ostringstream summary;
+	Logger::printSummary(summary);
+	EXPECT_NE(std::string::npos, summary.str().find(": 10 (7 not written)"));
+
+	Logger::setSiteLimit(0);
+	Logger::setLogStream(std::cerr);
+}
+
+TEST(testLogger, async) {
+	std::ostringstream s;
+	Logger::setLogStream(s);
+	Logger::setAsync(true);
+	EXPECT_TRUE(Logger::isAsync());
+
+	#pragma omp parallel for
+	for (int i = 0; i < 100; i++)
+		KISS_LOG_WARNING << "message " << i;
+	Logger::flush();
+	EXPECT_EQ(100, countLines(s.str()));
+	EXPECT_NE(std::string::npos, s.str().find("message 99\n"));
+
+	Logger::setAsync(false);
+	EXPECT_FALSE(Logger::isAsync());
+	KISS_LOG_WARNING << "synchronous";
+	EXPECT_EQ(101, countLines(s.str()));
+	Logger::setLogStream(std::cerr);
+}
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -10,6 +10,11 @@ void sophiaevent_(int& nature,                   // IN:  channel: 0 -> p, 1 -> n
 									int outPartID[2000],           // OUT: list of output particle IDs (see list below)
 									int& nParticles                // OUT: number of output particles
 		);
+
+double crossection_(double& x,                   // IN:  photon energy in the nucleon rest frame in GeV
+		int& NDIR,                                     // IN:  3 -> total cross section
+		int& NL0                                       // IN:  13 -> p, 14 -> n
+		);
 }
 
 /*
@@ -100,6 +100,54 @@ class StopIterator {};
 #endif
 
 /* Initialize numpy array interface, if available */
+#ifdef WITHNUMPY
+%{
+/* Array views on the memory of Referenced objects, without copies: the view
+   holds a reference of the owner, so that the memory lives as long as the view. */
+static void crpropa_releaseOwner(PyObject *capsule) {
+  const crpropa::Referenced *owner = (const crpropa::Referenced *) PyCapsule_GetPointer(capsule, "crpropa.owner");
+  if (owner)
+    owner->removeReference();
+}
+
+static PyObject *crpropa_arrayView(const crpropa::Referenced *owner, void *data,
+    int nd, npy_intp *dims, int type, bool writeable) {
+  int flags = writeable ? NPY_ARRAY_CARRAY : NPY_ARRAY_CARRAY_RO;
+  PyObject *array = PyArray_New(&PyArray_Type, nd, dims, type, NULL, data, 0, flags, NULL);
+  if (not array)
+    return NULL;
+  owner->addReference();
+  PyObject *capsule = PyCapsule_New((void *) owner, "crpropa.owner", crpropa_releaseOwner);
+  if (not capsule or PyArray_SetBaseObject((PyArrayObject *) array, capsule) < 0) {
+    Py_XDECREF(capsule);
+    Py_DECREF(array);
+    return NULL;
+  }
+  return array;
+}
+
+/* Contiguous double array of the input with nd dimensions, the last of the
+   given size if last > 0; NULL with a Python error otherwise */
+static PyArrayObject *crpropa_inputArray(PyObject *input, int nd, npy_intp last) {
+  PyArrayObject *array = (PyArrayObject *) PyArray_FROMANY(input, NPY_FLOAT64,
+      nd, nd, NPY_ARRAY_IN_ARRAY);
+  if (array and last > 0 and PyArray_DIM(array, nd - 1) != last) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError, "array of shape (N, 3) required");
+    return NULL;
+  }
+  return array;
+}
+
+/* NumPy type and number of components of the grid values */
+template<typename T> struct crpropa_NumpyType;
+template<> struct crpropa_NumpyType<float> { enum { type = NPY_FLOAT32, components = 1 }; };
+template<> struct crpropa_NumpyType<double> { enum { type = NPY_FLOAT64, components = 1 }; };
+template<> struct crpropa_NumpyType<crpropa::Vector3<float> > { enum { type = NPY_FLOAT32, components = 3 }; };
+template<> struct crpropa_NumpyType<crpropa::Vector3<double> > { enum { type = NPY_FLOAT64, components = 3 }; };
+%}
+#endif
+
 #ifdef WITHNUMPY
 %init %{
 import_array();
@@ -37,8 +37,13 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %ignore operator<<;
 %ignore operator>>;
 %ignore *::operator=;
+%ignore crpropa::Candidate::operator new;
+%ignore crpropa::RetainedParticleState::operator=;
+%ignore crpropa::RetainedParticleState::operator const ParticleState &;
+%ignore crpropa::Candidate::operator delete;
 %ignore operator crpropa::Source*;
 %ignore operator crpropa::SourceList*;
+%ignore operator crpropa::SourceCatalog*;
 %ignore operator crpropa::SourceInterface*;
 %ignore operator crpropa::SourceFeature*;
 %ignore operator crpropa::Candidate*;
@@ -57,6 +62,8 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %ignore operator crpropa::Grid< crpropa::Vector3< double > >*;
 %ignore operator crpropa::Grid< float >*;
 %ignore operator crpropa::Grid< double >*;
+%ignore crpropa::GridValues;
+%ignore crpropa::Grid::tricubicKernel;
 %ignore crpropa::TextOutput::load;
 
 %feature("ref")   crpropa::Referenced "$this->addReference();"
@@ -172,19 +179,41 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %include "crpropa/Units.h"
 %include "crpropa/Common.h"
 %include "crpropa/Cosmology.h"
+%include "crpropa/PageMemory.h"
+%template(PageMemoryRefPtr) crpropa::ref_ptr<crpropa::PageMemory>;
+%include "crpropa/DataTable.h"
+%ignore crpropa::TableRegistry::acquire;
+%include "crpropa/TableRegistry.h"
+%ignore crpropa::TableAxis::operator[];
+%ignore crpropa::LogGridTable::evaluate;
+%ignore crpropa::UniformTable2D::evaluate;
+%include "crpropa/LookupTable.h"
 %include "crpropa/PhotonPropagation.h"
+%template(CascadeParticleVector) std::vector<crpropa::CascadeParticle>;
 %template(RandomSeed) std::vector<uint32_t>;
 %template(RandomSeedThreads) std::vector< std::vector<uint32_t> >;
+%ignore crpropa::AliasSampler::operator=;
 %include "crpropa/Random.h"
 %include "crpropa/ParticleState.h"
 %include "crpropa/ParticleID.h"
 %include "crpropa/ParticleMass.h"
 %include "crpropa/Version.h"
+%ignore crpropa::SimdKernels;
+%ignore crpropa::getSimdKernels;
+%include "crpropa/SimdDispatch.h"
 
 %import "crpropa/Variant.h"
 
 /* override Candidate::getProperty() */
 %ignore crpropa::Candidate::getProperty(const std::string &) const;
+/* the property keys are for fast access from C++, Python uses the names */
+%ignore crpropa::Candidate::setProperty(PropertyKey, const Variant &);
+%ignore crpropa::Candidate::getProperty(PropertyKey) const;
+%ignore crpropa::Candidate::removeProperty(PropertyKey);
+%ignore crpropa::Candidate::hasProperty(PropertyKey) const;
+%ignore crpropa::Candidate::getProperties() const;
+%ignore crpropa::Candidate::StepBids;
+%ignore crpropa::Candidate::setStepBids;
 
 %nothread; /* disable threading for extend*/
 %extend crpropa::Candidate {
@@ -381,6 +410,10 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %template(CandidateRefPtr) crpropa::ref_ptr<crpropa::Candidate>;
 %include "crpropa/Candidate.h"
 
+%implicitconv crpropa::ref_ptr<crpropa::AdaptiveThinning>;
+%template(AdaptiveThinningRefPtr) crpropa::ref_ptr<crpropa::AdaptiveThinning>;
+%include "crpropa/AdaptiveThinning.h"
+
 %feature("director") crpropa::Surface;
 %feature("director") crpropa::ClosedSurface;
 %include "crpropa/Geometry.h"
@@ -388,18 +421,68 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %template(ModuleRefPtr) crpropa::ref_ptr<crpropa::Module>;
 %template(stdModuleList) std::list< crpropa::ref_ptr<crpropa::Module> >;
 %feature("director") crpropa::Module;
+%feature("nodirector") crpropa::Module::processBatch(const std::vector< crpropa::ref_ptr< crpropa::Candidate > > &) const;
 %feature("director") crpropa::AbstractCondition;
 %include "crpropa/Module.h"
 
 %implicitconv crpropa::ref_ptr<crpropa::MagneticField>;
 %template(MagneticFieldRefPtr) crpropa::ref_ptr<crpropa::MagneticField>;
 %feature("director") crpropa::MagneticField;
+%ignore crpropa::MagneticField::getFieldsParallel;
+#ifdef WITHNUMPY
+%nothread crpropa::MagneticField::getFields_numpyArray;
+%extend crpropa::MagneticField {
+  /* Field vectors at the N x 3 positions as N x 3 array, evaluated in
+     parallel without the GIL */
+  PyObject *getFields_numpyArray(PyObject *positions, double z = 0) {
+      PyArrayObject *p = crpropa_inputArray(positions, 2, 3);
+      if (not p)
+          return NULL;
+      npy_intp dims[2] = {PyArray_DIM(p, 0), 3};
+      PyObject *out = PyArray_SimpleNew(2, dims, NPY_FLOAT64);
+      if (out) {
+          const crpropa::Vector3d *pos = (const crpropa::Vector3d *) PyArray_DATA(p);
+          crpropa::Vector3d *B = (crpropa::Vector3d *) PyArray_DATA((PyArrayObject *) out);
+          Py_BEGIN_ALLOW_THREADS
+          $self->getFieldsParallel(pos, B, dims[0], z);
+          Py_END_ALLOW_THREADS
+      }
+      Py_DECREF(p);
+      return out;
+  }
+};
+#endif
 %include "crpropa/magneticField/MagneticField.h"
 
 %implicitconv crpropa::ref_ptr<crpropa::PhotonField>;
 %template(PhotonFieldRefPtr) crpropa::ref_ptr<crpropa::PhotonField>;
 %feature("director") crpropa::PhotonField;
+%ignore crpropa::PhotonField::getPhotonDensities;
+#ifdef WITHNUMPY
+%nothread crpropa::PhotonField::getPhotonDensities_numpyArray;
+%extend crpropa::PhotonField {
+  /* Photon densities at the photon energies of a 1D array, evaluated in
+     parallel without the GIL */
+  PyObject *getPhotonDensities_numpyArray(PyObject *energies, double z = 0) {
+      PyArrayObject *e = crpropa_inputArray(energies, 1, 0);
+      if (not e)
+          return NULL;
+      npy_intp n = PyArray_DIM(e, 0);
+      PyObject *out = PyArray_SimpleNew(1, &n, NPY_FLOAT64);
+      if (out) {
+          const double *x = (const double *) PyArray_DATA(e);
+          double *y = (double *) PyArray_DATA((PyArrayObject *) out);
+          Py_BEGIN_ALLOW_THREADS
+          $self->getPhotonDensities(x, y, n, z);
+          Py_END_ALLOW_THREADS
+      }
+      Py_DECREF(e);
+      return out;
+  }
+};
+#endif
 %include "crpropa/PhotonBackground.h"
+%include "crpropa/RateBuilder.h"
 
 %implicitconv crpropa::ref_ptr<crpropa::AdvectionField>;
 %template(AdvectionFieldRefPtr) crpropa::ref_ptr<crpropa::AdvectionField>;
@@ -409,9 +492,66 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %implicitconv crpropa::ref_ptr<crpropa::Density>;
 %template(DensityRefPtr) crpropa::ref_ptr<crpropa::Density>;
 %feature("director") crpropa::Density;
+%ignore crpropa::Density::getDensities;
+#ifdef WITHNUMPY
+%nothread crpropa::Density::getDensities_numpyArray;
+%extend crpropa::Density {
+  /* Densities of the DensityType at the N x 3 positions, evaluated in
+     parallel without the GIL */
+  PyObject *getDensities_numpyArray(PyObject *positions, crpropa::DensityType type = crpropa::TotalDensity) {
+      PyArrayObject *p = crpropa_inputArray(positions, 2, 3);
+      if (not p)
+          return NULL;
+      npy_intp n = PyArray_DIM(p, 0);
+      PyObject *out = PyArray_SimpleNew(1, &n, NPY_FLOAT64);
+      if (out) {
+          const crpropa::Vector3d *pos = (const crpropa::Vector3d *) PyArray_DATA(p);
+          double *rho = (double *) PyArray_DATA((PyArrayObject *) out);
+          Py_BEGIN_ALLOW_THREADS
+          $self->getDensities(pos, rho, n, type);
+          Py_END_ALLOW_THREADS
+      }
+      Py_DECREF(p);
+      return out;
+  }
+};
+#endif
 %include "crpropa/massDistribution/Density.h"
 
+#ifdef WITHNUMPY
+%extend crpropa::Grid {
+  /* NumPy view of the values without a copy, of shape (Nx, Ny, Nz[, 3]) for
+     the DENSE layout and flat for the BRICKED layout. The view is invalid
+     after the grid is resized. */
+  PyObject *toNumpy() {
+      int components = crpropa_NumpyType<T>::components;
+      npy_intp dims[4];
+      int nd;
+      if ($self->getLayout() == crpropa::DENSE) {
+          dims[0] = $self->getNx();
+          dims[1] = $self->getNy();
+          dims[2] = $self->getNz();
+          nd = 3;
+      } else {
+          dims[0] = $self->getNumberOfValues();
+          nd = 1;
+      }
+      if (components > 1)
+          dims[nd++] = components;
+      return crpropa_arrayView($self, (void *) $self->getValues(), nd, dims,
+          crpropa_NumpyType<T>::type, not $self->isMapped());
+  }
+};
+#endif
+%ignore crpropa::ThreadAffinityGuard;
+%ignore crpropa::getThreadCpus;
+%include "crpropa/Numa.h"
+%template(NumaNodeVector) std::vector<crpropa::NumaNode>;
 %include "crpropa/Grid.h"
+%include "crpropa/CompressedGrid.h"
+%ignore crpropa::TiledGrid3f::Tile;
+%ignore crpropa::TiledGrid3f::getTile;
+%include "crpropa/TiledGrid.h"
 %include "crpropa/GridTools.h"
 
 %template(Array3d) std::array<double, 3>;
@@ -433,10 +573,29 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %template(Grid1dRefPtr) crpropa::ref_ptr<crpropa::Grid<double> >;
 %template(Grid1d) crpropa::Grid<double>;
 
+%implicitconv crpropa::ref_ptr<crpropa::Grid<crpropa::Vector4f> >;
+%template(Grid4fRefPtr) crpropa::ref_ptr<crpropa::Grid<crpropa::Vector4f> >;
+%template(Grid4f) crpropa::Grid<crpropa::Vector4f>;
+
+%implicitconv crpropa::ref_ptr<crpropa::CompressedGrid3f>;
+%template(CompressedGrid3fRefPtr) crpropa::ref_ptr<crpropa::CompressedGrid3f>;
+
+%implicitconv crpropa::ref_ptr<crpropa::TiledGrid3f>;
+%template(TiledGrid3fRefPtr) crpropa::ref_ptr<crpropa::TiledGrid3f>;
+
 %implicitconv std::pair<std::vector<int>, std::vector<float> >;
 %template(PairIntFloat) std::pair<int, float>;
 %template(PairVector) std::vector<std::pair<int, float> >;
 
+#ifdef WITHNUMPY
+%extend crpropa::CylindricalProjectionMap {
+  /* NumPy view of the pdf without a copy, of shape (nTheta, nPhi) */
+  PyObject *getPdf_numpyArray() {
+      npy_intp dims[2] = {(npy_intp) $self->getNTheta(), (npy_intp) $self->getNPhi()};
+      return crpropa_arrayView($self, (void *) &$self->getPdf()[0], 2, dims, NPY_FLOAT64, true);
+  }
+};
+#endif
 %include "crpropa/EmissionMap.h"
 %implicitconv crpropa::ref_ptr<crpropa::EmissionMap>;
 %template(EmissionMapRefPtr) crpropa::ref_ptr<crpropa::EmissionMap>;
@@ -447,6 +606,7 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %feature("notabstract") QuimbyMagneticFieldAdapter;
 %include "crpropa/magneticField/QuimbyMagneticField.h"
 %include "crpropa/magneticField/AMRMagneticField.h"
+%include "crpropa/magneticField/OctreeMagneticField.h"
 %include "crpropa/magneticField/JF12Field.h"
 %include "crpropa/magneticField/JF12FieldSolenoidal.h"
 %include "crpropa/magneticField/PolarizedSingleModeMagneticField.h"
@@ -454,11 +614,13 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %include "crpropa/magneticField/TF17Field.h"
 %include "crpropa/magneticField/ArchimedeanSpiralField.h"
 %include "crpropa/magneticField/CMZField.h"
+%include "crpropa/magneticField/TabulatedMagneticField.h"
 %include "crpropa/magneticField/turbulentField/TurbulentField.h"
 %include "crpropa/magneticField/turbulentField/GridTurbulence.h"
 %include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
 %include "crpropa/magneticField/turbulentField/HelicalGridTurbulence.h"
 %include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
+%include "crpropa/magneticField/turbulentField/TiledTurbulence.h"
 %include "crpropa/module/BreakCondition.h"
 %include "crpropa/module/Boundary.h"
 
@@ -467,7 +629,12 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %include "crpropa/module/Observer.h"
 %include "crpropa/module/SimplePropagation.h"
 %include "crpropa/module/PropagationCK.h"
+%include "crpropa/module/PropagationDP.h"
 %include "crpropa/module/PropagationBP.h"
+%include "crpropa/module/PropagationBPDevice.h"
+%include "crpropa/module/PropagationHandoff.h"
+%include "crpropa/module/PropagationJump.h"
+%include "crpropa/module/PropagationGuidingCenter.h"
 
 %ignore crpropa::Output::enableProperty(const std::string &property, const Variant& defaultValue, const std::string &comment = "");
 %extend crpropa::Output{
@@ -543,15 +710,22 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 
 %include "crpropa/module/Output.h"
 %include "crpropa/module/DiffusionSDE.h"
+%include "crpropa/module/DiffusionEstimator.h"
 %include "crpropa/module/TextOutput.h"
 
 %include "crpropa/module/HDF5Output.h"
+%include "crpropa/module/ParquetOutput.h"
+%include "crpropa/module/SpectralReweighting.h"
+%template(SpectralModelRefPtr) crpropa::ref_ptr<crpropa::SpectralModel>;
+%include "crpropa/module/HistogramOutput.h"
 %include "crpropa/module/OutputShell.h"
 %include "crpropa/module/EMCascade.h"
 %include "crpropa/module/PhotonEleCa.h"
 %include "crpropa/module/PhotonOutput1D.h"
 %include "crpropa/module/NuclearDecay.h"
 %include "crpropa/module/ElectronPairProduction.h"
+%ignore crpropa::SophiaEventLibrary::Particle;
+%template(SophiaEventLibraryRefPtr) crpropa::ref_ptr<crpropa::SophiaEventLibrary>;
 %include "crpropa/module/PhotoPionProduction.h"
 %include "crpropa/module/PhotoDisintegration.h"
 %include "crpropa/module/ElasticScattering.h"
@@ -562,16 +736,101 @@ using namespace crpropa;   // for usage of namespace in header files, necessary
 %include "crpropa/module/EMTripletPairProduction.h"
 %include "crpropa/module/EMInverseComptonScattering.h"
 %include "crpropa/module/SynchrotronRadiation.h"
+%include "crpropa/module/ContinuousLosses.h"
 %include "crpropa/module/AdiabaticCooling.h"
+%include "crpropa/module/InteractionScheduler.h"
 
 %template(IntSet) std::set<int>;
+%template(UInt64Vector) std::vector<uint64_t>;
+%extend crpropa::PerformanceModule {
+  %pythoncode %{
+    def getStatistics(self):
+        """Merged counters of all threads as dict"""
+        import json
+        return json.loads(self.toJSON())
+  %}
+};
+%extend crpropa::StepLimiterProfiler {
+  %pythoncode %{
+    def getStatistics(self):
+        """Merged counters of all threads as dict"""
+        import json
+        return json.loads(self.toJSON())
+  %}
+};
 %include "crpropa/module/Tools.h"
+%ignore crpropa::TrajectoryRecorder::Point;
+%ignore crpropa::TrajectoryRecorder::Track;
+%include "crpropa/module/TrajectoryRecorder.h"
+%include "crpropa/module/WeightWindow.h"
+
+%ignore crpropa::CandidateBatch::records;
+%template(BatchModuleRefPtr) crpropa::ref_ptr<crpropa::BatchModule>;
+%feature("director") crpropa::BatchModule;
+%include "crpropa/module/BatchModule.h"
+#ifdef WITHNUMPY
+%extend crpropa::CandidateBatch {
+  PyObject *toNumpy() const {
+      // structured array with the layout of CandidateBatch::Record
+      PyObject *fields = Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+          "x", "f8", "y", "f8", "z", "f8", "energy", "f8", "weight", "f8",
+          "redshift", "f8", "id", "i8", "serialNumber", "u8");
+      PyArray_Descr *descr = NULL;
+      int ok = PyArray_DescrConverter(fields, &descr);
+      Py_DECREF(fields);
+      if (not ok)
+          return NULL;
+      npy_intp size = $self->size();
+      PyObject *out = PyArray_NewFromDescr(&PyArray_Type, descr, 1, &size,
+          NULL, NULL, 0, NULL);
+      if (out and size > 0)
+          memcpy(PyArray_DATA((PyArrayObject *) out), &$self->records[0],
+              size * sizeof(crpropa::CandidateBatch::Record));
+      return out;
+  }
+};
+#else
+%extend crpropa::CandidateBatch {
+  PyObject *toNumpy() const {
+      std::cerr << "ERROR: CRPropa was compiled without NumPy support!" << std::endl;
+      Py_RETURN_NONE;
+  }
+};
+#endif
 
 %template(SourceInterfaceRefPtr) crpropa::ref_ptr<crpropa::SourceInterface>;
 %feature("director") crpropa::SourceInterface;
 %template(SourceFeatureRefPtr) crpropa::ref_ptr<crpropa::SourceFeature>;
 %feature("director") crpropa::SourceFeature;
+%ignore crpropa::SourceFeature::prepareParticles;
+%ignore crpropa::SourceFeature::prepareCandidates;
 %include "crpropa/Source.h"
+%ignore crpropa::candidateStreamMagic;
+%ignore crpropa::candidateStreamEndMagic;
+%include "crpropa/CandidateStream.h"
+%include "crpropa/module/CandidateStreamOutput.h"
+%template(OutputTableRefPtr) crpropa::ref_ptr<crpropa::OutputTable>;
+%include "crpropa/OutputReader.h"
+#ifdef WITHNUMPY
+%extend crpropa::OutputTable {
+  PyObject *getColumnArray(const std::string &name) const {
+      // copy of the column as NumPy array
+      const std::vector<double> &column = $self->getColumn(name);
+      npy_intp size = column.size();
+      PyObject *out = PyArray_SimpleNew(1, &size, NPY_DOUBLE);
+      if (out and size > 0)
+          memcpy(PyArray_DATA((PyArrayObject *) out), &column[0], size * sizeof(double));
+      return out;
+  }
+};
+#else
+%extend crpropa::OutputTable {
+  PyObject *getColumnArray(const std::string &name) const {
+      std::cerr << "ERROR: CRPropa was compiled without NumPy support!" << std::endl;
+      Py_RETURN_NONE;
+  }
+};
+#endif
 
 %inline %{
 class ModuleListIterator {
@@ -614,8 +873,208 @@ class ModuleListIterator {
   }
 };
 
+%template(CheckpointRefPtr) crpropa::ref_ptr<crpropa::Checkpoint>;
+%include "crpropa/Checkpoint.h"
+%template(ConvergenceMonitorRefPtr) crpropa::ref_ptr<crpropa::ConvergenceMonitor>;
+%include "crpropa/ConvergenceMonitor.h"
+%template(PrimaryCostModelRefPtr) crpropa::ref_ptr<crpropa::PrimaryCostModel>;
+%include "crpropa/PrimaryCostModel.h"
+
 %template(ModuleListRefPtr) crpropa::ref_ptr<crpropa::ModuleList>;
+%ignore crpropa::ModuleList::setProgressCallback;
+%ignore crpropa::ModuleList::submit(const candidate_vector_t &, BatchCallback, bool, bool);
+#ifdef WITHNUMPY
+%nothread crpropa::ModuleList::run_numpyArrays;
+%nothread crpropa::ModuleList::run_numpyArray;
+%{
+/* Contiguous array of the given type and dimensions of an optional input,
+   NULL for None; sets ok to false with a Python error if not convertible */
+static PyArrayObject *crpropa_stateArray(PyObject *input, int type, int nd,
+    npy_intp count, bool &ok) {
+  if (not ok or input == NULL or input == Py_None)
+    return NULL;
+  PyArrayObject *array = (PyArrayObject *) PyArray_FROMANY(input, type, nd, nd,
+      NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+  if (array and (PyArray_DIM(array, 0) != count or (nd == 2 and PyArray_DIM(array, 1) != 3))) {
+    Py_DECREF(array);
+    array = NULL;
+    PyErr_SetString(PyExc_ValueError, "arrays of length N and shape (N, 3) required");
+  }
+  ok = array != NULL;
+  return array;
+}
+
+/* Run the module list for the states without the GIL */
+static PyObject *crpropa_runStates(crpropa::ModuleList *modules,
+    const crpropa::InitialStates &states, bool recursive, bool secondariesFirst) {
+  std::string error;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    modules->run(states, recursive, secondariesFirst);
+  } catch (std::exception &e) {
+    error = e.what();
+  }
+  Py_END_ALLOW_THREADS
+  if (not error.empty()) {
+    PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static const double *crpropa_stateData(PyArrayObject *array) {
+  return array ? (const double *) PyArray_DATA(array) : NULL;
+}
+
+/* Field of a structured array, NULL without a Python error if missing */
+static PyObject *crpropa_stateField(PyObject *states, const char *name) {
+  PyObject *field = PyMapping_GetItemString(states, name);
+  if (not field)
+    PyErr_Clear();
+  return field;
+}
+%}
+%extend crpropa::ModuleList {
+  /* Run the simulation for primaries given as arrays of length N, the
+     positions and directions of shape (N, 3); all but the ids and energies
+     are optional. The candidates are created in the parallel loop, the GIL
+     is released during the run. */
+  PyObject *run_numpyArrays(PyObject *ids, PyObject *energies,
+      PyObject *positions = Py_None, PyObject *directions = Py_None,
+      PyObject *weights = Py_None, PyObject *redshifts = Py_None,
+      bool recursive = true, bool secondariesFirst = false) {
+    npy_intp count = PyObject_Length(ids);
+    if (count < 0)
+      return NULL;
+    bool ok = true;
+    PyArrayObject *arrays[6] = {
+      crpropa_stateArray(ids, NPY_INT, 1, count, ok),
+      crpropa_stateArray(energies, NPY_FLOAT64, 1, count, ok),
+      crpropa_stateArray(positions, NPY_FLOAT64, 2, count, ok),
+      crpropa_stateArray(directions, NPY_FLOAT64, 2, count, ok),
+      crpropa_stateArray(weights, NPY_FLOAT64, 1, count, ok),
+      crpropa_stateArray(redshifts, NPY_FLOAT64, 1, count, ok)};
+    PyObject *result = NULL;
+    if (ok and arrays[1] == NULL)
+      PyErr_SetString(PyExc_ValueError, "energies required");
+    else if (ok) {
+      crpropa::InitialStates states;
+      states.count = count;
+      states.id = (const int *) PyArray_DATA(arrays[0]);
+      states.energy = crpropa_stateData(arrays[1]);
+      states.position = crpropa_stateData(arrays[2]);
+      states.direction = crpropa_stateData(arrays[3]);
+      states.weight = crpropa_stateData(arrays[4]);
+      states.redshift = crpropa_stateData(arrays[5]);
+      result = crpropa_runStates($self, states, recursive, secondariesFirst);
+    }
+    for (int i = 0; i < 6; i++)
+      Py_XDECREF(arrays[i]);
+    return result;
+  }
+
+  /* As run_numpyArrays for a structured array with the fields id and
+     energy, and optionally x, y, z (position), px, py, pz (direction),
+     weight and redshift */
+  PyObject *run_numpyArray(PyObject *states, bool recursive = true,
+      bool secondariesFirst = false) {
+    npy_intp count = PyObject_Length(states);
+    if (count < 0)
+      return NULL;
+    const char *names[10] = {"id", "energy", "weight", "redshift",
+        "x", "y", "z", "px", "py", "pz"};
+    int types[10] = {NPY_INT, NPY_FLOAT64, NPY_FLOAT64, NPY_FLOAT64,
+        NPY_FLOAT64, NPY_FLOAT64, NPY_FLOAT64, NPY_FLOAT64, NPY_FLOAT64, NPY_FLOAT64};
+    bool ok = true;
+    PyArrayObject *arrays[10];
+    for (int i = 0; i < 10; i++) {
+      PyObject *field = crpropa_stateField(states, names[i]);
+      arrays[i] = crpropa_stateArray(field, types[i], 1, count, ok);
+      Py_XDECREF(field);
+    }
+    // the positions and directions as x, y, z of each primary
+    std::vector<double> vectors[2];
+    for (int v = 0; v < 2; v++) {
+      PyArrayObject **a = arrays + 4 + 3 * v;
+      if (not (a[0] and a[1] and a[2]))
+        continue;
+      vectors[v].resize(3 * count);
+      for (npy_intp i = 0; i < count; i++)
+        for (int j = 0; j < 3; j++)
+          vectors[v][3 * i + j] = crpropa_stateData(a[j])[i];
+    }
+    PyObject *result = NULL;
+    if (ok and (arrays[0] == NULL or arrays[1] == NULL))
+      PyErr_SetString(PyExc_ValueError, "fields id and energy required");
+    else if (ok) {
+      crpropa::InitialStates s;
+      s.count = count;
+      s.id = (const int *) PyArray_DATA(arrays[0]);
+      s.energy = crpropa_stateData(arrays[1]);
+      s.weight = crpropa_stateData(arrays[2]);
+      s.redshift = crpropa_stateData(arrays[3]);
+      s.position = vectors[0].empty() ? NULL : &vectors[0][0];
+      s.direction = vectors[1].empty() ? NULL : &vectors[1][0];
+      result = crpropa_runStates($self, s, recursive, secondariesFirst);
+    }
+    for (int i = 0; i < 10; i++)
+      Py_XDECREF(arrays[i]);
+    return result;
+  }
+};
+#endif
 %include "crpropa/ModuleList.h"
+%template(DomainDecompositionRefPtr) crpropa::ref_ptr<crpropa::DomainDecomposition>;
+%template(DomainMagneticFieldRefPtr) crpropa::ref_ptr<crpropa::DomainMagneticField>;
+%include "crpropa/DomainDecomposition.h"
+%include "crpropa/DistributedModuleList.h"
+%include "crpropa/StaticModuleList.h"
+%template(MultilevelMonteCarloRefPtr) crpropa::ref_ptr<crpropa::MultilevelMonteCarlo>;
+%include "crpropa/MultilevelMonteCarlo.h"
+%include "crpropa/module/EMCascadeResponse.h"
+%template(TransferMatrixRefPtr) crpropa::ref_ptr<crpropa::TransferMatrix>;
+%include "crpropa/TransferMatrix.h"
+
+/* simulations built from JSON configurations, pickled as their text so that
+   worker processes rebuild them */
+%ignore crpropa::ConfigValue::operator[];
+%ignore crpropa::SimulationConfig::registerModule;
+%ignore crpropa::SimulationConfig::registerField;
+%ignore crpropa::SimulationConfig::registerSourceFeature;
+%ignore crpropa::SimulationConfig::registerObserverFeature;
+%ignore crpropa::SimulationConfig::registerPhotonField;
+%template(SimulationConfigRefPtr) crpropa::ref_ptr<crpropa::SimulationConfig>;
+%include "crpropa/Configuration.h"
+%extend crpropa::ConfigValue {
+  const crpropa::ConfigValue &get(const std::string &key) const {
+    return (*$self)[key];
+  }
+  const crpropa::ConfigValue &at(size_t i) const {
+    return (*$self)[i];
+  }
+  %pythoncode %{
+    def __reduce__(self):
+        return (_configValueFromJSON, (self.toJSON(),))
+  %}
+};
+%extend crpropa::SimulationConfig {
+  %pythoncode %{
+    def __reduce__(self):
+        """Pickled as the JSON configuration, unpickling builds the simulation again"""
+        return (_simulationConfigFromJSON, (self.getConfig().toJSON(),))
+  %}
+};
+%pythoncode %{
+def _configValueFromJSON(text):
+    return ConfigValue.parse(text)
+
+def _simulationConfigFromJSON(text):
+    return SimulationConfig(ConfigValue.parse(text))
+%}
+/* standard 1D pipeline with a fused step, the modules have to be given in this order */
+%template(StaticModuleList1D) crpropa::StaticModuleList<crpropa::SimplePropagation,
+	crpropa::Redshift, crpropa::PhotoPionProduction, crpropa::ElectronPairProduction,
+	crpropa::MinimumEnergy, crpropa::Observer>;
 
 %template(ParticleCollectorRefPtr) crpropa::ref_ptr<crpropa::ParticleCollector>;
 
@@ -684,6 +1143,56 @@ class ParticleCollectorIterator {
   }
 };
 
+%ignore crpropa::ParticleCollector::Columns;
+%ignore crpropa::ParticleCollector::getColumns;
+#ifdef WITHNUMPY
+%{
+static void crpropa_deleteColumns(PyObject *capsule) {
+  delete (crpropa::ParticleCollector::Columns *) PyCapsule_GetPointer(capsule, "crpropa.columns");
+}
+
+template<typename T>
+static PyObject *crpropa_columnView(std::vector<T> &v, int type, PyObject *capsule) {
+  npy_intp size = v.size();
+  PyObject *array = PyArray_New(&PyArray_Type, 1, &size, type, NULL,
+      size ? (void *) &v[0] : NULL, 0, NPY_ARRAY_CARRAY, NULL);
+  if (not array)
+    return NULL;
+  Py_INCREF(capsule);
+  PyArray_SetBaseObject((PyArrayObject *) array, capsule);
+  return array;
+}
+%}
+%extend crpropa::ParticleCollector {
+  /* Snapshot of the current states as a dict of NumPy arrays: id, energy,
+     x, y, z, px, py, pz (direction), redshift and weight. The arrays share
+     one snapshot, which is not copied again. */
+  PyObject *toNumpy() const {
+      crpropa::ParticleCollector::Columns *c = new crpropa::ParticleCollector::Columns();
+      $self->getColumns(*c);
+      PyObject *capsule = PyCapsule_New((void *) c, "crpropa.columns", crpropa_deleteColumns);
+      PyObject *out = PyDict_New();
+      PyObject *a;
+#define CRPROPA_ADD_COLUMN(name, type) \
+      a = crpropa_columnView(c->name, type, capsule); \
+      PyDict_SetItemString(out, #name, a); \
+      Py_XDECREF(a);
+      CRPROPA_ADD_COLUMN(id, NPY_INT32)
+      CRPROPA_ADD_COLUMN(energy, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(x, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(y, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(z, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(px, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(py, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(pz, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(redshift, NPY_FLOAT64)
+      CRPROPA_ADD_COLUMN(weight, NPY_FLOAT64)
+#undef CRPROPA_ADD_COLUMN
+      Py_DECREF(capsule);
+      return out;
+  }
+};
+#endif
 %include "crpropa/module/ParticleCollector.h"
 
 %include "crpropa/massDistribution/Density.h"
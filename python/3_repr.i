@@ -7,6 +7,7 @@ __REPR__( crpropa::Module );
 __REPR__( crpropa::ModuleList );
 __REPR__( crpropa::Source );
 __REPR__( crpropa::SourceList );
+__REPR__( crpropa::SourceCatalog );
 __REPR__( crpropa::SourceFeature );
 __REPR__( crpropa::Observer );
 __REPR__( crpropa::ObserverFeature );
@@ -13,6 +13,8 @@
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/MagneticLens.h"
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/magneticLens/GalacticLens.h"
 %}
 
 %include "crpropa/magneticLens/ModelMatrix.h"
@@ -37,6 +39,9 @@
 %include "crpropa/magneticLens/MagneticLens.h"
 %template(LenspartVector) std::vector< crpropa::LensPart *>;
 
+%include "crpropa/magneticLens/LensBuilder.h"
+%include "crpropa/magneticLens/GalacticLens.h"
+
 #ifdef WITHNUMPY
 %extend crpropa::MagneticLens{
   PyObject * transformModelVector_numpyArray(PyObject *input, double rigidity)
@@ -78,6 +83,7 @@
 %ignore ParticleMapsContainer::getParticleIds;
 %ignore ParticleMapsContainer::getEnergies;
 %ignore ParticleMapsContainer::getRandomParticles;
+%ignore ParticleMapsContainer::addParticles(const std::vector<int> &, const std::vector<double> &, const std::vector<double> &, const std::vector<double> &, const std::vector<double> &);
 %include "crpropa/magneticLens/ParticleMapsContainer.h"
 
 #ifdef WITHNUMPY
@@ -152,24 +158,19 @@
     npy_intp *D = PyArray_DIMS(particleIds_arr);
     int arraySize = D[0];
 
+    std::vector<int> ids(arraySize);
     for(size_t i = 0; i < arraySize; i++)
     {
       if (intSize == 32)
-      {
-        $self->addParticle(((int32_t*) particleIds_dp)[i], energies_dp[i],
-            galacticLongitudes_dp[i], galacticLatitudes_dp[i], weights_dp[i]);
-      }
-      else if (intSize == 64)
-      {
-        $self->addParticle(((int64_t*) particleIds_dp)[i], energies_dp[i],
-            galacticLongitudes_dp[i], galacticLatitudes_dp[i], weights_dp[i]);
-      }
+        ids[i] = ((int32_t*) particleIds_dp)[i];
       else
-      {
-        throw std::runtime_error("ParticleMapsContainer::addParticles - unknown int size");
-      }
-
+        ids[i] = ((int64_t*) particleIds_dp)[i];
     }
+    $self->addParticles(ids,
+        std::vector<double>(energies_dp, energies_dp + arraySize),
+        std::vector<double>(galacticLongitudes_dp, galacticLongitudes_dp + arraySize),
+        std::vector<double>(galacticLatitudes_dp, galacticLatitudes_dp + arraySize),
+        std::vector<double>(weights_dp, weights_dp + arraySize));
     Py_RETURN_TRUE;
   }
 
@@ -0,0 +1,76 @@
+#include "crpropa/AdaptiveThinning.h"
+#include "crpropa/Random.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+AdaptiveThinning::AdaptiveThinning(double budget, const std::string &property) :
+		budgetKey(Candidate::getPropertyKey(property)) {
+	setBudget(budget);
+}
+
+void AdaptiveThinning::setBudget(double b) {
+	if (not (b >= 1))
+		throw std::runtime_error("AdaptiveThinning: budget must be at least 1");
+	budget = b;
+}
+
+double AdaptiveThinning::getBudget() const {
+	return budget;
+}
+
+double AdaptiveThinning::getBudget(const Candidate *candidate) const {
+	if (not candidate->hasProperty(budgetKey))
+		return budget;
+	return candidate->getProperty(budgetKey).toDouble();
+}
+
+void AdaptiveThinning::setBudget(Candidate *candidate, double b) const {
+	candidate->setProperty(budgetKey, Variant(b));
+}
+
+void AdaptiveThinning::setSecondaryBudget(Candidate *parent, double b) const {
+	parent->setSecondaryProperty(budgetKey, b);
+}
+
+double AdaptiveThinning::sample(const Candidate *parent, double f, double &b) const {
+	b = getBudget(parent) * f;
+	if (b >= 1)
+		return 1;
+	if (not (b > 0))
+		return 0;
+	if (Random::instance().rand() >= b)
+		return 0;
+	double w = 1. / b;
+	b = 1;
+	return w;
+}
+
+bool AdaptiveThinning::addSecondary(Candidate *parent, double f, int id, double energy,
+		const Vector3d &position, const std::string &tag) const {
+	return addSecondary(parent, f, id, energy, position, Candidate::getTagCode(tag));
+}
+
+bool AdaptiveThinning::addSecondary(Candidate *parent, double f, int id, double energy,
+		const Vector3d &position, uint32_t tag) const {
+	if (Candidate::isBelowSecondaryThreshold(id, energy)) {
+		// not created, but counted as dropped energy without thinning
+		parent->addSecondary(id, energy, position, 1., tag);
+		return false;
+	}
+	double b;
+	double w = sample(parent, f, b);
+	if (w == 0)
+		return false;
+	if (not parent->addSecondary(id, energy, position, w, tag))
+		return false;
+	setSecondaryBudget(parent, b);
+	return true;
+}
+
+void AdaptiveThinning::keep(Candidate *parent, double f) const {
+	setBudget(parent, getBudget(parent) * f);
+}
+
+} // namespace crpropa
@@ -1,44 +1,453 @@
 #include "crpropa/Candidate.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/PhotonBackground.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
 #include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 namespace crpropa {
 
+namespace {
+
+// free blocks and counters of one thread
+struct CandidateFreeList {
+	std::vector<void *> blocks;
+	std::atomic<uint64_t> allocated, reused, recycled, released, cached;
+
+	CandidateFreeList();
+	~CandidateFreeList();
+	void clear();
+};
+
+std::atomic<size_t> candidatePoolMaximumSize(1024);
+
+// all living free lists, and the counts of the finished threads
+std::mutex candidatePoolMutex;
+std::vector<CandidateFreeList *> candidatePoolRegistry;
+CandidatePool::Statistics candidatePoolRetired = {0, 0, 0, 0, 0};
+
+// the free list of a thread is gone during its destruction at thread exit,
+// candidates destroyed afterwards use the normal heap
+thread_local bool candidateFreeListDestroyed = false;
+thread_local CandidateFreeList candidateFreeList;
+
+CandidateFreeList::CandidateFreeList() :
+		allocated(0), reused(0), recycled(0), released(0), cached(0) {
+	std::lock_guard<std::mutex> lock(candidatePoolMutex);
+	candidatePoolRegistry.push_back(this);
+}
+
+CandidateFreeList::~CandidateFreeList() {
+	clear();
+	candidateFreeListDestroyed = true;
+	std::lock_guard<std::mutex> lock(candidatePoolMutex);
+	candidatePoolRetired.allocated += allocated;
+	candidatePoolRetired.reused += reused;
+	candidatePoolRetired.recycled += recycled;
+	candidatePoolRetired.released += released;
+	for (size_t i = 0; i < candidatePoolRegistry.size(); i++) {
+		if (candidatePoolRegistry[i] == this) {
+			candidatePoolRegistry.erase(candidatePoolRegistry.begin() + i);
+			break;
+		}
+	}
+}
+
+void CandidateFreeList::clear() {
+	for (size_t i = 0; i < blocks.size(); i++)
+		::operator delete(blocks[i]);
+	released.fetch_add(blocks.size(), std::memory_order_relaxed);
+	cached.store(0, std::memory_order_relaxed);
+	blocks.clear();
+}
+
+// Names of the property keys and of the tag codes. Registrations are rare,
+// thus every one publishes a new immutable copy and lookups need no lock.
+// The old copies are kept, as other threads may still read them.
+struct PropertyKeys {
+	std::unordered_map<std::string, PropertyKey> keys;
+	std::vector<std::string> names;
+};
+
+typedef std::atomic<const PropertyKeys *> KeyTable;
+
+KeyTable &propertyKeys() {
+	static KeyTable keys(new PropertyKeys());
+	return keys;
+}
+
+std::mutex propertyKeysMutex;
+
+KeyTable &tagCodes() {
+	static KeyTable codes(new PropertyKeys());
+	return codes;
+}
+
+std::mutex tagCodesMutex;
+
+bool findKey(const KeyTable &table, const std::string &name, PropertyKey &key) {
+	const PropertyKeys *p = table.load(std::memory_order_acquire);
+	if (p->names.empty())
+		return false;
+	std::unordered_map<std::string, PropertyKey>::const_iterator i = p->keys.find(name);
+	if (i == p->keys.end())
+		return false;
+	key = i->second;
+	return true;
+}
+
+PropertyKey registerKey(KeyTable &table, std::mutex &mutex, const std::string &name) {
+	PropertyKey key;
+	if (findKey(table, name, key))
+		return key;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (findKey(table, name, key))
+		return key;
+	PropertyKeys *p = new PropertyKeys(*table.load());
+	key = p->names.size();
+	p->names.push_back(name);
+	p->keys[name] = key;
+	table.store(p, std::memory_order_release);
+	return key;
+}
+
+bool findPropertyKey(const std::string &name, PropertyKey &key) {
+	return findKey(propertyKeys(), name, key);
+}
+
+// code of the default tag of the candidates, also of the secondaries before
+// they get the tag of their interaction
+uint32_t primaryTag() {
+	static const uint32_t code = Candidate::getTagCode("PRIM");
+	return code;
+}
+
+// serial numbers of one thread, taken from the global counter in blocks;
+// the generation invalidates the blocks when the counter is set
+struct SerialNumberBlock {
+	uint64_t next, end, generation;
+};
+
+std::atomic<uint64_t> serialNumberGeneration(0);
+thread_local SerialNumberBlock serialNumberBlock = {0, 0, 0};
+
+} // namespace
+
+void *CandidatePool::allocate(size_t size) {
+	if (size == sizeof(Candidate) and not candidateFreeListDestroyed) {
+		CandidateFreeList &freeList = candidateFreeList;
+		if (not freeList.blocks.empty()) {
+			void *p = freeList.blocks.back();
+			freeList.blocks.pop_back();
+			freeList.reused.fetch_add(1, std::memory_order_relaxed);
+			freeList.cached.fetch_sub(1, std::memory_order_relaxed);
+			return p;
+		}
+		freeList.allocated.fetch_add(1, std::memory_order_relaxed);
+	}
+	return ::operator new(size);
+}
+
+void CandidatePool::deallocate(void *p, size_t size) {
+	if (p == 0)
+		return;
+	if (size == sizeof(Candidate) and not candidateFreeListDestroyed) {
+		CandidateFreeList &freeList = candidateFreeList;
+		if (freeList.blocks.size() < candidatePoolMaximumSize.load(std::memory_order_relaxed)) {
+			freeList.blocks.push_back(p);
+			freeList.recycled.fetch_add(1, std::memory_order_relaxed);
+			freeList.cached.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		freeList.released.fetch_add(1, std::memory_order_relaxed);
+	}
+	::operator delete(p);
+}
+
+CandidatePool::Statistics CandidatePool::getStatistics() {
+	std::lock_guard<std::mutex> lock(candidatePoolMutex);
+	Statistics s = candidatePoolRetired;
+	for (size_t i = 0; i < candidatePoolRegistry.size(); i++) {
+		const CandidateFreeList *freeList = candidatePoolRegistry[i];
+		s.allocated += freeList->allocated.load(std::memory_order_relaxed);
+		s.reused += freeList->reused.load(std::memory_order_relaxed);
+		s.recycled += freeList->recycled.load(std::memory_order_relaxed);
+		s.released += freeList->released.load(std::memory_order_relaxed);
+		s.cached += freeList->cached.load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+void CandidatePool::setMaximumSize(size_t n) {
+	candidatePoolMaximumSize = n;
+}
+
+size_t CandidatePool::getMaximumSize() {
+	return candidatePoolMaximumSize;
+}
+
+void CandidatePool::clear() {
+	if (not candidateFreeListDestroyed)
+		candidateFreeList.clear();
+}
+
+void *Candidate::operator new(size_t size) {
+	return CandidatePool::allocate(size);
+}
+
+void Candidate::operator delete(void *p, size_t size) {
+	CandidatePool::deallocate(p, size);
+}
+
+// RetainedParticleState -------------------------------------------------------
+RetainedParticleState::RetainedParticleState(unsigned int retention) :
+		retention(retention) {
+}
+
+RetainedParticleState::RetainedParticleState(unsigned int retention, const ParticleState &state) :
+		retention(retention) {
+	*this = state;
+}
+
+RetainedParticleState::RetainedParticleState(const RetainedParticleState &state) :
+		block(state.block), retention(state.retention) {
+}
+
+RetainedParticleState &RetainedParticleState::operator=(const RetainedParticleState &state) {
+	if (Candidate::getStateRetention() & retention)
+		block = state.block;
+	else
+		block = 0;
+	return *this;
+}
+
+RetainedParticleState &RetainedParticleState::operator=(const ParticleState &state) {
+	if (not (Candidate::getStateRetention() & retention))
+		block = 0;
+	else if (block.valid() and (block->getReferenceCount() == 1))
+		block->state = state;
+	else
+		block = new Block(state);
+	return *this;
+}
+
+ParticleState &RetainedParticleState::modify() {
+	// copy on write, the other owners keep the old state
+	if (block->getReferenceCount() > 1)
+		block = new Block(block->state);
+	return block->state;
+}
+
+bool RetainedParticleState::isRetained() const {
+	return block.valid();
+}
+
+const ParticleState &RetainedParticleState::get() const {
+	if (not block.valid())
+		throw std::runtime_error("RetainedParticleState: state not retained, see Candidate::setStateRetention");
+	return block->state;
+}
+
+RetainedParticleState::operator const ParticleState &() const {
+	return get();
+}
+
+void RetainedParticleState::setPosition(const Vector3d &pos) {
+	if (block.valid())
+		modify().setPosition(pos);
+}
+
+const Vector3d &RetainedParticleState::getPosition() const {
+	return get().getPosition();
+}
+
+void RetainedParticleState::setDirection(const Vector3d &dir) {
+	if (block.valid())
+		modify().setDirection(dir);
+}
+
+const Vector3d &RetainedParticleState::getDirection() const {
+	return get().getDirection();
+}
+
+void RetainedParticleState::setEnergy(double newEnergy) {
+	if (block.valid())
+		modify().setEnergy(newEnergy);
+}
+
+double RetainedParticleState::getEnergy() const {
+	return get().getEnergy();
+}
+
+double RetainedParticleState::getRigidity() const {
+	return get().getRigidity();
+}
+
+void RetainedParticleState::setId(int newId) {
+	if (block.valid())
+		modify().setId(newId);
+}
+
+int RetainedParticleState::getId() const {
+	return get().getId();
+}
+
+std::string RetainedParticleState::getDescription() const {
+	if (not block.valid())
+		return "not retained";
+	return block->state.getDescription();
+}
+
+double RetainedParticleState::getCharge() const {
+	return get().getCharge();
+}
+
+double RetainedParticleState::getMass() const {
+	return get().getMass();
+}
+
+void RetainedParticleState::setLorentzFactor(double gamma) {
+	if (block.valid())
+		modify().setLorentzFactor(gamma);
+}
+
+double RetainedParticleState::getLorentzFactor() const {
+	return get().getLorentzFactor();
+}
+
+Vector3d RetainedParticleState::getVelocity() const {
+	return get().getVelocity();
+}
+
+Vector3d RetainedParticleState::getMomentum() const {
+	return get().getMomentum();
+}
+
+// StepQuantities --------------------------------------------------------------
+StepQuantities::StepQuantities() :
+		redshift2(1), redshift3(1), energy(0), lorentzFactor(0), lgLorentzFactor(0),
+		rigidity(0), id(0), E(std::numeric_limits<double>::quiet_NaN()),
+		z(std::numeric_limits<double>::quiet_NaN()), nFieldsCached(0) {
+}
+
+void StepQuantities::update(const ParticleState &state, double redshift) {
+	if (redshift != z) {
+		redshift2 = pow_integer<2>(1 + redshift);
+		redshift3 = pow_integer<3>(1 + redshift);
+		nFieldsCached = 0;
+	}
+	id = state.getId();
+	E = state.getEnergy();
+	z = redshift;
+	energy = E * (1 + z);
+	lorentzFactor = state.getLorentzFactor();
+	lgLorentzFactor = log10(lorentzFactor * (1 + z));
+	rigidity = state.getRigidity();
+}
+
+double StepQuantities::getRedshiftScaling(const PhotonField *field) const {
+	for (int i = 0; i < nFieldsCached; i++)
+		if (fields[i] == field)
+			return scalings[i];
+	double s = field->getRedshiftScaling(z);
+	if (nFieldsCached < nFields) {
+		fields[nFieldsCached] = field;
+		scalings[nFieldsCached] = s;
+		nFieldsCached++;
+	}
+	return s;
+}
+
+// InteractionRateCache --------------------------------------------------------
+InteractionRateCache::InteractionRateCache() : nCached(0), next(0) {
+}
+
+bool InteractionRateCache::find(const void *owner, const ParticleState &state,
+		double redshift, double &rate) const {
+	for (int i = 0; i < nCached; i++) {
+		const Entry &e = entries[i];
+		if (e.owner != owner)
+			continue;
+		double E = state.getEnergy();
+		if ((state.getId() != e.id) or (E < e.Emin) or (E > e.Emax)
+				or (redshift < e.zmin) or (redshift > e.zmax))
+			return false;
+		rate = e.rate;
+		return true;
+	}
+	return false;
+}
+
+void InteractionRateCache::store(const void *owner, const ParticleState &state,
+		double redshift, double rate, double lgTolerance, double zTolerance) {
+	int i = 0;
+	while ((i < nCached) and (entries[i].owner != owner))
+		i++;
+	if (i == nRates) {
+		i = next;
+		next = (next + 1) % nRates;
+	} else if (i == nCached) {
+		nCached++;
+	}
+	Entry &e = entries[i];
+	double E = state.getEnergy();
+	double f = std::pow(10, lgTolerance);
+	e.owner = owner;
+	e.id = state.getId();
+	e.Emin = E / f;
+	e.Emax = E * f;
+	e.zmin = redshift - zTolerance;
+	e.zmax = redshift + zTolerance;
+	e.rate = rate;
+}
+
+void InteractionRateCache::clear() {
+	nCached = 0;
+	next = 0;
+}
+
+// Candidate -------------------------------------------------------------------
+// created is the source state for primaries, shared if both are retained
+static void shareCreated(RetainedParticleState &created,
+		const RetainedParticleState &source, const ParticleState &state) {
+	if (source.isRetained())
+		created = source;
+	else
+		created = state;
+}
+
 Candidate::Candidate(int id, double E, Vector3d pos, Vector3d dir, double z, double weight, std::string tagOrigin) :
-  redshift(z), trajectoryLength(0), weight(weight), currentStep(0), nextStep(0), active(true), parent(0), tagOrigin(tagOrigin) {
+  active(true), detached(false), tagOrigin((tagOrigin == "PRIM") ? primaryTag() : getTagCode(tagOrigin)),
+  weight(weight), redshift(z), trajectoryLength(0), currentStep(0), nextStep(0),
+  source(RetainSource, ParticleState(id, E, pos, dir)), created(RetainCreated), parent(0) {
 	ParticleState state(id, E, pos, dir);
-	source = state;
-	created = state;
+	shareCreated(created, source, state);
 	previous = state;
 	current = state;
 
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
-
+	serialNumber = newSerialNumber();
 }
 
 Candidate::Candidate(const ParticleState &state) :
-		source(state), created(state), current(state), previous(state), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), active(true), parent(0), tagOrigin ("PRIM") {
+		current(state), previous(state), active(true), detached(false), tagOrigin(primaryTag()), weight(1), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), source(RetainSource, state), created(RetainCreated), parent(0) {
+	shareCreated(created, source, state);
 
-#if defined(OPENMP_3_1)
-		#pragma omp atomic capture
-		{serialNumber = nextSerialNumber++;}
-#elif defined(__GNUC__)
-		{serialNumber = __sync_add_and_fetch(&nextSerialNumber, 1);}
-#else
-		#pragma omp critical
-		{serialNumber = nextSerialNumber++;}
-#endif
+	serialNumber = newSerialNumber();
+}
 
+Candidate::Candidate(const ParticleState &state, uint64_t serialNumber) :
+		current(state), previous(state), active(true), detached(false), tagOrigin(primaryTag()), weight(1), redshift(0), trajectoryLength(0), currentStep(0), nextStep(0), source(RetainSource, state), created(RetainCreated), parent(0), serialNumber(serialNumber) {
+	shareCreated(created, source, state);
 }
 
 bool Candidate::isActive() const {
@@ -90,27 +499,135 @@ void Candidate::setCurrentStep(double lstep) {
 	trajectoryLength += lstep;
 }
 
+Vector3d Candidate::interpolatePosition(double f) const {
+	// cubic Hermite basis, tangents of the length of the step
+	double f2 = f * f, f3 = f2 * f;
+	double h00 = 2 * f3 - 3 * f2 + 1;
+	double h10 = f3 - 2 * f2 + f;
+	double h01 = -2 * f3 + 3 * f2;
+	double h11 = f3 - f2;
+	return previous.getPosition() * h00 + current.getPosition() * h01
+			+ (previous.getDirection() * h10 + current.getDirection() * h11) * currentStep;
+}
+
+void Candidate::interpolateStep(double f) {
+	if ((f >= 1) or (f < 0))
+		return;
+	// derivative of the Hermite interpolation
+	double f2 = f * f;
+	Vector3d tangent = (previous.getPosition() - current.getPosition()) * (6 * f2 - 6 * f)
+			+ (previous.getDirection() * (3 * f2 - 4 * f + 1)
+			+ current.getDirection() * (3 * f2 - 2 * f)) * currentStep;
+	Vector3d position = interpolatePosition(f);
+	double E0 = previous.getEnergy();
+	double E = E0 + f * (current.getEnergy() - E0);
+
+	current.setPosition(position);
+	if (tangent.getR2() > 0)
+		current.setDirection(tangent / tangent.getR());
+	current.setEnergy(E);
+	trajectoryLength -= (1 - f) * currentStep;
+	currentStep *= f;
+}
+
+// step bids of the thread; checked only while some thread attributes them
+namespace {
+std::atomic<int> stepBidsThreads(0);
+thread_local Candidate::StepBids *stepBids = 0;
+
+inline void noteStepBid() {
+	if (stepBidsThreads.load(std::memory_order_relaxed) > 0 and stepBids)
+		stepBids->winner = stepBids->bidder;
+}
+}
+
 void Candidate::setNextStep(double step) {
 	nextStep = step;
+	noteStepBid();
 }
 
 void Candidate::limitNextStep(double step) {
-	nextStep = std::min(nextStep, step);
+	if (step < nextStep) {
+		nextStep = step;
+		noteStepBid();
+	}
+}
+
+Candidate::StepBids *Candidate::setStepBids(StepBids *bids) {
+	StepBids *previous = stepBids;
+	if (bids and not previous)
+		stepBidsThreads++;
+	if (previous and not bids)
+		stepBidsThreads--;
+	stepBids = bids;
+	return previous;
+}
+
+// magnetic field of the step, see Candidate::getStepField
+namespace {
+struct StepField {
+	const Candidate *candidate;
+	const MagneticField *field;
+	Vector3d position;
+	double z;
+	Vector3d B;
+};
+thread_local StepField stepField = {0, 0, Vector3d(0.), 0, Vector3d(0.)};
+}
+
+bool Candidate::getStepField(const MagneticField *f, const Vector3d &position,
+		double z, Vector3d &B) const {
+	StepField &s = stepField;
+	if ((s.candidate != this) or (s.field != f) or (s.z != z)
+			or not (s.position == position))
+		return false;
+	B = s.B;
+	return true;
+}
+
+void Candidate::setStepField(const MagneticField *f, const Vector3d &position,
+		double z, const Vector3d &B) const {
+	StepField &s = stepField;
+	s.candidate = this;
+	s.field = f;
+	s.position = position;
+	s.z = z;
+	s.B = B;
+}
+
+void Candidate::clearStepField() {
+	stepField.candidate = 0;
+	stepField.field = 0;
 }
 
 void Candidate::setProperty(const std::string &name, const Variant &value) {
-	properties[name] = value;
+	PropertyKey key;
+	if (findPropertyKey(name, key))
+		setProperty(key, value);
+	else
+		properties[name] = value;
 }
 
-void Candidate::setTagOrigin (std::string tagOrigin) {
-	this -> tagOrigin  = tagOrigin ;
+void Candidate::setTagOrigin(const std::string &tagOrigin) {
+	this -> tagOrigin = getTagCode(tagOrigin);
 }
 
-std::string Candidate::getTagOrigin () const {
-	return tagOrigin ;
+const std::string &Candidate::getTagOrigin() const {
+	return getTagName(tagOrigin);
+}
+
+void Candidate::setTagOriginCode(uint32_t code) {
+	tagOrigin = code;
+}
+
+uint32_t Candidate::getTagOriginCode() const {
+	return tagOrigin;
 }
 
 const Variant &Candidate::getProperty(const std::string &name) const {
+	PropertyKey key;
+	if (findPropertyKey(name, key))
+		return getProperty(key);
 	PropertyMap::const_iterator i = properties.find(name);
 	if (i == properties.end())
 		throw std::runtime_error("Unknown candidate property: " + name);
@@ -118,6 +635,9 @@ const Variant &Candidate::getProperty(const std::string &name) const {
 }
 
 bool Candidate::removeProperty(const std::string& name) {
+	PropertyKey key;
+	if (findPropertyKey(name, key))
+		return removeProperty(key);
 	PropertyMap::iterator i = properties.find(name);
 	if (i == properties.end())
 		return false;
@@ -126,17 +646,185 @@ bool Candidate::removeProperty(const std::string& name) {
 }
 
 bool Candidate::hasProperty(const std::string &name) const {
+	PropertyKey key;
+	if (findPropertyKey(name, key))
+		return hasProperty(key);
 	PropertyMap::const_iterator i = properties.find(name);
 	if (i == properties.end())
 		return false;
 	return true;
 }
 
+PropertyKey Candidate::getPropertyKey(const std::string &name) {
+	return registerKey(propertyKeys(), propertyKeysMutex, name);
+}
+
+const std::string &Candidate::getPropertyName(PropertyKey key) {
+	const PropertyKeys *p = propertyKeys().load(std::memory_order_acquire);
+	if (key >= p->names.size())
+		throw std::runtime_error("Candidate: unknown property key");
+	return p->names[key];
+}
+
+std::vector<Variant> &Candidate::modifyPropertySlots() {
+	if (not propertySlots.valid()) {
+		propertySlots = new PropertySlots;
+	} else if (propertySlots->getReferenceCount() > 1) {
+		// shared with a clone
+		ref_ptr<PropertySlots> copy = new PropertySlots;
+		copy->values = propertySlots->values;
+		propertySlots = copy;
+	}
+	return propertySlots->values;
+}
+
+void Candidate::setProperty(PropertyKey key, const Variant &value) {
+	std::vector<Variant> &slots = modifyPropertySlots();
+	if (key >= slots.size())
+		slots.resize(key + 1);
+	slots[key] = value;
+	// the value may have been set by name before the key was registered
+	if (not properties.empty())
+		properties.erase(getPropertyName(key));
+}
+
+const Variant &Candidate::getProperty(PropertyKey key) const {
+	if (propertySlots.valid() and key < propertySlots->values.size()
+			and propertySlots->values[key].getType() != Variant::TYPE_NONE)
+		return propertySlots->values[key];
+	if (not properties.empty()) {
+		PropertyMap::const_iterator i = properties.find(getPropertyName(key));
+		if (i != properties.end())
+			return i->second;
+	}
+	throw std::runtime_error("Unknown candidate property: " + getPropertyName(key));
+}
+
+bool Candidate::removeProperty(PropertyKey key) {
+	bool removed = false;
+	if (propertySlots.valid() and key < propertySlots->values.size()
+			and propertySlots->values[key].getType() != Variant::TYPE_NONE) {
+		modifyPropertySlots()[key] = Variant();
+		removed = true;
+	}
+	if (not properties.empty())
+		removed = (properties.erase(getPropertyName(key)) > 0) or removed;
+	return removed;
+}
+
+bool Candidate::hasProperty(PropertyKey key) const {
+	if (propertySlots.valid() and key < propertySlots->values.size()
+			and propertySlots->values[key].getType() != Variant::TYPE_NONE)
+		return true;
+	if (not properties.empty())
+		return properties.find(getPropertyName(key)) != properties.end();
+	return false;
+}
+
+Candidate::PropertyMap Candidate::getProperties() const {
+	PropertyMap all = properties;
+	if (not propertySlots.valid())
+		return all;
+	const std::vector<Variant> &slots = propertySlots->values;
+	for (size_t i = 0; i < slots.size(); i++)
+		if (slots[i].getType() != Variant::TYPE_NONE)
+			all[getPropertyName(i)] = slots[i];
+	return all;
+}
+
 void Candidate::addSecondary(Candidate *c) {
 	secondaries.push_back(c);
 }
 
-void Candidate::addSecondary(int id, double energy, double w, std::string tagOrigin) {
+bool Candidate::dropSecondary(int id, double energy, double w) {
+	if (not isBelowSecondaryThreshold(id, energy))
+		return false;
+	if (droppedEnergyEnabled) {
+		double dropped = hasProperty(droppedEnergyKey) ? getProperty(droppedEnergyKey).toDouble() : 0;
+		setProperty(droppedEnergyKey, Variant::fromDouble(dropped + energy * w));
+	}
+	return true;
+}
+
+void Candidate::deferSecondary(int id, double energy, const Vector3d &position,
+		bool atPosition, double length, double w, uint32_t tagOrigin) {
+	deferredSecondaries.push_back(SecondaryRecord());
+	SecondaryRecord &r = deferredSecondaries.back();
+	r.current = current;
+	r.current.setId(id);
+	r.current.setEnergy(energy);
+	r.current.setPosition(position);
+	r.previous = previous;
+	r.weight = weight * w;
+	r.redshift = redshift;
+	r.trajectoryLength = length;
+	r.tag = tagOrigin;
+	r.atPosition = atPosition;
+	r.hasProperty = false;
+}
+
+bool Candidate::mergeSecondary(int id, double energy, const Vector3d &position,
+		bool atPosition, double length, double w, uint32_t tagOrigin) {
+	if (not (secondaryMerging > 0 and energy > 0))
+		return false;
+	double bin = floor(log10(energy) * secondaryMerging);
+	double W = weight * w;
+
+	// the secondaries of this step are at the end, they have the same previous state
+	if (deferSecondaries) {
+		for (size_t i = deferredSecondaries.size(); i-- > 0;) {
+			SecondaryRecord &r = deferredSecondaries[i];
+			if ((r.redshift != redshift) or not (r.previous.getPosition() == previous.getPosition()))
+				break;
+			if ((r.current.getId() != id) or (r.tag != tagOrigin)
+					or (floor(log10(r.current.getEnergy()) * secondaryMerging) != bin))
+				continue;
+			double total = r.weight + W;
+			r.current.setEnergy((r.current.getEnergy() * r.weight + energy * W) / total);
+			r.current.setPosition((r.current.getPosition() * r.weight + position * W) / total);
+			r.trajectoryLength = (r.trajectoryLength * r.weight + length * W) / total;
+			r.atPosition = r.atPosition or atPosition;
+			r.weight = total;
+			std::swap(r, deferredSecondaries.back());
+			return true;
+		}
+		return false;
+	}
+
+	for (size_t i = secondaries.size(); i-- > 0;) {
+		Candidate *c = secondaries[i];
+		if ((c->redshift != redshift) or not (c->previous.getPosition() == previous.getPosition())
+				or (c->parent != this))
+			break;
+		if ((c->current.getId() != id) or (c->tagOrigin != tagOrigin)
+				or (floor(log10(c->current.getEnergy()) * secondaryMerging) != bin))
+			continue;
+		double total = c->weight + W;
+		c->current.setEnergy((c->current.getEnergy() * c->weight + energy * W) / total);
+		c->current.setPosition((c->current.getPosition() * c->weight + position * W) / total);
+		c->trajectoryLength = (c->trajectoryLength * c->weight + length * W) / total;
+		if (atPosition or not (c->current.getPosition() == current.getPosition()))
+			c->created.setPosition(c->current.getPosition());
+		c->weight = total;
+		std::swap(secondaries[i], secondaries.back());
+		return true;
+	}
+	return false;
+}
+
+bool Candidate::addSecondary(int id, double energy, double w, const std::string &tagOrigin) {
+	return addSecondary(id, energy, w, getTagCode(tagOrigin));
+}
+
+bool Candidate::addSecondary(int id, double energy, double w, uint32_t tagOrigin) {
+	if (dropSecondary(id, energy, w))
+		return false;
+	if (mergeSecondary(id, energy, current.getPosition(), false, trajectoryLength, w, tagOrigin))
+		return true;
+	if (deferSecondaries) {
+		deferSecondary(id, energy, current.getPosition(), false, trajectoryLength, w, tagOrigin);
+		return true;
+	}
 	ref_ptr<Candidate> secondary = new Candidate;
 	secondary->setRedshift(redshift);
 	secondary->setTrajectoryLength(trajectoryLength);
@@ -148,14 +836,29 @@ void Candidate::addSecondary(int id, double energy, double w, std::string tagOri
 	secondary->current.setId(id);
 	secondary->current.setEnergy(energy);
 	secondary->parent = this;
-	secondary->setTagOrigin (tagOrigin);
+	secondary->tagOrigin = tagOrigin;
+	secondary->setThreadConfined(isThreadConfined());
 	secondaries.push_back(secondary);
+	return true;
+}
+
+bool Candidate::addSecondary(int id, double energy, Vector3d position, double w, const std::string &tagOrigin) {
+	return addSecondary(id, energy, position, w, getTagCode(tagOrigin));
 }
 
-void Candidate::addSecondary(int id, double energy, Vector3d position, double w, std::string tagOrigin) {
+bool Candidate::addSecondary(int id, double energy, const Vector3d &position, double w, uint32_t tagOrigin) {
+	if (dropSecondary(id, energy, w))
+		return false;
+	double length = trajectoryLength - (current.getPosition() - position).getR();
+	if (mergeSecondary(id, energy, position, true, length, w, tagOrigin))
+		return true;
+	if (deferSecondaries) {
+		deferSecondary(id, energy, position, true, length, w, tagOrigin);
+		return true;
+	}
 	ref_ptr<Candidate> secondary = new Candidate;
 	secondary->setRedshift(redshift);
-	secondary->setTrajectoryLength(trajectoryLength - (current.getPosition() - position).getR() );
+	secondary->setTrajectoryLength(length);
 	secondary->setWeight(weight * w);
 	secondary->source = source;
 	secondary->previous = previous;
@@ -166,12 +869,80 @@ void Candidate::addSecondary(int id, double energy, Vector3d position, double w,
 	secondary->current.setPosition(position);
 	secondary->created.setPosition(position);
 	secondary->parent = this;
-	secondary->setTagOrigin (tagOrigin);
+	secondary->tagOrigin = tagOrigin;
+	secondary->setThreadConfined(isThreadConfined());
 	secondaries.push_back(secondary);
+	return true;
+}
+
+void Candidate::setSecondaryProperty(PropertyKey key, double value) {
+	// created and merged secondaries are at the end
+	if (deferSecondaries) {
+		if (deferredSecondaries.empty())
+			throw std::runtime_error("Candidate: no secondary for the property");
+		SecondaryRecord &r = deferredSecondaries.back();
+		r.hasProperty = true;
+		r.propertyKey = key;
+		r.propertyValue = value;
+		return;
+	}
+	if (secondaries.empty())
+		throw std::runtime_error("Candidate: no secondary for the property");
+	secondaries.back()->setProperty(key, Variant(value));
 }
 
 void Candidate::clearSecondaries() {
 	secondaries.clear();
+	deferredSecondaries.clear();
+}
+
+void Candidate::setDeferSecondaries(bool defer) {
+	deferSecondaries = defer;
+}
+
+bool Candidate::getDeferSecondaries() {
+	return deferSecondaries;
+}
+
+ref_ptr<Candidate> Candidate::createSecondary(const SecondaryRecord &r) {
+	ref_ptr<Candidate> secondary = new Candidate;
+	secondary->setRedshift(r.redshift);
+	secondary->setTrajectoryLength(r.trajectoryLength);
+	secondary->setWeight(r.weight);
+	secondary->source = source;
+	secondary->previous = r.previous;
+	secondary->created = r.previous;
+	if (r.atPosition)
+		secondary->created.setPosition(r.current.getPosition());
+	secondary->current = r.current;
+	secondary->parent = this;
+	secondary->tagOrigin = r.tag;
+	secondary->setThreadConfined(isThreadConfined());
+	if (r.hasProperty)
+		secondary->setProperty(r.propertyKey, Variant(r.propertyValue));
+	return secondary;
+}
+
+void Candidate::materializeSecondaries() {
+	secondaries.reserve(secondaries.size() + deferredSecondaries.size());
+	for (size_t i = 0; i < deferredSecondaries.size(); i++)
+		secondaries.push_back(createSecondary(deferredSecondaries[i]));
+	deferredSecondaries.clear();
+}
+
+uint32_t Candidate::getTagCode(const std::string &tag) {
+	return registerKey(tagCodes(), tagCodesMutex, tag);
+}
+
+const std::string &Candidate::getTagName(uint32_t code) {
+	const PropertyKeys *p = tagCodes().load(std::memory_order_acquire);
+	if (code >= p->names.size())
+		throw std::runtime_error("Candidate: unknown tag code");
+	return p->names[code];
+}
+
+std::vector<std::string> Candidate::getTagNames() {
+	return tagCodes().load(std::memory_order_acquire)->names;
 }
 
 std::string Candidate::getDescription() const {
@@ -190,12 +961,14 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 	cloned->previous = previous;
 
 	cloned->properties = properties;
+	cloned->propertySlots = propertySlots;
 	cloned->active = active;
 	cloned->redshift = redshift;
 	cloned->weight = weight;
 	cloned->trajectoryLength = trajectoryLength;
 	cloned->currentStep = currentStep;
 	cloned->nextStep = nextStep;
+	cloned->setThreadConfined(isThreadConfined());
 	if (recursive) {
 		cloned->secondaries.reserve(secondaries.size());
 		for (size_t i = 0; i < secondaries.size(); i++) {
@@ -203,10 +976,174 @@ ref_ptr<Candidate> Candidate::clone(bool recursive) const {
 			s->parent = cloned;
 			cloned->secondaries.push_back(s);
 		}
+		cloned->deferredSecondaries = deferredSecondaries;
 	}
 	return cloned;
 }
 
+namespace {
+// bytes of pack, in the byte order of the machine
+template<typename T>
+void packValue(std::vector<char> &buffer, const T &value) {
+	const char *p = (const char *) &value;
+	buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+template<typename T>
+T unpackValue(const char *&p, const char *end) {
+	if (end - p < (ptrdiff_t) sizeof(T))
+		throw std::runtime_error("Candidate::unpack: buffer too short");
+	T value;
+	std::memcpy(&value, p, sizeof(T));
+	p += sizeof(T);
+	return value;
+}
+
+void packString(std::vector<char> &buffer, const std::string &s) {
+	packValue<uint32_t>(buffer, s.size());
+	buffer.insert(buffer.end(), s.begin(), s.end());
+}
+
+std::string unpackString(const char *&p, const char *end) {
+	uint32_t n = unpackValue<uint32_t>(p, end);
+	if (end - p < (ptrdiff_t) n)
+		throw std::runtime_error("Candidate::unpack: buffer too short");
+	std::string s(p, n);
+	p += n;
+	return s;
+}
+
+void packState(std::vector<char> &buffer, const ParticleState &state) {
+	packValue<int32_t>(buffer, state.getId());
+	packValue(buffer, state.getEnergy());
+	const Vector3d &x = state.getPosition(), &u = state.getDirection();
+	double v[6] = {x.x, x.y, x.z, u.x, u.y, u.z};
+	packValue(buffer, v);
+}
+
+ParticleState unpackState(const char *&p, const char *end) {
+	int32_t id = unpackValue<int32_t>(p, end);
+	double energy = unpackValue<double>(p, end);
+	double v[6];
+	for (int i = 0; i < 6; i++)
+		v[i] = unpackValue<double>(p, end);
+	return ParticleState(id, energy, Vector3d(v[0], v[1], v[2]),
+			Vector3d(v[3], v[4], v[5]));
+}
+
+Variant unpackVariant(uint32_t type, const char *&p, const char *end) {
+	switch (type) {
+	case Variant::TYPE_BOOL:
+		return Variant(unpackValue<bool>(p, end));
+	case Variant::TYPE_CHAR:
+		return Variant(unpackValue<char>(p, end));
+	case Variant::TYPE_UCHAR:
+		return Variant(unpackValue<unsigned char>(p, end));
+	case Variant::TYPE_INT16:
+		return Variant(unpackValue<int16_t>(p, end));
+	case Variant::TYPE_UINT16:
+		return Variant(unpackValue<uint16_t>(p, end));
+	case Variant::TYPE_INT32:
+		return Variant(unpackValue<int32_t>(p, end));
+	case Variant::TYPE_UINT32:
+		return Variant(unpackValue<uint32_t>(p, end));
+	case Variant::TYPE_INT64:
+		return Variant(unpackValue<int64_t>(p, end));
+	case Variant::TYPE_UINT64:
+		return Variant(unpackValue<uint64_t>(p, end));
+	case Variant::TYPE_FLOAT:
+		return Variant(unpackValue<float>(p, end));
+	case Variant::TYPE_DOUBLE:
+		return Variant(unpackValue<double>(p, end));
+	case Variant::TYPE_STRING:
+		return Variant(unpackString(p, end));
+	default:
+		throw std::runtime_error("Candidate::unpack: unknown property type");
+	}
+}
+} // namespace
+
+void Candidate::pack(std::vector<char> &buffer) const {
+	packValue(buffer, serialNumber);
+	packValue(buffer, getSourceSerialNumber());
+	packValue(buffer, getCreatedSerialNumber());
+	packValue(buffer, weight);
+	packValue(buffer, redshift);
+	packValue(buffer, trajectoryLength);
+	packValue(buffer, currentStep);
+	packValue(buffer, nextStep);
+	uint32_t flags = (active ? 1 : 0) | (source.isRetained() ? 2 : 0)
+			| (created.isRetained() ? 4 : 0);
+	packValue(buffer, flags);
+	packString(buffer, getTagOrigin());
+	if (source.isRetained())
+		packState(buffer, source);
+	if (created.isRetained())
+		packState(buffer, created);
+	packState(buffer, previous);
+	packState(buffer, current);
+
+	PropertyMap all = getProperties();
+	packValue<uint32_t>(buffer, all.size());
+	for (PropertyMap::const_iterator i = all.begin(); i != all.end(); ++i) {
+		packString(buffer, i->first);
+		Variant value = i->second;
+		packValue<uint32_t>(buffer, value.getType());
+		if (value.getType() == Variant::TYPE_STRING) {
+			packString(buffer, value.toString());
+		} else {
+			char data[8];
+			size_t n = value.copyToBuffer(data);
+			buffer.insert(buffer.end(), data, data + n);
+		}
+	}
+}
+
+ref_ptr<Candidate> Candidate::unpack(const char *&p, const char *end) {
+	uint64_t serial = unpackValue<uint64_t>(p, end);
+	uint64_t sourceSerial = unpackValue<uint64_t>(p, end);
+	uint64_t createdSerial = unpackValue<uint64_t>(p, end);
+	double w = unpackValue<double>(p, end);
+	double z = unpackValue<double>(p, end);
+	double length = unpackValue<double>(p, end);
+	double step = unpackValue<double>(p, end);
+	double next = unpackValue<double>(p, end);
+	uint32_t flags = unpackValue<uint32_t>(p, end);
+	std::string tag = unpackString(p, end);
+	ParticleState sourceState, createdState;
+	if (flags & 2)
+		sourceState = unpackState(p, end);
+	if (flags & 4)
+		createdState = unpackState(p, end);
+	ParticleState previousState = unpackState(p, end);
+	ParticleState currentState = unpackState(p, end);
+
+	ref_ptr<Candidate> c = new Candidate(currentState, serial);
+	if (flags & 2)
+		c->source = sourceState;
+	if (flags & 4)
+		c->created = createdState;
+	c->previous = previousState;
+	c->sourceSerialNumber = sourceSerial;
+	c->createdSerialNumber = createdSerial;
+	c->detached = true;
+	c->weight = w;
+	c->redshift = z;
+	c->trajectoryLength = length;
+	c->currentStep = step;
+	c->nextStep = next;
+	c->active = (flags & 1) != 0;
+	c->tagOrigin = getTagCode(tag);
+
+	uint32_t n = unpackValue<uint32_t>(p, end);
+	for (uint32_t i = 0; i < n; i++) {
+		std::string name = unpackString(p, end);
+		uint32_t type = unpackValue<uint32_t>(p, end);
+		c->setProperty(name, unpackVariant(type, p, end));
+	}
+	return c;
+}
+
 uint64_t Candidate::getSerialNumber() const {
 	return serialNumber;
 }
@@ -218,6 +1155,8 @@ void Candidate::setSerialNumber(const uint64_t snr) {
 uint64_t Candidate::getSourceSerialNumber() const {
 	if (parent)
 		return parent->getSourceSerialNumber();
+	else if (detached)
+		return sourceSerialNumber;
 	else
 		return serialNumber;
 }
@@ -225,19 +1164,235 @@ uint64_t Candidate::getSourceSerialNumber() const {
 uint64_t Candidate::getCreatedSerialNumber() const {
 	if (parent)
 		return parent->getSerialNumber();
+	else if (detached)
+		return createdSerialNumber;
 	else
 		return serialNumber;
 }
 
+void Candidate::makeShared() {
+	setThreadConfined(false);
+	for (size_t i = 0; i < secondaries.size(); i++)
+		secondaries[i]->makeShared();
+}
+
+void Candidate::detachParent() {
+	if (not parent)
+		return;
+	sourceSerialNumber = getSourceSerialNumber();
+	createdSerialNumber = getCreatedSerialNumber();
+	detached = true;
+	parent = 0;
+}
+
 void Candidate::setNextSerialNumber(uint64_t snr) {
 	nextSerialNumber = snr;
+	serialNumberGeneration++;
 }
 
 uint64_t Candidate::getNextSerialNumber() {
 	return nextSerialNumber;
 }
 
+uint64_t Candidate::reserveSerialNumbers(uint64_t n) {
+	// same numbering as the constructors for each of the n candidates
+	uint64_t first;
+#if defined(OPENMP_3_1)
+		#pragma omp atomic capture
+		{first = nextSerialNumber; nextSerialNumber += n;}
+#elif defined(__GNUC__)
+		{first = __sync_fetch_and_add(&nextSerialNumber, n) + 1;}
+#else
+		#pragma omp critical
+		{first = nextSerialNumber; nextSerialNumber += n;}
+#endif
+	return first;
+}
+
+uint64_t Candidate::newSerialNumber() {
+	if (serialNumberBlockSize == 1)
+		return reserveSerialNumbers(1);
+	SerialNumberBlock &block = serialNumberBlock;
+	uint64_t generation = serialNumberGeneration.load(std::memory_order_relaxed);
+	if ((block.next == block.end) or (block.generation != generation)) {
+		block.next = reserveSerialNumbers(serialNumberBlockSize);
+		block.end = block.next + serialNumberBlockSize;
+		block.generation = generation;
+	}
+	return block.next++;
+}
+
+void Candidate::setSerialNumberBlockSize(uint64_t size) {
+	if (size == 0)
+		throw std::runtime_error("Candidate: serial number block size must be at least 1");
+	serialNumberBlockSize = size;
+	serialNumberGeneration++;
+}
+
+uint64_t Candidate::getSerialNumberBlockSize() {
+	return serialNumberBlockSize;
+}
+
 uint64_t Candidate::nextSerialNumber = 0;
+uint64_t Candidate::serialNumberBlockSize = 1 << 16;
+
+void Candidate::setStateRetention(unsigned int states) {
+	stateRetention = states;
+}
+
+unsigned int Candidate::getStateRetention() {
+	return stateRetention;
+}
+
+unsigned int Candidate::stateRetention = Candidate::RetainAll;
+bool Candidate::deferSecondaries = false;
+
+void Candidate::setSecondaryThreshold(double energy) {
+	secondaryThreshold = energy;
+}
+
+void Candidate::setSecondaryThreshold(int id, double energy) {
+	secondaryThresholds[id] = energy;
+}
+
+double Candidate::getSecondaryThreshold(int id) {
+	std::map<int, double>::const_iterator i = secondaryThresholds.find(id);
+	return (i == secondaryThresholds.end()) ? secondaryThreshold : i->second;
+}
+
+void Candidate::clearSecondaryThresholds() {
+	secondaryThreshold = 0;
+	secondaryThresholds.clear();
+}
+
+bool Candidate::isBelowSecondaryThreshold(int id, double energy) {
+	if (secondaryThresholds.empty())
+		return energy < secondaryThreshold;
+	return energy < getSecondaryThreshold(id);
+}
+
+void Candidate::setDroppedEnergyProperty(const std::string &name) {
+	droppedEnergyEnabled = not name.empty();
+	if (droppedEnergyEnabled)
+		droppedEnergyKey = getPropertyKey(name);
+}
+
+void Candidate::setSecondaryMerging(double binsPerDecade) {
+	if (binsPerDecade < 0)
+		throw std::runtime_error("Candidate: negative number of merging bins");
+	secondaryMerging = binsPerDecade;
+}
+
+double Candidate::getSecondaryMerging() {
+	return secondaryMerging;
+}
+
+CandidateCost::CandidateCost() : steps(0), fieldEvaluations(0),
+		rejectedSteps(0), secondaries(0), time(0) {
+}
+
+CandidateCost &CandidateCost::operator+=(const CandidateCost &cost) {
+	steps += cost.steps;
+	fieldEvaluations += cost.fieldEvaluations;
+	rejectedSteps += cost.rejectedSteps;
+	secondaries += cost.secondaries;
+	time += cost.time;
+	return *this;
+}
+
+// keys of the cost properties, the own cost and that of the finished secondaries
+namespace {
+const char *costNames[10] = {"CostSteps", "CostFieldEvaluations",
+		"CostRejectedSteps", "CostSecondaries", "CostTime",
+		"SecondaryCostSteps", "SecondaryCostFieldEvaluations",
+		"SecondaryCostRejectedSteps", "SecondaryCostSecondaries",
+		"SecondaryCostTime"};
+
+struct CostKeys {
+	PropertyKey keys[10];
+	CostKeys() {
+		for (int i = 0; i < 10; i++)
+			keys[i] = Candidate::getPropertyKey(costNames[i]);
+	}
+};
+
+const PropertyKey *costKeys() {
+	static const CostKeys keys;
+	return keys.keys;
+}
+
+thread_local CandidateCost threadCost;
+}
+
+void Candidate::setCostAccounting(bool enable) {
+	if (enable)
+		costKeys();
+	costAccounting = enable;
+}
+
+bool Candidate::getCostAccounting() {
+	return costAccounting;
+}
+
+void Candidate::addThreadCost(uint64_t fieldEvaluations, uint64_t rejectedSteps) {
+	threadCost.fieldEvaluations += fieldEvaluations;
+	threadCost.rejectedSteps += rejectedSteps;
+}
+
+CandidateCost Candidate::takeThreadCost() {
+	CandidateCost cost = threadCost;
+	threadCost = CandidateCost();
+	return cost;
+}
+
+static CandidateCost readCost(const Candidate *candidate, const PropertyKey *keys) {
+	CandidateCost cost;
+	if (not candidate->hasProperty(keys[0]))
+		return cost;
+	cost.steps = candidate->getProperty(keys[0]).toUInt64();
+	cost.fieldEvaluations = candidate->getProperty(keys[1]).toUInt64();
+	cost.rejectedSteps = candidate->getProperty(keys[2]).toUInt64();
+	cost.secondaries = candidate->getProperty(keys[3]).toUInt64();
+	cost.time = candidate->getProperty(keys[4]).toDouble();
+	return cost;
+}
+
+static void writeCost(Candidate *candidate, const PropertyKey *keys, const CandidateCost &cost) {
+	candidate->setProperty(keys[0], Variant::fromUInt64(cost.steps));
+	candidate->setProperty(keys[1], Variant::fromUInt64(cost.fieldEvaluations));
+	candidate->setProperty(keys[2], Variant::fromUInt64(cost.rejectedSteps));
+	candidate->setProperty(keys[3], Variant::fromUInt64(cost.secondaries));
+	candidate->setProperty(keys[4], Variant::fromDouble(cost.time));
+}
+
+CandidateCost Candidate::getCost() const {
+	return readCost(this, costKeys());
+}
+
+void Candidate::addCost(const CandidateCost &cost) {
+	CandidateCost sum = getCost();
+	sum += cost;
+	writeCost(this, costKeys(), sum);
+}
+
+CandidateCost Candidate::getTreeCost() const {
+	CandidateCost cost = getCost();
+	cost += readCost(this, costKeys() + 5);
+	return cost;
+}
+
+void Candidate::addSecondaryCost(const CandidateCost &cost) {
+	CandidateCost sum = readCost(this, costKeys() + 5);
+	sum += cost;
+	writeCost(this, costKeys() + 5, sum);
+}
+
+double Candidate::secondaryThreshold = 0;
+std::map<int, double> Candidate::secondaryThresholds;
+bool Candidate::droppedEnergyEnabled = false;
+double Candidate::secondaryMerging = 0;
+bool Candidate::costAccounting = false;
+PropertyKey Candidate::droppedEnergyKey = 0;
 
 void Candidate::restart() {
 	setActive(true);
@@ -246,4 +1401,13 @@ void Candidate::restart() {
 	current = source;
 }
 
+size_t Candidate::getSizeOf() const {
+	size_t size = sizeof(*this) + sizeof(secondaries[0]) * secondaries.capacity()
+			+ sizeof(deferredSecondaries[0]) * deferredSecondaries.capacity()
+			+ sizeof(PropertyMap::value_type) * properties.size();
+	if (propertySlots.valid())
+		size += sizeof(PropertySlots) + sizeof(Variant) * propertySlots->values.capacity();
+	return size;
+}
+
 } // namespace crpropa
@@ -0,0 +1,291 @@
+#include "crpropa/CandidateStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crpropa {
+
+const char candidateStreamMagic[8] = {'C', 'R', 'P', 'C', 'A', 'N', '0', '1'};
+const char candidateStreamEndMagic[8] = {'C', 'R', 'P', 'C', 'A', 'N', 'E', 'N'};
+
+namespace {
+
+ParticleState decodeState(const CandidateStreamState &s) {
+	return ParticleState(s.id, s.energy,
+			Vector3d(s.position[0], s.position[1], s.position[2]),
+			Vector3d(s.direction[0], s.direction[1], s.direction[2]));
+}
+
+Variant decodeValue(const CandidateStreamValue &v) {
+	switch (v.type) {
+	case Variant::TYPE_BOOL: {
+		bool b;
+		memcpy(&b, v.data, sizeof(b));
+		return Variant(b);
+	}
+	case Variant::TYPE_CHAR: {
+		char c;
+		memcpy(&c, v.data, sizeof(c));
+		return Variant(c);
+	}
+	case Variant::TYPE_UCHAR: {
+		unsigned char c;
+		memcpy(&c, v.data, sizeof(c));
+		return Variant(c);
+	}
+	case Variant::TYPE_INT16: {
+		int16_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_UINT16: {
+		uint16_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_INT32: {
+		int32_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_UINT32: {
+		uint32_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_INT64: {
+		int64_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_UINT64: {
+		uint64_t i;
+		memcpy(&i, v.data, sizeof(i));
+		return Variant(i);
+	}
+	case Variant::TYPE_FLOAT: {
+		float f;
+		memcpy(&f, v.data, sizeof(f));
+		return Variant(f);
+	}
+	case Variant::TYPE_DOUBLE: {
+		double d;
+		memcpy(&d, v.data, sizeof(d));
+		return Variant(d);
+	}
+	default:
+		throw std::runtime_error("SourceFromFile: unknown property type");
+	}
+}
+
+// reads the strings (uint32 length and characters) at p, up to end
+const char *readString(const char *p, const char *end, std::string &s) {
+	uint32_t n;
+	if (end - p < (ptrdiff_t) sizeof(n))
+		return 0;
+	memcpy(&n, p, sizeof(n));
+	p += sizeof(n);
+	if (end - p < (ptrdiff_t) n)
+		return 0;
+	s.assign(p, n);
+	return p + n;
+}
+
+} // namespace
+
+struct SourceFromFile::File {
+	std::string filename;
+	void *mapping;
+	size_t mappingSize;
+	const char *records;
+	size_t recordSize;
+	size_t count;
+	std::vector<PropertyKey> keys; ///< of the properties of the records
+	std::vector<std::string> tags;
+
+	File(const std::string &filename) : filename(filename), mapping(0), mappingSize(0) {
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("SourceFromFile: cannot open " + filename);
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) != 0) {
+			::close(fd);
+			throw std::runtime_error("SourceFromFile: cannot read " + filename);
+		}
+		mappingSize = fileStat.st_size;
+		if (mappingSize > 0)
+			mapping = mmap(0, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED or mapping == 0) {
+			mapping = 0;
+			throw std::runtime_error("SourceFromFile: cannot map " + filename);
+		}
+		try {
+			parse();
+		} catch (...) {
+			munmap(mapping, mappingSize);
+			throw;
+		}
+		// the records are read once, mostly in order
+		madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+	}
+
+	~File() {
+		if (mapping)
+			munmap(mapping, mappingSize);
+	}
+
+	void parse() {
+		const char *begin = (const char *) mapping;
+		const char *end = begin + mappingSize;
+		const std::string invalid = "SourceFromFile: not a candidate stream file: " + filename;
+		if (mappingSize < 16 or memcmp(begin, candidateStreamMagic, 8) != 0)
+			throw std::runtime_error(invalid);
+		if (mappingSize < 40 or memcmp(end - 8, candidateStreamEndMagic, 8) != 0)
+			throw std::runtime_error("SourceFromFile: incomplete file (not closed?): " + filename);
+
+		uint32_t nProperties;
+		memcpy(&nProperties, begin + 8, sizeof(nProperties));
+		const char *p = begin + 16;
+		for (uint32_t i = 0; i < nProperties; i++) {
+			std::string name;
+			p = readString(p, end, name);
+			if (p == 0)
+				throw std::runtime_error(invalid);
+			keys.push_back(Candidate::getPropertyKey(name));
+		}
+		size_t offset = p - begin;
+		records = begin + (offset + 7) / 8 * 8;
+		recordSize = sizeof(CandidateStreamRecord)
+				+ nProperties * sizeof(CandidateStreamValue);
+
+		uint64_t footer, n;
+		memcpy(&footer, end - 16, sizeof(footer));
+		memcpy(&n, end - 24, sizeof(n));
+		if (footer > mappingSize - 24 or begin + footer < records
+				or (begin + footer - records) != n * recordSize)
+			throw std::runtime_error(invalid);
+		count = n;
+
+		p = begin + footer;
+		uint32_t nTags;
+		if (end - 24 - p < (ptrdiff_t) sizeof(nTags))
+			throw std::runtime_error(invalid);
+		memcpy(&nTags, p, sizeof(nTags));
+		p += sizeof(nTags);
+		tags.resize(nTags);
+		for (uint32_t i = 0; i < nTags; i++) {
+			p = readString(p, end - 24, tags[i]);
+			if (p == 0)
+				throw std::runtime_error(invalid);
+		}
+	}
+};
+
+SourceFromFile::SourceFromFile() : firsts(1, 0), next(0) {
+}
+
+SourceFromFile::SourceFromFile(const std::string &filename) : firsts(1, 0), next(0) {
+	add(filename);
+}
+
+SourceFromFile::~SourceFromFile() {
+	for (size_t i = 0; i < files.size(); i++)
+		delete files[i];
+}
+
+void SourceFromFile::add(const std::string &filename) {
+	File *file = new File(filename);
+	files.push_back(file);
+	firsts.push_back(firsts.back() + file->count);
+}
+
+ref_ptr<Candidate> SourceFromFile::read(size_t i) const {
+	// file with firsts[f] <= i < firsts[f + 1]
+	size_t f = std::upper_bound(firsts.begin(), firsts.end(), i) - firsts.begin() - 1;
+	const File *file = files[f];
+	const char *p = file->records + (i - firsts[f]) * file->recordSize;
+	CandidateStreamRecord r;
+	memcpy(&r, p, sizeof(r));
+
+	ref_ptr<Candidate> c = new Candidate(decodeState(r.current));
+	if (r.flags & CandidateStreamRecord::SourceRetained)
+		c->source = decodeState(r.source);
+	if (r.flags & CandidateStreamRecord::CreatedRetained)
+		c->created = decodeState(r.created);
+	c->previous = decodeState(r.previous);
+	c->setWeight(r.weight);
+	c->setRedshift(r.redshift);
+	c->setTrajectoryLength(r.trajectoryLength);
+	if (r.tag >= file->tags.size())
+		throw std::runtime_error("SourceFromFile: unknown tag in " + file->filename);
+	c->setTagOrigin(file->tags[r.tag]);
+
+	p += sizeof(r);
+	for (size_t k = 0; k < file->keys.size(); k++, p += sizeof(CandidateStreamValue)) {
+		CandidateStreamValue v;
+		memcpy(&v, p, sizeof(v));
+		if (v.type != Variant::TYPE_NONE)
+			c->setProperty(file->keys[k], decodeValue(v));
+	}
+	return c;
+}
+
+// index of the first of n candidates taken by the calling thread
+static size_t take(size_t &next, size_t n) {
+	size_t first;
+#if defined(OPENMP_3_1)
+		#pragma omp atomic capture
+		{first = next; next += n;}
+#elif defined(__GNUC__)
+		{first = __sync_fetch_and_add(&next, n);}
+#else
+		#pragma omp critical(SourceFromFile)
+		{first = next; next += n;}
+#endif
+	return first;
+}
+
+ref_ptr<Candidate> SourceFromFile::getCandidate() const {
+	size_t i = take(next, 1);
+	if (i >= getCount())
+		throw std::runtime_error("SourceFromFile: no more candidates");
+	return read(i);
+}
+
+void SourceFromFile::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+	size_t first = take(next, n);
+	out.reserve(out.size() + n);
+	for (size_t i = first; i < first + n; i++)
+		out.push_back(i < getCount() ? read(i) : ref_ptr<Candidate>());
+}
+
+size_t SourceFromFile::getCount() const {
+	return firsts.back();
+}
+
+size_t SourceFromFile::getPosition() const {
+	return std::min(next, getCount());
+}
+
+void SourceFromFile::rewind() {
+	next = 0;
+}
+
+std::string SourceFromFile::getDescription() const {
+	std::stringstream ss;
+	ss << "SourceFromFile: " << getCount() << " candidates from";
+	for (size_t i = 0; i < files.size(); i++)
+		ss << " " << files[i]->filename;
+	ss << "\n";
+	return ss.str();
+}
+
+} // namespace crpropa
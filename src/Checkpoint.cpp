@@ -0,0 +1,146 @@
+#include "crpropa/Checkpoint.h"
+#include "crpropa/Random.h"
+
+#include "kiss/logger.h"
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace crpropa {
+
+// output positions of the checkpoint loaded last, by filename
+static std::map<std::string, std::pair<size_t, size_t> > restartOutputs;
+
+Checkpoint::Checkpoint(const std::string &filename, size_t interval) :
+		filename(filename), interval(interval), restart(false), seed(0),
+		nextPrimary(0) {
+	if (interval == 0)
+		throw std::runtime_error("Checkpoint: interval must be > 0");
+	restart = load();
+	if (Random::useStreams() and not restart)
+		seed = Random::getStreamsSeed();
+	else if (not restart)
+		seed = Random::instance().randInt64();
+}
+
+bool Checkpoint::load() {
+	std::ifstream in(filename.c_str());
+	if (not in.good())
+		return false;
+
+	restartOutputs.clear();
+	bool complete = false, completed = false;
+	std::string line;
+	while (std::getline(in, line)) {
+		std::stringstream ss(line);
+		std::string key;
+		ss >> key;
+		if (key == "seed") {
+			ss >> seed;
+		} else if (key == "next") {
+			ss >> nextPrimary;
+		} else if (key == "output") {
+			size_t offset, count;
+			std::string name;
+			ss >> offset >> count;
+			ss.ignore(1);
+			std::getline(ss, name);
+			restartOutputs[name] = std::make_pair(offset, count);
+		} else if (key == "completed") {
+			completed = true;
+		} else if (key == "end") {
+			complete = true;
+		}
+	}
+	if (not complete)
+		throw std::runtime_error("Checkpoint: incomplete checkpoint file " + filename);
+
+	if (completed) {
+		// the run has finished, a new one starts from the beginning
+		KISS_LOG_INFO << "Checkpoint: the run of " << filename << " was completed, starting a new run";
+		restartOutputs.clear();
+		seed = 0;
+		nextPrimary = 0;
+		return false;
+	}
+
+	KISS_LOG_INFO << "Checkpoint: restart from " << filename << " at primary " << nextPrimary;
+	return true;
+}
+
+void Checkpoint::add(Output *output) {
+	// fails early for outputs that do not support checkpoints
+	std::string name;
+	output->checkpoint(name);
+	outputs.push_back(output);
+}
+
+void Checkpoint::setInterval(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("Checkpoint: interval must be > 0");
+	interval = n;
+}
+
+size_t Checkpoint::getInterval() const {
+	return interval;
+}
+
+bool Checkpoint::isRestart() const {
+	return restart;
+}
+
+size_t Checkpoint::getNextPrimary() const {
+	return nextPrimary;
+}
+
+uint64_t Checkpoint::getSeed() const {
+	return seed;
+}
+
+void Checkpoint::begin() {
+	Random::seedStreams(seed);
+}
+
+void Checkpoint::save(size_t next, bool completed) {
+	nextPrimary = next;
+
+	// write to a temporary file first, so that an interruption while
+	// writing leaves the previous checkpoint intact
+	std::stringstream tmpname;
+	tmpname << filename << ".tmp" << getpid();
+	std::ofstream out(tmpname.str().c_str());
+	out << "# CRPropa checkpoint\n";
+	out << "seed " << seed << "\n";
+	out << "next " << nextPrimary << "\n";
+	for (size_t i = 0; i < outputs.size(); i++) {
+		std::string name;
+		size_t offset = outputs[i]->checkpoint(name);
+		out << "output " << offset << " " << outputs[i]->size() << " " << name << "\n";
+	}
+	if (completed)
+		out << "completed\n";
+	out << "end\n";
+	out.close();
+
+	if (not out or rename(tmpname.str().c_str(), filename.c_str()) != 0) {
+		remove(tmpname.str().c_str());
+		throw std::runtime_error("Checkpoint: cannot write " + filename);
+	}
+}
+
+bool Checkpoint::getRestart(const std::string &filename, size_t &offset, size_t &count) {
+	std::map<std::string, std::pair<size_t, size_t> >::const_iterator i =
+			restartOutputs.find(filename);
+	if (i == restartOutputs.end() or i->second.first == 0)
+		return false;
+	offset = i->second.first;
+	count = i->second.second;
+	return true;
+}
+
+} // namespace crpropa
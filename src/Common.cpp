@@ -9,11 +9,34 @@
 #include <cmath>
 #include <algorithm>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
 #define index(i,j) ((j)+(i)*Y.size())
 
 namespace crpropa {
 
+static std::vector<std::string> &extraDataPaths() {
+	static std::vector<std::string> paths;
+	return paths;
+}
+
+void addDataPath(const std::string &path) {
+	std::vector<std::string> &paths = extraDataPaths();
+	if (std::find(paths.begin(), paths.end(), path) == paths.end())
+		paths.push_back(path);
+}
+
 std::string getDataPath(std::string filename) {
+	// the most recently added directory that contains the file
+	const std::vector<std::string> &paths = extraDataPaths();
+	for (size_t i = paths.size(); i > 0; i--) {
+		std::string path = concat_path(paths[i - 1], filename);
+		if (std::ifstream(path.c_str()).good())
+			return path;
+	}
+
 	static std::string dataPath;
 	if (dataPath.size())
 		return concat_path(dataPath, filename);
@@ -65,6 +88,21 @@ std::string getInstallPrefix()
   return _path;
 };
 
+size_t getPeakResidentMemory() {
+#if defined(__unix__) || defined(__APPLE__)
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#if defined(__APPLE__)
+	return usage.ru_maxrss; // bytes
+#else
+	return usage.ru_maxrss * size_t(1024); // kilobytes
+#endif
+#else
+	return 0;
+#endif
+}
+
 double interpolate(double x, const std::vector<double> &X,
 		const std::vector<double> &Y) {
 	std::vector<double>::const_iterator it = std::upper_bound(X.begin(),
@@ -0,0 +1,240 @@
+#include "crpropa/CompressedGrid.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace crpropa {
+
+uint16_t floatToHalf(float f) {
+	#if defined(HAVE_SIMD) && defined(__F16C__)
+	return _cvtss_sh(f, 0);
+	#else
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t e = (x >> 23) & 0xff;
+	uint32_t mantissa = x & 0x7fffff;
+	if (e == 0xff) // infinity and NaN
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	int exponent = int(e) - 127 + 15;
+	if (exponent >= 31) // overflow
+		return sign | 0x7c00;
+	if (exponent <= 0) { // subnormal or zero
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t h = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if ((rest > halfway) or ((rest == halfway) and (h & 1)))
+			h++;
+		return sign | h;
+	}
+	uint32_t h = sign | (exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	if ((rest > 0x1000) or ((rest == 0x1000) and (h & 1)))
+		h++; // a carry into the exponent is the correct rounding
+	return h;
+	#endif // HAVE_SIMD && __F16C__
+}
+
+float halfToFloat(uint16_t h) {
+	#if defined(HAVE_SIMD) && defined(__F16C__)
+	return _cvtsh_ss(h);
+	#else
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	if (exponent == 0) { // subnormal or zero
+		float f = std::ldexp(float(mantissa), -24);
+		return sign ? -f : f;
+	}
+	uint32_t x;
+	if (exponent == 31)
+		x = sign | 0x7f800000 | (mantissa << 13);
+	else
+		x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+	#endif // HAVE_SIMD && __F16C__
+}
+
+CompressedGrid3f::CompressedGrid3f(const Grid3f &grid, gridEncoding encoding) :
+		Nx(grid.getNx()), Ny(grid.getNy()), Nz(grid.getNz()),
+		origin(grid.getOrigin()), spacing(grid.getSpacing()),
+		reflective(grid.isReflective()), ipolType(TRILINEAR), encoding(encoding) {
+	if ((encoding != FLOAT16) and (encoding != QUANTIZED_INT16))
+		throw std::runtime_error("CompressedGrid3f: unknown encoding");
+	gridOrigin = origin + spacing / 2;
+	size_t nBricksX = (Nx + 7) / 8;
+	nBricksY = (Ny + 7) / 8;
+	nBricksZ = (Nz + 7) / 8;
+	size_t nBricks = nBricksX * nBricksY * nBricksZ;
+	values.assign(3 * 512 * nBricks + 1, 0); // one half of padding for the F16C decoding
+	scales.assign(nBricks, 0);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t b = 0; b < nBricks; b++) {
+		size_t x0 = (b / (nBricksY * nBricksZ)) * 8;
+		size_t y0 = ((b / nBricksZ) % nBricksY) * 8;
+		size_t z0 = (b % nBricksZ) * 8;
+		size_t x1 = std::min(x0 + 8, Nx), y1 = std::min(y0 + 8, Ny), z1 = std::min(z0 + 8, Nz);
+
+		float largest = 0;
+		for (size_t ix = x0; ix < x1; ix++)
+			for (size_t iy = y0; iy < y1; iy++)
+				for (size_t iz = z0; iz < z1; iz++) {
+					const Vector3f &v = grid.get(ix, iy, iz);
+					largest = std::max(largest, std::max(std::fabs(v.x), std::max(std::fabs(v.y), std::fabs(v.z))));
+				}
+		if (largest == 0)
+			continue; // zeros
+
+		float norm = (encoding == QUANTIZED_INT16) ? 32767 / largest : 1 / largest;
+		scales[b] = 1 / norm;
+		for (size_t ix = x0; ix < x1; ix++)
+			for (size_t iy = y0; iy < y1; iy++)
+				for (size_t iz = z0; iz < z1; iz++) {
+					size_t brick, i;
+					locate(ix, iy, iz, brick, i);
+					Vector3f v = grid.get(ix, iy, iz) * norm;
+					float c[3] = {v.x, v.y, v.z};
+					for (int k = 0; k < 3; k++) {
+						if (encoding == QUANTIZED_INT16)
+							values[i + k] = uint16_t(int16_t(std::max(-32767.f, std::min(32767.f, float(round(c[k]))))));
+						else
+							values[i + k] = floatToHalf(c[k]);
+					}
+				}
+	}
+}
+
+Vector3f CompressedGrid3f::interpolate(const Vector3d &position) const {
+	if (ipolType == TRICUBIC)
+		return tricubicInterpolate(position);
+	else if (ipolType == NEAREST_NEIGHBOUR)
+		return closestValue(position);
+	else
+		return trilinearInterpolate(position);
+}
+
+void CompressedGrid3f::setReflective(bool b) {
+	reflective = b;
+}
+
+void CompressedGrid3f::setInterpolationType(interpolationType i) {
+	if ((i != TRILINEAR) and (i != TRICUBIC) and (i != NEAREST_NEIGHBOUR))
+		throw std::runtime_error("InterpolationType: unknown interpolation type");
+	ipolType = i;
+}
+
+Vector3d CompressedGrid3f::getOrigin() const {
+	return origin;
+}
+
+Vector3d CompressedGrid3f::getSpacing() const {
+	return spacing;
+}
+
+size_t CompressedGrid3f::getNx() const {
+	return Nx;
+}
+
+size_t CompressedGrid3f::getNy() const {
+	return Ny;
+}
+
+size_t CompressedGrid3f::getNz() const {
+	return Nz;
+}
+
+bool CompressedGrid3f::isReflective() const {
+	return reflective;
+}
+
+gridEncoding CompressedGrid3f::getEncoding() const {
+	return encoding;
+}
+
+size_t CompressedGrid3f::getSizeOf() const {
+	return sizeof(*this) + sizeof(values[0]) * values.size() + sizeof(scales[0]) * scales.size();
+}
+
+Vector3f CompressedGrid3f::closestValue(const Vector3d &position) const {
+	// as Grid::closestValue
+	Vector3d r = (position - gridOrigin) / spacing;
+	int ix, iy, iz;
+	if (reflective) {
+		ix = reflectiveBoundary(round(r.x), Nx);
+		iy = reflectiveBoundary(round(r.y), Ny);
+		iz = reflectiveBoundary(round(r.z), Nz);
+	} else {
+		ix = round(fmod(r.x, Nx));
+		iy = round(fmod(r.y, Ny));
+		iz = round(fmod(r.z, Nz));
+		ix = (ix + Nx * (ix < 0)) % Nx;
+		iy = (iy + Ny * (iy < 0)) % Ny;
+		iz = (iz + Nz * (iz < 0)) % Nz;
+	}
+	return get(ix, iy, iz);
+}
+
+Vector3f CompressedGrid3f::trilinearInterpolate(const Vector3d &position) const {
+	// as Grid::trilinearInterpolate
+	Vector3d r = (position - gridOrigin) / spacing;
+	int iX0, iX1, iY0, iY1, iZ0, iZ1;
+	double resX, resY, resZ, fX0, fY0, fZ0;
+	if (reflective) {
+		reflectiveClamp(r.x, Nx, iX0, iX1, resX);
+		reflectiveClamp(r.y, Ny, iY0, iY1, resY);
+		reflectiveClamp(r.z, Nz, iZ0, iZ1, resZ);
+		fX0 = resX - floor(resX);
+		fY0 = resY - floor(resY);
+		fZ0 = resZ - floor(resZ);
+	} else {
+		periodicClamp(r.x, Nx, iX0, iX1);
+		periodicClamp(r.y, Ny, iY0, iY1);
+		periodicClamp(r.z, Nz, iZ0, iZ1);
+		fX0 = r.x - floor(r.x);
+		fY0 = r.y - floor(r.y);
+		fZ0 = r.z - floor(r.z);
+	}
+	double fX1 = 1 - fX0;
+	double fY1 = 1 - fY0;
+	double fZ1 = 1 - fZ0;
+
+	Vector3f b(0.);
+	b += get(iX0, iY0, iZ0) * fX1 * fY1 * fZ1;
+	b += get(iX1, iY0, iZ0) * fX0 * fY1 * fZ1;
+	b += get(iX0, iY1, iZ0) * fX1 * fY0 * fZ1;
+	b += get(iX0, iY0, iZ1) * fX1 * fY1 * fZ0;
+	b += get(iX1, iY0, iZ1) * fX0 * fY1 * fZ0;
+	b += get(iX0, iY1, iZ1) * fX1 * fY0 * fZ0;
+	b += get(iX1, iY1, iZ0) * fX0 * fY0 * fZ1;
+	b += get(iX1, iY1, iZ1) * fX0 * fY0 * fZ0;
+	return b;
+}
+
+Vector3f CompressedGrid3f::tricubicInterpolate(const Vector3d &position) const {
+	// Catmull-Rom weights as Grid::tricubicInterpolate
+	Vector3d r = (position - gridOrigin) / spacing;
+	size_t iX[4], iY[4], iZ[4];
+	double wX[4], wY[4], wZ[4];
+	cubicStencil(r.x, Nx, reflective, iX, wX);
+	cubicStencil(r.y, Ny, reflective, iY, wY);
+	cubicStencil(r.z, Nz, reflective, iZ, wZ);
+
+	Vector3f result(0.);
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			float wXY = wX[i] * wY[j];
+			for (int k = 0; k < 4; k++)
+				result += get(iX[i], iY[j], iZ[k]) * (wXY * float(wZ[k]));
+		}
+	return result;
+}
+
+} // namespace crpropa
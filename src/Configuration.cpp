@@ -0,0 +1,1382 @@
+#include "crpropa/Configuration.h"
+#include "crpropa/Common.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/magneticField/PT11Field.h"
+#include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
+#include "crpropa/module/Boundary.h"
+#include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/module/EMPairProduction.h"
+#include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/module/HDF5Output.h"
+#include "crpropa/module/NuclearDecay.h"
+#include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationDP.h"
+#include "crpropa/module/PropagationGuidingCenter.h"
+#include "crpropa/module/PropagationHandoff.h"
+#include "crpropa/module/PropagationJump.h"
+#include "crpropa/module/Redshift.h"
+#include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/SynchrotronRadiation.h"
+#include "crpropa/module/TextOutput.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+/** Recursive descent parser of JSON with '#' comments */
+class ConfigParser {
+	const std::string &text;
+	size_t pos;
+	size_t line;
+
+	void error(const std::string &message) const {
+		std::stringstream ss;
+		ss << "ConfigValue: line " << line << ": " << message;
+		throw std::runtime_error(ss.str());
+	}
+
+	void skipSpace() {
+		while (pos < text.size()) {
+			char c = text[pos];
+			if (c == '\n') {
+				line++;
+				pos++;
+			} else if (c == ' ' or c == '\t' or c == '\r') {
+				pos++;
+			} else if (c == '#') {
+				while (pos < text.size() and text[pos] != '\n')
+					pos++;
+			} else {
+				break;
+			}
+		}
+	}
+
+	void expect(char c) {
+		skipSpace();
+		if (pos >= text.size() or text[pos] != c)
+			error(std::string("expected '") + c + "'");
+		pos++;
+	}
+
+	bool literal(const char *word) {
+		size_t n = std::char_traits<char>::length(word);
+		if (text.compare(pos, n, word) != 0)
+			return false;
+		pos += n;
+		return true;
+	}
+
+	static void appendUtf8(std::string &s, unsigned long code) {
+		if (code < 0x80) {
+			s += char(code);
+		} else if (code < 0x800) {
+			s += char(0xC0 | (code >> 6));
+			s += char(0x80 | (code & 0x3F));
+		} else if (code < 0x10000) {
+			s += char(0xE0 | (code >> 12));
+			s += char(0x80 | ((code >> 6) & 0x3F));
+			s += char(0x80 | (code & 0x3F));
+		} else {
+			s += char(0xF0 | (code >> 18));
+			s += char(0x80 | ((code >> 12) & 0x3F));
+			s += char(0x80 | ((code >> 6) & 0x3F));
+			s += char(0x80 | (code & 0x3F));
+		}
+	}
+
+	/** Four hex digits after \u, without sign or spaces as strtoul takes */
+	unsigned long parseHex4() {
+		if (pos + 4 > text.size())
+			error("invalid unicode escape");
+		unsigned long code = 0;
+		for (size_t i = 0; i < 4; i++) {
+			char c = text[pos + i];
+			if (not std::isxdigit((unsigned char) c))
+				error("invalid unicode escape");
+			code = code * 16 + (std::isdigit((unsigned char) c) ?
+					c - '0' : std::tolower((unsigned char) c) - 'a' + 10);
+		}
+		pos += 4;
+		return code;
+	}
+
+	/** Skip the digits at pos, returns false if there are none */
+	bool skipDigits() {
+		size_t start = pos;
+		while (pos < text.size() and std::isdigit((unsigned char) text[pos]))
+			pos++;
+		return pos > start;
+	}
+
+	std::string parseString() {
+		expect('"');
+		std::string s;
+		while (true) {
+			if (pos >= text.size())
+				error("unterminated string");
+			char c = text[pos++];
+			if (c == '"')
+				return s;
+			if (c == '\n')
+				error("line break in string");
+			if (c != '\\') {
+				s += c;
+				continue;
+			}
+			if (pos >= text.size())
+				error("unterminated string");
+			c = text[pos++];
+			switch (c) {
+			case '"': s += '"'; break;
+			case '\\': s += '\\'; break;
+			case '/': s += '/'; break;
+			case 'b': s += '\b'; break;
+			case 'f': s += '\f'; break;
+			case 'n': s += '\n'; break;
+			case 'r': s += '\r'; break;
+			case 't': s += '\t'; break;
+			case 'u': {
+				unsigned long code = parseHex4();
+				if (code >= 0xDC00 and code <= 0xDFFF)
+					error("unpaired surrogate in unicode escape");
+				if (code >= 0xD800 and code <= 0xDBFF) {
+					// UTF-16 pair of a code point above U+FFFF
+					if (text.compare(pos, 2, "\\u") != 0)
+						error("unpaired surrogate in unicode escape");
+					pos += 2;
+					unsigned long low = parseHex4();
+					if (low < 0xDC00 or low > 0xDFFF)
+						error("unpaired surrogate in unicode escape");
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				appendUtf8(s, code);
+				break;
+			}
+			default:
+				error(std::string("invalid escape '\\") + c + "'");
+			}
+		}
+	}
+
+public:
+	ConfigParser(const std::string &text) : text(text), pos(0), line(1) {
+	}
+
+	ConfigValue parseValue(const std::string &path) {
+		skipSpace();
+		if (pos >= text.size())
+			error("unexpected end of input");
+		ConfigValue v;
+		v.path = path;
+		char c = text[pos];
+		if (c == '{') {
+			pos++;
+			v.type = ConfigValue::Object;
+			skipSpace();
+			if (pos < text.size() and text[pos] == '}') {
+				pos++;
+				return v;
+			}
+			while (true) {
+				skipSpace();
+				std::string key = parseString();
+				if (v.has(key))
+					error("duplicate key '" + key + "'");
+				expect(':');
+				v.keys.push_back(key);
+				v.elements.push_back(parseValue(path.empty() ? key : path + "." + key));
+				skipSpace();
+				if (pos < text.size() and text[pos] == ',') {
+					pos++;
+					continue;
+				}
+				expect('}');
+				return v;
+			}
+		}
+		if (c == '[') {
+			pos++;
+			v.type = ConfigValue::Array;
+			skipSpace();
+			if (pos < text.size() and text[pos] == ']') {
+				pos++;
+				return v;
+			}
+			while (true) {
+				std::stringstream p;
+				p << path << "[" << v.elements.size() << "]";
+				v.elements.push_back(parseValue(p.str()));
+				skipSpace();
+				if (pos < text.size() and text[pos] == ',') {
+					pos++;
+					continue;
+				}
+				expect(']');
+				return v;
+			}
+		}
+		if (c == '"') {
+			v.type = ConfigValue::String;
+			v.string = parseString();
+			return v;
+		}
+		if (literal("true")) {
+			v.type = ConfigValue::Bool;
+			v.boolean = true;
+			return v;
+		}
+		if (literal("false")) {
+			v.type = ConfigValue::Bool;
+			v.boolean = false;
+			return v;
+		}
+		if (literal("null"))
+			return v;
+
+		// number of the JSON grammar, strtod alone also takes inf, nan and hex
+		size_t begin = pos;
+		if (text[pos] == '-')
+			pos++;
+		if (pos < text.size() and text[pos] == '0')
+			pos++;
+		else if (not skipDigits()) {
+			pos = begin;
+			error(std::string("unexpected character '") + c + "'");
+		}
+		if (pos < text.size() and text[pos] == '.') {
+			pos++;
+			if (not skipDigits())
+				error("invalid number");
+		}
+		if (pos < text.size() and (text[pos] == 'e' or text[pos] == 'E')) {
+			pos++;
+			if (pos < text.size() and (text[pos] == '+' or text[pos] == '-'))
+				pos++;
+			if (not skipDigits())
+				error("invalid number");
+		}
+		std::string number = text.substr(begin, pos - begin);
+		v.number = std::strtod(number.c_str(), NULL);
+		if (not std::isfinite(v.number))
+			error("number out of range: " + number);
+		v.type = ConfigValue::Number;
+		return v;
+	}
+
+	ConfigValue parseDocument() {
+		ConfigValue v = parseValue("");
+		skipSpace();
+		if (pos < text.size())
+			error("unexpected characters after the end of the document");
+		return v;
+	}
+};
+
+ConfigValue::ConfigValue() :
+		type(Null), boolean(false), number(0) {
+}
+
+ConfigValue ConfigValue::parse(const std::string &text) {
+	ConfigParser parser(text);
+	return parser.parseDocument();
+}
+
+ConfigValue ConfigValue::load(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	if (not in.good())
+		throw std::runtime_error("ConfigValue: could not open file " + filename);
+	std::stringstream ss;
+	ss << in.rdbuf();
+	try {
+		return parse(ss.str());
+	} catch (std::runtime_error &e) {
+		throw std::runtime_error(filename + ": " + e.what());
+	}
+}
+
+/** JSON string with the escapes of ConfigParser::parseString */
+static void writeString(std::ostream &out, const std::string &s) {
+	out << '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		switch (c) {
+		case '"': out << "\\\""; break;
+		case '\\': out << "\\\\"; break;
+		case '\b': out << "\\b"; break;
+		case '\f': out << "\\f"; break;
+		case '\n': out << "\\n"; break;
+		case '\r': out << "\\r"; break;
+		case '\t': out << "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char hex[8];
+				snprintf(hex, sizeof(hex), "\\u%04x", c);
+				out << hex;
+			} else
+				out << c;
+		}
+	}
+	out << '"';
+}
+
+static void writeValue(std::ostream &out, const ConfigValue &v) {
+	switch (v.getType()) {
+	case ConfigValue::Null:
+		out << "null";
+		break;
+	case ConfigValue::Bool:
+		out << (v.asBool() ? "true" : "false");
+		break;
+	case ConfigValue::Number:
+		// JSON has no inf or nan
+		if (not std::isfinite(v.asDouble()))
+			v.error("not a finite number");
+		out << v.asDouble();
+		break;
+	case ConfigValue::String:
+		writeString(out, v.asString());
+		break;
+	case ConfigValue::Array:
+		out << '[';
+		for (size_t i = 0; i < v.size(); i++) {
+			if (i > 0)
+				out << ", ";
+			writeValue(out, v[i]);
+		}
+		out << ']';
+		break;
+	case ConfigValue::Object:
+		out << '{';
+		for (size_t i = 0; i < v.size(); i++) {
+			if (i > 0)
+				out << ", ";
+			writeString(out, v.getKeys()[i]);
+			out << ": ";
+			writeValue(out, v[v.getKeys()[i]]);
+		}
+		out << '}';
+		break;
+	}
+}
+
+std::string ConfigValue::toJSON() const {
+	std::ostringstream out;
+	out.precision(17);
+	writeValue(out, *this);
+	return out.str();
+}
+
+void ConfigValue::error(const std::string &message) const {
+	if (path.empty())
+		throw std::runtime_error("ConfigValue: " + message);
+	throw std::runtime_error("ConfigValue: " + path + ": " + message);
+}
+
+ConfigValue::Type ConfigValue::getType() const {
+	return type;
+}
+
+bool ConfigValue::isNull() const {
+	return type == Null;
+}
+
+bool ConfigValue::isArray() const {
+	return type == Array;
+}
+
+bool ConfigValue::isObject() const {
+	return type == Object;
+}
+
+const std::string &ConfigValue::getPath() const {
+	return path;
+}
+
+size_t ConfigValue::size() const {
+	return elements.size();
+}
+
+bool ConfigValue::has(const std::string &key) const {
+	if (type != Object)
+		return false;
+	for (size_t i = 0; i < keys.size(); i++)
+		if (keys[i] == key)
+			return true;
+	return false;
+}
+
+const ConfigValue &ConfigValue::operator[](const std::string &key) const {
+	if (type != Object)
+		error("expected an object with the key '" + key + "'");
+	for (size_t i = 0; i < keys.size(); i++)
+		if (keys[i] == key)
+			return elements[i];
+	error("missing key '" + key + "'");
+	return *this;
+}
+
+const ConfigValue &ConfigValue::operator[](size_t i) const {
+	if (type != Array)
+		error("expected an array");
+	if (i >= elements.size())
+		error("index out of range");
+	return elements[i];
+}
+
+const std::vector<std::string> &ConfigValue::getKeys() const {
+	return keys;
+}
+
+bool ConfigValue::asBool() const {
+	if (type != Bool)
+		error("expected true or false");
+	return boolean;
+}
+
+double ConfigValue::asDouble() const {
+	if (type == Number)
+		return number;
+	if (type != String)
+		error("expected a number");
+
+	// number followed by units, e.g. "10 EeV" or "1 * kpc"
+	std::stringstream ss(string);
+	double value;
+	if (not (ss >> value))
+		error("expected a number with a unit, got '" + string + "'");
+	std::string token;
+	while (ss >> token) {
+		if (token == "*")
+			continue;
+		try {
+			value *= unit(token);
+		} catch (std::runtime_error &e) {
+			error(e.what());
+		}
+	}
+	return value;
+}
+
+int ConfigValue::asInt() const {
+	double value = asDouble();
+	if (value != std::floor(value))
+		error("expected an integer");
+	return int(value);
+}
+
+size_t ConfigValue::asSize() const {
+	double value = asDouble();
+	if (value < 0 or value != std::floor(value))
+		error("expected a non-negative integer");
+	return size_t(value);
+}
+
+std::string ConfigValue::asString() const {
+	if (type != String)
+		error("expected a string");
+	return string;
+}
+
+Vector3d ConfigValue::asVector3d() const {
+	if (type != Array or elements.size() != 3)
+		error("expected an array of three numbers");
+	return Vector3d(elements[0].asDouble(), elements[1].asDouble(), elements[2].asDouble());
+}
+
+bool ConfigValue::getBool(const std::string &key, bool defaultValue) const {
+	return has(key) ? (*this)[key].asBool() : defaultValue;
+}
+
+double ConfigValue::getDouble(const std::string &key, double defaultValue) const {
+	return has(key) ? (*this)[key].asDouble() : defaultValue;
+}
+
+int ConfigValue::getInt(const std::string &key, int defaultValue) const {
+	return has(key) ? (*this)[key].asInt() : defaultValue;
+}
+
+size_t ConfigValue::getSize(const std::string &key, size_t defaultValue) const {
+	return has(key) ? (*this)[key].asSize() : defaultValue;
+}
+
+std::string ConfigValue::getString(const std::string &key, const std::string &defaultValue) const {
+	return has(key) ? (*this)[key].asString() : defaultValue;
+}
+
+Vector3d ConfigValue::getVector3d(const std::string &key, const Vector3d &defaultValue) const {
+	return has(key) ? (*this)[key].asVector3d() : defaultValue;
+}
+
+double ConfigValue::unit(const std::string &name) {
+	static std::map<std::string, double> units;
+	if (units.empty()) {
+#define CRPROPA_CONFIG_UNIT(u) units[#u] = u;
+		CRPROPA_CONFIG_UNIT(meter) CRPROPA_CONFIG_UNIT(second) CRPROPA_CONFIG_UNIT(kilogram)
+		CRPROPA_CONFIG_UNIT(ampere) CRPROPA_CONFIG_UNIT(kelvin) CRPROPA_CONFIG_UNIT(joule)
+		CRPROPA_CONFIG_UNIT(tesla) CRPROPA_CONFIG_UNIT(volt) CRPROPA_CONFIG_UNIT(rad)
+		CRPROPA_CONFIG_UNIT(deg) CRPROPA_CONFIG_UNIT(gauss) CRPROPA_CONFIG_UNIT(microgauss)
+		CRPROPA_CONFIG_UNIT(nanogauss) CRPROPA_CONFIG_UNIT(muG) CRPROPA_CONFIG_UNIT(nG)
+		CRPROPA_CONFIG_UNIT(erg) CRPROPA_CONFIG_UNIT(eV) CRPROPA_CONFIG_UNIT(keV)
+		CRPROPA_CONFIG_UNIT(MeV) CRPROPA_CONFIG_UNIT(GeV) CRPROPA_CONFIG_UNIT(TeV)
+		CRPROPA_CONFIG_UNIT(PeV) CRPROPA_CONFIG_UNIT(EeV) CRPROPA_CONFIG_UNIT(au)
+		CRPROPA_CONFIG_UNIT(ly) CRPROPA_CONFIG_UNIT(parsec) CRPROPA_CONFIG_UNIT(pc)
+		CRPROPA_CONFIG_UNIT(kpc) CRPROPA_CONFIG_UNIT(Mpc) CRPROPA_CONFIG_UNIT(Gpc)
+		CRPROPA_CONFIG_UNIT(kilometer) CRPROPA_CONFIG_UNIT(km) CRPROPA_CONFIG_UNIT(centimeter)
+		CRPROPA_CONFIG_UNIT(cm) CRPROPA_CONFIG_UNIT(ns) CRPROPA_CONFIG_UNIT(mus)
+		CRPROPA_CONFIG_UNIT(ms) CRPROPA_CONFIG_UNIT(sec) CRPROPA_CONFIG_UNIT(minute)
+		CRPROPA_CONFIG_UNIT(hour) CRPROPA_CONFIG_UNIT(barn) CRPROPA_CONFIG_UNIT(ccm)
+#undef CRPROPA_CONFIG_UNIT
+	}
+	std::map<std::string, double>::const_iterator it = units.find(name);
+	if (it == units.end())
+		throw std::runtime_error("unknown unit '" + name + "'");
+	return it->second;
+}
+
+// ----------------------------------------------------------------------------
+// built-in factories, the parameters are named as in the constructors
+// ----------------------------------------------------------------------------
+
+// magnetic fields
+static MagneticField *createUniformMagneticField(const ConfigValue &c, SimulationConfig &s) {
+	return new UniformMagneticField(c["value"].asVector3d());
+}
+
+static MagneticField *createJF12Field(const ConfigValue &c, SimulationConfig &s) {
+	JF12Field *field = new JF12Field();
+	if (c.has("striatedSeed"))
+		field->randomStriated(c["striatedSeed"].asInt());
+	if (c.has("turbulentSeed")) {
+#ifdef CRPROPA_HAVE_FFTW3F
+		field->randomTurbulent(c["turbulentSeed"].asInt());
+#else
+		c["turbulentSeed"].error("the turbulent field requires FFTW3F");
+#endif
+	}
+	return field;
+}
+
+static MagneticField *createPT11Field(const ConfigValue &c, SimulationConfig &s) {
+	return new PT11Field();
+}
+
+static MagneticField *createMagneticFieldList(const ConfigValue &c, SimulationConfig &s) {
+	ref_ptr<MagneticFieldList> list = new MagneticFieldList();
+	const ConfigValue &fields = c["fields"];
+	for (size_t i = 0; i < fields.size(); i++)
+		list->addField(s.getField(fields[i]));
+	return list.release();
+}
+
+static MagneticField *createMagneticFieldGrid(const ConfigValue &c, SimulationConfig &s) {
+	if (not c.has("N"))
+		return new MagneticFieldGrid(c["file"].asString());
+	GridProperties properties(c.getVector3d("origin", Vector3d(0.)), c["N"].asSize(),
+			c["spacing"].asDouble());
+	ref_ptr<Grid3f> grid = new Grid3f(properties);
+	loadGrid(grid, c["file"].asString(), c.getDouble("conversion", 1));
+	return new MagneticFieldGrid(grid);
+}
+
+#ifdef CRPROPA_HAVE_FFTW3F
+static MagneticField *createSimpleGridTurbulence(const ConfigValue &c, SimulationConfig &s) {
+	SimpleTurbulenceSpectrum spectrum(c["Brms"].asDouble(), c["lMin"].asDouble(),
+			c["lMax"].asDouble(), c.getDouble("sIndex", 5. / 3));
+	GridProperties properties(c.getVector3d("origin", Vector3d(0.)), c["N"].asSize(),
+			c["spacing"].asDouble());
+	return new SimpleGridTurbulence(spectrum, properties, c.getInt("seed", 0));
+}
+#endif
+
+// source features
+static SourceFeature *createSourceParticleType(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceParticleType(c["id"].asInt());
+}
+
+static SourceFeature *createSourceMultipleParticleTypes(const ConfigValue &c, SimulationConfig &s) {
+	ref_ptr<SourceMultipleParticleTypes> feature = new SourceMultipleParticleTypes();
+	const ConfigValue &particles = c["particles"];
+	for (size_t i = 0; i < particles.size(); i++)
+		feature->add(particles[i]["id"].asInt(), particles[i].getDouble("weight", 1));
+	return feature.release();
+}
+
+static SourceFeature *createSourceEnergy(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceEnergy(c["energy"].asDouble());
+}
+
+static SourceFeature *createSourcePowerLawSpectrum(const ConfigValue &c, SimulationConfig &s) {
+	return new SourcePowerLawSpectrum(c["Emin"].asDouble(), c["Emax"].asDouble(),
+			c["index"].asDouble());
+}
+
+static SourceFeature *createSourceComposition(const ConfigValue &c, SimulationConfig &s) {
+	ref_ptr<SourceComposition> feature = new SourceComposition(c["Emin"].asDouble(),
+			c["Rmax"].asDouble(), c["index"].asDouble());
+	const ConfigValue &nuclei = c["nuclei"];
+	for (size_t i = 0; i < nuclei.size(); i++) {
+		const ConfigValue &n = nuclei[i];
+		if (n.has("id"))
+			feature->add(n["id"].asInt(), n["abundance"].asDouble());
+		else
+			feature->add(n["A"].asInt(), n["Z"].asInt(), n["abundance"].asDouble());
+	}
+	return feature.release();
+}
+
+static SourceFeature *createSourcePosition(const ConfigValue &c, SimulationConfig &s) {
+	const ConfigValue &position = c["position"];
+	if (position.isArray())
+		return new SourcePosition(position.asVector3d());
+	return new SourcePosition(position.asDouble());
+}
+
+static SourceFeature *createSourceUniform1D(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniform1D(c["minD"].asDouble(), c["maxD"].asDouble(),
+			c.getBool("withCosmology", true));
+}
+
+static SourceFeature *createSourceUniformSphere(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniformSphere(c["center"].asVector3d(), c["radius"].asDouble());
+}
+
+static SourceFeature *createSourceUniformShell(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniformShell(c["center"].asVector3d(), c["radius"].asDouble());
+}
+
+static SourceFeature *createSourceUniformBox(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniformBox(c["origin"].asVector3d(), c["size"].asVector3d());
+}
+
+static SourceFeature *createSourceUniformCylinder(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniformCylinder(c["origin"].asVector3d(), c["height"].asDouble(),
+			c["radius"].asDouble());
+}
+
+static SourceFeature *createSourceIsotropicEmission(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceIsotropicEmission();
+}
+
+static SourceFeature *createSourceDirection(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceDirection(c.getVector3d("direction", Vector3d(-1, 0, 0)));
+}
+
+static SourceFeature *createSourceEmissionCone(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceEmissionCone(c["direction"].asVector3d(), c["aperture"].asDouble());
+}
+
+static SourceFeature *createSourceDirectedEmission(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceDirectedEmission(c["mu"].asVector3d(), c["kappa"].asDouble());
+}
+
+static SourceFeature *createSourceRedshift(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceRedshift(c["z"].asDouble());
+}
+
+static SourceFeature *createSourceUniformRedshift(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceUniformRedshift(c["zmin"].asDouble(), c["zmax"].asDouble());
+}
+
+static SourceFeature *createSourceRedshiftEvolution(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceRedshiftEvolution(c["m"].asDouble(), c["zmin"].asDouble(),
+			c["zmax"].asDouble());
+}
+
+static SourceFeature *createSourceRedshift1D(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceRedshift1D();
+}
+
+static SourceFeature *createSourceTag(const ConfigValue &c, SimulationConfig &s) {
+	return new SourceTag(c["tag"].asString());
+}
+
+// observer features
+static ObserverFeature *createObserverDetectAll(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverDetectAll();
+}
+
+static ObserverFeature *createObserverPoint(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverPoint();
+}
+
+static ObserverFeature *createObserverSmallSphere(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverSmallSphere(c.getVector3d("center", Vector3d(0.)), c["radius"].asDouble());
+}
+
+static ObserverFeature *createObserverLargeSphere(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverLargeSphere(c.getVector3d("center", Vector3d(0.)), c["radius"].asDouble());
+}
+
+static ObserverFeature *createObserverTracking(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverTracking(c["center"].asVector3d(), c["radius"].asDouble(),
+			c.getDouble("stepSize", 0));
+}
+
+static ObserverFeature *createObserverMultiSurface(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverMultiSurface(c["cellSize"].asDouble(), c.getInt("maxRings", 2));
+}
+
+static ObserverFeature *createObserverRedshiftWindow(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverRedshiftWindow(c.getDouble("zmin", 0), c.getDouble("zmax", 0.1));
+}
+
+static ObserverFeature *createObserverTimeEvolution(const ConfigValue &c, SimulationConfig &s) {
+	if (c.has("max"))
+		return new ObserverTimeEvolution(c["min"].asDouble(), c["max"].asDouble(),
+				c["numb"].asDouble(), c.getBool("log", false));
+	return new ObserverTimeEvolution(c["min"].asDouble(), c["dist"].asDouble(),
+			c["numb"].asDouble());
+}
+
+static ObserverFeature *createObserverInactiveVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverInactiveVeto();
+}
+
+static ObserverFeature *createObserverNucleusVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverNucleusVeto();
+}
+
+static ObserverFeature *createObserverNeutrinoVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverNeutrinoVeto();
+}
+
+static ObserverFeature *createObserverPhotonVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverPhotonVeto();
+}
+
+static ObserverFeature *createObserverElectronVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverElectronVeto();
+}
+
+static ObserverFeature *createObserverParticleIdVeto(const ConfigValue &c, SimulationConfig &s) {
+	return new ObserverParticleIdVeto(c["id"].asInt());
+}
+
+// modules
+static ObserverFeature *createObserverFeature(const ConfigValue &c, SimulationConfig &s);
+
+static Module *createObserver(const ConfigValue &c, SimulationConfig &s) {
+	ref_ptr<Observer> observer = new Observer();
+	const ConfigValue &features = c["features"];
+	for (size_t i = 0; i < features.size(); i++)
+		observer->add(createObserverFeature(features[i], s));
+	if (c.has("output"))
+		observer->onDetection(s.getOutput(c["output"].asString()), c.getBool("clone", false));
+	if (c.has("deactivateOnDetection"))
+		observer->setDeactivateOnDetection(c["deactivateOnDetection"].asBool());
+	return observer.release();
+}
+
+static Module *createOutputModule(const ConfigValue &c, SimulationConfig &s) {
+	return s.getOutput(c["output"].asString()).release();
+}
+
+static Module *createSimplePropagation(const ConfigValue &c, SimulationConfig &s) {
+	return new SimplePropagation(c.getDouble("minStep", 0.1 * kpc), c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationCK(const ConfigValue &c, SimulationConfig &s) {
+	return new PropagationCK(s.getField(c["field"]), c.getDouble("tolerance", 1e-4),
+			c.getDouble("minStep", 0.1 * kpc), c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationBP(const ConfigValue &c, SimulationConfig &s) {
+	if (c.has("fixedStep"))
+		return new PropagationBP(s.getField(c["field"]), c["fixedStep"].asDouble());
+	return new PropagationBP(s.getField(c["field"]), c.getDouble("tolerance", 1e-4),
+			c.getDouble("minStep", 0.1 * kpc), c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationDP(const ConfigValue &c, SimulationConfig &s) {
+	return new PropagationDP(s.getField(c["field"]), c.getDouble("tolerance", 1e-4),
+			c.getDouble("minStep", 0.1 * kpc), c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationGuidingCenter(const ConfigValue &c, SimulationConfig &s) {
+	return new PropagationGuidingCenter(s.getField(c["field"]), c.getDouble("maxAdiabaticity", 0.01),
+			c.getDouble("tolerance", 1e-4), c.getDouble("minStep", 0.1 * kpc),
+			c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationHandoff(const ConfigValue &c, SimulationConfig &s) {
+	const ConfigValue &r = c["region"];
+	ref_ptr<Surface> region;
+	if (r.has("radius"))
+		region = new Sphere(r["center"].asVector3d(), r["radius"].asDouble());
+	else
+		region = new ParaxialBox(r["corner"].asVector3d(), r["size"].asVector3d());
+	ref_ptr<Module> propagation = s.createModule(c["propagation"]);
+	return new PropagationHandoff(propagation, region, c.getVector3d("observerCenter", Vector3d(0.)),
+			c["observerRadius"].asDouble(), c.getDouble("minStep", 0.1 * kpc),
+			c.getDouble("maxStep", 1 * Gpc));
+}
+
+static Module *createPropagationJump(const ConfigValue &c, SimulationConfig &s) {
+	ref_ptr<Module> propagation = s.createModule(c["propagation"]);
+	ref_ptr<PropagationJump> jump = new PropagationJump(propagation, c.getDouble("maxStep", 1 * Gpc));
+	if (c.has("particleIds")) {
+		const ConfigValue &ids = c["particleIds"];
+		for (size_t i = 0; i < ids.size(); i++)
+			jump->addParticleId(ids[i].asInt());
+	}
+	if (c.has("surfaces")) {
+		const ConfigValue &surfaces = c["surfaces"];
+		for (size_t i = 0; i < surfaces.size(); i++) {
+			const ConfigValue &r = surfaces[i];
+			if (r.has("radius"))
+				jump->addSurface(new Sphere(r["center"].asVector3d(), r["radius"].asDouble()));
+			else if (r.has("normal"))
+				jump->addSurface(new Plane(r["point"].asVector3d(), r["normal"].asVector3d()));
+			else
+				jump->addSurface(new ParaxialBox(r["corner"].asVector3d(), r["size"].asVector3d()));
+		}
+	}
+	return jump.release();
+}
+
+static Module *createRedshift(const ConfigValue &c, SimulationConfig &s) {
+	return new Redshift();
+}
+
+static Module *createMaximumTrajectoryLength(const ConfigValue &c, SimulationConfig &s) {
+	return new MaximumTrajectoryLength(c["length"].asDouble());
+}
+
+static Module *createMinimumEnergy(const ConfigValue &c, SimulationConfig &s) {
+	return new MinimumEnergy(c["minEnergy"].asDouble());
+}
+
+static Module *createMinimumRigidity(const ConfigValue &c, SimulationConfig &s) {
+	return new MinimumRigidity(c["minRigidity"].asDouble());
+}
+
+static Module *createMinimumRedshift(const ConfigValue &c, SimulationConfig &s) {
+	return new MinimumRedshift(c.getDouble("zmin", 0));
+}
+
+static Module *createMinimumChargeNumber(const ConfigValue &c, SimulationConfig &s) {
+	return new MinimumChargeNumber(c["minChargeNumber"].asInt());
+}
+
+static Module *createDetectionLength(const ConfigValue &c, SimulationConfig &s) {
+	return new DetectionLength(c["length"].asDouble());
+}
+
+static Module *createSphericalBoundary(const ConfigValue &c, SimulationConfig &s) {
+	return new SphericalBoundary(c["center"].asVector3d(), c["radius"].asDouble());
+}
+
+static Module *createCubicBoundary(const ConfigValue &c, SimulationConfig &s) {
+	return new CubicBoundary(c["origin"].asVector3d(), c["size"].asDouble());
+}
+
+static Module *createPeriodicBox(const ConfigValue &c, SimulationConfig &s) {
+	return new PeriodicBox(c["origin"].asVector3d(), c["size"].asVector3d());
+}
+
+static Module *createReflectiveBox(const ConfigValue &c, SimulationConfig &s) {
+	return new ReflectiveBox(c["origin"].asVector3d(), c["size"].asVector3d());
+}
+
+static Module *createPhotoPionProduction(const ConfigValue &c, SimulationConfig &s) {
+	return new PhotoPionProduction(s.getPhotonField(c["photonField"]),
+			c.getBool("photons", false), c.getBool("neutrinos", false),
+			c.getBool("electrons", false), c.getBool("antiNucleons", false),
+			c.getDouble("limit", 0.1), c.getBool("haveRedshiftDependence", false));
+}
+
+static Module *createElectronPairProduction(const ConfigValue &c, SimulationConfig &s) {
+	return new ElectronPairProduction(s.getPhotonField(c["photonField"]),
+			c.getBool("haveElectrons", false), c.getDouble("limit", 0.1));
+}
+
+static Module *createPhotoDisintegration(const ConfigValue &c, SimulationConfig &s) {
+	return new PhotoDisintegration(s.getPhotonField(c["photonField"]),
+			c.getBool("havePhotons", false), c.getDouble("limit", 0.1));
+}
+
+static Module *createNuclearDecay(const ConfigValue &c, SimulationConfig &s) {
+	return new NuclearDecay(c.getBool("electrons", false), c.getBool("photons", false),
+			c.getBool("neutrinos", false), c.getDouble("limit", 0.1));
+}
+
+static Module *createEMPairProduction(const ConfigValue &c, SimulationConfig &s) {
+	return new EMPairProduction(s.getPhotonField(c["photonField"]),
+			c.getBool("haveElectrons", false), c.getDouble("thinning", 0), c.getDouble("limit", 0.1));
+}
+
+static Module *createEMDoublePairProduction(const ConfigValue &c, SimulationConfig &s) {
+	return new EMDoublePairProduction(s.getPhotonField(c["photonField"]),
+			c.getBool("haveElectrons", false), c.getDouble("thinning", 0), c.getDouble("limit", 0.1));
+}
+
+static Module *createEMTripletPairProduction(const ConfigValue &c, SimulationConfig &s) {
+	return new EMTripletPairProduction(s.getPhotonField(c["photonField"]),
+			c.getBool("haveElectrons", false), c.getDouble("thinning", 0), c.getDouble("limit", 0.1));
+}
+
+static Module *createEMInverseComptonScattering(const ConfigValue &c, SimulationConfig &s) {
+	return new EMInverseComptonScattering(s.getPhotonField(c["photonField"]),
+			c.getBool("havePhotons", false), c.getDouble("thinning", 0), c.getDouble("limit", 0.1));
+}
+
+static Module *createSynchrotronRadiation(const ConfigValue &c, SimulationConfig &s) {
+	if (c.has("field"))
+		return new SynchrotronRadiation(s.getField(c["field"]), c.getBool("havePhotons", false),
+				c.getDouble("thinning", 0), c.getInt("nSamples", 0), c.getDouble("limit", 0.1));
+	return new SynchrotronRadiation(c.getDouble("Brms", 0), c.getBool("havePhotons", false),
+			c.getDouble("thinning", 0), c.getInt("nSamples", 0), c.getDouble("limit", 0.1));
+}
+
+// photon fields
+template <class T>
+static PhotonField *createPhotonField() {
+	return new T();
+}
+
+struct ConfigRegistry {
+	std::map<std::string, SimulationConfig::ModuleFactory> modules;
+	std::map<std::string, SimulationConfig::FieldFactory> fields;
+	std::map<std::string, SimulationConfig::SourceFeatureFactory> sourceFeatures;
+	std::map<std::string, SimulationConfig::ObserverFeatureFactory> observerFeatures;
+	std::map<std::string, SimulationConfig::PhotonFieldFactory> photonFields;
+
+	ConfigRegistry() {
+		fields["UniformMagneticField"] = createUniformMagneticField;
+		fields["JF12Field"] = createJF12Field;
+		fields["PT11Field"] = createPT11Field;
+		fields["MagneticFieldList"] = createMagneticFieldList;
+		fields["MagneticFieldGrid"] = createMagneticFieldGrid;
+#ifdef CRPROPA_HAVE_FFTW3F
+		fields["SimpleGridTurbulence"] = createSimpleGridTurbulence;
+#endif
+
+		sourceFeatures["SourceParticleType"] = createSourceParticleType;
+		sourceFeatures["SourceMultipleParticleTypes"] = createSourceMultipleParticleTypes;
+		sourceFeatures["SourceEnergy"] = createSourceEnergy;
+		sourceFeatures["SourcePowerLawSpectrum"] = createSourcePowerLawSpectrum;
+		sourceFeatures["SourceComposition"] = createSourceComposition;
+		sourceFeatures["SourcePosition"] = createSourcePosition;
+		sourceFeatures["SourceUniform1D"] = createSourceUniform1D;
+		sourceFeatures["SourceUniformSphere"] = createSourceUniformSphere;
+		sourceFeatures["SourceUniformShell"] = createSourceUniformShell;
+		sourceFeatures["SourceUniformBox"] = createSourceUniformBox;
+		sourceFeatures["SourceUniformCylinder"] = createSourceUniformCylinder;
+		sourceFeatures["SourceIsotropicEmission"] = createSourceIsotropicEmission;
+		sourceFeatures["SourceDirection"] = createSourceDirection;
+		sourceFeatures["SourceEmissionCone"] = createSourceEmissionCone;
+		sourceFeatures["SourceDirectedEmission"] = createSourceDirectedEmission;
+		sourceFeatures["SourceRedshift"] = createSourceRedshift;
+		sourceFeatures["SourceUniformRedshift"] = createSourceUniformRedshift;
+		sourceFeatures["SourceRedshiftEvolution"] = createSourceRedshiftEvolution;
+		sourceFeatures["SourceRedshift1D"] = createSourceRedshift1D;
+		sourceFeatures["SourceTag"] = createSourceTag;
+
+		observerFeatures["ObserverDetectAll"] = createObserverDetectAll;
+		observerFeatures["ObserverPoint"] = createObserverPoint;
+		observerFeatures["ObserverSmallSphere"] = createObserverSmallSphere;
+		observerFeatures["ObserverLargeSphere"] = createObserverLargeSphere;
+		observerFeatures["ObserverTracking"] = createObserverTracking;
+		observerFeatures["ObserverMultiSurface"] = createObserverMultiSurface;
+		observerFeatures["ObserverRedshiftWindow"] = createObserverRedshiftWindow;
+		observerFeatures["ObserverTimeEvolution"] = createObserverTimeEvolution;
+		observerFeatures["ObserverInactiveVeto"] = createObserverInactiveVeto;
+		observerFeatures["ObserverNucleusVeto"] = createObserverNucleusVeto;
+		observerFeatures["ObserverNeutrinoVeto"] = createObserverNeutrinoVeto;
+		observerFeatures["ObserverPhotonVeto"] = createObserverPhotonVeto;
+		observerFeatures["ObserverElectronVeto"] = createObserverElectronVeto;
+		observerFeatures["ObserverParticleIdVeto"] = createObserverParticleIdVeto;
+
+		modules["Observer"] = createObserver;
+		modules["Output"] = createOutputModule;
+		modules["SimplePropagation"] = createSimplePropagation;
+		modules["PropagationCK"] = createPropagationCK;
+		modules["PropagationDP"] = createPropagationDP;
+		modules["PropagationBP"] = createPropagationBP;
+		modules["PropagationGuidingCenter"] = createPropagationGuidingCenter;
+		modules["PropagationHandoff"] = createPropagationHandoff;
+		modules["PropagationJump"] = createPropagationJump;
+		modules["Redshift"] = createRedshift;
+		modules["MaximumTrajectoryLength"] = createMaximumTrajectoryLength;
+		modules["MinimumEnergy"] = createMinimumEnergy;
+		modules["MinimumRigidity"] = createMinimumRigidity;
+		modules["MinimumRedshift"] = createMinimumRedshift;
+		modules["MinimumChargeNumber"] = createMinimumChargeNumber;
+		modules["DetectionLength"] = createDetectionLength;
+		modules["SphericalBoundary"] = createSphericalBoundary;
+		modules["CubicBoundary"] = createCubicBoundary;
+		modules["PeriodicBox"] = createPeriodicBox;
+		modules["ReflectiveBox"] = createReflectiveBox;
+		modules["PhotoPionProduction"] = createPhotoPionProduction;
+		modules["ElectronPairProduction"] = createElectronPairProduction;
+		modules["PhotoDisintegration"] = createPhotoDisintegration;
+		modules["NuclearDecay"] = createNuclearDecay;
+		modules["EMPairProduction"] = createEMPairProduction;
+		modules["EMDoublePairProduction"] = createEMDoublePairProduction;
+		modules["EMTripletPairProduction"] = createEMTripletPairProduction;
+		modules["EMInverseComptonScattering"] = createEMInverseComptonScattering;
+		modules["SynchrotronRadiation"] = createSynchrotronRadiation;
+
+		photonFields["CMB"] = createPhotonField<CMB>;
+		photonFields["IRB_Kneiske04"] = createPhotonField<IRB_Kneiske04>;
+		photonFields["IRB_Stecker05"] = createPhotonField<IRB_Stecker05>;
+		photonFields["IRB_Franceschini08"] = createPhotonField<IRB_Franceschini08>;
+		photonFields["IRB_Finke10"] = createPhotonField<IRB_Finke10>;
+		photonFields["IRB_Dominguez11"] = createPhotonField<IRB_Dominguez11>;
+		photonFields["IRB_Gilmore12"] = createPhotonField<IRB_Gilmore12>;
+		photonFields["IRB_Stecker16_upper"] = createPhotonField<IRB_Stecker16_upper>;
+		photonFields["IRB_Stecker16_lower"] = createPhotonField<IRB_Stecker16_lower>;
+		photonFields["URB_Protheroe96"] = createPhotonField<URB_Protheroe96>;
+		photonFields["URB_Fixsen11"] = createPhotonField<URB_Fixsen11>;
+		photonFields["URB_Nitu21"] = createPhotonField<URB_Nitu21>;
+	}
+};
+
+static ConfigRegistry &registry() {
+	static ConfigRegistry r;
+	return r;
+}
+
+template <class Factory>
+static Factory findFactory(const std::map<std::string, Factory> &factories, const ConfigValue &c,
+		const std::string &kind) {
+	std::string type = c["type"].asString();
+	typename std::map<std::string, Factory>::const_iterator it = factories.find(type);
+	if (it == factories.end())
+		c["type"].error("unknown " + kind + " '" + type + "'");
+	return it->second;
+}
+
+static ObserverFeature *createObserverFeature(const ConfigValue &c, SimulationConfig &s) {
+	return findFactory(registry().observerFeatures, c, "observer feature")(c, s);
+}
+
+static Output::OutputType outputType(const ConfigValue &c) {
+	std::string name = c.asString();
+	if (name == "Trajectory1D")
+		return Output::Trajectory1D;
+	if (name == "Trajectory3D")
+		return Output::Trajectory3D;
+	if (name == "Event1D")
+		return Output::Event1D;
+	if (name == "Event3D")
+		return Output::Event3D;
+	if (name == "Everything")
+		return Output::Everything;
+	c.error("unknown output type '" + name + "'");
+	return Output::Everything;
+}
+
+static Output::OutputColumn outputColumn(const ConfigValue &c) {
+	static const char *names[] = {"TrajectoryLengthColumn", "ColumnDensityColumn",
+			"RedshiftColumn", "CurrentIdColumn", "CurrentEnergyColumn",
+			"CurrentPositionColumn", "CurrentDirectionColumn", "SourceIdColumn",
+			"SourceEnergyColumn", "SourcePositionColumn", "SourceDirectionColumn",
+			"CreatedIdColumn", "CreatedEnergyColumn", "CreatedPositionColumn",
+			"CreatedDirectionColumn", "CandidateTagColumn", "SerialNumberColumn",
+			"WeightColumn"};
+	std::string name = c.asString();
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (name == names[i])
+			return Output::OutputColumn(i);
+	c.error("unknown output column '" + name + "'");
+	return Output::WeightColumn;
+}
+
+// ----------------------------------------------------------------------------
+// SimulationConfig
+// ----------------------------------------------------------------------------
+
+SimulationConfig::SimulationConfig(const ConfigValue &config) :
+		config(config), count(0), recursive(true), secondariesFirst(false) {
+	build();
+}
+
+SimulationConfig::SimulationConfig(const std::string &filename) :
+		config(ConfigValue::load(filename)), count(0), recursive(true),
+		secondariesFirst(false) {
+	build();
+}
+
+void SimulationConfig::build() {
+	if (not config.isObject())
+		config.error("expected an object");
+	// the checkpoint has to exist before the outputs, which continue their files on a restart
+	buildSimulation(config["simulation"]);
+	if (config.has("fields"))
+		buildFields(config["fields"]);
+	if (config.has("outputs"))
+		buildOutputs(config["outputs"]);
+	buildSource(config["source"]);
+	buildModules(config["modules"]);
+}
+
+void SimulationConfig::buildSimulation(const ConfigValue &c) {
+	count = c["count"].asSize();
+	recursive = c.getBool("recursive", true);
+	secondariesFirst = c.getBool("secondariesFirst", false);
+
+	if (c.has("dataPath")) {
+		const ConfigValue &paths = c["dataPath"];
+		if (paths.isArray()) {
+			for (size_t i = 0; i < paths.size(); i++)
+				addDataPath(paths[i].asString());
+		} else {
+			addDataPath(paths.asString());
+		}
+	}
+
+	if (c.has("threads")) {
+#if _OPENMP
+		omp_set_num_threads(c["threads"].asInt());
+#endif
+	}
+
+	if (c.has("distributed")) {
+		const ConfigValue &d = c["distributed"];
+		distributed = new DistributedModuleList(d.getSize("chunkSize", 100));
+		if (c.has("seed"))
+			distributed->setSeed(c["seed"].asSize());
+		modules = distributed;
+	} else {
+		modules = new ModuleList();
+		if (c.has("seed"))
+			Random::seedThreads(c["seed"].asSize());
+	}
+
+	if (c.has("checkpoint")) {
+		const ConfigValue &cp = c["checkpoint"];
+		if (distributed.valid())
+			cp.error("checkpoints are not supported in distributed runs");
+		checkpoint = new Checkpoint(cp["file"].asString(), cp.getSize("interval", 100000));
+		modules->setCheckpoint(checkpoint);
+	}
+
+	modules->setShowProgress(c.getBool("showProgress", false));
+	modules->setSecondaryTasks(c.getBool("secondaryTasks", false));
+	modules->setStreamSecondaries(c.getBool("streamSecondaries", false));
+	if (c.has("sourceBatchSize"))
+		modules->setSourceBatchSize(c["sourceBatchSize"].asSize());
+}
+
+void SimulationConfig::buildFields(const ConfigValue &section) {
+	const std::vector<std::string> &names = section.getKeys();
+	for (size_t i = 0; i < names.size(); i++) {
+		const ConfigValue &c = section[names[i]];
+		fields[names[i]] = findFactory(registry().fields, c, "magnetic field")(c, *this);
+	}
+}
+
+void SimulationConfig::buildOutputs(const ConfigValue &section) {
+	const std::vector<std::string> &names = section.getKeys();
+	for (size_t i = 0; i < names.size(); i++) {
+		const ConfigValue &c = section[names[i]];
+		OutputEntry entry;
+		entry.type = c["type"].asString();
+		entry.filename = c["file"].asString();
+		std::string filename = entry.filename;
+		if (distributed.valid())
+			filename = DistributedModuleList::shardFilename(filename);
+		Output::OutputType type = c.has("columns") ? outputType(c["columns"]) : Output::Everything;
+
+		if (entry.type == "TextOutput")
+			entry.output = new TextOutput(filename, type);
+#ifdef CRPROPA_HAVE_HDF5
+		else if (entry.type == "HDF5Output")
+			entry.output = new HDF5Output(filename, type);
+#endif
+		else
+			c["type"].error("unknown output '" + entry.type + "'");
+
+		Output *output = entry.output;
+		if (c.has("energyScale"))
+			output->setEnergyScale(c["energyScale"].asDouble());
+		if (c.has("lengthScale"))
+			output->setLengthScale(c["lengthScale"].asDouble());
+		if (c.has("enable"))
+			for (size_t j = 0; j < c["enable"].size(); j++)
+				output->enable(outputColumn(c["enable"][j]));
+		if (c.has("disable"))
+			for (size_t j = 0; j < c["disable"].size(); j++)
+				output->disable(outputColumn(c["disable"][j]));
+		if (c.has("asynchronous"))
+			output->setAsynchronous(c["asynchronous"].asBool());
+		if (c.getBool("cost", false)) {
+			output->enableCost();
+			Candidate::setCostAccounting(true);
+		}
+		if (checkpoint.valid())
+			checkpoint->add(output);
+		outputs[names[i]] = entry;
+	}
+}
+
+void SimulationConfig::buildSource(const ConfigValue &section) {
+	source = new Source();
+	for (size_t i = 0; i < section.size(); i++) {
+		const ConfigValue &c = section[i];
+		source->add(findFactory(registry().sourceFeatures, c, "source feature")(c, *this));
+	}
+}
+
+void SimulationConfig::buildModules(const ConfigValue &section) {
+	for (size_t i = 0; i < section.size(); i++)
+		modules->add(createModule(section[i]));
+}
+
+ref_ptr<Module> SimulationConfig::createModule(const ConfigValue &c) {
+	ref_ptr<Module> module = findFactory(registry().modules, c, "module")(c, *this);
+	AbstractCondition *condition = dynamic_cast<AbstractCondition *>(module.get());
+	if (condition) {
+		if (c.has("onReject"))
+			condition->onReject(getOutput(c["onReject"].asString()));
+		if (c.has("onAccept"))
+			condition->onAccept(getOutput(c["onAccept"].asString()));
+		if (c.has("makeRejectedInactive"))
+			condition->setMakeRejectedInactive(c["makeRejectedInactive"].asBool());
+		if (c.has("makeAcceptedInactive"))
+			condition->setMakeAcceptedInactive(c["makeAcceptedInactive"].asBool());
+	}
+	return module;
+}
+
+ModuleList *SimulationConfig::getModuleList() const {
+	return modules;
+}
+
+Source *SimulationConfig::getSource() const {
+	return source;
+}
+
+Checkpoint *SimulationConfig::getCheckpoint() const {
+	return checkpoint;
+}
+
+size_t SimulationConfig::getCount() const {
+	return count;
+}
+
+bool SimulationConfig::isDistributed() const {
+	return distributed.valid();
+}
+
+const ConfigValue &SimulationConfig::getConfig() const {
+	return config;
+}
+
+ref_ptr<MagneticField> SimulationConfig::getField(const ConfigValue &value) {
+	if (value.isObject())
+		return findFactory(registry().fields, value, "magnetic field")(value, *this);
+	std::string name = value.asString();
+	std::map<std::string, ref_ptr<MagneticField> >::const_iterator it = fields.find(name);
+	if (it == fields.end())
+		value.error("unknown magnetic field '" + name + "'");
+	return it->second;
+}
+
+ref_ptr<Output> SimulationConfig::getOutput(const std::string &name) const {
+	std::map<std::string, OutputEntry>::const_iterator it = outputs.find(name);
+	if (it == outputs.end())
+		throw std::runtime_error("SimulationConfig: unknown output '" + name + "'");
+	return it->second.output;
+}
+
+ref_ptr<PhotonField> SimulationConfig::getPhotonField(const ConfigValue &value) const {
+	std::string name = value.asString();
+	std::map<std::string, PhotonFieldFactory>::const_iterator it = registry().photonFields.find(name);
+	if (it == registry().photonFields.end())
+		value.error("unknown photon field '" + name + "'");
+	return it->second();
+}
+
+void SimulationConfig::run() {
+	if (distributed.valid())
+		distributed->run(source, count, recursive, secondariesFirst);
+	else
+		modules->run(source, count, recursive, secondariesFirst);
+
+	std::map<std::string, OutputEntry>::iterator it;
+	for (it = outputs.begin(); it != outputs.end(); ++it) {
+		if (it->second.type == "TextOutput")
+			static_cast<TextOutput *>(it->second.output.get())->close();
+#ifdef CRPROPA_HAVE_HDF5
+		else if (it->second.type == "HDF5Output")
+			static_cast<HDF5Output *>(it->second.output.get())->close();
+#endif
+	}
+
+	if (not distributed.valid())
+		return;
+	for (it = outputs.begin(); it != outputs.end(); ++it) {
+		if (it->second.type == "TextOutput")
+			DistributedModuleList::mergeTextShards(it->second.filename);
+		else if (it->second.type == "HDF5Output")
+			DistributedModuleList::mergeHDF5Shards(it->second.filename);
+	}
+}
+
+void SimulationConfig::registerModule(const std::string &type, ModuleFactory factory) {
+	registry().modules[type] = factory;
+}
+
+void SimulationConfig::registerField(const std::string &type, FieldFactory factory) {
+	registry().fields[type] = factory;
+}
+
+void SimulationConfig::registerSourceFeature(const std::string &type, SourceFeatureFactory factory) {
+	registry().sourceFeatures[type] = factory;
+}
+
+void SimulationConfig::registerObserverFeature(const std::string &type, ObserverFeatureFactory factory) {
+	registry().observerFeatures[type] = factory;
+}
+
+void SimulationConfig::registerPhotonField(const std::string &type, PhotonFieldFactory factory) {
+	registry().photonFields[type] = factory;
+}
+
+template <class Factory>
+static std::vector<std::string> typeNames(const std::map<std::string, Factory> &factories) {
+	std::vector<std::string> names;
+	typename std::map<std::string, Factory>::const_iterator it;
+	for (it = factories.begin(); it != factories.end(); ++it)
+		names.push_back(it->first);
+	return names;
+}
+
+std::vector<std::string> SimulationConfig::getTypes(const std::string &kind) {
+	if (kind == "modules")
+		return typeNames(registry().modules);
+	if (kind == "fields")
+		return typeNames(registry().fields);
+	if (kind == "source")
+		return typeNames(registry().sourceFeatures);
+	if (kind == "observer")
+		return typeNames(registry().observerFeatures);
+	if (kind == "photonFields")
+		return typeNames(registry().photonFields);
+	throw std::runtime_error("SimulationConfig: unknown kind of types '" + kind + "'");
+}
+
+} // namespace crpropa
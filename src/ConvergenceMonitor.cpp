@@ -0,0 +1,268 @@
+#include "crpropa/ConvergenceMonitor.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+ConvergenceMonitor::ConvergenceMonitor(double targetUncertainty, size_t batchSize) :
+		minBatches(10), primaries(0) {
+	setTargetUncertainty(targetUncertainty);
+	setBatchSize(batchSize);
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadSums.resize(threads);
+	setDescription("ConvergenceMonitor");
+}
+
+size_t ConvergenceMonitor::addObservable(ObservableType type, double energyMin,
+		double energyMax, int order) {
+	if (getBatches() > 0)
+		throw std::runtime_error("ConvergenceMonitor: observables cannot be added after the first batch");
+	Observable o;
+	o.type = type;
+	o.energyMin = energyMin;
+	o.energyMax = energyMax;
+	o.order = order;
+	observables.push_back(o);
+	return observables.size() - 1;
+}
+
+size_t ConvergenceMonitor::addDetectionFraction() {
+	return addObservable(DetectionFraction, 0, 0, 0);
+}
+
+size_t ConvergenceMonitor::addSpectrumBin(double energyMin, double energyMax) {
+	if (not (energyMin < energyMax))
+		throw std::runtime_error("ConvergenceMonitor: invalid energy range");
+	return addObservable(SpectrumBin, energyMin, energyMax, 0);
+}
+
+size_t ConvergenceMonitor::addSpectrum(double energyMin, double energyMax, size_t nBins) {
+	if ((nBins == 0) or (energyMin <= 0) or not (energyMin < energyMax))
+		throw std::runtime_error("ConvergenceMonitor: invalid spectrum binning");
+	double dlE = log(energyMax / energyMin) / nBins;
+	size_t first = observables.size();
+	for (size_t i = 0; i < nBins; i++) {
+		double eMax = (i + 1 == nBins) ? energyMax : energyMin * exp((i + 1) * dlE);
+		addSpectrumBin(energyMin * exp(i * dlE), eMax);
+	}
+	return first;
+}
+
+size_t ConvergenceMonitor::addCompositionMoment(int order) {
+	if (order < 1)
+		throw std::runtime_error("ConvergenceMonitor: the order of a moment must be positive");
+	return addObservable(CompositionMoment, 0, 0, order);
+}
+
+void ConvergenceMonitor::setTargetUncertainty(double u) {
+	if (not (u > 0))
+		throw std::runtime_error("ConvergenceMonitor: the relative uncertainty must be positive");
+	targetUncertainty = u;
+}
+
+double ConvergenceMonitor::getTargetUncertainty() const {
+	return targetUncertainty;
+}
+
+void ConvergenceMonitor::setBatchSize(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("ConvergenceMonitor: the batch size must be positive");
+	batchSize = n;
+}
+
+size_t ConvergenceMonitor::getBatchSize() const {
+	return batchSize;
+}
+
+void ConvergenceMonitor::setMinBatches(size_t n) {
+	minBatches = std::max<size_t>(n, 2);
+}
+
+size_t ConvergenceMonitor::getMinBatches() const {
+	return minBatches;
+}
+
+void ConvergenceMonitor::record(Candidate *candidate, ThreadSums &t) const {
+	if (t.sums.size() < observables.size())
+		t.sums.resize(observables.size(), 0.);
+	double w = candidate->getWeight();
+	double E = candidate->current.getEnergy();
+	bool nucleus = candidate->current.isNucleus();
+	double lnA = nucleus ? log(double(candidate->current.getMassNumber())) : 0;
+	if (nucleus)
+		t.nucleusWeight += w;
+	for (size_t i = 0; i < observables.size(); i++) {
+		const Observable &o = observables[i];
+		switch (o.type) {
+		case DetectionFraction:
+			t.sums[i] += w;
+			break;
+		case SpectrumBin:
+			if ((E >= o.energyMin) and (E < o.energyMax))
+				t.sums[i] += w;
+			break;
+		case CompositionMoment:
+			if (nucleus)
+				t.sums[i] += w * pow(lnA, o.order);
+			break;
+		}
+	}
+}
+
+void ConvergenceMonitor::process(Candidate *candidate) const {
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid < threadSums.size()) {
+		record(candidate, threadSums[tid]);
+	} else {
+		// more threads than at construction
+#pragma omp critical(ConvergenceMonitor)
+		record(candidate, sharedSums);
+	}
+}
+
+void ConvergenceMonitor::endBatch(size_t n) {
+	std::vector<double> sums(observables.size(), 0.);
+	double nucleusWeight = 0;
+	for (size_t t = 0; t <= threadSums.size(); t++) {
+		ThreadSums &s = (t < threadSums.size()) ? threadSums[t] : sharedSums;
+		for (size_t i = 0; i < s.sums.size() and i < sums.size(); i++)
+			sums[i] += s.sums[i];
+		nucleusWeight += s.nucleusWeight;
+		s.sums.assign(s.sums.size(), 0.);
+		s.nucleusWeight = 0;
+	}
+	for (size_t i = 0; i < observables.size(); i++) {
+		Observable &o = observables[i];
+		o.numerator.push_back(sums[i]);
+		o.denominator.push_back((o.type == CompositionMoment) ? nucleusWeight : double(n));
+	}
+	primaries += n;
+}
+
+void ConvergenceMonitor::reset() {
+	for (size_t i = 0; i < observables.size(); i++) {
+		observables[i].numerator.clear();
+		observables[i].denominator.clear();
+	}
+	for (size_t t = 0; t < threadSums.size(); t++)
+		threadSums[t] = ThreadSums();
+	sharedSums = ThreadSums();
+	primaries = 0;
+}
+
+size_t ConvergenceMonitor::size() const {
+	return observables.size();
+}
+
+ConvergenceMonitor::ObservableType ConvergenceMonitor::getType(size_t i) const {
+	return observables.at(i).type;
+}
+
+double ConvergenceMonitor::getValue(size_t i) const {
+	const Observable &o = observables.at(i);
+	double num = 0, den = 0;
+	for (size_t b = 0; b < o.numerator.size(); b++) {
+		num += o.numerator[b];
+		den += o.denominator[b];
+	}
+	return (den > 0) ? num / den : 0;
+}
+
+double ConvergenceMonitor::getUncertainty(size_t i) const {
+	const Observable &o = observables.at(i);
+	size_t B = o.numerator.size();
+	if (B < 2)
+		return std::numeric_limits<double>::infinity();
+	// batch means of the ratio estimator: var(R) = B / (B - 1) sum (x_b - R y_b)^2 / (sum y_b)^2
+	double R = getValue(i);
+	double den = 0, sum = 0;
+	for (size_t b = 0; b < B; b++) {
+		double d = o.numerator[b] - R * o.denominator[b];
+		sum += d * d;
+		den += o.denominator[b];
+	}
+	if (den <= 0)
+		return std::numeric_limits<double>::infinity();
+	return sqrt(sum * B / (B - 1)) / den;
+}
+
+double ConvergenceMonitor::getRelativeUncertainty(size_t i) const {
+	double value = getValue(i);
+	if (value == 0)
+		return std::numeric_limits<double>::infinity();
+	return getUncertainty(i) / fabs(value);
+}
+
+size_t ConvergenceMonitor::getPrimaries() const {
+	return primaries;
+}
+
+size_t ConvergenceMonitor::getBatches() const {
+	return observables.empty() ? 0 : observables[0].numerator.size();
+}
+
+bool ConvergenceMonitor::isConverged() const {
+	if (observables.empty() or (getBatches() < minBatches))
+		return false;
+	for (size_t i = 0; i < observables.size(); i++)
+		if (not (getRelativeUncertainty(i) <= targetUncertainty))
+			return false;
+	return true;
+}
+
+size_t ConvergenceMonitor::getRemainingPrimaries() const {
+	if (isConverged())
+		return 0;
+	size_t batches = getBatches();
+	double needed = (batches < minBatches) ? double(minBatches - batches) * batchSize : 0.;
+	needed += primaries;
+	if (batches >= 2) {
+		for (size_t i = 0; i < observables.size(); i++) {
+			double u = getRelativeUncertainty(i);
+			if (std::isinf(u))
+				return std::numeric_limits<size_t>::max();
+			needed = std::max(needed, primaries * pow(u / targetUncertainty, 2));
+		}
+	} else if (not observables.empty()) {
+		return std::numeric_limits<size_t>::max();
+	}
+	if (needed >= double(std::numeric_limits<size_t>::max()))
+		return std::numeric_limits<size_t>::max();
+	return std::max<size_t>(size_t(ceil(needed)), primaries) - primaries;
+}
+
+std::string ConvergenceMonitor::getDescription() const {
+	std::stringstream ss;
+	ss << "ConvergenceMonitor: target relative uncertainty " << targetUncertainty
+			<< ", " << primaries << " primaries in " << getBatches() << " batches\n";
+	for (size_t i = 0; i < observables.size(); i++) {
+		const Observable &o = observables[i];
+		ss << "  ";
+		if (o.type == DetectionFraction)
+			ss << "detection fraction";
+		else if (o.type == SpectrumBin)
+			ss << "spectrum " << o.energyMin / EeV << " - " << o.energyMax / EeV << " EeV";
+		else
+			ss << "<(ln A)^" << o.order << ">";
+		ss << ": " << getValue(i) << " +- " << getUncertainty(i) << "\n";
+	}
+	return ss.str();
+}
+
+} // namespace crpropa
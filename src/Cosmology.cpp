@@ -1,7 +1,9 @@
 #include "crpropa/Cosmology.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
+#include "crpropa/LookupTable.h"
 
+#include <algorithm>
 #include <vector>
 #include <cmath>
 #include <stdexcept>
@@ -11,11 +13,18 @@ namespace crpropa {
 /**
  @class Cosmology
  @brief Cosmology calculations
+
+ The distances are tabulated on redshifts with logarithmic spacing. All
+ conversions interpolate linearly between the nodes as interpolate() does,
+ but find the interval in constant time: directly for the redshifts and by
+ a log-spaced index of the nodes for the distances.
  */
 struct Cosmology {
 	double H0; // Hubble parameter at z=0
 	double omegaM; // matter density parameter
-	double omegaL; // vacuum energy parameter
+	double omegaL; // dark energy density parameter
+	double omegaK; // curvature parameter, 1 - omegaM - omegaL
+	double w0, wa; // dark energy equation of state w(a) = w0 + wa (1 - a)
 
 	static const int n;
 	static const double zmin;
@@ -26,6 +35,62 @@ struct Cosmology {
 	std::vector<double> Dl; // luminosity distance [m]
 	std::vector<double> Dt; // light travel distance [m]
 
+	// forward tables on Z[1...], which are log-spaced
+	LogGridTable DcOfZ, DlOfZ, DtOfZ;
+
+	/**
+	 Interval lookup in the increasing distances: the nodes in log-spaced
+	 buckets are listed, so that the interval is found in the few nodes of a
+	 bucket and the result equals interpolate(d, D, Y).
+	 */
+	struct DistanceIndex {
+		const std::vector<double> *D;
+		double lo, scale;
+		std::vector<size_t> first; // last node <= lower edge of the bucket
+
+		void build(const std::vector<double> &D) {
+			this->D = &D;
+			size_t m = 4 * D.size();
+			lo = log(D[1]);
+			scale = (m - 1) / (log(D.back()) - lo);
+			first.resize(m + 1);
+			for (size_t k = 0; k <= m; k++) {
+				double edge = exp(lo + k / scale);
+				first[k] = std::upper_bound(D.begin() + 1, D.end(), edge) - D.begin() - 1;
+			}
+		}
+
+		// linear in the interval [D[0], D[1]] and constant beyond the last node
+		double operator()(double d, const std::vector<double> &Y) const {
+			const std::vector<double> &X = *D;
+			if (not (d > X[1]))
+				return Y[0] + (d - X[0]) * (Y[1] - Y[0]) / (X[1] - X[0]);
+			if (not (d < X.back()))
+				return Y.back();
+			size_t k = std::min(size_t((log(d) - lo) * scale), first.size() - 2);
+			size_t i = std::upper_bound(X.begin() + first[k],
+					X.begin() + std::min(first[k + 1] + 2, X.size()), d) - X.begin() - 1;
+			return Y[i] + (d - X[i]) * (Y[i + 1] - Y[i]) / (X[i + 1] - X[i]);
+		}
+	};
+	DistanceIndex DcIndex, DlIndex, DtIndex;
+
+	// E(z) = H(z) / H0
+	double E(double z) const {
+		double a = 1 + z;
+		double de = omegaL;
+		if ((w0 != -1) or (wa != 0))
+			de *= pow(a, 3 * (1 + w0 + wa)) * exp(-3 * wa * z / a);
+		return sqrt(omegaM * pow_integer<3>(a) + omegaK * a * a + de);
+	}
+
+	// lookup with a linear continuation to the origin below the second node
+	static double lookup(const LogGridTable &table, double x, double x1, double y1) {
+		if (x < x1)
+			return y1 * x / x1;
+		return table(x);
+	}
+
 	void update() {
 		double dH = c_light / H0; // Hubble distance
 
@@ -38,14 +103,32 @@ struct Cosmology {
 		for (int i = 1; i < n; i++) {
 			Z[i] = zmin * pow(10, i * dlz / (n - 1)); // logarithmic even spacing
 			double dz = (Z[i] - Z[i - 1]); // redshift step
-			E[i] = sqrt(omegaL + omegaM * pow_integer<3>(1 + Z[i]));
+			E[i] = this->E(Z[i]);
 			Dc[i] = Dc[i - 1] + dH * dz * (1 / E[i] + 1 / E[i - 1]) / 2;
-			Dl[i] = (1 + Z[i]) * Dc[i];
+			Dl[i] = (1 + Z[i]) * transverseDistance(Dc[i], dH);
 			Dt[i] = Dt[i - 1]
 					+ dH * dz
 							* (1 / ((1 + Z[i]) * E[i])
 									+ 1 / ((1 + Z[i - 1]) * E[i - 1])) / 2;
 		}
+
+		std::vector<double> z(Z.begin() + 1, Z.end());
+		DcOfZ.assign(z, std::vector<double>(Dc.begin() + 1, Dc.end()));
+		DlOfZ.assign(z, std::vector<double>(Dl.begin() + 1, Dl.end()));
+		DtOfZ.assign(z, std::vector<double>(Dt.begin() + 1, Dt.end()));
+		DcIndex.build(Dc);
+		DlIndex.build(Dl);
+		DtIndex.build(Dt);
+	}
+
+	// transverse comoving distance for the curvature
+	double transverseDistance(double dc, double dH) const {
+		if (std::fabs(omegaK) < 1e-8)
+			return dc;
+		double sk = sqrt(std::fabs(omegaK));
+		if (omegaK > 0)
+			return dH / sk * sinh(sk * dc / dH);
+		return dH / sk * sin(sk * dc / dH);
 	}
 
 	Cosmology() {
@@ -53,6 +136,9 @@ struct Cosmology {
 		H0 = 67.3 * 1000 * meter / second / Mpc; // default values
 		omegaM = 0.315;
 		omegaL = 1 - omegaM;
+		omegaK = 0;
+		w0 = -1;
+		wa = 0;
 
 		Z.resize(n);
 		Dc.resize(n);
@@ -68,9 +154,28 @@ struct Cosmology {
 	}
 
 	void setParameters(double h, double oM) {
+		setParameters(h, oM, 1 - oM, -1, 0);
+	}
+
+	void assign(double h, double oM, double oL, double w0, double wa) {
 		H0 = h * 1e5 / Mpc;
 		omegaM = oM;
-		omegaL = 1 - oM;
+		omegaL = oL;
+		omegaK = 1 - oM - oL;
+		this->w0 = w0;
+		this->wa = wa;
+	}
+
+	void setParameters(double h, double oM, double oL, double w0, double wa) {
+		// the tables are built on a copy first, so that invalid parameters
+		// leave the cosmology in use unchanged
+		Cosmology trial(*this);
+		trial.assign(h, oM, oL, w0, wa);
+		trial.update();
+		for (int i = 1; i < n; i++)
+			if (not (trial.Dl[i] > trial.Dl[i - 1]))
+				throw std::runtime_error("Cosmology: the luminosity distance has to increase with the redshift up to zmax");
+		assign(h, oM, oL, w0, wa);
 		update();
 	}
 };
@@ -85,9 +190,12 @@ void setCosmologyParameters(double h, double oM) {
 	cosmology.setParameters(h, oM);
 }
 
+void setCosmologyParameters(double h, double oM, double oL, double w0, double wa) {
+	cosmology.setParameters(h, oM, oL, w0, wa);
+}
+
 double hubbleRate(double z) {
-	return cosmology.H0
-			* sqrt(cosmology.omegaL + cosmology.omegaM * pow(1 + z, 3));
+	return cosmology.H0 * cosmology.E(z);
 }
 
 double omegaL() {
@@ -102,12 +210,28 @@ double H0() {
 	return cosmology.H0;
 }
 
+double redshiftRange() {
+	return cosmology.zmax;
+}
+
+double omegaK() {
+	return cosmology.omegaK;
+}
+
+double darkEnergyW0() {
+	return cosmology.w0;
+}
+
+double darkEnergyWa() {
+	return cosmology.wa;
+}
+
 double comovingDistance2Redshift(double d) {
 	if (d < 0)
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dc.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Z);
+	return cosmology.DcIndex(d, cosmology.Z);
 }
 
 double redshift2ComovingDistance(double z) {
@@ -115,7 +239,7 @@ double redshift2ComovingDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dc);
+	return Cosmology::lookup(cosmology.DcOfZ, z, cosmology.Z[1], cosmology.Dc[1]);
 }
 
 double luminosityDistance2Redshift(double d) {
@@ -123,7 +247,7 @@ double luminosityDistance2Redshift(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dl.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dl, cosmology.Z);
+	return cosmology.DlIndex(d, cosmology.Z);
 }
 
 double redshift2LuminosityDistance(double z) {
@@ -131,7 +255,7 @@ double redshift2LuminosityDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dl);
+	return Cosmology::lookup(cosmology.DlOfZ, z, cosmology.Z[1], cosmology.Dl[1]);
 }
 
 double lightTravelDistance2Redshift(double d) {
@@ -139,7 +263,7 @@ double lightTravelDistance2Redshift(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dt.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Z);
+	return cosmology.DtIndex(d, cosmology.Z);
 }
 
 double redshift2LightTravelDistance(double z) {
@@ -147,7 +271,7 @@ double redshift2LightTravelDistance(double z) {
 		throw std::runtime_error("Cosmology: z < 0");
 	if (z > cosmology.zmax)
 		throw std::runtime_error("Cosmology: z > zmax");
-	return interpolate(z, cosmology.Z, cosmology.Dt);
+	return Cosmology::lookup(cosmology.DtOfZ, z, cosmology.Z[1], cosmology.Dt[1]);
 }
 
 double comoving2LightTravelDistance(double d) {
@@ -155,7 +279,7 @@ double comoving2LightTravelDistance(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dc.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dc, cosmology.Dt);
+	return cosmology.DcIndex(d, cosmology.Dt);
 }
 
 double lightTravel2ComovingDistance(double d) {
@@ -163,7 +287,7 @@ double lightTravel2ComovingDistance(double d) {
 		throw std::runtime_error("Cosmology: d < 0");
 	if (d > cosmology.Dt.back())
 		throw std::runtime_error("Cosmology: d > dmax");
-	return interpolate(d, cosmology.Dt, cosmology.Dc);
+	return cosmology.DtIndex(d, cosmology.Dc);
 }
 
 } // namespace crpropa
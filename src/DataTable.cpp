@@ -0,0 +1,279 @@
+#include "crpropa/DataTable.h"
+#include "crpropa/Common.h"
+#include "crpropa/TableRegistry.h"
+
+#include "kiss/logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crpropa {
+
+// layout of the cache file: header, row offsets (nRows + 1), values
+struct DataTableHeader {
+	char magic[8];
+	uint64_t textSize;
+	int64_t textTime;
+	uint64_t nRows;
+	uint64_t nValues;
+};
+
+static const char dataTableMagic[8] = {'C', 'R', 'P', 'T', 'A', 'B', '0', '2'};
+
+bool DataTable::cacheEnabled = true;
+bool DataTable::hugePages = false;
+
+DataTable::DataTable() : mapping(0), mappingSize(0), offsets(0), values(0), nRows(0) {
+}
+
+DataTable::~DataTable() {
+	unmap();
+}
+
+void DataTable::unmap() {
+	if (mapping)
+		munmap(mapping, mappingSize);
+	mapping = 0;
+	mappingSize = 0;
+}
+
+bool DataTable::load(const std::string &filename) {
+	struct stat textStat;
+	if (stat(filename.c_str(), &textStat) != 0)
+		return false;
+	uint64_t textSize = textStat.st_size;
+	int64_t textTime = textStat.st_mtime;
+
+	unmap();
+	ownOffsets.clear();
+	ownValues.clear();
+	pages = NULL;
+
+	std::string cachename = cacheFilename(filename);
+	if (not (cacheEnabled and mapCache(cachename, textSize, textTime))) {
+		if (not parse(filename))
+			return false;
+		if (cacheEnabled)
+			writeCache(cachename, textSize, textTime);
+	}
+
+	if (hugePages)
+		copyToHugePages();
+	return true;
+}
+
+static DataTable *loadDataTable(const std::string &filename) {
+	DataTable *table = new DataTable();
+	if (table->load(filename))
+		return table;
+	delete table;
+	return 0;
+}
+
+ref_ptr<const DataTable> DataTable::acquire(const std::string &filename) {
+	return TableRegistry::acquire("DataTable", filename, loadDataTable);
+}
+
+void DataTable::copyToHugePages() {
+	size_t offsetBytes = (nRows + 1) * sizeof(uint64_t);
+	size_t bytes = offsetBytes + offsets[nRows] * sizeof(double);
+	size_t huge = PageMemory::getHugePageSize();
+	if (huge == 0 or bytes < huge)
+		return;
+	ref_ptr<PageMemory> memory = new PageMemory(bytes, PageMemory::HugePages);
+	char *p = (char *) memory->data();
+	memcpy(p, offsets, offsetBytes);
+	memcpy(p + offsetBytes, values, bytes - offsetBytes);
+	unmap();
+	std::vector<uint64_t>().swap(ownOffsets);
+	std::vector<double>().swap(ownValues);
+	pages = memory;
+	offsets = (const uint64_t *) p;
+	values = (const double *) (p + offsetBytes);
+}
+
+bool DataTable::mapCache(const std::string &cachename, uint64_t textSize, int64_t textTime) {
+	int fd = open(cachename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat cacheStat;
+	if (fstat(fd, &cacheStat) != 0 or cacheStat.st_size < (off_t) sizeof(DataTableHeader)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = cacheStat.st_size;
+	void *p = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+
+	const DataTableHeader *header = (const DataTableHeader *) p;
+	bool valid = (memcmp(header->magic, dataTableMagic, 8) == 0)
+			and (header->textSize == textSize) and (header->textTime == textTime)
+			and (size == sizeof(DataTableHeader)
+					+ (header->nRows + 1) * sizeof(uint64_t)
+					+ header->nValues * sizeof(double));
+	if (not valid) {
+		KISS_LOG_DEBUG << "DataTable: outdated cache " << cachename;
+		munmap(p, size);
+		return false;
+	}
+
+	mapping = p;
+	mappingSize = size;
+	nRows = header->nRows;
+	offsets = (const uint64_t *) ((const char *) p + sizeof(DataTableHeader));
+	values = (const double *) (offsets + nRows + 1);
+	return true;
+}
+
+bool DataTable::parse(const std::string &filename) {
+	std::ifstream infile(filename.c_str(), std::ios::binary);
+	if (not infile.good())
+		return false;
+	std::stringstream ss;
+	ss << infile.rdbuf();
+	const std::string text = ss.str();
+
+	ownOffsets.push_back(0);
+	const char *p = text.c_str();
+	const char *end = p + text.size();
+	while (p < end) {
+		const char *eol = (const char *) memchr(p, '\n', end - p);
+		if (eol == 0)
+			eol = end;
+		if (*p != '#') {
+			size_t n = ownValues.size();
+			while (p < eol) {
+				// strtod would skip the line end and read the next line
+				while (p < eol and (*p == ' ' or *p == '\t' or *p == '\r'))
+					++p;
+				if (p == eol)
+					break;
+				char *next;
+				double v = strtod(p, &next);
+				if (next == p or next > eol)
+					break; // no further number in this line
+				ownValues.push_back(v);
+				p = next;
+			}
+			if (ownValues.size() > n)
+				ownOffsets.push_back(ownValues.size());
+		}
+		p = eol + 1;
+	}
+
+	nRows = ownOffsets.size() - 1;
+	offsets = ownOffsets.data();
+	values = ownValues.data();
+	return true;
+}
+
+void DataTable::writeCache(const std::string &cachename, uint64_t textSize, int64_t textTime) const {
+	// write to a temporary file first, so that concurrent processes never
+	// see an incomplete cache
+	std::stringstream tmpname;
+	tmpname << cachename << ".tmp" << getpid();
+	FILE *f = fopen(tmpname.str().c_str(), "wb");
+	if (f == 0) {
+		KISS_LOG_DEBUG << "DataTable: cannot write cache " << cachename;
+		return;
+	}
+
+	DataTableHeader header;
+	memcpy(header.magic, dataTableMagic, 8);
+	header.textSize = textSize;
+	header.textTime = textTime;
+	header.nRows = nRows;
+	header.nValues = offsets[nRows];
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok and fwrite(offsets, sizeof(uint64_t), nRows + 1, f) == nRows + 1;
+	if (header.nValues > 0)
+		ok = ok and fwrite(values, sizeof(double), header.nValues, f) == header.nValues;
+	ok = (fclose(f) == 0) and ok;
+
+	if (not ok or rename(tmpname.str().c_str(), cachename.c_str()) != 0) {
+		KISS_LOG_DEBUG << "DataTable: cannot write cache " << cachename;
+		remove(tmpname.str().c_str());
+	}
+}
+
+size_t DataTable::size() const {
+	return nRows;
+}
+
+size_t DataTable::columns(size_t i) const {
+	if (i >= nRows)
+		throw std::out_of_range("DataTable: row index out of range");
+	return offsets[i + 1] - offsets[i];
+}
+
+const double *DataTable::row(size_t i) const {
+	if (i >= nRows)
+		throw std::out_of_range("DataTable: row index out of range");
+	return values + offsets[i];
+}
+
+const double *DataTable::row(size_t i, size_t minColumns) const {
+	if (columns(i) < minColumns) {
+		std::stringstream ss;
+		ss << "DataTable: row " << i << " has fewer than " << minColumns << " columns";
+		throw std::runtime_error(ss.str());
+	}
+	return values + offsets[i];
+}
+
+double DataTable::get(size_t i, size_t j) const {
+	if (j >= columns(i))
+		throw std::out_of_range("DataTable: column index out of range");
+	return values[offsets[i] + j];
+}
+
+bool DataTable::isMapped() const {
+	return mapping != 0;
+}
+
+size_t DataTable::getPageSize() const {
+	return pages.valid() ? pages->getPageSize() : PageMemory::getSystemPageSize();
+}
+
+size_t DataTable::getSizeOf() const {
+	size_t size = sizeof(*this) + mappingSize + vectorSizeOf(ownOffsets) + vectorSizeOf(ownValues);
+	if (pages.valid())
+		size += pages->size();
+	return size;
+}
+
+void DataTable::setCacheEnabled(bool enabled) {
+	cacheEnabled = enabled;
+}
+
+bool DataTable::isCacheEnabled() {
+	return cacheEnabled;
+}
+
+void DataTable::setHugePages(bool enabled) {
+	hugePages = enabled;
+}
+
+bool DataTable::getHugePages() {
+	return hugePages;
+}
+
+std::string DataTable::cacheFilename(const std::string &filename) {
+	return filename + ".bin";
+}
+
+} // namespace crpropa
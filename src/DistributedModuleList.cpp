@@ -0,0 +1,795 @@
+#include "crpropa/DistributedModuleList.h"
+#include "crpropa/Random.h"
+#include "crpropa/module/TextOutput.h"
+
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef CRPROPA_HAVE_MPI
+#include <mpi.h>
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+#include "crpropa/module/HDF5Output.h"
+#include <hdf5.h>
+#endif
+
+#ifndef sighandler_t
+typedef void (*sighandler_t)(int);
+#endif
+
+namespace crpropa {
+
+// signal handling of ModuleList::run
+extern int g_cancel_signal_flag;
+void g_cancel_signal_callback(int sig);
+
+#ifdef CRPROPA_HAVE_MPI
+static void finalizeMPI() {
+	int finalized;
+	MPI_Finalized(&finalized);
+	if (not finalized)
+		MPI_Finalize();
+}
+
+// initialize MPI, unless done by the application (e.g. mpi4py)
+static void initMPI() {
+	int initialized;
+	MPI_Initialized(&initialized);
+	if (initialized)
+		return;
+	int provided;
+	MPI_Init_thread(0, 0, MPI_THREAD_SERIALIZED, &provided);
+	atexit(finalizeMPI);
+}
+#endif
+
+DistributedModuleList::DistributedModuleList(size_t chunkSize) :
+		chunkSize(chunkSize), seed(0), seedSet(false), processed(0), migrated(0) {
+	if (chunkSize == 0)
+		throw std::runtime_error("DistributedModuleList: chunk size must be > 0");
+}
+
+void DistributedModuleList::setChunkSize(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("DistributedModuleList: chunk size must be > 0");
+	chunkSize = n;
+}
+
+size_t DistributedModuleList::getChunkSize() const {
+	return chunkSize;
+}
+
+void DistributedModuleList::setSeed(uint64_t s) {
+	seed = s;
+	seedSet = true;
+}
+
+size_t DistributedModuleList::getProcessed() const {
+	return processed;
+}
+
+void DistributedModuleList::setDomainDecomposition(ref_ptr<DomainDecomposition> d) {
+	domain = d;
+}
+
+ref_ptr<DomainDecomposition> DistributedModuleList::getDomainDecomposition() const {
+	return domain;
+}
+
+size_t DistributedModuleList::getMigrated() const {
+	return migrated;
+}
+
+void DistributedModuleList::run(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst) {
+	uint64_t runSeed = seed;
+#ifdef CRPROPA_HAVE_MPI
+	initMPI();
+	if (not seedSet) {
+		if (getRank() == 0)
+			runSeed = Random::instance().randInt64();
+		MPI_Bcast(&runSeed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	}
+#else
+	if (not seedSet)
+		runSeed = Random::instance().randInt64();
+#endif
+	Random::seedStreams(runSeed);
+
+	g_cancel_signal_flag = 0;
+	sighandler_t old_sigint_handler = ::signal(SIGINT, g_cancel_signal_callback);
+	sighandler_t old_sigterm_handler = ::signal(SIGTERM, g_cancel_signal_callback);
+
+	try {
+		if (domain.valid())
+			runDomains(source, count, recursive, secondariesFirst);
+		else
+			runChunks(source, count, recursive, secondariesFirst);
+	} catch (...) {
+		::signal(SIGINT, old_sigint_handler);
+		::signal(SIGTERM, old_sigterm_handler);
+		throw;
+	}
+
+	::signal(SIGINT, old_sigint_handler);
+	::signal(SIGTERM, old_sigterm_handler);
+	// Propagate signal to old handler.
+	if (g_cancel_signal_flag > 0)
+		raise(g_cancel_signal_flag);
+}
+
+void DistributedModuleList::runChunks(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst) {
+	int threads = 1;
+#if _OPENMP
+	threads = omp_get_max_threads();
+#endif
+
+#ifdef CRPROPA_HAVE_MPI
+	// chunks are fetched from within the OpenMP threads, one at a time
+	int provided;
+	MPI_Query_thread(&provided);
+	if (provided < MPI_THREAD_SERIALIZED)
+		threads = 1;
+
+	// counter of the next primary, held by rank 0
+	uint64_t *next;
+	MPI_Win window;
+	MPI_Win_allocate(getRank() == 0 ? sizeof(uint64_t) : 0, sizeof(uint64_t),
+			MPI_INFO_NULL, MPI_COMM_WORLD, &next, &window);
+	if (getRank() == 0)
+		*next = 0;
+	MPI_Barrier(MPI_COMM_WORLD);
+#else
+	uint64_t next = 0;
+#endif
+
+	if (getRank() == 0)
+		KISS_LOG_INFO << "crpropa::DistributedModuleList: " << getSize()
+				<< " processes, " << threads << " threads each";
+
+	size_t n = 0;
+#pragma omp parallel num_threads(threads) reduction(+:n)
+	while (g_cancel_signal_flag == 0) {
+		uint64_t increment = chunkSize, start;
+#pragma omp critical(DistributedModuleListChunk)
+		{
+#ifdef CRPROPA_HAVE_MPI
+			MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+			MPI_Fetch_and_op(&increment, &start, MPI_UINT64_T, 0, 0, MPI_SUM, window);
+			MPI_Win_unlock(0, window);
+#else
+			start = next;
+			next += increment;
+#endif
+		}
+		if (start >= count)
+			break;
+
+		size_t end = std::min<uint64_t>(start + increment, count);
+		for (size_t i = start; i < end; i++) {
+			if (g_cancel_signal_flag != 0)
+				break;
+			Random::selectStream(i);
+			try {
+				ref_ptr<Candidate> candidate = source->getCandidate();
+				ModuleList::run(candidate, recursive, secondariesFirst);
+			} catch (std::exception &e) {
+				std::cerr << "Exception in crpropa::DistributedModuleList::run: " << std::endl;
+				std::cerr << e.what() << std::endl;
+			}
+			n++;
+		}
+	}
+	processed = n;
+	migrated = 0;
+
+#ifdef CRPROPA_HAVE_MPI
+	MPI_Win_free(&window);
+#endif
+}
+
+namespace {
+
+// message tag of the migrating candidates
+const int MIGRATION_TAG = 7201;
+
+// limits the steps to the reach of the halo and deactivates the candidates
+// that left the box of this rank, which are packed for their new rank
+class DomainBoundary: public Module {
+	ref_ptr<DomainDecomposition> domain;
+	mutable std::vector<std::vector<std::vector<char> > > buffers; // [thread][rank]
+	mutable std::vector<std::vector<uint64_t> > counts; // [thread][rank]
+public:
+	DomainBoundary(ref_ptr<DomainDecomposition> domain, int threads) : domain(domain),
+			buffers(threads, std::vector<std::vector<char> >(domain->getRanks())),
+			counts(threads, std::vector<uint64_t>(domain->getRanks(), 0)) {
+		setDescription("DomainBoundary");
+	}
+
+	void process(Candidate *candidate) const {
+		// finished in this step
+		if (not candidate->isActive())
+			return;
+		if (domain->isLocal(candidate->current.getPosition()))
+			candidate->limitNextStep(domain->getReach());
+		else
+			migrate(candidate);
+	}
+
+	void migrate(Candidate *candidate) const {
+		size_t tid = 0;
+#if _OPENMP
+		tid = omp_get_thread_num();
+#endif
+		int rank = domain->getRank(candidate->current.getPosition());
+		candidate->setActive(false);
+		candidate->pack(buffers[tid][rank]);
+		counts[tid][rank]++;
+	}
+
+	// append the candidates packed for each rank by all threads, returns their number
+	uint64_t collect(std::vector<std::vector<char> > &messages) const {
+		uint64_t n = 0;
+		messages.resize(domain->getRanks());
+		for (size_t t = 0; t < buffers.size(); t++)
+			for (size_t r = 0; r < buffers[t].size(); r++) {
+				messages[r].insert(messages[r].end(), buffers[t][r].begin(), buffers[t][r].end());
+				buffers[t][r].clear();
+				n += counts[t][r];
+				counts[t][r] = 0;
+			}
+		return n;
+	}
+};
+
+// a primary to draw from the source, or a received candidate
+struct DomainWork {
+	uint64_t stream;
+	ref_ptr<Candidate> candidate;
+};
+
+#ifdef CRPROPA_HAVE_MPI
+struct Migration {
+	MPI_Request request;
+	std::vector<char> data;
+};
+
+// receive the pending migrations, returns the number of candidates
+uint64_t receiveMigrations(std::deque<ref_ptr<Candidate> > &queue) {
+	uint64_t n = 0;
+	while (true) {
+		int flag;
+		MPI_Status status;
+		MPI_Iprobe(MPI_ANY_SOURCE, MIGRATION_TAG, MPI_COMM_WORLD, &flag, &status);
+		if (not flag)
+			return n;
+		int size;
+		MPI_Get_count(&status, MPI_CHAR, &size);
+		std::vector<char> data(size);
+		MPI_Recv(data.data(), size, MPI_CHAR, status.MPI_SOURCE, MIGRATION_TAG,
+				MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		const char *p = data.data(), *end = p + size;
+		while (p < end) {
+			ref_ptr<Candidate> candidate = Candidate::unpack(p, end);
+			candidate->setActive(true);
+			queue.push_back(candidate);
+			n++;
+		}
+	}
+}
+
+// forget the finished sends
+void testMigrations(std::list<Migration> &sends) {
+	for (std::list<Migration>::iterator i = sends.begin(); i != sends.end();) {
+		int done;
+		MPI_Test(&i->request, &done, MPI_STATUS_IGNORE);
+		if (done)
+			i = sends.erase(i);
+		else
+			++i;
+	}
+}
+#endif
+
+} // namespace
+
+void DistributedModuleList::runDomains(SourceInterface *source, size_t count, bool recursive, bool secondariesFirst) {
+	int rank = getRank(), ranks = getSize();
+	if (domain->getRanks() != ranks or domain->getRank() != rank)
+		throw std::runtime_error("DistributedModuleList: domain decomposition for another number of processes");
+	int threads = 1;
+#if _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	if (rank == 0)
+		KISS_LOG_INFO << "crpropa::DistributedModuleList: " << ranks << " processes, "
+				<< domain->getDivision(0) << " x " << domain->getDivision(1) << " x "
+				<< domain->getDivision(2) << " domains, " << threads << " threads each";
+
+	ref_ptr<DomainBoundary> boundary = new DomainBoundary(domain, threads);
+	add(boundary);
+
+	std::deque<ref_ptr<Candidate> > received;
+	uint64_t nextPrimary = rank, sent = 0, receivedCount = 0, firstStream = count;
+	size_t n = 0;
+#ifdef CRPROPA_HAVE_MPI
+	std::list<Migration> sends;
+	uint64_t local[3], totals[3], last[3];
+	std::fill(last, last + 3, std::numeric_limits<uint64_t>::max());
+	bool wavePending = false;
+	MPI_Request wave;
+#endif
+
+	try {
+		while (true) {
+			bool cancel = (g_cancel_signal_flag != 0);
+#ifdef CRPROPA_HAVE_MPI
+			receivedCount += receiveMigrations(received);
+			testMigrations(sends);
+			if (cancel)
+				received.clear();
+#endif
+
+			// the next batch: received candidates first, then primaries
+			std::vector<DomainWork> batch;
+			bool take = not cancel;
+#ifdef CRPROPA_HAVE_MPI
+			// only receive until the round of the termination check is done
+			take = take and not wavePending;
+#endif
+			while (take and batch.size() < chunkSize) {
+				DomainWork work;
+				if (not received.empty()) {
+					// streams after those of the primaries, distinct on each rank
+					work.stream = firstStream + rank;
+					firstStream += ranks;
+					work.candidate = received.front();
+					received.pop_front();
+				} else if (nextPrimary < count) {
+					work.stream = nextPrimary;
+					nextPrimary += ranks;
+				} else {
+					break;
+				}
+				batch.push_back(work);
+			}
+
+			if (not batch.empty()) {
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+				for (long i = 0; i < (long) batch.size(); i++) {
+					if (g_cancel_signal_flag != 0)
+						continue;
+					Random::selectStream(batch[i].stream);
+					try {
+						ref_ptr<Candidate> candidate = batch[i].candidate;
+						if (not candidate.valid()) {
+							candidate = source->getCandidate();
+							if (not domain->isLocal(candidate->current.getPosition())) {
+								boundary->migrate(candidate);
+								continue;
+							}
+						}
+						ModuleList::run(candidate, recursive, secondariesFirst);
+					} catch (std::exception &e) {
+						std::cerr << "Exception in crpropa::DistributedModuleList::run: " << std::endl;
+						std::cerr << e.what() << std::endl;
+					}
+				}
+				n += batch.size();
+
+				std::vector<std::vector<char> > messages;
+				uint64_t packed = boundary->collect(messages);
+#ifdef CRPROPA_HAVE_MPI
+				for (int r = 0; r < ranks; r++) {
+					if (messages[r].empty())
+						continue;
+					sends.push_back(Migration());
+					Migration &m = sends.back();
+					m.data.swap(messages[r]);
+					// synchronous, so that a finished send was also received
+					MPI_Issend(m.data.data(), m.data.size(), MPI_CHAR, r,
+							MIGRATION_TAG, MPI_COMM_WORLD, &m.request);
+				}
+				sent += packed;
+#else
+				// a single domain has no other ranks
+				(void) packed;
+#endif
+				continue;
+			}
+
+#ifdef CRPROPA_HAVE_MPI
+			// idle: take part in the next round of the termination check
+			if (not wavePending) {
+				local[0] = sent;
+				local[1] = receivedCount;
+				local[2] = cancel ? 1 : 0;
+				MPI_Iallreduce(local, totals, 3, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD, &wave);
+				wavePending = true;
+			} else {
+				int done;
+				MPI_Test(&wave, &done, MPI_STATUS_IGNORE);
+				if (done) {
+					wavePending = false;
+					if (totals[2] > 0)
+						break;
+					// no candidate in transit and none moved since the last round
+					if (totals[0] == totals[1] and totals[0] == last[0] and totals[1] == last[1])
+						break;
+					std::copy(totals, totals + 3, last);
+				}
+			}
+#else
+			break;
+#endif
+		}
+
+#ifdef CRPROPA_HAVE_MPI
+		// complete the sends, e.g. after a cancel, dropping what arrives
+		MPI_Request barrier;
+		bool barrierPosted = false;
+		while (true) {
+			receiveMigrations(received);
+			received.clear();
+			testMigrations(sends);
+			if (not barrierPosted and sends.empty()) {
+				MPI_Ibarrier(MPI_COMM_WORLD, &barrier);
+				barrierPosted = true;
+			}
+			if (barrierPosted) {
+				int done;
+				MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+				if (done)
+					break;
+			}
+		}
+#endif
+	} catch (...) {
+		remove(ModuleList::size() - 1);
+		throw;
+	}
+	remove(ModuleList::size() - 1);
+	processed = n;
+	migrated = sent;
+}
+
+std::string DistributedModuleList::getDescription() const {
+	std::stringstream ss;
+	ss << "DistributedModuleList: chunk size " << chunkSize << ", ";
+	if (domain.valid())
+		ss << domain->getDescription();
+	ss << ModuleList::getDescription();
+	return ss.str();
+}
+
+int DistributedModuleList::getRank() {
+#ifdef CRPROPA_HAVE_MPI
+	initMPI();
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	return rank;
+#else
+	return 0;
+#endif
+}
+
+int DistributedModuleList::getSize() {
+#ifdef CRPROPA_HAVE_MPI
+	initMPI();
+	int size;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	return size;
+#else
+	return 1;
+#endif
+}
+
+std::string DistributedModuleList::shardFilename(const std::string &filename) {
+	std::stringstream ss;
+	ss << filename << "." << getRank();
+	return ss.str();
+}
+
+void DistributedModuleList::mergeTextShards(const std::string &filename, bool removeShards) {
+	int size = getSize();
+#ifdef CRPROPA_HAVE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+	bool ok = true;
+	if (getRank() == 0) {
+		std::vector<std::string> shards;
+		for (int r = 0; r < size; r++) {
+			std::stringstream shard;
+			shard << filename << "." << r;
+			if (std::ifstream(shard.str().c_str()).good())
+				shards.push_back(shard.str());
+			else
+				KISS_LOG_WARNING << "DistributedModuleList: missing shard " << shard.str();
+		}
+		try {
+			TextOutput::concatenate(shards, filename);
+		} catch (std::exception &e) {
+			KISS_LOG_ERROR << e.what();
+			ok = false;
+		}
+		if (removeShards and ok)
+			for (size_t i = 0; i < shards.size(); i++)
+				std::remove(shards[i].c_str());
+	}
+#ifdef CRPROPA_HAVE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+	if (not ok)
+		throw std::runtime_error("DistributedModuleList: could not open file " + filename);
+}
+
+#ifdef CRPROPA_HAVE_HDF5
+static bool fileExists(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	return in.good();
+}
+
+// rank 0 copies the first shard and appends the rows of the others
+static bool mergeHDF5Serial(const std::string &filename, int size) {
+	std::vector<std::string> shards;
+	for (int r = 0; r < size; r++) {
+		std::stringstream shard;
+		shard << filename << "." << r;
+		if (fileExists(shard.str()))
+			shards.push_back(shard.str());
+		else
+			KISS_LOG_WARNING << "DistributedModuleList: missing shard " << shard.str();
+	}
+	try {
+		HDF5Output::concatenate(shards, filename);
+	} catch (std::exception &e) {
+		KISS_LOG_ERROR << e.what();
+		return false;
+	}
+	return true;
+}
+
+#if defined(CRPROPA_HAVE_MPI) && defined(H5_HAVE_PARALLEL)
+// rows read and written at once while merging
+static const hsize_t MERGE_BLOCK_SIZE = 65536;
+
+static hsize_t datasetRows(hid_t dset) {
+	hid_t space = H5Dget_space(dset);
+	hsize_t n = 0;
+	H5Sget_simple_extent_dims(space, &n, NULL);
+	H5Sclose(space);
+	return n;
+}
+
+// read (write) the rows offset ... offset+n-1, n = 0 takes part without data
+static void transferRows(hid_t dset, hid_t type, hsize_t offset, hsize_t n,
+		void *buffer, bool write, hid_t dxpl = H5P_DEFAULT) {
+	hid_t fspace = H5Dget_space(dset);
+	hsize_t count = std::max(n, (hsize_t)1);
+	hid_t mspace = H5Screate_simple(1, &count, NULL);
+	if (n > 0) {
+		H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &n, NULL);
+	} else {
+		H5Sselect_none(fspace);
+		H5Sselect_none(mspace);
+	}
+	herr_t status = write ? H5Dwrite(dset, type, mspace, fspace, dxpl, buffer)
+			: H5Dread(dset, type, mspace, fspace, dxpl, buffer);
+	H5Sclose(mspace);
+	H5Sclose(fspace);
+	if (status < 0)
+		throw std::runtime_error("DistributedModuleList: HDF5 transfer failed");
+}
+
+static herr_t copyAttribute(hid_t loc, const char *name, const H5A_info_t *info, void *data) {
+	hid_t target = *static_cast<hid_t *>(data);
+	hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	hid_t space = H5Aget_space(attr);
+	std::vector<char> buffer(H5Tget_size(type) * H5Sget_simple_extent_npoints(space));
+	H5Aread(attr, type, &buffer[0]);
+	hid_t copy = H5Acreate2(target, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	herr_t status = H5Awrite(copy, type, &buffer[0]);
+	H5Aclose(copy);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+	return status;
+}
+
+// union of the tag names of all ranks in the order of the ranks, and the
+// codes of the names of this rank in it
+static std::vector<std::string> gatherTagNames(const std::vector<std::string> &names,
+		std::vector<uint32_t> &codes) {
+	std::string local;
+	for (size_t i = 0; i < names.size(); i++)
+		local += names[i] + "\n";
+	int length = local.size(), size = 1;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	std::vector<int> lengths(size), offsets(size, 0);
+	MPI_Allgather(&length, 1, MPI_INT, &lengths[0], 1, MPI_INT, MPI_COMM_WORLD);
+	for (int r = 1; r < size; r++)
+		offsets[r] = offsets[r - 1] + lengths[r - 1];
+	std::vector<char> all(offsets[size - 1] + lengths[size - 1] + 1, 0);
+	MPI_Allgatherv(const_cast<char *>(local.c_str()), length, MPI_CHAR,
+			&all[0], &lengths[0], &offsets[0], MPI_CHAR, MPI_COMM_WORLD);
+
+	std::vector<std::string> merged;
+	const char *p = &all[0];
+	while (const char *eol = strchr(p, '\n')) {
+		HDF5Output::getTagCode(merged, std::string(p, eol));
+		p = eol + 1;
+	}
+	codes.resize(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+		codes[i] = HDF5Output::getTagCode(merged, names[i]);
+	return merged;
+}
+
+// all ranks write their shard into the merged dataset with collective MPI-IO
+static void mergeHDF5Collective(const std::string &filename, int rank, int size) {
+	std::string shard = DistributedModuleList::shardFilename(filename);
+	hid_t in = -1, din = -1;
+	unsigned long long n = 0;
+	if (fileExists(shard)) {
+		in = H5Fopen(shard.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		din = H5Dopen2(in, "CRPROPA3", H5P_DEFAULT);
+		n = datasetRows(din);
+	}
+
+	// the tag codes of the ranks are only valid with their own tag names
+	std::vector<uint32_t> tagCodes;
+	std::vector<std::string> tagNames = gatherTagNames(
+			(din >= 0) ? HDF5Output::getTagNames(din) : std::vector<std::string>(), tagCodes);
+
+	// the lowest rank with a shard provides row type, layout and attributes
+	int source = (din >= 0) ? rank : size;
+	MPI_Allreduce(MPI_IN_PLACE, &source, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+	if (source == size)
+		throw std::runtime_error("DistributedModuleList: no HDF5 shards of " + filename);
+
+	unsigned long long lengths[2] = {0, 0};
+	std::vector<unsigned char> encodedType, encodedLayout;
+	if (rank == source) {
+		hid_t type = H5Dget_type(din);
+		hid_t layout = H5Dget_create_plist(din);
+		size_t nbytes = 0;
+		H5Tencode(type, NULL, &nbytes);
+		encodedType.resize(nbytes);
+		H5Tencode(type, &encodedType[0], &nbytes);
+		nbytes = 0;
+#if H5_VERSION_GE(1, 12, 0)
+		H5Pencode2(layout, NULL, &nbytes, H5P_DEFAULT);
+		encodedLayout.resize(nbytes);
+		H5Pencode2(layout, &encodedLayout[0], &nbytes, H5P_DEFAULT);
+#else
+		H5Pencode(layout, NULL, &nbytes);
+		encodedLayout.resize(nbytes);
+		H5Pencode(layout, &encodedLayout[0], &nbytes);
+#endif
+		H5Pclose(layout);
+		H5Tclose(type);
+		lengths[0] = encodedType.size();
+		lengths[1] = encodedLayout.size();
+	}
+	MPI_Bcast(lengths, 2, MPI_UNSIGNED_LONG_LONG, source, MPI_COMM_WORLD);
+	encodedType.resize(lengths[0]);
+	encodedLayout.resize(lengths[1]);
+	MPI_Bcast(&encodedType[0], lengths[0], MPI_UNSIGNED_CHAR, source, MPI_COMM_WORLD);
+	MPI_Bcast(&encodedLayout[0], lengths[1], MPI_UNSIGNED_CHAR, source, MPI_COMM_WORLD);
+	hid_t type = H5Tdecode(&encodedType[0]);
+	hid_t layout = H5Pdecode(&encodedLayout[0]);
+
+	// rows of this rank start after those of the lower ranks
+	std::vector<unsigned long long> counts(size);
+	MPI_Allgather(&n, 1, MPI_UNSIGNED_LONG_LONG, &counts[0], 1, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+	hsize_t offset = 0, total = 0;
+	for (int r = 0; r < size; r++) {
+		if (r < rank)
+			offset += counts[r];
+		total += counts[r];
+	}
+
+	hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+	H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+	hid_t out = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+	H5Pclose(fapl);
+	if (out < 0)
+		throw std::runtime_error("DistributedModuleList: could not open file " + filename);
+	hsize_t maxRows = H5S_UNLIMITED;
+	hid_t space = H5Screate_simple(1, &total, &maxRows);
+	hid_t dout = H5Dcreate2(out, "CRPROPA3", type, space, H5P_DEFAULT, layout, H5P_DEFAULT);
+	H5Sclose(space);
+
+	// every rank takes part in each collective write, with an empty selection
+	// once its shard is exhausted
+	unsigned long long blocks = (n + MERGE_BLOCK_SIZE - 1) / MERGE_BLOCK_SIZE;
+	MPI_Allreduce(MPI_IN_PLACE, &blocks, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+	hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+	H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+	std::vector<char> buffer(H5Tget_size(type) * MERGE_BLOCK_SIZE);
+	for (unsigned long long b = 0; b < blocks; b++) {
+		hsize_t first = b * MERGE_BLOCK_SIZE;
+		hsize_t count = (first < n) ? std::min(MERGE_BLOCK_SIZE, n - first) : 0;
+		if (count > 0) {
+			transferRows(din, type, first, count, &buffer[0], false);
+			HDF5Output::mapTagCodes(type, &buffer[0], count, tagCodes);
+		}
+		transferRows(dout, type, offset + first, count, &buffer[0], true, dxpl);
+	}
+	H5Pclose(dxpl);
+	H5Dclose(dout);
+	H5Fclose(out);
+	H5Pclose(layout);
+	H5Tclose(type);
+	if (in >= 0) {
+		H5Dclose(din);
+		H5Fclose(in);
+	}
+
+	// attributes are written by a single process
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank == 0) {
+		std::stringstream sourceShard;
+		sourceShard << filename << "." << source;
+		hid_t src = H5Fopen(sourceShard.str().c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		hid_t dsrc = H5Dopen2(src, "CRPROPA3", H5P_DEFAULT);
+		out = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+		dout = H5Dopen2(out, "CRPROPA3", H5P_DEFAULT);
+		H5Aiterate2(dsrc, H5_INDEX_CRT_ORDER, H5_ITER_NATIVE, NULL, copyAttribute, &dout);
+		if (not tagNames.empty())
+			HDF5Output::setTagNames(dout, tagNames);
+		H5Dclose(dout);
+		H5Fclose(out);
+		H5Dclose(dsrc);
+		H5Fclose(src);
+	}
+}
+#endif // CRPROPA_HAVE_MPI && H5_HAVE_PARALLEL
+#endif // CRPROPA_HAVE_HDF5
+
+void DistributedModuleList::mergeHDF5Shards(const std::string &filename, bool removeShards) {
+#ifdef CRPROPA_HAVE_HDF5
+	int rank = getRank(), size = getSize();
+#ifdef CRPROPA_HAVE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+#if defined(CRPROPA_HAVE_MPI) && defined(H5_HAVE_PARALLEL)
+	mergeHDF5Collective(filename, rank, size);
+	bool ok = true;
+#else
+	bool ok = (rank != 0) or mergeHDF5Serial(filename, size);
+#endif
+	if (removeShards and ok and rank == 0)
+		for (int r = 0; r < size; r++) {
+			std::stringstream shard;
+			shard << filename << "." << r;
+			std::remove(shard.str().c_str());
+		}
+#ifdef CRPROPA_HAVE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+	if (not ok)
+		throw std::runtime_error("DistributedModuleList: could not merge HDF5 shards into " + filename);
+#else
+	throw std::runtime_error("DistributedModuleList: HDF5 support not available");
+#endif
+}
+
+} // namespace crpropa
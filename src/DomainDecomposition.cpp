@@ -0,0 +1,205 @@
+#include "crpropa/DomainDecomposition.h"
+#include "crpropa/DistributedModuleList.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+
+// grid points beyond the cell of a position that the interpolation reads
+size_t interpolationWidth(interpolationType ipol) {
+	return ((ipol == TRICUBIC) or (ipol == ADAPTIVE)) ? 2 : 1;
+}
+
+// index i modulo n, also for negative i
+size_t wrap(long i, size_t n) {
+	long m = i % (long) n;
+	return (m < 0) ? m + n : m;
+}
+
+} // namespace
+
+DomainDecomposition::DomainDecomposition(const GridProperties &p, size_t halo,
+		int ranks, int rank) : properties(p), halo(halo), ranks(ranks), rank(rank) {
+	if (this->ranks < 0)
+		this->ranks = DistributedModuleList::getSize();
+	if (this->rank < 0)
+		this->rank = DistributedModuleList::getRank();
+	if (this->ranks < 1 or this->rank >= this->ranks)
+		throw std::runtime_error("DomainDecomposition: invalid rank");
+	if (p.reflective)
+		throw std::runtime_error("DomainDecomposition: the grid has to be periodic");
+	if (halo <= interpolationWidth(p.ipol))
+		throw std::runtime_error("DomainDecomposition: halo too small for the interpolation");
+	N[0] = p.Nx;
+	N[1] = p.Ny;
+	N[2] = p.Nz;
+
+	// division with the smallest surface of the boxes, sum of px / Nx
+	double best = std::numeric_limits<double>::max();
+	size_t n = this->ranks;
+	for (size_t px = 1; px <= n; px++) {
+		if (n % px != 0)
+			continue;
+		for (size_t py = 1; py <= n / px; py++) {
+			if ((n / px) % py != 0)
+				continue;
+			size_t pz = n / px / py;
+			if (px > N[0] or py > N[1] or pz > N[2])
+				continue;
+			double surface = double(px) / N[0] + double(py) / N[1] + double(pz) / N[2];
+			if (surface < best) {
+				best = surface;
+				division[0] = px;
+				division[1] = py;
+				division[2] = pz;
+			}
+		}
+	}
+	if (best == std::numeric_limits<double>::max())
+		throw std::runtime_error("DomainDecomposition: more ranks than grid points");
+
+	// rank = (ix * py + iy) * pz + iz
+	size_t part[3];
+	part[2] = this->rank % division[2];
+	part[1] = (this->rank / division[2]) % division[1];
+	part[0] = this->rank / division[2] / division[1];
+	for (int a = 0; a < 3; a++) {
+		localBegin[a] = begin(a, part[a]);
+		localEnd[a] = begin(a, part[a] + 1);
+	}
+}
+
+size_t DomainDecomposition::begin(int axis, size_t i) const {
+	return i * N[axis] / division[axis];
+}
+
+int DomainDecomposition::getRanks() const {
+	return ranks;
+}
+
+int DomainDecomposition::getRank() const {
+	return rank;
+}
+
+size_t DomainDecomposition::getHalo() const {
+	return halo;
+}
+
+size_t DomainDecomposition::getDivision(int axis) const {
+	if (axis < 0 or axis > 2)
+		throw std::runtime_error("DomainDecomposition: invalid axis");
+	return division[axis];
+}
+
+double DomainDecomposition::getReach() const {
+	const Vector3d &s = properties.spacing;
+	return (halo - interpolationWidth(properties.ipol)) * std::min(s.x, std::min(s.y, s.z));
+}
+
+int DomainDecomposition::getRank(const Vector3d &position) const {
+	Vector3d r = (position - properties.origin) / properties.spacing;
+	double x[3] = {r.x, r.y, r.z};
+	size_t part[3];
+	for (int a = 0; a < 3; a++) {
+		size_t i = wrap((long) std::floor(x[a]), N[a]);
+		// largest part with begin(part) <= i
+		part[a] = ((i + 1) * division[a] - 1) / N[a];
+	}
+	return (part[0] * division[1] + part[1]) * division[2] + part[2];
+}
+
+bool DomainDecomposition::isLocal(const Vector3d &position) const {
+	return getRank(position) == rank;
+}
+
+Vector3d DomainDecomposition::getLocalMin() const {
+	return properties.origin + Vector3d(localBegin[0], localBegin[1], localBegin[2]) * properties.spacing;
+}
+
+Vector3d DomainDecomposition::getLocalMax() const {
+	return properties.origin + Vector3d(localEnd[0], localEnd[1], localEnd[2]) * properties.spacing;
+}
+
+Vector3d DomainDecomposition::getLocalImage(const Vector3d &position) const {
+	Vector3d center = (getLocalMin() + getLocalMax()) / 2;
+	Vector3d length = Vector3d(N[0], N[1], N[2]) * properties.spacing;
+	Vector3d shift = (position - center) / length + Vector3d(0.5);
+	return position - shift.floor() * length;
+}
+
+GridProperties DomainDecomposition::getLocalGridProperties() const {
+	Vector3d origin = getLocalMin() - properties.spacing * (double) halo;
+	GridProperties p(origin, localEnd[0] - localBegin[0] + 2 * halo,
+			localEnd[1] - localBegin[1] + 2 * halo,
+			localEnd[2] - localBegin[2] + 2 * halo, properties.spacing);
+	p.setInterpolationType(properties.ipol);
+	return p;
+}
+
+ref_ptr<Grid3f> DomainDecomposition::extractLocalGrid(ref_ptr<Grid3f> grid) const {
+	if (grid->getNx() != N[0] or grid->getNy() != N[1] or grid->getNz() != N[2])
+		throw std::runtime_error("DomainDecomposition: grid of another size");
+	ref_ptr<Grid3f> local = new Grid3f(getLocalGridProperties());
+	size_t n[3] = {local->getNx(), local->getNy(), local->getNz()};
+	#pragma omp parallel for
+	for (size_t ix = 0; ix < n[0]; ix++) {
+		size_t gx = wrap((long) (localBegin[0] + ix) - (long) halo, N[0]);
+		for (size_t iy = 0; iy < n[1]; iy++) {
+			size_t gy = wrap((long) (localBegin[1] + iy) - (long) halo, N[1]);
+			for (size_t iz = 0; iz < n[2]; iz++) {
+				size_t gz = wrap((long) (localBegin[2] + iz) - (long) halo, N[2]);
+				local->get(ix, iy, iz) = grid->get(gx, gy, gz);
+			}
+		}
+	}
+	return local;
+}
+
+ref_ptr<Grid3f> DomainDecomposition::loadLocalGrid(const std::string &filename) const {
+	return extractLocalGrid(mapGrid3f(filename));
+}
+
+std::string DomainDecomposition::getDescription() const {
+	std::stringstream ss;
+	ss << "DomainDecomposition: " << division[0] << " x " << division[1] << " x "
+			<< division[2] << " boxes, halo " << halo << " grid points, rank "
+			<< rank << " of " << ranks << "\n";
+	return ss.str();
+}
+
+DomainMagneticField::DomainMagneticField(ref_ptr<DomainDecomposition> domain,
+		ref_ptr<Grid3f> grid, double scale) : domain(domain), grid(grid), scale(scale) {
+	GridProperties p = domain->getLocalGridProperties();
+	if (grid->getNx() != p.Nx or grid->getNy() != p.Ny or grid->getNz() != p.Nz)
+		throw std::runtime_error("DomainMagneticField: not the grid of this rank");
+	grid->setInterpolationType(p.ipol);
+	Vector3d margin = p.spacing * (double) (domain->getHalo() - interpolationWidth(p.ipol));
+	lower = domain->getLocalMin() - margin;
+	upper = domain->getLocalMax() + margin;
+}
+
+ref_ptr<Grid3f> DomainMagneticField::getGrid() {
+	return grid;
+}
+
+Vector3d DomainMagneticField::getField(const Vector3d &position) const {
+	Vector3d r = domain->getLocalImage(position);
+	if (r.x < lower.x or r.y < lower.y or r.z < lower.z
+			or r.x >= upper.x or r.y >= upper.y or r.z >= upper.z) {
+		std::stringstream ss;
+		ss << "DomainMagneticField: position " << position / Mpc
+				<< " Mpc outside of the halo of rank " << domain->getRank();
+		throw std::runtime_error(ss.str());
+	}
+	return grid->interpolate(r) * scale;
+}
+
+} // namespace crpropa
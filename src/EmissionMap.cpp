@@ -1,19 +1,27 @@
 #include "crpropa/EmissionMap.h"
+#include "crpropa/Common.h"
 #include "crpropa/Random.h"
 #include "crpropa/Units.h"
 
 #include "kiss/logger.h"
 
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
-CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+CylindricalProjectionMap::CylindricalProjectionMap() : nPhi(360), nTheta(180), dirty(false), frozen(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
 	sPhi = 2. * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
 
-CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), dirty(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
+CylindricalProjectionMap::CylindricalProjectionMap(size_t nPhi, size_t nTheta) : nPhi(nPhi), nTheta(nTheta), dirty(false), frozen(false), pdf(nPhi* nTheta, 0), cdf(nPhi* nTheta, 0) {
 	sPhi = 2 * M_PI / nPhi;
 	sTheta = 2. / nTheta;
 }
@@ -24,30 +32,73 @@ void CylindricalProjectionMap::fillBin(const Vector3d& direction, double weight)
 }
 
 void CylindricalProjectionMap::fillBin(size_t bin, double weight) {
+	if (frozen)
+		throw std::runtime_error("CylindricalProjectionMap: map is frozen");
 	pdf[bin] += weight;
 	dirty = true;
 }
 
 Vector3d CylindricalProjectionMap::drawDirection() const {
-	if (dirty)
+	if (frozen)
+		return directionFromBin(Random::instance().randBin(sampler));
+
+	if (dirty) {
+#pragma omp critical(CylindricalProjectionMap)
 		updateCdf();
+	}
 
 	size_t bin = Random::instance().randBin(cdf);
 
 	return directionFromBin(bin);
 }
 
+void CylindricalProjectionMap::freeze() {
+	if (frozen)
+		return;
+	updateCdf();
+	sampler.setWeights(pdf);
+	sampler.prepare();
+	frozen = true;
+}
+
+bool CylindricalProjectionMap::isFrozen() const {
+	return frozen;
+}
+
+size_t CylindricalProjectionMap::getSizeOf() const {
+	return sizeof(*this) + vectorSizeOf(pdf) + vectorSizeOf(cdf) + sampler.getSizeOf();
+}
+
 bool CylindricalProjectionMap::checkDirection(const Vector3d &direction) const {
 	size_t bin = binFromDirection(direction);
 	return pdf[bin];
 }
 
+double CylindricalProjectionMap::getDensity(const Vector3d &direction) const {
+	double total;
+	if (frozen) {
+		total = sampler.getTotalWeight();
+	} else {
+		if (dirty) {
+#pragma omp critical(CylindricalProjectionMap)
+			updateCdf();
+		}
+		total = cdf.back();
+	}
+	if (not (total > 0))
+		return 0;
+	// the bins are equal in area, d(sin(latitude)) x d(phi)
+	return pdf[binFromDirection(direction)] / (total * sPhi * sTheta);
+}
+
 
 const std::vector<double>& CylindricalProjectionMap::getPdf() const {
 	return pdf;
 }
 
 std::vector<double>& CylindricalProjectionMap::getPdf() {
+	// the pdf may be modified, the cdf is updated on the next draw
+	dirty = true;
 	return pdf;
 }
 
@@ -55,11 +106,11 @@ const std::vector<double>& CylindricalProjectionMap::getCdf() const {
 	return cdf;
 }
 
-size_t CylindricalProjectionMap::getNPhi() {
+size_t CylindricalProjectionMap::getNPhi() const {
 	return nPhi;
 }
 
-size_t CylindricalProjectionMap::getNTheta() {
+size_t CylindricalProjectionMap::getNTheta() const {
 	return nTheta;
 }
 
@@ -121,15 +172,77 @@ void CylindricalProjectionMap::updateCdf() const {
 EmissionMap::EmissionMap() : minEnergy(0.0001 * EeV), maxEnergy(10000 * EeV),
 	nEnergy(8*2), nPhi(360), nTheta(180) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
+	initThreadMaps();
 }
 
 EmissionMap::EmissionMap(size_t nPhi, size_t nTheta, size_t nEnergy) : minEnergy(0.0001 * EeV), maxEnergy(10000 * EeV),
 	nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
+	initThreadMaps();
 }
 
 EmissionMap::EmissionMap(size_t nPhi, size_t nTheta, size_t nEnergy, double minEnergy, double maxEnergy) : minEnergy(minEnergy), maxEnergy(maxEnergy), nEnergy(nEnergy), nPhi(nPhi), nTheta(nTheta) {
 	logStep = log10(maxEnergy / minEnergy) / nEnergy;
+	initThreadMaps();
+}
+
+void EmissionMap::initThreadMaps() {
+	frozen = false;
+	threadMapsFilled = false;
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadMaps.resize(threads);
+}
+
+void EmissionMap::addMap(map_t &maps, const key_t &key, const CylindricalProjectionMap &map) {
+	ref_ptr<CylindricalProjectionMap> &cpm = maps[key];
+	const std::vector<double> &pdf = map.getPdf();
+	if (not cpm.valid())
+		cpm = new CylindricalProjectionMap(map.getNPhi(), map.getNTheta());
+	if (pdf.size() != cpm->getPdf().size())
+		throw std::runtime_error("PDF size mismatch!");
+	for (size_t k = 0; k < pdf.size(); k++)
+		cpm->fillBin(k, pdf[k]);
+}
+
+void EmissionMap::reduce() const {
+	bool filled;
+#pragma omp atomic read
+	filled = threadMapsFilled;
+	if (not filled)
+		return;
+	map_t &m = const_cast<map_t &>(maps);
+	for (size_t t = 0; t < threadMaps.size(); t++) {
+		for (map_t::const_iterator i = threadMaps[t].begin(); i != threadMaps[t].end(); i++)
+			if (i->second.valid())
+				addMap(m, i->first, *(i->second));
+		threadMaps[t].clear();
+	}
+	threadMapsFilled = false;
+}
+
+void EmissionMap::freeze() {
+	reduce();
+	for (map_t::iterator i = maps.begin(); i != maps.end(); i++)
+		if (i->second.valid())
+			i->second->freeze();
+	frozen = true;
+}
+
+bool EmissionMap::isFrozen() const {
+	return frozen;
+}
+
+size_t EmissionMap::getSizeOf() const {
+	size_t size = 0;
+	for (map_t::const_iterator it = maps.begin(); it != maps.end(); ++it)
+		size += sizeof(*it) + it->second->getSizeOf();
+	for (size_t i = 0; i < threadMaps.size(); i++)
+		for (map_t::const_iterator it = threadMaps[i].begin(); it != threadMaps[i].end(); ++it)
+			size += sizeof(*it) + it->second->getSizeOf();
+	return size;
 }
 
 double EmissionMap::energyFromBin(size_t bin) const {
@@ -141,7 +254,29 @@ size_t EmissionMap::binFromEnergy(double energy) const {
 }
 
 void EmissionMap::fillMap(int pid, double energy, const Vector3d& direction, double weight) {
-	getMap(pid, energy)->fillBin(direction, weight);
+	if (frozen)
+		throw std::runtime_error("EmissionMap: map is frozen");
+	size_t tid = 0;
+	bool parallel = false;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+	parallel = omp_in_parallel();
+#endif
+	if (parallel and tid < threadMaps.size()) {
+		// filled without locking and added on the next access
+		ref_ptr<CylindricalProjectionMap> &cpm = threadMaps[tid][key_t(pid, binFromEnergy(energy))];
+		if (not cpm.valid())
+			cpm = new CylindricalProjectionMap(nPhi, nTheta);
+		cpm->fillBin(direction, weight);
+#pragma omp atomic write
+		threadMapsFilled = true;
+	} else if (parallel) {
+		// more threads than at construction
+#pragma omp critical(EmissionMap)
+		getMap(pid, energy)->fillBin(direction, weight);
+	} else {
+		getMap(pid, energy)->fillBin(direction, weight);
+	}
 }
 
 void EmissionMap::fillMap(const ParticleState& state, double weight) {
@@ -149,14 +284,17 @@ void EmissionMap::fillMap(const ParticleState& state, double weight) {
 }
 
 EmissionMap::map_t &EmissionMap::getMaps() {
+	reduce();
 	return maps;
 }
 
 const EmissionMap::map_t &EmissionMap::getMaps() const {
+	reduce();
 	return maps;
 }
 
 bool EmissionMap::drawDirection(int pid, double energy, Vector3d& direction) const {
+	reduce();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::const_iterator i = maps.find(key);
 
@@ -173,6 +311,7 @@ bool EmissionMap::drawDirection(const ParticleState& state, Vector3d& direction)
 }
 
 bool EmissionMap::checkDirection(int pid, double energy, const Vector3d& direction) const {
+	reduce();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::const_iterator i = maps.find(key);
 
@@ -187,19 +326,32 @@ bool EmissionMap::checkDirection(const ParticleState& state) const {
 	return checkDirection(state.getId(), state.getEnergy(), state.getDirection());
 }
 
-bool EmissionMap::hasMap(int pid, double energy) {
+bool EmissionMap::hasMap(int pid, double energy) const {
+    reduce();
     key_t key(pid, binFromEnergy(energy));
-    map_t::iterator i = maps.find(key);
+    map_t::const_iterator i = maps.find(key);
     if (i == maps.end() || !i->second.valid())
 		return false;
 	else
 		return true;
 }
 
+double EmissionMap::getDensity(int pid, double energy, const Vector3d& direction) const {
+	reduce();
+	key_t key(pid, binFromEnergy(energy));
+	map_t::const_iterator i = maps.find(key);
+	if (i == maps.end() || !i->second.valid())
+		return 0;
+	return i->second->getDensity(direction);
+}
+
 ref_ptr<CylindricalProjectionMap> EmissionMap::getMap(int pid, double energy) {
+	reduce();
 	key_t key(pid, binFromEnergy(energy));
 	map_t::iterator i = maps.find(key);
 	if (i == maps.end() || !i->second.valid()) {
+		if (frozen)
+			throw std::runtime_error("EmissionMap: map is frozen");
 		ref_ptr<CylindricalProjectionMap> cpm = new CylindricalProjectionMap(nPhi, nTheta);
 		maps[key] = cpm;
 		return cpm;
@@ -209,6 +361,7 @@ ref_ptr<CylindricalProjectionMap> EmissionMap::getMap(int pid, double energy) {
 }
 
 void EmissionMap::save(const std::string &filename) {
+	reduce();
 	std::ofstream out(filename.c_str());
 	out.imbue(std::locale("C"));
 
@@ -227,23 +380,15 @@ void EmissionMap::save(const std::string &filename) {
 void EmissionMap::merge(const EmissionMap *other) {
 	if (other == 0)
 		return;
+	if (frozen)
+		throw std::runtime_error("EmissionMap: map is frozen");
+	reduce();
 	map_t::const_iterator i = other->getMaps().begin();
 	map_t::const_iterator end = other->getMaps().end();
 	for(;i != end; i++) {
 		if (!i->second.valid())
 			continue;
-
-		std::vector<double> &otherpdf = i->second->getPdf();
-		ref_ptr<CylindricalProjectionMap> cpm = getMap(i->first.first, i->first.second);
-
-		if (otherpdf.size() != cpm->getPdf().size()) {
-			throw std::runtime_error("PDF size mismatch!");
-			break;
-		}
-
-		for (size_t k = 0; k < otherpdf.size(); k++) {
-			cpm->fillBin(k, otherpdf[k]);
-		}
+		addMap(maps, i->first, *(i->second));
 	}
 }
 
@@ -253,8 +398,53 @@ void EmissionMap::merge(const std::string &filename) {
 	merge(&em);
 }
 
+// header of the binary files
+static const char binaryMagic[8] = {'C', 'R', 'P', 'E', 'M', 'A', 'P', '1'};
+
+void EmissionMap::saveBinary(const std::string &filename) {
+	reduce();
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (not out)
+		throw std::runtime_error("EmissionMap: cannot write " + filename);
+	out.write(binaryMagic, sizeof(binaryMagic));
+	for (map_t::iterator i = maps.begin(); i != maps.end(); i++) {
+		if (!i->second.valid())
+			continue;
+		int64_t header[4] = {i->first.first, (int64_t)i->first.second,
+				(int64_t)i->second->getNPhi(), (int64_t)i->second->getNTheta()};
+		out.write((const char *) header, sizeof(header));
+		const std::vector<double> &pdf = i->second->getPdf();
+		out.write((const char *) &pdf[0], pdf.size() * sizeof(double));
+	}
+	if (not out)
+		throw std::runtime_error("EmissionMap: cannot write " + filename);
+}
+
 void EmissionMap::load(const std::string &filename) {
-	std::ifstream in(filename.c_str());
+	if (frozen)
+		throw std::runtime_error("EmissionMap: map is frozen");
+	reduce();
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char magic[sizeof(binaryMagic)];
+	if (in.read(magic, sizeof(magic)) and std::memcmp(magic, binaryMagic, sizeof(magic)) == 0) {
+		int64_t header[4];
+		while (in.read((char *) header, sizeof(header))) {
+			key_t key(header[0], header[1]);
+			if (nPhi != (size_t)header[2] or nTheta != (size_t)header[3])
+				KISS_LOG_WARNING << "nPhi/nTheta mismatch: " << nPhi << " " << nTheta
+						<< " " << header[2] << " " << header[3];
+			ref_ptr<CylindricalProjectionMap> cpm = new CylindricalProjectionMap(header[2], header[3]);
+			std::vector<double> &pdf = cpm->getPdf();
+			if (not in.read((char *) &pdf[0], pdf.size() * sizeof(double))) {
+				KISS_LOG_WARNING << "Truncated map: " << key.first << " " << key.second;
+				break;
+			}
+			maps[key] = cpm;
+		}
+		return;
+	}
+	in.clear();
+	in.seekg(0);
 	in.imbue(std::locale("C"));
 
 	while(in.good()) {
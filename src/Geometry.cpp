@@ -7,6 +7,37 @@
 
 namespace crpropa {
 
+// Surface ----------------------------------------------------------------
+double Surface::rayDistance(const Vector3d &point, const Vector3d &direction,
+		double maxDistance) const {
+	double d0 = distance(point);
+	double t = 0;
+	for (int i = 0; i < 1000 and t < maxDistance; i++) {
+		double d = distance(point + direction * t);
+		if (d * d0 <= 0 or fabs(d) <= 1e-12 * (t + fabs(d0)))
+			return t;
+		t += fabs(d);
+	}
+	return (t < maxDistance) ? t : std::numeric_limits<double>::infinity();
+}
+
+double Surface::getStepCrossing(const Candidate *candidate) const {
+	bool inside = distance(candidate->previous.getPosition()) < 0;
+	if ((distance(candidate->current.getPosition()) < 0) == inside)
+		return 1;
+	// lo on the side of the previous position, hi behind the surface
+	double lo = 0, hi = 1;
+	while (hi - lo > 1e-12) {
+		double mid = (lo + hi) / 2;
+		if ((distance(candidate->interpolatePosition(mid)) < 0) == inside)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return hi;
+}
+
+
 // Plane ------------------------------------------------------------------
 Plane::Plane(const Vector3d& _x0, const Vector3d& _n) : x0(_x0), n(_n) {
 };
@@ -33,6 +64,12 @@ Vector3d Plane::normal(const Vector3d& point) const {
 	return n;
 }
 
+double Plane::rayDistance(const Vector3d &point, const Vector3d &direction,
+		double maxDistance) const {
+	double t = -distance(point) / n.dot(direction);
+	return (t > 0) ? t : std::numeric_limits<double>::infinity();
+}
+
 
 // Sphere ------------------------------------------------------------------
 Sphere::Sphere(const Vector3d& _center, double _radius) : center(_center), radius(_radius) {
@@ -48,6 +85,28 @@ Vector3d Sphere::normal(const Vector3d& point) const {
 	return d.getUnitVector();
 }
 
+bool Sphere::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = center - Vector3d(radius);
+	upper = center + Vector3d(radius);
+	return true;
+}
+
+double Sphere::rayDistance(const Vector3d &point, const Vector3d &direction,
+		double maxDistance) const {
+	// |q + t d| = R for the point q relative to the center
+	Vector3d q = point - center;
+	double b = q.dot(direction);
+	double c = q.getR2() - radius * radius;
+	double discriminant = b * b - c;
+	if (discriminant < 0)
+		return std::numeric_limits<double>::infinity();
+	if (c <= 0)
+		return -b + sqrt(discriminant); // inside, leaving the sphere
+	if (b < 0)
+		return -b - sqrt(discriminant); // outside, entering the sphere
+	return std::numeric_limits<double>::infinity();
+}
+
 std::string Sphere::getDescription() const {
 	std::stringstream ss;
 	ss << "Sphere: " << std::endl
@@ -112,6 +171,35 @@ Vector3d ParaxialBox::normal(const Vector3d& point) const {
 	return n;
 }
 
+bool ParaxialBox::getBounds(Vector3d &lower, Vector3d &upper) const {
+	lower = corner;
+	upper = corner + size;
+	return true;
+}
+
+double ParaxialBox::rayDistance(const Vector3d &point, const Vector3d &direction,
+		double maxDistance) const {
+	// intersection of the slabs between the faces of each axis
+	double tNear = -std::numeric_limits<double>::infinity();
+	double tFar = std::numeric_limits<double>::infinity();
+	for (int i = 0; i < 3; i++) {
+		double lo = corner.data[i] - point.data[i];
+		double hi = corner.data[i] + size.data[i] - point.data[i];
+		if (direction.data[i] == 0) {
+			if (lo > 0 or hi < 0)
+				return std::numeric_limits<double>::infinity(); // parallel outside
+			continue;
+		}
+		double t0 = lo / direction.data[i];
+		double t1 = hi / direction.data[i];
+		tNear = std::max(tNear, std::min(t0, t1));
+		tFar = std::min(tFar, std::max(t0, t1));
+	}
+	if (tNear > tFar or tFar <= 0)
+		return std::numeric_limits<double>::infinity();
+	return (tNear > 0) ? tNear : tFar;
+}
+
 std::string ParaxialBox::getDescription() const {
 	std::stringstream ss;
 	ss << "ParaxialBox: " << std::endl
@@ -1,104 +1,325 @@
 #include "crpropa/GridTools.h"
 #include "crpropa/magneticField/MagneticField.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <sstream>
+#include <stdint.h>
+
+#if _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CRPROPA_HAVE_MMAP
+#endif
 
 namespace crpropa {
 
+namespace {
+
+// header of the files of dumpMappedGrid, the values start at the next page boundary
+const char gridFileMagic[8] = {'C', 'R', 'P', 'G', 'R', 'I', 'D', '1'};
+const size_t gridFileHeaderSize = 4096;
+
+struct GridFileHeader {
+	char magic[8];
+	uint32_t headerSize;
+	uint32_t components;
+	uint32_t bytesPerComponent;
+	uint32_t layout;
+	uint64_t N[3];
+	double origin[3];
+	double spacing[3];
+	uint32_t reflective;
+	uint32_t reserved;
+	double unit;
+	char unitName[64];
+};
+
+// read-only mapping of a whole file, private copy on write
+class MappedFile: public Referenced {
+	char *address;
+	size_t length;
+public:
+	MappedFile(const std::string &filename) : address(0), length(0) {
+#ifdef CRPROPA_HAVE_MMAP
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("mapGrid: " + filename + " not found");
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			throw std::runtime_error("mapGrid: could not read " + filename);
+		}
+		length = st.st_size;
+		void *p = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			throw std::runtime_error("mapGrid: could not map " + filename);
+		address = (char*) p;
+#else
+		throw std::runtime_error("mapGrid: memory mapped files are not supported on this platform");
+#endif
+	}
+
+	~MappedFile() {
+#ifdef CRPROPA_HAVE_MMAP
+		if (address)
+			munmap(address, length);
+#endif
+	}
+
+	char *data() {
+		return address;
+	}
+
+	size_t size() const {
+		return length;
+	}
+};
+
+template<typename T>
+void dumpMappedGridFile(ref_ptr<Grid<T> > grid, const std::string &filename,
+		size_t components, double unit, const std::string &unitName) {
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout)
+		throw std::runtime_error("dumpMappedGrid: could not open " + filename);
+
+	std::vector<char> buffer(gridFileHeaderSize, 0);
+	GridFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, gridFileMagic, sizeof(gridFileMagic));
+	header.headerSize = gridFileHeaderSize;
+	header.components = components;
+	header.bytesPerComponent = sizeof(float);
+	header.layout = grid->getLayout();
+	header.N[0] = grid->getNx();
+	header.N[1] = grid->getNy();
+	header.N[2] = grid->getNz();
+	Vector3d origin = grid->getOrigin(), spacing = grid->getSpacing();
+	header.origin[0] = origin.x;
+	header.origin[1] = origin.y;
+	header.origin[2] = origin.z;
+	header.spacing[0] = spacing.x;
+	header.spacing[1] = spacing.y;
+	header.spacing[2] = spacing.z;
+	header.reflective = grid->isReflective();
+	header.unit = unit;
+	std::strncpy(header.unitName, unitName.c_str(), sizeof(header.unitName) - 1);
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	fout.write(buffer.data(), buffer.size());
+
+	// values in the layout of the grid, in chunks
+	const T *values = grid->getValues();
+	size_t n = grid->getNumberOfValues();
+	std::vector<T> chunk;
+	for (size_t i = 0; i < n; i += 65536) {
+		chunk.assign(values + i, values + std::min(n, i + 65536));
+		for (size_t j = 0; j < chunk.size(); j++)
+			chunk[j] = chunk[j] / unit;
+		fout.write((const char*) chunk.data(), chunk.size() * sizeof(T));
+	}
+	if (!fout)
+		throw std::runtime_error("dumpMappedGrid: could not write " + filename);
+}
+
+template<typename T>
+ref_ptr<Grid<T> > mapGridFile(const std::string &filename, size_t components) {
+	GridFileInfo info = readGridFileInfo(filename);
+	if ((info.components != components) or (sizeof(T) != components * sizeof(float)))
+		throw std::runtime_error("mapGrid: " + filename + " holds a grid of another type");
+	GridProperties p(info.origin, info.Nx, info.Ny, info.Nz, info.spacing);
+	p.setReflective(info.reflective);
+	p.setLayout(info.layout);
+	ref_ptr<MappedFile> file = new MappedFile(filename);
+	size_t n = (file->size() - gridFileHeaderSize) / sizeof(T);
+	return new Grid<T>(p, file, (T*) (file->data() + gridFileHeaderSize), n);
+}
+
+// sum of f over the grid points, from a partial sum per x-slab that are
+// computed in parallel and added in order, so that the result does not
+// depend on the number of threads
+template<typename T, typename S, typename F>
+S sumGrid(const Grid<T> &grid, S zero, F f) {
+	size_t Nx = grid.getNx();
+	size_t Ny = grid.getNy();
+	size_t Nz = grid.getNz();
+	std::vector<S> partial(Nx, zero);
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t ix = 0; ix < Nx; ix++) {
+		S slab = zero;
+		for (size_t iy = 0; iy < Ny; iy++) {
+			S row = zero;
+			for (size_t iz = 0; iz < Nz; iz++)
+				row += f(grid.get(ix, iy, iz));
+			slab += row;
+		}
+		partial[ix] = slab;
+	}
+	S sum = zero;
+	for (size_t ix = 0; ix < Nx; ix++)
+		sum += partial[ix];
+	return sum;
+}
+
+// parse count floats from the text, separated by white space
+void parseFloats(const std::string &text, float *values, size_t count,
+		const std::string &name) {
+	const char *p = text.c_str();
+	for (size_t i = 0; i < count; i++) {
+		char *end;
+		values[i] = std::strtof(p, &end);
+		if (end == p)
+			throw std::runtime_error(name + ": file too short");
+		p = end;
+	}
+}
+
+} // namespace
+
 void scaleGrid(ref_ptr<Grid1f> grid, double a) {
-	for (int ix = 0; ix < grid->getNx(); ix++)
-		for (int iy = 0; iy < grid->getNy(); iy++)
-			for (int iz = 0; iz < grid->getNz(); iz++)
-				grid->get(ix, iy, iz) *= a;
+	float *values = grid->getValues();
+	size_t n = grid->getNumberOfValues();
+	#pragma omp parallel for
+	for (size_t i = 0; i < n; i++)
+		values[i] *= a;
 }
 
 void scaleGrid(ref_ptr<Grid3f> grid, double a) {
-	for (int ix = 0; ix < grid->getNx(); ix++)
-		for (int iy = 0; iy < grid->getNy(); iy++)
-			for (int iz = 0; iz < grid->getNz(); iz++)
-				grid->get(ix, iy, iz) *= a;
+	Vector3f *values = grid->getValues();
+	size_t n = grid->getNumberOfValues();
+	#pragma omp parallel for
+	for (size_t i = 0; i < n; i++)
+		values[i] *= a;
 }
 
 Vector3f meanFieldVector(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	Vector3f mean(0.);
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz);
-	return mean / Nx / Ny / Nz;
+	Vector3d sum = sumGrid(*grid, Vector3d(0.), [](const Vector3f &b) {
+		return Vector3d(b);
+	});
+	return Vector3f(sum / grid->getNx() / grid->getNy() / grid->getNz());
 }
 
 double meanFieldStrength(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double mean = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz).getR();
-	return mean / Nx / Ny / Nz;
+	double sum = sumGrid(*grid, 0., [](const Vector3f &b) {
+		return double(b.getR());
+	});
+	return sum / grid->getNx() / grid->getNy() / grid->getNz();
 }
 
 double meanFieldStrength(ref_ptr<Grid1f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double mean = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				mean += grid->get(ix, iy, iz);
-	return mean / Nx / Ny / Nz;
+	double sum = sumGrid(*grid, 0., [](float b) {
+		return double(b);
+	});
+	return sum / grid->getNx() / grid->getNy() / grid->getNz();
 }
 
 double rmsFieldStrength(ref_ptr<Grid3f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double sumV2 = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				sumV2 += grid->get(ix, iy, iz).getR2();
-	return std::sqrt(sumV2 / Nx / Ny / Nz);
+	double sumV2 = sumGrid(*grid, 0., [](const Vector3f &b) {
+		return Vector3d(b).getR2();
+	});
+	return std::sqrt(sumV2 / grid->getNx() / grid->getNy() / grid->getNz());
 }
 
 double rmsFieldStrength(ref_ptr<Grid1f> grid) {
-	size_t Nx = grid->getNx();
-	size_t Ny = grid->getNy();
-	size_t Nz = grid->getNz();
-	double sumV2 = 0;
-	for (int ix = 0; ix < Nx; ix++)
-		for (int iy = 0; iy < Ny; iy++)
-			for (int iz = 0; iz < Nz; iz++)
-				sumV2 += pow(grid->get(ix, iy, iz), 2);
-	return std::sqrt(sumV2 / Nx / Ny / Nz);
+	double sumV2 = sumGrid(*grid, 0., [](float b) {
+		return double(b) * b;
+	});
+	return std::sqrt(sumV2 / grid->getNx() / grid->getNy() / grid->getNz());
 }
 
 std::array<float, 3> rmsFieldStrengthPerAxis(ref_ptr<Grid3f> grid) {
-    size_t Nx = grid->getNx();
-    size_t Ny = grid->getNy();
-    size_t Nz = grid->getNz();
-    float sumV2_x = 0;
-    float sumV2_y = 0;
-    float sumV2_z = 0;
-    for (int ix = 0; ix < Nx; ix++)
-        for (int iy = 0; iy < Ny; iy++)
-            for (int iz = 0; iz < Nz; iz++) {
-                sumV2_x += pow(grid->get(ix, iy, iz).x, 2);
-                sumV2_y += pow(grid->get(ix, iy, iz).y, 2);
-                sumV2_z += pow(grid->get(ix, iy, iz).z, 2);
-            }
-    return {
-        std::sqrt(sumV2_x / Nx / Ny / Nz),
-        std::sqrt(sumV2_y / Nx / Ny / Nz),
-        std::sqrt(sumV2_z / Nx / Ny / Nz)
-    };
+	Vector3d sumV2 = sumGrid(*grid, Vector3d(0.), [](const Vector3f &b) {
+		Vector3d d(b);
+		return d * d;
+	});
+	sumV2 /= double(grid->getNx()) * grid->getNy() * grid->getNz();
+	return {
+		float(std::sqrt(sumV2.x)),
+		float(std::sqrt(sumV2.y)),
+		float(std::sqrt(sumV2.z))
+	};
+}
+
+double rmsDivergence(ref_ptr<Grid3f> grid) {
+	int n[3] = {int(grid->getNx()), int(grid->getNy()), int(grid->getNz())};
+	Vector3d spacing = grid->getSpacing();
+	bool reflective = grid->isReflective();
+	// neighbour of index i in the continued grid
+	auto neighbour = [reflective](int i, int n) {
+		return size_t(reflective ? reflectiveBoundary(i, n) : periodicBoundary(i, n));
+	};
+	// sum per x-slab, added in order as in sumGrid
+	std::vector<double> partial(n[0], 0.);
+	#pragma omp parallel for schedule(dynamic)
+	for (int ix = 0; ix < n[0]; ix++) {
+		size_t xl = neighbour(ix - 1, n[0]), xh = neighbour(ix + 1, n[0]);
+		double slab = 0;
+		for (int iy = 0; iy < n[1]; iy++) {
+			size_t yl = neighbour(iy - 1, n[1]), yh = neighbour(iy + 1, n[1]);
+			for (int iz = 0; iz < n[2]; iz++) {
+				size_t zl = neighbour(iz - 1, n[2]), zh = neighbour(iz + 1, n[2]);
+				double div = (grid->get(xh, iy, iz).x - grid->get(xl, iy, iz).x) / (2 * spacing.x)
+						+ (grid->get(ix, yh, iz).y - grid->get(ix, yl, iz).y) / (2 * spacing.y)
+						+ (grid->get(ix, iy, zh).z - grid->get(ix, iy, zl).z) / (2 * spacing.z);
+				slab += div * div;
+			}
+		}
+		partial[ix] = slab;
+	}
+	double sum = 0;
+	for (int ix = 0; ix < n[0]; ix++)
+		sum += partial[ix];
+	return std::sqrt(sum / n[0] / n[1] / n[2]);
+}
+
+std::vector<double> structureFunction(ref_ptr<Grid3f> grid, size_t maxLag, double order) {
+	if (not (order > 0))
+		throw std::runtime_error("structureFunction: the order must be positive");
+	int n[3] = {int(grid->getNx()), int(grid->getNy()), int(grid->getNz())};
+	bool reflective = grid->isReflective();
+	auto neighbour = [reflective](int i, int n) {
+		return size_t(reflective ? reflectiveBoundary(i, n) : periodicBoundary(i, n));
+	};
+	size_t lags = maxLag + 1;
+	// sums of |dB|^p per x-slab and lag, added in order as in sumGrid
+	std::vector<double> partial(n[0] * lags, 0.);
+	#pragma omp parallel for schedule(dynamic)
+	for (int ix = 0; ix < n[0]; ix++) {
+		double *slab = &partial[ix * lags];
+		for (int iy = 0; iy < n[1]; iy++) {
+			for (int iz = 0; iz < n[2]; iz++) {
+				Vector3d b(grid->get(ix, iy, iz));
+				for (size_t l = 1; l < lags; l++) {
+					Vector3d d[3] = {
+						Vector3d(grid->get(neighbour(ix + l, n[0]), iy, iz)) - b,
+						Vector3d(grid->get(ix, neighbour(iy + l, n[1]), iz)) - b,
+						Vector3d(grid->get(ix, iy, neighbour(iz + l, n[2]))) - b
+					};
+					for (int a = 0; a < 3; a++) {
+						double d2 = d[a].getR2();
+						slab[l] += (order == 2) ? d2 : pow(d2, order / 2);
+					}
+				}
+			}
+		}
+	}
+	std::vector<double> s(lags, 0.);
+	double points = 3. * n[0] * n[1] * n[2];
+	for (size_t l = 1; l < lags; l++) {
+		for (int ix = 0; ix < n[0]; ix++)
+			s[l] += partial[ix * lags + l];
+		s[l] /= points;
+	}
+	return s;
 }
 
 void fromMagneticField(ref_ptr<Grid3f> grid, ref_ptr<MagneticField> field) {
@@ -107,12 +328,19 @@ void fromMagneticField(ref_ptr<Grid3f> grid, ref_ptr<MagneticField> field) {
 	size_t Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	for (size_t ix = 0; ix < Nx; ix++)
-		for (size_t iy = 0; iy < Ny; iy++)
-			for (size_t iz = 0; iz < Nz; iz++) {
-				Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
-				Vector3d B = field->getField(pos);
-				grid->get(ix, iy, iz) = B;
+	// evaluate the field for one row of grid points at a time, the rows in parallel
+	#pragma omp parallel
+	{
+		std::vector<Vector3d> pos(Nz), B(Nz);
+		#pragma omp for schedule(dynamic)
+		for (size_t row = 0; row < Nx * Ny; row++) {
+			size_t ix = row / Ny, iy = row % Ny;
+			for (size_t iz = 0; iz < Nz; iz++)
+				pos[iz] = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+			field->getFields(pos.data(), B.data(), Nz);
+			for (size_t iz = 0; iz < Nz; iz++)
+				grid->get(ix, iy, iz) = B[iz];
+		}
 	}
 }
 
@@ -122,13 +350,136 @@ void fromMagneticFieldStrength(ref_ptr<Grid1f> grid, ref_ptr<MagneticField> fiel
 	size_t Nx = grid->getNx();
 	size_t Ny = grid->getNy();
 	size_t Nz = grid->getNz();
-	for (size_t ix = 0; ix < Nx; ix++)
+	#pragma omp parallel
+	{
+		std::vector<Vector3d> pos(Nz), B(Nz);
+		#pragma omp for schedule(dynamic)
+		for (size_t row = 0; row < Nx * Ny; row++) {
+			size_t ix = row / Ny, iy = row % Ny;
+			for (size_t iz = 0; iz < Nz; iz++)
+				pos[iz] = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+			field->getFields(pos.data(), B.data(), Nz);
+			for (size_t iz = 0; iz < Nz; iz++)
+				grid->get(ix, iy, iz) = B[iz].getR();
+		}
+	}
+}
+
+ref_ptr<Grid3f> convertLayout(ref_ptr<Grid3f> grid, gridLayout layout) {
+	ref_ptr<Grid3f> copy = new Grid3f(*grid);
+	copy->setLayout(layout);
+	return copy;
+}
+
+ref_ptr<Grid1f> convertLayout(ref_ptr<Grid1f> grid, gridLayout layout) {
+	ref_ptr<Grid1f> copy = new Grid1f(*grid);
+	copy->setLayout(layout);
+	return copy;
+}
+
+ref_ptr<Grid4f> fuseGrids(ref_ptr<Grid3f> grid, ref_ptr<Grid1f> modGrid) {
+	if ((grid->getNx() != modGrid->getNx()) or (grid->getNy() != modGrid->getNy())
+			or (grid->getNz() != modGrid->getNz()))
+		throw std::runtime_error("fuseGrids: grids of different size");
+	if (not (grid->getOrigin() == modGrid->getOrigin()) or not (grid->getSpacing() == modGrid->getSpacing()))
+		throw std::runtime_error("fuseGrids: grids of different origin or spacing");
+	if (grid->isReflective() != modGrid->isReflective())
+		throw std::runtime_error("fuseGrids: grids of different boundary conditions");
+	if ((grid->getInterpolationType() != modGrid->getInterpolationType())
+			or (grid->isClipVolume() != modGrid->isClipVolume()))
+		throw std::runtime_error("fuseGrids: grids of different interpolation");
+
+	GridProperties p(grid->getOrigin(), grid->getNx(), grid->getNy(), grid->getNz(), grid->getSpacing());
+	p.setReflective(grid->isReflective());
+	p.setInterpolationType(grid->getInterpolationType());
+	p.setLayout(grid->getLayout());
+	ref_ptr<Grid4f> fused = new Grid4f(p);
+	fused->setClipVolume(grid->isClipVolume());
+	for (size_t ix = 0; ix < grid->getNx(); ix++)
+		for (size_t iy = 0; iy < grid->getNy(); iy++)
+			for (size_t iz = 0; iz < grid->getNz(); iz++)
+				fused->get(ix, iy, iz) = Vector4f(grid->get(ix, iy, iz), modGrid->get(ix, iy, iz));
+	return fused;
+}
+
+ref_ptr<CompressedGrid3f> compressGrid(ref_ptr<Grid3f> grid, gridEncoding encoding) {
+	return new CompressedGrid3f(*grid, encoding);
+}
+
+ref_ptr<Grid3f> decompressGrid(ref_ptr<CompressedGrid3f> grid, gridLayout layout) {
+	GridProperties p(grid->getOrigin(), grid->getNx(), grid->getNy(), grid->getNz(), grid->getSpacing());
+	p.setReflective(grid->isReflective());
+	p.setLayout(layout);
+	ref_ptr<Grid3f> copy = new Grid3f(p);
+	for (size_t ix = 0; ix < grid->getNx(); ix++)
+		for (size_t iy = 0; iy < grid->getNy(); iy++)
+			for (size_t iz = 0; iz < grid->getNz(); iz++)
+				copy->get(ix, iy, iz) = grid->get(ix, iy, iz);
+	return copy;
+}
+
+double rmsCompressionError(ref_ptr<Grid3f> grid, ref_ptr<CompressedGrid3f> compressed) {
+	size_t Nx = grid->getNx();
+	size_t Ny = grid->getNy();
+	size_t Nz = grid->getNz();
+	if ((compressed->getNx() != Nx) or (compressed->getNy() != Ny) or (compressed->getNz() != Nz))
+		throw std::runtime_error("rmsCompressionError: grids of different size");
+	std::vector<double> partial(Nx);
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t ix = 0; ix < Nx; ix++) {
+		double slab = 0;
 		for (size_t iy = 0; iy < Ny; iy++)
-			for (size_t iz = 0; iz < Nz; iz++) {
-				Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
-				double s = field->getField(pos).getR();
-				grid->get(ix, iy, iz) = s;
+			for (size_t iz = 0; iz < Nz; iz++)
+				slab += Vector3d(grid->get(ix, iy, iz) - compressed->get(ix, iy, iz)).getR2();
+		partial[ix] = slab;
 	}
+	double sumV2 = 0;
+	for (size_t ix = 0; ix < Nx; ix++)
+		sumV2 += partial[ix];
+	return std::sqrt(sumV2 / Nx / Ny / Nz);
+}
+
+void dumpMappedGrid(ref_ptr<Grid3f> grid, std::string filename, double unit, std::string unitName) {
+	dumpMappedGridFile(grid, filename, 3, unit, unitName);
+}
+
+void dumpMappedGrid(ref_ptr<Grid1f> grid, std::string filename, double unit, std::string unitName) {
+	dumpMappedGridFile(grid, filename, 1, unit, unitName);
+}
+
+GridFileInfo readGridFileInfo(std::string filename) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin)
+		throw std::runtime_error("readGridFileInfo: " + filename + " not found");
+	GridFileHeader header;
+	fin.read((char*) &header, sizeof(header));
+	if (!fin or (std::memcmp(header.magic, gridFileMagic, sizeof(gridFileMagic)) != 0))
+		throw std::runtime_error("readGridFileInfo: " + filename + " is not a grid file of dumpMappedGrid");
+	if ((header.headerSize != gridFileHeaderSize) or (header.bytesPerComponent != sizeof(float))
+			or (header.layout > BRICKED))
+		throw std::runtime_error("readGridFileInfo: unsupported header in " + filename);
+
+	GridFileInfo info;
+	info.components = header.components;
+	info.Nx = header.N[0];
+	info.Ny = header.N[1];
+	info.Nz = header.N[2];
+	info.origin = Vector3d(header.origin[0], header.origin[1], header.origin[2]);
+	info.spacing = Vector3d(header.spacing[0], header.spacing[1], header.spacing[2]);
+	info.reflective = header.reflective;
+	info.layout = gridLayout(header.layout);
+	info.unit = header.unit;
+	header.unitName[sizeof(header.unitName) - 1] = 0;
+	info.unitName = header.unitName;
+	return info;
+}
+
+ref_ptr<Grid3f> mapGrid3f(std::string filename) {
+	return mapGridFile<Vector3f>(filename, 3);
+}
+
+ref_ptr<Grid1f> mapGrid1f(std::string filename) {
+	return mapGridFile<float>(filename, 1);
 }
 
 void loadGrid(ref_ptr<Grid3f> grid, std::string filename, double c) {
@@ -151,15 +502,13 @@ void loadGrid(ref_ptr<Grid3f> grid, std::string filename, double c) {
 	if (length != (3 * nx * ny * nz))
 		throw std::runtime_error("loadGrid: file and grid size do not match");
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				Vector3f &b = grid->get(ix, iy, iz);
-				fin.read((char*) &(b.x), sizeof(float));
-				fin.read((char*) &(b.y), sizeof(float));
-				fin.read((char*) &(b.z), sizeof(float));
-				b *= c;
-			}
+	// read one row along z at a time
+	std::vector<float> row(3 * nz);
+	for (size_t ix = 0; ix < nx; ix++) {
+		for (size_t iy = 0; iy < ny; iy++) {
+			fin.read((char*) row.data(), row.size() * sizeof(float));
+			for (size_t iz = 0; iz < nz; iz++)
+				grid->get(ix, iy, iz) = Vector3f(row[3 * iz], row[3 * iz + 1], row[3 * iz + 2]) * c;
 		}
 	}
 	fin.close();
@@ -185,13 +534,13 @@ void loadGrid(ref_ptr<Grid1f> grid, std::string filename, double c) {
 	if (length != (nx * ny * nz))
 		throw std::runtime_error("loadGrid: file and grid size do not match");
 
-	for (int ix = 0; ix < nx; ix++) {
-		for (int iy = 0; iy < ny; iy++) {
-			for (int iz = 0; iz < nz; iz++) {
-				float &b = grid->get(ix, iy, iz);
-				fin.read((char*) &b, sizeof(float));
-				b *= c;
-			}
+	// read one row along z at a time
+	std::vector<float> row(nz);
+	for (size_t ix = 0; ix < nx; ix++) {
+		for (size_t iy = 0; iy < ny; iy++) {
+			fin.read((char*) row.data(), row.size() * sizeof(float));
+			for (size_t iz = 0; iz < nz; iz++)
+				grid->get(ix, iy, iz) = row[iz] * c;
 		}
 	}
 	fin.close();
@@ -204,14 +553,18 @@ void dumpGrid(ref_ptr<Grid3f> grid, std::string filename, double c) {
 		ss << "dump Grid3f: " << filename << " not found";
 		throw std::runtime_error(ss.str());
 	}
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
+	// write one row along z at a time
+	size_t nz = grid->getNz();
+	std::vector<float> row(3 * nz);
+	for (size_t ix = 0; ix < grid->getNx(); ix++) {
+		for (size_t iy = 0; iy < grid->getNy(); iy++) {
+			for (size_t iz = 0; iz < nz; iz++) {
 				Vector3f b = grid->get(ix, iy, iz) * c;
-				fout.write((char*) &(b.x), sizeof(float));
-				fout.write((char*) &(b.y), sizeof(float));
-				fout.write((char*) &(b.z), sizeof(float));
+				row[3 * iz] = b.x;
+				row[3 * iz + 1] = b.y;
+				row[3 * iz + 2] = b.z;
 			}
+			fout.write((const char*) row.data(), row.size() * sizeof(float));
 		}
 	}
 	fout.close();
@@ -224,12 +577,14 @@ void dumpGrid(ref_ptr<Grid1f> grid, std::string filename, double c) {
 		ss << "dump Grid1f: " << filename << " not found";
 		throw std::runtime_error(ss.str());
 	}
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				float b = grid->get(ix, iy, iz) * c;
-				fout.write((char*) &b, sizeof(float));
-			}
+	// write one row along z at a time
+	size_t nz = grid->getNz();
+	std::vector<float> row(nz);
+	for (size_t ix = 0; ix < grid->getNx(); ix++) {
+		for (size_t iy = 0; iy < grid->getNy(); iy++) {
+			for (size_t iz = 0; iz < nz; iz++)
+				row[iz] = grid->get(ix, iy, iz) * c;
+			fout.write((const char*) row.data(), row.size() * sizeof(float));
 		}
 	}
 	fout.close();
@@ -246,17 +601,18 @@ void loadGridFromTxt(ref_ptr<Grid3f> grid, std::string filename, double c) {
 	while (fin.peek() == '#')
 		fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				Vector3f &b = grid->get(ix, iy, iz);
-				fin >> b.x >> b.y >> b.z;
-				b *= c;
-				if (fin.eof())
-					throw std::runtime_error("load Grid3f: file too short");
+	// read the values at once and parse them without the stream
+	std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	size_t nx = grid->getNx(), ny = grid->getNy(), nz = grid->getNz();
+	std::vector<float> values(3 * nx * ny * nz);
+	parseFloats(text, values.data(), values.size(), "load Grid3f");
+	#pragma omp parallel for
+	for (size_t ix = 0; ix < nx; ix++)
+		for (size_t iy = 0; iy < ny; iy++)
+			for (size_t iz = 0; iz < nz; iz++) {
+				const float *v = &values[3 * ((ix * ny + iy) * nz + iz)];
+				grid->get(ix, iy, iz) = Vector3f(v[0], v[1], v[2]) * c;
 			}
-		}
-	}
 	fin.close();
 }
 
@@ -271,17 +627,16 @@ void loadGridFromTxt(ref_ptr<Grid1f> grid, std::string filename, double c) {
 	while (fin.peek() == '#')
 		fin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				float &b = grid->get(ix, iy, iz);
-				fin >> b;
-				b *= c;
-				if (fin.eof())
-					throw std::runtime_error("load Grid1f: file too short");
-			}
-		}
-	}
+	// read the values at once and parse them without the stream
+	std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	size_t nx = grid->getNx(), ny = grid->getNy(), nz = grid->getNz();
+	std::vector<float> values(nx * ny * nz);
+	parseFloats(text, values.data(), values.size(), "load Grid1f");
+	#pragma omp parallel for
+	for (size_t ix = 0; ix < nx; ix++)
+		for (size_t iy = 0; iy < ny; iy++)
+			for (size_t iz = 0; iz < nz; iz++)
+				grid->get(ix, iy, iz) = values[(ix * ny + iy) * nz + iz] * c;
 	fin.close();
 }
 
@@ -323,81 +678,107 @@ void dumpGridToTxt(ref_ptr<Grid1f> grid, std::string filename, double c) {
 
 #ifdef CRPROPA_HAVE_FFTW3F
 
-std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
-
-  double rms = rmsFieldStrength(grid);
-  size_t n = grid->getNx(); // size of array
+void initFFTWThreads() {
+#ifdef CRPROPA_HAVE_FFTW3F_THREADS
+  static bool initialized = false;
+#pragma omp critical(fftwPlanner)
+  {
+    if (not initialized)
+      initialized = (fftwf_init_threads() != 0);
+#ifdef _OPENMP
+    if (initialized)
+      fftwf_plan_with_nthreads(omp_get_max_threads());
+#endif
+  }
+#endif // CRPROPA_HAVE_FFTW3F_THREADS
+}
 
-  // arrays to hold the complex vector components of the B(k)-field
-  fftwf_complex *Bkx, *Bky, *Bkz;
-  Bkx = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n);
-  Bky = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n);
-  Bkz = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n);
-
-  fftwf_complex *Bx = (fftwf_complex *)Bkx;
-  fftwf_complex *By = (fftwf_complex *)Bky;
-  fftwf_complex *Bz = (fftwf_complex *)Bkz;
-
-  // save to temp
-  int i;
-  for (size_t ix = 0; ix < n; ix++) {
-    for (size_t iy = 0; iy < n; iy++) {
-      for (size_t iz = 0; iz < n; iz++) {
-        i = ix * n * n + iy * n + iz;
-        Vector3<float> &b = grid->get(ix, iy, iz);
-        Bx[i][0] = b.x / rms;
-        By[i][0] = b.y / rms;
-        Bz[i][0] = b.z / rms;
-      }
-    }
+namespace {
+
+// forward transform of the component c of a cubic grid into the complex half
+// spectrum Bk of n * n * (n / 2 + 1) modes; B is a buffer for non-dense grids
+void transformComponent(const Grid3f &grid, int c, fftwf_complex *Bk,
+                        std::vector<float> &B) {
+  size_t n = grid.getNx();
+  int dims[3] = {int(n), int(n), int(n)};
+  // out-of-place, real to complex, forward Fourier transformation, which
+  // keeps the input; only the modes with iz <= n/2 are computed
+  float *in = (float *)grid.getValues() + c;
+  int stride = 3;
+  if (grid.getLayout() != DENSE) {
+    B.resize(n * n * n);
+    #pragma omp parallel for
+    for (size_t ix = 0; ix < n; ix++)
+      for (size_t iy = 0; iy < n; iy++)
+        for (size_t iz = 0; iz < n; iz++) {
+          const Vector3f &b = grid.get(ix, iy, iz);
+          B[ix * n * n + iy * n + iz] = (c == 0) ? b.x : ((c == 1) ? b.y : b.z);
+        }
+    in = B.data();
+    stride = 1;
   }
+  fftwf_plan plan;
+#pragma omp critical(fftwPlanner)
+  plan = fftwf_plan_many_dft_r2c(3, dims, 1, in, NULL, stride, 0, Bk, NULL,
+                                 1, 0, FFTW_ESTIMATE);
+  fftwf_execute(plan);
+#pragma omp critical(fftwPlanner)
+  fftwf_destroy_plan(plan);
+}
 
-  // in-place, real to complex, inverse Fourier transformation on each component
-  // note that the last elements of B(x) are unused now
-  fftwf_plan plan_x =
-      fftwf_plan_dft_3d(n, n, n, Bx, Bkx, FFTW_FORWARD, FFTW_ESTIMATE);
-  fftwf_execute(plan_x);
-  fftwf_destroy_plan(plan_x);
+void checkCubic(const Grid3f &grid, const std::string &name) {
+  if ((grid.getNy() != grid.getNx()) or (grid.getNz() != grid.getNx()))
+    throw std::runtime_error(name + ": the grid has to be cubic");
+}
 
-  fftwf_plan plan_y =
-      fftwf_plan_dft_3d(n, n, n, By, Bky, FFTW_FORWARD, FFTW_ESTIMATE);
-  fftwf_execute(plan_y);
-  fftwf_destroy_plan(plan_y);
+// wave number of the index i of n modes
+inline int waveNumber(size_t i, size_t n) {
+  return (i <= n / 2) ? int(i) : int(i) - int(n);
+}
 
-  fftwf_plan plan_z =
-      fftwf_plan_dft_3d(n, n, n, Bz, Bkz, FFTW_FORWARD, FFTW_ESTIMATE);
-  fftwf_execute(plan_z);
-  fftwf_destroy_plan(plan_z);
+} // namespace
 
-  float power;
-  std::map<size_t, std::pair<float, int>> spectrum;
-  int k;
-
-  for (size_t ix = 0; ix < n; ix++) {
-    for (size_t iy = 0; iy < n; iy++) {
-      for (size_t iz = 0; iz < n; iz++) {
-        i = ix * n * n + iy * n + iz;
-        k = static_cast<int>(
-            std::floor(std::sqrt(ix * ix + iy * iy + iz * iz)));
-        if (k > n / 2. || k == 0)
-          continue;
-        power = ((Bkx[i][0] * Bkx[i][0] + Bkx[i][1] * Bkx[i][1]) +
-                 (Bky[i][0] * Bky[i][0] + Bky[i][1] * Bky[i][1]) +
-                 (Bkz[i][0] * Bkz[i][0] + Bkz[i][1] * Bkz[i][1]));
-        if (spectrum.find(k) == spectrum.end()) {
-          spectrum[k].first = power;
-          spectrum[k].second = 1;
-        } else {
-          spectrum[k].first += power;
-          spectrum[k].second += 1;
+std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
+
+  double rms = rmsFieldStrength(grid);
+  size_t n = grid->getNx(); // size of array
+  size_t n2 = n / 2 + 1;    // size of the half spectrum in z-direction
+  initFFTWThreads();
+
+  // array to hold the complex half spectrum of one component of the B(k)-field
+  fftwf_complex *Bk =
+      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+  // copy of a component, if the values are not dense
+  std::vector<float> B;
+
+  std::vector<double> power(n / 2 + 1, 0.);
+  std::vector<int> count(n / 2 + 1, 0);
+
+  for (int c = 0; c < 3; c++) {
+    transformComponent(*grid, c, Bk, B);
+
+    for (size_t ix = 0; ix < n; ix++) {
+      for (size_t iy = 0; iy < n; iy++) {
+        for (size_t iz = 0; iz < n2; iz++) {
+          size_t i = ix * n * n2 + iy * n2 + iz;
+          int k = static_cast<int>(
+              std::floor(std::sqrt(ix * ix + iy * iy + iz * iz)));
+          if (k > n / 2. || k == 0)
+            continue;
+          power[k] += (Bk[i][0] * Bk[i][0] + Bk[i][1] * Bk[i][1]) / (rms * rms);
+          if (c == 0)
+            count[k]++;
         }
       }
     }
   }
 
-  fftwf_free(Bkx);
-  fftwf_free(Bky);
-  fftwf_free(Bkz);
+  fftwf_free(Bk);
+
+  std::map<size_t, std::pair<float, int>> spectrum;
+  for (size_t k = 1; k < count.size(); k++)
+    if (count[k] > 0)
+      spectrum[k] = std::make_pair(float(power[k]), count[k]);
 
   std::vector<std::pair<int, float>> points;
   for (std::map<size_t, std::pair<float, int>>::iterator it = spectrum.begin();
@@ -409,6 +790,120 @@ std::vector<std::pair<int, float>> gridPowerSpectrum(ref_ptr<Grid3f> grid) {
   return points;
 }
 
+double gridCorrelationLength(ref_ptr<Grid3f> grid) {
+  checkCubic(*grid, "gridCorrelationLength");
+  size_t n = grid->getNx();
+  size_t n2 = n / 2 + 1;
+  initFFTWThreads();
+
+  fftwf_complex *Bk =
+      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+  std::vector<float> B;
+
+  // energy in the shells |k| = 1, ..., n/2 in units of 2 pi / (n spacing)
+  std::vector<double> energy(n2, 0.);
+  for (int c = 0; c < 3; c++) {
+    transformComponent(*grid, c, Bk, B);
+    #pragma omp parallel
+    {
+      std::vector<double> shells(n2, 0.);
+      #pragma omp for
+      for (size_t ix = 0; ix < n; ix++) {
+        int kx = waveNumber(ix, n);
+        for (size_t iy = 0; iy < n; iy++) {
+          int ky = waveNumber(iy, n);
+          for (size_t iz = 0; iz < n2; iz++) {
+            size_t k = size_t(std::floor(std::sqrt(double(kx * kx + ky * ky + iz * iz)) + 0.5));
+            if ((k == 0) or (k >= n2))
+              continue;
+            // the modes 0 < iz < n/2 stand for their complex conjugates as well
+            double w = ((iz == 0) or (2 * iz == n)) ? 1 : 2;
+            size_t i = ix * n * n2 + iy * n2 + iz;
+            shells[k] += w * (Bk[i][0] * Bk[i][0] + Bk[i][1] * Bk[i][1]);
+          }
+        }
+      }
+      #pragma omp critical(gridCorrelationLength)
+      for (size_t k = 0; k < n2; k++)
+        energy[k] += shells[k];
+    }
+  }
+  fftwf_free(Bk);
+
+  double sum = 0, weighted = 0;
+  for (size_t k = 1; k < n2; k++) {
+    sum += energy[k];
+    weighted += energy[k] / k;
+  }
+  if (sum == 0)
+    return 0;
+  // 1/2 * (2 pi / k) with k = 2 pi k_i / (n spacing)
+  return 0.5 * n * grid->getSpacing().x * weighted / sum;
+}
+
+double gridRelativeHelicity(ref_ptr<Grid3f> grid) {
+  checkCubic(*grid, "gridRelativeHelicity");
+  size_t n = grid->getNx();
+  size_t n2 = n / 2 + 1;
+  initFFTWThreads();
+
+  // k <A_k* . B_k> = 2 k/|k| . (Re B_k x Im B_k), whose components are
+  // Im(B_i* B_j) of two components; with two transforms at a time:
+  // (x, y) for the z-term, (z, y) for the x-term, (z, x) for the y-term
+  fftwf_complex *P =
+      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+  fftwf_complex *Q =
+      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+  std::vector<float> B;
+  const int first[3] = {0, 2, 2}; // component in P
+  const int second[3] = {1, 1, 0}; // component in Q
+  const int term[3] = {2, 0, 1}; // component of the wave vector
+  const double sign[3] = {1, -1, 1}; // Im(B_z* B_y) = -Im(B_y* B_z)
+
+  double helicity = 0, energy = 0;
+  for (int s = 0; s < 3; s++) {
+    // the previous transforms are reused
+    if ((s == 0) or (first[s] != first[s - 1]))
+      transformComponent(*grid, first[s], P, B);
+    if ((s == 0) or (second[s] != second[s - 1]))
+      transformComponent(*grid, second[s], Q, B);
+    bool sumP = (s == 0) or (first[s] != first[s - 1]);
+    bool sumQ = (s == 0);
+    double h = 0, e = 0;
+    #pragma omp parallel for reduction(+: h, e)
+    for (size_t ix = 0; ix < n; ix++) {
+      int kx = waveNumber(ix, n);
+      for (size_t iy = 0; iy < n; iy++) {
+        int ky = waveNumber(iy, n);
+        for (size_t iz = 0; iz < n2; iz++) {
+          int kz = iz;
+          double k = std::sqrt(double(kx * kx + ky * ky + kz * kz));
+          if (k == 0)
+            continue;
+          double w = ((iz == 0) or (2 * iz == n)) ? 1 : 2;
+          size_t i = ix * n * n2 + iy * n2 + iz;
+          int kc = (term[s] == 0) ? kx : ((term[s] == 1) ? ky : kz);
+          // Im(P* Q)
+          double im = P[i][0] * Q[i][1] - P[i][1] * Q[i][0];
+          h += w * 2 * sign[s] * kc / k * im;
+          if (sumP)
+            e += w * (P[i][0] * P[i][0] + P[i][1] * P[i][1]);
+          if (sumQ)
+            e += w * (Q[i][0] * Q[i][0] + Q[i][1] * Q[i][1]);
+        }
+      }
+    }
+    helicity += h;
+    energy += e;
+  }
+  fftwf_free(P);
+  fftwf_free(Q);
+
+  if (energy == 0)
+    return 0;
+  return helicity / energy;
+}
+
 #endif // CRPROPA_HAVE_FFTW3F
 
 
@@ -0,0 +1,99 @@
+#include "crpropa/LookupTable.h"
+
+#include <stdexcept>
+
+namespace crpropa {
+
+// the nodes are equidistant if no node deviates by more than a quarter of the spacing
+static bool isEquidistant(const std::vector<double> &X, bool logarithmic, double &lo, double &step) {
+	size_t n = X.size();
+	if (logarithmic and not (X.front() > 0))
+		return false;
+	lo = logarithmic ? std::log(X.front()) : X.front();
+	double hi = logarithmic ? std::log(X.back()) : X.back();
+	step = (hi - lo) / (n - 1);
+	if (not (step > 0))
+		return false;
+	for (size_t i = 0; i < n; i++) {
+		double x = logarithmic ? std::log(X[i]) : X[i];
+		if (not (std::fabs(x - lo - i * step) <= 0.25 * step))
+			return false;
+	}
+	return true;
+}
+
+TableAxis::TableAxis() :
+		spacing(Irregular), lo(0), invStep(0) {
+}
+
+TableAxis::TableAxis(const std::vector<double> &X) {
+	assign(X);
+}
+
+void TableAxis::assign(const std::vector<double> &nodes) {
+	X = nodes;
+	spacing = Irregular;
+	lo = invStep = 0;
+	if (X.size() < 2)
+		return;
+
+	double step;
+	if (isEquidistant(X, false, lo, step))
+		spacing = Linear;
+	else if (isEquidistant(X, true, lo, step))
+		spacing = Logarithmic;
+	else
+		return;
+	invStep = 1. / step;
+}
+
+LogGridTable::LogGridTable() {
+}
+
+LogGridTable::LogGridTable(const std::vector<double> &X, const std::vector<double> &Y) {
+	assign(X, Y);
+}
+
+void LogGridTable::assign(const std::vector<double> &X, const std::vector<double> &Y) {
+	if (X.size() != Y.size())
+		throw std::runtime_error("LogGridTable: number of nodes and values differ");
+	this->X.assign(X);
+	this->Y = Y;
+}
+
+void LogGridTable::evaluate(const double *x, double *y, size_t n) const {
+#if _OPENMP >= 201307
+	#pragma omp simd
+#endif
+	for (size_t i = 0; i < n; i++)
+		y[i] = (*this)(x[i]);
+}
+
+UniformTable2D::UniformTable2D() {
+}
+
+UniformTable2D::UniformTable2D(const std::vector<double> &X, const std::vector<double> &Y,
+		const std::vector<double> &Z) {
+	assign(X, Y, Z);
+}
+
+void UniformTable2D::assign(const std::vector<double> &X, const std::vector<double> &Y,
+		const std::vector<double> &Z) {
+	if ((X.size() < 2) or (Y.size() < 2))
+		throw std::runtime_error("UniformTable2D: at least two nodes per axis needed");
+	if (Z.size() != X.size() * Y.size())
+		throw std::runtime_error("UniformTable2D: number of values is not the product of the numbers of nodes");
+	this->X.assign(X);
+	this->Y.assign(Y);
+	this->Z = Z;
+}
+
+void UniformTable2D::evaluate(const double *x, const double *y, double *z, size_t n) const {
+#if _OPENMP >= 201307
+	#pragma omp simd
+#endif
+	for (size_t i = 0; i < n; i++)
+		z[i] = (*this)(x[i], y[i]);
+}
+
+} // namespace crpropa
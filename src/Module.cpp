@@ -1,5 +1,9 @@
 #include "crpropa/Module.h"
+#include "crpropa/Random.h"
+#include "crpropa/ScratchVector.h"
 
+#include <cmath>
+#include <stdexcept>
 #include <typeinfo>
 
 namespace crpropa {
@@ -17,6 +21,101 @@ void Module::setDescription(const std::string &d) {
 	description = d;
 }
 
+size_t Module::getSizeOf() const {
+	return 0;
+}
+
+void Module::endRun() {
+}
+
+void Module::processSecondaryRecord(const SecondaryRecord &record,
+		Candidate *parent) const {
+	ref_ptr<Candidate> candidate = parent->createSecondary(record);
+	process(candidate);
+}
+
+void Module::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	for (size_t i = 0; i < candidates.size(); i++)
+		process(candidates[i].get());
+}
+
+StochasticInteraction::StochasticInteraction() :
+		lgEnergyTolerance(0), redshiftTolerance(0) {
+}
+
+void StochasticInteraction::setRateTolerance(double lgEnergy, double redshift) {
+	if ((lgEnergy < 0) or (redshift < 0))
+		throw std::runtime_error("StochasticInteraction: tolerances must be >= 0");
+	lgEnergyTolerance = lgEnergy;
+	redshiftTolerance = redshift;
+}
+
+double StochasticInteraction::getRateEnergyTolerance() const {
+	return lgEnergyTolerance;
+}
+
+double StochasticInteraction::getRateRedshiftTolerance() const {
+	return redshiftTolerance;
+}
+
+double StochasticInteraction::getCachedInteractionRate(Candidate *candidate) const {
+	if ((lgEnergyTolerance == 0) and (redshiftTolerance == 0))
+		return getInteractionRate(candidate);
+	InteractionRateCache &cache = candidate->getRateCache();
+	double rate;
+	if (cache.find(this, candidate->current, candidate->getRedshift(), rate))
+		return rate;
+	rate = getInteractionRate(candidate);
+	cache.store(this, candidate->current, candidate->getRedshift(), rate,
+			lgEnergyTolerance, redshiftTolerance);
+	return rate;
+}
+
+void StochasticInteraction::processInteractionBatch(
+		const std::vector<ref_ptr<Candidate> > &candidates, double limit) const {
+	size_t n = candidates.size();
+	if (n == 0)
+		return;
+	Random &random = Random::instance();
+
+	// rates and interaction distances of all candidates
+	ScratchVector<double> rates(n), distances(n);
+	for (size_t i = 0; i < n; i++)
+		rates[i] = getCachedInteractionRate(candidates[i]);
+	random.fillExponential(&distances[0], n);
+
+	// limit the next step of the candidates without interaction, collect the others
+	ScratchVector<size_t> interacting;
+	for (size_t i = 0; i < n; i++) {
+		if (rates[i] == 0)
+			continue;
+		distances[i] /= rates[i];
+		if (candidates[i]->getCurrentStep() < distances[i])
+			candidates[i]->limitNextStep(limit / rates[i]);
+		else
+			interacting->push_back(i);
+	}
+
+	// interact and repeat with the remaining step, one by one
+	for (size_t k = 0; k < interacting.size(); k++) {
+		Candidate *candidate = candidates[interacting[k]];
+		double step = candidate->getCurrentStep() - distances[interacting[k]];
+		interact(candidate);
+		while (step > 0) {
+			double rate = getCachedInteractionRate(candidate);
+			if (rate == 0)
+				break;
+			double randDist = -log(random.rand()) / rate;
+			if (step < randDist) {
+				candidate->limitNextStep(limit / rate);
+				break;
+			}
+			interact(candidate);
+			step -= randDist;
+		}
+	}
+}
+
 AbstractCondition::AbstractCondition() :
 		makeRejectedInactive(true), makeAcceptedInactive(false), rejectFlagKey(
 				"Rejected") {
@@ -77,4 +176,20 @@ void AbstractCondition::setAcceptFlag(std::string key, std::string value) {
 	acceptFlagValue = value;
 }
 
+size_t AbstractCondition::getSizeOf() const {
+	size_t size = 0;
+	if (rejectAction.valid())
+		size += rejectAction->getSizeOf();
+	if (acceptAction.valid())
+		size += acceptAction->getSizeOf();
+	return size;
+}
+
+void AbstractCondition::endRun() {
+	if (rejectAction.valid())
+		rejectAction->endRun();
+	if (acceptAction.valid())
+		acceptAction->endRun();
+}
+
 } // namespace crpropa
@@ -0,0 +1,276 @@
+#include "crpropa/MultilevelMonteCarlo.h"
+#include "crpropa/Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+MultilevelMonteCarlo::Level::Level(ModuleList *simulation) :
+		simulation(simulation), samples(0), sum(0), sum2(0), fineSum(0), time(0) {
+}
+
+MultilevelMonteCarlo::MultilevelMonteCarlo(double targetUncertainty,
+		size_t initialSamples, uint64_t seed) :
+		seed(seed), energyMin(0), energyMax(std::numeric_limits<double>::max()),
+		energyPower(0) {
+	setTargetUncertainty(targetUncertainty);
+	setInitialSamples(initialSamples);
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadSums.resize(threads);
+	setDescription("MultilevelMonteCarlo");
+}
+
+void MultilevelMonteCarlo::addLevel(ModuleList *simulation) {
+	if (simulation == NULL)
+		throw std::runtime_error("MultilevelMonteCarlo: invalid simulation");
+	if (simulation->getSecondaryTasks())
+		throw std::runtime_error("MultilevelMonteCarlo: secondary tasks are not supported");
+	levels.push_back(Level(simulation));
+}
+
+size_t MultilevelMonteCarlo::size() const {
+	return levels.size();
+}
+
+void MultilevelMonteCarlo::setTargetUncertainty(double u) {
+	if (not (u > 0))
+		throw std::runtime_error("MultilevelMonteCarlo: the uncertainty must be positive");
+	targetUncertainty = u;
+}
+
+double MultilevelMonteCarlo::getTargetUncertainty() const {
+	return targetUncertainty;
+}
+
+void MultilevelMonteCarlo::setInitialSamples(size_t n) {
+	if (n < 2)
+		throw std::runtime_error("MultilevelMonteCarlo: at least 2 initial samples are needed");
+	initialSamples = n;
+}
+
+size_t MultilevelMonteCarlo::getInitialSamples() const {
+	return initialSamples;
+}
+
+void MultilevelMonteCarlo::setEnergyRange(double eMin, double eMax) {
+	if (not (eMin < eMax))
+		throw std::runtime_error("MultilevelMonteCarlo: invalid energy range");
+	energyMin = eMin;
+	energyMax = eMax;
+}
+
+void MultilevelMonteCarlo::setEnergyPower(double power) {
+	energyPower = power;
+}
+
+void MultilevelMonteCarlo::process(Candidate *candidate) const {
+	double E = candidate->current.getEnergy();
+	if ((E < energyMin) or (E >= energyMax))
+		return;
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+	if (tid >= threadSums.size())
+		throw std::runtime_error("MultilevelMonteCarlo: more threads than at construction");
+#endif
+	double value = candidate->getWeight();
+	if (energyPower != 0)
+		value *= pow(E, energyPower);
+	threadSums[tid] += value;
+}
+
+double MultilevelMonteCarlo::sample(ModuleList *simulation, Candidate *primary,
+		uint64_t stream) const {
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	Random::instance().seedStream(seed, stream);
+	threadSums[tid] = 0;
+	simulation->run(primary->clone(), true);
+	return threadSums[tid];
+}
+
+void MultilevelMonteCarlo::runSamples(SourceInterface *source, size_t l, size_t n) {
+	Level &level = levels[l];
+	size_t first = level.samples;
+	double sum = 0, sum2 = 0, fineSum = 0, time = 0;
+	bool failed = false;
+	std::string error;
+
+#pragma omp parallel reduction(+: sum, sum2, fineSum, time)
+	{
+		// the generator of the thread is left in its previous mode and state;
+		// the copy is only assigned back, so its pointer into the state stays valid
+		Random &random = Random::instance();
+		Random previous = random;
+
+#pragma omp for schedule(dynamic, 1)
+		for (long i = 0; i < long(n); i++) {
+			if (failed)
+				continue;
+			try {
+				// streams (level, sample, 0) for the primary and (level, sample, 1) for its propagation
+				uint64_t stream = ((uint64_t(l) << 40) + first + i) << 1;
+				random.seedStream(seed, stream);
+				ref_ptr<Candidate> primary = source->getCandidate();
+
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				double fine = sample(level.simulation, primary, stream + 1);
+				double coarse = 0;
+				if (l > 0)
+					coarse = sample(levels[l - 1].simulation, primary, stream + 1);
+				time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				double y = fine - coarse;
+				sum += y;
+				sum2 += y * y;
+				fineSum += fine;
+			} catch (std::exception &e) {
+#pragma omp critical(MultilevelMonteCarloError)
+				{
+					failed = true;
+					error = e.what();
+				}
+			}
+		}
+
+		random = previous;
+	}
+
+	if (failed)
+		throw std::runtime_error("MultilevelMonteCarlo: " + error);
+
+	level.samples += n;
+	level.sum += sum;
+	level.sum2 += sum2;
+	level.fineSum += fineSum;
+	level.time += time;
+}
+
+void MultilevelMonteCarlo::run(SourceInterface *source, size_t maxSamples) {
+	if (levels.empty())
+		throw std::runtime_error("MultilevelMonteCarlo: no levels");
+	if (source == NULL)
+		throw std::runtime_error("MultilevelMonteCarlo: invalid source");
+
+	size_t total = 0;
+	while (total < maxSamples) {
+		// the initial samples, then the missing samples of the levels for the target
+		std::vector<size_t> missing(levels.size(), 0);
+		size_t sumMissing = 0;
+		for (size_t l = 0; l < levels.size(); l++) {
+			size_t target = std::max(initialSamples, levels[l].samples);
+			if (levels[l].samples >= initialSamples)
+				target = getOptimalSamples(l);
+			if (target > levels[l].samples)
+				missing[l] = target - levels[l].samples;
+			sumMissing += missing[l];
+		}
+		if (sumMissing == 0)
+			break;
+
+		for (size_t l = 0; (l < levels.size()) and (total < maxSamples); l++) {
+			size_t n = std::min(missing[l], maxSamples - total);
+			if (n == 0)
+				continue;
+			runSamples(source, l, n);
+			total += n;
+		}
+	}
+}
+
+void MultilevelMonteCarlo::reset() {
+	for (size_t l = 0; l < levels.size(); l++)
+		levels[l] = Level(levels[l].simulation);
+}
+
+size_t MultilevelMonteCarlo::getOptimalSamples(size_t l) const {
+	// N_l = sqrt(V_l / C_l) sum_k sqrt(V_k C_k) / eps^2
+	double sum = 0;
+	for (size_t k = 0; k < levels.size(); k++)
+		sum += sqrt(getLevelVariance(k) * getLevelCost(k));
+	double cost = getLevelCost(l);
+	if (not (sum > 0) or not (cost > 0))
+		return levels[l].samples;
+	double n = sqrt(getLevelVariance(l) / cost) * sum / (targetUncertainty * targetUncertainty);
+	if (not (n < double(std::numeric_limits<size_t>::max())))
+		return std::numeric_limits<size_t>::max();
+	return size_t(ceil(n));
+}
+
+double MultilevelMonteCarlo::getValue() const {
+	double value = 0;
+	for (size_t l = 0; l < levels.size(); l++)
+		value += getLevelMean(l);
+	return value;
+}
+
+double MultilevelMonteCarlo::getUncertainty() const {
+	double variance = 0;
+	for (size_t l = 0; l < levels.size(); l++) {
+		if (levels[l].samples < 2)
+			return std::numeric_limits<double>::infinity();
+		variance += getLevelVariance(l) / levels[l].samples;
+	}
+	return sqrt(variance);
+}
+
+size_t MultilevelMonteCarlo::getSamples(size_t l) const {
+	return levels.at(l).samples;
+}
+
+double MultilevelMonteCarlo::getLevelMean(size_t l) const {
+	const Level &level = levels.at(l);
+	if (level.samples == 0)
+		return 0;
+	return level.sum / level.samples;
+}
+
+double MultilevelMonteCarlo::getLevelVariance(size_t l) const {
+	const Level &level = levels.at(l);
+	if (level.samples < 2)
+		return 0;
+	double mean = level.sum / level.samples;
+	double variance = (level.sum2 - level.samples * mean * mean) / (level.samples - 1);
+	return std::max(variance, 0.);
+}
+
+double MultilevelMonteCarlo::getLevelObservable(size_t l) const {
+	const Level &level = levels.at(l);
+	if (level.samples == 0)
+		return 0;
+	return level.fineSum / level.samples;
+}
+
+double MultilevelMonteCarlo::getLevelCost(size_t l) const {
+	const Level &level = levels.at(l);
+	if (level.samples == 0)
+		return 0;
+	return level.time / level.samples;
+}
+
+std::string MultilevelMonteCarlo::getDescription() const {
+	std::stringstream s;
+	s << "MultilevelMonteCarlo: " << levels.size() << " levels, target uncertainty "
+			<< targetUncertainty;
+	for (size_t l = 0; l < levels.size(); l++)
+		s << "\n  level " << l << ": " << levels[l].samples << " samples, mean "
+				<< getLevelMean(l) << ", variance " << getLevelVariance(l)
+				<< ", cost " << getLevelCost(l) << " s";
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,141 @@
+#include "crpropa/Numa.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// cpus or nodes of a list like "0-3,8,10-11"
+std::vector<int> parseList(const std::string &list) {
+	std::vector<int> values;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		int first, last;
+		int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+		if (n < 1)
+			continue;
+		if (n == 1)
+			last = first;
+		for (int i = first; i <= last; i++)
+			values.push_back(i);
+	}
+	return values;
+}
+
+bool readLine(const std::string &filename, std::string &line) {
+	std::ifstream in(filename.c_str());
+	return std::getline(in, line) ? true : false;
+}
+
+} // namespace
+
+std::vector<NumaNode> getNumaNodes() {
+	std::vector<NumaNode> nodes;
+	std::string line;
+	if (readLine("/sys/devices/system/node/online", line)) {
+		std::vector<int> ids = parseList(line);
+		for (size_t i = 0; i < ids.size(); i++) {
+			std::stringstream filename;
+			filename << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+			NumaNode node;
+			node.id = ids[i];
+			if (readLine(filename.str(), line))
+				node.cpus = parseList(line);
+			// nodes with memory only
+			if (not node.cpus.empty())
+				nodes.push_back(node);
+		}
+	}
+	if (nodes.empty()) {
+		NumaNode node;
+		node.id = 0;
+		unsigned int n = std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned int i = 0; i < n; i++)
+			node.cpus.push_back(i);
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+std::vector<int> getThreadCpus(bool spread) {
+	std::vector<NumaNode> nodes = getNumaNodes();
+#ifdef __linux__
+	// only the cpus of the affinity mask of the process
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (size_t i = 0; i < nodes.size(); i++) {
+			std::vector<int> &cpus = nodes[i].cpus;
+			std::vector<int> kept;
+			for (size_t j = 0; j < cpus.size(); j++)
+				if (cpus[j] < CPU_SETSIZE and CPU_ISSET(cpus[j], &allowed))
+					kept.push_back(cpus[j]);
+			cpus.swap(kept);
+		}
+	}
+#endif
+	std::vector<int> order;
+	if (not spread) {
+		for (size_t i = 0; i < nodes.size(); i++)
+			order.insert(order.end(), nodes[i].cpus.begin(), nodes[i].cpus.end());
+		return order;
+	}
+	for (size_t j = 0; true; j++) {
+		size_t added = 0;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			if (j < nodes[i].cpus.size()) {
+				order.push_back(nodes[i].cpus[j]);
+				added++;
+			}
+		}
+		if (added == 0)
+			break;
+	}
+	return order;
+}
+
+ThreadAffinityGuard::ThreadAffinityGuard(int cpu) : pinned(false) {
+#ifdef __linux__
+	if (cpu < 0 or cpu >= CPU_SETSIZE)
+		return;
+	cpu_set_t old;
+	if (sched_getaffinity(0, sizeof(old), &old) != 0)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		return;
+	previous.resize(sizeof(old) / sizeof(unsigned long) + 1);
+	memcpy(previous.data(), &old, sizeof(old));
+	pinned = true;
+#endif
+}
+
+ThreadAffinityGuard::~ThreadAffinityGuard() {
+#ifdef __linux__
+	if (not pinned)
+		return;
+	cpu_set_t old;
+	memcpy(&old, previous.data(), sizeof(old));
+	sched_setaffinity(0, sizeof(old), &old);
+#endif
+}
+
+bool ThreadAffinityGuard::isPinned() const {
+	return pinned;
+}
+
+} // namespace crpropa
@@ -0,0 +1,576 @@
+#include "crpropa/OutputReader.h"
+#include "crpropa/Units.h"
+
+#include "kiss/string.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef CRPROPA_HAVE_ZLIB
+#include <izstream.hpp>
+#endif
+
+#ifdef CRPROPA_HAVE_HDF5
+#include <hdf5.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// columns of lengths and energies, which are multiplied by the scales of the file
+bool isLengthColumn(const std::string &name) {
+	static const char *lengths[] = {"D", "X", "Y", "Z", "X0", "Y0", "Z0", "X1", "Y1", "Z1"};
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+		if (name == lengths[i])
+			return true;
+	return false;
+}
+
+bool isEnergyColumn(const std::string &name) {
+	return (name == "E") or (name == "E0") or (name == "E1");
+}
+
+// parses the number in [p, end) with the fast path of Clinger: a mantissa of
+// at most 19 digits below 2^53 and a power of ten up to 22, which are exact
+// doubles, give the correctly rounded value with one multiplication or
+// division; other numbers are parsed by strtod. Returns false for text that
+// is not a number.
+bool parseNumber(const char *p, const char *end, double &value) {
+	static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+			1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+			1e19, 1e20, 1e21, 1e22};
+	const char *s = p;
+	bool negative = false;
+	if ((p < end) and ((*p == '-') or (*p == '+'))) {
+		negative = (*p == '-');
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; (p < end) and (*p >= '0') and (*p <= '9'); p++) {
+		any = true;
+		if ((mantissa > 0) or (*p != '0'))
+			digits++;
+		if (digits <= 19)
+			mantissa = mantissa * 10 + (*p - '0');
+	}
+	if ((p < end) and (*p == '.')) {
+		for (p++; (p < end) and (*p >= '0') and (*p <= '9'); p++) {
+			any = true;
+			if ((mantissa > 0) or (*p != '0'))
+				digits++;
+			if (digits <= 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if (any and (p < end) and ((*p == 'e') or (*p == 'E'))) {
+		const char *q = p + 1;
+		bool negativeExponent = false;
+		if ((q < end) and ((*q == '-') or (*q == '+'))) {
+			negativeExponent = (*q == '-');
+			q++;
+		}
+		int e = 0;
+		bool exponentDigits = false;
+		for (; (q < end) and (*q >= '0') and (*q <= '9'); q++) {
+			exponentDigits = true;
+			if (e < 10000)
+				e = e * 10 + (*q - '0');
+		}
+		if (exponentDigits) {
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	if (any and (p == end) and (digits <= 19) and (mantissa <= (uint64_t(1) << 53))
+			and (exponent >= -22) and (exponent <= 22)) {
+		double m = double(mantissa);
+		value = (exponent < 0) ? m / powers[-exponent] : m * powers[exponent];
+		if (negative)
+			value = -value;
+		return true;
+	}
+
+	// slow path, also for nan and inf
+	std::string text(s, end);
+	char *stop;
+	value = std::strtod(text.c_str(), &stop);
+	if (text.empty() or (*stop != '\0')) {
+		value = std::numeric_limits<double>::quiet_NaN();
+		return false;
+	}
+	return true;
+}
+
+// codes of the tags of one thread, without locking the registry for each row
+class TagCodes {
+	std::vector<std::pair<std::string, uint32_t> > codes;
+public:
+	uint32_t get(const char *p, const char *end) {
+		size_t n = end - p;
+		for (size_t i = 0; i < codes.size(); i++)
+			if ((codes[i].first.size() == n) and (memcmp(codes[i].first.data(), p, n) == 0))
+				return codes[i].second;
+		std::string tag(p, end);
+		uint32_t code = Candidate::getTagCode(tag);
+		codes.push_back(std::make_pair(tag, code));
+		return code;
+	}
+};
+
+// splits a line of a text output into the columns of row i; returns false if
+// the line does not have one field per column
+bool parseLine(const char *p, const char *end, std::vector<std::vector<double> > &columns,
+		size_t tagColumn, size_t i, TagCodes &tags) {
+	for (size_t k = 0; k < columns.size(); k++) {
+		if (p > end)
+			return false;
+		const char *q = static_cast<const char *>(memchr(p, '\t', end - p));
+		if (q == 0)
+			q = end;
+		const char *a = p, *b = q;
+		while ((a < b) and (*a == ' '))
+			a++;
+		while ((b > a) and ((b[-1] == ' ') or (b[-1] == '\r')))
+			b--;
+		double value;
+		if (k == tagColumn)
+			value = tags.get(a, b);
+		else
+			parseNumber(a, b, value);
+		columns[k][i] = value;
+		p = q + 1;
+	}
+	return p > end;
+}
+
+bool isDataLine(const char *p, const char *end) {
+	return (p < end) and (*p != '#') and (*p != '\r');
+}
+
+// next line after p, or end
+const char *nextLine(const char *p, const char *end) {
+	const char *q = static_cast<const char *>(memchr(p, '\n', end - p));
+	return q ? q + 1 : end;
+}
+
+// line of p, without the line break
+const char *lineEnd(const char *p, const char *end) {
+	const char *q = static_cast<const char *>(memchr(p, '\n', end - p));
+	return q ? q : end;
+}
+
+std::string readFile(const std::string &filename) {
+	std::ifstream infile(filename.c_str(), std::ios::binary);
+	if (not infile.good())
+		throw std::runtime_error("OutputTable: could not open file " + filename);
+	std::string content;
+	if (kiss::ends_with(filename, ".gz")) {
+#ifdef CRPROPA_HAVE_ZLIB
+		zstream::igzstream in(infile);
+		content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+#else
+		throw std::runtime_error("CRPropa was built without Zlib compression!");
+#endif
+	} else {
+		infile.seekg(0, std::ios::end);
+		content.resize(infile.tellg());
+		infile.seekg(0, std::ios::beg);
+		infile.read(&content[0], content.size());
+		if (not infile)
+			throw std::runtime_error("OutputTable: error reading " + filename);
+	}
+	return content;
+}
+
+// value in brackets of a header line like "# E/E0/E1       Energy [1 EeV]"
+double headerScale(const std::string &line, double unit, double scale) {
+	size_t bracket = line.find('[');
+	if (bracket == std::string::npos)
+		return scale;
+	return std::strtod(line.c_str() + bracket + 1, 0) * unit;
+}
+
+} // namespace
+
+OutputTable::OutputTable() {
+}
+
+OutputTable::OutputTable(const std::vector<std::string> &names) : names(names),
+		columns(names.size()) {
+}
+
+ref_ptr<OutputTable> OutputTable::readText(const std::string &filename, int threads) {
+	std::string content = readFile(filename);
+	const char *begin = content.data(), *end = begin + content.size();
+
+	// column names and scales from the header
+	std::vector<std::string> names;
+	double lengthScale = Mpc, energyScale = EeV;
+	const char *p = begin;
+	for (; (p < end) and (*p == '#'); p = nextLine(p, end)) {
+		std::string line(p, lineEnd(p, end));
+		if (names.empty() and (line.compare(0, 2, "#\t") == 0)) {
+			std::stringstream ss(line.substr(2));
+			std::string name;
+			while (std::getline(ss, name, '\t'))
+				names.push_back(name);
+		} else if ((line.compare(0, 4, "# D ") == 0) or (line.compare(0, 10, "# X/X0/X1.") == 0)) {
+			lengthScale = headerScale(line, Mpc, lengthScale);
+		} else if (line.compare(0, 10, "# E/E0/E1 ") == 0) {
+			energyScale = headerScale(line, EeV, energyScale);
+		}
+	}
+	if (names.empty())
+		throw std::runtime_error("OutputTable: no header with the column names in " + filename);
+	const char *data = p;
+
+	// byte ranges of the threads, starting at lines
+#ifdef _OPENMP
+	if (threads <= 0)
+		threads = omp_get_max_threads();
+#else
+	threads = 1;
+#endif
+	std::vector<const char *> ranges(threads + 1, end);
+	ranges[0] = data;
+	for (int t = 1; t < threads; t++) {
+		const char *q = data + (end - data) * t / threads;
+		ranges[t] = std::max(ranges[t - 1], (q > data) ? nextLine(q - 1, end) : data);
+	}
+
+	// rows per range, then the rows of all ranges at once
+	std::vector<size_t> firsts(threads + 1, 0);
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+	for (int t = 0; t < threads; t++) {
+		size_t rows = 0;
+		for (const char *q = ranges[t]; q < ranges[t + 1]; q = nextLine(q, end))
+			if (isDataLine(q, lineEnd(q, end)))
+				rows++;
+		firsts[t + 1] = rows;
+	}
+	for (int t = 0; t < threads; t++)
+		firsts[t + 1] += firsts[t];
+
+	ref_ptr<OutputTable> table = new OutputTable(names);
+	for (size_t k = 0; k < names.size(); k++)
+		table->columns[k].resize(firsts[threads]);
+	size_t tagColumn = std::find(names.begin(), names.end(), "tag") - names.begin();
+	bool failed = false;
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+	for (int t = 0; t < threads; t++) {
+		TagCodes tags;
+		size_t i = firsts[t];
+		for (const char *q = ranges[t]; q < ranges[t + 1]; q = nextLine(q, end)) {
+			const char *e = lineEnd(q, end);
+			if (not isDataLine(q, e))
+				continue;
+			if (not parseLine(q, e, table->columns, tagColumn, i, tags))
+				failed = true;
+			i++;
+		}
+	}
+	if (failed)
+		throw std::runtime_error("OutputTable: rows without one value per column in " + filename);
+
+	for (size_t k = 0; k < names.size(); k++) {
+		double scale = isLengthColumn(names[k]) ? lengthScale
+				: (isEnergyColumn(names[k]) ? energyScale : 1);
+		if (scale == 1)
+			continue;
+		std::vector<double> &column = table->columns[k];
+#pragma omp parallel for num_threads(threads)
+		for (long i = 0; i < (long) column.size(); i++)
+			column[i] *= scale;
+	}
+	return table;
+}
+
+#ifdef CRPROPA_HAVE_HDF5
+namespace {
+
+double readDoubleAttribute(hid_t dset, const char *name, double value) {
+	if (H5Aexists(dset, name) <= 0)
+		return value;
+	hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+	H5Aread(attr, H5T_NATIVE_DOUBLE, &value);
+	H5Aclose(attr);
+	return value;
+}
+
+std::string readStringAttribute(hid_t dset, const char *name) {
+	if (H5Aexists(dset, name) <= 0)
+		return "";
+	hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	std::vector<char> buffer(H5Tget_size(type) + 1, 0);
+	H5Aread(attr, type, &buffer[0]);
+	H5Tclose(type);
+	H5Aclose(attr);
+	return std::string(&buffer[0]);
+}
+
+} // namespace
+
+ref_ptr<OutputTable> OutputTable::readHDF5(const std::string &filename, size_t chunkRows) {
+	if (chunkRows == 0)
+		throw std::runtime_error("OutputTable: chunkRows must be > 0");
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("OutputTable: could not open file " + filename);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	if (dset < 0) {
+		H5Fclose(file);
+		throw std::runtime_error("OutputTable: no CRPropa output in " + filename);
+	}
+
+	// the numeric members of the rows, read as consecutive doubles
+	std::vector<std::string> names;
+	hid_t fileType = H5Dget_type(dset);
+	int members = H5Tget_nmembers(fileType);
+	for (int m = 0; m < members; m++) {
+		H5T_class_t type = H5Tget_member_class(fileType, m);
+		if ((type != H5T_INTEGER) and (type != H5T_FLOAT))
+			continue;
+		char *name = H5Tget_member_name(fileType, m);
+		names.push_back(name);
+		H5free_memory(name);
+	}
+	H5Tclose(fileType);
+	size_t nc = names.size();
+	hid_t memoryType = H5Tcreate(H5T_COMPOUND, std::max<size_t>(nc, 1) * sizeof(double));
+	for (size_t k = 0; k < nc; k++)
+		H5Tinsert(memoryType, names[k].c_str(), k * sizeof(double), H5T_NATIVE_DOUBLE);
+
+	ref_ptr<OutputTable> table = new OutputTable(names);
+	hid_t space = H5Dget_space(dset);
+	hsize_t rows = H5Sget_simple_extent_npoints(space);
+	for (size_t k = 0; k < nc; k++)
+		table->columns[k].resize(rows);
+
+	std::vector<double> buffer(std::min<hsize_t>(chunkRows, rows) * nc);
+	herr_t status = 0;
+	for (hsize_t first = 0; (first < rows) and (status >= 0) and (nc > 0); first += chunkRows) {
+		hsize_t count = std::min<hsize_t>(chunkRows, rows - first);
+		H5Sselect_hyperslab(space, H5S_SELECT_SET, &first, NULL, &count, NULL);
+		hid_t memorySpace = H5Screate_simple(1, &count, NULL);
+		status = H5Dread(dset, memoryType, memorySpace, space, H5P_DEFAULT, &buffer[0]);
+		H5Sclose(memorySpace);
+#pragma omp parallel for
+		for (long k = 0; k < (long) nc; k++) {
+			double *column = &table->columns[k][first];
+			for (hsize_t i = 0; i < count; i++)
+				column[i] = buffer[i * nc + k];
+		}
+	}
+
+	double lengthScale = readDoubleAttribute(dset, "LengthScale", Mpc);
+	double energyScale = readDoubleAttribute(dset, "EnergyScale", EeV);
+	std::stringstream tagNames(readStringAttribute(dset, "TagNames"));
+	H5Sclose(space);
+	H5Tclose(memoryType);
+	H5Dclose(dset);
+	H5Fclose(file);
+	if (status < 0)
+		throw std::runtime_error("OutputTable: error reading " + filename);
+
+	// codes of the tags of the file to those of this process
+	std::vector<double> tagCodes;
+	std::string tag;
+	while (std::getline(tagNames, tag))
+		tagCodes.push_back(Candidate::getTagCode(tag));
+
+	for (size_t k = 0; k < nc; k++) {
+		std::vector<double> &column = table->columns[k];
+		if ((names[k] == "tag") and not tagCodes.empty()) {
+			for (size_t i = 0; i < column.size(); i++)
+				if (column[i] < tagCodes.size())
+					column[i] = tagCodes[size_t(column[i])];
+			continue;
+		}
+		double scale = isLengthColumn(names[k]) ? lengthScale
+				: (isEnergyColumn(names[k]) ? energyScale : 1);
+		if (scale == 1)
+			continue;
+#pragma omp parallel for
+		for (long i = 0; i < (long) column.size(); i++)
+			column[i] *= scale;
+	}
+	return table;
+}
+#endif
+
+void OutputTable::append(const OutputTable &other) {
+	if (other.names != names)
+		throw std::runtime_error("OutputTable: cannot append a table of other columns");
+	for (size_t k = 0; k < columns.size(); k++)
+		columns[k].insert(columns[k].end(), other.columns[k].begin(), other.columns[k].end());
+}
+
+size_t OutputTable::getNumberOfRows() const {
+	return columns.empty() ? 0 : columns[0].size();
+}
+
+size_t OutputTable::getNumberOfColumns() const {
+	return columns.size();
+}
+
+const std::vector<std::string> &OutputTable::getColumnNames() const {
+	return names;
+}
+
+size_t OutputTable::index(const std::string &name) const {
+	return std::find(names.begin(), names.end(), name) - names.begin();
+}
+
+bool OutputTable::hasColumn(const std::string &name) const {
+	return index(name) < names.size();
+}
+
+const std::vector<double> &OutputTable::getColumn(const std::string &name) const {
+	size_t k = index(name);
+	if (k == names.size())
+		throw std::runtime_error("OutputTable: no column " + name);
+	return columns[k];
+}
+
+double OutputTable::get(const std::string &name, size_t row) const {
+	const std::vector<double> &column = getColumn(name);
+	if (row >= column.size())
+		throw std::runtime_error("OutputTable: row out of range");
+	return column[row];
+}
+
+SourceFromOutput::SourceFromOutput(ref_ptr<OutputTable> table) : table(table), next(0) {
+	current = stateColumns("");
+	source = stateColumns("0");
+	created = stateColumns("1");
+	trajectoryLength = column("D");
+	redshift = column("z");
+	weight = column("W");
+	tag = column("tag");
+
+	static const char *standard[] = {"D", "z", "SN", "ID", "E", "X", "Y", "Z",
+			"Px", "Py", "Pz", "SN0", "ID0", "E0", "X0", "Y0", "Z0", "P0x", "P0y",
+			"P0z", "SN1", "ID1", "E1", "X1", "Y1", "Z1", "P1x", "P1y", "P1z", "W", "tag"};
+	const char **standardEnd = standard + sizeof(standard) / sizeof(standard[0]);
+	const std::vector<std::string> &names = table->getColumnNames();
+	for (size_t k = 0; k < names.size(); k++)
+		if (std::find(standard, standardEnd, names[k]) == standardEnd)
+			properties.push_back(std::make_pair(Candidate::getPropertyKey(names[k]),
+					&table->getColumn(names[k])));
+}
+
+const std::vector<double> *SourceFromOutput::column(const std::string &name) const {
+	return table->hasColumn(name) ? &table->getColumn(name) : 0;
+}
+
+SourceFromOutput::StateColumns SourceFromOutput::stateColumns(const std::string &suffix) const {
+	StateColumns s;
+	s.id = column("ID" + suffix);
+	s.energy = column("E" + suffix);
+	s.position[0] = column("X" + suffix);
+	s.position[1] = column("Y" + suffix);
+	s.position[2] = column("Z" + suffix);
+	s.direction[0] = column("P" + suffix + "x");
+	s.direction[1] = column("P" + suffix + "y");
+	s.direction[2] = column("P" + suffix + "z");
+	return s;
+}
+
+ParticleState SourceFromOutput::state(const StateColumns &s, size_t i) const {
+	Vector3d position(s.position[0] ? (*s.position[0])[i] : 0,
+			s.position[1] ? (*s.position[1])[i] : 0, s.position[2] ? (*s.position[2])[i] : 0);
+	Vector3d direction(-1, 0, 0);
+	if (s.direction[0] and s.direction[1] and s.direction[2])
+		direction = Vector3d((*s.direction[0])[i], (*s.direction[1])[i], (*s.direction[2])[i]);
+	return ParticleState(s.id ? int((*s.id)[i]) : 0, s.energy ? (*s.energy)[i] : 0,
+			position, direction);
+}
+
+ref_ptr<Candidate> SourceFromOutput::read(size_t i) const {
+	ref_ptr<Candidate> c = new Candidate(state(current, i));
+	if (source.id)
+		c->source = state(source, i);
+	if (created.id)
+		c->created = state(created, i);
+	if (trajectoryLength)
+		c->setTrajectoryLength((*trajectoryLength)[i]);
+	if (redshift)
+		c->setRedshift((*redshift)[i]);
+	if (weight)
+		c->setWeight((*weight)[i]);
+	if (tag)
+		c->setTagOriginCode(uint32_t((*tag)[i]));
+	for (size_t k = 0; k < properties.size(); k++) {
+		double value = (*properties[k].second)[i];
+		if (not std::isnan(value))
+			c->setProperty(properties[k].first, Variant(value));
+	}
+	return c;
+}
+
+// index of the first of n candidates taken by the calling thread
+static size_t take(size_t &next, size_t n) {
+	size_t first;
+#if defined(OPENMP_3_1)
+		#pragma omp atomic capture
+		{first = next; next += n;}
+#elif defined(__GNUC__)
+		{first = __sync_fetch_and_add(&next, n);}
+#else
+		#pragma omp critical(SourceFromOutput)
+		{first = next; next += n;}
+#endif
+	return first;
+}
+
+ref_ptr<Candidate> SourceFromOutput::getCandidate() const {
+	size_t i = take(next, 1);
+	if (i >= getCount())
+		throw std::runtime_error("SourceFromOutput: no more candidates");
+	return read(i);
+}
+
+void SourceFromOutput::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+	size_t first = take(next, n);
+	out.reserve(out.size() + n);
+	for (size_t i = first; i < first + n; i++)
+		out.push_back(i < getCount() ? read(i) : ref_ptr<Candidate>());
+}
+
+size_t SourceFromOutput::getCount() const {
+	return table->getNumberOfRows();
+}
+
+size_t SourceFromOutput::getPosition() const {
+	return std::min(next, getCount());
+}
+
+void SourceFromOutput::rewind() {
+	next = 0;
+}
+
+std::string SourceFromOutput::getDescription() const {
+	std::stringstream ss;
+	ss << "SourceFromOutput: " << getCount() << " candidates of "
+			<< table->getNumberOfColumns() << " columns\n";
+	return ss.str();
+}
+
+} // namespace crpropa
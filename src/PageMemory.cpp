@@ -0,0 +1,151 @@
+#include "crpropa/PageMemory.h"
+#include "crpropa/Numa.h"
+
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <stdint.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// size in kB of the lines of a /proc file that start with the key, -1 if none
+long readKilobytes(std::istream &in, const std::string &key) {
+	std::string line;
+	while (std::getline(in, line))
+		if (line.compare(0, key.size(), key) == 0)
+			return atol(line.c_str() + key.size());
+	return -1;
+}
+
+// true if some of the memory at p is in transparent huge pages
+bool hasTransparentHugePages(const void *p) {
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	uintptr_t address = (uintptr_t) p;
+	while (std::getline(smaps, line)) {
+		unsigned long begin, end;
+		if (sscanf(line.c_str(), "%lx-%lx ", &begin, &end) != 2)
+			continue;
+		if (address < begin or address >= end)
+			continue;
+		return readKilobytes(smaps, "AnonHugePages:") > 0;
+	}
+	return false;
+}
+
+} // namespace
+
+size_t PageMemory::getSystemPageSize() {
+	long size = sysconf(_SC_PAGESIZE);
+	return (size > 0) ? size : 4096;
+}
+
+size_t PageMemory::getHugePageSize() {
+	std::ifstream thp("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+	size_t size = 0;
+	if (thp >> size and size > 0)
+		return size;
+	std::ifstream meminfo("/proc/meminfo");
+	long kB = readKilobytes(meminfo, "Hugepagesize:");
+	return (kB > 0) ? kB * 1024 : 0;
+}
+
+PageMemory::PageMemory(size_t bytes, unsigned int flags) : region(0), regionSize(0),
+		memory(0), bytes(bytes), flags(flags), interleaved(false), hugetlb(false) {
+	if (bytes == 0)
+		return;
+	size_t huge = (flags & HugePages) ? getHugePageSize() : 0;
+#ifdef MAP_HUGETLB
+	// reserved huge pages, fails if there are not enough (without
+	// MAP_NORESERVE, which would fault on the first touch instead)
+	if (huge > 0) {
+		regionSize = (bytes + huge - 1) / huge * huge;
+		region = mmap(0, regionSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		hugetlb = (region != MAP_FAILED);
+		if (not hugetlb)
+			region = 0;
+	}
+#endif
+	if (not hugetlb) {
+		// transparent huge pages need aligned memory
+		regionSize = bytes + huge;
+		region = mmap(0, regionSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) {
+			region = 0;
+			throw std::bad_alloc();
+		}
+	}
+	memory = region;
+	if (huge > 0 and not hugetlb) {
+		memory = (void *) (((uintptr_t) region + huge - 1) / huge * huge);
+#ifdef MADV_HUGEPAGE
+		if (madvise(memory, bytes, MADV_HUGEPAGE) != 0)
+			KISS_LOG_DEBUG << "PageMemory: no transparent huge pages";
+#endif
+	}
+
+#ifdef __linux__
+	// the policy applies to the pages when they are first touched
+	std::vector<NumaNode> nodes = getNumaNodes();
+	if (not (flags & Interleave) or nodes.size() < 2)
+		return;
+	const size_t bits = 8 * sizeof(unsigned long);
+	int maxId = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		maxId = std::max(maxId, nodes[i].id);
+	std::vector<unsigned long> mask(maxId / bits + 1, 0);
+	for (size_t i = 0; i < nodes.size(); i++)
+		mask[nodes[i].id / bits] |= 1UL << (nodes[i].id % bits);
+	interleaved = syscall(__NR_mbind, memory, bytes, MPOL_INTERLEAVE, mask.data(),
+			mask.size() * bits + 1, 0) == 0;
+	if (not interleaved)
+		KISS_LOG_DEBUG << "PageMemory: mbind failed, the pages stay with the first touch";
+#endif
+}
+
+PageMemory::~PageMemory() {
+	if (region)
+		munmap(region, regionSize);
+}
+
+void *PageMemory::data() const {
+	return memory;
+}
+
+size_t PageMemory::size() const {
+	return bytes;
+}
+
+unsigned int PageMemory::getFlags() const {
+	return flags;
+}
+
+bool PageMemory::isInterleaved() const {
+	return interleaved;
+}
+
+size_t PageMemory::getPageSize() const {
+	if (hugetlb or (memory and (flags & HugePages) and hasTransparentHugePages(memory)))
+		return getHugePageSize();
+	return getSystemPageSize();
+}
+
+} // namespace crpropa
@@ -45,7 +45,8 @@ struct NuclearMassTable {
 	double getMass(std::size_t idx) {
 		if (!initialized) {
 #pragma omp critical(init)
-			init();
+			if (!initialized)
+				init();
 		}
 		return table[idx];
 	}
@@ -11,7 +11,8 @@
 
 namespace crpropa {
 
-ParticleState::ParticleState(int id, double E, Vector3d pos, Vector3d dir): id(0), energy(0.), position(0.), direction(0.), pmass(0.), charge(0.)
+ParticleState::ParticleState(int id, double E, Vector3d pos, Vector3d dir): id(0), energy(0.), position(0.), direction(0.), pmass(0.), charge(0.),
+		A(0), Z(0), isotope(-1), flags(0)
 {
 	setId(id);
 	setEnergy(E);
@@ -49,15 +50,44 @@ double ParticleState::getRigidity() const {
 
 void ParticleState::setId(int newId) {
 	id = newId;
-	if (isNucleus(id)) {
-		pmass = nuclearMass(id);
-		charge = chargeNumber(id) * eplus;
+	if (id == 0) {
+		// default states of new candidates, no decoding needed
+		A = Z = 0;
+		isotope = -1;
+		flags = 0;
+		charge = 0;
+		return;
+	}
+	A = massNumber(id);
+	Z = chargeNumber(id);
+	isotope = -1;
+	flags = 0;
+	int absId = abs(id);
+	if ((absId >= 11) and (absId <= 18))
+		flags |= LeptonFlag;
+	if ((absId == 12) or (absId == 14) or (absId == 16))
+		flags |= NeutrinoFlag;
+	if (id == 22)
+		flags |= PhotonFlag;
+
+	if (crpropa::isNucleus(id)) {
+		flags |= NucleusFlag;
+		int N = A - Z;
+		if ((Z <= 26) and (N >= 0) and (N <= 30))
+			isotope = Z * 31 + N;
+		pmass = nuclearMass(A, Z);
+		charge = Z * eplus;
 		if (id < 0)
 			charge *= -1; // anti-nucleus
 	} else {
 		if (abs(id) == 11)
 			pmass = mass_electron;
-		charge = HepPID::charge(id) * eplus;
+		if (absId == 11)
+			charge = (id > 0) ? -eplus : eplus;
+		else if (flags & (NeutrinoFlag | PhotonFlag))
+			charge = 0;
+		else
+			charge = HepPID::charge(id) * eplus;
 	}
 }
 
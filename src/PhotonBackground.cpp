@@ -11,6 +11,13 @@
 
 namespace crpropa {
 
+void PhotonField::getPhotonDensities(const double *ePhoton, double *densities,
+		size_t n, double z) const {
+	#pragma omp parallel for schedule(static)
+	for (long i = 0; i < long(n); i++)
+		densities[i] = getPhotonDensity(ePhoton[i], z);
+}
+
 TabularPhotonField::TabularPhotonField(std::string fieldName, bool isRedshiftDependent) {
 	this->fieldName = fieldName;
 	this->isRedshiftDependent = isRedshiftDependent;
@@ -23,7 +30,14 @@ TabularPhotonField::TabularPhotonField(std::string fieldName, bool isRedshiftDep
 	checkInputData();
 
 	if (this->isRedshiftDependent)
+		this->densityTable2d.assign(this->photonEnergies, this->redshifts, this->photonDensity);
+	else
+		this->densityTable.assign(this->photonEnergies, this->photonDensity);
+
+	if (this->isRedshiftDependent) {
 		initRedshiftScaling();
+		this->scalingTable.assign(this->redshifts, this->redshiftScalings);
+	}
 }
 
 
@@ -39,10 +53,10 @@ double TabularPhotonField::getPhotonDensity(double Ephoton, double z) const {
 			}
 			return getPhotonDensity(Ephoton, zMin);
 		} else {
-			return interpolate2d(Ephoton, z, this->photonEnergies, this->redshifts, this->photonDensity);
+			return this->densityTable2d(Ephoton, z);
 		}
 	} else {
-		return interpolate(Ephoton, this->photonEnergies, this->photonDensity);
+		return this->densityTable(Ephoton);
 	}
 }
 
@@ -57,7 +71,7 @@ double TabularPhotonField::getRedshiftScaling(double z) const {
 	if (z > this->redshifts.back())
 		return 0.;
  
-	return interpolate(z, this->redshifts, this->redshiftScalings);
+	return this->scalingTable(z);
 }
 
 double TabularPhotonField::getMinimumPhotonEnergy(double z) const{
@@ -170,6 +184,8 @@ void TabularPhotonField::checkInputData() const {
 	}
 }
 
+const double BlackbodyPhotonField::cmbTemperature = 2.73;
+
 BlackbodyPhotonField::BlackbodyPhotonField(std::string fieldName, double blackbodyTemperature) {
 	this->fieldName = fieldName;
 	this->blackbodyTemperature = blackbodyTemperature;
@@ -206,10 +222,28 @@ double BlackbodyPhotonField::getMaximumPhotonEnergy(double z) const {
 	return 0.1 * factor * eV; // T dependent scaling, starting at 0.1 eV as suitable for CMB
 }
 
+double BlackbodyPhotonField::getBlackbodyTemperature() const {
+	return blackbodyTemperature;
+}
+
 void BlackbodyPhotonField::setQuantile(double q) {
 	if(not ((q == 0.0001) or (q == 0.001) or (q == 0.01)))
 		throw std::runtime_error("Quantile not understood. Please use 0.01 (1%), 0.001 (0.1%) or 0.0001 (0.01%) \n");
 	this -> quantile = q;
 }
 
+std::string interactionTableField(const PhotonField &field, const std::string &prefix,
+		double &scale, size_t nameLength) {
+	std::string name = field.getFieldName().substr(0, nameLength);
+	scale = 1;
+	const BlackbodyPhotonField *blackbody = dynamic_cast<const BlackbodyPhotonField *>(&field);
+	if (not blackbody)
+		return name;
+	std::ifstream infile(getDataPath(prefix + name + ".txt").c_str());
+	if (infile.good())
+		return name;
+	scale = blackbody->getBlackbodyTemperature() / BlackbodyPhotonField::cmbTemperature;
+	return "CMB";
+}
+
 } // namespace crpropa
@@ -22,6 +22,10 @@
 #include <limits>
 #include <cmath>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 void ElecaPropagation(
@@ -96,20 +100,8 @@ void ElecaPropagation(
 				double z = eleca::Mpc2z(X1);
 				eleca::Particle p0(ID, E * 1e18, z);
 
-				std::vector<eleca::Particle> ParticleAtMatrix;
 				std::vector<eleca::Particle> ParticleAtGround;
-				ParticleAtMatrix.push_back(p0);
-
-				while (ParticleAtMatrix.size() > 0) {
-
-					eleca::Particle p1 = ParticleAtMatrix.back();
-					ParticleAtMatrix.pop_back();
-
-					if (p1.IsGood()) {
-						propagation.Propagate(p1, ParticleAtMatrix,
-								ParticleAtGround);
-					}
-				}
+				propagation.PropagateCascade(p0, ParticleAtGround);
 
 				for (int i = 0; i < ParticleAtGround.size(); ++i) {
 					eleca::Particle &p = ParticleAtGround[i];
@@ -165,6 +157,148 @@ void FillInSpectrum(Spectrum *a, const _Secondary &s) {
 		std::cout << "DintPropagation: Unhandled particle ID " << s.ID << std::endl;
 }
 
+static const double _DintBinWidth = 0.1;  // distance bin width in [Mpc]
+static const size_t _DintGroups = 64;  // groups of distance bins propagated in parallel
+
+// propagate the secondaries in [begin, end), sorted by distance, down to the
+// distance stop and add them to the spectrum, which is at distance stop afterwards
+static void _DintPropagateRange(const _Secondary *begin, const _Secondary *end,
+		double stop, DintEMCascade &dint, Spectrum *spectrum,
+		double aCutcascade_Magfield) {
+	const double dMargin = _DintBinWidth;
+
+	Spectrum inputSpectrum, outputSpectrum;
+	NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
+	NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
+	InitializeSpectrum(&inputSpectrum);
+
+	// process secondaries
+	const _Secondary *s = end;
+	while ((s > begin) && ((s - 1)->X1 > stop)) {
+		double Dmax = (s - 1)->X1;  // upper bound of distance bin
+		double Dmin = max(Dmax - dMargin, stop);  // lower bound of distance bin
+
+		// add all secondaries within the current distance bin
+		while ((s > begin) && ((s - 1)->X1 > Dmin)) {
+			--s;
+			FillInSpectrum(&inputSpectrum, *s);
+		}
+
+		// propagate to next closest particle or to the stop distance
+		double D = stop;
+		if (s > begin)
+			D = (s - 1)->X1;
+
+		// propagate distance step and make the output the new input spectrum
+		InitializeSpectrum(&outputSpectrum);
+		dint.propagate(Dmax, D, &inputSpectrum, &outputSpectrum, aCutcascade_Magfield);
+		SetSpectrum(&inputSpectrum, &outputSpectrum);
+	}
+
+	// add remaining secondaries at the stop distance
+	while (s > begin) {
+		--s;
+		FillInSpectrum(&inputSpectrum, *s);
+	}
+
+	AddSpectrum(spectrum, &inputSpectrum);
+	DeleteSpectrum(&outputSpectrum);
+	DeleteSpectrum(&inputSpectrum);
+}
+
+// propagate the secondaries, sorted by distance, to D = 0 and add them to the spectrum
+static void _DintPropagate(const std::vector<_Secondary> &secondaries,
+		const DintEMCascade &dint, Spectrum *spectrum, double aCutcascade_Magfield) {
+	size_t n = secondaries.size();
+	if (n == 0)
+		return;
+
+	// The cascade equations are linear in the spectrum: the groups of
+	// neighbouring distances, which contain most of the distance bins, are
+	// propagated in parallel to the top of the next closer group. Then the
+	// spectrum is propagated group by group from the largest distance down,
+	// adding the result of each group. The group boundaries are step
+	// endpoints of the calculation, so they depend only on the secondaries:
+	// a fixed number of groups of about equal size, split between the
+	// distance bins of the serial calculation.
+	std::vector<size_t> binFirst; // first secondary of each bin, from the largest distance
+	for (size_t i = n; i > 0;) {
+		double Dmin = secondaries[i - 1].X1 - _DintBinWidth;
+		while (i > 0 and secondaries[i - 1].X1 > Dmin)
+			--i;
+		binFirst.push_back(i);
+	}
+	std::vector<size_t> first(1, 0);
+	for (size_t k = 1, j = binFirst.size(); k < _DintGroups; k++) {
+		// closest bin that starts at or above the k-th fraction of the secondaries
+		size_t target = n * k / _DintGroups;
+		while (j > 0 and binFirst[j - 1] < target)
+			--j;
+		if (j == 0)
+			break;
+		if (binFirst[j - 1] > first.back() and binFirst[j - 1] < n)
+			first.push_back(binFirst[j - 1]);
+	}
+	first.push_back(n);
+	size_t nGroups = first.size() - 1;
+	std::vector<double> stop(nGroups, 0.);
+	for (size_t k = 1; k < nGroups; k++)
+		stop[k] = secondaries[first[k] - 1].X1;
+
+	std::vector<Spectrum> groupSpectra(nGroups);
+	for (size_t k = 0; k < nGroups; k++) {
+		NewSpectrum(&groupSpectra[k], NUM_MAIN_BINS);
+		InitializeSpectrum(&groupSpectra[k]);
+	}
+
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int k = 0; k < (int)nGroups; k++) {
+		DintEMCascade local(dint);
+		_DintPropagateRange(&secondaries[0] + first[k], &secondaries[0] + first[k + 1],
+				stop[k], local, &groupSpectra[k], aCutcascade_Magfield);
+	}
+
+	Spectrum acc, propagated;
+	NewSpectrum(&acc, NUM_MAIN_BINS);
+	NewSpectrum(&propagated, NUM_MAIN_BINS);
+	InitializeSpectrum(&acc);
+	DintEMCascade combine(dint);
+	for (size_t k = nGroups; k > 0; k--) {
+		size_t i = k - 1;
+		if (i + 1 < nGroups) {
+			// propagate the spectrum from the top of this group to its stop distance
+			InitializeSpectrum(&propagated);
+			combine.propagate(stop[i + 1], stop[i], &acc, &propagated, aCutcascade_Magfield);
+			SetSpectrum(&acc, &propagated);
+		}
+		AddSpectrum(&acc, &groupSpectra[i]);
+		DeleteSpectrum(&groupSpectra[i]);
+	}
+	AddSpectrum(spectrum, &acc);
+	DeleteSpectrum(&propagated);
+	DeleteSpectrum(&acc);
+}
+
+static void _DintWriteSpectrum(const std::string &outputfile, const Spectrum &finalSpectrum) {
+	std::ofstream outfile(outputfile.c_str());
+	if (!outfile.good())
+		throw std::runtime_error(
+				"DintPropagation: could not open file " + outputfile);
+
+	outfile << "# logE photons electrons positrons\n";
+	outfile << "#   - logE: energy bin center <log10(E/eV)>\n";
+	outfile << "#   - photons, electrons, positrons: total flux weights\n";
+	for (int j = 0; j < finalSpectrum.numberOfMainBins; j++) {
+		double logEc = MIN_ENERGY_EXP + 0.05 + j * 1. / BINS_PER_DECADE;
+		outfile << std::setw(5) << logEc;
+		for (int i = 0; i < 3; i++) {
+			outfile << std::setw(13) << finalSpectrum.spectrum[i][j];
+		}
+		outfile << "\n";
+	}
+	outfile.close();
+}
+
 void DintPropagation(
 		const std::string &inputfile,
 		const std::string &outputfile,
@@ -175,14 +309,8 @@ void DintPropagation(
 
 	KISS_LOG_WARNING << "DINT propagation is deprecated and is no longer supported. Please use the EM* (EMPairProduction, EMInverseComptonScattering, ...) modules instead.\n";
 
-	// initialize the energy grids for DINT
-	dCVector energyGrid, energyWidth;
-	New_dCVector(&energyGrid, NUM_MAIN_BINS);
-	New_dCVector(&energyWidth, NUM_MAIN_BINS);
-	SetEnergyBins(MIN_ENERGY_EXP, &energyGrid, &energyWidth);
-
-	std::ofstream outfile(outputfile.c_str());
-	if (!outfile.good())
+	// check the output file before the calculation
+	if (!std::ofstream(outputfile.c_str()).good())
 		throw std::runtime_error(
 				"DintPropagation: could not open file " + outputfile);
 
@@ -213,7 +341,6 @@ void DintPropagation(
 	DintEMCascade dint(IRBFlag, RadioFlag, dataPath, B, h, omegaM(), omegaL());
 
 	const size_t nBuffer = 7.5E7;  // maximum number of simultaneously processed particles, keep memory requirement < 1GB
-	const double dMargin = 0.1;  // distance bin width in [Mpc]
 
 	while (infile.good()) {
 		// read up to nBuffer secondaries from input file
@@ -241,61 +368,44 @@ void DintPropagation(
 		std::sort(secondaries.begin(), secondaries.end(),
 				_SecondarySortPredicate);
 
-		Spectrum inputSpectrum, outputSpectrum;
-		NewSpectrum(&inputSpectrum, NUM_MAIN_BINS);
-		NewSpectrum(&outputSpectrum, NUM_MAIN_BINS);
-		InitializeSpectrum(&inputSpectrum);
-
-		// process secondaries
-		while ((secondaries.size() > 0 ) && (secondaries.back().X1 > 0)) {
-			double Dmax = secondaries.back().X1;  // upper bound of distance bin
-			double Dmin = max(Dmax - dMargin, 0.);  // lower bound of distance bin
-
-			// add all secondaries within the current distance bin
-			while ((secondaries.size() > 0) && (secondaries.back().X1 > Dmin)) {
-				FillInSpectrum(&inputSpectrum, secondaries.back());
-				secondaries.pop_back();
-			}
+		_DintPropagate(secondaries, dint, &finalSpectrum, aCutcascade_Magfield);
+	}
 
-			// propagate to next closest particle or to D=0
-			double D = 0;
-			if (secondaries.size() > 0)
-				D = secondaries.back().X1;
+	// output
+	_DintWriteSpectrum(outputfile, finalSpectrum);
+	DeleteSpectrum(&finalSpectrum);
+}
 
-			// propagate distance step and make the output the new input spectrum
-			InitializeSpectrum(&outputSpectrum);
-			dint.propagate(Dmax, D, &inputSpectrum, &outputSpectrum, aCutcascade_Magfield);
-			SetSpectrum(&inputSpectrum, &outputSpectrum);
-		}
+void DintPropagation(
+		const std::vector<CascadeParticle> &particles,
+		const std::string &outputfile,
+		int IRBFlag,
+		int RadioFlag,
+		double magneticFieldStrength,
+		double aCutcascade_Magfield) {
 
-		// add remaining secondaries at D=0 to output spectrum
-		while (secondaries.size() > 0) {
-			FillInSpectrum(&inputSpectrum, secondaries.back());
-			secondaries.pop_back();
-		}
+	KISS_LOG_WARNING << "DINT propagation is deprecated and is no longer supported. Please use the EM* (EMPairProduction, EMInverseComptonScattering, ...) modules instead.\n";
 
-		AddSpectrum(&finalSpectrum, &inputSpectrum);
-		DeleteSpectrum(&outputSpectrum);
-		DeleteSpectrum(&inputSpectrum);
+	std::vector<_Secondary> secondaries(particles.size());
+	for (size_t i = 0; i < particles.size(); i++) {
+		_Secondary &s = secondaries[i];
+		s.ID = particles[i].id;
+		s.E = particles[i].energy / EeV;
+		s.X1 = comoving2LightTravelDistance(particles[i].distance) / Mpc;  // DintEMCascade expects light travel distance
 	}
+	std::sort(secondaries.begin(), secondaries.end(), _SecondarySortPredicate);
 
-	// output
-	outfile << "# logE photons electrons positrons\n";
-	outfile << "#   - logE: energy bin center <log10(E/eV)>\n";
-	outfile << "#   - photons, electrons, positrons: total flux weights\n";
-	for (int j = 0; j < finalSpectrum.numberOfMainBins; j++) {
-		double logEc = MIN_ENERGY_EXP + 0.05 + j * 1. / BINS_PER_DECADE;
-		outfile << std::setw(5) << logEc;
-		for (int i = 0; i < 3; i++) {
-			outfile << std::setw(13) << finalSpectrum.spectrum[i][j];
-		}
-		outfile << "\n";
-	}
-	outfile.close();
+	Spectrum finalSpectrum;
+	NewSpectrum(&finalSpectrum, NUM_MAIN_BINS);
+	InitializeSpectrum(&finalSpectrum);
+
+	double B = magneticFieldStrength / gauss;
+	double h = H0() * Mpc / 1000;
+	DintEMCascade dint(IRBFlag, RadioFlag, getDataPath("dint"), B, h, omegaM(), omegaL());
+	_DintPropagate(secondaries, dint, &finalSpectrum, aCutcascade_Magfield);
 
+	_DintWriteSpectrum(outputfile, finalSpectrum);
 	DeleteSpectrum(&finalSpectrum);
-	Delete_dCVector(&energyGrid);
-	Delete_dCVector(&energyWidth);
 }
 
 
@@ -398,18 +508,7 @@ void DintElecaPropagation(
 			double z = eleca::Mpc2z(X1);
 			eleca::Particle p0(ID, E * 1e18, z);
 
-			std::vector<eleca::Particle> ParticleAtMatrix;
-			ParticleAtMatrix.push_back(p0);
-
-			while (ParticleAtMatrix.size() > 0) {
-				eleca::Particle p1 = ParticleAtMatrix.back();
-				ParticleAtMatrix.pop_back();
-
-				if (p1.IsGood()) {
-					propagation.Propagate(p1, ParticleAtMatrix,
-							ParticleAtGround, false);
-				}
-			}
+			propagation.PropagateCascade(p0, ParticleAtGround, false);
 		}
 
 		// The vector is larger than ~1GB, or the infile is completely read - better call DINT.
@@ -0,0 +1,104 @@
+#include "crpropa/PrimaryCostModel.h"
+#include "crpropa/Units.h"
+
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+
+namespace crpropa {
+
+PrimaryCostModel::PrimaryCostModel(double binsPerDecade, size_t batchSize) :
+		totalTime(0), totalEnergy(0), totalSamples(0), binsPerDecade(binsPerDecade) {
+	if (binsPerDecade <= 0)
+		throw std::runtime_error("PrimaryCostModel: the bins per decade must be positive");
+	setBatchSize(batchSize);
+}
+
+int PrimaryCostModel::energyBin(double energy) const {
+	if (energy <= 0)
+		return INT_MIN;
+	return (int) std::floor(std::log10(energy / eV) * binsPerDecade);
+}
+
+void PrimaryCostModel::record(int id, double energy, double seconds) {
+	std::lock_guard<std::mutex> guard(mutex);
+	Bin &bin = bins[std::make_pair(id, energyBin(energy))];
+	bin.time += seconds;
+	bin.samples++;
+	totalTime += seconds;
+	totalEnergy += energy;
+	totalSamples++;
+}
+
+void PrimaryCostModel::record(const Candidate *candidate, double seconds) {
+	record(candidate->source.getId(), candidate->source.getEnergy(), seconds);
+}
+
+double PrimaryCostModel::getCost(int id, double energy) const {
+	std::lock_guard<std::mutex> guard(mutex);
+	if (totalSamples == 0)
+		return energy / joule;
+	int k = energyBin(energy);
+	BinMap::const_iterator it = bins.find(std::make_pair(id, k));
+	if (it != bins.end())
+		return it->second.time / it->second.samples;
+
+	// closest energy bin of the particle
+	BinMap::const_iterator closest = bins.end();
+	BinMap::const_iterator upper = bins.lower_bound(std::make_pair(id, k));
+	if (upper != bins.end() and upper->first.first == id)
+		closest = upper;
+	if (upper != bins.begin()) {
+		BinMap::const_iterator lower = upper;
+		--lower;
+		if (lower->first.first == id and (closest == bins.end()
+				or k - lower->first.second < closest->first.second - k))
+			closest = lower;
+	}
+	if (closest != bins.end()) {
+		double mean = closest->second.time / closest->second.samples;
+		return mean * std::pow(10., (k - closest->first.second) / binsPerDecade);
+	}
+
+	if (totalEnergy > 0)
+		return totalTime / totalEnergy * energy;
+	return totalTime / totalSamples;
+}
+
+double PrimaryCostModel::getCost(const Candidate *candidate) const {
+	return getCost(candidate->source.getId(), candidate->source.getEnergy());
+}
+
+size_t PrimaryCostModel::getSamples() const {
+	std::lock_guard<std::mutex> guard(mutex);
+	return totalSamples;
+}
+
+double PrimaryCostModel::getMeanCost() const {
+	std::lock_guard<std::mutex> guard(mutex);
+	return (totalSamples > 0) ? totalTime / totalSamples : 0;
+}
+
+void PrimaryCostModel::reset() {
+	std::lock_guard<std::mutex> guard(mutex);
+	bins.clear();
+	totalTime = 0;
+	totalEnergy = 0;
+	totalSamples = 0;
+}
+
+double PrimaryCostModel::getBinsPerDecade() const {
+	return binsPerDecade;
+}
+
+void PrimaryCostModel::setBatchSize(size_t size) {
+	if (size == 0)
+		throw std::runtime_error("PrimaryCostModel: the batch size must be positive");
+	batchSize = size;
+}
+
+size_t PrimaryCostModel::getBatchSize() const {
+	return batchSize;
+}
+
+} // namespace crpropa
@@ -1,19 +1,43 @@
 #include "crpropa/ProgressBar.h"
 
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
 
+#include <unistd.h>
+
 namespace crpropa {
 
-/// Initialize a ProgressBar with [steps] number of steps, updated at [updateSteps] intervalls
+static double wallTime() {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string formatTime(double seconds) {
+	int t = int(seconds);
+	char s[32];
+	std::sprintf(s, "%02i:%02i:%02i", t / 3600, (t % 3600) / 60, t % 60);
+	return s;
+}
+
+/// Initialize a ProgressBar with [steps] number of steps
 ProgressBar::ProgressBar(unsigned long steps, unsigned long updateSteps) :
-		_steps(steps), _currentCount(0), _maxbarLength(10), _updateSteps(
-				updateSteps), _nextStep(1), _startTime(0) {
-	if (_updateSteps > _steps)
-		_updateSteps = _steps;
+		_steps(steps), _currentCount(0), _secondaries(0), _maxbarLength(10),
+		_startTime(0), interval(1), logLines(not isatty(fileno(stdout))),
+		running(false), startTime(0), lastTime(0), lastCount(0),
+		lastSecondaries(0), cost(0) {
+	status = ProgressStatus();
+	status.total = steps;
 	arrow.append(">");
 }
 
+ProgressBar::~ProgressBar() {
+	stop();
+}
+
 void ProgressBar::start(const std::string &title) {
 	_startTime = time(NULL);
 	std::string s = ctime(&_startTime);
@@ -23,45 +47,144 @@ void ProgressBar::start(const std::string &title) {
 	stringTmpl.append(" : [%-10s] %3i%%    %s: %02i:%02i:%02i %s\r");
 	std::cout << title << std::endl;
 
+	startTime = lastTime = wallTime();
+	lastCount = _currentCount;
+	lastSecondaries = _secondaries;
+	running = true;
+	reporter = std::thread([this]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (running) {
+			wakeup.wait_for(lock, std::chrono::duration<double>(interval));
+			if (not running)
+				break;
+			lock.unlock();
+			report();
+			lock.lock();
+		}
+	});
+}
+
+void ProgressBar::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (not running)
+			return;
+		running = false;
+	}
+	wakeup.notify_all();
+	reporter.join();
+	report();
+	if (callback)
+		return;
+
+	if (_currentCount < _steps) {
+		if (not logLines)
+			std::cout << std::endl;
+		return;
+	}
+
+	time_t currentTime = time(NULL);
+	if (logLines) {
+		std::string elapsed = formatTime(status.elapsed);
+		KISS_LOG_INFO << "ProgressBar: finished " << status.primaries << " primaries, "
+				<< status.secondaries << " secondaries in " << elapsed;
+		return;
+	}
+	float tElapsed = currentTime - _startTime;
+	std::string s = " - Finished at ";
+	s.append(ctime(&currentTime));
+	char fs[255];
+	std::sprintf(fs, "%c[%d;%dm Finished %c[%dm", 27, 1, 32, 27, 0);
+	std::printf(stringTmpl.c_str(), fs, 100, "Needed",
+			int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
+			int(tElapsed) % 60, s.c_str());
+	fflush(stdout);
 }
+
 /// update the progressbar
 /// should be called steps times in a loop
 void ProgressBar::update() {
-	_currentCount++;
-	if (_currentCount == _nextStep || _currentCount == _steps
-			|| _currentCount == 1000) {
-				_nextStep += long(_steps / float(_updateSteps));
-			setPosition(_currentCount);
-			}
+	_currentCount.fetch_add(1, std::memory_order_relaxed);
 }
 
-void ProgressBar::setPosition(unsigned long position) {
-	int percentage = int(100 * (position / float(_steps)));
-	time_t currentTime = time(NULL);
-	if (position < _steps) {
-		if (arrow.size() <= (_maxbarLength) * (position) / (_steps))
-			arrow.insert(0, "=");
-		float tElapsed = currentTime - _startTime;
-		float tToGo = (_steps - position) * tElapsed / position;
-		std::printf(stringTmpl.c_str(), arrow.c_str(), percentage, "Finish in",
-				int(tToGo / 3600), (int(tToGo) % 3600) / 60,
-				int(tToGo) % 60, "");
-		fflush(stdout);
-	} else {
-		float tElapsed = currentTime - _startTime;
-		std::string s = " - Finished at ";
-		s.append(ctime(&currentTime));
-		char fs[255];
-		std::sprintf(fs, "%c[%d;%dm Finished %c[%dm", 27, 1, 32, 27, 0);
-		std::printf(stringTmpl.c_str(), fs, 100, "Needed",
-				int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
-				int(tElapsed) % 60, s.c_str());
+void ProgressBar::addSecondaries(unsigned long n) {
+	_secondaries.fetch_add(n, std::memory_order_relaxed);
+}
+
+void ProgressBar::report() {
+	double now = wallTime();
+	unsigned long count = _currentCount.load(std::memory_order_relaxed);
+	unsigned long secondaries = _secondaries.load(std::memory_order_relaxed);
+
+	ProgressStatus s;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		double dt = now - lastTime;
+		unsigned long dn = count - lastCount;
+		// the time to go follows the recent cost per primary
+		if (dn > 0) {
+			double sample = dt / dn;
+			cost = (cost > 0) ? 0.7 * cost + 0.3 * sample : sample;
+		}
+		s.primaries = count;
+		s.secondaries = secondaries;
+		s.total = _steps;
+		s.elapsed = now - startTime;
+		s.primaryRate = (dt > 0) ? dn / dt : 0;
+		s.secondaryRate = (dt > 0) ? (secondaries - lastSecondaries) / dt : 0;
+		s.eta = (count < _steps) ? (_steps - count) * cost : 0;
+		lastTime = now;
+		lastCount = count;
+		lastSecondaries = secondaries;
+		status = s;
+	}
+
+	if (callback)
+		callback(s);
+	else
+		print(s);
+}
+
+void ProgressBar::print(const ProgressStatus &s) {
+	if (s.primaries >= _steps)
+		return; // the final state is printed by stop
+
+	int percentage = (_steps > 0) ? int(100 * (s.primaries / float(_steps))) : 0;
+	if (logLines) {
+		std::string eta = formatTime(s.eta);
+		KISS_LOG_INFO << "ProgressBar: " << s.primaries << "/" << _steps << " primaries ("
+				<< percentage << "%), " << s.primaryRate << " primaries/s, "
+				<< s.secondaryRate << " secondaries/s, finish in " << eta;
+		return;
 	}
+
+	size_t length = (_steps > 0) ? _maxbarLength * s.primaries / _steps : 0;
+	arrow = std::string(std::min<size_t>(length, _maxbarLength - 1), '=') + ">";
+	char rate[64];
+	std::sprintf(rate, "(%.3g primaries/s) ", s.primaryRate);
+	std::printf(stringTmpl.c_str(), arrow.c_str(), percentage, "Finish in",
+			int(s.eta / 3600), (int(s.eta) % 3600) / 60, int(s.eta) % 60, rate);
+	fflush(stdout);
 }
 
+void ProgressBar::setPosition(unsigned long position) {
+	_currentCount = position;
+	report();
+}
 
 /// Mark the progressbar with an error
 void ProgressBar::setError() {
+	bool wasRunning;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		wasRunning = running;
+		running = false;
+	}
+	if (wasRunning) {
+		wakeup.notify_all();
+		reporter.join();
+	}
+
 	time_t currentTime = time(NULL);
 	_currentCount++;
 	float tElapsed = currentTime - _startTime;
@@ -69,9 +192,26 @@ void ProgressBar::setError() {
 	s.append(ctime(&currentTime));
 	char fs[255];
 	std::sprintf(fs, "%c[%d;%dm  ERROR   %c[%dm", 27, 1, 31, 27, 0);
-	std::printf(stringTmpl.c_str(), fs, _currentCount, "Needed",
+	std::printf(stringTmpl.c_str(), fs, int(_currentCount), "Needed",
 			int(tElapsed / 3600), (int(tElapsed) % 3600) / 60,
 			int(tElapsed) % 60, s.c_str());
 }
 
+void ProgressBar::setInterval(double seconds) {
+	interval = seconds;
+}
+
+void ProgressBar::setLogLines(bool lines) {
+	logLines = lines;
+}
+
+void ProgressBar::setCallback(Callback c) {
+	callback = c;
+}
+
+ProgressStatus ProgressBar::getStatus() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return status;
+}
+
 } // namespace crpropa
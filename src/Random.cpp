@@ -59,12 +59,80 @@
 
 #include "crpropa/Random.h"
 
+#include "crpropa/Common.h"
+#include "crpropa/SimdMath.h"
 #include "crpropa/base64.h"
 
 #include <cstdio>
 
 namespace crpropa {
 
+// run seed of seedStreams
+static bool streamsEnabled = false;
+static uint64_t streamsSeed = 0;
+// scramble seed of seedQuasiSources
+static bool quasiSourcesEnabled = false;
+static uint64_t quasiSourcesSeed = 0;
+
+// Sobol direction numbers of dimensions 2 to SOBOL_DIM: degree s and
+// coefficients a of the primitive polynomial, initial numbers m
+// (new-joe-kuo-6.21201, the first dimension is the van der Corput sequence)
+struct SobolPolynomial {
+	unsigned int s, a, m[6];
+};
+static const SobolPolynomial sobolPolynomials[Random::SOBOL_DIM - 1] = {
+	{1, 0, {1}},
+	{2, 1, {1, 3}},
+	{3, 1, {1, 3, 1}},
+	{3, 2, {1, 1, 1}},
+	{4, 1, {1, 1, 3, 3}},
+	{4, 4, {1, 3, 5, 13}},
+	{5, 2, {1, 1, 5, 5, 17}},
+	{5, 4, {1, 1, 5, 5, 5}},
+	{5, 7, {1, 1, 7, 11, 19}},
+	{5, 11, {1, 1, 5, 1, 1}},
+	{5, 13, {1, 1, 1, 3, 11}},
+	{5, 14, {1, 3, 5, 5, 31}},
+	{6, 1, {1, 3, 3, 9, 7, 49}},
+	{6, 13, {1, 1, 1, 15, 21, 21}},
+	{6, 16, {1, 3, 1, 13, 27, 49}}
+};
+
+struct SobolDirections {
+	uint32_t v[Random::SOBOL_DIM][32];
+	SobolDirections() {
+		for (int k = 0; k < 32; k++)
+			v[0][k] = uint32_t(1) << (31 - k);
+		for (int d = 1; d < Random::SOBOL_DIM; d++) {
+			const SobolPolynomial &p = sobolPolynomials[d - 1];
+			uint32_t *w = v[d];
+			for (unsigned int k = 0; k < 32; k++) {
+				if (k < p.s) {
+					w[k] = p.m[k] << (31 - k);
+					continue;
+				}
+				w[k] = w[k - p.s] ^ (w[k - p.s] >> p.s);
+				for (unsigned int j = 1; j < p.s; j++)
+					if ((p.a >> (p.s - 1 - j)) & 1)
+						w[k] ^= w[k - j];
+			}
+		}
+	}
+};
+
+static const SobolDirections &sobolDirections() {
+	static const SobolDirections directions;
+	return directions;
+}
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555UL) | ((x & 0x55555555UL) << 1);
+	x = ((x >> 2) & 0x33333333UL) | ((x & 0x33333333UL) << 2);
+	x = ((x >> 4) & 0x0F0F0F0FUL) | ((x & 0x0F0F0F0FUL) << 4);
+	x = ((x >> 8) & 0x00FF00FFUL) | ((x & 0x00FF00FFUL) << 8);
+	return (x >> 16) | (x << 16);
+}
+
 Random::Random(const uint32_t& oneSeed) {
 	seed(oneSeed);
 }
@@ -114,10 +182,107 @@ double Random::randNorm(const double& mean, const double& variance) {
 	return mean + r * cos(phi);
 }
 
+void Random::randNormArray(double *values, size_t n) {
+	fillNormal(values, n);
+}
+
 double Random::randUniform(double min, double max) {
 	return min + (max - min) * rand();
 }
 
+void Random::fillInt(uint32_t *values, size_t n) {
+	size_t i = 0;
+	// coordinates of the Sobol point and unaligned stream positions one by one
+	while (i < n and ((quasiRandom and sobolDimension < SOBOL_DIM)
+			or (counterBased and streamPosition % STREAM_BUFFER != 0)))
+		values[i++] = randInt();
+
+	if (counterBased) {
+		// whole buffers directly, the rest through the buffer
+		size_t m = (n - i) / STREAM_BUFFER * STREAM_BUFFER;
+		philox(streamPosition >> 2, values + i, m / 4);
+		streamPosition += m;
+		for (i += m; i < n; i++)
+			values[i] = randInt();
+		return;
+	}
+
+	// tempered chunks of the state vector
+	while (i < n) {
+		if (left == 0)
+			reload();
+		size_t m = std::min(size_t(left), n - i);
+		for (size_t j = 0; j < m; j++) {
+			uint32_t s1 = pNext[j];
+			s1 ^= (s1 >> 11);
+			s1 ^= (s1 << 7) & 0x9d2c5680UL;
+			s1 ^= (s1 << 15) & 0xefc60000UL;
+			values[i + j] = (s1 ^ (s1 >> 18));
+		}
+		pNext += m;
+		left -= m;
+		i += m;
+	}
+}
+
+// number of 32-bit values that the bulk functions transform at once
+static const size_t fillChunk = 256;
+
+void Random::fillUniform(double *values, size_t n) {
+	uint32_t bits[fillChunk];
+	for (size_t i = 0; i < n; i += fillChunk) {
+		size_t m = std::min(fillChunk, n - i);
+		fillInt(bits, m);
+		for (size_t j = 0; j < m; j++)
+			values[i + j] = double(bits[j]) * (1.0 / 4294967295.0);
+	}
+}
+
+void Random::fillUniform(double *values, size_t n, double min, double max) {
+	fillUniform(values, n);
+	for (size_t i = 0; i < n; i++)
+		values[i] = min + (max - min) * values[i];
+}
+
+void Random::fillNormal(double *values, size_t n, double mean, double sigma) {
+	// Box-Muller with both branches: pairs of randDblExc() and randExc() as in randNorm
+	uint32_t bits[fillChunk];
+	double r[fillChunk / 2], phi[fillChunk / 2], s[fillChunk / 2], c[fillChunk / 2];
+	for (size_t i = 0; i < n; i += fillChunk) {
+		size_t m = std::min(fillChunk, n - i);
+		size_t pairs = (m + 1) / 2;
+		fillInt(bits, 2 * pairs);
+		for (size_t j = 0; j < pairs; j++) {
+			r[j] = 1.0 - (double(bits[2 * j]) + 0.5) * (1.0 / 4294967296.0);
+			phi[j] = 2.0 * M_PI * (double(bits[2 * j + 1]) * (1.0 / 4294967296.0));
+		}
+		simdLog(r, r, pairs);
+		simdSinCos(phi, s, c, pairs);
+		for (size_t j = 0; j < pairs; j++)
+			r[j] = sigma * sqrt(-2.0 * r[j]);
+		for (size_t j = 0; j < m / 2; j++) {
+			values[i + 2 * j] = mean + r[j] * c[j];
+			values[i + 2 * j + 1] = mean + r[j] * s[j];
+		}
+		if (m % 2 == 1)
+			values[i + m - 1] = mean + r[pairs - 1] * c[pairs - 1];
+	}
+}
+
+void Random::fillExponential(double *values, size_t n) {
+	uint32_t bits[fillChunk];
+	for (size_t i = 0; i < n; i += fillChunk) {
+		size_t m = std::min(fillChunk, n - i);
+		fillInt(bits, m);
+		double *u = values + i;
+		for (size_t j = 0; j < m; j++)
+			u[j] = (double(bits[j]) + 0.5) * (1.0 / 4294967296.0);
+		simdLog(u, u, m);
+		for (size_t j = 0; j < m; j++)
+			u[j] = -u[j];
+	}
+}
+
 double Random::randRayleigh(double sigma) {
 	return sigma * sqrt(-2.0 * log(1 - rand()));
 }
@@ -126,6 +291,42 @@ double Random::randFisher(double kappa) {
 	return acos(1. + 1. / kappa * log(1 - rand() * (1 - exp(-2 * kappa))));
 }
 
+uint64_t Random::randPoisson(double mean) {
+	if (mean <= 0)
+		return 0;
+	if (mean < 10) {
+		// multiplication of uniform numbers
+		const double limit = exp(-mean);
+		uint64_t k = 0;
+		double product = randDblExc();
+		while (product > limit) {
+			k++;
+			product *= randDblExc();
+		}
+		return k;
+	}
+	// transformed rejection with squeeze (PTRS), W. Hoermann, Insurance:
+	// Mathematics and Economics 12 (1993) 39
+	const double sqrtMean = sqrt(mean);
+	const double logMean = log(mean);
+	const double b = 0.931 + 2.53 * sqrtMean;
+	const double a = -0.059 + 0.02483 * b;
+	const double invAlpha = 1.1239 + 1.1328 / (b - 3.4);
+	const double vr = 0.9277 - 3.6224 / (b - 2);
+	while (true) {
+		const double u = randExc() - 0.5;
+		const double v = randDblExc();
+		const double us = 0.5 - fabs(u);
+		const double k = floor((2 * a / us + b) * u + mean + 0.43);
+		if (us >= 0.07 and v <= vr)
+			return (uint64_t) k;
+		if (k < 0 or (us < 0.013 and v > us))
+			continue;
+		if (log(v) + log(invAlpha) - log(a / (us * us) + b) <= -mean + k * logMean - lgamma(k + 1))
+			return (uint64_t) k;
+	}
+}
+
 size_t Random::randBin(const std::vector<float> &cdf) {
 	std::vector<float>::const_iterator it = std::lower_bound(cdf.begin(),
 			cdf.end(), rand() * cdf.back());
@@ -247,6 +448,17 @@ double Random::randExponential() {
 }
 
 uint32_t Random::randInt() {
+	if (quasiRandom and sobolDimension < SOBOL_DIM)
+		return sobol();
+
+	if (counterBased) {
+		size_t i = streamPosition % STREAM_BUFFER;
+		if (i == 0)
+			philox(streamPosition >> 2, streamBuffer, STREAM_BUFFER / 4);
+		++streamPosition;
+		return streamBuffer[i];
+	}
+
 	if (left == 0)
 		reload();
 	--left;
@@ -307,6 +519,11 @@ uint64_t Random::randInt64(const uint64_t &n)
 
 
 void Random::seed(const uint32_t oneSeed) {
+	counterBased = false;
+	quasiRandom = false;
+	sobolIndex = sobolDimension = 0;
+	sobolScramble = 0;
+	streamKey = streamId = streamPosition = 0;
 	initial_seed.resize(1);
 	initial_seed[0] = oneSeed;
 	initialize(oneSeed);
@@ -314,7 +531,11 @@ void Random::seed(const uint32_t oneSeed) {
 }
 
 void Random::seed(uint32_t * const bigSeed, const uint32_t seedLength) {
-
+	counterBased = false;
+	quasiRandom = false;
+	sobolIndex = sobolDimension = 0;
+	sobolScramble = 0;
+	streamKey = streamId = streamPosition = 0;
 	initial_seed.resize(seedLength);
 	for (size_t i =0; i< seedLength; i++)
 	{
@@ -426,6 +647,167 @@ void Random::save(uint32_t* saveArray) const {
 	*sa = left;
 }
 
+void Random::philox(uint64_t first, uint32_t *values, size_t blocks) const {
+	// counter: block number and stream, key: run key; the rounds run over
+	// lanes of consecutive blocks, so that they are vectorized
+	enum {LANES = 8};
+	for (size_t b = 0; b < blocks; b += LANES) {
+		uint32_t c0[LANES], c1[LANES], c2[LANES], c3[LANES];
+		for (size_t j = 0; j < LANES; j++) {
+			uint64_t block = first + b + j;
+			c0[j] = uint32_t(block);
+			c1[j] = uint32_t(block >> 32);
+			c2[j] = uint32_t(streamId);
+			c3[j] = uint32_t(streamId >> 32);
+		}
+		uint32_t k0 = uint32_t(streamKey), k1 = uint32_t(streamKey >> 32);
+		for (int r = 0; r < 10; r++) {
+			for (size_t j = 0; j < LANES; j++) {
+				uint64_t p0 = uint64_t(0xD2511F53UL) * c0[j];
+				uint64_t p1 = uint64_t(0xCD9E8D57UL) * c2[j];
+				uint32_t hi0 = uint32_t(p0 >> 32), lo0 = uint32_t(p0);
+				uint32_t hi1 = uint32_t(p1 >> 32), lo1 = uint32_t(p1);
+				c0[j] = hi1 ^ c1[j] ^ k0;
+				c1[j] = lo1;
+				c2[j] = hi0 ^ c3[j] ^ k1;
+				c3[j] = lo0;
+			}
+			k0 += 0x9E3779B9UL;
+			k1 += 0xBB67AE85UL;
+		}
+		size_t m = std::min(size_t(LANES), blocks - b);
+		for (size_t j = 0; j < m; j++) {
+			values[4 * (b + j)] = c0[j];
+			values[4 * (b + j) + 1] = c1[j];
+			values[4 * (b + j) + 2] = c2[j];
+			values[4 * (b + j) + 3] = c3[j];
+		}
+	}
+}
+
+uint32_t Random::sobol() {
+	const uint32_t *v = sobolDirections().v[sobolDimension];
+	uint32_t x = 0;
+	for (uint32_t i = sobolIndex, k = 0; i != 0; i >>= 1, k++)
+		if (i & 1)
+			x ^= v[k];
+
+	// nested uniform (Owen) scrambling with a seed per dimension, as the
+	// Laine-Karras permutation of the reversed bits
+	uint64_t z = sobolScramble + 0x9E3779B97F4A7C15ULL * (sobolDimension + 1);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	uint32_t seed = uint32_t(z ^ (z >> 31));
+	sobolDimension++;
+
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cUL;
+	x ^= x * 0xb82f1e52UL;
+	x ^= x * 0xc7afe638UL;
+	x ^= x * 0x8d22f6e6UL;
+	return reverseBits(x);
+}
+
+void Random::seedSobol(uint64_t index, uint64_t scramble) {
+	quasiRandom = true;
+	sobolIndex = uint32_t(index);
+	sobolScramble = scramble;
+	sobolDimension = 0;
+}
+
+void Random::endSobol() {
+	quasiRandom = false;
+}
+
+bool Random::isQuasiRandom() const {
+	return quasiRandom;
+}
+
+unsigned int Random::getSobolDimension() const {
+	return sobolDimension;
+}
+
+void Random::seedStream(uint64_t key, uint64_t stream, uint64_t position) {
+	counterBased = true;
+	streamKey = key;
+	streamId = stream;
+	streamPosition = position;
+	// randInt refills the buffer at its boundaries only
+	if (position % STREAM_BUFFER)
+		philox((position - position % STREAM_BUFFER) >> 2, streamBuffer, STREAM_BUFFER / 4);
+}
+
+bool Random::isCounterBased() const {
+	return counterBased;
+}
+
+uint64_t Random::getStreamKey() const {
+	return streamKey;
+}
+
+uint64_t Random::getStream() const {
+	return streamId;
+}
+
+uint64_t Random::getStreamPosition() const {
+	return streamPosition;
+}
+
+uint64_t Random::deriveStream(uint64_t i) const {
+	// splitmix64 finalizer of stream, position and i
+	uint64_t z = streamId;
+	uint64_t v[2] = {streamPosition, i};
+	for (int j = 0; j < 2; j++) {
+		z += 0x9E3779B97F4A7C15ULL + v[j];
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+	}
+	return z;
+}
+
+void Random::seedStreams(uint64_t runSeed) {
+	streamsSeed = runSeed;
+	streamsEnabled = true;
+}
+
+bool Random::useStreams() {
+	return streamsEnabled;
+}
+
+uint64_t Random::getStreamsSeed() {
+	return streamsSeed;
+}
+
+void Random::selectStream(uint64_t stream) {
+	if (streamsEnabled)
+		instance().seedStream(streamsSeed, stream);
+}
+
+void Random::seedQuasiSources(uint64_t scrambleSeed) {
+	quasiSourcesSeed = scrambleSeed;
+	quasiSourcesEnabled = true;
+}
+
+void Random::disableQuasiSources() {
+	quasiSourcesEnabled = false;
+}
+
+bool Random::useQuasiSources() {
+	return quasiSourcesEnabled;
+}
+
+void Random::selectQuasiPoint(uint64_t index) {
+	if (quasiSourcesEnabled)
+		instance().seedSobol(index, quasiSourcesSeed);
+}
+
+void Random::endQuasiPoint() {
+	if (quasiSourcesEnabled)
+		instance().endSobol();
+}
+
 const std::vector<uint32_t> &Random::getSeed() const
 {
 	return initial_seed;
@@ -485,6 +867,7 @@ Random &Random::instance() {
 }
 
 void Random::seedThreads(const uint32_t oneSeed) {
+	streamsEnabled = false;
 	for(size_t i = 0; i < MAX_THREAD; ++i)
 	_tls[i].r.seed(oneSeed + i);
 }
@@ -503,6 +886,7 @@ Random &Random::instance() {
 	return _random;
 }
 void Random::seedThreads(const uint32_t oneSeed) {
+	streamsEnabled = false;
 	_random.seed(oneSeed);
 }
 std::vector< std::vector<uint32_t> > Random::getSeedThreads()
@@ -525,5 +909,216 @@ void Random::seed(const std::string &b64Seed)
 	seed((uint32_t*)decoded_data.c_str(), seedSize );
 }
 
+size_t Random::randBin(const AliasSampler &sampler) {
+	return sampler.draw(*this);
+}
+
+// AliasSampler ----------------------------------------------------------------
+AliasSampler::AliasSampler() :
+		stale(false), total(0), n(0) {
+}
+
+AliasSampler::AliasSampler(const std::vector<double> &w) :
+		stale(false), total(0), n(0) {
+	setWeights(w);
+}
+
+AliasSampler::AliasSampler(const AliasSampler &sampler) :
+		weights(sampler.weights), table(sampler.table), stale(sampler.stale.load()),
+		total(sampler.total), n(sampler.n) {
+}
+
+AliasSampler &AliasSampler::operator=(const AliasSampler &sampler) {
+	weights = sampler.weights;
+	table = sampler.table;
+	stale = sampler.stale.load();
+	total = sampler.total;
+	n = sampler.n;
+	return *this;
+}
+
+// Vose's construction of the alias table: pair each bin below the mean with one above
+static void buildAliasTable(const double *weights, size_t n, double total, AliasBin *table) {
+	if (n > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("AliasSampler: too many bins");
+
+	AliasBin empty = {0, 0};
+	std::fill(table, table + n, empty);
+	if (not (total > 0))
+		return;
+
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		scaled[i] = weights[i] * n / total;
+		if (scaled[i] < 1)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while (not small.empty() and not large.empty()) {
+		uint32_t s = small.back();
+		small.pop_back();
+		uint32_t l = large.back();
+		table[s].probability = scaled[s];
+		table[s].alias = l;
+		scaled[l] -= 1 - scaled[s];
+		if (scaled[l] < 1) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// the remaining bins are full up to rounding
+	for (size_t i = 0; i < large.size(); i++) {
+		table[large[i]].probability = 1;
+		table[large[i]].alias = large[i];
+	}
+	for (size_t i = 0; i < small.size(); i++) {
+		table[small[i]].probability = 1;
+		table[small[i]].alias = small[i];
+	}
+}
+
+void AliasSampler::build() const {
+	table.resize(n);
+	if (n > 0)
+		buildAliasTable(&weights[0], n, total, &table[0]);
+	std::vector<double>().swap(weights);
+}
+
+void AliasSampler::restoreWeights() {
+	if (stale)
+		return;
+	weights.assign(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		weights[i] += table[i].probability * total / n;
+		weights[table[i].alias] += (1 - table[i].probability) * total / n;
+	}
+	std::vector<AliasBin>().swap(table);
+	stale = true;
+}
+
+void AliasSampler::add(double weight) {
+	if (not (weight >= 0))
+		throw std::runtime_error("AliasSampler: weights have to be non-negative");
+	restoreWeights();
+	weights.push_back(weight);
+	total += weight;
+	n++;
+}
+
+void AliasSampler::setWeights(const std::vector<double> &w) {
+	clear();
+	weights.reserve(w.size());
+	for (size_t i = 0; i < w.size(); i++)
+		add(w[i]);
+}
+
+void AliasSampler::setWeights(const std::vector<float> &w) {
+	clear();
+	weights.reserve(w.size());
+	for (size_t i = 0; i < w.size(); i++)
+		add(w[i]);
+}
+
+void AliasSampler::setCDF(const std::vector<double> &cdf) {
+	clear();
+	weights.reserve(cdf.size());
+	for (size_t i = 0; i < cdf.size(); i++)
+		add(std::max(0., (i > 0) ? cdf[i] - cdf[i - 1] : cdf[i]));
+}
+
+void AliasSampler::setCDF(const std::vector<float> &cdf) {
+	clear();
+	weights.reserve(cdf.size());
+	for (size_t i = 0; i < cdf.size(); i++)
+		add(std::max(0., (i > 0) ? double(cdf[i]) - cdf[i - 1] : cdf[i]));
+}
+
+void AliasSampler::clear() {
+	weights.clear();
+	table.clear();
+	stale = true;
+	total = 0;
+	n = 0;
+}
+
+size_t AliasSampler::size() const {
+	return n;
+}
+
+size_t AliasSampler::getSizeOf() const {
+	return vectorSizeOf(weights) + vectorSizeOf(table);
+}
+
+bool AliasSampler::empty() const {
+	return n == 0;
+}
+
+double AliasSampler::getTotalWeight() const {
+	return total;
+}
+
+void AliasSampler::prepare() const {
+	if (stale.load(std::memory_order_acquire)) {
+#pragma omp critical(AliasSampler)
+		if (stale.load(std::memory_order_relaxed)) {
+			build();
+			stale.store(false, std::memory_order_release);
+		}
+	}
+}
+
+size_t AliasSampler::draw(Random &random) const {
+	prepare();
+	if (n == 0)
+		throw std::runtime_error("AliasSampler: no bins");
+
+	size_t i = random.randInt(uint32_t(n - 1));
+	const AliasBin &bin = table[i];
+	return (random.randExc() < bin.probability) ? i : bin.alias;
+}
+
+// AliasTable ------------------------------------------------------------------
+AliasTable::AliasTable() :
+		nBins(0) {
+}
+
+void AliasTable::addCDF(const std::vector<double> &cdf) {
+	if (cdf.empty())
+		throw std::runtime_error("AliasTable: empty distribution");
+	if (table.empty())
+		nBins = cdf.size();
+	else if (cdf.size() != nBins)
+		throw std::runtime_error("AliasTable: all rows need the same number of bins");
+
+	std::vector<double> weights(nBins);
+	for (size_t i = 0; i < nBins; i++)
+		weights[i] = std::max(0., (i > 0) ? cdf[i] - cdf[i - 1] : cdf[i]);
+	double total = 0;
+	for (size_t i = 0; i < nBins; i++)
+		total += weights[i];
+
+	table.resize(table.size() + nBins);
+	buildAliasTable(&weights[0], nBins, total, &table[table.size() - nBins]);
+}
+
+void AliasTable::clear() {
+	table.clear();
+	nBins = 0;
+}
+
+size_t AliasTable::size() const {
+	return (nBins > 0) ? table.size() / nBins : 0;
+}
+
+size_t AliasTable::bins() const {
+	return nBins;
+}
+
+size_t AliasTable::getSizeOf() const {
+	return vectorSizeOf(table);
+}
+
 } // namespace crpropa
 
@@ -0,0 +1,374 @@
+#include "crpropa/RateBuilder.h"
+#include "crpropa/Common.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/PhotoPionProduction.h"
+
+#include "kiss/logger.h"
+#include "kiss/path.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace crpropa {
+
+// format of the tables; increase if the grids or the integration change
+static const char *rateBuilderFormat = "RateBuilder 1";
+
+static const size_t nPhotonSamples = 2001;
+
+static const double mec2 = mass_electron * c_squared;
+static const double radiusElectron = eplus * eplus / (4 * M_PI * epsilon0 * mec2);
+static const double alphaFineStructure = eplus * eplus / (2 * epsilon0 * h_planck * c_light);
+static const double sigmaThomson = 8 * M_PI / 3 * radiusElectron * radiusElectron;
+
+// Breit-Wheeler pair production, s in [J^2]
+static double sigmaPairProduction(double s) {
+	double smin = 4 * mec2 * mec2;
+	if (s <= smin)
+		return 0;
+	double b = sqrt(1 - smin / s);
+	return sigmaThomson * 3 / 16 * (1 - b * b)
+			* ((3 - b * b * b * b) * log((1 + b) / (1 - b)) - 2 * b * (2 - b * b));
+}
+
+// double pair production, constant cross section above the threshold
+static double sigmaDoublePairProduction(double s) {
+	double smin = 16 * mec2 * mec2;
+	if (s <= smin)
+		return 0;
+	return 6.45e-34 * pow(1 - smin / s, 6); // 6.45 mubarn
+}
+
+// triplet pair production, asymptotic cross section
+static double sigmaTripletPairProduction(double s) {
+	double beta = 28. / 9 * log(s / mec2 / mec2) - 218. / 27;
+	if (beta < 0)
+		return 0;
+	return sigmaThomson * 3 / 8 / M_PI * alphaFineStructure * beta;
+}
+
+// Klein-Nishina cross section, s in [J^2]
+static double sigmaInverseCompton(double s) {
+	double k = (s - mec2 * mec2) / (2 * mec2 * mec2); // photon energy in the electron rest frame [me c^2]
+	if (k <= 0)
+		return 0;
+	if (k < 1e-3)
+		return sigmaThomson * (1 - 2 * k + 26. / 5 * k * k);
+	double l = log1p(2 * k);
+	return sigmaThomson * 3 / 4 * ((1 + k) / (k * k * k) * (2 * k * (1 + k) / (1 + 2 * k) - l)
+			+ l / (2 * k) - (1 + 3 * k) / ((1 + 2 * k) * (1 + 2 * k)));
+}
+
+// Chodorowski et al. 1992, fit of phi(kappa) of the Bethe-Heitler energy loss
+static double phiBetheHeitler(double k) {
+	if (k < 25) {
+		static const double c[4] = {0.8048, 0.1459, 1.137e-3, -3.879e-6};
+		double x = k - 2, d = 1, xi = 1;
+		for (int i = 0; i < 4; i++) {
+			xi *= x;
+			d += c[i] * xi;
+		}
+		return M_PI / 12 * x * x * x * x / d;
+	}
+	static const double d[4] = {-86.07, 50.96, -14.45, 8. / 3};
+	static const double f[3] = {2.910, 78.35, 1837};
+	double lk = log(k), num = 0, lki = 1;
+	for (int i = 0; i < 4; i++) {
+		num += d[i] * lki;
+		lki *= lk;
+	}
+	double den = 1, ki = 1;
+	for (int i = 0; i < 3; i++) {
+		ki /= k;
+		den -= f[i] * ki;
+	}
+	return k * num / den;
+}
+
+// write to a temporary file first, so that concurrent processes never see
+// an incomplete table
+static void writeTable(const std::string &filename, const std::string &content) {
+	size_t slash = filename.rfind(path_seperator);
+	if (slash != std::string::npos)
+		create_directory_recursive(filename.substr(0, slash));
+
+	std::stringstream tmpname;
+	tmpname << filename << ".tmp" << getpid();
+	std::ofstream out(tmpname.str().c_str());
+	out << content;
+	out.close();
+	if (not out or rename(tmpname.str().c_str(), filename.c_str()) != 0) {
+		remove(tmpname.str().c_str());
+		throw std::runtime_error("RateBuilder: could not write " + filename);
+	}
+	KISS_LOG_INFO << "RateBuilder: wrote " << filename;
+}
+
+RateBuilder::RateBuilder(ref_ptr<PhotonField> field, const std::string &directory) :
+		photonField(field), fieldName(field->getFieldName()), cacheDirectory(directory),
+		lnEpsMin(0), dlnEps(0) {
+	if (cacheDirectory.empty()) {
+		const char *env = getenv("CRPROPA_CACHE_PATH");
+		cacheDirectory = env ? env : "crpropa_cache";
+	}
+	samplePhotonField();
+}
+
+void RateBuilder::samplePhotonField() {
+	double epsMin = photonField->getMinimumPhotonEnergy(0);
+	double epsMax = photonField->getMaximumPhotonEnergy(0);
+	if (not (epsMin > 0) or not (epsMax > epsMin))
+		throw std::runtime_error("RateBuilder: invalid energy range of photon field " + fieldName);
+
+	// sampled once and serially, since the field may be implemented in Python
+	lnEpsMin = log(epsMin);
+	dlnEps = log(epsMax / epsMin) / (nPhotonSamples - 1);
+	density.resize(nPhotonSamples);
+	for (size_t i = 0; i < nPhotonSamples; i++)
+		density[i] = std::max(0., photonField->getPhotonDensity(exp(lnEpsMin + i * dlnEps), 0));
+
+	// I(eps) = int_eps density / eps'^2 dln(eps'), from the top
+	integral.assign(nPhotonSamples, 0.);
+	for (size_t i = nPhotonSamples - 1; i > 0; i--) {
+		double e0 = exp(lnEpsMin + (i - 1) * dlnEps), e1 = exp(lnEpsMin + i * dlnEps);
+		integral[i - 1] = integral[i] + 0.5 * dlnEps * (density[i - 1] / e0 / e0 + density[i] / e1 / e1);
+	}
+
+	// FNV-1a of the format, the name and the sampled density
+	uint64_t h = 14695981039346656037ULL;
+	std::string key = std::string(rateBuilderFormat) + "|" + fieldName + "|";
+	std::vector<unsigned char> bytes(key.begin(), key.end());
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(&lnEpsMin);
+	bytes.insert(bytes.end(), p, p + sizeof(double));
+	p = reinterpret_cast<const unsigned char *>(&dlnEps);
+	bytes.insert(bytes.end(), p, p + sizeof(double));
+	p = reinterpret_cast<const unsigned char *>(&density[0]);
+	bytes.insert(bytes.end(), p, p + density.size() * sizeof(double));
+	for (size_t i = 0; i < bytes.size(); i++) {
+		h ^= bytes[i];
+		h *= 1099511628211ULL;
+	}
+	char s[17];
+	std::snprintf(s, sizeof(s), "%016llx", (unsigned long long) h);
+	hash = s;
+}
+
+double RateBuilder::photonIntegral(double eps) const {
+	double p = (log(eps) - lnEpsMin) / dlnEps;
+	if (not (p > 0))
+		return integral.front();
+	if (p >= nPhotonSamples - 1)
+		return 0;
+	size_t i = size_t(p);
+	return integral[i] + (p - i) * (integral[i + 1] - integral[i]);
+}
+
+double RateBuilder::photonDensity(double eps) const {
+	double p = (log(eps) - lnEpsMin) / dlnEps;
+	if ((p < 0) or (p >= nPhotonSamples - 1))
+		return 0;
+	size_t i = size_t(p);
+	return density[i] + (p - i) * (density[i + 1] - density[i]);
+}
+
+std::string RateBuilder::getHash() const {
+	return hash;
+}
+
+std::string RateBuilder::getDirectory() const {
+	return concat_path(cacheDirectory, hash);
+}
+
+std::string RateBuilder::tableFile(const std::string &module, const std::string &prefix) const {
+	return concat_path(getDirectory(), module, prefix + fieldName + ".txt");
+}
+
+bool RateBuilder::haveTable(const std::string &filename) const {
+	return std::ifstream(filename.c_str()).good();
+}
+
+void RateBuilder::buildEM(const std::string &module, CrossSection sigma, double mass,
+		double sKinMin, bool centered, bool cumulative) {
+	std::string rateFile = tableFile(module, "rate_");
+	std::string cdfFile = tableFile(module, "cdf_");
+	if (haveTable(rateFile) and (not cumulative or haveTable(cdfFile)))
+		return;
+
+	// energies log10(E/eV) = 9 ... 23, s_kin nodes in steps of 0.1 in log10
+	// (s_kin / eV^2) from sKinMin up to the largest reachable value; the cdf
+	// bins are [s_j-1, s_j] or, if centered, s_j +- 0.05 in log10
+	const size_t nE = 281;
+	const double lgEMin = 9, dlgE = 0.05, dlgS = 0.1;
+	const size_t nSub = 10; // integration steps per s bin
+	double epsMax = exp(lnEpsMin + (nPhotonSamples - 1) * dlnEps);
+	double lgS0 = log10(sKinMin / eV / eV) + (centered ? 0.5 * dlgS : 0);
+	double lgSMax = log10(4 * pow(10, lgEMin + (nE - 1) * dlgE) * eV * epsMax / eV / eV);
+	size_t nS = std::max(2., ceil((lgSMax - lgS0) / dlgS) + 2);
+
+	std::vector<double> cdf(nE * nS, 0.);
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(nE); i++) {
+		double E = pow(10, lgEMin + i * dlgE) * eV;
+		double sKinTop = 4 * E * epsMax;
+		double total = 0;
+		double lnLo = log(sKinMin);
+		for (size_t j = 0; j < nS; j++) {
+			double lnHi = (lgS0 + j * dlgS + (centered ? 0.5 * dlgS : 0)) * M_LN10 + 2 * log(eV);
+			if ((lnHi > lnLo) and (lnLo < log(sKinTop))) {
+				double h = (lnHi - lnLo) / nSub;
+				for (size_t k = 0; k <= nSub; k++) {
+					double sKin = exp(lnLo + k * h);
+					double w = ((k == 0) or (k == nSub)) ? 0.5 : 1;
+					total += w * h * sigma(sKin + mass * mass) * sKin * sKin * photonIntegral(sKin / 4 / E);
+				}
+			}
+			lnLo = std::max(lnLo, lnHi);
+			cdf[i * nS + j] = total / (8 * E * E);
+		}
+	}
+
+	std::ostringstream rate;
+	rate << "# " << module << " on " << fieldName << ", " << rateBuilderFormat << "\n";
+	rate << "# log10(E/eV), rate [1/Mpc]\n" << std::setprecision(8);
+	for (size_t i = 0; i < nE; i++)
+		rate << lgEMin + i * dlgE << " " << cdf[i * nS + nS - 1] * Mpc << "\n";
+	writeTable(rateFile, rate.str());
+	if (not cumulative)
+		return;
+
+	std::ostringstream table;
+	table << "# " << module << " on " << fieldName << ", " << rateBuilderFormat << "\n";
+	table << "# cumulative rate [1/Mpc]: first row log10(s_kin/eV^2), then rows log10(E/eV), cdf\n";
+	table << std::setprecision(8) << 0;
+	for (size_t j = 0; j < nS; j++)
+		table << " " << lgS0 + j * dlgS;
+	table << "\n";
+	for (size_t i = 0; i < nE; i++) {
+		if (not (cdf[i * nS + nS - 1] > 0))
+			continue; // no interactions
+		table << lgEMin + i * dlgE;
+		for (size_t j = 0; j < nS; j++)
+			table << " " << cdf[i * nS + j] * Mpc;
+		table << "\n";
+	}
+	writeTable(cdfFile, table.str());
+}
+
+void RateBuilder::buildEMPairProduction() {
+	buildEM("EMPairProduction", sigmaPairProduction, 0, 4 * mec2 * mec2, false, true);
+}
+
+void RateBuilder::buildEMDoublePairProduction() {
+	buildEM("EMDoublePairProduction", sigmaDoublePairProduction, 0, 16 * mec2 * mec2, false, false);
+}
+
+void RateBuilder::buildEMTripletPairProduction() {
+	// threshold of the asymptotic cross section
+	double sMin = mec2 * mec2 * exp(218. / 27 * 9 / 28);
+	buildEM("EMTripletPairProduction", sigmaTripletPairProduction, mec2, sMin - mec2 * mec2, true, true);
+}
+
+void RateBuilder::buildEMInverseComptonScattering() {
+	// no threshold: start where the smallest photon energies contribute
+	double sKinMin = 4 * 1e9 * eV * exp(lnEpsMin) * 1e-2;
+	buildEM("EMInverseComptonScattering", sigmaInverseCompton, mec2, sKinMin, true, true);
+}
+
+void RateBuilder::buildElectronPairProduction() {
+	std::string filename = tableFile("ElectronPairProduction", "lossrate_");
+	if (haveTable(filename))
+		return;
+
+	// relative energy loss rate of protons, Blumenthal 1970 eq. 3.11:
+	// b = alpha r_e^2 me / mp / Gamma int_2 n(kappa / 2 Gamma) phi(kappa) / kappa^2 dkappa
+	// with n the density per photon energy in units of me c^2
+	const size_t nG = 161, nK = 400;
+	const double lgGMin = 6, dlgG = 0.05;
+	double epsMax = exp(lnEpsMin + (nPhotonSamples - 1) * dlnEps);
+	std::vector<double> loss(nG, 0.);
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(nG); i++) {
+		double gamma = pow(10, lgGMin + i * dlgG);
+		double lnK0 = log(2.), lnK1 = log(2 * gamma * epsMax / mec2);
+		if (lnK1 <= lnK0)
+			continue;
+		double h = (lnK1 - lnK0) / nK, sum = 0;
+		for (size_t k = 0; k <= nK; k++) {
+			double kappa = exp(lnK0 + k * h);
+			double eps = kappa * mec2 / 2 / gamma;
+			double n = photonDensity(eps) / eps * mec2;
+			double w = ((k == 0) or (k == nK)) ? 0.5 : 1;
+			sum += w * h * n * phiBetheHeitler(kappa) / kappa;
+		}
+		loss[i] = alphaFineStructure * radiusElectron * radiusElectron * mass_electron / mass_proton / gamma * sum;
+	}
+
+	std::ostringstream table;
+	table << "# ElectronPairProduction on " << fieldName << ", " << rateBuilderFormat << "\n";
+	table << "# log10(Gamma), energy loss rate 1/E dE/dx [1/Mpc]\n" << std::setprecision(8);
+	for (size_t i = 0; i < nG; i++)
+		table << lgGMin + i * dlgG << " " << loss[i] * Mpc << "\n";
+	writeTable(filename, table.str());
+}
+
+void RateBuilder::buildPhotoPionProduction() {
+	std::string filename = tableFile("PhotoPionProduction", "rate_");
+	if (haveTable(filename))
+		return;
+
+	// rate = 1 / (2 Gamma^2) int sigma(eps') eps' I(eps' / 2 Gamma) deps'
+	// with eps' the photon energy in the nucleon rest frame
+	const size_t nG = 201;
+	const double lgGMin = 6, dlgG = 0.05, dlgEps = 0.005;
+	double epsMax = exp(lnEpsMin + (nPhotonSamples - 1) * dlnEps);
+	std::vector<double> rate(2 * nG, 0.);
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < int(2 * nG); i++) {
+		bool onProton = (i % 2 == 0);
+		double gamma = pow(10, lgGMin + (i / 2) * dlgG);
+		double lnE0 = log(0.1 * GeV); // below the pion production threshold
+		double lnE1 = log(2 * gamma * epsMax);
+		if (lnE1 <= lnE0)
+			continue;
+		size_t n = std::max(2., ceil((lnE1 - lnE0) / M_LN10 / dlgEps));
+		double h = (lnE1 - lnE0) / n, sum = 0;
+		for (size_t k = 0; k <= n; k++) {
+			double epsPrime = exp(lnE0 + k * h);
+			double sigma = PhotoPionProduction::crossection(epsPrime / GeV, onProton) * 1e-34; // mubarn
+			double w = ((k == 0) or (k == n)) ? 0.5 : 1;
+			sum += w * h * sigma * epsPrime * epsPrime * photonIntegral(epsPrime / 2 / gamma);
+		}
+		rate[i] = sum / (2 * gamma * gamma);
+	}
+
+	std::ostringstream table;
+	table << "# PhotoPionProduction on " << fieldName << ", " << rateBuilderFormat << "\n";
+	table << "# log10(Gamma), proton rate [1/Mpc], neutron rate [1/Mpc]\n" << std::setprecision(8);
+	for (size_t i = 0; i < nG; i++)
+		table << lgGMin + i * dlgG << " " << rate[2 * i] * Mpc << " " << rate[2 * i + 1] * Mpc << "\n";
+	writeTable(filename, table.str());
+}
+
+void RateBuilder::buildAll() {
+	buildEMPairProduction();
+	buildEMDoublePairProduction();
+	buildEMTripletPairProduction();
+	buildEMInverseComptonScattering();
+	buildElectronPairProduction();
+	buildPhotoPionProduction();
+	registerTables();
+}
+
+void RateBuilder::registerTables() const {
+	addDataPath(getDirectory());
+}
+
+} // namespace crpropa
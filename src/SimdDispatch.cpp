@@ -0,0 +1,100 @@
+#include "crpropa/SimdDispatch.h"
+
+#include "kiss/logger.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace crpropa {
+
+#ifdef CRPROPA_SIMD_DISPATCH
+// in src/simd/KernelsAVX*.cpp
+void simdKernelsAVX(SimdKernels &kernels);
+void simdKernelsAVX2(SimdKernels &kernels);
+void simdKernelsAVX512(SimdKernels &kernels);
+#endif
+
+namespace {
+
+SimdLevel detectSimdLevel() {
+	SimdLevel level = SIMD_NONE;
+#ifdef CRPROPA_SIMD_DISPATCH
+	// also checks that the operating system saves the registers
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		level = SIMD_AVX;
+	if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma"))
+		level = SIMD_AVX2;
+	if ((level == SIMD_AVX2) and __builtin_cpu_supports("avx512f"))
+		level = SIMD_AVX512;
+#endif
+
+	const char *env = getenv("CRPROPA_SIMD");
+	if (env) {
+		SimdLevel limit = level;
+		for (int l = SIMD_NONE; l <= SIMD_AVX512; l++)
+			if (getSimdLevelName(SimdLevel(l)) == env)
+				limit = SimdLevel(l);
+		if (limit == level and getSimdLevelName(level) != env)
+			KISS_LOG_WARNING << "CRPROPA_SIMD: unknown level " << env;
+		if (limit < level)
+			level = limit;
+	}
+	return level;
+}
+
+struct KernelTables {
+	SimdLevel supported;
+	SimdKernels tables[SIMD_AVX512 + 1];
+
+	KernelTables() : supported(detectSimdLevel()) {
+		memset(tables, 0, sizeof(tables));
+#ifdef CRPROPA_SIMD_DISPATCH
+		simdKernelsAVX(tables[SIMD_AVX]);
+		simdKernelsAVX2(tables[SIMD_AVX2]);
+		simdKernelsAVX512(tables[SIMD_AVX512]);
+#endif
+	}
+};
+
+KernelTables &kernelTables() {
+	static KernelTables tables;
+	return tables;
+}
+
+// < 0: not limited by setSimdLevel
+std::atomic<int> simdLevelLimit(-1);
+
+} // namespace
+
+SimdLevel getSimdLevel() {
+	SimdLevel level = kernelTables().supported;
+	int limit = simdLevelLimit;
+	if ((limit >= 0) and (limit < level))
+		level = SimdLevel(limit);
+	return level;
+}
+
+void setSimdLevel(SimdLevel level) {
+	simdLevelLimit = level;
+}
+
+std::string getSimdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_AVX:
+		return "avx";
+	case SIMD_AVX2:
+		return "avx2";
+	case SIMD_AVX512:
+		return "avx512";
+	default:
+		return "none";
+	}
+}
+
+const SimdKernels &getSimdKernels() {
+	return kernelTables().tables[getSimdLevel()];
+}
+
+} // namespace crpropa
@@ -0,0 +1,57 @@
+#include "crpropa/SimdMath.h"
+#include "crpropa/SimdDispatch.h"
+
+#include "simd/SimdMath.h"
+
+namespace crpropa {
+
+// the kernels of the SimdLevel if there are any, else the loops compiled here
+
+void simdLog(const double *x, double *y, size_t n) {
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.logArray)
+		kernels.logArray(x, y, n);
+	else
+		simdmath::logArray(x, y, n);
+}
+
+void simdLog10(const double *x, double *y, size_t n) {
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.log10Array)
+		kernels.log10Array(x, y, n);
+	else
+		simdmath::log10Array(x, y, n);
+}
+
+void simdExp(const double *x, double *y, size_t n) {
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.expArray)
+		kernels.expArray(x, y, n);
+	else
+		simdmath::expArray(x, y, n);
+}
+
+void simdPow10(const double *x, double *y, size_t n) {
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.pow10Array)
+		kernels.pow10Array(x, y, n);
+	else
+		simdmath::pow10Array(x, y, n);
+}
+
+void simdPow(const double *x, double a, double *y, size_t n) {
+	simdLog(x, y, n);
+	for (size_t i = 0; i < n; i++)
+		y[i] *= a;
+	simdExp(y, y, n);
+}
+
+void simdSinCos(const double *x, double *s, double *c, size_t n) {
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.sinCosArray)
+		kernels.sinCosArray(x, s, c, n);
+	else
+		simdmath::sinCosArray(x, s, c, n);
+}
+
+} // namespace crpropa
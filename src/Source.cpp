@@ -4,16 +4,123 @@
 #include "crpropa/Common.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/SimdMath.h"
 
 #ifdef CRPROPA_HAVE_MUPARSER
 #include "muParser.h"
 #endif
 
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 
 namespace crpropa {
 
+namespace {
+
+// Random::randPowerLaw with the constants computed once for many energies
+class PowerLawSampler {
+	bool logarithmic;
+	double part1, part2, ex;
+public:
+	PowerLawSampler(double index, double min, double max) {
+		if ((min < 0) || (max < min))
+			throw std::runtime_error(
+					"Power law distribution only possible for 0 <= min <= max");
+		logarithmic = std::abs(index + 1.0) < std::numeric_limits<double>::epsilon();
+		if (logarithmic) {
+			part1 = log(max);
+			part2 = log(min);
+		} else {
+			part1 = pow(max, index + 1);
+			part2 = pow(min, index + 1);
+			ex = 1 / (index + 1);
+		}
+	}
+
+	// argument of exp or pow for a uniform random number u
+	double argument(double u) const {
+		return (part1 - part2) * u + part2;
+	}
+
+	// energy for a uniform random number u
+	double operator()(double u) const {
+		if (logarithmic)
+			return exp(argument(u));
+		return pow(argument(u), ex);
+	}
+
+	// energies for n arguments, in place, vectorized; the same for all
+	// samplers of the same index
+	void energies(double *a, size_t n) const {
+		if (logarithmic)
+			simdExp(a, a, n);
+		else
+			simdPow(a, ex, a, n);
+	}
+};
+
+// Inverse of the cumulative distribution of pdf on [0, xMax], tabulated in
+// the uniform random number, so that a draw costs one number and one
+// interpolation
+template<class Pdf>
+LogGridTable inverseCdfTable(const Pdf &pdf, double xMax) {
+	const size_t n = 4096;
+	std::vector<double> x(n + 1), cdf(n + 1, 0);
+	for (size_t i = 0; i <= n; i++)
+		x[i] = xMax * i / n;
+	for (size_t i = 0; i < n; i++) // Simpson's rule in each interval
+		cdf[i + 1] = cdf[i] + (x[i + 1] - x[i]) / 6
+				* (pdf(x[i]) + 4 * pdf((x[i] + x[i + 1]) / 2) + pdf(x[i + 1]));
+	if (not (cdf[n] > 0) or not std::isfinite(cdf[n]))
+		throw std::runtime_error("Source: distribution cannot be normalized");
+
+	std::vector<double> u(n + 1), y(n + 1);
+	size_t j = 0;
+	for (size_t k = 0; k <= n; k++) {
+		u[k] = double(k) / n;
+		double c = u[k] * cdf[n];
+		while ((j + 1 < n) and (cdf[j + 1] < c))
+			j++;
+		double d = cdf[j + 1] - cdf[j];
+		y[k] = (d > 0) ? x[j] + (x[j + 1] - x[j]) * (c - cdf[j]) / d : x[j];
+	}
+	y[n] = xMax;
+	return LogGridTable(u, y);
+}
+
+// height from exp(-|z| / zg) in [-zMax, zMax], the sign from the same number
+double sampleHeight(double u, double zg, double zMax) {
+	double v = std::fabs(2 * u - 1);
+	double z = -zg * std::log1p(v * std::expm1(-zMax / zg));
+	return (u < 0.5) ? -z : z;
+}
+
+// uniform direction in a cone, given by 1 - cos of the half-opening angle,
+// which is precise for small cones
+Vector3d coneDirection(const Vector3d &axis, double oneMinusCos, Random &random) {
+	double theta = 2 * asin(std::sqrt(random.rand() * oneMinusCos / 2));
+	return random.randVectorAroundMean(axis, theta);
+}
+
+// true if the unit vector direction lies in the cone, with a tolerance for
+// the rounding of coneDirection
+bool inCone(const Vector3d &direction, const Vector3d &axis, double oneMinusCos) {
+	return (direction - axis).getR2() / 2 <= oneMinusCos * (1 + 1e-9);
+}
+
+// all states are equal at the source, the current one is always retained
+void setSourceStates(Candidate &candidate) {
+	candidate.previous = candidate.current;
+	candidate.source = candidate.current;
+	if (candidate.source.isRetained())
+		candidate.created = candidate.source;
+	else
+		candidate.created = candidate.current;
+}
+
+} // namespace
+
 // Source ---------------------------------------------------------------------
 void Source::add(SourceFeature* property) {
 	features.push_back(property);
@@ -26,6 +133,27 @@ ref_ptr<Candidate> Source::getCandidate() const {
 	return candidate;
 }
 
+void Source::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+	if (n == 0)
+		return;
+
+	// prepare the particle states with the leading particle features
+	std::vector<ParticleState> states(n);
+	size_t i = 0;
+	for (; (i < features.size()) and features[i]->isParticleFeature(); i++)
+		features[i]->prepareParticles(&states[0], n);
+
+	size_t first = out.size();
+	out.reserve(first + n);
+	uint64_t serialNumber = Candidate::reserveSerialNumbers(n);
+	for (size_t j = 0; j < n; j++)
+		out.push_back(new Candidate(states[j], serialNumber + j));
+
+	// remaining features, which may depend on the candidate
+	for (; i < features.size(); i++)
+		features[i]->prepareCandidates(&out[first], n);
+}
+
 std::string Source::getDescription() const {
 	std::stringstream ss;
 	ss << "Cosmic ray source\n";
@@ -34,18 +162,23 @@ std::string Source::getDescription() const {
 	return ss.str();
 }
 
+// SourceInterface-------------------------------------------------------------
+void SourceInterface::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+	out.reserve(out.size() + n);
+	for (size_t i = 0; i < n; i++)
+		out.push_back(getCandidate());
+}
+
 // SourceList------------------------------------------------------------------
 void SourceList::add(Source* source, double weight) {
 	sources.push_back(source);
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
 }
 
 ref_ptr<Candidate> SourceList::getCandidate() const {
 	if (sources.size() == 0)
 		throw std::runtime_error("SourceList: no sources set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = Random::instance().randBin(sampler);
 	return (sources[i])->getCandidate();
 }
 
@@ -57,13 +190,191 @@ std::string SourceList::getDescription() const {
 	return ss.str();
 }
 
+// SourceCatalog---------------------------------------------------------------
+SourceCatalog::SourceCatalog(double minEnergy) {
+	setMinimumEnergy(minEnergy);
+}
+
+void SourceCatalog::add(const Vector3d &position, double weight, double redshift) {
+	if (weight < 0)
+		throw std::runtime_error("SourceCatalog: weight < 0");
+	x.push_back(position.x);
+	y.push_back(position.y);
+	z.push_back(position.z);
+	weights.push_back(weight);
+	redshifts.push_back(redshift);
+	sampler.add(weight);
+	if (not indices.empty()) {
+		indices.push_back(std::numeric_limits<double>::quiet_NaN());
+		maxEnergies.push_back(0);
+	}
+}
+
+void SourceCatalog::add(const Vector3d &position, double weight, double redshift,
+		double index, double maxEnergy) {
+	if (not std::isfinite(index))
+		throw std::runtime_error("SourceCatalog: spectral index not finite");
+	if (maxEnergy < minEnergy)
+		throw std::runtime_error("SourceCatalog: maxEnergy < minEnergy");
+	// the sources without spectrum so far
+	if (indices.empty()) {
+		indices.assign(x.size(), std::numeric_limits<double>::quiet_NaN());
+		maxEnergies.assign(x.size(), 0);
+	}
+	add(position, weight, redshift);
+	indices.back() = index;
+	maxEnergies.back() = maxEnergy;
+}
+
+void SourceCatalog::add(SourceFeature *feature) {
+	features.push_back(feature);
+}
+
+void SourceCatalog::reserve(size_t n) {
+	x.reserve(n);
+	y.reserve(n);
+	z.reserve(n);
+	weights.reserve(n);
+	redshifts.reserve(n);
+}
+
+void SourceCatalog::setMinimumEnergy(double energy) {
+	if (energy < 0)
+		throw std::runtime_error("SourceCatalog: minEnergy < 0");
+	for (size_t i = 0; i < maxEnergies.size(); i++)
+		if (hasSpectrum(i) and maxEnergies[i] < energy)
+			throw std::runtime_error("SourceCatalog: maxEnergy < minEnergy");
+	minEnergy = energy;
+}
+
+double SourceCatalog::getMinimumEnergy() const {
+	return minEnergy;
+}
+
+size_t SourceCatalog::size() const {
+	return x.size();
+}
+
+Vector3d SourceCatalog::getPosition(size_t i) const {
+	return Vector3d(x.at(i), y.at(i), z.at(i));
+}
+
+double SourceCatalog::getWeight(size_t i) const {
+	return weights.at(i);
+}
+
+double SourceCatalog::getRedshift(size_t i) const {
+	return redshifts.at(i);
+}
+
+bool SourceCatalog::hasSpectrum(size_t i) const {
+	return (i < indices.size()) and std::isfinite(indices[i]);
+}
+
+double SourceCatalog::getSpectralIndex(size_t i) const {
+	return hasSpectrum(i) ? indices[i] : std::numeric_limits<double>::quiet_NaN();
+}
+
+double SourceCatalog::getMaximumEnergy(size_t i) const {
+	return hasSpectrum(i) ? maxEnergies[i] : 0;
+}
+
+size_t SourceCatalog::getSizeOf() const {
+	return vectorSizeOf(x) + vectorSizeOf(y) + vectorSizeOf(z) + vectorSizeOf(weights)
+			+ vectorSizeOf(redshifts) + vectorSizeOf(indices) + vectorSizeOf(maxEnergies)
+			+ sampler.getSizeOf();
+}
+
+void SourceCatalog::prepareSource(size_t i, Candidate &candidate) const {
+	candidate.current.setPosition(Vector3d(x[i], y[i], z[i]));
+	candidate.setRedshift(redshifts[i]);
+}
+
+void SourceCatalog::prepareSpectrum(size_t i, Candidate &candidate) const {
+	if (not hasSpectrum(i))
+		return;
+	double u = Random::instance().rand();
+	candidate.current.setEnergy(PowerLawSampler(indices[i], minEnergy, maxEnergies[i])(u));
+	setSourceStates(candidate);
+}
+
+ref_ptr<Candidate> SourceCatalog::getCandidate() const {
+	if (x.empty())
+		throw std::runtime_error("SourceCatalog: no sources set");
+	size_t i = Random::instance().randBin(sampler);
+	ref_ptr<Candidate> candidate = new Candidate();
+	prepareSource(i, *candidate);
+	setSourceStates(*candidate);
+	for (size_t j = 0; j < features.size(); j++)
+		features[j]->prepareCandidate(*candidate);
+	prepareSpectrum(i, *candidate);
+	return candidate;
+}
+
+void SourceCatalog::getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+	if (n == 0)
+		return;
+	if (x.empty())
+		throw std::runtime_error("SourceCatalog: no sources set");
+
+	// the sources first, then as Source::getCandidates
+	Random &random = Random::instance();
+	std::vector<size_t> source(n);
+	for (size_t k = 0; k < n; k++)
+		source[k] = random.randBin(sampler);
+
+	std::vector<ParticleState> states(n);
+	for (size_t k = 0; k < n; k++)
+		states[k].setPosition(Vector3d(x[source[k]], y[source[k]], z[source[k]]));
+	size_t j = 0;
+	for (; (j < features.size()) and features[j]->isParticleFeature(); j++)
+		features[j]->prepareParticles(&states[0], n);
+
+	size_t first = out.size();
+	out.reserve(first + n);
+	uint64_t serialNumber = Candidate::reserveSerialNumbers(n);
+	for (size_t k = 0; k < n; k++) {
+		out.push_back(new Candidate(states[k], serialNumber + k));
+		out.back()->setRedshift(redshifts[source[k]]);
+		setSourceStates(*out.back());
+	}
+
+	for (; j < features.size(); j++)
+		features[j]->prepareCandidates(&out[first], n);
+	if (not indices.empty())
+		for (size_t k = 0; k < n; k++)
+			prepareSpectrum(source[k], *out[first + k]);
+}
+
+std::string SourceCatalog::getDescription() const {
+	std::stringstream ss;
+	ss << "Catalogue of " << x.size() << " cosmic ray sources";
+	if (not indices.empty())
+		ss << ", minimum energy " << minEnergy / EeV << " EeV";
+	ss << "\n";
+	for (size_t i = 0; i < features.size(); i++)
+		ss << "    " << features[i]->getDescription();
+	return ss.str();
+}
+
 // SourceFeature---------------------------------------------------------------
 void SourceFeature::prepareCandidate(Candidate& candidate) const {
-	ParticleState &source = candidate.source;
-	prepareParticle(source);
-	candidate.created = source;
-	candidate.current = source;
-	candidate.previous = source;
+	prepareParticle(candidate.current);
+	setSourceStates(candidate);
+}
+
+void SourceFeature::prepareParticles(ParticleState *particles, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		prepareParticle(particles[i]);
+}
+
+void SourceFeature::prepareCandidates(ref_ptr<Candidate> *candidates, size_t n) const {
+	for (size_t i = 0; i < n; i++)
+		prepareCandidate(*candidates[i]);
+}
+
+bool SourceFeature::isParticleFeature() const {
+	return false;
 }
 
 std::string SourceFeature::getDescription() const {
@@ -80,6 +391,10 @@ void SourceParticleType::prepareParticle(ParticleState& particle) const {
 	particle.setId(id);
 }
 
+bool SourceParticleType::isParticleFeature() const {
+	return true;
+}
+
 void SourceParticleType::setDescription() {
 	std::stringstream ss;
 	ss << "SourceParticleType: " << id << "\n";
@@ -120,16 +435,14 @@ SourceMultipleParticleTypes::SourceMultipleParticleTypes() {
 
 void SourceMultipleParticleTypes::add(int id, double a) {
 	particleTypes.push_back(id);
-	if (cdf.size() > 0)
-		a += cdf.back();
-	cdf.push_back(a);
+	sampler.add(a);
 	setDescription();
 }
 
 void SourceMultipleParticleTypes::prepareParticle(ParticleState& particle) const {
 	if (particleTypes.size() == 0)
 		throw std::runtime_error("SourceMultipleParticleTypes: no nuclei set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = Random::instance().randBin(sampler);
 	particle.setId(particleTypes[i]);
 }
 
@@ -151,6 +464,10 @@ void SourceEnergy::prepareParticle(ParticleState& p) const {
 	p.setEnergy(E);
 }
 
+bool SourceEnergy::isParticleFeature() const {
+	return true;
+}
+
 void SourceEnergy::setDescription() {
 	std::stringstream ss;
 	ss << "SourceEnergy: " << E / EeV << " EeV\n";
@@ -170,6 +487,23 @@ void SourcePowerLawSpectrum::prepareParticle(ParticleState& particle) const {
 	particle.setEnergy(E);
 }
 
+void SourcePowerLawSpectrum::prepareParticles(ParticleState *particles, size_t n) const {
+	// draw all random numbers first, then compute the energies in one loop
+	Random &random = Random::instance();
+	PowerLawSampler sampler(index, Emin, Emax);
+	std::vector<double> E(n);
+	random.fillUniform(E.data(), n);
+	for (size_t i = 0; i < n; i++)
+		E[i] = sampler.argument(E[i]);
+	sampler.energies(E.data(), n);
+	for (size_t i = 0; i < n; i++)
+		particles[i].setEnergy(E[i]);
+}
+
+bool SourcePowerLawSpectrum::isParticleFeature() const {
+	return true;
+}
+
 void SourcePowerLawSpectrum::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePowerLawSpectrum: Random energy ";
@@ -197,9 +531,7 @@ void SourceComposition::add(int id, double weight) {
 
 	weight *= pow(A, -a);
 
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
 	setDescription();
 }
 
@@ -214,7 +546,7 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 	// draw random particle type
-	size_t i = random.randBin(cdf);
+	size_t i = random.randBin(sampler);
 	int id = nuclei[i];
 	particle.setId(id);
 
@@ -223,6 +555,35 @@ void SourceComposition::prepareParticle(ParticleState& particle) const {
 	particle.setEnergy(random.randPowerLaw(index, Emin, Z * Rmax));
 }
 
+void SourceComposition::prepareParticles(ParticleState *particles, size_t n) const {
+	if (nuclei.size() == 0)
+		throw std::runtime_error("SourceComposition: No source isotope set");
+
+	Random &random = Random::instance();
+	std::vector<size_t> species(n);
+	std::vector<double> u(n);
+	for (size_t i = 0; i < n; i++) {
+		species[i] = random.randBin(sampler);
+		u[i] = random.rand();
+	}
+
+	std::vector<PowerLawSampler> samplers;
+	samplers.reserve(nuclei.size());
+	for (size_t j = 0; j < nuclei.size(); j++)
+		samplers.push_back(PowerLawSampler(index, Emin, chargeNumber(nuclei[j]) * Rmax));
+	for (size_t i = 0; i < n; i++)
+		u[i] = samplers[species[i]].argument(u[i]);
+	samplers[0].energies(u.data(), n);
+	for (size_t i = 0; i < n; i++) {
+		particles[i].setId(nuclei[species[i]]);
+		particles[i].setEnergy(u[i]);
+	}
+}
+
+bool SourceComposition::isParticleFeature() const {
+	return true;
+}
+
 void SourceComposition::setDescription() {
 	std::stringstream ss;
 	ss << "SourceComposition: Random element and energy ";
@@ -248,6 +609,10 @@ void SourcePosition::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(position);
 }
 
+bool SourcePosition::isParticleFeature() const {
+	return true;
+}
+
 void SourcePosition::setDescription() {
 	std::stringstream ss;
 	ss << "SourcePosition: " << position / Mpc << " Mpc\n";
@@ -261,15 +626,13 @@ SourceMultiplePositions::SourceMultiplePositions() {
 
 void SourceMultiplePositions::add(Vector3d pos, double weight) {
 	positions.push_back(pos);
-	if (cdf.size() > 0)
-		weight += cdf.back();
-	cdf.push_back(weight);
+	sampler.add(weight);
 }
 
 void SourceMultiplePositions::prepareParticle(ParticleState& particle) const {
 	if (positions.size() == 0)
 		throw std::runtime_error("SourceMultiplePositions: no position set");
-	size_t i = Random::instance().randBin(cdf);
+	size_t i = Random::instance().randBin(sampler);
 	particle.setPosition(positions[i]);
 }
 
@@ -293,6 +656,29 @@ void SourceUniformSphere::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(center + random.randVector() * r);
 }
 
+void SourceUniformSphere::prepareParticles(ParticleState *particles, size_t n) const {
+	Random &random = Random::instance();
+	std::vector<double> u(3 * n), r(n), z(n), t(n), cosT(n), sinT(n);
+	random.fillUniform(u.data(), u.size());
+	for (size_t i = 0; i < n; i++) {
+		// as rand(), randUniform(-1, 1) and randUniform(-pi, pi)
+		r[i] = u[3 * i];
+		z[i] = -1.0 + 2.0 * u[3 * i + 1];
+		t[i] = -1.0 * M_PI + 2.0 * M_PI * u[3 * i + 2];
+	}
+	simdPow(r.data(), 1. / 3., r.data(), n);
+	simdSinCos(t.data(), sinT.data(), cosT.data(), n);
+	for (size_t i = 0; i < n; i++) {
+		// as randVector
+		double s = sqrt(1 - z[i] * z[i]);
+		particles[i].setPosition(center + Vector3d(s * cosT[i], s * sinT[i], z[i]) * (r[i] * radius));
+	}
+}
+
+bool SourceUniformSphere::isParticleFeature() const {
+	return true;
+}
+
 void SourceUniformSphere::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniformSphere: Random position within a sphere at ";
@@ -406,29 +792,17 @@ SourceSNRDistribution::SourceSNRDistribution(double rEarth, double alpha, double
 
 void SourceSNRDistribution::prepareParticle(ParticleState& particle) const {
   	Random &random = Random::instance();
-	double RPos;
-	while (true) {
-		RPos = random.rand() * rMax;
-		double fTest = random.rand() * frMax;
-		double fR = fr(RPos);
-		if (fTest <= fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true) {
-		ZPos = (random.rand() - 0.5) * 2 * zMax;
-		double fTest = random.rand() * fzMax;
-		double fZ=fz(ZPos);
-		if (fTest<=fZ) {
-			break;
-		}
-	}
+	double RPos = rTable(random.rand());
+	double ZPos = sampleHeight(random.rand(), zg, zMax);
 	double phi = random.rand() * 2 * M_PI;
 	Vector3d pos(cos(phi) * RPos, sin(phi) * RPos, ZPos);
 	particle.setPosition(pos);
 }
 
+void SourceSNRDistribution::updateRTable() {
+	rTable = inverseCdfTable([this](double r) { return fr(r); }, rMax);
+}
+
 double SourceSNRDistribution::fr(double r) const {
 	return pow(r / rEarth, alpha) * exp(- beta * (r - rEarth) / rEarth);
 }
@@ -460,7 +834,7 @@ void SourceSNRDistribution::setFzMax(double zg) {
 
 void SourceSNRDistribution::setRMax(double r) {
 	rMax = r;
-	return;
+	updateRTable();
 }
 
 void SourceSNRDistribution::setZMax(double z) {
@@ -528,24 +902,8 @@ SourcePulsarDistribution::SourcePulsarDistribution(double rEarth, double beta, d
 
 void SourcePulsarDistribution::prepareParticle(ParticleState& particle) const {
   	Random &random = Random::instance();
-	double Rtilde;
-	while (true) {
-		Rtilde = random.rand() * rMax;
-		double fTest = random.rand() * frMax;
-		double fR = fr(Rtilde);
-		if (fTest <= fR) {
-			break;
-		}
-	}
-	double ZPos;
-	while (true) {
-		ZPos = (random.rand() - 0.5) * 2 * zMax;
-		double fTest = random.rand() * fzMax;
-		double fZ = fz(ZPos);
-		if (fTest <= fZ) {
-			break;
-		}
-	}
+	double Rtilde = rTable(random.rand());
+	double ZPos = sampleHeight(random.rand(), zg, zMax);
 
 	int i = random.randInt(3);
 	double thetaTilde = ftheta(i, Rtilde);
@@ -605,9 +963,13 @@ void SourcePulsarDistribution::setFzMax(double zg) {
 	return;
 }
 
+void SourcePulsarDistribution::updateRTable() {
+	rTable = inverseCdfTable([this](double r) { return fr(r); }, rMax);
+}
+
 void SourcePulsarDistribution::setRMax(double r) {
 	rMax = r;
-	return;
+	updateRTable();
 }
 
 void SourcePulsarDistribution::setZMax(double z) {
@@ -682,6 +1044,10 @@ void SourceUniform1D::prepareParticle(ParticleState& particle) const {
 	particle.setPosition(Vector3d(d, 0, 0));
 }
 
+bool SourceUniform1D::isParticleFeature() const {
+	return true;
+}
+
 void SourceUniform1D::setDescription() {
 	std::stringstream ss;
 	ss << "SourceUniform1D: Random uniform position in D = ";
@@ -695,24 +1061,66 @@ void SourceUniform1D::setDescription() {
 // ----------------------------------------------------------------------------
 SourceDensityGrid::SourceDensityGrid(ref_ptr<Grid1f> grid) :
 		grid(grid) {
-	float sum = 0;
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		for (int iy = 0; iy < grid->getNy(); iy++) {
-			for (int iz = 0; iz < grid->getNz(); iz++) {
-				sum += grid->get(ix, iy, iz);
-				grid->get(ix, iy, iz) = sum;
+	const size_t Nx = grid->getNx(), Ny = grid->getNy(), Nz = grid->getNz();
+	nBricksY = (Ny + 7) / 8;
+	nBricksZ = (Nz + 7) / 8;
+	size_t nBricks = ((Nx + 7) / 8) * nBricksY * nBricksZ;
+
+	std::vector<double> brickWeights;
+	float rows[64];
+	for (size_t brick = 0; brick < nBricks; brick++) {
+		size_t bx = brick / (nBricksY * nBricksZ);
+		size_t by = (brick / nBricksZ) % nBricksY;
+		size_t bz = brick % nBricksZ;
+		double sum = 0;
+		for (size_t row = 0; row < 64; row++) {
+			size_t ix = bx * 8 + row / 8, iy = by * 8 + row % 8;
+			if ((ix < Nx) and (iy < Ny)) {
+				for (size_t iz = bz * 8; iz < std::min(Nz, bz * 8 + 8); iz++)
+					sum += std::max(0.f, grid->get(ix, iy, iz));
 			}
+			rows[row] = sum;
 		}
+		if (not (sum > 0))
+			continue; // empty bricks are never drawn
+		bricks.push_back(brick);
+		brickWeights.push_back(sum);
+		for (size_t row = 0; row < 64; row++)
+			rowCdfs.push_back(rows[row] / sum);
+		rowCdfs.back() = 1;
 	}
+	if (bricks.empty())
+		throw std::runtime_error("SourceDensityGrid: grid without positive density");
+	brickSampler.setWeights(brickWeights);
+	brickSampler.prepare();
 	setDescription();
 }
 
 void SourceDensityGrid::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
-	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
-	Vector3d pos = grid->positionFromIndex(i);
+	// draw random brick, row of 8 cells along z within the brick, and cell
+	size_t b = random.randBin(brickSampler);
+	size_t brick = bricks[b];
+	const float *cdf = &rowCdfs[64 * b];
+	size_t row = std::upper_bound(cdf, cdf + 64, float(random.rand())) - cdf;
+	row = std::min(row, size_t(63));
+
+	size_t ix = (brick / (nBricksY * nBricksZ)) * 8 + row / 8;
+	size_t iy = ((brick / nBricksZ) % nBricksY) * 8 + row % 8;
+	size_t iz0 = (brick % nBricksZ) * 8;
+	size_t iz1 = std::min(grid->getNz(), iz0 + 8);
+	double w[8], sum = 0;
+	for (size_t iz = iz0; iz < iz1; iz++) {
+		sum += std::max(0.f, grid->get(ix, iy, iz));
+		w[iz - iz0] = sum;
+	}
+	double r = random.rand() * sum;
+	size_t iz = iz0;
+	while ((iz + 1 < iz1) and not (r < w[iz - iz0]))
+		iz++;
+
+	Vector3d pos = grid->positionFromIndex(0) + Vector3d(ix, iy, iz) * grid->getSpacing();
 
 	// draw uniform position within bin
 	double dx = random.rand() - 0.5;
@@ -735,11 +1143,7 @@ SourceDensityGrid1D::SourceDensityGrid1D(ref_ptr<Grid1f> grid) :
 	if (grid->getNz() != 1)
 		throw std::runtime_error("SourceDensityGrid1D: Nz != 1");
 
-	float sum = 0;
-	for (int ix = 0; ix < grid->getNx(); ix++) {
-		sum += grid->get(ix, 0, 0);
-		grid->get(ix, 0, 0) = sum;
-	}
+	sampler.setWeights(grid->getGrid());
 	setDescription();
 }
 
@@ -747,7 +1151,7 @@ void SourceDensityGrid1D::prepareParticle(ParticleState& particle) const {
 	Random &random = Random::instance();
 
 	// draw random bin
-	size_t i = random.randBin(grid->getGrid());
+	size_t i = random.randBin(sampler);
 	Vector3d pos = grid->positionFromIndex(i);
 
 	// draw uniform position within bin
@@ -771,6 +1175,10 @@ void SourceIsotropicEmission::prepareParticle(ParticleState& particle) const {
 	particle.setDirection(random.randVector());
 }
 
+bool SourceIsotropicEmission::isParticleFeature() const {
+	return true;
+}
+
 void SourceIsotropicEmission::setDescription() {
 	description = "SourceIsotropicEmission: Random isotropic direction\n";
 }
@@ -813,10 +1221,8 @@ void SourceDirectedEmission::prepareCandidate(Candidate &candidate) const {
 		- cd * n.x + sd * n.z);
 
 	v = v.getUnitVector();
-	candidate.source.setDirection(v);
-	candidate.created.setDirection(v);
-	candidate.previous.setDirection(v);
 	candidate.current.setDirection(v);
+	setSourceStates(candidate);
 
 	//set the weight of the particle, see eq. 3.1 of PoS(ICRC2019)447
 	double pdfVonMises = kappa / (2. * M_PI * (1. - exp(-2. * kappa))) * exp(-kappa * (1. - v.dot(mu)));
@@ -868,6 +1274,151 @@ void SourceDirectedEmission::setDescription() {
 	description = ss.str();
 }
 
+// ----------------------------------------------------------------------------
+SourceBiasedEmission::SourceBiasedEmission(double isotropicFraction) {
+	setIsotropicFraction(isotropicFraction);
+}
+
+void SourceBiasedEmission::prepareCandidate(Candidate &candidate) const {
+	Random &random = Random::instance();
+	ParticleState &state = candidate.current;
+	if (not hasTarget(state)) {
+		state.setDirection(random.randVector());
+		setSourceStates(candidate);
+		return;
+	}
+
+	Vector3d direction;
+	if (random.rand() < isotropicFraction)
+		direction = random.randVector();
+	else
+		direction = drawTarget(state);
+	state.setDirection(direction);
+	setSourceStates(candidate);
+
+	// ratio of the isotropic density to the density of the mixture
+	double q = getTargetDensity(state, direction);
+	candidate.updateWeight(1. / (isotropicFraction + (1 - isotropicFraction) * 4 * M_PI * q));
+}
+
+void SourceBiasedEmission::setIsotropicFraction(double fraction) {
+	if ((fraction < 0) or (fraction > 1))
+		throw std::runtime_error("SourceBiasedEmission: the isotropic fraction has to be in [0, 1]");
+	isotropicFraction = fraction;
+}
+
+double SourceBiasedEmission::getIsotropicFraction() const {
+	return isotropicFraction;
+}
+
+// ----------------------------------------------------------------------------
+SourceBiasedEmissionCone::SourceBiasedEmissionCone(Vector3d direction, double aperture,
+		double isotropicFraction) : SourceBiasedEmission(isotropicFraction), aperture(aperture) {
+	if (direction.getR() == 0)
+		throw std::runtime_error("SourceBiasedEmissionCone: The direction vector was a null vector.");
+	if ((aperture <= 0) or (aperture > M_PI))
+		throw std::runtime_error("SourceBiasedEmissionCone: the aperture has to be in (0, pi]");
+	this->direction = direction.getUnitVector();
+	oneMinusCos = 2 * pow(sin(aperture / 2), 2);
+	setDescription();
+}
+
+bool SourceBiasedEmissionCone::hasTarget(const ParticleState &state) const {
+	return true;
+}
+
+Vector3d SourceBiasedEmissionCone::drawTarget(const ParticleState &state) const {
+	return coneDirection(direction, oneMinusCos, Random::instance());
+}
+
+double SourceBiasedEmissionCone::getTargetDensity(const ParticleState &state, const Vector3d &v) const {
+	if (not inCone(v, direction, oneMinusCos))
+		return 0;
+	return 1. / (2 * M_PI * oneMinusCos);
+}
+
+void SourceBiasedEmissionCone::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBiasedEmissionCone: emission biased towards ";
+	ss << "direction = " << direction << " with ";
+	ss << "half-opening angle = " << aperture << " rad, ";
+	ss << "isotropic fraction = " << isotropicFraction << "\n";
+	description = ss.str();
+}
+
+// ----------------------------------------------------------------------------
+SourceBiasedEmissionSphere::SourceBiasedEmissionSphere(Vector3d center, double radius,
+		double isotropicFraction) : SourceBiasedEmission(isotropicFraction), center(center), radius(radius) {
+	if (radius <= 0)
+		throw std::runtime_error("SourceBiasedEmissionSphere: the radius has to be positive");
+	setDescription();
+}
+
+double SourceBiasedEmissionSphere::oneMinusCos(const Vector3d &position) const {
+	// 1 - sqrt(1 - x^2) without cancellation for small spheres
+	double x2 = pow(radius / (center - position).getR(), 2);
+	return x2 / (1 + std::sqrt(1 - x2));
+}
+
+bool SourceBiasedEmissionSphere::hasTarget(const ParticleState &state) const {
+	return (center - state.getPosition()).getR() > radius;
+}
+
+Vector3d SourceBiasedEmissionSphere::drawTarget(const ParticleState &state) const {
+	Vector3d axis = (center - state.getPosition()).getUnitVector();
+	return coneDirection(axis, oneMinusCos(state.getPosition()), Random::instance());
+}
+
+double SourceBiasedEmissionSphere::getTargetDensity(const ParticleState &state, const Vector3d &v) const {
+	Vector3d axis = (center - state.getPosition()).getUnitVector();
+	double c = oneMinusCos(state.getPosition());
+	if (not inCone(v, axis, c))
+		return 0;
+	return 1. / (2 * M_PI * c);
+}
+
+void SourceBiasedEmissionSphere::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBiasedEmissionSphere: emission biased towards the sphere at ";
+	ss << center / Mpc << " Mpc with radius " << radius / Mpc << " Mpc, ";
+	ss << "isotropic fraction = " << isotropicFraction << "\n";
+	description = ss.str();
+}
+
+// ----------------------------------------------------------------------------
+SourceBiasedEmissionMap::SourceBiasedEmissionMap(EmissionMap *emissionMap,
+		double isotropicFraction) : SourceBiasedEmission(isotropicFraction) {
+	setEmissionMap(emissionMap);
+	setDescription();
+}
+
+bool SourceBiasedEmissionMap::hasTarget(const ParticleState &state) const {
+	return emissionMap->hasMap(state.getId(), state.getEnergy());
+}
+
+Vector3d SourceBiasedEmissionMap::drawTarget(const ParticleState &state) const {
+	Vector3d v;
+	emissionMap->drawDirection(state, v);
+	return v;
+}
+
+double SourceBiasedEmissionMap::getTargetDensity(const ParticleState &state, const Vector3d &v) const {
+	return emissionMap->getDensity(state.getId(), state.getEnergy(), v);
+}
+
+void SourceBiasedEmissionMap::setEmissionMap(EmissionMap *emissionMap) {
+	if (not emissionMap)
+		throw std::runtime_error("SourceBiasedEmissionMap: no emission map");
+	this->emissionMap = emissionMap;
+}
+
+void SourceBiasedEmissionMap::setDescription() {
+	std::stringstream ss;
+	ss << "SourceBiasedEmissionMap: emission biased by an emission map, ";
+	ss << "isotropic fraction = " << isotropicFraction << "\n";
+	description = ss.str();
+}
+
 // ----------------------------------------------------------------------------
 SourceLambertDistributionOnSphere::SourceLambertDistributionOnSphere(const Vector3d &center, double radius, bool inward) :
 		center(center), radius(radius) {
@@ -901,6 +1452,10 @@ void SourceDirection::prepareParticle(ParticleState& particle) const {
 	particle.setDirection(direction);
 }
 
+bool SourceDirection::isParticleFeature() const {
+	return true;
+}
+
 void SourceDirection::setDescription() {
 	std::stringstream ss;
 	ss <<  "SourceDirection: Emission direction = " << direction << "\n";
@@ -914,7 +1469,7 @@ SourceEmissionMap::SourceEmissionMap(EmissionMap *emissionMap) : emissionMap(emi
 
 void SourceEmissionMap::prepareCandidate(Candidate &candidate) const {
 	if (emissionMap) {
-		bool accept = emissionMap->checkDirection(candidate.source);
+		bool accept = emissionMap->checkDirection(candidate.current);
 		candidate.setActive(accept);
 	}
 }
@@ -1019,7 +1574,7 @@ SourceRedshift1D::SourceRedshift1D() {
 }
 
 void SourceRedshift1D::prepareCandidate(Candidate& candidate) const {
-	double d = candidate.source.getPosition().getR();
+	double d = candidate.current.getPosition().getR();
 	double z = comovingDistance2Redshift(d);
 	candidate.setRedshift(z);
 }
@@ -1090,11 +1645,8 @@ void SourceGenericComposition::add(int id, double weight) {
 
 	nuclei.push_back(n);
 
-	// update composition cdf
-	if (cdf.size() == 0)
-		cdf.push_back(weight * n.cdf.back());
-	else
-		cdf.push_back(cdf.back() + weight * n.cdf.back());
+	// update composition weights
+	sampler.add(weight * n.cdf.back());
 }
 
 void SourceGenericComposition::add(int A, int Z, double a) {
@@ -1109,7 +1661,7 @@ void SourceGenericComposition::prepareParticle(ParticleState& particle) const {
 
 
 	// draw random particle type
-	size_t iN = random.randBin(cdf);
+	size_t iN = random.randBin(sampler);
 	const Nucleus &n = nuclei.at(iN);
 	particle.setId(n.id);
 
@@ -0,0 +1,98 @@
+#include "crpropa/TableRegistry.h"
+
+#include <map>
+
+#include <sys/stat.h>
+
+namespace crpropa {
+
+namespace {
+
+struct TableKey {
+	std::string type;
+	std::string filename;
+
+	bool operator<(const TableKey &other) const {
+		if (type != other.type)
+			return type < other.type;
+		return filename < other.filename;
+	}
+};
+
+struct TableEntry {
+	uint64_t fileSize;
+	int64_t fileTime;
+	ref_ptr<const Referenced> table;
+};
+
+typedef std::map<TableKey, TableEntry> TableMap;
+
+TableMap &tables() {
+	static TableMap instance;
+	return instance;
+}
+
+void pruneTables() {
+	TableMap &t = tables();
+	for (TableMap::iterator i = t.begin(); i != t.end();) {
+		if (i->second.table->getReferenceCount() == 1)
+			t.erase(i++);
+		else
+			++i;
+	}
+}
+
+} // namespace
+
+std::recursive_mutex &TableRegistry::mutex() {
+	static std::recursive_mutex instance;
+	return instance;
+}
+
+bool TableRegistry::stamp(const std::string &filename, uint64_t &fileSize, int64_t &fileTime) {
+	struct stat s;
+	if (stat(filename.c_str(), &s) != 0)
+		return false;
+	fileSize = s.st_size;
+	fileTime = s.st_mtime;
+	return true;
+}
+
+ref_ptr<const Referenced> TableRegistry::find(const std::string &type, const std::string &filename,
+		uint64_t fileSize, int64_t fileTime) {
+	TableKey key = {type, filename};
+	TableMap::iterator i = tables().find(key);
+	if (i == tables().end())
+		return NULL;
+	if (i->second.fileSize != fileSize or i->second.fileTime != fileTime) {
+		// the file changed, modules keep the previous table
+		tables().erase(i);
+		return NULL;
+	}
+	return i->second.table;
+}
+
+void TableRegistry::insert(const std::string &type, const std::string &filename,
+		uint64_t fileSize, int64_t fileTime, const Referenced *table) {
+	pruneTables();
+	TableKey key = {type, filename};
+	TableEntry entry = {fileSize, fileTime, table};
+	tables()[key] = entry;
+}
+
+void TableRegistry::prune() {
+	std::lock_guard<std::recursive_mutex> guard(mutex());
+	pruneTables();
+}
+
+void TableRegistry::clear() {
+	std::lock_guard<std::recursive_mutex> guard(mutex());
+	tables().clear();
+}
+
+size_t TableRegistry::size() {
+	std::lock_guard<std::recursive_mutex> guard(mutex());
+	return tables().size();
+}
+
+} // namespace crpropa
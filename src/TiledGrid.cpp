@@ -0,0 +1,381 @@
+#include "crpropa/TiledGrid.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define CRPROPA_HAVE_PREAD
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// header of the files of dumpTiledGrid, the tiles start at the next page boundary
+const char tiledGridMagic[8] = {'C', 'R', 'P', 'T', 'I', 'L', 'E', '1'};
+const size_t tiledGridHeaderSize = 4096;
+
+struct TiledGridHeader {
+	char magic[8];
+	uint32_t headerSize;
+	uint32_t tileSize;
+	uint64_t N[3];
+	double origin[3];
+	double spacing[3];
+	uint32_t reflective;
+	uint32_t reserved;
+};
+
+} // namespace
+
+void dumpTiledGrid(ref_ptr<Grid3f> grid, std::string filename, size_t tileSize) {
+	if ((tileSize == 0) or (tileSize & (tileSize - 1)))
+		throw std::runtime_error("dumpTiledGrid: the tile size has to be a power of two");
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout)
+		throw std::runtime_error("dumpTiledGrid: could not open " + filename);
+
+	size_t Nx = grid->getNx(), Ny = grid->getNy(), Nz = grid->getNz();
+	Vector3d origin = grid->getOrigin(), spacing = grid->getSpacing();
+	TiledGridHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, tiledGridMagic, sizeof(tiledGridMagic));
+	header.headerSize = tiledGridHeaderSize;
+	header.tileSize = tileSize;
+	header.N[0] = Nx;
+	header.N[1] = Ny;
+	header.N[2] = Nz;
+	header.origin[0] = origin.x;
+	header.origin[1] = origin.y;
+	header.origin[2] = origin.z;
+	header.spacing[0] = spacing.x;
+	header.spacing[1] = spacing.y;
+	header.spacing[2] = spacing.z;
+	header.reflective = grid->isReflective();
+	std::vector<char> buffer(tiledGridHeaderSize, 0);
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	fout.write(buffer.data(), buffer.size());
+
+	// tiles in row-major order, padded with zeros at the upper edges
+	std::vector<Vector3f> tile(tileSize * tileSize * tileSize);
+	for (size_t x0 = 0; x0 < Nx; x0 += tileSize)
+		for (size_t y0 = 0; y0 < Ny; y0 += tileSize)
+			for (size_t z0 = 0; z0 < Nz; z0 += tileSize) {
+				std::fill(tile.begin(), tile.end(), Vector3f(0.f));
+				for (size_t ix = x0; ix < std::min(x0 + tileSize, Nx); ix++)
+					for (size_t iy = y0; iy < std::min(y0 + tileSize, Ny); iy++)
+						for (size_t iz = z0; iz < std::min(z0 + tileSize, Nz); iz++)
+							tile[((ix - x0) * tileSize + iy - y0) * tileSize + iz - z0] = grid->get(ix, iy, iz);
+				fout.write((const char*) tile.data(), tile.size() * sizeof(Vector3f));
+			}
+	if (!fout)
+		throw std::runtime_error("dumpTiledGrid: could not write " + filename);
+}
+
+/** Access to the values of a grid that keeps the last used tile */
+class TiledGrid3f::Cursor {
+	const TiledGrid3f &grid;
+	size_t current;
+	ref_ptr<Tile> tile;
+public:
+	Cursor(const TiledGrid3f &grid) : grid(grid), current(-1) {
+	}
+
+	const Vector3f &get(size_t ix, size_t iy, size_t iz) {
+		size_t s = grid.tileShift, m = grid.tileSize - 1;
+		size_t t = ((ix >> s) * grid.nTilesY + (iy >> s)) * grid.nTilesZ + (iz >> s);
+		if (t != current) {
+			tile = grid.getTile(t);
+			current = t;
+		}
+		return tile->values[((((ix & m) << s) + (iy & m)) << s) + (iz & m)];
+	}
+};
+
+TiledGrid3f::TiledGrid3f(const std::string &filename, size_t cacheBytes) :
+		filename(filename), fd(-1), ipolType(TRILINEAR), loads(0) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin)
+		throw std::runtime_error("TiledGrid3f: " + filename + " not found");
+	TiledGridHeader header;
+	fin.read((char*) &header, sizeof(header));
+	if (!fin or (std::memcmp(header.magic, tiledGridMagic, sizeof(tiledGridMagic)) != 0))
+		throw std::runtime_error("TiledGrid3f: " + filename + " is not a grid file of dumpTiledGrid");
+	if ((header.headerSize != tiledGridHeaderSize) or (header.tileSize == 0)
+			or (header.tileSize & (header.tileSize - 1)))
+		throw std::runtime_error("TiledGrid3f: unsupported header in " + filename);
+
+	Nx = header.N[0];
+	Ny = header.N[1];
+	Nz = header.N[2];
+	tileSize = header.tileSize;
+	tileShift = 0;
+	while ((size_t(1) << tileShift) < tileSize)
+		tileShift++;
+	nTilesX = (Nx + tileSize - 1) / tileSize;
+	nTilesY = (Ny + tileSize - 1) / tileSize;
+	nTilesZ = (Nz + tileSize - 1) / tileSize;
+	origin = Vector3d(header.origin[0], header.origin[1], header.origin[2]);
+	spacing = Vector3d(header.spacing[0], header.spacing[1], header.spacing[2]);
+	gridOrigin = origin + spacing / 2;
+	reflective = header.reflective;
+	setCacheSize(cacheBytes);
+
+#ifdef CRPROPA_HAVE_PREAD
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("TiledGrid3f: could not open " + filename);
+#endif
+}
+
+TiledGrid3f::~TiledGrid3f() {
+#ifdef CRPROPA_HAVE_PREAD
+	if (fd >= 0)
+		close(fd);
+#endif
+}
+
+ref_ptr<TiledGrid3f::Tile> TiledGrid3f::loadTile(size_t t) const {
+	ref_ptr<Tile> tile = new Tile;
+	tile->values.resize(tileSize * tileSize * tileSize);
+	size_t bytes = tile->values.size() * sizeof(Vector3f);
+	size_t offset = tiledGridHeaderSize + t * bytes;
+#ifdef CRPROPA_HAVE_PREAD
+	char *data = (char*) tile->values.data();
+	size_t done = 0;
+	while (done < bytes) {
+		ssize_t n = pread(fd, data + done, bytes - done, offset + done);
+		if (n <= 0)
+			throw std::runtime_error("TiledGrid3f: could not read a tile of " + filename);
+		done += n;
+	}
+#else
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	fin.seekg(offset);
+	fin.read((char*) tile->values.data(), bytes);
+	if (!fin)
+		throw std::runtime_error("TiledGrid3f: could not read a tile of " + filename);
+#endif
+	return tile;
+}
+
+ref_ptr<TiledGrid3f::Tile> TiledGrid3f::getTile(size_t t) const {
+	if (t >= nTilesX * nTilesY * nTilesZ)
+		throw std::runtime_error("TiledGrid3f: tile index out of range");
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto i = cache.find(t);
+		if (i != cache.end()) {
+			recentTiles.splice(recentTiles.begin(), recentTiles, i->second.second);
+			return i->second.first;
+		}
+	}
+
+	// read without the lock, so that other threads continue with cached tiles
+	ref_ptr<Tile> tile = loadTile(t);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	loads++;
+	auto i = cache.find(t);
+	if (i != cache.end()) // loaded by another thread meanwhile
+		return i->second.first;
+	recentTiles.push_front(t);
+	cache[t] = std::make_pair(tile, recentTiles.begin());
+	while (cache.size() > cacheSize) {
+		cache.erase(recentTiles.back());
+		recentTiles.pop_back();
+	}
+	return tile;
+}
+
+Vector3f TiledGrid3f::get(size_t ix, size_t iy, size_t iz) const {
+	Cursor cursor(*this);
+	return cursor.get(ix, iy, iz);
+}
+
+Vector3f TiledGrid3f::interpolate(const Vector3d &position) const {
+	if (ipolType == TRICUBIC)
+		return tricubicInterpolate(position);
+	else if (ipolType == NEAREST_NEIGHBOUR)
+		return closestValue(position);
+	else
+		return trilinearInterpolate(position);
+}
+
+void TiledGrid3f::prefetch(const Vector3d &position, const Vector3d &direction, double distance) const {
+#if defined(CRPROPA_HAVE_PREAD) && defined(POSIX_FADV_WILLNEED)
+	// tiles along the line, in steps of half a tile
+	double step = std::min(spacing.x, std::min(spacing.y, spacing.z)) * tileSize / 2;
+	Vector3d d = direction.getUnitVector();
+	std::set<size_t> tiles;
+	for (double s = 0; s <= distance; s += step) {
+		Vector3d r = (position + d * s - origin) / spacing;
+		int ix = floor(r.x), iy = floor(r.y), iz = floor(r.z);
+		if (reflective) {
+			ix = reflectiveBoundary(ix, Nx);
+			iy = reflectiveBoundary(iy, Ny);
+			iz = reflectiveBoundary(iz, Nz);
+		} else {
+			ix = periodicBoundary(ix, Nx);
+			iy = periodicBoundary(iy, Ny);
+			iz = periodicBoundary(iz, Nz);
+		}
+		tiles.insert(((ix >> tileShift) * nTilesY + (iy >> tileShift)) * nTilesZ + (iz >> tileShift));
+	}
+
+	size_t bytes = tileSize * tileSize * tileSize * sizeof(Vector3f);
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::set<size_t>::const_iterator t = tiles.begin(); t != tiles.end(); ++t)
+		if (cache.find(*t) == cache.end())
+			posix_fadvise(fd, tiledGridHeaderSize + *t * bytes, bytes, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void TiledGrid3f::setCacheSize(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	cacheSize = std::max(size_t(1), bytes / (tileSize * tileSize * tileSize * sizeof(Vector3f)));
+	while (cache.size() > cacheSize) {
+		cache.erase(recentTiles.back());
+		recentTiles.pop_back();
+	}
+}
+
+size_t TiledGrid3f::getCacheSize() const {
+	return cacheSize * tileSize * tileSize * tileSize * sizeof(Vector3f);
+}
+
+size_t TiledGrid3f::getNumberOfCachedTiles() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return cache.size();
+}
+
+uint64_t TiledGrid3f::getNumberOfLoads() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return loads;
+}
+
+size_t TiledGrid3f::getSizeOf() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sizeof(*this) + cache.size() * tileSize * tileSize * tileSize * sizeof(Vector3f);
+}
+
+void TiledGrid3f::setReflective(bool b) {
+	reflective = b;
+}
+
+void TiledGrid3f::setInterpolationType(interpolationType i) {
+	if ((i != TRILINEAR) and (i != TRICUBIC) and (i != NEAREST_NEIGHBOUR))
+		throw std::runtime_error("InterpolationType: unknown interpolation type");
+	ipolType = i;
+}
+
+Vector3d TiledGrid3f::getOrigin() const {
+	return origin;
+}
+
+Vector3d TiledGrid3f::getSpacing() const {
+	return spacing;
+}
+
+size_t TiledGrid3f::getNx() const {
+	return Nx;
+}
+
+size_t TiledGrid3f::getNy() const {
+	return Ny;
+}
+
+size_t TiledGrid3f::getNz() const {
+	return Nz;
+}
+
+size_t TiledGrid3f::getTileSize() const {
+	return tileSize;
+}
+
+bool TiledGrid3f::isReflective() const {
+	return reflective;
+}
+
+Vector3f TiledGrid3f::closestValue(const Vector3d &position) const {
+	// as Grid::closestValue
+	Vector3d r = (position - gridOrigin) / spacing;
+	int ix, iy, iz;
+	if (reflective) {
+		ix = reflectiveBoundary(round(r.x), Nx);
+		iy = reflectiveBoundary(round(r.y), Ny);
+		iz = reflectiveBoundary(round(r.z), Nz);
+	} else {
+		ix = round(fmod(r.x, Nx));
+		iy = round(fmod(r.y, Ny));
+		iz = round(fmod(r.z, Nz));
+		ix = (ix + Nx * (ix < 0)) % Nx;
+		iy = (iy + Ny * (iy < 0)) % Ny;
+		iz = (iz + Nz * (iz < 0)) % Nz;
+	}
+	return get(ix, iy, iz);
+}
+
+Vector3f TiledGrid3f::trilinearInterpolate(const Vector3d &position) const {
+	// as Grid::trilinearInterpolate
+	Vector3d r = (position - gridOrigin) / spacing;
+	int iX0, iX1, iY0, iY1, iZ0, iZ1;
+	double resX, resY, resZ, fX0, fY0, fZ0;
+	if (reflective) {
+		reflectiveClamp(r.x, Nx, iX0, iX1, resX);
+		reflectiveClamp(r.y, Ny, iY0, iY1, resY);
+		reflectiveClamp(r.z, Nz, iZ0, iZ1, resZ);
+		fX0 = resX - floor(resX);
+		fY0 = resY - floor(resY);
+		fZ0 = resZ - floor(resZ);
+	} else {
+		periodicClamp(r.x, Nx, iX0, iX1);
+		periodicClamp(r.y, Ny, iY0, iY1);
+		periodicClamp(r.z, Nz, iZ0, iZ1);
+		fX0 = r.x - floor(r.x);
+		fY0 = r.y - floor(r.y);
+		fZ0 = r.z - floor(r.z);
+	}
+	double fX1 = 1 - fX0;
+	double fY1 = 1 - fY0;
+	double fZ1 = 1 - fZ0;
+
+	Cursor c(*this);
+	Vector3f b(0.);
+	b += c.get(iX0, iY0, iZ0) * fX1 * fY1 * fZ1;
+	b += c.get(iX1, iY0, iZ0) * fX0 * fY1 * fZ1;
+	b += c.get(iX0, iY1, iZ0) * fX1 * fY0 * fZ1;
+	b += c.get(iX0, iY0, iZ1) * fX1 * fY1 * fZ0;
+	b += c.get(iX1, iY0, iZ1) * fX0 * fY1 * fZ0;
+	b += c.get(iX0, iY1, iZ1) * fX1 * fY0 * fZ0;
+	b += c.get(iX1, iY1, iZ0) * fX0 * fY0 * fZ1;
+	b += c.get(iX1, iY1, iZ1) * fX0 * fY0 * fZ0;
+	return b;
+}
+
+Vector3f TiledGrid3f::tricubicInterpolate(const Vector3d &position) const {
+	// Catmull-Rom weights as Grid::tricubicInterpolate
+	Vector3d r = (position - gridOrigin) / spacing;
+	size_t iX[4], iY[4], iZ[4];
+	double wX[4], wY[4], wZ[4];
+	cubicStencil(r.x, Nx, reflective, iX, wX);
+	cubicStencil(r.y, Ny, reflective, iY, wY);
+	cubicStencil(r.z, Nz, reflective, iZ, wZ);
+
+	Cursor c(*this);
+	Vector3f result(0.);
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			float wXY = wX[i] * wY[j];
+			for (int k = 0; k < 4; k++)
+				result += c.get(iX[i], iY[j], iZ[k]) * (wXY * float(wZ[k]));
+		}
+	return result;
+}
+
+} // namespace crpropa
@@ -0,0 +1,259 @@
+#include "crpropa/TransferMatrix.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+
+// candidates run at once by TransferMatrix::build
+const size_t BUILD_BLOCK = 100000;
+
+// detects the candidates of TransferMatrix::build at the origin and adds
+// the arriving nuclei to the matrix, in the cell of their source state
+class TransferArrival: public Module {
+	const std::vector<int> &species;
+	int nE, nD, nA;
+	double logEmin, dlogE, dD, Emin, scale;
+	std::vector<double> &matrix;
+public:
+	TransferArrival(const std::vector<int> &species, int nE, int nD, int nA,
+			double logEmin, double dlogE, double dD, double scale,
+			std::vector<double> &matrix) : species(species), nE(nE), nD(nD),
+			nA(nA), logEmin(logEmin), dlogE(dlogE), dD(dD), scale(scale),
+			matrix(matrix) {
+		Emin = std::pow(10, logEmin) * eV;
+		setDescription("TransferMatrix detection at the origin");
+	}
+
+	int energyBin(double E) const {
+		return std::floor((std::log10(E / eV) - logEmin) / dlogE);
+	}
+
+	void process(Candidate *candidate) const {
+		if (candidate->current.getEnergy() < Emin) {
+			candidate->setActive(false);
+			return;
+		}
+		double x = candidate->current.getPosition().x;
+		if (x > 0) {
+			candidate->limitNextStep(x);
+			return;
+		}
+		candidate->setActive(false);
+
+		int id = candidate->current.getId();
+		if (not isNucleus(id))
+			return;
+		int A = massNumber(id);
+		int jE = energyBin(candidate->current.getEnergy());
+		if ((A < 1) or (A > nA) or (jE < 0) or (jE >= nE))
+			return;
+
+		const ParticleState &source = candidate->source;
+		size_t s = std::find(species.begin(), species.end(), source.getId()) - species.begin();
+		int iE = energyBin(source.getEnergy());
+		int iD = source.getPosition().x / dD;
+		if ((s == species.size()) or (iE < 0) or (iE >= nE) or (iD < 0) or (iD >= nD))
+			return;
+		size_t k = (((s * nE + iE) * nD + iD) * nA + (A - 1)) * nE + jE;
+		double w = candidate->getWeight() * scale;
+#pragma omp atomic
+		matrix[k] += w;
+	}
+};
+
+} // namespace
+
+TransferMatrix::TransferMatrix(const std::vector<int> &species, double Dmax,
+		int nD, double logEmin, double logEmax, double dlogE) : species(species),
+		nD(nD), nA(0), logEmin(logEmin), logEmax(logEmax), dlogE(dlogE), Dmax(Dmax) {
+	if (species.empty())
+		throw std::runtime_error("TransferMatrix: no species");
+	if ((nD <= 0) or (Dmax <= 0) or (dlogE <= 0) or (logEmax <= logEmin))
+		throw std::runtime_error("TransferMatrix: invalid binning");
+	for (size_t i = 0; i < species.size(); i++) {
+		if (not isNucleus(species[i]))
+			throw std::runtime_error("TransferMatrix: species must be nuclei");
+		nA = std::max(nA, massNumber(species[i]));
+	}
+	nE = std::floor((logEmax - logEmin) / dlogE + 0.5);
+	dD = Dmax / nD;
+	matrix.assign(getNumberOfCells() * nA * nE, 0);
+}
+
+size_t TransferMatrix::cellIndex(size_t s, int iE, int iD) const {
+	return cell(s, iE, iD) * nA * nE;
+}
+
+void TransferMatrix::build(ref_ptr<ModuleList> simulation, size_t samples) {
+	if (samples == 0)
+		throw std::runtime_error("TransferMatrix: samples must be > 0");
+	if (not (Candidate::getStateRetention() & Candidate::RetainSource))
+		throw std::runtime_error("TransferMatrix: the source states have to be retained");
+
+	std::vector<double> table(matrix.size(), 0);
+	ref_ptr<TransferArrival> arrival = new TransferArrival(species, nE, nD, nA,
+			logEmin, dlogE, dD, 1. / samples, table);
+	simulation->add(arrival);
+
+	Random &random = Random::instance();
+	ModuleList::candidate_vector_t candidates;
+	try {
+		size_t cells = getNumberOfCells();
+		for (size_t c = 0; c < cells; c++) {
+			size_t s = c / (nE * nD);
+			int iE = (c / nD) % nE;
+			int iD = c % nD;
+			for (size_t i = 0; i < samples; i++) {
+				double E = std::pow(10, logEmin + (iE + random.rand()) * dlogE) * eV;
+				double D = (iD + random.rand()) * dD;
+				candidates.push_back(new Candidate(species[s], E, Vector3d(D, 0, 0),
+						Vector3d(-1, 0, 0), comovingDistance2Redshift(D)));
+			}
+			if ((candidates.size() >= BUILD_BLOCK) or (c + 1 == cells)) {
+				simulation->run(&candidates, true);
+				candidates.clear();
+			}
+		}
+	} catch (...) {
+		simulation->remove(simulation->size() - 1);
+		throw;
+	}
+	simulation->remove(simulation->size() - 1);
+	matrix.swap(table);
+}
+
+void TransferMatrix::save(const std::string &filename) const {
+	std::ofstream outfile(filename.c_str());
+	if (!outfile)
+		throw std::runtime_error("TransferMatrix: could not open " + filename);
+	outfile << "# TransferMatrix " << nD << " " << Dmax / Mpc << " " << nE << " "
+			<< logEmin << " " << dlogE << " " << species.size();
+	for (size_t s = 0; s < species.size(); s++)
+		outfile << " " << species[s];
+	outfile << "\n# species iE iD A jE value\n";
+	outfile.precision(12);
+	for (size_t s = 0; s < species.size(); s++)
+		for (int iE = 0; iE < nE; iE++)
+			for (int iD = 0; iD < nD; iD++)
+				for (int A = 1; A <= nA; A++)
+					for (int jE = 0; jE < nE; jE++) {
+						double v = get(s, iE, iD, A, jE);
+						if (v != 0)
+							outfile << s << "\t" << iE << "\t" << iD << "\t" << A
+									<< "\t" << jE << "\t" << v << "\n";
+					}
+}
+
+void TransferMatrix::load(const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile)
+		throw std::runtime_error("TransferMatrix: could not open " + filename);
+	std::string hash, name;
+	int n1, n2;
+	size_t ns;
+	double d, l, w;
+	infile >> hash >> name >> n1 >> d >> n2 >> l >> w >> ns;
+	if (!infile or (name != "TransferMatrix"))
+		throw std::runtime_error("TransferMatrix: not a transfer matrix " + filename);
+	bool same = (n1 == nD) and (n2 == nE) and (ns == species.size())
+			and (std::fabs(d * Mpc - Dmax) <= 1e-9 * Dmax)
+			and (std::fabs(l - logEmin) <= 1e-9) and (std::fabs(w - dlogE) <= 1e-9);
+	for (size_t s = 0; same and (s < ns); s++) {
+		int id;
+		infile >> id;
+		same = (id == species[s]);
+	}
+	if (not same)
+		throw std::runtime_error("TransferMatrix: other species or binning in " + filename);
+	infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+	std::vector<double> table(matrix.size(), 0);
+	size_t s;
+	int iE, iD, A, jE;
+	double v;
+	while (infile >> s >> iE >> iD >> A >> jE >> v) {
+		if ((s >= species.size()) or (iE < 0) or (iE >= nE) or (iD < 0) or (iD >= nD)
+				or (A < 1) or (A > nA) or (jE < 0) or (jE >= nE))
+			throw std::runtime_error("TransferMatrix: invalid element in " + filename);
+		table[cellIndex(s, iE, iD) + arrival(A, jE)] = v;
+	}
+	if (not infile.eof())
+		throw std::runtime_error("TransferMatrix: error reading " + filename);
+	matrix.swap(table);
+}
+
+std::vector<double> TransferMatrix::apply(const std::vector<double> &injection) const {
+	size_t cells = getNumberOfCells();
+	if (injection.size() != cells)
+		throw std::runtime_error("TransferMatrix: injection of another size");
+	size_t n = size_t(nA) * nE;
+	std::vector<double> result(n, 0);
+	for (size_t c = 0; c < cells; c++) {
+		double q = injection[c];
+		if (q == 0)
+			continue;
+		const double *row = &matrix[c * n];
+		for (size_t k = 0; k < n; k++)
+			result[k] += q * row[k];
+	}
+	return result;
+}
+
+double TransferMatrix::get(size_t s, int iE, int iD, int A, int jE) const {
+	if ((A < 1) or (A > nA))
+		return 0;
+	return matrix[cellIndex(s, iE, iD) + arrival(A, jE)];
+}
+
+size_t TransferMatrix::cell(size_t s, int iE, int iD) const {
+	return (s * nE + iE) * nD + iD;
+}
+
+size_t TransferMatrix::arrival(int A, int iE) const {
+	return size_t(A - 1) * nE + iE;
+}
+
+size_t TransferMatrix::getNumberOfCells() const {
+	return species.size() * nE * nD;
+}
+
+int TransferMatrix::getNumberOfEnergyBins() const {
+	return nE;
+}
+
+int TransferMatrix::getNumberOfDistanceBins() const {
+	return nD;
+}
+
+int TransferMatrix::getMaximumMassNumber() const {
+	return nA;
+}
+
+double TransferMatrix::getEnergy(int iE) const {
+	return std::pow(10, logEmin + (iE + 0.5) * dlogE) * eV;
+}
+
+double TransferMatrix::getDistance(int iD) const {
+	return (iD + 0.5) * dD;
+}
+
+std::string TransferMatrix::getDescription() const {
+	std::stringstream ss;
+	ss << "TransferMatrix: " << species.size() << " species, " << nE
+			<< " energy bins from 10^" << logEmin << " eV, " << nD
+			<< " distance bins up to " << Dmax / Mpc << " Mpc\n";
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -282,4 +282,78 @@ std::string SphericalAdvectionShock::getDescription() const {
 	return s.str();
 }
 
+//----------------------------------------------------------------
+AdvectionFieldGrid::AdvectionFieldGrid(ref_ptr<Grid3f> grid, double scale) :
+		grid(grid), divergence(computeDivergence(grid)), scale(scale) {
+}
+
+AdvectionFieldGrid::AdvectionFieldGrid(ref_ptr<Grid3f> grid,
+		ref_ptr<Grid1f> divergence, double scale) :
+		grid(grid), divergence(divergence), scale(scale) {
+}
+
+Vector3d AdvectionFieldGrid::getField(const Vector3d &position) const {
+	return grid->interpolate(position) * scale;
+}
+
+double AdvectionFieldGrid::getDivergence(const Vector3d &position) const {
+	return divergence->interpolate(position) * scale;
+}
+
+ref_ptr<Grid3f> AdvectionFieldGrid::getGrid() const {
+	return grid;
+}
+
+ref_ptr<Grid1f> AdvectionFieldGrid::getDivergenceGrid() const {
+	return divergence;
+}
+
+double AdvectionFieldGrid::getScale() const {
+	return scale;
+}
+
+ref_ptr<Grid1f> AdvectionFieldGrid::computeDivergence(ref_ptr<Grid3f> grid) {
+	GridProperties p(grid->getOrigin(), grid->getNx(), grid->getNy(),
+			grid->getNz(), grid->getSpacing());
+	p.setReflective(grid->isReflective());
+	p.setInterpolationType(grid->getInterpolationType());
+	ref_ptr<Grid1f> div = new Grid1f(p);
+
+	int Nx = grid->getNx(), Ny = grid->getNy(), Nz = grid->getNz();
+	Vector3d h = grid->getSpacing() * 2;
+	bool reflective = grid->isReflective();
+	#pragma omp parallel for
+	for (int ix = 0; ix < Nx; ix++)
+		for (int iy = 0; iy < Ny; iy++)
+			for (int iz = 0; iz < Nz; iz++) {
+				Vector3f xp, xm, yp, ym, zp, zm;
+				if (reflective) {
+					xp = grid->reflectiveGet(ix + 1, iy, iz);
+					xm = grid->reflectiveGet(ix - 1, iy, iz);
+					yp = grid->reflectiveGet(ix, iy + 1, iz);
+					ym = grid->reflectiveGet(ix, iy - 1, iz);
+					zp = grid->reflectiveGet(ix, iy, iz + 1);
+					zm = grid->reflectiveGet(ix, iy, iz - 1);
+				} else {
+					xp = grid->periodicGet(ix + 1, iy, iz);
+					xm = grid->periodicGet(ix - 1, iy, iz);
+					yp = grid->periodicGet(ix, iy + 1, iz);
+					ym = grid->periodicGet(ix, iy - 1, iz);
+					zp = grid->periodicGet(ix, iy, iz + 1);
+					zm = grid->periodicGet(ix, iy, iz - 1);
+				}
+				div->get(ix, iy, iz) = (xp.x - xm.x) / h.x + (yp.y - ym.y) / h.y
+						+ (zp.z - zm.z) / h.z;
+			}
+	return div;
+}
+
+std::string AdvectionFieldGrid::getDescription() const {
+	std::stringstream s;
+	s << "Grid of " << grid->getNx() << " x " << grid->getNy() << " x "
+			<< grid->getNz() << " points, spacing: " << grid->getSpacing() / kpc
+			<< " kpc, scale: " << scale / km * sec << " km/s";
+	return s.str();
+}
+
 } // namespace crpropa
@@ -0,0 +1,71 @@
+// crpropa-run: runs the simulation of a JSON configuration file without Python
+//
+// usage: crpropa-run [--check] [--types] config.json
+//   --check	build the simulation and show its modules without running it
+//   --types	list the types that can be used in the configuration files
+//
+// See crpropa::SimulationConfig for the format of the configuration file.
+
+#include "crpropa/Configuration.h"
+#include "crpropa/DistributedModuleList.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace crpropa;
+
+static void usage() {
+	std::cerr << "usage: crpropa-run [--check] [--types] config.json" << std::endl;
+}
+
+static void showTypes() {
+	const char *kinds[] = {"modules", "fields", "source", "observer", "photonFields"};
+	for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		std::cout << kinds[i] << ":";
+		std::vector<std::string> types = SimulationConfig::getTypes(kinds[i]);
+		for (size_t j = 0; j < types.size(); j++)
+			std::cout << " " << types[j];
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char **argv) {
+	bool check = false;
+	std::string filename;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--check") == 0) {
+			check = true;
+		} else if (std::strcmp(argv[i], "--types") == 0) {
+			showTypes();
+			return 0;
+		} else if (argv[i][0] == '-' or not filename.empty()) {
+			usage();
+			return 2;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (filename.empty()) {
+		usage();
+		return 2;
+	}
+
+	try {
+		ref_ptr<SimulationConfig> simulation = new SimulationConfig(filename);
+		bool root = not simulation->isDistributed() or DistributedModuleList::getRank() == 0;
+		if (check) {
+			if (root) {
+				simulation->getModuleList()->showModules();
+				std::cout << simulation->getSource()->getDescription();
+				std::cout << "Primaries: " << simulation->getCount() << std::endl;
+			}
+			return 0;
+		}
+		simulation->run();
+	} catch (std::exception &e) {
+		std::cerr << "crpropa-run: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
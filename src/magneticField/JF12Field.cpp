@@ -3,6 +3,8 @@
 #include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
 #include "crpropa/Random.h"
 
+#include <algorithm>
+
 namespace crpropa {
 
 JF12Field::JF12Field() {
@@ -134,6 +136,37 @@ ref_ptr<Grid3f> JF12Field::getTurbulentGrid() {
 	return turbulentGrid;
 }
 
+size_t JF12Field::getSizeOf() const {
+	size_t size = 0;
+	if (striatedGrid.valid())
+		size += striatedGrid->getSizeOf();
+	if (turbulentGrid.valid())
+		size += turbulentGrid->getSizeOf();
+	return size;
+}
+
+static double minSpacing(const Vector3d &spacing) {
+	return std::min(spacing.x, std::min(spacing.y, spacing.z));
+}
+
+MagneticFieldStepHint JF12Field::getStepHint(const Vector3d &pos, double z) const {
+	double d = pos.getR();
+	if (d >= 20 * kpc)
+		return MagneticFieldStepHint(std::numeric_limits<double>::infinity(), d - 20 * kpc, 0);
+
+	double r = sqrt(pos.x * pos.x + pos.y * pos.y);
+	double length = 1 * kpc;
+	if (fabs(pos.z) < hDisk + 3 * wDisk)
+		length = wDisk;
+	else if ((fabs(r - rNorth) < 3 * wHalo) or (fabs(r - rSouth) < 3 * wHalo))
+		length = wHalo;
+	if (useStriatedField and striatedGrid.valid())
+		length = std::min(length, minSpacing(striatedGrid->getSpacing()));
+	if (useTurbulentField and turbulentGrid.valid())
+		length = std::min(length, minSpacing(turbulentGrid->getSpacing()));
+	return MagneticFieldStepHint(length);
+}
+
 void JF12Field::setUseRegularField(bool use) {
 	useRegularField = use;
 }
@@ -195,13 +228,20 @@ double JF12Field::logisticFunction(const double& x, const double& x0, const doub
 }
 
 Vector3d JF12Field::getRegularField(const Vector3d& pos) const {
+	if (pos.getR() >= 20 * kpc)
+		return Vector3d(0.);
+
+	double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
+	double phi = pos.getPhi(); // azimuth
+	return getRegularField(pos, r, phi);
+}
+
+Vector3d JF12Field::getRegularField(const Vector3d& pos, const double& r, const double& phi) const {
 	Vector3d b(0.);
 
 	double d = pos.getR(); // distance to galactic center
 
 	if (d < 20 * kpc) {
-		double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
-		double phi = pos.getPhi(); // azimuth
 		double sinPhi = sin(phi);
 		double cosPhi = cos(phi);
 
@@ -295,6 +335,116 @@ Vector3d JF12Field::getXField(const double& r, const double& z, const double& si
 	return b;
 }
 
+Vector3d JF12Field::getRegularFieldAndJacobian(const Vector3d& pos,
+		Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	dBdx = dBdy = dBdz = Vector3d(0.);
+	double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
+	if (pos.getR() >= 20 * kpc)
+		return Vector3d(0.);
+	if (r == 0) // no azimuthal derivatives on the z-axis
+		return MagneticField::getFieldAndJacobian(pos, 0, dBdx, dBdy, dBdz);
+
+	double z = pos.z;
+	double phi = pos.getPhi();
+	double sinPhi = sin(phi);
+	double cosPhi = cos(phi);
+	double zsign = z < 0 ? -1 : 1;
+
+	// field and its derivatives in r, phi and z
+	Vector3d b(0.), dr(0.), dphi(0.), dz(0.);
+
+	double lfDisk = logisticFunction(z, hDisk, wDisk);
+	double dlfDisk = lfDisk * (1 - lfDisk) * 2 / wDisk * zsign;
+
+	if (useDiskField and (r > 3 * kpc)) {
+		double bMag;
+		Vector3d dir, dirPhi;
+		if (r < 5 * kpc) {
+			// molecular ring
+			bMag = bRing;
+			dir = Vector3d(-sinPhi, cosPhi, 0);
+			dirPhi = Vector3d(-cosPhi, -sinPhi, 0);
+		} else {
+			// spiral region, constant within an arm
+			double r_negx = r * exp(-(phi - M_PI) / tan90MinusPitch);
+			if (r_negx > rArms[7])
+				r_negx = r * exp(-(phi + M_PI) / tan90MinusPitch);
+			if (r_negx > rArms[7])
+				r_negx = r * exp(-(phi + 3 * M_PI) / tan90MinusPitch);
+
+			for (int i = 7; i >= 0; i--)
+				if (r_negx < rArms[i])
+					bMag = bDisk[i];
+			dir = Vector3d(sinPitch * cosPhi - cosPitch * sinPhi, sinPitch * sinPhi + cosPitch * cosPhi, 0);
+			dirPhi = Vector3d(-sinPitch * sinPhi - cosPitch * cosPhi, sinPitch * cosPhi - cosPitch * sinPhi, 0);
+		}
+		double bR = bMag * (5 * kpc / r);
+		b += dir * (bR * (1 - lfDisk));
+		dr += dir * (-bR / r * (1 - lfDisk));
+		dphi += dirPhi * (bR * (1 - lfDisk));
+		dz += dir * (-bR * dlfDisk);
+	}
+
+	if (useToroidalHaloField and (r * r + z * z > 1 * kpc * kpc)) {
+		double ez = exp(-fabs(z) / z0);
+		double bz = ez * lfDisk;
+		double dbz = ez * (dlfDisk - zsign / z0 * lfDisk);
+		double lfHalo = (z >= 0) ? logisticFunction(r, rNorth, wHalo) : logisticFunction(r, rSouth, wHalo);
+		double bHalo = (z >= 0) ? bNorth : bSouth;
+		double br = bHalo * (1 - lfHalo);
+		double dbr = -bHalo * lfHalo * (1 - lfHalo) * 2 / wHalo;
+		Vector3d dir(-sinPhi, cosPhi, 0);
+		b += dir * (bz * br);
+		dr += dir * (bz * dbr);
+		dphi += Vector3d(-cosPhi, -sinPhi, 0) * (bz * br);
+		dz += dir * (dbz * br);
+	}
+
+	if (useXField and (r * r + z * z > 1 * kpc * kpc)) {
+		double bMagX, dbMagXdr, dbMagXdz;
+		double sinThetaX, cosThetaX, dThetaXdr, dThetaXdz;
+		double rc = rXc + fabs(z) / tanThetaX0;
+		if (r < rc) {
+			// varying elevation region, tan(thetaX) = rc tan(thetaX0) / r
+			double rp = r * rXc / rc;
+			bMagX = bX * exp(-1 * rp / rX) * pow(rXc / rc, 2.);
+			double drpdz = -rp / rc * zsign / tanThetaX0;
+			dbMagXdr = -bMagX / rX * rXc / rc;
+			dbMagXdz = bMagX * (-drpdz / rX - 2 / rc * zsign / tanThetaX0);
+			double t = rc * tanThetaX0 / r;
+			dThetaXdr = -t / r / (1 + t * t);
+			dThetaXdz = zsign / r / (1 + t * t);
+			double thetaX = atan2(fabs(z), (r - rp));
+			if (z == 0)
+				thetaX = M_PI / 2.;
+			sinThetaX = sin(thetaX);
+			cosThetaX = cos(thetaX);
+		} else {
+			// constant elevation region
+			double rp = r - fabs(z) / tanThetaX0;
+			double e = bX * exp(-rp / rX);
+			bMagX = e * (rp / r);
+			dbMagXdr = e * (1 / r - rp / (rX * r) - rp / (r * r));
+			dbMagXdz = -e * zsign / tanThetaX0 * (1 / r - rp / (rX * r));
+			dThetaXdr = 0;
+			dThetaXdz = 0;
+			sinThetaX = sinThetaX0;
+			cosThetaX = cosThetaX0;
+		}
+		Vector3d dir(zsign * cosThetaX * cosPhi, zsign * cosThetaX * sinPhi, sinThetaX);
+		Vector3d dirTheta(-zsign * sinThetaX * cosPhi, -zsign * sinThetaX * sinPhi, cosThetaX);
+		b += dir * bMagX;
+		dr += dir * dbMagXdr + dirTheta * (bMagX * dThetaXdr);
+		dphi += Vector3d(-zsign * cosThetaX * sinPhi, zsign * cosThetaX * cosPhi, 0) * bMagX;
+		dz += dir * dbMagXdz + dirTheta * (bMagX * dThetaXdz);
+	}
+
+	dBdx = dr * cosPhi - dphi * (sinPhi / r);
+	dBdy = dr * sinPhi + dphi * (cosPhi / r);
+	dBdz = dz;
+	return b;
+}
+
 Vector3d JF12Field::getStriatedField(const Vector3d& pos) const {
 	return (getRegularField(pos)
 			* (1. + sqrtbeta * striatedGrid->closestValue(pos)));
@@ -306,6 +456,12 @@ double JF12Field::getTurbulentStrength(const Vector3d& pos) const {
 
 	double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
 	double phi = pos.getPhi(); // azimuth
+	return getTurbulentStrength(pos, r, phi);
+}
+
+double JF12Field::getTurbulentStrength(const Vector3d& pos, const double& r, const double& phi) const {
+	if (pos.getR() > 20 * kpc)
+		return 0;
 
 	// disk
 	double bDisk = 0;
@@ -350,6 +506,34 @@ Vector3d JF12Field::getField(const Vector3d& pos) const {
 	return b;
 }
 
+void JF12Field::getFields(const Vector3d *positions, Vector3d *fields, size_t n, double z) const {
+	for (size_t i = 0; i < n; i++) {
+		const Vector3d &pos = positions[i];
+		double r = sqrt(pos.x * pos.x + pos.y * pos.y); // in-plane radius
+		double phi = pos.getPhi(); // azimuth
+
+		Vector3d b(0.);
+		if (useTurbulentField)
+			b += turbulentGrid->interpolate(pos) * getTurbulentStrength(pos, r, phi);
+		if (useStriatedField)
+			b += getRegularField(pos, r, phi)
+					* (1. + sqrtbeta * striatedGrid->closestValue(pos));
+		else if (useRegularField)
+			b += getRegularField(pos, r, phi);
+		fields[i] = b;
+	}
+}
+
+Vector3d JF12Field::getFieldAndJacobian(const Vector3d &position, double z,
+		Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	if (useTurbulentField or useStriatedField)
+		return MagneticField::getFieldAndJacobian(position, z, dBdx, dBdy, dBdz);
+	if (useRegularField)
+		return getRegularFieldAndJacobian(position, dBdx, dBdy, dBdz);
+	dBdx = dBdy = dBdz = Vector3d(0.);
+	return Vector3d(0.);
+}
+
 
 
 PlanckJF12bField::PlanckJF12bField() : JF12Field::JF12Field(){
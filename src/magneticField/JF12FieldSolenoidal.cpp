@@ -106,6 +106,11 @@ void JF12FieldSolenoidal::setUseTurbulentField(bool use) {
 	useTurbulentField = use;
 }
 
+Vector3d JF12FieldSolenoidal::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	return MagneticField::getFieldAndJacobian(position, z, dBdx, dBdy, dBdz);
+}
+
 Vector3d JF12FieldSolenoidal::getDiskField(const double& r, const double& z, const double& phi, const double& sinPhi, const double& cosPhi) const {
 	Vector3d b(0.);
 
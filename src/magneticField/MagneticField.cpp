@@ -1,7 +1,44 @@
 #include "crpropa/magneticField/MagneticField.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace crpropa {
 
+void MagneticField::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(positions[i], z);
+}
+
+void MagneticField::getFieldsParallel(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	const size_t block = 1024;
+	long blocks = (n + block - 1) / block;
+	#pragma omp parallel for schedule(dynamic)
+	for (long b = 0; b < blocks; b++) {
+		size_t i = b * block;
+		getFields(positions + i, fields + i, std::min(block, n - i), z);
+	}
+}
+
+Vector3d MagneticField::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	double h = 1e-5 * std::max(position.getR(), kpc);
+	Vector3d ex(h, 0, 0), ey(0, h, 0), ez(0, 0, h);
+	dBdx = (getField(position + ex, z) - getField(position - ex, z)) / (2 * h);
+	dBdy = (getField(position + ey, z) - getField(position - ey, z)) / (2 * h);
+	dBdz = (getField(position + ez, z) - getField(position - ez, z)) / (2 * h);
+	return getField(position, z);
+}
+
+double MagneticFieldStepHint::getInitialStep(double rigidity) const {
+	double step = variationLength;
+	if ((maxField > 0) and std::isfinite(maxField))
+		step = std::min(step, 0.1 * rigidity / (c_light * maxField));
+	return step;
+}
+
 PeriodicMagneticField::PeriodicMagneticField(ref_ptr<MagneticField> field,
 		const Vector3d &extends) :
 		field(field), extends(extends), origin(0, 0, 0), reflective(false) {
@@ -57,6 +94,39 @@ Vector3d PeriodicMagneticField::getField(const Vector3d &position) const {
 	return field->getField(p);
 }
 
+Vector3d PeriodicMagneticField::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	Vector3d n = ((position - origin) / extends).floor();
+	Vector3d p = position - origin - n * extends;
+
+	// the derivatives change sign along the reflected axes
+	bool rx = false, ry = false, rz = false;
+	if (reflective) {
+		rx = (long) ::fabs(n.x) % 2 == 1;
+		if (rx)
+			p.x = extends.x - p.x;
+		ry = (long) ::fabs(n.y) % 2 == 1;
+		if (ry)
+			p.y = extends.y - p.y;
+		rz = (long) ::fabs(n.z) % 2 == 1;
+		if (rz)
+			p.z = extends.z - p.z;
+	}
+
+	Vector3d b = field->getFieldAndJacobian(p, z, dBdx, dBdy, dBdz);
+	if (rx)
+		dBdx *= -1;
+	if (ry)
+		dBdy *= -1;
+	if (rz)
+		dBdz *= -1;
+	return b;
+}
+
+size_t PeriodicMagneticField::getSizeOf() const {
+	return field->getSizeOf();
+}
+
 void MagneticFieldList::addField(ref_ptr<MagneticField> field) {
 	fields.push_back(field);
 }
@@ -68,6 +138,40 @@ Vector3d MagneticFieldList::getField(const Vector3d &position) const {
 	return b;
 }
 
+Vector3d MagneticFieldList::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	Vector3d b(0.);
+	dBdx = dBdy = dBdz = Vector3d(0.);
+	for (int i = 0; i < fields.size(); i++) {
+		Vector3d dx, dy, dz;
+		b += fields[i]->getFieldAndJacobian(position, z, dx, dy, dz);
+		dBdx += dx;
+		dBdy += dy;
+		dBdz += dz;
+	}
+	return b;
+}
+
+size_t MagneticFieldList::getSizeOf() const {
+	size_t size = 0;
+	for (size_t i = 0; i < fields.size(); i++)
+		size += fields[i]->getSizeOf();
+	return size;
+}
+
+MagneticFieldStepHint MagneticFieldList::getStepHint(const Vector3d &position,
+		double z) const {
+	MagneticFieldStepHint hint(std::numeric_limits<double>::infinity(),
+			std::numeric_limits<double>::infinity(), 0);
+	for (size_t i = 0; i < fields.size(); i++) {
+		MagneticFieldStepHint h = fields[i]->getStepHint(position, z);
+		hint.variationLength = std::min(hint.variationLength, h.variationLength);
+		hint.radius = std::min(hint.radius, h.radius);
+		hint.maxField += h.maxField;
+	}
+	return hint;
+}
+
 MagneticFieldEvolution::MagneticFieldEvolution(ref_ptr<MagneticField> field,
 	double m) :
 	field(field), m(m) {
@@ -78,6 +182,27 @@ Vector3d MagneticFieldEvolution::getField(const Vector3d &position,
 	return field->getField(position) * pow(1+z, m);
 }
 
+Vector3d MagneticFieldEvolution::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	double evolution = pow(1+z, m);
+	Vector3d b = field->getFieldAndJacobian(position, 0, dBdx, dBdy, dBdz);
+	dBdx *= evolution;
+	dBdy *= evolution;
+	dBdz *= evolution;
+	return b * evolution;
+}
+
+size_t MagneticFieldEvolution::getSizeOf() const {
+	return field->getSizeOf();
+}
+
+MagneticFieldStepHint MagneticFieldEvolution::getStepHint(const Vector3d &position,
+		double z) const {
+	MagneticFieldStepHint hint = field->getStepHint(position, 0);
+	hint.maxField *= pow(1+z, m);
+	return hint;
+}
+
 Vector3d MagneticDipoleField::getField(const Vector3d &position) const {
 		Vector3d r = (position - origin);
 		Vector3d unit_r = r.getUnitVector();
@@ -88,6 +213,28 @@ Vector3d MagneticDipoleField::getField(const Vector3d &position) const {
 		return (unit_r * (unit_r.dot(moment)) * 3 - moment) / pow(r.getR() / radius, 3) * mu0 / (4*M_PI);
 }
 
+Vector3d MagneticDipoleField::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	Vector3d r = position - origin;
+	double d = r.getR();
+	if (d == 0) { // singularity, constant inside
+		dBdx = dBdy = dBdz = Vector3d(0.);
+		return moment * 2 * mu0 / 3;
+	}
+
+	// B = k (3 r (r.m) / d^5 - m / d^3)
+	double k = mu0 / (4*M_PI) * pow(radius, 3);
+	double rm = r.dot(moment);
+	double d2 = d * d, d5 = d2 * d2 * d;
+	Vector3d *dB[3] = {&dBdx, &dBdy, &dBdz};
+	for (int j = 0; j < 3; j++) {
+		Vector3d e(j == 0, j == 1, j == 2);
+		double rj = r.dot(e), mj = moment.dot(e);
+		*dB[j] = (e * rm + r * mj + moment * rj - r * (5 * rj * rm / d2)) * (3 * k / d5);
+	}
+	return getField(position);
+}
+
 #ifdef CRPROPA_HAVE_MUPARSER
 RenormalizeMagneticField::RenormalizeMagneticField(ref_ptr<MagneticField> field,
 		std::string expression) :
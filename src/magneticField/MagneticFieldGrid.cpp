@@ -1,11 +1,20 @@
 #include "crpropa/magneticField/MagneticFieldGrid.h"
+#include "crpropa/GridTools.h"
+
+#include <algorithm>
 
 namespace crpropa {
 
-MagneticFieldGrid::MagneticFieldGrid(ref_ptr<Grid3f> grid) {
+MagneticFieldGrid::MagneticFieldGrid(ref_ptr<Grid3f> grid, double scale) :
+		scale(scale) {
 	setGrid(grid);
 }
 
+MagneticFieldGrid::MagneticFieldGrid(const std::string &filename) {
+	setGrid(mapGrid3f(filename));
+	setScale(readGridFileInfo(filename).unit);
+}
+
 void MagneticFieldGrid::setGrid(ref_ptr<Grid3f> grid) {
 	this->grid = grid;
 }
@@ -14,8 +23,132 @@ ref_ptr<Grid3f> MagneticFieldGrid::getGrid() {
 	return grid;
 }
 
+size_t MagneticFieldGrid::getSizeOf() const {
+	return grid.valid() ? grid->getSizeOf() : 0;
+}
+
+MagneticFieldStepHint MagneticFieldGrid::getStepHint(const Vector3d &position,
+		double z) const {
+	Vector3d spacing = grid->getSpacing();
+	MagneticFieldStepHint hint(std::min(spacing.x, std::min(spacing.y, spacing.z)));
+	if (not grid->isClipVolume())
+		return hint;
+
+	// distance to the grid volume, outside of which the field is zero
+	Vector3d lower = grid->getOrigin();
+	Vector3d upper = lower + Vector3d(grid->getNx(), grid->getNy(), grid->getNz()) * spacing;
+	Vector3d d(std::max(0., std::max(lower.x - position.x, position.x - upper.x)),
+			std::max(0., std::max(lower.y - position.y, position.y - upper.y)),
+			std::max(0., std::max(lower.z - position.z, position.z - upper.z)));
+	if (d.getR() > 0) {
+		hint.radius = d.getR();
+		hint.maxField = 0;
+	}
+	return hint;
+}
+
+void MagneticFieldGrid::setScale(double s) {
+	scale = s;
+}
+
+double MagneticFieldGrid::getScale() const {
+	return scale;
+}
+
 Vector3d MagneticFieldGrid::getField(const Vector3d &pos) const {
-	return grid->interpolate(pos);
+	// the steps of a propagation mostly query the last cell of the thread
+	static thread_local GridCell cell;
+	return grid->interpolate(pos, cell) * scale;
+}
+
+void MagneticFieldGrid::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	GridCell cell;
+	for (size_t i = 0; i < n; i++)
+		fields[i] = grid->interpolate(positions[i], cell) * scale;
+}
+
+Vector3d MagneticFieldGrid::getFieldAndJacobian(const Vector3d &position,
+		double z, Vector3d &dBdx, Vector3d &dBdy, Vector3d &dBdz) const {
+	if (grid->isReflective() or grid->isClipVolume()
+			or (grid->getInterpolationType() != TRILINEAR))
+		return MagneticField::getFieldAndJacobian(position, z, dBdx, dBdy, dBdz);
+	Vector3f dx, dy, dz;
+	Vector3d b = grid->interpolateWithDerivatives(position, dx, dy, dz) * scale;
+	dBdx = Vector3d(dx) * scale;
+	dBdy = Vector3d(dy) * scale;
+	dBdz = Vector3d(dz) * scale;
+	return b;
+}
+
+CompressedMagneticFieldGrid::CompressedMagneticFieldGrid(ref_ptr<CompressedGrid3f> grid,
+		double scale) : scale(scale) {
+	setGrid(grid);
+}
+
+void CompressedMagneticFieldGrid::setGrid(ref_ptr<CompressedGrid3f> grid) {
+	this->grid = grid;
+}
+
+ref_ptr<CompressedGrid3f> CompressedMagneticFieldGrid::getGrid() {
+	return grid;
+}
+
+size_t CompressedMagneticFieldGrid::getSizeOf() const {
+	return grid.valid() ? grid->getSizeOf() : 0;
+}
+
+void CompressedMagneticFieldGrid::setScale(double s) {
+	scale = s;
+}
+
+double CompressedMagneticFieldGrid::getScale() const {
+	return scale;
+}
+
+Vector3d CompressedMagneticFieldGrid::getField(const Vector3d &pos) const {
+	return grid->interpolate(pos) * scale;
+}
+
+void CompressedMagneticFieldGrid::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = grid->interpolate(positions[i]) * scale;
+}
+
+TiledMagneticFieldGrid::TiledMagneticFieldGrid(ref_ptr<TiledGrid3f> grid,
+		double scale) : scale(scale) {
+	setGrid(grid);
+}
+
+void TiledMagneticFieldGrid::setGrid(ref_ptr<TiledGrid3f> grid) {
+	this->grid = grid;
+}
+
+ref_ptr<TiledGrid3f> TiledMagneticFieldGrid::getGrid() {
+	return grid;
+}
+
+size_t TiledMagneticFieldGrid::getSizeOf() const {
+	return grid.valid() ? grid->getSizeOf() : 0;
+}
+
+void TiledMagneticFieldGrid::setScale(double s) {
+	scale = s;
+}
+
+double TiledMagneticFieldGrid::getScale() const {
+	return scale;
+}
+
+Vector3d TiledMagneticFieldGrid::getField(const Vector3d &pos) const {
+	return grid->interpolate(pos) * scale;
+}
+
+void TiledMagneticFieldGrid::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = grid->interpolate(positions[i]) * scale;
 }
 
 ModulatedMagneticFieldGrid::ModulatedMagneticFieldGrid(ref_ptr<Grid3f> grid,
@@ -26,29 +159,75 @@ ModulatedMagneticFieldGrid::ModulatedMagneticFieldGrid(ref_ptr<Grid3f> grid,
 	setModulationGrid(modGrid);
 }
 
+ModulatedMagneticFieldGrid::ModulatedMagneticFieldGrid(ref_ptr<Grid4f> fusedGrid) {
+	setFusedGrid(fusedGrid);
+}
+
 void ModulatedMagneticFieldGrid::setGrid(ref_ptr<Grid3f> g) {
 	grid = g;
+	fusedGrid = NULL;
 }
 
 ref_ptr<Grid3f> ModulatedMagneticFieldGrid::getGrid() {
 	return grid;
 }
 
+size_t ModulatedMagneticFieldGrid::getSizeOf() const {
+	size_t size = 0;
+	if (grid.valid())
+		size += grid->getSizeOf();
+	if (modGrid.valid())
+		size += modGrid->getSizeOf();
+	if (fusedGrid.valid())
+		size += fusedGrid->getSizeOf();
+	return size;
+}
+
 void ModulatedMagneticFieldGrid::setModulationGrid(ref_ptr<Grid1f> g) {
 	modGrid = g;
+	fusedGrid = NULL;
 }
 
 ref_ptr<Grid1f> ModulatedMagneticFieldGrid::getModulationGrid() {
 	return modGrid;
 }
 
+void ModulatedMagneticFieldGrid::fuse() {
+	if (not grid.valid() or not modGrid.valid())
+		throw std::runtime_error("ModulatedMagneticFieldGrid: fuse needs a field and a modulation grid");
+	fusedGrid = fuseGrids(grid, modGrid);
+}
+
+void ModulatedMagneticFieldGrid::setFusedGrid(ref_ptr<Grid4f> g) {
+	fusedGrid = g;
+}
+
+ref_ptr<Grid4f> ModulatedMagneticFieldGrid::getFusedGrid() {
+	return fusedGrid;
+}
+
+bool ModulatedMagneticFieldGrid::isFused() const {
+	return fusedGrid.valid();
+}
+
 void ModulatedMagneticFieldGrid::setReflective(bool gridReflective,
 		bool modGridReflective) {
-	grid->setReflective(gridReflective);
-	modGrid->setReflective(modGridReflective);
+	if (fusedGrid.valid()) {
+		if (gridReflective != modGridReflective)
+			throw std::runtime_error("ModulatedMagneticFieldGrid: a fused grid has one boundary condition");
+		fusedGrid->setReflective(gridReflective);
+	}
+	if (grid.valid())
+		grid->setReflective(gridReflective);
+	if (modGrid.valid())
+		modGrid->setReflective(modGridReflective);
 }
 
 Vector3d ModulatedMagneticFieldGrid::getField(const Vector3d &pos) const {
+	if (fusedGrid.valid()) {
+		Vector4f v = fusedGrid->interpolate(pos);
+		return Vector3d(v.x, v.y, v.z) * v.w;
+	}
 	float m = modGrid->interpolate(pos);
 	Vector3d b = grid->interpolate(pos);
 	return b * m;
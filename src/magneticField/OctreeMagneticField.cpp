@@ -0,0 +1,381 @@
+#include "crpropa/magneticField/OctreeMagneticField.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace crpropa {
+
+namespace {
+
+const char octreeMagic[8] = {'C', 'R', 'P', 'O', 'C', 'T', '0', '1'};
+
+struct OctreeHeader {
+	char magic[8];
+	uint64_t blockSize, nNodes, nBlocks;
+	double origin[3], size;
+};
+
+std::atomic<uint64_t> octreeInstances(0);
+
+} // namespace
+
+OctreeMagneticField::OctreeMagneticField(const Vector3d &origin, double size,
+		size_t blockSize) : origin(origin), size(size), blockSize(blockSize) {
+	if (not (size > 0) or (blockSize == 0))
+		throw std::runtime_error("OctreeMagneticField: size and blockSize must be positive");
+	Node root;
+	root.child = -1;
+	root.block = 0;
+	nodes.push_back(root);
+	values.assign(blockSize * blockSize * blockSize, Vector3f(0.));
+	instance = ++octreeInstances;
+}
+
+OctreeMagneticField::OctreeMagneticField(const std::string &filename, double unit) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin)
+		throw std::runtime_error("OctreeMagneticField: " + filename + " not found");
+	OctreeHeader header;
+	fin.read((char*) &header, sizeof(header));
+	if (!fin or (std::memcmp(header.magic, octreeMagic, sizeof(octreeMagic)) != 0))
+		throw std::runtime_error("OctreeMagneticField: " + filename + " is not an octree file");
+	if ((header.blockSize == 0) or (header.nNodes == 0) or (header.nBlocks == 0)
+			or (header.nNodes > uint64_t(std::numeric_limits<int32_t>::max()))
+			or (header.nBlocks > uint64_t(std::numeric_limits<int32_t>::max())))
+		throw std::runtime_error("OctreeMagneticField: unsupported header in " + filename);
+
+	origin = Vector3d(header.origin[0], header.origin[1], header.origin[2]);
+	size = header.size;
+	blockSize = header.blockSize;
+	nodes.resize(header.nNodes);
+	fin.read((char*) nodes.data(), nodes.size() * sizeof(Node));
+	values.resize(header.nBlocks * blockSize * blockSize * blockSize);
+	fin.read((char*) values.data(), values.size() * sizeof(Vector3f));
+	if (!fin)
+		throw std::runtime_error("OctreeMagneticField: could not read " + filename);
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const Node &n = nodes[i];
+		if ((n.child < 0) ? ((n.block < 0) or (uint64_t(n.block) >= header.nBlocks))
+				: ((n.child <= int32_t(i)) or (uint64_t(n.child) + 8 > header.nNodes)))
+			throw std::runtime_error("OctreeMagneticField: invalid node in " + filename);
+	}
+	float u = unit;
+	for (size_t i = 0; i < values.size(); i++)
+		values[i] *= u;
+	instance = ++octreeInstances;
+}
+
+void OctreeMagneticField::split(int32_t node) {
+	size_t n3 = blockSize * blockSize * blockSize;
+	int32_t parentBlock = nodes[node].block;
+	std::vector<Vector3f> parent(values.begin() + parentBlock * n3,
+			values.begin() + (parentBlock + 1) * n3);
+
+	int32_t child = nodes.size();
+	nodes[node].child = child;
+	nodes[node].block = -1;
+	for (int o = 0; o < 8; o++) {
+		Node leaf;
+		leaf.child = -1;
+		// the first child takes over the block of the parent
+		leaf.block = (o == 0) ? parentBlock : int32_t(values.size() / n3);
+		if (o > 0)
+			values.resize(values.size() + n3);
+		nodes.push_back(leaf);
+
+		// values of the parent cells that contain the cell centers
+		size_t ox = (o >> 2) & 1, oy = (o >> 1) & 1, oz = o & 1;
+		Vector3f *block = &values[leaf.block * n3];
+		for (size_t ix = 0; ix < blockSize; ix++)
+			for (size_t iy = 0; iy < blockSize; iy++)
+				for (size_t iz = 0; iz < blockSize; iz++) {
+					size_t px = (ox * blockSize + ix) / 2;
+					size_t py = (oy * blockSize + iy) / 2;
+					size_t pz = (oz * blockSize + iz) / 2;
+					block[(ix * blockSize + iy) * blockSize + iz] =
+							parent[(px * blockSize + py) * blockSize + pz];
+				}
+	}
+}
+
+void OctreeMagneticField::refine(const Vector3d &position, int depth) {
+	Vector3d r = position - origin;
+	if ((r.x < 0) or (r.y < 0) or (r.z < 0) or (r.x >= size) or (r.y >= size) or (r.z >= size))
+		throw std::runtime_error("OctreeMagneticField: position outside of the volume");
+	int32_t node = 0;
+	Vector3d lo = origin;
+	double s = size;
+	for (int d = 0; d < depth; d++) {
+		if (nodes[node].child < 0)
+			split(node);
+		s /= 2;
+		int o = 0;
+		if (position.x >= lo.x + s) {
+			o |= 4;
+			lo.x += s;
+		}
+		if (position.y >= lo.y + s) {
+			o |= 2;
+			lo.y += s;
+		}
+		if (position.z >= lo.z + s) {
+			o |= 1;
+			lo.z += s;
+		}
+		node = nodes[node].child + o;
+	}
+	instance = ++octreeInstances; // the blocks of the cached leaves changed
+}
+
+void OctreeMagneticField::sample(ref_ptr<MagneticField> field) {
+	// leaves with their lower corners and edges
+	struct Leaf {
+		int32_t block;
+		Vector3d lo;
+		double s;
+	};
+	std::vector<Leaf> leaves;
+	std::vector<Leaf> stack(1);
+	stack[0].block = 0; // node index while on the stack
+	stack[0].lo = origin;
+	stack[0].s = size;
+	while (not stack.empty()) {
+		Leaf l = stack.back();
+		stack.pop_back();
+		const Node &n = nodes[l.block];
+		if (n.child < 0) {
+			l.block = n.block;
+			leaves.push_back(l);
+			continue;
+		}
+		for (int o = 0; o < 8; o++) {
+			Leaf c;
+			c.block = n.child + o;
+			c.s = l.s / 2;
+			c.lo = l.lo + Vector3d((o >> 2) & 1, (o >> 1) & 1, o & 1) * c.s;
+			stack.push_back(c);
+		}
+	}
+
+	size_t n3 = blockSize * blockSize * blockSize;
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t i = 0; i < leaves.size(); i++) {
+		const Leaf &l = leaves[i];
+		double cell = l.s / blockSize;
+		Vector3f *block = &values[l.block * n3];
+		for (size_t ix = 0; ix < blockSize; ix++)
+			for (size_t iy = 0; iy < blockSize; iy++)
+				for (size_t iz = 0; iz < blockSize; iz++) {
+					Vector3d position = l.lo + (Vector3d(ix, iy, iz) + Vector3d(0.5)) * cell;
+					block[(ix * blockSize + iy) * blockSize + iz] = Vector3f(field->getField(position));
+				}
+	}
+}
+
+void OctreeMagneticField::save(const std::string &filename, double unit) const {
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout)
+		throw std::runtime_error("OctreeMagneticField: could not open " + filename);
+	OctreeHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, octreeMagic, sizeof(octreeMagic));
+	header.blockSize = blockSize;
+	header.nNodes = nodes.size();
+	header.nBlocks = values.size() / (blockSize * blockSize * blockSize);
+	header.origin[0] = origin.x;
+	header.origin[1] = origin.y;
+	header.origin[2] = origin.z;
+	header.size = size;
+	fout.write((const char*) &header, sizeof(header));
+	fout.write((const char*) nodes.data(), nodes.size() * sizeof(Node));
+	std::vector<Vector3f> chunk;
+	for (size_t i = 0; i < values.size(); i += 65536) {
+		chunk.assign(values.begin() + i, values.begin() + std::min(values.size(), i + 65536));
+		for (size_t j = 0; j < chunk.size(); j++)
+			chunk[j] /= unit;
+		fout.write((const char*) chunk.data(), chunk.size() * sizeof(Vector3f));
+	}
+	if (!fout)
+		throw std::runtime_error("OctreeMagneticField: could not write " + filename);
+}
+
+int32_t OctreeMagneticField::locate(const Vector3d &position, Vector3d &lo,
+		double &s) const {
+	Vector3d r = position - origin;
+	if ((r.x < 0) or (r.y < 0) or (r.z < 0) or (r.x >= size) or (r.y >= size) or (r.z >= size))
+		return -1;
+	int32_t node = 0;
+	lo = origin;
+	s = size;
+	while (nodes[node].child >= 0) {
+		s /= 2;
+		int o = 0;
+		if (position.x >= lo.x + s) {
+			o |= 4;
+			lo.x += s;
+		}
+		if (position.y >= lo.y + s) {
+			o |= 2;
+			lo.y += s;
+		}
+		if (position.z >= lo.z + s) {
+			o |= 1;
+			lo.z += s;
+		}
+		node = nodes[node].child + o;
+	}
+	return nodes[node].block;
+}
+
+int32_t OctreeMagneticField::locateCached(const Vector3d &position,
+		Vector3d &lo, double &s) const {
+	// last leaf of the calling thread
+	struct LeafCache {
+		uint64_t instance;
+		int32_t block;
+		Vector3d lo;
+		double s;
+	};
+	static thread_local LeafCache cache = {0, -1, Vector3d(0.), 0};
+	if (cache.instance == instance) {
+		Vector3d r = position - cache.lo;
+		if ((r.x >= 0) and (r.y >= 0) and (r.z >= 0) and (r.x < cache.s)
+				and (r.y < cache.s) and (r.z < cache.s)) {
+			lo = cache.lo;
+			s = cache.s;
+			return cache.block;
+		}
+	}
+	int32_t block = locate(position, lo, s);
+	if (block >= 0) {
+		cache.instance = instance;
+		cache.block = block;
+		cache.lo = lo;
+		cache.s = s;
+	}
+	return block;
+}
+
+Vector3f OctreeMagneticField::cellValue(const Vector3d &position) const {
+	// nearest cell in the volume
+	Vector3d p = position;
+	double top = std::nextafter(size, 0.);
+	p.x = origin.x + std::min(std::max(p.x - origin.x, 0.), top);
+	p.y = origin.y + std::min(std::max(p.y - origin.y, 0.), top);
+	p.z = origin.z + std::min(std::max(p.z - origin.z, 0.), top);
+
+	Vector3d lo;
+	double s;
+	int32_t block = locateCached(p, lo, s);
+	double cell = s / blockSize;
+	size_t ix = std::min(size_t((p.x - lo.x) / cell), blockSize - 1);
+	size_t iy = std::min(size_t((p.y - lo.y) / cell), blockSize - 1);
+	size_t iz = std::min(size_t((p.z - lo.z) / cell), blockSize - 1);
+	return values[(block * blockSize + ix) * blockSize * blockSize + iy * blockSize + iz];
+}
+
+Vector3d OctreeMagneticField::getField(const Vector3d &position) const {
+	Vector3d lo;
+	double s;
+	int32_t block = locateCached(position, lo, s);
+	if (block < 0)
+		return Vector3d(0.);
+
+	// lower cell center of the interpolation
+	double cell = s / blockSize;
+	Vector3d u = (position - lo) / cell - Vector3d(0.5);
+	Vector3d u0 = u.floor();
+	int ix = u0.x, iy = u0.y, iz = u0.z;
+	double fx = u.x - u0.x, fy = u.y - u0.y, fz = u.z - u0.z;
+
+	Vector3f v[2][2][2];
+	int n = blockSize;
+	if ((ix >= 0) and (iy >= 0) and (iz >= 0) and (ix + 1 < n) and (iy + 1 < n) and (iz + 1 < n)) {
+		// inside of the block
+		const Vector3f *b = &values[block * blockSize * blockSize * blockSize];
+		for (int i = 0; i < 2; i++)
+			for (int j = 0; j < 2; j++)
+				for (int k = 0; k < 2; k++)
+					v[i][j][k] = b[((ix + i) * n + iy + j) * n + iz + k];
+	} else {
+		// at the faces, from the leaves of the neighbouring cells
+		for (int i = 0; i < 2; i++)
+			for (int j = 0; j < 2; j++)
+				for (int k = 0; k < 2; k++)
+					v[i][j][k] = cellValue(lo + (Vector3d(ix + i, iy + j, iz + k)
+							+ Vector3d(0.5)) * cell);
+	}
+
+	Vector3d b(0.);
+	b += Vector3d(v[0][0][0]) * ((1 - fx) * (1 - fy) * (1 - fz));
+	b += Vector3d(v[1][0][0]) * (fx * (1 - fy) * (1 - fz));
+	b += Vector3d(v[0][1][0]) * ((1 - fx) * fy * (1 - fz));
+	b += Vector3d(v[0][0][1]) * ((1 - fx) * (1 - fy) * fz);
+	b += Vector3d(v[1][0][1]) * (fx * (1 - fy) * fz);
+	b += Vector3d(v[0][1][1]) * ((1 - fx) * fy * fz);
+	b += Vector3d(v[1][1][0]) * (fx * fy * (1 - fz));
+	b += Vector3d(v[1][1][1]) * (fx * fy * fz);
+	return b;
+}
+
+void OctreeMagneticField::getFields(const Vector3d *positions, Vector3d *fields,
+		size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(positions[i]);
+}
+
+int OctreeMagneticField::getDepth(const Vector3d &position) const {
+	Vector3d r = position - origin;
+	if ((r.x < 0) or (r.y < 0) or (r.z < 0) or (r.x >= size) or (r.y >= size) or (r.z >= size))
+		return -1;
+	int32_t node = 0;
+	Vector3d lo = origin;
+	double s = size;
+	int depth = 0;
+	while (nodes[node].child >= 0) {
+		s /= 2;
+		int o = 0;
+		if (position.x >= lo.x + s) {
+			o |= 4;
+			lo.x += s;
+		}
+		if (position.y >= lo.y + s) {
+			o |= 2;
+			lo.y += s;
+		}
+		if (position.z >= lo.z + s) {
+			o |= 1;
+			lo.z += s;
+		}
+		node = nodes[node].child + o;
+		depth++;
+	}
+	return depth;
+}
+
+size_t OctreeMagneticField::getNumberOfLeaves() const {
+	return values.size() / (blockSize * blockSize * blockSize);
+}
+
+size_t OctreeMagneticField::getNumberOfNodes() const {
+	return nodes.size();
+}
+
+size_t OctreeMagneticField::getBlockSize() const {
+	return blockSize;
+}
+
+Vector3d OctreeMagneticField::getOrigin() const {
+	return origin;
+}
+
+double OctreeMagneticField::getSize() const {
+	return size;
+}
+
+} // namespace crpropa
@@ -0,0 +1,237 @@
+#include "crpropa/magneticField/TabulatedMagneticField.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/Random.h"
+
+#include "kiss/convert.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace crpropa {
+
+namespace {
+
+const char tabulatedFieldMagic[8] = {'C', 'R', 'P', 'T', 'A', 'B', '0', '1'};
+
+struct TabulatedFieldHeader {
+	char magic[8];
+	uint64_t nLevels;
+	double tolerance;
+};
+
+struct TabulatedLevelHeader {
+	double origin[3], size[3];
+	double requestedSpacing, spacing, error;
+};
+
+size_t numberOfPoints(const Vector3d &size, double spacing, size_t &Nx,
+		size_t &Ny, size_t &Nz) {
+	Nx = size_t(std::ceil(size.x / spacing)) + 1;
+	Ny = size_t(std::ceil(size.y / spacing)) + 1;
+	Nz = size_t(std::ceil(size.z / spacing)) + 1;
+	return Nx * Ny * Nz;
+}
+
+} // namespace
+
+TabulatedMagneticField::TabulatedMagneticField(ref_ptr<MagneticField> field) :
+		field(field) {
+}
+
+void TabulatedMagneticField::addLevel(const Vector3d &origin,
+		const Vector3d &size, double spacing) {
+	if (not (spacing > 0) or not (size.x >= 0) or not (size.y >= 0) or not (size.z >= 0))
+		throw std::runtime_error("TabulatedMagneticField: spacing and size must be positive");
+	Level level;
+	level.origin = origin;
+	level.size = size;
+	level.requestedSpacing = spacing;
+	level.spacing = spacing;
+	level.error = 0;
+	levels.push_back(level);
+}
+
+void TabulatedMagneticField::sample(Level &level) const {
+	size_t Nx, Ny, Nz;
+	numberOfPoints(level.size, level.spacing, Nx, Ny, Nz);
+	// the first grid point at the lower corner of the box
+	ref_ptr<Grid3f> grid = new Grid3f(level.origin - Vector3d(level.spacing / 2),
+			Nx, Ny, Nz, level.spacing);
+
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t ix = 0; ix < Nx; ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++) {
+				Vector3d position = level.origin + Vector3d(ix, iy, iz) * level.spacing;
+				grid->get(ix, iy, iz) = Vector3f(field->getField(position));
+			}
+	level.grid = grid;
+}
+
+double TabulatedMagneticField::testLevel(const Level &level, size_t n) const {
+	Random random(1);
+	std::vector<Vector3d> positions(n);
+	for (size_t i = 0; i < n; i++)
+		positions[i] = level.origin + Vector3d(random.rand(), random.rand(),
+				random.rand()) * level.size;
+
+	double error = 0;
+	#pragma omp parallel for reduction(max: error)
+	for (size_t i = 0; i < n; i++) {
+		Vector3d b = level.grid->interpolate(positions[i]);
+		error = std::max(error, (b - field->getField(positions[i])).getR());
+	}
+	return error;
+}
+
+void TabulatedMagneticField::tabulate(double tolerance, size_t maxPoints,
+		const std::string &cacheFile) {
+	if ((not cacheFile.empty()) and readCache(cacheFile, tolerance))
+		return;
+
+	for (size_t i = 0; i < levels.size(); i++) {
+		Level &level = levels[i];
+		level.spacing = level.requestedSpacing;
+		sample(level);
+		level.error = testLevel(level, 1000);
+		size_t Nx, Ny, Nz;
+		while ((tolerance > 0) and (level.error > tolerance)
+				and (numberOfPoints(level.size, level.spacing / 2, Nx, Ny, Nz) <= maxPoints)) {
+			level.spacing /= 2;
+			sample(level);
+			level.error = testLevel(level, 1000);
+		}
+	}
+
+	if (not cacheFile.empty())
+		writeCache(cacheFile, tolerance);
+}
+
+bool TabulatedMagneticField::readCache(const std::string &filename,
+		double tolerance) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin)
+		return false;
+	TabulatedFieldHeader header;
+	fin.read((char*) &header, sizeof(header));
+	if (!fin or (std::memcmp(header.magic, tabulatedFieldMagic, sizeof(tabulatedFieldMagic)) != 0))
+		throw std::runtime_error("TabulatedMagneticField: " + filename + " is not a cache file");
+	if ((header.nLevels != levels.size()) or (header.tolerance != tolerance))
+		return false;
+
+	std::vector<TabulatedLevelHeader> levelHeaders(levels.size());
+	for (size_t i = 0; i < levels.size(); i++) {
+		TabulatedLevelHeader &h = levelHeaders[i];
+		fin.read((char*) &h, sizeof(h));
+		const Level &level = levels[i];
+		if (!fin or (h.origin[0] != level.origin.x) or (h.origin[1] != level.origin.y)
+				or (h.origin[2] != level.origin.z) or (h.size[0] != level.size.x)
+				or (h.size[1] != level.size.y) or (h.size[2] != level.size.z)
+				or (h.requestedSpacing != level.requestedSpacing))
+			return false;
+	}
+
+	for (size_t i = 0; i < levels.size(); i++) {
+		levels[i].spacing = levelHeaders[i].spacing;
+		levels[i].error = levelHeaders[i].error;
+		levels[i].grid = mapGrid3f(filename + "." + kiss::str(i));
+	}
+	return true;
+}
+
+void TabulatedMagneticField::writeCache(const std::string &filename,
+		double tolerance) const {
+	for (size_t i = 0; i < levels.size(); i++)
+		dumpMappedGrid(levels[i].grid, filename + "." + kiss::str(i));
+
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout)
+		throw std::runtime_error("TabulatedMagneticField: could not open " + filename);
+	TabulatedFieldHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, tabulatedFieldMagic, sizeof(tabulatedFieldMagic));
+	header.nLevels = levels.size();
+	header.tolerance = tolerance;
+	fout.write((const char*) &header, sizeof(header));
+	for (size_t i = 0; i < levels.size(); i++) {
+		const Level &level = levels[i];
+		TabulatedLevelHeader h;
+		h.origin[0] = level.origin.x;
+		h.origin[1] = level.origin.y;
+		h.origin[2] = level.origin.z;
+		h.size[0] = level.size.x;
+		h.size[1] = level.size.y;
+		h.size[2] = level.size.z;
+		h.requestedSpacing = level.requestedSpacing;
+		h.spacing = level.spacing;
+		h.error = level.error;
+		fout.write((const char*) &h, sizeof(h));
+	}
+	if (!fout)
+		throw std::runtime_error("TabulatedMagneticField: could not write " + filename);
+}
+
+Vector3d TabulatedMagneticField::getField(const Vector3d &position) const {
+	// finest level that contains the position
+	const Level *finest = NULL;
+	for (size_t i = 0; i < levels.size(); i++) {
+		const Level &level = levels[i];
+		if (not level.grid.valid())
+			continue;
+		Vector3d r = position - level.origin;
+		if ((r.x < 0) or (r.y < 0) or (r.z < 0) or (r.x > level.size.x)
+				or (r.y > level.size.y) or (r.z > level.size.z))
+			continue;
+		if ((finest == NULL) or (level.spacing < finest->spacing))
+			finest = &level;
+	}
+	if (finest == NULL)
+		return field->getField(position);
+	return finest->grid->interpolate(position);
+}
+
+void TabulatedMagneticField::getFields(const Vector3d *positions,
+		Vector3d *fields, size_t n, double z) const {
+	for (size_t i = 0; i < n; i++)
+		fields[i] = getField(positions[i]);
+}
+
+size_t TabulatedMagneticField::getNumberOfLevels() const {
+	return levels.size();
+}
+
+double TabulatedMagneticField::getSpacing(size_t level) const {
+	return levels.at(level).spacing;
+}
+
+double TabulatedMagneticField::getError(size_t level) const {
+	return levels.at(level).error;
+}
+
+double TabulatedMagneticField::getErrorBound() const {
+	double error = 0;
+	for (size_t i = 0; i < levels.size(); i++)
+		error = std::max(error, levels[i].error);
+	return error;
+}
+
+ref_ptr<Grid3f> TabulatedMagneticField::getGrid(size_t level) const {
+	return levels.at(level).grid;
+}
+
+ref_ptr<MagneticField> TabulatedMagneticField::getWrappedField() const {
+	return field;
+}
+
+size_t TabulatedMagneticField::getSizeOf() const {
+	size_t size = field->getSizeOf();
+	for (size_t i = 0; i < levels.size(); i++)
+		if (levels[i].grid.valid())
+			size += levels[i].grid->getSizeOf();
+	return size;
+}
+
+} // namespace crpropa
@@ -2,6 +2,9 @@
 #include "crpropa/GridTools.h"
 #include "crpropa/Random.h"
 
+#include <stdexcept>
+#include <vector>
+
 #ifdef CRPROPA_HAVE_FFTW3F
 
 namespace crpropa {
@@ -26,102 +29,138 @@ Vector3d GridTurbulence::getField(const Vector3d &pos) const {
 
 const ref_ptr<Grid3f> &GridTurbulence::getGrid() const { return gridPtr; }
 
+size_t GridTurbulence::getSizeOf() const {
+	return gridPtr.valid() ? gridPtr->getSizeOf() : 0;
+}
+
 void GridTurbulence::initTurbulence() {
 
 	Vector3d spacing = gridPtr->getSpacing();
-	size_t n = gridPtr->getNx(); // size of array
-	size_t n2 = (size_t)floor(n / 2) +
-	            1; // size array in z-direction in configuration space
-
-	// arrays to hold the complex vector components of the B(k)-field
-	fftwf_complex *Bkx, *Bky, *Bkz;
-	Bkx = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bky = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
-	Bkz = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
 
 	Random random;
 	if (seed != 0)
 		random.seed(seed); // use given seed
 
-	// calculate the n possible discrete wave numbers
-	double K[n];
-	for (size_t i = 0; i < n; i++)
-		K[i] = ((double)i / n - i / (n / 2));
-
 	// double kMin = 2*M_PI / lMax; // * 2 * spacing.x; // spacing.x / lMax;
 	// double kMax = 2*M_PI / lMin; // * 2 * spacing.x; // spacing.x / lMin;
 	double kMin = spacing.x / spectrum.getLmax();
 	double kMax = spacing.x / spectrum.getLmin();
 	auto lambda = 1 / spacing.x * 2 * M_PI;
 
-	Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
+	const TurbulenceSpectrum &turbulenceSpectrum = spectrum;
+	DrawFunction draw = [](Random &random, float *draws) {
+		draws[0] = 2 * M_PI * random.rand(); // orientation
+		draws[1] = 2 * M_PI * random.rand(); // phase
+	};
+	ModeFunction mode = [&turbulenceSpectrum, lambda](const Vector3f &ek,
+	                                                  double k,
+	                                                  const float *draws,
+	                                                  Vector3f &re, Vector3f &im) {
+		Vector3f e1, e2;  // orthogonal base
+		Vector3f n0(1, 1, 1); // arbitrary vector to construct orthogonal base
+
+		// construct an orthogonal base ek, e1, e2
+		if (ek.isParallelTo(n0, float(1e-3))) {
+			// ek parallel to (1,1,1)
+			e1.setXYZ(-1., 1., 0);
+			e2.setXYZ(1., 1., -2.);
+		} else {
+			// ek not parallel to (1,1,1)
+			e1 = n0.cross(ek);
+			e2 = ek.cross(e1);
+		}
+		e1 /= e1.getR();
+		e2 /= e2.getR();
 
-	for (size_t ix = 0; ix < n; ix++) {
-		for (size_t iy = 0; iy < n; iy++) {
-			for (size_t iz = 0; iz < n2; iz++) {
-	
-				Vector3f ek, e1, e2;  // orthogonal base
-
-				size_t i = ix * n * n2 + iy * n2 + iz;
-				ek.setXYZ(K[ix], K[iy], K[iz]);
-				double k = ek.getR();
-
-				// wave outside of turbulent range -> B(k) = 0
-				if ((k < kMin) || (k > kMax)) {
-					Bkx[i][0] = 0;
-					Bkx[i][1] = 0;
-					Bky[i][0] = 0;
-					Bky[i][1] = 0;
-					Bkz[i][0] = 0;
-					Bkz[i][1] = 0;
-					continue;
-				}
-
-				// construct an orthogonal base ek, e1, e2
-				if (ek.isParallelTo(n0, float(1e-3))) {
-					// ek parallel to (1,1,1)
-					e1.setXYZ(-1., 1., 0);
-					e2.setXYZ(1., 1., -2.);
-				} else {
-					// ek not parallel to (1,1,1)
-					e1 = n0.cross(ek);
-					e2 = ek.cross(e1);
-				}
-				e1 /= e1.getR();
-				e2 /= e2.getR();
-
-				// random orientation perpendicular to k
-				double theta = 2 * M_PI * random.rand();
-				Vector3f b = e1 * std::cos(theta) + e2 * std::sin(theta); // real b-field vector
-
-				// normal distributed amplitude with mean = 0
-				b *= std::sqrt(spectrum.energySpectrum(k*lambda));
-				
-				// uniform random phase
-				double phase = 2 * M_PI * random.rand();
-				double cosPhase = std::cos(phase); // real part
-				double sinPhase = std::sin(phase); // imaginary part
-
-				Bkx[i][0] = b.x * cosPhase;
-				Bkx[i][1] = b.x * sinPhase;
-				Bky[i][0] = b.y * cosPhase;
-				Bky[i][1] = b.y * sinPhase;
-				Bkz[i][0] = b.z * cosPhase;
-				Bkz[i][1] = b.z * sinPhase;
-			} // for iz
-		}     // for iy
-	}         // for ix
-
-	executeInverseFFTInplace(gridPtr, Bkx, Bky, Bkz);
-
-	fftwf_free(Bkx);
-	fftwf_free(Bky);
-	fftwf_free(Bkz);
+		// random orientation perpendicular to k
+		double theta = draws[0];
+		Vector3f b = e1 * std::cos(theta) + e2 * std::sin(theta); // real b-field vector
+
+		// normal distributed amplitude with mean = 0
+		b *= std::sqrt(turbulenceSpectrum.energySpectrum(k*lambda));
+
+		// uniform random phase
+		double phase = draws[1];
+		re = b * std::cos(phase); // real part
+		im = b * std::sin(phase); // imaginary part
+	};
+	fillGrid(gridPtr, kMin, kMax, random, 2, draw, mode);
 
 	scaleGrid(gridPtr, spectrum.getBrms() /
 	                       rmsFieldStrength(gridPtr)); // normalize to Brms
 }
 
+void GridTurbulence::fillGrid(ref_ptr<Grid3f> grid, double kMin, double kMax,
+                              Random &random, int nDraws,
+                              const DrawFunction &draw,
+                              const ModeFunction &mode) {
+	size_t n = grid->getNx(); // size of array
+	size_t n2 = (size_t)floor(n / 2) +
+	            1; // size array in z-direction in configuration space
+
+	// calculate the n possible discrete wave numbers
+	std::vector<double> K(n);
+	for (size_t i = 0; i < n; i++)
+		K[i] = ((double)i / n - i / (n / 2));
+
+	// first random number of each x-plane, for the modes in the turbulent range
+	std::vector<size_t> first(n + 1, 0);
+	#pragma omp parallel for schedule(static)
+	for (size_t ix = 0; ix < n; ix++) {
+		size_t count = 0;
+		for (size_t iy = 0; iy < n; iy++)
+			for (size_t iz = 0; iz < n2; iz++) {
+				double k = Vector3f(K[ix], K[iy], K[iz]).getR();
+				if ((k >= kMin) && (k <= kMax))
+					count++;
+			}
+		first[ix + 1] = count * nDraws;
+	}
+	for (size_t ix = 0; ix < n; ix++)
+		first[ix + 1] += first[ix];
+
+	// draw in the order of the modes
+	std::vector<float> draws(first[n]);
+	for (size_t i = 0; i < draws.size(); i += nDraws)
+		draw(random, &draws[i]);
+
+	// array to hold the complex component of the B(k)-field
+	fftwf_complex *Bk =
+	    (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n * n * n2);
+	if (Bk == NULL)
+		throw std::runtime_error("turbulentField: not enough memory for the FFT");
+
+	for (int c = 0; c < 3; c++) {
+		#pragma omp parallel for schedule(static)
+		for (size_t ix = 0; ix < n; ix++) {
+			const float *d = draws.data() + first[ix];
+			for (size_t iy = 0; iy < n; iy++) {
+				for (size_t iz = 0; iz < n2; iz++) {
+					size_t i = ix * n * n2 + iy * n2 + iz;
+					Vector3f ek(K[ix], K[iy], K[iz]);
+					double k = ek.getR();
+
+					// wave outside of turbulent range -> B(k) = 0
+					if ((k < kMin) || (k > kMax)) {
+						Bk[i][0] = 0;
+						Bk[i][1] = 0;
+						continue;
+					}
+
+					Vector3f re, im;
+					mode(ek, k, d, re, im);
+					d += nDraws;
+					Bk[i][0] = (c == 0) ? re.x : ((c == 1) ? re.y : re.z);
+					Bk[i][1] = (c == 0) ? im.x : ((c == 1) ? im.y : im.z);
+				} // for iz
+			}     // for iy
+		}         // for ix
+		executeInverseFFT(grid, Bk, c);
+	}
+
+	fftwf_free(Bk);
+}
+
 // Check the grid properties before the FFT procedure
 void GridTurbulence::checkGridRequirements(ref_ptr<Grid3f> grid, double lMin,
                                            double lMax) {
@@ -146,37 +185,55 @@ void GridTurbulence::executeInverseFFTInplace(ref_ptr<Grid3f> grid,
                                               fftwf_complex *Bkx,
                                               fftwf_complex *Bky,
                                               fftwf_complex *Bkz) {
+	executeInverseFFT(grid, Bkx, 0);
+	executeInverseFFT(grid, Bky, 1);
+	executeInverseFFT(grid, Bkz, 2);
+}
 
+// Execute inverse discrete FFT of one component, from complex to real space
+void GridTurbulence::executeInverseFFT(ref_ptr<Grid3f> grid, fftwf_complex *Bk,
+                                       int component) {
 	size_t n = grid->getNx(); // size of array
 	size_t n2 = (size_t)floor(n / 2) +
 	            1; // size array in z-direction in configuration space
+	int dims[3] = {int(n), int(n), int(n)};
+	initFFTWThreads();
+
+	if (grid->getLayout() == DENSE) {
+		// out-of-place, complex to real, directly into the component of the grid values
+		float *B = (float *)grid->getValues() + component;
+		fftwf_plan plan;
+		#pragma omp critical(fftwPlanner)
+		plan = fftwf_plan_many_dft_c2r(3, dims, 1, Bk, NULL, 1, 0, B, NULL, 3,
+		                               0, FFTW_ESTIMATE);
+		fftwf_execute(plan);
+		#pragma omp critical(fftwPlanner)
+		fftwf_destroy_plan(plan);
+		return;
+	}
 
-	// in-place, complex to real, inverse Fourier transformation on each
-	// component note that the last elements of B(x) are unused now
-	float *Bx = (float *)Bkx;
-	fftwf_plan plan_x = fftwf_plan_dft_c2r_3d(n, n, n, Bkx, Bx, FFTW_ESTIMATE);
-	fftwf_execute(plan_x);
-	fftwf_destroy_plan(plan_x);
-
-	float *By = (float *)Bky;
-	fftwf_plan plan_y = fftwf_plan_dft_c2r_3d(n, n, n, Bky, By, FFTW_ESTIMATE);
-	fftwf_execute(plan_y);
-	fftwf_destroy_plan(plan_y);
-
-	float *Bz = (float *)Bkz;
-	fftwf_plan plan_z = fftwf_plan_dft_c2r_3d(n, n, n, Bkz, Bz, FFTW_ESTIMATE);
-	fftwf_execute(plan_z);
-	fftwf_destroy_plan(plan_z);
+	// in-place, complex to real, note that the last elements of B(x) are unused now
+	float *B = (float *)Bk;
+	fftwf_plan plan;
+	#pragma omp critical(fftwPlanner)
+	plan = fftwf_plan_dft_c2r_3d(n, n, n, Bk, B, FFTW_ESTIMATE);
+	fftwf_execute(plan);
+	#pragma omp critical(fftwPlanner)
+	fftwf_destroy_plan(plan);
 
 	// save to grid
+	#pragma omp parallel for schedule(static)
 	for (size_t ix = 0; ix < n; ix++) {
 		for (size_t iy = 0; iy < n; iy++) {
 			for (size_t iz = 0; iz < n; iz++) {
 				size_t i = ix * n * 2 * n2 + iy * 2 * n2 + iz;
 				Vector3f &b = grid->get(ix, iy, iz);
-				b.x = Bx[i];
-				b.y = By[i];
-				b.z = Bz[i];
+				if (component == 0)
+					b.x = B[i];
+				else if (component == 1)
+					b.y = B[i];
+				else
+					b.z = B[i];
 			}
 		}
 	}
@@ -1,92 +1,30 @@
-// This file contains an implementation of a vectorized cosine, which
-// is based in part on the implementations in the library "SLEEF" by
-// Naoki Shibata. SLEEF was used under the Boost Software License,
-// Version 1.0. The original source file contained the following
-// copyright notice:
-//
-//   //          Copyright Naoki Shibata 2010 - 2018.
-//   // Distributed under the Boost Software License, Version 1.0.
-//   //    (See accompanying file LICENSE.txt or copy at
-//   //          http://www.boost.org/LICENSE_1_0.txt)
-//
-// SLEEF was used under the following license, which is not necessarily the
-// license that applies to this file:
-//
-//         Boost Software License - Version 1.0 - August 17th, 2003
-//
-//         Permission is hereby granted, free of charge, to any person or
-//         organization obtaining a copy of the software and accompanying
-//         documentation covered by this license (the "Software") to use,
-//         reproduce, display, distribute, execute, and transmit the Software,
-//         and to prepare derivative works of the Software, and to permit
-//         third-parties to whom the Software is furnished to do so, all subject
-//         to the following:
-//
-//         The copyright notices in the Software and this entire statement,
-//         including the above license grant, this restriction and the following
-//         disclaimer, must be included in all copies of the Software, in whole
-//         or in part, and all derivative works of the Software, unless such
-//         copies or derivative works are solely in the form of
-//         machine-executable object code generated by a source language
-//         processor.
-//
-//         THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
-//         EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
-//         MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, TITLE AND
-//         NON-INFRINGEMENT. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR ANYONE
-//         DISTRIBUTING THE SOFTWARE BE LIABLE FOR ANY DAMAGES OR OTHER
-//         LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
-//         OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
-//         THE SOFTWARE.
-
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 #include "crpropa/GridTools.h"
 #include "crpropa/Random.h"
+#include "crpropa/SimdDispatch.h"
 #include "crpropa/Units.h"
 
 #include "kiss/logger.h"
 
 #include <iostream>
-
-#if defined(FAST_WAVES)
-#if defined(__SSE__) && defined(__SSE2__) && defined(__SSE3__) && defined(__SSE4_1__) && defined(__SSE4_2__) && defined(__AVX__)
-#define ENABLE_FAST_WAVES
-#else
-#error "FAST_WAVES is enabled, but it appears that not all required SIMD extensions are enabled in the compiler. Without these extensions, the FAST_WAVES optimization cannot be used. Please make sure that the SIMD_EXTENSIONS option in cmake matches the capabilities of your target CPU, or (if your target CPU does not support the required extensions), disable the FAST_WAVES flag in cmake."
-#endif
-#endif
-
-
-#ifdef ENABLE_FAST_WAVES
-#include <immintrin.h>
-#endif
+#include <memory>
 
 namespace crpropa {
-#ifdef ENABLE_FAST_WAVES
-// see
-// https://stackoverflow.com/questions/49941645/get-sum-of-values-stored-in-m256d-with-sse-avx
-double hsum_double_avx(__m256d v) {
-	__m128d vlow = _mm256_castpd256_pd128(v);
-	__m128d vhigh = _mm256_extractf128_pd(v, 1); // high 128
-	vlow = _mm_add_pd(vlow, vhigh);              // reduce down to 128
-
-	__m128d high64 = _mm_unpackhi_pd(vlow, vlow);
-	return _mm_cvtsd_f64(_mm_add_sd(vlow, high64)); // reduce to scalar
-}
-#endif // defined(ENABLE_FAST_WAVES)
 
 PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
                                          int Nm, int seed)
-    : TurbulentField(spectrum), Nm(Nm) {
-
-#ifdef ENABLE_FAST_WAVES
-	KISS_LOG_INFO << "PlaneWaveTurbulence: Using SIMD TD13 implementation"
-	              << std::endl;
-
-	// There used to be a cpuid check here, to see if the cpu running
-	// this code would support SIMD (SSE + AVX). However, the library providing
-	// the relevant function is no longer being used, and doing this manually
-	// might be a bit too much work.
+    : TurbulentField(spectrum), Nm(Nm), singlePrecision(false) {
+
+#ifdef FAST_WAVES
+	// the kernel is chosen at runtime for the instruction set of the CPU
+	std::string level = getSimdLevelName(getSimdLevel());
+	if (getSimdKernels().planeWaves)
+		KISS_LOG_INFO << "PlaneWaveTurbulence: Using SIMD TD13 implementation ("
+		              << level << ")" << std::endl;
+	else
+		KISS_LOG_WARNING << "PlaneWaveTurbulence: FAST_WAVES is enabled, but "
+		                    "the CPU does not support AVX. Using the scalar "
+		                    "implementation." << std::endl;
 #endif
 
 	if (Nm <= 1) {
@@ -128,6 +66,9 @@ PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
 	// non-normalized Ak^2). Normalization happens in a second loop,
 	// once the total is known.
 	double Ak2_sum = 0; // sum of Ak^2 over all k
+	// the random numbers of all modes at once, in the order of randUniform calls
+	std::vector<double> u(4 * Nm);
+	random.fillUniform(u.data(), u.size());
 	for (int i = 0; i < Nm; i++) {
 		double k = this->k[i];
 		double kHat = k * spectrum.getLbendover();
@@ -141,12 +82,12 @@ PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
 		// z is costheta, and r is sintheta. Our kappa is equivalent to
 		// the return value of randVector(); however, TD13 then reuse
 		// these values to generate a random vector perpendicular to kappa.
-		double phi = random.randUniform(-M_PI, M_PI);
-		double costheta = random.randUniform(-1., 1.);
+		double phi = -M_PI + 2 * M_PI * u[4 * i];
+		double costheta = -1. + 2. * u[4 * i + 1];
 		double sintheta = sqrt(1 - costheta * costheta);
 
-		double alpha = random.randUniform(0, 2 * M_PI);
-		double beta = random.randUniform(0, 2 * M_PI);
+		double alpha = 2 * M_PI * u[4 * i + 2];
+		double beta = 2 * M_PI * u[4 * i + 3];
 
 		Vector3d kappa =
 		    Vector3d(sintheta * cos(phi), sintheta * sin(phi), costheta);
@@ -172,11 +113,13 @@ PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
 	// Only in this loop are the actual Ak computed and stored.
 	// This two-step process is necessary in order to normalize the values
 	// properly.
+	sumAk = 0;
 	for (int i = 0; i < Nm; i++) {
 		Ak[i] = sqrt(2 * Ak[i] / Ak2_sum) * spectrum.getBrms();
+		sumAk += Ak[i];
 	}
 
-#ifdef ENABLE_FAST_WAVES
+#ifdef FAST_WAVES
 	// * copy data into AVX-compatible arrays *
 	//
 	// AVX requires all data to be aligned to 256 bit, or 32 bytes, which is the
@@ -193,17 +136,23 @@ PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
 	// divisible by 4. If it isn't, we simply pad it out with zeros. Since the
 	// final step of the computation of each wavemode is multiplication by the
 	// amplitude, which will be set to 0, these padding wavemodes won't affect
-	// the result.
+	// the result. AVX-512 reads 512 bits, or 16 floats in single precision, so
+	// the wavemodes are padded to a multiple of 16 and the arrays are aligned
+	// to 64 bytes for all of the SIMD types.
 
-	avx_Nm = ((Nm + 4 - 1) / 4) * 4; // round up to next larger multiple of 4:
-	                                 // align is 256 = 4 * sizeof(double) bit
-	avx_data = std::vector<double>(itotal * avx_Nm + 3, 0.);
+	avx_Nm = ((Nm + 16 - 1) / 16) * 16; // round up to next larger multiple of 16
+	avx_data = std::vector<double>(itotal * avx_Nm + 7, 0.);
+	avx_data_f = std::vector<float>(itotal * avx_Nm + 15, 0.f);
 
-	// get the first 256-bit aligned element
+	// get the first 512-bit aligned element
 	size_t size = avx_data.size() * sizeof(double);
 	void *pointer = avx_data.data();
 	align_offset =
-	    (double *)std::align(32, 32, pointer, size) - avx_data.data();
+	    (double *)std::align(64, 64, pointer, size) - avx_data.data();
+	size = avx_data_f.size() * sizeof(float);
+	pointer = avx_data_f.data();
+	align_offset_f =
+	    (float *)std::align(64, 64, pointer, size) - avx_data_f.data();
 
 	// copy into the AVX arrays
 	for (int i = 0; i < Nm; i++) {
@@ -224,218 +173,208 @@ PlaneWaveTurbulence::PlaneWaveTurbulence(const TurbulenceSpectrum &spectrum,
 		// of the cosine as well.
 		avx_data[i + align_offset + avx_Nm * ibeta] = beta[i] / M_PI;
 	}
-#endif // ENABLE_FAST_WAVES
+	for (int i = 0; i < itotal * avx_Nm; i++)
+		avx_data_f[i + align_offset_f] = avx_data[i + align_offset];
+#endif // FAST_WAVES
+}
+
+void PlaneWaveTurbulence::setSinglePrecision(bool b) {
+	singlePrecision = b;
+}
+
+bool PlaneWaveTurbulence::isSinglePrecision() const {
+	return singlePrecision;
+}
+
+void PlaneWaveTurbulence::getFields(const Vector3d *positions,
+                                    Vector3d *fields, size_t n,
+                                    double z) const {
+#ifdef FAST_WAVES
+	const SimdKernels &kernels = getSimdKernels();
+	if (singlePrecision and kernels.planeWavesFloat) {
+		kernels.planeWavesFloat(avx_data_f.data() + align_offset_f, avx_Nm,
+		                        positions->data, fields->data, n);
+		return;
+	}
+	if (kernels.planeWaves) {
+		kernels.planeWaves(avx_data.data() + align_offset, avx_Nm,
+		                   positions->data, fields->data, n);
+		return;
+	}
+#endif // FAST_WAVES
+
+	std::vector<double> x(n), y(n), zz(n), B0(n, 0.), B1(n, 0.), B2(n, 0.);
+	for (size_t j = 0; j < n; j++) {
+		x[j] = positions[j].x;
+		y[j] = positions[j].y;
+		zz[j] = positions[j].z;
+	}
+
+	for (int i = 0; i < Nm; i++) {
+		// same operations as in getField, B += xi * Ak * cos(k * z_ + beta)
+		const double kx = kappa[i].x, ky = kappa[i].y, kz = kappa[i].z;
+		const double Axi0 = xi[i].x * Ak[i];
+		const double Axi1 = xi[i].y * Ak[i];
+		const double Axi2 = xi[i].z * Ak[i];
+		const double ki = k[i], betai = beta[i];
+		for (size_t j = 0; j < n; j++) {
+			double z_ = x[j] * kx + y[j] * ky + zz[j] * kz;
+			double c = cos(ki * z_ + betai);
+			B0[j] += Axi0 * c;
+			B1[j] += Axi1 * c;
+			B2[j] += Axi2 * c;
+		}
+	}
+
+	for (size_t j = 0; j < n; j++)
+		fields[j] = Vector3d(B0[j], B1[j], B2[j]);
+}
+
+MagneticFieldStepHint PlaneWaveTurbulence::getStepHint(const Vector3d &position,
+                                                      double z) const {
+	return MagneticFieldStepHint(spectrum.getLmin() / (2 * M_PI),
+	                             std::numeric_limits<double>::infinity(), sumAk);
 }
 
 Vector3d PlaneWaveTurbulence::getField(const Vector3d &pos) const {
+#ifdef FAST_WAVES
+	const SimdKernels &kernels = getSimdKernels();
+	if (kernels.planeWaves) {
+		Vector3d B;
+		if (singlePrecision)
+			kernels.planeWavesFloat(avx_data_f.data() + align_offset_f, avx_Nm,
+			                        pos.data, B.data, 1);
+		else
+			kernels.planeWaves(avx_data.data() + align_offset, avx_Nm, pos.data,
+			                   B.data, 1);
+		return B;
+	}
+#endif // FAST_WAVES
 
-#ifndef ENABLE_FAST_WAVES
 	Vector3d B(0.);
 	for (int i = 0; i < Nm; i++) {
 		double z_ = pos.dot(kappa[i]);
 		B += xi[i] * Ak[i] * cos(k[i] * z_ + beta[i]);
 	}
 	return B;
+}
 
-#else  // ENABLE_FAST_WAVES
+PlaneWaveEvaluator::PlaneWaveEvaluator(const PlaneWaveTurbulence &field,
+                                       int resyncSteps)
+    : Nm(field.Nm), position(0.), step(0.), stepsSinceResync(0) {
+	setResyncSteps(resyncSteps);
+	nPadded = ((Nm + 8 - 1) / 8) * 8;
+	kx.assign(nPadded, 0.);
+	ky.assign(nPadded, 0.);
+	kz.assign(nPadded, 0.);
+	Ax.assign(nPadded, 0.);
+	Ay.assign(nPadded, 0.);
+	Az.assign(nPadded, 0.);
+	beta.assign(nPadded, 0.);
+	for (size_t i = 0; i < Nm; i++) {
+		kx[i] = field.k[i] * field.kappa[i].x;
+		ky[i] = field.k[i] * field.kappa[i].y;
+		kz[i] = field.k[i] * field.kappa[i].z;
+		Ax[i] = field.Ak[i] * field.xi[i].x;
+		Ay[i] = field.Ak[i] * field.xi[i].y;
+		Az[i] = field.Ak[i] * field.xi[i].z;
+		beta[i] = field.beta[i];
+	}
+	c.assign(nPadded, 1.);
+	s.assign(nPadded, 0.);
+	cd.assign(nPadded, 1.);
+	sd.assign(nPadded, 0.);
+	resync();
+}
 
-	// Initialize accumulators
-	//
-	// There is one accumulator per component of the result vector.
-	// Note that each accumulator contains four numbers. At the end of
-	// the loop, each of these numbers will contain the sum of every
-	// fourth wavemode, starting at a different offset. In the end, each
-	// of the accumulator's numbers are added together (using
-	// hsum_double_avx), resulting in the total sum for that component.
-
-	__m256d acc0 = _mm256_setzero_pd();
-	__m256d acc1 = _mm256_setzero_pd();
-	__m256d acc2 = _mm256_setzero_pd();
-
-	// broadcast position into AVX registers
-	__m256d pos0 = _mm256_set1_pd(pos.x);
-	__m256d pos1 = _mm256_set1_pd(pos.y);
-	__m256d pos2 = _mm256_set1_pd(pos.z);
-
-	for (int i = 0; i < avx_Nm; i += 4) {
-
-		// Load data from memory into AVX registers:
-		//  - the three components of the vector A * xi
-		__m256d Axi0 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi0);
-		__m256d Axi1 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi1);
-		__m256d Axi2 =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * iAxi2);
-
-		//  - the three components of the vector k * kappa
-		__m256d kkappa0 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa0);
-		__m256d kkappa1 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa1);
-		__m256d kkappa2 = _mm256_load_pd(avx_data.data() + i + align_offset +
-		                                 avx_Nm * ikkappa2);
-
-		//  - the phase beta.
-		__m256d beta =
-		    _mm256_load_pd(avx_data.data() + i + align_offset + avx_Nm * ibeta);
-
-		// Then, do the computation.
-
-		// This is the scalar product between k*kappa and pos:
-		__m256d z = _mm256_add_pd(_mm256_mul_pd(pos0, kkappa0),
-		                          _mm256_add_pd(_mm256_mul_pd(pos1, kkappa1),
-		                                        _mm256_mul_pd(pos2, kkappa2)));
-
-		// Here, the phase is added on. This is the argument of the cosine.
-		__m256d cos_arg = _mm256_add_pd(z, beta);
-
-		// ********
-		// * Computing the cosine
-		// * Part 1: Argument reduction
-		//
-		//  To understand the computation of the cosine, first note that the
-		//  cosine is periodic and we thus only need to model its behavior
-		//  between 0 and 2*pi to be able compute the function anywhere. In
-		//  fact, by mirroring the function along the x and y axes, even the
-		//  range between 0 and pi/2 is sufficient for this purpose. In this
-		//  range, the cosine can be efficiently evaluated with high precision
-		//  by using a polynomial approximation. Thus, to compute the cosine,
-		//  the input value is first reduced so that it lies within this range.
-		//  Then, the polynomial approximation is evaluated. Finally, if
-		//  necessary, the sign of the result is flipped (mirroring the function
-		//  along the x axis).
-		//
-		//  The actual computation is slightly more involved. First, argument
-		//  reduction can be simplified drastically by computing cos(pi*x),
-		//  such that the values are reduced to the range [0, 0.5) instead of
-		//  [0, pi/2). Since the cosine is even (independent of the sign), we
-		//  can first reduce values to [-0.5, 0.5) – that is, a simple rounding
-		//  operation – and then neutralize the sign. In fact, precisely because
-		//  the cosine is even, all terms of the polynomial are powers of x^2,
-		//  so the value of x^2 (computed as x*x) forms the basis for the
-		//  polynomial approximation. If I understand things correctly, then (in
-		//  IEEE-754 floating point) x*x and (-x)*(-x) will always result in the
-		//  exact same value, which means that any error bound over [0, 0.5)
-		//  automatically applies to (-0.5, 0] as well.
-
-		// First, compute round(x), and store it in q. If this value is odd,
-		// we're looking at the negative half-wave of the cosine, and thus
-		// will have to invert the sign of the result.
-		__m256d q = _mm256_round_pd(
-		    cos_arg, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
-
-		// Since we're computing cos(pi*x), round(x) always yields the center of
-		// a half-wave (where cos(pi*x) achieves an extremum). This point
-		// logically corresponds to x=0. Therefore, we subtract this center from
-		// the actual input argument to find the corresponding point on the
-		// half-wave that is centered around zero.
-		__m256d s = _mm256_sub_pd(cos_arg, q);
-
-		// We now want to check whether q (the index of our half-wave) is even
-		// or odd, since all of the odd-numbered half-waves are negative, so
-		// we'll have to flip the final result. On an int, this is as simple as
-		// checking the 0th bit. Idea: manipulate the double in such a way that
-		// we can do this. So, we add 2^52, such that the last digit of the
-		// mantissa is actually in the ones' position. Since q may be negative,
-		// we'll also add 2^51 to make sure it's positive. Note that 2^51 is
-		// even and thus leaves evenness invariant, which is the only thing we
-		// care about here.
-		//
-		// This is based on the int extraction process described here:
-		// https://stackoverflow.com/questions/41144668/how-to-efficiently-perform-double-int64-conversions-with-sse-avx/41223013
-		//
-		// We assume -2^51 <= q < 2^51 for this, which is unproblematic, as
-		// double precision has decayed far enough at that point that the
-		// usefulness of the cosine becomes limited.
-		//
-		// Explanation: The mantissa of a double-precision float has 52 bits
-		// (excluding the implicit first bit, which is always one). If |q| >
-		// 2^51, this implicit first bit has a place value of at least 2^51,
-		// while the first stored bit of the mantissa has a place value of at
-		// least 2^50. This means that the LSB of the mantissa has a place value
-		// of at least 2^(-1), or 0.5. For a cos(pi*x), this corresponds to a
-		// quarter of a cycle (pi/2), so at this point the precision of the
-		// input argument is so low that going from one representable number to
-		// the next causes the result to jump by +/-1.
-
-		q = _mm256_add_pd(q, _mm256_set1_pd(0x0018000000000000));
-
-		// Unfortunately, integer comparisons were only introduced in AVX2, so
-		// we'll have to make do with a floating point comparison to check
-		// whether the last bit is set. However, masking out all but the last
-		// bit will result in a denormal float, which may either result in
-		// performance problems or just be rounded down to zero, neither of
-		// which is what we want here. To fix this, we'll mask in not only bit
-		// 0, but also the exponent (and sign, but that doesn't matter) of q.
-		// Luckily, the exponent of q is guaranteed to have the fixed value of
-		// 1075 (corresponding to 2^52) after our addition.
-
-		__m256d invert = _mm256_and_pd(
-		    q, _mm256_castsi256_pd(_mm256_set1_epi64x(0xfff0000000000001)));
-
-		// If we did have a one in bit 0, our result will be equal to 2^52 + 1.
-		invert = _mm256_cmp_pd(
-		    invert, _mm256_castsi256_pd(_mm256_set1_epi64x(0x4330000000000001)),
-		    _CMP_EQ_OQ);
-
-		// Now we know whether to flip the sign of the result. However, remember
-		// that we're working on multiple values at a time, so an if statement
-		// won't be of much use here (plus it might perform badly). Instead,
-		// we'll make use of the fact that the result of the comparison is all
-		// ones if the comparison was true (i.e. q is odd and we need to flip
-		// the result), and all zeroes otherwise. If we now mask out all bits
-		// except the sign bit, we get something that, when xor'ed into our
-		// final result, will flip the sign exactly when q is odd.
-		invert = _mm256_and_pd(invert, _mm256_set1_pd(-0.0));
-		// (Note that the binary representation of -0.0 is all 0 bits, except
-		// for the sign bit, which is set to 1.)
-
-		// TODO: clamp floats between 0 and 1? This would ensure that we never
-		// see inf's, but maybe we want that, so that things dont just fail
-		// silently...
-
-		// * end of argument reduction
-		// *******
-
-		// ******
-		// * Evaluate the cosine using a polynomial approximation for the zeroth
-		// half-wave.
-		// * The coefficients for this were generated using sleefs gencoef.c.
-		// * These coefficients are probably far from optimal; however, they
-		// should be sufficient for this case.
-		s = _mm256_mul_pd(s, s);
-
-		__m256d u = _mm256_set1_pd(+0.2211852080653743946e+0);
-
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(-0.1332560668688523853e+1));
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(+0.4058509506474178075e+1));
-		u = _mm256_add_pd(_mm256_mul_pd(u, s),
-		                  _mm256_set1_pd(-0.4934797516664651162e+1));
-		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(1.));
-
-		// Then, flip the sign of each double for which invert is not zero.
-		// Since invert has only zero bits except for a possible one in bit 63,
-		// we can xor it onto our result to selectively invert the 63rd (sign)
-		// bit in each double where invert is set.
-		u = _mm256_xor_pd(u, invert);
-
-		// * end computation of cosine
-		// **********
-
-		// Finally, Ak*xi is multiplied on. Since this is a vector, the
-		// multiplication needs to be done for each of the three
-		// components, so it happens separately.
-		acc0 = _mm256_add_pd(_mm256_mul_pd(u, Axi0), acc0);
-		acc1 = _mm256_add_pd(_mm256_mul_pd(u, Axi1), acc1);
-		acc2 = _mm256_add_pd(_mm256_mul_pd(u, Axi2), acc2);
+void PlaneWaveEvaluator::resync() {
+	for (size_t i = 0; i < Nm; i++) {
+		double phase = kx[i] * position.x + ky[i] * position.y +
+		               kz[i] * position.z + beta[i];
+		c[i] = cos(phase);
+		s[i] = sin(phase);
+	}
+	stepsSinceResync = 0;
+}
+
+void PlaneWaveEvaluator::setPosition(const Vector3d &p) {
+	position = p;
+	resync();
+}
+
+void PlaneWaveEvaluator::setStep(const Vector3d &d) {
+	step = d;
+	for (size_t i = 0; i < Nm; i++) {
+		double delta = kx[i] * d.x + ky[i] * d.y + kz[i] * d.z;
+		cd[i] = cos(delta);
+		sd[i] = sin(delta);
+	}
+}
+
+Vector3d PlaneWaveEvaluator::advance() {
+	position += step;
+	if (++stepsSinceResync >= resyncSteps) {
+		resync();
+		return getField();
 	}
 
-	return Vector3d(hsum_double_avx(acc0), hsum_double_avx(acc1),
-	                hsum_double_avx(acc2));
-#endif // ENABLE_FAST_WAVES
+	// eight partial sums, to hide the latency of the additions; the padding
+	// wavemodes have zero amplitudes
+	double B0[8] = {0}, B1[8] = {0}, B2[8] = {0};
+	for (size_t j = 0; j < nPadded; j += 8) {
+		#pragma omp simd
+		for (size_t l = 0; l < 8; l++) {
+			size_t i = j + l;
+			// cos(a + d) = cos a cos d - sin a sin d, sin(a + d) = sin a cos d + cos a sin d
+			double cNew = c[i] * cd[i] - s[i] * sd[i];
+			s[i] = s[i] * cd[i] + c[i] * sd[i];
+			c[i] = cNew;
+			B0[l] += Ax[i] * cNew;
+			B1[l] += Ay[i] * cNew;
+			B2[l] += Az[i] * cNew;
+		}
+	}
+	return sum(B0, B1, B2);
+}
+
+Vector3d PlaneWaveEvaluator::getField() const {
+	double B0[8] = {0}, B1[8] = {0}, B2[8] = {0};
+	for (size_t j = 0; j < nPadded; j += 8) {
+		#pragma omp simd
+		for (size_t l = 0; l < 8; l++) {
+			size_t i = j + l;
+			B0[l] += Ax[i] * c[i];
+			B1[l] += Ay[i] * c[i];
+			B2[l] += Az[i] * c[i];
+		}
+	}
+	return sum(B0, B1, B2);
+}
+
+Vector3d PlaneWaveEvaluator::sum(const double *B0, const double *B1,
+                                 const double *B2) {
+	Vector3d B(0.);
+	for (int l = 0; l < 8; l++)
+		B += Vector3d(B0[l], B1[l], B2[l]);
+	return B;
+}
+
+Vector3d PlaneWaveEvaluator::getPosition() const {
+	return position;
+}
+
+Vector3d PlaneWaveEvaluator::getStep() const {
+	return step;
+}
+
+void PlaneWaveEvaluator::setResyncSteps(int n) {
+	if (n < 1)
+		throw std::runtime_error("PlaneWaveEvaluator: resyncSteps < 1");
+	resyncSteps = n;
+}
+
+int PlaneWaveEvaluator::getResyncSteps() const {
+	return resyncSteps;
 }
 
 } // namespace crpropa
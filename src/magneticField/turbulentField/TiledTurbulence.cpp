@@ -0,0 +1,146 @@
+#include "crpropa/magneticField/turbulentField/TiledTurbulence.h"
+#include "crpropa/magneticField/turbulentField/GridTurbulence.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#ifdef CRPROPA_HAVE_FFTW3F
+
+namespace crpropa {
+
+namespace {
+
+uint64_t tileKey(int ix, int iy, int iz) {
+	// 21 bits per index
+	const uint64_t mask = (uint64_t(1) << 21) - 1;
+	return ((uint64_t(ix) & mask) << 42) | ((uint64_t(iy) & mask) << 21) | (uint64_t(iz) & mask);
+}
+
+uint64_t splitmix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+} // namespace
+
+TiledTurbulence::TiledTurbulence(const TurbulenceSpectrum &spectrum,
+                                 const GridProperties &p, unsigned int seed,
+                                 size_t cacheBytes)
+    : TurbulentField(spectrum), seed(seed), tileProperties(p), generated(0) {
+	if ((p.Nx != p.Ny) or (p.Nx != p.Nz))
+		throw std::runtime_error("TiledTurbulence: only cubic tiles supported");
+	tileSize = p.spacing * double(p.Nx);
+	setCacheSize(cacheBytes);
+	getTile(0, 0, 0); // checks the grid requirements
+}
+
+unsigned int TiledTurbulence::getTileSeed(int ix, int iy, int iz) const {
+	uint64_t h = splitmix64(splitmix64(seed) ^ tileKey(ix, iy, iz));
+	unsigned int s = (unsigned int)(h ^ (h >> 32));
+	return (s == 0) ? 1 : s; // GridTurbulence draws a random seed for 0
+}
+
+ref_ptr<Grid3f> TiledTurbulence::generateTile(int ix, int iy, int iz) const {
+	GridProperties p = tileProperties;
+	p.origin += Vector3d(ix, iy, iz) * tileSize;
+	GridTurbulence tile(spectrum, p, getTileSeed(ix, iy, iz));
+	return tile.getGrid();
+}
+
+ref_ptr<Grid3f> TiledTurbulence::getTile(int ix, int iy, int iz) const {
+	const int limit = 1 << 20;
+	if ((std::abs(ix) >= limit) or (std::abs(iy) >= limit) or (std::abs(iz) >= limit))
+		throw std::runtime_error("TiledTurbulence: tile index out of range");
+	uint64_t t = tileKey(ix, iy, iz);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto i = cache.find(t);
+		if (i != cache.end()) {
+			recentTiles.splice(recentTiles.begin(), recentTiles, i->second.second);
+			return i->second.first;
+		}
+	}
+
+	// generate without the lock, so that other threads continue with cached tiles
+	ref_ptr<Grid3f> tile = generateTile(ix, iy, iz);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	generated++;
+	auto i = cache.find(t);
+	if (i != cache.end()) // generated by another thread meanwhile
+		return i->second.first;
+	recentTiles.push_front(t);
+	cache[t] = std::make_pair(tile, recentTiles.begin());
+	while (cache.size() > cacheSize) {
+		cache.erase(recentTiles.back());
+		recentTiles.pop_back();
+	}
+	return tile;
+}
+
+Vector3d TiledTurbulence::getField(const Vector3d &pos) const {
+	// offset from the center of the tile (i0, j0, k0)
+	Vector3d r = (pos - tileProperties.origin) / tileSize - Vector3d(0.5);
+	Vector3d r0 = r.floor();
+	Vector3d f = r - r0;
+	int i0 = r0.x, j0 = r0.y, k0 = r0.z;
+
+	double wX[2] = {std::cos(M_PI_2 * f.x), std::sin(M_PI_2 * f.x)};
+	double wY[2] = {std::cos(M_PI_2 * f.y), std::sin(M_PI_2 * f.y)};
+	double wZ[2] = {std::cos(M_PI_2 * f.z), std::sin(M_PI_2 * f.z)};
+
+	Vector3d b(0.);
+	for (int i = 0; i < 2; i++)
+		for (int j = 0; j < 2; j++)
+			for (int k = 0; k < 2; k++) {
+				double w = wX[i] * wY[j] * wZ[k];
+				if (w == 0)
+					continue;
+				b += Vector3d(getTile(i0 + i, j0 + j, k0 + k)->interpolate(pos)) * w;
+			}
+	return b;
+}
+
+void TiledTurbulence::setCacheSize(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t tileBytes = tileProperties.Nx * tileProperties.Ny * tileProperties.Nz * sizeof(Vector3f);
+	cacheSize = std::max(size_t(8), bytes / tileBytes);
+	while (cache.size() > cacheSize) {
+		cache.erase(recentTiles.back());
+		recentTiles.pop_back();
+	}
+}
+
+size_t TiledTurbulence::getCacheSize() const {
+	size_t tileBytes = tileProperties.Nx * tileProperties.Ny * tileProperties.Nz * sizeof(Vector3f);
+	std::lock_guard<std::mutex> lock(mutex);
+	return cacheSize * tileBytes;
+}
+
+size_t TiledTurbulence::getNumberOfCachedTiles() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return cache.size();
+}
+
+uint64_t TiledTurbulence::getNumberOfGeneratedTiles() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return generated;
+}
+
+size_t TiledTurbulence::getSizeOf() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t size = 0;
+	for (auto it = cache.begin(); it != cache.end(); ++it)
+		size += it->second.first->getSizeOf();
+	return size;
+}
+
+Vector3d TiledTurbulence::getTileSize() const {
+	return tileSize;
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_FFTW3F
@@ -0,0 +1,63 @@
+#include "crpropa/magneticLens/GalacticLens.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+GalacticLens::GalacticLens(MagneticLens *lens, Module *output) : output(output) {
+	setLens(lens);
+}
+
+void GalacticLens::setLens(MagneticLens *lens) {
+	if (lens == 0)
+		throw std::runtime_error("GalacticLens: no lens");
+	this->lens = lens;
+}
+
+void GalacticLens::setOutput(Module *output) {
+	this->output = output;
+}
+
+bool GalacticLens::lensCandidate(Candidate *candidate) const {
+	int Z = std::abs(candidate->current.getChargeNumber());
+	if (Z == 0)
+		return true;
+	double rigidity = candidate->current.getEnergy() / Z;
+	if (not lens->rigidityCovered(rigidity))
+		return false;
+	Vector3d direction = candidate->current.getDirection();
+	if (not lens->transformCosmicRay(rigidity, direction))
+		return false;
+	candidate->current.setDirection(direction);
+	return true;
+}
+
+void GalacticLens::process(Candidate *candidate) const {
+	if (lensCandidate(candidate) and output.valid())
+		output->process(candidate);
+}
+
+std::string GalacticLens::getDescription() const {
+	std::stringstream ss;
+	ss << "GalacticLens: rigidities " << lens->getMinimumRigidity() << " - "
+			<< lens->getMaximumRigidity() << " eV";
+	if (output.valid())
+		ss << ", output: " << output->getDescription();
+	return ss.str();
+}
+
+size_t GalacticLens::getSizeOf() const {
+	size_t size = lens->getSizeOf();
+	if (output.valid())
+		size += output->getSizeOf();
+	return size;
+}
+
+void GalacticLens::endRun() {
+	if (output.valid())
+		output->endRun();
+}
+
+} // namespace crpropa
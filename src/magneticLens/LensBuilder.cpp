@@ -0,0 +1,158 @@
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/Candidate.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+
+#include "HepPID/ParticleIDMethods.hh"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace crpropa {
+
+LensBuilder::LensBuilder(ref_ptr<MagneticField> field, int order) :
+		field(field), pixelization(order), observer(-8.5 * kpc, 0, 0),
+		center(0, 0, 0), radius(20 * kpc), maximumTrajectoryLength(200 * kpc),
+		particlesPerPixel(100), particleId(-nucleusId(1, 1)), lost(0) {
+	propagation = new PropagationCK(field, 1e-4, 1 * pc, 100 * pc);
+}
+
+void LensBuilder::setObserverPosition(Vector3d position) {
+	observer = position;
+}
+
+void LensBuilder::setBoundary(Vector3d c, double r) {
+	if (r <= 0)
+		throw std::runtime_error("LensBuilder: radius of the boundary has to be positive");
+	center = c;
+	radius = r;
+}
+
+void LensBuilder::setMaximumTrajectoryLength(double length) {
+	maximumTrajectoryLength = length;
+}
+
+void LensBuilder::setParticlesPerPixel(size_t n) {
+	if (n == 0)
+		throw std::runtime_error("LensBuilder: at least one particle per pixel");
+	particlesPerPixel = n;
+}
+
+void LensBuilder::setParticleId(int id) {
+	particleId = id;
+}
+
+void LensBuilder::setPropagation(ref_ptr<Module> p) {
+	propagation = p;
+}
+
+size_t LensBuilder::getNumberOfLost() const {
+	return lost;
+}
+
+// direction of longitude and latitude as in ParticleMapsContainer
+static Vector3d pixelDirection(double longitude, double latitude) {
+	return Vector3d(cos(longitude) * cos(latitude), sin(longitude) * cos(latitude), sin(latitude));
+}
+
+ModelMatrixType LensBuilder::buildMatrix(double rigidityMin, double rigidityMax) {
+	if (not (rigidityMax > rigidityMin) or (rigidityMin <= 0))
+		throw std::runtime_error("LensBuilder: invalid rigidity range");
+	if ((observer - center).getR() >= radius)
+		throw std::runtime_error("LensBuilder: observer outside of the boundary");
+
+	const double Z = std::abs(HepPID::charge(particleId));
+	if (Z == 0)
+		throw std::runtime_error("LensBuilder: neutral particles are not deflected");
+
+	const uint32_t nPix = pixelization.nPix();
+	const double w = 1. / particlesPerPixel;
+	const double lgMin = log10(rigidityMin * Z), lgMax = log10(rigidityMax * Z);
+	const long long n = (long long) nPix * particlesPerPixel;
+	std::vector<Eigen::Triplet<double> > triplets;
+	size_t nLost = 0;
+
+#pragma omp parallel reduction(+:nLost)
+	{
+		// (arrival pixel, outside pixel) -> weight
+		std::unordered_map<uint64_t, double> elements;
+
+#pragma omp for schedule(dynamic, 64)
+		for (long long k = 0; k < n; k++) {
+			uint32_t row = k / particlesPerPixel;
+			Random &random = Random::instance();
+			double longitude, latitude;
+			pixelization.getRandomDirectionInPixel(row, longitude, latitude);
+			double energy = pow(10, lgMin + (lgMax - lgMin) * random.rand());
+
+			ref_ptr<Candidate> c = new Candidate(particleId, energy, observer,
+					pixelDirection(longitude, latitude));
+			while (true) {
+				propagation->process(c);
+				if ((c->current.getPosition() - center).getR() >= radius)
+					break;
+				if (c->getTrajectoryLength() >= maximumTrajectoryLength)
+					break;
+			}
+			Vector3d p = c->current.getPosition() - center;
+			if (p.getR() < radius) {
+				nLost++;
+				continue;
+			}
+
+			Vector3d d = c->current.getDirection();
+			uint32_t column = pixelization.direction2Pix(atan2(d.y, d.x),
+					M_PI / 2 - acos(d.z / d.getR()));
+			elements[(uint64_t(row) << 32) | column] += w;
+		}
+
+#pragma omp critical(LensBuilder)
+		{
+			for (std::unordered_map<uint64_t, double>::const_iterator i = elements.begin(); i != elements.end(); ++i)
+				triplets.push_back(Eigen::Triplet<double>(i->first >> 32, i->first & 0xffffffff, i->second));
+		}
+	}
+
+	lost = nLost;
+	ModelMatrixType M(nPix, nPix);
+	M.setFromTriplets(triplets.begin(), triplets.end());
+	M.makeCompressed();
+	return M;
+}
+
+void LensBuilder::buildLens(const std::string &filename,
+		const std::vector<double> &log10RigidityEdges) {
+	if (log10RigidityEdges.size() < 2)
+		throw std::runtime_error("LensBuilder: at least two edges of rigidity bins");
+
+	std::string prefix, name = filename;
+	size_t sp = filename.find_last_of("/");
+	if (sp != std::string::npos) {
+		prefix = filename.substr(0, sp + 1);
+		name = filename.substr(sp + 1);
+	}
+
+	std::ofstream outfile(filename.c_str());
+	if (not outfile)
+		throw std::runtime_error("LensBuilder: cannot create file " + filename);
+	outfile << "# CRPropa magnetic lens, built by backtracking\n";
+	outfile << "# file log10(rigidityMin / eV) log10(rigidityMax / eV)\n";
+	outfile.precision(17);
+	for (size_t i = 0; i + 1 < log10RigidityEdges.size(); i++) {
+		double lgMin = log10RigidityEdges[i], lgMax = log10RigidityEdges[i + 1];
+		ModelMatrixType M = buildMatrix(pow(10, lgMin) * eV, pow(10, lgMax) * eV);
+		std::stringstream partname;
+		partname << name << "_" << i << ".mldat";
+		serialize(prefix + partname.str(), M);
+		outfile << partname.str() << " " << lgMin << " " << lgMax << "\n";
+	}
+	if (not outfile)
+		throw std::runtime_error("LensBuilder: error writing file " + filename);
+}
+
+} // namespace crpropa
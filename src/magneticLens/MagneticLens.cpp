@@ -22,15 +22,353 @@
 
 #include "crpropa/magneticLens/MagneticLens.h"
 
+#include "crpropa/Common.h"
 #include "crpropa/Random.h"
 #include "crpropa/Units.h"
 
+#include "kiss/logger.h"
+
 // needed for memcpy in gcc 4.3.2
 #include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa 
 {
 
+// layout of the compact lens files: header, column offsets (columns + 1),
+// rows of the entries, padding to 8 bytes, cumulative sums of the columns
+struct CompactLensHeader
+{
+	char magic[8];
+	uint64_t rows;
+	uint64_t columns;
+	uint64_t nonZeros;
+};
+
+static const char compactLensMagic[8] = {'C', 'R', 'P', 'L', 'E', 'N', 'S', '1'};
+
+static size_t compactPixelsSize(uint64_t nonZeros)
+{
+	return (nonZeros * sizeof(uint32_t) + 7) / 8 * 8;
+}
+
+LensPart::LensPart() :
+		_rigidityMin(0), _rigidityMax(0), _maximumSumOfColumns(0),
+		_maximumSumOfColumns_calculated(false), _loaded(false), _mapping(NULL),
+		_mappingSize(0), _nColumns(0), _offsets(NULL), _pixels(NULL), _cdf(NULL),
+		_scale(1), _columnsNormalized(false)
+{
+}
+
+LensPart::LensPart(const std::string &filename, double rigidityMin,
+		double rigidityMax) :
+		_filename(filename), _rigidityMin(rigidityMin), _rigidityMax(rigidityMax),
+		_maximumSumOfColumns(0), _maximumSumOfColumns_calculated(false),
+		_loaded(false), _mapping(NULL), _mappingSize(0), _nColumns(0),
+		_offsets(NULL), _pixels(NULL), _cdf(NULL), _scale(1),
+		_columnsNormalized(false)
+{
+}
+
+LensPart::~LensPart()
+{
+	unmap();
+}
+
+void LensPart::unmap()
+{
+	if (_mapping)
+		munmap(_mapping, _mappingSize);
+	_mapping = NULL;
+	_mappingSize = 0;
+	_offsets = NULL;
+	_pixels = NULL;
+	_cdf = NULL;
+	_scale = 1;
+	_columnsNormalized = false;
+}
+
+bool LensPart::isCompactFile(const std::string &filename)
+{
+	ifstream infile(filename.c_str(), ios::binary);
+	char magic[8];
+	infile.read(magic, 8);
+	return infile && (memcmp(magic, compactLensMagic, 8) == 0);
+}
+
+void LensPart::readSize(uint32_t &rows, uint32_t &columns) const
+{
+	ifstream infile(_filename.c_str(), ios::binary);
+	if (!infile)
+		throw std::runtime_error("Can't read file: " + _filename);
+	if (isCompactFile(_filename))
+	{
+		CompactLensHeader header;
+		infile.read((char*) &header, sizeof(header));
+		rows = header.rows;
+		columns = header.columns;
+	}
+	else
+	{
+		uint32_t nnz;
+		infile.read((char*) &nnz, sizeof(uint32_t));
+		infile.read((char*) &rows, sizeof(uint32_t));
+		infile.read((char*) &columns, sizeof(uint32_t));
+	}
+	if (!infile)
+		throw std::runtime_error("Can't read header of file: " + _filename);
+}
+
+bool LensPart::mapCompact()
+{
+	int fd = open(_filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t) sizeof(CompactLensHeader))
+	{
+		close(fd);
+		return false;
+	}
+	size_t size = fileStat.st_size;
+	void *p = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+
+	const CompactLensHeader *header = (const CompactLensHeader *) p;
+	if ((memcmp(header->magic, compactLensMagic, 8) != 0)
+			|| (size != sizeof(CompactLensHeader)
+					+ (header->columns + 1) * sizeof(uint64_t)
+					+ compactPixelsSize(header->nonZeros)
+					+ header->nonZeros * sizeof(double)))
+	{
+		munmap(p, size);
+		return false;
+	}
+
+	_mapping = p;
+	_mappingSize = size;
+	_nColumns = header->columns;
+	_offsets = (const uint64_t *) ((const char *) p + sizeof(CompactLensHeader));
+	_pixels = (const uint32_t *) (_offsets + _nColumns + 1);
+	_cdf = (const double *) ((const char *) _pixels + compactPixelsSize(header->nonZeros));
+	M.resize(0, 0);
+	return true;
+}
+
+void LensPart::loadMatrixFromFile()
+{
+	unmap();
+	if (isCompactFile(_filename))
+	{
+		if (!mapCompact())
+			throw std::runtime_error("Can't map file: " + _filename);
+	}
+	else
+	{
+		deserialize(_filename, M);
+		updateColumnCdfs();
+	}
+	_maximumSumOfColumns_calculated = false;
+	_loaded = true;
+}
+
+void LensPart::saveCompact(const std::string &filename)
+{
+	load();
+	ofstream outfile(filename.c_str(), ios::binary);
+	if (!outfile)
+		throw runtime_error("Can't write file: " + filename);
+
+	uint64_t nonZeros = _offsets[_nColumns];
+	CompactLensHeader header;
+	memcpy(header.magic, compactLensMagic, 8);
+	header.rows = _nColumns;
+	header.columns = _nColumns;
+	header.nonZeros = nonZeros;
+	outfile.write((char*) &header, sizeof(header));
+	outfile.write((char*) _offsets, (_nColumns + 1) * sizeof(uint64_t));
+	outfile.write((char*) _pixels, nonZeros * sizeof(uint32_t));
+	const char padding[8] = {0};
+	outfile.write(padding, compactPixelsSize(nonZeros) - nonZeros * sizeof(uint32_t));
+	for (uint32_t c = 0; c < _nColumns; c++)
+	{
+		double f = columnFactor(c);
+		for (uint64_t i = _offsets[c]; i < _offsets[c + 1]; i++)
+		{
+			double v = _cdf[i] * f;
+			outfile.write((char*) &v, sizeof(double));
+		}
+	}
+	if (!outfile)
+		throw runtime_error("Error writing file: " + filename);
+}
+
+double LensPart::columnFactor(uint32_t column) const
+{
+	if (!_columnsNormalized)
+		return _scale;
+	uint64_t end = _offsets[column + 1];
+	if (end == _offsets[column])
+		return 0;
+	return _scale / _cdf[end - 1];
+}
+
+void LensPart::materialize()
+{
+	std::vector< Eigen::Triplet<double> > triplets;
+	triplets.reserve(_offsets[_nColumns]);
+	for (uint32_t c = 0; c < _nColumns; c++)
+	{
+		double f = columnFactor(c);
+		double previous = 0;
+		for (uint64_t i = _offsets[c]; i < _offsets[c + 1]; i++)
+		{
+			triplets.push_back(Eigen::Triplet<double>(_pixels[i], c, (_cdf[i] - previous) * f));
+			previous = _cdf[i];
+		}
+	}
+	M.resize(_nColumns, _nColumns);
+	M.setFromTriplets(triplets.begin(), triplets.end());
+	M.makeCompressed();
+	unmap();
+	updateColumnCdfs();
+}
+
+ModelMatrixType& LensPart::getMatrix()
+{
+	load();
+	if (isMapped())
+	{
+#pragma omp critical(LensPartLoad)
+		{
+			if (isMapped())
+				materialize();
+		}
+	}
+	return M;
+}
+
+void LensPart::setMatrix(const ModelMatrixType& m)
+{
+	unmap();
+	M = m;
+	updateColumnCdfs();
+	_maximumSumOfColumns_calculated = false;
+	_loaded = true;
+}
+
+double LensPart::getMaximumOfSumsOfColumns()
+{
+	if (!_maximumSumOfColumns_calculated)
+	{ // lazy calculation of maximum
+		load();
+		if (isMapped())
+		{
+			_maximumSumOfColumns = 0;
+			for (uint32_t c = 0; c < _nColumns; c++)
+			{
+				if (_offsets[c + 1] > _offsets[c])
+					_maximumSumOfColumns = std::max(_maximumSumOfColumns,
+							_cdf[_offsets[c + 1] - 1] * columnFactor(c));
+			}
+		}
+		else
+			_maximumSumOfColumns = maximumOfSumsOfColumns(M);
+		_maximumSumOfColumns_calculated = true;
+	}
+	return _maximumSumOfColumns;
+}
+
+void LensPart::normalize(double norm)
+{
+	load();
+	if (isMapped())
+		_scale /= norm;
+	else
+	{
+		normalizeMatrix(M, norm);
+		updateColumnCdfs();
+	}
+	_maximumSumOfColumns_calculated = false;
+}
+
+void LensPart::normalizeColumns()
+{
+	load();
+	if (isMapped())
+	{
+		_scale = 1;
+		_columnsNormalized = true;
+	}
+	else
+	{
+		crpropa::normalizeColumns(M);
+		updateColumnCdfs();
+	}
+	_maximumSumOfColumns_calculated = false;
+}
+
+void LensPart::updateColumnCdfs()
+{
+	_cdfOffsets.assign(M.cols() + 1, 0);
+	_cdfValues.clear();
+	_cdfPixels.clear();
+	_cdfValues.reserve(M.nonZeros());
+	_cdfPixels.reserve(M.nonZeros());
+	for (int c = 0; c < M.outerSize(); c++)
+	{
+		double cpv = 0;
+		for (ModelMatrixType::InnerIterator i(M, c); i; ++i)
+		{
+			if (i.value() <= 0)
+				continue;
+			cpv += i.value();
+			_cdfValues.push_back(cpv);
+			_cdfPixels.push_back(i.index());
+		}
+		_cdfOffsets[c + 1] = _cdfValues.size();
+	}
+	_nColumns = M.cols();
+	_offsets = _cdfOffsets.data();
+	_pixels = _cdfPixels.data();
+	_cdf = _cdfValues.data();
+}
+
+bool LensPart::drawPixel(uint32_t column, double rn, uint32_t &pixel) const
+{
+	double f = columnFactor(column);
+	if (f <= 0)
+		return false;
+	const double *begin = _cdf + _offsets[column];
+	const double *end = _cdf + _offsets[column + 1];
+	// first entry with rn < cumulative sum
+	const double *i = std::upper_bound(begin, end, rn / f);
+	if (i == end)
+		return false;
+	pixel = _pixels[i - _cdf];
+	return true;
+}
+
+size_t LensPart::getSizeOf() const
+{
+	size_t size = _mappingSize + vectorSizeOf(_cdfOffsets) + vectorSizeOf(_cdfValues)
+			+ vectorSizeOf(_cdfPixels);
+	size += M.nonZeros() * (sizeof(double) + sizeof(ModelMatrixType::StorageIndex))
+			+ (M.outerSize() + 1) * sizeof(ModelMatrixType::StorageIndex);
+	return size;
+}
+
 void MagneticLens::loadLens(const string &filename)
 {
 	ifstream infile(filename.c_str());
@@ -80,34 +418,58 @@ bool MagneticLens::transformCosmicRay(double rigidity, double& phi,
 	LensPart *lenspart = getLensPart(rigidity);
 	if (!lenspart)
 	{
-		std::cerr << "Warning. Trying to transform cosmic ray with rigidity " << rigidity / eV << " eV which is not covered by this lens!.\n";
-		std::cerr << " This lens covers the range " << _minimumRigidity /eV << " eV - " << _maximumRigidity << " eV.\n";
+		KISS_LOG_WARNING << "MagneticLens: Trying to transform cosmic ray with rigidity " << rigidity / eV
+				<< " eV which is not covered by this lens. This lens covers the range "
+				<< _minimumRigidity / eV << " eV - " << _maximumRigidity / eV << " eV.";
 		return false;
 	}
 
-	ModelVectorType v = lenspart->getMatrix().col(c);
-
-	uint32_t r;
-
 	// the random number to compare with
 	double rn = Random::instance().rand();
 
-	ModelVectorType::InnerIterator i(v);
-  double cpv = 0;
-  while (i)
-  {
-		cpv += i.value();
-		if (rn < cpv)
+	uint32_t r;
+	if (!lenspart->drawPixel(c, rn, r))
+		return false;
+	_pixelization->pix2Direction(r, phi, theta);
+	return true;
+}
+
+std::vector<int> MagneticLens::transformCosmicRays(
+		const std::vector<double> &rigidities, std::vector<double> &phis,
+		std::vector<double> &thetas)
+{
+	const size_t n = rigidities.size();
+	if ((phis.size() != n) || (thetas.size() != n))
+		throw std::runtime_error("MagneticLens: rigidities, phis and thetas of different size");
+
+	std::vector<int> accepted(n, 0);
+	size_t notCovered = 0;
+#pragma omp parallel for schedule(static) reduction(+:notCovered)
+	for (long long k = 0; k < (long long)n; k++)
+	{
+		const LensPart *lenspart = getLensPart(rigidities[k]);
+		if (!lenspart)
 		{
-			_pixelization->pix2Direction(i.index(), phi, theta);
-			return true;
-    }
-    else
-    {
-			++i;
-    }
-   }
-  return false;
+			notCovered++;
+			continue;
+		}
+		uint32_t c = _pixelization->direction2Pix(phis[k], thetas[k]);
+		double rn = Random::instance().rand();
+		uint32_t r;
+		if (lenspart->drawPixel(c, rn, r))
+		{
+			_pixelization->pix2Direction(r, phis[k], thetas[k]);
+			accepted[k] = 1;
+		}
+	}
+
+	if (notCovered > 0)
+	{
+		KISS_LOG_WARNING << "MagneticLens: " << notCovered
+				<< " cosmic rays with rigidities not covered by this lens. This lens covers the range "
+				<< _minimumRigidity / eV << " eV - " << _maximumRigidity / eV << " eV.";
+	}
+	return accepted;
 }
 
 bool MagneticLens::transformCosmicRay(double rigidity, Vector3d &p){
@@ -128,33 +490,48 @@ void MagneticLens::loadLensPart(const string &filename, double rigidityMin,
 {
 	updateRigidityBounds(rigidityMin, rigidityMax);
 
+	// only the size is checked, the matrix is loaded on first use
 	LensPart *p = new LensPart(filename, rigidityMin, rigidityMax);
-	p->loadMatrixFromFile();
-	_checkMatrix(p->getMatrix());
+	uint32_t rows, columns;
+	try
+	{
+		p->readSize(rows, columns);
+		_checkSize(rows, columns);
+	}
+	catch (...)
+	{
+		delete p;
+		throw;
+	}
 
 	_lensParts.push_back(p);
 }
 
 void MagneticLens::_checkMatrix(const ModelMatrixType &M)
 {
-	if (M.rows() != M.cols())
+	_checkSize(M.rows(), M.cols());
+}
+
+void MagneticLens::_checkSize(uint32_t rows, uint32_t columns)
+{
+	if (rows != columns)
 	{
 		throw std::runtime_error("Not a square Matrix!");
 	}
 
 	if (_pixelization)
 	{
-		if (_pixelization->nPix() != M.cols())
+		if (_pixelization->nPix() != columns)
 		{
 			std::cerr << "*** ERROR ***" << endl;
 			std::cerr << "  Pixelization: " << _pixelization->nPix() << endl;
-			std::cerr << "  Matrix Size : " << M.cols() << endl;
+			std::cerr << "  Matrix Size : " << columns << endl;
 			throw std::runtime_error("Matrix doesn't fit into Lense");
 		}
 	}
 	else
 	{
-		uint32_t morder = Pixelization::pix2Order(M.cols());
+		uint32_t morder = Pixelization::pix2Order(columns);
 		if (morder == 0)
 		{
 			throw std::runtime_error(
@@ -189,11 +566,19 @@ void MagneticLens::setLensPart(const ModelMatrixType &M, double rigidityMin,
 
 	p->setMatrix(M);
 
-	_checkMatrix(p->getMatrix());
+	try
+	{
+		_checkMatrix(p->getMatrix());
+	}
+	catch (...)
+	{
+		delete p;
+		throw;
+	}
 	_lensParts.push_back(p);
 }
 
-LensPart* MagneticLens::getLensPart(double rigidity) const
+LensPart* MagneticLens::findLensPart(double rigidity) const
 {
 	const_LensPartIter i = _lensParts.begin();
 	while (i != _lensParts.end())
@@ -208,9 +593,25 @@ LensPart* MagneticLens::getLensPart(double rigidity) const
 	return NULL;
 }
 
+LensPart* MagneticLens::getLensPart(double rigidity) const
+{
+	LensPart *p = findLensPart(rigidity);
+	if (p)
+		p->load();
+	return p;
+}
+
+size_t MagneticLens::getSizeOf() const
+{
+	size_t size = vectorSizeOf(_lensParts);
+	for (size_t i = 0; i < _lensParts.size(); i++)
+		size += sizeof(LensPart) + _lensParts[i]->getSizeOf();
+	return size;
+}
+
 bool MagneticLens::rigidityCovered(double rigidity) const
 {
-	if (getLensPart(rigidity))
+	if (findLensPart(rigidity))
 		return true;
 	else
 		return false;
@@ -222,7 +623,7 @@ void MagneticLens::normalizeMatrixColumns()
 	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
 			++iter)
 	{
-		normalizeColumns((*iter)->getMatrix());
+		(*iter)->normalizeColumns();
 	}
 }
 
@@ -242,7 +643,7 @@ void MagneticLens::normalizeLens()
 	for (LensPartIter iter = _lensParts.begin(); iter != _lensParts.end();
 			++iter)
 	{
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalize(norm);
 	}
   _norm = norm;
 }
@@ -253,8 +654,39 @@ void MagneticLens::normalizeLensparts()
 			++iter)
 	{
 		double norm = (*iter)->getMaximumOfSumsOfColumns();
-		normalizeMatrix((*iter)->getMatrix(), norm);
+		(*iter)->normalize(norm);
+	}
+}
+
+void MagneticLens::saveCompact(const string &filename)
+{
+	string prefix, name = filename;
+	size_t sp = filename.find_last_of("/");
+	if (sp != string::npos)
+	{
+		prefix = filename.substr(0, sp + 1);
+		name = filename.substr(sp + 1);
+	}
+
+	ofstream outfile(filename.c_str());
+	if (!outfile)
+	{
+		throw std::runtime_error("Can't write file: " + filename);
+	}
+	outfile << "# CRPropa magnetic lens, parts in the compact format\n";
+	outfile << "# file log10(rigidityMin / eV) log10(rigidityMax / eV)\n";
+	outfile.precision(17);
+	for (size_t i = 0; i < _lensParts.size(); i++)
+	{
+		stringstream partname;
+		partname << name << "_" << i << ".mlcmp";
+		_lensParts[i]->saveCompact(prefix + partname.str());
+		outfile << partname.str() << " "
+				<< log10(_lensParts[i]->getMinimumRigidity()) << " "
+				<< log10(_lensParts[i]->getMaximumRigidity()) << "\n";
 	}
+	if (!outfile)
+		throw std::runtime_error("Error writing file: " + filename);
 }
 
 void MagneticLens::transformModelVector(double* model, double rigidity) const
@@ -263,7 +695,8 @@ void MagneticLens::transformModelVector(double* model, double rigidity) const
 	
 	if (!lenspart)
 	{
-		std::cerr << "Warning. Trying to transform vector with rigidity " << rigidity / eV << "eV which is not covered by this lens!.\n" << std::endl;
+		KISS_LOG_WARNING << "MagneticLens: Trying to transform vector with rigidity " << rigidity / eV
+				<< " eV which is not covered by this lens.";
 		return;
 	}
 
@@ -3,19 +3,14 @@
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
 
 namespace crpropa  {
 
 ParticleMapsContainer::~ParticleMapsContainer() {
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-			delete[] (energy_iter->second);
-		}
-	}
 }
 
 int ParticleMapsContainer::energy2Idx(double energy) const {
@@ -27,37 +22,45 @@ double ParticleMapsContainer::idx2Energy(int idx) const {
 	return pow(10, idx * _deltaLogE + _bin0lowerEdge + _deltaLogE / 2) * eV;
 }
 
+int64_t ParticleMapsContainer::mapKey(int pid, int energyIdx) {
+	return (int64_t(pid) << 32) | uint32_t(energyIdx);
+}
+
+long ParticleMapsContainer::findMap(int pid, int energyIdx) const {
+	std::unordered_map<int64_t, size_t>::const_iterator i = _mapIndex.find(mapKey(pid, energyIdx));
+	if (i == _mapIndex.end())
+		return -1;
+	return i->second;
+}
+
+size_t ParticleMapsContainer::addMap(int pid, int energyIdx) {
+	std::pair<std::unordered_map<int64_t, size_t>::iterator, bool> i =
+		_mapIndex.insert(std::make_pair(mapKey(pid, energyIdx), _mapIds.size()));
+	if (i.second) {
+		_mapIds.push_back(pid);
+		_mapEnergyIdx.push_back(energyIdx);
+		_data.resize(_data.size() + _pixelization.getNumberOfPixels(), 0);
+	}
+	return i.first->second;
+}
+
 		
 double* ParticleMapsContainer::getMap(const int particleId, double energy) {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end()) {
-		std::cerr << "No map for ParticleID " << particleId << std::endl;
-		return NULL;
-	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end()) {
-		std::cerr << "No map for ParticleID and energy" << energy / eV << " eV" << std::endl;
+	long i = findMap(particleId, energy2Idx(energy));
+	if (i < 0) {
+		std::cerr << "No map for ParticleID " << particleId << " and energy " << energy / eV << " eV" << std::endl;
 		return NULL;
 	}
-	return _data[particleId][energy2Idx(energy)];
+	return &_data[i * _pixelization.getNumberOfPixels()];
 }
 			
 			
 void ParticleMapsContainer::addParticle(const int particleId, double energy, double galacticLongitude, double galacticLatitude, double weight) {
 	_weightsUpToDate = false;
-	if (_data.find(particleId) == _data.end()) {
-		map<int, double*> M;
-		_data[particleId] = M;
-	}
-
-	int energyIdx	= energy2Idx(energy);
-	if (_data[particleId].find(energyIdx) == _data[particleId].end()) {
-		_data[particleId][energyIdx] = new double[_pixelization.getNumberOfPixels()];
-		std::fill(_data[particleId][energyIdx], _data[particleId][energyIdx] + _pixelization.getNumberOfPixels(), 0);
-	}
-
+	size_t i = addMap(particleId, energy2Idx(energy));
 	uint32_t pixel = _pixelization.direction2Pix(galacticLongitude, galacticLatitude);
-	_data[particleId][energyIdx][pixel] += weight;
+	_data[i * _pixelization.getNumberOfPixels() + pixel] += weight;
 }
 
 
@@ -68,24 +71,70 @@ void ParticleMapsContainer::addParticle(const int particleId, double energy, con
 }
 
 
-std::vector<int> ParticleMapsContainer::getParticleIds() {
-	std::vector<int> ids;
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		ids.push_back(pid_iter->first);
+void ParticleMapsContainer::addParticles(const std::vector<int> &particleIds,
+	const std::vector<double> &energies,
+	const std::vector<double> &galacticLongitudes,
+	const std::vector<double> &galacticLatitudes,
+	const std::vector<double> &weights) {
+	const size_t n = particleIds.size();
+	if ((energies.size() != n) || (galacticLongitudes.size() != n)
+			|| (galacticLatitudes.size() != n) || (weights.size() != n))
+		throw std::runtime_error("ParticleMapsContainer: arrays of different size");
+	_weightsUpToDate = false;
+
+	// the pixels are the expensive part
+	std::vector<uint32_t> pixels;
+	_pixelization.direction2Pix(galacticLongitudes, galacticLatitudes, pixels);
+
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	int lastId = 0, lastEnergyIdx = 0;
+	size_t i = 0;
+	for (size_t k = 0; k < n; k++) {
+		int energyIdx = energy2Idx(energies[k]);
+		if ((k == 0) || (particleIds[k] != lastId) || (energyIdx != lastEnergyIdx)) {
+			i = addMap(particleIds[k], energyIdx);
+			lastId = particleIds[k];
+			lastEnergyIdx = energyIdx;
+		}
+		_data[i * nPix + pixels[k]] += weights[k];
+	}
+}
+
+
+void ParticleMapsContainer::merge(const ParticleMapsContainer &other) {
+	if ((other._deltaLogE != _deltaLogE) || (other._bin0lowerEdge != _bin0lowerEdge))
+		throw std::runtime_error("ParticleMapsContainer: merge of containers with different energy bins");
+	_weightsUpToDate = false;
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	for (size_t j = 0; j < other._mapIds.size(); j++) {
+		size_t i = addMap(other._mapIds[j], other._mapEnergyIdx[j]);
+		const double *src = &other._data[j * nPix];
+		double *dst = &_data[i * nPix];
+		for (size_t p = 0; p < nPix; p++)
+			dst[p] += src[p];
 	}
+}
+
+
+std::vector<int> ParticleMapsContainer::getParticleIds() {
+	std::vector<int> ids(_mapIds);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
 	return ids;
 }
 
 
 std::vector<double> ParticleMapsContainer::getEnergies(int pid) {
-	std::vector<double> energies;
-	if (_data.find(pid) != _data.end()) {
-		for(std::map<int, double*>::iterator iter = _data[pid].begin(); 
-			iter != _data[pid].end(); ++iter) {
-			energies.push_back( idx2Energy(iter->first) / eV );
-		}
+	std::vector<int> indices;
+	for (size_t i = 0; i < _mapIds.size(); i++) {
+		if (_mapIds[i] == pid)
+			indices.push_back(_mapEnergyIdx[i]);
 	}
+	std::sort(indices.begin(), indices.end());
+
+	std::vector<double> energies;
+	for (size_t i = 0; i < indices.size(); i++)
+		energies.push_back( idx2Energy(indices[i]) / eV );
 	return energies;
 }
 
@@ -94,19 +143,17 @@ void ParticleMapsContainer::applyLens(MagneticLens &lens) {
 	// if lens is normalized, this should not be necessary.
 	_weightsUpToDate = false;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter) {
-			// transform only nuclei
-			double energy = idx2Energy(energy_iter->first);
-			int chargeNumber = HepPID::Z(pid_iter->first);
-			if (chargeNumber != 0 && lens.rigidityCovered(energy / chargeNumber)) {
-				lens.transformModelVector(energy_iter->second, energy / chargeNumber);
-			} else { // still normalize the vectors 
-				for(size_t j=0; j< _pixelization.getNumberOfPixels() ; j++) {
-					energy_iter->second[j] /= lens.getNorm();
-				}
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	for (size_t i = 0; i < _mapIds.size(); i++) {
+		double *map = &_data[i * nPix];
+		// transform only nuclei
+		double energy = idx2Energy(_mapEnergyIdx[i]);
+		int chargeNumber = HepPID::Z(_mapIds[i]);
+		if (chargeNumber != 0 && lens.rigidityCovered(energy / chargeNumber)) {
+			lens.transformModelVector(map, energy / chargeNumber);
+		} else { // still normalize the vectors 
+			for(size_t j=0; j< nPix ; j++) {
+				map[j] /= lens.getNorm();
 			}
 		}
 	}
@@ -117,21 +164,23 @@ void ParticleMapsContainer::_updateWeights() {
 	if (_weightsUpToDate)
 		return;
 
-	for(std::map<int, std::map<int, double*> >::iterator pid_iter = _data.begin(); 
-			pid_iter != _data.end(); ++pid_iter) {
-		_weightsPID[pid_iter->first] = 0;
-
-		for(std::map<int, double*>::iterator energy_iter = pid_iter->second.begin();
-			energy_iter != pid_iter->second.end(); ++energy_iter)  {
-
-			_weights_pidEnergy[pid_iter->first][energy_iter->first] = 0;
-			for(size_t j = 0; j< _pixelization.getNumberOfPixels() ; j++) {
-				_weights_pidEnergy[pid_iter->first][energy_iter->first] +=energy_iter->second[j];
-				_weightsPID[pid_iter->first]+=energy_iter->second[j];
-			}
-			_sumOfWeights+=_weights_pidEnergy[pid_iter->first][energy_iter->first];
+	const size_t nPix = _pixelization.getNumberOfPixels();
+	_mapWeights.assign(_mapIds.size(), 0);
+	_pixelSampler.clear();
+	std::vector<double> cdf(nPix);
+	for (size_t i = 0; i < _mapIds.size(); i++) {
+		const double *map = &_data[i * nPix];
+		double sum = 0;
+		for (size_t j = 0; j < nPix; j++) {
+			sum += map[j];
+			cdf[j] = sum;
 		}
+		_mapWeights[i] = sum;
+		_pixelSampler.addCDF(cdf);
 	}
+	_mapSampler.setWeights(_mapWeights);
+	_mapSampler.prepare();
+	_sumOfWeights = _mapSampler.getTotalWeight();
 	_weightsUpToDate = true;
 }
 
@@ -145,25 +194,17 @@ void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId
 	energy.resize(N);
 	galacticLongitudes.resize(N);
 	galacticLatitudes.resize(N);
+	if (_mapIds.empty())
+		return;
 
-	for(size_t i=0; i< N; i++) {
-		//get particle
-		double r = Random::instance().rand() * _sumOfWeights;
-		std::map<int, double>::iterator iter = _weightsPID.begin();
-		while ((r-= iter->second) > 0) {
-			++iter; 
-		}
-		particleId[i] = iter->first;
-	
-		//get energy
-		r = Random::instance().rand() * iter->second;
-		iter = _weights_pidEnergy[particleId[i]].begin();
-		while ((r-= iter->second) > 0) {
-		 ++iter; 
-		}
-		energy[i] = idx2Energy(iter->first) / eV;
-
-		placeOnMap(particleId[i], energy[i] * eV, galacticLongitudes[i], galacticLatitudes[i]);
+#pragma omp parallel for schedule(static)
+	for (long long k = 0; k < (long long)N; k++) {
+		Random &random = Random::instance();
+		size_t i = _mapSampler.draw(random);
+		particleId[k] = _mapIds[i];
+		energy[k] = idx2Energy(_mapEnergyIdx[i]) / eV;
+		uint32_t pixel = _pixelSampler.draw(i, random);
+		_pixelization.getRandomDirectionInPixel(pixel, galacticLongitudes[k], galacticLatitudes[k]);
 	}
 }
 
@@ -171,24 +212,14 @@ void ParticleMapsContainer::getRandomParticles(size_t N, vector<int> &particleId
 bool ParticleMapsContainer::placeOnMap(int pid, double energy, double &galacticLongitude, double &galacticLatitude) {
 	_updateWeights();
 
-	if (_data.find(pid) == _data.end()) {
+	long i = findMap(pid, energy2Idx(energy));
+	if ((i < 0) || (_mapWeights[i] <= 0)) {
 		return false;
 	}
-	int energyIdx	= energy2Idx(energy);
-	if (_data[pid].find(energyIdx) == _data[pid].end()) {
-		return false;
-	}
-
-	double r = Random::instance().rand() * _weights_pidEnergy[pid][energyIdx];
 
-	for(size_t j = 0; j< _pixelization.getNumberOfPixels(); j++) {
-		r -= _data[pid][energyIdx][j];
-		if (r <= 0) {
-			_pixelization.getRandomDirectionInPixel(j, galacticLongitude, galacticLatitude);
-			return true;
-		}
-	}
-	return false;
+	uint32_t pixel = _pixelSampler.draw(i, Random::instance());
+	_pixelization.getRandomDirectionInPixel(pixel, galacticLongitude, galacticLatitude);
+	return true;
 }
 
 
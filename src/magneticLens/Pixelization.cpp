@@ -23,11 +23,35 @@
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/Random.h"
 
+#include <stdexcept>
+
 namespace crpropa 
 {
 
 	healpix::T_Healpix_Base<healpix::int64> Pixelization::_healpix_nest = healpix::T_Healpix_Base<healpix::int64>(29, healpix::NEST);
 
+std::vector<double> Pixelization::_centerTables[_nOrder_centerTable + 1];
+
+void Pixelization::initCenters()
+{
+	_centers = NULL;
+	uint8_t order = _healpix->Order();
+	if (order > _nOrder_centerTable)
+		return;
+#pragma omp critical(Pixelization)
+	{
+		std::vector<double> &table = _centerTables[order];
+		if (table.empty())
+		{
+			std::vector<double> centers(2 * nPix());
+			for (uint32_t i = 0; i < nPix(); i++)
+				vec2SphereCo(centers[2 * i], centers[2 * i + 1], _healpix->pix2vec(i));
+			table.swap(centers);
+		}
+		_centers = &table[0];
+	}
+}
+
 
 uint8_t Pixelization::pix2Order(uint32_t pix)
 {
@@ -53,6 +77,12 @@ uint32_t Pixelization::nPix(uint8_t order)
 
 uint32_t Pixelization::direction2Pix(double longitude, double latitude) const
 {
+	// away from the poles the pixel follows from z and phi directly, as in
+	// vec2pix but without the conversion to a vector and back
+	double z = sin(latitude);
+	if (std::abs(z) <= 0.99)
+		return (uint32_t) _healpix->zphi2pix(z, longitude);
+
 	healpix::vec3 v;
 	spherCo2Vec(longitude, latitude, v);
 	try
@@ -70,9 +100,40 @@ uint32_t Pixelization::direction2Pix(double longitude, double latitude) const
 	}
 }
 
+void Pixelization::direction2Pix(const std::vector<double> &longitudes,
+		const std::vector<double> &latitudes, std::vector<uint32_t> &pixels) const
+{
+	const size_t n = longitudes.size();
+	if (latitudes.size() != n)
+		throw std::runtime_error("Pixelization: longitudes and latitudes of different size");
+	pixels.resize(n);
+	bool failed = false;
+#pragma omp parallel for schedule(static)
+	for (long long k = 0; k < (long long)n; k++)
+	{
+		try
+		{
+			pixels[k] = direction2Pix(longitudes[k], latitudes[k]);
+		}
+		catch (healpix::PlanckError &e)
+		{
+			failed = true;
+		}
+	}
+	if (failed)
+		throw std::runtime_error("Pixelization: invalid direction in direction2Pix");
+}
+
 void Pixelization::pix2Direction(uint32_t i, double &longitude,
 		double &latitude) const
 {
+	if (_centers && i < nPix())
+	{
+		longitude = _centers[2 * i];
+		latitude = _centers[2 * i + 1];
+		return;
+	}
+
 	healpix::vec3 v;
 	try{
 		v = _healpix->pix2vec(i);
@@ -88,6 +149,29 @@ void Pixelization::pix2Direction(uint32_t i, double &longitude,
 	vec2SphereCo(longitude, latitude, v);
 }
 
+void Pixelization::pix2Direction(const std::vector<uint32_t> &pixels,
+		std::vector<double> &longitudes, std::vector<double> &latitudes) const
+{
+	const size_t n = pixels.size();
+	longitudes.resize(n);
+	latitudes.resize(n);
+	bool failed = false;
+#pragma omp parallel for schedule(static)
+	for (long long k = 0; k < (long long)n; k++)
+	{
+		try
+		{
+			pix2Direction(pixels[k], longitudes[k], latitudes[k]);
+		}
+		catch (healpix::PlanckError &e)
+		{
+			failed = true;
+		}
+	}
+	if (failed)
+		throw std::runtime_error("Pixelization: invalid pixel in pix2Direction");
+}
+
 void Pixelization::spherCo2Vec(double phi, double theta,
 		healpix::vec3 &V) const
 {
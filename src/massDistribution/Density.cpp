@@ -0,0 +1,29 @@
+#include "crpropa/massDistribution/Density.h"
+
+namespace crpropa {
+
+void Density::getDensities(const Vector3d *positions, double *densities,
+		size_t n, DensityType type) const {
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (long i = 0; i < long(n); i++) {
+		const Vector3d &p = positions[i];
+		switch (type) {
+		case HIDensity:
+			densities[i] = getHIDensity(p);
+			break;
+		case HIIDensity:
+			densities[i] = getHIIDensity(p);
+			break;
+		case H2Density:
+			densities[i] = getH2Density(p);
+			break;
+		case NucleonDensity:
+			densities[i] = getNucleonDensity(p);
+			break;
+		default:
+			densities[i] = getDensity(p);
+		}
+	}
+}
+
+}  // namespace crpropa
@@ -1,5 +1,10 @@
 #include "crpropa/massDistribution/Massdistribution.h"
+
+#include <fstream>
 #include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+
 namespace crpropa {
 
 void DensityList::addDensity(ref_ptr<Density> dens) {
@@ -41,6 +46,27 @@ double DensityList::getNucleonDensity(const Vector3d &position) const {
 	return n;
 }
 
+bool DensityList::getIsForHI() {
+	for (int i = 0; i < DensityList.size(); i++)
+		if (DensityList[i]->getIsForHI())
+			return true;
+	return false;
+}
+
+bool DensityList::getIsForHII() {
+	for (int i = 0; i < DensityList.size(); i++)
+		if (DensityList[i]->getIsForHII())
+			return true;
+	return false;
+}
+
+bool DensityList::getIsForH2() {
+	for (int i = 0; i < DensityList.size(); i++)
+		if (DensityList[i]->getIsForH2())
+			return true;
+	return false;
+}
+
 std::string DensityList::getDescription() {
 	std::stringstream ss; 
 	ss << "DensityList with " << DensityList.size() << " modules: \n";
@@ -53,11 +79,137 @@ std::string DensityList::getDescription() {
 
 // ----------- DensityGrid -----------------------------------------------------------------
 
+// identifier and version of the cache file of DensityGrid
+static const char densityCacheMagic[8] = {'C', 'R', 'P', 'D', 'E', 'N', 'S', '1'};
+
 DensityGrid::DensityGrid(ref_ptr<Grid1f> grid, bool isForHI, bool isForHII, bool isForH2) : 
-	grid(grid), isForHI(isForHI), isForHII(isForHII), isForH2(isForH2) {
+	gridHI(grid), gridHII(grid), gridH2(grid), isForHI(isForHI), isForHII(isForHII), isForH2(isForH2) {
 		checkAndWarn();
 	}
 
+DensityGrid::DensityGrid(ref_ptr<Density> density, const GridProperties &p,
+		const std::string &cacheFile) {
+	isForHI = density->getIsForHI();
+	isForHII = density->getIsForHII();
+	isForH2 = density->getIsForH2();
+	if (isForHI)
+		gridHI = new Grid1f(p);
+	if (isForHII)
+		gridHII = new Grid1f(p);
+	if (isForH2)
+		gridH2 = new Grid1f(p);
+	checkAndWarn();
+
+	std::string description = density->getDescription();
+	if (not cacheFile.empty() and loadCache(cacheFile, description))
+		return;
+	sample(density);
+	if (not cacheFile.empty())
+		dumpCache(cacheFile, description);
+}
+
+void DensityGrid::sample(ref_ptr<Density> density) {
+	ref_ptr<Grid1f> grids[3] = {gridHI, gridHII, gridH2};
+	for (int t = 0; t < 3; t++) {
+		Grid1f *grid = grids[t];
+		if (grid == NULL)
+			continue;
+		const Density *d = density;
+		Vector3d origin = grid->getOrigin();
+		Vector3d spacing = grid->getSpacing();
+		int Nx = grid->getNx();
+		int Ny = grid->getNy();
+		int Nz = grid->getNz();
+		#pragma omp parallel for schedule(dynamic)
+		for (int ix = 0; ix < Nx; ix++)
+			for (int iy = 0; iy < Ny; iy++)
+				for (int iz = 0; iz < Nz; iz++) {
+					Vector3d pos = Vector3d(double(ix) + 0.5, double(iy) + 0.5, double(iz) + 0.5) * spacing + origin;
+					double n;
+					if (t == 0)
+						n = d->getHIDensity(pos);
+					else if (t == 1)
+						n = d->getHIIDensity(pos);
+					else
+						n = d->getH2Density(pos);
+					grid->get(ix, iy, iz) = n;
+				}
+	}
+}
+
+// header of the cache file: identifier, grid size, origin and spacing, sampled types, layout, density description
+static void writeCacheHeader(std::ostream &out, const Grid1f &grid, uint8_t types,
+		const std::string &description) {
+	out.write(densityCacheMagic, sizeof(densityCacheMagic));
+	uint64_t n[3] = {grid.getNx(), grid.getNy(), grid.getNz()};
+	out.write((const char*) n, sizeof(n));
+	double geometry[6] = {grid.getOrigin().x, grid.getOrigin().y, grid.getOrigin().z,
+			grid.getSpacing().x, grid.getSpacing().y, grid.getSpacing().z};
+	out.write((const char*) geometry, sizeof(geometry));
+	out.write((const char*) &types, sizeof(types));
+	uint8_t layout = grid.getLayout();
+	out.write((const char*) &layout, sizeof(layout));
+	uint64_t length = description.size();
+	out.write((const char*) &length, sizeof(length));
+	out.write(description.data(), length);
+}
+
+bool DensityGrid::loadCache(const std::string &filename, const std::string &description) {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (!fin)
+		return false;
+
+	ref_ptr<Grid1f> grids[3] = {gridHI, gridHII, gridH2};
+	const Grid1f *grid = gridHI ? gridHI : (gridHII ? gridHII : gridH2);
+	if (grid == NULL)
+		return false;
+	uint8_t types = (gridHI ? 1 : 0) | (gridHII ? 2 : 0) | (gridH2 ? 4 : 0);
+
+	// the header has to match byte by byte
+	std::stringstream expected;
+	writeCacheHeader(expected, *grid, types, description);
+	std::string header = expected.str();
+	std::string found(header.size(), '\0');
+	fin.read(&found[0], found.size());
+	if (!fin or (found != header)) {
+		KISS_LOG_WARNING << "DensityGrid: cache file " << filename
+			<< " does not match the grid or density and is rewritten.";
+		return false;
+	}
+
+	for (int t = 0; t < 3; t++) {
+		if (grids[t] == NULL)
+			continue;
+		std::vector<float> &values = grids[t]->getGrid();
+		fin.read((char*) values.data(), values.size() * sizeof(float));
+	}
+	if (!fin) {
+		KISS_LOG_WARNING << "DensityGrid: cache file " << filename
+			<< " is truncated and is rewritten.";
+		return false;
+	}
+	return true;
+}
+
+void DensityGrid::dumpCache(const std::string &filename, const std::string &description) const {
+	ref_ptr<Grid1f> grids[3] = {gridHI, gridHII, gridH2};
+	const Grid1f *grid = gridHI ? gridHI : (gridHII ? gridHII : gridH2);
+	if (grid == NULL)
+		return;
+	uint8_t types = (gridHI ? 1 : 0) | (gridHII ? 2 : 0) | (gridH2 ? 4 : 0);
+
+	std::ofstream fout(filename.c_str(), std::ios::binary);
+	if (!fout)
+		throw std::runtime_error("DensityGrid: could not write cache file " + filename);
+	writeCacheHeader(fout, *grid, types, description);
+	for (int t = 0; t < 3; t++) {
+		if (grids[t] == NULL)
+			continue;
+		const std::vector<float> &values = grids[t]->getGrid();
+		fout.write((const char*) values.data(), values.size() * sizeof(float));
+	}
+}
+
 void DensityGrid::checkAndWarn() {
 	bool allDeactivated = (isForHI == false) && (isForHII == false) && (isForH2 == false);
 	if (allDeactivated) {
@@ -68,22 +220,22 @@ void DensityGrid::checkAndWarn() {
 }
 
 double DensityGrid::getHIDensity(const Vector3d &position) const {
-	if (isForHI)
-		return grid -> interpolate(position);
+	if (isForHI and gridHI)
+		return gridHI -> interpolate(position);
 	else 
 		return 0.;
 }
 
 double DensityGrid::getHIIDensity(const Vector3d &position) const {
-	if (isForHII) 
-		return grid -> interpolate(position);
+	if (isForHII and gridHII)
+		return gridHII -> interpolate(position);
 	else
 		return 0.;
 }
 
 double DensityGrid::getH2Density(const Vector3d &position) const {
-	if (isForH2)
-		return grid -> interpolate(position);
+	if (isForH2 and gridH2)
+		return gridH2 -> interpolate(position);
 	else
 		return 0.;
 }
@@ -134,7 +286,21 @@ void DensityGrid::setIsForH2(bool b) {
 }
 
 void DensityGrid::setGrid(ref_ptr<Grid1f> grid) {
-	this->grid = grid;
+	gridHI = grid;
+	gridHII = grid;
+	gridH2 = grid;
+}
+
+ref_ptr<Grid1f> DensityGrid::getGridHI() const {
+	return gridHI;
+}
+
+ref_ptr<Grid1f> DensityGrid::getGridHII() const {
+	return gridHII;
+}
+
+ref_ptr<Grid1f> DensityGrid::getGridH2() const {
+	return gridH2;
 }
 
 std::string DensityGrid::getDescription() {
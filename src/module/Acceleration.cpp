@@ -6,7 +6,7 @@
 namespace crpropa {
 
 AbstractAccelerationModule::AbstractAccelerationModule(double _stepLength)
-	: crpropa::Module(), stepLength(_stepLength) {}
+	: crpropa::Module(), stepLength(_stepLength), compound(false) {}
 
 
 void AbstractAccelerationModule::add(StepLengthModifier *modifier) {
@@ -49,6 +49,14 @@ void AbstractAccelerationModule::process(crpropa::Candidate *candidate) const {
 	}
 
 	double step = candidate->getCurrentStep();
+	if (compound and step > 0) {
+		// the distances between scatterings are exponential, so their number
+		// in the step is Poisson distributed
+		uint64_t n = crpropa::Random::instance().randPoisson(step / currentStepLength);
+		compoundScatter(candidate, n);
+		candidate->limitNextStep(0.1 * currentStepLength);
+		return;
+	}
 	while (step > 0) {
 		double randDistance = -1. * log(crpropa::Random::instance().rand()) * currentStepLength;
 
@@ -62,6 +70,23 @@ void AbstractAccelerationModule::process(crpropa::Candidate *candidate) const {
 }
 
 
+void AbstractAccelerationModule::setCompoundScattering(bool compound) {
+	this->compound = compound;
+}
+
+
+bool AbstractAccelerationModule::getCompoundScattering() const {
+	return compound;
+}
+
+
+void AbstractAccelerationModule::compoundScatter(Candidate *candidate,
+												 uint64_t n) const {
+	for (uint64_t i = 0; i < n; i++)
+		scatter(candidate, scatterCenterVelocity(candidate));
+}
+
+
 SecondOrderFermi::SecondOrderFermi(double scatterVelocity, double stepLength,
 								   unsigned int sizeOfPitchangleTable)
 	: AbstractAccelerationModule(stepLength),
@@ -75,6 +100,55 @@ SecondOrderFermi::SecondOrderFermi(double scatterVelocity, double stepLength,
 		angle[i] = i * M_PI / (sizeOfPitchangleTable-1);
 		angleCDF[i] = (angle[i] +scatterVelocity / crpropa::c_light * sin(angle[i])) / M_PI;
 	}
+
+	// The gain of a scattering is gamma^2 (1 + beta cos(angle)) (1 + beta mu)
+	// with the angle from the table and the cosine mu of the new direction in
+	// the rest frame of the center uniform in [-1, 1].
+	const double beta = scatterVelocity / crpropa::c_light;
+	const size_t nMu = 1000;
+	double muMean = 0, muSquare = 0;
+	for (size_t i = 0; i < nMu; i++) {
+		double l = log(1 + beta * (-1 + (i + 0.5) * 2. / nMu));
+		muMean += l / nMu;
+		muSquare += l * l / nMu;
+	}
+	double angleMean = 0, angleSquare = 0;
+	for (size_t i = 1; i < sizeOfPitchangleTable; i++) {
+		double p = angleCDF[i] - angleCDF[i - 1];
+		double l = log(1 + beta * cos(0.5 * (angle[i] + angle[i - 1])));
+		angleMean += p * l;
+		angleSquare += p * l * l;
+	}
+	logGainMean = -log(1 - beta * beta) + muMean + angleMean;
+	logGainVariance = muSquare - muMean * muMean + angleSquare - angleMean * angleMean;
+}
+
+
+double SecondOrderFermi::logGain() const {
+	crpropa::Random &random = crpropa::Random::instance();
+	const double beta = scatterVelocity / crpropa::c_light;
+	size_t idx = crpropa::closestIndex(random.rand(), angleCDF);
+	return -log(1 - beta * beta) + log(1 + beta * cos(angle[idx]))
+		+ log(1 + beta * random.randUniform(-1, 1));
+}
+
+
+void SecondOrderFermi::compoundScatter(Candidate *candidate, uint64_t n) const {
+	if (n == 0)
+		return;
+	if (n > 1) {
+		double l = 0;
+		if (n - 1 <= compoundThreshold) {
+			for (uint64_t i = 1; i < n; i++)
+				l += logGain();
+		} else {
+			l = crpropa::Random::instance().randNorm((n - 1) * logGainMean,
+				sqrt((n - 1) * logGainVariance));
+		}
+		candidate->current.setEnergy(candidate->current.getEnergy() * exp(l));
+		candidate->current.setDirection(crpropa::Random::instance().randVector());
+	}
+	scatter(candidate, scatterCenterVelocity(candidate));
 }
 
 
@@ -119,6 +193,13 @@ crpropa::Vector3d DirectedFlowScattering::scatterCenterVelocity(
 }
 
 
+void DirectedFlowScattering::compoundScatter(Candidate *candidate,
+											 uint64_t n) const {
+	if (n > 0)
+		scatter(candidate, __scatterVelocity);
+}
+
+
 QuasiLinearTheory::QuasiLinearTheory(double referenecEnergy,
 									 double turbulenceIndex,
 									 double minimumRigidity)
@@ -144,7 +225,8 @@ double QuasiLinearTheory::modify(double steplength, Candidate* candidate)
 ParticleSplitting::ParticleSplitting(Surface *surface, int	crossingThreshold, 
 	int numberSplits, double minWeight, std::string counterid)
 	: surface(surface), crossingThreshold(crossingThreshold),
-	  numberSplits(numberSplits), minWeight(minWeight), counterid(counterid){};
+	  numberSplits(numberSplits), minWeight(minWeight), counterid(counterid),
+	  counterKey(Candidate::getPropertyKey(counterid)){};
 
 void ParticleSplitting::process(Candidate *candidate) const {
 	const double currentDistance =
@@ -160,9 +242,9 @@ void ParticleSplitting::process(Candidate *candidate) const {
 		return;
 
 	int num_crossings = 1;
-	if (candidate->hasProperty(counterid))
-		num_crossings = candidate->getProperty(counterid).toInt32() + 1;
-	candidate->setProperty(counterid, num_crossings);
+	if (candidate->hasProperty(counterKey))
+		num_crossings = candidate->getProperty(counterKey).toInt32() + 1;
+	candidate->setProperty(counterKey, num_crossings);
 
 	if (num_crossings % crossingThreshold != 0)
 		return;
@@ -174,9 +256,6 @@ void ParticleSplitting::process(Candidate *candidate) const {
 		// before the split are not affected
 		ref_ptr<Candidate> new_candidate = candidate->clone(false);
 		new_candidate->parent = candidate;
-		uint64_t snr = Candidate::getNextSerialNumber();
-		Candidate::setNextSerialNumber(snr + 1);
-		new_candidate->setSerialNumber(snr);
 		candidate->addSecondary(new_candidate);
 	}
 };
@@ -0,0 +1,89 @@
+#include "crpropa/module/BatchModule.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+BatchModule::BatchModule(size_t batchSize) : batches(0) {
+	setBatchSize(batchSize);
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadRecords.resize(threads);
+}
+
+BatchModule::~BatchModule() {
+}
+
+void BatchModule::setBatchSize(size_t batchSize) {
+	if (batchSize < 1)
+		throw std::runtime_error("BatchModule: the batch size has to be positive");
+	this->batchSize = batchSize;
+}
+
+size_t BatchModule::getBatchSize() const {
+	return batchSize;
+}
+
+size_t BatchModule::getNumberOfBatches() const {
+	return batches;
+}
+
+void BatchModule::dispatch(std::vector<CandidateBatch::Record> &records) const {
+	CandidateBatch batch;
+	batch.records.swap(records);
+	records.reserve(batchSize);
+#pragma omp critical(BatchModule)
+	{
+		processBatch(batch);
+		batches++;
+	}
+}
+
+void BatchModule::flush() const {
+	for (size_t i = 0; i < threadRecords.size(); i++)
+		if (not threadRecords[i].empty())
+			dispatch(threadRecords[i]);
+}
+
+void BatchModule::process(Candidate *c) const {
+	CandidateBatch::Record r;
+	Vector3d p = c->current.getPosition();
+	r.x = p.x;
+	r.y = p.y;
+	r.z = p.z;
+	r.energy = c->current.getEnergy();
+	r.weight = c->getWeight();
+	r.redshift = c->getRedshift();
+	r.id = c->current.getId();
+	r.serialNumber = c->getSerialNumber();
+
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid < threadRecords.size()) {
+		std::vector<CandidateBatch::Record> &rs = threadRecords[tid];
+		rs.push_back(r);
+		if (rs.size() >= batchSize)
+			dispatch(rs);
+	} else {
+		// more threads than at construction
+		std::vector<CandidateBatch::Record> rs(1, r);
+		dispatch(rs);
+	}
+}
+
+std::string BatchModule::getDescription() const {
+	std::stringstream ss;
+	ss << "BatchModule: batches of " << batchSize << " candidates";
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -22,8 +22,10 @@ void PeriodicBox::process(Candidate *c) const {
 
 	c->current.setPosition(pos - n * size);
 	c->previous.setPosition(c->previous.getPosition() - n * size);
-	c->source.setPosition(c->source.getPosition() - n * size);
-	c->created.setPosition(c->created.getPosition() - n * size);
+	if (c->source.isRetained())
+		c->source.setPosition(c->source.getPosition() - n * size);
+	if (c->created.isRetained())
+		c->created.setPosition(c->created.getPosition() - n * size);
 }
 
 void PeriodicBox::setOrigin(Vector3d o) {
@@ -59,11 +61,18 @@ void ReflectiveBox::process(Candidate *c) const {
 	Vector3d nReflect(pow(-1, n.x), pow(-1, n.y), pow(-1, n.z));
 	c->current.setDirection(c->current.getDirection() * nReflect);
 	c->previous.setDirection(c->previous.getDirection() * nReflect);
-	c->created.setDirection(c->created.getDirection() * nReflect);
-	c->source.setDirection(c->source.getDirection() * nReflect);
-
-	Vector3d src = (c->source.getPosition() - origin) / size; // initial position in cell units
-	Vector3d cre = (c->created.getPosition() - origin) / size; // initial position in cell units
+	bool source = c->source.isRetained();
+	bool created = c->created.isRetained();
+	if (created)
+		c->created.setDirection(c->created.getDirection() * nReflect);
+	if (source)
+		c->source.setDirection(c->source.getDirection() * nReflect);
+
+	Vector3d src, cre; // initial positions in cell units
+	if (source)
+		src = (c->source.getPosition() - origin) / size;
+	if (created)
+		cre = (c->created.getPosition() - origin) / size;
 	Vector3d prv = (c->previous.getPosition() - origin) / size; // previous position in cell units
 
 	// repeatedly translate until the current position is inside the cell
@@ -90,8 +99,10 @@ void ReflectiveBox::process(Candidate *c) const {
 	}
 
 	c->current.setPosition(cur * size + origin);
-	c->source.setPosition(src * size + origin);
-	c->created.setPosition(cre * size + origin);
+	if (source)
+		c->source.setPosition(src * size + origin);
+	if (created)
+		c->created.setPosition(cre * size + origin);
 	c->previous.setPosition(prv * size + origin);
 }
 
@@ -110,11 +121,11 @@ std::string ReflectiveBox::getDescription() const {
 }
 
 CubicBoundary::CubicBoundary() :
-		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), margin(0.1 * kpc) {
+		origin(Vector3d(0, 0, 0)), size(0), limitStep(true), interpolate(false), margin(0.1 * kpc) {
 }
 
 CubicBoundary::CubicBoundary(Vector3d o, double s) :
-		origin(o), size(s), limitStep(true), margin(0.1 * kpc) {
+		origin(o), size(s), limitStep(true), interpolate(false), margin(0.1 * kpc) {
 }
 
 void CubicBoundary::process(Candidate *c) const {
@@ -122,9 +133,13 @@ void CubicBoundary::process(Candidate *c) const {
 	double lo = r.min();
 	double hi = r.max();
 	if ((lo <= 0) or (hi >= size)) {
+		if (interpolate) {
+			ParaxialBox box(origin, Vector3d(size));
+			c->interpolateStep(box.getStepCrossing(c));
+		}
 		reject(c);
 	}
-	if (limitStep) {
+	if (limitStep and not interpolate) {
 		c->limitNextStep(lo + margin);
 		c->limitNextStep(size - hi + margin);
 	}
@@ -142,6 +157,9 @@ void CubicBoundary::setMargin(double m) {
 void CubicBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void CubicBoundary::setInterpolateCrossing(bool b) {
+	interpolate = b;
+}
 
 std::string CubicBoundary::getDescription() const {
 	std::stringstream s;
@@ -155,19 +173,23 @@ std::string CubicBoundary::getDescription() const {
 }
 
 SphericalBoundary::SphericalBoundary() :
-		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), margin(0.1 * kpc) {
+		center(Vector3d(0, 0, 0)), radius(0), limitStep(true), interpolate(false), margin(0.1 * kpc) {
 }
 
 SphericalBoundary::SphericalBoundary(Vector3d c, double r) :
-		center(c), radius(r), limitStep(true), margin(0.1 * kpc) {
+		center(c), radius(r), limitStep(true), interpolate(false), margin(0.1 * kpc) {
 }
 
 void SphericalBoundary::process(Candidate *c) const {
 	double d = (c->current.getPosition() - center).getR();
 	if (d >= radius) {
+		if (interpolate) {
+			Sphere sphere(center, radius);
+			c->interpolateStep(sphere.getStepCrossing(c));
+		}
 		reject(c);
 	}
-	if (limitStep)
+	if (limitStep and not interpolate)
 		c->limitNextStep(radius - d + margin);
 }
 
@@ -183,6 +205,9 @@ void SphericalBoundary::setMargin(double m) {
 void SphericalBoundary::setLimitStep(bool b) {
 	limitStep = b;
 }
+void SphericalBoundary::setInterpolateCrossing(bool b) {
+	interpolate = b;
+}
 
 std::string SphericalBoundary::getDescription() const {
 	std::stringstream s;
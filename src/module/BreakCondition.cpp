@@ -1,8 +1,16 @@
 #include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/ElectronPairProduction.h"
+#include "crpropa/Common.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/ParticleMass.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <sstream>
+#include <stdexcept>
 
 namespace crpropa {
 
@@ -76,6 +84,12 @@ double MinimumEnergy::getMinimumEnergy() const {
 	return minEnergy;
 }
 
+void MinimumEnergy::applyToSecondaries() const {
+	if (rejectAction.valid() or not makeRejectedInactive)
+		throw std::runtime_error("MinimumEnergy: secondary threshold only for conditions that just deactivate");
+	Candidate::setSecondaryThreshold(minEnergy);
+}
+
 void MinimumEnergy::process(Candidate *c) const {
 	if (c->current.getEnergy() > minEnergy)
 		return;
@@ -107,7 +121,7 @@ double MinimumRigidity::getMinimumRigidity() const {
 }
 
 void MinimumRigidity::process(Candidate *c) const {
-	if (c->current.getRigidity() < minRigidity)
+	if (c->getStepQuantities().rigidity < minRigidity)
 		reject(c);
 }
 
@@ -165,7 +179,7 @@ int MinimumChargeNumber::getMinimumChargeNumber() const {
 }
 
 void MinimumChargeNumber::process(Candidate *c) const {
-	if (chargeNumber(c->current.getId()) > minChargeNumber)
+	if (c->current.getChargeNumber() > minChargeNumber)
 		return;
 	else
 		reject(c);
@@ -199,6 +213,14 @@ double MinimumEnergyPerParticleId::getMinimumEnergyOthers() const {
 	return minEnergyOthers;
 }
 
+void MinimumEnergyPerParticleId::applyToSecondaries() const {
+	if (rejectAction.valid() or not makeRejectedInactive)
+		throw std::runtime_error("MinimumEnergyPerParticleId: secondary threshold only for conditions that just deactivate");
+	Candidate::setSecondaryThreshold(minEnergyOthers);
+	for (size_t i = 0; i < particleIds.size(); i++)
+		Candidate::setSecondaryThreshold(particleIds[i], minEnergies[i]);
+}
+
 void MinimumEnergyPerParticleId::process(Candidate *c) const {
 	for (int i = 0; i < particleIds.size(); i++) {
 		if (c->current.getId() == particleIds[i]) {
@@ -228,6 +250,109 @@ std::string MinimumEnergyPerParticleId::getDescription() const {
 	return s.str();
 }
 
+//*****************************************************************************
+ReachabilityPruning::ReachabilityPruning(double minEnergy, double maxEnergy) :
+		minEnergy(minEnergy), maxEnergy(maxEnergy), oneDimensional(false) {
+	if (not (minEnergy > 0) or not (maxEnergy > minEnergy))
+		throw std::runtime_error("ReachabilityPruning: invalid energy range");
+}
+
+void ReachabilityPruning::addObserverPosition(const Vector3d &position, double radius) {
+	observerPositions.push_back(position);
+	observerRadii.push_back(radius);
+}
+
+void ReachabilityPruning::set1D(bool value) {
+	oneDimensional = value;
+}
+
+void ReachabilityPruning::setRanges(int id, const std::vector<double> &lossLengths) {
+	// the range grows with the loss length per step in log(E), the larger
+	// loss length of both ends of each step bounds the range from above
+	double h = log(10.) / nodesPerDecade;
+	std::vector<double> &range = ranges[id];
+	range.assign(lossLengths.size(), 0);
+	for (size_t k = 1; k < range.size(); k++)
+		range[k] = range[k - 1] + h * std::max(lossLengths[k - 1], lossLengths[k]);
+}
+
+void ReachabilityPruning::setLossLength(int id, const std::vector<double> &energies,
+		const std::vector<double> &lossLengths) {
+	if ((energies.size() < 2) or (energies.size() != lossLengths.size()))
+		throw std::runtime_error("ReachabilityPruning: loss length table needs at least two energies");
+	std::vector<double> x(energies.size()), y(energies.size());
+	for (size_t i = 0; i < energies.size(); i++) {
+		if (not (energies[i] > 0) or not (lossLengths[i] > 0) or ((i > 0) and not (energies[i] > energies[i - 1])))
+			throw std::runtime_error("ReachabilityPruning: invalid loss length table");
+		x[i] = log(energies[i]);
+		y[i] = log(lossLengths[i]);
+	}
+
+	size_t n = std::ceil(log10(maxEnergy / minEnergy) * nodesPerDecade) + 1;
+	std::vector<double> L(n);
+	for (size_t k = 0; k < n; k++)
+		L[k] = exp(interpolate(log(minEnergy) + k * log(10.) / nodesPerDecade, x, y));
+	setRanges(id, L);
+}
+
+void ReachabilityPruning::addSpecies(int id, const ElectronPairProduction *pairProduction) {
+	if (not isNucleus(id))
+		throw std::runtime_error("ReachabilityPruning: pair production losses only for nuclei");
+	double mc2 = nuclearMass(id) * c_squared;
+	size_t n = std::ceil(log10(maxEnergy / minEnergy) * nodesPerDecade) + 1;
+	std::vector<double> L(n);
+	for (size_t k = 0; k < n; k++) {
+		double E = minEnergy * pow(10, double(k) / nodesPerDecade);
+		L[k] = pairProduction->lossLength(id, E / mc2, 0);
+	}
+	setRanges(id, L);
+}
+
+double ReachabilityPruning::getRange(int id, double energy) const {
+	std::map<int, std::vector<double> >::const_iterator i = ranges.find(id);
+	if (i == ranges.end())
+		return std::numeric_limits<double>::infinity();
+	if (energy < minEnergy)
+		return 0;
+	// next node above the energy
+	double k = std::ceil(log10(energy / minEnergy) * nodesPerDecade);
+	if (k >= i->second.size())
+		return std::numeric_limits<double>::infinity();
+	return i->second[size_t(k)];
+}
+
+double ReachabilityPruning::getDistance(const Vector3d &position) const {
+	if (oneDimensional)
+		return std::max(position.x, 0.);
+	if (observerPositions.empty())
+		return 0;
+	double d = std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < observerPositions.size(); i++)
+		d = std::min(d, position.getDistanceTo(observerPositions[i]) - observerRadii[i]);
+	return std::max(d, 0.);
+}
+
+void ReachabilityPruning::process(Candidate *c) const {
+	double range = getRange(c->current.getId(), c->current.getEnergy());
+	if (range < getDistance(c->current.getPosition()))
+		reject(c);
+}
+
+std::string ReachabilityPruning::getDescription() const {
+	std::stringstream s;
+	s << "Reachability pruning: minimum energy " << minEnergy / EeV << " EeV, ";
+	s << ranges.size() << " species, ";
+	if (oneDimensional)
+		s << "observer at x = 0, ";
+	else
+		s << observerPositions.size() << " observers, ";
+	s << "Flag: '" << rejectFlagKey << "' -> '" << rejectFlagValue << "', ";
+	s << "MakeInactive: " << (makeRejectedInactive ? "yes" : "no");
+	if (rejectAction.valid())
+		s << ", Action: " << rejectAction->getDescription();
+	return s.str();
+}
+
 //*****************************************************************************
 DetectionLength::DetectionLength(double detLength) :
 		detLength(detLength) {
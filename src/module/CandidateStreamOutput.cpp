@@ -0,0 +1,192 @@
+#include "crpropa/module/CandidateStreamOutput.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// bytes of records collected by a thread before they are written
+const size_t THREAD_BUFFER = 1 << 20;
+
+void encodeState(const ParticleState &state, CandidateStreamState &s) {
+	s.id = state.getId();
+	s.padding = 0;
+	s.energy = state.getEnergy();
+	const Vector3d &x = state.getPosition();
+	s.position[0] = x.x;
+	s.position[1] = x.y;
+	s.position[2] = x.z;
+	const Vector3d &u = state.getDirection();
+	s.direction[0] = u.x;
+	s.direction[1] = u.y;
+	s.direction[2] = u.z;
+}
+
+void writeString(std::ostream &out, const std::string &s) {
+	uint32_t n = s.size();
+	out.write((const char *) &n, sizeof(n));
+	out.write(s.data(), n);
+}
+
+} // namespace
+
+CandidateStreamOutput::CandidateStreamOutput(const std::string &filename) :
+		filename(filename), started(false), count(0), maxTag(0) {
+	fout.open(filename.c_str(), std::ios::binary);
+	if (not fout)
+		throw std::runtime_error("CandidateStreamOutput: cannot open " + filename);
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadBuffers.resize(threads);
+	// the tag of the primaries is always in the file
+	maxTag = Candidate::getTagCode("PRIM");
+}
+
+CandidateStreamOutput::~CandidateStreamOutput() {
+	close();
+}
+
+void CandidateStreamOutput::enableProperty(const std::string &property) {
+	bool empty = true;
+	for (size_t i = 0; i < threadBuffers.size(); i++)
+		empty = empty and threadBuffers[i].empty();
+	if (started or not empty)
+		throw std::runtime_error("CandidateStreamOutput: properties can only be enabled before the first candidate");
+	if (std::find(properties.begin(), properties.end(), property) != properties.end())
+		return;
+	properties.push_back(property);
+	keys.push_back(Candidate::getPropertyKey(property));
+}
+
+void CandidateStreamOutput::start() const {
+	started = true;
+	fout.write(candidateStreamMagic, 8);
+	uint32_t header[2] = {(uint32_t) properties.size(), 0};
+	fout.write((const char *) header, sizeof(header));
+	size_t size = 16;
+	for (size_t i = 0; i < properties.size(); i++) {
+		writeString(fout, properties[i]);
+		size += sizeof(uint32_t) + properties[i].size();
+	}
+	const char zeros[8] = {0};
+	fout.write(zeros, (8 - size % 8) % 8);
+}
+
+void CandidateStreamOutput::flush(std::vector<char> &buffer) const {
+	if (not started)
+		start();
+	fout.write(buffer.data(), buffer.size());
+	if (not fout)
+		throw std::runtime_error("CandidateStreamOutput: cannot write " + filename);
+	size_t recordSize = sizeof(CandidateStreamRecord)
+			+ keys.size() * sizeof(CandidateStreamValue);
+	for (size_t i = 0; i < buffer.size(); i += recordSize) {
+		uint32_t tag;
+		memcpy(&tag, &buffer[i] + offsetof(CandidateStreamRecord, tag), sizeof(tag));
+		maxTag = std::max(maxTag, tag);
+	}
+	count += buffer.size() / recordSize;
+	buffer.clear();
+}
+
+void CandidateStreamOutput::process(Candidate *c) const {
+	if (not fout.is_open())
+		throw std::runtime_error("CandidateStreamOutput: file closed " + filename);
+
+	CandidateStreamRecord r;
+	memset(&r, 0, sizeof(r));
+	r.serialNumber = c->getSerialNumber();
+	r.sourceSerialNumber = c->getSourceSerialNumber();
+	r.createdSerialNumber = c->getCreatedSerialNumber();
+	r.weight = c->getWeight();
+	r.redshift = c->getRedshift();
+	r.trajectoryLength = c->getTrajectoryLength();
+	r.tag = c->getTagOriginCode();
+	if (c->source.isRetained()) {
+		r.flags |= CandidateStreamRecord::SourceRetained;
+		encodeState(c->source, r.source);
+	}
+	if (c->created.isRetained()) {
+		r.flags |= CandidateStreamRecord::CreatedRetained;
+		encodeState(c->created, r.created);
+	}
+	encodeState(c->previous, r.previous);
+	encodeState(c->current, r.current);
+
+	std::vector<CandidateStreamValue> values(keys.size());
+	for (size_t k = 0; k < keys.size(); k++) {
+		CandidateStreamValue &v = values[k];
+		memset(&v, 0, sizeof(v));
+		if (not c->hasProperty(keys[k]))
+			continue;
+		Variant value = c->getProperty(keys[k]);
+		if (value.getType() == Variant::TYPE_STRING)
+			throw std::runtime_error("CandidateStreamOutput: string property " + properties[k]);
+		v.type = value.getType();
+		value.copyToBuffer(v.data);
+	}
+
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	std::vector<char> single;
+	std::vector<char> &buffer = tid < threadBuffers.size() ? threadBuffers[tid] : single;
+	buffer.insert(buffer.end(), (const char *) &r, (const char *) &r + sizeof(r));
+	if (not values.empty())
+		buffer.insert(buffer.end(), (const char *) &values[0],
+				(const char *) &values[0] + values.size() * sizeof(CandidateStreamValue));
+
+	if (buffer.size() < THREAD_BUFFER and &buffer != &single)
+		return;
+#pragma omp critical(CandidateStreamOutput)
+	flush(buffer);
+}
+
+void CandidateStreamOutput::close() {
+	if (not fout.is_open())
+		return;
+	for (size_t i = 0; i < threadBuffers.size(); i++)
+		flush(threadBuffers[i]);
+	if (not started)
+		start();
+
+	uint64_t footer = fout.tellp();
+	uint32_t nTags = maxTag + 1;
+	fout.write((const char *) &nTags, sizeof(nTags));
+	for (uint32_t i = 0; i < nTags; i++)
+		writeString(fout, Candidate::getTagName(i));
+	uint64_t n = count;
+	fout.write((const char *) &n, sizeof(n));
+	fout.write((const char *) &footer, sizeof(footer));
+	fout.write(candidateStreamEndMagic, 8);
+	fout.close();
+}
+
+size_t CandidateStreamOutput::getCount() const {
+	return count;
+}
+
+std::string CandidateStreamOutput::getDescription() const {
+	std::stringstream ss;
+	ss << "CandidateStreamOutput: " << filename;
+	if (not properties.empty()) {
+		ss << ", properties";
+		for (size_t i = 0; i < properties.size(); i++)
+			ss << " " << properties[i];
+	}
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,217 @@
+#include "crpropa/module/ContinuousLosses.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/ParticleMass.h"
+#include "crpropa/Units.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// spacing of the summed pair production table
+static const double pairTableDRedshift = 0.05;
+static const double pairTableDLgGamma = 0.02;
+
+// bound of the Runge-Kutta steps per call
+static const int maxSubSteps = 100;
+
+ContinuousLosses::ContinuousLosses(double limit, bool redshift) :
+		limit(limit), redshift(redshift), Brms(0), maxRedshift(10),
+		lgGammaMin(0), lgGammaMax(0) {
+}
+
+void ContinuousLosses::addPhotonField(ref_ptr<PhotonField> photonField) {
+	std::string filename = getDataPath("ElectronPairProduction/lossrate_" + photonField->getFieldName() + ".txt");
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
+		throw std::runtime_error("ContinuousLosses: could not open file " + filename);
+
+	// row: log10(Gamma), relative loss rate [1/Mpc]
+	std::vector<double> lf, rate;
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->columns(i) < 2)
+			continue;
+		lf.push_back(pow(10, table->get(i, 0)));
+		rate.push_back(table->get(i, 1) / Mpc);
+	}
+	if (lf.size() < 2)
+		throw std::runtime_error("ContinuousLosses: no loss rates in " + filename);
+
+	photonFields.push_back(photonField);
+	pairTables.push_back(LogGridTable(lf, rate));
+	initPairTable();
+}
+
+void ContinuousLosses::setBrms(double B) {
+	Brms = B;
+}
+
+void ContinuousLosses::setRedshift(bool b) {
+	redshift = b;
+}
+
+void ContinuousLosses::setLimit(double l) {
+	limit = l;
+}
+
+void ContinuousLosses::setMaximumRedshift(double z) {
+	maxRedshift = z;
+	initPairTable();
+}
+
+double ContinuousLosses::getLimit() const {
+	return limit;
+}
+
+// relative loss rate of a proton summed over the photon fields, as ElectronPairProduction::lossLength
+static double sumPairLossRate(const std::vector<ref_ptr<PhotonField> > &fields,
+		const std::vector<LogGridTable> &tables, double lf, double z) {
+	double rate = 0;
+	for (size_t i = 0; i < tables.size(); i++) {
+		const TableAxis &axis = tables[i].getAxis();
+		double x = lf * (1 + z);
+		if (x < axis.front())
+			continue; // below energy threshold
+		double r;
+		if (x < axis.back())
+			r = tables[i](x);
+		else
+			r = tables[i].getValues().back() * pow(x / axis.back(), -0.6); // extrapolation
+		rate += r * pow_integer<3>(1 + z) * fields[i]->getRedshiftScaling(z);
+	}
+	return rate;
+}
+
+void ContinuousLosses::initPairTable() {
+	if (pairTables.empty())
+		return;
+
+	// Lorentz factors of all tables, down to the threshold at the largest tabulated redshift
+	double lo = std::numeric_limits<double>::max(), hi = 0;
+	for (size_t i = 0; i < pairTables.size(); i++) {
+		lo = std::min(lo, log10(pairTables[i].getAxis().front()));
+		hi = std::max(hi, log10(pairTables[i].getAxis().back()));
+	}
+	lgGammaMin = lo - log10(1 + maxRedshift);
+	lgGammaMax = hi;
+
+	size_t nz = std::max(2., ceil(maxRedshift / pairTableDRedshift) + 1);
+	size_t ng = std::max(2., ceil((lgGammaMax - lgGammaMin) / pairTableDLgGamma) + 1);
+	std::vector<double> zs(nz), lgs(ng), rates(nz * ng);
+	for (size_t i = 0; i < nz; i++)
+		zs[i] = maxRedshift * i / (nz - 1);
+	for (size_t j = 0; j < ng; j++)
+		lgs[j] = lgGammaMin + (lgGammaMax - lgGammaMin) * j / (ng - 1);
+	for (size_t i = 0; i < nz; i++)
+		for (size_t j = 0; j < ng; j++)
+			rates[i * ng + j] = sumPairLossRate(photonFields, pairTables, pow(10, lgs[j]), zs[i]);
+	pairTable.assign(zs, lgs, rates);
+}
+
+double ContinuousLosses::pairLossRate(double lf, double z) const {
+	if (pairTables.empty())
+		return 0;
+	double lg = log10(lf);
+	if ((z <= maxRedshift) and (lg >= lgGammaMin) and (lg <= lgGammaMax))
+		return pairTable(z, lg);
+	return sumPairLossRate(photonFields, pairTables, lf, z);
+}
+
+void ContinuousLosses::derivatives(double u, double z, double mc2, double pairScale,
+		double charge, double &du, double &dz) const {
+	double b = 0; // relative loss rate in the local frame
+	if (mc2 > 0) {
+		double lf = exp(u) * (1 + z) / mc2;
+		if (pairScale > 0)
+			b += pairScale * pairLossRate(lf, z);
+		if ((Brms > 0) and (charge != 0)) {
+			// Jackson p. 770 (14.31) with the gyroradius p / (q B), average perpendicular field
+			double B = sqrt(2. / 3) * Brms * pow(1 + z, 2);
+			b += pow(charge, 4) * B * B * c_squared * (lf * lf - 1) / (6 * M_PI * epsilon0 * pow(mc2, 3) * lf);
+		}
+	}
+	du = -b / (1 + z); // step size in local frame
+	dz = 0;
+	if (redshift and (z > 0))
+		dz = -hubbleRate(z) / c_light;
+}
+
+double ContinuousLosses::getLossRate(Candidate *candidate) const {
+	const ParticleState &state = candidate->current;
+	double pairScale = 0;
+	if (state.isNucleus()) {
+		double Z = state.getChargeNumber();
+		pairScale = Z * Z / (state.getMass() / mass_proton); // Z^2 / A
+	}
+	double z = candidate->getRedshift();
+	double du, dz;
+	derivatives(log(candidate->current.getEnergy() / (1 + z)), z,
+			candidate->current.getMass() * c_squared, pairScale,
+			candidate->current.getCharge(), du, dz);
+	return -du - dz / (1 + z); // adiabatic energy loss: dE / dz = E / (1 + z)
+}
+
+void ContinuousLosses::process(Candidate *candidate) const {
+	double E = candidate->current.getEnergy();
+	if (not (E > 0))
+		return;
+
+	const ParticleState &state = candidate->current;
+	double pairScale = 0;
+	if (state.isNucleus()) {
+		double Z = state.getChargeNumber();
+		pairScale = Z * Z / (state.getMass() / mass_proton); // Z^2 / A
+	}
+	double mc2 = candidate->current.getMass() * c_squared;
+	double charge = candidate->current.getCharge();
+
+	// classical Runge-Kutta for ln(E / (1 + z)), which is conserved by the
+	// adiabatic losses, and z over the current step, in sub-steps of at most
+	// the limited step if the step was set by other modules
+	double remaining = candidate->getCurrentStep();
+	double z = candidate->getRedshift();
+	double y = log(E / (1 + z));
+	double k1, k2, k3, k4, l1, l2, l3, l4;
+	derivatives(y, z, mc2, pairScale, charge, k1, l1);
+	double rate = -k1 - l1 / (1 + z);
+	for (int i = 0; (remaining > 0) and (i < maxSubSteps); i++) {
+		double h = remaining;
+		double r = -k1 - l1 / (1 + z);
+		if ((r > 0) and (i + 1 < maxSubSteps))
+			h = std::min(h, limit / r);
+		derivatives(y + h / 2 * k1, std::max(0., z + h / 2 * l1), mc2, pairScale, charge, k2, l2);
+		derivatives(y + h / 2 * k2, std::max(0., z + h / 2 * l2), mc2, pairScale, charge, k3, l3);
+		derivatives(y + h * k3, std::max(0., z + h * l3), mc2, pairScale, charge, k4, l4);
+		y += h / 6 * (k1 + 2 * k2 + 2 * k3 + k4);
+		z = std::max(0., z + h / 6 * (l1 + 2 * l2 + 2 * l3 + l4));
+		remaining -= h;
+		derivatives(y, z, mc2, pairScale, charge, k1, l1);
+	}
+
+	if (redshift and (candidate->getRedshift() > 0))
+		candidate->setRedshift(z);
+	candidate->current.setEnergy(exp(y) * (1 + z));
+
+	// limit next step to a fraction of the energy loss length
+	rate = std::max(rate, -k1 - l1 / (1 + z));
+	if (rate > 0)
+		candidate->limitNextStep(limit / rate);
+}
+
+std::string ContinuousLosses::getDescription() const {
+	std::stringstream s;
+	s << "ContinuousLosses: limit " << limit;
+	if (redshift)
+		s << ", redshift";
+	if (Brms > 0)
+		s << ", synchrotron Brms = " << Brms / nG << " nG";
+	for (size_t i = 0; i < photonFields.size(); i++)
+		s << ", pair production " << photonFields[i]->getFieldName();
+	return s.str();
+}
+
+} // namespace crpropa
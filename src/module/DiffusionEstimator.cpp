@@ -0,0 +1,173 @@
+#include "crpropa/module/DiffusionEstimator.h"
+#include "crpropa/Common.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// weighted moments per detection time
+enum {
+	COUNT, WEIGHT, DX, DY, DZ, DX2, DY2, DZ2, DPAR2, DPERP2, MOMENTS
+};
+
+DiffusionEstimator::DiffusionEstimator(const std::vector<double> &times,
+		Vector3d fieldDirection) : times(times),
+		indexKey(Candidate::getPropertyKey("DetectionIndex")) {
+	if (times.empty())
+		throw std::runtime_error("DiffusionEstimator: no detection times");
+	setFieldDirection(fieldDirection);
+	clear();
+}
+
+void DiffusionEstimator::setFieldDirection(Vector3d direction) {
+	if (direction.getR() == 0)
+		throw std::runtime_error("DiffusionEstimator: field direction of zero length");
+	fieldDirection = direction / direction.getR();
+}
+
+Vector3d DiffusionEstimator::getFieldDirection() const {
+	return fieldDirection;
+}
+
+const std::vector<double> &DiffusionEstimator::getTimes() const {
+	return times;
+}
+
+void DiffusionEstimator::process(Candidate *candidate) const {
+	size_t i;
+	if (candidate->hasProperty(indexKey)) {
+		i = candidate->getProperty(indexKey).asUInt64() - 1;
+	} else {
+		double length = candidate->getTrajectoryLength();
+		i = std::upper_bound(times.begin(), times.end(), length) - times.begin();
+		if (i == 0)
+			return;
+		i--;
+	}
+	if (i >= times.size())
+		return;
+
+	Vector3d d = candidate->current.getPosition() - candidate->source.getPosition();
+	double w = candidate->getWeight();
+	double par = d.dot(fieldDirection);
+	double d2 = d.getR2();
+
+	double *m = &threadMoments.local()[i * MOMENTS];
+	m[COUNT] += 1;
+	m[WEIGHT] += w;
+	m[DX] += w * d.x;
+	m[DY] += w * d.y;
+	m[DZ] += w * d.z;
+	m[DX2] += w * d.x * d.x;
+	m[DY2] += w * d.y * d.y;
+	m[DZ2] += w * d.z * d.z;
+	m[DPAR2] += w * par * par;
+	m[DPERP2] += w * (d2 - par * par);
+}
+
+static void addMoments(std::vector<double> &sum, const std::vector<double> &m) {
+	for (size_t i = 0; i < sum.size(); i++)
+		sum[i] += m[i];
+}
+
+void DiffusionEstimator::endRun() {
+	threadMoments.merge(moments, addMoments);
+}
+
+void DiffusionEstimator::clear() {
+	moments.assign(times.size() * MOMENTS, 0);
+	threadMoments.clear(moments);
+}
+
+double DiffusionEstimator::getMoment(size_t i, int moment) const {
+	if (i >= times.size())
+		throw std::runtime_error("DiffusionEstimator: time index out of range");
+	return moments[i * MOMENTS + moment];
+}
+
+double DiffusionEstimator::getWeight(size_t i) const {
+	return getMoment(i, WEIGHT);
+}
+
+size_t DiffusionEstimator::getCount(size_t i) const {
+	return getMoment(i, COUNT);
+}
+
+Vector3d DiffusionEstimator::getMeanDisplacement(size_t i) const {
+	double w = getWeight(i);
+	if (w == 0)
+		return Vector3d(0.);
+	return Vector3d(getMoment(i, DX), getMoment(i, DY), getMoment(i, DZ)) / w;
+}
+
+Vector3d DiffusionEstimator::getMeanSquaredDisplacement(size_t i) const {
+	double w = getWeight(i);
+	if (w == 0)
+		return Vector3d(0.);
+	return Vector3d(getMoment(i, DX2), getMoment(i, DY2), getMoment(i, DZ2)) / w;
+}
+
+double DiffusionEstimator::getParallelMeanSquaredDisplacement(size_t i) const {
+	double w = getWeight(i);
+	return (w == 0) ? 0 : getMoment(i, DPAR2) / w;
+}
+
+double DiffusionEstimator::getPerpendicularMeanSquaredDisplacement(size_t i) const {
+	double w = getWeight(i);
+	return (w == 0) ? 0 : getMoment(i, DPERP2) / w;
+}
+
+Vector3d DiffusionEstimator::getDiffusionCoefficient(size_t i) const {
+	return getMeanSquaredDisplacement(i) / (2 * times[i] / c_light);
+}
+
+double DiffusionEstimator::getParallelDiffusionCoefficient(size_t i) const {
+	return getParallelMeanSquaredDisplacement(i) / (2 * times[i] / c_light);
+}
+
+double DiffusionEstimator::getPerpendicularDiffusionCoefficient(size_t i) const {
+	return getPerpendicularMeanSquaredDisplacement(i) / (4 * times[i] / c_light);
+}
+
+void DiffusionEstimator::save(const std::string &filename) {
+	endRun();
+	std::ofstream outfile(filename.c_str());
+	if (!outfile)
+		throw std::runtime_error("DiffusionEstimator: could not open " + filename);
+	outfile << "# L/kpc\tN\tW\t<dx>/kpc\t<dy>/kpc\t<dz>/kpc\t<dx^2>/kpc^2\t<dy^2>/kpc^2\t<dz^2>/kpc^2"
+			<< "\t<dpar^2>/kpc^2\t<dperp^2>/kpc^2\tDx/(m^2/s)\tDy/(m^2/s)\tDz/(m^2/s)"
+			<< "\tDpar/(m^2/s)\tDperp/(m^2/s)\n";
+	outfile.precision(8);
+	for (size_t i = 0; i < times.size(); i++) {
+		Vector3d mean = getMeanDisplacement(i) / kpc;
+		Vector3d msd = getMeanSquaredDisplacement(i) / (kpc * kpc);
+		Vector3d D = getDiffusionCoefficient(i);
+		outfile << times[i] / kpc << "\t" << getCount(i) << "\t" << getWeight(i)
+				<< "\t" << mean.x << "\t" << mean.y << "\t" << mean.z
+				<< "\t" << msd.x << "\t" << msd.y << "\t" << msd.z
+				<< "\t" << getParallelMeanSquaredDisplacement(i) / (kpc * kpc)
+				<< "\t" << getPerpendicularMeanSquaredDisplacement(i) / (kpc * kpc)
+				<< "\t" << D.x << "\t" << D.y << "\t" << D.z
+				<< "\t" << getParallelDiffusionCoefficient(i)
+				<< "\t" << getPerpendicularDiffusionCoefficient(i) << "\n";
+	}
+}
+
+std::string DiffusionEstimator::getDescription() const {
+	std::stringstream ss;
+	ss << "DiffusionEstimator: " << times.size() << " detection times from "
+			<< times.front() / kpc << " to " << times.back() / kpc
+			<< " kpc, mean field direction " << fieldDirection;
+	return ss.str();
+}
+
+size_t DiffusionEstimator::getSizeOf() const {
+	// the moments and those of each thread
+	return (1 + threadMoments.size()) * vectorSizeOf(moments) + vectorSizeOf(times);
+}
+
+} // namespace crpropa
@@ -20,7 +20,7 @@ const double bs[] = { 2825. / 27648., 0., 18575. / 48384., 13525.
 
 DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, double tolerance,
 				 double minStep, double maxStep, double epsilon) :
-	minStep(0)
+	minStep(0), stepHints(false)
 {
   	setMagneticField(magneticField);
   	setMaximumStep(maxStep);
@@ -32,7 +32,7 @@ DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, double toleranc
 	}
 
 DiffusionSDE::DiffusionSDE(ref_ptr<MagneticField> magneticField, ref_ptr<AdvectionField> advectionField, double tolerance, double minStep, double maxStep, double epsilon) :
-  	minStep(0)
+  	minStep(0), stepHints(false)
 {
 	setMagneticField(magneticField);
 	setAdvectionField(advectionField);
@@ -51,7 +51,11 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	ParticleState &current = candidate->current;
 	candidate->previous = current;
 
-	double h = clip(candidate->getNextStep(), minStep, maxStep) / c_light;
+	double nextStep = candidate->getNextStep();
+	// first step of the candidate, bound by the variation length of the field
+	if (stepHints and (nextStep == 0) and magneticField.valid())
+		nextStep = magneticField->getStepHint(current.getPosition(), candidate->getRedshift()).variationLength;
+	double h = clip(nextStep, minStep, maxStep) / c_light;
 	Vector3d PosIn = current.getPosition();
 	Vector3d DirIn = current.getDirection();
 
@@ -91,21 +95,25 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	double NStep = BTensor[4] * eta[1];
 	double BStep = BTensor[8] * eta[2];
 
-	Vector3d TVec(0.);
-	Vector3d NVec(0.);
-	Vector3d BVec(0.);
-
-	Vector3d DirOut = Vector3d(0.);
-
 
 	double propTime = TStep * sqrt(h) / c_light;
 	size_t counter = 0;
 	double r=42.; //arbitrary number larger than one
 
+	// all trials start at PosIn, the field there is evaluated once and shared
+	// with the other modules of the step
+	Vector3d B0;
+	if (not candidate->getStepField(magneticField, PosIn, z, B0)) {
+		B0 = getMagneticFieldAtPosition(PosIn, z);
+		candidate->setStepField(magneticField, PosIn, z, B0);
+	}
+	Vector3d k0 = B0.getUnitVector() * c_light;
+	Vector3d PosOut = Vector3d(0.);
+	Vector3d PosErr = Vector3d(0.);
 	do {
-		Vector3d PosOut = Vector3d(0.);
-		Vector3d PosErr = Vector3d(0.);
-	  	tryStep(PosIn, PosOut, PosErr, z, propTime);
+		PosOut = Vector3d(0.);
+		PosErr = Vector3d(0.);
+	  	tryStep(PosIn, k0, PosOut, PosErr, z, propTime);
 	    // calculate the relative position error r and the next time step h
 	  	r = PosErr.getR() / tolerance;
 	  	propTime *= 0.5;
@@ -113,24 +121,175 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
     // Check for better break condition
 	} while (r > 1 && fabs(propTime) >= minStep/c_light);
+	Candidate::countRejectedSteps(counter - 1);
 
 
+	// the first of the sub-steps is the last trial, which ends at PosOut
 	size_t stepNumber = pow(2, counter-1);
 	double allowedTime = TStep * sqrt(h) / c_light / stepNumber;
-	Vector3d Start = PosIn;
-	Vector3d PosOut = Vector3d(0.);
-	Vector3d PosErr = Vector3d(0.);
-	for (size_t j=0; j<stepNumber; j++) {
+	Vector3d Start = PosOut;
+	for (size_t j=1; j<stepNumber; j++) {
 		tryStep(Start, PosOut, PosErr, z, allowedTime);
 		Start = PosOut;
 	}
 
+	finishStep(candidate, PosIn, PosOut, h, TStep, NStep, BStep, stepNumber);
+
+    	// Debugging and Testing
+    	// Delete comments if additional information should be stored in candidate
+	// This property "arcLength" can be interpreted as the effective arclength
+	// of the propagation along a magnetic field line.
+
+/*
+	const std::string AL = "arcLength";
+	if (candidate->hasProperty(AL) == false){
+	  double arcLen = (TStep + NStep + BStep) * sqrt(h);
+	  candidate->setProperty(AL, arcLen);
+	  return;
+	}
+	else {
+	  double arcLen = candidate->getProperty(AL);
+	  arcLen += (TStep + NStep + BStep) * sqrt(h);
+	  candidate->setProperty(AL, arcLen);
+	}
+*/
+
+}
+
+void DiffusionSDE::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	// neutral candidates move rectilinearly and are handled one by one
+	std::vector<Candidate *> charged;
+	charged.reserve(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		Candidate *candidate = candidates[i];
+		if (candidate->current.getCharge() == 0)
+			process(candidate);
+		else
+			charged.push_back(candidate);
+	}
+
+	size_t n = charged.size();
+	if (n == 0)
+		return;
+
+	// normal variates of all candidates at once
+	std::vector<double> eta(3 * n);
+	Random::instance().randNormArray(eta.data(), eta.size());
+
+	std::vector<double> h(n), z(n), TStep(n), NStep(n), BStep(n), propTime(n);
+	std::vector<Vector3d> PosIn(n);
+	for (size_t i = 0; i < n; i++) {
+		Candidate *candidate = charged[i];
+		ParticleState &current = candidate->current;
+		candidate->previous = current;
+		h[i] = clip(candidate->getNextStep(), minStep, maxStep) / c_light;
+		z[i] = candidate->getRedshift();
+		PosIn[i] = current.getPosition();
+
+		double BTensor[] = {0., 0., 0., 0., 0., 0., 0., 0., 0.};
+		double rig = current.getEnergy() / current.getCharge();
+		calculateBTensor(rig, BTensor, PosIn[i], current.getDirection(), z[i]);
+		TStep[i] = BTensor[0] * eta[3 * i];
+		NStep[i] = BTensor[4] * eta[3 * i + 1];
+		BStep[i] = BTensor[8] * eta[3 * i + 2];
+		propTime[i] = TStep[i] * sqrt(h[i]) / c_light;
+	}
+
+	// lanes of the active candidates, components in structure-of-arrays form
+	std::vector<double> inStore(3 * n), outStore(3 * n), errStore(3 * n);
+	std::vector<double> laneTime(n), laneZ(n);
+	double *x[3], *out[3], *err[3];
+
+	// halve the field line step until the error is below the tolerance, as in process()
+	std::vector<size_t> counter(n, 0), active(n);
+	std::vector<Vector3d> PosOut(n);
+	for (size_t i = 0; i < n; i++)
+		active[i] = i;
+	while (not active.empty()) {
+		size_t m = active.size();
+		for (size_t c = 0; c < 3; c++) {
+			x[c] = &inStore[c * m];
+			out[c] = &outStore[c * m];
+			err[c] = &errStore[c * m];
+		}
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			x[0][l] = PosIn[i].x;
+			x[1][l] = PosIn[i].y;
+			x[2][l] = PosIn[i].z;
+			laneTime[l] = propTime[i];
+			laneZ[l] = z[i];
+		}
+
+		tryStepBatch(x, out, err, laneTime.data(), laneZ.data(), m);
+
+		size_t remaining = 0;
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			double r = Vector3d(err[0][l], err[1][l], err[2][l]).getR() / tolerance;
+			PosOut[i] = Vector3d(out[0][l], out[1][l], out[2][l]);
+			propTime[i] *= 0.5;
+			counter[i] += 1;
+			if (r > 1 && fabs(propTime[i]) >= minStep / c_light)
+				active[remaining++] = i;
+		}
+		active.resize(remaining);
+	}
+
+	// integrate the field lines in 2^(counter - 1) steps, the first of
+	// which is the last trial
+	std::vector<size_t> stepNumber(n);
+	std::vector<double> allowedTime(n);
+	active.clear();
+	for (size_t i = 0; i < n; i++) {
+		stepNumber[i] = pow(2, counter[i] - 1);
+		allowedTime[i] = TStep[i] * sqrt(h[i]) / c_light / stepNumber[i];
+		if (stepNumber[i] > 1)
+			active.push_back(i);
+	}
+	for (size_t j = 1; not active.empty(); j++) {
+		size_t m = active.size();
+		for (size_t c = 0; c < 3; c++) {
+			x[c] = &inStore[c * m];
+			out[c] = &outStore[c * m];
+			err[c] = &errStore[c * m];
+		}
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			x[0][l] = PosOut[i].x;
+			x[1][l] = PosOut[i].y;
+			x[2][l] = PosOut[i].z;
+			laneTime[l] = allowedTime[i];
+			laneZ[l] = z[i];
+		}
+
+		tryStepBatch(x, out, err, laneTime.data(), laneZ.data(), m);
+
+		size_t remaining = 0;
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			PosOut[i] = Vector3d(out[0][l], out[1][l], out[2][l]);
+			if (j + 1 < stepNumber[i])
+				active[remaining++] = i;
+		}
+		active.resize(remaining);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		finishStep(charged[i], PosIn[i], PosOut[i], h[i], TStep[i], NStep[i],
+				BStep[i], stepNumber[i]);
+}
+
+void DiffusionSDE::finishStep(Candidate *candidate, const Vector3d &PosIn,
+		const Vector3d &PosOut, double h, double TStep, double NStep, double BStep,
+		size_t stepNumber) const {
     // Normalize the tangent vector
-	TVec = (PosOut-PosIn).getUnitVector();
+	Vector3d TVec = (PosOut-PosIn).getUnitVector();
     // Exception: If the magnetic field vanishes: Use only advection.
     // If an advection field is not provided --> rectilinear propagation.
 	double tTest = TVec.getR();
 	if (tTest != tTest) {
+		ParticleState &current = candidate->current;
 	  	Vector3d dir = current.getDirection();
 		Vector3d Pos = current.getPosition();
 		Vector3d LinProp(0.);
@@ -153,6 +312,7 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
     // Choose a random perpendicular vector as the Normal-vector.
     // Prevent 'nan's in the NVec-vector in the case of <TVec, NVec> = 0.
+	Vector3d NVec(0.);
 	while (NVec.getR()==0.){
 	  	Vector3d RandomVector = Random::instance().randVector();
 	  	NVec = TVec.cross( RandomVector );
@@ -160,7 +320,7 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	NVec = NVec.getUnitVector();
 
     // Calculate the Binormal-vector
-	BVec = (TVec.cross(NVec)).getUnitVector();
+	Vector3d BVec = (TVec.cross(NVec)).getUnitVector();
 
     // Calculate the advection step
 	Vector3d LinProp(0.);
@@ -192,9 +352,9 @@ void DiffusionSDE::process(Candidate *candidate) const {
 
 	//DirOut = (PO - PosIn - LinProp).getUnitVector(); //Advection does not change the momentum vector
 	// Random direction around the tangential direction accounts for the pitch angle average.
-	DirOut = Random::instance().randConeVector(TVec, M_PI/2.);
-	current.setPosition(PO);
-	current.setDirection(DirOut);
+	Vector3d DirOut = Random::instance().randConeVector(TVec, M_PI/2.);
+	candidate->current.setPosition(PO);
+	candidate->current.setDirection(DirOut);
 	candidate->setCurrentStep(h * c_light);
 
 	double nextStep;
@@ -206,44 +366,31 @@ void DiffusionSDE::process(Candidate *candidate) const {
 	}
 
 	candidate->setNextStep(nextStep);
-
-    	// Debugging and Testing
-    	// Delete comments if additional information should be stored in candidate
-	// This property "arcLength" can be interpreted as the effective arclength
-	// of the propagation along a magnetic field line.
-
-/*
-	const std::string AL = "arcLength";
-	if (candidate->hasProperty(AL) == false){
-	  double arcLen = (TStep + NStep + BStep) * sqrt(h);
-	  candidate->setProperty(AL, arcLen);
-	  return;
-	}
-	else {
-	  double arcLen = candidate->getProperty(AL);
-	  arcLen += (TStep + NStep + BStep) * sqrt(h);
-	  candidate->setProperty(AL, arcLen);
-	}
-*/
-
 }
 
-
 void DiffusionSDE::tryStep(const Vector3d &PosIn, Vector3d &POut, Vector3d &PosErr,double z, double propStep) const {
+	Vector3d k0 = getMagneticFieldAtPosition(PosIn, z).getUnitVector() * c_light;
+	tryStep(PosIn, k0, POut, PosErr, z, propStep);
+}
 
-	Vector3d k[] = {Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.)};
+void DiffusionSDE::tryStep(const Vector3d &PosIn, const Vector3d &k0, Vector3d &POut,
+		Vector3d &PosErr, double z, double propStep) const {
+
+	Vector3d k[] = {k0,Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.),Vector3d(0.)};
 	POut = PosIn;
 	//calculate the sum k_i * b_i
 	for (size_t i = 0; i < 6; i++) {
 
-		Vector3d y_n = PosIn;
-		for (size_t j = 0; j < i; j++)
-		  y_n += k[j] * a[i * 6 + j] * propStep;
+		if (i > 0) {
+			Vector3d y_n = PosIn;
+			for (size_t j = 0; j < i; j++)
+			  y_n += k[j] * a[i * 6 + j] * propStep;
 
-		// update k_i = direction of the regular magnetic mean field
-		Vector3d BField = getMagneticFieldAtPosition(y_n, z);
+			// update k_i = direction of the regular magnetic mean field
+			Vector3d BField = getMagneticFieldAtPosition(y_n, z);
 
-		k[i] = BField.getUnitVector() * c_light;
+			k[i] = BField.getUnitVector() * c_light;
+		}
 
 		POut += k[i] * b[i] * propStep;
 		PosErr +=  (k[i] * (b[i] - bs[i])) * propStep / kpc;
@@ -251,6 +398,47 @@ void DiffusionSDE::tryStep(const Vector3d &PosIn, Vector3d &POut, Vector3d &PosE
 	}
 }
 
+void DiffusionSDE::tryStepBatch(const double *const *x, double **out,
+		double **err, const double *propStep, const double *z, size_t n) const {
+	// k[i][c] holds component c of stage i for all lanes
+	std::vector<double> kStore(18 * n);
+	std::vector<Vector3d> y(n), B(n);
+	for (size_t c = 0; c < 3; c++)
+		for (size_t l = 0; l < n; l++) {
+			out[c][l] = x[c][l];
+			err[c][l] = 0;
+		}
+
+	for (size_t i = 0; i < 6; i++) {
+		for (size_t l = 0; l < n; l++) {
+			double v[3];
+			for (size_t c = 0; c < 3; c++) {
+				v[c] = x[c][l];
+				for (size_t j = 0; j < i; j++)
+					v[c] += kStore[(j * 3 + c) * n + l] * a[i * 6 + j] * propStep[l];
+			}
+			y[l] = Vector3d(v[0], v[1], v[2]);
+		}
+
+		// direction of the regular magnetic field at the stage positions of all lanes
+		getMagneticFieldsAtPositions(y.data(), B.data(), z, n);
+		for (size_t l = 0; l < n; l++) {
+			Vector3d k = B[l].getUnitVector() * c_light;
+			kStore[(i * 3 + 0) * n + l] = k.x;
+			kStore[(i * 3 + 1) * n + l] = k.y;
+			kStore[(i * 3 + 2) * n + l] = k.z;
+		}
+
+		for (size_t c = 0; c < 3; c++) {
+			const double *k = &kStore[(i * 3 + c) * n];
+			for (size_t l = 0; l < n; l++) {
+				out[c][l] += k[l] * b[i] * propStep[l];
+				err[c][l] += k[l] * (b[i] - bs[i]) * propStep[l] / kpc;
+			}
+		}
+	}
+}
+
 void DiffusionSDE::driftStep(const Vector3d &pos, Vector3d &linProp, double h) const {
 	Vector3d advField = getAdvectionFieldAtPosition(pos);
 	linProp += advField * h;
@@ -324,6 +512,14 @@ double DiffusionSDE::getMinimumStep() const {
 	return minStep;
 }
 
+void DiffusionSDE::setStepHints(bool use) {
+	stepHints = use;
+}
+
+bool DiffusionSDE::getStepHints() const {
+	return stepHints;
+}
+
 double DiffusionSDE::getMaximumStep() const {
 	return maxStep;
 }
@@ -350,6 +546,7 @@ ref_ptr<MagneticField> DiffusionSDE::getMagneticField() const {
 
 Vector3d DiffusionSDE::getMagneticFieldAtPosition(Vector3d pos, double z) const {
 	Vector3d B(0, 0, 0);
+	Candidate::countFieldEvaluations(1);
 	try {
 		// check if field is valid and use the field vector at the
 		// position pos with the redshift z
@@ -363,6 +560,32 @@ Vector3d DiffusionSDE::getMagneticFieldAtPosition(Vector3d pos, double z) const
 	return B;
 }
 
+void DiffusionSDE::getMagneticFieldsAtPositions(const Vector3d *pos,
+		Vector3d *B, const double *z, size_t n) const {
+	if (n == 0)
+		return;
+	if (not magneticField.valid()) {
+		for (size_t i = 0; i < n; i++)
+			B[i] = Vector3d(0, 0, 0);
+		return;
+	}
+
+	bool sameRedshift = true;
+	for (size_t i = 1; i < n; i++)
+		sameRedshift = sameRedshift and (z[i] == z[0]);
+
+	if (sameRedshift) {
+		try {
+			magneticField->getFields(pos, B, n, z[0]);
+			return;
+		} catch (std::exception &e) {
+			// evaluate point by point to report the failing positions
+		}
+	}
+	for (size_t i = 0; i < n; i++)
+		B[i] = getMagneticFieldAtPosition(pos[i], z[i]);
+}
+
 ref_ptr<AdvectionField> DiffusionSDE::getAdvectionField() const {
 	return advectionField;
 }
@@ -382,6 +605,10 @@ Vector3d DiffusionSDE::getAdvectionFieldAtPosition(Vector3d pos) const {
 	return AdvField;
 }
 
+size_t DiffusionSDE::getSizeOf() const {
+	return magneticField.valid() ? magneticField->getSizeOf() : 0;
+}
+
 std::string DiffusionSDE::getDescription() const {
 	std::stringstream s;
 	s << "minStep: " << minStep / kpc  << " kpc, ";
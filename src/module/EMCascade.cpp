@@ -33,6 +33,23 @@ void EMCascade::init() {
 	electronHist.assign(nD * nE, 0);
 	positronHist.reserve(nD * nE);
 	positronHist.assign(nD * nE, 0);
+	threadHist.clear(std::vector<uint64_t>(3 * nD * nE, 0));
+}
+
+static void addHistogram(std::vector<uint64_t> &sum, const std::vector<uint64_t> &h) {
+	for (size_t i = 0; i < sum.size(); i++)
+		sum[i] += h[i];
+}
+
+void EMCascade::endRun() {
+	size_t n = nD * nE;
+	std::vector<uint64_t> sum(3 * n, 0);
+	threadHist.merge(sum, addHistogram);
+	for (size_t i = 0; i < n; i++) {
+		photonHist[i] += sum[i];
+		electronHist[i] += sum[n + i];
+		positronHist[i] += sum[2 * n + i];
+	}
 }
 
 std::string EMCascade::getDescription() const {
@@ -60,18 +77,12 @@ void EMCascade::process(Candidate *candidate) const {
 	int iD = D / dD;
 	int i = (iD * nE) + iE;
 
-#pragma omp critical
-	{
-	if (id == 22)
-		photonHist[i] += 1;
-	else if (id == 11)
-		electronHist[i] += 1;
-	else
-		positronHist[i] += 1;
-	}
+	int type = (id == 22) ? 0 : ((id == 11) ? 1 : 2);
+	threadHist.local()[type * nD * nE + i] += 1;
 }
 
 void EMCascade::save(const std::string &filename) {
+	endRun();
 	std::ofstream outfile(filename.c_str());
 	if (!outfile) {
 		std::stringstream s;
@@ -115,6 +126,7 @@ void EMCascade::load(const std::string &filename) {
 
 void EMCascade::runCascade(const std::string &filename, int IRBFlag,
 		int RadioFlag, double Bfield, double cutCascade) {
+	endRun();
 
 	// set up DINT
 	std::string dataPath = getDataPath("dint");
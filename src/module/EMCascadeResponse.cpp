@@ -0,0 +1,246 @@
+#include "crpropa/module/EMCascadeResponse.h"
+#include "crpropa/Cosmology.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+size_t threadNumber() {
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+size_t maxThreads() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+// detects the candidates of EMCascadeResponse::build at the origin and
+// counts the photons in the histogram of the thread
+class CascadeArrival: public Module {
+	double Emin, logEmin, dlogE;
+	int nE;
+	mutable std::vector<std::vector<double> > histograms;
+public:
+	CascadeArrival(double logEmin, double dlogE, int nE) : logEmin(logEmin),
+			dlogE(dlogE), nE(nE), histograms(maxThreads()) {
+		Emin = std::pow(10, logEmin) * eV;
+		setDescription("EMCascadeResponse detection at the origin");
+	}
+
+	void process(Candidate *candidate) const {
+		if (candidate->current.getEnergy() < Emin) {
+			candidate->setActive(false);
+			return;
+		}
+		double x = candidate->current.getPosition().x;
+		if (x > 0) {
+			candidate->limitNextStep(x);
+			return;
+		}
+		candidate->setActive(false);
+		if (candidate->current.getId() != 22)
+			return;
+		double logE = std::log10(candidate->current.getEnergy() / eV);
+		int j = std::floor((logE - logEmin) / dlogE);
+		if ((j >= 0) and (j < nE))
+			histograms[threadNumber()][j] += candidate->getWeight();
+	}
+
+	std::vector<double> &getHistogram() const {
+		return histograms[threadNumber()];
+	}
+};
+
+} // namespace
+
+EMCascadeResponse::EMCascadeResponse(double Dmax, int nD, double logEmin,
+		double logEmax, double dlogE) : nD(nD), logEmin(logEmin),
+		logEmax(logEmax), dlogE(dlogE), Dmax(Dmax) {
+	if ((nD <= 0) or (Dmax <= 0) or (dlogE <= 0) or (logEmax <= logEmin))
+		throw std::runtime_error("EMCascadeResponse: invalid binning");
+	nE = std::floor((logEmax - logEmin) / dlogE + 0.5);
+	dD = Dmax / nD;
+	response.assign(2 * nD * nE * nE, 0);
+	threadSpectra.clear(std::vector<double>(nE, 0));
+}
+
+size_t EMCascadeResponse::index(int type, int iD, int iE) const {
+	return ((size_t(type) * nD + iD) * nE + iE) * nE;
+}
+
+void EMCascadeResponse::build(ref_ptr<ModuleList> cascade, size_t samples) {
+	if (samples == 0)
+		throw std::runtime_error("EMCascadeResponse: samples must be > 0");
+	ref_ptr<CascadeArrival> arrival = new CascadeArrival(logEmin, dlogE, nE);
+	cascade->add(arrival);
+
+	std::string error;
+	int cells = 2 * nD * nE;
+#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < cells; k++) {
+		int type = k / (nD * nE);
+		int iD = (k / nE) % nD;
+		int iE = k % nE;
+		double E = std::pow(10, logEmin + (iE + 0.5) * dlogE) * eV;
+		double D = (iD + 0.5) * dD;
+		std::vector<double> &histogram = arrival->getHistogram();
+		histogram.assign(nE, 0);
+		try {
+			for (size_t s = 0; s < samples; s++) {
+				ref_ptr<Candidate> c = new Candidate(type == 0 ? 22 : 11, E,
+						Vector3d(D, 0, 0), Vector3d(-1, 0, 0), comovingDistance2Redshift(D));
+				cascade->run(c, true);
+			}
+		} catch (std::exception &e) {
+#pragma omp critical(EMCascadeResponse)
+			error = e.what();
+		}
+		for (int j = 0; j < nE; j++)
+			response[index(type, iD, iE) + j] = histogram[j] / samples;
+	}
+
+	cascade->remove(cascade->size() - 1);
+	if (not error.empty())
+		throw std::runtime_error("EMCascadeResponse: " + error);
+}
+
+void EMCascadeResponse::save(const std::string &filename) const {
+	std::ofstream outfile(filename.c_str());
+	if (!outfile)
+		throw std::runtime_error("EMCascadeResponse: could not open " + filename);
+	outfile << "# EMCascadeResponse " << nD << " " << Dmax / Mpc << " " << nE
+			<< " " << logEmin << " " << dlogE << "\n";
+	outfile << "# type D/Mpc log10(E/eV) photons per arrival energy bin\n";
+	outfile.precision(12);
+	for (int type = 0; type < 2; type++)
+		for (int iD = 0; iD < nD; iD++)
+			for (int iE = 0; iE < nE; iE++) {
+				outfile << type << "\t" << (iD + 0.5) * dD / Mpc << "\t"
+						<< logEmin + (iE + 0.5) * dlogE;
+				const double *row = &response[index(type, iD, iE)];
+				for (int j = 0; j < nE; j++)
+					outfile << "\t" << row[j];
+				outfile << "\n";
+			}
+}
+
+void EMCascadeResponse::load(const std::string &filename) {
+	std::ifstream infile(filename.c_str());
+	if (!infile)
+		throw std::runtime_error("EMCascadeResponse: could not open " + filename);
+	std::string hash, name;
+	int n1, n2;
+	double d, l, w;
+	infile >> hash >> name >> n1 >> d >> n2 >> l >> w;
+	if (!infile or (name != "EMCascadeResponse"))
+		throw std::runtime_error("EMCascadeResponse: not a response table " + filename);
+	if ((n1 != nD) or (n2 != nE) or (std::fabs(d * Mpc - Dmax) > 1e-9 * Dmax)
+			or (std::fabs(l - logEmin) > 1e-9) or (std::fabs(w - dlogE) > 1e-9))
+		throw std::runtime_error("EMCascadeResponse: other binning in " + filename);
+	infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+	std::vector<double> table(response.size());
+	for (int k = 0; k < 2 * nD * nE; k++) {
+		double type, D, logE;
+		infile >> type >> D >> logE;
+		for (int j = 0; j < nE; j++)
+			infile >> table[size_t(k) * nE + j];
+		if (!infile)
+			throw std::runtime_error("EMCascadeResponse: error reading " + filename);
+	}
+	response.swap(table);
+}
+
+std::vector<double> EMCascadeResponse::getResponse(int id, double energy, double distance) const {
+	std::vector<double> row(nE, 0);
+	double logE = std::log10(energy / eV);
+	if ((id != 22) and (std::abs(id) != 11))
+		return row;
+	if ((logE < logEmin) or (logE >= logEmax) or (distance < 0) or (distance >= Dmax))
+		return row;
+	int iE = (logE - logEmin) / dlogE;
+	int iD = distance / dD;
+	const double *r = &response[index(id == 22 ? 0 : 1, iD, iE)];
+	row.assign(r, r + nE);
+	return row;
+}
+
+double EMCascadeResponse::getEnergy(int i) const {
+	return std::pow(10, logEmin + (i + 0.5) * dlogE) * eV;
+}
+
+int EMCascadeResponse::getNumberOfEnergyBins() const {
+	return nE;
+}
+
+void EMCascadeResponse::process(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if ((id != 22) and (id != 11) and (id != -11))
+		return;
+
+	candidate->setActive(false);
+
+	double logE = std::log10(candidate->current.getEnergy() / eV);
+	double D = candidate->current.getPosition().getR();  // distance to (0,0,0)
+	if ((logE < logEmin) or (logE >= logEmax) or (D >= Dmax))
+		return;
+
+	int iE = (logE - logEmin) / dlogE;
+	int iD = D / dD;
+	const double *row = &response[index(id == 22 ? 0 : 1, iD, iE)];
+	double w = candidate->getWeight();
+	std::vector<double> &spectrum = threadSpectra.local();
+	for (int j = 0; j < nE; j++)
+		spectrum[j] += w * row[j];
+}
+
+std::vector<double> EMCascadeResponse::getSpectrum() const {
+	std::vector<double> spectrum(nE, 0);
+	threadSpectra.forEach([&](const std::vector<double> &s) {
+		for (int j = 0; j < nE; j++)
+			spectrum[j] += s[j];
+	});
+	return spectrum;
+}
+
+void EMCascadeResponse::clearSpectrum() {
+	threadSpectra.clear();
+}
+
+void EMCascadeResponse::dumpSpectrum(const std::string &filename) const {
+	std::ofstream outfile(filename.c_str());
+	if (!outfile)
+		throw std::runtime_error("EMCascadeResponse: could not open " + filename);
+	outfile << "# log10(E/eV) photons\n";
+	std::vector<double> spectrum = getSpectrum();
+	for (int j = 0; j < nE; j++)
+		outfile << logEmin + (j + 0.5) * dlogE << "\t" << spectrum[j] << "\n";
+}
+
+std::string EMCascadeResponse::getDescription() const {
+	std::stringstream s;
+	s << "EMCascadeResponse: " << nD << " distance bins up to " << Dmax / Mpc
+			<< " Mpc, " << nE << " energy bins from 10^" << logEmin << " eV";
+	return s.str();
+}
+
+} // namespace crpropa
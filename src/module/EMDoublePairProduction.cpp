@@ -1,4 +1,5 @@
 #include "crpropa/module/EMDoublePairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
@@ -34,28 +35,31 @@ void EMDoublePairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
-void EMDoublePairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMDoublePairProduction::setAdaptiveThinning(ref_ptr<AdaptiveThinning> t) {
+	adaptiveThinning = t;
+}
 
-	if (!infile.good())
+ref_ptr<AdaptiveThinning> EMDoublePairProduction::getAdaptiveThinning() const {
+	return adaptiveThinning;
+}
+
+void EMDoublePairProduction::initRate(std::string filename) {
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMDoublePairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	// row: log10(E/eV), rate [1/Mpc]
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->columns(i) < 2)
+			continue;
+		tabEnergy.push_back(pow(10, table->get(i, 0)) * eV);
+		tabRate.push_back(table->get(i, 1) / Mpc);
 	}
-	infile.close();
+	rateTable.assign(tabEnergy, tabRate);
 }
 
 
@@ -78,34 +82,47 @@ void EMDoublePairProduction::performInteraction(Candidate *candidate) const {
 
 	double f = Ee / E;
 
-	if (haveElectrons) {
+	if (adaptiveThinning.valid()) {
+		adaptiveThinning->addSecondary(candidate, f, 11, Ee / (1 + z), pos, interactionTagCode);
+		adaptiveThinning->addSecondary(candidate, f, -11, Ee / (1 + z), pos, interactionTagCode);
+	} else if (haveElectrons) {
 		if (random.rand() < pow(1 - f, thinning)) {
 			double w = 1. / pow(1 - f, thinning);
-			candidate->addSecondary( 11, Ee / (1 + z), pos, w, interactionTag);
+			candidate->addSecondary( 11, Ee / (1 + z), pos, w, interactionTagCode);
 		} 
 		if (random.rand() < pow(f, thinning)) {
 			double w = 1. / pow(f, thinning);
-			candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTag);
+			candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTagCode);
 		}
 	}
 }
 
-void EMDoublePairProduction::process(Candidate *candidate) const {
+double EMDoublePairProduction::getInteractionRate(Candidate *candidate) const {
 	// check if photon
 	if (candidate->current.getId() != 22)
-		return;
+		return 0;
 
 	// scale the electron energy instead of background photons
-	double z = candidate->getRedshift();
-	double E = (1 + z) * candidate->current.getEnergy();
+	const StepQuantities &q = candidate->getStepQuantities();
+	double E = q.energy;
 
 	// check if in tabulated energy range
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+	double rate = rateTable(E);
+	return rate * q.redshift2 * q.getRedshiftScaling(photonField);
+}
+
+void EMDoublePairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMDoublePairProduction::process(Candidate *candidate) const {
+	double rate = getCachedInteractionRate(candidate);
+	if (rate == 0)
+		return;
 
 	// check for interaction
 	Random &random = Random::instance();
@@ -123,11 +140,15 @@ void EMDoublePairProduction::process(Candidate *candidate) const {
 
 void EMDoublePairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string EMDoublePairProduction::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t EMDoublePairProduction::getSizeOf() const {
+	return vectorSizeOf(tabEnergy) + vectorSizeOf(tabRate) + rateTable.getSizeOf();
+}
 
 } // namespace crpropa
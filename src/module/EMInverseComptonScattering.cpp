@@ -1,4 +1,5 @@
 #include "crpropa/module/EMInverseComptonScattering.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 #include "crpropa/Common.h"
@@ -20,8 +21,8 @@ EMInverseComptonScattering::EMInverseComptonScattering(ref_ptr<PhotonField> phot
 
 void EMInverseComptonScattering::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
-	std::string fname = photonField->getFieldName();
-	setDescription("EMInverseComptonScattering: " + fname);
+	std::string fname = interactionTableField(*photonField, "EMInverseComptonScattering/rate_", tableScale);
+	setDescription("EMInverseComptonScattering: " + photonField->getFieldName());
 	initRate(getDataPath("EMInverseComptonScattering/rate_" + fname + ".txt"));
 	initCumulativeRate(getDataPath("EMInverseComptonScattering/cdf_" + fname + ".txt"));
 }
@@ -38,74 +39,70 @@ void EMInverseComptonScattering::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
-void EMInverseComptonScattering::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMInverseComptonScattering::setAdaptiveThinning(ref_ptr<AdaptiveThinning> t) {
+	adaptiveThinning = t;
+}
+
+ref_ptr<AdaptiveThinning> EMInverseComptonScattering::getAdaptiveThinning() const {
+	return adaptiveThinning;
+}
 
-	if (!infile.good())
+void EMInverseComptonScattering::initRate(std::string filename) {
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	// row: log10(E/eV), rate [1/Mpc]
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->columns(i) < 2)
+			continue;
+		tabEnergy.push_back(pow(10, table->get(i, 0)) * eV);
+		tabRate.push_back(table->get(i, 1) / Mpc);
 	}
-	infile.close();
+	rateTable.assign(tabEnergy, tabRate);
 }
 
 void EMInverseComptonScattering::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMInverseComptonScattering: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
 	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
+	tabSampler.clear();
+
+	if (table->size() == 0)
+		return;
+
+	// first row: s values (first value is skipped)
+	const double *row = table->row(0);
+	for (size_t j = 1; j < table->columns(0); j++)
+		tabs.push_back(pow(10, row[j]) * eV * eV);
 
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
+	// all following rows: E, cdf values
+	for (size_t i = 1; i < table->size(); i++) {
+		row = table->row(i, 1 + tabs.size());
+		tabE.push_back(pow(10, row[0]) * eV);
 		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[j + 1] / Mpc);
 		tabCDF.push_back(cdf);
+		tabSampler.addCDF(cdf);
 	}
-	infile.close();
+	tabEAxis.assign(tabE);
 }
 
 // Class to calculate the energy distribution of the ICS photon and to sample from it
 class ICSSecondariesEnergyDistribution {
 	private:
-		std::vector< std::vector<double> > data;
-		std::vector<double> s_values;
+		AliasTable data;
+		TableAxis s_values;
 		size_t Ns;
 		size_t Nrer;
 		double s_min;
@@ -126,13 +123,13 @@ class ICSSecondariesEnergyDistribution {
 			s_min = mec2 * mec2;
 			s_max = 1e23 * eV * eV;
 			dls = (log(s_max) - log(s_min)) / Ns;
-			data = std::vector< std::vector<double> >(1000, std::vector<double>(1000));
 			std::vector<double> data_i(1000);
 
 			// tabulate s bin borders
-			s_values = std::vector<double>(1001);
+			std::vector<double> s_borders(Ns + 1);
 			for (size_t i = 0; i < Ns + 1; ++i)
-				s_values[i] = s_min * exp(i*dls);
+				s_borders[i] = s_min * exp(i*dls);
+			s_values.assign(s_borders);
 
 
 			// for each s tabulate cumulative differential cross section
@@ -150,16 +147,19 @@ class ICSSecondariesEnergyDistribution {
 					data_i[j] = dSigmadE(x, beta) * dx;
 					data_i[j] += data_i[j-1];
 				}
-				data[i] = data_i;
+				data.addCDF(data_i);
 			}
 		}
 
 		// draw random energy for the up-scattered photon Ep(Ee, s)
 		double sample(double Ee, double s) {
-			size_t idx = std::lower_bound(s_values.begin(), s_values.end(), s) - s_values.begin();
-			std::vector<double> s0 = data[idx];
+			// first border >= s as std::lower_bound
+			size_t idx = s_values.index(s);
+			if (s > s_values[idx])
+				idx++;
+			idx = std::min(idx, data.size() - 1);
 			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1; // draw random bin (upper bin boundary returned)
+			size_t j = data.draw(idx, random) + 1; // draw random bin (upper bin boundary returned)
 			double beta = (s - s_min) / (s + s_min);
 			double x0 = (1 - beta) / (1 + beta);
 			double dlx = -log(x0) / Nrer;
@@ -174,13 +174,15 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 	double z = candidate->getRedshift();
 	double E = candidate->current.getEnergy() * (1 + z);
 
-	if (E < tabE.front() or E > tabE.back())
+	// the distribution of s is that of the tables at E * tableScale
+	double Es = E * tableScale;
+	if (Es < tabE.front() or Es > tabE.back())
 		return;
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabEAxis.closest(Es);
+	size_t j = tabSampler.draw(i, random);
 	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
 	double s = s_kin + mec2 * mec2;
 
@@ -191,11 +193,15 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 	// add up-scattered photon
 	double Esecondary = E - Enew;
 	double f = Enew / E;
-	if (havePhotons) {
+	if (havePhotons and adaptiveThinning.valid()) {
+		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+		adaptiveThinning->addSecondary(candidate, 1 - f, 22, Esecondary / (1 + z), pos, interactionTagCode);
+		adaptiveThinning->keep(candidate, f);
+	} else if (havePhotons) {
 		if (random.rand() < pow(1 - f, thinning)) {
 			double w = 1. / pow(1 - f, thinning);
 			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
-			candidate->addSecondary(22, Esecondary / (1 + z), pos, w, interactionTag);
+			candidate->addSecondary(22, Esecondary / (1 + z), pos, w, interactionTagCode);
 		}
 	}
 
@@ -203,22 +209,32 @@ void EMInverseComptonScattering::performInteraction(Candidate *candidate) const
 	candidate->current.setEnergy(Enew / (1 + z));
 }
 
-void EMInverseComptonScattering::process(Candidate *candidate) const {
+double EMInverseComptonScattering::getInteractionRate(Candidate *candidate) const {
 	// check if electron / positron
 	int id = candidate->current.getId();
 	if (abs(id) != 11)
-		return;
+		return 0;
 
 	// scale the particle energy instead of background photons
-	double z = candidate->getRedshift();
-	double E = candidate->current.getEnergy() * (1 + z);
+	const StepQuantities &q = candidate->getStepQuantities();
+	double E = q.energy * tableScale;
 
 	if (E < tabEnergy.front() or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+	double rate = rateTable(E) * pow_integer<3>(tableScale);
+	return rate * q.redshift2 * q.getRedshiftScaling(photonField);
+}
+
+void EMInverseComptonScattering::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMInverseComptonScattering::process(Candidate *candidate) const {
+	double rate = getCachedInteractionRate(candidate);
+	if (rate == 0)
+		return;
 
 	// run this loop at least once to limit the step size
 	double step = candidate->getCurrentStep();
@@ -240,10 +256,17 @@ void EMInverseComptonScattering::process(Candidate *candidate) const {
 
 void EMInverseComptonScattering::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string EMInverseComptonScattering::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t EMInverseComptonScattering::getSizeOf() const {
+	return vectorSizeOf(tabEnergy) + vectorSizeOf(tabRate) + rateTable.getSizeOf()
+			+ vectorSizeOf(tabE) + vectorSizeOf(tabs) + vectorSizeOf(tabCDF)
+			+ tabSampler.getSizeOf() + tabEAxis.getSizeOf();
+}
+
 } // namespace crpropa
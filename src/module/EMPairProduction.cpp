@@ -1,4 +1,5 @@
 #include "crpropa/module/EMPairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
@@ -20,8 +21,8 @@ EMPairProduction::EMPairProduction(ref_ptr<PhotonField> photonField, bool haveEl
 
 void EMPairProduction::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
-	std::string fname = photonField->getFieldName();
-	setDescription("EMPairProduction: " + fname);
+	std::string fname = interactionTableField(*photonField, "EMPairProduction/rate_", tableScale);
+	setDescription("EMPairProduction: " + photonField->getFieldName());
 	initRate(getDataPath("EMPairProduction/rate_" + fname + ".txt"));
 	initCumulativeRate(getDataPath("EMPairProduction/cdf_" + fname + ".txt"));
 }
@@ -38,74 +39,70 @@ void EMPairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
-void EMPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMPairProduction::setAdaptiveThinning(ref_ptr<AdaptiveThinning> t) {
+	adaptiveThinning = t;
+}
+
+ref_ptr<AdaptiveThinning> EMPairProduction::getAdaptiveThinning() const {
+	return adaptiveThinning;
+}
 
-	if (!infile.good())
+void EMPairProduction::initRate(std::string filename) {
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMPairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	// row: log10(E/eV), rate [1/Mpc]
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->columns(i) < 2)
+			continue;
+		tabEnergy.push_back(pow(10, table->get(i, 0)) * eV);
+		tabRate.push_back(table->get(i, 1) / Mpc);
 	}
-	infile.close();
+	rateTable.assign(tabEnergy, tabRate);
 }
 
 void EMPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMPairProduction: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
 	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
+	tabSampler.clear();
+
+	if (table->size() == 0)
+		return;
+
+	// first row: s values (first value is skipped)
+	const double *row = table->row(0);
+	for (size_t j = 1; j < table->columns(0); j++)
+		tabs.push_back(pow(10, row[j]) * eV * eV);
 
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
+	// all following rows: E, cdf values
+	for (size_t i = 1; i < table->size(); i++) {
+		row = table->row(i, 1 + tabs.size());
+		tabE.push_back(pow(10, row[0]) * eV);
 		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[j + 1] / Mpc);
 		tabCDF.push_back(cdf);
+		tabSampler.addCDF(cdf);
 	}
-	infile.close();
+	tabEAxis.assign(tabE);
 }
 
 // Hold an data array to interpolate the energy distribution on
 class PPSecondariesEnergyDistribution {
 	private:
-		std::vector<double> tab_s;
-		std::vector< std::vector<double> > data;
+		TableAxis tab_s;
+		AliasTable data;
 		size_t N;
 
 	public:
@@ -123,11 +120,10 @@ class PPSecondariesEnergyDistribution {
 			double s_min = 4 * mec2 * mec2;
 			double s_max = 1e23 * eV * eV;
 			double dls = log(s_max / s_min) / Ns;
-			data = std::vector< std::vector<double> >(Ns, std::vector<double>(N));
-			tab_s = std::vector<double>(Ns + 1);
-
+			std::vector<double> s_borders(Ns + 1);
 			for (size_t i = 0; i < Ns + 1; ++i)
-				tab_s[i] = s_min * exp(i*dls); // tabulate s bin borders
+				s_borders[i] = s_min * exp(i*dls); // tabulate s bin borders
+			tab_s.assign(s_borders);
 
 			for (size_t i = 0; i < Ns; i++) {
 				double s = s_min * exp(i*dls + 0.5*dls);
@@ -143,19 +139,22 @@ class PPSecondariesEnergyDistribution {
 					double binWidth = exp((j+1)*dx)-exp(j*dx);
 					data_i[j] = dSigmadE_PPx(x, beta) * binWidth + data_i[j-1];
 				}
-				data[i] = data_i;
+				data.addCDF(data_i);
 			}
 		}
 
 		// sample positron energy from cdf(E, s_kin)
 		double sample(double E0, double s) {
 			// get distribution for given s
-			size_t idx = std::lower_bound(tab_s.begin(), tab_s.end(), s) - tab_s.begin();
-			std::vector<double> s0 = data[idx];
+			// first border >= s as std::lower_bound
+			size_t idx = tab_s.index(s);
+			if (s > tab_s[idx])
+				idx++;
+			idx = std::min(idx, data.size() - 1);
 
 			// draw random bin
 			Random &random = Random::instance();
-			size_t j = random.randBin(s0) + 1;
+			size_t j = data.draw(idx, random) + 1;
 
 			double s_min = 4. * mec2 * mec2;
 			double beta = sqrtl(1. - s_min / s);
@@ -182,13 +181,15 @@ void EMPairProduction::performInteraction(Candidate *candidate) const {
 		return;
 
 	// check if in tabulated energy range
-	if (E < tabE.front() or (E > tabE.back()))
+	// the distribution of s is that of the tables at E * tableScale
+	double Es = E * tableScale;
+	if (Es < tabE.front() or (Es > tabE.back()))
 		return;
 
 	// sample the value of s
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);  // find closest tabulation point
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabEAxis.closest(Es);  // find closest tabulation point
+	size_t j = tabSampler.draw(i, random);
 	double lo = std::max(4 * mec2 * mec2, tabs[j-1]);  // first s-tabulation point below min(s_kin) = (2 me c^2)^2; ensure physical value
 	double hi = tabs[j];
 	double s = lo + random.rand() * (hi - lo);
@@ -206,32 +207,47 @@ void EMPairProduction::performInteraction(Candidate *candidate) const {
 	// sample random position along current step
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 	// apply sampling
+	if (adaptiveThinning.valid()) {
+		adaptiveThinning->addSecondary(candidate, f, 11, Ep / (1 + z), pos, interactionTagCode);
+		adaptiveThinning->addSecondary(candidate, 1 - f, -11, Ee / (1 + z), pos, interactionTagCode);
+		return;
+	}
 	if (random.rand() < pow(f, thinning)) {
 		double w = 1. / pow(f, thinning);
-		candidate->addSecondary(11, Ep / (1 + z), pos, w, interactionTag);
+		candidate->addSecondary(11, Ep / (1 + z), pos, w, interactionTagCode);
 	}
 	if (random.rand() < pow(1 - f, thinning)){
 		double w = 1. / pow(1 - f, thinning);
-		candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTag);	
+		candidate->addSecondary(-11, Ee / (1 + z), pos, w, interactionTagCode);	
 	}
 }
 
-void EMPairProduction::process(Candidate *candidate) const {
+double EMPairProduction::getInteractionRate(Candidate *candidate) const {
 	// check if photon
 	if (candidate->current.getId() != 22)
-		return;
+		return 0;
 
 	// scale particle energy instead of background photon energy
-	double z = candidate->getRedshift();
-	double E = candidate->current.getEnergy() * (1 + z);
+	const StepQuantities &q = candidate->getStepQuantities();
+	double E = q.energy * tableScale;
 
 	// check if in tabulated energy range
 	if ((E < tabEnergy.front()) or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// interaction rate
-	double rate = interpolate(E, tabEnergy, tabRate);
-	rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
+	double rate = rateTable(E) * pow_integer<3>(tableScale);
+	return rate * q.redshift2 * q.getRedshiftScaling(photonField);
+}
+
+void EMPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMPairProduction::process(Candidate *candidate) const {
+	double rate = getCachedInteractionRate(candidate);
+	if (rate == 0)
+		return;
 
 	// run this loop at least once to limit the step size 
 	double step = candidate->getCurrentStep();
@@ -252,10 +268,17 @@ void EMPairProduction::process(Candidate *candidate) const {
 
 void EMPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string EMPairProduction::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t EMPairProduction::getSizeOf() const {
+	return vectorSizeOf(tabEnergy) + vectorSizeOf(tabRate) + rateTable.getSizeOf()
+			+ vectorSizeOf(tabE) + vectorSizeOf(tabs) + vectorSizeOf(tabCDF)
+			+ tabSampler.getSizeOf() + tabEAxis.getSizeOf();
+}
+
 } // namespace crpropa
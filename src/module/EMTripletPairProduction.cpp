@@ -1,4 +1,5 @@
 #include "crpropa/module/EMTripletPairProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
 
@@ -37,68 +38,63 @@ void EMTripletPairProduction::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
-void EMTripletPairProduction::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
+void EMTripletPairProduction::setAdaptiveThinning(ref_ptr<AdaptiveThinning> t) {
+	adaptiveThinning = t;
+}
+
+ref_ptr<AdaptiveThinning> EMTripletPairProduction::getAdaptiveThinning() const {
+	return adaptiveThinning;
+}
 
-	if (!infile.good())
+void EMTripletPairProduction::initRate(std::string filename) {
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("EMTripletPairProduction: could not open file " + filename);
 
 	// clear previously loaded interaction rates
 	tabEnergy.clear();
 	tabRate.clear();
 
-	while (infile.good()) {
-		if (infile.peek() != '#') {
-			double a, b;
-			infile >> a >> b;
-			if (infile) {
-				tabEnergy.push_back(pow(10, a) * eV);
-				tabRate.push_back(b / Mpc);
-			}
-		}
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
+	// row: log10(E/eV), rate [1/Mpc]
+	for (size_t i = 0; i < table->size(); i++) {
+		if (table->columns(i) < 2)
+			continue;
+		tabEnergy.push_back(pow(10, table->get(i, 0)) * eV);
+		tabRate.push_back(table->get(i, 1) / Mpc);
 	}
-	infile.close();
+	rateTable.assign(tabEnergy, tabRate);
 }
 
 void EMTripletPairProduction::initCumulativeRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-
-	if (!infile.good())
-		throw std::runtime_error(
-				"EMTripletPairProduction: could not open file " + filename);
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
+		throw std::runtime_error("EMTripletPairProduction: could not open file " + filename);
 
 	// clear previously loaded tables
 	tabE.clear();
 	tabs.clear();
 	tabCDF.clear();
-	
-	// skip header
-	while (infile.peek() == '#')
-		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
-
-	// read s values in first line
-	double a;
-	infile >> a; // skip first value
-	while (infile.good() and (infile.peek() != '\n')) {
-		infile >> a;
-		tabs.push_back(pow(10, a) * eV * eV);
-	}
+	tabSampler.clear();
+
+	if (table->size() == 0)
+		return;
+
+	// first row: s values (first value is skipped)
+	const double *row = table->row(0);
+	for (size_t j = 1; j < table->columns(0); j++)
+		tabs.push_back(pow(10, row[j]) * eV * eV);
 
-	// read all following lines: E, cdf values
-	while (infile.good()) {
-		infile >> a;
-		if (!infile)
-			break;  // end of file
-		tabE.push_back(pow(10, a) * eV);
+	// all following rows: E, cdf values
+	for (size_t i = 1; i < table->size(); i++) {
+		row = table->row(i, 1 + tabs.size());
+		tabE.push_back(pow(10, row[0]) * eV);
 		std::vector<double> cdf;
-		for (int i = 0; i < tabs.size(); i++) {
-			infile >> a;
-			cdf.push_back(a / Mpc);
-		}
+		for (size_t j = 0; j < tabs.size(); j++)
+			cdf.push_back(row[j + 1] / Mpc);
 		tabCDF.push_back(cdf);
+		tabSampler.addCDF(cdf);
 	}
-	infile.close();
+	tabEAxis.assign(tabE);
 }
 
 void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
@@ -115,8 +111,8 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 
 	// sample the value of eps
 	Random &random = Random::instance();
-	size_t i = closestIndex(E, tabE);
-	size_t j = random.randBin(tabCDF[i]);
+	size_t i = tabEAxis.closest(E);
+	size_t j = tabSampler.draw(i, random);
 	double s_kin = pow(10, log10(tabs[j]) + (random.rand() - 0.5) * 0.1);
 	double eps = s_kin / 4. / E; // random background photon energy
 
@@ -127,15 +123,20 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 
 	double f = Epp / E;
 
-	if (haveElectrons) {
+	if (haveElectrons and adaptiveThinning.valid()) {
+		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+		adaptiveThinning->addSecondary(candidate, f, 11, Epp / (1 + z), pos, interactionTagCode);
+		adaptiveThinning->addSecondary(candidate, f, -11, Epp / (1 + z), pos, interactionTagCode);
+		adaptiveThinning->keep(candidate, 1 - 2 * f);
+	} else if (haveElectrons) {
 		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 		if (random.rand() < pow(1 - f, thinning)) {
 			double w = 1. / pow(1 - f, thinning);
-			candidate->addSecondary(11, Epp / (1 + z), pos, w, interactionTag);
+			candidate->addSecondary(11, Epp / (1 + z), pos, w, interactionTagCode);
 		}
 		if (random.rand() < pow(f, thinning)) {
 			double w = 1. / pow(f, thinning);
-			candidate->addSecondary(-11, Epp / (1 + z), pos, w, interactionTag);
+			candidate->addSecondary(-11, Epp / (1 + z), pos, w, interactionTagCode);
 		}
 	}
 	// Update the primary particle energy.
@@ -143,23 +144,33 @@ void EMTripletPairProduction::performInteraction(Candidate *candidate) const {
 	candidate->current.setEnergy((E - 2 * Epp) / (1. + z));
 }
 
-void EMTripletPairProduction::process(Candidate *candidate) const {
+double EMTripletPairProduction::getInteractionRate(Candidate *candidate) const {
 	// check if electron / positron
 	int id = candidate->current.getId();
 	if (abs(id) != 11)
-		return;
+		return 0;
 
 	// scale the particle energy instead of background photons
-	double z = candidate->getRedshift();
-	double E = (1 + z) * candidate->current.getEnergy();
+	const StepQuantities &q = candidate->getStepQuantities();
+	double E = q.energy;
 
 	// check if in tabulated energy range
 	if ((E < tabEnergy.front()) or (E > tabEnergy.back()))
-		return;
+		return 0;
 
 	// cosmological scaling of interaction distance (comoving)
-	double scaling = pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);
-	double rate = scaling * interpolate(E, tabEnergy, tabRate);
+	double scaling = q.redshift2 * q.getRedshiftScaling(photonField);
+	return scaling * rateTable(E);
+}
+
+void EMTripletPairProduction::interact(Candidate *candidate) const {
+	performInteraction(candidate);
+}
+
+void EMTripletPairProduction::process(Candidate *candidate) const {
+	double rate = getCachedInteractionRate(candidate);
+	if (rate == 0)
+		return;
 
 	// run this loop at least once to limit the step size
 	double step = candidate->getCurrentStep();
@@ -178,10 +189,17 @@ void EMTripletPairProduction::process(Candidate *candidate) const {
 
 void EMTripletPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string EMTripletPairProduction::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t EMTripletPairProduction::getSizeOf() const {
+	return vectorSizeOf(tabEnergy) + vectorSizeOf(tabRate) + rateTable.getSizeOf()
+			+ vectorSizeOf(tabE) + vectorSizeOf(tabs) + vectorSizeOf(tabCDF)
+			+ tabSampler.getSizeOf() + tabEAxis.getSizeOf();
+}
+
 } // namespace crpropa
@@ -25,10 +25,11 @@ ElasticScattering::ElasticScattering(ref_ptr<PhotonField> f) {
 
 void ElasticScattering::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
-	std::string fname = photonField->getFieldName();
-	setDescription("ElasticScattering: " + fname);
-	initRate(getDataPath("ElasticScattering/rate_" + fname.substr(0,3) + ".txt"));
-	initCDF(getDataPath("ElasticScattering/cdf_" + fname.substr(0,3) + ".txt"));
+	std::string fname = interactionTableField(*photonField, "ElasticScattering/rate_", tableScale, 3);
+	lgTableScale = log10(tableScale);
+	setDescription("ElasticScattering: " + photonField->getFieldName());
+	initRate(getDataPath("ElasticScattering/rate_" + fname + ".txt"));
+	initCDF(getDataPath("ElasticScattering/cdf_" + fname + ".txt"));
 }
 
 void ElasticScattering::initRate(std::string filename) {
@@ -59,6 +60,7 @@ void ElasticScattering::initCDF(std::string filename) {
 		throw std::runtime_error("ElasticScattering: could not open file " + filename);
 
 	tabCDF.clear();
+	tabSampler.clear();
 	std::string line;
 	double a;
 	while (std::getline(infile, line)) {
@@ -74,51 +76,66 @@ void ElasticScattering::initCDF(std::string filename) {
 			cdf[i] = a;
 		}
 		tabCDF.push_back(cdf);
+		tabSampler.addCDF(cdf);
 	}
 
 	infile.close();
 }
 
-void ElasticScattering::process(Candidate *candidate) const {
-	int id = candidate->current.getId();
-	double z = candidate->getRedshift();
-
-	if (not isNucleus(id))
-		return;
+double ElasticScattering::getInteractionRate(Candidate *candidate) const {
+	const ParticleState &state = candidate->current;
+	if (not state.isNucleus())
+		return 0;
 
-	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
+	const StepQuantities &q = candidate->getStepQuantities();
+	double lg = q.lgLorentzFactor + lgTableScale;
 	if ((lg < lgmin) or (lg > lgmax))
-		return;
+		return 0;
 
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = state.getMassNumber();
+	int Z = state.getChargeNumber();
 	int N = A - Z;
 
-	double step = candidate->getCurrentStep();
-	while (step > 0) {
+	double rate = interpolateEquidistant(lg, lgmin, lgmax, tabRate);
+	rate *= Z * N / double(A);  // TRK scaling
+	rate *= pow_integer<3>(tableScale);  // temperature scaling of the tables
+	rate *= q.redshift2 * q.getRedshiftScaling(photonField);  // cosmological scaling
+	return rate;
+}
+
+void ElasticScattering::interact(Candidate *candidate) const {
+	const StepQuantities &q = candidate->getStepQuantities();
+	double lg = q.lgLorentzFactor + lgTableScale;
+	Random &random = Random::instance();
+
+	// draw random background photon energy from CDF
+	size_t i = floor((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest gamma tabulation point
+	size_t j = tabSampler.draw(i, random) - 1; // index of next lower tabulated eps value
+	double binWidth = (epsmax - epsmin) / (neps - 1); // logarithmic bin width
+	double eps = pow(10, epsmin + (j + random.rand()) * binWidth);
 
-		double rate = interpolateEquidistant(lg, lgmin, lgmax, tabRate);
-		rate *= Z * N / double(A);  // TRK scaling
-		rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z);  // cosmological scaling
+	// boost to lab frame
+	double cosTheta = 2 * random.rand() - 1;
+	double E = eps * q.lorentzFactor * (1. - cosTheta);
 
+	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+	candidate->addSecondary(22, E, pos, 1., interactionTagCode);
+}
+
+void ElasticScattering::process(Candidate *candidate) const {
+	double rate = getCachedInteractionRate(candidate);
+	if (rate == 0)
+		return;
+
+	double step = candidate->getCurrentStep();
+	while (step > 0) {
 		// check for interaction
 		Random &random = Random::instance();
 		double randDist = -log(random.rand()) / rate;
 		if (step < randDist)
 			return;
 
-		// draw random background photon energy from CDF
-		size_t i = floor((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest gamma tabulation point
-		size_t j = random.randBin(tabCDF[i]) - 1; // index of next lower tabulated eps value
-		double binWidth = (epsmax - epsmin) / (neps - 1); // logarithmic bin width
-		double eps = pow(10, epsmin + (j + random.rand()) * binWidth);
-
-		// boost to lab frame
-		double cosTheta = 2 * random.rand() - 1;
-		double E = eps * candidate->current.getLorentzFactor() * (1. - cosTheta);
-
-		Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
-		candidate->addSecondary(22, E, pos, 1., interactionTag);
+		interact(candidate);
 
 		// repeat with remaining step
 		step -= randDist;
@@ -127,6 +144,7 @@ void ElasticScattering::process(Candidate *candidate) const {
 
 void ElasticScattering::setInteractionTag(std::string tag) {
 	this -> interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string ElasticScattering::getInteractionTag() const {
@@ -3,6 +3,7 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/ScratchVector.h"
 
 #include <fstream>
 #include <limits>
@@ -55,6 +56,7 @@ void ElectronPairProduction::initRate(std::string filename) {
 		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
 	}
 	infile.close();
+	lossRateTable.assign(tabLorentzFactor, tabLossRate);
 }
 
 void ElectronPairProduction::initSpectrum(std::string filename) {
@@ -75,10 +77,21 @@ void ElectronPairProduction::initSpectrum(std::string filename) {
 		}
 	}
 	infile.close();
+
+	spectrumSampler.clear();
+	for (size_t i = 0; i < 70; i++)
+		spectrumSampler.addCDF(tabSpectrum[i]);
 }
 
 double ElectronPairProduction::lossLength(int id, double lf, double z) const {
 	double Z = chargeNumber(id);
+	if (Z == 0)
+		return std::numeric_limits<double>::max(); // no pair production on uncharged particles
+	double A = nuclearMass(id) / mass_proton; // more accurate than massNumber(Id)
+	return lossLength(Z, A, lf, z);
+}
+
+double ElectronPairProduction::lossLength(double Z, double A, double lf, double z) const {
 	if (Z == 0)
 		return std::numeric_limits<double>::max(); // no pair production on uncharged particles
 
@@ -88,26 +101,66 @@ double ElectronPairProduction::lossLength(int id, double lf, double z) const {
 
 	double rate;
 	if (lf < tabLorentzFactor.back())
-		rate = interpolate(lf, tabLorentzFactor, tabLossRate); // interpolation
+		rate = lossRateTable(lf); // interpolation
 	else
 		rate = tabLossRate.back() * pow(lf / tabLorentzFactor.back(), -0.6); // extrapolation
 
-	double A = nuclearMass(id) / mass_proton; // more accurate than massNumber(Id)
 	rate *= Z * Z / A * pow_integer<3>(1 + z) * photonField->getRedshiftScaling(z);
 	return 1. / rate;
 }
 
 void ElectronPairProduction::process(Candidate *c) const {
-	int id = c->current.getId();
-	if (not (isNucleus(id)))
+	const ParticleState &state = c->current;
+	if (not state.isNucleus())
 		return; // only nuclei
 
-	double lf = c->current.getLorentzFactor();
+	double lf = c->getStepQuantities().lorentzFactor;
 	double z = c->getRedshift();
-	double losslen = lossLength(id, lf, z);  // energy loss length
+	double losslen = lossLength(state.getChargeNumber(), state.getMass() / mass_proton, lf, z);  // energy loss length
 	if (losslen >= std::numeric_limits<double>::max())
 		return;
+	applyLoss(c, lf, losslen);
+}
+
+void ElectronPairProduction::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	// Lorentz factors in the frame of the photon field of the charged nuclei above the threshold
+	ScratchVector<Candidate *> lanes;
+	ScratchVector<double> lfs, lfsLocal;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		Candidate *c = candidates[i];
+		const ParticleState &state = c->current;
+		if ((not state.isNucleus()) or (state.getChargeNumber() == 0))
+			continue;
+		double lf = c->getStepQuantities().lorentzFactor;
+		if (lf * (1 + c->getRedshift()) < tabLorentzFactor.front())
+			continue;
+		lanes->push_back(c);
+		lfsLocal->push_back(lf);
+		lfs->push_back(lf * (1 + c->getRedshift()));
+	}
+	size_t n = lanes.size();
+	if (n == 0)
+		return;
+
+	ScratchVector<double> rates(n);
+	lossRateTable.evaluate(&lfs[0], &rates[0], n);
+
+	for (size_t i = 0; i < n; i++) {
+		Candidate *c = lanes[i];
+		const ParticleState &state = c->current;
+		double z = c->getRedshift();
+		double rate = rates[i];
+		if (not (lfs[i] < tabLorentzFactor.back()))
+			rate = tabLossRate.back() * pow(lfs[i] / tabLorentzFactor.back(), -0.6); // extrapolation
+		double Z = state.getChargeNumber();
+		rate *= Z * Z / (state.getMass() / mass_proton) * pow_integer<3>(1 + z)
+				* photonField->getRedshiftScaling(z);
+		applyLoss(c, lfsLocal[i], 1. / rate);
+	}
+}
 
+void ElectronPairProduction::applyLoss(Candidate *c, double lf, double losslen) const {
+	double z = c->getRedshift();
 	double step = c->getCurrentStep() / (1 + z); // step size in local frame
 	double loss = step / losslen;  // relative energy loss
 
@@ -119,7 +172,7 @@ void ElectronPairProduction::process(Candidate *c) const {
 
 		// draw pairs as long as their energy is smaller than the pair production energy loss
 		while (dE > 0) {
-			size_t j = random.randBin(tabSpectrum[i]);
+			size_t j = spectrumSampler.draw(i, random);
 			double Ee = pow(10, 6.95 + (j + random.rand()) * 0.1) * eV;
 			double Epair = 2 * Ee; // NOTE: electron and positron in general don't have same lab frame energy, but averaged over many draws the result is consistent
 			// if the remaining energy is not sufficient check for random accepting
@@ -130,8 +183,8 @@ void ElectronPairProduction::process(Candidate *c) const {
 			// create pair and repeat with remaining energy
 			dE -= Epair;
 			Vector3d pos = random.randomInterpolatedPosition(c->previous.getPosition(), c->current.getPosition());
-			c->addSecondary( 11, Ee, pos, 1., interactionTag);
-			c->addSecondary(-11, Ee, pos, 1., interactionTag);
+			c->addSecondary( 11, Ee, pos, 1., interactionTagCode);
+			c->addSecondary(-11, Ee, pos, 1., interactionTagCode);
 		}
 	}
 
@@ -141,11 +194,17 @@ void ElectronPairProduction::process(Candidate *c) const {
 
 void ElectronPairProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string ElectronPairProduction::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t ElectronPairProduction::getSizeOf() const {
+	return vectorSizeOf(tabLossRate) + vectorSizeOf(tabLorentzFactor)
+			+ lossRateTable.getSizeOf() + spectrumSampler.getSizeOf()
+			+ vectorSizeOf(tabSpectrum);
+}
 
 } // namespace crpropa
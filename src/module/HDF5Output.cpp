@@ -1,15 +1,27 @@
 #ifdef CRPROPA_HAVE_HDF5
 
 #include "crpropa/module/HDF5Output.h"
+#include "crpropa/Checkpoint.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
 #include "kiss/logger.h"
 
 #include <hdf5.h>
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <memory>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 const hsize_t RANK = 1;
 const hsize_t BUFFER_SIZE = 1024 * 16;
+const size_t THREAD_BUFFER_SIZE = 256;
+// ids of the registered filter plugins
+const H5Z_filter_t H5Z_FILTER_BLOSC = 32001;
+const H5Z_filter_t H5Z_FILTER_ZSTD = 32015;
 
 namespace crpropa {
 
@@ -48,13 +60,13 @@ hid_t variantTypeToH5T_NATIVE(Variant::Type type) {
 	}
 }
 
-HDF5Output::HDF5Output() :  Output(), filename(), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output() :  Output(), filename(), file(-1), sid(-1), dset(-1), dataspace(-1), opened(false), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()), chunkSize(BUFFER_SIZE), compression(DeflateCompression), compressionLevel(5), syncInterval(0), lastSync(0) {
 }
 
-HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename) :  Output(), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), opened(false), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()), chunkSize(BUFFER_SIZE), compression(DeflateCompression), compressionLevel(5), syncInterval(0), lastSync(0) {
 }
 
-HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+HDF5Output::HDF5Output(const std::string& filename, OutputType outputtype) :  Output(outputtype), filename(filename), file(-1), sid(-1), dset(-1), dataspace(-1), opened(false), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()), chunkSize(BUFFER_SIZE), compression(DeflateCompression), compressionLevel(5), syncInterval(0), lastSync(0) {
 	outputtype = outputtype;
 }
 
@@ -98,7 +110,13 @@ herr_t HDF5Output::insertDoubleAttribute(const std::string &key, const double &v
 
 
 void HDF5Output::open(const std::string& filename) {
-	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	// continue the file of an interrupted run after its last checkpoint
+	size_t offset, n;
+	bool resume = Checkpoint::getRestart(filename, offset, n);
+	if (resume)
+		file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+	else
+		file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
 	if (file < 0)
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 
@@ -166,7 +184,7 @@ void HDF5Output::open(const std::string& filename) {
 		H5Tinsert(sid, "W", HOFFSET(OutputRow, weight), H5T_NATIVE_DOUBLE);
 	
 	if (fields.test(CandidateTagColumn)) 
-		H5Tinsert(sid, "tag", HOFFSET(OutputRow, tag), H5T_C_S1);
+		H5Tinsert(sid, "tag", HOFFSET(OutputRow, tag), H5T_NATIVE_UINT32);
 
 	size_t pos = 0;
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
@@ -188,12 +206,52 @@ void HDF5Output::open(const std::string& filename) {
 		throw std::runtime_error("Size of property buffer exceeded");
 	}
 
+	buffer.reserve(BUFFER_SIZE);
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	threadBuffers.resize(nThreads);
+	for (size_t i = 0; i < nThreads; i++)
+		threadBuffers[i].reserve(THREAD_BUFFER_SIZE);
+	time(&lastFlush);
+
+	// the codes of this process are mapped to those already in the file
+	tagCodes.clear();
+	tagNames.clear();
+
+	if (resume) {
+		dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+		if (dset < 0)
+			throw std::runtime_error(std::string("Cannot resume file: ") + filename);
+		hsize_t size[RANK] = {offset};
+		H5Dset_extent(dset, size);
+		dataspace = H5Dget_space(dset);
+		count = n;
+		tagNames = getTagNames(dset);
+		return;
+	}
+
 	// chunked prop
 	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
 	H5Pset_layout(plist, H5D_CHUNKED);
-	hsize_t chunk_dims[RANK] = {BUFFER_SIZE};
+	hsize_t chunk_dims[RANK] = {chunkSize};
 	H5Pset_chunk(plist, RANK, chunk_dims);
-	H5Pset_deflate(plist, 5);
+	if (compression == DeflateCompression) {
+		H5Pset_deflate(plist, compressionLevel);
+	} else if (compression == ZstdCompression) {
+		unsigned int cd_values[1] = {(unsigned int)compressionLevel};
+		if (H5Zfilter_avail(H5Z_FILTER_ZSTD) <= 0)
+			throw std::runtime_error("HDF5Output: zstd filter plugin not available");
+		H5Pset_filter(plist, H5Z_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, cd_values);
+	} else if (compression == BloscCompression) {
+		// reserved, reserved, type size and chunk size are set by the filter;
+		// level, byte shuffle, blosclz
+		unsigned int cd_values[7] = {0, 0, 0, 0, (unsigned int)compressionLevel, 1, 0};
+		if (H5Zfilter_avail(H5Z_FILTER_BLOSC) <= 0)
+			throw std::runtime_error("HDF5Output: blosc filter plugin not available");
+		H5Pset_filter(plist, H5Z_FILTER_BLOSC, H5Z_FLAG_MANDATORY, 7, cd_values);
+	}
 
 	hsize_t dims[RANK] = {0};
 	hsize_t max_dims[RANK] = {H5S_UNLIMITED};
@@ -215,7 +273,7 @@ void HDF5Output::open(const std::string& filename) {
 		hsize_t dims[] = {1, 0};
 		dims[1] = seeds[i].size();
 
-		type = H5Tarray_create(H5T_NATIVE_ULONG, 2, dims);
+		type = H5Tarray_create(H5T_NATIVE_UINT32, 2, dims);
 
 		attr_space = H5Screate_simple(0, dims, NULL);
 		char nameBuffer[256];
@@ -226,37 +284,313 @@ void HDF5Output::open(const std::string& filename) {
 		status = H5Awrite(version_attr, type, &seeds[i][0]);
 		status = H5Aclose(version_attr);
 		status = H5Sclose(attr_space);
+		status = H5Tclose(type);
 
 	}
 
 
 	H5Pclose(plist);
-
-	buffer.reserve(BUFFER_SIZE);
-	time(&lastFlush);
+	opened = true;
 }
 
 void HDF5Output::close() {
 	if (file >= 0) {
 		flush();
+		drain();
+		writeTagNames();
 		H5Dclose(dset);
 		H5Tclose(sid);
 		H5Sclose(dataspace);
 		H5Fclose(file);
 		file = -1;
+		opened = false;
+	}
+	if (not shards.empty())
+		writeShardIndex(releaseShards());
+}
+
+Output *HDF5Output::createShard(size_t index) const {
+	if (filename.empty())
+		throw std::runtime_error("HDF5Output: shards require an output file");
+	// the type is stored as attribute, the columns are set by configureShard
+	OutputType type = Everything;
+	for (int t = Trajectory1D; t < Everything; t++)
+		if (const_cast<HDF5Output *>(this)->OutputTypeName(OutputType(t)) == outputName)
+			type = OutputType(t);
+	HDF5Output *shard = new HDF5Output(shardFilename(filename, index), type);
+	configureShard(shard);
+	shard->flushLimit = flushLimit;
+	shard->chunkSize = chunkSize;
+	shard->compression = compression;
+	shard->compressionLevel = compressionLevel;
+	shard->syncInterval = syncInterval;
+	return shard;
+}
+
+static herr_t copyAttribute(hid_t loc, const char *name, const H5A_info_t *info, void *data) {
+	hid_t target = *static_cast<hid_t *>(data);
+	hid_t attr = H5Aopen(loc, name, H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	hid_t space = H5Aget_space(attr);
+	std::vector<char> buffer(H5Tget_size(type) * H5Sget_simple_extent_npoints(space));
+	H5Aread(attr, type, &buffer[0]);
+	hid_t copy = H5Acreate2(target, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+	herr_t status = H5Awrite(copy, type, &buffer[0]);
+	H5Aclose(copy);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Aclose(attr);
+	return status;
+}
+
+void HDF5Output::writeShardIndex(const std::vector<std::pair<size_t, size_t> > &rows) {
+	// shards without rows have no file
+	std::vector<std::pair<size_t, size_t> > used;
+	hsize_t total = 0;
+	for (size_t i = 0; i < rows.size(); i++)
+		if (rows[i].second > 0) {
+			used.push_back(rows[i]);
+			total += rows[i].second;
+		}
+	if (used.empty())
+		return;
+
+	// row type and attributes of the first shard
+	hid_t src = H5Fopen(shardFilename(filename, used[0].first).c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (src < 0)
+		throw std::runtime_error("HDF5Output: cannot open the shards of " + filename);
+	hid_t dsrc = H5Dopen2(src, "CRPROPA3", H5P_DEFAULT);
+	hid_t type = H5Dget_type(dsrc);
+
+	// the shards are found relative to the index
+	std::string name = filename.substr(filename.rfind('/') + 1);
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	hid_t space = H5Screate_simple(RANK, &total, NULL);
+	hsize_t offset = 0;
+	for (size_t i = 0; i < used.size(); i++) {
+		hsize_t n = used[i].second;
+		hid_t shardSpace = H5Screate_simple(RANK, &n, NULL);
+		H5Sselect_hyperslab(space, H5S_SELECT_SET, &offset, NULL, &n, NULL);
+		H5Pset_virtual(plist, space, shardFilename(name, used[i].first).c_str(), "CRPROPA3", shardSpace);
+		H5Sclose(shardSpace);
+		offset += n;
 	}
+	H5Sselect_all(space);
+
+	hid_t index = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	hid_t dindex = H5Dcreate2(index, "CRPROPA3", type, space, H5P_DEFAULT, plist, H5P_DEFAULT);
+	if (index >= 0 and dindex >= 0) {
+		H5Aiterate2(dsrc, H5_INDEX_CRT_ORDER, H5_ITER_NATIVE, NULL, copyAttribute, &dindex);
+		// the shards share the codes of this process, also those used after
+		// the first shard was closed
+		if (fields.test(CandidateTagColumn) and Candidate::getTagNames().size() > 0)
+			setTagNames(dindex, Candidate::getTagNames());
+	}
+	H5Dclose(dindex);
+	H5Fclose(index);
+	H5Sclose(space);
+	H5Pclose(plist);
+	H5Tclose(type);
+	H5Dclose(dsrc);
+	H5Fclose(src);
+	if (index < 0 or dindex < 0)
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+}
+
+// rows read and written at once while merging
+static const hsize_t MERGE_BLOCK_SIZE = 65536;
+
+static hsize_t datasetRows(hid_t dset) {
+	hid_t space = H5Dget_space(dset);
+	hsize_t n = 0;
+	H5Sget_simple_extent_dims(space, &n, NULL);
+	H5Sclose(space);
+	return n;
+}
+
+// read (write) the rows offset ... offset+n-1
+static void transferRows(hid_t dset, hid_t type, hsize_t offset, hsize_t n, void *buffer, bool write) {
+	hid_t fspace = H5Dget_space(dset);
+	hid_t mspace = H5Screate_simple(RANK, &n, NULL);
+	H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &n, NULL);
+	herr_t status = write ? H5Dwrite(dset, type, mspace, fspace, H5P_DEFAULT, buffer)
+			: H5Dread(dset, type, mspace, fspace, H5P_DEFAULT, buffer);
+	H5Sclose(mspace);
+	H5Sclose(fspace);
+	if (status < 0)
+		throw std::runtime_error("HDF5Output: transfer of rows failed");
+}
+
+size_t HDF5Output::concatenate(const std::vector<std::string> &files, const std::string &filename) {
+	hid_t out = -1, dout = -1, type = -1;
+	hsize_t rows = 0;
+	std::vector<char> buffer;
+	// tags of the output, starting with those of the first file
+	std::vector<std::string> names;
+	for (size_t i = 0; i < files.size(); i++) {
+		hid_t in = H5Fopen(files[i].c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		if (in < 0)
+			throw std::runtime_error("HDF5Output: could not open file " + files[i]);
+		if (out < 0) {
+			// layout, filters and attributes are taken from the first file
+			out = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+			if (out < 0) {
+				H5Fclose(in);
+				throw std::runtime_error(std::string("Cannot create file: ") + filename);
+			}
+			H5Ocopy(in, "CRPROPA3", out, "CRPROPA3", H5P_DEFAULT, H5P_DEFAULT);
+			dout = H5Dopen2(out, "CRPROPA3", H5P_DEFAULT);
+			type = H5Dget_type(dout);
+			rows = datasetRows(dout);
+			buffer.resize(H5Tget_size(type) * MERGE_BLOCK_SIZE);
+			names = getTagNames(dout);
+		} else {
+			hid_t din = H5Dopen2(in, "CRPROPA3", H5P_DEFAULT);
+			hsize_t n = datasetRows(din);
+
+			// the codes of each file are only valid with its own tag names
+			std::vector<std::string> fileNames = getTagNames(din);
+			std::vector<uint32_t> codes(fileNames.size());
+			for (size_t j = 0; j < fileNames.size(); j++)
+				codes[j] = getTagCode(names, fileNames[j]);
+
+			for (hsize_t i = 0; i < n; i += MERGE_BLOCK_SIZE) {
+				hsize_t count = std::min(MERGE_BLOCK_SIZE, n - i);
+				transferRows(din, type, i, count, &buffer[0], false);
+				mapTagCodes(type, &buffer[0], count, codes);
+				hsize_t extent = rows + count;
+				H5Dset_extent(dout, &extent);
+				transferRows(dout, type, rows, count, &buffer[0], true);
+				rows += count;
+			}
+			H5Dclose(din);
+		}
+		H5Fclose(in);
+	}
+	if (out >= 0) {
+		if (not names.empty())
+			setTagNames(dout, names);
+		H5Tclose(type);
+		H5Dclose(dout);
+		H5Fclose(out);
+	}
+	return rows;
+}
+
+std::vector<std::string> HDF5Output::getTagNames(hid_t dset) {
+	std::vector<std::string> names;
+	if (H5Aexists(dset, "TagNames") <= 0)
+		return names;
+	hid_t attr = H5Aopen(dset, "TagNames", H5P_DEFAULT);
+	hid_t type = H5Aget_type(attr);
+	std::vector<char> value(H5Tget_size(type) + 1, 0);
+	H5Aread(attr, type, &value[0]);
+	H5Tclose(type);
+	H5Aclose(attr);
+
+	// one name per line
+	const char *p = &value[0];
+	while (const char *eol = strchr(p, '\n')) {
+		names.push_back(std::string(p, eol));
+		p = eol + 1;
+	}
+	return names;
+}
+
+void HDF5Output::setTagNames(hid_t dset, const std::vector<std::string> &names) {
+	std::string value;
+	for (size_t i = 0; i < names.size(); i++)
+		value += names[i] + "\n";
+	if (H5Aexists(dset, "TagNames") > 0)
+		H5Adelete(dset, "TagNames");
+	hid_t strtype = H5Tcopy(H5T_C_S1);
+	H5Tset_size(strtype, value.size());
+	hsize_t dims = 0;
+	hid_t space = H5Screate_simple(0, &dims, NULL);
+	hid_t attr = H5Acreate2(dset, "TagNames", strtype, space, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(attr, strtype, value.c_str());
+	H5Aclose(attr);
+	H5Sclose(space);
+	H5Tclose(strtype);
+}
+
+uint32_t HDF5Output::getTagCode(std::vector<std::string> &names, const std::string &name) {
+	std::vector<std::string>::iterator i = std::find(names.begin(), names.end(), name);
+	if (i != names.end())
+		return i - names.begin();
+	names.push_back(name);
+	return names.size() - 1;
+}
+
+void HDF5Output::mapTagCodes(hid_t type, void *rows, size_t n, const std::vector<uint32_t> &codes) {
+	int member = H5Tget_member_index(type, "tag");
+	if (member < 0)
+		return;
+	size_t offset = H5Tget_member_offset(type, member);
+	size_t size = H5Tget_size(type);
+	char *p = static_cast<char *>(rows) + offset;
+	for (size_t i = 0; i < n; i++, p += size) {
+		uint32_t code;
+		memcpy(&code, p, sizeof(code));
+		if (code < codes.size()) {
+			code = codes[code];
+			memcpy(p, &code, sizeof(code));
+		}
+	}
+}
+
+size_t HDF5Output::mergeShards(const std::string &index, const std::string &filename, bool removeShards) {
+	hid_t file = H5Fopen(index.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	if (file < 0)
+		throw std::runtime_error("HDF5Output: could not open file " + index);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t plist = H5Dget_create_plist(dset);
+	std::vector<std::string> files;
+	size_t n = 0;
+	if (H5Pget_layout(plist) == H5D_VIRTUAL)
+		H5Pget_virtual_count(plist, &n);
+	std::string directory = index.substr(0, index.rfind('/') + 1);
+	for (size_t i = 0; i < n; i++) {
+		ssize_t length = H5Pget_virtual_filename(plist, i, NULL, 0);
+		std::vector<char> name(length + 1);
+		H5Pget_virtual_filename(plist, i, &name[0], name.size());
+		files.push_back(directory + &name[0]);
+	}
+	H5Pclose(plist);
+	H5Dclose(dset);
+	H5Fclose(file);
+	if (n == 0)
+		throw std::runtime_error("HDF5Output: no shards in " + index);
+
+	size_t rows = concatenate(files, filename);
+	if (removeShards) {
+		for (size_t i = 0; i < files.size(); i++)
+			std::remove(files[i].c_str());
+		if (index != filename)
+			std::remove(index.c_str());
+	}
+	return rows;
 }
 
 void HDF5Output::process(Candidate* candidate) const {
-	#pragma omp critical
-	{
-	if (file == -1)
-		// This is ugly, but necesary as otherwise the user has to manually open the
-		// file before processing the first candidate
-		const_cast<HDF5Output*>(this)->open(filename);
+	if (const Output *shard = getShard()) {
+		shard->process(candidate);
+		return;
+	}
+	checkRetention(candidate);
+	if (not opened) {
+		// file is assigned before the dataset is created, so the threads
+		// wait for the flag, which open sets last
+		#pragma omp critical
+		{
+		if (not opened)
+			// This is ugly, but necesary as otherwise the user has to manually open the
+			// file before processing the first candidate
+			const_cast<HDF5Output*>(this)->open(filename);
+		}
 	}
 
-	OutputRow r;
+	OutputRow r = OutputRow();
 	r.D = candidate->getTrajectoryLength() / lengthScale;
 	r.z = candidate->getRedshift();
 
@@ -273,41 +607,46 @@ void HDF5Output::process(Candidate* candidate) const {
 	r.Pz = v.z;
 
 	r.SN0 = candidate->getSourceSerialNumber();
-	r.ID0 = candidate->source.getId();
-	r.E0 = candidate->source.getEnergy() / energyScale;
-	v = candidate->source.getPosition() / lengthScale;
-	r.X0 = v.x;
-	r.Y0 = v.y;
-	r.Z0 = v.z;
-	v = candidate->source.getDirection();
-	r.P0x = v.x;
-	r.P0y = v.y;
-	r.P0z = v.z;
+	// the columns of states that are not retained stay zero
+	if (candidate->source.isRetained()) {
+		r.ID0 = candidate->source.getId();
+		r.E0 = candidate->source.getEnergy() / energyScale;
+		v = candidate->source.getPosition() / lengthScale;
+		r.X0 = v.x;
+		r.Y0 = v.y;
+		r.Z0 = v.z;
+		v = candidate->source.getDirection();
+		r.P0x = v.x;
+		r.P0y = v.y;
+		r.P0z = v.z;
+	}
 
 	r.SN1 = candidate->getCreatedSerialNumber();
-	r.ID1 = candidate->created.getId();
-	r.E1 = candidate->created.getEnergy() / energyScale;
-	v = candidate->created.getPosition() / lengthScale;
-	r.X1 = v.x;
-	r.Y1 = v.y;
-	r.Z1 = v.z;
-	v = candidate->created.getDirection();
-	r.P1x = v.x;
-	r.P1y = v.y;
-	r.P1z = v.z;
+	if (candidate->created.isRetained()) {
+		r.ID1 = candidate->created.getId();
+		r.E1 = candidate->created.getEnergy() / energyScale;
+		v = candidate->created.getPosition() / lengthScale;
+		r.X1 = v.x;
+		r.Y1 = v.y;
+		r.Z1 = v.z;
+		v = candidate->created.getDirection();
+		r.P1x = v.x;
+		r.P1y = v.y;
+		r.P1z = v.z;
+	}
 
 	r.weight= candidate->getWeight();
 
-	r.tag = candidate->getTagOrigin();
+	r.tag = candidate->getTagOriginCode();
 
 	size_t pos = 0;
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
 		  Variant v;
-			if (candidate->hasProperty((*iter).name))
+			if (candidate->hasProperty((*iter).key))
 			{
-				v = candidate->getProperty((*iter).name);
+				v = candidate->getProperty((*iter).key);
 			}
 			else
 			{
@@ -316,41 +655,104 @@ void HDF5Output::process(Candidate* candidate) const {
 			pos += v.copyToBuffer(&r.propertyBuffer[pos]);
 	}
 
-	#pragma omp critical
-	{
-		const_cast<HDF5Output*>(this)->candidatesSinceFlush++;
-		Output::process(candidate);
+	#pragma omp atomic
+	count++;
+
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid < threadBuffers.size()) {
+		// collect rows without locking and hand them over in batches
+		std::vector<OutputRow> &rows = threadBuffers[tid];
+		rows.push_back(r);
+		if (isHeld(tid) or rows.size() < std::min<size_t>(THREAD_BUFFER_SIZE, flushLimit))
+			return;
+		if (exclusive) {
+			appendRows(rows);
+			return;
+		}
+		#pragma omp critical
+		appendRows(rows);
+	} else {
+		// more threads than at the time the file was opened
+		std::vector<OutputRow> rows(1, r);
+		#pragma omp critical
+		appendRows(rows);
+	}
+}
 
-		buffer.push_back(r);
+void HDF5Output::appendRows(std::vector<OutputRow> &rows) const {
+	const_cast<HDF5Output*>(this)->candidatesSinceFlush += rows.size();
+	buffer.insert(buffer.end(), rows.begin(), rows.end());
+	rows.clear();
 
+	if (buffer.size() >= BUFFER_SIZE)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to buffer capacity exceeded";
+	}
+	else if (candidatesSinceFlush >= flushLimit)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
+	}
+	else if (difftime(time(NULL), lastFlush) > 60*10)
+	{
+		KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
+	}
+	else
+		return;
 
-		if (buffer.size() >= buffer.capacity())
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to buffer capacity exceeded";
-			flush();
-		}
-		else if (candidatesSinceFlush >= flushLimit)
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to number of candidates";
-			flush();
-		}
-		else if (difftime(time(NULL), lastFlush) > 60*10)
-		{
-			KISS_LOG_DEBUG << "HDF5Output: Flush due to time exceeded";
-			flush();
-		}
+	if (exclusive) {
+		// the rows of a shard need the lock only for the HDF5 calls
+		#pragma omp critical
+		flush();
+	} else {
+		flush();
 	}
 }
 
+void HDF5Output::holdPrimary(uint64_t index, size_t thread) const {
+	if (thread < threadBuffers.size() and not threadBuffers[thread].empty())
+		heldRows[index].swap(threadBuffers[thread]);
+}
+
+void HDF5Output::writePrimary(uint64_t index) const {
+	std::map<uint64_t, std::vector<OutputRow> >::iterator i = heldRows.find(index);
+	if (i == heldRows.end())
+		return;
+	appendRows(i->second);
+	heldRows.erase(i);
+}
+
 void HDF5Output::flush() const {
 	const_cast<HDF5Output*>(this)->lastFlush = time(NULL);
 	const_cast<HDF5Output*>(this)->candidatesSinceFlush = 0;
 
-	hsize_t n = buffer.size();
+	// rows of the threads can only be collected safely if no thread is
+	// currently adding to them
+#ifdef _OPENMP
+	if (not omp_in_parallel())
+#endif
+	for (size_t i = 0; i < threadBuffers.size(); i++) {
+		buffer.insert(buffer.end(), threadBuffers[i].begin(), threadBuffers[i].end());
+		threadBuffers[i].clear();
+	}
 
-	if (n == 0)
+	if (buffer.empty())
 		return;
 
+	// hand the rows to the output thread, or write them directly
+	std::shared_ptr<std::vector<OutputRow> > rows = std::make_shared<std::vector<OutputRow> >();
+	rows->reserve(BUFFER_SIZE);
+	rows->swap(buffer);
+	if (fields.test(CandidateTagColumn))
+		mapTagCodes(*rows);
+	submit([this, rows]() { writeRows(*rows); });
+}
+
+void HDF5Output::writeRows(const std::vector<OutputRow> &rows) const {
+	hsize_t n = rows.size();
+
 	hid_t file_space = H5Dget_space(dset);
 	hsize_t count = H5Sget_simple_extent_npoints(file_space);
 
@@ -368,14 +770,63 @@ void HDF5Output::flush() const {
 	H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, cnt, NULL);
 	hid_t mspace_id = H5Screate_simple(RANK, cnt, NULL);
 
-	H5Dwrite(dset, sid, mspace_id, file_space, H5P_DEFAULT, buffer.data());
+	H5Dwrite(dset, sid, mspace_id, file_space, H5P_DEFAULT, rows.data());
 
 	H5Sclose(mspace_id);
 	H5Sclose(file_space);
 
-	buffer.clear();
+	// the global sync is expensive on parallel file systems
+	time_t now = time(NULL);
+	if (difftime(now, lastSync) >= syncInterval) {
+		H5Fflush(file, H5F_SCOPE_GLOBAL);
+		lastSync = now;
+	}
+}
 
+size_t HDF5Output::checkpoint(std::string &name) {
+	if (sharded)
+		throw std::runtime_error("HDF5Output: checkpoints are not supported with shards");
+	name = filename;
+	if (file < 0)
+		return 0;
+	flush();
+	drain();
+	hid_t file_space = H5Dget_space(dset);
+	size_t rows = H5Sget_simple_extent_npoints(file_space);
+	H5Sclose(file_space);
+	writeTagNames();
 	H5Fflush(file, H5F_SCOPE_GLOBAL);
+	return rows;
+}
+
+void HDF5Output::mapTagCodes(std::vector<OutputRow> &rows) const {
+	for (size_t i = 0; i < rows.size(); i++) {
+		uint32_t code = rows[i].tag;
+		// new files take the codes of this process in their order
+		while (tagCodes.size() <= code)
+			tagCodes.push_back(getTagCode(tagNames, Candidate::getTagName(tagCodes.size())));
+		rows[i].tag = tagCodes[code];
+	}
+}
+
+void HDF5Output::writeTagNames() {
+	if (not fields.test(CandidateTagColumn))
+		return;
+	// also the tags without rows, e.g. for the index of the shards
+	size_t n = Candidate::getTagNames().size();
+	while (tagCodes.size() < n)
+		tagCodes.push_back(getTagCode(tagNames, Candidate::getTagName(tagCodes.size())));
+	if (tagNames.empty())
+		return;
+	setTagNames(dset, tagNames);
+}
+
+size_t HDF5Output::getSizeOf() const {
+	size_t size = Output::getSizeOf() + vectorSizeOf(buffer) + vectorSizeOf(threadBuffers);
+	for (std::map<uint64_t, std::vector<OutputRow> >::const_iterator it = heldRows.begin();
+			it != heldRows.end(); ++it)
+		size += sizeof(*it) + vectorSizeOf(it->second);
+	return size;
 }
 
 std::string HDF5Output::getDescription() const  {
@@ -387,6 +838,21 @@ void HDF5Output::setFlushLimit(unsigned int N)
 	flushLimit = N;
 }
 
+void HDF5Output::setChunkSize(size_t rows) {
+	if (rows == 0)
+		throw std::runtime_error("HDF5Output: chunk size 0");
+	chunkSize = rows;
+}
+
+void HDF5Output::setCompression(CompressionFilter filter, int level) {
+	compression = filter;
+	compressionLevel = level;
+}
+
+void HDF5Output::setSyncInterval(double seconds) {
+	syncInterval = seconds;
+}
+
 } // namespace crpropa
 
 #endif // CRPROPA_HAVE_HDF5
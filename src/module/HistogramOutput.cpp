@@ -0,0 +1,394 @@
+#include "crpropa/module/HistogramOutput.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/ScratchVector.h"
+#include "crpropa/Units.h"
+#include "crpropa/Version.h"
+
+#include "kiss/string.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef WITH_GALACTIC_LENSES
+#include "crpropa/magneticLens/Pixelization.h"
+#endif
+
+#ifdef CRPROPA_HAVE_ZLIB
+#include <ozstream.hpp>
+#endif
+
+namespace crpropa {
+
+static const char *quantityName(HistogramOutput::Quantity quantity) {
+	switch (quantity) {
+	case HistogramOutput::Energy:
+		return "E";
+	case HistogramOutput::SourceEnergy:
+		return "E0";
+	case HistogramOutput::Redshift:
+		return "z";
+	case HistogramOutput::TrajectoryLength:
+		return "D";
+	case HistogramOutput::SourceDistance:
+		return "R0";
+	case HistogramOutput::Id:
+		return "ID";
+	case HistogramOutput::MassNumber:
+		return "A";
+	case HistogramOutput::ArrivalPixel:
+		return "pixel";
+	case HistogramOutput::Hypothesis:
+		return "hypothesis";
+	}
+	return "";
+}
+
+// the histograms of the threads are allocated on their first candidate
+static size_t bufferCount() {
+#ifdef _OPENMP
+	return omp_get_max_threads() + 1;
+#else
+	return 2;
+#endif
+}
+
+HistogramOutput::HistogramOutput() : Output(), pixelization(0), nBins(1),
+		threadBins(bufferCount()), outOfRange(0) {
+}
+
+HistogramOutput::HistogramOutput(const std::string &filename) : Output(),
+		filename(filename), pixelization(0), nBins(1), threadBins(bufferCount()),
+		outOfRange(0) {
+}
+
+HistogramOutput::~HistogramOutput() {
+	close();
+#ifdef WITH_GALACTIC_LENSES
+	delete pixelization;
+#endif
+}
+
+void HistogramOutput::appendAxis(const Axis &axis) {
+	if (axis.bins == 0)
+		throw std::runtime_error("HistogramOutput: axis without bins");
+	if (count > 0)
+		throw std::runtime_error("HistogramOutput: axes have to be added before the first candidate");
+	axes.push_back(axis);
+	nBins *= axis.bins;
+}
+
+void HistogramOutput::addAxis(Quantity quantity, size_t bins, double min, double max, bool logarithmic) {
+	if (quantity == Id or quantity == MassNumber or quantity == ArrivalPixel or quantity == Hypothesis)
+		throw std::runtime_error("HistogramOutput: use addIdAxis, addMassGroupAxis, addPixelAxis or addHypothesisAxis");
+	if (not (max > min) or (logarithmic and min <= 0))
+		throw std::runtime_error("HistogramOutput: invalid axis range");
+	Axis axis;
+	axis.quantity = quantity;
+	axis.bins = bins;
+	axis.min = logarithmic ? std::log10(min) : min;
+	axis.max = logarithmic ? std::log10(max) : max;
+	axis.logarithmic = logarithmic;
+	appendAxis(axis);
+}
+
+void HistogramOutput::addIdAxis(const std::vector<int> &ids) {
+	Axis axis;
+	axis.quantity = Id;
+	axis.bins = ids.size();
+	axis.min = axis.max = 0;
+	axis.logarithmic = false;
+	axis.values = ids;
+	appendAxis(axis);
+}
+
+void HistogramOutput::addMassGroupAxis(const std::vector<int> &edges) {
+	if (edges.size() < 2 or not std::is_sorted(edges.begin(), edges.end()))
+		throw std::runtime_error("HistogramOutput: mass groups need at least two increasing edges");
+	Axis axis;
+	axis.quantity = MassNumber;
+	axis.bins = edges.size() - 1;
+	axis.min = edges.front();
+	axis.max = edges.back();
+	axis.logarithmic = false;
+	axis.values = edges;
+	appendAxis(axis);
+}
+
+void HistogramOutput::addPixelAxis(int order) {
+#ifdef WITH_GALACTIC_LENSES
+	if (pixelization)
+		throw std::runtime_error("HistogramOutput: only one pixel axis is supported");
+	if (order < 0 or order > _nOrder_max)
+		throw std::runtime_error("HistogramOutput: invalid HEALPix order");
+	Axis axis;
+	axis.quantity = ArrivalPixel;
+	axis.bins = 12 * (size_t(1) << (2 * order));
+	axis.min = axis.max = order;
+	axis.logarithmic = false;
+	appendAxis(axis);
+	pixelization = new Pixelization(order);
+#else
+	throw std::runtime_error("HistogramOutput: CRPropa was built without HEALPix (ENABLE_GALACTICMAGETICLENS)");
+#endif
+}
+
+void HistogramOutput::addHypothesisAxis(SpectralReweighting *r) {
+	if (not r or r->getNumberOfHypotheses() == 0)
+		throw std::runtime_error("HistogramOutput: reweighting without hypotheses");
+	if (not axes.empty())
+		throw std::runtime_error("HistogramOutput: the hypothesis axis has to be the first axis");
+	Axis axis;
+	axis.quantity = Hypothesis;
+	axis.bins = r->getNumberOfHypotheses();
+	axis.min = axis.max = 0;
+	axis.logarithmic = false;
+	appendAxis(axis);
+	reweighting = r;
+}
+
+size_t HistogramOutput::getNumberOfAxes() const {
+	return axes.size();
+}
+
+size_t HistogramOutput::getNumberOfBins() const {
+	return nBins;
+}
+
+bool HistogramOutput::getBin(const Candidate *c, size_t &index) const {
+	index = 0;
+	for (size_t i = 0; i < axes.size(); i++) {
+		const Axis &axis = axes[i];
+		size_t bin = 0;
+		if (axis.quantity == Hypothesis) {
+			// filled for all hypotheses in process
+		} else if (axis.quantity == Id) {
+			std::vector<int>::const_iterator it = std::find(axis.values.begin(),
+					axis.values.end(), c->current.getId());
+			if (it == axis.values.end())
+				return false;
+			bin = it - axis.values.begin();
+		} else if (axis.quantity == MassNumber) {
+			int A = c->current.getMassNumber();
+			if (A < axis.values.front() or A >= axis.values.back())
+				return false;
+			bin = std::upper_bound(axis.values.begin(), axis.values.end(), A)
+					- axis.values.begin() - 1;
+		} else if (axis.quantity == ArrivalPixel) {
+#ifdef WITH_GALACTIC_LENSES
+			Vector3d p = c->current.getDirection();
+			double longitude = atan2(-p.y, -p.x);
+			double latitude = M_PI / 2 - acos(-p.z / p.getR());
+			bin = pixelization->direction2Pix(longitude, latitude);
+#endif
+		} else {
+			double x;
+			if (axis.quantity == Energy)
+				x = c->current.getEnergy();
+			else if (axis.quantity == SourceEnergy)
+				x = c->source.getEnergy();
+			else if (axis.quantity == Redshift)
+				x = c->getRedshift();
+			else if (axis.quantity == TrajectoryLength)
+				x = c->getTrajectoryLength();
+			else
+				x = (c->current.getPosition() - c->source.getPosition()).getR();
+			if (axis.logarithmic) {
+				if (x <= 0)
+					return false;
+				x = std::log10(x);
+			}
+			double f = (x - axis.min) / (axis.max - axis.min);
+			if (not (f >= 0 and f < 1))
+				return false;
+			bin = std::min(size_t(f * axis.bins), axis.bins - 1);
+		}
+		index = index * axis.bins + bin;
+	}
+	return true;
+}
+
+void HistogramOutput::process(Candidate *c) const {
+	if ((c->source.isRetained() == false) and std::any_of(axes.begin(), axes.end(),
+			[](const Axis &a) { return a.quantity == SourceEnergy or a.quantity == SourceDistance
+					or a.quantity == Hypothesis; }))
+		throw std::runtime_error("HistogramOutput: source axis, but the source state is not retained");
+
+	double w = c->getWeight();
+#pragma omp atomic
+	count++;
+
+	size_t index;
+	if (not getBin(c, index)) {
+#pragma omp atomic
+		outOfRange += w;
+		return;
+	}
+
+	// one bin per hypothesis, the hypothesis axis is the slowest
+	ScratchVector<double> weights(1, w);
+	size_t stride = 0;
+	if (reweighting.valid()) {
+		reweighting->getWeights(c, *weights);
+		stride = nBins / weights.size();
+	}
+
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid + 1 < threadBins.size()) {
+		// filled without locking
+		std::vector<double> &bins = threadBins[tid];
+		if (bins.empty())
+			bins.resize(2 * nBins, 0);
+		for (size_t h = 0; h < weights.size(); h++) {
+			bins[2 * (index + h * stride)] += weights[h];
+			bins[2 * (index + h * stride) + 1] += weights[h] * weights[h];
+		}
+	} else {
+		// more threads than at construction
+#pragma omp critical(HistogramOutput)
+		{
+			std::vector<double> &bins = threadBins.back();
+			if (bins.empty())
+				bins.resize(2 * nBins, 0);
+			for (size_t h = 0; h < weights.size(); h++) {
+				bins[2 * (index + h * stride)] += weights[h];
+				bins[2 * (index + h * stride) + 1] += weights[h] * weights[h];
+			}
+		}
+	}
+}
+
+std::vector<double> HistogramOutput::merge(size_t offset) const {
+	std::vector<double> result(nBins, 0);
+	for (size_t t = 0; t < threadBins.size(); t++) {
+		const std::vector<double> &bins = threadBins[t];
+		if (bins.empty())
+			continue;
+		for (size_t i = 0; i < nBins; i++)
+			result[i] += bins[2 * i + offset];
+	}
+	return result;
+}
+
+std::vector<double> HistogramOutput::getWeights() const {
+	return merge(0);
+}
+
+std::vector<double> HistogramOutput::getSquaredWeights() const {
+	return merge(1);
+}
+
+double HistogramOutput::getOutOfRange() const {
+	return outOfRange;
+}
+
+void HistogramOutput::clear() {
+	for (size_t t = 0; t < threadBins.size(); t++)
+		threadBins[t].clear();
+	outOfRange = 0;
+	count = 0;
+}
+
+void HistogramOutput::save(const std::string &filename) const {
+	std::ofstream outfile(filename.c_str(), std::ios::binary);
+	if (not outfile.is_open())
+		throw std::runtime_error("HistogramOutput: cannot create file " + filename);
+	std::ostream *out = &outfile;
+	if (kiss::ends_with(filename, ".gz")) {
+#ifdef CRPROPA_HAVE_ZLIB
+		out = new zstream::ogzstream(outfile);
+#else
+		throw std::runtime_error("CRPropa was built without Zlib compression!");
+#endif
+	}
+
+	*out << "# CRPropa HistogramOutput\n";
+	*out << "# CRPropa version: " << g_GIT_DESC << "\n";
+	*out << "# candidates " << count << ", weight out of range " << outOfRange << "\n";
+	*out << "# energies [" << energyScale / EeV << " EeV], lengths ["
+			<< lengthScale / Mpc << " Mpc]\n";
+	*out << "# axes " << axes.size() << "\n";
+	for (size_t i = 0; i < axes.size(); i++) {
+		const Axis &axis = axes[i];
+		*out << "# axis " << i << " " << quantityName(axis.quantity) << " " << axis.bins;
+		if (axis.quantity == Id or axis.quantity == MassNumber) {
+			*out << " values";
+			for (size_t j = 0; j < axis.values.size(); j++)
+				*out << " " << axis.values[j];
+		} else if (axis.quantity == ArrivalPixel) {
+			*out << " healpix_ring_order " << axis.min;
+		} else if (axis.quantity == Hypothesis) {
+			*out << " names";
+			for (size_t j = 0; j < axis.bins; j++)
+				*out << " " << reweighting->getName(j);
+		} else {
+			double scale = 1;
+			if (axis.quantity == Energy or axis.quantity == SourceEnergy)
+				scale = energyScale;
+			else if (axis.quantity == TrajectoryLength or axis.quantity == SourceDistance)
+				scale = lengthScale;
+			double min = axis.logarithmic ? std::pow(10, axis.min) : axis.min;
+			double max = axis.logarithmic ? std::pow(10, axis.max) : axis.max;
+			*out << (axis.logarithmic ? " log " : " linear ") << min / scale << " " << max / scale;
+		}
+		*out << "\n";
+	}
+	*out << "#";
+	for (size_t i = 0; i < axes.size(); i++)
+		*out << " i_" << quantityName(axes[i].quantity);
+	*out << " W W2\n";
+
+	out->precision(10);
+	std::vector<double> weights = getWeights();
+	std::vector<double> squares = getSquaredWeights();
+	std::vector<size_t> indices(axes.size());
+	for (size_t bin = 0; bin < nBins; bin++) {
+		if (squares[bin] == 0)
+			continue;
+		size_t rest = bin;
+		for (size_t i = axes.size(); i-- > 0;) {
+			indices[i] = rest % axes[i].bins;
+			rest /= axes[i].bins;
+		}
+		for (size_t i = 0; i < axes.size(); i++)
+			*out << indices[i] << " ";
+		*out << weights[bin] << " " << squares[bin] << "\n";
+	}
+
+#ifdef CRPROPA_HAVE_ZLIB
+	zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
+	if (zs) {
+		zs->close();
+		delete zs;
+	}
+#endif
+	outfile.close();
+}
+
+void HistogramOutput::close() {
+	if (filename.empty())
+		return;
+	save(filename);
+	filename.clear();
+}
+
+size_t HistogramOutput::getSizeOf() const {
+	return Output::getSizeOf() + vectorSizeOf(threadBins);
+}
+
+std::string HistogramOutput::getDescription() const {
+	std::stringstream ss;
+	ss << "HistogramOutput: " << axes.size() << " axes, " << nBins << " bins";
+	return ss.str();
+}
+
+} // namespace crpropa
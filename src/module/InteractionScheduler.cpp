@@ -0,0 +1,100 @@
+#include "crpropa/module/InteractionScheduler.h"
+#include "crpropa/Random.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// number of modules whose rates are kept on the stack
+static const std::size_t stackInteractions = 16;
+
+InteractionScheduler::InteractionScheduler(const std::string &depthProperty) :
+		depthProperty(depthProperty), depthKey(Candidate::getPropertyKey(depthProperty)) {
+}
+
+void InteractionScheduler::add(Module *module) {
+	const StochasticInteraction *interaction = dynamic_cast<const StochasticInteraction *>(module);
+	if (interaction == 0)
+		throw std::runtime_error("InteractionScheduler: module does not implement StochasticInteraction");
+	modules.push_back(module);
+	interactions.push_back(interaction);
+}
+
+std::size_t InteractionScheduler::size() const {
+	return modules.size();
+}
+
+ref_ptr<Module> InteractionScheduler::operator[](const std::size_t i) {
+	return modules.at(i);
+}
+
+double InteractionScheduler::getTotalRate(Candidate *candidate) const {
+	double rate = 0;
+	for (std::size_t i = 0; i < interactions.size(); i++)
+		rate += interactions[i]->getCachedInteractionRate(candidate);
+	return rate;
+}
+
+void InteractionScheduler::process(Candidate *candidate) const {
+	std::size_t n = interactions.size();
+	if (n == 0)
+		return;
+
+	double stackRates[stackInteractions];
+	std::vector<double> heapRates;
+	double *rates = stackRates;
+	if (n > stackInteractions) {
+		heapRates.resize(n);
+		rates = &heapRates[0];
+	}
+
+	Random &random = Random::instance();
+	double depth;
+	if (candidate->hasProperty(depthKey))
+		depth = candidate->getProperty(depthKey).toDouble();
+	else
+		depth = -log(random.rand());
+
+	double step = candidate->getCurrentStep();
+	while (candidate->isActive()) {
+		double totalRate = 0;
+		for (std::size_t i = 0; i < n; i++) {
+			rates[i] = interactions[i]->getCachedInteractionRate(candidate);
+			totalRate += rates[i];
+		}
+		if (totalRate <= 0)
+			break;
+
+		// no interaction in the remaining step: step to the next one
+		if (depth > totalRate * step) {
+			depth -= totalRate * step;
+			candidate->limitNextStep(depth / totalRate);
+			break;
+		}
+
+		// select the interaction proportionally to the rates
+		step -= depth / totalRate;
+		double cmp = random.rand() * totalRate;
+		std::size_t i = 0;
+		while ((i + 1 < n) and (cmp >= rates[i])) {
+			cmp -= rates[i];
+			i++;
+		}
+		interactions[i]->interact(candidate);
+		depth = -log(random.rand());
+	}
+
+	candidate->setProperty(depthKey, depth);
+}
+
+std::string InteractionScheduler::getDescription() const {
+	std::stringstream ss;
+	ss << "InteractionScheduler\n";
+	for (std::size_t i = 0; i < modules.size(); i++)
+		ss << "    " << modules[i]->getDescription() << "\n";
+	return ss.str();
+}
+
+} // namespace crpropa
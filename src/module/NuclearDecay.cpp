@@ -1,8 +1,10 @@
 #include "crpropa/module/NuclearDecay.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
+#include "crpropa/ScratchVector.h"
 
 #include <fstream>
 #include <limits>
@@ -18,38 +20,75 @@ NuclearDecay::NuclearDecay(bool electrons, bool photons, bool neutrinos, double
 	havePhotons = photons;
 	haveNeutrinos = neutrinos;
 	limit = l;
+	chainFraction = 0.01;
 	setDescription("NuclearDecay");
 
 	// load decay table
 	std::string filename = getDataPath("nuclear_decay.txt");
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error(
 				"crpropa::NuclearDecay: could not open file " + filename);
 
+	// row: Z, N, channel, lifetime, (photon energy, intensity) of the gamma decays
 	decayTable.resize(27 * 31);
-	std::string line;
-	while (std::getline(infile,line)) {
-		std::stringstream stream(line);
-		if (stream.peek() == '#')
+	for (size_t i = 0; i < table->size(); i++) {
+		size_t n = table->columns(i);
+		if (n < 4)
 			continue;
+		const double *row = table->row(i);
 		DecayMode decay;
-		int Z, N;
-		double lifetime;
-		stream >> Z >> N >> decay.channel >> lifetime;
-		decay.rate = 1. / lifetime / c_light; // decay rate in [1/m]
-		std::vector<double> gamma;
-		double val;
-		while (stream >> val)
-			gamma.push_back(val);
-		for (int i = 0; i < gamma.size(); i += 2) {
-			decay.energy.push_back(gamma[i] * keV);
-			decay.intensity.push_back(gamma[i+1]);
+		int Z = row[0];
+		int N = row[1];
+		decay.channel = row[2];
+		decay.rate = 1. / row[3] / c_light; // decay rate in [1/m]
+		for (size_t j = 4; j + 1 < n; j += 2) {
+			decay.energy.push_back(row[j] * keV);
+			decay.intensity.push_back(row[j + 1]);
 		}
-		if (infile)
-			decayTable[Z * 31 + N].push_back(decay);
+		int dZ = digit(decay.channel, 10000) - digit(decay.channel, 1000)
+				- 2 * digit(decay.channel, 100) - digit(decay.channel, 10);
+		int dN = -digit(decay.channel, 10000) + digit(decay.channel, 1000)
+				- 2 * digit(decay.channel, 100) - digit(decay.channel, 1);
+		decay.product = (Z + dZ) * 31 + N + dN;
+		decayTable[Z * 31 + N].push_back(decay);
 	}
-	infile.close();
+	initChains();
+}
+
+void NuclearDecay::initChains() {
+	size_t n = decayTable.size();
+	totalRate.assign(n, 0.);
+	for (size_t i = 0; i < n; i++)
+		for (size_t j = 0; j < decayTable[i].size(); j++)
+			totalRate[i] += decayTable[i][j].rate;
+
+	// mean length of the chain: 1 / rate + mean over the modes of the chain length of the product
+	chainLength.assign(n, 0.);
+	std::vector<int> state(n, 0); // 0: unknown, 1: in progress, 2: done
+	for (size_t i = 0; i < n; i++)
+		chainDecayLength(i, state);
+}
+
+double NuclearDecay::chainDecayLength(int idx, std::vector<int> &state) {
+	if ((idx < 0) or (idx >= int(decayTable.size())))
+		return 0;
+	if (state[idx] == 2)
+		return chainLength[idx];
+	if (state[idx] == 1)
+		return std::numeric_limits<double>::infinity(); // cycle, never collapsed
+	state[idx] = 1;
+
+	double length = 0;
+	const std::vector<DecayMode> &decays = decayTable[idx];
+	if (decays.size() > 0) {
+		length = 1. / totalRate[idx];
+		for (size_t i = 0; i < decays.size(); i++)
+			length += decays[i].rate / totalRate[idx] * chainDecayLength(decays[i].product, state);
+	}
+	chainLength[idx] = length;
+	state[idx] = 2;
+	return length;
 }
 
 void NuclearDecay::setHaveElectrons(bool b) {
@@ -68,25 +107,62 @@ void NuclearDecay::setLimit(double l) {
 	limit = l;
 }
 
+void NuclearDecay::setChainFraction(double fraction) {
+	chainFraction = fraction;
+}
+
+double NuclearDecay::getInteractionRate(Candidate *candidate) const {
+	// nuclei up to Z = 26, N = 30
+	int idx = candidate->current.getIsotopeIndex();
+	if (idx < 0)
+		return 0;
+
+	double rate = totalRate[idx];
+	rate /= candidate->getStepQuantities().lorentzFactor;  // relativistic time dilation
+	rate /= (1 + candidate->getRedshift());  // rate per light travel distance -> rate per comoving distance
+	return rate;
+}
+
+void NuclearDecay::interact(Candidate *candidate) const {
+	performInteraction(candidate, randomChannel(decayTable[candidate->current.getIsotopeIndex()]));
+}
+
+int NuclearDecay::randomChannel(const std::vector<DecayMode> &decays) const {
+	// choose the decay mode proportionally to its rate
+	double total = 0;
+	for (size_t i = 0; i < decays.size(); i++)
+		total += decays[i].rate;
+	double cmp = Random::instance().rand() * total;
+	size_t i = 0;
+	while ((i + 1 < decays.size()) and (cmp >= decays[i].rate)) {
+		cmp -= decays[i].rate;
+		i++;
+	}
+	return decays[i].channel;
+}
+
 void NuclearDecay::process(Candidate *candidate) const {
 	// the loop should be processed at least once for limiting the next step
 	double step = candidate->getCurrentStep();
 	double z = candidate->getRedshift();
 	do {
-		// check if nucleus
-		int id = candidate->current.getId();
-		if (not (isNucleus(id)))
+		// check if nucleus in the decay table
+		int idx = candidate->current.getIsotopeIndex();
+		if (idx < 0)
 			return;
 
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
-		int N = A - Z;
-
 		// check if particle can decay
-		const std::vector<DecayMode> &decays = decayTable[Z * 31 + N];
+		const std::vector<DecayMode> &decays = decayTable[idx];
 		if (decays.size() == 0)
 			return;
 
+		// the whole chain decays well within the step: no need to sample the distances
+		double gamma = candidate->getStepQuantities().lorentzFactor;
+		if (chainLength[idx] * gamma * (1 + z) < chainFraction * step) {
+			performInteraction(candidate, randomChannel(decays));
+			continue;
+		}
+
 		// find interaction mode with minimum random decay distance
 		Random &random = Random::instance();
 		double randDistance = std::numeric_limits<double>::max();
@@ -95,7 +171,7 @@ void NuclearDecay::process(Candidate *candidate) const {
 
 		for (size_t i = 0; i < decays.size(); i++) {
 			double rate = decays[i].rate;
-			rate /= candidate->current.getLorentzFactor();  // relativistic time dilation
+			rate /= candidate->getStepQuantities().lorentzFactor;  // relativistic time dilation
 			rate /= (1 + z);  // rate per light travel distance -> rate per comoving distance
 			totalRate += rate;
 			double d = -log(random.rand()) / rate;
@@ -171,7 +247,7 @@ void NuclearDecay::gammaEmission(Candidate *candidate, int channel) const {
 		// create secondary photon; boost to lab frame
 		double cosTheta = 2 * random.rand() - 1;
 		double E = energy[i] * candidate->current.getLorentzFactor() * (1. - cosTheta);
-		candidate->addSecondary(22, E, pos, 1., interactionTag);
+		candidate->addSecondary(22, E, pos, 1., interactionTagCode);
 	}
 }
 
@@ -217,19 +293,19 @@ void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 	// see Basdevant, Fundamentals in Nuclear Physics, eq. (4.92)
 	// This leads to deviations from theoretical expectations at low 
 	// primary energies.
-	std::vector<double> energies;
-	std::vector<double> densities; // cdf(E), unnormalized
+	ScratchVector<double> energies;
+	ScratchVector<double> densities; // cdf(E), unnormalized
 
-	energies.reserve(51);
-	densities.reserve(51);
+	energies->reserve(51);
+	densities->reserve(51);
 
 	double me = mass_electron * c_squared;
 	double cdf = 0;
 	for (int i = 0; i <= 50; i++) {
 		double E = me + i / 50. * Q;
 		cdf += E * sqrt(E * E - me * me) * pow(Q + me - E, 2);
-		energies.push_back(E);
-		densities.push_back(cdf);
+		energies->push_back(E);
+		densities->push_back(cdf);
 	}
 
 	// draw random electron energy and angle
@@ -237,7 +313,7 @@ void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 	// leads to deviations from theoretical predictions
 	// is not problematic for usual CRPropa energies E>~TeV
 	Random &random = Random::instance();
-	double E = interpolate(random.rand() * cdf, densities, energies);
+	double E = interpolate(random.rand() * cdf, *densities, *energies);
 	double p = sqrt(E * E - me * me);  // p*c
 	double cosTheta = 2 * random.rand() - 1;
 
@@ -247,9 +323,9 @@ void NuclearDecay::betaDecay(Candidate *candidate, bool isBetaPlus) const {
 
 	Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 	if (haveElectrons)
-		candidate->addSecondary(electronId, Ee, pos, 1., interactionTag);
+		candidate->addSecondary(electronId, Ee, pos, 1., interactionTagCode);
 	if (haveNeutrinos)
-		candidate->addSecondary(neutrinoId, Enu, pos, 1., interactionTag);
+		candidate->addSecondary(neutrinoId, Enu, pos, 1., interactionTagCode);
 }
 
 void NuclearDecay::nucleonEmission(Candidate *candidate, int dA, int dZ) const {
@@ -274,7 +350,7 @@ void NuclearDecay::nucleonEmission(Candidate *candidate, int dA, int dZ) const {
 
 	try
 	{
-		candidate->addSecondary(nucleusId(dA, dZ), EpA * dA, pos, 1., interactionTag);
+		candidate->addSecondary(nucleusId(dA, dZ), EpA * dA, pos, 1., interactionTagCode);
 	}
 	catch (std::runtime_error &e)
 	{
@@ -310,10 +386,19 @@ double NuclearDecay::meanFreePath(int id, double gamma) {
 
 void NuclearDecay::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string NuclearDecay::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t NuclearDecay::getSizeOf() const {
+	size_t size = vectorSizeOf(decayTable) + vectorSizeOf(totalRate) + vectorSizeOf(chainLength);
+	for (size_t i = 0; i < decayTable.size(); i++)
+		for (size_t j = 0; j < decayTable[i].size(); j++)
+			size += vectorSizeOf(decayTable[i][j].energy) + vectorSizeOf(decayTable[i][j].intensity);
+	return size;
+}
+
 } // namespace crpropa
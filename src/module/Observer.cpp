@@ -5,8 +5,10 @@
 
 #include "kiss/logger.h"
 
-#include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <iostream>
 
 namespace crpropa {
 
@@ -60,6 +62,15 @@ void Observer::setFlag(std::string key, std::string value) {
 	flagValue = value;
 }
 
+size_t Observer::getSizeOf() const {
+	return detectionAction.valid() ? detectionAction->getSizeOf() : 0;
+}
+
+void Observer::endRun() {
+	if (detectionAction.valid())
+		detectionAction->endRun();
+}
+
 std::string Observer::getDescription() const {
 	std::stringstream ss;
 	ss << "Observer";
@@ -261,7 +272,7 @@ std::string ObserverInactiveVeto::getDescription() const {
 
 // ObserverNucleusVeto --------------------------------------------------------
 DetectionState ObserverNucleusVeto::checkDetection(Candidate *c) const {
-	if (isNucleus(c->current.getId()))
+	if (c->current.isNucleus())
 		return VETO;
 	return NOTHING;
 }
@@ -272,8 +283,7 @@ std::string ObserverNucleusVeto::getDescription() const {
 
 // ObserverNeutrinoVeto -------------------------------------------------------
 DetectionState ObserverNeutrinoVeto::checkDetection(Candidate *c) const {
-	int id = abs(c->current.getId());
-	if ((id == 12) or (id == 14) or (id == 16))
+	if (c->current.isNeutrino())
 		return VETO;
 	return NOTHING;
 }
@@ -339,8 +349,7 @@ DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
 	if (detList.size()) {
 		double length = c->getTrajectoryLength();
 		size_t index;
-		const std::string DI = "DetectionIndex";
-		std::string value;
+		static const PropertyKey DI = Candidate::getPropertyKey("DetectionIndex");
 
 		// Load the last detection index
 		if (c->hasProperty(DI)) {
@@ -351,7 +360,7 @@ DetectionState ObserverTimeEvolution::checkDetection(Candidate *c) const {
 		}
 
 		// Break if the particle has been detected once for all detList entries.
-		if (index > detList.size()) {
+		if (index >= detList.size()) {
 			return NOTHING;
 		}
 
@@ -404,20 +413,31 @@ std::string ObserverTimeEvolution::getDescription() const {
 }
 
 // ObserverSurface--------------------------------------------------------------
-ObserverSurface::ObserverSurface(Surface* _surface) : surface(_surface) { }
+ObserverSurface::ObserverSurface(Surface* _surface) : surface(_surface), interpolate(false) { }
 
 DetectionState ObserverSurface::checkDetection(Candidate *candidate) const
 {
 		double currentDistance = surface->distance(candidate->current.getPosition());
 		double previousDistance = surface->distance(candidate->previous.getPosition());
-		candidate->limitNextStep(fabs(currentDistance));
+		if (not interpolate)
+			candidate->limitNextStep(fabs(currentDistance));
 
 		if (currentDistance * previousDistance > 0)
 			return NOTHING;
 		else if (previousDistance == 0)
 			return NOTHING;
-		else
-			return DETECTED;
+
+		if (interpolate)
+			candidate->interpolateStep(surface->getStepCrossing(candidate));
+		return DETECTED;
+}
+
+void ObserverSurface::setInterpolateCrossing(bool b) {
+	interpolate = b;
+}
+
+bool ObserverSurface::getInterpolateCrossing() const {
+	return interpolate;
 }
 
 std::string ObserverSurface::getDescription() const {
@@ -426,4 +446,168 @@ std::string ObserverSurface::getDescription() const {
 	return ss.str();
 }
 
+// ObserverMultiSurface --------------------------------------------------------
+ObserverMultiSurface::ObserverMultiSurface(double cellSize, int maxRings) :
+		cellSize(cellSize), maxRings(maxRings) {
+	if (cellSize <= 0)
+		throw std::runtime_error("ObserverMultiSurface: cellSize <= 0");
+	if (maxRings < 0)
+		throw std::runtime_error("ObserverMultiSurface: maxRings < 0");
+}
+
+ObserverMultiSurface::CellKey ObserverMultiSurface::cellOf(const Vector3d &p) const {
+	CellKey k;
+	k.x = int64_t(floor(p.x / cellSize));
+	k.y = int64_t(floor(p.y / cellSize));
+	k.z = int64_t(floor(p.z / cellSize));
+	return k;
+}
+
+void ObserverMultiSurface::add(Surface *surface) {
+	size_t index = surfaces.size();
+	surfaces.push_back(surface);
+
+	Vector3d lower, upper;
+	if (not surface->getBounds(lower, upper)) {
+		unbounded.push_back(index);
+		return;
+	}
+	CellKey lo = cellOf(lower), hi = cellOf(upper);
+	if ((hi.x - lo.x >= 64) or (hi.y - lo.y >= 64) or (hi.z - lo.z >= 64)) {
+		unbounded.push_back(index);
+		return;
+	}
+	CellKey k;
+	for (k.x = lo.x; k.x <= hi.x; k.x++)
+		for (k.y = lo.y; k.y <= hi.y; k.y++)
+			for (k.z = lo.z; k.z <= hi.z; k.z++)
+				cells[k].push_back(index);
+}
+
+void ObserverMultiSurface::addSphere(const Vector3d &center, double radius) {
+	add(new Sphere(center, radius));
+}
+
+void ObserverMultiSurface::setIndexProperty(const std::string &key) {
+	indexKey = key;
+}
+
+void ObserverMultiSurface::collectSegment(const Vector3d &a, const Vector3d &b,
+		std::vector<size_t> &found) const {
+	// cells along the segment from a to b (Amanatides & Woo)
+	CellKey k = cellOf(a), end = cellOf(b);
+	int64_t *index[3] = {&k.x, &k.y, &k.z};
+	double start[3] = {a.x, a.y, a.z};
+	double delta[3] = {b.x - a.x, b.y - a.y, b.z - a.z};
+	int64_t step[3];
+	double tMax[3], tDelta[3];
+	for (int c = 0; c < 3; c++) {
+		step[c] = (delta[c] > 0) ? 1 : -1;
+		if (delta[c] == 0) {
+			tMax[c] = tDelta[c] = std::numeric_limits<double>::infinity();
+			continue;
+		}
+		double boundary = (*index[c] + (step[c] > 0)) * cellSize;
+		tMax[c] = (boundary - start[c]) / delta[c];
+		tDelta[c] = cellSize / fabs(delta[c]);
+	}
+
+	int64_t n = std::llabs(end.x - k.x) + std::llabs(end.y - k.y)
+			+ std::llabs(end.z - k.z);
+	for (int64_t i = 0; i <= n; i++) {
+		std::unordered_map<CellKey, std::vector<size_t>, CellHash>::const_iterator
+				cell = cells.find(k);
+		if (cell != cells.end())
+			found.insert(found.end(), cell->second.begin(), cell->second.end());
+		int c = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2)
+				: ((tMax[1] < tMax[2]) ? 1 : 2);
+		if (tMax[c] > 1)
+			break;
+		*index[c] += step[c];
+		tMax[c] += tDelta[c];
+	}
+}
+
+double ObserverMultiSurface::getNearestDistance(const Vector3d &position) const {
+	double dMin = std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < unbounded.size(); i++)
+		dMin = std::min(dMin, fabs(surfaces[unbounded[i]]->distance(position)));
+
+	CellKey c = cellOf(position);
+	double x[3] = {position.x, position.y, position.z};
+	int64_t ic[3] = {c.x, c.y, c.z};
+	double bound = 0;
+	for (int r = 0; r <= maxRings; r++) {
+		// the surfaces of the cells on the shell r around the current cell
+		CellKey k;
+		for (int64_t dx = -r; dx <= r; dx++)
+			for (int64_t dy = -r; dy <= r; dy++)
+				for (int64_t dz = -r; dz <= r; dz++) {
+					if ((std::llabs(dx) != r) and (std::llabs(dy) != r) and (std::llabs(dz) != r))
+						continue;
+					k.x = c.x + dx;
+					k.y = c.y + dy;
+					k.z = c.z + dz;
+					std::unordered_map<CellKey, std::vector<size_t>, CellHash>::const_iterator
+							cell = cells.find(k);
+					if (cell == cells.end())
+						continue;
+					for (size_t i = 0; i < cell->second.size(); i++)
+						dMin = std::min(dMin, fabs(surfaces[cell->second[i]]->distance(position)));
+				}
+
+		// all surfaces not seen yet are outside of the cells up to shell r
+		bound = std::numeric_limits<double>::infinity();
+		for (int a = 0; a < 3; a++) {
+			bound = std::min(bound, x[a] - (ic[a] - r) * cellSize);
+			bound = std::min(bound, (ic[a] + r + 1) * cellSize - x[a]);
+		}
+		if (dMin <= bound)
+			return dMin;
+	}
+	return std::min(dMin, bound);
+}
+
+size_t ObserverMultiSurface::getNumberOfSurfaces() const {
+	return surfaces.size();
+}
+
+size_t ObserverMultiSurface::getNumberOfCells() const {
+	return cells.size();
+}
+
+DetectionState ObserverMultiSurface::checkDetection(Candidate *candidate) const {
+	Vector3d current = candidate->current.getPosition();
+	Vector3d previous = candidate->previous.getPosition();
+	candidate->limitNextStep(getNearestDistance(current));
+
+	static thread_local std::vector<size_t> found;
+	found.clear();
+	collectSegment(previous, current, found);
+	found.insert(found.end(), unbounded.begin(), unbounded.end());
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	// as ObserverSurface, the first crossed surface is reported
+	for (size_t i = 0; i < found.size(); i++) {
+		const Surface *surface = surfaces[found[i]];
+		double currentDistance = surface->distance(current);
+		double previousDistance = surface->distance(previous);
+		if ((currentDistance * previousDistance > 0) or (previousDistance == 0))
+			continue;
+		if (not indexKey.empty())
+			candidate->setProperty(indexKey, Variant::fromUInt64(found[i]));
+		return DETECTED;
+	}
+	return NOTHING;
+}
+
+std::string ObserverMultiSurface::getDescription() const {
+	std::stringstream ss;
+	ss << "ObserverMultiSurface: " << surfaces.size() << " surfaces in "
+			<< cells.size() << " cells of " << cellSize / kpc << " kpc, "
+			<< unbounded.size() << " tested every step";
+	return ss.str();
+}
+
 } // namespace crpropa
@@ -1,18 +1,267 @@
 #include "crpropa/module/Output.h"
 #include "crpropa/Units.h"
 
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
-Output::Output() : outputName(OutputTypeName(Everything)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0) {
+struct Output::AsyncQueue {
+	std::mutex mutex;
+	std::condition_variable pushed, popped;
+	std::deque<std::function<void()> > jobs;
+	size_t limit;
+	bool busy, stop;
+	std::thread thread;
+
+	AsyncQueue(size_t limit) : limit(std::max(limit, size_t(1))), busy(false), stop(false) {
+		thread = std::thread(&AsyncQueue::run, this);
+	}
+
+	~AsyncQueue() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stop = true;
+		}
+		pushed.notify_all();
+		thread.join();
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			pushed.wait(lock, [this] { return stop or not jobs.empty(); });
+			if (jobs.empty())
+				return; // stopped and nothing left to do
+			std::function<void()> job = jobs.front();
+			jobs.pop_front();
+			busy = true;
+			lock.unlock();
+			popped.notify_all();
+			try {
+				job();
+			} catch (std::exception &e) {
+				KISS_LOG_ERROR << "Output: Exception in output thread.\n" << e.what();
+			}
+			lock.lock();
+			busy = false;
+			popped.notify_all();
+		}
+	}
+
+	void push(const std::function<void()> &job) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			popped.wait(lock, [this] { return jobs.size() < limit; });
+			jobs.push_back(job);
+		}
+		pushed.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		popped.wait(lock, [this] { return jobs.empty() and not busy; });
+	}
+};
+
+Output::Output() : outputName(OutputTypeName(Everything)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0),
+		ordered(false), nextPrimary(0), sharded(false), exclusive(false), asyncQueue(0) {
 	enableAll();
 }
 
-Output::Output(OutputType outputType) : outputName(OutputTypeName(outputType)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0) {
+Output::Output(OutputType outputType) : outputName(OutputTypeName(outputType)), lengthScale(Mpc), energyScale(EeV), oneDimensional(false), count(0),
+		ordered(false), nextPrimary(0), sharded(false), exclusive(false), asyncQueue(0) {
 	setOutputType(outputType);
 }
 
+Output::~Output() {
+	delete asyncQueue;
+}
+
+void Output::submit(const std::function<void()> &job) const {
+	if (asyncQueue)
+		asyncQueue->push(job);
+	else
+		job();
+}
+
+void Output::drain() const {
+	if (asyncQueue)
+		asyncQueue->wait();
+}
+
+void Output::beginOrder(uint64_t firstPrimary) {
+	if (sharded)
+		throw std::runtime_error("Output: the ordered mode is not supported with shards");
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	threadHeld.assign(nThreads, 0);
+	nextPrimary = firstPrimary;
+	ordered = true;
+}
+
+void Output::endOrder() {
+	// primaries after a gap, e.g. of a cancelled run
+#pragma omp critical
+	{
+		for (std::set<uint64_t>::iterator i = finishedPrimaries.begin();
+				i != finishedPrimaries.end(); ++i)
+			writePrimary(*i);
+		finishedPrimaries.clear();
+	}
+	ordered = false;
+}
+
+bool Output::isOrdered() const {
+	return ordered;
+}
+
+uint64_t Output::getNextPrimary() const {
+	uint64_t next;
+#pragma omp atomic read
+	next = nextPrimary;
+	return next;
+}
+
+bool Output::isHeld(size_t thread) const {
+	return ordered and thread < threadHeld.size() and threadHeld[thread];
+}
+
+void Output::holdPrimary(uint64_t index, size_t thread) const {
+}
+
+void Output::writePrimary(uint64_t index) const {
+}
+
+void Output::beginPrimary(uint64_t index) const {
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (ordered and thread < threadHeld.size())
+		threadHeld[thread] = 1;
+}
+
+void Output::endPrimary(uint64_t index) const {
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (not ordered)
+		return;
+	if (thread < threadHeld.size())
+		threadHeld[thread] = 0;
+#pragma omp critical
+	{
+		holdPrimary(index, thread);
+		finishedPrimaries.insert(index);
+		while (not finishedPrimaries.empty() and *finishedPrimaries.begin() <= nextPrimary) {
+			uint64_t i = *finishedPrimaries.begin();
+			writePrimary(i);
+			finishedPrimaries.erase(finishedPrimaries.begin());
+			if (i == nextPrimary) {
+#pragma omp atomic update
+				nextPrimary++;
+			}
+		}
+	}
+}
+
+void Output::setSharded(bool value) {
+	modify();
+	if (value and ordered)
+		throw std::runtime_error("Output: shards are not supported in the ordered mode");
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	sharded = value;
+	shards.assign(value ? nThreads : 0, 0);
+}
+
+bool Output::isSharded() const {
+	return sharded;
+}
+
+std::string Output::shardFilename(const std::string &filename, size_t index) {
+	std::stringstream ss;
+	ss << ".t" << index;
+	size_t slash = filename.rfind('/');
+	size_t base = (slash == std::string::npos) ? 0 : slash + 1;
+	// a leading dot is not an extension
+	size_t dot = filename.find('.', base + 1);
+	if (base >= filename.size() or dot == std::string::npos)
+		return filename + ss.str();
+	return filename.substr(0, dot) + ss.str() + filename.substr(dot);
+}
+
+Output *Output::createShard(size_t index) const {
+	throw std::runtime_error("Output: shards are not supported by " + getDescription());
+}
+
+void Output::configureShard(Output *shard) const {
+	shard->lengthScale = lengthScale;
+	shard->energyScale = energyScale;
+	shard->fields = fields;
+	shard->properties = properties;
+	shard->oneDimensional = oneDimensional;
+	shard->exclusive = true;
+}
+
+Output *Output::getShard() const {
+	if (shards.empty())
+		return 0;
+	size_t thread = 0;
+#ifdef _OPENMP
+	thread = omp_get_thread_num();
+#endif
+	if (thread >= shards.size())
+		return 0;
+	// only the thread itself accesses its shard
+	if (not shards[thread])
+		shards[thread] = createShard(thread);
+	return shards[thread];
+}
+
+std::vector<std::pair<size_t, size_t> > Output::releaseShards() {
+	std::vector<std::pair<size_t, size_t> > rows;
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (not shards[i])
+			continue;
+		rows.push_back(std::make_pair(i, shards[i]->size()));
+		count += shards[i]->size();
+	}
+	shards.clear();
+	return rows;
+}
+
+void Output::setAsynchronous(bool async, size_t queueLimit) {
+	modify();
+	delete asyncQueue;
+	asyncQueue = async ? new AsyncQueue(queueLimit) : 0;
+}
+
+bool Output::isAsynchronous() const {
+	return asyncQueue != 0;
+}
+
+size_t Output::checkpoint(std::string &filename) {
+	throw std::runtime_error("Output: checkpoints are not supported by " + getDescription());
+}
+
 std::string Output::OutputTypeName(OutputType outputType) {
 	if (outputType == Trajectory1D)
 		return "Trajectory1D";
@@ -30,6 +279,17 @@ void Output::modify() {
 		throw std::runtime_error("Output: cannot change Output parameters after data has been written to file.");
 }
 
+void Output::checkRetention(const Candidate *c) const {
+	if (not c->source.isRetained() and (fields.test(SourceIdColumn)
+			or fields.test(SourceEnergyColumn) or fields.test(SourcePositionColumn)
+			or fields.test(SourceDirectionColumn)))
+		throw std::runtime_error("Output: source columns enabled, but the source state is not retained");
+	if (not c->created.isRetained() and (fields.test(CreatedIdColumn)
+			or fields.test(CreatedEnergyColumn) or fields.test(CreatedPositionColumn)
+			or fields.test(CreatedDirectionColumn)))
+		throw std::runtime_error("Output: created columns enabled, but the created state is not retained");
+}
+
 void Output::process(Candidate *c) const {
 	count++;
 }
@@ -121,16 +381,37 @@ void Output::disableAll() {
 }
 
 size_t Output::size() const {
-	return count;
+	size_t n = count;
+	for (size_t i = 0; i < shards.size(); i++)
+		if (shards[i])
+			n += shards[i]->size();
+	return n;
+}
+
+size_t Output::getSizeOf() const {
+	size_t size = 0;
+	for (size_t i = 0; i < shards.size(); i++)
+		if (shards[i])
+			size += shards[i]->getSizeOf();
+	return size;
 }
 
 void Output::enableProperty(const std::string &property, const Variant &defaultValue, const std::string &comment) {
 	modify();
 	Property prop;
 	prop.name = property;
+	prop.key = Candidate::getPropertyKey(property);
 	prop.comment = comment;
 	prop.defaultValue = defaultValue;
 	properties.push_back(prop);
 };
 
+void Output::enableCost() {
+	enableProperty("CostSteps", Variant::fromUInt64(0), "steps of the candidate");
+	enableProperty("CostFieldEvaluations", Variant::fromUInt64(0), "field evaluations of the propagation");
+	enableProperty("CostRejectedSteps", Variant::fromUInt64(0), "rejected adaptive steps");
+	enableProperty("CostSecondaries", Variant::fromUInt64(0), "secondaries created");
+	enableProperty("CostTime", Variant::fromDouble(0), "wall time of the steps [s]");
+}
+
 } // namespace crpropa
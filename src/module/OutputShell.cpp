@@ -42,10 +42,11 @@ std::string ShellOutput1D::getDescription() const {
 }
 
 void ShellPropertyOutput::process(Candidate* c) const {
-	Candidate::PropertyMap::const_iterator i = c->properties.begin();
+	Candidate::PropertyMap properties = c->getProperties();
+	Candidate::PropertyMap::const_iterator i = properties.begin();
 #pragma omp critical
 	{
-		for ( ; i != c->properties.end(); i++) {
+		for ( ; i != properties.end(); i++) {
 			std::cout << "  " << i->first << ", " << i->second << std::endl;
 		}
 	}
@@ -0,0 +1,488 @@
+#ifdef CRPROPA_HAVE_PARQUET
+
+#include "crpropa/module/ParquetOutput.h"
+#include "crpropa/Checkpoint.h"
+#include "crpropa/Version.h"
+#include "kiss/logger.h"
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+
+#include <limits>
+#include <memory>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+const size_t BUFFER_SIZE = 1024 * 64;
+const size_t THREAD_BUFFER_SIZE = 256;
+
+namespace crpropa {
+
+struct ParquetOutput::Row {
+	double D, z, E, X, Y, Z, Px, Py, Pz;
+	double E0, X0, Y0, Z0, P0x, P0y, P0z;
+	double E1, X1, Y1, Z1, P1x, P1y, P1z;
+	double weight;
+	uint64_t SN, SN0, SN1;
+	int32_t ID, ID0, ID1;
+	uint32_t tag; // code of Candidate::getTagCode
+	std::vector<Variant> properties;
+};
+
+namespace {
+
+std::shared_ptr<arrow::DataType> variantTypeToArrow(Variant::Type type) {
+	switch (type) {
+	case Variant::TYPE_BOOL: return arrow::boolean();
+	case Variant::TYPE_CHAR: return arrow::int8();
+	case Variant::TYPE_UCHAR: return arrow::uint8();
+	case Variant::TYPE_INT16: return arrow::int16();
+	case Variant::TYPE_UINT16: return arrow::uint16();
+	case Variant::TYPE_INT32: return arrow::int32();
+	case Variant::TYPE_UINT32: return arrow::uint32();
+	case Variant::TYPE_INT64: return arrow::int64();
+	case Variant::TYPE_UINT64: return arrow::uint64();
+	case Variant::TYPE_FLOAT: return arrow::float32();
+	case Variant::TYPE_DOUBLE: return arrow::float64();
+	case Variant::TYPE_STRING: return arrow::utf8();
+	default:
+		KISS_LOG_ERROR << "variantTypeToArrow:: Type: " << Variant::getTypeName(type) << " unknown.";
+		throw std::runtime_error("No matching Arrow type for Variant type");
+	}
+}
+
+template<typename Builder, typename T>
+arrow::Status appendProperty(arrow::ArrayBuilder *builder, const T &value) {
+	return static_cast<Builder *>(builder)->Append(value);
+}
+
+arrow::Status appendVariant(arrow::ArrayBuilder *b, const Variant &v, Variant::Type type) {
+	switch (type) {
+	case Variant::TYPE_BOOL: return appendProperty<arrow::BooleanBuilder>(b, v.toBool());
+	case Variant::TYPE_CHAR: return appendProperty<arrow::Int8Builder>(b, int8_t(v.toChar()));
+	case Variant::TYPE_UCHAR: return appendProperty<arrow::UInt8Builder>(b, v.toUChar());
+	case Variant::TYPE_INT16: return appendProperty<arrow::Int16Builder>(b, v.toInt16());
+	case Variant::TYPE_UINT16: return appendProperty<arrow::UInt16Builder>(b, v.toUInt16());
+	case Variant::TYPE_INT32: return appendProperty<arrow::Int32Builder>(b, v.toInt32());
+	case Variant::TYPE_UINT32: return appendProperty<arrow::UInt32Builder>(b, v.toUInt32());
+	case Variant::TYPE_INT64: return appendProperty<arrow::Int64Builder>(b, v.toInt64());
+	case Variant::TYPE_UINT64: return appendProperty<arrow::UInt64Builder>(b, v.toUInt64());
+	case Variant::TYPE_FLOAT: return appendProperty<arrow::FloatBuilder>(b, v.toFloat());
+	case Variant::TYPE_DOUBLE: return appendProperty<arrow::DoubleBuilder>(b, v.toDouble());
+	default: return appendProperty<arrow::StringBuilder>(b, v.toString());
+	}
+}
+
+void check(const arrow::Status &status) {
+	if (not status.ok())
+		throw std::runtime_error("ParquetOutput: " + status.ToString());
+}
+
+} // namespace
+
+struct ParquetOutput::Writer {
+	// a column of the file, one of the members of a row or a property
+	struct Column {
+		std::string name;
+		double Row::*d;
+		uint64_t Row::*u;
+		int32_t Row::*i;
+		bool tag;
+		int property;
+		Variant::Type type;
+
+		Column(const std::string &name) :
+				name(name), d(0), u(0), i(0), tag(false), property(-1),
+				type(Variant::TYPE_NONE) {
+		}
+	};
+
+	std::vector<Column> columns;
+	std::shared_ptr<arrow::Schema> schema;
+	std::shared_ptr<arrow::io::FileOutputStream> stream;
+	std::unique_ptr<parquet::arrow::FileWriter> file;
+	std::vector<Row> buffer;
+	/// rows of each thread, handed over to buffer in batches to avoid
+	/// locking for every candidate
+	std::vector<std::vector<Row> > threadBuffers;
+	size_t rowsWritten;
+};
+
+ParquetOutput::ParquetOutput() : Output(), filename(), writer(0),
+		candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+}
+
+ParquetOutput::ParquetOutput(const std::string &filename) : Output(), filename(filename),
+		writer(0), candidatesSinceFlush(0), flushLimit(std::numeric_limits<unsigned int>::max()) {
+}
+
+ParquetOutput::ParquetOutput(const std::string &filename, OutputType outputtype) :
+		Output(outputtype), filename(filename), writer(0), candidatesSinceFlush(0),
+		flushLimit(std::numeric_limits<unsigned int>::max()) {
+}
+
+ParquetOutput::~ParquetOutput() {
+	close();
+}
+
+void ParquetOutput::open(const std::string &filename) {
+	size_t offset, n;
+	if (Checkpoint::getRestart(filename, offset, n))
+		throw std::runtime_error("ParquetOutput: cannot resume " + filename
+				+ ", Parquet files can not be appended");
+
+	std::unique_ptr<Writer> w(new Writer());
+	w->rowsWritten = 0;
+	std::vector<Writer::Column> &c = w->columns;
+	std::vector<std::shared_ptr<arrow::Field> > fieldList;
+#define CRPROPA_COLUMN(NAME, MEMBER, KIND, TYPE) \
+	c.push_back(Writer::Column(NAME)); \
+	c.back().KIND = &Row::MEMBER; \
+	fieldList.push_back(arrow::field(NAME, TYPE, false));
+
+	if (fields.test(TrajectoryLengthColumn)) {
+		CRPROPA_COLUMN("D", D, d, arrow::float64());
+	}
+	if (fields.test(RedshiftColumn)) {
+		CRPROPA_COLUMN("z", z, d, arrow::float64());
+	}
+	if (fields.test(SerialNumberColumn)) {
+		CRPROPA_COLUMN("SN", SN, u, arrow::uint64());
+	}
+	if (fields.test(CurrentIdColumn)) {
+		CRPROPA_COLUMN("ID", ID, i, arrow::int32());
+	}
+	if (fields.test(CurrentEnergyColumn)) {
+		CRPROPA_COLUMN("E", E, d, arrow::float64());
+	}
+	if (fields.test(CurrentPositionColumn)) {
+		CRPROPA_COLUMN("X", X, d, arrow::float64());
+	}
+	if (fields.test(CurrentPositionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("Y", Y, d, arrow::float64());
+		CRPROPA_COLUMN("Z", Z, d, arrow::float64());
+	}
+	if (fields.test(CurrentDirectionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("Px", Px, d, arrow::float64());
+		CRPROPA_COLUMN("Py", Py, d, arrow::float64());
+		CRPROPA_COLUMN("Pz", Pz, d, arrow::float64());
+	}
+	if (fields.test(SerialNumberColumn)) {
+		CRPROPA_COLUMN("SN0", SN0, u, arrow::uint64());
+	}
+	if (fields.test(SourceIdColumn)) {
+		CRPROPA_COLUMN("ID0", ID0, i, arrow::int32());
+	}
+	if (fields.test(SourceEnergyColumn)) {
+		CRPROPA_COLUMN("E0", E0, d, arrow::float64());
+	}
+	if (fields.test(SourcePositionColumn)) {
+		CRPROPA_COLUMN("X0", X0, d, arrow::float64());
+	}
+	if (fields.test(SourcePositionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("Y0", Y0, d, arrow::float64());
+		CRPROPA_COLUMN("Z0", Z0, d, arrow::float64());
+	}
+	if (fields.test(SourceDirectionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("P0x", P0x, d, arrow::float64());
+		CRPROPA_COLUMN("P0y", P0y, d, arrow::float64());
+		CRPROPA_COLUMN("P0z", P0z, d, arrow::float64());
+	}
+	if (fields.test(SerialNumberColumn)) {
+		CRPROPA_COLUMN("SN1", SN1, u, arrow::uint64());
+	}
+	if (fields.test(CreatedIdColumn)) {
+		CRPROPA_COLUMN("ID1", ID1, i, arrow::int32());
+	}
+	if (fields.test(CreatedEnergyColumn)) {
+		CRPROPA_COLUMN("E1", E1, d, arrow::float64());
+	}
+	if (fields.test(CreatedPositionColumn)) {
+		CRPROPA_COLUMN("X1", X1, d, arrow::float64());
+	}
+	if (fields.test(CreatedPositionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("Y1", Y1, d, arrow::float64());
+		CRPROPA_COLUMN("Z1", Z1, d, arrow::float64());
+	}
+	if (fields.test(CreatedDirectionColumn) && not oneDimensional) {
+		CRPROPA_COLUMN("P1x", P1x, d, arrow::float64());
+		CRPROPA_COLUMN("P1y", P1y, d, arrow::float64());
+		CRPROPA_COLUMN("P1z", P1z, d, arrow::float64());
+	}
+	if (fields.test(WeightColumn)) {
+		CRPROPA_COLUMN("W", weight, d, arrow::float64());
+	}
+#undef CRPROPA_COLUMN
+	if (fields.test(CandidateTagColumn)) {
+		c.push_back(Writer::Column("tag"));
+		c.back().tag = true;
+		fieldList.push_back(arrow::field("tag", arrow::utf8(), false));
+	}
+	for (size_t i = 0; i < properties.size(); i++) {
+		c.push_back(Writer::Column(properties[i].name));
+		c.back().property = i;
+		c.back().type = properties[i].defaultValue.getType();
+		fieldList.push_back(arrow::field(properties[i].name,
+				variantTypeToArrow(c.back().type), false));
+	}
+
+	std::ostringstream lengthScaleValue, energyScaleValue;
+	lengthScaleValue.precision(17);
+	lengthScaleValue << lengthScale;
+	energyScaleValue.precision(17);
+	energyScaleValue << energyScale;
+	std::shared_ptr<arrow::KeyValueMetadata> metadata = arrow::key_value_metadata(
+			{"OutputType", "Version", "LengthScale", "EnergyScale"},
+			{outputName, g_GIT_DESC, lengthScaleValue.str(), energyScaleValue.str()});
+	w->schema = arrow::schema(fieldList, metadata);
+
+	// zstd for all columns, dictionaries only for the ids and the tag
+	parquet::WriterProperties::Builder builder;
+	builder.compression(parquet::Compression::ZSTD)->disable_dictionary();
+	const char *dictionaryColumns[] = {"ID", "ID0", "ID1", "tag"};
+	for (size_t i = 0; i < 4; i++)
+		builder.enable_dictionary(dictionaryColumns[i]);
+	std::shared_ptr<parquet::WriterProperties> writerProperties = builder.build();
+	std::shared_ptr<parquet::ArrowWriterProperties> arrowProperties =
+			parquet::ArrowWriterProperties::Builder().store_schema()->build();
+
+	arrow::Result<std::shared_ptr<arrow::io::FileOutputStream> > stream =
+			arrow::io::FileOutputStream::Open(filename);
+	if (not stream.ok())
+		throw std::runtime_error(std::string("Cannot create file: ") + filename);
+	w->stream = *stream;
+	arrow::Result<std::unique_ptr<parquet::arrow::FileWriter> > file =
+			parquet::arrow::FileWriter::Open(*w->schema, arrow::default_memory_pool(),
+			w->stream, writerProperties, arrowProperties);
+	check(file.status());
+	w->file = std::move(*file);
+
+	w->buffer.reserve(BUFFER_SIZE);
+	size_t nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	w->threadBuffers.resize(nThreads);
+	for (size_t i = 0; i < nThreads; i++)
+		w->threadBuffers[i].reserve(THREAD_BUFFER_SIZE);
+	time(&lastFlush);
+
+	writer = w.release();
+}
+
+void ParquetOutput::close() {
+	if (writer) {
+		flush();
+		drain();
+		check(writer->file->Close());
+		check(writer->stream->Close());
+		delete writer;
+		writer = 0;
+	}
+}
+
+void ParquetOutput::process(Candidate *candidate) const {
+	checkRetention(candidate);
+	if (not writer) {
+		#pragma omp critical
+		{
+		if (not writer)
+			const_cast<ParquetOutput*>(this)->open(filename);
+		}
+	}
+
+	Row r = Row();
+	r.D = candidate->getTrajectoryLength() / lengthScale;
+	r.z = candidate->getRedshift();
+
+	r.SN = candidate->getSerialNumber();
+	r.ID = candidate->current.getId();
+	r.E = candidate->current.getEnergy() / energyScale;
+	Vector3d v = candidate->current.getPosition() / lengthScale;
+	r.X = v.x;
+	r.Y = v.y;
+	r.Z = v.z;
+	v = candidate->current.getDirection();
+	r.Px = v.x;
+	r.Py = v.y;
+	r.Pz = v.z;
+
+	r.SN0 = candidate->getSourceSerialNumber();
+	// the columns of states that are not retained stay zero
+	if (candidate->source.isRetained()) {
+		r.ID0 = candidate->source.getId();
+		r.E0 = candidate->source.getEnergy() / energyScale;
+		v = candidate->source.getPosition() / lengthScale;
+		r.X0 = v.x;
+		r.Y0 = v.y;
+		r.Z0 = v.z;
+		v = candidate->source.getDirection();
+		r.P0x = v.x;
+		r.P0y = v.y;
+		r.P0z = v.z;
+	}
+
+	r.SN1 = candidate->getCreatedSerialNumber();
+	if (candidate->created.isRetained()) {
+		r.ID1 = candidate->created.getId();
+		r.E1 = candidate->created.getEnergy() / energyScale;
+		v = candidate->created.getPosition() / lengthScale;
+		r.X1 = v.x;
+		r.Y1 = v.y;
+		r.Z1 = v.z;
+		v = candidate->created.getDirection();
+		r.P1x = v.x;
+		r.P1y = v.y;
+		r.P1z = v.z;
+	}
+
+	r.weight = candidate->getWeight();
+	if (fields.test(CandidateTagColumn))
+		r.tag = candidate->getTagOriginCode();
+
+	r.properties.resize(properties.size());
+	for (size_t i = 0; i < properties.size(); i++) {
+		if (candidate->hasProperty(properties[i].key))
+			r.properties[i] = candidate->getProperty(properties[i].key);
+		else
+			r.properties[i] = properties[i].defaultValue;
+	}
+
+	#pragma omp atomic
+	count++;
+
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid < writer->threadBuffers.size()) {
+		// collect rows without locking and hand them over in batches
+		std::vector<Row> &rows = writer->threadBuffers[tid];
+		rows.push_back(r);
+		if (rows.size() < std::min<size_t>(THREAD_BUFFER_SIZE, flushLimit))
+			return;
+		#pragma omp critical
+		appendRows(rows);
+	} else {
+		// more threads than at the time the file was opened
+		std::vector<Row> rows(1, r);
+		#pragma omp critical
+		appendRows(rows);
+	}
+}
+
+void ParquetOutput::appendRows(std::vector<Row> &rows) const {
+	const_cast<ParquetOutput*>(this)->candidatesSinceFlush += rows.size();
+	writer->buffer.insert(writer->buffer.end(), rows.begin(), rows.end());
+	rows.clear();
+
+	if (writer->buffer.size() >= BUFFER_SIZE) {
+		KISS_LOG_DEBUG << "ParquetOutput: Flush due to buffer capacity exceeded";
+		flush();
+	} else if (candidatesSinceFlush >= flushLimit) {
+		KISS_LOG_DEBUG << "ParquetOutput: Flush due to number of candidates";
+		flush();
+	} else if (difftime(time(NULL), lastFlush) > 60*10) {
+		KISS_LOG_DEBUG << "ParquetOutput: Flush due to time exceeded";
+		flush();
+	}
+}
+
+void ParquetOutput::flush() const {
+	if (not writer)
+		return;
+	const_cast<ParquetOutput*>(this)->lastFlush = time(NULL);
+	const_cast<ParquetOutput*>(this)->candidatesSinceFlush = 0;
+
+	// rows of the threads can only be collected safely if no thread is
+	// currently adding to them
+#ifdef _OPENMP
+	if (not omp_in_parallel())
+#endif
+	for (size_t i = 0; i < writer->threadBuffers.size(); i++) {
+		std::vector<Row> &rows = writer->threadBuffers[i];
+		writer->buffer.insert(writer->buffer.end(), rows.begin(), rows.end());
+		rows.clear();
+	}
+
+	if (writer->buffer.empty())
+		return;
+
+	// hand the rows to the output thread, or write them directly
+	std::shared_ptr<std::vector<Row> > rows = std::make_shared<std::vector<Row> >();
+	rows->reserve(BUFFER_SIZE);
+	rows->swap(writer->buffer);
+	submit([this, rows]() { writeRows(*rows); });
+}
+
+void ParquetOutput::writeRows(const std::vector<Row> &rows) const {
+	// one array per column, written as a row group
+	size_t n = rows.size();
+	std::vector<std::shared_ptr<arrow::Array> > arrays;
+	for (size_t k = 0; k < writer->columns.size(); k++) {
+		const Writer::Column &c = writer->columns[k];
+		std::shared_ptr<arrow::Array> array;
+		if (c.d) {
+			arrow::DoubleBuilder b;
+			check(b.Reserve(n));
+			for (size_t j = 0; j < n; j++)
+				b.UnsafeAppend(rows[j].*c.d);
+			check(b.Finish(&array));
+		} else if (c.u) {
+			arrow::UInt64Builder b;
+			check(b.Reserve(n));
+			for (size_t j = 0; j < n; j++)
+				b.UnsafeAppend(rows[j].*c.u);
+			check(b.Finish(&array));
+		} else if (c.i) {
+			arrow::Int32Builder b;
+			check(b.Reserve(n));
+			for (size_t j = 0; j < n; j++)
+				b.UnsafeAppend(rows[j].*c.i);
+			check(b.Finish(&array));
+		} else if (c.tag) {
+			arrow::StringBuilder b;
+			for (size_t j = 0; j < n; j++)
+				check(b.Append(Candidate::getTagName(rows[j].tag)));
+			check(b.Finish(&array));
+		} else {
+			arrow::Result<std::unique_ptr<arrow::ArrayBuilder> > b =
+					arrow::MakeBuilder(variantTypeToArrow(c.type));
+			check(b.status());
+			for (size_t j = 0; j < n; j++)
+				check(appendVariant(b->get(), rows[j].properties[c.property], c.type));
+			check((*b)->Finish(&array));
+		}
+		arrays.push_back(array);
+	}
+
+	std::shared_ptr<arrow::Table> table = arrow::Table::Make(writer->schema, arrays, n);
+	check(writer->file->WriteTable(*table, n));
+	writer->rowsWritten += n;
+}
+
+size_t ParquetOutput::checkpoint(std::string &name) {
+	name = filename;
+	if (not writer)
+		return 0;
+	flush();
+	drain();
+	return writer->rowsWritten;
+}
+
+std::string ParquetOutput::getDescription() const {
+	return "ParquetOutput";
+}
+
+void ParquetOutput::setFlushLimit(unsigned int N) {
+	flushLimit = N;
+}
+
+} // namespace crpropa
+
+#endif // CRPROPA_HAVE_PARQUET
@@ -2,39 +2,193 @@
 #include "crpropa/module/TextOutput.h"
 #include "crpropa/Units.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
+// records collected by a thread before they are handed to the shared buffer
+static const size_t THREAD_RECORDS = 4096;
+
 ParticleCollector::ParticleCollector() : nBuffer(10e6), clone(false), recursive(false)  {
+	init();
         container.reserve(nBuffer); // for 1e6 candidates ~ 500MB of RAM
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer) : clone(false), recursive(false)  {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer) : nBuffer(nBuffer), clone(false), recursive(false)  {
+	init();
 	container.reserve(nBuffer);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : recursive(false) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone) : nBuffer(nBuffer), clone(clone), recursive(false) {
+	init();
 	container.reserve(nBuffer);
 }
 
-ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) {
+ParticleCollector::ParticleCollector(const std::size_t nBuffer, const bool clone, const bool recursive) : nBuffer(nBuffer), clone(clone), recursive(recursive) {
+	init();
 	container.reserve(nBuffer);
 }
 
+void ParticleCollector::init() {
+	compact = false;
+	memoryLimit = 0;
+	spilled = 0;
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadContainers.resize(threads);
+	threadRecords.resize(threads);
+}
+
+static ParticleCollector::Record compactRecord(const ParticleState &state,
+		double redshift, double weight) {
+	ParticleCollector::Record r;
+	r.id = state.getId();
+	r.energy = state.getEnergy();
+	Vector3d v = state.getPosition();
+	r.position[0] = v.x;
+	r.position[1] = v.y;
+	r.position[2] = v.z;
+	v = state.getDirection();
+	r.direction[0] = v.x;
+	r.direction[1] = v.y;
+	r.direction[2] = v.z;
+	r.redshift = redshift;
+	r.weight = weight;
+	return r;
+}
+
 void ParticleCollector::process(Candidate *c) const {
-#pragma omp critical
-        {
-		if(clone)
-		       	container.push_back(c->clone(recursive));
-		else
-			container.push_back(c);
-        }
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (compact) {
+		collect(compactRecord(c->current, c->getRedshift(), c->getWeight()), tid);
+		return;
+	}
+
+	ref_ptr<Candidate> candidate = c;
+	if (clone)
+		candidate = c->clone(recursive);
+	// read by other threads after the run
+	candidate->makeShared();
+	if (tid < threadContainers.size()) {
+		threadContainers[tid].push_back(candidate);
+	} else {
+		// more threads than at construction
+#pragma omp critical(ParticleCollector)
+		container.push_back(candidate);
+	}
 }
 
 void ParticleCollector::process(ref_ptr<Candidate> c) const {
 	ParticleCollector::process((Candidate*) c);
 }
 
+void ParticleCollector::processSecondaryRecord(const SecondaryRecord &s,
+		Candidate *parent) const {
+	if (not compact) {
+		Module::processSecondaryRecord(s, parent);
+		return;
+	}
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	collect(compactRecord(s.current, s.redshift, s.weight), tid);
+}
+
+void ParticleCollector::collect(const Record &r, size_t tid) const {
+	if (tid < threadRecords.size()) {
+		std::vector<Record> &rs = threadRecords[tid];
+		rs.push_back(r);
+		// without a memory limit the records are merged after the run
+		if (memoryLimit == 0 or rs.size() < THREAD_RECORDS)
+			return;
+#pragma omp critical(ParticleCollector)
+		appendRecords(rs);
+	} else {
+		std::vector<Record> rs(1, r);
+#pragma omp critical(ParticleCollector)
+		appendRecords(rs);
+	}
+}
+
+void ParticleCollector::appendRecords(std::vector<Record> &rs) const {
+	records.insert(records.end(), rs.begin(), rs.end());
+	rs.clear();
+	if (memoryLimit > 0 and records.size() > memoryLimit)
+		spill();
+}
+
+void ParticleCollector::spill() const {
+	std::ofstream out(spillFilename.c_str(), std::ios::binary | std::ios::app);
+	out.write((const char *) &records[0], records.size() * sizeof(Record));
+	if (not out)
+		throw std::runtime_error("ParticleCollector: cannot write " + spillFilename);
+	spilled += records.size();
+	records.clear();
+}
+
+void ParticleCollector::merge() const {
+	for (size_t i = 0; i < threadContainers.size(); i++) {
+		if (threadContainers[i].empty())
+			continue;
+		container.insert(container.end(), threadContainers[i].begin(), threadContainers[i].end());
+		threadContainers[i].clear();
+	}
+	for (size_t i = 0; i < threadRecords.size(); i++)
+		if (not threadRecords[i].empty())
+			appendRecords(threadRecords[i]);
+}
+
 void ParticleCollector::reprocess(Module *action) const {
+	merge();
+	if (compact) {
+		std::vector<Record> block;
+		std::ifstream in;
+		if (spilled > 0) {
+			in.open(spillFilename.c_str(), std::ios::binary);
+			if (not in)
+				throw std::runtime_error("ParticleCollector: cannot read " + spillFilename);
+		}
+		// stream the spilled records in blocks, then the ones in memory
+		for (size_t done = 0; done < spilled + records.size();) {
+			const Record *rs;
+			size_t n;
+			if (done < spilled) {
+				n = std::min(spilled - done, THREAD_RECORDS);
+				block.resize(n);
+				in.read((char *) &block[0], n * sizeof(Record));
+				if (not in)
+					throw std::runtime_error("ParticleCollector: cannot read " + spillFilename);
+				rs = &block[0];
+			} else {
+				n = records.size();
+				rs = &records[0];
+			}
+			for (size_t i = 0; i < n; i++) {
+				const Record &r = rs[i];
+				ref_ptr<Candidate> c = new Candidate(r.id, r.energy,
+						Vector3d(r.position[0], r.position[1], r.position[2]),
+						Vector3d(r.direction[0], r.direction[1], r.direction[2]),
+						r.redshift, r.weight);
+				action->process(c);
+			}
+			done += n;
+		}
+		return;
+	}
+
 	for (ParticleCollector::iterator itr = container.begin(); itr != container.end(); ++itr){
 		if (clone)
 			action->process((*(itr->get())).clone(false));
@@ -43,6 +197,59 @@ void ParticleCollector::reprocess(Module *action) const {
 	}
 }
 
+void ParticleCollector::Columns::reserve(size_t n) {
+	id.reserve(n);
+	energy.reserve(n);
+	x.reserve(n);
+	y.reserve(n);
+	z.reserve(n);
+	px.reserve(n);
+	py.reserve(n);
+	pz.reserve(n);
+	redshift.reserve(n);
+	weight.reserve(n);
+}
+
+void ParticleCollector::Columns::append(const Candidate *c) {
+	id.push_back(c->current.getId());
+	energy.push_back(c->current.getEnergy());
+	Vector3d v = c->current.getPosition();
+	x.push_back(v.x);
+	y.push_back(v.y);
+	z.push_back(v.z);
+	v = c->current.getDirection();
+	px.push_back(v.x);
+	py.push_back(v.y);
+	pz.push_back(v.z);
+	redshift.push_back(c->getRedshift());
+	weight.push_back(c->getWeight());
+}
+
+namespace {
+// appends the reprocessed records of the compact mode
+class ColumnsAppender: public Module {
+	ParticleCollector::Columns &columns;
+public:
+	ColumnsAppender(ParticleCollector::Columns &columns) : columns(columns) {
+	}
+	void process(Candidate *c) const {
+		columns.append(c);
+	}
+};
+}
+
+void ParticleCollector::getColumns(Columns &columns) const {
+	columns = Columns();
+	columns.reserve(size());
+	if (compact) {
+		ColumnsAppender appender(columns);
+		reprocess(&appender);
+		return;
+	}
+	for (const_iterator itr = container.begin(); itr != container.end(); ++itr)
+		columns.append(itr->get());
+}
+
 void ParticleCollector::dump(const std::string &filename) const {
 	TextOutput output(filename.c_str(), Output::Everything);
 	reprocess(&output);
@@ -58,18 +265,31 @@ ParticleCollector::~ParticleCollector() {
 }
 
 std::size_t ParticleCollector::size() const {
+	merge();
+	if (compact)
+		return spilled + records.size();
         return container.size();
 }
 
 ref_ptr<Candidate> ParticleCollector::operator[](const std::size_t i) const {
+	merge();
 	return container[i];
 }
 
 void ParticleCollector::clearContainer() {
+	for (size_t i = 0; i < threadContainers.size(); i++)
+		threadContainers[i].clear();
+	for (size_t i = 0; i < threadRecords.size(); i++)
+		threadRecords[i].clear();
         container.clear();
+	records.clear();
+	if (spilled > 0)
+		std::remove(spillFilename.c_str());
+	spilled = 0;
 }
 
 std::vector<ref_ptr<Candidate> >& ParticleCollector::getContainer() const {
+	merge();
         return container;
 }
 
@@ -81,27 +301,65 @@ bool ParticleCollector::getClone() const {
         return clone;
 }
 
+void ParticleCollector::setCompact(bool b) {
+	if (b != compact and size() > 0)
+		throw std::runtime_error("ParticleCollector: compact mode can only be changed while empty");
+	compact = b;
+}
+
+bool ParticleCollector::isCompact() const {
+	return compact;
+}
+
+void ParticleCollector::setMemoryLimit(std::size_t maxRecords, const std::string &filename) {
+	setCompact(true);
+	if (spilled == 0)
+		std::remove(filename.c_str()); // left over from an earlier run
+	memoryLimit = maxRecords;
+	spillFilename = filename;
+}
+
+std::size_t ParticleCollector::getSpilled() const {
+	return spilled;
+}
+
+std::size_t ParticleCollector::getSizeOf() const {
+	size_t size = vectorSizeOf(container) + vectorSizeOf(records) + vectorSizeOf(threadRecords);
+	for (size_t i = 0; i < container.size(); i++)
+		size += container[i]->getSizeOf();
+	size += vectorSizeOf(threadContainers);
+	for (size_t t = 0; t < threadContainers.size(); t++)
+		for (size_t i = 0; i < threadContainers[t].size(); i++)
+			size += threadContainers[t][i]->getSizeOf();
+	return size;
+}
+
 std::string ParticleCollector::getDescription() const {
         return "ParticleCollector";
 }
 
 ParticleCollector::iterator ParticleCollector::begin() {
+	merge();
 	return container.begin();
 }
 
 ParticleCollector::const_iterator ParticleCollector::begin() const {
+	merge();
 	return container.begin();
 }
 
 ParticleCollector::iterator ParticleCollector::end() {
+	merge();
 	return container.end();
 }
 
 ParticleCollector::const_iterator ParticleCollector::end() const {
+	merge();
 	return container.end();
 }
 
 void ParticleCollector::getTrajectory(ModuleList* mlist, std::size_t i, Module *output) const {
+	merge();
 	ref_ptr<Candidate> c_tmp = container[i]->clone();
 
 	c_tmp->restart();
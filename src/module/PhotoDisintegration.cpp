@@ -1,10 +1,12 @@
 #include "crpropa/module/PhotoDisintegration.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
 #include "crpropa/Random.h"
 #include "kiss/logger.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <sstream>
@@ -13,6 +15,22 @@
 
 namespace crpropa {
 
+// change of mass and charge number in a disintegration channel
+static void channelChange(int channel, int &dA, int &dZ) {
+	int nNeutron = digit(channel, 100000);
+	int nProton = digit(channel, 10000);
+	int nH2 = digit(channel, 1000);
+	int nH3 = digit(channel, 100);
+	int nHe3 = digit(channel, 10);
+	int nHe4 = digit(channel, 1);
+	dA = -nNeutron - nProton - 2 * nH2 - 3 * nH3 - 3 * nHe3 - 4 * nHe4;
+	dZ = -nProton - nH2 - nH3 - 2 * nHe3 - 2 * nHe4;
+}
+
+static bool compareKey(const std::pair<int, size_t> &a, const std::pair<int, size_t> &b) {
+	return a.first < b.first;
+}
+
 const double PhotoDisintegration::lgmin = 6;  // minimum log10(Lorentz-factor)
 const double PhotoDisintegration::lgmax = 14; // maximum log10(Lorentz-factor)
 const size_t PhotoDisintegration::nlg = 201;  // number of Lorentz-factor steps
@@ -25,8 +43,9 @@ PhotoDisintegration::PhotoDisintegration(ref_ptr<PhotonField> f, bool havePhoton
 
 void PhotoDisintegration::setPhotonField(ref_ptr<PhotonField> photonField) {
 	this->photonField = photonField;
-	std::string fname = photonField->getFieldName();
-	setDescription("PhotoDisintegration: " + fname);
+	std::string fname = interactionTableField(*photonField, "Photodisintegration/rate_", tableScale);
+	lgTableScale = log10(tableScale);
+	setDescription("PhotoDisintegration: " + photonField->getFieldName());
 	initRate(getDataPath("Photodisintegration/rate_" + fname + ".txt"));
 	initBranching(getDataPath("Photodisintegration/branching_" + fname + ".txt"));
 	initPhotonEmission(getDataPath("Photodisintegration/photon_emission_" + fname.substr(0,3) + ".txt"));
@@ -41,139 +60,169 @@ void PhotoDisintegration::setLimit(double limit) {
 }
 
 void PhotoDisintegration::initRate(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
 
-	// clear previously loaded interaction rates
-	pdRate.clear();
-	pdRate.resize(27 * 31);
-
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
-		std::stringstream lineStream(line);
-
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
-
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			pdRate[Z * 31 + N].push_back(r / Mpc);
-		}
+	// index of the rows, the rates are read in loadNucleus
+	rateData = table;
+	rateRow.assign(27 * 31, -1);
+	for (size_t i = 0; i < table->size(); i++) {
+		const double *row = table->row(i, 2 + nlg);
+		rateRow[int(row[0]) * 31 + int(row[1])] = i;
 	}
-	infile.close();
+	resetNuclei();
 }
 
 void PhotoDisintegration::initBranching(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
 
-	// clear previously loaded interaction rates
-	pdBranch.clear();
-	pdBranch.resize(27 * 31);
+	// index of the rows, the branches are read in loadNucleus
+	branchData = table;
+	branchRows.clear();
+	branchRows.resize(27 * 31);
+	for (size_t i = 0; i < table->size(); i++) {
+		const double *row = table->row(i, 3 + nlg);
+		branchRows[int(row[0]) * 31 + int(row[1])].push_back(i);
+	}
+	resetNuclei();
+}
 
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
+void PhotoDisintegration::initPhotonEmission(std::string filename) {
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
+		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
 
-		std::stringstream lineStream(line);
+	// row: Z, N, Z daughter, N daughter, photon energy, emission probabilities
+	std::vector<std::pair<int, size_t> > order(table->size());
+	for (size_t i = 0; i < table->size(); i++) {
+		const double *row = table->row(i, 5 + nlg);
+		int key = int(row[0]) * 1000000 + int(row[1]) * 10000 + int(row[2]) * 100 + int(row[3]);
+		order[i] = std::make_pair(key, i);
+	}
+	std::stable_sort(order.begin(), order.end(), compareKey);
+
+	// replace previously loaded emission probabilities
+	pdPhotonKey.resize(order.size());
+	pdPhotonEnergy.resize(order.size());
+	pdPhotonProbability.resize(order.size() * nlg);
+	for (size_t i = 0; i < order.size(); i++) {
+		const double *row = table->row(order[i].second);
+		pdPhotonKey[i] = order[i].first;
+		pdPhotonEnergy[i] = row[4] * eV;
+		std::copy(row + 5, row + 5 + nlg, pdPhotonProbability.begin() + i * nlg);
+	}
 
-		int Z, N;
-		lineStream >> Z;
-		lineStream >> N;
+	// the branches link to the emitted photons
+	resetNuclei();
+}
 
-		Branch branch;
-		lineStream >> branch.channel;
+void PhotoDisintegration::resetNuclei() {
+	pdRate.clear();
+	pdRate.resize(27 * 31);
+	pdBranch.clear();
+	pdBranch.resize(27 * 31);
+	pdLoaded.assign(27 * 31, 0);
+}
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			branch.branchingRatio.push_back(r);
+void PhotoDisintegration::loadNucleus(size_t idx) const {
+	if (__atomic_load_n(&pdLoaded[idx], __ATOMIC_ACQUIRE))
+		return;
+#pragma omp critical(PhotoDisintegration)
+	if (not pdLoaded[idx]) {
+		int Z = idx / 31;
+		int N = idx % 31;
+		if (rateData.valid() and (rateRow[idx] >= 0)) {
+			const double *row = rateData->row(rateRow[idx]);
+			for (size_t j = 0; j < nlg; j++)
+				pdRate[idx].push_back(row[2 + j] / Mpc);
 		}
-
-		pdBranch[Z * 31 + N].push_back(branch);
+		if (branchData.valid()) {
+			const std::vector<size_t> &rows = branchRows[idx];
+			for (size_t i = 0; i < rows.size(); i++) {
+				const double *row = branchData->row(rows[i]);
+				Branch branch;
+				branch.channel = row[2];
+				branch.branchingRatio.assign(row + 3, row + 3 + nlg);
+
+				// range of the emitted photons
+				int dA, dZ;
+				channelChange(branch.channel, dA, dZ);
+				int key = Z * 1000000 + N * 10000 + (Z + dZ) * 100 + (N + dA - dZ);
+				branch.photonBegin = std::lower_bound(pdPhotonKey.begin(), pdPhotonKey.end(), key) - pdPhotonKey.begin();
+				branch.photonEnd = std::upper_bound(pdPhotonKey.begin(), pdPhotonKey.end(), key) - pdPhotonKey.begin();
+				pdBranch[idx].push_back(branch);
+			}
+		}
+		__atomic_store_n(&pdLoaded[idx], 1, __ATOMIC_RELEASE);
 	}
-
-	infile.close();
 }
 
-void PhotoDisintegration::initPhotonEmission(std::string filename) {
-	std::ifstream infile(filename.c_str());
-	if (not infile.good())
-		throw std::runtime_error("PhotoDisintegration: could not open file " + filename);
-
-	// clear previously loaded emission probabilities
-	pdPhoton.clear();
+const std::vector<double> &PhotoDisintegration::getRate(size_t idx) const {
+	loadNucleus(idx);
+	return pdRate[idx];
+}
 
-	std::string line;
-	while (std::getline(infile, line)) {
-		if (line[0] == '#')
-			continue;
+const std::vector<PhotoDisintegration::Branch> &PhotoDisintegration::getBranches(size_t idx) const {
+	loadNucleus(idx);
+	return pdBranch[idx];
+}
 
-		std::stringstream lineStream(line);
+const PhotoDisintegration::Branch *PhotoDisintegration::findBranch(int Z, int N, int channel) const {
+	if ((Z > 26) or (N > 30))
+		return 0;
+	const std::vector<Branch> &branches = getBranches(Z * 31 + N);
+	for (size_t i = 0; i < branches.size(); i++)
+		if (branches[i].channel == channel)
+			return &branches[i];
+	return 0;
+}
 
-		int Z, N, Zd, Nd;
-		lineStream >> Z;
-		lineStream >> N;
-		lineStream >> Zd;
-		lineStream >> Nd;
+double PhotoDisintegration::getInteractionRate(Candidate *candidate) const {
+	// check if disintegration data available: nuclei up to Z = 26, N = 30
+	int idx = candidate->current.getIsotopeIndex();
+	if (idx < 0)
+		return 0;
+	const std::vector<double> &rate = getRate(idx);
+	if (rate.size() == 0)
+		return 0;
 
-		PhotonEmission em;
-		lineStream >> em.energy;
-		em.energy *= eV;
+	// check if in tabulated energy range
+	const StepQuantities &q = candidate->getStepQuantities();
+	double lg = q.lgLorentzFactor + lgTableScale;
+	if ((lg <= lgmin) or (lg >= lgmax))
+		return 0;
 
-		double r;
-		for (size_t i = 0; i < nlg; i++) {
-			lineStream >> r;
-			em.emissionProbability.push_back(r);
-		}
+	return interpolateEquidistant(lg, lgmin, lgmax, rate) * pow_integer<3>(tableScale)
+			* q.redshift2 * q.getRedshiftScaling(photonField); // cosmological scaling, rate per comoving distance
+}
 
-		int key = Z * 1000000 + N * 10000 + Zd * 100 + Nd;
-		if (pdPhoton.find(key) == pdPhoton.end()) {
-			std::vector<PhotonEmission> emissions;
-			pdPhoton[key] = emissions;
-		}
-		pdPhoton[key].push_back(em);
+void PhotoDisintegration::interact(Candidate *candidate) const {
+	size_t idx = candidate->current.getIsotopeIndex();
+	double lg = candidate->getStepQuantities().lgLorentzFactor + lgTableScale;
+
+	// select channel and interact
+	const std::vector<Branch> &branches = getBranches(idx);
+	double cmp = Random::instance().rand();
+	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest tabulation point
+	size_t i = 0;
+	while ((i < branches.size()) and (cmp > 0)) {
+		cmp -= branches[i].branchingRatio[l];
+		i++;
 	}
-
-	infile.close();
+	performInteraction(candidate, branches[i-1].channel);
 }
 
 void PhotoDisintegration::process(Candidate *candidate) const {
 	// execute the loop at least once for limiting the next step
 	double step = candidate->getCurrentStep();
 	do {
-		// check if nucleus
-		int id = candidate->current.getId();
-		if (not isNucleus(id))
+		double rate = getCachedInteractionRate(candidate);
+		if (rate == 0)
 			return;
 
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
-		int N = A - Z;
-		size_t idx = Z * 31 + N;
-
-		// check if disintegration data available
-		if ((Z > 26) or (N > 30))
-			return;
-		if (pdRate[idx].size() == 0)
-			return;
-
-		// check if in tabulated energy range
-		double z = candidate->getRedshift();
-		double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
-		if ((lg <= lgmin) or (lg >= lgmax))
-			return;
-
-		double rate = interpolateEquidistant(lg, lgmin, lgmax, pdRate[idx]);
-		rate *= pow_integer<2>(1 + z) * photonField->getRedshiftScaling(z); // cosmological scaling, rate per comoving distance
-
 		// check if interaction occurs in this step
 		// otherwise limit next step to a fraction of the mean free path
 		Random &random = Random::instance();
@@ -183,22 +232,17 @@ void PhotoDisintegration::process(Candidate *candidate) const {
 			return;
 		}
 
-		// select channel and interact
-		const std::vector<Branch> &branches = pdBranch[idx];
-		double cmp = random.rand();
-		int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1)); // index of closest tabulation point
-		size_t i = 0;
-		while ((i < branches.size()) and (cmp > 0)) {
-			cmp -= branches[i].branchingRatio[l];
-			i++;
-		}
-		performInteraction(candidate, branches[i-1].channel);
+		interact(candidate);
 
 		// repeat with remaining step
 		step -= randDist;
 	} while (step > 0);
 }
 
+void PhotoDisintegration::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	processInteractionBatch(candidates, limit);
+}
+
 void PhotoDisintegration::performInteraction(Candidate *candidate, int channel) const {
 	KISS_LOG_DEBUG << "Photodisintegration::performInteraction. Channel " <<  channel << " on candidate " << candidate->getDescription(); 
 	// parse disintegration channel
@@ -209,12 +253,11 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 	int nHe3 = digit(channel, 10);
 	int nHe4 = digit(channel, 1);
 
-	int dA = -nNeutron - nProton - 2 * nH2 - 3 * nH3 - 3 * nHe3 - 4 * nHe4;
-	int dZ = -nProton - nH2 - nH3 - 2 * nHe3 - 2 * nHe4;
+	int dA, dZ;
+	channelChange(channel, dA, dZ);
 
-	int id = candidate->current.getId();
-	int A = massNumber(id);
-	int Z = chargeNumber(id);
+	int A = candidate->current.getMassNumber();
+	int Z = candidate->current.getChargeNumber();
 	double EpA = candidate->current.getEnergy() / A;
 
 	// create secondaries
@@ -223,17 +266,17 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 	try
 	{
 		for (size_t i = 0; i < nNeutron; i++)
-			candidate->addSecondary(nucleusId(1, 0), EpA, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(1, 0), EpA, pos, 1., interactionTagCode);
 		for (size_t i = 0; i < nProton; i++)
-			candidate->addSecondary(nucleusId(1, 1), EpA, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(1, 1), EpA, pos, 1., interactionTagCode);
 		for (size_t i = 0; i < nH2; i++)
-			candidate->addSecondary(nucleusId(2, 1), EpA * 2, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(2, 1), EpA * 2, pos, 1., interactionTagCode);
 		for (size_t i = 0; i < nH3; i++)
-			candidate->addSecondary(nucleusId(3, 1), EpA * 3, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(3, 1), EpA * 3, pos, 1., interactionTagCode);
 		for (size_t i = 0; i < nHe3; i++)
-			candidate->addSecondary(nucleusId(3, 2), EpA * 3, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(3, 2), EpA * 3, pos, 1., interactionTagCode);
 		for (size_t i = 0; i < nHe4; i++)
-			candidate->addSecondary(nucleusId(4, 2), EpA * 4, pos, 1., interactionTag);
+			candidate->addSecondary(nucleusId(4, 2), EpA * 4, pos, 1., interactionTagCode);
 
 
 	// update particle
@@ -251,22 +294,25 @@ void PhotoDisintegration::performInteraction(Candidate *candidate, int channel)
 		return;
 
 	// create photons
-	double z = candidate->getRedshift();
-	double lg = log10(candidate->current.getLorentzFactor() * (1 + z));
-	double lf = candidate->current.getLorentzFactor();
+	const StepQuantities &q = candidate->getStepQuantities();
+	double lg = q.lgLorentzFactor + lgTableScale;
+	double lf = q.lorentzFactor;
 
 	int l = round((lg - lgmin) / (lgmax - lgmin) * (nlg - 1));  // index of closest tabulation point
-	int key = Z*1e6 + (A-Z)*1e4 + (Z+dZ)*1e2 + (A+dA) - (Z+dZ);
+	l = std::min(std::max(l, 0), int(nlg) - 1);
+	const Branch *branch = findBranch(Z, A - Z, channel);
+	if (branch == 0)
+		return;
 
-	for (int i = 0; i < pdPhoton[key].size(); i++) {
+	for (size_t i = branch->photonBegin; i < branch->photonEnd; i++) {
 		// check for random emission
-		if (random.rand() > pdPhoton[key][i].emissionProbability[l])
+		if (random.rand() > pdPhotonProbability[i * nlg + l])
 			continue;
 
 		// boost to lab frame
 		double cosTheta = 2 * random.rand() - 1;
-		double E = pdPhoton[key][i].energy * lf * (1 - cosTheta);
-		candidate->addSecondary(22, E, pos, 1., interactionTag);
+		double E = pdPhotonEnergy[i] * lf * (1 - cosTheta);
+		candidate->addSecondary(22, E, pos, 1., interactionTagCode);
 	}
 }
 
@@ -283,24 +329,24 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 	// check if disintegration data available
 	if ((Z > 26) or (N > 30))
 		return std::numeric_limits<double>::max();
-	const std::vector<double> &rate = pdRate[idx];
+	const std::vector<double> &rate = getRate(idx);
 	if (rate.size() == 0)
 		return std::numeric_limits<double>::max();
 
 	// check if in tabulated energy range
-	double lg = log10(gamma * (1 + z));
+	double lg = log10(gamma * (1 + z) * tableScale);
 	if ((lg <= lgmin) or (lg >= lgmax))
 		return std::numeric_limits<double>::max();
 
 	// total interaction rate
-	double lossRate = interpolateEquidistant(lg, lgmin, lgmax, rate);
+	double lossRate = interpolateEquidistant(lg, lgmin, lgmax, rate) * pow_integer<3>(tableScale);
 
 	// comological scaling, rate per physical distance
 	lossRate *= pow_integer<3>(1 + z) * photonField->getRedshiftScaling(z);
 
 	// average number of nucleons lost for all disintegration channels
 	double avg_dA = 0;
-	const std::vector<Branch> &branches = pdBranch[idx];
+	const std::vector<Branch> &branches = getBranches(idx);
 	for (size_t i = 0; i < branches.size(); i++) {
 		int channel = branches[i].channel;
 		int dA = 0;
@@ -321,10 +367,33 @@ double PhotoDisintegration::lossLength(int id, double gamma, double z) {
 
 void PhotoDisintegration::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string PhotoDisintegration::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t PhotoDisintegration::getSizeOf() const {
+	size_t size = vectorSizeOf(rateRow) + vectorSizeOf(branchRows)
+			+ sizeof(pdRate[0]) * pdRate.capacity()
+			+ sizeof(pdBranch[0]) * pdBranch.capacity() + vectorSizeOf(pdLoaded)
+			+ vectorSizeOf(pdPhotonKey) + vectorSizeOf(pdPhotonEnergy)
+			+ vectorSizeOf(pdPhotonProbability);
+	// other threads may be unpacking nuclei, whose tables are complete once
+	// their flag is set, see loadNucleus
+	for (size_t i = 0; i < pdLoaded.size(); i++) {
+		if (not __atomic_load_n(&pdLoaded[i], __ATOMIC_ACQUIRE))
+			continue;
+		size += vectorSizeOf(pdRate[i]) + vectorSizeOf(pdBranch[i]);
+		for (size_t j = 0; j < pdBranch[i].size(); j++)
+			size += vectorSizeOf(pdBranch[i][j].branchingRatio);
+	}
+	if (rateData.valid())
+		size += rateData->getSizeOf();
+	if (branchData.valid())
+		size += branchData->getSizeOf();
+	return size;
+}
+
 } // namespace crpropa
@@ -1,4 +1,5 @@
 #include "crpropa/module/PhotoPionProduction.h"
+#include "crpropa/DataTable.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Random.h"
@@ -7,14 +8,190 @@
 #include "kiss/logger.h"
 #include "sophia.h"
 
-#include <limits>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
 
 namespace crpropa {
 
+// SophiaEventLibrary ----------------------------------------------------------
+namespace {
+
+struct SophiaEventLibraryHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t nEnergy;
+	uint32_t nEps;
+	uint32_t reserved;
+	double lgEnergyMin, lgEnergyMax;
+	double lgEpsMin, lgEpsMax;
+	uint64_t nEvents;
+	uint64_t nParticles;
+};
+
+const char sophiaEventLibraryMagic[8] = "CRPSOPH";
+const uint32_t sophiaEventLibraryVersion = 1;
+
+template <typename T>
+void readArray(std::ifstream &in, std::vector<T> &v, size_t n) {
+	v.resize(n);
+	in.read(reinterpret_cast<char *>(&v[0]), n * sizeof(T));
+}
+
+template <typename T>
+void writeArray(std::ofstream &out, const std::vector<T> &v) {
+	out.write(reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T));
+}
+
+} // namespace
+
+SophiaEventLibrary::SophiaEventLibrary(const std::string &filename) {
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	if (!in.good())
+		throw std::runtime_error("SophiaEventLibrary: could not open file " + filename);
+
+	SophiaEventLibraryHeader header;
+	in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	if (!in or (std::memcmp(header.magic, sophiaEventLibraryMagic, 8) != 0)
+			or (header.version != sophiaEventLibraryVersion))
+		throw std::runtime_error("SophiaEventLibrary: not an event library " + filename);
+
+	nEnergy = header.nEnergy;
+	nEps = header.nEps;
+	lgEnergyMin = header.lgEnergyMin;
+	lgEnergyMax = header.lgEnergyMax;
+	lgEpsMin = header.lgEpsMin;
+	lgEpsMax = header.lgEpsMax;
+	readArray(in, binFirst, 2 * size_t(nEnergy) * nEps + 1);
+	readArray(in, eventFirst, header.nEvents + 1);
+	readArray(in, particles, header.nParticles);
+	if (!in or (binFirst.back() != header.nEvents) or (eventFirst.back() != header.nParticles))
+		throw std::runtime_error("SophiaEventLibrary: corrupt file " + filename);
+}
+
+void SophiaEventLibrary::generate(const std::string &filename, size_t events,
+		size_t nEnergy, double energyMin, double energyMax,
+		size_t nEps, double epsMin, double epsMax) {
+	if ((nEnergy == 0) or (nEps == 0) or (energyMin <= 0) or (energyMax <= energyMin)
+			or (epsMin <= 0) or (epsMax <= epsMin))
+		throw std::runtime_error("SophiaEventLibrary: invalid binning");
+
+	SophiaEventLibraryHeader header;
+	std::memcpy(header.magic, sophiaEventLibraryMagic, 8);
+	header.version = sophiaEventLibraryVersion;
+	header.nEnergy = nEnergy;
+	header.nEps = nEps;
+	header.reserved = 0;
+	header.lgEnergyMin = log10(energyMin / GeV);
+	header.lgEnergyMax = log10(energyMax / GeV);
+	header.lgEpsMin = log10(epsMin / GeV);
+	header.lgEpsMax = log10(epsMax / GeV);
+	double dE = (header.lgEnergyMax - header.lgEnergyMin) / nEnergy;
+	double dEps = (header.lgEpsMax - header.lgEpsMin) / nEps;
+
+	std::vector<uint32_t> binFirst, eventFirst;
+	std::vector<Particle> particles;
+	Random &random = Random::instance();
+	double outputEnergy[5][2000];
+	int outPartID[2000];
+	int nParticles;
+	for (int nature = 0; nature < 2; nature++) {
+		double m = ((nature == 0) ? mass_proton : mass_neutron) * c_squared / GeV;
+		for (size_t i = 0; i < nEnergy; i++) {
+			for (size_t j = 0; j < nEps; j++) {
+				binFirst.push_back(eventFirst.size());
+				for (size_t k = 0; k < events; k++) {
+					double Ein = pow(10, header.lgEnergyMin + (i + random.rand()) * dE);
+					// photon energy above the threshold, see PhotoPionProduction::epsMinInteraction
+					double epsThreshold = (1.1646 - m * m) / 2. / (Ein + sqrt(Ein * Ein - m * m));
+					double lo = std::max(header.lgEpsMin + j * dEps, log10(epsThreshold));
+					double hi = header.lgEpsMin + (j + 1) * dEps;
+					if (lo >= hi)
+						continue;
+					double eps = pow(10, lo + random.rand() * (hi - lo));
+
+					int n = nature;
+					sophiaevent_(n, Ein, eps, outputEnergy, outPartID, nParticles);
+					eventFirst.push_back(particles.size());
+					for (int l = 0; l < nParticles; l++) {
+						Particle p;
+						p.id = outPartID[l];
+						p.fraction = outputEnergy[3][l] / Ein;
+						particles.push_back(p);
+					}
+				}
+			}
+		}
+	}
+	binFirst.push_back(eventFirst.size());
+	eventFirst.push_back(particles.size());
+	header.nEvents = binFirst.back();
+	header.nParticles = particles.size();
+
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out.good())
+		throw std::runtime_error("SophiaEventLibrary: could not open file " + filename);
+	out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	writeArray(out, binFirst);
+	writeArray(out, eventFirst);
+	if (not particles.empty())
+		writeArray(out, particles);
+	if (!out)
+		throw std::runtime_error("SophiaEventLibrary: could not write file " + filename);
+}
+
+long SophiaEventLibrary::bin(bool onProton, double Ein, double eps) const {
+	double x = (log10(Ein / GeV) - lgEnergyMin) / (lgEnergyMax - lgEnergyMin) * nEnergy;
+	double y = (log10(eps / GeV) - lgEpsMin) / (lgEpsMax - lgEpsMin) * nEps;
+	if ((x < 0) or (x >= nEnergy) or (y < 0) or (y >= nEps))
+		return -1;
+	long nature = onProton ? 0 : 1;
+	return (nature * nEnergy + long(x)) * nEps + long(y);
+}
+
+bool SophiaEventLibrary::contains(bool onProton, double Ein, double eps) const {
+	return getNumberOfEvents(onProton, Ein, eps) > 0;
+}
+
+size_t SophiaEventLibrary::sample(bool onProton, double Ein, double eps,
+		std::vector<double> &energies, std::vector<int> &ids) const {
+	long b = bin(onProton, Ein, eps);
+	if ((b < 0) or (binFirst[b + 1] == binFirst[b]))
+		throw std::runtime_error("SophiaEventLibrary: no events for this interaction");
+
+	uint32_t k = binFirst[b] + Random::instance().randInt(binFirst[b + 1] - binFirst[b] - 1);
+	energies.clear();
+	ids.clear();
+	for (uint32_t i = eventFirst[k]; i < eventFirst[k + 1]; i++) {
+		ids.push_back(particles[i].id);
+		energies.push_back(particles[i].fraction * Ein);
+	}
+	return ids.size();
+}
+
+size_t SophiaEventLibrary::getNumberOfEvents() const {
+	return binFirst.back();
+}
+
+size_t SophiaEventLibrary::getSizeOf() const {
+	return sizeof(*this) + vectorSizeOf(binFirst) + vectorSizeOf(eventFirst) + vectorSizeOf(particles);
+}
+
+size_t SophiaEventLibrary::getNumberOfEvents(bool onProton, double Ein, double eps) const {
+	long b = bin(onProton, Ein, eps);
+	if (b < 0)
+		return 0;
+	return binFirst[b + 1] - binFirst[b];
+}
+
+// PhotoPionProduction ---------------------------------------------------------
+// number of tabulated quantiles of the photon energy distributions
+static const size_t nSampleQuantiles = 129;
+
 PhotoPionProduction::PhotoPionProduction(ref_ptr<PhotonField> field, bool photons, bool neutrinos, bool electrons, bool antiNucleons, double l, bool redshift) {
 	havePhotons = photons;
 	haveNeutrinos = neutrinos;
@@ -39,11 +216,14 @@ void PhotoPionProduction::setPhotonField(ref_ptr<PhotonField> field) {
 	}
 	
 	setDescription("PhotoPionProduction: " + fname);
+	tableScale = 1;
 	if (haveRedshiftDependence){
 		initRate(getDataPath("PhotoPionProduction/rate_" + fname.replace(0, 3, "IRBz") + ".txt"));
 	}
 	else
-		initRate(getDataPath("PhotoPionProduction/rate_" + fname + ".txt"));
+		initRate(getDataPath("PhotoPionProduction/rate_"
+				+ interactionTableField(*photonField, "PhotoPionProduction/rate_", tableScale) + ".txt"));
+	initSampleTables();
 }
 
 void PhotoPionProduction::setHavePhotons(bool b) {
@@ -78,64 +258,164 @@ void PhotoPionProduction::initRate(std::string filename) {
 	tabProtonRate.clear();
 	tabNeutronRate.clear();
 
-	std::ifstream infile(filename.c_str());
-	if (!infile.good())
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	if (not table.valid())
 		throw std::runtime_error("PhotoPionProduction: could not open file " + filename);
 
 	if (haveRedshiftDependence) {
+		// row: z, log10(Lorentz factor), proton rate, neutron rate [1/Mpc]
 		double zOld = -1, aOld = -1;
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				continue;
-			}
-			double z, a, b, c;
-			infile >> z >> a >> b >> c;
-			if (!infile)
+		for (size_t i = 0; i < table->size(); i++) {
+			if (table->columns(i) < 4)
 				break;
-			if (z > zOld) {
-				tabRedshifts.push_back(z);
-				zOld = z;
+			const double *row = table->row(i);
+			if (row[0] > zOld) {
+				tabRedshifts.push_back(row[0]);
+				zOld = row[0];
 			}
-			if (a > aOld) {
-				tabLorentz.push_back(pow(10, a));
-				aOld = a;
+			if (row[1] > aOld) {
+				tabLorentz.push_back(pow(10, row[1]));
+				aOld = row[1];
 			}
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
+			tabProtonRate.push_back(row[2] / Mpc);
+			tabNeutronRate.push_back(row[3] / Mpc);
 		}
 	} else {
-		while (infile.good()) {
-			if (infile.peek() == '#') {
-				infile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				continue;
-			}
-			double a, b, c;
-			infile >> a >> b >> c;
-			if (!infile)
+		// row: log10(Lorentz factor), proton rate, neutron rate [1/Mpc]
+		for (size_t i = 0; i < table->size(); i++) {
+			if (table->columns(i) < 3)
 				break;
-			tabLorentz.push_back(pow(10, a));
-			tabProtonRate.push_back(b / Mpc);
-			tabNeutronRate.push_back(c / Mpc);
+			const double *row = table->row(i);
+			tabLorentz.push_back(pow(10, row[0]));
+			tabProtonRate.push_back(row[1] / Mpc);
+			tabNeutronRate.push_back(row[2] / Mpc);
 		}
 	}
 
-	infile.close();
+	if (haveRedshiftDependence) {
+		rateTable2d[0].assign(tabRedshifts, tabLorentz, tabProtonRate);
+		rateTable2d[1].assign(tabRedshifts, tabLorentz, tabNeutronRate);
+	} else {
+		rateTable[0].assign(tabLorentz, tabProtonRate);
+		rateTable[1].assign(tabLorentz, tabNeutronRate);
+	}
 }
 
-double PhotoPionProduction::nucleonMFP(double gamma, double z, bool onProton) const {
-	const std::vector<double> &tabRate = (onProton)? tabProtonRate : tabNeutronRate;
+void PhotoPionProduction::initSampleTables() {
+	tabEpsQuantiles.clear();
+	tabSampleNEnergy = tabSampleNRedshift = 0;
+	if (tabLorentz.size() < 2)
+		return;
+
+	// probEps depends on the nucleon energy only through the upper limit of
+	// the integral over functs, which is tabulated once per nucleon type
+	const size_t nS = 641;
+	std::vector<double> lgDs(nS), integral[2];
+	for (int n = 0; n < 2; n++) {
+		integral[n].resize(nS, 0.);
+		for (size_t j = 0; j < nS; j++) {
+			lgDs[j] = -6. + j * 0.025; // log10(s - sMin) up to 10
+			if (j == 0)
+				continue;
+			double s0 = sMin() + pow(10, lgDs[j - 1]);
+			double s1 = sMin() + pow(10, lgDs[j]);
+			integral[n][j] = integral[n][j - 1]
+				+ gaussInt([this, n](double s) { return this->functs(s, n == 0); }, s0, s1);
+		}
+	}
 
+	// nucleon energies of the rate tables, 10 per decade
+	double lgMin = log10(tabLorentz.front() / tableScale * mass(true));
+	double lgMax = log10(tabLorentz.back() / tableScale * mass(true));
+	tabSampleDLgEnergy = 0.1;
+	tabSampleNEnergy = std::max<size_t>(2, ceil((lgMax - lgMin) / tabSampleDLgEnergy) + 1);
+	tabSampleLgEnergyMin = lgMin;
+
+	// redshifts up to where the photon field vanishes
+	tabSampleDRedshift = 0.1;
+	tabSampleNRedshift = 1;
+	if (photonField->hasRedshiftDependence()) {
+		while ((tabSampleNRedshift < 101)
+				and (photonField->getRedshiftScaling(tabSampleNRedshift * tabSampleDRedshift) > 0))
+			tabSampleNRedshift++;
+		tabSampleNRedshift = std::max<size_t>(2, tabSampleNRedshift);
+	}
+
+	const size_t nEps = 257;
+	tabEpsQuantiles.resize(2 * tabSampleNEnergy * tabSampleNRedshift * nSampleQuantiles);
+	std::vector<double> lnEps(nEps), cdf(nEps);
+	for (int n = 0; n < 2; n++) {
+		bool onProton = (n == 0);
+		double m = mass(onProton);
+		for (size_t i = 0; i < tabSampleNEnergy; i++) {
+			double Ein = pow(10, tabSampleLgEnergyMin + i * tabSampleDLgEnergy);
+			double p = momentum(onProton, Ein);
+			for (size_t k = 0; k < tabSampleNRedshift; k++) {
+				double z = k * tabSampleDRedshift;
+				float *quantiles = &tabEpsQuantiles[((n * tabSampleNEnergy + i) * tabSampleNRedshift + k) * nSampleQuantiles];
+				double epsMin = std::max(photonField->getMinimumPhotonEnergy(z) / eV, epsMinInteraction(onProton, Ein));
+				double epsMax = photonField->getMaximumPhotonEnergy(z) / eV;
+
+				// cumulative distribution in ln(eps) of probEps * eps, once over the
+				// photon field and once over the range of non-negligible probability
+				for (int pass = 0; pass < 2; pass++) {
+					if (pass == 1) {
+						size_t lo = 0, hi = nEps - 1;
+						while ((lo + 1 < nEps) and (cdf[lo + 1] < 1e-9 * cdf.back()))
+							lo++;
+						while ((hi > lo + 1) and (cdf[hi - 1] > (1 - 1e-9) * cdf.back()))
+							hi--;
+						epsMin = exp(lnEps[lo]);
+						epsMax = exp(lnEps[hi]);
+					}
+					double fOld = 0;
+					for (size_t j = 0; j < nEps; j++) {
+						lnEps[j] = log(epsMin) + j * log(epsMax / epsMin) / (nEps - 1);
+						double eps = exp(lnEps[j]);
+						double sMax = m * m + 2. * eps * (Ein + p) / 1.e9;
+						double f = 0;
+						if ((epsMax > epsMin) and (sMax > sMin()))
+							f = photonField->getPhotonDensity(eps * eV, z) / eps / eps
+								* interpolateEquidistant(log10(sMax - sMin()), lgDs.front(), lgDs.back(), integral[n]);
+						cdf[j] = (j == 0) ? 0 : cdf[j - 1] + 0.5 * (f + fOld) * (lnEps[j] - lnEps[j - 1]);
+						fOld = f;
+					}
+					if (not (cdf.back() > 0))
+						break;
+				}
+				if (not (cdf.back() > 0)) {
+					for (size_t q = 0; q < nSampleQuantiles; q++)
+						quantiles[q] = std::numeric_limits<float>::quiet_NaN();
+					continue;
+				}
+
+				// invert the cumulative distribution, with the quantiles denser in the tails
+				size_t j = 1;
+				for (size_t q = 0; q < nSampleQuantiles; q++) {
+					double c = cdf.back() * (1 - cos(M_PI * q / (nSampleQuantiles - 1))) / 2;
+					while ((j < nEps - 1) and (cdf[j] < c))
+						j++;
+					double w = (cdf[j] > cdf[j - 1]) ? (c - cdf[j - 1]) / (cdf[j] - cdf[j - 1]) : 0;
+					w = std::min(1., std::max(0., w));
+					quantiles[q] = (lnEps[j - 1] + w * (lnEps[j] - lnEps[j - 1])) / M_LN10;
+				}
+			}
+		}
+	}
+}
+
+double PhotoPionProduction::nucleonMFP(double gamma, double z, bool onProton) const {
 	// scale nucleus energy instead of background photon energy
-	gamma *= (1 + z);
+	gamma *= (1 + z) * tableScale;
 	if (gamma < tabLorentz.front() or (gamma > tabLorentz.back()))
 		return std::numeric_limits<double>::max();
 
 	double rate;
 	if (haveRedshiftDependence)
-		rate = interpolate2d(z, gamma, tabRedshifts, tabLorentz, tabRate);
+		rate = rateTable2d[onProton ? 0 : 1](z, gamma);
 	else
-		rate = interpolate(gamma, tabLorentz, tabRate) * photonField->getRedshiftScaling(z);
+		rate = rateTable[onProton ? 0 : 1](gamma) * pow_integer<3>(tableScale)
+				* photonField->getRedshiftScaling(z);
 
 	// cosmological scaling
 	rate *= pow_integer<2>(1 + z);
@@ -157,8 +437,8 @@ void PhotoPionProduction::process(Candidate *candidate) const {
 	// the loop is processed at least once for limiting the next step
 	do {
 		// check if nucleus
-		int id = candidate->current.getId();
-		if (!isNucleus(id))
+		const ParticleState &state = candidate->current;
+		if (!state.isNucleus())
 			return;
 
 		// find interaction with minimum random distance
@@ -168,10 +448,10 @@ void PhotoPionProduction::process(Candidate *candidate) const {
 		double totalRate = 0;
 		bool onProton = true; // interacting particle: proton or neutron
 
-		int A = massNumber(id);
-		int Z = chargeNumber(id);
+		int A = state.getMassNumber();
+		int Z = state.getChargeNumber();
 		int N = A - Z;
-		double gamma = candidate->current.getLorentzFactor();
+		double gamma = candidate->getStepQuantities().lorentzFactor;
 
 		// check for interaction on protons
 		if (Z > 0) {
@@ -203,6 +483,44 @@ void PhotoPionProduction::process(Candidate *candidate) const {
 	} while (step > 0);
 }
 
+void PhotoPionProduction::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	processInteractionBatch(candidates, limit);
+}
+
+double PhotoPionProduction::getInteractionRate(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	if (!isNucleus(id))
+		return 0;
+
+	double z = candidate->getRedshift();
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	double gamma = candidate->getStepQuantities().lorentzFactor;
+
+	double rate = 0;
+	if (Z > 0)
+		rate += nucleiModification(A, Z) / nucleonMFP(gamma, z, true);
+	if (N > 0)
+		rate += nucleiModification(A, N) / nucleonMFP(gamma, z, false);
+	return rate;
+}
+
+void PhotoPionProduction::interact(Candidate *candidate) const {
+	int id = candidate->current.getId();
+	double z = candidate->getRedshift();
+	int A = massNumber(id);
+	int Z = chargeNumber(id);
+	int N = A - Z;
+	double gamma = candidate->getStepQuantities().lorentzFactor;
+
+	// interacting nucleon, chosen proportionally to the rates on protons and neutrons
+	double rateProton = (Z > 0) ? nucleiModification(A, Z) / nucleonMFP(gamma, z, true) : 0;
+	double rateNeutron = (N > 0) ? nucleiModification(A, N) / nucleonMFP(gamma, z, false) : 0;
+	bool onProton = Random::instance().rand() * (rateProton + rateNeutron) < rateProton;
+	performInteraction(candidate, onProton);
+}
+
 void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton) const {
 	int id = candidate->current.getId();
 	int A = massNumber(id);
@@ -231,9 +549,20 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 	int outPartID[2000];
 	int nParticles;
 
+	if (eventLibrary.valid() and eventLibrary->contains(onProton, EpA, eps * GeV)) {
+		// precomputed event, only the energies are used below
+		std::vector<double> energies;
+		std::vector<int> ids;
+		nParticles = std::min<size_t>(eventLibrary->sample(onProton, EpA, eps * GeV, energies, ids), 2000);
+		for (int i = 0; i < nParticles; i++) {
+			outputEnergy[3][i] = energies[i] / GeV;
+			outPartID[i] = ids[i];
+		}
+	} else {
 #pragma omp critical
-	{
-		sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+		{
+			sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+		}
 	}
 
 	Random &random = Random::instance();
@@ -257,7 +586,7 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 			if (haveAntiNucleons)
 				try
 				{
-					candidate->addSecondary(-sign * nucleusId(1, 14 + pType), Eout, pos, 1., interactionTag);
+					candidate->addSecondary(-sign * nucleusId(1, 14 + pType), Eout, pos, 1., interactionTagCode);
 				}
 				catch (std::runtime_error &e)
 				{
@@ -267,31 +596,31 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 			break;
 		case 1: // photon
 			if (havePhotons)
-				candidate->addSecondary(22, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(22, Eout, pos, 1., interactionTagCode);
 			break;
 		case 2: // positron
 			if (haveElectrons)
-				candidate->addSecondary(sign * -11, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * -11, Eout, pos, 1., interactionTagCode);
 			break;
 		case 3: // electron
 			if (haveElectrons)
-				candidate->addSecondary(sign * 11, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * 11, Eout, pos, 1., interactionTagCode);
 			break;
 		case 15: // nu_e
 			if (haveNeutrinos)
-				candidate->addSecondary(sign * 12, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * 12, Eout, pos, 1., interactionTagCode);
 			break;
 		case 16: // anti-nu_e
 			if (haveNeutrinos)
-				candidate->addSecondary(sign * -12, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * -12, Eout, pos, 1., interactionTagCode);
 			break;
 		case 17: // nu_mu
 			if (haveNeutrinos)
-				candidate->addSecondary(sign * 14, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * 14, Eout, pos, 1., interactionTagCode);
 			break;
 		case 18: // anti-nu_mu
 			if (haveNeutrinos)
-				candidate->addSecondary(sign * -14, Eout, pos, 1., interactionTag);
+				candidate->addSecondary(sign * -14, Eout, pos, 1., interactionTagCode);
 			break;
 		default:
 			throw std::runtime_error("PhotoPionProduction: unexpected particle " + kiss::str(pType));
@@ -318,7 +647,7 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 				try
 				{
 					candidate->current.setId(sign * nucleusId(A - 1, Z - int(onProton)));
-					candidate->addSecondary(sign * nucleusId(1, 14 - pnType[i]), pnEnergy[i], pos, 1., interactionTag);
+					candidate->addSecondary(sign * nucleusId(1, 14 - pnType[i]), pnEnergy[i], pos, 1., interactionTagCode);
 				}
 				catch (std::runtime_error &e)
 				{
@@ -327,7 +656,7 @@ void PhotoPionProduction::performInteraction(Candidate *candidate, bool onProton
 				}
 			}
 		} else {  // nucleon is secondary proton or neutron
-			candidate->addSecondary(sign * nucleusId(1, 14 - pnType[i]), pnEnergy[i], pos, 1., interactionTag);
+			candidate->addSecondary(sign * nucleusId(1, 14 - pnType[i]), pnEnergy[i], pos, 1., interactionTagCode);
 		}
 	}
 }
@@ -413,7 +742,51 @@ SophiaEventOutput PhotoPionProduction::sophiaEvent(bool onProton, double Ein, do
 	return output;
 }
 
+double PhotoPionProduction::sampleEpsTable(bool onProton, double E, double z) const {
+	if (tabEpsQuantiles.empty())
+		return 0;
+	double x = (log10(E / GeV) - tabSampleLgEnergyMin) / tabSampleDLgEnergy;
+	double y = std::max(0., z / tabSampleDRedshift); // photon fields are constant for z < 0
+	if (tabSampleNRedshift == 1)
+		y = 0;
+	if ((x < 0) or (x > tabSampleNEnergy - 1) or (y > tabSampleNRedshift - 1))
+		return 0;
+
+	size_t i = std::min<size_t>(x, tabSampleNEnergy - 2);
+	size_t k = std::min<size_t>(y, std::max<size_t>(tabSampleNRedshift, 2) - 2);
+	double fx = x - i;
+	double fy = (tabSampleNRedshift == 1) ? 0 : y - k;
+	double u = acos(1 - 2 * Random::instance().rand()) / M_PI * (nSampleQuantiles - 1);
+	size_t q = std::min<size_t>(u, nSampleQuantiles - 2);
+	double fu = u - q;
+
+	// quantile at u of the corners, interpolated in log10 of the nucleon energy and redshift
+	size_t nature = onProton ? 0 : 1;
+	double lgEps = 0;
+	for (size_t di = 0; di < 2; di++) {
+		for (size_t dk = 0; dk < 2; dk++) {
+			double w = (di ? fx : 1 - fx) * (dk ? fy : 1 - fy);
+			if (w == 0)
+				continue;
+			size_t kk = std::min(k + dk, tabSampleNRedshift - 1);
+			const float *quantiles = &tabEpsQuantiles[((nature * tabSampleNEnergy + i + di) * tabSampleNRedshift + kk) * nSampleQuantiles];
+			double v = quantiles[q] + fu * (quantiles[q + 1] - quantiles[q]);
+			if (std::isnan(v))
+				return 0;
+			lgEps += w * v;
+		}
+	}
+	double eps = std::max(pow(10, lgEps), epsMinInteraction(onProton, E / GeV));
+	return eps * eV;
+}
+
 double PhotoPionProduction::sampleEps(bool onProton, double E, double z) const {
+	if (sampleTables) {
+		double eps = sampleEpsTable(onProton, E, z);
+		if (eps > 0)
+			return eps;
+	}
+
 	// sample eps between epsMin ... epsMax
 	double Ein = E / GeV;
 	double epsMin = std::max(photonField -> getMinimumPhotonEnergy(z) / eV, epsMinInteraction(onProton, Ein));
@@ -500,7 +873,7 @@ double PhotoPionProduction::momentum(bool onProton, double Ein) const {
 	return momentumHadron;
 }
 
-double PhotoPionProduction::crossection(double eps, bool onProton) const {
+double PhotoPionProduction::crossection(double eps, bool onProton) {
 	const double m = mass(onProton);
 	const double s = m * m + 2. * m * eps;
 	if (s < sMin())
@@ -552,8 +925,7 @@ double PhotoPionProduction::crossection(double eps, bool onProton) const {
 	double cross_diffr = 0.;
 	if (eps > 0.85) {
 		double ss1 = (eps - 0.85) / 0.69;
-		double ss2 = onProton? 29.3 : 26.4;
-		ss2 *= std::pow(s, -0.34) + 59.3 * std::pow(s, 0.095);
+		double ss2 = (onProton? 29.3 : 26.4) * std::pow(s, -0.34) + 59.3 * std::pow(s, 0.095);
 		cs_multidiff = (1. - std::exp(-ss1)) * ss2;
 		cs_multi = 0.89 * cs_multidiff;
 		// diffractive scattering:
@@ -581,7 +953,7 @@ double PhotoPionProduction::crossection(double eps, bool onProton) const {
 	return cross_res + cross_dir + cs_multidiff + cross_frag2;
 }
 
-double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double alpha) const {
+double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double alpha) {
 	if (epsTh > eps)
 		return 0.;
 	const double a = alpha * epsMax / epsTh;
@@ -590,7 +962,7 @@ double PhotoPionProduction::Pl(double eps, double epsTh, double epsMax, double a
 	return prod1 * prod2;
 }
 
-double PhotoPionProduction::Ef(double eps, double epsTh, double w) const {
+double PhotoPionProduction::Ef(double eps, double epsTh, double w) {
 	const double wTh = w + epsTh;
 	if (eps <= epsTh) {
 		return 0.;
@@ -603,7 +975,7 @@ double PhotoPionProduction::Ef(double eps, double epsTh, double w) const {
 	}
 }
 
-double PhotoPionProduction::breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) const {
+double PhotoPionProduction::breitwigner(double sigma0, double gamma, double DMM, double epsPrime, bool onProton) {
 	const double m = mass(onProton);
 	const double s = m * m + 2. * m * epsPrime;
 	const double gam2s = gamma * gamma * s;
@@ -618,12 +990,12 @@ double PhotoPionProduction::functs(double s, bool onProton) const {
 	return factor * sigmaPg;
 }
 
-double PhotoPionProduction::mass(bool onProton) const {
+double PhotoPionProduction::mass(bool onProton) {
 	const double m =  onProton ? mass_proton : mass_neutron;
 	return m / GeV * c_squared;
 }
 
-double PhotoPionProduction::sMin() const {
+double PhotoPionProduction::sMin() {
 	return 1.1646; // [GeV^2] head-on collision
 }
 
@@ -635,6 +1007,10 @@ void PhotoPionProduction::setCorrectionFactor(double factor) {
 	correctionFactor = factor;
 }
 
+void PhotoPionProduction::setSampleTables(bool b) {
+	sampleTables = b;
+}
+
 ref_ptr<PhotonField> PhotoPionProduction::getPhotonField() const {
 	return photonField;
 }
@@ -671,12 +1047,40 @@ double PhotoPionProduction::getCorrectionFactor() const {
 	return correctionFactor;
 }
 
+bool PhotoPionProduction::getSampleTables() const {
+	return sampleTables;
+}
+
 void PhotoPionProduction::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string PhotoPionProduction::getInteractionTag() const {
 	return interactionTag;
 }
 
+void PhotoPionProduction::setEventLibrary(ref_ptr<SophiaEventLibrary> library) {
+	eventLibrary = library;
+}
+
+void PhotoPionProduction::loadEventLibrary(const std::string &filename) {
+	eventLibrary = new SophiaEventLibrary(getDataPath(filename));
+}
+
+ref_ptr<SophiaEventLibrary> PhotoPionProduction::getEventLibrary() const {
+	return eventLibrary;
+}
+
+size_t PhotoPionProduction::getSizeOf() const {
+	size_t size = vectorSizeOf(tabLorentz) + vectorSizeOf(tabRedshifts)
+			+ vectorSizeOf(tabProtonRate) + vectorSizeOf(tabNeutronRate)
+			+ vectorSizeOf(tabEpsQuantiles);
+	for (int i = 0; i < 2; i++)
+		size += rateTable[i].getSizeOf() + rateTable2d[i].getSizeOf();
+	if (eventLibrary.valid())
+		size += eventLibrary->getSizeOf();
+	return size;
+}
+
 } // namespace crpropa
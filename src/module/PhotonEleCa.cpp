@@ -1,4 +1,5 @@
 #include "crpropa/module/PhotonEleCa.h"
+#include "crpropa/Random.h"
 #include "crpropa/Units.h"
 
 #include "EleCa/Propagation.h"
@@ -10,16 +11,22 @@
 
 namespace crpropa {
 
+static double randUniform(double min, double max) {
+	return Random::instance().randUniform(min, max);
+}
+
 PhotonEleCa::PhotonEleCa(const std::string background,
 		const std::string &outputFilename) :
 		propagation(new eleca::Propagation), saveOnlyPhotonEnergies(false) {
 	KISS_LOG_WARNING << "EleCa propagation is deprecated and is no longer supported. Please use the EM* (EMPairProduction, EMInverseComptonScattering, ...) modules instead.\n";
 	propagation->ReadTables(getDataPath("EleCa/eleca.dat"));
 	propagation->InitBkgArray(background);
+	previousUniform = eleca::setUniformCallback(randUniform);
 	output.open(outputFilename.c_str());
 }
 
 PhotonEleCa::~PhotonEleCa() {
+	eleca::setUniformCallback(previousUniform);
 }
 
 void PhotonEleCa::process(Candidate *candidate) const {
@@ -32,19 +39,8 @@ void PhotonEleCa::process(Candidate *candidate) const {
 				(candidate->current.getPosition() - observer).getR() / Mpc);
 	eleca::Particle p0(candidate->current.getId(),
 			candidate->current.getEnergy() / eV, z);
-	std::vector<eleca::Particle> ParticleAtMatrix;
 	std::vector<eleca::Particle> ParticleAtGround;
-	ParticleAtMatrix.push_back(p0);
-
-	while (ParticleAtMatrix.size() > 0) {
-
-		eleca::Particle p1 = ParticleAtMatrix.back();
-		ParticleAtMatrix.pop_back();
-
-		if (p1.IsGood()) {
-			propagation->Propagate(p1, ParticleAtMatrix, ParticleAtGround);
-		}
-	}
+	propagation->PropagateCascade(p0, ParticleAtGround);
 
 #pragma omp critical
 	{
@@ -64,6 +60,12 @@ void PhotonEleCa::process(Candidate *candidate) const {
 	return;
 }
 
+void PhotonEleCa::propagate(const std::vector<ref_ptr<Candidate> > &candidates) const {
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int) candidates.size(); i++)
+		process(candidates[i]);
+}
+
 void PhotonEleCa::setObserver(const Vector3d &position) {
 	observer = position;
 }
@@ -17,16 +17,16 @@ using namespace std;
 
 namespace crpropa {
 
-PhotonOutput1D::PhotonOutput1D() : out(&std::cout) {
+PhotonOutput1D::PhotonOutput1D() : out(&std::cout), collecting(false) {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 }
 
-PhotonOutput1D::PhotonOutput1D(std::ostream &out) : out(&out) {
+PhotonOutput1D::PhotonOutput1D(std::ostream &out) : out(&out), collecting(false) {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 }
 
 PhotonOutput1D::PhotonOutput1D(const std::string &filename) : outfile(
-	filename.c_str(), std::ios::binary), out(&outfile), filename(filename) {
+	filename.c_str(), std::ios::binary), out(&outfile), filename(filename), collecting(false) {
 	KISS_LOG_WARNING << "PhotonOutput1D is deprecated and will be removed in the future. Replace with TextOutput or HDF5Output with features ObserverNucleusVeto + ObserverDetectAll";
 	if (kiss::ends_with(filename, ".gz"))
 		gzip();
@@ -49,6 +49,15 @@ void PhotonOutput1D::process(Candidate *candidate) const {
 	if ((pid != 22) and (abs(pid) != 11))
 		return;
 
+	if (collecting) {
+#pragma omp critical
+		{
+			particles.push_back(CascadeParticle(pid, candidate->current.getEnergy(), candidate->current.getPosition().getR()));
+		}
+		candidate->setActive(false);
+		return;
+	}
+
 	char buffer[1024];
 	size_t p = 0;
 
@@ -71,6 +80,20 @@ void PhotonOutput1D::process(Candidate *candidate) const {
 	candidate->setActive(false);
 }
 
+void PhotonOutput1D::collect() {
+	close();
+	out = 0;
+	collecting = true;
+}
+
+const std::vector<CascadeParticle> &PhotonOutput1D::getParticles() const {
+	return particles;
+}
+
+void PhotonOutput1D::clearParticles() {
+	particles.clear();
+}
+
 void PhotonOutput1D::close() {
 	#ifdef CRPROPA_HAVE_ZLIB
 		zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
@@ -85,7 +108,10 @@ void PhotonOutput1D::close() {
 
 string PhotonOutput1D::getDescription() const {
 	std::stringstream s;
-	s << "PhotonOutput1D: Output file = " << filename;
+	if (collecting)
+		s << "PhotonOutput1D: " << particles.size() << " particles in memory";
+	else
+		s << "PhotonOutput1D: Output file = " << filename;
 	return s.str();
 }
 
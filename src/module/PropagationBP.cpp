@@ -1,5 +1,7 @@
 #include "crpropa/module/PropagationBP.h"
+#include "crpropa/Vector3Packet.h"
 
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -39,9 +41,85 @@ namespace crpropa {
 	}
 
 
+	void PropagationBP::tryStepBatch(const double *const *y, double *const *out,
+			double *error, const double *h, const double *z, const double *m,
+			const double *q, size_t n) const {
+		std::vector<double> helpStore(6 * n), hHalf(n);
+		double *help[6];
+		for (size_t c = 0; c < 6; c++) {
+			help[c] = &helpStore[c * n];
+			for (size_t l = 0; l < n; l++) {
+				out[c][l] = y[c][l];
+				help[c][l] = y[c][l];
+			}
+		}
+		for (size_t l = 0; l < n; l++)
+			hHalf[l] = h[l] / 2;
+
+		dYBatch(out, h, z, q, m, n);  // 1 step with h
+		dYBatch(help, hHalf.data(), z, q, m, n);  // 2 steps with h/2
+		dYBatch(help, hHalf.data(), z, q, m, n);
+
+		for (size_t l = 0; l < n; l++) {
+			Vector3d x1(out[0][l], out[1][l], out[2][l]);
+			Vector3d x2(help[0][l], help[1][l], help[2][l]);
+			error[l] = errorEstimation(x1, x2, h[l]);
+		}
+	}
+
+
+	void PropagationBP::dYBatch(double *const *y, const double *step,
+			const double *z, const double *q, const double *m, size_t n) const {
+		double *x0 = y[0], *x1 = y[1], *x2 = y[2];
+		double *u0 = y[3], *u1 = y[4], *u2 = y[5];
+		std::vector<Vector3d> pos(n), B(n);
+
+		// half leap frog step in the position
+		for (size_t l = 0; l < n; l++) {
+			x0[l] += u0[l] * step[l] / 2.;
+			x1[l] += u1[l] * step[l] / 2.;
+			x2[l] += u2[l] * step[l] / 2.;
+			pos[l] = Vector3d(x0[l], x1[l], x2[l]);
+		}
+
+		// one field evaluation for all lanes
+		getFieldsAtPositions(pos.data(), B.data(), z, n);
+
+		// Boris push, Vector3Packetd::lanes particles at a time
+		const int N = Vector3Packetd::lanes;
+		for (size_t i = 0; i < n; i += N) {
+			int nl = std::min<size_t>(N, n - i);
+			Vector3Packetd u = Vector3Packetd::loadSoA(y + 3, i, nl);
+			Vector3Packetd b = Vector3Packetd::load(B.data() + i, nl);
+			Vector3Packetd::Scalars qs, ms, dt;
+			for (int l = 0; l < nl; l++) {
+				qs[l] = q[i + l];
+				ms[l] = m[i + l];
+				dt[l] = step[i + l];
+			}
+			for (int l = nl; l < N; l++)
+				ms[l] = 1;  // unused lanes
+
+			// Boris help vectors, in the order of dY for identical results
+			Vector3Packetd t = b * qs / 2. / ms * dt / c_light;
+			Vector3Packetd s = t * 2. / (t.getR2() + Vector3Packetd::Scalars(1));
+
+			// Boris push
+			Vector3Packetd v = u + u.cross(t);
+			u += v.cross(s);
+			u.storeSoA(y + 3, i, nl);
+
+			// the other half leap frog step in the position
+			Vector3Packetd x = Vector3Packetd::loadSoA(y, i, nl);
+			x += u * dt / 2.;
+			x.storeSoA(y, i, nl);
+		}
+	}
+
+
 	// with a fixed step size
 	PropagationBP::PropagationBP(ref_ptr<MagneticField> field, double fixedStep) :
-			minStep(0) {
+			minStep(0), stepHints(false) {
 		setField(field);
 		setTolerance(0.42);
 		setMaximumStep(fixedStep);
@@ -51,7 +129,7 @@ namespace crpropa {
 
 	// with adaptive step size
 	PropagationBP::PropagationBP(ref_ptr<MagneticField> field, double tolerance, double minStep, double maxStep) :
-			minStep(0) {
+			minStep(0), stepHints(false) {
 		setField(field);
 		setTolerance(tolerance);
 		setMaximumStep(maxStep);
@@ -83,13 +161,30 @@ namespace crpropa {
 		double newStep = step;
 		double z = candidate->getRedshift();
 		double m = current.getEnergy()/(c_light * c_light);
+		double nextStep = candidate->getNextStep();
+
+		if (stepHints and field.valid()) {
+			MagneticFieldStepHint hint = field->getStepHint(yIn.x, z);
+			// no field around: straight step, at most to the border of the region
+			if (hint.isFieldFree() and (hint.radius >= minStep)) {
+				step = std::min(clip((nextStep == 0) ? maxStep : nextStep, minStep, maxStep), hint.radius);
+				current.setPosition(yIn.x + yIn.u * step);
+				candidate->setCurrentStep(step);
+				// at the border the next step starts afresh, like the first one
+				candidate->setNextStep((step < hint.radius) ? maxStep : 0);
+				return;
+			}
+			// first step of the candidate
+			if (nextStep == 0)
+				nextStep = hint.getInitialStep(current.getRigidity());
+		}
 
 		// if minStep is the same as maxStep the adaptive algorithm with its error
 		// estimation is not needed and the computation time can be saved:
 		if (minStep == maxStep){
 			tryStep(yIn, yOut, yErr, step, current, z, m, q);
 		} else {
-			step = clip(candidate->getNextStep(), minStep, maxStep);
+			step = clip(nextStep, minStep, maxStep);
 			newStep = step;
 			double r = 42;  // arbitrary value
 
@@ -101,6 +196,7 @@ namespace crpropa {
 					if (step == minStep)  // already minimum step size
 						break;
 					else {
+						Candidate::countRejectedSteps(1);
 						newStep = step * 0.95 * pow(r, -0.2);
 						newStep = std::max(newStep, 0.1 * step); // limit step size decrease
 						newStep = std::max(newStep, minStep); // limit step size to minStep
@@ -124,6 +220,112 @@ namespace crpropa {
 	}
 
 
+	void PropagationBP::processBatch(
+			const std::vector<ref_ptr<Candidate> > &candidates) const {
+		// neutral candidates move rectilinearly and are handled one by one
+		std::vector<Candidate *> charged;
+		charged.reserve(candidates.size());
+		for (size_t i = 0; i < candidates.size(); i++) {
+			Candidate *candidate = candidates[i];
+			if (candidate->current.getCharge() == 0)
+				process(candidate);
+			else
+				charged.push_back(candidate);
+		}
+
+		size_t n = charged.size();
+		if (n == 0)
+			return;
+
+		std::vector<double> step(n), newStep(n), q(n), m(n), z(n);
+		for (size_t i = 0; i < n; i++) {
+			Candidate *candidate = charged[i];
+			ParticleState &current = candidate->current;
+			candidate->previous = current;
+			if (minStep == maxStep)
+				step[i] = maxStep;
+			else
+				step[i] = clip(candidate->getNextStep(), minStep, maxStep);
+			newStep[i] = step[i];
+			q[i] = current.getCharge();
+			m[i] = current.getEnergy()/(c_light * c_light);
+			z[i] = candidate->getRedshift();
+		}
+
+		// candidates whose step has not been accepted yet
+		std::vector<size_t> active(n);
+		for (size_t i = 0; i < n; i++)
+			active[i] = i;
+
+		std::vector<double> yStore(6 * n), outStore(6 * n), error(n);
+		std::vector<double> h(n), laneZ(n), laneM(n), laneQ(n);
+		while (not active.empty()) {
+			size_t k = active.size();
+			double *y[6], *out[6];
+			for (size_t c = 0; c < 6; c++) {
+				y[c] = &yStore[c * k];
+				out[c] = &outStore[c * k];
+			}
+
+			for (size_t l = 0; l < k; l++) {
+				size_t i = active[l];
+				const ParticleState &current = charged[i]->current;
+				Vector3d x = current.getPosition();
+				Vector3d u = current.getDirection();
+				y[0][l] = x.x;
+				y[1][l] = x.y;
+				y[2][l] = x.z;
+				y[3][l] = u.x;
+				y[4][l] = u.y;
+				y[5][l] = u.z;
+				h[l] = step[i];
+				laneZ[l] = z[i];
+				laneM[l] = m[i];
+				laneQ[l] = q[i];
+			}
+
+			tryStepBatch(y, out, error.data(), h.data(), laneZ.data(),
+					laneM.data(), laneQ.data(), k);
+
+			// step size control as in process(), lanes with a rejected step
+			// are tried again with the reduced step
+			size_t remaining = 0;
+			for (size_t l = 0; l < k; l++) {
+				size_t i = active[l];
+				bool accepted = true;
+				if (minStep != maxStep) {
+					// the error of tryStep is the same in all components
+					double r = Y(error[l]).u.getR() / tolerance;
+					if (r > 1) {
+						if (step[i] != minStep) {
+							newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+							newStep[i] = std::max(newStep[i], 0.1 * step[i]);
+							newStep[i] = std::max(newStep[i], minStep);
+							step[i] = newStep[i];
+							accepted = false;
+						}
+					} else if (step[i] != maxStep) {
+						newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+						newStep[i] = std::min(newStep[i], 5 * step[i]);
+						newStep[i] = std::min(newStep[i], maxStep);
+					}
+				}
+
+				if (not accepted) {
+					active[remaining++] = i;
+					continue;
+				}
+				Candidate *candidate = charged[i];
+				candidate->current.setPosition(Vector3d(out[0][l], out[1][l], out[2][l]));
+				candidate->current.setDirection(Vector3d(out[3][l], out[4][l], out[5][l]).getUnitVector());
+				candidate->setCurrentStep(step[i]);
+				candidate->setNextStep(newStep[i]);
+			}
+			active.resize(remaining);
+		}
+	}
+
+
 	void PropagationBP::setField(ref_ptr<MagneticField> f) {
 		field = f;
 	}
@@ -136,6 +338,7 @@ namespace crpropa {
 
 	Vector3d PropagationBP::getFieldAtPosition(Vector3d pos, double z) const {
 		Vector3d B(0, 0, 0);
+		Candidate::countFieldEvaluations(1);
 		try {
 			// check if field is valid and use the field vector at the
 			// position pos with the redshift z
@@ -149,6 +352,34 @@ namespace crpropa {
 	}
 
 
+	void PropagationBP::getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+			const double *z, size_t n) const {
+		if (n == 0)
+			return;
+		if (not field.valid()) {
+			for (size_t i = 0; i < n; i++)
+				B[i] = Vector3d(0, 0, 0);
+			return;
+		}
+
+		bool sameRedshift = true;
+		for (size_t i = 1; i < n; i++)
+			sameRedshift = sameRedshift and (z[i] == z[0]);
+
+		if (sameRedshift) {
+			Candidate::countFieldEvaluations(n);
+			try {
+				field->getFields(pos, B, n, z[0]);
+				return;
+			} catch (std::exception &e) {
+				// evaluate point by point to report the failing positions
+			}
+		}
+		for (size_t i = 0; i < n; i++)
+			B[i] = getFieldAtPosition(pos[i], z[i]);
+	}
+
+
 	double PropagationBP::errorEstimation(const Vector3d x1, const Vector3d x2, double step) const {
 		// compare the position after one step with the position after two steps with step/2.
 		Vector3d diff = (x1 - x2);
@@ -198,6 +429,16 @@ namespace crpropa {
 	}
 
 
+	void PropagationBP::setStepHints(bool use) {
+		stepHints = use;
+	}
+
+
+	bool PropagationBP::getStepHints() const {
+		return stepHints;
+	}
+
+
 	std::string PropagationBP::getDescription() const {
 		std::stringstream s;
 		s << "Propagation in magnetic fields using the adaptive Boris push method.";
@@ -206,4 +447,8 @@ namespace crpropa {
 		s << ", Maximum Step: " << maxStep / kpc << " kpc";
 		return s.str();
 	}
+
+	size_t PropagationBP::getSizeOf() const {
+		return field.valid() ? field->getSizeOf() : 0;
+	}
 } // namespace crpropa
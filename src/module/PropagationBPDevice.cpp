@@ -0,0 +1,300 @@
+#include "crpropa/module/PropagationBPDevice.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+// geometry of the grid, copied by value into the kernel
+struct DeviceGrid {
+	int N[3];
+	double origin[3], edge[3], gridOrigin[3], spacing[3];
+	bool clip;
+	float scale;
+};
+
+void copyVector(const Vector3d &v, double *a) {
+	a[0] = v.x;
+	a[1] = v.y;
+	a[2] = v.z;
+}
+
+#pragma omp declare target
+// as Grid::interpolate (trilinear and periodic) and MagneticFieldGrid::getField
+inline void deviceField(const float *v, const DeviceGrid &g, const double *x,
+		double *B) {
+	B[0] = B[1] = B[2] = 0;
+	if (g.clip) {
+		for (int c = 0; c < 3; c++)
+			if ((x[c] < g.origin[c]) or (x[c] > g.edge[c]))
+				return;
+	}
+
+	int i0[3], i1[3];
+	double f0[3], f1[3];
+	for (int c = 0; c < 3; c++) {
+		double r = (x[c] - g.gridOrigin[c]) / g.spacing[c];
+		double r0 = std::floor(r);
+		i0[c] = ((int(r0) % g.N[c]) + g.N[c]) % g.N[c];
+		i1[c] = (i0[c] + 1) % g.N[c];
+		f0[c] = r - r0;
+		f1[c] = 1 - f0[c];
+	}
+
+	// same order of the float operations as Vector3f
+	float b[3] = {0, 0, 0};
+	for (int k = 0; k < 8; k++) {
+		const int order[8][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+				{1, 0, 1}, {0, 1, 1}, {1, 1, 0}, {1, 1, 1}};
+		int ix = order[k][0] ? i1[0] : i0[0];
+		int iy = order[k][1] ? i1[1] : i0[1];
+		int iz = order[k][2] ? i1[2] : i0[2];
+		float wX = order[k][0] ? f0[0] : f1[0];
+		float wY = order[k][1] ? f0[1] : f1[1];
+		float wZ = order[k][2] ? f0[2] : f1[2];
+		const float *p = v + 3 * ((size_t(ix) * g.N[1] + iy) * g.N[2] + iz);
+		for (int c = 0; c < 3; c++)
+			b[c] += p[c] * wX * wY * wZ;
+	}
+	for (int c = 0; c < 3; c++)
+		B[c] = b[c] * g.scale;
+}
+
+// substeps of lane l as PropagationBP::dY with a normalized direction after each step
+inline void devicePush(const float *v, const DeviceGrid &g, double *y,
+		size_t n, size_t l, double step, double q, double m, int substeps) {
+	double x[3] = {y[l], y[n + l], y[2 * n + l]};
+	double u[3] = {y[3 * n + l], y[4 * n + l], y[5 * n + l]};
+	for (int k = 0; k < substeps; k++) {
+		// half leap frog step in the position
+		for (int c = 0; c < 3; c++)
+			x[c] += u[c] * step / 2.;
+
+		double B[3];
+		deviceField(v, g, x, B);
+
+		// Boris help vectors
+		double t[3], s[3];
+		for (int c = 0; c < 3; c++)
+			t[c] = B[c] * q / 2 / m * step / c_light;
+		double f = 1 + (t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+		for (int c = 0; c < 3; c++)
+			s[c] = t[c] * 2 / f;
+
+		// Boris push
+		double h0 = u[0] + (u[1] * t[2] - t[1] * u[2]);
+		double h1 = u[1] + (u[2] * t[0] - t[2] * u[0]);
+		double h2 = u[2] + (u[0] * t[1] - t[0] * u[1]);
+		u[0] = u[0] + (h1 * s[2] - s[1] * h2);
+		u[1] = u[1] + (h2 * s[0] - s[2] * h0);
+		u[2] = u[2] + (h0 * s[1] - s[0] * h1);
+
+		// the other half leap frog step in the position
+		for (int c = 0; c < 3; c++)
+			x[c] += u[c] * step / 2.;
+
+		double r = std::sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		for (int c = 0; c < 3; c++)
+			u[c] = u[c] / r;
+	}
+	for (int c = 0; c < 3; c++) {
+		y[c * n + l] = x[c];
+		y[(3 + c) * n + l] = u[c];
+	}
+}
+#pragma omp end declare target
+
+} // namespace
+
+PropagationBPDevice::PropagationBPDevice(ref_ptr<MagneticFieldGrid> field,
+		double step, size_t maxSubsteps) :
+		field(field), mapped(false) {
+	if (not field.valid())
+		throw std::runtime_error("PropagationBPDevice: no field grid");
+	setStep(step);
+	setMaximumSubsteps(maxSubsteps);
+	update();
+}
+
+PropagationBPDevice::~PropagationBPDevice() {
+	release();
+}
+
+void PropagationBPDevice::release() {
+#ifdef CRPROPA_HAVE_OPENMP_OFFLOAD
+	if (mapped) {
+		float *v = values.data();
+		size_t nv = values.size();
+		#pragma omp target exit data map(delete: v[0:nv])
+	}
+#endif
+	mapped = false;
+}
+
+void PropagationBPDevice::update() {
+	ref_ptr<Grid3f> grid = field->getGrid();
+	if (grid->isReflective() or (grid->getInterpolationType() != TRILINEAR))
+		throw std::runtime_error(
+				"PropagationBPDevice: only periodic grids with trilinear interpolation");
+
+	release();
+	Nx = grid->getNx();
+	Ny = grid->getNy();
+	Nz = grid->getNz();
+	origin = grid->getOrigin();
+	spacing = grid->getSpacing();
+	gridOrigin = origin + spacing / 2;
+	clipVolume = grid->isClipVolume();
+	scale = field->getScale();
+
+	values.resize(3 * Nx * Ny * Nz);
+#pragma omp parallel for
+	for (int ix = 0; ix < int(Nx); ix++)
+		for (size_t iy = 0; iy < Ny; iy++)
+			for (size_t iz = 0; iz < Nz; iz++) {
+				const Vector3f &b = grid->get(ix, iy, iz);
+				float *p = &values[3 * ((ix * Ny + iy) * Nz + iz)];
+				p[0] = b.x;
+				p[1] = b.y;
+				p[2] = b.z;
+			}
+
+#ifdef CRPROPA_HAVE_OPENMP_OFFLOAD
+	float *v = values.data();
+	size_t nv = values.size();
+	#pragma omp target enter data map(to: v[0:nv])
+	mapped = true;
+#endif
+}
+
+void PropagationBPDevice::process(Candidate *candidate) const {
+	std::vector<ref_ptr<Candidate> > batch(1, candidate);
+	processBatch(batch);
+}
+
+void PropagationBPDevice::processBatch(
+		const std::vector<ref_ptr<Candidate> > &candidates) const {
+	// neutral candidates move rectilinearly on the host
+	std::vector<Candidate *> charged;
+	charged.reserve(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		Candidate *candidate = candidates[i];
+		ParticleState &current = candidate->current;
+		candidate->previous = current;
+		if (current.getCharge() != 0) {
+			charged.push_back(candidate);
+			continue;
+		}
+		double s = std::min(candidate->getNextStep(), maxSubsteps * step);
+		s = std::max(1., std::floor(s / step)) * step;
+		current.setPosition(current.getPosition() + current.getDirection() * s);
+		candidate->setCurrentStep(s);
+		candidate->setNextStep(maxSubsteps * step);
+	}
+
+	size_t n = charged.size();
+	if (n == 0)
+		return;
+
+	// states of the lanes (x, y, z, ux, uy, uz), 6 arrays of length n
+	std::vector<double> yStore(6 * n), qStore(n), mStore(n);
+	std::vector<int> subStore(n);
+	for (size_t l = 0; l < n; l++) {
+		const ParticleState &current = charged[l]->current;
+		Vector3d x = current.getPosition();
+		Vector3d u = current.getDirection();
+		yStore[l] = x.x;
+		yStore[n + l] = x.y;
+		yStore[2 * n + l] = x.z;
+		yStore[3 * n + l] = u.x;
+		yStore[4 * n + l] = u.y;
+		yStore[5 * n + l] = u.z;
+		qStore[l] = current.getCharge();
+		mStore[l] = current.getEnergy() / (c_light * c_light);
+		double k = std::floor(charged[l]->getNextStep() / step);
+		subStore[l] = std::max(1., std::min(k, double(maxSubsteps)));
+	}
+
+	DeviceGrid g;
+	Vector3d edge = origin + Vector3d(Nx, Ny, Nz) * spacing;
+	g.N[0] = Nx;
+	g.N[1] = Ny;
+	g.N[2] = Nz;
+	copyVector(edge, g.edge);
+	copyVector(origin, g.origin);
+	copyVector(gridOrigin, g.gridOrigin);
+	copyVector(spacing, g.spacing);
+	g.clip = clipVolume;
+	g.scale = scale;
+
+	const float *v = values.data();
+	double *y = yStore.data(), *q = qStore.data(), *m = mStore.data();
+	int *sub = subStore.data();
+	double h = step;
+#ifdef CRPROPA_HAVE_OPENMP_OFFLOAD
+	bool device = mapped;
+	#pragma omp target teams distribute parallel for if(device) \
+			map(tofrom: y[0:6*n]) map(to: q[0:n], m[0:n], sub[0:n])
+#endif
+	for (size_t l = 0; l < n; l++)
+		devicePush(v, g, y, n, l, h, q[l], m[l], sub[l]);
+
+	for (size_t l = 0; l < n; l++) {
+		Candidate *candidate = charged[l];
+		candidate->current.setPosition(Vector3d(y[l], y[n + l], y[2 * n + l]));
+		candidate->current.setDirection(
+				Vector3d(y[3 * n + l], y[4 * n + l], y[5 * n + l]));
+		candidate->setCurrentStep(sub[l] * step);
+		candidate->setNextStep(maxSubsteps * step);
+	}
+}
+
+void PropagationBPDevice::setStep(double s) {
+	if (s <= 0)
+		throw std::runtime_error("PropagationBPDevice: step <= 0");
+	step = s;
+}
+
+void PropagationBPDevice::setMaximumSubsteps(size_t n) {
+	if (n < 1)
+		throw std::runtime_error("PropagationBPDevice: maxSubsteps < 1");
+	maxSubsteps = n;
+}
+
+ref_ptr<MagneticFieldGrid> PropagationBPDevice::getField() const {
+	return field;
+}
+
+double PropagationBPDevice::getStep() const {
+	return step;
+}
+
+size_t PropagationBPDevice::getMaximumSubsteps() const {
+	return maxSubsteps;
+}
+
+bool PropagationBPDevice::isOffloaded() const {
+#if defined(CRPROPA_HAVE_OPENMP_OFFLOAD) && defined(_OPENMP)
+	return mapped and (omp_get_num_devices() > 0);
+#else
+	return false;
+#endif
+}
+
+std::string PropagationBPDevice::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in a magnetic field grid using the Boris push";
+	s << (isOffloaded() ? " on the device" : " on the host");
+	s << ", Step: " << step / kpc << " kpc";
+	s << ", Maximum substeps: " << maxSubsteps;
+	return s.str();
+}
+
+} // namespace crpropa
@@ -1,5 +1,6 @@
 #include "crpropa/module/PropagationCK.h"
 
+#include <cmath>
 #include <limits>
 #include <sstream>
 #include <stdexcept>
@@ -26,7 +27,7 @@ const double cash_karp_bs[] = {
 };
 
 void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
-		ParticleState &particle, double z) const {
+		ParticleState &particle, double z, const Vector3d *B0) const {
 	std::vector<Y> k;
 	k.reserve(6);
 
@@ -41,19 +42,96 @@ void PropagationCK::tryStep(const Y &y, Y &out, Y &error, double h,
 			y_n += k[j] * a[i * 6 + j] * h;
 
 		// update k_i
-		k[i] = dYdt(y_n, particle, z);
+		if ((i == 0) and B0)
+			k[i] = dYdt(y_n, particle, *B0);
+		else
+			k[i] = dYdt(y_n, particle, z);
 
 		out += k[i] * b[i] * h;
 		error += k[i] * (b[i] - bs[i]) * h;
 	}
 }
 
+void PropagationCK::tryStepBatch(const double *const *y, double **out,
+		double **errU, const double *h, const double *qcE, const double *z,
+		size_t n) const {
+	// k[i][c][l]: component c (x, y, z, ux, uy, uz) of stage i for lane l
+	std::vector<double> kStore(6 * 6 * n), ynStore(6 * n);
+	double *k[6][6], *yn[6];
+	for (size_t c = 0; c < 6; c++) {
+		yn[c] = &ynStore[c * n];
+		for (size_t i = 0; i < 6; i++)
+			k[i][c] = &kStore[(i * 6 + c) * n];
+	}
+	std::vector<Vector3d> pos(n), B(n);
+
+	for (size_t c = 0; c < 6; c++)
+		for (size_t l = 0; l < n; l++)
+			out[c][l] = y[c][l];
+	for (size_t c = 0; c < 3; c++)
+		for (size_t l = 0; l < n; l++)
+			errU[c][l] = 0;
+
+	for (size_t i = 0; i < 6; i++) {
+		for (size_t c = 0; c < 6; c++) {
+			double *ync = yn[c];
+			const double *yc = y[c];
+			for (size_t l = 0; l < n; l++)
+				ync[l] = yc[l];
+			for (size_t j = 0; j < i; j++) {
+				const double aij = a[i * 6 + j];
+				const double *kjc = k[j][c];
+				for (size_t l = 0; l < n; l++)
+					ync[l] += kjc[l] * aij * h[l];
+			}
+		}
+
+		// one field evaluation for all lanes
+		for (size_t l = 0; l < n; l++)
+			pos[l] = Vector3d(yn[0][l], yn[1][l], yn[2][l]);
+		getFieldsAtPositions(pos.data(), B.data(), z, n);
+
+		// same as dYdt: v = c * unit(u), du/dt = q*c/E * (v x B)
+		double *kx = k[i][0], *ky = k[i][1], *kz = k[i][2];
+		double *kux = k[i][3], *kuy = k[i][4], *kuz = k[i][5];
+		for (size_t l = 0; l < n; l++) {
+			double ux = yn[3][l], uy = yn[4][l], uz = yn[5][l];
+			double r = std::sqrt(ux * ux + uy * uy + uz * uz);
+			double vx = ux / r * c_light;
+			double vy = uy / r * c_light;
+			double vz = uz / r * c_light;
+			kx[l] = vx;
+			ky[l] = vy;
+			kz[l] = vz;
+			kux[l] = (vy * B[l].z - vz * B[l].y) * qcE[l];
+			kuy[l] = (vz * B[l].x - vx * B[l].z) * qcE[l];
+			kuz[l] = (vx * B[l].y - vy * B[l].x) * qcE[l];
+		}
+
+		const double bi = b[i], ei = b[i] - bs[i];
+		for (size_t c = 0; c < 6; c++) {
+			const double *kic = k[i][c];
+			double *outc = out[c];
+			for (size_t l = 0; l < n; l++)
+				outc[l] += kic[l] * bi * h[l];
+		}
+		for (size_t c = 0; c < 3; c++) {
+			const double *kic = k[i][c + 3];
+			double *errc = errU[c];
+			for (size_t l = 0; l < n; l++)
+				errc[l] += kic[l] * ei * h[l];
+		}
+	}
+}
+
 PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) const {
+	// get B field at particle position
+	return dYdt(y, p, getFieldAtPosition(y.x, z));
+}
+
+PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, const Vector3d &B) const {
 	// normalize direction vector to prevent numerical losses
 	Vector3d velocity = y.u.getUnitVector() * c_light;
-	
-	// get B field at particle position
-	Vector3d B = getFieldAtPosition(y.x, z);
 
 	// Lorentz force: du/dt = q*c/E * (v x B)
 	Vector3d dudt = p.getCharge() * c_light / p.getEnergy() * velocity.cross(B);
@@ -62,7 +140,7 @@ PropagationCK::Y PropagationCK::dYdt(const Y &y, ParticleState &p, double z) con
 
 PropagationCK::PropagationCK(ref_ptr<MagneticField> field, double tolerance,
 		double minStep, double maxStep) :
-		minStep(0) {
+		minStep(0), stepHints(false) {
 	setField(field);
 	setTolerance(tolerance);
 	setMaximumStep(maxStep);
@@ -94,25 +172,51 @@ void PropagationCK::process(Candidate *candidate) const {
 	Y yOut, yErr;
 	double newStep = step;
 	double z = candidate->getRedshift();
+	double nextStep = candidate->getNextStep();
+
+	if (stepHints and field.valid()) {
+		MagneticFieldStepHint hint = field->getStepHint(yIn.x, z);
+		// no field around: straight step, at most to the border of the region
+		if (hint.isFieldFree() and (hint.radius >= minStep)) {
+			step = std::min(clip((nextStep == 0) ? maxStep : nextStep, minStep, maxStep), hint.radius);
+			current.setPosition(yIn.x + yIn.u * step);
+			candidate->setCurrentStep(step);
+			// at the border the next step starts afresh, like the first one
+			candidate->setNextStep((step < hint.radius) ? maxStep : 0);
+			return;
+		}
+		// first step of the candidate
+		if (nextStep == 0)
+			nextStep = hint.getInitialStep(current.getRigidity());
+	}
+
+	// the field at the start, for all tries; it may be known from the
+	// previous step
+	Vector3d B0;
+	if (not candidate->getStepField(field, yIn.x, z, B0)) {
+		B0 = getFieldAtPosition(yIn.x, z);
+		candidate->setStepField(field, yIn.x, z, B0);
+	}
 
 
 	// if minStep is the same as maxStep the adaptive algorithm with its error
 	// estimation is not needed and the computation time can be saved:
 	if (minStep == maxStep){
-		tryStep(yIn, yOut, yErr, step / c_light, current, z);
+		tryStep(yIn, yOut, yErr, step / c_light, current, z, &B0);
 	} else {
-		step = clip(candidate->getNextStep(), minStep, maxStep);
+		step = clip(nextStep, minStep, maxStep);
 		newStep = step;
 		double r = 42;  // arbitrary value
 
 		// try performing step until the target error (tolerance) or the minimum/maximum step size has been reached
 		while (true) {
-			tryStep(yIn, yOut, yErr, step / c_light, current, z);
+			tryStep(yIn, yOut, yErr, step / c_light, current, z, &B0);
 			r = yErr.u.getR() / tolerance;  // ratio of absolute direction error and tolerance
 			if (r > 1) {  // large direction error relative to tolerance, try to decrease step size
 				if (step == minStep)  // already minimum step size
 					break;
 				else {
+					Candidate::countRejectedSteps(1);
 					newStep = step * 0.95 * pow(r, -0.2);
 					newStep = std::max(newStep, 0.1 * step); // limit step size decrease
 					newStep = std::max(newStep, minStep); // limit step size to minStep
@@ -135,6 +239,109 @@ void PropagationCK::process(Candidate *candidate) const {
 	candidate->setNextStep(newStep);
 }
 
+void PropagationCK::processBatch(
+		const std::vector<ref_ptr<Candidate> > &candidates) const {
+	// neutral candidates move rectilinearly and are handled one by one
+	std::vector<Candidate *> charged;
+	charged.reserve(candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		Candidate *candidate = candidates[i];
+		if (candidate->current.getCharge() == 0)
+			process(candidate);
+		else
+			charged.push_back(candidate);
+	}
+
+	size_t n = charged.size();
+	if (n == 0)
+		return;
+
+	std::vector<double> step(n), newStep(n), qcE(n), z(n);
+	for (size_t i = 0; i < n; i++) {
+		Candidate *candidate = charged[i];
+		ParticleState &current = candidate->current;
+		candidate->previous = current;
+		if (minStep == maxStep)
+			step[i] = maxStep;
+		else
+			step[i] = clip(candidate->getNextStep(), minStep, maxStep);
+		newStep[i] = step[i];
+		qcE[i] = current.getCharge() * c_light / current.getEnergy();
+		z[i] = candidate->getRedshift();
+	}
+
+	// candidates whose step has not been accepted yet
+	std::vector<size_t> active(n);
+	for (size_t i = 0; i < n; i++)
+		active[i] = i;
+
+	std::vector<double> yStore(6 * n), outStore(6 * n), errStore(3 * n);
+	std::vector<double> h(n), laneQcE(n), laneZ(n);
+	while (not active.empty()) {
+		size_t m = active.size();
+		double *y[6], *out[6], *errU[3];
+		for (size_t c = 0; c < 6; c++) {
+			y[c] = &yStore[c * m];
+			out[c] = &outStore[c * m];
+		}
+		for (size_t c = 0; c < 3; c++)
+			errU[c] = &errStore[c * m];
+
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			const ParticleState &current = charged[i]->current;
+			Vector3d x = current.getPosition();
+			Vector3d u = current.getDirection();
+			y[0][l] = x.x;
+			y[1][l] = x.y;
+			y[2][l] = x.z;
+			y[3][l] = u.x;
+			y[4][l] = u.y;
+			y[5][l] = u.z;
+			h[l] = step[i] / c_light;
+			laneQcE[l] = qcE[i];
+			laneZ[l] = z[i];
+		}
+
+		tryStepBatch(y, out, errU, h.data(), laneQcE.data(), laneZ.data(), m);
+
+		// step size control as in process(), lanes with a rejected step
+		// are tried again with the reduced step
+		size_t remaining = 0;
+		for (size_t l = 0; l < m; l++) {
+			size_t i = active[l];
+			bool accepted = true;
+			if (minStep != maxStep) {
+				double r = Vector3d(errU[0][l], errU[1][l], errU[2][l]).getR() / tolerance;
+				if (r > 1) {
+					if (step[i] != minStep) {
+						newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+						newStep[i] = std::max(newStep[i], 0.1 * step[i]);
+						newStep[i] = std::max(newStep[i], minStep);
+						step[i] = newStep[i];
+						accepted = false;
+					}
+				} else if (step[i] != maxStep) {
+					newStep[i] = step[i] * 0.95 * pow(r, -0.2);
+					newStep[i] = std::min(newStep[i], 5 * step[i]);
+					newStep[i] = std::min(newStep[i], maxStep);
+				}
+			}
+
+			if (not accepted) {
+				active[remaining++] = i;
+				continue;
+			}
+			Candidate *candidate = charged[i];
+			candidate->current.setPosition(Vector3d(out[0][l], out[1][l], out[2][l]));
+			candidate->current.setDirection(Vector3d(out[3][l], out[4][l], out[5][l]).getUnitVector());
+			candidate->setCurrentStep(step[i]);
+			candidate->setNextStep(newStep[i]);
+		}
+		active.resize(remaining);
+	}
+}
+
 void PropagationCK::setField(ref_ptr<MagneticField> f) {
 	field = f;
 }
@@ -145,6 +352,7 @@ ref_ptr<MagneticField> PropagationCK::getField() const {
 
 Vector3d PropagationCK::getFieldAtPosition(Vector3d pos, double z) const {
 	Vector3d B(0, 0, 0);
+	Candidate::countFieldEvaluations(1);
 	try {
 		// check if field is valid and use the field vector at the
 		// position pos with the redshift z
@@ -157,6 +365,33 @@ Vector3d PropagationCK::getFieldAtPosition(Vector3d pos, double z) const {
 	return B;
 }
 
+void PropagationCK::getFieldsAtPositions(const Vector3d *pos, Vector3d *B,
+		const double *z, size_t n) const {
+	if (n == 0)
+		return;
+	if (not field.valid()) {
+		for (size_t i = 0; i < n; i++)
+			B[i] = Vector3d(0, 0, 0);
+		return;
+	}
+
+	bool sameRedshift = true;
+	for (size_t i = 1; i < n; i++)
+		sameRedshift = sameRedshift and (z[i] == z[0]);
+
+	if (sameRedshift) {
+		Candidate::countFieldEvaluations(n);
+		try {
+			field->getFields(pos, B, n, z[0]);
+			return;
+		} catch (std::exception &e) {
+			// evaluate point by point to report the failing positions
+		}
+	}
+	for (size_t i = 0; i < n; i++)
+		B[i] = getFieldAtPosition(pos[i], z[i]);
+}
+
 void PropagationCK::setTolerance(double tol) {
 	if ((tol > 1) or (tol < 0))
 		throw std::runtime_error(
@@ -182,6 +417,14 @@ double PropagationCK::getTolerance() const {
 	return tolerance;
 }
 
+void PropagationCK::setStepHints(bool use) {
+	stepHints = use;
+}
+
+bool PropagationCK::getStepHints() const {
+	return stepHints;
+}
+
 double PropagationCK::getMinimumStep() const {
 	return minStep;
 }
@@ -190,6 +433,10 @@ double PropagationCK::getMaximumStep() const {
 	return maxStep;
 }
 
+size_t PropagationCK::getSizeOf() const {
+	return field.valid() ? field->getSizeOf() : 0;
+}
+
 std::string PropagationCK::getDescription() const {
 	std::stringstream s;
 	s << "Propagation in magnetic fields using the Cash-Karp method.";
@@ -0,0 +1,299 @@
+#include "crpropa/module/PropagationDP.h"
+
+#include "kiss/logger.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// Dormand-Prince coefficients; the last row are the weights of the 5th order solution
+static const double dp_a[7][6] = {
+	{0., 0., 0., 0., 0., 0.},
+	{1. / 5., 0., 0., 0., 0., 0.},
+	{3. / 40., 9. / 40., 0., 0., 0., 0.},
+	{44. / 45., -56. / 15., 32. / 9., 0., 0., 0.},
+	{19372. / 6561., -25360. / 2187., 64448. / 6561., -212. / 729., 0., 0.},
+	{9017. / 3168., -355. / 33., 46732. / 5247., 49. / 176., -5103. / 18656., 0.},
+	{35. / 384., 0., 500. / 1113., 125. / 192., -2187. / 6784., 11. / 84.}
+};
+
+// difference of the weights of the 5th and 4th order solutions
+static const double dp_e[7] = {
+	71. / 57600., 0., -71. / 16695., 71. / 1920., -17253. / 339200., 22. / 525., -1. / 40.
+};
+
+// coefficients of the dense output (Hairer, Norsett and Wanner, dopri5)
+static const double dp_d[7] = {
+	-12715105075. / 11282082432., 0., 87487479700. / 32700410799.,
+	-10690763975. / 1880347072., 701980252875. / 199316789632.,
+	-1453857185. / 822651844., 69997945. / 29380423.
+};
+
+// PI controller: exponents of the current and the previous error ratio
+static const double alpha = 0.17;
+static const double beta = 0.04;
+
+// candidate property with the error ratio of the previous accepted step
+static PropertyKey errorRatioKey() {
+	static const PropertyKey key = Candidate::getPropertyKey("PropagationDP_errorRatio");
+	return key;
+}
+
+PropagationDP::PropagationDP(ref_ptr<MagneticField> field, double tolerance,
+		double minStep, double maxStep) :
+		minStep(0) {
+	setField(field);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+PropagationDP::Y PropagationDP::dYdt(const Y &y, ParticleState &p, double z) const {
+	return dYdt(y, p, getFieldAtPosition(y.x, z));
+}
+
+PropagationDP::Y PropagationDP::dYdt(const Y &y, ParticleState &p, const Vector3d &B) const {
+	// normalize direction vector to prevent numerical losses
+	Vector3d velocity = y.u.getUnitVector() * c_light;
+	// Lorentz force: du/dt = q*c/E * (v x B)
+	Vector3d dudt = p.getCharge() * c_light / p.getEnergy() * velocity.cross(B);
+	return Y(velocity, dudt);
+}
+
+void PropagationDP::tryStep(const Y &y, Y &out, Y &error, Y *k, double h,
+		ParticleState &p, double z, Vector3d *Bout) const {
+	for (size_t i = 1; i < 7; i++) {
+		Y yn = y;
+		for (size_t j = 0; j < i; j++)
+			yn += k[j] * (dp_a[i][j] * h);
+		// the last stage is evaluated at the 5th order solution
+		if ((i == 6) and Bout) {
+			out = yn;
+			*Bout = getFieldAtPosition(yn.x, z);
+			k[i] = dYdt(yn, p, *Bout);
+			continue;
+		}
+		if (i == 6)
+			out = yn;
+		k[i] = dYdt(yn, p, z);
+	}
+
+	error = Y(0);
+	for (size_t i = 0; i < 7; i++)
+		error += k[i] * (dp_e[i] * h);
+}
+
+PropagationDP::Y PropagationDP::denseOutput(const Y &y, const Y &out,
+		const Y *k, double h, double theta) const {
+	Y difference = out;
+	difference += y * -1.;
+	Y r3 = k[0] * h;
+	r3 += difference * -1.;
+	Y r4 = difference;
+	r4 += k[6] * -h;
+	r4 += r3 * -1.;
+	Y r5(0);
+	for (size_t i = 0; i < 7; i++)
+		r5 += k[i] * (dp_d[i] * h);
+
+	// y + theta (difference + (1 - theta) (r3 + theta (r4 + (1 - theta) r5)))
+	double theta1 = 1 - theta;
+	Y s = r4;
+	s += r5 * theta1;
+	Y t = r3;
+	t += s * theta;
+	Y result = difference;
+	result += t * theta1;
+	Y dense = y;
+	dense += result * theta;
+	return dense;
+}
+
+double PropagationDP::crossing(const Y &y, const Y &out, const Y *k, double h) const {
+	double theta = 1;
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		double d0 = surfaces[i]->distance(y.x);
+		double d1 = surfaces[i]->distance(out.x);
+		if (d0 * d1 >= 0 or d0 == 0)
+			continue;
+		// bisection for the first point behind the surface
+		double lo = 0, hi = 1;
+		for (int j = 0; j < 60 and hi - lo > 1e-12; j++) {
+			double mid = 0.5 * (lo + hi);
+			double d = surfaces[i]->distance(denseOutput(y, out, k, h, mid).x);
+			if (d * d0 > 0)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		theta = std::min(theta, hi);
+	}
+	return theta;
+}
+
+void PropagationDP::process(Candidate *candidate) const {
+	// save the new previous particle state
+	ParticleState &current = candidate->current;
+	candidate->previous = current;
+
+	Y yIn(current.getPosition(), current.getDirection());
+	double z = candidate->getRedshift();
+	double step = maxStep;
+	Y yOut, yErr;
+	Y k[7];
+
+	// rectilinear propagation for neutral particles
+	if (current.getCharge() == 0) {
+		step = clip(candidate->getNextStep(), minStep, maxStep);
+		yOut = Y(yIn.x + yIn.u * step, yIn.u);
+		if (not surfaces.empty()) {
+			for (size_t i = 0; i < 7; i++)
+				k[i] = Y(yIn.u * c_light, Vector3d(0.));
+			step *= crossing(yIn, yOut, k, step / c_light);
+		}
+		current.setPosition(yIn.x + yIn.u * step);
+		candidate->setCurrentStep(step);
+		candidate->setNextStep(maxStep);
+		return;
+	}
+
+	// first same as last: the first stage is the same for all tries, its
+	// field is usually known from the last stage of the previous step
+	Vector3d B0, B1; // field at the start and the end
+	if (not candidate->getStepField(field, yIn.x, z, B0))
+		B0 = getFieldAtPosition(yIn.x, z);
+	k[0] = dYdt(yIn, current, B0);
+	double newStep = step;
+
+	// if minStep is the same as maxStep the step size control is not needed
+	if (minStep == maxStep) {
+		tryStep(yIn, yOut, yErr, k, step / c_light, current, z, &B1);
+	} else {
+		step = clip(candidate->getNextStep(), minStep, maxStep);
+		newStep = step;
+		double rOld = 1;
+		if (candidate->hasProperty(errorRatioKey()))
+			rOld = candidate->getProperty(errorRatioKey()).asDouble();
+
+		while (true) {
+			tryStep(yIn, yOut, yErr, k, step / c_light, current, z, &B1);
+			double r = yErr.u.getR() / tolerance; // ratio of direction error and tolerance
+			if (r > 1) { // rejected: proportional decrease
+				if (step == minStep)
+					break;
+				Candidate::countRejectedSteps(1);
+				newStep = step * 0.9 * pow(r, -0.2);
+				newStep = std::max(newStep, 0.1 * step);
+				newStep = std::max(newStep, minStep);
+				step = newStep;
+			} else { // accepted: proportional-integral increase
+				if (step != maxStep) {
+					newStep = step * 0.9 * pow(r, -alpha) * pow(rOld, beta);
+					newStep = clip(newStep, 0.1 * step, 5 * step);
+					newStep = std::min(newStep, maxStep);
+				}
+				candidate->setProperty(errorRatioKey(), Variant::fromDouble(std::max(r, 1e-4)));
+				break;
+			}
+		}
+	}
+
+	bool shortened = false;
+	if (not surfaces.empty()) {
+		double theta = crossing(yIn, yOut, k, step / c_light);
+		if (theta < 1) {
+			yOut = denseOutput(yIn, yOut, k, step / c_light, theta);
+			step *= theta;
+			shortened = true;
+		}
+	}
+	if (not shortened)
+		candidate->setStepField(field, yOut.x, z, B1);
+
+	current.setPosition(yOut.x);
+	current.setDirection(yOut.u.getUnitVector());
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(newStep);
+}
+
+void PropagationDP::addCrossingSurface(Surface *surface) {
+	surfaces.push_back(surface);
+}
+
+void PropagationDP::clearCrossingSurfaces() {
+	surfaces.clear();
+}
+
+void PropagationDP::setField(ref_ptr<MagneticField> f) {
+	field = f;
+}
+
+ref_ptr<MagneticField> PropagationDP::getField() const {
+	return field;
+}
+
+Vector3d PropagationDP::getFieldAtPosition(Vector3d pos, double z) const {
+	Vector3d B(0, 0, 0);
+	Candidate::countFieldEvaluations(1);
+	try {
+		if (field.valid())
+			B = field->getField(pos, z);
+	} catch (std::exception &e) {
+		KISS_LOG_ERROR << "PropagationDP: Exception in PropagationDP::getFieldAtPosition.\n"
+				<< e.what();
+	}
+	return B;
+}
+
+void PropagationDP::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationDP: target error not in range 0-1");
+	tolerance = tol;
+}
+
+void PropagationDP::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationDP: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationDP: minStep > maxStep");
+	minStep = min;
+}
+
+void PropagationDP::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationDP: maxStep < minStep");
+	maxStep = max;
+}
+
+double PropagationDP::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationDP::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationDP::getMaximumStep() const {
+	return maxStep;
+}
+
+size_t PropagationDP::getSizeOf() const {
+	return field.valid() ? field->getSizeOf() : 0;
+}
+
+std::string PropagationDP::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in magnetic fields using the Dormand-Prince method.";
+	s << " Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / kpc << " kpc";
+	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	if (not surfaces.empty())
+		s << ", Crossing surfaces: " << surfaces.size();
+	return s.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,264 @@
+#include "crpropa/module/PropagationGuidingCenter.h"
+
+#include "kiss/logger.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// ratio of the maximum gyroradius E / (|q| c B) and the scale length of the field
+static double adiabaticity(const PropagationGuidingCenter::FieldGeometry &g,
+		double charge, double energy) {
+	if (g.B == 0)
+		return std::numeric_limits<double>::infinity();
+	double gyroradius = energy / (std::fabs(charge) * c_light * g.B);
+	double inverseScale = std::max(g.gradB.getR() / g.B, g.curvature.getR());
+	return gyroradius * inverseScale;
+}
+
+// unit vector of the direction perpendicular to the field
+static Vector3d perpendicularDirection(const Vector3d &direction, const Vector3d &b) {
+	Vector3d perpendicular = direction - b * direction.dot(b);
+	if (perpendicular.getR() > 0)
+		return perpendicular.getUnitVector();
+	// no gyration: any direction perpendicular to b
+	Vector3d a = (std::fabs(b.x) < 0.9) ? Vector3d(1, 0, 0) : Vector3d(0, 1, 0);
+	return b.cross(a).getUnitVector();
+}
+
+PropagationGuidingCenter::PropagationGuidingCenter(ref_ptr<MagneticField> field,
+		double maxAdiabaticity, double tolerance, double minStep, double maxStep) :
+		minStep(0) {
+	// the setters check the parameters and pass them on
+	fullOrbit = new PropagationCK(field, 1e-4, 0, std::numeric_limits<double>::max());
+	setField(field);
+	setMaximumAdiabaticity(maxAdiabaticity);
+	setTolerance(tolerance);
+	setMaximumStep(maxStep);
+	setMinimumStep(minStep);
+}
+
+PropagationGuidingCenter::FieldGeometry PropagationGuidingCenter::getFieldGeometry(
+		const Vector3d &position, double z) const {
+	FieldGeometry g;
+	if (not field.valid())
+		return g;
+
+	Vector3d B, dBdx, dBdy, dBdz;
+	Candidate::countFieldEvaluations(1);
+	try {
+		B = field->getFieldAndJacobian(position, z, dBdx, dBdy, dBdz);
+	} catch (std::exception &e) {
+		KISS_LOG_ERROR << "PropagationGuidingCenter: Exception in PropagationGuidingCenter::getFieldGeometry.\n"
+				<< e.what();
+		return g;
+	}
+
+	g.B = B.getR();
+	if (g.B == 0)
+		return g;
+	g.b = B / g.B;
+	// d|B|/dx_i = b.dB/dx_i
+	g.gradB = Vector3d(g.b.dot(dBdx), g.b.dot(dBdy), g.b.dot(dBdz));
+	// (b.grad)b = ((b.grad)B - b (b.(b.grad)B)) / |B|
+	Vector3d bGradB = dBdx * g.b.x + dBdy * g.b.y + dBdz * g.b.z;
+	g.curvature = (bGradB - g.b * g.b.dot(bGradB)) / g.B;
+	return g;
+}
+
+double PropagationGuidingCenter::getAdiabaticity(const Candidate *candidate) const {
+	const ParticleState &current = candidate->current;
+	FieldGeometry g = getFieldGeometry(current.getPosition(), candidate->getRedshift());
+	return adiabaticity(g, current.getCharge(), current.getEnergy());
+}
+
+Vector3d PropagationGuidingCenter::getGuidingCenter(const ParticleState &particle,
+		double z) const {
+	Vector3d x = particle.getPosition();
+	FieldGeometry g = getFieldGeometry(x, z);
+	if (g.B == 0 or particle.getCharge() == 0)
+		return x;
+	// R = x - b x p / (q B)
+	double qcE = particle.getCharge() * c_light / particle.getEnergy();
+	return x - g.b.cross(particle.getDirection()) / (qcE * g.B);
+}
+
+PropagationGuidingCenter::Y PropagationGuidingCenter::dYdt(const Y &y,
+		double invariant, double qcE, double z) const {
+	FieldGeometry g = getFieldGeometry(y.x, z);
+	if (g.B == 0)
+		return Y(Vector3d(0.), 0);
+
+	// conserved magnetic moment: sin^2(a) = invariant * B
+	double sin2 = std::min(invariant * g.B, 1.);
+	// parallel motion, grad-B and curvature drift
+	Vector3d drift = g.b.cross(g.gradB * (0.5 * sin2 / g.B) + g.curvature * (y.u * y.u));
+	Vector3d dxdt = g.b * (c_light * y.u) + drift * (c_light / (qcE * g.B));
+	// mirror force
+	double dudt = -0.5 * c_light * sin2 * g.b.dot(g.gradB) / g.B;
+	return Y(dxdt, dudt);
+}
+
+void PropagationGuidingCenter::tryStep(const Y &y, Y &out, Y &error, double h,
+		double invariant, double qcE, double z) const {
+	Y k1 = dYdt(y, invariant, qcE, z);
+	Y k2 = dYdt(y + k1 * (0.5 * h), invariant, qcE, z);
+	Y k3 = dYdt(y + k2 * (0.75 * h), invariant, qcE, z);
+	out = y + (k1 * (2. / 9.) + k2 * (1. / 3.) + k3 * (4. / 9.)) * h;
+	Y k4 = dYdt(out, invariant, qcE, z);
+	error = (k1 * (-5. / 72.) + k2 * (1. / 12.) + k3 * (1. / 9.) + k4 * (-1. / 8.)) * h;
+}
+
+void PropagationGuidingCenter::process(Candidate *candidate) const {
+	ParticleState &current = candidate->current;
+	double z = candidate->getRedshift();
+	double charge = current.getCharge();
+	double energy = current.getEnergy();
+
+	// full orbit integration for neutral particles and non-adiabatic motion
+	FieldGeometry g0;
+	if (charge != 0)
+		g0 = getFieldGeometry(current.getPosition(), z);
+	if (charge == 0 or adiabaticity(g0, charge, energy) > maxAdiabaticity) {
+		fullOrbit->process(candidate);
+		return;
+	}
+
+	// save the new previous particle state
+	candidate->previous = current;
+
+	// split the particle into guiding centre and gyration
+	double qcE = charge * c_light / energy;
+	Vector3d direction = current.getDirection();
+	double u0 = clip(direction.dot(g0.b), -1., 1.);
+	double s0 = std::sqrt(1 - u0 * u0);
+	Vector3d n0 = perpendicularDirection(direction, g0.b);
+	Y yIn(current.getPosition() - g0.b.cross(n0) * (s0 / (qcE * g0.B)), u0);
+	FieldGeometry gIn = getFieldGeometry(yIn.x, z);
+	double invariant = s0 * s0 / ((gIn.B > 0) ? gIn.B : g0.B);
+
+	Y yOut, yErr;
+	double step = maxStep;
+	double newStep = step;
+
+	// step size control as in PropagationCK, for the errors of a 3rd order method
+	if (minStep == maxStep) {
+		tryStep(yIn, yOut, yErr, step / c_light, invariant, qcE, z);
+	} else {
+		step = clip(candidate->getNextStep(), minStep, maxStep);
+		newStep = step;
+		while (true) {
+			tryStep(yIn, yOut, yErr, step / c_light, invariant, qcE, z);
+			double r = std::max(yErr.x.getR() / step, std::fabs(yErr.u)) / tolerance;
+			if (r > 1) {
+				if (step == minStep)
+					break;
+				newStep = step * 0.95 * pow(r, -1. / 3.);
+				newStep = std::max(newStep, 0.1 * step);
+				newStep = std::max(newStep, minStep);
+				step = newStep;
+			} else {
+				if (step != maxStep) {
+					newStep = step * 0.95 * pow(r, -1. / 3.);
+					newStep = std::min(newStep, 5 * step);
+					newStep = std::min(newStep, maxStep);
+				}
+				break;
+			}
+		}
+	}
+
+	// reconstruct the particle: transport the perpendicular direction to the
+	// new field direction and advance the gyrophase by -q c B step / E
+	FieldGeometry g1 = getFieldGeometry(yOut.x, z);
+	if (g1.B == 0)
+		g1 = g0;
+	Vector3d n1 = n0;
+	Vector3d axis = g0.b.cross(g1.b);
+	if (axis.getR() > 0)
+		n1 = n1.getRotated(axis, g0.b.getAngleTo(g1.b));
+	n1 = perpendicularDirection(n1, g1.b);
+	double phase = std::fmod(-qcE * 0.5 * (g0.B + g1.B) * step, 2 * M_PI);
+	n1 = n1.getRotated(g1.b, phase);
+
+	double u1 = clip(yOut.u, -1., 1.);
+	double s1 = std::sqrt(1 - u1 * u1);
+	current.setPosition(yOut.x + g1.b.cross(n1) * (s1 / (qcE * g1.B)));
+	current.setDirection(g1.b * u1 + n1 * s1);
+	candidate->setCurrentStep(step);
+	candidate->setNextStep(newStep);
+}
+
+void PropagationGuidingCenter::setField(ref_ptr<MagneticField> f) {
+	field = f;
+	fullOrbit->setField(f);
+}
+
+void PropagationGuidingCenter::setMaximumAdiabaticity(double max) {
+	if (max <= 0)
+		throw std::runtime_error("PropagationGuidingCenter: maxAdiabaticity <= 0");
+	maxAdiabaticity = max;
+}
+
+void PropagationGuidingCenter::setTolerance(double tol) {
+	if ((tol > 1) or (tol < 0))
+		throw std::runtime_error(
+				"PropagationGuidingCenter: target error not in range 0-1");
+	tolerance = tol;
+	fullOrbit->setTolerance(tol);
+}
+
+void PropagationGuidingCenter::setMinimumStep(double min) {
+	if (min < 0)
+		throw std::runtime_error("PropagationGuidingCenter: minStep < 0 ");
+	if (min > maxStep)
+		throw std::runtime_error("PropagationGuidingCenter: minStep > maxStep");
+	minStep = min;
+	fullOrbit->setMinimumStep(min);
+}
+
+void PropagationGuidingCenter::setMaximumStep(double max) {
+	if (max < minStep)
+		throw std::runtime_error("PropagationGuidingCenter: maxStep < minStep");
+	maxStep = max;
+	fullOrbit->setMaximumStep(max);
+}
+
+ref_ptr<MagneticField> PropagationGuidingCenter::getField() const {
+	return field;
+}
+
+double PropagationGuidingCenter::getMaximumAdiabaticity() const {
+	return maxAdiabaticity;
+}
+
+double PropagationGuidingCenter::getTolerance() const {
+	return tolerance;
+}
+
+double PropagationGuidingCenter::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationGuidingCenter::getMaximumStep() const {
+	return maxStep;
+}
+
+size_t PropagationGuidingCenter::getSizeOf() const {
+	return field.valid() ? field->getSizeOf() : 0;
+}
+
+std::string PropagationGuidingCenter::getDescription() const {
+	std::stringstream s;
+	s << "Propagation in magnetic fields using the guiding centre approximation.";
+	s << " Maximum adiabaticity: " << maxAdiabaticity;
+	s << ", Target error: " << tolerance;
+	s << ", Minimum Step: " << minStep / kpc << " kpc";
+	s << ", Maximum Step: " << maxStep / kpc << " kpc";
+	return s.str();
+}
+
+} // namespace crpropa
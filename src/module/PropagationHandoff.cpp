@@ -0,0 +1,91 @@
+#include "crpropa/module/PropagationHandoff.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+PropagationHandoff::PropagationHandoff(Module *propagation, Surface *region,
+		Vector3d observerCenter, double observerRadius, double minStep, double maxStep) :
+		propagation(propagation), region(region), observerCenter(observerCenter),
+		observerRadius(observerRadius), minStep(minStep), maxStep(maxStep) {
+	if (minStep > maxStep)
+		throw std::runtime_error("PropagationHandoff: minStep > maxStep");
+}
+
+bool PropagationHandoff::isHandedOff(const Candidate *candidate) const {
+	Vector3d pos = candidate->current.getPosition();
+	if (region->distance(pos) <= 0)
+		return false;
+	return candidate->current.getDirection().dot(region->normal(pos)) >= 0;
+}
+
+double PropagationHandoff::distanceToObserver(const Candidate *candidate) const {
+	// |q + t d| = R for the position q relative to the center and the direction d
+	Vector3d q = candidate->current.getPosition() - observerCenter;
+	double b = q.dot(candidate->current.getDirection());
+	double c = q.getR2() - observerRadius * observerRadius;
+	double discriminant = b * b - c;
+	if (discriminant < 0)
+		return -1;
+	if (c < 0)
+		return -b + std::sqrt(discriminant); // inside, leaving the sphere
+	if (b < 0)
+		return -b - std::sqrt(discriminant); // outside, entering the sphere
+	return -1;
+}
+
+void PropagationHandoff::process(Candidate *candidate) const {
+	if (not isHandedOff(candidate)) {
+		propagation->process(candidate);
+		return;
+	}
+
+	candidate->previous = candidate->current;
+	double step = clip(candidate->getNextStep(), minStep, maxStep);
+	double hit = distanceToObserver(candidate);
+	// end just behind the observer sphere, so that it detects the crossing
+	if (hit >= 0 and hit < step)
+		step = hit + 1e-12 * observerRadius;
+	candidate->setCurrentStep(step);
+	Vector3d pos = candidate->current.getPosition();
+	Vector3d dir = candidate->current.getDirection();
+	candidate->current.setPosition(pos + dir * step);
+	candidate->setNextStep(maxStep);
+}
+
+void PropagationHandoff::setMinimumStep(double step) {
+	if (step > maxStep)
+		throw std::runtime_error("PropagationHandoff: minStep > maxStep");
+	minStep = step;
+}
+
+void PropagationHandoff::setMaximumStep(double step) {
+	if (minStep > step)
+		throw std::runtime_error("PropagationHandoff: minStep > maxStep");
+	maxStep = step;
+}
+
+double PropagationHandoff::getMinimumStep() const {
+	return minStep;
+}
+
+double PropagationHandoff::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string PropagationHandoff::getDescription() const {
+	std::stringstream s;
+	s << "PropagationHandoff: rectilinear outside of " << region->getDescription()
+			<< " towards the observer sphere at " << observerCenter / Mpc << " Mpc, radius "
+			<< observerRadius / Mpc << " Mpc, step size " << minStep / kpc << " - "
+			<< maxStep / kpc << " kpc\n  inside: " << propagation->getDescription();
+	return s.str();
+}
+
+size_t PropagationHandoff::getSizeOf() const {
+	return propagation->getSizeOf();
+}
+
+} // namespace crpropa
@@ -0,0 +1,90 @@
+#include "crpropa/module/PropagationJump.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+PropagationJump::PropagationJump(Module *propagation, double maxStep) :
+		propagation(propagation), maxStep(maxStep) {
+	if (maxStep <= 0)
+		throw std::runtime_error("PropagationJump: maxStep <= 0");
+	int neutrinos[] = {12, 14, 16};
+	for (size_t i = 0; i < 3; i++) {
+		ids.insert(neutrinos[i]);
+		ids.insert(-neutrinos[i]);
+	}
+}
+
+bool PropagationJump::isJumping(const Candidate *candidate) const {
+	return ids.count(candidate->current.getId()) > 0;
+}
+
+double PropagationJump::distanceToSurfaces(const Candidate *candidate) const {
+	Vector3d pos = candidate->current.getPosition();
+	Vector3d dir = candidate->current.getDirection();
+	double step = maxStep;
+	for (size_t i = 0; i < surfaces.size(); i++)
+		step = std::min(step, surfaces[i]->rayDistance(pos, dir, step));
+	return step;
+}
+
+void PropagationJump::process(Candidate *candidate) const {
+	if (not isJumping(candidate)) {
+		propagation->process(candidate);
+		return;
+	}
+
+	candidate->previous = candidate->current;
+	Vector3d pos = candidate->current.getPosition();
+	Vector3d dir = candidate->current.getDirection();
+	double step = distanceToSurfaces(candidate);
+	// end just behind the surface, so that its crossing is detected
+	if (step < maxStep)
+		step = std::min(step + 1e-12 * (step + pos.getR()), maxStep);
+	candidate->setCurrentStep(step);
+	candidate->current.setPosition(pos + dir * step);
+	candidate->setNextStep(maxStep);
+}
+
+void PropagationJump::addSurface(Surface *surface) {
+	surfaces.push_back(surface);
+}
+
+void PropagationJump::addParticleId(int id) {
+	ParticleState p;
+	p.setId(id);
+	if (p.getCharge() != 0)
+		throw std::runtime_error("PropagationJump: particle is charged");
+	ids.insert(id);
+}
+
+void PropagationJump::clearParticleIds() {
+	ids.clear();
+}
+
+void PropagationJump::setMaximumStep(double step) {
+	if (step <= 0)
+		throw std::runtime_error("PropagationJump: maxStep <= 0");
+	maxStep = step;
+}
+
+double PropagationJump::getMaximumStep() const {
+	return maxStep;
+}
+
+std::string PropagationJump::getDescription() const {
+	std::stringstream s;
+	s << "PropagationJump: single steps of up to " << maxStep / Mpc << " Mpc to "
+			<< surfaces.size() << " surfaces for the particles";
+	for (std::set<int>::const_iterator i = ids.begin(); i != ids.end(); ++i)
+		s << " " << *i;
+	s << "\n  other: " << propagation->getDescription();
+	return s.str();
+}
+
+size_t PropagationJump::getSizeOf() const {
+	return propagation->getSizeOf();
+}
+
+} // namespace crpropa
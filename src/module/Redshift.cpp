@@ -1,11 +1,37 @@
 #include "crpropa/module/Redshift.h"
 #include "crpropa/Units.h"
 #include "crpropa/Cosmology.h"
+#include "crpropa/ScratchVector.h"
 
+#include <algorithm>
 #include <limits>
 
 namespace crpropa {
 
+namespace {
+
+// redshift step dz <= z for a comoving step at redshift z > 0
+double redshiftStep(double z, double step) {
+	double dz;
+	if (z < redshiftRange()) {
+		// exact step along the tabulated comoving distance, the difference of
+		// the inverse table keeps dz >= 0 also for steps below its precision
+		double d = redshift2ComovingDistance(z);
+		if (step >= d)
+			dz = z;
+		else
+			dz = comovingDistance2Redshift(d) - comovingDistance2Redshift(d - step);
+	} else {
+		// use small step approximation:  dz = H(z) / c * ds
+		dz = hubbleRate(z) / c_light * step;
+	}
+
+	// prevent dz > z
+	return std::min(std::max(dz, 0.), z);
+}
+
+} // namespace
+
 void Redshift::process(Candidate *c) const {
 	double z = c->getRedshift();
 
@@ -13,11 +39,7 @@ void Redshift::process(Candidate *c) const {
 	if (z <= std::numeric_limits<double>::min())
 		return;
 
-	// use small step approximation:  dz = H(z) / c * ds
-	double dz = hubbleRate(z) / c_light * c->getCurrentStep();
-
-	// prevent dz > z
-	dz = std::min(dz, z);
+	double dz = redshiftStep(z, c->getCurrentStep());
 
 	// update redshift
 	c->setRedshift(z - dz);
@@ -27,10 +49,29 @@ void Redshift::process(Candidate *c) const {
 	c->current.setEnergy(E * (1 - dz / (1 + z)));
 }
 
+void Redshift::processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+	size_t n = candidates.size();
+	ScratchVector<double> z(n), dz(n);
+	for (size_t i = 0; i < n; i++) {
+		z[i] = candidates[i]->getRedshift();
+		if (z[i] > std::numeric_limits<double>::min())
+			dz[i] = redshiftStep(z[i], candidates[i]->getCurrentStep());
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (dz[i] == 0)
+			continue;
+		Candidate *c = candidates[i];
+		c->setRedshift(z[i] - dz[i]);
+		c->current.setEnergy(c->current.getEnergy() * (1 - dz[i] / (1 + z[i])));
+	}
+}
+
 std::string Redshift::getDescription() const {
 	std::stringstream s;
 	s << "Redshift: h0 = " << hubbleRate() / 1e5 * Mpc << ", omegaL = "
-			<< omegaL() << ", omegaM = " << omegaM();
+			<< omegaL() << ", omegaM = " << omegaM() << ", omegaK = " << omegaK()
+			<< ", w0 = " << darkEnergyW0() << ", wa = " << darkEnergyWa();
 	return s.str();
 }
 
@@ -55,7 +96,8 @@ void FutureRedshift::process(Candidate *c) const {
 std::string FutureRedshift::getDescription() const {
 	std::stringstream s;
 	s << "FutureRedshift: h0 = " << hubbleRate() / 1e5 * Mpc << ", omegaL = "
-			<< omegaL() << ", omegaM = " << omegaM();
+			<< omegaL() << ", omegaM = " << omegaM() << ", omegaK = " << omegaK()
+			<< ", w0 = " << darkEnergyW0() << ", wa = " << darkEnergyWa();
 	return s.str();
 }
 
@@ -0,0 +1,172 @@
+#include "crpropa/module/SpectralReweighting.h"
+#include "crpropa/module/Output.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+// effective charge and mass number, at least one
+static int modelCharge(int id) {
+	return std::max(std::abs(chargeNumber(id)), 1);
+}
+
+static int modelMass(int id) {
+	return std::max(massNumber(id), 1);
+}
+
+SpectralModel::SpectralModel(double Emin, double Rmax, double index, double Rcut) :
+		Emin(Emin), Rmax(Rmax), index(index), Rcut(Rcut) {
+	if (not (Emin > 0) or not (Rmax > 0) or not std::isfinite(Rmax))
+		throw std::runtime_error("SpectralModel: invalid energy or rigidity range");
+	if (not (Rcut > 0))
+		throw std::runtime_error("SpectralModel: the cutoff rigidity has to be positive");
+}
+
+double SpectralModel::integral(int Z) const {
+	// integral of E^index over the energy range, with the cutoff
+	double Emax = Z * Rmax;
+	double Ecut = Z * Rcut;
+	double a = 1 + index;
+	double E1 = std::min(Emax, Ecut);
+	double I = 0;
+	if (E1 > Emin) {
+		if (std::abs(a) < std::numeric_limits<double>::min())
+			I = log(E1 / Emin);
+		else
+			I = (pow(E1, a) - pow(Emin, a)) / a;
+	}
+	if (Ecut < Emax) {
+		// Simpson's rule in log(E) above the cutoff
+		double x0 = log(std::max(Emin, Ecut)), x1 = log(Emax);
+		const size_t n = 2000;
+		double h = (x1 - x0) / n, sum = 0;
+		for (size_t i = 0; i <= n; i++) {
+			double E = exp(x0 + i * h);
+			double f = pow(E, a) * exp(1 - E / Ecut);
+			sum += f * ((i == 0 or i == n) ? 1 : ((i % 2) ? 4 : 2));
+		}
+		I += sum * h / 3;
+	}
+	return I;
+}
+
+void SpectralModel::normalize() {
+	factors.resize(ids.size());
+	double total = 0;
+	for (size_t i = 0; i < ids.size(); i++) {
+		factors[i] = abundances[i] * pow(modelMass(ids[i]), -(1 + index));
+		total += factors[i] * integral(modelCharge(ids[i]));
+	}
+	if (not (total > 0))
+		throw std::runtime_error("SpectralModel: the model cannot be normalized");
+	for (size_t i = 0; i < ids.size(); i++)
+		factors[i] /= total;
+}
+
+void SpectralModel::add(int id, double abundance) {
+	if (abundance < 0)
+		throw std::runtime_error("SpectralModel: negative abundance");
+	std::vector<int>::iterator it = std::find(ids.begin(), ids.end(), id);
+	if (it == ids.end()) {
+		ids.push_back(id);
+		abundances.push_back(abundance);
+	} else {
+		abundances[it - ids.begin()] += abundance;
+	}
+	normalize();
+}
+
+void SpectralModel::add(int A, int Z, double abundance) {
+	add(nucleusId(A, Z), abundance);
+}
+
+double SpectralModel::getDensity(int id, double E) const {
+	std::vector<int>::const_iterator it = std::find(ids.begin(), ids.end(), id);
+	if (it == ids.end())
+		return 0;
+	int Z = modelCharge(id);
+	if ((E < Emin) or (E > Z * Rmax))
+		return 0;
+	double f = factors[it - ids.begin()] * pow(E, index);
+	if (E > Z * Rcut)
+		f *= exp(1 - E / (Z * Rcut));
+	return f;
+}
+
+std::string SpectralModel::getDescription() const {
+	std::stringstream ss;
+	ss << "SpectralModel: E = " << Emin / EeV << " - Z*" << Rmax / EeV << " EeV, ";
+	ss << "dN/dE ~ E^" << index;
+	if (std::isfinite(Rcut))
+		ss << ", cutoff above Z*" << Rcut / EeV << " EeV";
+	ss << ", " << ids.size() << " species";
+	return ss.str();
+}
+
+// ----------------------------------------------------------------------------
+SpectralReweighting::SpectralReweighting(SpectralModel *injection) : injection(injection) {
+	if (not injection)
+		throw std::runtime_error("SpectralReweighting: no injection model");
+}
+
+void SpectralReweighting::addHypothesis(const std::string &name, SpectralModel *model) {
+	if (not model)
+		throw std::runtime_error("SpectralReweighting: no model");
+	if (std::find(names.begin(), names.end(), name) != names.end())
+		throw std::runtime_error("SpectralReweighting: hypothesis " + name + " exists already");
+	models.push_back(model);
+	names.push_back(name);
+	keys.push_back(Candidate::getPropertyKey("weight_" + name));
+}
+
+size_t SpectralReweighting::getNumberOfHypotheses() const {
+	return models.size();
+}
+
+const std::string &SpectralReweighting::getName(size_t i) const {
+	return names.at(i);
+}
+
+void SpectralReweighting::getWeights(const Candidate *c, std::vector<double> &weights) const {
+	if (not c->source.isRetained())
+		throw std::runtime_error("SpectralReweighting: the source state is not retained");
+	int id = c->source.getId();
+	double E = c->source.getEnergy();
+	double p = injection->getDensity(id, E);
+	weights.resize(models.size());
+	for (size_t i = 0; i < models.size(); i++)
+		weights[i] = (p > 0) ? c->getWeight() * models[i]->getDensity(id, E) / p : 0;
+}
+
+std::vector<double> SpectralReweighting::getWeights(const Candidate *c) const {
+	std::vector<double> weights;
+	getWeights(c, weights);
+	return weights;
+}
+
+void SpectralReweighting::enableOutput(Output *output) const {
+	for (size_t i = 0; i < names.size(); i++)
+		output->enableProperty("weight_" + names[i], Variant::fromDouble(0),
+				"weight for the source model " + names[i]);
+}
+
+void SpectralReweighting::process(Candidate *c) const {
+	std::vector<double> weights;
+	getWeights(c, weights);
+	for (size_t i = 0; i < weights.size(); i++)
+		c->setProperty(keys[i], Variant::fromDouble(weights[i]));
+}
+
+std::string SpectralReweighting::getDescription() const {
+	std::stringstream ss;
+	ss << "SpectralReweighting: " << models.size() << " hypotheses, injection "
+			<< injection->getDescription();
+	return ss.str();
+}
+
+} // namespace crpropa
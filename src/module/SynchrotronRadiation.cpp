@@ -1,7 +1,9 @@
 #include "crpropa/module/SynchrotronRadiation.h"
 #include "crpropa/Units.h"
 #include "crpropa/Random.h"
+#include "crpropa/ScratchVector.h"
 
+#include <algorithm>
 #include <fstream>
 #include <limits>
 #include <stdexcept>
@@ -13,18 +15,22 @@ SynchrotronRadiation::SynchrotronRadiation(ref_ptr<MagneticField> field, bool ha
 	setBrms(0);
 	initSpectrum();
 	setHavePhotons(havePhotons);
+	setThinning(thinning);
 	setLimit(limit);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setAggregatedSamples(0);
 }
 
 SynchrotronRadiation::SynchrotronRadiation(double Brms, bool havePhotons, double thinning, int nSamples, double limit) {
 	setBrms(Brms);
 	initSpectrum();
 	setHavePhotons(havePhotons);
+	setThinning(thinning);
 	setLimit(limit);
 	setSecondaryThreshold(1e6 * eV);
 	setMaximumSamples(nSamples);
+	setAggregatedSamples(0);
 }
 
 void SynchrotronRadiation::setField(ref_ptr<MagneticField> f) {
@@ -55,6 +61,14 @@ void SynchrotronRadiation::setThinning(double thinning) {
 	this->thinning = thinning;
 }
 
+void SynchrotronRadiation::setAdaptiveThinning(ref_ptr<AdaptiveThinning> t) {
+	adaptiveThinning = t;
+}
+
+ref_ptr<AdaptiveThinning> SynchrotronRadiation::getAdaptiveThinning() const {
+	return adaptiveThinning;
+}
+
 double SynchrotronRadiation::getThinning() {
 	return thinning;
 }
@@ -75,6 +89,14 @@ int SynchrotronRadiation::getMaximumSamples() {
 	return maximumSamples;
 }
 
+void SynchrotronRadiation::setAggregatedSamples(int n) {
+	aggregatedSamples = n;
+}
+
+int SynchrotronRadiation::getAggregatedSamples() const {
+	return aggregatedSamples;
+}
+
 void SynchrotronRadiation::setSecondaryThreshold(double threshold) {
 	secondaryThreshold = threshold;
 }
@@ -106,6 +128,13 @@ void SynchrotronRadiation::initSpectrum() {
 		infile.ignore(std::numeric_limits < std::streamsize > ::max(), '\n');
 	}
 	infile.close();
+	cdfSampler.setCDF(tabCDF);
+
+	// mean photon energy for the expected number of photons per step, x uniform in the bins
+	double sum = 0;
+	for (size_t i = 1; i < tabx.size(); i++)
+		sum += (tabCDF[i] - tabCDF[i - 1]) * (tabx[i - 1] + tabx[i]) / 2;
+	tabMeanX = (tabCDF.size() > 1) ? sum / (tabCDF.back() - tabCDF.front()) : 0;
 }
 
 void SynchrotronRadiation::process(Candidate *candidate) const {
@@ -117,7 +146,13 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	double z = candidate->getRedshift();
 	double B;
 	if (field.valid()) {
-		Vector3d Bvec = field->getField(candidate->current.getPosition(), z);
+		// shared with the other modules of the step
+		Vector3d position = candidate->current.getPosition();
+		Vector3d Bvec;
+		if (not candidate->getStepField(field, position, z, Bvec)) {
+			Bvec = field->getField(position, z);
+			candidate->setStepField(field, position, z, Bvec);
+		}
 		B = Bvec.cross(candidate->current.getDirection()).getR();
 	} else {
 		B = sqrt(2. / 3) * Brms; // average perpendicular field component
@@ -145,46 +180,87 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 	if (14 * Ecrit < secondaryThreshold)
 		return;
 
-	// draw photons up to the total energy loss
-	// if maximumSamples is reached before that, compensate the total energy afterwards
 	Random &random = Random::instance();
 	double dE0 = dE;
-	std::vector<double> energies;
-	int counter = 0;
-	while (dE > 0) {
-		// draw random value between 0 and maximum of corresponding cdf
-		// choose bin of s where cdf(x) = cdf_rand -> x_rand
-		size_t i = random.randBin(tabCDF); // draw random bin (upper bin boundary returned)
-		double binWidth = (tabx[i] - tabx[i-1]);
-		double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
-		double Ephoton = x * Ecrit;
-
-		// if the remaining energy is not sufficient check for random accepting
-		if (Ephoton > dE) {
-			if (random.rand() > (dE / Ephoton))
-				break; // not accepted
-		}
+	ScratchVector<double> energies;
+	double w1 = 1;
 
-		// only activate the "per-step" sampling if maximumSamples is explicitly set.
-		if (maximumSamples > 0) {
-			if (counter >= maximumSamples) 
-				break;			
+	if ((aggregatedSamples > 0) and (dE > aggregatedSamples * tabMeanX * Ecrit)) {
+		// aggregated mode: stratified draws from the inverse cumulative distribution
+		// weighted to the total energy loss
+		double sum = 0;
+		for (int k = 0; k < aggregatedSamples; k++) {
+			double u = (k + random.rand()) / aggregatedSamples;
+			u = tabCDF.front() + u * (tabCDF.back() - tabCDF.front());
+			size_t i = std::upper_bound(tabCDF.begin(), tabCDF.end(), u) - tabCDF.begin();
+			i = std::min(std::max(i, size_t(1)), tabCDF.size() - 1);
+			double x = tabx[i-1] + random.rand() * (tabx[i] - tabx[i-1]);
+			energies->push_back(x * Ecrit);
+			sum += x * Ecrit;
 		}
+		w1 = dE0 / sum;
+		dE = 0;
+	} else {
+		// draw photons up to the total energy loss
+		// if maximumSamples is reached before that, compensate the total energy afterwards
+		int counter = 0;
+		while (dE > 0) {
+			// draw random value between 0 and maximum of corresponding cdf
+			// choose bin of s where cdf(x) = cdf_rand -> x_rand
+			size_t i = random.randBin(cdfSampler); // draw random bin (upper bin boundary returned)
+			double binWidth = (tabx[i] - tabx[i-1]);
+			double x = tabx[i-1] + random.rand() * binWidth; // draw random x uniformly distributed in bin
+			double Ephoton = x * Ecrit;
+
+			// if the remaining energy is not sufficient check for random accepting
+			if (Ephoton > dE) {
+				if (random.rand() > (dE / Ephoton))
+					break; // not accepted
+			}
+
+			// only activate the "per-step" sampling if maximumSamples is explicitly set.
+			if (maximumSamples > 0) {
+				if (counter >= maximumSamples) 
+					break;			
+			}
 
-		// store energies in array
-		energies.push_back(Ephoton);
+			// store energies in array
+			energies->push_back(Ephoton);
 
-		// energy loss
-		dE -= Ephoton;
+			// energy loss
+			dE -= Ephoton;
 
-		// counter for sampling break condition;
-		counter++;
+			// counter for sampling break condition;
+			counter++;
+		}
+
+		// while loop before gave total energy which is just a fraction of the required
+		if (maximumSamples > 0 && dE > 0)
+			w1 = 1. / (1. - dE / dE0); 
 	}
 
-	// while loop before gave total energy which is just a fraction of the required
-	double w1 = 1;
-	if (maximumSamples > 0 && dE > 0)
-		w1 = 1. / (1. - dE / dE0); 
+	if (adaptiveThinning.valid()) {
+		// budget of the photons in proportion to their energy, before the electron keeps its share
+		for (size_t i = 0; i < energies.size(); i++) {
+			double Ephoton = energies[i];
+			if (Ephoton <= secondaryThreshold)
+				continue;
+			if (Candidate::isBelowSecondaryThreshold(22, Ephoton)) {
+				// not created, but counted as dropped energy
+				candidate->addSecondary(22, Ephoton, w1, interactionTagCode);
+				continue;
+			}
+			double b;
+			double w = w1 * adaptiveThinning->sample(candidate, w1 * Ephoton / E, b);
+			if (w == 0)
+				continue;
+			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
+			if (candidate->addSecondary(22, Ephoton, pos, w, interactionTagCode))
+				adaptiveThinning->setSecondaryBudget(candidate, b);
+		}
+		adaptiveThinning->keep(candidate, (E - dE0) / E);
+		return;
+	}
 
 	// loop over sampled photons and attribute weights accordingly
 	for (int i = 0; i < energies.size(); i++) {
@@ -196,7 +272,7 @@ void SynchrotronRadiation::process(Candidate *candidate) const {
 		if (random.rand() < pow(f, thinning)) {
 			Vector3d pos = random.randomInterpolatedPosition(candidate->previous.getPosition(), candidate->current.getPosition());
 			if (Ephoton > secondaryThreshold) // create only photons with energies above threshold
-				candidate->addSecondary(22, Ephoton, pos, w, interactionTag);
+				candidate->addSecondary(22, Ephoton, pos, w, interactionTagCode);
 		}
 	}
 }
@@ -212,7 +288,9 @@ std::string SynchrotronRadiation::getDescription() const {
 		s << ", synchrotron photons E > " << secondaryThreshold / eV << " eV";
 	else
 		s << ", no synchrotron photons";
-	if (maximumSamples > 0)
+	if (aggregatedSamples > 0)
+		s << ", aggregated photon samples: " << aggregatedSamples;
+	else if (maximumSamples > 0)
 		s << "maximum number of photon samples: " << maximumSamples;
 	if (thinning > 0)
 		s << "thinning parameter: " << thinning; 
@@ -221,10 +299,15 @@ std::string SynchrotronRadiation::getDescription() const {
 
 void SynchrotronRadiation::setInteractionTag(std::string tag) {
 	interactionTag = tag;
+	interactionTagCode = Candidate::getTagCode(tag);
 }
 
 std::string SynchrotronRadiation::getInteractionTag() const {
 	return interactionTag;
 }
 
+size_t SynchrotronRadiation::getSizeOf() const {
+	return vectorSizeOf(tabx) + vectorSizeOf(tabCDF);
+}
+
 } // namespace crpropa
@@ -1,5 +1,6 @@
 #include "crpropa/module/TextOutput.h"
 #include "crpropa/module/ParticleCollector.h"
+#include "crpropa/Checkpoint.h"
 #include "crpropa/Units.h"
 #include "crpropa/Version.h"
 #include "crpropa/Random.h"
@@ -7,10 +8,19 @@
 
 #include "kiss/string.h"
 
+#include <cmath>
 #include <cstdio>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <iostream>
 
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #ifdef CRPROPA_HAVE_ZLIB
 #include <izstream.hpp>
 #include <ozstream.hpp>
@@ -18,32 +28,158 @@
 
 namespace crpropa {
 
-TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false) {
+// size of the blocks in which the lines of a thread are written
+static const size_t LINE_BLOCK_SIZE = 64 * 1024;
+
+static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+		1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+		1e20, 1e21, 1e22};
+
+static size_t threadCount() {
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+// x * 10^n with exactly representable powers, at most 16 roundings
+static double scaleByPowerOf10(double x, int n) {
+	for (; n > 22; n -= 22)
+		x *= 1e22;
+	for (; n < -22; n += 22)
+		x /= 1e22;
+	return (n >= 0) ? x * powersOf10[n] : x / powersOf10[-n];
+}
+
+// append x as printf("%.5E") would, independent of the locale
+static void appendScientific(std::string &line, double x) {
+	char buffer[32];
+	if (not std::isfinite(x)) {
+		std::snprintf(buffer, sizeof(buffer), "%.5E", x);
+		line.append(buffer);
+		return;
+	}
+
+	char *p = buffer;
+	if (std::signbit(x))
+		*p++ = '-';
+	double a = std::fabs(x);
+	int exponent = 0;
+	uint64_t mantissa = 0;
+	if (a > 0) {
+		// six significant digits: 1e5 <= s < 1e6
+		exponent = (int)std::floor(std::log10(a));
+		double s = scaleByPowerOf10(a, 5 - exponent);
+		if (s < 1e5) {
+			exponent--;
+			s = scaleByPowerOf10(a, 5 - exponent);
+		} else if (s >= 1e6) {
+			exponent++;
+			s = scaleByPowerOf10(a, 5 - exponent);
+		}
+		double digits = std::floor(s);
+		double fraction = s - digits;
+		if (std::fabs(fraction - 0.5) < 1e-6) {
+			// the rounding error of s may decide the last digit
+			int n = std::snprintf(buffer, sizeof(buffer), "%.5E", x);
+			buffer[std::signbit(x) ? 2 : 1] = '.'; // decimal point of the locale
+			line.append(buffer, n);
+			return;
+		}
+		mantissa = (uint64_t)digits + (fraction > 0.5 ? 1 : 0);
+		if (mantissa == 1000000) {
+			mantissa = 100000;
+			exponent++;
+		}
+	}
+
+	char digits[6];
+	for (int i = 5; i >= 0; i--) {
+		digits[i] = '0' + mantissa % 10;
+		mantissa /= 10;
+	}
+	*p++ = digits[0];
+	*p++ = '.';
+	for (int i = 1; i < 6; i++)
+		*p++ = digits[i];
+	*p++ = 'E';
+	*p++ = (exponent < 0) ? '-' : '+';
+	unsigned int e = std::abs(exponent);
+	if (e >= 100)
+		*p++ = '0' + e / 100;
+	*p++ = '0' + (e / 10) % 10;
+	*p++ = '0' + e % 10;
+	line.append(buffer, p - buffer);
+}
+
+// append the value right aligned in a field of the given width, as %10lu
+static void appendInteger(std::string &line, uint64_t value, bool negative = false, size_t width = 10) {
+	char buffer[24];
+	char *end = buffer + sizeof(buffer), *p = end;
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	if (negative)
+		*--p = '-';
+	if ((size_t)(end - p) < width)
+		line.append(width - (end - p), ' ');
+	line.append(p, end - p);
+}
+
+// as %10i
+static void appendInteger(std::string &line, int value) {
+	uint64_t magnitude = (value < 0) ? -(int64_t)value : value;
+	appendInteger(line, magnitude, value < 0);
+}
+
+static void appendColumn(std::string &line, double x) {
+	appendScientific(line, x);
+	line.push_back('\t');
+}
+
+static void appendColumn(std::string &line, const Vector3d &v) {
+	appendColumn(line, v.x);
+	appendColumn(line, v.y);
+	appendColumn(line, v.z);
 }
 
-TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false) {
+TextOutput::TextOutput() : Output(), out(&std::cout), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
 }
 
-TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false) {
+TextOutput::TextOutput(OutputType outputtype) : Output(outputtype), out(&std::cout), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
+}
+
+TextOutput::TextOutput(std::ostream &out) : Output(), out(&out), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
 }
 
 TextOutput::TextOutput(std::ostream &out,
-		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false) {
+		OutputType outputtype) : Output(outputtype), out(&out), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
 }
 
-TextOutput::TextOutput(const std::string &filename) :  Output(), outfile(filename.c_str(),
-				std::ios::binary), out(&outfile),  filename(
-				filename), storeRandomSeeds(false) {
-	if (!outfile.is_open())
-		throw std::runtime_error(std::string("Cannot create file: ") + filename);
-	if (kiss::ends_with(filename, ".gz"))
-		gzip();
+TextOutput::TextOutput(const std::string &filename) :  Output(), out(&outfile),
+				filename(filename), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
+	openFile();
 }
 
 TextOutput::TextOutput(const std::string &filename,
-				OutputType outputtype) : Output(outputtype), outfile(filename.c_str(),
-				std::ios::binary), out(&outfile), filename(
-				filename), storeRandomSeeds(false) {
+				OutputType outputtype) : Output(outputtype), out(&outfile),
+				filename(filename), storeRandomSeeds(false), lineBuffers(threadCount()), headerWritten(false), resumeCount(0) {
+	openFile();
+}
+
+void TextOutput::openFile() {
+	size_t offset, n;
+	if (Checkpoint::getRestart(filename, offset, n)) {
+		// continue the file of an interrupted run after its last checkpoint
+		if (truncate(filename.c_str(), offset) != 0)
+			throw std::runtime_error(std::string("Cannot resume file: ") + filename);
+		outfile.open(filename.c_str(), std::ios::binary | std::ios::app);
+		resumeCount = n;
+	} else {
+		outfile.open(filename.c_str(), std::ios::binary);
+	}
 	if (!outfile.is_open())
 		throw std::runtime_error(std::string("Cannot create file: ") + filename);
 	if (kiss::ends_with(filename, ".gz"))
@@ -157,132 +293,201 @@ void TextOutput::printHeader() const {
 }
 
 void TextOutput::process(Candidate *c) const {
+	if (const Output *shard = getShard()) {
+		shard->process(c);
+		return;
+	}
 	if (fields.none() && properties.empty())
 		return;
+	checkRetention(c);
 
-	char buffer[1024];
-	size_t p = 0;
-
-	std::locale old_locale = std::locale::global(std::locale::classic());
+	size_t tid = 0;
+	bool parallel = false;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+	parallel = omp_in_parallel();
+#endif
+	std::string other;
+	// more threads than at construction write their lines directly
+	std::string &line = (tid < lineBuffers.size()) ? lineBuffers[tid] : other;
 
 	if (fields.test(TrajectoryLengthColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->getTrajectoryLength() / lengthScale);
+		appendColumn(line, c->getTrajectoryLength() / lengthScale);
 
 	if (fields.test(RedshiftColumn))
-		p += std::sprintf(buffer + p, "%1.5E\t", c->getRedshift());
+		appendColumn(line, c->getRedshift());
 
-	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getSerialNumber());
-	if (fields.test(CurrentIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->current.getId());
+	if (fields.test(SerialNumberColumn)) {
+		appendInteger(line, c->getSerialNumber());
+		line.push_back('\t');
+	}
+	if (fields.test(CurrentIdColumn)) {
+		appendInteger(line, c->current.getId());
+		line.push_back('\t');
+	}
 	if (fields.test(CurrentEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->current.getEnergy() / energyScale);
+		appendColumn(line, c->current.getEnergy() / energyScale);
 	if (fields.test(CurrentPositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->current.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->current.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(CurrentDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->current.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (oneDimensional)
+			appendColumn(line, c->current.getPosition().x / lengthScale);
+		else
+			appendColumn(line, c->current.getPosition() / lengthScale);
 	}
+	if (fields.test(CurrentDirectionColumn) and not oneDimensional)
+		appendColumn(line, c->current.getDirection());
 
-	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t", c->getSourceSerialNumber());
-	if (fields.test(SourceIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->source.getId());
+	if (fields.test(SerialNumberColumn)) {
+		appendInteger(line, c->getSourceSerialNumber());
+		line.push_back('\t');
+	}
+	if (fields.test(SourceIdColumn)) {
+		appendInteger(line, c->source.getId());
+		line.push_back('\t');
+	}
 	if (fields.test(SourceEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->source.getEnergy() / energyScale);
+		appendColumn(line, c->source.getEnergy() / energyScale);
 	if (fields.test(SourcePositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->source.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->source.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+		if (oneDimensional)
+			appendColumn(line, c->source.getPosition().x / lengthScale);
+		else
+			appendColumn(line, c->source.getPosition() / lengthScale);
 	}
-	if (fields.test(SourceDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->source.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
+	if (fields.test(SourceDirectionColumn) and not oneDimensional)
+		appendColumn(line, c->source.getDirection());
 
+	if (fields.test(SerialNumberColumn)) {
+		appendInteger(line, c->getCreatedSerialNumber());
+		line.push_back('\t');
+	}
+	if (fields.test(CreatedIdColumn)) {
+		appendInteger(line, c->created.getId());
+		line.push_back('\t');
 	}
-
-	if (fields.test(SerialNumberColumn))
-		p += std::sprintf(buffer + p, "%10lu\t",
-				c->getCreatedSerialNumber());
-	if (fields.test(CreatedIdColumn))
-		p += std::sprintf(buffer + p, "%10i\t", c->created.getId());
 	if (fields.test(CreatedEnergyColumn))
-		p += std::sprintf(buffer + p, "%8.5E\t",
-				c->created.getEnergy() / energyScale);
+		appendColumn(line, c->created.getEnergy() / energyScale);
 	if (fields.test(CreatedPositionColumn)) {
-		if (oneDimensional) {
-			p += std::sprintf(buffer + p, "%8.5E\t",
-					c->created.getPosition().x / lengthScale);
-		} else {
-			const Vector3d pos = c->created.getPosition() / lengthScale;
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(CreatedDirectionColumn)) {
-		if (not oneDimensional) {
-			const Vector3d pos = c->created.getDirection();
-			p += std::sprintf(buffer + p, "%8.5E\t%8.5E\t%8.5E\t", pos.x, pos.y,
-					pos.z);
-		}
-	}
-	if (fields.test(WeightColumn)) {
-		p += std::sprintf(buffer + p, "%8.5E\t", c->getWeight());
+		if (oneDimensional)
+			appendColumn(line, c->created.getPosition().x / lengthScale);
+		else
+			appendColumn(line, c->created.getPosition() / lengthScale);
 	}
+	if (fields.test(CreatedDirectionColumn) and not oneDimensional)
+		appendColumn(line, c->created.getDirection());
+	if (fields.test(WeightColumn))
+		appendColumn(line, c->getWeight());
 	if (fields.test(CandidateTagColumn)) {
-		p += std::sprintf(buffer + p, "%s\t", c->getTagOrigin().c_str());
+		line.append(c->getTagOrigin());
+		line.push_back('\t');
 	}
 
 	for(std::vector<Output::Property>::const_iterator iter = properties.begin();
 			iter != properties.end(); ++iter)
 	{
 		  Variant v;
-			if (c->hasProperty((*iter).name))
+			if (c->hasProperty((*iter).key))
 			{
-				v = c->getProperty((*iter).name);
+				v = c->getProperty((*iter).key);
 			}
 			else
 			{
 				v = (*iter).defaultValue;
 			}
-			p += std::sprintf(buffer + p, "%s", v.toString().c_str());
-			p += std::sprintf(buffer + p, "\t");
+			line.append(v.toString());
+			line.push_back('\t');
 	}
-	buffer[p - 1] = '\n';
+	line[line.size() - 1] = '\n';
 
-	std::locale::global(old_locale);
+#pragma omp atomic
+	count++;
 
+	if (exclusive) {
+		// a shard is written by its thread only
+		if (&line == &other or line.size() >= LINE_BLOCK_SIZE)
+			writeLines(line);
+		return;
+	}
+	if (&line != &other and (isHeld(tid) or (parallel and line.size() < LINE_BLOCK_SIZE)))
+		return;
 #pragma omp critical
 	{
-		if (count == 0)
-			printHeader();
-		Output::process(c);
-		out->write(buffer, p);
+		// keep the order of the lines written outside of parallel regions
+		if (not parallel)
+			flush();
+		writeLines(line);
+	}
+}
+
+void TextOutput::writeLines(std::string &lines) const {
+	if (lines.empty())
+		return;
+	if (not headerWritten) {
+		headerWritten = true;
+		// a continued file already has its header
+		if (resumeCount > 0) {
+#pragma omp atomic
+			count += resumeCount;
+		} else {
+			submit(std::bind(&TextOutput::printHeader, this));
+		}
+	}
+	if (isAsynchronous()) {
+		batch.append(lines);
+		if (batch.size() >= LINE_BLOCK_SIZE)
+			submitBatch();
+	} else {
+		out->write(lines.data(), lines.size());
 	}
+	lines.clear();
+}
 
+void TextOutput::holdPrimary(uint64_t index, size_t thread) const {
+	if (thread < lineBuffers.size() and not lineBuffers[thread].empty())
+		heldLines[index].swap(lineBuffers[thread]);
+}
+
+void TextOutput::writePrimary(uint64_t index) const {
+	std::map<uint64_t, std::string>::iterator i = heldLines.find(index);
+	if (i == heldLines.end())
+		return;
+	writeLines(i->second);
+	heldLines.erase(i);
+}
+
+void TextOutput::flush() const {
+	for (size_t i = 0; i < lineBuffers.size(); i++)
+		writeLines(lineBuffers[i]);
+	for (size_t i = 0; i < shards.size(); i++)
+		if (shards[i])
+			static_cast<TextOutput *>(shards[i].get())->flush();
+}
+
+void TextOutput::endRun() {
+#pragma omp critical
+	{
+		flush();
+		submitBatch();
+	}
+	drain();
+	if (out)
+		out->flush();
+}
+
+Output *TextOutput::createShard(size_t index) const {
+	if (filename.empty())
+		throw std::runtime_error("TextOutput: shards require an output file");
+	TextOutput *shard = new TextOutput(shardFilename(filename, index));
+	configureShard(shard);
+	shard->storeRandomSeeds = storeRandomSeeds;
+	return shard;
+}
+
+void TextOutput::submitBatch() const {
+	if (batch.empty())
+		return;
+	std::shared_ptr<std::string> data = std::make_shared<std::string>();
+	data->swap(batch);
+	std::ostream *stream = out;
+	submit([stream, data]() { stream->write(data->data(), data->size()); });
 }
 
 void TextOutput::load(const std::string &filename, ParticleCollector *collector){
@@ -354,11 +559,100 @@ void TextOutput::load(const std::string &filename, ParticleCollector *collector)
 	infile.close();
 }
 
+size_t TextOutput::checkpoint(std::string &name) {
+	if (sharded)
+		throw std::runtime_error("TextOutput: checkpoints are not supported with shards");
+	if (filename.empty() or kiss::ends_with(filename, ".gz"))
+		throw std::runtime_error("TextOutput: checkpoints require an uncompressed output file");
+#pragma omp critical
+	{
+		flush();
+		submitBatch();
+	}
+	drain();
+	outfile.flush();
+	outfile.seekp(0, std::ios::end);
+	name = filename;
+	return outfile.tellp();
+}
+
+size_t TextOutput::mergeShards(const std::string &index, const std::string &filename, bool removeShards) {
+	std::ifstream in(index.c_str());
+	if (not in.good())
+		throw std::runtime_error("TextOutput: could not open file " + index);
+	std::string directory = index.substr(0, index.rfind('/') + 1);
+	std::vector<std::string> files;
+	std::string line;
+	while (std::getline(in, line)) {
+		std::stringstream stream(line);
+		std::string comment, keyword, name;
+		if ((stream >> comment >> keyword >> name) and comment == "#" and keyword == "shard")
+			files.push_back(directory + name);
+	}
+	in.close();
+
+	size_t rows = concatenate(files, filename);
+	if (removeShards) {
+		for (size_t i = 0; i < files.size(); i++)
+			std::remove(files[i].c_str());
+		if (index != filename)
+			std::remove(index.c_str());
+	}
+	return rows;
+}
+
+size_t TextOutput::concatenate(const std::vector<std::string> &files, const std::string &filename) {
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (not out.good())
+		throw std::runtime_error("TextOutput: could not create file " + filename);
+	size_t rows = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		if (kiss::ends_with(files[i], ".gz"))
+			throw std::runtime_error("TextOutput: cannot concatenate compressed file " + files[i]);
+		std::ifstream in(files[i].c_str(), std::ios::binary);
+		if (not in.good())
+			throw std::runtime_error("TextOutput: could not open file " + files[i]);
+		// the header of the first file is sufficient
+		std::string line;
+		bool header = (i > 0);
+		while (std::getline(in, line)) {
+			bool comment = (not line.empty() and line[0] == '#');
+			if (header and comment)
+				continue;
+			header = false;
+			out << line << "\n";
+			if (not comment and not line.empty())
+				rows++;
+		}
+	}
+	return rows;
+}
+
+size_t TextOutput::getSizeOf() const {
+	size_t size = Output::getSizeOf() + batch.capacity() + vectorSizeOf(lineBuffers);
+	for (size_t i = 0; i < lineBuffers.size(); i++)
+		size += lineBuffers[i].capacity();
+	for (std::map<uint64_t, std::string>::const_iterator it = heldLines.begin();
+			it != heldLines.end(); ++it)
+		size += sizeof(*it) + it->second.capacity();
+	return size;
+}
+
 std::string TextOutput::getDescription() const {
 	return "TextOutput";
 }
 
 void TextOutput::close() {
+	flush();
+	submitBatch();
+	drain();
+	if (not shards.empty()) {
+		std::vector<std::pair<size_t, size_t> > rows = releaseShards();
+		std::string name = filename.substr(filename.rfind('/') + 1);
+		for (size_t i = 0; i < rows.size(); i++)
+			*out << "# shard " << shardFilename(name, rows[i].first) << " "
+					<< rows[i].second << "\n";
+	}
 #ifdef CRPROPA_HAVE_ZLIB
 	zstream::ogzstream *zs = dynamic_cast<zstream::ogzstream *>(out);
 	if (zs) {
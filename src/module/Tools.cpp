@@ -1,63 +1,527 @@
 #include "crpropa/module/Tools.h"
-#include "crpropa/Clock.h"
+#include "crpropa/Units.h"
 
+#include "kiss/logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 using namespace std;
 
 namespace crpropa {
 
+const size_t PerformanceModule::histogramBins;
+const size_t PerformanceModule::hardwareEvents;
+
+namespace {
+
+// hardware counters of the calling thread, opened and read as one group
+class HardwareCounterGroup {
+	int fds[PerformanceModule::hardwareEvents];
+public:
+	HardwareCounterGroup() {
+		for (size_t i = 0; i < PerformanceModule::hardwareEvents; i++)
+			fds[i] = -1;
+	}
+
+	~HardwareCounterGroup() {
+		close();
+	}
+
+	bool open() {
+#ifdef __linux__
+		static const uint64_t configs[PerformanceModule::hardwareEvents] = {
+				PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+				PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+		for (size_t i = 0; i < PerformanceModule::hardwareEvents; i++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.read_format = PERF_FORMAT_GROUP;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			// this thread on any cpu, the first event leads the group
+			fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+					(i == 0) ? -1 : fds[0], 0);
+			if (fds[i] < 0) {
+				close();
+				return false;
+			}
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void close() {
+		for (size_t i = 0; i < PerformanceModule::hardwareEvents; i++) {
+			if (fds[i] >= 0)
+				::close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+
+	bool isOpen() const {
+		return fds[0] >= 0;
+	}
+
+	// counts since the opening, in the order of HardwareEvent
+	bool read(uint64_t *values) const {
+		uint64_t data[1 + PerformanceModule::hardwareEvents];
+		if (::read(fds[0], data, sizeof(data)) != (ssize_t) sizeof(data)
+				or data[0] != PerformanceModule::hardwareEvents)
+			return false;
+		memcpy(values, data + 1, sizeof(data) - sizeof(data[0]));
+		return true;
+	}
+};
+
+} // namespace
+
+struct PerformanceModule::ThreadCounters {
+	struct Counters {
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> time; ///< in ns
+		std::atomic<uint64_t> histogram[histogramBins];
+		std::atomic<uint64_t> events[hardwareEvents];
+	};
+
+	std::atomic<uint64_t> steps;
+	std::vector<Counters> modules;
+	HardwareCounterGroup hardware; ///< opened if the hardware events are counted
+	char padding[64]; ///< keeps the counters of different threads on separate cache lines
+
+	ThreadCounters(size_t n) : modules(n) {
+		steps = 0;
+		for (size_t i = 0; i < n; i++) {
+			modules[i].calls = 0;
+			modules[i].time = 0;
+			for (size_t j = 0; j < histogramBins; j++)
+				modules[i].histogram[j] = 0;
+			for (size_t j = 0; j < hardwareEvents; j++)
+				modules[i].events[j] = 0;
+		}
+	}
+};
+
+// ids of the PerformanceModule instances
+static std::atomic<uint64_t> performanceModuleInstances(0);
+
+// each counter has a single writer, no atomic read-modify-write needed
+static inline void increment(std::atomic<uint64_t> &counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static inline uint64_t nanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline size_t histogramBin(uint64_t ns) {
+	size_t bin = 0;
+	while ((ns >>= 1) and (bin + 1 < PerformanceModule::histogramBins))
+		bin++;
+	return bin;
+}
+
+static std::string escapeJSON(const std::string &s) {
+	std::stringstream ss;
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' or s[i] == '\\')
+			ss << '\\' << s[i];
+		else if (s[i] == '\n')
+			ss << "\\n";
+		else if (s[i] == '\t')
+			ss << "\\t";
+		else
+			ss << s[i];
+	}
+	return ss.str();
+}
+
+PerformanceModule::PerformanceModule() : instance(++performanceModuleInstances),
+		hardwareCounters(false) {
+}
+
 PerformanceModule::~PerformanceModule() {
+	uint64_t steps = getSteps();
 	double total = 0;
+	for (size_t i = 0; i < modules.size(); i++)
+		total += getTime(i);
+	cout << "Performance for " << steps << " calls:" << endl;
 	for (size_t i = 0; i < modules.size(); i++) {
-		_module_info &m = modules[i];
-		total += m.time;
+		double time = getTime(i);
+		double fraction = (total > 0) ? time / total : 0;
+		double perCall = (steps > 0) ? time / steps : 0;
+		cout << " - " << floor((1000 * fraction) + 0.5) / 10 << "% -> "
+				<< modules[i]->getDescription() << ": " << perCall * 1e6
+				<< " us" << endl;
+		uint64_t cycles = getHardwareCount(i, Cycles);
+		if (hardwareCounters and cycles > 0) {
+			uint64_t calls = std::max(getCalls(i), (uint64_t) 1);
+			cout << "   " << double(getHardwareCount(i, Instructions)) / cycles
+					<< " instructions/cycle, " << cycles / calls << " cycles, "
+					<< getHardwareCount(i, CacheMisses) / calls << " cache misses, "
+					<< getHardwareCount(i, BranchMisses) / calls
+					<< " branch misses per call" << endl;
+		}
 	}
-	cout << "Performance for " << calls << " calls:" << endl;
-	for (size_t i = 0; i < modules.size(); i++) {
-		_module_info &m = modules[i];
-		cout << " - " << floor((1000 * m.time / total) + 0.5) / 10 << "% -> "
-				<< m.module->getDescription() << ": " << (m.time / calls)
-				<< endl;
+	clearCounters();
+}
+
+PerformanceModule::ThreadCounters *PerformanceModule::getThreadCounters() const {
+	// counters of the calling thread, by instance
+	static thread_local std::vector<std::pair<uint64_t, ThreadCounters *> > cache;
+	for (size_t i = 0; i < cache.size(); i++)
+		if (cache[i].first == instance)
+			return cache[i].second;
+
+	ThreadCounters *counters = new ThreadCounters(modules.size());
+	if (hardwareCounters and not counters->hardware.open())
+		KISS_LOG_WARNING << "PerformanceModule: cannot open the hardware counters";
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threadCounters.push_back(counters);
 	}
+	cache.push_back(std::make_pair(instance, counters));
+	return counters;
+}
+
+void PerformanceModule::clearCounters() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < threadCounters.size(); i++)
+		delete threadCounters[i];
+	threadCounters.clear();
+	// the threads allocate new counters on the next call
+	instance = ++performanceModuleInstances;
 }
 
 void PerformanceModule::add(Module *module) {
-	_module_info info;
-	info.module = module;
-	info.time = 0;
-	modules.push_back(info);
+	clearCounters();
+	modules.push_back(module);
 }
 
 void PerformanceModule::process(Candidate *candidate) const {
-	vector<double> times(modules.size());
+	ThreadCounters *counters = getThreadCounters();
+	increment(counters->steps, 1);
+	// the events between the calls are read once for the one before and after
+	bool hardware = counters->hardware.isOpen();
+	uint64_t events[2][hardwareEvents];
+	if (hardware)
+		hardware = counters->hardware.read(events[0]);
 	for (size_t i = 0; i < modules.size(); i++) {
-		_module_info &m = modules[i];
-		double start = Clock::getInstance().getMillisecond();
-		m.module->process(candidate);
-		double end = Clock::getInstance().getMillisecond();
-		times[i] = end - start;
+		uint64_t start = nanoseconds();
+		modules[i]->process(candidate);
+		uint64_t time = nanoseconds() - start;
+
+		ThreadCounters::Counters &c = counters->modules[i];
+		increment(c.calls, 1);
+		increment(c.time, time);
+		increment(c.histogram[histogramBin(time)], 1);
+		if (hardware) {
+			const uint64_t *before = events[i % 2];
+			uint64_t *after = events[(i + 1) % 2];
+			hardware = counters->hardware.read(after);
+			for (size_t j = 0; hardware and j < hardwareEvents; j++)
+				increment(c.events[j], after[j] - before[j]);
+		}
 	}
+}
 
-#pragma omp critical
-	{
-		for (size_t i = 0; i < modules.size(); i++) {
-			_module_info &m = modules[i];
-			m.time += times[i];
+size_t PerformanceModule::size() const {
+	return modules.size();
+}
+
+uint64_t PerformanceModule::getSteps() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t steps = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		steps += threadCounters[t]->steps.load(std::memory_order_relaxed);
+	return steps;
+}
+
+uint64_t PerformanceModule::getCalls(size_t i) const {
+	if (i >= modules.size())
+		throw std::runtime_error("PerformanceModule: module index out of range");
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t calls = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		calls += threadCounters[t]->modules[i].calls.load(std::memory_order_relaxed);
+	return calls;
+}
+
+double PerformanceModule::getTime(size_t i) const {
+	if (i >= modules.size())
+		throw std::runtime_error("PerformanceModule: module index out of range");
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t time = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		time += threadCounters[t]->modules[i].time.load(std::memory_order_relaxed);
+	return time * 1e-9;
+}
+
+std::vector<uint64_t> PerformanceModule::getTimeHistogram(size_t i) const {
+	if (i >= modules.size())
+		throw std::runtime_error("PerformanceModule: module index out of range");
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<uint64_t> histogram(histogramBins, 0);
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		for (size_t j = 0; j < histogramBins; j++)
+			histogram[j] += threadCounters[t]->modules[i].histogram[j].load(std::memory_order_relaxed);
+	return histogram;
+}
+
+void PerformanceModule::setHardwareCounters(bool enable) {
+	clearCounters();
+	hardwareCounters = enable;
+}
+
+bool PerformanceModule::getHardwareCounters() const {
+	return hardwareCounters;
+}
+
+bool PerformanceModule::hasHardwareCounters() {
+	HardwareCounterGroup group;
+	return group.open();
+}
+
+uint64_t PerformanceModule::getHardwareCount(size_t i, HardwareEvent event) const {
+	if (i >= modules.size())
+		throw std::runtime_error("PerformanceModule: module index out of range");
+	if ((size_t) event >= hardwareEvents)
+		throw std::runtime_error("PerformanceModule: unknown hardware event");
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t count = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		count += threadCounters[t]->modules[i].events[event].load(std::memory_order_relaxed);
+	return count;
+}
+
+void PerformanceModule::reset() {
+	clearCounters();
+}
+
+string PerformanceModule::toJSON() const {
+	stringstream sstr;
+	sstr << "{\"steps\": " << getSteps() << ", \"modules\": [";
+	for (size_t i = 0; i < modules.size(); i++) {
+		if (i > 0)
+			sstr << ", ";
+		sstr << "{\"description\": \"" << escapeJSON(modules[i]->getDescription()) << "\"";
+		sstr << ", \"calls\": " << getCalls(i);
+		sstr << ", \"time\": " << getTime(i);
+		sstr << ", \"histogram\": [";
+		std::vector<uint64_t> histogram = getTimeHistogram(i);
+		for (size_t j = 0; j < histogram.size(); j++)
+			sstr << (j > 0 ? ", " : "") << histogram[j];
+		sstr << "]";
+		if (hardwareCounters) {
+			sstr << ", \"cycles\": " << getHardwareCount(i, Cycles);
+			sstr << ", \"instructions\": " << getHardwareCount(i, Instructions);
+			sstr << ", \"cacheMisses\": " << getHardwareCount(i, CacheMisses);
+			sstr << ", \"branchMisses\": " << getHardwareCount(i, BranchMisses);
 		}
-		calls++;
+		sstr << "}";
 	}
+	sstr << "]}";
+	return sstr.str();
 }
 
 string PerformanceModule::getDescription() const {
 	stringstream sstr;
 	sstr << "PerformanceModule (";
 	for (size_t i = 0; i < modules.size(); i++) {
-		_module_info &m = modules[i];
 		if (i > 0)
 			sstr << ", ";
-		sstr << m.module->getDescription();
+		sstr << modules[i]->getDescription();
+	}
+	sstr << ")";
+	return sstr.str();
+}
+
+// ----------------------------------------------------------------------------
+struct StepLimiterProfiler::ThreadCounters {
+	typedef std::map<std::pair<int, int>, std::vector<uint64_t> > Bins;
+	uint64_t steps;
+	Bins bins; ///< wins of the modules by particle id and energy decade
+
+	ThreadCounters() : steps(0) {
+	}
+};
+
+// ids of the StepLimiterProfiler instances
+static std::atomic<uint64_t> stepLimiterProfilerInstances(0);
+
+StepLimiterProfiler::StepLimiterProfiler() : instance(++stepLimiterProfilerInstances) {
+}
+
+StepLimiterProfiler::~StepLimiterProfiler() {
+	clearCounters();
+}
+
+StepLimiterProfiler::ThreadCounters *StepLimiterProfiler::getThreadCounters() const {
+	// counters of the calling thread, by instance
+	static thread_local std::vector<std::pair<uint64_t, ThreadCounters *> > cache;
+	for (size_t i = 0; i < cache.size(); i++)
+		if (cache[i].first == instance)
+			return cache[i].second;
+
+	ThreadCounters *counters = new ThreadCounters();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		threadCounters.push_back(counters);
+	}
+	cache.push_back(std::make_pair(instance, counters));
+	return counters;
+}
+
+void StepLimiterProfiler::clearCounters() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < threadCounters.size(); i++)
+		delete threadCounters[i];
+	threadCounters.clear();
+	// the threads allocate new counters on the next call
+	instance = ++stepLimiterProfilerInstances;
+}
+
+void StepLimiterProfiler::add(Module *module) {
+	clearCounters();
+	modules.push_back(module);
+}
+
+void StepLimiterProfiler::process(Candidate *candidate) const {
+	Candidate::StepBids bids;
+	bids.winner = -1;
+	// keeps the bids of an enclosing profiler, e.g. of a module list run by a module
+	Candidate::StepBids *outer = Candidate::setStepBids(&bids);
+	try {
+		for (size_t i = 0; i < modules.size(); i++) {
+			bids.bidder = i;
+			modules[i]->process(candidate);
+		}
+	} catch (...) {
+		Candidate::setStepBids(outer);
+		throw;
+	}
+	Candidate::setStepBids(outer);
+
+	if (bids.winner < 0 or not candidate->isActive())
+		return;
+	ThreadCounters *counters = getThreadCounters();
+	counters->steps++;
+	double E = candidate->current.getEnergy();
+	int decade = (E > 0) ? floor(log10(E / eV)) : 0;
+	std::vector<uint64_t> &wins = counters->bins[std::make_pair(
+			candidate->current.getId(), decade)];
+	wins.resize(modules.size(), 0);
+	wins[bids.winner]++;
+}
+
+size_t StepLimiterProfiler::size() const {
+	return modules.size();
+}
+
+uint64_t StepLimiterProfiler::getSteps() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t steps = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++)
+		steps += threadCounters[t]->steps;
+	return steps;
+}
+
+uint64_t StepLimiterProfiler::getWins(size_t i) const {
+	if (i >= modules.size())
+		throw std::runtime_error("StepLimiterProfiler: module index out of range");
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t wins = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++) {
+		const ThreadCounters::Bins &bins = threadCounters[t]->bins;
+		for (ThreadCounters::Bins::const_iterator b = bins.begin(); b != bins.end(); ++b)
+			wins += b->second[i];
+	}
+	return wins;
+}
+
+uint64_t StepLimiterProfiler::getWins(size_t i, int id, int decade) const {
+	if (i >= modules.size())
+		throw std::runtime_error("StepLimiterProfiler: module index out of range");
+	std::lock_guard<std::mutex> lock(mutex);
+	uint64_t wins = 0;
+	for (size_t t = 0; t < threadCounters.size(); t++) {
+		const ThreadCounters::Bins &bins = threadCounters[t]->bins;
+		ThreadCounters::Bins::const_iterator b = bins.find(std::make_pair(id, decade));
+		if (b != bins.end())
+			wins += b->second[i];
+	}
+	return wins;
+}
+
+void StepLimiterProfiler::reset() {
+	clearCounters();
+}
+
+string StepLimiterProfiler::toJSON() const {
+	// merged bins of all threads
+	ThreadCounters::Bins bins;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t t = 0; t < threadCounters.size(); t++) {
+			const ThreadCounters::Bins &b = threadCounters[t]->bins;
+			for (ThreadCounters::Bins::const_iterator i = b.begin(); i != b.end(); ++i) {
+				std::vector<uint64_t> &wins = bins[i->first];
+				wins.resize(modules.size(), 0);
+				for (size_t m = 0; m < modules.size(); m++)
+					wins[m] += i->second[m];
+			}
+		}
+	}
+
+	stringstream sstr;
+	sstr << "{\"steps\": " << getSteps() << ", \"modules\": [";
+	for (size_t m = 0; m < modules.size(); m++) {
+		if (m > 0)
+			sstr << ", ";
+		sstr << "{\"description\": \"" << escapeJSON(modules[m]->getDescription()) << "\"";
+		sstr << ", \"wins\": " << getWins(m);
+		sstr << ", \"bins\": [";
+		bool first = true;
+		for (ThreadCounters::Bins::const_iterator i = bins.begin(); i != bins.end(); ++i) {
+			if (i->second[m] == 0)
+				continue;
+			sstr << (first ? "" : ", ") << "{\"id\": " << i->first.first
+					<< ", \"decade\": " << i->first.second
+					<< ", \"wins\": " << i->second[m] << "}";
+			first = false;
+		}
+		sstr << "]}";
+	}
+	sstr << "]}";
+	return sstr.str();
+}
+
+string StepLimiterProfiler::getDescription() const {
+	stringstream sstr;
+	sstr << "StepLimiterProfiler (";
+	for (size_t i = 0; i < modules.size(); i++) {
+		if (i > 0)
+			sstr << ", ";
+		sstr << modules[i]->getDescription();
 	}
 	sstr << ")";
 	return sstr.str();
@@ -109,10 +573,8 @@ void EmissionMapFiller::setEmissionMap(EmissionMap *emissionMap) {
 
 void EmissionMapFiller::process(Candidate* candidate) const {
 	if (emissionMap) {
-		#pragma omp critical
-		{
-			emissionMap->fillMap(candidate->source);
-		}
+		// each thread fills its own maps
+		emissionMap->fillMap(candidate->source);
 	}
 }
 
@@ -120,4 +582,32 @@ string EmissionMapFiller::getDescription() const {
 	return "EmissionMapFiller";
 }
 
+TiledGridPrefetch::TiledGridPrefetch(ref_ptr<TiledGrid3f> grid, double distance) :
+		grid(grid), distance(distance) {
+}
+
+void TiledGridPrefetch::setDistance(double d) {
+	distance = d;
+}
+
+double TiledGridPrefetch::getDistance() const {
+	return distance;
+}
+
+void TiledGridPrefetch::process(Candidate* candidate) const {
+	double d = (distance > 0) ? distance : candidate->getNextStep();
+	grid->prefetch(candidate->current.getPosition(), candidate->current.getDirection(), d);
+}
+
+string TiledGridPrefetch::getDescription() const {
+	std::stringstream s;
+	s << "TiledGridPrefetch: ";
+	if (distance > 0)
+		s << distance / kpc << " kpc";
+	else
+		s << "next step";
+	s << " ahead";
+	return s.str();
+}
+
 } // namespace crpropa
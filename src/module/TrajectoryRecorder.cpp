@@ -0,0 +1,427 @@
+#include "crpropa/module/TrajectoryRecorder.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef CRPROPA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace crpropa {
+
+namespace {
+
+const char trajectoryMagic[8] = {'C', 'R', 'P', 'T', 'R', 'J', '0', '1'};
+
+// compression of the trajectories in the file
+enum TrajectoryCompression {
+	NoCompression = 0, ZlibCompression = 1
+};
+
+// header of a trajectory in the file, followed by size bytes of data
+struct TrajectoryHeader {
+	uint64_t serialNumber;
+	uint64_t sourceSerialNumber;
+	uint32_t points;
+	uint32_t size;
+};
+
+const size_t pointSize = TrajectoryRecorder::nValues * sizeof(double) + sizeof(int32_t);
+
+// one column per quantity, each value xor the previous one, so that the
+// slowly changing values start with many zero bits
+void encodePoints(const std::vector<TrajectoryRecorder::Point> &points,
+		std::vector<char> &raw) {
+	size_t n = points.size();
+	raw.resize(n * pointSize);
+	char *p = raw.data();
+	for (int q = 0; q < TrajectoryRecorder::nValues; q++) {
+		uint64_t last = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t bits;
+			memcpy(&bits, &points[i].values[q], sizeof(bits));
+			uint64_t delta = bits ^ last;
+			memcpy(p, &delta, sizeof(delta));
+			p += sizeof(delta);
+			last = bits;
+		}
+	}
+	int32_t last = 0;
+	for (size_t i = 0; i < n; i++) {
+		int32_t delta = points[i].id ^ last;
+		memcpy(p, &delta, sizeof(delta));
+		p += sizeof(delta);
+		last = points[i].id;
+	}
+}
+
+void decodePoints(const char *p, size_t n,
+		std::vector<TrajectoryRecorder::Point> &points) {
+	points.resize(n);
+	for (int q = 0; q < TrajectoryRecorder::nValues; q++) {
+		uint64_t last = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t delta;
+			memcpy(&delta, p, sizeof(delta));
+			p += sizeof(delta);
+			last ^= delta;
+			memcpy(&points[i].values[q], &last, sizeof(last));
+		}
+	}
+	int32_t last = 0;
+	for (size_t i = 0; i < n; i++) {
+		int32_t delta;
+		memcpy(&delta, p, sizeof(delta));
+		p += sizeof(delta);
+		last ^= delta;
+		points[i].id = last;
+	}
+}
+
+TrajectoryRecorder::Point makePoint(const ParticleState &state, double length,
+		double redshift, double weight) {
+	TrajectoryRecorder::Point point;
+	const Vector3d &x = state.getPosition();
+	const Vector3d &p = state.getDirection();
+	double values[TrajectoryRecorder::nValues] = {x.x, x.y, x.z, p.x, p.y, p.z,
+			state.getEnergy(), length, redshift, weight};
+	memcpy(point.values, values, sizeof(values));
+	point.id = state.getId();
+	return point;
+}
+
+ParticleState pointState(const TrajectoryRecorder::Point &point) {
+	const double *v = point.values;
+	return ParticleState(point.id, v[6], Vector3d(v[0], v[1], v[2]),
+			Vector3d(v[3], v[4], v[5]));
+}
+
+// distance of x to the line through a and b
+double lineDistance(const Vector3d &x, const Vector3d &a, const Vector3d &b) {
+	Vector3d ab = b - a;
+	double l2 = ab.getR2();
+	if (l2 == 0)
+		return (x - a).getR();
+	return (x - a).cross(ab).getR() / std::sqrt(l2);
+}
+
+Vector3d pointPosition(const TrajectoryRecorder::Point &point) {
+	return Vector3d(point.values[0], point.values[1], point.values[2]);
+}
+
+} // namespace
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string &filename) :
+		filename(filename), count(0), samplingInterval(0), tolerance(0),
+		chunkSize(0) {
+	fout.open(filename.c_str(), std::ios::binary);
+	if (not fout.is_open())
+		throw std::runtime_error("TrajectoryRecorder: cannot create file " + filename);
+	uint32_t compression = NoCompression;
+#ifdef CRPROPA_HAVE_ZLIB
+	compression = ZlibCompression;
+#endif
+	fout.write(trajectoryMagic, sizeof(trajectoryMagic));
+	fout.write((const char *) &compression, sizeof(compression));
+
+	size_t threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	threadTracks.resize(threads);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+	close();
+}
+
+void TrajectoryRecorder::record(Candidate *c,
+		std::unordered_map<uint64_t, Track> &tracks) const {
+	uint64_t serialNumber = c->getSerialNumber();
+	Track &track = tracks[serialNumber];
+	if (track.points.empty()) {
+		track.sourceSerialNumber = c->getSourceSerialNumber();
+		double length = c->getTrajectoryLength() - c->getCurrentStep();
+		track.points.push_back(makePoint(c->previous, length, c->getRedshift(),
+				c->getWeight()));
+		track.provisional = false;
+		track.sampled = length;
+	}
+
+	// a provisional point is replaced by the next one of the same particle
+	Point point = makePoint(c->current, c->getTrajectoryLength(),
+			c->getRedshift(), c->getWeight());
+	if (track.provisional and track.points.back().id == point.id)
+		track.points.pop_back();
+	track.points.push_back(point);
+	double length = c->getTrajectoryLength();
+	track.provisional = (length - track.sampled < samplingInterval)
+			and (track.points.size() > 1);
+	if (not track.provisional)
+		track.sampled = length;
+
+	if (not c->isActive()) {
+		write(serialNumber, track);
+		tracks.erase(serialNumber);
+	} else if ((chunkSize > 1) and (track.points.size() >= chunkSize)
+			and not track.provisional) {
+		write(serialNumber, track);
+		track.points.erase(track.points.begin(), track.points.end() - 1);
+	}
+}
+
+void TrajectoryRecorder::decimate(const std::vector<Point> &points,
+		std::vector<Point> &kept) const {
+	size_t n = points.size();
+	std::vector<bool> keep(n, false);
+	keep[0] = keep[n - 1] = true;
+	for (size_t i = 1; i < n; i++)
+		if (points[i].id != points[i - 1].id)
+			keep[i - 1] = keep[i] = true;
+
+	// split the segments between kept points at their farthest point until
+	// all points are within the tolerance
+	std::vector<std::pair<size_t, size_t> > segments;
+	size_t first = 0;
+	for (size_t i = 1; i < n; i++) {
+		if (keep[i]) {
+			segments.push_back(std::make_pair(first, i));
+			first = i;
+		}
+	}
+	while (not segments.empty()) {
+		size_t a = segments.back().first, b = segments.back().second;
+		segments.pop_back();
+		Vector3d xa = pointPosition(points[a]), xb = pointPosition(points[b]);
+		double dMax = 0;
+		size_t iMax = a;
+		for (size_t i = a + 1; i < b; i++) {
+			double d = lineDistance(pointPosition(points[i]), xa, xb);
+			if (d > dMax) {
+				dMax = d;
+				iMax = i;
+			}
+		}
+		if (dMax > tolerance) {
+			keep[iMax] = true;
+			segments.push_back(std::make_pair(a, iMax));
+			segments.push_back(std::make_pair(iMax, b));
+		}
+	}
+
+	kept.clear();
+	for (size_t i = 0; i < n; i++)
+		if (keep[i])
+			kept.push_back(points[i]);
+}
+
+void TrajectoryRecorder::process(Candidate *c) const {
+	size_t tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	if (tid < threadTracks.size()) {
+		record(c, threadTracks[tid]);
+	} else {
+		// more threads than at construction
+#pragma omp critical(TrajectoryRecorder)
+		record(c, sharedTracks);
+	}
+}
+
+void TrajectoryRecorder::write(uint64_t serialNumber, const Track &track) const {
+	const std::vector<Point> *points = &track.points;
+	std::vector<Point> kept;
+	if ((tolerance > 0) and (points->size() > 2)) {
+		decimate(track.points, kept);
+		points = &kept;
+	}
+	std::vector<char> raw;
+	encodePoints(*points, raw);
+	const std::vector<char> *data = &raw;
+#ifdef CRPROPA_HAVE_ZLIB
+	std::vector<char> compressed(compressBound(raw.size()));
+	uLongf size = compressed.size();
+	if (compress2((Bytef *) compressed.data(), &size, (const Bytef *) raw.data(),
+			raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+		throw std::runtime_error("TrajectoryRecorder: compression failed");
+	compressed.resize(size);
+	data = &compressed;
+#endif
+
+	TrajectoryHeader header;
+	header.serialNumber = serialNumber;
+	header.sourceSerialNumber = track.sourceSerialNumber;
+	header.points = points->size();
+	header.size = data->size();
+#pragma omp critical(TrajectoryRecorder)
+	{
+		if (fout.is_open()) {
+			fout.write((const char *) &header, sizeof(header));
+			fout.write(data->data(), data->size());
+			count++;
+		}
+	}
+}
+
+void TrajectoryRecorder::close() {
+	if (not fout.is_open())
+		return;
+	for (size_t t = 0; t < threadTracks.size(); t++) {
+		std::unordered_map<uint64_t, Track>::const_iterator i;
+		for (i = threadTracks[t].begin(); i != threadTracks[t].end(); i++)
+			write(i->first, i->second);
+		threadTracks[t].clear();
+	}
+	std::unordered_map<uint64_t, Track>::const_iterator i;
+	for (i = sharedTracks.begin(); i != sharedTracks.end(); i++)
+		write(i->first, i->second);
+	sharedTracks.clear();
+	fout.close();
+}
+
+void TrajectoryRecorder::setSamplingInterval(double interval) {
+	samplingInterval = interval;
+}
+
+double TrajectoryRecorder::getSamplingInterval() const {
+	return samplingInterval;
+}
+
+void TrajectoryRecorder::setTolerance(double t) {
+	tolerance = t;
+}
+
+double TrajectoryRecorder::getTolerance() const {
+	return tolerance;
+}
+
+void TrajectoryRecorder::setChunkSize(size_t points) {
+	chunkSize = points;
+}
+
+size_t TrajectoryRecorder::getChunkSize() const {
+	return chunkSize;
+}
+
+size_t TrajectoryRecorder::getCount() const {
+	return count;
+}
+
+std::string TrajectoryRecorder::getDescription() const {
+	std::stringstream ss;
+	ss << "TrajectoryRecorder: " << filename;
+	return ss.str();
+}
+
+TrajectoryReplay::TrajectoryReplay(const std::string &filename) :
+		filename(filename) {
+}
+
+size_t TrajectoryReplay::run(Module *module) const {
+	std::ifstream fin(filename.c_str(), std::ios::binary);
+	if (not fin.is_open())
+		throw std::runtime_error("TrajectoryReplay: cannot open file " + filename);
+	char magic[sizeof(trajectoryMagic)];
+	uint32_t compression;
+	fin.read(magic, sizeof(magic));
+	fin.read((char *) &compression, sizeof(compression));
+	if (not fin or memcmp(magic, trajectoryMagic, sizeof(magic)) != 0)
+		throw std::runtime_error("TrajectoryReplay: no trajectory file " + filename);
+#ifndef CRPROPA_HAVE_ZLIB
+	if (compression == ZlibCompression)
+		throw std::runtime_error("CRPropa was built without Zlib compression!");
+#endif
+	if (compression > ZlibCompression)
+		throw std::runtime_error("TrajectoryReplay: unknown compression in " + filename);
+
+	size_t count = 0;
+	bool failed = false;
+	std::string error;
+	// the threads take the next trajectory from the file, then decode and
+	// replay it in parallel
+#pragma omp parallel
+	{
+		std::vector<char> data, raw;
+		std::vector<TrajectoryRecorder::Point> points;
+		while (true) {
+			TrajectoryHeader header;
+			bool found = false;
+#pragma omp critical(TrajectoryReplay)
+			{
+				if (not failed and fin.read((char *) &header, sizeof(header))) {
+					data.resize(header.size);
+					fin.read(data.data(), header.size);
+					found = bool(fin);
+					failed = not found;
+				}
+			}
+			if (not found)
+				break;
+
+			const char *p = data.data();
+			size_t rawSize = header.points * pointSize;
+			if (compression == ZlibCompression) {
+#ifdef CRPROPA_HAVE_ZLIB
+				raw.resize(rawSize);
+				uLongf size = rawSize;
+				if ((uncompress((Bytef *) raw.data(), &size, (const Bytef *) data.data(),
+						data.size()) != Z_OK) or (size != rawSize)) {
+#pragma omp critical(TrajectoryReplay)
+					failed = true;
+					break;
+				}
+				p = raw.data();
+#endif
+			} else if (data.size() != rawSize) {
+#pragma omp critical(TrajectoryReplay)
+				failed = true;
+				break;
+			}
+			decodePoints(p, header.points, points);
+			if (points.empty())
+				continue;
+
+			const double *v = points[0].values;
+			ref_ptr<Candidate> c = new Candidate(pointState(points[0]));
+			c->setSerialNumber(header.serialNumber);
+			c->setTrajectoryLength(v[7]);
+			c->setRedshift(v[8]);
+			c->setWeight(v[9]);
+			try {
+				for (size_t i = 1; i < points.size() and c->isActive(); i++) {
+					v = points[i].values;
+					c->previous = c->current;
+					c->current = pointState(points[i]);
+					c->setCurrentStep(v[7] - c->getTrajectoryLength());
+					c->setTrajectoryLength(v[7]);
+					c->setRedshift(v[8]);
+					c->setWeight(v[9]);
+					module->process(c);
+				}
+			} catch (std::exception &e) {
+#pragma omp critical(TrajectoryReplay)
+				{
+					error = e.what();
+					failed = true;
+				}
+				break;
+			}
+#pragma omp atomic
+			count++;
+		}
+	}
+	if (not error.empty())
+		throw std::runtime_error("TrajectoryReplay: " + error);
+	if (failed)
+		throw std::runtime_error("TrajectoryReplay: corrupt file " + filename);
+	return count;
+}
+
+} // namespace crpropa
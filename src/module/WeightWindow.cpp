@@ -0,0 +1,112 @@
+#include "crpropa/module/WeightWindow.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace crpropa {
+
+WeightWindow::WeightWindow(double lower, double upper, size_t maxSplits) :
+		referenceEnergy(1 * EeV), energyIndex(0), useObserver(false), observerScale(0) {
+	setWindow(lower, upper);
+	setMaximumSplits(maxSplits);
+}
+
+void WeightWindow::setWindow(double lower, double upper) {
+	if (not (lower > 0) or not (upper >= lower))
+		throw std::runtime_error("WeightWindow: invalid window");
+	this->lower = lower;
+	this->upper = upper;
+}
+
+void WeightWindow::setMaximumSplits(size_t maxSplits) {
+	if (maxSplits < 1)
+		throw std::runtime_error("WeightWindow: at least one split required");
+	this->maxSplits = maxSplits;
+}
+
+void WeightWindow::setEnergyImportance(double referenceEnergy, double index) {
+	if (not (referenceEnergy > 0))
+		throw std::runtime_error("WeightWindow: the reference energy has to be positive");
+	this->referenceEnergy = referenceEnergy;
+	energyIndex = index;
+}
+
+void WeightWindow::setSpeciesImportance(int id, double importance) {
+	if (importance < 0)
+		throw std::runtime_error("WeightWindow: negative importance");
+	speciesImportance[id] = importance;
+}
+
+void WeightWindow::setObserverImportance(const Vector3d &position, double scale) {
+	if (not (scale > 0))
+		throw std::runtime_error("WeightWindow: the distance scale has to be positive");
+	observer = position;
+	observerScale = scale;
+	useObserver = true;
+}
+
+double WeightWindow::getImportance(const Candidate *c) const {
+	double importance = 1;
+	if (energyIndex != 0)
+		importance *= pow(c->current.getEnergy() / referenceEnergy, energyIndex);
+	if (not speciesImportance.empty()) {
+		std::map<int, double>::const_iterator i = speciesImportance.find(c->current.getId());
+		if (i != speciesImportance.end())
+			importance *= i->second;
+	}
+	if (useObserver) {
+		double d = (c->current.getPosition() - observer).getR();
+		importance *= observerScale / (observerScale + d);
+	}
+	return importance;
+}
+
+void WeightWindow::process(Candidate *c) const {
+	double importance = getImportance(c);
+	if (not (importance > 0)) {
+		c->setActive(false);
+		return;
+	}
+
+	double w = c->getWeight();
+	double x = w * importance;
+	if (x < lower) {
+		// roulette with the survival weight in the center of the window
+		double s = std::sqrt(lower * upper);
+		if (Random::instance().rand() * s < x)
+			c->setWeight(s / importance);
+		else
+			c->setActive(false);
+	} else if (x > upper) {
+		size_t n = std::min(size_t(std::ceil(x / upper)), maxSplits);
+		if (n < 2)
+			return;
+		c->setWeight(w / n);
+		for (size_t i = 1; i < n; i++) {
+			// the secondaries of the candidate so far keep their weights
+			ref_ptr<Candidate> copy = c->clone(false);
+			copy->parent = c;
+			copy->setTagOriginCode(c->getTagOriginCode());
+			c->addSecondary(copy);
+		}
+	}
+}
+
+std::string WeightWindow::getDescription() const {
+	std::stringstream ss;
+	ss << "WeightWindow: weight x importance in [" << lower << ", " << upper
+			<< "], at most " << maxSplits << " splits";
+	if (energyIndex != 0)
+		ss << ", importance (E / " << referenceEnergy / EeV << " EeV)^" << energyIndex;
+	if (not speciesImportance.empty())
+		ss << ", " << speciesImportance.size() << " species importances";
+	if (useObserver)
+		ss << ", observer at " << observer / Mpc << " Mpc, scale " << observerScale / Mpc << " Mpc";
+	return ss.str();
+}
+
+} // namespace crpropa
@@ -0,0 +1,3 @@
+// SIMD kernels of SIMD_AVX, compiled with -mavx, see CMakeLists.txt
+#define CRPROPA_SIMD_KERNELS simdKernelsAVX
+#include "SimdKernels.h"
@@ -0,0 +1,3 @@
+// SIMD kernels of SIMD_AVX2, compiled with -mavx2 -mfma, see CMakeLists.txt
+#define CRPROPA_SIMD_KERNELS simdKernelsAVX2
+#include "SimdKernels.h"
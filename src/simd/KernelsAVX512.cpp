@@ -0,0 +1,3 @@
+// SIMD kernels of SIMD_AVX512, compiled with -mavx512f -mavx2 -mfma, see CMakeLists.txt
+#define CRPROPA_SIMD_KERNELS simdKernelsAVX512
+#include "SimdKernels.h"
@@ -0,0 +1,529 @@
+// SIMD kernels of SimdKernels, included once per SimdLevel by the
+// KernelsAVX*.cpp files, which are compiled for the instruction set of their
+// level. CRPROPA_SIMD_KERNELS is the name of the function that fills the
+// table of the level. Everything here has internal linkage: inline functions
+// of other headers, e.g. of Vector3, would be emitted with the instruction
+// set of the level and could be picked by the linker for the whole library.
+//
+// This file contains an implementation of a vectorized cosine, which
+// is based in part on the implementations in the library "SLEEF" by
+// Naoki Shibata. SLEEF was used under the Boost Software License,
+// Version 1.0. The original source file contained the following
+// copyright notice:
+//
+//   //          Copyright Naoki Shibata 2010 - 2018.
+//   // Distributed under the Boost Software License, Version 1.0.
+//   //    (See accompanying file LICENSE.txt or copy at
+//   //          http://www.boost.org/LICENSE_1_0.txt)
+//
+// SLEEF was used under the following license, which is not necessarily the
+// license that applies to this file:
+//
+//         Boost Software License - Version 1.0 - August 17th, 2003
+//
+//         Permission is hereby granted, free of charge, to any person or
+//         organization obtaining a copy of the software and accompanying
+//         documentation covered by this license (the "Software") to use,
+//         reproduce, display, distribute, execute, and transmit the Software,
+//         and to prepare derivative works of the Software, and to permit
+//         third-parties to whom the Software is furnished to do so, all subject
+//         to the following:
+//
+//         The copyright notices in the Software and this entire statement,
+//         including the above license grant, this restriction and the following
+//         disclaimer, must be included in all copies of the Software, in whole
+//         or in part, and all derivative works of the Software, unless such
+//         copies or derivative works are solely in the form of
+//         machine-executable object code generated by a source language
+//         processor.
+//
+//         THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//         EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//         MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, TITLE AND
+//         NON-INFRINGEMENT. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR ANYONE
+//         DISTRIBUTING THE SOFTWARE BE LIABLE FOR ANY DAMAGES OR OTHER
+//         LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT
+//         OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//         THE SOFTWARE.
+
+#include "crpropa/SimdDispatch.h"
+
+#include "SimdMath.h"
+
+#include <immintrin.h>
+
+#ifndef CRPROPA_SIMD_KERNELS
+#error "define CRPROPA_SIMD_KERNELS before including SimdKernels.h"
+#endif
+
+#ifndef __AVX__
+#error "the SIMD kernels need at least AVX"
+#endif
+
+namespace crpropa {
+namespace {
+
+// ----------------------------------------------------------------------------
+// plane waves, see PlaneWaveTurbulence
+
+// see
+// https://stackoverflow.com/questions/49941645/get-sum-of-values-stored-in-m256d-with-sse-avx
+inline double hsum_double_avx(__m256d v) {
+	__m128d vlow = _mm256_castpd256_pd128(v);
+	__m128d vhigh = _mm256_extractf128_pd(v, 1); // high 128
+	vlow = _mm_add_pd(vlow, vhigh);              // reduce down to 128
+
+	__m128d high64 = _mm_unpackhi_pd(vlow, vlow);
+	return _mm_cvtsd_f64(_mm_add_sd(vlow, high64)); // reduce to scalar
+}
+
+// horizontal sum of eight floats
+inline float hsum_float_avx(__m256 v) {
+	__m128 vlow = _mm256_castps256_ps128(v);
+	__m128 vhigh = _mm256_extractf128_ps(v, 1); // high 128
+	vlow = _mm_add_ps(vlow, vhigh);             // reduce down to 128
+	vlow = _mm_add_ps(vlow, _mm_movehl_ps(vlow, vlow));
+	return _mm_cvtss_f32(_mm_add_ss(vlow, _mm_shuffle_ps(vlow, vlow, 1)));
+}
+
+// The SIMD types of the sums over the wavemodes. Each of them provides the
+// vector type, the number of lanes and the operations of the kernel, including
+// cos(pi*x). The double precision AVX version is the reference, the others
+// follow it with the instructions of their type.
+
+struct AVXDouble {
+	typedef double scalar;
+	typedef __m256d vector;
+	static const int width = 4;
+	static vector zero() { return _mm256_setzero_pd(); }
+	static vector set1(double x) { return _mm256_set1_pd(x); }
+	static vector load(const double *p) { return _mm256_load_pd(p); }
+	static vector add(vector a, vector b) { return _mm256_add_pd(a, b); }
+	static vector mul(vector a, vector b) { return _mm256_mul_pd(a, b); }
+	static double hsum(vector v) { return hsum_double_avx(v); }
+
+	static vector cosPi(vector x) {
+		// ********
+		// * Computing the cosine
+		// * Part 1: Argument reduction
+		//
+		//  To understand the computation of the cosine, first note that the
+		//  cosine is periodic and we thus only need to model its behavior
+		//  between 0 and 2*pi to be able compute the function anywhere. In
+		//  fact, by mirroring the function along the x and y axes, even the
+		//  range between 0 and pi/2 is sufficient for this purpose. In this
+		//  range, the cosine can be efficiently evaluated with high precision
+		//  by using a polynomial approximation. Thus, to compute the cosine,
+		//  the input value is first reduced so that it lies within this range.
+		//  Then, the polynomial approximation is evaluated. Finally, if
+		//  necessary, the sign of the result is flipped (mirroring the function
+		//  along the x axis).
+		//
+		//  The actual computation is slightly more involved. First, argument
+		//  reduction can be simplified drastically by computing cos(pi*x),
+		//  such that the values are reduced to the range [0, 0.5) instead of
+		//  [0, pi/2). Since the cosine is even (independent of the sign), we
+		//  can first reduce values to [-0.5, 0.5) – that is, a simple rounding
+		//  operation – and then neutralize the sign. In fact, precisely because
+		//  the cosine is even, all terms of the polynomial are powers of x^2,
+		//  so the value of x^2 (computed as x*x) forms the basis for the
+		//  polynomial approximation. If I understand things correctly, then (in
+		//  IEEE-754 floating point) x*x and (-x)*(-x) will always result in the
+		//  exact same value, which means that any error bound over [0, 0.5)
+		//  automatically applies to (-0.5, 0] as well.
+
+		// First, compute round(x), and store it in q. If this value is odd,
+		// we're looking at the negative half-wave of the cosine, and thus
+		// will have to invert the sign of the result.
+		__m256d q = _mm256_round_pd(
+		    x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+
+		// Since we're computing cos(pi*x), round(x) always yields the center of
+		// a half-wave (where cos(pi*x) achieves an extremum). This point
+		// logically corresponds to x=0. Therefore, we subtract this center from
+		// the actual input argument to find the corresponding point on the
+		// half-wave that is centered around zero.
+		__m256d s = _mm256_sub_pd(x, q);
+
+		// We now want to check whether q (the index of our half-wave) is even
+		// or odd, since all of the odd-numbered half-waves are negative, so
+		// we'll have to flip the final result. On an int, this is as simple as
+		// checking the 0th bit. Idea: manipulate the double in such a way that
+		// we can do this. So, we add 2^52, such that the last digit of the
+		// mantissa is actually in the ones' position. Since q may be negative,
+		// we'll also add 2^51 to make sure it's positive. Note that 2^51 is
+		// even and thus leaves evenness invariant, which is the only thing we
+		// care about here.
+		//
+		// This is based on the int extraction process described here:
+		// https://stackoverflow.com/questions/41144668/how-to-efficiently-perform-double-int64-conversions-with-sse-avx/41223013
+		//
+		// We assume -2^51 <= q < 2^51 for this, which is unproblematic, as
+		// double precision has decayed far enough at that point that the
+		// usefulness of the cosine becomes limited.
+		//
+		// Explanation: The mantissa of a double-precision float has 52 bits
+		// (excluding the implicit first bit, which is always one). If |q| >
+		// 2^51, this implicit first bit has a place value of at least 2^51,
+		// while the first stored bit of the mantissa has a place value of at
+		// least 2^50. This means that the LSB of the mantissa has a place value
+		// of at least 2^(-1), or 0.5. For a cos(pi*x), this corresponds to a
+		// quarter of a cycle (pi/2), so at this point the precision of the
+		// input argument is so low that going from one representable number to
+		// the next causes the result to jump by +/-1.
+
+		q = _mm256_add_pd(q, _mm256_set1_pd(0x0018000000000000));
+
+		// Unfortunately, integer comparisons were only introduced in AVX2, so
+		// we'll have to make do with a floating point comparison to check
+		// whether the last bit is set. However, masking out all but the last
+		// bit will result in a denormal float, which may either result in
+		// performance problems or just be rounded down to zero, neither of
+		// which is what we want here. To fix this, we'll mask in not only bit
+		// 0, but also the exponent (and sign, but that doesn't matter) of q.
+		// Luckily, the exponent of q is guaranteed to have the fixed value of
+		// 1075 (corresponding to 2^52) after our addition.
+
+		__m256d invert = _mm256_and_pd(
+		    q, _mm256_castsi256_pd(_mm256_set1_epi64x(0xfff0000000000001)));
+
+		// If we did have a one in bit 0, our result will be equal to 2^52 + 1.
+		invert = _mm256_cmp_pd(
+		    invert, _mm256_castsi256_pd(_mm256_set1_epi64x(0x4330000000000001)),
+		    _CMP_EQ_OQ);
+
+		// Now we know whether to flip the sign of the result. However, remember
+		// that we're working on multiple values at a time, so an if statement
+		// won't be of much use here (plus it might perform badly). Instead,
+		// we'll make use of the fact that the result of the comparison is all
+		// ones if the comparison was true (i.e. q is odd and we need to flip
+		// the result), and all zeroes otherwise. If we now mask out all bits
+		// except the sign bit, we get something that, when xor'ed into our
+		// final result, will flip the sign exactly when q is odd.
+		invert = _mm256_and_pd(invert, _mm256_set1_pd(-0.0));
+		// (Note that the binary representation of -0.0 is all 0 bits, except
+		// for the sign bit, which is set to 1.)
+
+		// TODO: clamp floats between 0 and 1? This would ensure that we never
+		// see inf's, but maybe we want that, so that things dont just fail
+		// silently...
+
+		// * end of argument reduction
+		// *******
+
+		// ******
+		// * Evaluate the cosine using a polynomial approximation for the zeroth
+		// half-wave.
+		// * The coefficients for this were generated using sleefs gencoef.c.
+		// * These coefficients are probably far from optimal; however, they
+		// should be sufficient for this case.
+		s = _mm256_mul_pd(s, s);
+
+		__m256d u = _mm256_set1_pd(+0.2211852080653743946e+0);
+
+		u = _mm256_add_pd(_mm256_mul_pd(u, s),
+		                  _mm256_set1_pd(-0.1332560668688523853e+1));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s),
+		                  _mm256_set1_pd(+0.4058509506474178075e+1));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s),
+		                  _mm256_set1_pd(-0.4934797516664651162e+1));
+		u = _mm256_add_pd(_mm256_mul_pd(u, s), _mm256_set1_pd(1.));
+
+		// Then, flip the sign of each double for which invert is not zero.
+		// Since invert has only zero bits except for a possible one in bit 63,
+		// we can xor it onto our result to selectively invert the 63rd (sign)
+		// bit in each double where invert is set.
+		u = _mm256_xor_pd(u, invert);
+
+		// * end computation of cosine
+		// **********
+
+		return u;
+	}
+};
+
+struct AVXFloat {
+	typedef float scalar;
+	typedef __m256 vector;
+	static const int width = 8;
+	static vector zero() { return _mm256_setzero_ps(); }
+	static vector set1(float x) { return _mm256_set1_ps(x); }
+	static vector load(const float *p) { return _mm256_load_ps(p); }
+	static vector add(vector a, vector b) { return _mm256_add_ps(a, b); }
+	static vector mul(vector a, vector b) { return _mm256_mul_ps(a, b); }
+	static float hsum(vector v) { return hsum_float_avx(v); }
+
+	static vector cosPi(vector x) {
+		// as AVXDouble::cosPi; 1.5 * 2^23 moves the ones' position of q into
+		// bit 0 of the mantissa, for -2^22 <= q < 2^22
+		__m256 q = _mm256_round_ps(
+		    x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m256 s = _mm256_sub_ps(x, q);
+		q = _mm256_add_ps(q, _mm256_set1_ps(12582912.f));
+		__m256 invert = _mm256_and_ps(
+		    q, _mm256_castsi256_ps(_mm256_set1_epi32(0xff800001)));
+		invert = _mm256_cmp_ps(
+		    invert, _mm256_castsi256_ps(_mm256_set1_epi32(0x4b000001)),
+		    _CMP_EQ_OQ);
+		invert = _mm256_and_ps(invert, _mm256_set1_ps(-0.f));
+
+		s = _mm256_mul_ps(s, s);
+		__m256 u = _mm256_set1_ps(+0.2211852080653743946e+0f);
+		u = _mm256_add_ps(_mm256_mul_ps(u, s),
+		                  _mm256_set1_ps(-0.1332560668688523853e+1f));
+		u = _mm256_add_ps(_mm256_mul_ps(u, s),
+		                  _mm256_set1_ps(+0.4058509506474178075e+1f));
+		u = _mm256_add_ps(_mm256_mul_ps(u, s),
+		                  _mm256_set1_ps(-0.4934797516664651162e+1f));
+		u = _mm256_add_ps(_mm256_mul_ps(u, s), _mm256_set1_ps(1.f));
+		return _mm256_xor_ps(u, invert);
+	}
+};
+
+#ifdef __AVX512F__
+struct AVX512Double {
+	typedef double scalar;
+	typedef __m512d vector;
+	static const int width = 8;
+	static vector zero() { return _mm512_setzero_pd(); }
+	static vector set1(double x) { return _mm512_set1_pd(x); }
+	static vector load(const double *p) { return _mm512_load_pd(p); }
+	static vector add(vector a, vector b) { return _mm512_add_pd(a, b); }
+	static vector mul(vector a, vector b) { return _mm512_mul_pd(a, b); }
+	static double hsum(vector v) { return _mm512_reduce_add_pd(v); }
+
+	static vector cosPi(vector x) {
+		// as AVXDouble::cosPi, with the integer instructions of AVX-512 for
+		// moving bit 0 of q into the sign bit
+		__m512d q = _mm512_roundscale_pd(
+		    x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m512d s = _mm512_sub_pd(x, q);
+		q = _mm512_add_pd(q, _mm512_set1_pd(0x0018000000000000));
+		__m512i invert = _mm512_slli_epi64(_mm512_castpd_si512(q), 63);
+
+		s = _mm512_mul_pd(s, s);
+		__m512d u = _mm512_set1_pd(+0.2211852080653743946e+0);
+		u = _mm512_add_pd(_mm512_mul_pd(u, s),
+		                  _mm512_set1_pd(-0.1332560668688523853e+1));
+		u = _mm512_add_pd(_mm512_mul_pd(u, s),
+		                  _mm512_set1_pd(+0.4058509506474178075e+1));
+		u = _mm512_add_pd(_mm512_mul_pd(u, s),
+		                  _mm512_set1_pd(-0.4934797516664651162e+1));
+		u = _mm512_add_pd(_mm512_mul_pd(u, s), _mm512_set1_pd(1.));
+		return _mm512_castsi512_pd(
+		    _mm512_xor_si512(_mm512_castpd_si512(u), invert));
+	}
+};
+
+struct AVX512Float {
+	typedef float scalar;
+	typedef __m512 vector;
+	static const int width = 16;
+	static vector zero() { return _mm512_setzero_ps(); }
+	static vector set1(float x) { return _mm512_set1_ps(x); }
+	static vector load(const float *p) { return _mm512_load_ps(p); }
+	static vector add(vector a, vector b) { return _mm512_add_ps(a, b); }
+	static vector mul(vector a, vector b) { return _mm512_mul_ps(a, b); }
+	static float hsum(vector v) { return _mm512_reduce_add_ps(v); }
+
+	static vector cosPi(vector x) {
+		// as AVX512Double::cosPi and AVXFloat::cosPi
+		__m512 q = _mm512_roundscale_ps(
+		    x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+		__m512 s = _mm512_sub_ps(x, q);
+		q = _mm512_add_ps(q, _mm512_set1_ps(12582912.f));
+		__m512i invert = _mm512_slli_epi32(_mm512_castps_si512(q), 31);
+
+		s = _mm512_mul_ps(s, s);
+		__m512 u = _mm512_set1_ps(+0.2211852080653743946e+0f);
+		u = _mm512_add_ps(_mm512_mul_ps(u, s),
+		                  _mm512_set1_ps(-0.1332560668688523853e+1f));
+		u = _mm512_add_ps(_mm512_mul_ps(u, s),
+		                  _mm512_set1_ps(+0.4058509506474178075e+1f));
+		u = _mm512_add_ps(_mm512_mul_ps(u, s),
+		                  _mm512_set1_ps(-0.4934797516664651162e+1f));
+		u = _mm512_add_ps(_mm512_mul_ps(u, s), _mm512_set1_ps(1.f));
+		return _mm512_castsi512_ps(
+		    _mm512_xor_si512(_mm512_castps_si512(u), invert));
+	}
+};
+
+typedef AVX512Double DoubleSIMD;
+typedef AVX512Float FloatSIMD;
+#else
+typedef AVXDouble DoubleSIMD;
+typedef AVXFloat FloatSIMD;
+#endif // __AVX512F__
+
+// sum of the wavemodes with the SIMD type V, for NP positions at once
+template <class V, int NP>
+void sumWavemodes(const typename V::scalar *data, int n, const double *pos,
+                  double *fields) {
+	typedef typename V::scalar scalar;
+	typedef typename V::vector vector;
+
+	// Initialize accumulators
+	//
+	// There is one accumulator per component of the result vector and
+	// position. Note that each accumulator contains V::width numbers. At the
+	// end of the loop, each of these numbers will contain the sum of every
+	// V::width-th wavemode, starting at a different offset. In the end, each
+	// of the accumulator's numbers are added together (using V::hsum),
+	// resulting in the total sum for that component.
+	vector acc[NP][3];
+	for (int j = 0; j < NP; j++)
+		acc[j][0] = acc[j][1] = acc[j][2] = V::zero();
+
+	for (int i = 0; i < n; i += V::width) {
+
+		// Load data from memory into SIMD registers, once for all positions:
+		//  - the three components of the vector A * xi
+		vector Axi0 = V::load(data + i + n * 0);
+		vector Axi1 = V::load(data + i + n * 1);
+		vector Axi2 = V::load(data + i + n * 2);
+
+		//  - the three components of the vector k * kappa
+		vector kkappa0 = V::load(data + i + n * 3);
+		vector kkappa1 = V::load(data + i + n * 4);
+		vector kkappa2 = V::load(data + i + n * 5);
+
+		//  - the phase beta.
+		vector beta = V::load(data + i + n * 6);
+
+		for (int j = 0; j < NP; j++) {
+			// This is the scalar product between k*kappa and pos:
+			vector z = V::add(V::mul(V::set1(scalar(pos[3 * j])), kkappa0),
+			                  V::add(V::mul(V::set1(scalar(pos[3 * j + 1])), kkappa1),
+			                         V::mul(V::set1(scalar(pos[3 * j + 2])), kkappa2)));
+
+			// Here, the phase is added on. This is the argument of the cosine.
+			vector u = V::cosPi(V::add(z, beta));
+
+			// Finally, Ak*xi is multiplied on. Since this is a vector, the
+			// multiplication needs to be done for each of the three
+			// components, so it happens separately.
+			acc[j][0] = V::add(V::mul(u, Axi0), acc[j][0]);
+			acc[j][1] = V::add(V::mul(u, Axi1), acc[j][1]);
+			acc[j][2] = V::add(V::mul(u, Axi2), acc[j][2]);
+		}
+	}
+
+	for (int j = 0; j < NP; j++) {
+		fields[3 * j] = V::hsum(acc[j][0]);
+		fields[3 * j + 1] = V::hsum(acc[j][1]);
+		fields[3 * j + 2] = V::hsum(acc[j][2]);
+	}
+}
+
+template <class V>
+void planeWaves(const typename V::scalar *data, int n, const double *positions,
+                double *fields, size_t nPos) {
+	// blocks of four positions, then the rest one by one
+	size_t j = 0;
+	for (; j + 4 <= nPos; j += 4)
+		sumWavemodes<V, 4>(data, n, positions + 3 * j, fields + 3 * j);
+	for (; j < nPos; j++)
+		sumWavemodes<V, 1>(data, n, positions + 3 * j, fields + 3 * j);
+}
+
+// ----------------------------------------------------------------------------
+// tricubic interpolation, see Grid::tricubicInterpolate
+
+/** a * b + c, fused if the target supports FMA */
+inline __m256d mulAdd(__m256d a, __m256d b, __m256d c) {
+#ifdef __FMA__
+	return _mm256_fmadd_pd(a, b, c);
+#else
+	return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+inline __m256 mulAdd(__m256 a, __m256 b, __m256 c) {
+#ifdef __FMA__
+	return _mm256_fmadd_ps(a, b, c);
+#else
+	return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+void tricubic3f(const float *values, const size_t iX[4], const size_t iY[4],
+                const size_t iZ[4], const double wX[4], const double wY[4],
+                const double wZ[4], float result[3]) {
+	// the components of two neighbours along z per register
+	__m256 acc = _mm256_setzero_ps();
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			const float *row = values + 3 * (iX[i] + iY[j]);
+			double wXY = wX[i] * wY[j];
+			for (int k = 0; k < 4; k += 2) {
+				const float *a = row + 3 * iZ[k];
+				const float *b = row + 3 * iZ[k + 1];
+				float wa = wXY * wZ[k];
+				float wb = wXY * wZ[k + 1];
+				__m256 p = _mm256_set_ps(0, b[2], b[1], b[0], 0, a[2], a[1], a[0]);
+				__m256 w = _mm256_set_ps(wb, wb, wb, wb, wa, wa, wa, wa);
+				acc = mulAdd(w, p, acc);
+			}
+		}
+	float sum[4];
+	_mm_storeu_ps(sum, _mm_add_ps(_mm256_castps256_ps128(acc),
+	                              _mm256_extractf128_ps(acc, 1)));
+	result[0] = sum[0];
+	result[1] = sum[1];
+	result[2] = sum[2];
+}
+
+void tricubic3d(const double *values, const size_t iX[4], const size_t iY[4],
+                const size_t iZ[4], const double wX[4], const double wY[4],
+                const double wZ[4], double result[3]) {
+	// the three components of a neighbour per register
+	__m256d acc = _mm256_setzero_pd();
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			const double *row = values + 3 * (iX[i] + iY[j]);
+			double wXY = wX[i] * wY[j];
+			for (int k = 0; k < 4; k++) {
+				const double *v = row + 3 * iZ[k];
+				acc = mulAdd(_mm256_set1_pd(wXY * wZ[k]),
+				             _mm256_set_pd(0, v[2], v[1], v[0]), acc);
+			}
+		}
+	double sum[4];
+	_mm256_storeu_pd(sum, acc);
+	result[0] = sum[0];
+	result[1] = sum[1];
+	result[2] = sum[2];
+}
+
+double tricubic1d(const double *values, const size_t iX[4], const size_t iY[4],
+                  const size_t iZ[4], const double wX[4], const double wY[4],
+                  const double wZ[4]) {
+	// the four neighbours along z per register, weighted along z at the end
+	__m256d acc = _mm256_setzero_pd();
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			const double *row = values + iX[i] + iY[j];
+			__m256d p = _mm256_set_pd(row[iZ[3]], row[iZ[2]], row[iZ[1]], row[iZ[0]]);
+			acc = mulAdd(_mm256_set1_pd(wX[i] * wY[j]), p, acc);
+		}
+	acc = _mm256_mul_pd(acc, _mm256_set_pd(wZ[3], wZ[2], wZ[1], wZ[0]));
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+} // namespace
+
+void CRPROPA_SIMD_KERNELS(SimdKernels &kernels) {
+	kernels.tricubic3f = tricubic3f;
+	kernels.tricubic3d = tricubic3d;
+	kernels.tricubic1d = tricubic1d;
+	kernels.planeWaves = planeWaves<DoubleSIMD>;
+	kernels.planeWavesFloat = planeWaves<FloatSIMD>;
+	kernels.logArray = simdmath::logArray;
+	kernels.log10Array = simdmath::log10Array;
+	kernels.expArray = simdmath::expArray;
+	kernels.pow10Array = simdmath::pow10Array;
+	kernels.sinCosArray = simdmath::sinCosArray;
+}
+
+} // namespace crpropa
@@ -0,0 +1,242 @@
+// Elementwise log, log10, exp, pow10 and sincos of arrays, see
+// crpropa/SimdMath.h. The functions are branch-free, use no calls of libm
+// and only integer operations on the bits of the doubles that SSE2 has, so
+// that the compiler vectorizes the loops for the instruction set of the file
+// that includes this one: once in SimdMath.cpp for the baseline of the build
+// and once per SimdLevel in SimdKernels.h. As for the vectorized cosine of
+// PlaneWaveTurbulence, the integers are taken from the mantissa of x + 1.5 *
+// 2^52 instead of a conversion.
+//
+// The selects of the special cases are only vectorized with
+// -fno-trapping-math, see CMakeLists.txt.
+//
+// The functions are in an anonymous namespace: each file that includes this
+// one has its own copy, compiled for its instruction set.
+
+#ifndef CRPROPA_SIMD_SIMDMATH_H
+#define CRPROPA_SIMD_SIMDMATH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace crpropa {
+namespace {
+namespace simdmath {
+
+// x + magic - magic rounds x to an integer for |x| < 2^51, and the lower bits
+// of the mantissa of x + magic are the integer in two's complement
+const double magic = 6755399441055744.0; // 1.5 * 2^52
+const uint64_t magicBits = 0x4338000000000000ULL;
+
+const double ln2Hi = 6.93147180369123816490e-01; // the lower 32 bits are 0
+const double ln2Lo = 1.90821492927058770002e-10;
+const double log10of2Hi = 0.30102992057800293; // the lower 32 bits are 0
+const double log10of2Lo = 7.508597826552623503e-08;
+const double ln10 = 2.302585092994046;
+const double log2e = 1.4426950408889634;
+const double log2of10 = 3.321928094887362;
+const double log10e = 0.4342944819032518;
+// pi / 2 in three parts of 33 bits each, as in fdlibm
+const double pio2Part1 = 1.57079632673412561417e+00;
+const double pio2Part2 = 6.07710050650619224932e-11;
+const double pio2Part3 = 2.02226624871116645580e-21;
+const double twoOverPi = 0.63661977236758134308;
+
+const double infinity = __builtin_inf();
+const double notANumber = __builtin_nan("");
+
+inline uint64_t bitsOf(double x) {
+	uint64_t b;
+	memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+inline double fromBits(uint64_t b) {
+	double x;
+	memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+// exp(r) for |r| <= ln(2) / 2, Taylor series to r^13 / 13!
+inline double expPolynomial(double r) {
+	double p = 1. / 6227020800.;
+	p = p * r + 1. / 479001600.;
+	p = p * r + 1. / 39916800.;
+	p = p * r + 1. / 3628800.;
+	p = p * r + 1. / 362880.;
+	p = p * r + 1. / 40320.;
+	p = p * r + 1. / 5040.;
+	p = p * r + 1. / 720.;
+	p = p * r + 1. / 120.;
+	p = p * r + 1. / 24.;
+	p = p * r + 1. / 6.;
+	p = p * r + 0.5;
+	p = p * r + 1.;
+	return p * r + 1.;
+}
+
+// 2^k for the bits of k + magic, -1022 <= k <= 1023
+inline double twoToThe(uint64_t kBits) {
+	return fromBits((kBits - magicBits + 1023) << 52);
+}
+
+// exp(x); 0 for x < -708.40, where the result would be subnormal
+inline double exp(double x) {
+	double xc = (x > 709.782712893384) ? 709.782712893384 : x;
+	xc = (xc < -708.3964185322641) ? -708.3964185322641 : xc;
+	double t = xc * log2e + magic;
+	double k = t - magic;
+	double r = (xc - k * ln2Hi) - k * ln2Lo;
+	// 2^k as 2^(k - 1) * 2 for k = 1024
+	uint64_t large = (xc > 709.) ? 1 : 0;
+	double y = expPolynomial(r) * twoToThe(bitsOf(t) - large) * twoToThe(magicBits + large);
+	y = (x > 709.782712893384) ? infinity : y;
+	y = (x < -708.3964185322641) ? 0. : y;
+	return (x != x) ? x : y;
+}
+
+// 10^x; 0 for x < -307.65, where the result would be subnormal
+inline double pow10(double x) {
+	double xc = (x > 308.25471555991675) ? 308.25471555991675 : x;
+	xc = (xc < -307.6526555685888) ? -307.6526555685888 : xc;
+	double t = xc * log2of10 + magic;
+	double k = t - magic;
+	// x - k log10(2) is exact up to the rounding of the last subtraction
+	double r = ((xc - k * log10of2Hi) - k * log10of2Lo) * ln10;
+	uint64_t large = (xc > 308.) ? 1 : 0;
+	double y = expPolynomial(r) * twoToThe(bitsOf(t) - large) * twoToThe(magicBits + large);
+	y = (x > 308.25471555991675) ? infinity : y;
+	y = (x < -307.6526555685888) ? 0. : y;
+	return (x != x) ? x : y;
+}
+
+// exponent e and mantissa m in [sqrt(1/2), sqrt(2)) of x = m 2^e, x > 0
+inline void frexpSqrt2(double x, double &e, double &m) {
+	// subnormal numbers are scaled to normal ones first
+	bool subnormal = x < 2.2250738585072014e-308;
+	x = subnormal ? x * 18014398509481984. : x; // 2^54
+	uint64_t b = bitsOf(x);
+	// the biased exponent as a double, from the mantissa of 2^52 + exponent
+	e = fromBits(0x4330000000000000ULL | (b >> 52)) - 4503599627370496.;
+	e -= subnormal ? 1023. + 54. : 1023.;
+	m = fromBits((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	bool large = m > 1.4142135623730951;
+	m = large ? 0.5 * m : m;
+	e = large ? e + 1. : e;
+}
+
+// log(m) for m in [sqrt(1/2), sqrt(2)): 2 atanh(f), f = (m - 1) / (m + 1),
+// with the series of atanh to f^23
+inline double logMantissa(double m) {
+	double f = (m - 1.) / (m + 1.);
+	double s = f * f;
+	double p = 1. / 23.;
+	p = p * s + 1. / 21.;
+	p = p * s + 1. / 19.;
+	p = p * s + 1. / 17.;
+	p = p * s + 1. / 15.;
+	p = p * s + 1. / 13.;
+	p = p * s + 1. / 11.;
+	p = p * s + 1. / 9.;
+	p = p * s + 1. / 7.;
+	p = p * s + 1. / 5.;
+	p = p * s + 1. / 3.;
+	return 2. * f + 2. * f * s * p;
+}
+
+// log(x) or log10(x) for special x: -inf for 0, nan for negative x and nan
+inline double logSpecial(double x, double y) {
+	y = (x == infinity) ? infinity : y;
+	y = (x == 0.) ? -infinity : y;
+	y = (x < 0.) ? notANumber : y;
+	return (x != x) ? x : y;
+}
+
+inline double log(double x) {
+	double e, m;
+	frexpSqrt2(x, e, m);
+	double y = e * ln2Hi + (logMantissa(m) + e * ln2Lo);
+	return logSpecial(x, y);
+}
+
+inline double log10(double x) {
+	double e, m;
+	frexpSqrt2(x, e, m);
+	double y = e * log10of2Hi + (logMantissa(m) * log10e + e * log10of2Lo);
+	return logSpecial(x, y);
+}
+
+// sin(x) and cos(x), reduced to |r| <= pi / 4 with the quadrant q
+inline void sincos(double x, double &s, double &c) {
+	double t = x * twoOverPi + magic;
+	double q = t - magic;
+	double r = ((x - q * pio2Part1) - q * pio2Part2) - q * pio2Part3;
+	double r2 = r * r;
+
+	// Taylor series to r^17 / 17! and r^18 / 18!
+	double ps = -1. / 355687428096000.;
+	ps = ps * r2 + 1. / 1307674368000.;
+	ps = ps * r2 - 1. / 6227020800.;
+	ps = ps * r2 + 1. / 39916800.;
+	ps = ps * r2 - 1. / 362880.;
+	ps = ps * r2 + 1. / 5040.;
+	ps = ps * r2 - 1. / 120.;
+	ps = ps * r2 + 1. / 6.;
+	double sr = r - r * r2 * ps;
+	double pc = 1. / 6402373705728000.;
+	pc = pc * r2 - 1. / 20922789888000.;
+	pc = pc * r2 + 1. / 87178291200.;
+	pc = pc * r2 - 1. / 479001600.;
+	pc = pc * r2 + 1. / 3628800.;
+	pc = pc * r2 - 1. / 40320.;
+	pc = pc * r2 + 1. / 720.;
+	pc = pc * r2 - 1. / 24.;
+	pc = pc * r2 + 0.5;
+	double cr = 1. - r2 * pc;
+
+	// quadrant n = q mod 4: odd quadrants swap sin and cos, the sign of
+	// sin is negative for n = 2, 3 and that of cos for n = 1, 2
+	uint64_t n = bitsOf(t);
+	uint64_t swap = 0 - (n & 1);
+	uint64_t sBits = (bitsOf(sr) & ~swap) | (bitsOf(cr) & swap);
+	uint64_t cBits = (bitsOf(cr) & ~swap) | (bitsOf(sr) & swap);
+	s = fromBits(sBits ^ ((n & 2) << 62));
+	c = fromBits(cBits ^ (((n + 1) & 2) << 62));
+	// nan for infinite x
+	s = (x - x != 0.) ? notANumber : s;
+	c = (x - x != 0.) ? notANumber : c;
+}
+
+// loops over arrays, which the compiler vectorizes
+
+void logArray(const double *x, double *y, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		y[i] = log(x[i]);
+}
+
+void log10Array(const double *x, double *y, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		y[i] = log10(x[i]);
+}
+
+void expArray(const double *x, double *y, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		y[i] = exp(x[i]);
+}
+
+void pow10Array(const double *x, double *y, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		y[i] = pow10(x[i]);
+}
+
+void sinCosArray(const double *x, double *s, double *c, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		sincos(x[i], s[i], c[i]);
+}
+
+} // namespace simdmath
+} // namespace
+} // namespace crpropa
+
+#endif // CRPROPA_SIMD_SIMDMATH_H
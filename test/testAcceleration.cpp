@@ -0,0 +1,66 @@
+#include "crpropa/Candidate.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
+#include "crpropa/module/Acceleration.h"
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+namespace crpropa {
+
+// mean and variance of the logarithmic energy gain of one propagation step
+static void logGain(AbstractAccelerationModule &module, double step,
+		double &mean, double &variance) {
+	const size_t n = 4000;
+	double sum = 0, sum2 = 0;
+	for (size_t i = 0; i < n; i++) {
+		Candidate c(11, 1 * EeV);
+		c.setCurrentStep(step);
+		c.setNextStep(step);
+		module.process(&c);
+		double l = log(c.current.getEnergy() / EeV);
+		sum += l;
+		sum2 += l * l;
+	}
+	mean = sum / n;
+	variance = sum2 / n - mean * mean;
+}
+
+TEST(SecondOrderFermi, compoundScattering) {
+	Random::instance().seed(42);
+	SecondOrderFermi module(0.1 * c_light, 1 * parsec, 1000);
+	EXPECT_FALSE(module.getCompoundScattering());
+
+	// per scattering and compound: explicit gains and normal distribution
+	const double steps[] = {10 * parsec, 200 * parsec};
+	for (size_t i = 0; i < 2; i++) {
+		double mean, variance, compoundMean, compoundVariance;
+		module.setCompoundScattering(false);
+		logGain(module, steps[i], mean, variance);
+		module.setCompoundScattering(true);
+		logGain(module, steps[i], compoundMean, compoundVariance);
+		EXPECT_GT(mean, 0);
+		EXPECT_NEAR(mean, compoundMean, 5 * sqrt(2 * variance / 4000));
+		EXPECT_NEAR(variance, compoundVariance, 0.1 * variance);
+	}
+}
+
+TEST(DirectedFlowScattering, compoundScattering) {
+	Random::instance().seed(42);
+	DirectedFlowScattering module(Vector3d(0.1 * c_light, 0, 0), 1 * parsec);
+	double mean, variance, compoundMean, compoundVariance;
+	logGain(module, 3 * parsec, mean, variance);
+	module.setCompoundScattering(true);
+	logGain(module, 3 * parsec, compoundMean, compoundVariance);
+	EXPECT_NEAR(mean, compoundMean, 5 * sqrt(2 * variance / 4000));
+	EXPECT_NEAR(variance, compoundVariance, 0.1 * variance);
+
+	// the next step is limited to the scattering length in both modes
+	Candidate c(11, 1 * EeV);
+	c.setCurrentStep(3 * parsec);
+	c.setNextStep(3 * parsec);
+	module.process(&c);
+	EXPECT_GT(3 * parsec, c.getNextStep());
+}
+
+} // namespace crpropa
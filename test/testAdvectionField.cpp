@@ -166,4 +166,28 @@ TEST(testSphericalAdvectionShock, SimpleTest) {
 	
 }
 
+TEST(testAdvectionFieldGrid, SimpleTest) {
+	// linear flow v = (x, 2 y, 0) / s in the interior of the grid
+	double spacing = 10 * pc;
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 8, spacing);
+	for (int ix = 0; ix < 8; ix++)
+		for (int iy = 0; iy < 8; iy++)
+			for (int iz = 0; iz < 8; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, 2 * iy, 0);
+
+	AdvectionFieldGrid A(grid, 10 * km / sec);
+	Vector3d pos = Vector3d(3.2, 4.1, 5.7) * spacing;
+	Vector3d v = A.getField(pos);
+	EXPECT_NEAR(2.7 * 10 * km / sec, v.x, 1e-4 * km / sec);
+	EXPECT_NEAR(7.2 * 10 * km / sec, v.y, 1e-4 * km / sec);
+	EXPECT_DOUBLE_EQ(0, v.z);
+	EXPECT_NEAR(3 * 10 * km / sec / spacing, A.getDivergence(pos), 1e-6 * km / sec / spacing);
+
+	// with a given divergence
+	ref_ptr<Grid1f> div = new Grid1f(Vector3d(0.), 8, spacing);
+	div->get(3, 3, 5) = 1;
+	AdvectionFieldGrid B(grid, div, 2);
+	EXPECT_FLOAT_EQ(2, B.getDivergence(Vector3d(3.5, 3.5, 5.5) * spacing));
+}
+
 } //namespace crpropa
@@ -2,11 +2,16 @@
 
 #include "crpropa/module/BreakCondition.h"
 #include "crpropa/module/Observer.h"
+#include "crpropa/module/DiffusionEstimator.h"
 #include "crpropa/module/Boundary.h"
 #include "crpropa/module/Tools.h"
 #include "crpropa/module/RestrictToRegion.h"
+#include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/WeightWindow.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/Geometry.h"
+#include "crpropa/Random.h"
+#include "crpropa/Units.h"
 
 #include "gtest/gtest.h"
 
@@ -53,6 +58,19 @@ TEST(MinimumChargeNumber, test) {
 	EXPECT_TRUE(c.hasProperty("Rejected"));
 }
 
+TEST(MinimumEnergyPerParticleId, applyToSecondaries) {
+	MinimumEnergyPerParticleId minEnergy(1);
+	minEnergy.add(22, 10);
+	minEnergy.applyToSecondaries();
+	EXPECT_DOUBLE_EQ(Candidate::getSecondaryThreshold(22), 10);
+	EXPECT_DOUBLE_EQ(Candidate::getSecondaryThreshold(11), 1);
+	Candidate::clearSecondaryThresholds();
+
+	// rejected candidates have to be dropped without any action
+	minEnergy.setMakeRejectedInactive(false);
+	EXPECT_THROW(minEnergy.applyToSecondaries(), std::runtime_error);
+}
+
 TEST(MinimumEnergyPerParticleId, test) {
 	MinimumEnergyPerParticleId minEnergy(1);
 	minEnergy.add(22, 10);
@@ -139,6 +157,44 @@ TEST(MinimumRedshift, test) {
 	EXPECT_TRUE(c.hasProperty("Rejected"));
 }
 
+TEST(ReachabilityPruning, range) {
+	// constant loss length: range L * ln(E / Emin)
+	ReachabilityPruning pruning(1 * EeV);
+	int id = 11;
+	std::vector<double> energies, lengths;
+	energies.push_back(1 * EeV);
+	energies.push_back(1000 * EeV);
+	lengths.push_back(10 * Mpc);
+	lengths.push_back(10 * Mpc);
+	pruning.setLossLength(id, energies, lengths);
+	double range = pruning.getRange(id, 100 * EeV);
+	EXPECT_GE(range, 10 * Mpc * log(100));
+	EXPECT_NEAR(range, 10 * Mpc * log(100), 0.05 * Mpc);
+	EXPECT_DOUBLE_EQ(pruning.getRange(id, 0.5 * EeV), 0);
+	EXPECT_TRUE(std::isinf(pruning.getRange(22, 100 * EeV)));
+
+	// 1D: observer at x = 0
+	pruning.set1D(true);
+	Candidate c(id, 100 * EeV, Vector3d(40 * Mpc, 0, 0));
+	pruning.process(&c);
+	EXPECT_TRUE(c.isActive());
+	c.current.setPosition(Vector3d(50 * Mpc, 0, 0));
+	pruning.process(&c);
+	EXPECT_FALSE(c.isActive());
+
+	// 3D: distance to the surface of the nearest observer
+	pruning.set1D(false);
+	pruning.addObserverPosition(Vector3d(100 * Mpc, 0, 0), 5 * Mpc);
+	pruning.addObserverPosition(Vector3d(0, 100 * Mpc, 0));
+	EXPECT_DOUBLE_EQ(pruning.getDistance(Vector3d(50 * Mpc, 0, 0)), 45 * Mpc);
+	Candidate d(id, 100 * EeV, Vector3d(60 * Mpc, 0, 0));
+	pruning.process(&d);
+	EXPECT_TRUE(d.isActive());
+	d.current.setPosition(Vector3d(0, 0, 0));
+	pruning.process(&d);
+	EXPECT_FALSE(d.isActive());
+}
+
 TEST(DetectionLength, test) {
         DetectionLength detL(10);
 	detL.setMakeRejectedInactive(false);
@@ -180,6 +236,51 @@ TEST(ObserverFeature, SmallSphere) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(ObserverFeature, MultiSurface) {
+	// a lattice of small spheres and a plane, compared to a list of surfaces
+	ObserverMultiSurface multi(2);
+	std::vector<ref_ptr<Surface> > list;
+	for (int i = 0; i < 10; i++)
+		for (int j = 0; j < 10; j++)
+			for (int k = 0; k < 10; k++) {
+				ref_ptr<Surface> s = new Sphere(Vector3d(i, j, k) * 3, 0.5 + 0.05 * i);
+				multi.add(s);
+				list.push_back(s);
+			}
+	ref_ptr<Surface> plane = new Plane(Vector3d(0, 0, -5), Vector3d(0, 0, 1));
+	multi.add(plane);
+	list.push_back(plane);
+	multi.setIndexProperty("Target");
+	EXPECT_EQ(1001, multi.getNumberOfSurfaces());
+
+	Random random(42);
+	for (int n = 0; n < 2000; n++) {
+		Candidate c;
+		c.previous.setPosition(random.randVector() * random.randUniform(0, 40) + Vector3d(13.5));
+		c.current.setPosition(c.previous.getPosition() + random.randVector() * random.randUniform(0, 5));
+		c.setNextStep(100);
+
+		double dMin = 100;
+		int crossed = -1;
+		for (size_t i = 0; i < list.size(); i++) {
+			double d = list[i]->distance(c.current.getPosition());
+			double dPrev = list[i]->distance(c.previous.getPosition());
+			dMin = std::min(dMin, fabs(d));
+			if ((crossed < 0) and (d * dPrev <= 0) and (dPrev != 0))
+				crossed = i;
+		}
+
+		DetectionState state = multi.checkDetection(&c);
+		EXPECT_EQ(crossed >= 0 ? DETECTED : NOTHING, state);
+		if (crossed >= 0)
+			EXPECT_EQ(uint64_t(crossed), c.getProperty("Target").toUInt64());
+		// the limit is a lower bound, which is exact near the surfaces
+		EXPECT_LE(c.getNextStep(), dMin * (1 + 1e-12));
+		if (dMin < 2)
+			EXPECT_DOUBLE_EQ(dMin, c.getNextStep());
+	}
+}
+
 TEST(ObserverFeature, LargeSphere) {
 	// detect if the current position is outside and the previous inside of the sphere
 	Observer obs;
@@ -203,6 +304,46 @@ TEST(ObserverFeature, LargeSphere) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(ObserverFeature, SurfaceCrossing) {
+	// detect at the crossing of the step instead of limiting the steps
+	Observer obs;
+	ObserverSurface *surface = new ObserverSurface(new Plane(Vector3d(10, 0, 0), Vector3d(1, 0, 0)));
+	surface->setInterpolateCrossing(true);
+	obs.add(surface);
+	Candidate c;
+	c.previous.setPosition(Vector3d(8, 0, 0));
+	c.previous.setDirection(Vector3d(1, 0, 0));
+	c.previous.setEnergy(10 * EeV);
+	c.current.setPosition(Vector3d(12, 0, 0));
+	c.current.setDirection(Vector3d(1, 0, 0));
+	c.current.setEnergy(8 * EeV);
+	c.setCurrentStep(4);
+	c.setNextStep(100);
+	obs.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_DOUBLE_EQ(100, c.getNextStep());
+	EXPECT_NEAR(10, c.current.getPosition().x, 1e-9);
+	EXPECT_GE(c.current.getPosition().x, 10);
+	EXPECT_NEAR(2, c.getCurrentStep(), 1e-9);
+	EXPECT_NEAR(2, c.getTrajectoryLength(), 1e-9);
+	EXPECT_NEAR(9 * EeV, c.current.getEnergy(), 1e-9 * EeV);
+
+	// quarter circle of radius 1, crossing at 45 degrees; the interpolation
+	// is of third order, about 1% off the circle for a quarter turn
+	Candidate d;
+	d.previous.setPosition(Vector3d(1, 0, 0));
+	d.previous.setDirection(Vector3d(0, 1, 0));
+	d.current.setPosition(Vector3d(0, 1, 0));
+	d.current.setDirection(Vector3d(-1, 0, 0));
+	d.setCurrentStep(M_PI / 2);
+	Plane diagonal(Vector3d(0, 0, 0), Vector3d(-1, 1, 0) / sqrt(2));
+	d.interpolateStep(diagonal.getStepCrossing(&d));
+	EXPECT_NEAR(sqrt(0.5), d.current.getPosition().x, 2e-2);
+	EXPECT_NEAR(sqrt(0.5), d.current.getPosition().y, 2e-2);
+	EXPECT_NEAR(-sqrt(0.5), d.current.getDirection().x, 1e-2);
+	EXPECT_NEAR(M_PI / 4, d.getCurrentStep(), 1e-2);
+}
+
 TEST(ObserverFeature, Point) {
 	Observer obs;
 	obs.add(new ObserverPoint());
@@ -265,6 +406,12 @@ TEST(ObserverFeature, TimeEvolution) {
   obs.process(&c);
   EXPECT_TRUE(c.isActive());
   EXPECT_TRUE(c.hasProperty("Detected"));
+
+  // no detection after the last time
+  c.removeProperty("Detected");
+  c.setTrajectoryLength(20);
+  obs.process(&c);
+  EXPECT_FALSE(c.hasProperty("Detected"));
 }
 
 TEST(ObserverFeature, TimeEvolutionLog) {
@@ -304,6 +451,50 @@ TEST(ObserverFeature, TimeEvolutionLog) {
   EXPECT_TRUE(c.hasProperty("Detected"));
 }
 
+TEST(DiffusionEstimator, ballistic) {
+	// straight lines along x (weight 1) and z (weight 3), detected at 1 and 2 kpc
+	ref_ptr<ObserverTimeEvolution> times = new ObserverTimeEvolution(1 * kpc, 1 * kpc, 2);
+	ref_ptr<DiffusionEstimator> estimator = new DiffusionEstimator(times->getTimes());
+	Observer obs;
+	obs.setDeactivateOnDetection(false);
+	obs.add(times);
+	obs.onDetection(estimator);
+	SimplePropagation propagation(1 * pc, 0.3 * kpc);
+
+	Candidate a(nucleusId(1, 1), 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	Candidate b(nucleusId(1, 1), 1 * EeV, Vector3d(0.), Vector3d(0, 0, 1));
+	b.setWeight(3);
+	for (int i = 0; i < 20; i++) {
+		propagation.process(&a);
+		obs.process(&a);
+		propagation.process(&b);
+		obs.process(&b);
+	}
+	estimator->endRun();
+
+	for (size_t i = 0; i < 2; i++) {
+		double L = (i + 1) * kpc;
+		EXPECT_EQ(2, estimator->getCount(i));
+		EXPECT_DOUBLE_EQ(4, estimator->getWeight(i));
+		Vector3d msd = estimator->getMeanSquaredDisplacement(i);
+		EXPECT_NEAR(L * L / 4, msd.x, 1e-6 * L * L);
+		EXPECT_NEAR(0, msd.y, 1e-6 * L * L);
+		EXPECT_NEAR(3 * L * L / 4, msd.z, 1e-6 * L * L);
+		EXPECT_NEAR(3 * L / 4, estimator->getMeanDisplacement(i).z, 1e-6 * L);
+		EXPECT_NEAR(3 * L * L / 4, estimator->getParallelMeanSquaredDisplacement(i), 1e-6 * L * L);
+		EXPECT_NEAR(L * L / 4, estimator->getPerpendicularMeanSquaredDisplacement(i), 1e-6 * L * L);
+		// D = <dx^2> / 2t with t = L / c
+		double D = 3 * L * L / 4 / (2 * L / c_light);
+		EXPECT_NEAR(D, estimator->getParallelDiffusionCoefficient(i), 1e-6 * D);
+		EXPECT_NEAR(D, estimator->getDiffusionCoefficient(i).z, 1e-6 * D);
+	}
+
+	estimator->clear();
+	EXPECT_EQ(0, estimator->getCount(0));
+	EXPECT_THROW(estimator->getWeight(2), std::runtime_error);
+	EXPECT_THROW(DiffusionEstimator(std::vector<double>()), std::runtime_error);
+}
+
 //** ========================= Boundaries =================================== */
 TEST(PeriodicBox, high) {
 	// Tests if the periodical boundaries place the particle back inside the box and translate the initial position accordingly.
@@ -462,6 +653,23 @@ TEST(SphericalBoundary, limitStep) {
 	EXPECT_DOUBLE_EQ(1.5, c.getNextStep());
 }
 
+TEST(SphericalBoundary, interpolateCrossing) {
+	SphericalBoundary sphere(Vector3d(0, 0, 0), 10);
+	sphere.setInterpolateCrossing(true);
+	Candidate c;
+	c.previous.setPosition(Vector3d(9, 0, 0));
+	c.previous.setDirection(Vector3d(1, 0, 0));
+	c.current.setPosition(Vector3d(11, 0, 0));
+	c.current.setDirection(Vector3d(1, 0, 0));
+	c.setCurrentStep(2);
+	c.setNextStep(100);
+	sphere.process(&c);
+	EXPECT_FALSE(c.isActive());
+	EXPECT_NEAR(10, c.current.getPosition().x, 1e-9);
+	EXPECT_NEAR(1, c.getTrajectoryLength(), 1e-9);
+	EXPECT_DOUBLE_EQ(100, c.getNextStep());
+}
+
 TEST(EllipsoidalBoundary, inside) {
 	EllipsoidalBoundary ellipsoid(Vector3d(-5, 0, 0), Vector3d(5, 0, 0), 15);
 	Candidate c;
@@ -536,10 +744,137 @@ TEST(RestrictToRegion, RestrictToRegion) {
 	EXPECT_FALSE(c.isActive());
 }
 
+TEST(PerformanceModule, counters) {
+	PerformanceModule performance;
+	performance.add(new MinimumEnergy(5));
+	performance.add(new MaximumTrajectoryLength(10));
+
+	// counters of the threads are merged
+#pragma omp parallel for
+	for (int i = 0; i < 100; i++) {
+		Candidate c;
+		performance.process(&c);
+	}
+	EXPECT_EQ(100, performance.getSteps());
+	EXPECT_EQ(100, performance.getCalls(0));
+	EXPECT_EQ(100, performance.getCalls(1));
+	EXPECT_GE(performance.getTime(0), 0);
+
+	std::vector<uint64_t> histogram = performance.getTimeHistogram(1);
+	EXPECT_EQ(PerformanceModule::histogramBins, histogram.size());
+	uint64_t sum = 0;
+	for (size_t i = 0; i < histogram.size(); i++)
+		sum += histogram[i];
+	EXPECT_EQ(100, sum);
+
+	std::string json = performance.toJSON();
+	EXPECT_EQ(0, json.find("{\"steps\": 100, \"modules\": [{\"description\": "));
+	EXPECT_THROW(performance.getCalls(2), std::runtime_error);
+
+	performance.reset();
+	EXPECT_EQ(0, performance.getSteps());
+}
+
+TEST(PerformanceModule, hardwareCounters) {
+	PerformanceModule performance;
+	performance.add(new MinimumEnergy(5));
+	performance.setHardwareCounters(true);
+	EXPECT_TRUE(performance.getHardwareCounters());
+	for (int i = 0; i < 100; i++) {
+		Candidate c;
+		performance.process(&c);
+	}
+	EXPECT_EQ(100, performance.getCalls(0));
+	std::string json = performance.toJSON();
+	EXPECT_NE(std::string::npos, json.find("\"cacheMisses\": "));
+	EXPECT_THROW(performance.getHardwareCount(1, PerformanceModule::Cycles), std::runtime_error);
+
+	// without access to the counters (e.g. in containers) none are counted
+	if (not PerformanceModule::hasHardwareCounters()) {
+		EXPECT_EQ(0, performance.getHardwareCount(0, PerformanceModule::Cycles));
+		return;
+	}
+	EXPECT_GT(performance.getHardwareCount(0, PerformanceModule::Cycles), 0);
+	EXPECT_GT(performance.getHardwareCount(0, PerformanceModule::Instructions), 0);
+}
+
+TEST(StepLimiterProfiler, wins) {
+	ref_ptr<StepLimiterProfiler> profiler = new StepLimiterProfiler();
+	profiler->add(new SimplePropagation(0.1 * Mpc, 1 * Mpc));
+	profiler->add(new MaximumTrajectoryLength(9.5 * Mpc));
+
+	// 9 steps of 1 Mpc, the last one limited to 0.5 Mpc, then rejected
+	Candidate c(22, 2 * EeV);
+	c.setNextStep(1 * Mpc);
+	while (c.isActive())
+		profiler->process(&c);
+	EXPECT_EQ(9, profiler->getSteps());
+	EXPECT_EQ(8, profiler->getWins(0));
+	EXPECT_EQ(1, profiler->getWins(1));
+	EXPECT_EQ(8, profiler->getWins(0, 22, 18));
+	EXPECT_EQ(0, profiler->getWins(0, 22, 17));
+	EXPECT_EQ(0, profiler->getWins(0, 11, 18));
+	EXPECT_THROW(profiler->getWins(2), std::runtime_error);
+
+	std::string json = profiler->toJSON();
+	EXPECT_EQ(0, json.find("{\"steps\": 9, \"modules\": [{\"description\": "));
+	EXPECT_NE(std::string::npos, json.find("{\"id\": 22, \"decade\": 18, \"wins\": 1}"));
+
+	profiler->reset();
+	EXPECT_EQ(0, profiler->getSteps());
+
+	// the bids outside of the profiler are not attributed
+	c.setNextStep(1 * Mpc);
+	c.limitNextStep(0.5 * Mpc);
+	EXPECT_EQ(0, profiler->getSteps());
+}
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
 }
 
+TEST(WeightWindow, rouletteAndSplitting) {
+	WeightWindow window(0.5, 2, 10);
+
+	// roulette keeps the expected weight
+	size_t n = 100000;
+	double sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		Candidate c(22, 1 * EeV);
+		c.setWeight(0.01);
+		window.process(&c);
+		if (c.isActive()) {
+			EXPECT_DOUBLE_EQ(c.getWeight(), 1);
+			sum += c.getWeight();
+		}
+	}
+	EXPECT_NEAR(sum / n, 0.01, 0.001);
+
+	// splitting into ceil(7 / 2) candidates
+	Candidate c(22, 1 * EeV);
+	c.setWeight(7);
+	window.process(&c);
+	ASSERT_EQ(c.secondaries.size(), 3);
+	EXPECT_DOUBLE_EQ(c.getWeight(), 1.75);
+	EXPECT_DOUBLE_EQ(c.secondaries[0]->getWeight(), 1.75);
+	EXPECT_EQ(c.secondaries[0]->current.getId(), 22);
+	EXPECT_NE(c.secondaries[0]->getSerialNumber(), c.getSerialNumber());
+
+	// inside of the window nothing happens
+	window.process(&c);
+	EXPECT_EQ(c.secondaries.size(), 3);
+	EXPECT_TRUE(c.isActive());
+
+	// importances
+	window.setEnergyImportance(1 * EeV, 1);
+	window.setSpeciesImportance(11, 0);
+	window.setObserverImportance(Vector3d(0.), 1 * Mpc);
+	Candidate e(22, 10 * EeV, Vector3d(1 * Mpc, 0, 0));
+	EXPECT_DOUBLE_EQ(window.getImportance(&e), 5);
+	e.current.setId(11);
+	window.process(&e);
+	EXPECT_FALSE(e.isActive());
+}
+
 } // namespace crpropa
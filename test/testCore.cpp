@@ -5,20 +5,36 @@
 	Common functions
  */
 
+#include "crpropa/AdaptiveThinning.h"
 #include "crpropa/Candidate.h"
 #include "crpropa/base64.h"
 #include "crpropa/Common.h"
+#include "crpropa/DomainDecomposition.h"
+#include "crpropa/Configuration.h"
+#include "crpropa/Cosmology.h"
+#include "crpropa/DataTable.h"
+#include "crpropa/LookupTable.h"
+#include "crpropa/TableRegistry.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/ParticleMass.h"
+#include "crpropa/PhotonBackground.h"
 #include "crpropa/Random.h"
+#include "crpropa/ScratchVector.h"
+#include "crpropa/SimdMath.h"
 #include "crpropa/Grid.h"
+#include "crpropa/Numa.h"
 #include "crpropa/GridTools.h"
+#include "crpropa/TiledGrid.h"
 #include "crpropa/Geometry.h"
 #include "crpropa/EmissionMap.h"
 
 #include <HepPID/ParticleIDMethods.hh>
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <set>
 
 namespace crpropa {
 
@@ -89,6 +105,37 @@ TEST(ParticleState, Charge) {
 	EXPECT_DOUBLE_EQ(0, particle.getCharge());
 }
 
+TEST(ParticleState, type) {
+	ParticleState particle;
+
+	particle.setId(nucleusId(56, 26)); // iron
+	EXPECT_TRUE(particle.isNucleus());
+	EXPECT_FALSE(particle.isLepton());
+	EXPECT_EQ(56, particle.getMassNumber());
+	EXPECT_EQ(26, particle.getChargeNumber());
+	EXPECT_EQ(26 * 31 + 30, particle.getIsotopeIndex());
+
+	particle.setId(nucleusId(60, 28)); // beyond the tables
+	EXPECT_TRUE(particle.isNucleus());
+	EXPECT_EQ(-1, particle.getIsotopeIndex());
+
+	particle.setId(-11); // positron
+	EXPECT_FALSE(particle.isNucleus());
+	EXPECT_TRUE(particle.isLepton());
+	EXPECT_FALSE(particle.isNeutrino());
+	EXPECT_EQ(0, particle.getMassNumber());
+	EXPECT_EQ(-1, particle.getIsotopeIndex());
+
+	particle.setId(-14); // muon anti-neutrino
+	EXPECT_TRUE(particle.isLepton());
+	EXPECT_TRUE(particle.isNeutrino());
+
+	particle.setId(22); // photon
+	EXPECT_TRUE(particle.isPhoton());
+	EXPECT_FALSE(particle.isLepton());
+	EXPECT_EQ(0, particle.getChargeNumber());
+}
+
 TEST(ParticleState, Rigidity) {
 	ParticleState particle;
 
@@ -197,6 +244,58 @@ TEST(Candidate, property) {
 	EXPECT_EQ("bar", value);
 }
 
+TEST(Candidate, propertyKey) {
+	Candidate candidate;
+	// set by name before the key is registered
+	candidate.setProperty("propertyKeyTest", 1);
+
+	PropertyKey key = Candidate::getPropertyKey("propertyKeyTest");
+	EXPECT_EQ(key, Candidate::getPropertyKey("propertyKeyTest"));
+	EXPECT_EQ("propertyKeyTest", Candidate::getPropertyName(key));
+	EXPECT_NE(key, Candidate::getPropertyKey("propertyKeyTest2"));
+
+	EXPECT_TRUE(candidate.hasProperty(key));
+	EXPECT_EQ(1, candidate.getProperty(key).toInt32());
+
+	// the key and the name refer to the same value
+	candidate.setProperty(key, 2);
+	EXPECT_EQ(2, candidate.getProperty("propertyKeyTest").toInt32());
+	candidate.setProperty("propertyKeyTest", 3);
+	EXPECT_EQ(3, candidate.getProperty(key).toInt32());
+	EXPECT_EQ(1, candidate.getProperties().size());
+
+	ref_ptr<Candidate> cloned = candidate.clone();
+	EXPECT_EQ(3, cloned->getProperty(key).toInt32());
+
+	EXPECT_TRUE(candidate.removeProperty(key));
+	EXPECT_FALSE(candidate.hasProperty("propertyKeyTest"));
+	EXPECT_FALSE(candidate.removeProperty(key));
+	EXPECT_THROW(candidate.getProperty(key), std::runtime_error);
+	EXPECT_TRUE(cloned->hasProperty(key));
+}
+
+TEST(Candidate, propertyCopyOnWrite) {
+	PropertyKey key = Candidate::getPropertyKey("propertyCopyOnWriteTest");
+	Candidate candidate;
+	EXPECT_FALSE(candidate.hasProperty(key));
+	EXPECT_EQ(0, candidate.getProperties().size());
+	candidate.setProperty(key, 1);
+
+	// modifying the clone leaves the original
+	ref_ptr<Candidate> cloned = candidate.clone();
+	cloned->setProperty(key, 2);
+	EXPECT_EQ(1, candidate.getProperty(key).toInt32());
+	EXPECT_EQ(2, cloned->getProperty(key).toInt32());
+
+	// and vice versa
+	ref_ptr<Candidate> cloned2 = candidate.clone();
+	candidate.setProperty(key, 3);
+	EXPECT_EQ(1, cloned2->getProperty(key).toInt32());
+	EXPECT_TRUE(candidate.removeProperty(key));
+	EXPECT_TRUE(cloned2->hasProperty(key));
+	EXPECT_EQ(2, cloned->getProperty(key).toInt32());
+}
+
 TEST(Candidate, weight) {
     Candidate candidate;
     EXPECT_EQ (1., candidate.getWeight());
@@ -247,12 +346,369 @@ TEST(Candidate, candidateTag) {
 	EXPECT_TRUE(c.getTagOrigin() == "myTag");
 }
 
+TEST(Candidate, rateCache) {
+	// the rate cache is kept per candidate, copies start without rates
+	Candidate c(nucleusId(1, 1), 10 * EeV);
+	int owner;
+	double rate = 0;
+	EXPECT_FALSE(c.getRateCache().find(&owner, c.current, 0, rate));
+	c.getRateCache().store(&owner, c.current, 0, 2., 0.01, 0.01);
+	EXPECT_TRUE(c.getRateCache().find(&owner, c.current, 0, rate));
+	EXPECT_EQ(2., rate);
+
+	Candidate copy(c);
+	EXPECT_FALSE(copy.getRateCache().find(&owner, copy.current, 0, rate));
+	EXPECT_TRUE(c.getRateCache().find(&owner, c.current, 0, rate));
+	copy = c;
+	EXPECT_FALSE(copy.getRateCache().find(&owner, copy.current, 0, rate));
+}
+
+TEST(Candidate, tagCodes) {
+	uint32_t code = Candidate::getTagCode("myCodedTag");
+	EXPECT_EQ(code, Candidate::getTagCode("myCodedTag"));
+	EXPECT_EQ("myCodedTag", Candidate::getTagName(code));
+	std::vector<std::string> names = Candidate::getTagNames();
+	ASSERT_LT(code, names.size());
+	EXPECT_EQ("myCodedTag", names[code]);
+	EXPECT_THROW(Candidate::getTagName(names.size()), std::runtime_error);
+
+	Candidate c;
+	EXPECT_EQ(Candidate::getTagCode("PRIM"), c.getTagOriginCode());
+	c.setTagOriginCode(code);
+	EXPECT_EQ("myCodedTag", c.getTagOrigin());
+
+	// the secondaries of codes and names are the same
+	c.addSecondary(22, 1 * EeV, 1., code);
+	c.addSecondary(22, 1 * EeV, Vector3d(1, 0, 0), 1., code);
+	c.addSecondary(22, 1 * EeV, Vector3d(1, 0, 0), 1., "myCodedTag");
+	ASSERT_EQ(3, c.secondaries.size());
+	for (size_t i = 0; i < 3; i++) {
+		EXPECT_EQ(code, c.secondaries[i]->getTagOriginCode());
+		EXPECT_EQ("myCodedTag", c.secondaries[i]->getTagOrigin());
+	}
+}
+
 TEST(Candidate, serialNumber) {
 	Candidate::setNextSerialNumber(42);
 	Candidate c;
 	EXPECT_EQ(43, c.getSourceSerialNumber());
 }
 
+TEST(Candidate, serialNumberBlocks) {
+	EXPECT_THROW(Candidate::setSerialNumberBlockSize(0), std::runtime_error);
+	Candidate::setSerialNumberBlockSize(100);
+	Candidate::setNextSerialNumber(0);
+	Candidate a, b;
+	EXPECT_EQ(a.getSerialNumber() + 1, b.getSerialNumber());
+	EXPECT_EQ(100, Candidate::getNextSerialNumber());
+
+	// unique over the threads
+	std::vector<uint64_t> numbers(1000);
+#pragma omp parallel for
+	for (int i = 0; i < 1000; i++)
+		numbers[i] = Candidate::newSerialNumber();
+	std::set<uint64_t> unique(numbers.begin(), numbers.end());
+	EXPECT_EQ(1000, unique.size());
+	EXPECT_EQ(0, unique.count(a.getSerialNumber()));
+
+	Candidate::setSerialNumberBlockSize(1);
+	Candidate::setNextSerialNumber(42);
+	EXPECT_EQ(43, Candidate::newSerialNumber());
+	EXPECT_EQ(43, Candidate::getNextSerialNumber());
+	Candidate::setSerialNumberBlockSize(1 << 16);
+}
+
+TEST(Candidate, stateRetention) {
+	EXPECT_EQ(Candidate::RetainAll, Candidate::getStateRetention());
+	EXPECT_LT(sizeof(RetainedParticleState), sizeof(ParticleState));
+
+	// secondaries share the source state until it is modified
+	Candidate c(22, 1000, Vector3d(1, 2, 3));
+	c.addSecondary(22, 200);
+	Candidate &s = *c.secondaries[0];
+	EXPECT_TRUE(s.source.isRetained());
+	s.source.setEnergy(500);
+	EXPECT_EQ(500, s.source.getEnergy());
+	EXPECT_EQ(1000, c.source.getEnergy());
+	EXPECT_EQ(1000, c.created.getEnergy());
+
+	// without the created state
+	Candidate::setStateRetention(Candidate::RetainSource);
+	Candidate p(22, 1000, Vector3d(1, 2, 3));
+	EXPECT_TRUE(p.source.isRetained());
+	EXPECT_FALSE(p.created.isRetained());
+	EXPECT_THROW(p.created.getEnergy(), std::runtime_error);
+	p.created.setEnergy(10); // ignored
+	EXPECT_FALSE(p.created.isRetained());
+	p.addSecondary(22, 200);
+	EXPECT_FALSE(p.secondaries[0]->created.isRetained());
+	EXPECT_TRUE(Vector3d(1, 2, 3) == p.secondaries[0]->source.getPosition());
+	Candidate::setStateRetention(Candidate::RetainAll);
+}
+
+TEST(Candidate, detachParent) {
+	Candidate c(22, 1000);
+	c.addSecondary(22, 200);
+	ref_ptr<Candidate> s = c.secondaries[0];
+	s->addSecondary(22, 100);
+	ref_ptr<Candidate> s2 = s->secondaries[0];
+	s2->detachParent();
+	s->detachParent();
+	EXPECT_TRUE(s2->parent == 0);
+	c.setSerialNumber(0); // no longer looked up
+	EXPECT_EQ(s->getSerialNumber(), s2->getCreatedSerialNumber());
+	EXPECT_EQ(s->getSourceSerialNumber(), s2->getSourceSerialNumber());
+	EXPECT_NE(0, s->getSourceSerialNumber());
+}
+
+TEST(Candidate, threadConfined) {
+	ref_ptr<Candidate> c = new Candidate(22, 1000);
+	EXPECT_FALSE(c->isThreadConfined());
+	c->setThreadConfined(true);
+	{
+		ref_ptr<Candidate> copy = c;
+		EXPECT_EQ(2, c->getReferenceCount());
+	}
+	EXPECT_EQ(1, c->getReferenceCount());
+
+	// secondaries and clones inherit it
+	c->addSecondary(22, 200);
+	ref_ptr<Candidate> s = c->secondaries[0];
+	EXPECT_TRUE(s->isThreadConfined());
+	EXPECT_TRUE(c->clone(false)->isThreadConfined());
+
+	c->makeShared();
+	EXPECT_FALSE(c->isThreadConfined());
+	EXPECT_FALSE(s->isThreadConfined());
+	EXPECT_EQ(2, s->getReferenceCount());
+}
+
+TEST(Candidate, deferredSecondaries) {
+	Candidate c(11, 100 * EeV, Vector3d(1, 2, 3));
+	c.setTrajectoryLength(10);
+	c.setWeight(2);
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(4, 2, 3));
+	c.addSecondary(22, 1 * EeV, Vector3d(3, 2, 3), 0.5, "PP");
+
+	Candidate::setDeferSecondaries(true);
+	c.addSecondary(22, 1 * EeV, Vector3d(3, 2, 3), 0.5, "PP");
+	c.addSecondary(12, 2 * EeV);
+	Candidate::setDeferSecondaries(false);
+	EXPECT_EQ(1, c.secondaries.size());
+	ASSERT_EQ(2, c.deferredSecondaries.size());
+	EXPECT_EQ("PP", Candidate::getTagName(c.deferredSecondaries[0].tag));
+
+	c.materializeSecondaries();
+	EXPECT_EQ(0, c.deferredSecondaries.size());
+	ASSERT_EQ(3, c.secondaries.size());
+	const Candidate *a = c.secondaries[0], *b = c.secondaries[1];
+	EXPECT_EQ(a->current.getPosition(), b->current.getPosition());
+	EXPECT_EQ(a->created.getPosition(), b->created.getPosition());
+	EXPECT_EQ(a->previous.getPosition(), b->previous.getPosition());
+	EXPECT_EQ(a->created.getId(), b->created.getId());
+	EXPECT_DOUBLE_EQ(a->current.getEnergy(), b->current.getEnergy());
+	EXPECT_DOUBLE_EQ(a->getWeight(), b->getWeight());
+	EXPECT_DOUBLE_EQ(a->getTrajectoryLength(), b->getTrajectoryLength());
+	EXPECT_DOUBLE_EQ(9, b->getTrajectoryLength());
+	EXPECT_EQ("PP", b->getTagOrigin());
+	EXPECT_TRUE(b->parent == &c);
+	EXPECT_EQ(12, c.secondaries[2]->current.getId());
+	EXPECT_EQ("SEC", c.secondaries[2]->getTagOrigin());
+	EXPECT_EQ(Vector3d(4, 2, 3), c.secondaries[2]->current.getPosition());
+}
+
+// photon field that counts the evaluations of its redshift scaling
+class CountingPhotonField: public PhotonField {
+public:
+	mutable int n;
+	CountingPhotonField() : n(0) {}
+	double getPhotonDensity(double ePhoton, double z) const { return 0; }
+	double getMinimumPhotonEnergy(double z) const { return 0; }
+	double getMaximumPhotonEnergy(double z) const { return 0; }
+	double getRedshiftScaling(double z) const { n++; return 1 - z / 10; }
+};
+
+TEST(Candidate, stepQuantities) {
+	Candidate c(11, 10 * EeV);
+	c.setRedshift(1);
+	const StepQuantities &q = c.getStepQuantities();
+	EXPECT_DOUBLE_EQ(c.current.getLorentzFactor(), q.lorentzFactor);
+	EXPECT_DOUBLE_EQ(log10(c.current.getLorentzFactor() * 2), q.lgLorentzFactor);
+	EXPECT_DOUBLE_EQ(c.current.getRigidity(), q.rigidity);
+	EXPECT_DOUBLE_EQ(20 * EeV, q.energy);
+	EXPECT_DOUBLE_EQ(4, q.redshift2);
+	EXPECT_DOUBLE_EQ(8, q.redshift3);
+
+	// the redshift scaling is evaluated once per field and redshift
+	CountingPhotonField field;
+	EXPECT_DOUBLE_EQ(0.9, q.getRedshiftScaling(&field));
+	EXPECT_DOUBLE_EQ(0.9, c.getStepQuantities().getRedshiftScaling(&field));
+	EXPECT_EQ(1, field.n);
+	c.current.setEnergy(5 * EeV);
+	EXPECT_DOUBLE_EQ(5 * EeV * 2, c.getStepQuantities().energy);
+	EXPECT_DOUBLE_EQ(0.9, c.getStepQuantities().getRedshiftScaling(&field));
+	EXPECT_EQ(1, field.n);
+
+	// a change of the redshift or id invalidates the quantities
+	c.setRedshift(0.5);
+	EXPECT_DOUBLE_EQ(2.25, c.getStepQuantities().redshift2);
+	EXPECT_DOUBLE_EQ(0.95, c.getStepQuantities().getRedshiftScaling(&field));
+	EXPECT_EQ(2, field.n);
+	c.current.setId(22);
+	EXPECT_EQ(c.current.getRigidity(), c.getStepQuantities().rigidity);
+}
+
+TEST(Candidate, pool) {
+	CandidatePool::clear();
+	CandidatePool::Statistics s0 = CandidatePool::getStatistics();
+
+	// a finished secondary returns its memory to the pool
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	void *p = c.get();
+	c->addSecondary(22, 0.5 * EeV);
+	c->secondaries.clear();
+	c = NULL;
+	CandidatePool::Statistics s1 = CandidatePool::getStatistics();
+	EXPECT_EQ(s0.recycled + 2, s1.recycled);
+	EXPECT_EQ(2, s1.cached);
+
+	// and the next candidate reuses it
+	c = new Candidate(11, 1 * EeV);
+	EXPECT_EQ(p, (void *) c.get());
+	CandidatePool::Statistics s2 = CandidatePool::getStatistics();
+	EXPECT_EQ(s1.reused + 1, s2.reused);
+	EXPECT_EQ(1, s2.cached);
+
+	CandidatePool::clear();
+	EXPECT_EQ(0, CandidatePool::getStatistics().cached);
+
+	// disabled pool
+	size_t maximumSize = CandidatePool::getMaximumSize();
+	CandidatePool::setMaximumSize(0);
+	c = NULL;
+	EXPECT_EQ(0, CandidatePool::getStatistics().cached);
+	CandidatePool::setMaximumSize(maximumSize);
+}
+
+TEST(Candidate, secondaryThreshold) {
+	Candidate::setSecondaryThreshold(1 * EeV);
+	Candidate::setSecondaryThreshold(11, 5 * EeV);
+	Candidate::setDroppedEnergyProperty("DroppedEnergy");
+	EXPECT_TRUE(Candidate::isBelowSecondaryThreshold(22, 0.5 * EeV));
+	EXPECT_FALSE(Candidate::isBelowSecondaryThreshold(22, 2 * EeV));
+	EXPECT_TRUE(Candidate::isBelowSecondaryThreshold(11, 2 * EeV));
+
+	Candidate c(22, 10 * EeV);
+	EXPECT_TRUE(c.addSecondary(22, 2 * EeV));
+	EXPECT_FALSE(c.addSecondary(22, 0.5 * EeV, 2.));
+	EXPECT_FALSE(c.addSecondary(11, 2 * EeV, Vector3d(1, 0, 0)));
+	EXPECT_EQ(c.secondaries.size(), 1);
+	EXPECT_DOUBLE_EQ(c.getProperty("DroppedEnergy").asDouble(), 3 * EeV);
+
+	Candidate::clearSecondaryThresholds();
+	Candidate::setDroppedEnergyProperty("");
+	EXPECT_TRUE(c.addSecondary(11, 2 * EeV));
+	EXPECT_EQ(Candidate::getSecondaryThreshold(11), 0);
+}
+
+TEST(Candidate, secondaryMerging) {
+	Candidate::setSecondaryMerging(10);
+	Candidate c(11, 100 * EeV, Vector3d(0.));
+	c.setWeight(2);
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(4, 0, 0));
+	c.setTrajectoryLength(4);
+
+	// same bin, id and tag: one macro-particle
+	EXPECT_TRUE(c.addSecondary(22, 1.00 * EeV, Vector3d(1, 0, 0), 1., "IC"));
+	EXPECT_TRUE(c.addSecondary(22, 1.10 * EeV, Vector3d(3, 0, 0), 3., "IC"));
+	// other bin, id or tag
+	EXPECT_TRUE(c.addSecondary(22, 2 * EeV, Vector3d(1, 0, 0), 1., "IC"));
+	EXPECT_TRUE(c.addSecondary(11, 1 * EeV, Vector3d(1, 0, 0), 1., "IC"));
+	EXPECT_TRUE(c.addSecondary(22, 1 * EeV, Vector3d(1, 0, 0), 1., "PP"));
+	ASSERT_EQ(4, c.secondaries.size());
+
+	const Candidate *m = c.secondaries[0];
+	EXPECT_EQ(22, m->current.getId());
+	EXPECT_EQ("IC", m->getTagOrigin());
+	EXPECT_DOUBLE_EQ(8, m->getWeight());
+	EXPECT_DOUBLE_EQ(1.075 * EeV, m->current.getEnergy());
+	EXPECT_DOUBLE_EQ(2.5, m->current.getPosition().x);
+	EXPECT_DOUBLE_EQ(2.5, m->created.getPosition().x);
+	EXPECT_DOUBLE_EQ(2.5, m->getTrajectoryLength());
+
+	// a merged secondary is moved to the end
+	EXPECT_TRUE(c.addSecondary(22, 1 * EeV, 1., "PP"));
+	ASSERT_EQ(4, c.secondaries.size());
+	EXPECT_DOUBLE_EQ(4, c.secondaries.back()->getWeight());
+	EXPECT_DOUBLE_EQ(2.5, c.secondaries.back()->current.getPosition().x);
+
+	// not with the secondaries of the previous step
+	c.previous = c.current;
+	c.current.setPosition(Vector3d(8, 0, 0));
+	EXPECT_TRUE(c.addSecondary(22, 1 * EeV, Vector3d(5, 0, 0), 1., "IC"));
+	EXPECT_EQ(5, c.secondaries.size());
+
+	// deferred secondaries
+	Candidate::setDeferSecondaries(true);
+	EXPECT_TRUE(c.addSecondary(12, 1 * EeV, 1., "D"));
+	EXPECT_TRUE(c.addSecondary(12, 1.05 * EeV, 1., "D"));
+	Candidate::setDeferSecondaries(false);
+	ASSERT_EQ(1, c.deferredSecondaries.size());
+	EXPECT_DOUBLE_EQ(4, c.deferredSecondaries[0].weight);
+	EXPECT_DOUBLE_EQ(1.025 * EeV, c.deferredSecondaries[0].current.getEnergy());
+
+	Candidate::setSecondaryMerging(0);
+	EXPECT_TRUE(c.addSecondary(22, 1 * EeV, Vector3d(5, 0, 0), 1., "IC"));
+	EXPECT_EQ(6, c.secondaries.size());
+	EXPECT_THROW(Candidate::setSecondaryMerging(-1), std::runtime_error);
+}
+
+TEST(Candidate, pack) {
+	Candidate parent(11, 100 * EeV, Vector3d(1, 2, 3));
+	parent.addSecondary(22, 1 * EeV, 2., "ElecPair");
+	Candidate &c = *parent.secondaries[0];
+	c.current.setPosition(Vector3d(4, 5, 6));
+	c.setRedshift(0.5);
+	c.setCurrentStep(8);
+	c.setTrajectoryLength(7);
+	c.setNextStep(9);
+	c.setProperty("Length", 1.5);
+	c.setProperty("Name", "photon");
+
+	std::vector<char> buffer;
+	c.pack(buffer);
+	parent.pack(buffer);
+	const char *p = buffer.data(), *end = p + buffer.size();
+	ref_ptr<Candidate> u = Candidate::unpack(p, end);
+	ref_ptr<Candidate> v = Candidate::unpack(p, end);
+	EXPECT_EQ(end, p);
+
+	EXPECT_TRUE(u->parent == 0);
+	EXPECT_EQ(c.getSerialNumber(), u->getSerialNumber());
+	EXPECT_EQ(parent.getSerialNumber(), u->getSourceSerialNumber());
+	EXPECT_EQ(parent.getSerialNumber(), u->getCreatedSerialNumber());
+	EXPECT_EQ(22, u->current.getId());
+	EXPECT_EQ(Vector3d(4, 5, 6), u->current.getPosition());
+	EXPECT_EQ(Vector3d(1, 2, 3), u->created.getPosition());
+	EXPECT_EQ(11, u->source.getId());
+	EXPECT_DOUBLE_EQ(2, u->getWeight());
+	EXPECT_DOUBLE_EQ(0.5, u->getRedshift());
+	EXPECT_DOUBLE_EQ(7, u->getTrajectoryLength());
+	EXPECT_DOUBLE_EQ(8, u->getCurrentStep());
+	EXPECT_DOUBLE_EQ(9, u->getNextStep());
+	EXPECT_EQ("ElecPair", u->getTagOrigin());
+	EXPECT_DOUBLE_EQ(1.5, u->getProperty("Length").toDouble());
+	EXPECT_EQ("photon", u->getProperty("Name").toString());
+	EXPECT_EQ(parent.getSerialNumber(), v->getSerialNumber());
+	EXPECT_EQ(parent.getSerialNumber(), v->getSourceSerialNumber());
+
+	// truncated buffer
+	p = buffer.data();
+	EXPECT_THROW(Candidate::unpack(p, p + 20), std::runtime_error);
+}
+
 TEST(common, digit) {
 	EXPECT_EQ(1, digit(1234, 1000));
 	EXPECT_EQ(2, digit(1234, 100));
@@ -328,6 +784,356 @@ TEST(common, gaussInt)
 	EXPECT_NEAR(gaussInt(([](double x){ return sin(x)*sin(x); }), 0, M_PI), M_PI/2., 1e-4);
 }
 
+TEST(LookupTable, spacing) {
+	std::vector<double> lin(11), lg(11), irregular(11);
+	for (int i = 0; i <= 10; i++) {
+		lin[i] = 1 + i * 0.1;
+		lg[i] = pow(10, 15 + i * 0.1) * eV; // as read from the interaction tables
+		irregular[i] = i * i;
+	}
+	EXPECT_EQ(TableAxis::Linear, TableAxis(lin).getSpacing());
+	EXPECT_EQ(TableAxis::Logarithmic, TableAxis(lg).getSpacing());
+	EXPECT_EQ(TableAxis::Irregular, TableAxis(irregular).getSpacing());
+
+	// the interval has to be the one of the binary search, also at the nodes
+	TableAxis axis(lg);
+	for (int i = 0; i < 10; i++) {
+		EXPECT_EQ(i, axis.index(lg[i]));
+		EXPECT_EQ(i, axis.index(lg[i] * 1.01));
+	}
+	EXPECT_EQ(9, axis.index(lg[10]));
+}
+
+TEST(LookupTable, closest) {
+	// same node as closestIndex for log-spaced and irregular nodes
+	std::vector<double> X[2];
+	for (int i = 0; i <= 20; i++) {
+		X[0].push_back(pow(10, 15 + i * 0.1) * eV);
+		X[1].push_back(i * i + 1);
+	}
+	Random &random = Random::instance();
+	for (int k = 0; k < 2; k++) {
+		TableAxis axis(X[k]);
+		for (int i = 0; i <= 20; i++)
+			EXPECT_EQ(i, axis.closest(X[k][i]));
+		for (int i = 0; i < 1000; i++) {
+			double x = X[k].front() + random.rand() * (X[k].back() - X[k].front());
+			EXPECT_EQ(closestIndex(x, X[k]), axis.closest(x));
+		}
+		EXPECT_EQ(0, axis.closest(X[k].front() * 0.5));
+		EXPECT_EQ(20, axis.closest(X[k].back() * 2));
+	}
+}
+
+TEST(LookupTable, LogGridTable) {
+	// log-spaced, linear and irregular nodes give the results of interpolate
+	std::vector<double> X[3], Y(101);
+	for (int i = 0; i <= 100; i++) {
+		X[0].push_back(pow(10, 6 + i * 0.07));
+		X[1].push_back(2 + i * 0.5);
+		X[2].push_back(sqrt(i + 0.5));
+		Y[i] = sin(0.1 * i);
+	}
+	Random &random = Random::instance();
+	for (int k = 0; k < 3; k++) {
+		LogGridTable table(X[k], Y);
+		for (int i = 0; i < 1000; i++) {
+			double x = X[k].front() * 0.9 + random.rand() * (X[k].back() * 1.1 - X[k].front() * 0.9);
+			EXPECT_DOUBLE_EQ(interpolate(x, X[k], Y), table(x));
+		}
+		EXPECT_EQ(Y.front(), table(X[k].front()));
+		EXPECT_EQ(Y.back(), table(X[k].back()));
+	}
+
+	// batch evaluation
+	LogGridTable table(X[0], Y);
+	std::vector<double> x(100), y(100);
+	for (int i = 0; i < 100; i++)
+		x[i] = pow(10, 5.5 + i * 0.08);
+	table.evaluate(&x[0], &y[0], x.size());
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(table(x[i]), y[i]);
+
+	EXPECT_THROW(LogGridTable(X[0], std::vector<double>(10)), std::runtime_error);
+}
+
+TEST(LookupTable, UniformTable2D) {
+	// log-spaced energies and linear redshifts as in the photon fields
+	std::vector<double> X, Y, Z;
+	for (int i = 0; i < 50; i++)
+		X.push_back(pow(10, -4 + i * 0.1) * eV);
+	for (int j = 0; j < 20; j++)
+		Y.push_back(j * 0.25);
+	for (int i = 0; i < 50; i++)
+		for (int j = 0; j < 20; j++)
+			Z.push_back(i + j * j);
+
+	UniformTable2D table(X, Y, Z);
+	Random &random = Random::instance();
+	for (int i = 0; i < 1000; i++) {
+		double x = X.front() * pow(X.back() / X.front(), random.rand());
+		double y = random.rand() * Y.back();
+		EXPECT_NEAR(interpolate2d(x, y, X, Y, Z), table(x, y), 1e-12);
+	}
+	EXPECT_DOUBLE_EQ(Z.back(), table(X.back(), Y.back()));
+	EXPECT_DOUBLE_EQ(49 + 4, table(X.back(), 0.5)); // upper edge in x
+	EXPECT_EQ(0, table(X.front() * 0.9, 1));
+	EXPECT_EQ(0, table(X[10], -0.1));
+	EXPECT_EQ(0, table(X[10], 5));
+
+	double x[2] = {X[3], X[30]}, y[2] = {0.1, 3.3}, z[2];
+	table.evaluate(x, y, z, 2);
+	EXPECT_EQ(table(x[0], y[0]), z[0]);
+	EXPECT_EQ(table(x[1], y[1]), z[1]);
+
+	EXPECT_THROW(UniformTable2D(X, Y, std::vector<double>(10)), std::runtime_error);
+}
+
+TEST(DataTable, loadAndCache) {
+	std::string filename = "testDataTable.txt";
+	std::string cachename = DataTable::cacheFilename(filename);
+	remove(cachename.c_str());
+	{
+		std::ofstream out(filename.c_str());
+		out << "# comment line\n1 2 3\n\n4.5 -6e-3\n# another comment\n7\n";
+	}
+
+	DataTable table;
+	EXPECT_FALSE(table.load("THIS_FILE_MUST_NOT_EXIST_12345.txt"));
+	EXPECT_TRUE(table.load(filename));
+	EXPECT_FALSE(table.isMapped());
+	ASSERT_EQ(table.size(), 3);
+	EXPECT_EQ(table.columns(0), 3);
+	EXPECT_EQ(table.columns(1), 2);
+	EXPECT_EQ(table.columns(2), 1);
+	EXPECT_DOUBLE_EQ(table.get(0, 2), 3);
+	EXPECT_DOUBLE_EQ(table.get(1, 1), -6e-3);
+	EXPECT_DOUBLE_EQ(table.row(2)[0], 7);
+	EXPECT_THROW(table.get(1, 2), std::out_of_range);
+
+	// second load uses the cache
+	DataTable cached;
+	EXPECT_TRUE(cached.load(filename));
+	EXPECT_TRUE(cached.isMapped());
+	ASSERT_EQ(cached.size(), 3);
+	EXPECT_EQ(cached.columns(1), 2);
+	EXPECT_DOUBLE_EQ(cached.get(1, 0), 4.5);
+
+	// a modified text file invalidates the cache
+	{
+		std::ofstream out(filename.c_str());
+		out << "1 2 3 4 5 6 7 8\n";
+	}
+	DataTable modified;
+	EXPECT_TRUE(modified.load(filename));
+	EXPECT_FALSE(modified.isMapped());
+	ASSERT_EQ(modified.size(), 1);
+	EXPECT_EQ(modified.columns(0), 8);
+
+	remove(filename.c_str());
+	remove(cachename.c_str());
+}
+
+TEST(DataTable, lineEnds) {
+	// CRLF, trailing whitespace and whitespace-only lines end the rows
+	std::string filename = "testDataTableLineEnds.txt";
+	std::string cachename = DataTable::cacheFilename(filename);
+	remove(cachename.c_str());
+	{
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		out << "1 2 3\r\n4 5\r\n\r\n6 \n7\t\n \t \n8 9\n";
+	}
+
+	DataTable table;
+	EXPECT_TRUE(table.load(filename));
+	ASSERT_EQ(table.size(), 5);
+	EXPECT_EQ(table.columns(0), 3);
+	EXPECT_EQ(table.columns(1), 2);
+	EXPECT_EQ(table.columns(2), 1);
+	EXPECT_EQ(table.columns(3), 1);
+	EXPECT_EQ(table.columns(4), 2);
+	EXPECT_DOUBLE_EQ(table.get(1, 1), 5);
+	EXPECT_DOUBLE_EQ(table.get(2, 0), 6);
+	EXPECT_DOUBLE_EQ(table.get(3, 0), 7);
+	EXPECT_DOUBLE_EQ(table.get(4, 0), 8);
+
+	// rows too short for the caller
+	EXPECT_EQ(table.row(0, 3)[2], 3);
+	EXPECT_THROW(table.row(1, 3), std::runtime_error);
+
+	remove(filename.c_str());
+	remove(cachename.c_str());
+}
+
+TEST(DataTable, acquire) {
+	std::string filename = "testSharedTable.txt";
+	std::string cachename = DataTable::cacheFilename(filename);
+	{
+		std::ofstream out(filename.c_str());
+		out << "1 2\n3 4\n";
+	}
+	TableRegistry::clear();
+	EXPECT_FALSE(DataTable::acquire("THIS_FILE_MUST_NOT_EXIST_12345.txt").valid());
+
+	ref_ptr<const DataTable> table = DataTable::acquire(filename);
+	ASSERT_TRUE(table.valid());
+	EXPECT_EQ(2, table->size());
+	EXPECT_EQ(table.get(), DataTable::acquire(filename).get());
+	EXPECT_EQ(1, TableRegistry::size());
+
+	// a modified file is loaded again, the previous table stays valid
+	{
+		std::ofstream out(filename.c_str());
+		out << "1 2\n3 4\n5 6\n";
+	}
+	ref_ptr<const DataTable> modified = DataTable::acquire(filename);
+	EXPECT_NE(table.get(), modified.get());
+	EXPECT_EQ(3, modified->size());
+	EXPECT_EQ(2, table->size());
+
+	// unused tables are released
+	modified = NULL;
+	TableRegistry::prune();
+	EXPECT_EQ(0, TableRegistry::size());
+
+	remove(filename.c_str());
+	remove(cachename.c_str());
+}
+
+TEST(Random, aliasSampler) {
+	std::vector<double> w;
+	w.push_back(1);
+	w.push_back(0);
+	w.push_back(3);
+	w.push_back(0.5);
+	w.push_back(5.5);
+	AliasSampler sampler(w);
+	EXPECT_EQ(5, sampler.size());
+	EXPECT_DOUBLE_EQ(10, sampler.getTotalWeight());
+
+	// frequencies follow the weights, empty bins are never drawn
+	Random random(42);
+	int n = 100000;
+	std::vector<int> counts(6, 0);
+	for (int i = 0; i < n; i++)
+		counts[random.randBin(sampler)]++;
+	EXPECT_EQ(0, counts[1]);
+	for (size_t i = 0; i < w.size(); i++)
+		EXPECT_NEAR(w[i] / 10, double(counts[i]) / n, 0.005);
+
+	// bins added after drawing
+	sampler.add(10);
+	counts.assign(6, 0);
+	for (int i = 0; i < n; i++)
+		counts[sampler.draw(random)]++;
+	EXPECT_NEAR(0.5, double(counts[5]) / n, 0.005);
+	EXPECT_NEAR(0.15, double(counts[2]) / n, 0.005);
+
+	// same bins as randBin on the cumulative distribution
+	std::vector<double> cdf(w.size());
+	for (size_t i = 0; i < w.size(); i++)
+		cdf[i] = w[i] + ((i > 0) ? cdf[i - 1] : 0);
+	AliasSampler fromCDF;
+	fromCDF.setCDF(cdf);
+	AliasSampler copy(fromCDF);
+	counts.assign(6, 0);
+	for (int i = 0; i < n; i++)
+		counts[copy.draw(random)]++;
+	EXPECT_EQ(0, counts[1]);
+	EXPECT_NEAR(0.55, double(counts[4]) / n, 0.005);
+
+	// all weights zero: first bin, as randBin
+	AliasSampler zero(std::vector<double>(3, 0.));
+	EXPECT_EQ(0, zero.draw(random));
+
+	EXPECT_THROW(AliasSampler().draw(random), std::runtime_error);
+	EXPECT_THROW(sampler.add(-1), std::runtime_error);
+}
+
+TEST(Random, aliasTable) {
+	// rows of an AliasTable draw as an AliasSampler of the same cdf
+	std::vector<double> cdf1(4), cdf2(4);
+	double w1[] = {1, 0, 2, 1}, w2[] = {0, 0, 0, 5};
+	for (size_t i = 0; i < 4; i++) {
+		cdf1[i] = w1[i] + ((i > 0) ? cdf1[i - 1] : 0);
+		cdf2[i] = w2[i] + ((i > 0) ? cdf2[i - 1] : 0);
+	}
+	AliasTable table;
+	table.addCDF(cdf1);
+	table.addCDF(cdf2);
+	table.addCDF(std::vector<double>(4, 0.));
+	EXPECT_EQ(3, table.size());
+	EXPECT_EQ(4, table.bins());
+	EXPECT_THROW(table.addCDF(std::vector<double>(3, 1.)), std::runtime_error);
+
+	Random random(7);
+	int n = 100000;
+	std::vector<int> counts(4, 0);
+	for (int i = 0; i < n; i++) {
+		counts[table.draw(0, random)]++;
+		EXPECT_EQ(3, table.draw(1, random));
+		EXPECT_EQ(0, table.draw(2, random));
+	}
+	EXPECT_EQ(0, counts[1]);
+	EXPECT_NEAR(0.25, double(counts[0]) / n, 0.005);
+	EXPECT_NEAR(0.5, double(counts[2]) / n, 0.005);
+
+	table.clear();
+	EXPECT_EQ(0, table.size());
+}
+
+TEST(AdaptiveThinning, budget) {
+	AdaptiveThinning thinning(100);
+	EXPECT_THROW(thinning.setBudget(0.5), std::runtime_error);
+	Candidate c(11, 1 * EeV);
+	EXPECT_DOUBLE_EQ(100, thinning.getBudget(&c));
+
+	// secondaries with a budget >= 1 are kept without weight
+	EXPECT_TRUE(thinning.addSecondary(&c, 0.5, 22, 0.5 * EeV, Vector3d(0.), "T"));
+	EXPECT_DOUBLE_EQ(1, c.secondaries[0]->getWeight());
+	EXPECT_DOUBLE_EQ(50, thinning.getBudget(c.secondaries[0]));
+	thinning.keep(&c, 0.5);
+	EXPECT_DOUBLE_EQ(50, thinning.getBudget(&c));
+
+	// secondaries with the budget 0.1 are kept in 1 of 10 cases with weight 10
+	c.clearSecondaries();
+	int n = 10000;
+	for (int i = 0; i < n; i++)
+		thinning.addSecondary(&c, 0.002, 22, 1 * PeV, Vector3d(0.), "T");
+	double w = 0;
+	for (size_t i = 0; i < c.secondaries.size(); i++) {
+		w += c.secondaries[i]->getWeight();
+		EXPECT_DOUBLE_EQ(1, thinning.getBudget(c.secondaries[i]));
+	}
+	EXPECT_NEAR(n / 10, c.secondaries.size(), 100);
+	EXPECT_NEAR(10, c.secondaries[0]->getWeight(), 1e-9);
+	EXPECT_NEAR(n, w, 1000);
+}
+
+TEST(AdaptiveThinning, deferredSecondaries) {
+	AdaptiveThinning thinning(100);
+	Candidate c(11, 1 * EeV);
+	c.addSecondary(22, 1 * PeV);
+	Candidate::setDeferSecondaries(true);
+	EXPECT_TRUE(thinning.addSecondary(&c, 0.5, 22, 0.5 * EeV, Vector3d(0.), "T"));
+	EXPECT_TRUE(thinning.addSecondary(&c, 0.25, 22, 0.25 * EeV, Vector3d(0.), "T"));
+	Candidate::setDeferSecondaries(false);
+	ASSERT_EQ(1, c.secondaries.size());
+	ASSERT_EQ(2, c.deferredSecondaries.size());
+	EXPECT_FALSE(c.secondaries[0]->hasProperty("ThinningBudget"));
+
+	// the budgets are set on the created candidates
+	c.materializeSecondaries();
+	ASSERT_EQ(3, c.secondaries.size());
+	EXPECT_DOUBLE_EQ(100, thinning.getBudget(c.secondaries[0]));
+	EXPECT_FALSE(c.secondaries[0]->hasProperty("ThinningBudget"));
+	EXPECT_DOUBLE_EQ(50, thinning.getBudget(c.secondaries[1]));
+	EXPECT_DOUBLE_EQ(25, thinning.getBudget(c.secondaries[2]));
+
+	Candidate d(11, 1 * EeV);
+	EXPECT_THROW(d.setSecondaryProperty(0, 1), std::runtime_error);
+}
+
 TEST(Random, seed) {
 	Random &a = Random::instance();
 	Random &b = Random::instance();
@@ -379,6 +1185,165 @@ TEST(Random, bigSeedStorage) {
 
 }
 
+TEST(Random, counterBased) {
+	Random a;
+	a.seedStream(0, 0);
+	EXPECT_TRUE(a.isCounterBased());
+	// Philox4x32-10 known answer for zero key and counter
+	EXPECT_EQ(0x6627e8d5, a.randInt());
+	EXPECT_EQ(0xe169c58d, a.randInt());
+	EXPECT_EQ(0xbc57ac4c, a.randInt());
+	EXPECT_EQ(0x9b00dbd8, a.randInt());
+
+	// a stream can be continued from any position
+	a.seedStream(42, 7);
+	std::vector<uint32_t> values;
+	for (size_t i = 0; i < 10; i++)
+		values.push_back(a.randInt());
+	Random b;
+	b.seedStream(42, 7, 3);
+	for (size_t i = 3; i < 10; i++)
+		EXPECT_EQ(values[i], b.randInt());
+	EXPECT_EQ(10, b.getStreamPosition());
+
+	// other streams differ
+	b.seedStream(42, 8);
+	EXPECT_NE(values[0], b.randInt());
+
+	// seeding returns to the Mersenne Twister
+	a.seed(42);
+	EXPECT_FALSE(a.isCounterBased());
+}
+
+TEST(Random, fill) {
+	// the bulk functions draw the same numbers as the single calls
+	Random a(42), b(42);
+	std::vector<uint32_t> ints(2000);
+	a.fillInt(ints.data(), 3);
+	a.fillInt(ints.data() + 3, ints.size() - 3); // across reloads of the state
+	for (size_t i = 0; i < ints.size(); i++)
+		EXPECT_EQ(b.randInt(), ints[i]);
+
+	// counter-based mode from an unaligned position, and a stream continued by single calls
+	a.seedStream(42, 7, 5);
+	b.seedStream(42, 7, 5);
+	a.fillInt(ints.data(), 1000);
+	for (size_t i = 0; i < 1000; i++)
+		EXPECT_EQ(b.randInt(), ints[i]);
+	EXPECT_EQ(b.getStreamPosition(), a.getStreamPosition());
+	EXPECT_EQ(b.randInt(), a.randInt());
+
+	std::vector<double> u(1000);
+	a.fillUniform(u.data(), u.size(), -2., 3.);
+	for (size_t i = 0; i < u.size(); i++)
+		EXPECT_EQ(b.randUniform(-2., 3.), u[i]);
+
+	// the cosine branches are randNorm up to the rounding of log and sincos
+	std::vector<double> x(1001);
+	a.fillNormal(x.data(), x.size(), 1., 2.);
+	for (size_t i = 0; i < x.size(); i += 2)
+		EXPECT_NEAR(b.randNorm(1., 2.), x[i], 1e-13);
+	EXPECT_EQ(b.getStreamPosition(), a.getStreamPosition());
+
+	// moments
+	Random c(1);
+	std::vector<double> v(100000);
+	c.fillNormal(v.data(), v.size());
+	double sum = 0, sum2 = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		sum += v[i];
+		sum2 += v[i] * v[i];
+	}
+	EXPECT_NEAR(0, sum / v.size(), 0.02);
+	EXPECT_NEAR(1, sum2 / v.size(), 0.02);
+
+	c.fillExponential(v.data(), v.size());
+	sum = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		EXPECT_GT(v[i], 0);
+		sum += v[i];
+	}
+	EXPECT_NEAR(1, sum / v.size(), 0.02);
+}
+
+TEST(Random, seedStreams) {
+	Random::seedStreams(42);
+	EXPECT_TRUE(Random::useStreams());
+	Random::selectStream(3);
+	double r1 = Random::instance().rand();
+	Random::instance().rand();
+	Random::selectStream(3);
+	EXPECT_EQ(r1, Random::instance().rand());
+
+	Random::seedThreads(42);
+	EXPECT_FALSE(Random::useStreams());
+	EXPECT_FALSE(Random::instance().isCounterBased());
+}
+
+TEST(Random, sobol) {
+	// each dimension of the first 2^m scrambled points is stratified
+	const size_t n = 256;
+	std::vector<std::vector<int> > bins(Random::SOBOL_DIM, std::vector<int>(n, 0));
+	Random a(42);
+	for (size_t i = 0; i < n; i++) {
+		a.seedSobol(i, 7);
+		EXPECT_TRUE(a.isQuasiRandom());
+		for (size_t d = 0; d < Random::SOBOL_DIM; d++)
+			bins[d][a.randInt() / (uint32_t(1) << 24)]++;
+		EXPECT_EQ(Random::SOBOL_DIM, a.getSobolDimension());
+	}
+	for (size_t d = 0; d < Random::SOBOL_DIM; d++)
+		for (size_t k = 0; k < n; k++)
+			EXPECT_EQ(1, bins[d][k]);
+
+	// the same point for the same index and scramble, another one otherwise
+	a.seedSobol(5, 7);
+	uint32_t x = a.randInt();
+	a.seedSobol(5, 7);
+	EXPECT_EQ(x, a.randInt());
+	a.seedSobol(5, 8);
+	EXPECT_NE(x, a.randInt());
+
+	// after the last dimension and endSobol the generator continues
+	Random b(42);
+	uint32_t r = b.randInt();
+	for (size_t d = 1; d < Random::SOBOL_DIM; d++)
+		a.randInt();
+	EXPECT_EQ(r, a.randInt());
+	a.endSobol();
+	EXPECT_FALSE(a.isQuasiRandom());
+	EXPECT_EQ(b.randInt(), a.randInt());
+
+	Random::seedQuasiSources(1);
+	EXPECT_TRUE(Random::useQuasiSources());
+	Random::selectQuasiPoint(3);
+	EXPECT_TRUE(Random::instance().isQuasiRandom());
+	Random::endQuasiPoint();
+	EXPECT_FALSE(Random::instance().isQuasiRandom());
+	Random::disableQuasiSources();
+	Random::selectQuasiPoint(3);
+	EXPECT_FALSE(Random::instance().isQuasiRandom());
+}
+
+TEST(Random, poisson) {
+	Random a(42);
+	EXPECT_EQ(0, a.randPoisson(0));
+	// multiplication method and transformed rejection
+	const double means[] = {3.5, 250.};
+	for (size_t j = 0; j < 2; j++) {
+		const size_t n = 20000;
+		double sum = 0, sum2 = 0;
+		for (size_t i = 0; i < n; i++) {
+			double k = a.randPoisson(means[j]);
+			sum += k;
+			sum2 += k * k;
+		}
+		double mean = sum / n;
+		EXPECT_NEAR(means[j], mean, 5 * sqrt(means[j] / n));
+		EXPECT_NEAR(means[j], sum2 / n - mean * mean, 0.05 * means[j]);
+	}
+}
+
 TEST(base64, de_en_coding)
 {
 	Random a;
@@ -629,7 +1594,6 @@ TEST(Grid3f, Interpolation) {
 	EXPECT_FLOAT_EQ(1.7 * 0.9 * 0.15, b.x);
 	
 	//tricubic
-	#ifdef HAVE_SIMD
 	grid.setInterpolationType(TRICUBIC);
 	
 	b = grid.interpolate(Vector3d(0.5, 0.5, 1.5) * spacing);
@@ -646,7 +1610,170 @@ TEST(Grid3f, Interpolation) {
 
 	b = grid.interpolate(Vector3d(0.5, 2.65, 1.6) * spacing);
 	EXPECT_FLOAT_EQ(0.190802007914, b.x);
-	#endif // HAVE_SIMD
+}
+
+TEST(Grid3d, TricubicInterpolation) {
+	// tricubic interpolation in double precision, also without SIMD
+	double spacing = 2.793;
+	int n = 3;
+	Grid3d grid(Vector3d(0.), n, n, n, spacing);
+	grid.setInterpolationType(TRICUBIC);
+	grid.get(0, 0, 1) = Vector3d(1.7, 0., 0.);
+
+	// Catmull-Rom weights of the neighbours at the fraction 0.9 and 0.85
+	double w09 = -1.5 * pow(0.9, 3) + 2 * pow(0.9, 2) + 0.5 * 0.9;
+	double w085 = -1.5 * pow(0.85, 3) + 2 * pow(0.85, 2) + 0.5 * 0.85;
+	Vector3d b = grid.interpolate(Vector3d(0.5, 0.5, 1.5) * spacing);
+	EXPECT_DOUBLE_EQ(1.7, b.x);
+	b = grid.interpolate(Vector3d(0.5, 0.5, 1.4) * spacing);
+	EXPECT_NEAR(1.7 * w09, b.x, 1e-14);
+	b = grid.interpolate(Vector3d(0.5, 0.5, 1.6) * spacing);
+	EXPECT_NEAR(1.7 * w09, b.x, 1e-14);
+	b = grid.interpolate(Vector3d(0.5, 0.35, 1.6) * spacing);
+	EXPECT_NEAR(1.7 * w09 * w085, b.x, 1e-14);
+	b = grid.interpolate(Vector3d(0.5, 2.65, 1.6) * spacing); // using periodic repetition, as for Grid3f
+	EXPECT_NEAR(0.190802007914, b.x, 1e-7);
+	EXPECT_DOUBLE_EQ(0, b.y);
+
+	// single and double precision grids and the scalar grids of each component agree
+	Grid3f gridf(Vector3d(0.), 4, 5, 6, spacing);
+	Grid3d gridd(Vector3d(0.), 4, 5, 6, spacing);
+	Grid1d gridx(Vector3d(0.), 4, 5, 6, spacing);
+	Random random(42);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 6; iz++) {
+				Vector3f v(random.rand(), random.rand(), random.rand());
+				gridf.get(ix, iy, iz) = v;
+				gridd.get(ix, iy, iz) = v;
+				gridx.get(ix, iy, iz) = v.x;
+			}
+	gridd.setInterpolationType(TRICUBIC);
+	gridx.setInterpolationType(TRICUBIC);
+	for (int i = 0; i < 20; i++) {
+		Vector3d pos = random.randVector() * 20 * spacing;
+		Vector3d bd = gridd.interpolate(pos);
+		EXPECT_NEAR(bd.x, gridx.interpolate(pos), 1e-12);
+		gridf.setInterpolationType(TRICUBIC);
+		Vector3f bf = gridf.interpolate(pos);
+		EXPECT_NEAR(bd.x, bf.x, 1e-5);
+		EXPECT_NEAR(bd.y, bf.y, 1e-5);
+		EXPECT_NEAR(bd.z, bf.z, 1e-5);
+	}
+
+	// reflective repetition: grid(x + a) = grid(-x - a)
+	gridd.setReflective(true);
+	Vector3d pos(1.2, 2.3, 0.7);
+	Vector3d b1 = gridd.interpolate(pos + Vector3d(0, 5, 0) * spacing);
+	Vector3d b2 = gridd.interpolate(pos * (-1) - Vector3d(0, 5, 0) * spacing);
+	EXPECT_NEAR(b1.x, b2.x, 1e-12);
+	EXPECT_NEAR(b1.z, b2.z, 1e-12);
+}
+
+TEST(Grid3f, SimdKernels) {
+	// the SIMD kernels of all supported levels agree with the portable version
+	Grid3f gridf(Vector3d(0.), 4, 5, 6, 1.);
+	Grid3d gridd(Vector3d(0.), 4, 5, 6, 1.);
+	Grid1d gridx(Vector3d(0.), 4, 5, 6, 1.);
+	Random random(42);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 6; iz++) {
+				Vector3f v(random.rand(), random.rand(), random.rand());
+				gridf.get(ix, iy, iz) = v;
+				gridd.get(ix, iy, iz) = Vector3d(v.x, v.y, v.z);
+				gridx.get(ix, iy, iz) = v.y;
+			}
+	gridf.setInterpolationType(TRICUBIC);
+	gridd.setInterpolationType(TRICUBIC);
+	gridx.setInterpolationType(TRICUBIC);
+
+	std::vector<Vector3d> pos;
+	for (int i = 0; i < 20; i++)
+		pos.push_back(random.randVector() * 10);
+
+	SimdLevel supported = getSimdLevel();
+	setSimdLevel(SIMD_NONE);
+	EXPECT_EQ(SIMD_NONE, getSimdLevel());
+	EXPECT_FALSE(getSimdKernels().tricubic3f);
+	std::vector<Vector3d> bd;
+	std::vector<double> bx;
+	for (size_t i = 0; i < pos.size(); i++) {
+		bd.push_back(gridd.interpolate(pos[i]));
+		bx.push_back(gridx.interpolate(pos[i]));
+	}
+
+	for (int level = SIMD_AVX; level <= supported; level++) {
+		setSimdLevel(SimdLevel(level));
+		EXPECT_EQ(level, getSimdLevel());
+		EXPECT_TRUE(getSimdKernels().tricubic3f);
+		for (size_t i = 0; i < pos.size(); i++) {
+			Vector3f bf = gridf.interpolate(pos[i]);
+			EXPECT_NEAR(bd[i].x, bf.x, 1e-5);
+			EXPECT_NEAR(bd[i].z, bf.z, 1e-5);
+			EXPECT_NEAR(bd[i].y, gridd.interpolate(pos[i]).y, 1e-12);
+			EXPECT_NEAR(bx[i], gridx.interpolate(pos[i]), 1e-12);
+		}
+	}
+	setSimdLevel(SIMD_AVX512);
+	EXPECT_EQ(supported, getSimdLevel());
+	EXPECT_EQ("avx2", getSimdLevelName(SIMD_AVX2));
+}
+
+TEST(SimdMath, accuracy) {
+	// the portable loops and the kernels of all supported levels agree with libm
+	Random random(42);
+	const size_t n = 10000;
+	std::vector<double> logX(n), expX(n), pow10X(n), angle(n), y(n), s(n), c(n);
+	for (size_t i = 0; i < n; i++) {
+		logX[i] = exp(random.randUniform(-740, 700));
+		expX[i] = random.randUniform(-708, 709.7);
+		pow10X[i] = random.randUniform(-307, 308);
+		angle[i] = random.randUniform(-1e5, 1e5);
+	}
+	logX[0] = 1 + 1e-12;
+	logX[1] = 1 - 1e-12;
+
+	SimdLevel supported = getSimdLevel();
+	for (int level = SIMD_NONE; level <= supported; level++) {
+		setSimdLevel(SimdLevel(level));
+		simdLog(logX.data(), y.data(), n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_NEAR(log(logX[i]), y[i], 5e-16 * fabs(log(logX[i])));
+		simdLog10(logX.data(), y.data(), n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_NEAR(log10(logX[i]), y[i], 6e-16 * fabs(log10(logX[i])));
+		simdExp(expX.data(), y.data(), n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_NEAR(exp(expX[i]), y[i], 3e-16 * exp(expX[i]));
+		simdPow10(pow10X.data(), y.data(), n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_NEAR(pow(10, pow10X[i]), y[i], 4e-16 * pow(10, pow10X[i]));
+		simdPow(logX.data(), -0.4, y.data(), n);
+		for (size_t i = 0; i < n; i++)
+			EXPECT_NEAR(pow(logX[i], -0.4), y[i],
+					(1 + fabs(0.4 * log(logX[i]))) * 3e-16 * pow(logX[i], -0.4));
+		simdSinCos(angle.data(), s.data(), c.data(), n);
+		for (size_t i = 0; i < n; i++) {
+			EXPECT_NEAR(sin(angle[i]), s[i], 3e-16);
+			EXPECT_NEAR(cos(angle[i]), c[i], 3e-16);
+		}
+
+		// special values
+		double x[5] = {0, -1, std::numeric_limits<double>::infinity(), 4.9e-324, 1};
+		simdLog(x, y.data(), 5);
+		EXPECT_EQ(-std::numeric_limits<double>::infinity(), y[0]);
+		EXPECT_TRUE(std::isnan(y[1]));
+		EXPECT_EQ(std::numeric_limits<double>::infinity(), y[2]);
+		EXPECT_NEAR(log(4.9e-324), y[3], 1e-13);
+		EXPECT_EQ(0, y[4]);
+		double e[3] = {710, -710, 0};
+		simdExp(e, y.data(), 3);
+		EXPECT_EQ(std::numeric_limits<double>::infinity(), y[0]);
+		EXPECT_EQ(0, y[1]);
+		EXPECT_EQ(1, y[2]);
+	}
+	setSimdLevel(SIMD_AVX512);
 }
 
 TEST(VectordGrid, Scale) {
@@ -664,6 +1791,125 @@ TEST(VectordGrid, Scale) {
 				EXPECT_FLOAT_EQ(5, grid->interpolate(Vector3d(0.7, 0, 0.1)).x);
 }
 
+TEST(Grid3f, Reductions) {
+	// the same statistics for both layouts, without the padding of the bricks
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 5, 6, 7, 1.);
+	for (int ix = 0; ix < 5; ix++)
+		for (int iy = 0; iy < 6; iy++)
+			for (int iz = 0; iz < 7; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, -iy, 2);
+	ref_ptr<Grid3f> bricked = convertLayout(grid, BRICKED);
+
+	for (int i = 0; i < 2; i++) {
+		ref_ptr<Grid3f> g = (i == 0) ? grid : bricked;
+		Vector3f mean = meanFieldVector(g);
+		EXPECT_FLOAT_EQ(2, mean.x);
+		EXPECT_FLOAT_EQ(-2.5, mean.y);
+		EXPECT_FLOAT_EQ(2, mean.z);
+		std::array<float, 3> rms = rmsFieldStrengthPerAxis(g);
+		EXPECT_FLOAT_EQ(std::sqrt(6.), rms[0]); // (0 + 1 + 4 + 9 + 16) / 5
+		EXPECT_FLOAT_EQ(std::sqrt(55. / 6), rms[1]);
+		EXPECT_FLOAT_EQ(2, rms[2]);
+		EXPECT_FLOAT_EQ(std::sqrt(6 + 55. / 6 + 4), rmsFieldStrength(g));
+	}
+}
+
+TEST(Grid3f, TurbulenceDiagnostics) {
+	// B = (cos(2 pi x / n), 0, 0) on a periodic grid
+	size_t n = 16;
+	double spacing = 2;
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), n, spacing);
+	for (size_t ix = 0; ix < n; ix++)
+		for (size_t iy = 0; iy < n; iy++)
+			for (size_t iz = 0; iz < n; iz++)
+				grid->get(ix, iy, iz) = Vector3f(cos(2 * M_PI * ix / n), 0, 0);
+
+	// central difference: -sin(2 pi x / n) sin(2 pi / n) / spacing
+	double div = sin(2 * M_PI / n) / sqrt(2.) / spacing;
+	EXPECT_NEAR(div, rmsDivergence(grid), 1e-6);
+	EXPECT_NEAR(div, rmsDivergence(convertLayout(grid, BRICKED)), 1e-6);
+
+	// <|dB|^2> = 1 - cos(2 pi l / n) along x, 0 along y and z
+	std::vector<double> s2 = structureFunction(grid, 4);
+	ASSERT_EQ(5, s2.size());
+	EXPECT_EQ(0, s2[0]);
+	for (size_t l = 1; l < s2.size(); l++)
+		EXPECT_NEAR((1 - cos(2 * M_PI * l / n)) / 3, s2[l], 1e-6);
+	std::vector<double> s1 = structureFunction(grid, 4, 1);
+	EXPECT_LT(s1[1], sqrt(s2[1]));
+	EXPECT_THROW(structureFunction(grid, 1, 0), std::runtime_error);
+
+	// a solenoidal field
+	for (size_t ix = 0; ix < n; ix++)
+		for (size_t iy = 0; iy < n; iy++)
+			for (size_t iz = 0; iz < n; iz++)
+				grid->get(ix, iy, iz) = Vector3f(0, sin(2 * M_PI * ix / n), cos(2 * M_PI * ix / n));
+	EXPECT_NEAR(0, rmsDivergence(grid), 1e-7);
+#ifdef CRPROPA_HAVE_FFTW3F
+	// B = curl(B / k): maximally helical, one mode of wave length n * spacing
+	EXPECT_NEAR(1, gridRelativeHelicity(grid), 1e-5);
+	EXPECT_NEAR(0.5 * n * spacing, gridCorrelationLength(grid), 1e-5 * n * spacing);
+#endif
+}
+
+TEST(DomainDecomposition, boxes) {
+	GridProperties properties(Vector3d(-8.), 8, 8, 16, 2.);
+	DomainDecomposition d0(properties, 2, 4, 0);
+	EXPECT_EQ(4, d0.getDivision(0) * d0.getDivision(1) * d0.getDivision(2));
+	EXPECT_EQ(1, d0.getDivision(0));
+	EXPECT_DOUBLE_EQ(2, d0.getReach());
+
+	// each position is in the box of exactly one rank, also periodically
+	std::vector<ref_ptr<DomainDecomposition> > domains;
+	for (int r = 0; r < 4; r++)
+		domains.push_back(new DomainDecomposition(properties, 2, 4, r));
+	Random random(3);
+	for (int i = 0; i < 100; i++) {
+		Vector3d x = random.randVector() * random.rand() * 40;
+		int owners = 0;
+		for (int r = 0; r < 4; r++)
+			if (domains[r]->isLocal(x)) {
+				owners++;
+				EXPECT_EQ(r, domains[r]->getRank(x));
+			}
+		EXPECT_EQ(1, owners);
+	}
+
+	EXPECT_THROW(DomainDecomposition(properties, 1, 4, 0), std::runtime_error);
+	EXPECT_THROW(DomainDecomposition(properties, 2, 4, 4), std::runtime_error);
+	properties.setReflective(true);
+	EXPECT_THROW(DomainDecomposition(properties, 2, 4, 0), std::runtime_error);
+}
+
+TEST(DomainDecomposition, localField) {
+	// the field of each rank agrees with the whole grid in the box and halo
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 16, 1.);
+	Random random(5);
+	for (size_t ix = 0; ix < 16; ix++)
+		for (size_t iy = 0; iy < 16; iy++)
+			for (size_t iz = 0; iz < 16; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+
+	for (int r = 0; r < 8; r++) {
+		ref_ptr<DomainDecomposition> domain = new DomainDecomposition(
+				GridProperties(Vector3d(0.), 16, 1.), 3, 8, r);
+		ref_ptr<Grid3f> local = domain->extractLocalGrid(grid);
+		EXPECT_EQ(14, local->getNx());
+		DomainMagneticField field(domain, local, 2);
+		for (int i = 0; i < 20; i++) {
+			// inside the box widened by the reach of the steps
+			Vector3d x = domain->getLocalMin() - Vector3d(domain->getReach())
+					+ Vector3d(random.rand(), random.rand(), random.rand()) * (8 + 2 * domain->getReach());
+			Vector3d b = field.getField(x + Vector3d(32, -16, 16));
+			Vector3f expected = grid->interpolate(x) * 2;
+			EXPECT_NEAR(expected.x, b.x, 1e-6);
+			EXPECT_NEAR(expected.y, b.y, 1e-6);
+			EXPECT_NEAR(expected.z, b.z, 1e-6);
+		}
+		EXPECT_THROW(field.getField(domain->getLocalMax() + Vector3d(2.5)), std::runtime_error);
+	}
+}
+
 TEST(Grid3f, Periodicity) {
 	// Test for periodic boundaries: grid(x+a*n) = grid(x)
 	size_t n = 3;
@@ -695,7 +1941,6 @@ TEST(Grid3f, Periodicity) {
 	EXPECT_FLOAT_EQ(b.z, b2.z);
 	
 	//tricubic interpolated
-	#ifdef HAVE_SIMD
 	grid.setInterpolationType(TRICUBIC);
 	b = grid.interpolate(pos);
 	b2 = grid.interpolate(pos + Vector3d(1, 0, 0) * size);
@@ -712,7 +1957,6 @@ TEST(Grid3f, Periodicity) {
 	EXPECT_FLOAT_EQ(b.x, b2.x);
 	EXPECT_FLOAT_EQ(b.y, b2.y);
 	EXPECT_FLOAT_EQ(b.z, b2.z);
-	#endif // HAVE_SIMD
 	
 	//nearest neighbour interpolated
 	grid.setInterpolationType(NEAREST_NEIGHBOUR);
@@ -767,7 +2011,6 @@ TEST(Grid3f, Reflectivity) {
 	EXPECT_FLOAT_EQ(b.z, b2.z);
 	
 	//tricubic interpolated
-	#ifdef HAVE_SIMD
 	grid.setInterpolationType(TRICUBIC);
 	b = grid.interpolate(pos + Vector3d(1,0,0) * spacing);
 	b2 = grid.interpolate(pos *(-1) - Vector3d(1,0,0) * spacing);
@@ -786,7 +2029,6 @@ TEST(Grid3f, Reflectivity) {
 	EXPECT_FLOAT_EQ(b.x, b2.x);
 	EXPECT_FLOAT_EQ(b.y, b2.y);
 	EXPECT_FLOAT_EQ(b.z, b2.z);
-	#endif //HAVE_SIMD
 	
 	//nearest neighbour interpolated
 	grid.setInterpolationType(NEAREST_NEIGHBOUR);
@@ -809,6 +2051,409 @@ TEST(Grid3f, Reflectivity) {
 	EXPECT_FLOAT_EQ(b.z, b2.z);
 }
 
+TEST(Grid3f, BrickedLayout) {
+	// the bricked layout gives the same values and interpolations as the dense layout
+	double spacing = 1.3;
+	ref_ptr<Grid3f> dense = new Grid3f(Vector3d(-2.), 11, 9, 20, spacing);
+	Random random(7);
+	for (int ix = 0; ix < 11; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 20; iz++)
+				dense->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+
+	ref_ptr<Grid3f> bricked = convertLayout(dense, BRICKED);
+	EXPECT_EQ(BRICKED, bricked->getLayout());
+	EXPECT_EQ(16 * 16 * 24, bricked->getGrid().size()); // padded to bricks of 8^3
+
+	for (int ix = 0; ix < 11; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 20; iz++)
+				EXPECT_EQ(dense->get(ix, iy, iz), bricked->get(ix, iy, iz));
+
+	for (int i = 0; i < 50; i++) {
+		Vector3d pos = random.randVector() * 30;
+		EXPECT_EQ(dense->interpolate(pos), bricked->interpolate(pos));
+	}
+	dense->setInterpolationType(TRICUBIC);
+	bricked->setInterpolationType(TRICUBIC);
+	for (int i = 0; i < 50; i++) {
+		Vector3d pos = random.randVector() * 30;
+		EXPECT_EQ(dense->interpolate(pos), bricked->interpolate(pos));
+	}
+
+	// position of the index of a value, e.g. for SourceDensityGrid
+	std::vector<Vector3f> &values = bricked->getGrid();
+	size_t i = std::find(values.begin(), values.end(), dense->get(10, 3, 17)) - values.begin();
+	EXPECT_EQ(dense->positionFromIndex(10 * 9 * 20 + 3 * 20 + 17), bricked->positionFromIndex(i));
+
+	// and back
+	ref_ptr<Grid3f> back = convertLayout(bricked, DENSE);
+	EXPECT_EQ(dense->getGrid(), back->getGrid());
+
+	// scalar grids created with the layout
+	GridProperties properties(Vector3d(0.), 3, 5, 7, spacing);
+	properties.setLayout(BRICKED);
+	Grid1f grid(properties);
+	grid.get(2, 4, 6) = 5;
+	EXPECT_EQ(BRICKED, grid.getLayout());
+	EXPECT_FLOAT_EQ(5, grid.interpolate(grid.positionFromIndex(2 * 64 + 4 * 8 + 6)));
+}
+
+TEST(Grid, mortonKey) {
+	EXPECT_EQ(0, mortonKey(0, 0, 0));
+	EXPECT_EQ(4, mortonKey(1, 0, 0));
+	EXPECT_EQ(2, mortonKey(0, 1, 0));
+	EXPECT_EQ(1, mortonKey(0, 0, 1));
+	EXPECT_EQ(63, mortonKey(3, 3, 3));
+	EXPECT_EQ(uint64_t(1) << 62, mortonKey(1 << 20, 0, 0));
+	// only the lower 21 bits of each index
+	EXPECT_EQ(0, mortonKey(1 << 21, 0, 0));
+	EXPECT_EQ(mortonKey(0x1fffff, 0x1fffff, 0x1fffff), (uint64_t(1) << 63) - 1);
+}
+
+TEST(Grid3f, GhostLayers) {
+	// the interpolations of the padded copy agree with the continued grid
+	double spacing = 1.3;
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-2.), 11, 1, 6, spacing);
+	Random random(11);
+	for (int ix = 0; ix < 11; ix++)
+		for (int iz = 0; iz < 6; iz++)
+			grid->get(ix, 0, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+	ref_ptr<Grid3f> padded = new Grid3f(*grid);
+	padded->setGhostLayers(true);
+	EXPECT_TRUE(padded->hasGhostLayers());
+	EXPECT_GT(padded->getSizeOf(), grid->getSizeOf());
+
+	interpolationType types[2] = {TRILINEAR, TRICUBIC};
+	for (int reflective = 0; reflective < 2; reflective++)
+		for (int t = 0; t < 2; t++) {
+			grid->setReflective(reflective);
+			padded->setReflective(reflective);
+			grid->setInterpolationType(types[t]);
+			padded->setInterpolationType(types[t]);
+			for (int i = 0; i < 100; i++) {
+				Vector3d pos = random.randVector() * random.rand() * 40;
+				Vector3f a = grid->interpolate(pos), b = padded->interpolate(pos);
+				EXPECT_NEAR(a.x, b.x, 1e-5);
+				EXPECT_NEAR(a.y, b.y, 1e-5);
+				EXPECT_NEAR(a.z, b.z, 1e-5);
+			}
+		}
+
+	// setValue changes the copies at the edges, get needs updateGhostLayers
+	padded->setInterpolationType(TRILINEAR);
+	padded->setReflective(false);
+	padded->setValue(10, 0, 0, Vector3f(7.));
+	Vector3d edge = Vector3d(-2.) + Vector3d(11, 0.5, 0.5) * spacing; // between the last and first point
+	EXPECT_FLOAT_EQ(0.5 * (7 + padded->get(0, 0, 0).x), padded->interpolate(edge).x);
+	padded->get(0, 0, 0) = Vector3f(1.);
+	EXPECT_NE(4, padded->interpolate(edge).x);
+	padded->updateGhostLayers();
+	EXPECT_FLOAT_EQ(4, padded->interpolate(edge).x);
+
+	padded->setGhostLayers(false);
+	EXPECT_EQ(grid->getSizeOf(), padded->getSizeOf());
+}
+
+TEST(Grid1f, AdaptiveInterpolation) {
+	// smooth values with a narrow peak at grid point (12, 12, 12)
+	ref_ptr<Grid1f> grid = new Grid1f(Vector3d(0.), 32, 1);
+	for (int ix = 0; ix < 32; ix++)
+		for (int iy = 0; iy < 32; iy++)
+			for (int iz = 0; iz < 32; iz++) {
+				double r2 = pow(ix - 12, 2) + pow(iy - 12, 2) + pow(iz - 12, 2);
+				grid->get(ix, iy, iz) = 1 + 0.1 * sin(2 * M_PI * ix / 32) + 5 * exp(-r2);
+			}
+	ref_ptr<Grid1f> cubic = new Grid1f(*grid);
+	cubic->setInterpolationType(TRICUBIC);
+
+	grid->setInterpolationType(ADAPTIVE);
+	EXPECT_EQ(ADAPTIVE, grid->getInterpolationType());
+	EXPECT_GT(grid->getTricubicFraction(), 0);
+	EXPECT_LT(grid->getTricubicFraction(), 0.5);
+
+	// tricubic at the peak, trilinear in the smooth bricks
+	Vector3d peak(12.3, 12.6, 12.8), smooth(28.3, 3.2, 20.7);
+	EXPECT_TRUE(grid->isTricubic(peak));
+	EXPECT_FALSE(grid->isTricubic(smooth));
+	EXPECT_FLOAT_EQ(cubic->interpolate(peak), grid->interpolate(peak));
+	ref_ptr<Grid1f> linear = new Grid1f(*grid);
+	linear->setInterpolationType(TRILINEAR);
+	EXPECT_FLOAT_EQ(linear->interpolate(smooth), grid->interpolate(smooth));
+
+	// without tolerance all bricks with curvature are tricubic
+	grid->setAdaptiveTolerance(0);
+	EXPECT_TRUE(grid->isTricubic(smooth));
+	EXPECT_THROW(grid->setAdaptiveTolerance(-1), std::runtime_error);
+}
+
+TEST(Grid3f, CellInterpolation) {
+	// interpolations with a cell are those without, also after changes of the
+	// values, the layout and the grid that the cell was used with
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-2.), 11, 9, 20, 1.3);
+	ref_ptr<Grid3f> other = new Grid3f(Vector3d(0.), 4, 4, 4, 1.);
+	Random random(11);
+	for (int ix = 0; ix < 11; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 20; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+
+	GridCell cell;
+	Vector3d pos = random.randVector() * 30;
+	for (int i = 0; i < 200; i++) {
+		pos += random.randVector() * 0.3; // mostly in the same cell
+		EXPECT_EQ(grid->interpolate(pos), grid->interpolate(pos, cell));
+		if (i == 50)
+			grid->getValues()[cell.offset[0]] *= 2;
+		if (i == 100)
+			grid->setLayout(BRICKED);
+		if (i == 150)
+			EXPECT_EQ(other->interpolate(pos), other->interpolate(pos, cell));
+	}
+
+	grid->setReflective(true);
+	EXPECT_EQ(grid->interpolate(pos), grid->interpolate(pos, cell));
+}
+
+TEST(Grid3f, MappedGrid) {
+	// grids dumped with a header are mapped with the same values
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-1.), 6, 5, 4, Vector3d(0.5, 1, 2));
+	grid->setReflective(true);
+	Random random(3);
+	for (int ix = 0; ix < 6; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand()) * 2;
+	dumpMappedGrid(grid, "testMappedGrid.raw", 2, "two");
+
+	GridFileInfo info = readGridFileInfo("testMappedGrid.raw");
+	EXPECT_EQ(3, info.components);
+	EXPECT_EQ(6, info.Nx);
+	EXPECT_EQ(4, info.Nz);
+	EXPECT_EQ(Vector3d(0.5, 1, 2), info.spacing);
+	EXPECT_TRUE(info.reflective);
+	EXPECT_DOUBLE_EQ(2, info.unit);
+	EXPECT_EQ("two", info.unitName);
+
+	ref_ptr<Grid3f> mapped = mapGrid3f("testMappedGrid.raw");
+	EXPECT_TRUE(mapped->isMapped());
+	EXPECT_TRUE(mapped->isReflective());
+	EXPECT_THROW(mapped->getGrid(), std::runtime_error);
+	for (int ix = 0; ix < 6; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				EXPECT_EQ(grid->get(ix, iy, iz), mapped->get(ix, iy, iz) * 2);
+	for (int i = 0; i < 20; i++) {
+		Vector3d pos = random.randVector() * 5;
+		EXPECT_EQ(grid->interpolate(pos), mapped->interpolate(pos) * 2);
+	}
+
+	// modifications are private to the process
+	mapped->get(1, 2, 3) = Vector3f(7.);
+	ref_ptr<Grid3f> again = mapGrid3f("testMappedGrid.raw");
+	EXPECT_EQ(grid->get(1, 2, 3), again->get(1, 2, 3) * 2);
+
+	// copies own their values
+	Grid3f copy = *again;
+	EXPECT_FALSE(copy.isMapped());
+	copy.get(0, 0, 0) = Vector3f(-1.);
+	EXPECT_EQ(grid->get(0, 0, 0), again->get(0, 0, 0) * 2);
+
+	// bricked scalar grids
+	ref_ptr<Grid1f> scalar = new Grid1f(Vector3d(0.), 9, 1);
+	for (int ix = 0; ix < 9; ix++)
+		scalar->get(ix, 8 - ix, ix % 3) = ix;
+	scalar = convertLayout(scalar, BRICKED);
+	dumpMappedGrid(scalar, "testMappedGrid.raw");
+	ref_ptr<Grid1f> mappedScalar = mapGrid1f("testMappedGrid.raw");
+	EXPECT_EQ(BRICKED, mappedScalar->getLayout());
+	for (int ix = 0; ix < 9; ix++)
+		EXPECT_EQ(ix, mappedScalar->get(ix, 8 - ix, ix % 3));
+	EXPECT_THROW(mapGrid3f("testMappedGrid.raw"), std::runtime_error);
+	remove("testMappedGrid.raw");
+}
+
+TEST(Grid3f, interleave) {
+	std::vector<NumaNode> nodes = getNumaNodes();
+	ASSERT_FALSE(nodes.empty());
+	EXPECT_FALSE(nodes[0].cpus.empty());
+
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 6, 5, 4, 1.);
+	Random random;
+	for (int ix = 0; ix < 6; ix++)
+		for (int iy = 0; iy < 5; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+	Grid3f copy = *grid;
+
+	grid->interleave();
+	EXPECT_TRUE(grid->isInterleaved());
+	EXPECT_FALSE(grid->isMapped());
+	EXPECT_THROW(grid->getGrid(), std::runtime_error);
+	for (int i = 0; i < 20; i++) {
+		Vector3d pos = random.randVector() * 5;
+		EXPECT_EQ(copy.interpolate(pos), grid->interpolate(pos));
+	}
+	grid->get(1, 2, 3) = Vector3f(7.);
+	EXPECT_EQ(Vector3f(7.), grid->get(1, 2, 3));
+
+	// back to ordinary memory
+	grid->setLayout(BRICKED);
+	EXPECT_FALSE(grid->isInterleaved());
+	EXPECT_EQ(Vector3f(7.), grid->get(1, 2, 3));
+	EXPECT_EQ(copy.get(0, 0, 0), grid->get(0, 0, 0));
+}
+
+TEST(Grid3f, hugePages) {
+	// 3 MB of values, enough for a huge page
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 64, 1.);
+	for (int ix = 0; ix < 64; ix++)
+		for (int iy = 0; iy < 64; iy++)
+			for (int iz = 0; iz < 64; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy, iz);
+	EXPECT_EQ(PageMemory::getSystemPageSize(), grid->getPageSize());
+
+	grid->placeValues(PageMemory::HugePages);
+	EXPECT_FALSE(grid->isMapped());
+	EXPECT_EQ(Vector3f(1, 2, 3), grid->get(1, 2, 3));
+	EXPECT_EQ(Vector3f(63, 0, 62), grid->get(63, 0, 62));
+	// huge pages if the system provides them
+	size_t pageSize = grid->getPageSize();
+	EXPECT_TRUE(pageSize == PageMemory::getSystemPageSize()
+			or pageSize == PageMemory::getHugePageSize());
+
+	grid->setLayout(BRICKED);
+	EXPECT_EQ(PageMemory::getSystemPageSize(), grid->getPageSize());
+	EXPECT_EQ(Vector3f(63, 0, 62), grid->get(63, 0, 62));
+}
+
+TEST(CompressedGrid3f, HalfConversion) {
+	EXPECT_EQ(0x3c00, floatToHalf(1));
+	EXPECT_EQ(0xc000, floatToHalf(-2));
+	EXPECT_EQ(0x7bff, floatToHalf(65504));
+	EXPECT_EQ(0x7c00, floatToHalf(1e6));
+	EXPECT_EQ(0x0001, floatToHalf(std::ldexp(1., -24)));
+	EXPECT_EQ(0x3c00, floatToHalf(1 + std::ldexp(1., -11))); // halfway, to even
+	EXPECT_EQ(0x3c02, floatToHalf(1 + 3 * std::ldexp(1., -11)));
+	EXPECT_FLOAT_EQ(0.333251953125, halfToFloat(floatToHalf(1. / 3)));
+	// all finite halfs are exact
+	for (uint32_t h = 0; h < 0x10000; h++) {
+		if ((h & 0x7c00) == 0x7c00)
+			continue;
+		EXPECT_EQ(h, floatToHalf(halfToFloat(h)));
+	}
+}
+
+TEST(CompressedGrid3f, Compression) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-1.), 20, 9, 11, Vector3d(1, 0.5, 2));
+	Random random(11);
+	for (int ix = 0; ix < 20; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 11; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.randNorm(), random.randNorm(), random.randNorm()) * 1e-13;
+	for (int iy = 0; iy < 8; iy++) // a brick of zeros
+		for (int iz = 0; iz < 8; iz++)
+			grid->get(19, iy, iz) = Vector3f(0.);
+	double rms = rmsFieldStrength(grid);
+
+	ref_ptr<CompressedGrid3f> half = compressGrid(grid, FLOAT16);
+	ref_ptr<CompressedGrid3f> quantized = compressGrid(grid, QUANTIZED_INT16);
+	EXPECT_EQ(QUANTIZED_INT16, quantized->getEncoding());
+	EXPECT_LT(half->getSizeOf(), convertLayout(grid, BRICKED)->getSizeOf() * 0.6); // same padding
+	EXPECT_EQ(Vector3f(0.), half->get(19, 3, 4));
+	EXPECT_LT(rmsCompressionError(grid, half), 1e-3 * rms);
+	EXPECT_LT(rmsCompressionError(grid, quantized), 1e-4 * rms);
+	EXPECT_LT(rmsCompressionError(grid, quantized), rmsCompressionError(grid, half));
+
+	// interpolation of the decoded values
+	ref_ptr<Grid3f> decoded = decompressGrid(half, BRICKED);
+	EXPECT_DOUBLE_EQ(0, rmsCompressionError(decoded, half));
+	for (int i = 0; i < 30; i++) {
+		Vector3d pos = random.randVector() * 15;
+		Vector3f a = decoded->interpolate(pos), b = half->interpolate(pos);
+		EXPECT_NEAR(a.x, b.x, 1e-6 * rms);
+		EXPECT_NEAR(a.y, b.y, 1e-6 * rms);
+		EXPECT_NEAR(a.z, b.z, 1e-6 * rms);
+	}
+	half->setReflective(true);
+	decoded->setReflective(true);
+	half->setInterpolationType(NEAREST_NEIGHBOUR);
+	decoded->setInterpolationType(NEAREST_NEIGHBOUR);
+	for (int i = 0; i < 30; i++) {
+		Vector3d pos = random.randVector() * 15;
+		EXPECT_EQ(decoded->interpolate(pos), half->interpolate(pos));
+	}
+	half->setInterpolationType(TRICUBIC);
+	decoded->setInterpolationType(TRICUBIC);
+	for (int i = 0; i < 30; i++) {
+		Vector3d pos = random.randVector() * 15;
+		Vector3f a = decoded->interpolate(pos), b = half->interpolate(pos);
+		EXPECT_NEAR(a.x, b.x, 1e-5 * rms);
+		EXPECT_NEAR(a.y, b.y, 1e-5 * rms);
+		EXPECT_NEAR(a.z, b.z, 1e-5 * rms);
+	}
+}
+
+TEST(TiledGrid3f, Cache) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-1.), 20, 9, 13, Vector3d(1, 0.5, 2));
+	Random random(5);
+	for (int ix = 0; ix < 20; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 13; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.rand(), random.rand(), random.rand());
+	EXPECT_THROW(dumpTiledGrid(grid, "testTiledGrid.raw", 6), std::runtime_error);
+	dumpTiledGrid(grid, "testTiledGrid.raw", 8);
+
+	// a cache of three out of 3 x 2 x 2 tiles
+	size_t tileBytes = 8 * 8 * 8 * sizeof(Vector3f);
+	ref_ptr<TiledGrid3f> tiled = new TiledGrid3f("testTiledGrid.raw", 3 * tileBytes);
+	EXPECT_EQ(3 * tileBytes, tiled->getCacheSize());
+	EXPECT_EQ(8, tiled->getTileSize());
+	EXPECT_EQ(13, tiled->getNz());
+	EXPECT_EQ(Vector3d(1, 0.5, 2), tiled->getSpacing());
+	for (int ix = 0; ix < 20; ix++)
+		for (int iy = 0; iy < 9; iy++)
+			for (int iz = 0; iz < 13; iz++)
+				EXPECT_EQ(grid->get(ix, iy, iz), tiled->get(ix, iy, iz));
+	EXPECT_EQ(3, tiled->getNumberOfCachedTiles());
+	EXPECT_GT(tiled->getNumberOfLoads(), 12);
+
+	// same interpolation as the grid, also in parallel
+	std::vector<Vector3d> positions;
+	for (int i = 0; i < 200; i++)
+		positions.push_back(random.randVector() * random.rand() * 40);
+	tiled->prefetch(positions[0], Vector3d(1, 0, 0), 30);
+	std::vector<Vector3f> b(positions.size());
+	#pragma omp parallel for
+	for (int i = 0; i < positions.size(); i++)
+		b[i] = tiled->interpolate(positions[i]);
+	for (int i = 0; i < positions.size(); i++) {
+		Vector3f a = grid->interpolate(positions[i]);
+		EXPECT_NEAR(a.x, b[i].x, 1e-6);
+		EXPECT_NEAR(a.y, b[i].y, 1e-6);
+		EXPECT_NEAR(a.z, b[i].z, 1e-6);
+	}
+	grid->setReflective(true);
+	tiled->setReflective(true);
+	grid->setInterpolationType(NEAREST_NEIGHBOUR);
+	tiled->setInterpolationType(NEAREST_NEIGHBOUR);
+	for (int i = 0; i < positions.size(); i++)
+		EXPECT_EQ(grid->interpolate(positions[i]), tiled->interpolate(positions[i]));
+	grid->setInterpolationType(TRICUBIC);
+	tiled->setInterpolationType(TRICUBIC);
+	for (int i = 0; i < positions.size(); i++) {
+		Vector3f a = grid->interpolate(positions[i]), c = tiled->interpolate(positions[i]);
+		EXPECT_NEAR(a.x, c.x, 1e-5);
+		EXPECT_NEAR(a.y, c.y, 1e-5);
+		EXPECT_NEAR(a.z, c.z, 1e-5);
+	}
+
+	// a smaller cache keeps at least one tile
+	tiled->setCacheSize(0);
+	EXPECT_EQ(1, tiled->getNumberOfCachedTiles());
+	remove("testTiledGrid.raw");
+}
+
 TEST(Grid3f, DumpLoad) {
 	// Dump and load a field grid
 	ref_ptr<Grid3f> grid1 = new Grid3f(Vector3d(0.), 3, 1);
@@ -929,6 +2574,54 @@ TEST(EmissionMap, merge) {
 }
 
 
+TEST(EmissionMap, parallelFill) {
+	EmissionMap em;
+	const int n = 1000;
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++)
+		em.fillMap(1, 50 * EeV, Vector3d(1.0, 0.0, 0.0));
+
+	ref_ptr<CylindricalProjectionMap> cpm = em.getMap(1, 50 * EeV);
+	size_t bin = cpm->binFromDirection(Vector3d(1.0, 0.0, 0.0));
+	EXPECT_DOUBLE_EQ(cpm->getPdf()[bin], n);
+	EXPECT_EQ(em.getMaps().size(), 1);
+}
+
+TEST(EmissionMap, freeze) {
+	EmissionMap em;
+	em.fillMap(1, 50 * EeV, Vector3d(0.0, 1.0, 0.0));
+	em.freeze();
+	EXPECT_TRUE(em.isFrozen());
+	EXPECT_THROW(em.fillMap(1, 50 * EeV, Vector3d(1.0, 0.0, 0.0)), std::runtime_error);
+
+	int failures = 0;
+	#pragma omp parallel for reduction(+:failures)
+	for (int i = 0; i < 1000; i++) {
+		Vector3d d;
+		if (not em.drawDirection(1, 50 * EeV, d) or d.getAngleTo(Vector3d(0.0, 1.0, 0.0)) > 2 * M_PI / 180)
+			failures++;
+	}
+	EXPECT_EQ(failures, 0);
+}
+
+TEST(EmissionMap, binaryFile) {
+	EmissionMap em1, em2;
+	em1.fillMap(1, 50 * EeV, Vector3d(1.0, 0.0, 0.0), 0.1);
+	em1.fillMap(2, 5 * EeV, Vector3d(0.0, 0.6, 0.8));
+	em1.saveBinary("testEmissionMap.bin");
+	em2.fillMap(1, 50 * EeV, Vector3d(1.0, 0.0, 0.0), 0.2);
+	em2.merge("testEmissionMap.bin");
+	remove("testEmissionMap.bin");
+
+	EXPECT_EQ(em2.getMaps().size(), 2);
+	ref_ptr<CylindricalProjectionMap> cpm = em2.getMap(1, 50 * EeV);
+	size_t bin = cpm->binFromDirection(Vector3d(1.0, 0.0, 0.0));
+	EXPECT_DOUBLE_EQ(cpm->getPdf()[bin], 0.1 + 0.2);
+	Vector3d d;
+	EXPECT_TRUE(em2.drawDirection(2, 5 * EeV, d));
+	EXPECT_LT(d.getAngleTo(Vector3d(0.0, 0.6, 0.8)), 0.1);
+}
+
 TEST(Variant, copyToBuffer)
 {
 	double a = 23.42;
@@ -986,6 +2679,189 @@ TEST(Geometry, ParaxialBox)
 	EXPECT_NEAR(8., b.distance(Vector3d(-8., 0., 0.)), 1E-10);
 }
 
+// sphere without ray intersection, for the default of Surface
+class MarchedSphere: public Surface {
+public:
+	double distance(const Vector3d &point) const {
+		return point.getR() - 1.;
+	}
+	Vector3d normal(const Vector3d &point) const {
+		return point.getUnitVector();
+	}
+};
+
+TEST(Geometry, rayDistance)
+{
+	double inf = std::numeric_limits<double>::infinity();
+	Plane p(Vector3d(0,0,1), Vector3d(0,0,2));
+	EXPECT_DOUBLE_EQ(1.25, p.rayDistance(Vector3d(0, 0, 0), Vector3d(0, 0.6, 0.8), 10.));
+	EXPECT_EQ(inf, p.rayDistance(Vector3d(0, 0, 0), Vector3d(0, 0, -1), 10.));
+	EXPECT_EQ(inf, p.rayDistance(Vector3d(0, 0, 0), Vector3d(1, 0, 0), 10.));
+
+	Sphere s(Vector3d(1,0,0), 1.);
+	EXPECT_DOUBLE_EQ(1., s.rayDistance(Vector3d(1, 0, 0), Vector3d(0, 1, 0), 10.));
+	EXPECT_DOUBLE_EQ(2., s.rayDistance(Vector3d(-2, 0, 0), Vector3d(1, 0, 0), 10.));
+	EXPECT_EQ(inf, s.rayDistance(Vector3d(-2, 0, 0), Vector3d(-1, 0, 0), 10.));
+	EXPECT_EQ(inf, s.rayDistance(Vector3d(-2, 2, 0), Vector3d(1, 0, 0), 10.));
+
+	ParaxialBox b(Vector3d(0,0,0), Vector3d(3,4,5));
+	EXPECT_DOUBLE_EQ(2., b.rayDistance(Vector3d(1, 1, 1), Vector3d(1, 0, 0), 10.));
+	EXPECT_DOUBLE_EQ(4., b.rayDistance(Vector3d(1, 1, 1), Vector3d(0, 0, 1), 10.));
+	EXPECT_DOUBLE_EQ(7., b.rayDistance(Vector3d(-7, 1, 1), Vector3d(1, 0, 0), 10.));
+	EXPECT_EQ(inf, b.rayDistance(Vector3d(-7, 1, 1), Vector3d(-1, 0, 0), 10.));
+	EXPECT_EQ(inf, b.rayDistance(Vector3d(-7, 5, 1), Vector3d(1, 0, 0), 10.));
+
+	MarchedSphere m;
+	EXPECT_NEAR(2., m.rayDistance(Vector3d(-3, 0, 0), Vector3d(1, 0, 0), 10.), 1e-9);
+	EXPECT_NEAR(1., m.rayDistance(Vector3d(0, 0, 0), Vector3d(0, 0, 1), 10.), 1e-9);
+	EXPECT_EQ(inf, m.rayDistance(Vector3d(-3, 0, 0), Vector3d(-1, 0, 0), 10.));
+}
+
+TEST(Cosmology, conversions) {
+	// round trips of the tabulated conversions and the linear range at small z
+	double zs[] = {0.00005, 0.001, 0.05, 1, 10, 90};
+	for (size_t i = 0; i < 6; i++) {
+		double z = zs[i];
+		EXPECT_NEAR(z, comovingDistance2Redshift(redshift2ComovingDistance(z)), 1e-4 * z);
+		EXPECT_NEAR(z, luminosityDistance2Redshift(redshift2LuminosityDistance(z)), 1e-4 * z);
+		EXPECT_NEAR(z, lightTravelDistance2Redshift(redshift2LightTravelDistance(z)), 1e-4 * z);
+		double d = redshift2ComovingDistance(z);
+		EXPECT_NEAR(d, lightTravel2ComovingDistance(comoving2LightTravelDistance(d)), 1e-4 * d);
+	}
+	// Hubble law at small distances
+	EXPECT_NEAR(c_light / H0() * 0.001, redshift2ComovingDistance(0.001), 0.15 * Mpc);
+	EXPECT_THROW(redshift2ComovingDistance(-1), std::runtime_error);
+	EXPECT_THROW(redshift2ComovingDistance(101), std::runtime_error);
+}
+
+TEST(Cosmology, curvatureAndDarkEnergy) {
+	// open universe: d_L = (1 + z) dH / sqrt(omegaK) sinh(sqrt(omegaK) d_C / dH)
+	setCosmologyParameters(0.7, 0.3, 0.5);
+	EXPECT_NEAR(0.2, omegaK(), 1e-12);
+	double dH = c_light / H0();
+	double dc = redshift2ComovingDistance(2);
+	double dl = 3 * dH / sqrt(0.2) * sinh(sqrt(0.2) * dc / dH);
+	EXPECT_NEAR(dl, redshift2LuminosityDistance(2), 1e-4 * dl);
+	EXPECT_NEAR(2, luminosityDistance2Redshift(dl), 1e-4);
+
+	// constant w: omegaL scales as (1 + z)^(3 (1 + w))
+	setCosmologyParameters(0.7, 0.3, 0.7, -0.8);
+	double E = sqrt(0.3 * 8 + 0.7 * pow(2, 0.6));
+	EXPECT_NEAR(E, hubbleRate(1) / H0(), 1e-12);
+
+	setCosmologyParameters(0.673, 0.315);
+	EXPECT_DOUBLE_EQ(0, omegaK());
+	EXPECT_DOUBLE_EQ(-1, darkEnergyW0());
+
+	// invalid parameters are rejected before anything is changed
+	double dl2 = redshift2LuminosityDistance(2);
+	EXPECT_THROW(setCosmologyParameters(0.7, 0.3, 3), std::runtime_error);
+	EXPECT_DOUBLE_EQ(0.315, omegaM());
+	EXPECT_DOUBLE_EQ(1 - 0.315, omegaL());
+	EXPECT_DOUBLE_EQ(0, omegaK());
+	EXPECT_DOUBLE_EQ(dl2, redshift2LuminosityDistance(2));
+}
+
+TEST(ScratchVector, reuse) {
+	const double *data;
+	{
+		ScratchVector<double> a(100, 1.);
+		data = &a[0];
+		EXPECT_EQ(1., a[99]);
+		// nested scratch vectors borrow another vector
+		ScratchVector<double> b;
+		EXPECT_EQ(0, b.size());
+		b->push_back(2);
+		EXPECT_NE(data, &b[0]);
+	}
+	// the vectors are given back cleared, with their capacity
+	ScratchVector<double> c;
+	EXPECT_EQ(0, c.size());
+	EXPECT_GE(c->capacity(), 100);
+	c->resize(100);
+	EXPECT_EQ(data, &c[0]);
+}
+
+TEST(ConfigValue, parse) {
+	ConfigValue c = ConfigValue::parse(
+			"# comment\n"
+			"{\"a\": [1, 2.5e3, -3], \"b\": {\"c\": true, \"d\": null},\n"
+			" \"e\": \"x\\\"y\\u0041\", \"f\": \"10 EeV\", \"g\": \"2 * kpc\"} # end");
+	ASSERT_TRUE(c.isObject());
+	EXPECT_EQ(5, c.size());
+	EXPECT_EQ("b", c.getKeys()[1]);
+	EXPECT_DOUBLE_EQ(2500, c["a"][1].asDouble());
+	EXPECT_EQ(-3, c["a"][2].asInt());
+	EXPECT_TRUE(c["b"]["c"].asBool());
+	EXPECT_TRUE(c["b"]["d"].isNull());
+	EXPECT_EQ("x\"yA", c["e"].asString());
+	EXPECT_DOUBLE_EQ(10 * EeV, c["f"].asDouble());
+	EXPECT_DOUBLE_EQ(2 * kpc, c["g"].asDouble());
+	EXPECT_EQ(Vector3d(1, 2500, -3), c["a"].asVector3d());
+	EXPECT_EQ("a[1]", c["a"][1].getPath());
+
+	// defaults for missing keys
+	EXPECT_DOUBLE_EQ(7, c.getDouble("h", 7));
+	EXPECT_FALSE(c["b"].getBool("h", false));
+	EXPECT_EQ("y", c.getString("h", "y"));
+}
+
+TEST(ConfigValue, toJSON) {
+	ConfigValue c = ConfigValue::parse(
+			"{\"b\": [0.1, -3, true, null], \"a\": {\"s\": \"x\\\"y\\\\z\\n\\u0001\"},"
+			" \"e\": [], \"f\": {}, \"g\": \"10 EeV\"}");
+	std::string text = c.toJSON();
+	ConfigValue d = ConfigValue::parse(text);
+	EXPECT_EQ(text, d.toJSON());
+	EXPECT_EQ("b", d.getKeys()[0]);
+	EXPECT_EQ(0.1, d["b"][0].asDouble());
+	EXPECT_TRUE(d["b"][2].asBool());
+	EXPECT_TRUE(d["b"][3].isNull());
+	EXPECT_EQ("x\"y\\z\n\x01", d["a"]["s"].asString());
+	EXPECT_EQ(0, d["e"].size());
+	EXPECT_TRUE(d["f"].isObject());
+	EXPECT_DOUBLE_EQ(10 * EeV, d["g"].asDouble());
+}
+
+TEST(ConfigValue, errors) {
+	EXPECT_THROW(ConfigValue::parse("{\"a\": 1,}"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("{\"a\": 1, \"a\": 2}"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("[1, 2] 3"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("\"abc"), std::runtime_error);
+
+	// numbers and unicode escapes of the JSON grammar only
+	EXPECT_THROW(ConfigValue::parse("inf"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("nan"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("0x10"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("+1"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("1."), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse(".5"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("1e"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("01"), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("1e400"), std::runtime_error);
+	EXPECT_DOUBLE_EQ(-0.5e-3, ConfigValue::parse("-0.5E-3").asDouble());
+	EXPECT_THROW(ConfigValue::parse("\"\\u+041\""), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("\"\\u 041\""), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("\"\\ud83d\""), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("\"\\ude00\""), std::runtime_error);
+	EXPECT_THROW(ConfigValue::parse("\"\\ud83d\\u0041\""), std::runtime_error);
+	EXPECT_EQ("\xF0\x9F\x98\x80", ConfigValue::parse("\"\\ud83d\\ude00\"").asString());
+	EXPECT_EQ("\xE2\x82\xAC", ConfigValue::parse("\"\\u20AC\"").asString());
+
+	ConfigValue c = ConfigValue::parse("{\"a\": {\"b\": \"1 parsecs\"}, \"c\": 1.5}");
+	EXPECT_THROW(c["x"], std::runtime_error);
+	EXPECT_THROW(c["c"].asInt(), std::runtime_error);
+	EXPECT_THROW(c["c"].asString(), std::runtime_error);
+	try {
+		c["a"]["b"].asDouble();
+		FAIL();
+	} catch (std::runtime_error &e) {
+		// the message names the value and the unknown unit
+		EXPECT_NE(std::string::npos, std::string(e.what()).find("a.b"));
+		EXPECT_NE(std::string::npos, std::string(e.what()).find("parsecs"));
+	}
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -10,6 +10,7 @@
 
 #include <stdexcept>
 #include <cmath>
+#include <cstdio>
 #include <string>
 
 namespace crpropa {
@@ -66,6 +67,18 @@ TEST(testConstantDensity, SimpleTest) {
 }
 
 
+TEST(testCordes, getDensities) {
+	Cordes n;
+	Vector3d pos[3] = {Vector3d(0.), Vector3d(3, 0, 0) * kpc, Vector3d(-1, 2, 0.1) * kpc};
+	double rho[3];
+	n.getDensities(pos, rho, 3);
+	for (int i = 0; i < 3; i++)
+		EXPECT_DOUBLE_EQ(n.getDensity(pos[i]), rho[i]);
+	n.getDensities(pos, rho, 3, NucleonDensity);
+	for (int i = 0; i < 3; i++)
+		EXPECT_DOUBLE_EQ(n.getNucleonDensity(pos[i]), rho[i]);
+}
+
 TEST(testDensityList, SimpleTest) {
 
 	DensityList MS;
@@ -293,4 +306,42 @@ TEST(testGridDensity, testRetrunValue) {
 }
 
 
+TEST(testGridDensity, sampledDensity) {
+	ref_ptr<Nakanishi> model = new Nakanishi();
+	GridProperties properties(Vector3d(-10, -10, -1) * kpc, 20, 20, 8, Vector3d(1, 1, 0.25) * kpc);
+
+	DensityGrid dens(model, properties);
+	EXPECT_TRUE(dens.getIsForHI());
+	EXPECT_FALSE(dens.getIsForHII());
+	EXPECT_TRUE(dens.getIsForH2());
+	EXPECT_TRUE(dens.getGridHII() == NULL);
+
+	// grid points are the sampled values
+	Vector3d p = dens.getGridHI()->positionFromIndex(3 * 20 * 8 + 17 * 8 + 4);
+	EXPECT_NEAR(model->getHIDensity(p), dens.getHIDensity(p), 1e-6 * model->getHIDensity(p));
+	EXPECT_NEAR(model->getH2Density(p), dens.getH2Density(p), 1e-6 * model->getH2Density(p));
+	EXPECT_DOUBLE_EQ(0, dens.getHIIDensity(p));
+
+	// in between the interpolation is close to the model
+	p = Vector3d(-3.3, 2.6, 0.1) * kpc;
+	EXPECT_NEAR(model->getHIDensity(p), dens.getHIDensity(p), 0.05 * model->getHIDensity(p));
+
+	// the cache file reproduces the sampled grids
+	std::string filename = "testDensityGrid.bin";
+	DensityGrid written(model, properties, filename);
+	testing::internal::CaptureStderr();
+	DensityGrid read(model, properties, filename);
+	EXPECT_EQ(testing::internal::GetCapturedStderr().find("WARNING"), std::string::npos);
+	EXPECT_EQ(written.getGridH2()->getGrid(), read.getGridH2()->getGrid());
+	EXPECT_EQ(dens.getGridHI()->getGrid(), read.getGridHI()->getGrid());
+
+	// and is resampled for other grid properties
+	GridProperties coarse(Vector3d(-10, -10, -1) * kpc, 10, 10, 4, Vector3d(2, 2, 0.5) * kpc);
+	testing::internal::CaptureStderr();
+	DensityGrid resampled(model, coarse, filename);
+	EXPECT_NE(testing::internal::GetCapturedStderr().find("does not match"), std::string::npos);
+	EXPECT_EQ(DensityGrid(model, coarse).getGridHI()->getGrid(), resampled.getGridHI()->getGrid());
+	remove(filename.c_str());
+}
+
 } //namespace crpropa
@@ -2,6 +2,7 @@
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
 #include "crpropa/PhotonBackground.h"
+#include "crpropa/module/ContinuousLosses.h"
 #include "crpropa/module/ElectronPairProduction.h"
 #include "crpropa/module/NuclearDecay.h"
 #include "crpropa/module/PhotoDisintegration.h"
@@ -13,9 +14,27 @@
 #include "crpropa/module/EMTripletPairProduction.h"
 #include "crpropa/module/EMInverseComptonScattering.h"
 #include "crpropa/module/SynchrotronRadiation.h"
+#include "crpropa/module/InteractionScheduler.h"
+#include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/EMCascadeResponse.h"
+#include "crpropa/Random.h"
+#include "crpropa/RateBuilder.h"
+#include "crpropa/PhotonPropagation.h"
+#include "crpropa/Common.h"
 #include "gtest/gtest.h"
+#include "sophia.h"
+#include "EleCa/Common.h"
 
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <ftw.h>
+#include <numeric>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace crpropa {
 
@@ -85,6 +104,30 @@ TEST(ElectronPairProduction, thisIsNotNucleonic) {
 	EXPECT_DOUBLE_EQ(1E20 * eV, c.current.getEnergy());
 }
 
+TEST(ElectronPairProduction, processBatch) {
+	// Test if the batch gives the energy losses and step limits of process.
+	ref_ptr<PhotonField> CMB_instance = new CMB();
+	ElectronPairProduction epp(CMB_instance);
+	std::vector<ref_ptr<Candidate> > batch;
+	std::vector<ref_ptr<Candidate> > single;
+	int ids[] = {nucleusId(1, 1), nucleusId(56, 26), nucleusId(1, 0), 11};
+	for (size_t i = 0; i < 8; i++) {
+		for (size_t k = 0; k < 2; k++) {
+			ref_ptr<Candidate> c = new Candidate(ids[i % 4], pow(10, 16 + i) * eV);
+			c->setRedshift(0.1 * i);
+			c->setCurrentStep(1 * Mpc);
+			((k == 0) ? batch : single).push_back(c);
+		}
+	}
+
+	epp.processBatch(batch);
+	for (size_t i = 0; i < single.size(); i++) {
+		epp.process(single[i]);
+		EXPECT_DOUBLE_EQ(single[i]->current.getEnergy(), batch[i]->current.getEnergy());
+		EXPECT_DOUBLE_EQ(single[i]->getNextStep(), batch[i]->getNextStep());
+	}
+}
+
 TEST(ElectronPairProduction, valuesCMB) {
 	// Test if energy loss corresponds to the data table.
 	std::vector<double> x;
@@ -231,6 +274,22 @@ TEST(NuclearDecay, helium5) {
 	EXPECT_EQ(1, c2.current.getEnergy() / EeV);
 }
 
+TEST(NuclearDecay, chain) {
+	// Li-8 --> Be-8 + e- + neutrino, Be-8 --> He-4 + He-4
+	// the whole chain decays within 1 pc at this energy and is resolved at once
+	NuclearDecay d(true, false, true);
+	for (int i = 0; i < 2; i++) {
+		d.setChainFraction(i == 0 ? 0.01 : 0);
+		Candidate c(nucleusId(8, 3), 1 * EeV);
+		c.setCurrentStep(1 * Mpc);
+		c.setNextStep(std::numeric_limits<double>::max());
+		d.process(&c);
+		EXPECT_EQ(nucleusId(4, 2), c.current.getId());
+		EXPECT_EQ(3, c.secondaries.size());
+		EXPECT_EQ(std::numeric_limits<double>::max(), c.getNextStep());
+	}
+}
+
 TEST(NuclearDecay, limitNextStep) {
 	// Test if next step is limited in case of a neutron.
 	NuclearDecay decay;
@@ -447,6 +506,23 @@ TEST(PhotoDisintegration, limitNextStep) {
 	EXPECT_LT(c.getNextStep(), std::numeric_limits<double>::max());
 }
 
+TEST(PhotoDisintegration, sizeOf) {
+	// the memory grows with the unpacked nuclei and can be read meanwhile
+	ref_ptr<PhotonField> CMB_instance = new CMB();
+	PhotoDisintegration pd(CMB_instance);
+	size_t size = pd.getSizeOf();
+#pragma omp parallel for
+	for (int A = 4; A <= 56; A++) {
+		Candidate c;
+		c.current.setId(nucleusId(A, A / 2));
+		c.current.setEnergy(100 * EeV);
+		c.setCurrentStep(1 * kpc);
+		pd.process(&c);
+		EXPECT_GE(pd.getSizeOf(), size);
+	}
+	EXPECT_GT(pd.getSizeOf(), size);
+}
+
 TEST(PhotoDisintegration, allIsotopes) {
 	// Test if all isotopes are handled.
 	ref_ptr<PhotonField> CMB_instance = new CMB();
@@ -650,6 +726,26 @@ TEST(PhotoPionProduction, sampling) {
 	EXPECT_DOUBLE_EQ(pEpsMax,132673934934.922);
 }
 
+TEST(PhotoPionProduction, sampleTables) {
+	// The tabulated photon sampling should reproduce the rejection sampling
+	PhotoPionProduction ppp(new CMB());
+	EXPECT_TRUE(ppp.getSampleTables());
+	double E = 1e20 * eV;
+	int n = 1000;
+	double mean[2] = {0, 0}, rms[2] = {0, 0};
+	for (int tables = 0; tables < 2; tables++) {
+		ppp.setSampleTables(tables == 1);
+		for (int i = 0; i < n; i++) {
+			double x = log10(ppp.sampleEps(true, E, 0) / eV);
+			mean[tables] += x / n;
+			rms[tables] += x * x / n;
+		}
+		rms[tables] = sqrt(rms[tables] - mean[tables] * mean[tables]);
+	}
+	EXPECT_NEAR(mean[0], mean[1], 0.02);
+	EXPECT_NEAR(rms[0], rms[1], 0.01);
+}
+
 TEST(PhotoPionProduction, interactionTag) {
 	PhotoPionProduction ppp(new CMB());
 
@@ -668,6 +764,82 @@ TEST(PhotoPionProduction, interactionTag) {
 	EXPECT_TRUE(ppp.getInteractionTag() == "myTag");
 }
 
+TEST(PhotoPionProduction, crossectionSOPHIA) {
+	// total cross section compared to SOPHIA, whose resonance parameters are
+	// set by a proton event
+	double outputEnergy[5][2000];
+	int outPartID[2000];
+	int nParticles;
+	int nature = 0;
+	double Ein = 1e11, eps = 1e-11; // GeV
+	sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+
+	int ndir = 3; // total cross section
+	int proton = 13, neutron = 14;
+	for (int i = 0; i <= 60; i++) {
+		eps = pow(10, -1 + i * 0.05); // 0.1 - 100 GeV
+		double cs = crossection_(eps, ndir, proton);
+		EXPECT_NEAR(cs, PhotoPionProduction::crossection(eps, true), 1e-3 * cs);
+	}
+
+	// only multi-pion production and fragmentation above 10 GeV
+	for (int i = 0; i <= 20; i++) {
+		eps = pow(10, 1.05 + i * 0.1); // 11 GeV - 1 TeV
+		double cs = crossection_(eps, ndir, neutron);
+		EXPECT_NEAR(cs, PhotoPionProduction::crossection(eps, false), 1e-3 * cs);
+	}
+}
+
+TEST(SophiaEventLibrary, generate) {
+	// one bin of proton and neutron events, compared to direct SOPHIA calls
+	std::string filename = "testSophiaEventLibrary.bin";
+	double Emin = 1e20 * eV, Emax = 1.1e20 * eV;
+	double epsMin = 2e-3 * eV, epsMax = 2.2e-3 * eV;
+	SophiaEventLibrary::generate(filename, 1000, 1, Emin, Emax, 1, epsMin, epsMax);
+	SophiaEventLibrary library(filename);
+	std::remove(filename.c_str());
+
+	EXPECT_EQ(2000, library.getNumberOfEvents());
+	EXPECT_EQ(1000, library.getNumberOfEvents(false, 1.05e20 * eV, 2.1e-3 * eV));
+	EXPECT_TRUE(library.contains(true, 1.05e20 * eV, 2.1e-3 * eV));
+	EXPECT_FALSE(library.contains(true, 2e20 * eV, 2.1e-3 * eV));
+	EXPECT_FALSE(library.contains(true, 1.05e20 * eV, 1e-3 * eV));
+
+	Random &random = Random::instance();
+	std::vector<double> energies;
+	std::vector<int> ids;
+	double multiplicityLibrary = 0, multiplicitySophia = 0;
+	double nucleonLibrary = 0, nucleonSophia = 0;
+	int n = 1000;
+	for (int i = 0; i < n; i++) {
+		double E = 1.05e20 * eV;
+		size_t m = library.sample(true, E, 2.1e-3 * eV, energies, ids);
+		EXPECT_EQ(m, ids.size());
+		double sum = 0;
+		for (size_t j = 0; j < m; j++) {
+			sum += energies[j];
+			if ((ids[j] == 13) or (ids[j] == 14))
+				nucleonLibrary += energies[j] / E;
+		}
+		EXPECT_NEAR(1, sum / E, 1e-3); // energy conservation
+		multiplicityLibrary += m;
+
+		double outputEnergy[5][2000];
+		int outPartID[2000];
+		int nParticles;
+		int nature = 0;
+		double Ein = pow(10, log10(Emin / GeV) + random.rand() * log10(Emax / Emin));
+		double eps = pow(10, log10(epsMin / GeV) + random.rand() * log10(epsMax / epsMin));
+		sophiaevent_(nature, Ein, eps, outputEnergy, outPartID, nParticles);
+		for (int j = 0; j < nParticles; j++)
+			if ((outPartID[j] == 13) or (outPartID[j] == 14))
+				nucleonSophia += outputEnergy[3][j] / Ein;
+		multiplicitySophia += nParticles;
+	}
+	EXPECT_NEAR(multiplicitySophia / n, multiplicityLibrary / n, 0.1 * multiplicitySophia / n);
+	EXPECT_NEAR(nucleonSophia / n, nucleonLibrary / n, 0.05);
+}
+
 // Redshift -------------------------------------------------------------------
 TEST(Redshift, simpleTest) {
 	// Test if redshift is decreased and adiabatic energy loss is applied.
@@ -695,6 +867,29 @@ TEST(Redshift, limitRedshiftDecrease) {
 	EXPECT_DOUBLE_EQ(0, c.getRedshift());
 }
 
+TEST(Redshift, processBatch) {
+	// Test if the batch gives the redshifts and energies of process.
+	Redshift redshift;
+	std::vector<ref_ptr<Candidate> > batch;
+	std::vector<ref_ptr<Candidate> > single;
+	double redshifts[] = {0, 0.001, 0.024, 0.5, 3, 12};
+	for (size_t i = 0; i < 6; i++) {
+		for (size_t k = 0; k < 2; k++) {
+			ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 100 * EeV);
+			c->setRedshift(redshifts[i]);
+			c->setCurrentStep(50 * Mpc);
+			((k == 0) ? batch : single).push_back(c);
+		}
+	}
+
+	redshift.processBatch(batch);
+	for (size_t i = 0; i < single.size(); i++) {
+		redshift.process(single[i]);
+		EXPECT_EQ(single[i]->getRedshift(), batch[i]->getRedshift());
+		EXPECT_EQ(single[i]->current.getEnergy(), batch[i]->current.getEnergy());
+	}
+}
+
 // EMPairProduction -----------------------------------------------------------
 TEST(EMPairProduction, allBackgrounds) {
 	// Test if interaction data files are loaded.
@@ -1094,6 +1289,25 @@ TEST(EMInverseComptonScattering, secondaries) {
 	}
 }
 
+TEST(EMInverseComptonScattering, blackbodyTemperature) {
+	// a blackbody field without tables of its own uses those of the CMB
+	double scale;
+	BlackbodyPhotonField hotField("BlackbodyTest", 2 * BlackbodyPhotonField::cmbTemperature);
+	EXPECT_EQ("CMB", interactionTableField(hotField, "EMInverseComptonScattering/rate_", scale));
+	EXPECT_DOUBLE_EQ(2, scale);
+	EXPECT_EQ("CMB", interactionTableField(CMB(), "EMInverseComptonScattering/rate_", scale));
+	EXPECT_DOUBLE_EQ(1, scale);
+	EXPECT_EQ("IRB", interactionTableField(IRB_Gilmore12(), "ElasticScattering/rate_", scale, 3));
+	EXPECT_DOUBLE_EQ(1, scale);
+
+	// Thomson limit: the rate scales with the photon density, i.e. T^3
+	EMInverseComptonScattering cmb(new CMB());
+	EMInverseComptonScattering hot(new BlackbodyPhotonField("BlackbodyTest", 2 * BlackbodyPhotonField::cmbTemperature));
+	Candidate c(11, 1 * GeV);
+	double rate = cmb.getInteractionRate(&c);
+	EXPECT_NEAR(8 * rate, hot.getInteractionRate(&c), 0.01 * 8 * rate);
+}
+
 TEST(EMInverseComptonScattering, interactionTag) {
 	EMInverseComptonScattering m(new CMB());
 
@@ -1131,6 +1345,413 @@ TEST(SynchrtronRadiation, interactionTag) {
 	EXPECT_TRUE(s.getInteractionTag() == "myTag");
 }
 
+TEST(SynchrotronRadiation, aggregated) {
+	// a fixed number of weighted photons carries the total energy loss
+	SynchrotronRadiation s(1 * muG, true);
+	s.setSecondaryThreshold(0);
+	s.setAggregatedSamples(20);
+	EXPECT_EQ(20, s.getAggregatedSamples());
+
+	Candidate c(11, 100 * PeV);
+	c.setCurrentStep(1 * pc);
+	s.process(&c);
+	EXPECT_EQ(20, c.secondaries.size());
+
+	double Etot = 0;
+	for (size_t i = 0; i < c.secondaries.size(); i++)
+		Etot += c.secondaries[i]->getWeight() * c.secondaries[i]->current.getEnergy();
+	EXPECT_NEAR(100 * PeV - c.current.getEnergy(), Etot, 1e-9 * Etot);
+}
+
+// InteractionScheduler -------------------------------------------------------
+// interaction with a constant rate, counting its interactions
+class ConstantRateInteraction: public Module, public StochasticInteraction {
+public:
+	double rate;
+	mutable int count;
+	ConstantRateInteraction(double rate) : rate(rate), count(0) {
+	}
+	void process(Candidate *candidate) const {
+	}
+	double getInteractionRate(Candidate *candidate) const {
+		return rate;
+	}
+	void interact(Candidate *candidate) const {
+		count++;
+	}
+};
+
+TEST(InteractionScheduler, add) {
+	InteractionScheduler scheduler;
+	EXPECT_THROW(scheduler.add(new SimplePropagation()), std::runtime_error);
+	scheduler.add(new ConstantRateInteraction(1 / Mpc));
+	EXPECT_EQ(1, scheduler.size());
+}
+
+TEST(InteractionScheduler, process) {
+	ref_ptr<ConstantRateInteraction> a = new ConstantRateInteraction(1 / Mpc);
+	ref_ptr<ConstantRateInteraction> b = new ConstantRateInteraction(3 / Mpc);
+	InteractionScheduler scheduler;
+	scheduler.add(a);
+	scheduler.add(b);
+
+	Candidate c;
+	EXPECT_DOUBLE_EQ(4 / Mpc, scheduler.getTotalRate(&c));
+
+	// propagate 1000 Mpc in steps up to the next interaction
+	SimplePropagation propagation(1 * kpc, 10 * Mpc);
+	int steps = 0;
+	while (c.getTrajectoryLength() < 1000 * Mpc) {
+		propagation.process(&c);
+		scheduler.process(&c);
+		steps++;
+	}
+
+	// 4000 interactions expected, split 1:3
+	int n = a->count + b->count;
+	EXPECT_NEAR(4000, n, 300);
+	EXPECT_NEAR(0.25, a->count / double(n), 0.03);
+	// about one step per interaction
+	EXPECT_LT(steps, 1.2 * n);
+	EXPECT_TRUE(c.hasProperty("InteractionSchedulerDepth"));
+}
+
+// interaction with a rate proportional to the energy, counting its evaluations
+class EnergyRateInteraction: public Module, public StochasticInteraction {
+public:
+	mutable int evaluations;
+	EnergyRateInteraction() : evaluations(0) {
+	}
+	void process(Candidate *candidate) const {
+	}
+	double getInteractionRate(Candidate *candidate) const {
+		evaluations++;
+		return candidate->current.getEnergy() / EeV / Mpc;
+	}
+	void interact(Candidate *candidate) const {
+	}
+};
+
+TEST(StochasticInteraction, rateTolerance) {
+	ref_ptr<EnergyRateInteraction> m = new EnergyRateInteraction();
+	Candidate c(22, 100 * EeV);
+
+	// without tolerances the rate is computed in each call
+	m->getCachedInteractionRate(&c);
+	m->getCachedInteractionRate(&c);
+	EXPECT_EQ(2, m->evaluations);
+
+	m->setRateTolerance(0.01, 0.001);
+	EXPECT_DOUBLE_EQ(100 / Mpc, m->getCachedInteractionRate(&c));
+	EXPECT_EQ(3, m->evaluations);
+
+	// within 10^0.01 in energy and 0.001 in redshift: cached rate
+	c.current.setEnergy(102 * EeV);
+	c.setRedshift(0.0005);
+	EXPECT_DOUBLE_EQ(100 / Mpc, m->getCachedInteractionRate(&c));
+	EXPECT_EQ(3, m->evaluations);
+
+	// energy, redshift or id out of the tolerances: new rate
+	c.current.setEnergy(110 * EeV);
+	EXPECT_DOUBLE_EQ(110 / Mpc, m->getCachedInteractionRate(&c));
+	c.setRedshift(0.01);
+	m->getCachedInteractionRate(&c);
+	c.current.setId(11);
+	m->getCachedInteractionRate(&c);
+	EXPECT_EQ(6, m->evaluations);
+
+	// the rates of other modules are kept separately
+	EnergyRateInteraction other;
+	other.setRateTolerance(0.01, 0.001);
+	other.getCachedInteractionRate(&c);
+	m->getCachedInteractionRate(&c);
+	EXPECT_EQ(1, other.evaluations);
+	EXPECT_EQ(6, m->evaluations);
+
+	EXPECT_THROW(m->setRateTolerance(-1, 0), std::runtime_error);
+}
+
+// ConstantRateInteraction with the batch interaction loop
+class BatchConstantRateInteraction: public ConstantRateInteraction {
+public:
+	BatchConstantRateInteraction(double rate) : ConstantRateInteraction(rate) {
+	}
+	void processBatch(const std::vector<ref_ptr<Candidate> > &candidates) const {
+		processInteractionBatch(candidates, 0.1);
+	}
+};
+
+TEST(StochasticInteraction, processInteractionBatch) {
+	BatchConstantRateInteraction m(1 / Mpc);
+	std::vector<ref_ptr<Candidate> > candidates;
+	for (size_t i = 0; i < 2000; i++) {
+		ref_ptr<Candidate> c = new Candidate();
+		c->setCurrentStep(1 * Mpc);
+		c->setNextStep(10 * Mpc);
+		candidates.push_back(c);
+	}
+	m.processBatch(candidates);
+
+	// one interaction per mean free path, next steps limited to 0.1 of it
+	EXPECT_NEAR(2000, m.count, 200);
+	for (size_t i = 0; i < candidates.size(); i++)
+		EXPECT_DOUBLE_EQ(0.1 * Mpc, candidates[i]->getNextStep());
+
+	// no interactions without rate
+	BatchConstantRateInteraction none(0);
+	none.processBatch(candidates);
+	EXPECT_EQ(0, none.count);
+}
+
+TEST(ContinuousLosses, adiabatic) {
+	// E / (1 + z) is conserved by the adiabatic losses, also for large steps
+	ContinuousLosses losses;
+	Candidate c(11, 1 * EeV);
+	c.setRedshift(1);
+	for (int i = 0; i < 20; i++) {
+		c.setCurrentStep(200 * Mpc);
+		losses.process(&c);
+	}
+	EXPECT_LT(c.getRedshift(), 1);
+	EXPECT_NEAR(0.5 * EeV, c.current.getEnergy() / (1 + c.getRedshift()), 1e-6 * EeV);
+
+	// no losses without redshift
+	losses.setRedshift(false);
+	double E = c.current.getEnergy();
+	losses.process(&c);
+	EXPECT_DOUBLE_EQ(E, c.current.getEnergy());
+}
+
+TEST(ContinuousLosses, synchrotron) {
+	// ultra-relativistic electrons: 1 / Gamma(x) = 1 / Gamma0 + k x
+	ContinuousLosses losses(0.3, false);
+	losses.setBrms(1 * muG);
+	double B = sqrt(2. / 3) * muG, mc2 = mass_electron * c_squared;
+	double k = pow(eplus, 4) * B * B * c_squared / (6 * M_PI * epsilon0 * pow(mc2, 3));
+
+	Candidate c(11, 1 * PeV);
+	double lf0 = c.current.getLorentzFactor();
+	EXPECT_NEAR(k * lf0, losses.getLossRate(&c), 1e-6 * k * lf0);
+
+	// propagate with the limited steps until the energy dropped by about 100
+	double x = 0;
+	int steps = 0;
+	double distance = 99 / lf0 / k;
+	c.setNextStep(std::numeric_limits<double>::max());
+	while (x < distance) {
+		double step = std::min(c.getNextStep(), distance - x);
+		c.setCurrentStep(step);
+		c.setNextStep(std::numeric_limits<double>::max());
+		losses.process(&c);
+		x += step;
+		steps++;
+	}
+	double lf = 1 / (1 / lf0 + k * x);
+	EXPECT_NEAR(lf, c.current.getLorentzFactor(), 1e-3 * lf);
+	EXPECT_LT(steps, 100);
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+	return remove(path);
+}
+
+TEST(RateBuilder, blackbody) {
+	// tables of a CMB-like field under its own name, built into a temporary cache
+	char cacheTemplate[] = "/tmp/RateBuilderTestCache.XXXXXX";
+	ASSERT_TRUE(mkdtemp(cacheTemplate) != 0);
+	std::string cache = cacheTemplate;
+	ref_ptr<PhotonField> field = new BlackbodyPhotonField("RateBuilderTest", 2.725);
+	RateBuilder builder(field, cache);
+	EXPECT_EQ(16, builder.getHash().size());
+	EXPECT_NE(builder.getHash(), RateBuilder(new BlackbodyPhotonField("RateBuilderTest", 3.), cache).getHash());
+	builder.buildAll();
+	EXPECT_EQ(builder.getDirectory() + "/EMPairProduction/rate_RateBuilderTest.txt",
+			getDataPath("EMPairProduction/rate_RateBuilderTest.txt"));
+
+	// the modules load the tables via getDataPath
+	double n = 410.7 / ccm; // photon density of the CMB
+	double sigmaThomson = 6.6524587e-29 * meter * meter;
+	Candidate c;
+	c.current.setId(11);
+	c.current.setEnergy(1 * GeV);
+	EMInverseComptonScattering ics(field);
+	EXPECT_NEAR(sigmaThomson * n, ics.getInteractionRate(&c), 0.02 * sigmaThomson * n); // Thomson limit
+
+	c.current.setId(22);
+	c.current.setEnergy(1e21 * eV);
+	EMDoublePairProduction dpp(field);
+	EXPECT_NEAR(6.45e-34 * n, dpp.getInteractionRate(&c), 0.02 * 6.45e-34 * n); // constant cross section
+	EMPairProduction pp(field);
+	c.current.setEnergy(2 * PeV);
+	EXPECT_NEAR(1 / (7 * kpc), pp.getInteractionRate(&c), 0.2 / (7 * kpc)); // shortest mean free path
+
+	// mean free path of protons at 10^21 eV of a few Mpc
+	PhotoPionProduction ppp(field);
+	double mfp = ppp.nucleonMFP(1e21 * eV / (mass_proton * c_squared), 0, true);
+	EXPECT_GT(mfp, 3 * Mpc);
+	EXPECT_LT(mfp, 5 * Mpc);
+
+	// the cached tables are reused
+	RateBuilder other(field, cache);
+	EXPECT_EQ(builder.getHash(), other.getHash());
+	other.buildAll();
+
+	nftw(cache.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// halves photons above 2 EeV into two photons, turns electrons into photons
+class HalvingCascade: public Module {
+public:
+	void process(Candidate *c) const {
+		int id = c->current.getId();
+		double E = c->current.getEnergy();
+		if (id == 11) {
+			c->addSecondary(22, E);
+			c->setActive(false);
+		} else if (id == 22 and E > 2 * EeV) {
+			c->addSecondary(22, E / 2);
+			c->addSecondary(22, E / 2);
+			c->setActive(false);
+		}
+	}
+};
+
+TEST(EMCascadeResponse, buildAndFold) {
+	ref_ptr<ModuleList> cascade = new ModuleList();
+	cascade->add(new SimplePropagation(1 * kpc, 1 * Mpc));
+	cascade->add(new HalvingCascade());
+	EMCascadeResponse response(10 * Mpc, 2, 17, 20, 0.1);
+	EXPECT_EQ(30, response.getNumberOfEnergyBins());
+	response.build(cascade, 2);
+	EXPECT_EQ(2, cascade->size());
+
+	// 10^19.05 eV photon: 8 photons of 10^18.15 eV
+	double E = response.getEnergy(20);
+	std::vector<double> r = response.getResponse(22, E, 7 * Mpc);
+	EXPECT_DOUBLE_EQ(8, r[11]);
+	EXPECT_DOUBLE_EQ(8, std::accumulate(r.begin(), r.end(), 0.));
+	// 10^17.55 eV electron: one photon
+	r = response.getResponse(-11, response.getEnergy(5), 2 * Mpc);
+	EXPECT_DOUBLE_EQ(1, r[5]);
+	EXPECT_DOUBLE_EQ(0, response.getResponse(22, E, 11 * Mpc)[11]);
+
+	// folding
+	Candidate photon(22, E, Vector3d(7 * Mpc, 0, 0));
+	photon.setWeight(2);
+	response.process(&photon);
+	EXPECT_FALSE(photon.isActive());
+	Candidate electron(11, response.getEnergy(5), Vector3d(0, 3 * Mpc, 0));
+	response.process(&electron);
+	Candidate neutrino(12, E, Vector3d(1 * Mpc, 0, 0));
+	response.process(&neutrino);
+	EXPECT_TRUE(neutrino.isActive());
+	std::vector<double> spectrum = response.getSpectrum();
+	EXPECT_DOUBLE_EQ(16, spectrum[11]);
+	EXPECT_DOUBLE_EQ(1, spectrum[5]);
+	response.clearSpectrum();
+	EXPECT_DOUBLE_EQ(0, response.getSpectrum()[11]);
+
+	// save and load
+	response.save("testEMCascadeResponse.txt");
+	EMCascadeResponse loaded(10 * Mpc, 2, 17, 20, 0.1);
+	loaded.load("testEMCascadeResponse.txt");
+	EXPECT_DOUBLE_EQ(8, loaded.getResponse(22, E, 7 * Mpc)[11]);
+	EMCascadeResponse other(10 * Mpc, 4, 17, 20, 0.1);
+	EXPECT_THROW(other.load("testEMCascadeResponse.txt"), std::runtime_error);
+	remove("testEMCascadeResponse.txt");
+}
+
+// EleCa ----------------------------------------------------------------------
+static double uniformOne(double min, double max) {
+	return 1;
+}
+
+TEST(EleCa, uniformCallback) {
+	eleca::UniformCallback previous = eleca::setUniformCallback(uniformOne);
+	EXPECT_DOUBLE_EQ(1, eleca::Uniform(0, 2));
+	EXPECT_TRUE(eleca::setUniformCallback(previous) == uniformOne);
+	eleca::setSeed(42);
+	double u = eleca::Uniform(0, 1);
+	EXPECT_LT(u, 1);
+	eleca::setSeed(42);
+	EXPECT_DOUBLE_EQ(u, eleca::Uniform(0, 1));
+}
+
+TEST(EleCa, threadStreams) {
+	// the stream of a thread follows its OpenMP thread number, not the order
+	// in which the threads first draw
+	eleca::setSeed(7);
+	std::vector<double> serial(1, eleca::Uniform(0, 1));
+#ifdef _OPENMP
+	const int n = 4;
+	for (int reverse = 0; reverse < 2; reverse++) {
+		eleca::setSeed(7); // restarts the streams of all threads
+		std::vector<double> u(n);
+		volatile int turn = 0;
+#pragma omp parallel num_threads(n)
+		{
+			int t = omp_get_thread_num();
+			int mine = reverse ? omp_get_num_threads() - 1 - t : t;
+			while (true) {
+				int current;
+#pragma omp atomic read
+				current = turn;
+				if (current == mine)
+					break;
+			}
+			u[t] = eleca::Uniform(0, 1);
+#pragma omp atomic
+			turn++;
+		}
+		EXPECT_DOUBLE_EQ(serial[0], u[0]);
+		if (reverse == 0)
+			serial = u;
+		else
+			for (int t = 1; t < n; t++)
+				EXPECT_DOUBLE_EQ(serial[t], u[t]);
+	}
+	EXPECT_NE(serial[0], serial[1]);
+#endif
+}
+
+// DintPropagation ------------------------------------------------------------
+static std::string readFile(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	std::stringstream content;
+	content << in.rdbuf();
+	return content.str();
+}
+
+TEST(DintPropagation, threads) {
+	// dint exits the process if its tables are missing
+	std::string table = getDataPath("dint/ICSLoss.dat");
+	if (not std::ifstream(table.c_str()).good())
+		FAIL() << "DintPropagation: could not open file " << table;
+
+	std::vector<CascadeParticle> particles;
+	for (int i = 0; i < 500; i++)
+		particles.push_back(CascadeParticle(22 - 11 * (i % 3 == 1),
+				pow(10, 17 + 0.005 * i) * eV, (0.3 + 0.37 * i) * Mpc));
+#ifdef _OPENMP
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+#endif
+	DintPropagation(particles, "testDint_serial.txt");
+#ifdef _OPENMP
+	omp_set_num_threads(4);
+#endif
+	DintPropagation(particles, "testDint_parallel.txt");
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	// the groups, and so the spectrum, do not depend on the number of threads
+	std::string serial = readFile("testDint_serial.txt");
+	EXPECT_FALSE(serial.empty());
+	EXPECT_EQ(serial, readFile("testDint_parallel.txt"));
+	remove("testDint_serial.txt");
+	remove("testDint_parallel.txt");
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
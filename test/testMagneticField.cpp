@@ -2,8 +2,12 @@
 
 #include "crpropa/magneticField/MagneticFieldGrid.h"
 #include "crpropa/magneticField/CMZField.h"
+#include "crpropa/magneticField/JF12Field.h"
+#include "crpropa/magneticField/OctreeMagneticField.h"
 #include "crpropa/magneticField/PolarizedSingleModeMagneticField.h"
+#include "crpropa/magneticField/TabulatedMagneticField.h"
 #include "crpropa/Grid.h"
+#include "crpropa/GridTools.h"
 #include "crpropa/Units.h"
 #include "crpropa/Common.h"
 
@@ -33,6 +37,27 @@ TEST(testMagneticDipoleField, SimpleTest) {
 	EXPECT_NEAR(b2.getZ(), -1 * mu0 / (4*M_PI), 1E-8);
 }
 
+TEST(testMagneticField, getFields) {
+	// the default implementation evaluates getField for each position
+	MagneticDipoleField B(Vector3d(0,0,0), Vector3d(0,0,1), 1);
+	Vector3d pos[3] = {Vector3d(0, 0, 1), Vector3d(1, 0, 0), Vector3d(1, 2, 3)};
+	Vector3d b[3];
+	B.getFields(pos, b, 3);
+	for (int i = 0; i < 3; i++)
+		EXPECT_EQ(B.getField(pos[i]), b[i]);
+}
+
+TEST(testMagneticField, getFieldsParallel) {
+	// blocks of getFields, also for a partial last block
+	MagneticDipoleField B(Vector3d(0,0,0), Vector3d(0,0,1), 1);
+	std::vector<Vector3d> pos(2500), b(2500);
+	for (size_t i = 0; i < pos.size(); i++)
+		pos[i] = Vector3d(1 + i, 2, -3);
+	B.getFieldsParallel(pos.data(), b.data(), pos.size());
+	for (size_t i = 0; i < pos.size(); i++)
+		EXPECT_EQ(B.getField(pos[i]), b[i]);
+}
+
 #ifdef CRPROPA_HAVE_MUPARSER
 TEST(testRenormalizeMagneticField, simpleTest) {
 	ref_ptr<UniformMagneticField> field = new UniformMagneticField(Vector3d(2*nG, 0, 0));
@@ -102,6 +127,265 @@ TEST(testPeriodicMagneticField, Exceptions) {
 
 }
 
+TEST(testMagneticFieldGrid, getFields) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1 - iz);
+	MagneticFieldGrid B(grid);
+	Vector3d pos[3] = {Vector3d(0.3, 1.2, 2.5), Vector3d(3.9, 0.1, 0), Vector3d(-1, 7, 2)};
+	Vector3d b[3];
+	B.getFields(pos, b, 3);
+	for (int i = 0; i < 3; i++)
+		EXPECT_EQ(B.getField(pos[i]), b[i]);
+}
+
+TEST(testMagneticFieldGrid, mappedGrid) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1 - iz) * nG;
+	dumpMappedGrid(grid, "testMappedField.raw", nG, "nG");
+	MagneticFieldGrid B(grid);
+	MagneticFieldGrid mapped("testMappedField.raw");
+	EXPECT_DOUBLE_EQ(nG, mapped.getScale());
+	Vector3d pos(0.3, 1.2, 2.5);
+	Vector3d b = B.getField(pos), m = mapped.getField(pos);
+	EXPECT_NEAR(b.x, m.x, 1e-6 * nG);
+	EXPECT_NEAR(b.y, m.y, 1e-6 * nG);
+	EXPECT_NEAR(b.z, m.z, 1e-6 * nG);
+	remove("testMappedField.raw");
+}
+
+TEST(testMagneticFieldGrid, stepHint) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 2);
+	ref_ptr<MagneticFieldGrid> B = new MagneticFieldGrid(grid);
+
+	// inside: the grid spacing, no bound on the field
+	MagneticFieldStepHint hint = B->getStepHint(Vector3d(1, 1, 1));
+	EXPECT_DOUBLE_EQ(2, hint.variationLength);
+	EXPECT_FALSE(hint.isFieldFree());
+
+	// outside of a periodic grid there still is a field
+	EXPECT_FALSE(B->getStepHint(Vector3d(20, 1, 1)).isFieldFree());
+
+	// outside of a clipped grid there is none up to the grid volume
+	grid->setClipVolume(true);
+	hint = B->getStepHint(Vector3d(20, 1, 1));
+	EXPECT_TRUE(hint.isFieldFree());
+	EXPECT_DOUBLE_EQ(12, hint.radius);
+	EXPECT_FALSE(B->getStepHint(Vector3d(1, 1, 1)).isFieldFree());
+
+	// lists bound the sum of their fields
+	MagneticFieldList list;
+	list.addField(B);
+	list.addField(new UniformMagneticField(Vector3d(0, 3, 4)));
+	hint = list.getStepHint(Vector3d(20, 1, 1));
+	EXPECT_FALSE(hint.isFieldFree());
+	EXPECT_DOUBLE_EQ(2, hint.variationLength);
+	EXPECT_DOUBLE_EQ(12, hint.radius);
+	EXPECT_DOUBLE_EQ(5, hint.maxField);
+	// a tenth of the gyroradius E / (c |q| B)
+	EXPECT_DOUBLE_EQ(2, hint.getInitialStep(1e12));
+	EXPECT_DOUBLE_EQ(0.1 * 1e6 / (c_light * 5), hint.getInitialStep(1e6));
+}
+
+TEST(testCompressedMagneticFieldGrid, getField) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1 - iz);
+	MagneticFieldGrid B(grid, nG);
+	CompressedMagneticFieldGrid C(compressGrid(grid, QUANTIZED_INT16), nG);
+	Vector3d pos[3] = {Vector3d(0.3, 1.2, 2.5), Vector3d(3.9, 0.1, 0), Vector3d(-1, 7, 2)};
+	Vector3d b[3];
+	C.getFields(pos, b, 3);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(C.getField(pos[i]), b[i]);
+		EXPECT_NEAR(0, (B.getField(pos[i]) - b[i]).getR(), 1e-3 * nG);
+	}
+}
+
+TEST(testTiledMagneticFieldGrid, getField) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1 - iz);
+	dumpTiledGrid(grid, "testTiledField.raw", 2);
+	MagneticFieldGrid B(grid, nG);
+	TiledMagneticFieldGrid T(new TiledGrid3f("testTiledField.raw"), nG);
+	Vector3d pos[3] = {Vector3d(0.3, 1.2, 2.5), Vector3d(3.9, 0.1, 0), Vector3d(-1, 7, 2)};
+	Vector3d b[3];
+	T.getFields(pos, b, 3);
+	for (int i = 0; i < 3; i++) {
+		EXPECT_EQ(T.getField(pos[i]), b[i]);
+		EXPECT_NEAR(0, (B.getField(pos[i]) - b[i]).getR(), 1e-6 * nG);
+	}
+	remove("testTiledField.raw");
+}
+
+TEST(testModulatedMagneticFieldGrid, fuse) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1);
+	ref_ptr<Grid1f> modGrid = new Grid1f(Vector3d(0.), 4, 1);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++) {
+				grid->get(ix, iy, iz) = Vector3f(ix, iy * iz, 1 - iz);
+				modGrid->get(ix, iy, iz) = 1 + ix * iy - iz;
+			}
+	ModulatedMagneticFieldGrid B(grid, modGrid);
+	// the default boundary conditions of the field and modulation differ
+	EXPECT_THROW(B.fuse(), std::runtime_error);
+	B.setReflective(false, false);
+
+	Vector3d pos[3] = {Vector3d(0.3, 1.2, 2.5), Vector3d(3.9, 0.1, 0), Vector3d(-1, 7, 2)};
+	const interpolationType types[] = {TRILINEAR, TRICUBIC, NEAREST_NEIGHBOUR};
+	for (int t = 0; t < 3; t++) {
+		grid->setInterpolationType(types[t]);
+		modGrid->setInterpolationType(types[t]);
+		ModulatedMagneticFieldGrid F(grid, modGrid);
+		F.setReflective(false, false);
+		F.fuse();
+		EXPECT_TRUE(F.isFused());
+		for (int i = 0; i < 3; i++) {
+			Vector3d b = B.getField(pos[i]);
+			EXPECT_NEAR(0, (F.getField(pos[i]) - b).getR(), 1e-5 * (1 + b.getR()));
+		}
+	}
+
+	// a new grid drops the fused grid
+	modGrid->setInterpolationType(TRILINEAR);
+	ModulatedMagneticFieldGrid F(new Grid3f(Vector3d(0.), 4, 1), modGrid);
+	F.setReflective(true, true);
+	F.fuse();
+	F.setGrid(grid);
+	EXPECT_FALSE(F.isFused());
+	EXPECT_THROW(fuseGrids(new Grid3f(Vector3d(0.), 4, 2), modGrid), std::runtime_error);
+}
+
+TEST(testJF12Field, getFields) {
+	JF12Field B;
+	B.randomStriated(42);
+	std::vector<Vector3d> pos, b(100);
+	for (int i = 0; i < 100; i++)
+		pos.push_back(Vector3d(i * 0.3 - 15, 0.2 * i - 10, 0.05 * i - 2) * kpc);
+	B.getFields(pos.data(), b.data(), pos.size());
+	for (int i = 0; i < 100; i++)
+		EXPECT_EQ(B.getField(pos[i]), b[i]);
+}
+
+// analytic against finite differences of getField
+void expectJacobian(const MagneticField &field, const Vector3d &pos, double tolerance) {
+	Vector3d d[3], fd[3];
+	Vector3d b = field.getFieldAndJacobian(pos, 0, d[0], d[1], d[2]);
+	EXPECT_NEAR(0, (field.getField(pos) - b).getR(), 1e-12 * b.getR());
+	field.MagneticField::getFieldAndJacobian(pos, 0, fd[0], fd[1], fd[2]);
+	for (int i = 0; i < 3; i++)
+		EXPECT_NEAR(0, (d[i] - fd[i]).getR(), tolerance);
+}
+
+TEST(testMagneticField, getFieldAndJacobian) {
+	MagneticDipoleField dipole(Vector3d(1, 2, 3) * kpc, Vector3d(1, -2, 0.5) * muG, 1 * kpc);
+	expectJacobian(dipole, Vector3d(3, 1, -2) * kpc, 1e-9 * muG / kpc);
+
+	JF12Field jf12;
+	Vector3d positions[4] = {Vector3d(-8.5, 0.3, 0.02), Vector3d(4, -1.2, 0.4),
+			Vector3d(2, 1, 3), Vector3d(-6., 7., -1.5)};
+	for (int i = 0; i < 4; i++)
+		expectJacobian(jf12, positions[i] * kpc, 1e-6 * muG / kpc);
+
+	// derivatives of the interpolation of a linear field
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 8, 1);
+	for (int ix = 0; ix < 8; ix++)
+		for (int iy = 0; iy < 8; iy++)
+			for (int iz = 0; iz < 8; iz++)
+				grid->get(ix, iy, iz) = Vector3f(ix + 2 * iy, iz, 3 * ix);
+	MagneticFieldGrid gridField(grid);
+	Vector3d d[3];
+	gridField.getFieldAndJacobian(Vector3d(3.3, 2.6, 4.1), 0, d[0], d[1], d[2]);
+	EXPECT_NEAR(0, (d[0] - Vector3d(1, 0, 3)).getR(), 1e-6);
+	EXPECT_NEAR(0, (d[1] - Vector3d(2, 0, 0)).getR(), 1e-6);
+	EXPECT_NEAR(0, (d[2] - Vector3d(0, 1, 0)).getR(), 1e-6);
+
+	// mirrored field in the reflected copies
+	PeriodicMagneticField periodic(new MagneticFieldGrid(grid), Vector3d(8.), Vector3d(0.), true);
+	periodic.getFieldAndJacobian(Vector3d(8 + 4.7, 2.6, 4.1), 0, d[0], d[1], d[2]);
+	EXPECT_NEAR(0, (d[0] - Vector3d(-1, 0, -3)).getR(), 1e-6);
+	EXPECT_NEAR(0, (d[1] - Vector3d(2, 0, 0)).getR(), 1e-6);
+}
+
+TEST(testTabulatedMagneticField, tabulate) {
+	const char *files[3] = {"testTabulatedField.cache", "testTabulatedField.cache.0", "testTabulatedField.cache.1"};
+	for (int i = 0; i < 3; i++)
+		remove(files[i]);
+	ref_ptr<MagneticField> wave = new PolarizedSingleModeMagneticField(1 * muG,
+			10 * kpc, 0.5, Vector3d(0.), Vector3d(0, 1, 0), Vector3d(1, 0, 0),
+			"amplitude", "polarization", "elliptical");
+	TabulatedMagneticField field(wave);
+	field.addLevel(Vector3d(-20, -20, -4) * kpc, Vector3d(40, 40, 8) * kpc, 2 * kpc);
+	field.addLevel(Vector3d(-20, -20, -0.5) * kpc, Vector3d(40, 40, 1) * kpc, 0.25 * kpc);
+	field.tabulate(0.02 * muG, 1 << 20, "testTabulatedField.cache");
+	EXPECT_EQ(2, field.getNumberOfLevels());
+	EXPECT_DOUBLE_EQ(0.5 * kpc, field.getSpacing(0)); // refined twice
+	EXPECT_DOUBLE_EQ(0.25 * kpc, field.getSpacing(1));
+	EXPECT_LE(field.getErrorBound(), 0.02 * muG);
+
+	// grid points of the disk level, the halo level and outside of both
+	Vector3d disk(8.5 * kpc, 0, 0), halo(-3 * kpc, 5 * kpc, 2 * kpc), outside(0, 0, 10 * kpc);
+	EXPECT_NEAR(0, (field.getField(disk) - wave->getField(disk)).getR(), 1e-6 * muG);
+	EXPECT_NEAR(0, (field.getField(halo) - wave->getField(halo)).getR(), 1e-6 * muG);
+	EXPECT_EQ(wave->getField(outside), field.getField(outside));
+
+	// mapped from the cache
+	TabulatedMagneticField cached(wave);
+	cached.addLevel(Vector3d(-20, -20, -4) * kpc, Vector3d(40, 40, 8) * kpc, 2 * kpc);
+	cached.addLevel(Vector3d(-20, -20, -0.5) * kpc, Vector3d(40, 40, 1) * kpc, 0.25 * kpc);
+	cached.tabulate(0.02 * muG, 1 << 20, "testTabulatedField.cache");
+	EXPECT_EQ(field.getSpacing(0), cached.getSpacing(0));
+	EXPECT_EQ(field.getErrorBound(), cached.getErrorBound());
+	Vector3d position(1.23 * kpc, -4.56 * kpc, 0.1 * kpc);
+	EXPECT_EQ(field.getField(position), cached.getField(position));
+	for (int i = 0; i < 3; i++)
+		remove(files[i]);
+}
+
+TEST(testOctreeMagneticField, getField) {
+	OctreeMagneticField field(Vector3d(0.), 8, 4);
+	field.refine(Vector3d(1, 1, 1), 2);
+	EXPECT_EQ(17, field.getNumberOfNodes());
+	EXPECT_EQ(15, field.getNumberOfLeaves());
+	EXPECT_EQ(2, field.getDepth(Vector3d(1, 1, 1)));
+	EXPECT_EQ(1, field.getDepth(Vector3d(7, 7, 7)));
+	EXPECT_EQ(-1, field.getDepth(Vector3d(-1, 1, 1)));
+
+	// uniform across leaves of different depth
+	field.sample(new UniformMagneticField(Vector3d(1, 2, 3)));
+	Vector3d b = field.getField(Vector3d(1.99, 2.01, 0.3));
+	EXPECT_NEAR(1, b.x, 1e-6);
+	EXPECT_NEAR(2, b.y, 1e-6);
+	EXPECT_NEAR(3, b.z, 1e-6);
+
+	// linear in a fine leaf, in a coarse leaf and across leaves of the same depth
+	field.sample(new EchoMagneticField());
+	Vector3d positions[3] = {Vector3d(1.1, 1.3, 0.7), Vector3d(5.3, 6.1, 5.7), Vector3d(5.3, 4.2, 5.7)};
+	for (int i = 0; i < 3; i++)
+		EXPECT_NEAR(0, (field.getField(positions[i]) - positions[i]).getR(), 1e-5);
+	EXPECT_EQ(Vector3d(0.), field.getField(Vector3d(8.5, 1, 1)));
+
+	field.save("testOctreeField.bin", 0.5);
+	OctreeMagneticField loaded("testOctreeField.bin", 0.5);
+	EXPECT_EQ(field.getNumberOfLeaves(), loaded.getNumberOfLeaves());
+	EXPECT_EQ(2, loaded.getDepth(Vector3d(1, 1, 1)));
+	for (int i = 0; i < 3; i++)
+		EXPECT_NEAR(0, (field.getField(positions[i]) - loaded.getField(positions[i])).getR(), 1e-5);
+	remove("testOctreeField.bin");
+	EXPECT_THROW(OctreeMagneticField("testOctreeField.bin"), std::runtime_error);
+}
+
 TEST(testCMZMagneticField, SimpleTest) {
 	ref_ptr<CMZField> field = new CMZField();
 	
@@ -16,6 +16,11 @@
 #include "crpropa/magneticLens/ModelMatrix.h"
 #include "crpropa/magneticLens/Pixelization.h"
 #include "crpropa/magneticLens/ParticleMapsContainer.h"
+#include "crpropa/magneticLens/LensBuilder.h"
+#include "crpropa/magneticLens/GalacticLens.h"
+#include "crpropa/module/ParticleCollector.h"
+#include "crpropa/ParticleID.h"
+#include "crpropa/magneticField/MagneticField.h"
 #include "crpropa/Common.h"
 
 using namespace std;
@@ -87,6 +92,53 @@ TEST(MagneticLens, Vector3Deflection)
 	EXPECT_NEAR(u.getAngleTo(v), 0., 2. / 180 * M_PI);
 }
 
+TEST(GalacticLens, process)
+{
+	MagneticLens magneticLens(5);
+	Pixelization P(5);
+	ModelMatrixType M;
+	M.resize(P.nPix(), P.nPix());
+	M.reserve(P.nPix());
+
+	// Map any direction (p,t) to (p, -t)
+	for (int i=0;i<P.nPix();i++)
+	{
+		double theta, phi;
+		P.pix2Direction(i, phi, theta);
+		int j = P.direction2Pix(phi, -theta);
+		M.insert(i,j) =1;
+	}
+	magneticLens.setLensPart(M, 10 * EeV, 100 * EeV);
+
+	ref_ptr<ParticleCollector> output = new ParticleCollector();
+	GalacticLens lens(&magneticLens, output);
+
+	// lensed proton
+	Vector3d u(1, 0, 1);
+	ref_ptr<Candidate> c = new Candidate(nucleusId(1, 1), 20 * EeV, Vector3d(0.), u / u.getR());
+	lens.process(c);
+	EXPECT_NEAR(c->current.getDirection().getAngleTo(Vector3d(1, 0, -1)), 0., 2. / 180 * M_PI);
+	EXPECT_EQ(1, output->size());
+
+	// rigidity not covered: not passed to the output
+	ref_ptr<Candidate> d = new Candidate(nucleusId(1, 1), 1 * EeV, Vector3d(0.), u / u.getR());
+	lens.process(d);
+	EXPECT_EQ(1, output->size());
+
+	// iron at the same rigidity is lensed
+	ref_ptr<Candidate> e = new Candidate(nucleusId(56, 26), 26 * 20 * EeV, Vector3d(0.), u / u.getR());
+	EXPECT_TRUE(lens.lensCandidate(e));
+	EXPECT_NEAR(e->current.getDirection().z, -u.z / u.getR(), 0.05);
+
+	// photons are passed unchanged
+	ref_ptr<Candidate> g = new Candidate(22, 1 * EeV, Vector3d(0.), u / u.getR());
+	lens.process(g);
+	EXPECT_EQ(2, output->size());
+	EXPECT_NEAR(g->current.getDirection().getAngleTo(u), 0., 1e-12);
+
+	EXPECT_THROW(GalacticLens(0), std::runtime_error);
+}
+
 TEST(MagneticLens, OutOfBoundsEnergy)
 {
 	MagneticLens magneticLens(5);
@@ -100,6 +152,139 @@ TEST(MagneticLens, OutOfBoundsEnergy)
 }
 
 
+TEST(MagneticLens, transformCosmicRays)
+{
+	MagneticLens magneticLens(4);
+	Pixelization P(4);
+	ModelMatrixType M;
+	M.resize(P.nPix(), P.nPix());
+	M.reserve(2 * P.nPix());
+
+	// half of each column to (p, -t), the other half is lost
+	for (int i=0;i<P.nPix();i++)
+	{
+		double theta, phi;
+		P.pix2Direction(i, phi, theta);
+		int j = P.direction2Pix(phi, -theta);
+		M.insert(i,j) = 0.5;
+	}
+	magneticLens.setLensPart(M, 10 * EeV, 100 * EeV);
+
+	size_t n = 20000;
+	std::vector<double> rigidities(n, 20 * EeV), phis(n), thetas(n);
+	rigidities[0] = 1 * EeV; // not covered
+	for (size_t k = 0; k < n; k++)
+		P.pix2Direction(k % P.nPix(), phis[k], thetas[k]);
+	std::vector<double> thetas0 = thetas;
+
+	std::vector<int> accepted = magneticLens.transformCosmicRays(rigidities, phis, thetas);
+	ASSERT_EQ(n, accepted.size());
+	EXPECT_EQ(0, accepted[0]);
+	size_t nAccepted = 0;
+	for (size_t k = 0; k < n; k++)
+	{
+		if (accepted[k])
+		{
+			nAccepted++;
+			EXPECT_NEAR(thetas[k] + thetas0[k], 0., 0.1);
+		}
+		else
+			EXPECT_EQ(thetas0[k], thetas[k]);
+	}
+	EXPECT_NEAR(0.5, double(nAccepted) / n, 0.02);
+
+	std::vector<double> wrongSize(1);
+	EXPECT_THROW(magneticLens.transformCosmicRays(rigidities, wrongSize, thetas), std::runtime_error);
+}
+
+
+TEST(MagneticLens, compactLens)
+{
+	Pixelization P(3);
+	ModelMatrixType M;
+	M.resize(P.nPix(), P.nPix());
+	for (int i=0;i<P.nPix();i++)
+	{
+		double theta, phi;
+		P.pix2Direction(i, phi, theta);
+		M.insert(P.direction2Pix(phi, -theta), i) = 0.25;
+		if (i % 2 == 0)
+			M.insert((i + 1) % P.nPix(), i) = 0.25;
+	}
+
+	MagneticLens lens;
+	lens.setLensPart(M, 10 * EeV, 100 * EeV);
+	lens.setLensPart(M * 2, 100 * EeV, 1000 * EeV);
+	lens.saveCompact("compactLens.txt");
+
+	MagneticLens compact("compactLens.txt");
+	ASSERT_EQ(2, compact.getLensParts().size());
+	EXPECT_FALSE(compact.getLensParts()[0]->isLoaded());
+	EXPECT_TRUE(compact.rigidityCovered(20 * EeV));
+	EXPECT_FALSE(compact.getLensParts()[0]->isLoaded());
+
+	LensPart *part = compact.getLensPart(200 * EeV);
+	EXPECT_TRUE(part->isLoaded());
+	EXPECT_TRUE(part->isMapped());
+	EXPECT_FALSE(compact.getLensParts()[0]->isLoaded());
+	EXPECT_NEAR(1., part->getMaximumOfSumsOfColumns(), 1e-12);
+
+	// normalizations of the mapped parts
+	compact.normalizeLens();
+	EXPECT_TRUE(part->isMapped());
+	EXPECT_NEAR(1., part->getMaximumOfSumsOfColumns(), 1e-12);
+	EXPECT_NEAR(0.5, compact.getLensParts()[0]->getMaximumOfSumsOfColumns(), 1e-12);
+	for (int i = 0; i < P.nPix(); i++)
+	{
+		uint32_t pixel;
+		EXPECT_EQ(i % 2 == 0, part->drawPixel(i, 0.6, pixel));
+		EXPECT_TRUE(part->drawPixel(i, 0.4, pixel));
+		EXPECT_FALSE(compact.getLensParts()[0]->drawPixel(i, 0.6, pixel));
+	}
+
+	// copy to memory
+	ModelMatrixType &N = part->getMatrix();
+	EXPECT_FALSE(part->isMapped());
+	EXPECT_EQ(M.nonZeros(), N.nonZeros());
+	EXPECT_NEAR(0, (N - M * 2).norm(), 1e-12);
+
+	remove("compactLens.txt");
+	remove("compactLens.txt_0.mlcmp");
+	remove("compactLens.txt_1.mlcmp");
+}
+
+
+TEST(LensBuilder, noField)
+{
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0.));
+	ref_ptr<LensBuilder> builder = new LensBuilder(field, 2);
+	builder->setParticleId(11);
+	builder->setParticlesPerPixel(4);
+
+	// without deflection the directions outside are the arrival directions
+	ModelMatrixType M = builder->buildMatrix(1 * EeV, 10 * EeV);
+	Pixelization P(2);
+	ASSERT_EQ(P.nPix(), M.cols());
+	EXPECT_EQ(0, builder->getNumberOfLost());
+	EXPECT_NEAR(P.nPix(), M.sum(), 1e-9);
+	EXPECT_GT(M.diagonal().sum(), 0.9 * P.nPix());
+
+	std::vector<double> edges;
+	edges.push_back(18);
+	edges.push_back(19);
+	builder->buildLens("builtLens.txt", edges);
+	MagneticLens lens("builtLens.txt");
+	ASSERT_EQ(1, lens.getLensParts().size());
+	EXPECT_TRUE(lens.rigidityCovered(5 * EeV));
+	EXPECT_NEAR(P.nPix(), lens.getLensPart(5 * EeV)->getMatrix().sum(), 1e-9);
+	remove("builtLens.txt");
+	remove("builtLens.txt_0.mldat");
+
+	builder->setParticleId(22);
+	EXPECT_THROW(builder->buildMatrix(1 * EeV, 10 * EeV), std::runtime_error);
+}
+
+
 TEST(Pixelization, angularDistance)
 {
 	// test for correct angular distance in case of same vectors 
@@ -150,6 +335,92 @@ TEST(ParticleMapsContainer, getRandomParticles)
   }
 
 }
+TEST(ParticleMapsContainer, addParticlesAndMerge)
+{
+  ParticleMapsContainer maps, other;
+  size_t n = 1000;
+  std::vector<int> ids(n, 1000010010);
+  std::vector<double> energies(n, 1 * EeV), lons(n, 0), lats(n, 0), weights(n, 1);
+  for (size_t i = 0; i < n / 4; i++)
+  {
+    ids[i] = 1000020040;
+    energies[i] = 10 * EeV;
+    lons[i] = 1.;
+    lats[i] = 0.5;
+  }
+  maps.addParticles(ids, energies, lons, lats, weights);
+  EXPECT_EQ(2, maps.getNumberOfMaps());
+  EXPECT_DOUBLE_EQ(750, maps.getWeight(1000010010, 1 * EeV));
+  EXPECT_DOUBLE_EQ(250, maps.getWeight(1000020040, 10 * EeV));
+
+  other.addParticle(1000010010, 1 * EeV, 0, 0, 250);
+  other.addParticle(1000260560, 1 * EeV, 0, 0, 1000);
+  maps.merge(other);
+  EXPECT_EQ(3, maps.getNumberOfMaps());
+  EXPECT_DOUBLE_EQ(1000, maps.getWeight(1000010010, 1 * EeV));
+  EXPECT_DOUBLE_EQ(2250, maps.getSumOfWeights());
+
+  // drawn in proportion to the weights of the maps
+  std::vector<double> e, lo, la;
+  std::vector<int> pids;
+  size_t N = 9000;
+  maps.getRandomParticles(N, pids, e, lo, la);
+  size_t nHe = 0;
+  for (size_t i = 0; i < N; i++)
+  {
+    if (pids[i] == 1000020040)
+    {
+      nHe++;
+      EXPECT_NEAR(lo[i], 1., 2./180*M_PI);
+      EXPECT_NEAR(la[i], 0.5, 2./180*M_PI);
+    }
+  }
+  EXPECT_NEAR(250. / 2250, double(nHe) / N, 0.015);
+
+  ParticleMapsContainer coarse(0.1);
+  EXPECT_THROW(maps.merge(coarse), std::runtime_error);
+}
+
+TEST(Pixelization, batchedConversions)
+{
+	// order 3 with the table of the pixel centers, order 9 without
+	for (int order = 3; order <= 9; order += 6)
+	{
+		Pixelization P(order);
+		std::vector<uint32_t> pixels;
+		for (uint32_t i = 0; i < P.nPix(); i += 7)
+			pixels.push_back(i);
+
+		std::vector<double> lons, lats;
+		P.pix2Direction(pixels, lons, lats);
+		ASSERT_EQ(pixels.size(), lons.size());
+		std::vector<uint32_t> back;
+		P.direction2Pix(lons, lats, back);
+		for (size_t k = 0; k < pixels.size(); k++)
+		{
+			double lon, lat;
+			P.pix2Direction(pixels[k], lon, lat);
+			EXPECT_DOUBLE_EQ(lon, lons[k]);
+			EXPECT_DOUBLE_EQ(lat, lats[k]);
+			EXPECT_EQ(pixels[k], back[k]);
+			EXPECT_EQ(back[k], P.direction2Pix(lons[k], lats[k]));
+		}
+	}
+
+	// close to the poles
+	Pixelization P(6);
+	double lon, lat;
+	P.pix2Direction(0, lon, lat);
+	EXPECT_EQ(0, P.direction2Pix(lon, lat));
+	P.pix2Direction(P.nPix() - 1, lon, lat);
+	EXPECT_EQ(P.nPix() - 1, P.direction2Pix(lon, lat));
+	EXPECT_EQ(P.direction2Pix(0.3, 0.2), P.direction2Pix(0.3 - 2 * M_PI, 0.2));
+
+	std::vector<double> wrongSize(2);
+	std::vector<uint32_t> pixels;
+	EXPECT_THROW(P.direction2Pix(wrongSize, std::vector<double>(1), pixels), std::runtime_error);
+}
+
 
 TEST(Pixelization, randomDirectionInPixel)
 {
@@ -1,11 +1,40 @@
 #include "crpropa/ModuleList.h"
+#include "crpropa/Configuration.h"
+#include "crpropa/GridTools.h"
+#include "crpropa/ConvergenceMonitor.h"
+#include "crpropa/MultilevelMonteCarlo.h"
+#include "crpropa/Numa.h"
+#include "crpropa/DistributedModuleList.h"
+#include "crpropa/StaticModuleList.h"
+#include "crpropa/ThreadSlots.h"
 #include "crpropa/Source.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
+#include "crpropa/TransferMatrix.h"
 #include "crpropa/module/SimplePropagation.h"
+#include "crpropa/module/PropagationCK.h"
+#include "crpropa/magneticField/MagneticField.h"
+#include "crpropa/module/BatchModule.h"
 #include "crpropa/module/BreakCondition.h"
+#include "crpropa/module/ParticleCollector.h"
+#include "crpropa/module/TextOutput.h"
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace crpropa {
 
 TEST(ModuleList, process) {
@@ -42,6 +71,54 @@ TEST(ModuleList, runCandidateList) {
 	EXPECT_TRUE(candidate->isActive() == false);
 }
 
+TEST(ModuleList, workerPool) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+#if _OPENMP
+	omp_set_num_threads(3);
+#endif
+	modules.startWorkers(0, 4); // small queue: submit has to wait
+	EXPECT_TRUE(modules.hasWorkers());
+#if _OPENMP
+	EXPECT_EQ(2, modules.getWorkers());
+#endif
+
+	std::atomic<int> callbacks(0);
+	std::vector<ModuleList::candidate_vector_t> batches(20);
+	std::vector<size_t> ids;
+	for (size_t i = 0; i < batches.size(); i++) {
+		for (size_t j = 0; j < 10; j++)
+			batches[i].push_back(new Candidate(22, 1 * EeV));
+		ids.push_back(modules.submit(batches[i], [&](size_t) { callbacks++; }));
+	}
+	modules.wait(ids[0]);
+	EXPECT_TRUE(modules.isFinished(ids[0]));
+	modules.drain();
+	EXPECT_EQ(0, modules.getPendingCandidates());
+	EXPECT_EQ(20, callbacks);
+	for (size_t i = 0; i < batches.size(); i++) {
+		EXPECT_TRUE(modules.isFinished(ids[i]));
+		for (size_t j = 0; j < 10; j++) {
+			EXPECT_FALSE(batches[i][j]->isActive());
+			EXPECT_DOUBLE_EQ(1 * Mpc, batches[i][j]->getTrajectoryLength());
+		}
+	}
+
+	size_t empty = modules.submit(ModuleList::candidate_vector_t());
+	EXPECT_TRUE(modules.isFinished(empty));
+
+	// the queued candidates are processed before the pool stops
+	ModuleList::candidate_vector_t last(100);
+	for (size_t i = 0; i < last.size(); i++)
+		last[i] = new Candidate(22, 1 * EeV);
+	modules.submit(last);
+	modules.stopWorkers();
+	EXPECT_FALSE(modules.hasWorkers());
+	for (size_t i = 0; i < last.size(); i++)
+		EXPECT_FALSE(last[i]->isActive());
+}
+
 TEST(ModuleList, runSource) {
 	ModuleList modules;
 	modules.add(new SimplePropagation());
@@ -55,6 +132,631 @@ TEST(ModuleList, runSource) {
 	modules.run(&source, 100, false);
 }
 
+TEST(ModuleList, schedule) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+
+	ModuleList::Schedule schedules[4] = {ModuleList::StaticSchedule,
+			ModuleList::DynamicSchedule, ModuleList::GuidedSchedule,
+			ModuleList::AdaptiveSchedule};
+	for (int s = 0; s < 4; s++) {
+		modules.setSchedule(schedules[s], 3);
+		EXPECT_EQ(schedules[s], modules.getSchedule());
+		EXPECT_EQ(3, modules.getScheduleChunkSize());
+
+		ModuleList::candidate_vector_t candidates;
+		for (int i = 0; i < 100; i++)
+			candidates.push_back(new Candidate(22, 1 * EeV));
+		modules.run(&candidates);
+		for (size_t i = 0; i < candidates.size(); i++) {
+			EXPECT_FALSE(candidates[i]->isActive());
+			EXPECT_DOUBLE_EQ(1 * Mpc, candidates[i]->getTrajectoryLength());
+		}
+
+		const std::vector<double> &busy = modules.getThreadBusyTime();
+		const std::vector<double> &idle = modules.getThreadIdleTime();
+		ASSERT_FALSE(busy.empty());
+		EXPECT_EQ(busy.size(), idle.size());
+		for (size_t i = 0; i < busy.size(); i++) {
+			EXPECT_GE(busy[i], 0);
+			EXPECT_GE(idle[i], 0);
+		}
+	}
+}
+
+TEST(ModuleList, sourceBatches) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	modules.add(maxLength);
+	EXPECT_EQ(1, modules.getSourceBatchSize());
+	EXPECT_THROW(modules.setSourceBatchSize(0), std::runtime_error);
+	modules.setSourceBatchSize(8);
+
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+
+	// each primary once, the same ones in both runs
+	double sum[2] = {0, 0};
+	for (int run = 0; run < 2; run++) {
+		ref_ptr<ParticleCollector> collector = new ParticleCollector();
+		maxLength->onReject(collector);
+		Random::seedStreams(42);
+		modules.run(&source, 100);
+		ASSERT_EQ(100, collector->size());
+		for (size_t i = 0; i < collector->size(); i++) {
+			EXPECT_DOUBLE_EQ(1 * Mpc, (*collector)[i]->getTrajectoryLength());
+			sum[run] += (*collector)[i]->source.getEnergy();
+		}
+	}
+	EXPECT_DOUBLE_EQ(sum[0], sum[1]);
+	Random::seedThreads(42);
+}
+
+// source of a limited number of candidates, which counts the requested ones
+class ShortSource: public SourceInterface {
+public:
+	mutable size_t remaining, requested;
+	ShortSource(size_t n) : remaining(n), requested(0) {
+	}
+	ref_ptr<Candidate> getCandidate() const {
+		std::vector<ref_ptr<Candidate> > out;
+		getCandidates(1, out);
+		return out.empty() ? 0 : out[0];
+	}
+	void getCandidates(size_t n, std::vector<ref_ptr<Candidate> > &out) const {
+#pragma omp critical(ShortSource)
+		{
+			requested += n;
+			for (size_t i = 0; i < n and remaining > 0; i++, remaining--)
+				out.push_back(new Candidate(22, 1 * EeV));
+		}
+	}
+	std::string getDescription() const {
+		return "ShortSource";
+	}
+};
+
+TEST(ModuleList, shortSourceBatches) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.setSourceBatchSize(8);
+
+	// the source runs out in the last batches, which end with the run
+	ref_ptr<ShortSource> source = new ShortSource(95);
+	modules.run(source.get(), 100);
+	EXPECT_EQ(95, collector->size());
+	EXPECT_EQ(100, source->requested);
+}
+
+TEST(ModuleList, quasiSources) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	modules.add(maxLength);
+	// source batches are not used
+	modules.setSourceBatchSize(8);
+
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -1));
+
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	Random::seedStreams(42);
+	Random::seedQuasiSources(42);
+	const size_t n = 64;
+	modules.run(&source, n);
+	Random::disableQuasiSources();
+	Random::seedThreads(42);
+	EXPECT_FALSE(Random::instance().isQuasiRandom());
+
+	// one primary in each of the n quantiles of the spectrum
+	ASSERT_EQ(n, collector->size());
+	std::vector<int> bins(n, 0);
+	for (size_t i = 0; i < n; i++) {
+		double u = log10((*collector)[i]->source.getEnergy() / EeV) / 2;
+		bins[std::min<size_t>(u * n, n - 1)]++;
+	}
+	for (size_t k = 0; k < n; k++)
+		EXPECT_EQ(1, bins[k]);
+}
+
+// counts the thread-confined candidates it sees
+class ConfinedCounter: public Module {
+public:
+	mutable int calls, confined;
+	ConfinedCounter() : calls(0), confined(0) {
+	}
+	void process(Candidate *c) const {
+#pragma omp atomic
+		calls++;
+		if (c->isThreadConfined()) {
+#pragma omp atomic
+			confined++;
+		}
+	}
+};
+
+TEST(ModuleList, threadConfined) {
+	ModuleList modules;
+	EXPECT_FALSE(modules.getThreadConfined());
+	modules.setThreadConfined(true);
+	ref_ptr<ConfinedCounter> counter = new ConfinedCounter();
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(counter);
+	modules.add(new SimplePropagation());
+	modules.add(maxLength);
+
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.run(&source, 20);
+	EXPECT_LE(20, counter->calls);
+	EXPECT_EQ(counter->calls, counter->confined);
+	ASSERT_EQ(20, collector->size());
+	for (size_t i = 0; i < collector->size(); i++)
+		EXPECT_FALSE((*collector)[i]->isThreadConfined());
+
+	int confined = counter->confined;
+	modules.setThreadConfined(false);
+	modules.run(&source, 20);
+	EXPECT_EQ(confined, counter->confined);
+}
+
+#ifdef __linux__
+// counts the calls on the cpu the thread is pinned to
+class CpuChecker: public Module {
+public:
+	std::vector<int> cpus;
+	mutable int calls, pinned;
+	CpuChecker(const std::vector<int> &cpus) : cpus(cpus), calls(0), pinned(0) {
+	}
+	void process(Candidate *c) const {
+		size_t thread = 0;
+#ifdef _OPENMP
+		thread = omp_get_thread_num();
+#endif
+		bool onCpu = sched_getcpu() == cpus[thread % cpus.size()];
+#pragma omp critical(CpuChecker)
+		{
+			calls++;
+			pinned += onCpu;
+		}
+	}
+};
+
+TEST(ModuleList, threadAffinity) {
+	ModuleList modules;
+	EXPECT_EQ(ModuleList::NoAffinity, modules.getThreadAffinity());
+	modules.setThreadAffinity(ModuleList::SpreadAffinity);
+	std::vector<int> cpus = getThreadCpus(true);
+	ASSERT_FALSE(cpus.empty());
+	EXPECT_EQ(cpus.size(), getThreadCpus(false).size());
+	ref_ptr<CpuChecker> checker = new CpuChecker(cpus);
+	modules.add(checker);
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+
+	cpu_set_t before, after;
+	sched_getaffinity(0, sizeof(before), &before);
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.run(&source, 20);
+	EXPECT_LE(20, checker->calls);
+	EXPECT_EQ(checker->calls, checker->pinned);
+
+	// the affinity of the threads is restored
+	sched_getaffinity(0, sizeof(after), &after);
+	EXPECT_TRUE(CPU_EQUAL(&before, &after));
+}
+#endif
+
+TEST(ModuleList, secondaryRecords) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> finished = new ParticleCollector();
+	maxLength->onReject(finished);
+	modules.add(maxLength);
+	ref_ptr<ParticleCollector> neutrinos = new ParticleCollector();
+	neutrinos->setCompact(true);
+	modules.setSecondaryRecordModule(12, neutrinos);
+
+	ref_ptr<Candidate> c = new Candidate(22, 10 * EeV);
+	Candidate::setDeferSecondaries(true);
+	c->addSecondary(12, 1 * EeV);
+	c->addSecondary(12, 2 * EeV, 0.5);
+	c->addSecondary(22, 3 * EeV);
+	Candidate::setDeferSecondaries(false);
+
+	modules.run(c);
+	EXPECT_EQ(0, c->deferredSecondaries.size());
+	ASSERT_EQ(1, c->secondaries.size());
+	EXPECT_DOUBLE_EQ(1 * Mpc, c->secondaries[0]->getTrajectoryLength());
+	EXPECT_EQ(2, finished->size());
+
+	ParticleCollector::Columns columns;
+	neutrinos->getColumns(columns);
+	ASSERT_EQ(2, columns.size());
+	EXPECT_EQ(12, columns.id[0]);
+	EXPECT_DOUBLE_EQ(2 * EeV, columns.energy[1]);
+	EXPECT_DOUBLE_EQ(0.5, columns.weight[1]);
+}
+
+TEST(StaticModuleList, run) {
+	StaticModuleList<SimplePropagation, MaximumTrajectoryLength> modules(
+			new SimplePropagation(), new MaximumTrajectoryLength(1 * Mpc));
+	EXPECT_EQ(2, modules.size());
+	EXPECT_DOUBLE_EQ(1 * Mpc, modules.get<1>()->getMaximumTrajectoryLength());
+
+	ref_ptr<Candidate> candidate = new Candidate();
+	modules.run(candidate);
+	EXPECT_DOUBLE_EQ(1 * Mpc, candidate->getTrajectoryLength());
+	EXPECT_FALSE(candidate->isActive());
+
+	// same steps as the dynamic list
+	ModuleList dynamic;
+	dynamic.add(new SimplePropagation());
+	dynamic.add(new MaximumTrajectoryLength(1 * Mpc));
+	ref_ptr<Candidate> a = new Candidate();
+	ref_ptr<Candidate> b = new Candidate();
+	for (int i = 0; i < 3; i++) {
+		dynamic.process(a);
+		modules.process(b);
+		EXPECT_EQ(a->getTrajectoryLength(), b->getTrajectoryLength());
+	}
+}
+
+class DerivedPropagation: public SimplePropagation {
+};
+
+TEST(StaticModuleList, rejectSubclass) {
+	typedef StaticModuleList<SimplePropagation> PropagationList;
+	EXPECT_THROW(PropagationList(new DerivedPropagation()), std::runtime_error);
+	EXPECT_THROW(PropagationList(0), std::runtime_error);
+}
+
+TEST(DistributedModuleList, run) {
+	DistributedModuleList modules(7);
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	modules.add(collector);
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.setSeed(42);
+	modules.run(&source, 100);
+	EXPECT_EQ(100, modules.getProcessed());
+
+	// same seed, same primaries
+	ref_ptr<ParticleCollector> collector2 = new ParticleCollector();
+	modules.remove(2);
+	modules.add(collector2);
+	modules.run(&source, 100);
+	ASSERT_EQ(collector->size(), collector2->size());
+	Vector3d sum1, sum2;
+	for (size_t i = 0; i < collector->size(); i++) {
+		sum1 += (*collector)[i]->source.getDirection();
+		sum2 += (*collector2)[i]->source.getDirection();
+	}
+	EXPECT_DOUBLE_EQ(sum1.x, sum2.x);
+	EXPECT_DOUBLE_EQ(sum1.y, sum2.y);
+	Random::seedThreads(42);
+}
+
+TEST(DistributedModuleList, domainDecomposition) {
+	// a single domain: all candidates are local, none migrates
+	DistributedModuleList modules(16);
+	modules.setDomainDecomposition(new DomainDecomposition(
+			GridProperties(Vector3d(-4 * Mpc), 8, 1 * Mpc)));
+	ref_ptr<SimplePropagation> propagation = new SimplePropagation(0, 10 * Mpc);
+	modules.add(propagation);
+	modules.add(new MaximumTrajectoryLength(3 * Mpc));
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	modules.add(collector);
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	modules.setSeed(42);
+	modules.run(&source, 50);
+	EXPECT_EQ(50, modules.getProcessed());
+	EXPECT_EQ(0, modules.getMigrated());
+	EXPECT_EQ(3, modules.size());
+	// the steps are limited to the reach of the halo
+	ASSERT_LT(0, collector->size());
+	for (size_t i = 0; i < collector->size(); i++) {
+		EXPECT_NEAR(3 * Mpc, (*collector)[i]->getTrajectoryLength(), 1e-6 * Mpc);
+		EXPECT_NEAR(1 * Mpc, (*collector)[i]->getCurrentStep(), 1e-6 * Mpc);
+	}
+	Random::seedThreads(42);
+}
+
+TEST(DistributedModuleList, mergeTextShards) {
+	std::string filename = "testDistributedModuleList.txt";
+	std::string shard = DistributedModuleList::shardFilename(filename);
+	std::ofstream out(shard.c_str());
+	out << "# header\n1 2\n3 4\n";
+	out.close();
+	DistributedModuleList::mergeTextShards(filename);
+
+	std::ifstream in(filename.c_str());
+	std::stringstream ss;
+	ss << in.rdbuf();
+	EXPECT_EQ("# header\n1 2\n3 4\n", ss.str());
+	std::ifstream removed(shard.c_str());
+	EXPECT_FALSE(removed.good());
+	remove(filename.c_str());
+}
+
+class TwoSecondaries: public Module {
+public:
+	void process(Candidate *candidate) const {
+		if (candidate->parent == 0 and candidate->secondaries.empty()) {
+			candidate->addSecondary(22, 1 * EeV);
+			candidate->addSecondary(22, 1 * EeV);
+		}
+	}
+};
+
+TEST(ModuleList, progressCallback) {
+	ModuleList modules;
+	modules.add(new TwoSecondaries());
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 20; i++)
+		candidates.push_back(new Candidate());
+
+	std::vector<ProgressStatus> reports;
+	modules.setShowProgress(true);
+	modules.setProgressCallback([&reports](const ProgressStatus &s) {
+		reports.push_back(s);
+	});
+	modules.run(&candidates);
+
+	// at least the final report
+	ASSERT_FALSE(reports.empty());
+	EXPECT_EQ(20, reports.back().primaries);
+	EXPECT_EQ(20, reports.back().total);
+	EXPECT_EQ(40, reports.back().secondaries);
+	EXPECT_EQ(0, reports.back().eta);
+}
+
+// splits each candidate above energy 1 into two of half the energy
+class Split: public Module {
+public:
+	void process(Candidate *candidate) const {
+		double E = candidate->current.getEnergy();
+		if ((E > 1) and not candidate->hasProperty("split")) {
+			candidate->setProperty("split", true);
+			candidate->addSecondary(22, E / 2);
+			candidate->addSecondary(22, E / 2);
+		}
+	}
+};
+
+// counts the finished candidates and their source serial numbers
+class Finished: public Module {
+public:
+	mutable size_t count;
+	mutable std::set<uint64_t> sources;
+	Finished() : count(0) {}
+	void process(Candidate *candidate) const {
+		if (candidate->isActive())
+			return;
+		count++;
+		sources.insert(candidate->getSourceSerialNumber());
+	}
+};
+
+TEST(ModuleList, streamSecondaries) {
+	ModuleList modules;
+	modules.add(new Split());
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	EXPECT_FALSE(modules.getStreamSecondaries());
+
+	for (int stream = 0; stream < 2; stream++) {
+		ref_ptr<Finished> finished = new Finished();
+		modules.add(finished);
+		modules.setStreamSecondaries(stream);
+		CandidatePool::clear();
+		CandidatePool::Statistics s0 = CandidatePool::getStatistics();
+
+		// binary tree of 127 candidates
+		ref_ptr<Candidate> primary = new Candidate(22, 64);
+		modules.run(primary);
+		CandidatePool::Statistics s1 = CandidatePool::getStatistics();
+		EXPECT_EQ(127, finished->count);
+		ASSERT_EQ(1, finished->sources.size());
+		EXPECT_EQ(primary->getSerialNumber(), *finished->sources.begin());
+
+		if (stream) {
+			// the finished candidates are reused instead of the whole tree
+			EXPECT_TRUE(primary->secondaries.empty());
+			EXPECT_LT(s1.allocated - s0.allocated, 20);
+		} else {
+			EXPECT_EQ(2, primary->secondaries.size());
+			EXPECT_GE(s1.allocated - s0.allocated, 126);
+		}
+		modules.remove(3);
+	}
+}
+
+TEST(ModuleList, runLanes) {
+	ModuleList modules;
+	modules.add(new Split());
+	modules.add(new SimplePropagation(1 * kpc, 100 * kpc));
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	ref_ptr<Finished> finished = new Finished();
+	modules.add(finished);
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(64));
+	EXPECT_THROW(modules.runLanes(&source, 1, 0), std::runtime_error);
+
+#if _OPENMP
+	omp_set_num_threads(1);
+#endif
+	// 5 binary trees of 127 candidates in 8 lanes
+	modules.runLanes(&source, 5, 8);
+	EXPECT_EQ(5 * 127, finished->count);
+	EXPECT_EQ(5, finished->sources.size());
+
+	ASSERT_EQ(1, modules.getLaneStatistics().size());
+	LaneStatistics statistics = modules.getLaneStatistics()[0];
+	EXPECT_EQ(8, statistics.width);
+	EXPECT_EQ(5, statistics.primaries);
+	EXPECT_EQ(5 * 126, statistics.secondaries);
+	EXPECT_EQ(5 * 127, statistics.refills);
+	// the lanes only drain at the end
+	EXPECT_GT(statistics.getOccupancy(), 0.9);
+	EXPECT_DOUBLE_EQ(statistics.getOccupancy(), modules.getLaneOccupancy());
+
+	// without the secondaries
+	finished->count = 0;
+	modules.runLanes(&source, 5, 8, false);
+	EXPECT_EQ(5, finished->count);
+	EXPECT_EQ(0, modules.getLaneStatistics()[0].secondaries);
+
+#if _OPENMP
+	// the secondaries of few primaries are shared among the threads
+	modules.remove(3);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	modules.add(collector);
+	omp_set_num_threads(4);
+	modules.runLanes(&source, 2, 8);
+	ASSERT_EQ(4, modules.getLaneStatistics().size());
+	// the collector holds each step of each candidate
+	size_t refills = 0, laneSteps = 0;
+	for (size_t i = 0; i < 4; i++) {
+		refills += modules.getLaneStatistics()[i].refills;
+		laneSteps += modules.getLaneStatistics()[i].laneSteps;
+	}
+	EXPECT_EQ(2 * 127, refills);
+	EXPECT_EQ(collector->size(), laneSteps);
+#endif
+}
+
+TEST(ModuleList, runInitialStates) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+
+	int id[3] = {22, 11, -11};
+	double energy[3] = {1 * EeV, 2 * EeV, 3 * EeV};
+	double position[9] = {0, 0, 0, 1 * Mpc, 0, 0, 0, 2 * Mpc, 0};
+	double direction[9] = {0, 0, 1, 0, 0, 1, 0, 0, 1};
+	double weight[3] = {1, 2, 3};
+	InitialStates states;
+	states.count = 3;
+	states.id = id;
+	EXPECT_THROW(modules.run(states), std::runtime_error);
+
+	states.energy = energy;
+	states.position = position;
+	states.direction = direction;
+	states.weight = weight;
+	modules.run(states);
+	ASSERT_EQ(3, collector->size());
+	for (size_t i = 0; i < 3; i++) {
+		Candidate *c = (*collector)[i];
+		// the collector is filled in any order
+		size_t j = 0;
+		while (id[j] != c->current.getId())
+			j++;
+		EXPECT_DOUBLE_EQ(energy[j], c->source.getEnergy());
+		EXPECT_EQ(Vector3d(position[3 * j], position[3 * j + 1], position[3 * j + 2]),
+				c->source.getPosition());
+		EXPECT_NEAR(1 * Mpc, c->current.getPosition().z, 1e-6 * Mpc);
+		EXPECT_DOUBLE_EQ(weight[j], c->getWeight());
+		EXPECT_DOUBLE_EQ(0, c->getRedshift());
+	}
+}
+
+TEST(ModuleList, costAccounting) {
+	Candidate::setCostAccounting(true);
+	ModuleList modules;
+	modules.add(new Split());
+	modules.add(new PropagationCK(new UniformMagneticField(Vector3d(0, 0, 1 * nG)),
+			1e-4, 1 * kpc, 100 * kpc));
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+
+	// binary tree of 7 electrons
+	ref_ptr<Candidate> primary = new Candidate(11, 4);
+	modules.run(primary);
+	Candidate::setCostAccounting(false);
+
+	CandidateCost cost = primary->getCost();
+	EXPECT_GE(cost.steps, 10);
+	EXPECT_EQ(2, cost.secondaries);
+	// six field evaluations per step of the Cash-Karp method
+	EXPECT_EQ(6 * (cost.steps + cost.rejectedSteps), cost.fieldEvaluations);
+	EXPECT_GT(cost.time, 0);
+	EXPECT_EQ(cost.steps, primary->getProperty("CostSteps").toUInt64());
+
+	// the tree cost is the sum over the secondaries
+	CandidateCost tree = primary->getTreeCost();
+	CandidateCost sum = cost;
+	ASSERT_EQ(2, primary->secondaries.size());
+	for (size_t i = 0; i < 2; i++)
+		sum += primary->secondaries[i]->getTreeCost();
+	EXPECT_EQ(6, tree.secondaries);
+	EXPECT_EQ(sum.steps, tree.steps);
+	EXPECT_EQ(sum.fieldEvaluations, tree.fieldEvaluations);
+	EXPECT_DOUBLE_EQ(sum.time, tree.time);
+	EXPECT_EQ(0, primary->secondaries[0]->secondaries[0]->getTreeCost().secondaries);
+
+	// without accounting nothing is counted
+	ref_ptr<Candidate> uncounted = new Candidate(11, 1 * EeV);
+	modules.run(uncounted);
+	EXPECT_EQ(0, uncounted->getCost().steps);
+	EXPECT_FALSE(uncounted->hasProperty("CostSteps"));
+}
+
+TEST(ModuleList, memory) {
+	ModuleList modules;
+	modules.add(new Split());
+	modules.add(new SimplePropagation());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	EXPECT_EQ(0, modules.getSizeOf());
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	modules.add(collector);
+
+	// binary tree of 127 candidates from one primary
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(22, 64));
+	modules.run(&candidates);
+	EXPECT_GE(modules.getPeakSecondaries(), 2);
+	EXPECT_EQ(modules.getPeakSecondaries() + 1, modules.getPeakCandidates());
+	EXPECT_LE(modules.getPeakCandidates(), 127);
+
+	// the collector holds every candidate of the tree
+	EXPECT_GE(modules.getSizeOf(), collector->size() * sizeof(Candidate));
+	EXPECT_EQ(collector->getSizeOf(), modules.getSizeOf());
+	std::string report = modules.getMemoryReport();
+	EXPECT_NE(std::string::npos, report.find("peak candidates in flight"));
+}
+
 #if _OPENMP
 #include <omp.h>
 TEST(ModuleList, runOpenMP) {
@@ -69,7 +771,563 @@ TEST(ModuleList, runOpenMP) {
 	omp_set_num_threads(2);
 	modules.run(&source, 1000, false);
 }
+
+class SecondaryEmitter: public Module {
+public:
+	void process(Candidate *candidate) const {
+		if (candidate->parent == 0 and candidate->secondaries.empty())
+			for (int i = 0; i < 50; i++)
+				candidate->addSecondary(22, 1 * EeV);
+	}
+};
+
+TEST(ModuleList, runSecondaryTasks) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	modules.add(new SecondaryEmitter());
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	modules.setSecondaryTasks(true);
+	EXPECT_TRUE(modules.getSecondaryTasks());
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 10; i++)
+		candidates.push_back(new Candidate(22, 10 * EeV));
+	omp_set_num_threads(2);
+	modules.run(&candidates);
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		EXPECT_FALSE(candidates[i]->isActive());
+		ASSERT_EQ(50, candidates[i]->secondaries.size());
+		for (size_t j = 0; j < 50; j++) {
+			EXPECT_FALSE(candidates[i]->secondaries[j]->isActive());
+			EXPECT_DOUBLE_EQ(1 * Mpc, candidates[i]->secondaries[j]->getTrajectoryLength());
+		}
+	}
+}
+#endif
+
+class RandomDetector: public Module {
+public:
+	ref_ptr<Module> detected;
+	RandomDetector(Module *detected) : detected(detected) {
+	}
+	void process(Candidate *candidate) const {
+		if (Random::instance().rand() < 0.3)
+			detected->process(candidate);
+		candidate->setActive(false);
+	}
+};
+
+TEST(ModuleList, runPipelined) {
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+
+#if _OPENMP
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(4);
+#endif
+	// the same primaries and random detections as run, for single
+	// candidates and batches from the source
+	for (size_t batch = 1; batch <= 8; batch *= 8) {
+		double sum[2] = {0, 0};
+		size_t detected[2] = {0, 0};
+		for (int pipelined = 0; pipelined < 2; pipelined++) {
+			ref_ptr<ParticleCollector> collector = new ParticleCollector();
+			ModuleList modules;
+			modules.add(new RandomDetector(collector));
+			modules.setSourceBatchSize(batch);
+			Random::seedStreams(42);
+			if (pipelined)
+				modules.runPipelined(&source, 200, 2, 4);
+			else
+				modules.run(&source, 200);
+			detected[pipelined] = collector->size();
+			for (size_t i = 0; i < collector->size(); i++)
+				sum[pipelined] += (*collector)[i]->source.getEnergy();
+		}
+		EXPECT_GT(detected[0], 0);
+		EXPECT_EQ(detected[0], detected[1]);
+		EXPECT_DOUBLE_EQ(sum[0], sum[1]);
+	}
+	Random::seedThreads(42);
+
+	ModuleList modules;
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(0);
+	maxLength->onReject(collector);
+	modules.add(maxLength);
+	modules.runPipelined(&source, 100, 8, 4);
+	EXPECT_EQ(100, collector->size());
+	const PipelineStatistics &statistics = modules.getPipelineStatistics();
+#if _OPENMP
+	// at least one thread propagates
+	EXPECT_EQ(3, statistics.producers);
+	EXPECT_EQ(1, statistics.workers);
+	EXPECT_EQ(100, statistics.primaries);
+	EXPECT_LE(statistics.peakDepth, 4);
+	EXPECT_LE(statistics.getMeanDepth(), 4);
+	omp_set_num_threads(threads);
 #endif
+}
+
+TEST(ConvergenceMonitor, run) {
+	ref_ptr<ConvergenceMonitor> monitor = new ConvergenceMonitor(0.05, 100);
+	EXPECT_EQ(0, monitor->addDetectionFraction());
+	EXPECT_EQ(1, monitor->addSpectrum(1 * EeV, 100 * EeV, 1));
+	EXPECT_EQ(2, monitor->size());
+	EXPECT_EQ(std::numeric_limits<size_t>::max(), monitor->getRemainingPrimaries());
+
+	ModuleList modules;
+	modules.add(new RandomDetector(monitor));
+	modules.setConvergenceMonitor(monitor);
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(5 * EeV));
+	modules.run(&source, 1000000);
+
+	EXPECT_TRUE(monitor->isConverged());
+	EXPECT_EQ(0, monitor->getRemainingPrimaries());
+	EXPECT_GE(monitor->getBatches(), 10);
+	EXPECT_LT(monitor->getPrimaries(), 10000);
+	EXPECT_NEAR(0.3, monitor->getValue(0), 0.05);
+	EXPECT_LE(monitor->getRelativeUncertainty(0), 0.05);
+	EXPECT_DOUBLE_EQ(monitor->getValue(0), monitor->getValue(1));
+	EXPECT_THROW(monitor->addDetectionFraction(), std::runtime_error);
+
+	// batch means: 1, 3 per primary in two batches
+	monitor = new ConvergenceMonitor(0.1, 10);
+	monitor->addDetectionFraction();
+	Candidate c(22, 1 * EeV);
+	for (int i = 0; i < 10; i++)
+		monitor->process(&c);
+	monitor->endBatch(10);
+	for (int i = 0; i < 30; i++)
+		monitor->process(&c);
+	monitor->endBatch(10);
+	EXPECT_DOUBLE_EQ(2, monitor->getValue(0));
+	EXPECT_DOUBLE_EQ(1, monitor->getUncertainty(0));
+	EXPECT_FALSE(monitor->isConverged());
+	// (0.5 / 0.1)^2 * 20 primaries in total
+	EXPECT_EQ(480, monitor->getRemainingPrimaries());
+	monitor->reset();
+	EXPECT_EQ(0, monitor->getBatches());
+}
+
+TEST(MultilevelMonteCarlo, run) {
+	ref_ptr<MultilevelMonteCarlo> mlmc = new MultilevelMonteCarlo(0.02, 50);
+	EXPECT_THROW(mlmc->run(NULL), std::runtime_error);
+	EXPECT_THROW(mlmc->setInitialSamples(1), std::runtime_error);
+	for (size_t l = 0; l < 2; l++) {
+		ref_ptr<ModuleList> modules = new ModuleList();
+		modules->add(new RandomDetector(mlmc));
+		mlmc->addLevel(modules);
+	}
+	EXPECT_EQ(2, mlmc->size());
+
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(5 * EeV));
+	mlmc->run(&source);
+
+	// the levels draw the same random numbers: no difference
+	EXPECT_EQ(50, mlmc->getSamples(1));
+	EXPECT_DOUBLE_EQ(0, mlmc->getLevelMean(1));
+	EXPECT_DOUBLE_EQ(0, mlmc->getLevelVariance(1));
+	EXPECT_DOUBLE_EQ(mlmc->getLevelObservable(0), mlmc->getLevelMean(0));
+	// p (1 - p) / 0.02^2 = 525 samples of level 0
+	EXPECT_GE(mlmc->getSamples(0), 500);
+	EXPECT_LE(mlmc->getUncertainty(), 0.021);
+	EXPECT_NEAR(0.3, mlmc->getValue(), 0.08);
+
+	// the samples are reproducible
+	double value = mlmc->getValue();
+	mlmc->reset();
+	EXPECT_EQ(0, mlmc->getSamples(0));
+	mlmc->run(&source);
+	EXPECT_DOUBLE_EQ(value, mlmc->getValue());
+}
+
+static void addCount(uint64_t &sum, const uint64_t &count) {
+	sum += count;
+}
+
+// counts the calls in slots of the threads, merged at the end of the run
+class SlotCounter: public Module {
+	mutable ThreadSlots<uint64_t> counts;
+public:
+	uint64_t total;
+	SlotCounter() : total(0) {
+	}
+	void process(Candidate *candidate) const {
+		counts.local() += 1;
+		candidate->setActive(false);
+	}
+	void endRun() {
+		counts.merge(total, addCount);
+	}
+	size_t threads() const {
+		return counts.size();
+	}
+};
+
+TEST(ThreadSlots, endRun) {
+	ref_ptr<SlotCounter> counter = new SlotCounter();
+	ref_ptr<ModuleList> inner = new ModuleList();
+	inner->add(counter);
+	ModuleList modules;
+	modules.add(inner);
+	Source source;
+	source.add(new SourceEnergy(1 * EeV));
+	modules.run(&source, 1000);
+	// merged through the nested list
+	EXPECT_EQ(1000, counter->total);
+	EXPECT_GE(counter->threads(), 1);
+	modules.run(&source, 500);
+	EXPECT_EQ(1500, counter->total);
+
+	ThreadSlots<uint64_t> slots(2);
+	uint64_t sum = 0;
+	slots.local() += 1;
+	slots.merge(sum, addCount);
+	EXPECT_EQ(3, sum);
+	EXPECT_EQ(2, slots.local());
+	slots.clear(5);
+	EXPECT_EQ(0, slots.size());
+	EXPECT_EQ(5, slots.local());
+}
+
+// removes one neutron from the nuclei at their first step
+class NeutronLoss: public Module {
+public:
+	void process(Candidate *candidate) const {
+		int id = candidate->current.getId();
+		if (candidate->hasProperty("NeutronLoss") or (massNumber(id) < 2))
+			return;
+		candidate->setProperty("NeutronLoss", true);
+		candidate->current.setId(nucleusId(massNumber(id) - 1, chargeNumber(id)));
+	}
+};
+
+TEST(TransferMatrix, buildAndApply) {
+	std::vector<int> species(1, nucleusId(4, 2));
+	EXPECT_THROW(TransferMatrix(std::vector<int>(1, 22)), std::runtime_error);
+	TransferMatrix matrix(species, 10 * Mpc, 2, 18, 19, 0.5);
+	EXPECT_EQ(4, matrix.getNumberOfCells());
+	EXPECT_EQ(2, matrix.getNumberOfEnergyBins());
+	EXPECT_EQ(4, matrix.getMaximumMassNumber());
+
+	ref_ptr<ModuleList> simulation = new ModuleList();
+	simulation->add(new SimplePropagation(0.1 * Mpc, 1 * Mpc));
+	simulation->add(new NeutronLoss());
+	unsigned int retention = Candidate::getStateRetention();
+	Candidate::setStateRetention(Candidate::RetainNone);
+	EXPECT_THROW(matrix.build(simulation, 10), std::runtime_error);
+	Candidate::setStateRetention(retention);
+	EXPECT_EQ(2, simulation->size());
+	matrix.build(simulation, 20);
+	EXPECT_EQ(2, simulation->size());
+
+	// each helium-4 arrives as helium-3 in the bin of its energy
+	for (int iE = 0; iE < 2; iE++)
+		for (int iD = 0; iD < 2; iD++) {
+			EXPECT_NEAR(1, matrix.get(0, iE, iD, 3, iE), 1e-9);
+			EXPECT_EQ(0, matrix.get(0, iE, iD, 4, iE));
+			EXPECT_EQ(0, matrix.get(0, iE, iD, 3, 1 - iE));
+		}
+
+	std::vector<double> injection(matrix.getNumberOfCells(), 0);
+	injection[matrix.cell(0, 1, 0)] = 2;
+	injection[matrix.cell(0, 1, 1)] = 3;
+	std::vector<double> arrival = matrix.apply(injection);
+	EXPECT_NEAR(5, arrival[matrix.arrival(3, 1)], 1e-9);
+	EXPECT_EQ(0, arrival[matrix.arrival(3, 0)]);
+	EXPECT_THROW(matrix.apply(std::vector<double>(3)), std::runtime_error);
+
+	std::string filename = "testTransferMatrix.txt";
+	matrix.save(filename);
+	TransferMatrix loaded(species, 10 * Mpc, 2, 18, 19, 0.5);
+	loaded.load(filename);
+	EXPECT_DOUBLE_EQ(matrix.get(0, 1, 1, 3, 1), loaded.get(0, 1, 1, 3, 1));
+	TransferMatrix other(species, 20 * Mpc, 2, 18, 19, 0.5);
+	EXPECT_THROW(other.load(filename), std::runtime_error);
+	remove(filename.c_str());
+}
+
+TEST(PrimaryCostModel, getCost) {
+	PrimaryCostModel model(1);
+	EXPECT_THROW(model.setBatchSize(0), std::runtime_error);
+	// the energy orders the primaries without samples
+	EXPECT_GT(model.getCost(22, 10 * EeV), model.getCost(22, 1 * EeV));
+
+	model.record(11, 1.5 * EeV, 2);
+	model.record(11, 2.5 * EeV, 4);
+	model.record(22, 5 * EeV, 1);
+	EXPECT_EQ(3, model.getSamples());
+	EXPECT_DOUBLE_EQ(7. / 3, model.getMeanCost());
+	// mean of the bin
+	EXPECT_DOUBLE_EQ(3, model.getCost(11, 1.1 * EeV));
+	// closest bin of the particle, scaled with the energy
+	EXPECT_NEAR(30, model.getCost(11, 50 * EeV), 1e-9);
+	EXPECT_NEAR(0.1, model.getCost(22, 0.5 * EeV), 1e-9);
+	// mean cost per energy of all primaries
+	EXPECT_DOUBLE_EQ(7. / 9, model.getCost(12, 1 * EeV));
+
+	Candidate c(11, 2 * EeV);
+	EXPECT_DOUBLE_EQ(3, model.getCost(&c));
+	model.reset();
+	EXPECT_EQ(0, model.getSamples());
+	EXPECT_DOUBLE_EQ(0, model.getMeanCost());
+}
+
+TEST(ModuleList, costModel) {
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	modules.add(maxLength);
+	ref_ptr<PrimaryCostModel> model = new PrimaryCostModel(4, 30);
+	modules.setCostModel(model);
+	EXPECT_EQ(model.get(), modules.getCostModel());
+
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+
+	// each primary once, the same ones in all runs
+	double sum[3] = {0, 0, 0};
+	for (int run = 0; run < 3; run++) {
+		// source batches that straddle the batches of the cost model
+		modules.setSourceBatchSize(run == 2 ? 8 : 1);
+		ref_ptr<ParticleCollector> collector = new ParticleCollector();
+		maxLength->onReject(collector);
+		Random::seedStreams(42);
+		modules.run(&source, 100);
+		ASSERT_EQ(100, collector->size());
+		for (size_t i = 0; i < collector->size(); i++) {
+			EXPECT_DOUBLE_EQ(1 * Mpc, (*collector)[i]->getTrajectoryLength());
+			sum[run] += (*collector)[i]->source.getEnergy();
+		}
+	}
+	EXPECT_DOUBLE_EQ(sum[0], sum[1]);
+	EXPECT_EQ(300, model->getSamples());
+	Random::seedThreads(42);
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 20; i++)
+		candidates.push_back(new Candidate(22, (i + 1) * EeV));
+	modules.run(&candidates);
+	for (size_t i = 0; i < candidates.size(); i++)
+		EXPECT_FALSE(candidates[i]->isActive());
+	EXPECT_EQ(320, model->getSamples());
+}
+
+// records the initial positions of the primaries in the order they run
+class PositionRecorder: public Module {
+public:
+	mutable std::vector<Vector3d> positions;
+	void process(Candidate *c) const {
+#pragma omp critical(PositionRecorder)
+		positions.push_back(c->source.getPosition());
+		c->setActive(false);
+	}
+};
+
+TEST(ModuleList, localityOrder) {
+	ModuleList modules;
+	ref_ptr<PositionRecorder> recorder = new PositionRecorder();
+	modules.add(recorder);
+	ref_ptr<GridProperties> grid = new GridProperties(Vector3d(0.), 8, 1.);
+	EXPECT_THROW(modules.setLocalityOrder(grid, 0), std::runtime_error);
+	modules.setLocalityOrder(grid, 50);
+	EXPECT_EQ(grid.get(), modules.getLocalityGrid());
+	EXPECT_EQ(50, modules.getLocalityBatchSize());
+
+	Source source;
+	source.add(new SourceUniformBox(Vector3d(0.), Vector3d(16.)));
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+
+#ifdef _OPENMP
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+#endif
+	// periodic grid, the keys ascend within each batch
+	modules.run(&source, 200);
+	ASSERT_EQ(200, recorder->positions.size());
+	for (size_t i = 1; i < recorder->positions.size(); i++) {
+		if (i % 50 == 0)
+			continue;
+		const Vector3d &a = recorder->positions[i - 1];
+		const Vector3d &b = recorder->positions[i];
+		EXPECT_LE(mortonKey(int(a.x) % 8, int(a.y) % 8, int(a.z) % 8),
+				mortonKey(int(b.x) % 8, int(b.y) % 8, int(b.z) % 8));
+	}
+
+	// a reflective grid mirrors the cells of the continued grid
+	grid->reflective = true;
+	modules.setLocalityOrder(grid);
+	ModuleList::candidate_vector_t candidates;
+	candidates.push_back(new Candidate(22, EeV, Vector3d(9.5, 0.5, 0.5)));
+	candidates.push_back(new Candidate(22, EeV, Vector3d(7.5, 7.5, 7.5)));
+	candidates.push_back(new Candidate(22, EeV, Vector3d(-0.5, 0.5, 0.5)));
+	candidates.push_back(new Candidate(22, EeV, Vector3d(0.5, 0.5, 1.5)));
+	recorder->positions.clear();
+	modules.run(&candidates);
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	ASSERT_EQ(4, recorder->positions.size());
+	EXPECT_EQ(Vector3d(-0.5, 0.5, 0.5), recorder->positions[0]);
+	EXPECT_EQ(Vector3d(0.5, 0.5, 1.5), recorder->positions[1]);
+	EXPECT_EQ(Vector3d(9.5, 0.5, 0.5), recorder->positions[2]);
+	EXPECT_EQ(Vector3d(7.5, 7.5, 7.5), recorder->positions[3]);
+
+	modules.setLocalityOrder(NULL);
+	EXPECT_EQ(NULL, modules.getLocalityGrid());
+}
+
+#ifdef _OPENMP
+TEST(ModuleList, orderedOutput) {
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+
+	// random number of rows per primary, the same output for any threads
+	std::string files[3];
+	for (int run = 0; run < 3; run++) {
+		std::stringstream ss;
+		ref_ptr<TextOutput> output = new TextOutput(ss, Output::Event3D);
+		output->disable(Output::SerialNumberColumn);
+		ModuleList modules;
+		modules.add(new SimplePropagation(0.1 * Mpc, 0.1 * Mpc));
+		modules.add(new RandomDetector(output));
+		modules.add(new MaximumTrajectoryLength(1 * Mpc));
+		modules.addOrderedOutput(output);
+		if (run == 2)
+			modules.setOrderWindow(2);
+		EXPECT_THROW(modules.setOrderWindow(0), std::runtime_error);
+
+		omp_set_num_threads(run == 0 ? 1 : 4);
+		Random::seedStreams(42);
+		modules.run(&source, 200);
+		EXPECT_FALSE(output->isOrdered());
+		EXPECT_EQ(200, output->getNextPrimary());
+		output->flush();
+		files[run] = ss.str();
+	}
+	Random::seedThreads(42);
+	EXPECT_GT(files[0].size(), 1000);
+	EXPECT_EQ(files[0], files[1]);
+	EXPECT_EQ(files[0], files[2]);
+
+	ModuleList modules;
+	modules.setSecondaryTasks(true);
+	modules.addOrderedOutput(new TextOutput(Output::Event3D));
+	EXPECT_THROW(modules.run(&source, 10), std::runtime_error);
+}
+#endif
+
+class BatchCounter: public BatchModule {
+public:
+	mutable size_t count;
+	mutable double energy;
+	BatchCounter() : BatchModule(64), count(0), energy(0) {
+	}
+	void processBatch(const CandidateBatch &batch) const {
+		count += batch.size();
+		for (size_t i = 0; i < batch.size(); i++)
+			energy += batch.getRecord(i).energy;
+	}
+};
+
+TEST(BatchModule, run) {
+	ModuleList modules;
+	modules.add(new SimplePropagation(0.25 * Mpc, 0.25 * Mpc));
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	ref_ptr<BatchCounter> counter = new BatchCounter();
+	modules.add(counter);
+
+	ModuleList::candidate_vector_t candidates;
+	for (int i = 0; i < 1000; i++)
+		candidates.push_back(new Candidate(22, 1 * EeV));
+	modules.run(&candidates);
+	counter->flush();
+
+	// each candidate passes the module in its four steps
+	size_t records = 4000;
+	EXPECT_EQ(records, counter->count);
+	EXPECT_NEAR(records * EeV, counter->energy, 1e-9 * records * EeV);
+	EXPECT_GE(counter->getNumberOfBatches(), records / 64);
+	counter->flush();
+	EXPECT_EQ(records, counter->count);
+}
+
+TEST(SimulationConfig, run) {
+	std::string filename = "testSimulationConfig.txt";
+	std::stringstream config;
+	config << "{\"simulation\": {\"count\": 20, \"seed\": 5},\n"
+			<< " \"fields\": {\"B\": {\"type\": \"UniformMagneticField\", \"value\": [0, 0, \"1 nG\"]}},\n"
+			<< " \"outputs\": {\"events\": {\"type\": \"TextOutput\", \"file\": \"" << filename
+			<< "\", \"columns\": \"Event3D\", \"disable\": [\"SerialNumberColumn\"]}},\n"
+			<< " \"source\": [{\"type\": \"SourceParticleType\", \"id\": 22},\n"
+			<< "   {\"type\": \"SourceEnergy\", \"energy\": \"1 EeV\"},\n"
+			<< "   {\"type\": \"SourceIsotropicEmission\"}],\n"
+			<< " \"modules\": [{\"type\": \"PropagationCK\", \"field\": \"B\", \"maxStep\": \"10 kpc\"},\n"
+			<< "   {\"type\": \"MaximumTrajectoryLength\", \"length\": \"100 kpc\", \"onReject\": \"events\"}]}";
+	ref_ptr<SimulationConfig> simulation = new SimulationConfig(ConfigValue::parse(config.str()));
+	EXPECT_EQ(20, simulation->getCount());
+	EXPECT_FALSE(simulation->isDistributed());
+	EXPECT_EQ(2, simulation->getModuleList()->size());
+	simulation->run();
+
+	// every primary is written once the outputs are closed
+	std::ifstream in(filename.c_str());
+	std::string line;
+	size_t rows = 0;
+	while (std::getline(in, line))
+		if (not line.empty() and line[0] != '#')
+			rows++;
+	EXPECT_EQ(20, rows);
+	remove(filename.c_str());
+}
+
+TEST(SimulationConfig, rebuild) {
+	// a grid mapped from its file and a simulation rebuilt from its text
+	std::string filename = "testSimulationConfig.grid";
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1 * kpc);
+	for (size_t i = 0; i < 4 * 4 * 4; i++)
+		grid->getGrid()[i] = Vector3f(0, 0, 2 * nG);
+	dumpMappedGrid(grid, filename, nG, "nG");
+	std::stringstream config;
+	config << "{\"simulation\": {\"count\": 1},\n"
+			<< " \"fields\": {\"B\": {\"type\": \"MagneticFieldGrid\", \"file\": \"" << filename << "\"}},\n"
+			<< " \"source\": [{\"type\": \"SourceEnergy\", \"energy\": \"1 EeV\"}],\n"
+			<< " \"modules\": [{\"type\": \"PropagationCK\", \"field\": \"B\"},\n"
+			<< "   {\"type\": \"MaximumTrajectoryLength\", \"length\": \"100 kpc\"}]}";
+	ref_ptr<SimulationConfig> simulation = new SimulationConfig(ConfigValue::parse(config.str()));
+	ref_ptr<SimulationConfig> rebuilt = new SimulationConfig(
+			ConfigValue::parse(simulation->getConfig().toJSON()));
+	EXPECT_EQ(simulation->getConfig().toJSON(), rebuilt->getConfig().toJSON());
+	EXPECT_EQ(2, rebuilt->getModuleList()->size());
+	ref_ptr<MagneticField> field = rebuilt->getField(ConfigValue::parse("\"B\""));
+	EXPECT_NEAR(2 * nG, field->getField(Vector3d(1.5 * kpc)).z, 1e-6 * nG);
+	remove(filename.c_str());
+}
+
+TEST(SimulationConfig, unknownTypes) {
+	ConfigValue module = ConfigValue::parse(
+			"{\"simulation\": {\"count\": 1}, \"source\": [], \"modules\": [{\"type\": \"Foo\"}]}");
+	EXPECT_THROW(SimulationConfig simulation(module), std::runtime_error);
+	ConfigValue field = ConfigValue::parse(
+			"{\"simulation\": {\"count\": 1}, \"source\": [],"
+			" \"modules\": [{\"type\": \"PropagationCK\", \"field\": \"B\"}]}");
+	EXPECT_THROW(SimulationConfig simulation(field), std::runtime_error);
+	std::vector<std::string> types = SimulationConfig::getTypes("modules");
+	EXPECT_NE(types.end(), std::find(types.begin(), types.end(), "Observer"));
+}
 
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
@@ -2,12 +2,18 @@
     Output
     TextOutput
     ParticleCollector
+    CandidateStreamOutput
+    OutputTable
  */
 
 #include "CRPropa.h"
 
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 
@@ -15,6 +21,14 @@
 #include <hdf5.h>
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef WITH_GALACTIC_LENSES
+#include "crpropa/magneticLens/Pixelization.h"
+#endif
+
 // compare two arrays (intead of using Google Mock)
 // https://stackoverflow.com/a/10062016/6819103
 template <typename T, size_t size>
@@ -56,6 +70,21 @@ TEST(TextOutput, printHeader_Trajectory1D) {
 	EXPECT_EQ(captured.substr(0, captured.find("\n")), "#\tID\tE\tX");
 }
 
+TEST(TextOutput, stateRetention) {
+	Candidate::setStateRetention(Candidate::RetainNone);
+	Candidate c(22, 1 * EeV);
+	Candidate::setStateRetention(Candidate::RetainAll);
+
+	// Event1D writes ID0 and E0 of the source state
+	TextOutput output(Output::Event1D);
+	::testing::internal::CaptureStdout();
+	EXPECT_THROW(output.process(&c), std::runtime_error);
+	output.disable(Output::SourceIdColumn);
+	output.disable(Output::SourceEnergyColumn);
+	output.process(&c);
+	testing::internal::GetCapturedStdout();
+}
+
 TEST(TextOutput, printHeader_Event1D) {
 	Candidate c;
 	TextOutput output(Output::Event1D);
@@ -138,12 +167,308 @@ TEST(TextOutput, printHeader_Version) {
 	          g_GIT_DESC);
 }
 
+TEST(TextOutput, asynchronous) {
+	Candidate c(22, 1 * EeV);
+	std::stringstream syncStream, asyncStream;
+	TextOutput syncOutput(syncStream, Output::Event1D);
+	TextOutput asyncOutput(asyncStream, Output::Event1D);
+	asyncOutput.setAsynchronous(true, 2);
+	EXPECT_TRUE(asyncOutput.isAsynchronous());
+
+	for (int i = 0; i < 5000; i++) {
+		syncOutput.process(&c);
+		asyncOutput.process(&c);
+	}
+	syncOutput.close();
+	asyncOutput.close();
+
+	EXPECT_EQ(asyncOutput.size(), 5000);
+	EXPECT_EQ(syncStream.str(), asyncStream.str());
+}
+
+TEST(TextOutput, numberFormat) {
+	// the columns match printf, including values close to rounding ties
+	double values[] = {0., -0., 1., -1., 0.5, 1.000005, 9.999995, 9.9999951,
+			123456.5, 1e-300, 4.9e-324, 1.7976931348623157e308, -2.5e-7, 1e100};
+	std::vector<double> weights(values, values + sizeof(values) / sizeof(double));
+	Random random(42);
+	for (int i = 0; i < 10000; i++)
+		weights.push_back(std::pow(10, random.randUniform(-30, 30)) * (i % 2 ? 1 : -1));
+
+	std::stringstream stream, expected;
+	TextOutput output(stream);
+	output.disableAll();
+	output.enable(Output::CurrentIdColumn);
+	output.enable(Output::WeightColumn);
+	Candidate c(-11);
+	for (size_t i = 0; i < weights.size(); i++) {
+		c.setWeight(weights[i]);
+		output.process(&c);
+		char buffer[64];
+		std::sprintf(buffer, "%10i\t%8.5E\n", -11, weights[i]);
+		expected << buffer;
+	}
+	output.close();
+
+	std::string line, lines;
+	while (std::getline(stream, line))
+		if (line[0] != '#')
+			lines += line + "\n";
+	EXPECT_EQ(lines, expected.str());
+}
+
+TEST(TextOutput, threadBuffers) {
+	std::stringstream stream;
+	TextOutput output(stream, Output::Event1D);
+	const int n = 10000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Candidate c(22, 1 * EeV);
+		output.process(&c);
+	}
+	EXPECT_EQ(output.size(), n);
+	output.close();
+
+	// complete lines after the header
+	std::string line;
+	int lines = 0;
+	bool header = true;
+	while (std::getline(stream, line)) {
+		if (header and line[0] == '#')
+			continue;
+		header = false;
+		EXPECT_EQ(std::count(line.begin(), line.end(), '\t'), 5);
+		lines++;
+	}
+	EXPECT_EQ(lines, n);
+}
+
+TEST(TextOutput, endRun) {
+	// the lines of the threads are in the stream when the run returns
+	std::stringstream stream;
+	ref_ptr<TextOutput> output = new TextOutput(stream, Output::Event1D);
+	ModuleList modules;
+	modules.add(new SimplePropagation());
+	ref_ptr<MaximumTrajectoryLength> maxLength = new MaximumTrajectoryLength(1 * Mpc);
+	maxLength->onReject(output);
+	modules.add(maxLength);
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+#ifdef _OPENMP
+	int threads = omp_get_max_threads();
+	omp_set_num_threads(4);
+#endif
+	modules.run(&source, 100);
+#ifdef _OPENMP
+	omp_set_num_threads(threads);
+#endif
+
+	std::string line;
+	int lines = 0;
+	while (std::getline(stream, line))
+		if (line[0] != '#')
+			lines++;
+	EXPECT_EQ(100, lines);
+}
+
+TEST(TextOutput, shards) {
+	EXPECT_EQ("out.t3.txt.gz", Output::shardFilename("out.txt.gz", 3));
+	EXPECT_EQ("dir.d/out.t0", Output::shardFilename("dir.d/out", 0));
+	EXPECT_EQ(".out.t1", Output::shardFilename(".out", 1));
+
+	std::string filename = "testTextOutput_shards.txt";
+	ref_ptr<TextOutput> output = new TextOutput(filename, Output::Event1D);
+	output->setSharded(true);
+	EXPECT_TRUE(output->isSharded());
+	EXPECT_THROW(output->beginOrder(0), std::runtime_error);
+	const int n = 10000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Candidate c(22, 1 * EeV);
+		output->process(&c);
+	}
+	EXPECT_EQ(output->size(), n);
+	std::string name;
+	EXPECT_THROW(output->checkpoint(name), std::runtime_error);
+	output->close();
+	EXPECT_EQ(output->size(), n);
+
+	std::string merged = "testTextOutput_shards_merged.txt";
+	EXPECT_EQ(n, TextOutput::mergeShards(filename, merged, true));
+	EXPECT_FALSE(std::ifstream(filename.c_str()).good());
+	EXPECT_FALSE(std::ifstream(Output::shardFilename(filename, 0).c_str()).good());
+
+	// one header, then complete lines
+	std::ifstream in(merged.c_str());
+	std::string line;
+	int lines = 0, headers = 0;
+	while (std::getline(in, line)) {
+		if (line.compare(0, 3, "#\tD") == 0)
+			headers++;
+		if (line[0] == '#')
+			continue;
+		EXPECT_EQ(std::count(line.begin(), line.end(), '\t'), 5);
+		lines++;
+	}
+	EXPECT_EQ(headers, 1);
+	EXPECT_EQ(lines, n);
+	in.close();
+	remove(merged.c_str());
+}
+
 TEST(TextOutput, failOnIllegalOutputFile) {
 	EXPECT_THROW(
 	    TextOutput output("THIS_FOLDER_MUST_NOT_EXISTS_12345+/FILE.txt"),
 	    std::runtime_error);
 }
 
+TEST(HistogramOutput, bins) {
+	HistogramOutput output;
+	output.addAxis(HistogramOutput::Energy, 4, 1 * EeV, 1e4 * EeV, true);
+	std::vector<int> ids;
+	ids.push_back(22);
+	ids.push_back(11);
+	output.addIdAxis(ids);
+	EXPECT_EQ(output.getNumberOfBins(), 8);
+
+	Candidate c(11, 20 * EeV);
+	c.setWeight(2);
+	output.process(&c); // bin 1 x 1
+	c.current.setId(22);
+	output.process(&c); // bin 1 x 0
+	c.current.setEnergy(0.5 * EeV);
+	output.process(&c); // out of energy range
+	c.current.setEnergy(5000 * EeV);
+	c.current.setId(-11);
+	output.process(&c); // id not binned
+	EXPECT_EQ(output.size(), 4);
+	EXPECT_DOUBLE_EQ(output.getOutOfRange(), 4);
+	EXPECT_THROW(output.addAxis(HistogramOutput::Redshift, 2, 0, 1), std::runtime_error);
+
+	std::vector<double> w = output.getWeights();
+	std::vector<double> w2 = output.getSquaredWeights();
+	EXPECT_DOUBLE_EQ(w[2], 2);
+	EXPECT_DOUBLE_EQ(w[3], 2);
+	EXPECT_DOUBLE_EQ(w2[3], 4);
+	double sum = 0;
+	for (size_t i = 0; i < w.size(); i++)
+		sum += w[i];
+	EXPECT_DOUBLE_EQ(sum, 4);
+}
+
+TEST(SpectralReweighting, hypotheses) {
+	// flat injection in log(E), reweighted to E^-2 with and without cutoff
+	ref_ptr<SpectralModel> injection = new SpectralModel(1 * EeV, 100 * EeV, -1);
+	injection->add(22);
+	ref_ptr<SpectralModel> soft = new SpectralModel(1 * EeV, 100 * EeV, -2);
+	soft->add(22);
+	ref_ptr<SpectralModel> cut = new SpectralModel(1 * EeV, 100 * EeV, -2, 10 * EeV);
+	cut->add(22);
+	EXPECT_NEAR(soft->getDensity(22, 1 * EeV), 1 / (0.99 * EeV), 1e-6 / EeV);
+	EXPECT_DOUBLE_EQ(soft->getDensity(11, 1 * EeV), 0);
+	EXPECT_DOUBLE_EQ(soft->getDensity(22, 200 * EeV), 0);
+
+	ref_ptr<SpectralReweighting> reweighting = new SpectralReweighting(injection);
+	reweighting->addHypothesis("soft", soft);
+	reweighting->addHypothesis("cut", cut);
+	EXPECT_THROW(reweighting->addHypothesis("soft", cut), std::runtime_error);
+
+	// the weighted energy distribution follows the models
+	Random random(42);
+	size_t n = 100000;
+	double sumSoft = 0, sumCut = 0, highSoft = 0;
+	std::vector<double> w;
+	for (size_t i = 0; i < n; i++) {
+		Candidate c(22, random.randPowerLaw(-1, 1 * EeV, 100 * EeV));
+		reweighting->getWeights(&c, w);
+		sumSoft += w[0];
+		sumCut += w[1];
+		if (c.source.getEnergy() > 10 * EeV)
+			highSoft += w[0];
+	}
+	EXPECT_NEAR(sumSoft / n, 1, 0.01);
+	EXPECT_NEAR(sumCut / n, 1, 0.01);
+	EXPECT_NEAR(highSoft / n, (0.1 - 0.01) / 0.99, 0.005);
+
+	// weights as candidate properties
+	Candidate c(22, 10 * EeV);
+	c.setWeight(2);
+	reweighting->process(&c);
+	EXPECT_NEAR(c.getProperty("weight_soft").asDouble(), 2. / 10 * log(100) / 0.99, 1e-9);
+
+	// one histogram per hypothesis
+	HistogramOutput output;
+	output.addHypothesisAxis(reweighting);
+	output.addAxis(HistogramOutput::Energy, 2, 1 * EeV, 100 * EeV, true);
+	output.process(&c);
+	std::vector<double> bins = output.getWeights();
+	ASSERT_EQ(bins.size(), 4);
+	EXPECT_DOUBLE_EQ(bins[1], c.getProperty("weight_soft").asDouble());
+	EXPECT_DOUBLE_EQ(bins[3], c.getProperty("weight_cut").asDouble());
+	EXPECT_THROW(output.addHypothesisAxis(reweighting), std::runtime_error);
+}
+
+TEST(HistogramOutput, threadBuffers) {
+	HistogramOutput output;
+	output.addAxis(HistogramOutput::TrajectoryLength, 10, 0, 10 * Mpc);
+	const int n = 10000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Candidate c(22, 1 * EeV);
+		c.setTrajectoryLength((i % 10 + 0.5) * Mpc);
+		output.process(&c);
+	}
+	std::vector<double> w = output.getWeights();
+	for (size_t i = 0; i < w.size(); i++)
+		EXPECT_DOUBLE_EQ(w[i], n / 10);
+}
+
+TEST(HistogramOutput, save) {
+	std::string filename = "testHistogramOutput.txt";
+	{
+		HistogramOutput output(filename);
+		std::vector<int> edges;
+		edges.push_back(0);
+		edges.push_back(1);
+		edges.push_back(57);
+		output.addMassGroupAxis(edges);
+		output.addAxis(HistogramOutput::Redshift, 2, 0, 1);
+		Candidate c(22, 1 * EeV);
+		c.setRedshift(0.7);
+		output.process(&c); // bin 0 x 1
+		output.process(&c);
+	}
+
+	std::ifstream in(filename.c_str());
+	std::string line;
+	std::vector<std::string> rows;
+	while (std::getline(in, line))
+		if (line[0] != '#')
+			rows.push_back(line);
+	in.close();
+	ASSERT_EQ(rows.size(), 1);
+	EXPECT_EQ(rows[0], "0 1 2 2");
+	remove(filename.c_str());
+}
+
+#ifdef WITH_GALACTIC_LENSES
+TEST(HistogramOutput, pixelAxis) {
+	HistogramOutput output;
+	output.addPixelAxis(4);
+	EXPECT_EQ(output.getNumberOfBins(), 12 * 256);
+	Candidate c(22, 1 * EeV);
+	c.current.setDirection(Vector3d(-1, 0, 0)); // from the galactic center
+	size_t bin;
+	EXPECT_TRUE(output.getBin(&c, bin));
+	Pixelization pixelization(4);
+	EXPECT_EQ(bin, pixelization.direction2Pix(0, 0));
+}
+#endif
+
 #ifdef CRPROPA_HAVE_HDF5
 TEST(HDF5Output, failOnIllegalOutputFile) {
 	HDF5Output out;
@@ -152,6 +477,436 @@ TEST(HDF5Output, failOnIllegalOutputFile) {
 	EXPECT_THROW(out.open("THIS_FOLDER_MUST_NOT_EXISTS_12345+/FILE.h5"),
 	             std::runtime_error);
 }
+
+TEST(HDF5Output, threadBuffers) {
+	std::string filename = "testHDF5Output_threadBuffers.h5";
+	ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event1D);
+	const int n = 1000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+		out->process(c);
+	}
+	EXPECT_EQ(out->size(), n);
+	out->close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), n);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+}
+
+TEST(HDF5Output, asynchronous) {
+	std::string filename = "testHDF5Output_asynchronous.h5";
+	ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event1D);
+	out->setAsynchronous(true);
+	out->setFlushLimit(10);
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	for (int i = 0; i < 100; i++)
+		out->process(c);
+	out->close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), 100);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+}
+
+TEST(HDF5Output, chunkingAndCompression) {
+	std::string filename = "testHDF5Output_chunking.h5";
+	ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event1D);
+	out->setChunkSize(64);
+	out->setCompression(HDF5Output::NoCompression);
+	out->setSyncInterval(3600);
+	out->setFlushLimit(10);
+	EXPECT_THROW(out->setChunkSize(0), std::runtime_error);
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	for (int i = 0; i < 100; i++)
+		out->process(c);
+	out->close();
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), 100);
+	hid_t plist = H5Dget_create_plist(dset);
+	hsize_t chunk = 0;
+	H5Pget_chunk(plist, 1, &chunk);
+	EXPECT_EQ(chunk, 64);
+	EXPECT_EQ(H5Pget_nfilters(plist), 0);
+	H5Pclose(plist);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+}
+
+TEST(HDF5Output, seeds) {
+	std::string filename = "testHDF5Output_seeds.h5";
+	Random::seedThreads(42);
+	std::vector<std::vector<uint32_t> > seeds = Random::getSeedThreads();
+	ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event1D);
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	out->process(c);
+	out->close();
+
+	// one attribute of the 32 bit seeds per thread
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	for (size_t i = 0; i < seeds.size(); i++) {
+		char name[256];
+		sprintf(name, "SEED_%03lu", i);
+		hid_t attr = H5Aopen(dset, name, H5P_DEFAULT);
+		ASSERT_GE(attr, 0);
+		hid_t type = H5Aget_type(attr);
+		EXPECT_EQ(H5Tget_size(type), seeds[i].size() * sizeof(uint32_t));
+		std::vector<uint32_t> values(seeds[i].size());
+		hsize_t dims[] = {1, seeds[i].size()};
+		hid_t memtype = H5Tarray_create(H5T_NATIVE_UINT32, 2, dims);
+		EXPECT_GE(H5Aread(attr, memtype, &values[0]), 0);
+		EXPECT_EQ(seeds[i], values);
+		H5Tclose(memtype);
+		H5Tclose(type);
+		H5Aclose(attr);
+	}
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+}
+
+TEST(HDF5Output, mergeShards) {
+	std::string filename = "testHDF5Output_merge.h5";
+	std::string shard = DistributedModuleList::shardFilename(filename);
+	ref_ptr<HDF5Output> out = new HDF5Output(shard, Output::Event1D);
+	ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+	for (int i = 0; i < 42; i++)
+		out->process(c);
+	out->close();
+
+	DistributedModuleList::mergeHDF5Shards(filename);
+	EXPECT_FALSE(std::ifstream(shard.c_str()).good());
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), 42);
+	EXPECT_GT(H5Aexists(dset, "OutputType"), 0);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+}
+
+// renumber the tags of a file as if written by another process
+static void renumberTags(const std::string &filename) {
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	std::vector<std::string> names = HDF5Output::getTagNames(dset);
+	std::vector<std::string> renumbered(names.size());
+	std::vector<uint32_t> codes(names.size());
+	for (size_t i = 0; i < names.size(); i++) {
+		codes[i] = (i + 1) % names.size();
+		renumbered[codes[i]] = names[i];
+	}
+	hid_t type = H5Dget_type(dset);
+	hid_t space = H5Dget_space(dset);
+	size_t n = H5Sget_simple_extent_npoints(space);
+	std::vector<char> rows(H5Tget_size(type) * n);
+	H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &rows[0]);
+	HDF5Output::mapTagCodes(type, &rows[0], n, codes);
+	H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &rows[0]);
+	HDF5Output::setTagNames(dset, renumbered);
+	H5Sclose(space);
+	H5Tclose(type);
+	H5Dclose(dset);
+	H5Fclose(file);
+}
+
+TEST(HDF5Output, concatenateTags) {
+	// the second file has other codes for the tags
+	std::string files[2] = {"testHDF5Output_tagsA.h5", "testHDF5Output_tagsB.h5"};
+	std::string tags[2] = {"CONCAT_A", "CONCAT_B"};
+	for (int f = 0; f < 2; f++) {
+		ref_ptr<HDF5Output> out = new HDF5Output(files[f], Output::Event1D);
+		out->enable(Output::CandidateTagColumn);
+		Candidate c(22, 1 * EeV);
+		c.setTagOrigin(tags[f]);
+		for (int i = 0; i < 10; i++)
+			out->process(&c);
+		out->close();
+	}
+	renumberTags(files[1]);
+
+	std::string merged = "testHDF5Output_tags.h5";
+	EXPECT_EQ(20, HDF5Output::concatenate(std::vector<std::string>(files, files + 2), merged));
+	ref_ptr<OutputTable> table = OutputTable::readHDF5(merged);
+	ASSERT_EQ(20, table->getNumberOfRows());
+	for (int i = 0; i < 20; i++)
+		EXPECT_EQ(Candidate::getTagCode(tags[i / 10]), table->get("tag", i));
+	remove(files[0].c_str());
+	remove(files[1].c_str());
+	remove(merged.c_str());
+}
+
+TEST(HDF5Output, shards) {
+	std::string filename = "testHDF5Output_shards.h5";
+	ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event1D);
+	out->setSharded(true);
+	const int n = 1000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+		out->process(c);
+	}
+	EXPECT_EQ(out->size(), n);
+	out->close();
+
+	// the virtual dataset reads the rows of all shards
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), n);
+	EXPECT_GT(H5Aexists(dset, "OutputType"), 0);
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(int32_t));
+	H5Tinsert(type, "ID", 0, H5T_NATIVE_INT32);
+	std::vector<int32_t> ids(n);
+	EXPECT_GE(H5Dread(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &ids[0]), 0);
+	EXPECT_EQ(std::count(ids.begin(), ids.end(), 22), n);
+	H5Tclose(type);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+
+	std::string merged = "testHDF5Output_shards_merged.h5";
+	EXPECT_EQ(n, HDF5Output::mergeShards(filename, merged, true));
+	EXPECT_FALSE(std::ifstream(filename.c_str()).good());
+	file = H5Fopen(merged.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), n);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(merged.c_str());
+}
+#endif
+
+#ifdef CRPROPA_HAVE_PARQUET
+TEST(ParquetOutput, threadBuffers) {
+	std::string filename = "testParquetOutput_threadBuffers.parquet";
+	ref_ptr<ParquetOutput> out = new ParquetOutput(filename, Output::Event3D);
+	out->enableProperty("Value", Variant::fromDouble(0.5));
+	const int n = 1000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+		out->process(c);
+	}
+	EXPECT_EQ(out->size(), n);
+	std::string name;
+	EXPECT_EQ(out->checkpoint(name), n);
+	EXPECT_EQ(filename, name);
+	out->close();
+
+	// Parquet files begin and end with the magic PAR1
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char head[4], tail[4];
+	in.read(head, 4);
+	in.seekg(-4, std::ios::end);
+	in.read(tail, 4);
+	EXPECT_EQ("PAR1", std::string(head, 4));
+	EXPECT_EQ("PAR1", std::string(tail, 4));
+	in.close();
+	remove(filename.c_str());
+}
+#endif
+
+//-- Checkpoint
+static void runCheckpointed(Output *output, Checkpoint *checkpoint, size_t count) {
+	ModuleList sim;
+	sim.add(new SimplePropagation());
+	sim.add(new MaximumTrajectoryLength(1 * Mpc));
+	sim.add(output);
+	sim.setCheckpoint(checkpoint);
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+	sim.run(&source, count);
+}
+
+// keeps a copy of the checkpoint file once it has reached the given primary
+class CopyCheckpoint: public Module {
+	std::string filename, copyname, next;
+	mutable bool copied;
+public:
+	CopyCheckpoint(const std::string &filename, const std::string &copyname,
+			size_t nextPrimary) : filename(filename), copyname(copyname),
+			copied(false) {
+		std::stringstream ss;
+		ss << "next " << nextPrimary << "\n";
+		next = ss.str();
+	}
+	void process(Candidate *candidate) const {
+#pragma omp critical(CopyCheckpoint)
+		if (not copied) {
+			std::ifstream in(filename.c_str());
+			std::stringstream content;
+			content << in.rdbuf();
+			if (content.str().find(next) != std::string::npos) {
+				std::ofstream out(copyname.c_str());
+				out << content.str();
+				copied = true;
+			}
+		}
+	}
+};
+
+// a run of count primaries that is killed after the checkpoint of the given
+// primary: the run is completed and the checkpoint replaced by that one
+static void runInterrupted(Output *output, Checkpoint *checkpoint,
+		const std::string &checkpointname, size_t count, size_t nextPrimary) {
+	std::string copyname = checkpointname + ".copy";
+	ModuleList sim;
+	sim.add(new SimplePropagation());
+	sim.add(new MaximumTrajectoryLength(1 * Mpc));
+	sim.add(output);
+	sim.add(new CopyCheckpoint(checkpointname, copyname, nextPrimary));
+	sim.setCheckpoint(checkpoint);
+	Source source;
+	source.add(new SourceIsotropicEmission());
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+	sim.run(&source, count);
+	rename(copyname.c_str(), checkpointname.c_str());
+}
+
+static std::vector<std::string> sortedLines(const std::string &filename) {
+	std::ifstream in(filename.c_str());
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(in, line))
+		lines.push_back(line);
+	std::sort(lines.begin(), lines.end());
+	return lines;
+}
+
+TEST(Checkpoint, restartTextOutput) {
+	std::string filename = "testCheckpoint.txt";
+	std::string checkpointname = "testCheckpoint.chk";
+	remove(checkpointname.c_str());
+	remove("testCheckpoint_reference.chk");
+	Random::seedStreams(7);
+
+	// reference run without interruption
+	{
+		ref_ptr<TextOutput> out = new TextOutput("testCheckpoint_reference.txt", Output::Event3D);
+		out->disable(Output::SerialNumberColumn);
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint("testCheckpoint_reference.chk", 10);
+		runCheckpointed(out, checkpoint, 30);
+	}
+
+	// run stopped after the checkpoint of 20 primaries, with data after it
+	{
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint(checkpointname, 10);
+		EXPECT_FALSE(checkpoint->isRestart());
+		ref_ptr<TextOutput> out = new TextOutput(filename, Output::Event3D);
+		out->disable(Output::SerialNumberColumn);
+		checkpoint->add(out);
+		runInterrupted(out, checkpoint, checkpointname, 30, 20);
+		out->close();
+		std::ofstream garbage(filename.c_str(), std::ios::app);
+		garbage << "incomplete\n";
+	}
+
+	// restart
+	{
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint(checkpointname, 10);
+		EXPECT_TRUE(checkpoint->isRestart());
+		EXPECT_EQ(20, checkpoint->getNextPrimary());
+		EXPECT_EQ(7, checkpoint->getSeed());
+		ref_ptr<TextOutput> out = new TextOutput(filename, Output::Event3D);
+		out->disable(Output::SerialNumberColumn);
+		checkpoint->add(out);
+		runCheckpointed(out, checkpoint, 30);
+		EXPECT_EQ(60, out->size());
+	}
+
+	EXPECT_EQ(sortedLines("testCheckpoint_reference.txt"), sortedLines(filename));
+
+	// running the completed script again starts a new run
+	{
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint(checkpointname, 10);
+		EXPECT_FALSE(checkpoint->isRestart());
+		EXPECT_EQ(0, checkpoint->getNextPrimary());
+		ref_ptr<TextOutput> out = new TextOutput(filename, Output::Event3D);
+		checkpoint->add(out);
+		runCheckpointed(out, checkpoint, 5);
+		EXPECT_EQ(10, out->size());
+	}
+
+	remove(filename.c_str());
+	remove(checkpointname.c_str());
+	remove("testCheckpoint_reference.txt");
+	remove("testCheckpoint_reference.chk");
+	Random::seedThreads(42);
+}
+
+TEST(Checkpoint, unsupportedOutput) {
+	std::stringstream stream;
+	ref_ptr<TextOutput> out = new TextOutput(stream);
+	Checkpoint checkpoint("testCheckpoint_unsupported.chk");
+	EXPECT_THROW(checkpoint.add(out), std::runtime_error);
+}
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(Checkpoint, restartHDF5Output) {
+	std::string filename = "testCheckpoint.h5";
+	std::string checkpointname = "testCheckpoint_h5.chk";
+	remove(checkpointname.c_str());
+	{
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint(checkpointname, 10);
+		ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event3D);
+		checkpoint->add(out);
+		runInterrupted(out, checkpoint, checkpointname, 30, 20);
+	}
+	// the resumed file keeps the codes of the interrupted process
+	renumberTags(filename);
+	{
+		ref_ptr<Checkpoint> checkpoint = new Checkpoint(checkpointname, 10);
+		EXPECT_TRUE(checkpoint->isRestart());
+		ref_ptr<HDF5Output> out = new HDF5Output(filename, Output::Event3D);
+		checkpoint->add(out);
+		runCheckpointed(out, checkpoint, 30);
+	}
+
+	ref_ptr<OutputTable> table = OutputTable::readHDF5(filename);
+	ASSERT_EQ(60, table->getNumberOfRows());
+	for (int i = 0; i < 60; i++)
+		EXPECT_EQ("PRIM", Candidate::getTagName(table->get("tag", i)));
+
+	hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dset = H5Dopen2(file, "CRPROPA3", H5P_DEFAULT);
+	hid_t space = H5Dget_space(dset);
+	EXPECT_EQ(H5Sget_simple_extent_npoints(space), 60);
+	H5Sclose(space);
+	H5Dclose(dset);
+	H5Fclose(file);
+	remove(filename.c_str());
+	remove(checkpointname.c_str());
+	Random::seedThreads(42);
+}
 #endif
 
 //-- ParticleCollector
@@ -250,6 +1005,92 @@ TEST(ParticleCollector, getTrajectory) {
 	EXPECT_TRUE(ArraysMatch(pos_x_expected, pos_x));
 }
 
+TEST(ParticleCollector, threadContainers) {
+	ParticleCollector collector;
+	const int n = 1000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		ref_ptr<Candidate> c = new Candidate(22, 1 * EeV);
+		collector.process(c);
+	}
+	EXPECT_EQ(collector.size(), n);
+	size_t count = 0;
+	for (ParticleCollector::iterator itr = collector.begin(); itr != collector.end(); ++itr)
+		count++;
+	EXPECT_EQ(count, n);
+}
+
+TEST(ParticleCollector, compactSpill) {
+	std::string filename = "ParticleCollector_spill.bin";
+	ParticleCollector collector;
+	collector.setMemoryLimit(100, filename);
+	EXPECT_TRUE(collector.isCompact());
+	const int n = 10000;
+
+	#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		Candidate c(11, (i + 1) * GeV, Vector3d(i, 0, 0));
+		c.setWeight(2);
+		collector.process(&c);
+	}
+	EXPECT_EQ(collector.size(), n);
+	EXPECT_GT(collector.getSpilled(), 0);
+	EXPECT_LE(collector.size() - collector.getSpilled(), 100);
+
+	// all records are streamed back
+	ParticleCollector output;
+	collector.reprocess(&output);
+	ASSERT_EQ(output.size(), n);
+	double sum = 0;
+	for (size_t i = 0; i < output.size(); i++) {
+		EXPECT_EQ(output[i]->current.getId(), 11);
+		EXPECT_EQ(output[i]->getWeight(), 2);
+		EXPECT_DOUBLE_EQ(output[i]->current.getEnergy(),
+				(output[i]->current.getPosition().x + 1) * GeV);
+		sum += output[i]->current.getPosition().x;
+	}
+	EXPECT_DOUBLE_EQ(sum, n * (n - 1) / 2.);
+
+	collector.clearContainer();
+	EXPECT_EQ(collector.size(), 0);
+	EXPECT_FALSE(std::ifstream(filename.c_str()).good());
+}
+
+TEST(ParticleCollector, columns) {
+	ParticleCollector collector;
+	ParticleCollector compact;
+	compact.setMemoryLimit(10, "ParticleCollector_columns.bin");
+	for (int i = 0; i < 50; i++) {
+		ref_ptr<Candidate> c = new Candidate(11, (i + 1) * GeV, Vector3d(i, 0, 0));
+		c->setWeight(i);
+		collector.process(c);
+		compact.process(c);
+	}
+
+	ParticleCollector::Columns columns;
+	collector.getColumns(columns);
+	ASSERT_EQ(50, columns.size());
+	for (size_t i = 0; i < 50; i++) {
+		EXPECT_EQ(11, columns.id[i]);
+		EXPECT_DOUBLE_EQ((i + 1) * GeV, columns.energy[i]);
+		EXPECT_DOUBLE_EQ(i, columns.x[i]);
+		EXPECT_DOUBLE_EQ(i, columns.weight[i]);
+		EXPECT_DOUBLE_EQ(-1, columns.px[i]);
+	}
+
+	// compact records including the spilled ones, in any order
+	compact.getColumns(columns);
+	ASSERT_EQ(50, columns.size());
+	double sum = 0;
+	for (size_t i = 0; i < 50; i++) {
+		EXPECT_DOUBLE_EQ(columns.x[i], columns.weight[i]);
+		sum += columns.x[i];
+	}
+	EXPECT_DOUBLE_EQ(49 * 50 / 2., sum);
+	compact.clearContainer();
+}
+
 TEST(ParticleCollector, runModuleList) {
 	ModuleList modules;
 	modules.add(new SimplePropagation());
@@ -269,6 +1110,257 @@ TEST(ParticleCollector, runModuleList) {
 	modules.run(&candidates);
 }
 
+TEST(TrajectoryRecorder, replay) {
+	std::string filename = "TrajectoryRecorder_replay.bin";
+	ModuleList modules;
+	modules.add(new SimplePropagation(0.1 * Mpc, 0.1 * Mpc));
+	modules.add(new MaximumTrajectoryLength(1 * Mpc));
+	ref_ptr<TrajectoryRecorder> recorder = new TrajectoryRecorder(filename);
+	modules.add(recorder);
+
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	source.add(new SourceDirection(Vector3d(1, 0, 0)));
+	modules.run(&source, 10);
+	EXPECT_EQ(10, recorder->getCount());
+	recorder->close();
+
+	// a plane on the way of all trajectories, and one behind them
+	for (int i = 0; i < 2; i++) {
+		double x = (i == 0) ? 0.55 * Mpc : 2 * Mpc;
+		Observer observer;
+		observer.add(new ObserverSurface(new Plane(Vector3d(x, 0, 0), Vector3d(1, 0, 0))));
+		ref_ptr<ParticleCollector> detected = new ParticleCollector();
+		observer.onDetection(detected);
+		TrajectoryReplay replay(filename);
+		EXPECT_EQ(10, replay.run(&observer));
+		ASSERT_EQ((i == 0) ? 10 : 0, detected->size());
+		if (i == 0) {
+			EXPECT_NEAR(0.6 * Mpc, (*detected)[0]->getTrajectoryLength(), 1e-6 * Mpc);
+			EXPECT_NEAR(0.6 * Mpc, (*detected)[0]->current.getPosition().x, 1e-6 * Mpc);
+			EXPECT_DOUBLE_EQ(1 * EeV, (*detected)[0]->current.getEnergy());
+		}
+	}
+	remove(filename.c_str());
+
+	EXPECT_THROW(TrajectoryReplay("no_such_file.bin").run(recorder), std::runtime_error);
+}
+
+// counts the steps of a replay
+class StepCounter: public Module {
+public:
+	mutable int steps;
+	StepCounter() : steps(0) {
+	}
+	void process(Candidate *c) const {
+#pragma omp atomic
+		steps++;
+	}
+};
+
+TEST(TrajectoryRecorder, decimation) {
+	std::string filename = "TrajectoryRecorder_decimation.bin";
+	Source source;
+	source.add(new SourceParticleType(22));
+	source.add(new SourceEnergy(1 * EeV));
+	source.add(new SourceDirection(Vector3d(1, 0, 0)));
+
+	// steps of 0.1 Mpc to 1 Mpc; all points, sampled every 0.25 Mpc,
+	// decimated to the straight line, in chunks of 4 points
+	int steps[4] = {10, 4, 1, 10};
+	size_t count[4] = {3, 3, 3, 12};
+	for (int i = 0; i < 4; i++) {
+		ModuleList modules;
+		modules.add(new SimplePropagation(0.1 * Mpc, 0.1 * Mpc));
+		modules.add(new MaximumTrajectoryLength(1 * Mpc));
+		ref_ptr<TrajectoryRecorder> recorder = new TrajectoryRecorder(filename);
+		if (i == 1)
+			recorder->setSamplingInterval(0.25 * Mpc);
+		if (i == 2)
+			recorder->setTolerance(1 * kpc);
+		if (i == 3)
+			recorder->setChunkSize(4);
+		modules.add(recorder);
+		modules.run(&source, 3);
+		EXPECT_EQ(count[i], recorder->getCount());
+		recorder->close();
+
+		ref_ptr<StepCounter> counter = new StepCounter();
+		EXPECT_EQ(count[i], TrajectoryReplay(filename).run(counter));
+		EXPECT_EQ(3 * steps[i], counter->steps);
+	}
+	remove(filename.c_str());
+}
+
+TEST(CandidateStreamOutput, SourceFromFile) {
+	std::string filename = "CandidateStreamOutput.bin";
+	ref_ptr<CandidateStreamOutput> output = new CandidateStreamOutput(filename);
+	output->enableProperty("Kind");
+	output->enableProperty("Count");
+
+	Candidate c(ParticleState(11, 2 * EeV, Vector3d(1, 2, 3) * Mpc, Vector3d(0, 1, 0)));
+	c.current.setEnergy(1 * EeV);
+	c.current.setPosition(Vector3d(4, 5, 6) * Mpc);
+	c.previous.setPosition(Vector3d(3, 4, 5) * Mpc);
+	c.setWeight(0.5);
+	c.setRedshift(0.1);
+	c.setTrajectoryLength(7 * Mpc);
+	c.setTagOrigin("STAGE1");
+	c.setProperty("Kind", Variant(2.5));
+	c.setProperty("Count", Variant(int32_t(3)));
+	c.setProperty("Comment", Variant("not written"));
+	output->process(&c);
+	Candidate d(ParticleState(22, 1 * TeV, Vector3d(), Vector3d(1, 0, 0)));
+	output->process(&d);
+	EXPECT_THROW(output->enableProperty("Late"), std::runtime_error);
+	output->close();
+	EXPECT_EQ(2, output->getCount());
+
+	SourceFromFile source(filename);
+	source.add(filename);
+	EXPECT_EQ(4, source.getCount());
+	ref_ptr<Candidate> r = source.getCandidate();
+	EXPECT_EQ(11, r->current.getId());
+	EXPECT_DOUBLE_EQ(2 * EeV, r->source.getEnergy());
+	EXPECT_DOUBLE_EQ(2 * EeV, r->created.getEnergy());
+	EXPECT_DOUBLE_EQ(1 * EeV, r->current.getEnergy());
+	EXPECT_EQ(Vector3d(1, 2, 3) * Mpc, r->source.getPosition());
+	EXPECT_EQ(Vector3d(3, 4, 5) * Mpc, r->previous.getPosition());
+	EXPECT_EQ(Vector3d(4, 5, 6) * Mpc, r->current.getPosition());
+	EXPECT_EQ(Vector3d(0, 1, 0), r->current.getDirection());
+	EXPECT_DOUBLE_EQ(0.5, r->getWeight());
+	EXPECT_DOUBLE_EQ(0.1, r->getRedshift());
+	EXPECT_DOUBLE_EQ(7 * Mpc, r->getTrajectoryLength());
+	EXPECT_EQ("STAGE1", r->getTagOrigin());
+	EXPECT_DOUBLE_EQ(2.5, r->getProperty("Kind").toDouble());
+	EXPECT_EQ(3, r->getProperty("Count").toInt32());
+	EXPECT_FALSE(r->hasProperty("Comment"));
+
+	r = source.getCandidate();
+	EXPECT_EQ(22, r->current.getId());
+	EXPECT_EQ("PRIM", r->getTagOrigin());
+	EXPECT_FALSE(r->hasProperty("Kind"));
+
+	// the second file, then the end
+	std::vector<ref_ptr<Candidate> > candidates;
+	source.getCandidates(3, candidates);
+	ASSERT_EQ(3, candidates.size());
+	EXPECT_EQ(11, candidates[0]->current.getId());
+	EXPECT_EQ(22, candidates[1]->current.getId());
+	EXPECT_FALSE(candidates[2].valid());
+	EXPECT_THROW(source.getCandidate(), std::runtime_error);
+
+	// as source of a simulation
+	source.rewind();
+	ModuleList modules;
+	ref_ptr<ParticleCollector> collector = new ParticleCollector();
+	modules.add(collector);
+	modules.add(new MaximumTrajectoryLength(0));
+	modules.run(&source, source.getCount());
+	EXPECT_EQ(4, collector->size());
+	EXPECT_EQ(4, source.getPosition());
+	remove(filename.c_str());
+
+	EXPECT_THROW(SourceFromFile("no_such_file.bin"), std::runtime_error);
+}
+
+TEST(OutputTable, readText) {
+	std::string filename = "testOutputTable_readText.txt";
+	ref_ptr<TextOutput> output = new TextOutput(filename, Output::Event3D);
+	output->setEnergyScale(TeV);
+	output->enable(Output::CandidateTagColumn);
+	output->enable(Output::WeightColumn);
+	output->enableProperty("Kind", Variant(0.), "kind of particle");
+	const int n = 1000;
+	for (int i = 0; i < n; i++) {
+		Candidate c(ParticleState(22, (i + 1) * EeV, Vector3d(i, 2, 3) * Mpc, Vector3d(0, 1, 0)));
+		c.current.setEnergy(i * EeV);
+		c.setWeight(0.5);
+		c.setTagOrigin((i % 2) ? "STAGE1" : "STAGE2");
+		c.setProperty("Kind", Variant(i / 4.));
+		output->process(&c);
+	}
+	output->close();
+
+	// the rows keep their order when parsed by several threads
+	ref_ptr<OutputTable> table = OutputTable::readText(filename, 3);
+	EXPECT_EQ(n, table->getNumberOfRows());
+	EXPECT_TRUE(table->hasColumn("E0"));
+	EXPECT_FALSE(table->hasColumn("Y9"));
+	EXPECT_THROW(table->getColumn("Y9"), std::runtime_error);
+	const std::vector<double> &E = table->getColumn("E");
+	const std::vector<double> &X0 = table->getColumn("X0");
+	for (int i = 0; i < n; i++) {
+		EXPECT_NEAR(i * EeV, E[i], 1e-5 * i * EeV);
+		EXPECT_NEAR(i * Mpc, X0[i], 1e-5 * i * Mpc);
+	}
+	EXPECT_EQ(Candidate::getTagCode("STAGE1"), table->get("tag", 1));
+	EXPECT_DOUBLE_EQ(1.25, table->get("Kind", 5));
+	EXPECT_DOUBLE_EQ(0.5, table->get("W", 7));
+
+	// candidates of the rows
+	SourceFromOutput source(table);
+	EXPECT_EQ(n, source.getCount());
+	source.getCandidate();
+	ref_ptr<Candidate> c = source.getCandidate();
+	EXPECT_EQ(22, c->current.getId());
+	EXPECT_NEAR(1 * EeV, c->current.getEnergy(), 1e-5 * EeV);
+	EXPECT_NEAR(2 * EeV, c->source.getEnergy(), 1e-5 * EeV);
+	EXPECT_NEAR(2 * Mpc, c->source.getPosition().y, 1e-5 * Mpc);
+	EXPECT_NEAR(1, c->current.getDirection().y, 1e-5);
+	EXPECT_DOUBLE_EQ(0.5, c->getWeight());
+	EXPECT_EQ("STAGE1", c->getTagOrigin());
+	EXPECT_DOUBLE_EQ(0.25, c->getProperty("Kind").toDouble());
+	source.rewind();
+	std::vector<ref_ptr<Candidate> > candidates;
+	source.getCandidates(n + 1, candidates);
+	EXPECT_TRUE(candidates[n - 1].valid());
+	EXPECT_FALSE(candidates[n].valid());
+	EXPECT_THROW(source.getCandidate(), std::runtime_error);
+
+	// the rows of another table with the same columns
+	table->append(*OutputTable::readText(filename, 1));
+	EXPECT_EQ(2 * n, table->getNumberOfRows());
+	EXPECT_THROW(table->append(OutputTable()), std::runtime_error);
+	remove(filename.c_str());
+
+	EXPECT_THROW(OutputTable::readText("no_such_file.txt"), std::runtime_error);
+}
+
+#ifdef CRPROPA_HAVE_HDF5
+TEST(OutputTable, readHDF5) {
+	std::string filename = "testOutputTable_readHDF5.h5";
+	ref_ptr<HDF5Output> output = new HDF5Output(filename, Output::Event1D);
+	output->setLengthScale(kpc);
+	output->enable(Output::CandidateTagColumn);
+	const int n = 100;
+	for (int i = 0; i < n; i++) {
+		Candidate c(1000010010, (i + 1) * EeV);
+		c.setTrajectoryLength(i * Mpc);
+		c.setTagOrigin("STAGE3");
+		output->process(&c);
+	}
+	output->close();
+
+	// in hyperslabs that do not divide the rows
+	ref_ptr<OutputTable> table = OutputTable::readHDF5(filename, 7);
+	EXPECT_EQ(n, table->getNumberOfRows());
+	for (int i = 0; i < n; i++) {
+		EXPECT_DOUBLE_EQ((i + 1) * EeV, table->get("E", i));
+		EXPECT_NEAR(i * Mpc, table->get("D", i), 1e-12 * Mpc);
+	}
+	EXPECT_EQ(Candidate::getTagCode("STAGE3"), table->get("tag", 0));
+
+	SourceFromOutput source(table);
+	ref_ptr<Candidate> c = source.getCandidate();
+	EXPECT_EQ(1000010010, c->current.getId());
+	EXPECT_EQ(Vector3d(-1, 0, 0), c->current.getDirection());
+	EXPECT_EQ("STAGE3", c->getTagOrigin());
+	remove(filename.c_str());
+}
+#endif
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -2,7 +2,14 @@
 #include "crpropa/ParticleID.h"
 #include "crpropa/module/SimplePropagation.h"
 #include "crpropa/module/PropagationBP.h"
+#include "crpropa/module/PropagationBPDevice.h"
 #include "crpropa/module/PropagationCK.h"
+#include "crpropa/module/PropagationDP.h"
+#include "crpropa/module/PropagationGuidingCenter.h"
+#include "crpropa/module/PropagationHandoff.h"
+#include "crpropa/module/PropagationJump.h"
+#include "crpropa/module/DiffusionSDE.h"
+#include "crpropa/Random.h"
 
 #include "gtest/gtest.h"
 
@@ -36,6 +43,37 @@ TEST(testSimplePropagation, step) {
 }
 
 
+// candidates for the batch tests: electrons and positrons of different
+// energies and directions, and one photon
+static std::vector<ref_ptr<Candidate> > batchCandidates() {
+	std::vector<ref_ptr<Candidate> > candidates;
+	for (int i = 0; i < 9; i++) {
+		ParticleState p;
+		p.setId((i == 4) ? 22 : ((i % 2) ? 11 : -11));
+		p.setEnergy((1 + i) * 10 * EeV);
+		p.setPosition(Vector3d(i * Mpc, 0, 0));
+		p.setDirection(Vector3d(1, i, 0.5 * i));
+		ref_ptr<Candidate> c = new Candidate(p);
+		c->setNextStep((1 + i) * kpc);
+		candidates.push_back(c);
+	}
+	return candidates;
+}
+
+static void expectSameState(Candidate *a, Candidate *b) {
+	EXPECT_DOUBLE_EQ(a->getCurrentStep(), b->getCurrentStep());
+	EXPECT_DOUBLE_EQ(a->getNextStep(), b->getNextStep());
+	Vector3d x = a->current.getPosition(), xb = b->current.getPosition();
+	Vector3d u = a->current.getDirection(), ub = b->current.getDirection();
+	EXPECT_DOUBLE_EQ(x.x, xb.x);
+	EXPECT_DOUBLE_EQ(x.y, xb.y);
+	EXPECT_DOUBLE_EQ(x.z, xb.z);
+	EXPECT_DOUBLE_EQ(u.x, ub.x);
+	EXPECT_DOUBLE_EQ(u.y, ub.y);
+	EXPECT_DOUBLE_EQ(u.z, ub.z);
+	EXPECT_EQ(a->previous.getPosition(), b->previous.getPosition());
+}
+
 TEST(testPropagationCK, zeroField) {
 	PropagationCK propa(new UniformMagneticField(Vector3d(0, 0, 0)));
 
@@ -270,6 +308,466 @@ TEST(testPropagationCK, neutron) {
 }
 
 
+TEST(testPropagationCK, batch) {
+	// strong field, so that some steps are rejected and retried
+	PropagationCK propa(new UniformMagneticField(Vector3d(0, 10 * nG, 100 * nG)),
+			1e-4, 0.1 * kpc, 1 * Mpc);
+	std::vector<ref_ptr<Candidate> > single = batchCandidates();
+	std::vector<ref_ptr<Candidate> > batch = batchCandidates();
+
+	for (int step = 0; step < 5; step++) {
+		for (size_t i = 0; i < single.size(); i++)
+			propa.process(single[i]);
+		propa.processBatch(batch);
+	}
+
+	for (size_t i = 0; i < single.size(); i++)
+		expectSameState(single[i], batch[i]);
+}
+
+
+TEST(testPropagationCK, stepHints) {
+	// field only in a clipped grid of 4 kpc edge length at the origin
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(0.), 4, 1 * kpc);
+	for (int ix = 0; ix < 4; ix++)
+		for (int iy = 0; iy < 4; iy++)
+			for (int iz = 0; iz < 4; iz++)
+				grid->get(ix, iy, iz) = Vector3f(0, 0, 1);
+	grid->setClipVolume(true);
+	PropagationCK propa(new MagneticFieldGrid(grid, 1 * nG), 1e-4, 0.1 * kpc, 1 * Mpc);
+	EXPECT_FALSE(propa.getStepHints());
+	propa.setStepHints(true);
+
+	// far from the grid: one straight step up to the grid volume
+	Candidate c(nucleusId(1, 1), 100 * EeV, Vector3d(-10 * kpc, 1 * kpc, 1 * kpc),
+			Vector3d(1, 0, 0));
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(10 * kpc, c.getCurrentStep());
+	EXPECT_DOUBLE_EQ(0, c.getNextStep());
+	EXPECT_NEAR(0, c.current.getPosition().x, 1e-9 * kpc);
+	EXPECT_EQ(Vector3d(1, 0, 0), c.current.getDirection());
+
+	// at the grid: the next step starts afresh from the grid spacing
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getCurrentStep());
+
+	// steps far away are limited by the maximum step
+	Candidate d(nucleusId(1, 1), 100 * EeV, Vector3d(-3 * Mpc, 1 * kpc, 1 * kpc),
+			Vector3d(1, 0, 0));
+	propa.process(&d);
+	EXPECT_DOUBLE_EQ(1 * Mpc, d.getCurrentStep());
+	EXPECT_DOUBLE_EQ(1 * Mpc, d.getNextStep());
+}
+
+
+TEST(testPropagationJump, jump) {
+	PropagationJump jump(new SimplePropagation(1 * kpc, 1 * Mpc), 100 * Mpc);
+	ref_ptr<Sphere> sphere = new Sphere(Vector3d(0.), 10 * Mpc);
+	jump.addSurface(sphere);
+	jump.addSurface(new Plane(Vector3d(0, 5 * Mpc, 0), Vector3d(0, 1, 0)));
+
+	// neutrinos jump just behind the first surface on the line
+	Candidate c(14, 1 * EeV, Vector3d(1 * Mpc, 0, 0), Vector3d(1, 0, 0));
+	c.setNextStep(1 * kpc);
+	jump.process(&c);
+	EXPECT_NEAR(9 * Mpc, c.getCurrentStep(), 1e-9 * Mpc);
+	EXPECT_GT(sphere->distance(c.current.getPosition()), 0);
+	EXPECT_DOUBLE_EQ(100 * Mpc, c.getNextStep());
+	EXPECT_EQ(Vector3d(1 * Mpc, 0, 0), c.previous.getPosition());
+
+	c.current.setPosition(Vector3d(0.));
+	c.current.setDirection(Vector3d(0, 1, 0));
+	jump.process(&c);
+	EXPECT_NEAR(5 * Mpc, c.getCurrentStep(), 1e-9 * Mpc);
+
+	// outside of all surfaces and moving away: the maximum step
+	c.current.setPosition(Vector3d(20 * Mpc, 0, 0));
+	c.current.setDirection(Vector3d(1, 0, 0));
+	jump.process(&c);
+	EXPECT_DOUBLE_EQ(100 * Mpc, c.getCurrentStep());
+
+	// other particles are propagated by the wrapped module
+	Candidate p(22, 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	p.setNextStep(10 * kpc);
+	jump.process(&p);
+	EXPECT_DOUBLE_EQ(10 * kpc, p.getCurrentStep());
+
+	jump.addParticleId(22);
+	EXPECT_TRUE(jump.isJumping(&p));
+	jump.process(&p);
+	EXPECT_NEAR(10 * Mpc - 10 * kpc, p.getCurrentStep(), 1e-9 * Mpc);
+	EXPECT_THROW(jump.addParticleId(11), std::runtime_error);
+}
+
+
+TEST(testPropagationHandoff, handoff) {
+	ref_ptr<PropagationCK> propa = new PropagationCK(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	PropagationHandoff handoff(propa, new Sphere(Vector3d(0.), 1 * Mpc), Vector3d(0.), 10 * Mpc);
+
+	// inside of the region: deflected by the field
+	Candidate c(11, 100 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	c.setNextStep(100 * kpc);
+	EXPECT_FALSE(handoff.isHandedOff(&c));
+	handoff.process(&c);
+	EXPECT_NE(0, c.current.getDirection().y);
+
+	// outside and moving inwards: still in the field
+	c.current.setPosition(Vector3d(2 * Mpc, 0, 0));
+	c.current.setDirection(Vector3d(-1, 0, 0));
+	EXPECT_FALSE(handoff.isHandedOff(&c));
+
+	// outside and moving outwards: straight to the observer sphere in one step
+	c.current.setPosition(Vector3d(2 * Mpc, 0, 0));
+	c.current.setDirection(Vector3d(1, 1, 0));
+	Vector3d dir = c.current.getDirection();
+	c.setNextStep(1 * Gpc);
+	EXPECT_TRUE(handoff.isHandedOff(&c));
+	double hit = handoff.distanceToObserver(&c);
+	handoff.process(&c);
+	EXPECT_EQ(dir, c.current.getDirection());
+	EXPECT_NEAR(hit, c.getCurrentStep(), 1e-9 * hit);
+	EXPECT_GE(c.current.getPosition().getR(), 10 * Mpc);
+	EXPECT_NEAR(10 * Mpc, c.current.getPosition().getR(), 1e-9 * Mpc);
+	EXPECT_DOUBLE_EQ(1 * Gpc, c.getNextStep());
+
+	// beyond the observer sphere: the line misses it
+	EXPECT_LT(handoff.distanceToObserver(&c), 0);
+
+	// steps limited by the interactions
+	c.current.setPosition(Vector3d(2 * Mpc, 0, 0));
+	c.setNextStep(1 * Mpc);
+	handoff.process(&c);
+	EXPECT_DOUBLE_EQ(1 * Mpc, c.getCurrentStep());
+}
+
+TEST(testPropagationDP, exceptions) {
+	// minStep should be smaller than maxStep
+	EXPECT_THROW(PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 0.42, 10, 0), std::runtime_error);
+	// tolerance should be between 0 and 1
+	EXPECT_THROW(PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 42., 10 * kpc, 20 * kpc), std::runtime_error);
+
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	propa.setMaximumStep(1 * Mpc);
+	EXPECT_THROW(propa.setMinimumStep(-1.), std::runtime_error);
+	EXPECT_THROW(propa.setMinimumStep(2 * Mpc), std::runtime_error);
+	propa.setMinimumStep(0.5 * Mpc);
+	EXPECT_THROW(propa.setMaximumStep(0.1 * Mpc), std::runtime_error);
+}
+
+
+TEST(testPropagationDP, gyration) {
+	// one orbit of an electron, gyroradius 1.08 kpc
+	double B = 1 * nG;
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, B)), 1e-8, 1 * pc, 100 * pc);
+	Candidate c(11, 1 * PeV, Vector3d(0.), Vector3d(1, 0, 0));
+	double R = 1 * PeV / (eplus * c_light * B);
+	double L = 2 * M_PI * R;
+
+	c.setNextStep(1 * pc);
+	while (c.getTrajectoryLength() < L) {
+		c.setNextStep(std::min(c.getNextStep(), L - c.getTrajectoryLength()));
+		propa.process(&c);
+	}
+
+	EXPECT_NEAR(0, c.current.getPosition().getR(), 1e-5 * R);
+	EXPECT_NEAR(1, c.current.getDirection().x, 1e-6);
+	// the error ratio of the last accepted step is kept for the PI controller
+	EXPECT_TRUE(c.hasProperty("PropagationDP_errorRatio"));
+}
+
+
+TEST(testPropagationDP, denseOutput) {
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	ParticleState p(11, 1 * PeV, Vector3d(0.), Vector3d(1, 0, 0));
+	PropagationDP::Y y(p.getPosition(), p.getDirection()), out, error;
+	PropagationDP::Y k[7];
+	double h = 100 * pc / c_light;
+	k[0] = propa.dYdt(y, p, 0);
+	propa.tryStep(y, out, error, k, h, p, 0);
+
+	PropagationDP::Y start = propa.denseOutput(y, out, k, h, 0);
+	PropagationDP::Y end = propa.denseOutput(y, out, k, h, 1);
+	EXPECT_NEAR(0, (start.x - y.x).getR(), 1e-9 * pc);
+	EXPECT_NEAR(0, (end.x - out.x).getR(), 1e-9 * pc);
+	EXPECT_NEAR(0, (end.u - out.u).getR(), 1e-12);
+}
+
+
+TEST(testPropagationDP, crossingSurface) {
+	PropagationDP propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)), 1e-4, 1 * pc, 10 * kpc);
+	ref_ptr<Plane> plane = new Plane(Vector3d(0.5 * kpc, 0, 0), Vector3d(1, 0, 0));
+	propa.addCrossingSurface(plane);
+
+	// neutral particles end the step on the surface
+	Candidate n(22, 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	n.setNextStep(10 * kpc);
+	propa.process(&n);
+	EXPECT_NEAR(0.5 * kpc, n.getCurrentStep(), 1e-9 * kpc);
+	EXPECT_GE(plane->distance(n.current.getPosition()), 0);
+
+	// charged particles end the step just behind the surface
+	Candidate c(11, 10 * PeV, Vector3d(0.), Vector3d(1, 0, 0));
+	c.setNextStep(1 * kpc);
+	propa.process(&c);
+	EXPECT_LT(c.getCurrentStep(), 1 * kpc);
+	EXPECT_GE(plane->distance(c.current.getPosition()), 0);
+	EXPECT_LT(plane->distance(c.current.getPosition()), 1e-9 * kpc);
+
+	// the following step starts on the surface and is not truncated
+	c.setNextStep(0.1 * kpc);
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(0.1 * kpc, c.getCurrentStep());
+}
+
+
+TEST(testPropagationGuidingCenter, uniformField) {
+	// in a uniform field the guiding centre step is exact: compare to small full orbit steps
+	ref_ptr<MagneticField> field = new UniformMagneticField(Vector3d(0, 0, 1 * nG));
+	PropagationGuidingCenter propa(field);
+	EXPECT_DOUBLE_EQ(0, propa.getFieldGeometry(Vector3d(1, 2, 3) * kpc, 0).gradB.getR());
+
+	// gyroradius of 1 PeV electrons in 1 nG: about 1 kpc
+	Candidate c(11, 1 * PeV, Vector3d(0.), Vector3d(1, 0, 1).getUnitVector());
+	ParticleState start = c.current;
+	EXPECT_DOUBLE_EQ(0, propa.getAdiabaticity(&c));
+	c.setNextStep(5 * kpc);
+	propa.process(&c);
+	EXPECT_DOUBLE_EQ(5 * kpc, c.getCurrentStep());
+
+	PropagationCK fullOrbit(field, 1e-8, 0.01 * kpc, 0.01 * kpc);
+	Candidate d(start);
+	for (int i = 0; i < 500; i++)
+		fullOrbit.process(&d);
+	EXPECT_NEAR(0, (c.current.getPosition() - d.current.getPosition()).getR(), 1e-6 * kpc);
+	EXPECT_NEAR(1, c.current.getDirection().dot(d.current.getDirection()), 1e-9);
+	EXPECT_NEAR(0, (propa.getGuidingCenter(c.current, 0) - propa.getGuidingCenter(start, 0)
+			- Vector3d(0, 0, 5 * kpc / sqrt(2))).getR(), 1e-6 * kpc);
+}
+
+// field along z, increasing along z: B = B0 (1 + (z / L)^2)
+class MirrorField: public MagneticField {
+public:
+	Vector3d getField(const Vector3d &position) const {
+		double f = position.z / Mpc;
+		return Vector3d(0, 0, 1 * nG * (1 + f * f));
+	}
+};
+
+TEST(testPropagationGuidingCenter, mirror) {
+	PropagationGuidingCenter propa(new MirrorField());
+	// pitch cosine 0.5 at B0: mirror point at B = 4/3 B0, z = Mpc / sqrt(3)
+	Candidate c(11, 1 * PeV, Vector3d(0.), Vector3d(sqrt(3), 0, 1).getUnitVector());
+	EXPECT_LT(propa.getAdiabaticity(&c), propa.getMaximumAdiabaticity());
+	c.setNextStep(10 * kpc);
+	double zMax = 0;
+	bool reflected = false;
+	for (int i = 0; i < 1000 and not reflected; i++) {
+		propa.process(&c);
+		zMax = std::max(zMax, c.current.getPosition().z);
+		reflected = c.current.getDirection().z < -0.2;
+		// conserved magnetic moment
+		double B = propa.getFieldGeometry(propa.getGuidingCenter(c.current, 0), 0).B;
+		double u = c.current.getDirection().z;
+		EXPECT_NEAR(0.75 / (1 * nG), (1 - u * u) / B, 1e-3 / nG);
+	}
+	EXPECT_TRUE(reflected);
+	EXPECT_NEAR(Mpc / sqrt(3), zMax, 0.01 * Mpc);
+}
+
+TEST(testPropagationGuidingCenter, fullOrbit) {
+	// 1 EeV electrons: gyroradius of 1 Mpc, larger than the scale of the field
+	PropagationGuidingCenter propa(new MirrorField());
+	Candidate c(11, 1 * EeV, Vector3d(0, 0, 1 * Mpc), Vector3d(1, 0, 0));
+	EXPECT_GT(propa.getAdiabaticity(&c), propa.getMaximumAdiabaticity());
+	PropagationCK fullOrbit(new MirrorField());
+	Candidate d(c.current);
+	c.setNextStep(10 * kpc);
+	d.setNextStep(10 * kpc);
+	propa.process(&c);
+	fullOrbit.process(&d);
+	EXPECT_EQ(d.current.getPosition(), c.current.getPosition());
+	EXPECT_EQ(d.current.getDirection(), c.current.getDirection());
+
+	// neutral particles move on straight lines
+	Candidate n(22, 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	n.setNextStep(10 * kpc);
+	propa.process(&n);
+	EXPECT_EQ(Vector3d(10 * kpc, 0, 0), n.current.getPosition());
+}
+
+TEST(testPropagationGuidingCenter, exceptions) {
+	PropagationGuidingCenter propa(new UniformMagneticField(Vector3d(0, 0, 1 * nG)));
+	EXPECT_THROW(propa.setMaximumAdiabaticity(0), std::runtime_error);
+	EXPECT_THROW(propa.setTolerance(2), std::runtime_error);
+	EXPECT_THROW(propa.setMinimumStep(2 * Gpc), std::runtime_error);
+	EXPECT_THROW(propa.setMaximumStep(0.01 * kpc), std::runtime_error);
+	EXPECT_THROW(PropagationGuidingCenter(NULL, 0.01, 1e-4, 10 * kpc, 1 * kpc), std::runtime_error);
+}
+
+TEST(testPropagationBPDevice, compareToBP) {
+	ref_ptr<Grid3f> grid = new Grid3f(Vector3d(-40 * kpc), 8, 10 * kpc);
+	Random &random = Random::instance();
+	for (size_t ix = 0; ix < 8; ix++)
+		for (size_t iy = 0; iy < 8; iy++)
+			for (size_t iz = 0; iz < 8; iz++)
+				grid->get(ix, iy, iz) = Vector3f(random.randUniform(-1, 1),
+						random.randUniform(-1, 1), random.randUniform(-1, 1));
+	ref_ptr<MagneticFieldGrid> field = new MagneticFieldGrid(grid, 1 * muG);
+
+	PropagationBP propaBP(field, 1 * kpc);
+	PropagationBPDevice propaDevice(field, 1 * kpc, 4);
+	EXPECT_EQ(4, propaDevice.getMaximumSubsteps());
+
+	std::vector<ref_ptr<Candidate> > batch;
+	for (int i = 0; i < 10; i++) {
+		ref_ptr<Candidate> c = new Candidate(-11, (i + 1) * EeV,
+				Vector3d(i, -2 * i, 3) * kpc, Vector3d(1, i, -1).getUnitVector());
+		// a single step for odd candidates, four for the others
+		c->setNextStep((i % 2 ? 1 : 4) * kpc);
+		batch.push_back(c);
+	}
+	ref_ptr<Candidate> photon = new Candidate(22, 1 * EeV, Vector3d(0.), Vector3d(1, 0, 0));
+	photon->setNextStep(2.5 * kpc);
+	batch.push_back(photon);
+
+	std::vector<ref_ptr<Candidate> > reference;
+	for (int i = 0; i < 10; i++)
+		reference.push_back(batch[i]->clone());
+
+	propaDevice.processBatch(batch);
+
+	for (int i = 0; i < 10; i++) {
+		int steps = (i % 2) ? 1 : 4;
+		for (int k = 0; k < steps; k++)
+			propaBP.process(reference[i]);
+		Vector3d x = batch[i]->current.getPosition();
+		Vector3d xRef = reference[i]->current.getPosition();
+		EXPECT_NEAR(0, (x - xRef).getR(), 1e-12 * xRef.getR());
+		Vector3d u = batch[i]->current.getDirection();
+		EXPECT_NEAR(0, (u - reference[i]->current.getDirection()).getR(), 1e-12);
+		EXPECT_DOUBLE_EQ(steps * kpc, batch[i]->getCurrentStep());
+		EXPECT_DOUBLE_EQ(4 * kpc, batch[i]->getNextStep());
+	}
+	EXPECT_EQ(Vector3d(2 * kpc, 0, 0), photon->current.getPosition());
+	EXPECT_DOUBLE_EQ(2 * kpc, photon->getCurrentStep());
+}
+
+TEST(testDiffusionSDE, tryStepBatch) {
+	DiffusionSDE propa(new MagneticDipoleField(Vector3d(0.), Vector3d(0, 0, 1) * muG, 1 * kpc));
+	Vector3d pos[3] = {Vector3d(2, 0, 1) * kpc, Vector3d(-1, 3, 0.5) * kpc, Vector3d(0.3, 0.2, -4) * kpc};
+	double time[3] = {0.1 * kpc / c_light, -0.3 * kpc / c_light, 1 * kpc / c_light};
+	double z[3] = {0, 0, 0};
+	double x[3][3], out[3][3], err[3][3];
+	for (int l = 0; l < 3; l++) {
+		x[0][l] = pos[l].x;
+		x[1][l] = pos[l].y;
+		x[2][l] = pos[l].z;
+	}
+	double *xp[3] = {x[0], x[1], x[2]}, *outp[3] = {out[0], out[1], out[2]}, *errp[3] = {err[0], err[1], err[2]};
+	propa.tryStepBatch(xp, outp, errp, time, z, 3);
+	for (int l = 0; l < 3; l++) {
+		Vector3d POut, PosErr(0.);
+		propa.tryStep(pos[l], POut, PosErr, 0, time[l]);
+		EXPECT_EQ(POut, Vector3d(out[0][l], out[1][l], out[2][l]));
+		EXPECT_EQ(PosErr, Vector3d(err[0][l], err[1][l], err[2][l]));
+	}
+}
+
+TEST(testDiffusionSDE, processBatch) {
+	// parallel diffusion along a uniform field, without perpendicular diffusion
+	DiffusionSDE propa(new UniformMagneticField(Vector3d(0, 0, 1) * muG), 1e-4,
+			10 * pc, 1 * kpc, 0);
+	std::vector<ref_ptr<Candidate> > batch;
+	for (int i = 0; i < 2000; i++) {
+		ref_ptr<Candidate> c = new Candidate(-11, 4 * GeV, Vector3d(1, 2, 3) * pc);
+		c->setNextStep(1 * kpc);
+		batch.push_back(c);
+	}
+	ref_ptr<Candidate> photon = new Candidate(22, 1 * GeV, Vector3d(0.), Vector3d(1, 0, 0));
+	photon->setNextStep(1 * kpc);
+	batch.push_back(photon);
+
+	propa.processBatch(batch);
+
+	double h = 1 * kpc / c_light;
+	double sum2 = 0;
+	for (int i = 0; i < 2000; i++) {
+		Vector3d p = batch[i]->current.getPosition();
+		EXPECT_NEAR(1 * pc, p.x, 1e-6 * pc);
+		EXPECT_NEAR(2 * pc, p.y, 1e-6 * pc);
+		EXPECT_DOUBLE_EQ(1 * kpc, batch[i]->getCurrentStep());
+		EXPECT_DOUBLE_EQ(4 * kpc, batch[i]->getNextStep());
+		sum2 += pow(p.z - 3 * pc, 2);
+	}
+	// <dz^2> = 2 D h, with D = 6.1e24 m^2/s at 4 GV
+	EXPECT_NEAR(1, sum2 / 2000 / (2 * 6.1e24 * h), 0.15);
+	EXPECT_EQ(Vector3d(1 * kpc, 0, 0), photon->current.getPosition());
+}
+
+// uniform field that counts its evaluations
+class CountingField: public MagneticField {
+public:
+	mutable size_t calls;
+	CountingField() : calls(0) {
+	}
+	Vector3d getField(const Vector3d &position) const {
+#pragma omp atomic
+		calls++;
+		return Vector3d(0, 0, 1) * muG;
+	}
+};
+
+TEST(testDiffusionSDE, fieldEvaluations) {
+	// a uniform field meets the tolerance at the first trial, which is the
+	// field line step: one Cash-Karp step of six evaluations
+	ref_ptr<CountingField> field = new CountingField();
+	DiffusionSDE propa(field, 1e-4, 10 * pc, 1 * kpc);
+	Candidate c(-11, 4 * GeV, Vector3d(1, 2, 3) * pc);
+	c.setNextStep(1 * kpc);
+	propa.process(&c);
+	EXPECT_EQ(6, field->calls);
+	EXPECT_DOUBLE_EQ(1 * kpc, c.getCurrentStep());
+
+	std::vector<ref_ptr<Candidate> > batch;
+	for (int i = 0; i < 10; i++) {
+		batch.push_back(new Candidate(-11, 4 * GeV, Vector3d(1, 2, 3) * pc));
+		batch.back()->setNextStep(1 * kpc);
+	}
+	field->calls = 0;
+	propa.processBatch(batch);
+	EXPECT_EQ(60, field->calls);
+}
+
+TEST(Candidate, stepField) {
+	// the last stage of a Dormand-Prince step is the first of the next
+	ref_ptr<CountingField> field = new CountingField();
+	PropagationDP propa(field, 1e-4, 1 * pc, 1 * pc);
+	Candidate::clearStepField();
+	Candidate c(11, 1 * PeV, Vector3d(0.), Vector3d(1, 0, 0));
+	propa.process(&c);
+	EXPECT_EQ(7, field->calls);
+	propa.process(&c);
+	EXPECT_EQ(13, field->calls);
+
+	// the value is shared for this candidate, field, position and redshift only
+	Vector3d B;
+	Vector3d position = c.current.getPosition();
+	EXPECT_TRUE(c.getStepField(field, position, 0, B));
+	EXPECT_EQ(Vector3d(0, 0, 1) * muG, B);
+	EXPECT_FALSE(c.getStepField(field, position, 1, B));
+	EXPECT_FALSE(c.getStepField(field, Vector3d(0.), 0, B));
+	Candidate d(c.current);
+	EXPECT_FALSE(d.getStepField(field, position, 0, B));
+
+	// all tries of a Cash-Karp step start with the same field
+	PropagationCK ck(field, 1e-4, 1 * pc, 1 * pc);
+	field->calls = 0;
+	ck.process(&c);
+	EXPECT_EQ(5, field->calls);
+	Candidate::clearStepField();
+	EXPECT_FALSE(c.getStepField(field, c.current.getPosition(), 0, B));
+}
+
 TEST(testPropagationBP, zeroField) {
 	PropagationBP propa(new UniformMagneticField(Vector3d(0, 0, 0)), 1 * kpc);
 
@@ -506,6 +1004,23 @@ TEST(testPropagationBP, neutron) {
 }
 
 
+TEST(testPropagationBP, batch) {
+	// strong field, so that some steps are rejected and retried
+	PropagationBP propa(new UniformMagneticField(Vector3d(0, 10 * nG, 100 * nG)),
+			1e-4, 0.1 * kpc, 1 * Mpc);
+	std::vector<ref_ptr<Candidate> > single = batchCandidates();
+	std::vector<ref_ptr<Candidate> > batch = batchCandidates();
+
+	for (int step = 0; step < 5; step++) {
+		for (size_t i = 0; i < single.size(); i++)
+			propa.process(single[i]);
+		propa.processBatch(batch);
+	}
+
+	for (size_t i = 0; i < single.size(); i++)
+		expectSameState(single[i], batch[i]);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -55,6 +55,75 @@ class testCrossLanguagePolymorphism(unittest.TestCase):
         for c_i in p:
             c_out = c_i
 
+    def test_BatchModule(self):
+        class EnergySum(crp.BatchModule):
+            def __init__(self):
+                crp.BatchModule.__init__(self, 2)
+                self.energy = 0
+
+            def processBatch(self, batch):
+                self.energy += batch.toNumpy()['energy'].sum()
+
+        c = crp.Candidate(22, 1 * crp.EeV)
+        m = EnergySum()
+        for i in range(3):
+            m.process(c)
+        self.assertEqual(m.getNumberOfBatches(), 1)
+        m.flush()
+        self.assertEqual(m.getNumberOfBatches(), 2)
+        self.assertAlmostEqual(m.energy / crp.EeV, 3)
+
+    @unittest.skipIf(not hasattr(crp.Grid3f, 'toNumpy'), "requires NumPy")
+    def test_numpyViews(self):
+        grid = crp.Grid3f(crp.Vector3d(0), 4, 5, 6, 1.)
+        a = grid.toNumpy()
+        self.assertEqual(a.shape, (4, 5, 6, 3))
+        a[1, 2, 3, 0] = 7
+        self.assertEqual(grid.getValue(1, 2, 3).x, 7)
+        del grid
+        self.assertEqual(a[1, 2, 3, 0], 7) # the view keeps the grid alive
+
+        pmap = crp.CylindricalProjectionMap(36, 18)
+        self.assertEqual(pmap.getPdf_numpyArray().shape, (18, 36))
+
+        collector = crp.ParticleCollector()
+        for i in range(3):
+            collector.process(crp.Candidate(22, (i + 1) * crp.EeV))
+        columns = collector.toNumpy()
+        self.assertEqual(list(columns['id']), [22, 22, 22])
+        self.assertAlmostEqual(columns['energy'].sum() / crp.EeV, 6)
+
+    @unittest.skipIf(not hasattr(crp.ModuleList, 'run_numpyArray'), "requires NumPy")
+    def test_runNumpyArray(self):
+        collector = crp.ParticleCollector()
+        modules = crp.ModuleList()
+        maxLength = crp.MaximumTrajectoryLength(1 * crp.Mpc)
+        maxLength.onReject(collector)
+        modules.add(crp.SimplePropagation())
+        modules.add(maxLength)
+
+        states = np.zeros(4, dtype=[('id', 'i8'), ('energy', 'f8'),
+            ('x', 'f8'), ('y', 'f8'), ('z', 'f8'), ('weight', 'f8')])
+        states['id'] = 22
+        states['energy'] = np.arange(1, 5) * crp.EeV
+        states['y'] = 2 * crp.Mpc
+        states['weight'] = 0.5
+        modules.run_numpyArray(states)
+        self.assertEqual(collector.size(), 4)
+        self.assertAlmostEqual(collector.toNumpy()['energy'].sum() / crp.EeV, 10)
+        for c in collector:
+            self.assertAlmostEqual(c.source.getPosition().y / crp.Mpc, 2)
+            self.assertEqual(c.getWeight(), 0.5)
+
+        collector.clearContainer()
+        positions = np.zeros((3, 3))
+        directions = np.tile([0., 0., 1.], (3, 1))
+        modules.run_numpyArrays(np.full(3, 11), np.ones(3) * crp.EeV,
+            positions, directions)
+        self.assertEqual(collector.size(), 3)
+        for c in collector:
+            self.assertAlmostEqual(c.current.getPosition().z / crp.Mpc, 1)
+
     def test_ObserverFeature(self):
         class CountingFeature(crp.ObserverFeature):
             def __init__(self):
@@ -1,6 +1,7 @@
 #include "crpropa/Source.h"
 #include "crpropa/Units.h"
 #include "crpropa/ParticleID.h"
+#include "crpropa/Random.h"
 
 #include "gtest/gtest.h"
 #include <stdexcept>
@@ -114,6 +115,47 @@ TEST(SourceSNRDistribution, simpleTest) {
 	EXPECT_NEAR(0., Z_mean, 0.1);
 }
 
+TEST(SourceSNRDistribution, inverseCdf) {
+	SourceSNRDistribution snr;
+	snr.setRMax(10 * kpc);
+	ParticleState ps;
+	size_t n = 100000;
+	double absZ_mean = 0;
+	double R_max = 0;
+	for (size_t i = 0; i < n; i++) {
+		snr.prepareParticle(ps);
+		Vector3d pos = ps.getPosition();
+		R_max = std::max(R_max, sqrt(pos.x * pos.x + pos.y * pos.y));
+		EXPECT_LE(fabs(pos.z), 5 * kpc);
+		absZ_mean += fabs(pos.z);
+	}
+	EXPECT_LE(R_max, 10 * kpc);
+	EXPECT_GT(R_max, 9.5 * kpc);
+	EXPECT_NEAR(0.3, absZ_mean / n / kpc, 0.005);
+}
+
+TEST(SourcePulsarDistribution, simpleTest) {
+	SourcePulsarDistribution pulsar;
+	pulsar.setRBlur(0);
+	pulsar.setThetaBlur(1e10 / kpc);
+	ParticleState ps;
+	size_t n = 100000;
+	double R_mean = 0;
+	for (size_t i = 0; i < n; i++) {
+		pulsar.prepareParticle(ps);
+		Vector3d pos = ps.getPosition();
+		R_mean += sqrt(pos.x * pos.x + pos.y * pos.y) / kpc;
+	}
+	// mean of r^2 exp(-beta r / rEarth) up to rMax = 22 kpc
+	double w = 0, wr = 0;
+	for (double r = 0.0005; r < 22; r += 0.001) {
+		double f = r * r * exp(-3.53 * r / 8.5);
+		w += f;
+		wr += f * r;
+	}
+	EXPECT_NEAR(wr / w, R_mean / n, 0.05);
+}
+
 TEST(SourceDensityGrid, withInRange) {
 	// Create a grid with 10^3 cells ranging from (0, 0, 0) to (10, 10, 10)
 	Vector3d origin(0, 0, 0);
@@ -180,6 +222,34 @@ TEST(SourceDensityGrid, OneAllowedCell) {
 	EXPECT_NEAR(1, mean.z, 0.2);
 }
 
+TEST(SourceDensityGrid, sparseBricks) {
+	// 20 x 9 x 11 cells, partial bricks at the upper ends
+	auto grid = new Grid1f(Vector3d(0.), 20, 9, 11, 1.);
+	grid->get(3, 2, 1) = 1;
+	grid->get(19, 8, 10) = 3;
+	grid->get(19, 8, 9) = -5; // ignored
+
+	SourceDensityGrid source(grid);
+	ParticleState p;
+	int n1 = 0, n2 = 0, nFalse = 0;
+	for (int i = 0; i < 20000; i++) {
+		source.prepareParticle(p);
+		Vector3d pos = p.getPosition();
+		if ((pos - Vector3d(3.5, 2.5, 1.5)).getR() < 0.9)
+			n1++;
+		else if ((pos - Vector3d(19.5, 8.5, 10.5)).getR() < 0.9)
+			n2++;
+		else
+			nFalse++;
+	}
+	EXPECT_EQ(0, nFalse);
+	EXPECT_NEAR(0.25, n1 / 20000., 0.015);
+
+	auto empty = new Grid1f(Vector3d(0.), 4, 1.);
+	empty->get(0, 0, 0) = 0;
+	EXPECT_THROW(SourceDensityGrid source2(empty), std::runtime_error);
+}
+
 TEST(SourceDensityGrid1D, withInRange) {
 	// Create a grid with 10 cells ranging from 0 to 10
 	Vector3d origin(0, 0, 0);
@@ -283,6 +353,62 @@ TEST(SourceEmissionCone, simpleTest) {
 	EXPECT_LE(angle, aperture);
 }
 
+TEST(SourceBiasedEmissionSphere, unbiased) {
+	// the weighted fraction hitting the sphere is its solid angle fraction
+	Vector3d center(10, 0, 0);
+	double radius = 1;
+	SourceBiasedEmissionSphere source(center, radius, 0.2);
+	double cosAperture = sqrt(1 - 0.01);
+	size_t n = 100000, hits = 0;
+	double sumW = 0, sumHit = 0;
+	for (size_t i = 0; i < n; i++) {
+		Candidate c;
+		source.prepareCandidate(c);
+		double w = c.getWeight();
+		sumW += w;
+		if (c.source.getDirection().x >= cosAperture) {
+			sumHit += w;
+			hits++;
+		}
+	}
+	EXPECT_NEAR(sumW / n, 1, 0.03);
+	EXPECT_NEAR(sumHit / n, (1 - cosAperture) / 2, 2e-5);
+	EXPECT_NEAR(double(hits) / n, 0.8, 0.01);
+
+	// isotropic with unchanged weight inside of the sphere
+	Candidate c;
+	c.current.setPosition(Vector3d(10.5, 0, 0));
+	source.prepareCandidate(c);
+	EXPECT_DOUBLE_EQ(1, c.getWeight());
+}
+
+TEST(SourceBiasedEmissionMap, unbiased) {
+	// target density in the hemisphere x > 0
+	ref_ptr<EmissionMap> map = new EmissionMap(36, 18, 4);
+	for (size_t i = 0; i < 10000; i++) {
+		Vector3d v = Random::instance().randVector();
+		map->fillMap(22, 1 * EeV, Vector3d(fabs(v.x), v.y, v.z));
+	}
+	map->freeze();
+	SourceBiasedEmissionMap source(map, 0.1);
+
+	size_t n = 100000;
+	double sumW = 0, sumFront = 0;
+	for (size_t i = 0; i < n; i++) {
+		Candidate c;
+		c.current.setId(22);
+		c.current.setEnergy(1 * EeV);
+		source.prepareCandidate(c);
+		sumW += c.getWeight();
+		if (c.source.getDirection().x > 0)
+			sumFront += c.getWeight();
+	}
+	EXPECT_NEAR(sumW / n, 1, 0.03);
+	EXPECT_NEAR(sumFront / n, 0.5, 0.02);
+
+	EXPECT_THROW(SourceBiasedEmissionMap(map, 1.5), std::runtime_error);
+}
+
 #ifdef CRPROPA_HAVE_MUPARSER
 TEST(SourceGenericComposition, simpleTest) {
 	double Emin = 10;
@@ -425,6 +551,66 @@ TEST(SourceList, luminosity) {
 	EXPECT_NEAR(80, meanE, 4); // this test can stochastically fail
 }
 
+TEST(SourceCatalog, simpleTest) {
+	SourceCatalog catalog(1 * EeV);
+	EXPECT_THROW(catalog.getCandidate(), std::runtime_error);
+	catalog.add(new SourceParticleType(22));
+	catalog.add(new SourceEnergy(2 * EeV));
+	catalog.add(Vector3d(1, 0, 0) * Mpc, 1, 0.1);
+	catalog.add(Vector3d(2, 0, 0) * Mpc, 0);
+	EXPECT_EQ(2, catalog.size());
+	EXPECT_EQ(Vector3d(2, 0, 0) * Mpc, catalog.getPosition(1));
+	EXPECT_FALSE(catalog.hasSpectrum(0));
+	EXPECT_GT(catalog.getSizeOf(), 2 * 5 * sizeof(double));
+
+	// only the first source has weight
+	ref_ptr<Candidate> c = catalog.getCandidate();
+	EXPECT_EQ(Vector3d(1, 0, 0) * Mpc, c->source.getPosition());
+	EXPECT_EQ(Vector3d(1, 0, 0) * Mpc, c->current.getPosition());
+	EXPECT_DOUBLE_EQ(0.1, c->getRedshift());
+	EXPECT_EQ(22, c->current.getId());
+	EXPECT_DOUBLE_EQ(2 * EeV, c->source.getEnergy());
+
+	std::vector<ref_ptr<Candidate> > candidates;
+	catalog.getCandidates(10, candidates);
+	ASSERT_EQ(10, candidates.size());
+	for (size_t i = 0; i < candidates.size(); i++) {
+		EXPECT_EQ(Vector3d(1, 0, 0) * Mpc, candidates[i]->created.getPosition());
+		EXPECT_DOUBLE_EQ(0.1, candidates[i]->getRedshift());
+		EXPECT_EQ(22, candidates[i]->current.getId());
+	}
+}
+
+TEST(SourceCatalog, spectra) {
+	SourceCatalog catalog(1 * EeV);
+	catalog.add(new SourceParticleType(22));
+	catalog.add(new SourceEnergy(50 * EeV));
+	catalog.add(Vector3d(1, 0, 0), 1, 0);
+	catalog.add(Vector3d(2, 0, 0), 1, 0, -2, 10 * EeV);
+	EXPECT_THROW(catalog.add(Vector3d(3, 0, 0), 1, 0, -2, 0.5 * EeV), std::runtime_error);
+	EXPECT_THROW(catalog.setMinimumEnergy(20 * EeV), std::runtime_error);
+	EXPECT_FALSE(catalog.hasSpectrum(0));
+	EXPECT_TRUE(catalog.hasSpectrum(1));
+	EXPECT_DOUBLE_EQ(-2, catalog.getSpectralIndex(1));
+
+	// the sources are drawn by weight, the spectrum replaces the energy of the features
+	std::vector<ref_ptr<Candidate> > candidates;
+	catalog.getCandidates(1000, candidates);
+	size_t second = 0;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		const ParticleState &s = candidates[i]->source;
+		if (s.getPosition().x == 2) {
+			second++;
+			EXPECT_LE(1 * EeV, s.getEnergy());
+			EXPECT_GE(10 * EeV, s.getEnergy());
+			EXPECT_EQ(s.getEnergy(), candidates[i]->current.getEnergy());
+		} else {
+			EXPECT_DOUBLE_EQ(50 * EeV, s.getEnergy());
+		}
+	}
+	EXPECT_NEAR(500, second, 60);
+}
+
 TEST(SourceTag, sourceTag) {
 	SourceTag tag("mySourceTag");
 	Candidate c;
@@ -432,6 +618,53 @@ TEST(SourceTag, sourceTag) {
 	EXPECT_TRUE(c.getTagOrigin() == "mySourceTag");
 }
 
+TEST(Source, getCandidates) {
+	// with a single random feature the batch equals repeated getCandidate
+	Source source;
+	source.add(new SourcePosition(Vector3d(1, 2, 3)));
+	source.add(new SourceParticleType(22));
+	source.add(new SourcePowerLawSpectrum(1 * EeV, 100 * EeV, -2));
+	source.add(new SourceTag("batch"));
+
+	Random::instance().seed(42);
+	std::vector<ref_ptr<Candidate> > candidates;
+	source.getCandidates(5, candidates);
+	ASSERT_EQ(5, candidates.size());
+
+	Random::instance().seed(42);
+	for (size_t i = 0; i < candidates.size(); i++) {
+		ref_ptr<Candidate> c = source.getCandidate();
+		EXPECT_DOUBLE_EQ(c->current.getEnergy(), candidates[i]->current.getEnergy());
+		EXPECT_DOUBLE_EQ(c->source.getEnergy(), candidates[i]->created.getEnergy());
+		EXPECT_EQ(22, candidates[i]->current.getId());
+		EXPECT_EQ(Vector3d(1, 2, 3), candidates[i]->current.getPosition());
+		EXPECT_EQ("batch", candidates[i]->getTagOrigin());
+		EXPECT_EQ(1, candidates[i]->getWeight());
+		if (i > 0)
+			EXPECT_EQ(candidates[i - 1]->getSerialNumber() + 1, candidates[i]->getSerialNumber());
+	}
+
+	// appends to the vector
+	source.getCandidates(2, candidates);
+	EXPECT_EQ(7, candidates.size());
+}
+
+TEST(SourceUniformSphere, prepareParticles) {
+	SourceUniformSphere sphere(Vector3d(1, 0, 0), 2);
+	ParticleState particles[10];
+	Random::instance().seed(42);
+	sphere.prepareParticles(particles, 10);
+
+	Random::instance().seed(42);
+	for (size_t i = 0; i < 10; i++) {
+		ParticleState p;
+		sphere.prepareParticle(p);
+		EXPECT_NEAR(p.getPosition().x, particles[i].getPosition().x, 1e-12);
+		EXPECT_NEAR(p.getPosition().y, particles[i].getPosition().y, 1e-12);
+		EXPECT_NEAR(p.getPosition().z, particles[i].getPosition().z, 1e-12);
+	}
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
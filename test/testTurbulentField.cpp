@@ -8,6 +8,7 @@
 #include "crpropa/magneticField/turbulentField/GridTurbulence.h"
 #include "crpropa/magneticField/turbulentField/PlaneWaveTurbulence.h"
 #include "crpropa/magneticField/turbulentField/SimpleGridTurbulence.h"
+#include "crpropa/magneticField/turbulentField/TiledTurbulence.h"
 
 #include "gtest/gtest.h"
 
@@ -39,6 +40,60 @@ TEST(testTurbulenceSpectrum, correlationLength) {
     EXPECT_NEAR(Lc, 0.498*lBo, 0.001*lBo);
 }
 
+TEST(testPlaneWaveTurbulence, getFields) {
+	auto spectrum = TurbulenceSpectrum(1 * muG, 10 * parsec, 200 * parsec);
+	PlaneWaveTurbulence field(spectrum, 50, 42);
+	std::vector<Vector3d> pos, b(20);
+	for (int i = 0; i < 20; i++)
+		pos.push_back(Vector3d(i, 2 * i, -3 * i) * 17 * parsec);
+	field.getFields(pos.data(), b.data(), pos.size());
+	for (int i = 0; i < 20; i++) {
+		Vector3d expected = field.getField(pos[i]);
+		EXPECT_DOUBLE_EQ(expected.x, b[i].x);
+		EXPECT_DOUBLE_EQ(expected.y, b[i].y);
+		EXPECT_DOUBLE_EQ(expected.z, b[i].z);
+	}
+}
+
+TEST(testPlaneWaveTurbulence, singlePrecision) {
+	auto spectrum = TurbulenceSpectrum(1 * muG, 10 * parsec, 200 * parsec);
+	PlaneWaveTurbulence field(spectrum, 50, 42);
+	EXPECT_FALSE(field.isSinglePrecision());
+	std::vector<Vector3d> pos, b(20), bSingle(20);
+	for (int i = 0; i < 20; i++)
+		pos.push_back(Vector3d(i, 2 * i, -3 * i) * 17 * parsec);
+	field.getFields(pos.data(), b.data(), pos.size());
+	field.setSinglePrecision(true);
+	field.getFields(pos.data(), bSingle.data(), pos.size());
+	for (int i = 0; i < 20; i++) {
+		// single precision only with FAST_WAVES
+		EXPECT_NEAR(b[i].x, bSingle[i].x, 1e-4 * muG);
+		EXPECT_NEAR(b[i].y, bSingle[i].y, 1e-4 * muG);
+		EXPECT_NEAR(b[i].z, bSingle[i].z, 1e-4 * muG);
+		Vector3d expected = field.getField(pos[i]);
+		EXPECT_DOUBLE_EQ(expected.x, bSingle[i].x);
+	}
+}
+
+TEST(testPlaneWaveEvaluator, advance) {
+	auto spectrum = TurbulenceSpectrum(1 * muG, 10 * parsec, 200 * parsec);
+	PlaneWaveTurbulence field(spectrum, 50, 42);
+	PlaneWaveEvaluator evaluator(field, 16);
+	Vector3d start(1 * kpc, -2 * kpc, 0.5 * kpc);
+	Vector3d step(0.3 * parsec, -0.7 * parsec, 1.1 * parsec);
+	evaluator.setPosition(start);
+	evaluator.setStep(step);
+	// the FAST_WAVES fields differ by about 1e-8 Brms
+	EXPECT_NEAR(0, (evaluator.getField() - field.getField(start)).getR(), 1e-6 * muG);
+	for (int i = 1; i <= 100; i++) {
+		Vector3d b = evaluator.advance();
+		Vector3d pos = start + step * i;
+		EXPECT_NEAR(0, (evaluator.getPosition() - pos).getR(), 1e-9 * parsec);
+		EXPECT_NEAR(0, (b - field.getField(pos)).getR(), 1e-6 * muG);
+	}
+	EXPECT_THROW(evaluator.setResyncSteps(0), std::runtime_error);
+}
+
 #ifdef CRPROPA_HAVE_FFTW3F
 
 TEST(testSimpleGridTurbulence, oldFunctionForCrrelationLength) { //TODO: remove in future
@@ -132,6 +187,55 @@ TEST(testGridTurbulence, Turbulence_seed) {
 	Vector3d pos(22 * Mpc);
 	EXPECT_FLOAT_EQ(tf1.getField(pos).x, tf2.getField(pos).x);
 }
+
+TEST(testGridTurbulence, bricked) {
+	// the field does not depend on the layout of the grid
+	size_t n = 16;
+	double spacing = 1 * Mpc;
+	auto spectrum = TurbulenceSpectrum(1 * muG, 2 * spacing, 8 * spacing, 4 * spacing);
+
+	auto gp1 = GridProperties(Vector3d(0, 0, 0), n, spacing);
+	auto tf1 = GridTurbulence(spectrum, gp1, 42);
+
+	auto gp2 = GridProperties(Vector3d(0, 0, 0), n, spacing);
+	gp2.setLayout(BRICKED);
+	auto tf2 = GridTurbulence(spectrum, gp2, 42);
+
+	for (int i = 0; i < 10; i++) {
+		Vector3d pos = Vector3d(i, 3 * i, 7 * i) * 0.7 * Mpc;
+		EXPECT_EQ(tf1.getField(pos), tf2.getField(pos));
+	}
+	std::vector<std::pair<int, float>> p1 = tf1.getPowerSpectrum();
+	std::vector<std::pair<int, float>> p2 = tf2.getPowerSpectrum();
+	ASSERT_EQ(p1.size(), p2.size());
+	for (size_t i = 0; i < p1.size(); i++)
+		EXPECT_NEAR(p1[i].second, p2[i].second, 1e-5 * p1[i].second);
+}
+TEST(testTiledTurbulence, getField) {
+	size_t n = 16;
+	double spacing = 1 * Mpc;
+	double L = n * spacing;
+	auto spectrum = TurbulenceSpectrum(1 * muG, 2 * spacing, 8 * spacing, 4 * spacing);
+	auto gp = GridProperties(Vector3d(0, 0, 0), n, spacing);
+	TiledTurbulence tf(spectrum, gp, 42, 0);
+	EXPECT_EQ(8, tf.getCacheSize() / (n * n * n * sizeof(Vector3f)));
+
+	// the field of a tile at its center
+	Vector3d center(L / 2);
+	EXPECT_EQ(Vector3d(tf.getTile(0, 0, 0)->interpolate(center)), tf.getField(center));
+
+	// smooth at the tile boundaries and not periodic
+	Vector3d pos(L * 1.001, L * 0.3, -L * 2.2);
+	Vector3d b = tf.getField(pos);
+	EXPECT_LT((tf.getField(pos + Vector3d(1e-3 * spacing, 0, 0)) - b).getR(), 0.01 * muG);
+	EXPECT_GT((tf.getField(pos + Vector3d(0, L, 0)) - b).getR(), 0);
+	EXPECT_LE(tf.getNumberOfCachedTiles(), 8);
+
+	// independent of the order of evaluation
+	TiledTurbulence tf2(spectrum, gp, 42);
+	EXPECT_EQ(b, tf2.getField(pos));
+	EXPECT_NE(tf.getTileSeed(0, 0, 1), tf.getTileSeed(0, 1, 0));
+}
 #endif // CRPROPA_HAVE_FFTW3F
 
 int main(int argc, char **argv) {
@@ -1,4 +1,5 @@
 #include "crpropa/Vector3.h"
+#include "crpropa/Vector3Packet.h"
 #include "gtest/gtest.h"
 
 namespace crpropa {
@@ -154,6 +155,47 @@ TEST(Vector3, parallelPerpendicular) {
 	EXPECT_DOUBLE_EQ(vperp.z, 1);
 }
 
+TEST(Vector3Packet, arithmetic) {
+	Vector3d v[3] = {Vector3d(1, 2, 3), Vector3d(0, 1, 0), Vector3d(-2, 0, 4)};
+	Vector3d w(3, 2, 1);
+	Vector3Packetd p = Vector3Packetd::load(v, 3);
+	Vector3Packetd q(w);
+
+	Vector3Packetd c = p.cross(q);
+	Vector3Packetd::Scalars d = p.dot(q);
+	Vector3Packetd s = p * 2. + q;
+	for (int l = 0; l < 3; l++) {
+		EXPECT_TRUE(c.get(l) == v[l].cross(w));
+		EXPECT_DOUBLE_EQ(d[l], v[l].dot(w));
+		EXPECT_TRUE(s.get(l) == v[l] * 2. + w);
+		EXPECT_DOUBLE_EQ(p.getR()[l], v[l].getR());
+	}
+	// unused lane
+	EXPECT_TRUE(p.get(3) == Vector3d(0.));
+
+	Vector3Packetd u = q.getUnitVector();
+	EXPECT_NEAR(u.get(2).getR(), 1, 1e-15);
+	EXPECT_TRUE(u.get(2) == w.getUnitVector());
+}
+
+TEST(Vector3Packet, structureOfArrays) {
+	double x[5] = {1, 2, 3, 4, 5}, y[5] = {0}, z[5] = {-1, -2, -3, -4, -5};
+	double *c[3] = {x, y, z};
+	Vector3Packetd p = Vector3Packetd::loadSoA(c, 1, 4);
+	EXPECT_TRUE(p.get(0) == Vector3d(2, 0, -2));
+	EXPECT_TRUE(p.get(3) == Vector3d(5, 0, -5));
+
+	p.set(1, Vector3d(7, 8, 9));
+	p.storeSoA(c, 1, 2);
+	EXPECT_DOUBLE_EQ(x[2], 7);
+	EXPECT_DOUBLE_EQ(y[2], 8);
+	EXPECT_DOUBLE_EQ(z[3], -4);  // not stored
+
+	Vector3f f[8];
+	Vector3Packetf(Vector3f(1, 2, 3)).store(f);
+	EXPECT_TRUE(f[7] == Vector3f(1, 2, 3));
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();